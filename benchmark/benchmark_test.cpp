@@ -184,6 +184,22 @@ static bool loadFile(const char* filename, void*& result, int length) {
   return false;
 }
 
+// Image buffer memory of a call, the figures are the same for every iteration
+static void setMemoryCounters(benchmark::State& s, const uhdr_codec_stats_t& stats) {
+  s.counters["allocs"] = stats.num_allocations;
+  s.counters["peak_MB"] = stats.peak_bytes / (1024.0 * 1024.0);
+}
+
+// gpu phases of the last call, if it ran on the gpu. gpu_timer is 0 where the driver has no timer
+// queries, the phases are then timed around glFinish() and the call runs serialized.
+static void setGpuCounters(benchmark::State& s, const uhdr_codec_stats_t& stats) {
+  if (stats.gpu.passes == 0) return;
+  s.counters["upload_ms"] = stats.gpu.upload_ms;
+  s.counters["shader_ms"] = stats.gpu.shader_ms;
+  s.counters["readback_ms"] = stats.gpu.readback_ms;
+  s.counters["gpu_timer"] = stats.gpu.timer_queries;
+}
+
 class DecBenchmark {
  public:
   std::string mUhdrFile;
@@ -347,15 +363,20 @@ static void BM_UHDRDecode(benchmark::State& s, TestParamsDecodeAPI testVectors)
   }
 
   uhdr_codec_private_t* decHandle = uhdr_create_decoder();
+  RET_IF_ERR(uhdr_enable_stats(decHandle, 1))
+  uhdr_codec_stats_t stats{};
   for (auto _ : s) {
     RET_IF_ERR(uhdr_dec_set_image(decHandle, &benchmark.mUhdrImg))
     RET_IF_ERR(uhdr_dec_set_out_color_transfer(decHandle, benchmark.mTf))
     RET_IF_ERR(uhdr_dec_set_out_img_format(decHandle, benchmark.mOfmt))
     RET_IF_ERR(uhdr_enable_gpu_acceleration(decHandle, benchmark.mEnableGLES))
     RET_IF_ERR(uhdr_decode(decHandle))
+    stats = *uhdr_dec_get_stats(decHandle);
     uhdr_reset_decoder(decHandle);
   }
   uhdr_release_decoder(decHandle);
+  setMemoryCounters(s, stats);
+  setGpuCounters(s, stats);
 #undef RET_IF_ERR
 }
 
@@ -404,6 +425,8 @@ static void BM_UHDREncode_Api0(benchmark::State& s, TestParamsEncoderAPI0 testVe
   }
 
   uhdr_codec_private_t* encHandle = uhdr_create_encoder();
+  RET_IF_ERR(uhdr_enable_stats(encHandle, 1))
+  uhdr_codec_stats_t stats{};
   for (auto _ : s) {
     RET_IF_ERR(uhdr_enc_set_raw_image(encHandle, &benchmark.mHdrImg, UHDR_HDR_IMG))
     RET_IF_ERR(
@@ -411,9 +434,11 @@ static void BM_UHDREncode_Api0(benchmark::State& s, TestParamsEncoderAPI0 testVe
     RET_IF_ERR(uhdr_enc_set_gainmap_scale_factor(encHandle, benchmark.mMapDimensionScaleFactor))
     RET_IF_ERR(uhdr_enc_set_gainmap_gamma(encHandle, benchmark.mGamma))
     RET_IF_ERR(uhdr_encode(encHandle))
+    stats = *uhdr_enc_get_stats(encHandle);
     uhdr_reset_encoder(encHandle);
   }
   uhdr_release_encoder(encHandle);
+  setMemoryCounters(s, stats);
 }
 
 static void BM_UHDREncode_Api1(benchmark::State& s, TestParamsEncoderAPI1 testVectors) {
@@ -470,6 +495,8 @@ static void BM_UHDREncode_Api1(benchmark::State& s, TestParamsEncoderAPI1 testVe
   }
 
   uhdr_codec_private_t* encHandle = uhdr_create_encoder();
+  RET_IF_ERR(uhdr_enable_stats(encHandle, 1))
+  uhdr_codec_stats_t stats{};
   for (auto _ : s) {
     RET_IF_ERR(uhdr_enc_set_raw_image(encHandle, &benchmark.mHdrImg, UHDR_HDR_IMG))
     RET_IF_ERR(uhdr_enc_set_raw_image(encHandle, &benchmark.mSdrImg, UHDR_SDR_IMG))
@@ -479,9 +506,11 @@ static void BM_UHDREncode_Api1(benchmark::State& s, TestParamsEncoderAPI1 testVe
     RET_IF_ERR(uhdr_enc_set_gainmap_gamma(encHandle, benchmark.mGamma))
     RET_IF_ERR(uhdr_enc_set_preset(encHandle, benchmark.mEncPreset))
     RET_IF_ERR(uhdr_encode(encHandle))
+    stats = *uhdr_enc_get_stats(encHandle);
     uhdr_reset_encoder(encHandle);
   }
   uhdr_release_encoder(encHandle);
+  setMemoryCounters(s, stats);
 }
 
 void addTestVectors() {
@@ -0,0 +1,296 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "ultrahdr_api.h"
+
+/*
+ * Replay of a corpus of ultrahdr images, so that optimizations are judged against the mix of
+ * images a deployment sees rather than a handful of 12MP test vectors. Nothing is registered
+ * unless the corpus is configured through the environment:
+ *
+ *   UHDR_BM_CORPUS           directory of ultrahdr images, searched recursively, other files are
+ *                            skipped
+ *   UHDR_BM_CORPUS_WEIGHTS   share of each size bucket in the mix to report, comma separated in
+ *                            bucket order, e.g. "0.5,0.35,0.1,0.03,0.02". Defaults to the share of
+ *                            the bucket in the corpus
+ *   UHDR_BM_CORPUS_REENCODE  if set, every decoded image is encoded again, as a transcoding
+ *                            service would. The decoded image is the hdr intent of the encode,
+ *                            so an srgb output transfer is replaced by hlg
+ *   UHDR_BM_CORPUS_CT        output color transfer, 0: linear, 1: hlg (default), 2: pq, 3: srgb
+ *
+ * Each iteration of BM_UHDRCorpus/<bucket> probes and decodes every image of the bucket once.
+ * Latency percentiles are over the images, throughput is in pixels per second. BM_UHDRCorpus/mix
+ * replays the whole corpus and weighs every image with the share of its bucket divided by the
+ * number of images in the bucket, so its figures are those of the configured mix. The label of a
+ * bucket counts its images per gain map scale factor and single / multi channel gain map.
+ */
+
+struct SizeBucket {
+  const char* name;
+  double maxPixels;
+};
+
+// upper bounds leave room for the resolutions of camera sensors, 4080x3072 is "12MP"
+static const SizeBucket kSizeBuckets[] = {
+    {"0-2MP", 2.5e6}, {"2-4MP", 5e6}, {"4-12MP", 13e6}, {"12-50MP", 52e6}, {"50MP+", INFINITY},
+};
+static const int kNumSizeBuckets = sizeof kSizeBuckets / sizeof kSizeBuckets[0];
+
+struct CorpusImage {
+  std::string path;
+  std::vector<uint8_t> data;
+  double pixels;
+  int bucket;
+  int scaleFactor;
+  bool multiChannel;
+};
+
+struct Corpus {
+  std::vector<CorpusImage> images;
+  double weights[kNumSizeBuckets];
+  int counts[kNumSizeBuckets];
+  bool reencode;
+  uhdr_color_transfer_t ct;
+};
+
+static uhdr_img_fmt_t corpusOutputFormat(uhdr_color_transfer_t ct) {
+  switch (ct) {
+    case UHDR_CT_LINEAR:
+      return UHDR_IMG_FMT_64bppRGBAHalfFloat;
+    case UHDR_CT_HLG:
+    case UHDR_CT_PQ:
+      return UHDR_IMG_FMT_32bppRGBA1010102;
+    default:
+      return UHDR_IMG_FMT_32bppRGBA8888;
+  }
+}
+
+static uhdr_compressed_image_t compressedImage(const CorpusImage& image) {
+  uhdr_compressed_image_t img{};
+  img.data = const_cast<uint8_t*>(image.data.data());
+  img.data_sz = image.data.size();
+  img.capacity = image.data.size();
+  img.cg = UHDR_CG_UNSPECIFIED;
+  img.ct = UHDR_CT_UNSPECIFIED;
+  img.range = UHDR_CR_UNSPECIFIED;
+  return img;
+}
+
+// Probes and decodes an image, and encodes the decoded image again if an encoder is given.
+// Returns false on any failure.
+static bool replay(const CorpusImage& image, uhdr_color_transfer_t ct, uhdr_codec_private_t* dec,
+                   uhdr_codec_private_t* enc) {
+  uhdr_compressed_image_t img = compressedImage(image);
+  bool ok = uhdr_dec_set_image(dec, &img).error_code == UHDR_CODEC_OK &&
+            uhdr_dec_set_out_color_transfer(dec, ct).error_code == UHDR_CODEC_OK &&
+            uhdr_dec_set_out_img_format(dec, corpusOutputFormat(ct)).error_code == UHDR_CODEC_OK &&
+            uhdr_dec_probe(dec).error_code == UHDR_CODEC_OK &&
+            uhdr_decode(dec).error_code == UHDR_CODEC_OK;
+  if (ok && enc != nullptr) {
+    uhdr_raw_image_t* decoded = uhdr_get_decoded_image(dec);
+    ok = decoded != nullptr;
+    if (ok) {
+      // packed rgb outputs are full range, the decoder leaves the field unspecified
+      uhdr_raw_image_t hdrImg = *decoded;
+      hdrImg.range = UHDR_CR_FULL_RANGE;
+      ok = uhdr_enc_set_raw_image(enc, &hdrImg, UHDR_HDR_IMG).error_code == UHDR_CODEC_OK &&
+           uhdr_encode(enc).error_code == UHDR_CODEC_OK;
+    }
+    uhdr_reset_encoder(enc);
+  }
+  return ok;
+}
+
+// Fills the geometry and gain map layout of an image with one decode, false if it does not decode
+static bool classify(CorpusImage& image, uhdr_color_transfer_t ct) {
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  if (dec == nullptr) return false;
+  const bool ok = replay(image, ct, dec, nullptr);
+  if (ok) {
+    const int width = uhdr_dec_get_image_width(dec);
+    const int height = uhdr_dec_get_image_height(dec);
+    const int gainmapWidth = uhdr_dec_get_gainmap_width(dec);
+    uhdr_raw_image_t* gainmap = uhdr_get_decoded_gainmap_image(dec);
+    image.pixels = (double)width * height;
+    image.scaleFactor = gainmapWidth > 0 ? (int)std::lround((double)width / gainmapWidth) : 0;
+    image.multiChannel = gainmap != nullptr && gainmap->fmt != UHDR_IMG_FMT_8bppYCbCr400;
+    image.bucket = 0;
+    while (image.bucket < kNumSizeBuckets - 1 &&
+           image.pixels > kSizeBuckets[image.bucket].maxPixels) {
+      image.bucket++;
+    }
+  }
+  uhdr_release_decoder(dec);
+  return ok;
+}
+
+static const Corpus& getCorpus() {
+  static Corpus corpus = []() {
+    Corpus c{};
+    const char* dir = getenv("UHDR_BM_CORPUS");
+    c.reencode = getenv("UHDR_BM_CORPUS_REENCODE") != nullptr;
+    const char* ct = getenv("UHDR_BM_CORPUS_CT");
+    c.ct = ct != nullptr ? (uhdr_color_transfer_t)atoi(ct) : UHDR_CT_HLG;
+    const uhdr_color_transfer_t maxCt = c.reencode ? UHDR_CT_PQ : UHDR_CT_SRGB;
+    if (c.ct < UHDR_CT_LINEAR || c.ct > maxCt) c.ct = UHDR_CT_HLG;
+    if (dir == nullptr || *dir == '\0') return c;
+
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(dir, ec)) {
+      if (!entry.is_regular_file(ec)) continue;
+      std::ifstream ifd(entry.path(), std::ios::binary);
+      CorpusImage image{};
+      image.path = entry.path().string();
+      image.data.assign(std::istreambuf_iterator<char>(ifd), std::istreambuf_iterator<char>());
+      if (image.data.empty() || !is_uhdr_image(image.data.data(), (int)image.data.size())) continue;
+      if (!classify(image, c.ct)) continue;
+      c.counts[image.bucket]++;
+      c.images.push_back(std::move(image));
+    }
+
+    // a bucket without images has no share, whatever its configured weight
+    bool configured = false;
+    if (const char* weights = getenv("UHDR_BM_CORPUS_WEIGHTS")) {
+      char* end = const_cast<char*>(weights);
+      for (int i = 0; i < kNumSizeBuckets && *end != '\0'; i++) {
+        const char* begin = end;
+        double weight = strtod(begin, &end);
+        if (end == begin || weight < 0.0) break;
+        c.weights[i] = weight;
+        configured = configured || weight > 0.0;
+        if (*end == ',') end++;
+      }
+    }
+    double total = 0.0;
+    for (int i = 0; i < kNumSizeBuckets; i++) {
+      if (!configured) c.weights[i] = c.counts[i];
+      if (c.counts[i] == 0) c.weights[i] = 0.0;
+      total += c.weights[i];
+    }
+    for (int i = 0; i < kNumSizeBuckets; i++) c.weights[i] = total > 0.0 ? c.weights[i] / total : 0;
+    return c;
+  }();
+  return corpus;
+}
+
+// Value below which the given share of the total weight of the samples lies
+static double weightedPercentile(std::vector<std::pair<double, double>> samples, double share) {
+  if (samples.empty()) return 0.0;
+  std::sort(samples.begin(), samples.end());
+  double total = 0.0;
+  for (const auto& sample : samples) total += sample.second;
+  double cumulative = 0.0;
+  for (const auto& sample : samples) {
+    cumulative += sample.second;
+    if (cumulative >= share * total) return sample.first;
+  }
+  return samples.back().first;
+}
+
+/* bucket is -1 for the weighted mix */
+static void BM_UHDRCorpus(benchmark::State& s, int bucket) {
+  const Corpus& corpus = getCorpus();
+  std::vector<const CorpusImage*> images;
+  std::map<std::string, int> layouts;
+  for (const auto& image : corpus.images) {
+    if (bucket >= 0 && image.bucket != bucket) continue;
+    if (bucket < 0 && corpus.weights[image.bucket] == 0.0) continue;
+    images.push_back(&image);
+    layouts["x" + std::to_string(image.scaleFactor) + (image.multiChannel ? " rgb" : " mono")]++;
+  }
+  if (images.empty()) {
+    s.SkipWithError("no images in the corpus for this bucket");
+    return;
+  }
+  std::string label = std::to_string(images.size()) + " images";
+  for (const auto& layout : layouts) {
+    label += ", " + std::to_string(layout.second) + " " + layout.first;
+  }
+  if (corpus.reencode) label += ", reencode";
+  s.SetLabel(label);
+
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  uhdr_codec_private_t* enc = corpus.reencode ? uhdr_create_encoder() : nullptr;
+  // latency in milliseconds and weight of every replay
+  std::vector<std::pair<double, double>> samples;
+  double weightedPixels = 0.0, weightedSeconds = 0.0;
+  bool failed = false;
+  for (auto _ : s) {
+    for (const CorpusImage* image : images) {
+      const double weight =
+          bucket >= 0 ? 1.0 : corpus.weights[image->bucket] / corpus.counts[image->bucket];
+      auto start = std::chrono::steady_clock::now();
+      const bool ok = replay(*image, corpus.ct, dec, enc);
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      uhdr_reset_decoder(dec);
+      if (!ok) {
+        s.SkipWithError(("unable to replay " + image->path).c_str());
+        failed = true;
+        break;
+      }
+      samples.emplace_back(elapsed.count() * 1e3, weight);
+      weightedPixels += weight * image->pixels;
+      weightedSeconds += weight * elapsed.count();
+    }
+    if (failed) break;
+  }
+  uhdr_release_encoder(enc);
+  uhdr_release_decoder(dec);
+  if (failed || samples.empty()) return;
+
+  s.counters["p50_ms"] = weightedPercentile(samples, 0.5);
+  s.counters["p90_ms"] = weightedPercentile(samples, 0.9);
+  s.counters["p99_ms"] = weightedPercentile(samples, 0.99);
+  s.counters["max_ms"] = weightedPercentile(samples, 1.0);
+  s.counters["pixels_per_second"] = weightedSeconds > 0.0 ? weightedPixels / weightedSeconds : 0.0;
+  if (bucket < 0) {
+    for (int i = 0; i < kNumSizeBuckets; i++) {
+      if (corpus.weights[i] > 0.0) {
+        s.counters[std::string("share_") + kSizeBuckets[i].name] = corpus.weights[i];
+      }
+    }
+  }
+}
+
+static bool registerCorpusBenchmarks() {
+  const char* dir = getenv("UHDR_BM_CORPUS");
+  if (dir == nullptr || *dir == '\0') return false;
+  for (int i = 0; i < kNumSizeBuckets; i++) {
+    benchmark::RegisterBenchmark((std::string("BM_UHDRCorpus/") + kSizeBuckets[i].name).c_str(),
+                                 BM_UHDRCorpus, i)
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime();
+  }
+  benchmark::RegisterBenchmark("BM_UHDRCorpus/mix", BM_UHDRCorpus, -1)
+      ->Unit(benchmark::kMillisecond)
+      ->UseRealTime();
+  return true;
+}
+
+[[maybe_unused]] static const bool kCorpusBenchmarksRegistered = registerCorpusBenchmarks();
@@ -0,0 +1,215 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include <benchmark/benchmark.h>
+
+#include "ultrahdr/dspdispatch.h"
+#include "ultrahdr/editorhelper.h"
+
+using namespace ultrahdr;
+
+/*
+ * Editor effect benchmarks. Each effect runs per element size, 8 to 64 bits, on three paths:
+ *   path 0, scalar: the portable buffer kernels
+ *   path 1, vector: the kernels picked by the dsp dispatcher, neon on arm and sse4.1 on x86
+ *   path 2, gles: texture upload, the effect and readback, as a caller without a resident texture
+ *               sees it. The upload_ms and readback_ms counters give the share of the transfers.
+ * A path the build or the device does not offer is skipped. Element sizes map to the formats
+ * yuv400 (8), yuv444 10 bit (16), rgba8888 (32) and rgba half float (64), gles has no 16 bit one.
+ * Every case reports input pixels per second.
+ */
+
+enum EditorPath {
+  kScalar = 0,
+  kVector = 1,
+  kGles = 2,
+};
+
+static const char* kPathNames[] = {"scalar", "vector", "gles"};
+
+// multiples of 64, so that strides equal widths as the texture transfers require
+static const int kImageWidth = 2048;
+static const int kImageHeight = 1536;
+static const int kOutWidth = 1536;
+static const int kOutHeight = 1152;
+
+static uhdr_img_fmt_t formatForBits(int64_t bits) {
+  switch (bits) {
+    case 8:
+      return UHDR_IMG_FMT_8bppYCbCr400;
+    case 16:
+      return UHDR_IMG_FMT_30bppYCbCr444;
+    case 32:
+      return UHDR_IMG_FMT_32bppRGBA8888;
+    default:
+      return UHDR_IMG_FMT_64bppRGBAHalfFloat;
+  }
+}
+
+static std::unique_ptr<uhdr_raw_image_ext_t> makeImage(uhdr_img_fmt_t fmt, int w, int h) {
+  auto img = std::make_unique<uhdr_raw_image_ext_t>(fmt, UHDR_CG_BT_709, UHDR_CT_SRGB,
+                                                    UHDR_CR_FULL_RANGE, w, h, 64);
+  const size_t bpp = fmt == UHDR_IMG_FMT_8bppYCbCr400   ? 1
+                     : fmt == UHDR_IMG_FMT_30bppYCbCr444 ? 2
+                     : fmt == UHDR_IMG_FMT_32bppRGBA8888 ? 4
+                                                         : 8;
+  for (int p = 0; p < 3; p++) {
+    if (img->planes[p] == nullptr) continue;
+    uint8_t* data = static_cast<uint8_t*>(img->planes[p]);
+    const size_t size = img->stride[p] * bpp * h;
+    for (size_t i = 0; i < size; i++) data[i] = static_cast<uint8_t>(i * 7 + (i >> 12));
+    if (fmt == UHDR_IMG_FMT_30bppYCbCr444) {
+      uint16_t* samples = reinterpret_cast<uint16_t*>(data);
+      for (size_t i = 0; i < size / 2; i++) samples[i] &= 0x3ff;
+    }
+  }
+  return img;
+}
+
+#ifdef UHDR_ENABLE_GLES
+// Shared by all cases and kept for the lifetime of the process, nullptr if no gpu is available
+static uhdr_opengl_ctxt* getGlContext() {
+  static uhdr_opengl_ctxt* ctxt = []() -> uhdr_opengl_ctxt* {
+    uhdr_opengl_ctxt* c = new uhdr_opengl_ctxt();
+    c->init_opengl_ctxt();
+    if (c->mErrorStatus.error_code != UHDR_CODEC_OK) {
+      c->delete_opengl_ctxt();
+      delete c;
+      return nullptr;
+    }
+    return c;
+  }();
+  return ctxt;
+}
+#endif
+
+typedef std::function<std::unique_ptr<uhdr_raw_image_ext_t>(uhdr_raw_image_t* src, void* gl_ctxt,
+                                                            void* texture)>
+    EffectFn;
+
+/* args: path, element size in bits */
+static void runEffect(benchmark::State& s, bool hasVector, const EffectFn& apply) {
+  const int64_t path = s.range(0);
+  const int64_t bits = s.range(1);
+  s.SetLabel(std::string(kPathNames[path]) + ", " + std::to_string(bits) + " bit");
+  if (path == kVector && !hasVector) {
+    s.SkipWithError("no vector implementation for this effect and cpu");
+    return;
+  }
+  auto src = makeImage(formatForBits(bits), kImageWidth, kImageHeight);
+
+  if (path == kGles) {
+#ifdef UHDR_ENABLE_GLES
+    uhdr_opengl_ctxt* gl = getGlContext();
+    if (gl == nullptr) {
+      s.SkipWithError("unable to create an opengl context");
+      return;
+    }
+    if (bits == 16) {
+      s.SkipWithError("no gles implementation for 16 bit elements");
+      return;
+    }
+    double uploadSeconds = 0.0, readbackSeconds = 0.0;
+    for (auto _ : s) {
+      auto start = std::chrono::steady_clock::now();
+      GLuint texture = gl->create_texture(src->fmt, src->w, src->h, src->planes[0]);
+      glFinish();
+      auto uploaded = std::chrono::steady_clock::now();
+      auto dst = apply(src.get(), gl, &texture);
+      glFinish();
+      auto applied = std::chrono::steady_clock::now();
+      gl->read_texture(&texture, dst->fmt, dst->w, dst->h, dst->planes[0]);
+      auto read = std::chrono::steady_clock::now();
+      glDeleteTextures(1, &texture);
+      uploadSeconds += std::chrono::duration<double>(uploaded - start).count();
+      readbackSeconds += std::chrono::duration<double>(read - applied).count();
+    }
+    s.counters["upload_ms"] = 1e3 * uploadSeconds / s.iterations();
+    s.counters["readback_ms"] = 1e3 * readbackSeconds / s.iterations();
+#else
+    s.SkipWithError("built without UHDR_ENABLE_GLES");
+    return;
+#endif
+  } else {
+    for (auto _ : s) {
+      auto dst = apply(src.get(), nullptr, nullptr);
+      benchmark::DoNotOptimize(dst->planes[0]);
+      benchmark::ClobberMemory();
+    }
+  }
+  s.SetItemsProcessed(s.iterations() * kImageWidth * kImageHeight);
+}
+
+static void BM_EditorRotate(benchmark::State& s) {
+  uhdr_rotate_effect_t desc(90);
+  if (s.range(0) == kScalar) {
+    desc.m_rotate_uint8_t = rotate_buffer_clockwise<uint8_t>;
+    desc.m_rotate_uint16_t = rotate_buffer_clockwise<uint16_t>;
+    desc.m_rotate_uint32_t = rotate_buffer_clockwise<uint32_t>;
+    desc.m_rotate_uint64_t = rotate_buffer_clockwise<uint64_t>;
+  }
+  runEffect(s, getDspFunctions().rotate_uint8_t != nullptr,
+            [&desc](uhdr_raw_image_t* src, void* gl_ctxt, void* texture) {
+              return apply_rotate(&desc, src, gl_ctxt, texture);
+            });
+}
+
+static void BM_EditorMirror(benchmark::State& s) {
+  uhdr_mirror_effect_t desc(UHDR_MIRROR_HORIZONTAL);
+  if (s.range(0) == kScalar) {
+    desc.m_mirror_uint8_t = mirror_buffer<uint8_t>;
+    desc.m_mirror_uint16_t = mirror_buffer<uint16_t>;
+    desc.m_mirror_uint32_t = mirror_buffer<uint32_t>;
+    desc.m_mirror_uint64_t = mirror_buffer<uint64_t>;
+  }
+  runEffect(s, getDspFunctions().mirror_uint8_t != nullptr,
+            [&desc](uhdr_raw_image_t* src, void* gl_ctxt, void* texture) {
+              return apply_mirror(&desc, src, gl_ctxt, texture);
+            });
+}
+
+// Times the copying crop. Formats that allow it are cropped as views in the codec, which is free.
+static void BM_EditorCrop(benchmark::State& s) {
+  const int left = (kImageWidth - kOutWidth) / 2, top = (kImageHeight - kOutHeight) / 2;
+  uhdr_crop_effect_t desc(left, left + kOutWidth, top, top + kOutHeight);
+  runEffect(s, false, [&desc, left, top](uhdr_raw_image_t* src, void* gl_ctxt, void* texture) {
+    return apply_crop(&desc, src, left, top, kOutWidth, kOutHeight, gl_ctxt, texture);
+  });
+}
+
+static void BM_EditorResize(benchmark::State& s) {
+  uhdr_resize_effect_t desc(kOutWidth, kOutHeight);
+  runEffect(s, false, [&desc](uhdr_raw_image_t* src, void* gl_ctxt, void* texture) {
+    return apply_resize(&desc, src, kOutWidth, kOutHeight, gl_ctxt, texture);
+  });
+}
+
+#define EDITOR_BENCHMARK(fn)                                       \
+  BENCHMARK(fn)                                                    \
+      ->ArgNames({"path", "bits"})                                 \
+      ->ArgsProduct({{kScalar, kVector, kGles}, {8, 16, 32, 64}}) \
+      ->Unit(benchmark::kMillisecond)                              \
+      ->UseRealTime()
+
+EDITOR_BENCHMARK(BM_EditorRotate);
+EDITOR_BENCHMARK(BM_EditorMirror);
+EDITOR_BENCHMARK(BM_EditorCrop);
+EDITOR_BENCHMARK(BM_EditorResize);
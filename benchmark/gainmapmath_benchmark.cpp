@@ -0,0 +1,468 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <memory>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "ultrahdr/dspdispatch.h"
+#include "ultrahdr/gainmapmath.h"
+#include "ultrahdr/jpegr.h"
+
+using namespace ultrahdr;
+
+/*
+ * Kernel level benchmarks of gainmapmath. Every case processes a fixed set of pixels per iteration
+ * and reports items/s, i.e. pixels per second, so scalar, lut and vector variants of a kernel can
+ * be compared directly and tracked across changes independent of the end to end codec runs.
+ */
+
+static const size_t kPixelCount = 64 * 1024;
+static const unsigned kImageWidth = 512;
+static const unsigned kImageHeight = 256;
+static const size_t kMapScaleFactor = 4;
+
+static std::vector<Color> makeColors(float lo, float hi) {
+  std::vector<Color> colors(kPixelCount);
+  for (size_t i = 0; i < kPixelCount; i++) {
+    float t = static_cast<float>((i * 2654435761u) % 65536) / 65535.0f;
+    float r = lo + (hi - lo) * t;
+    colors[i] = {{{r, lo + (hi - lo) * (1.0f - t), lo + (hi - lo) * (t * t)}}};
+  }
+  return colors;
+}
+
+static uhdr_gainmap_metadata_ext_t makeMetadata() {
+  uhdr_gainmap_metadata_ext_t metadata(kJpegrVersion);
+  metadata.max_content_boost = 8.0f;
+  metadata.min_content_boost = 1.0f / 2.0f;
+  metadata.gamma = 1.0f;
+  metadata.offset_sdr = 1.0f / 64.0f;
+  metadata.offset_hdr = 1.0f / 64.0f;
+  metadata.hdr_capacity_min = 1.0f;
+  metadata.hdr_capacity_max = 8.0f;
+  return metadata;
+}
+
+// bytes of one sample, strides of all formats are in samples
+static size_t sampleSize(uhdr_img_fmt_t fmt) {
+  switch (fmt) {
+    case UHDR_IMG_FMT_24bppYCbCrP010:
+    case UHDR_IMG_FMT_30bppYCbCr444:
+      return 2;
+    case UHDR_IMG_FMT_24bppRGB888:
+      return 3;
+    case UHDR_IMG_FMT_32bppRGBA8888:
+    case UHDR_IMG_FMT_32bppRGBA1010102:
+      return 4;
+    case UHDR_IMG_FMT_64bppRGBAHalfFloat:
+      return 8;
+    default:
+      return 1;
+  }
+}
+
+static size_t planeHeight(uhdr_img_fmt_t fmt, int p, size_t h) {
+  if (p == UHDR_PLANE_Y) return h;
+  if (fmt == UHDR_IMG_FMT_12bppYCbCr420 || fmt == UHDR_IMG_FMT_24bppYCbCrP010) return h / 2;
+  return h;
+}
+
+// Allocates an image and fills it with a pattern, so that no kernel gets to run on all zero input
+static std::unique_ptr<uhdr_raw_image_ext_t> makeImage(uhdr_img_fmt_t fmt, unsigned w,
+                                                       unsigned h) {
+  // 422 buffers are not allocated by uhdr_raw_image_ext, lay them out in a 444 allocation
+  const bool is422 = fmt == UHDR_IMG_FMT_16bppYCbCr422;
+  auto img = std::make_unique<uhdr_raw_image_ext_t>(is422 ? UHDR_IMG_FMT_24bppYCbCr444 : fmt,
+                                                    UHDR_CG_BT_709, UHDR_CT_SRGB,
+                                                    UHDR_CR_FULL_RANGE, w, h, 64);
+  if (is422) {
+    img->fmt = fmt;
+    img->stride[UHDR_PLANE_U] /= 2;
+    img->stride[UHDR_PLANE_V] /= 2;
+  }
+  for (int p = 0; p < 3; p++) {
+    if (img->planes[p] == nullptr) continue;
+    const size_t row_bytes = img->stride[p] * sampleSize(fmt);
+    for (size_t y = 0; y < planeHeight(fmt, p, h); y++) {
+      uint8_t* row = static_cast<uint8_t*>(img->planes[p]) + y * row_bytes;
+      if (fmt == UHDR_IMG_FMT_64bppRGBAHalfFloat) {
+        uint16_t* half = reinterpret_cast<uint16_t*>(row);
+        for (size_t x = 0; x < row_bytes / 2; x++) {
+          half[x] = floatToHalf(static_cast<float>((x + y) & 255) / 255.0f);
+        }
+      } else if (fmt == UHDR_IMG_FMT_24bppYCbCrP010 || fmt == UHDR_IMG_FMT_30bppYCbCr444) {
+        uint16_t* sample = reinterpret_cast<uint16_t*>(row);
+        for (size_t x = 0; x < row_bytes / 2; x++) {
+          uint16_t v = static_cast<uint16_t>(64 + ((x * 7 + y * 3) % 877));
+          sample[x] = fmt == UHDR_IMG_FMT_24bppYCbCrP010 ? static_cast<uint16_t>(v << 6) : v;
+        }
+      } else {
+        for (size_t x = 0; x < row_bytes; x++) {
+          row[x] = static_cast<uint8_t>(x * 7 + y * 3);
+        }
+      }
+    }
+  }
+  return img;
+}
+
+static void setPixelsProcessed(benchmark::State& s, size_t pixels) {
+  s.SetItemsProcessed(static_cast<int64_t>(s.iterations() * pixels));
+}
+
+/* Transfer functions */
+static void BM_TransferFn(benchmark::State& s, ColorTransformFn fn, float lo, float hi) {
+  std::vector<Color> colors = makeColors(lo, hi);
+  benchmark::DoNotOptimize(fn(colors[0]));  // builds the lut outside of the timed loop
+  for (auto _ : s) {
+    for (const Color& e : colors) {
+      benchmark::DoNotOptimize(fn(e));
+    }
+  }
+  setPixelsProcessed(s, colors.size());
+}
+
+BENCHMARK_CAPTURE(BM_TransferFn, srgbInvOetf, static_cast<ColorTransformFn>(srgbInvOetf), 0.0f,
+                  1.0f);
+BENCHMARK_CAPTURE(BM_TransferFn, srgbInvOetfLUT, static_cast<ColorTransformFn>(srgbInvOetfLUT),
+                  0.0f, 1.0f);
+BENCHMARK_CAPTURE(BM_TransferFn, pqOetf, static_cast<ColorTransformFn>(pqOetf), 0.0f, 1.0f);
+BENCHMARK_CAPTURE(BM_TransferFn, pqOetfLUT, static_cast<ColorTransformFn>(pqOetfLUT), 0.0f, 1.0f);
+BENCHMARK_CAPTURE(BM_TransferFn, pqInvOetf, static_cast<ColorTransformFn>(pqInvOetf), 0.0f, 1.0f);
+BENCHMARK_CAPTURE(BM_TransferFn, pqInvOetfLUT, static_cast<ColorTransformFn>(pqInvOetfLUT), 0.0f,
+                  1.0f);
+BENCHMARK_CAPTURE(BM_TransferFn, hlgOetf, static_cast<ColorTransformFn>(hlgOetf), 0.0f, 1.0f);
+BENCHMARK_CAPTURE(BM_TransferFn, hlgOetfLUT, static_cast<ColorTransformFn>(hlgOetfLUT), 0.0f,
+                  1.0f);
+BENCHMARK_CAPTURE(BM_TransferFn, hlgInvOetf, static_cast<ColorTransformFn>(hlgInvOetf), 0.0f,
+                  1.0f);
+BENCHMARK_CAPTURE(BM_TransferFn, hlgInvOetfLUT, static_cast<ColorTransformFn>(hlgInvOetfLUT),
+                  0.0f, 1.0f);
+
+/* Gain application */
+static void BM_ApplyGain(benchmark::State& s) {
+  std::vector<Color> colors = makeColors(0.0f, 1.0f);
+  uhdr_gainmap_metadata_ext_t metadata = makeMetadata();
+  for (auto _ : s) {
+    for (size_t i = 0; i < colors.size(); i++) {
+      benchmark::DoNotOptimize(applyGain(colors[i], colors[i].r, &metadata, 1.0f));
+    }
+  }
+  setPixelsProcessed(s, colors.size());
+}
+BENCHMARK(BM_ApplyGain);
+
+static void BM_ApplyGainLUT(benchmark::State& s) {
+  std::vector<Color> colors = makeColors(0.0f, 1.0f);
+  uhdr_gainmap_metadata_ext_t metadata = makeMetadata();
+  auto lut = std::make_unique<GainLUT>(&metadata, 1.0f);
+  for (auto _ : s) {
+    for (size_t i = 0; i < colors.size(); i++) {
+      benchmark::DoNotOptimize(applyGainLUT(colors[i], colors[i].r, *lut, &metadata));
+    }
+  }
+  setPixelsProcessed(s, colors.size());
+}
+BENCHMARK(BM_ApplyGainLUT);
+
+static void BM_ApplyGain3Channel(benchmark::State& s) {
+  std::vector<Color> colors = makeColors(0.0f, 1.0f);
+  uhdr_gainmap_metadata_ext_t metadata = makeMetadata();
+  for (auto _ : s) {
+    for (size_t i = 0; i < colors.size(); i++) {
+      benchmark::DoNotOptimize(applyGain(colors[i], colors[i], &metadata, 1.0f));
+    }
+  }
+  setPixelsProcessed(s, colors.size());
+}
+BENCHMARK(BM_ApplyGain3Channel);
+
+static void BM_ApplyGain3ChannelLUT(benchmark::State& s) {
+  std::vector<Color> colors = makeColors(0.0f, 1.0f);
+  uhdr_gainmap_metadata_ext_t metadata = makeMetadata();
+  auto lut = std::make_unique<GainLUT>(&metadata, 1.0f);
+  for (auto _ : s) {
+    for (size_t i = 0; i < colors.size(); i++) {
+      benchmark::DoNotOptimize(applyGainLUT(colors[i], colors[i], *lut, &metadata));
+    }
+  }
+  setPixelsProcessed(s, colors.size());
+}
+BENCHMARK(BM_ApplyGain3ChannelLUT);
+
+// sdr pixel and gain to the output pixel, through the transfer function luts and through the
+// approximation of the whole mapping
+static void BM_ApplyGainToOutput(benchmark::State& s, uhdr_color_transfer_t ct) {
+  std::vector<Color> colors = makeColors(0.0f, 1.0f);
+  uhdr_gainmap_metadata_ext_t metadata = makeMetadata();
+  auto lut = std::make_unique<GainLUT>(&metadata, 1.0f);
+  for (auto _ : s) {
+    for (size_t i = 0; i < colors.size(); i++) {
+      Color hdr = applyGainLUT(srgbInvOetfLUT(colors[i]), colors[i].r, *lut, &metadata);
+      if (ct == UHDR_CT_HLG) {
+        hdr = hlgOetfLUT(hlgInverseOotfApprox(hdr * kSdrWhiteNits / kHlgMaxNits));
+      } else {
+        hdr = pqOetfLUT(hdr * kSdrWhiteNits / kPqMaxNits);
+      }
+      benchmark::DoNotOptimize(hdr);
+    }
+  }
+  setPixelsProcessed(s, colors.size());
+}
+BENCHMARK_CAPTURE(BM_ApplyGainToOutput, hlg, UHDR_CT_HLG);
+BENCHMARK_CAPTURE(BM_ApplyGainToOutput, pq, UHDR_CT_PQ);
+
+static void BM_GainMapOutputLUT(benchmark::State& s, uhdr_color_transfer_t ct) {
+  std::vector<Color> colors = makeColors(0.0f, 1.0f);
+  uhdr_gainmap_metadata_ext_t metadata = makeMetadata();
+  auto lut = std::make_unique<GainMapOutputLUT>(&metadata, 1.0f, ct);
+  for (auto _ : s) {
+    for (size_t i = 0; i < colors.size(); i++) {
+      benchmark::DoNotOptimize(lut->lookup(colors[i], colors[i].r));
+    }
+  }
+  setPixelsProcessed(s, colors.size());
+}
+BENCHMARK_CAPTURE(BM_GainMapOutputLUT, hlg, UHDR_CT_HLG);
+BENCHMARK_CAPTURE(BM_GainMapOutputLUT, pq, UHDR_CT_PQ);
+
+/* Gain computation */
+static void BM_EncodeGain(benchmark::State& s) {
+  std::vector<Color> sdr = makeColors(0.0f, 1.0f);
+  std::vector<Color> hdr = makeColors(0.0f, 8.0f);
+  uhdr_gainmap_metadata_ext_t metadata = makeMetadata();
+  const float log2MinBoost = log2(metadata.min_content_boost);
+  const float log2MaxBoost = log2(metadata.max_content_boost);
+  for (auto _ : s) {
+    for (size_t i = 0; i < sdr.size(); i++) {
+      benchmark::DoNotOptimize(
+          encodeGain(sdr[i].g, hdr[i].g, &metadata, log2MinBoost, log2MaxBoost));
+    }
+  }
+  setPixelsProcessed(s, sdr.size());
+}
+BENCHMARK(BM_EncodeGain);
+
+/* Gain map sampling, the map is kMapScaleFactor times smaller than the image in each direction */
+static void BM_SampleMap(benchmark::State& s) {
+  auto map = makeImage(UHDR_IMG_FMT_8bppYCbCr400, kImageWidth / kMapScaleFactor,
+                       kImageHeight / kMapScaleFactor);
+  const float scale = static_cast<float>(kMapScaleFactor);
+  for (auto _ : s) {
+    for (size_t y = 0; y < kImageHeight; y++) {
+      for (size_t x = 0; x < kImageWidth; x++) {
+        benchmark::DoNotOptimize(sampleMap(map.get(), scale, x, y));
+      }
+    }
+  }
+  setPixelsProcessed(s, kImageWidth * kImageHeight);
+}
+BENCHMARK(BM_SampleMap);
+
+static void BM_SampleMapShepardsIDW(benchmark::State& s) {
+  auto map = makeImage(UHDR_IMG_FMT_8bppYCbCr400, kImageWidth / kMapScaleFactor,
+                       kImageHeight / kMapScaleFactor);
+  ShepardsIDW idw(kMapScaleFactor);
+  for (auto _ : s) {
+    for (size_t y = 0; y < kImageHeight; y++) {
+      for (size_t x = 0; x < kImageWidth; x++) {
+        benchmark::DoNotOptimize(sampleMap(map.get(), kMapScaleFactor, x, y, idw));
+      }
+    }
+  }
+  setPixelsProcessed(s, kImageWidth * kImageHeight);
+}
+BENCHMARK(BM_SampleMapShepardsIDW);
+
+static void BM_SampleMapRowShepardsIDW(benchmark::State& s) {
+  auto map = makeImage(UHDR_IMG_FMT_8bppYCbCr400, kImageWidth / kMapScaleFactor,
+                       kImageHeight / kMapScaleFactor);
+  ShepardsIDW idw(kMapScaleFactor);
+  std::vector<float> gains(kImageWidth);
+  for (auto _ : s) {
+    for (size_t y = 0; y < kImageHeight; y++) {
+      sampleMapRow(map.get(), kMapScaleFactor, 0, y, kImageWidth, idw, gains.data());
+      benchmark::ClobberMemory();
+    }
+  }
+  setPixelsProcessed(s, kImageWidth * kImageHeight);
+}
+BENCHMARK(BM_SampleMapRowShepardsIDW);
+
+/* Yuv encoding conversion, in place, so every iteration converts the output of the last one */
+static void BM_ConvertYuv420(benchmark::State& s) {
+  auto img = makeImage(UHDR_IMG_FMT_12bppYCbCr420, kImageWidth, kImageHeight);
+  for (auto _ : s) {
+    transformYuv420(img.get(), kYuvBt709ToBt601);
+    benchmark::ClobberMemory();
+  }
+  setPixelsProcessed(s, kImageWidth * kImageHeight);
+}
+BENCHMARK(BM_ConvertYuv420);
+
+// indexed by uhdr_isa_level_t
+static const char* kIsaNames[] = {"none",   "neon", "neon+fp16", "sse4.1", "avx2",
+                                  "avx512", "rvv",  "simd128",   "lsx",    "lasx"};
+
+// neon on arm, sse4.1 or avx2 on x86, rvv on risc-v, simd128 on wasm, lsx or lasx on loongarch,
+// as picked for the running cpu
+static void BM_ConvertYuv420Vector(benchmark::State& s) {
+  auto convertYuv = getDspFunctions().convertYuv;
+  if (convertYuv == nullptr) {
+    s.SkipWithError("no vector implementation for this cpu");
+    return;
+  }
+  s.SetLabel(kIsaNames[getDspFunctions().isa]);
+  auto img = makeImage(UHDR_IMG_FMT_12bppYCbCr420, kImageWidth, kImageHeight);
+  for (auto _ : s) {
+    convertYuv(img.get(), UHDR_CG_BT_709, UHDR_CG_DISPLAY_P3);
+    benchmark::ClobberMemory();
+  }
+  setPixelsProcessed(s, kImageWidth * kImageHeight);
+}
+BENCHMARK(BM_ConvertYuv420Vector);
+
+#if (defined(UHDR_ENABLE_INTRINSICS) && \
+     (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)))
+/*
+ * Gain map row kernels of every x86 isa level over a 50MP image, so the levels can be compared on
+ * one machine. Levels the cpu lacks are skipped. Pixels past the vector part of a row are left
+ * out, as the codec hands them to the scalar code.
+ */
+static const unsigned kLargeWidth = 8160;
+static const unsigned kLargeHeight = 6144;
+
+static bool isaAvailable(benchmark::State& s, uhdr_isa_level_t isa) {
+  if (getDspFunctions().isa < isa) {
+    s.SkipWithError("cpu lacks this isa level");
+    return false;
+  }
+  s.SetLabel(kIsaNames[isa]);
+  return true;
+}
+
+/* args: isa level, output transfer (0 linear, 1 hlg) */
+static void BM_ApplyGainMapRow50MP(benchmark::State& s) {
+  const uhdr_isa_level_t isa = static_cast<uhdr_isa_level_t>(s.range(0));
+  if (!isaAvailable(s, isa)) return;
+  const ApplyGainMapRowFn fn = isa == UHDR_ISA_AVX512 ? applyGainMapRowYuv420_avx512
+                               : isa == UHDR_ISA_AVX2 ? applyGainMapRowYuv420_avx2
+                                                      : applyGainMapRowYuv420_sse41;
+  const uhdr_color_transfer_t ct = s.range(1) ? UHDR_CT_HLG : UHDR_CT_LINEAR;
+
+  auto sdr = makeImage(UHDR_IMG_FMT_12bppYCbCr420, kLargeWidth, kLargeHeight);
+  auto map = makeImage(UHDR_IMG_FMT_8bppYCbCr400, kLargeWidth / kMapScaleFactor,
+                       kLargeHeight / kMapScaleFactor);
+  auto dest = std::make_unique<uhdr_raw_image_ext_t>(
+      ct == UHDR_CT_LINEAR ? UHDR_IMG_FMT_64bppRGBAHalfFloat : UHDR_IMG_FMT_32bppRGBA1010102,
+      UHDR_CG_BT_2100, ct, UHDR_CR_FULL_RANGE, kLargeWidth, kLargeHeight, 64);
+  uhdr_gainmap_metadata_ext_t metadata = makeMetadata();
+  GainLUT lut(&metadata, 1.0f);
+  ShepardsIDW idw(kMapScaleFactor);
+  for (auto _ : s) {
+    for (size_t y = 0; y < kLargeHeight; y++) {
+      fn(sdr.get(), map.get(), dest.get(), kMapScaleFactor, idw, lut, &metadata, ct, nullptr, y);
+    }
+    benchmark::ClobberMemory();
+  }
+  setPixelsProcessed(s, (size_t)kLargeWidth * kLargeHeight);
+}
+BENCHMARK(BM_ApplyGainMapRow50MP)
+    ->ArgNames({"isa", "hlg"})
+    ->ArgsProduct({{UHDR_ISA_SSE41, UHDR_ISA_AVX2, UHDR_ISA_AVX512}, {0, 1}})
+    ->Unit(benchmark::kMillisecond);
+
+/* args: isa level, multichannel */
+static void BM_GenerateGainMapRow50MP(benchmark::State& s) {
+  const uhdr_isa_level_t isa = static_cast<uhdr_isa_level_t>(s.range(0));
+  if (!isaAvailable(s, isa)) return;
+  const GenerateGainMapRowFn fn = isa == UHDR_ISA_AVX512 ? generateGainMapRow_avx512
+                                  : isa == UHDR_ISA_AVX2 ? generateGainMapRow_avx2
+                                                         : generateGainMapRow_sse41;
+  const bool multichannel = s.range(1) != 0;
+
+  auto sdr = makeImage(UHDR_IMG_FMT_12bppYCbCr420, kLargeWidth, kLargeHeight);
+  auto hdr = makeImage(UHDR_IMG_FMT_24bppYCbCrP010, kLargeWidth, kLargeHeight);
+  hdr->cg = UHDR_CG_BT_2100;
+  hdr->ct = UHDR_CT_PQ;
+  hdr->range = UHDR_CR_LIMITED_RANGE;
+  GainMapRowParams params;
+  if (!getGainMapRowParams(sdr.get(), hdr.get(), false, false, multichannel, kPqMaxNits,
+                           &params)) {
+    s.SkipWithError("no row parameters for the intents");
+    return;
+  }
+  const size_t mapWidth = kLargeWidth / kMapScaleFactor;
+  std::vector<float> gains(mapWidth * 3);
+  for (auto _ : s) {
+    for (size_t y = 0; y < kLargeHeight / kMapScaleFactor; y++) {
+      fn(sdr.get(), hdr.get(), params, kMapScaleFactor, mapWidth, y, gains.data());
+    }
+    benchmark::ClobberMemory();
+  }
+  setPixelsProcessed(s, (size_t)kLargeWidth * kLargeHeight);
+}
+BENCHMARK(BM_GenerateGainMapRow50MP)
+    ->ArgNames({"isa", "multichannel"})
+    ->ArgsProduct({{UHDR_ISA_SSE41, UHDR_ISA_AVX2, UHDR_ISA_AVX512}, {0, 1}})
+    ->Unit(benchmark::kMillisecond);
+#endif
+
+/* Pixel access */
+static void BM_GetPixel(benchmark::State& s, uhdr_img_fmt_t fmt, GetPixelFn fn) {
+  auto img = makeImage(fmt, kImageWidth, kImageHeight);
+  for (auto _ : s) {
+    for (size_t y = 0; y < kImageHeight; y++) {
+      for (size_t x = 0; x < kImageWidth; x++) {
+        benchmark::DoNotOptimize(fn(img.get(), x, y));
+      }
+    }
+  }
+  setPixelsProcessed(s, kImageWidth * kImageHeight);
+}
+
+BENCHMARK_CAPTURE(BM_GetPixel, Yuv444, UHDR_IMG_FMT_24bppYCbCr444, getYuv444Pixel);
+BENCHMARK_CAPTURE(BM_GetPixel, Yuv422, UHDR_IMG_FMT_16bppYCbCr422, getYuv422Pixel);
+BENCHMARK_CAPTURE(BM_GetPixel, Yuv420, UHDR_IMG_FMT_12bppYCbCr420, getYuv420Pixel);
+BENCHMARK_CAPTURE(BM_GetPixel, Yuv400, UHDR_IMG_FMT_8bppYCbCr400, getYuv400Pixel);
+BENCHMARK_CAPTURE(BM_GetPixel, P010, UHDR_IMG_FMT_24bppYCbCrP010, getP010Pixel);
+BENCHMARK_CAPTURE(BM_GetPixel, Yuv444_10bit, UHDR_IMG_FMT_30bppYCbCr444, getYuv444Pixel10bit);
+BENCHMARK_CAPTURE(BM_GetPixel, Rgb888, UHDR_IMG_FMT_24bppRGB888, getRgb888Pixel);
+BENCHMARK_CAPTURE(BM_GetPixel, Rgba8888, UHDR_IMG_FMT_32bppRGBA8888, getRgba8888Pixel);
+BENCHMARK_CAPTURE(BM_GetPixel, Rgba1010102, UHDR_IMG_FMT_32bppRGBA1010102, getRgba1010102Pixel);
+BENCHMARK_CAPTURE(BM_GetPixel, RgbaF16, UHDR_IMG_FMT_64bppRGBAHalfFloat, getRgbaF16Pixel);
+
+static void BM_PutPixel(benchmark::State& s, uhdr_img_fmt_t fmt, PutPixelFn fn) {
+  auto img = makeImage(fmt, kImageWidth, kImageHeight);
+  std::vector<Color> colors = makeColors(0.0f, 1.0f);
+  for (auto _ : s) {
+    size_t i = 0;
+    for (size_t y = 0; y < kImageHeight; y++) {
+      for (size_t x = 0; x < kImageWidth; x++) {
+        fn(img.get(), x, y, colors[i++ % kPixelCount]);
+      }
+    }
+    benchmark::ClobberMemory();
+  }
+  setPixelsProcessed(s, kImageWidth * kImageHeight);
+}
+
+BENCHMARK_CAPTURE(BM_PutPixel, Yuv444, UHDR_IMG_FMT_24bppYCbCr444, putYuv444Pixel);
+BENCHMARK_CAPTURE(BM_PutPixel, Yuv400, UHDR_IMG_FMT_8bppYCbCr400, putYuv400Pixel);
+BENCHMARK_CAPTURE(BM_PutPixel, Rgb888, UHDR_IMG_FMT_24bppRGB888, putRgb888Pixel);
+BENCHMARK_CAPTURE(BM_PutPixel, Rgba8888, UHDR_IMG_FMT_32bppRGBA8888, putRgba8888Pixel);
@@ -0,0 +1,394 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "ultrahdr_api.h"
+
+/*
+ * Encode and decode benchmarks over a matrix of resolutions, thread counts, gain map scale
+ * factors, presets, output transfers and gpu on/off, and batch benchmarks with NUMA placement
+ * on/off. Inputs are generated in memory, so no test resources are needed.
+ *
+ * Thread count is the first and fastest varying argument, starting at 1. Every multi threaded run
+ * reports speedup and efficiency (speedup / threads) against the single threaded run of the same
+ * configuration, if that was run in the same invocation. Resolution is the last and slowest varying
+ * one. Use --benchmark_filter to select a part of the matrix, e.g.
+ * --benchmark_filter='BM_UHDRDecode_Matrix/.+/res:2'.
+ */
+
+struct Resolution {
+  const char* name;
+  unsigned int width;
+  unsigned int height;
+};
+
+static const Resolution kResolutions[] = {
+    {"1MP", 1152, 864}, {"4MP", 2304, 1728}, {"12MP", 4080, 3072},
+    {"50MP", 8160, 6144}, {"100MP", 11520, 8640},
+};
+static const int64_t kNumResolutions = sizeof kResolutions / sizeof kResolutions[0];
+
+static const std::vector<int64_t> kThreadCounts = {1, 2, 4, 8};
+
+static const uhdr_color_transfer_t kOutputTransfers[] = {UHDR_CT_LINEAR, UHDR_CT_HLG, UHDR_CT_PQ,
+                                                         UHDR_CT_SRGB};
+
+static uhdr_img_fmt_t outputFormat(uhdr_color_transfer_t ct) {
+  switch (ct) {
+    case UHDR_CT_LINEAR:
+      return UHDR_IMG_FMT_64bppRGBAHalfFloat;
+    case UHDR_CT_HLG:
+    case UHDR_CT_PQ:
+      return UHDR_IMG_FMT_32bppRGBA1010102;
+    default:
+      return UHDR_IMG_FMT_32bppRGBA8888;
+  }
+}
+
+static const char* transferName(uhdr_color_transfer_t ct) {
+  switch (ct) {
+    case UHDR_CT_LINEAR:
+      return "linear";
+    case UHDR_CT_HLG:
+      return "hlg";
+    case UHDR_CT_PQ:
+      return "pq";
+    default:
+      return "srgb";
+  }
+}
+
+/*
+ * A p010 pq hdr intent, a yuv420 sdr intent derived from it, and their ultrahdr encoding. The
+ * content is a gradient with per pixel noise, so that the jpeg coder has real work to do.
+ */
+class SyntheticInput {
+ public:
+  explicit SyntheticInput(int64_t res) : mRes(res) {
+    const unsigned int w = kResolutions[res].width, h = kResolutions[res].height;
+    mP010Y.resize((size_t)w * h);
+    mP010UV.resize((size_t)w * h / 2);
+    mY.resize((size_t)w * h);
+    mU.resize((size_t)w * h / 4);
+    mV.resize((size_t)w * h / 4);
+
+    uint32_t seed = 0x9e3779b9u;
+    auto noise = [&seed]() {
+      seed = seed * 1664525u + 1013904223u;
+      return (int)(seed >> 27) - 16;
+    };
+    for (unsigned int y = 0; y < h; y++) {
+      for (unsigned int x = 0; x < w; x++) {
+        int luma = 64 + (int)((uint64_t)(x + y) * 876 / (w + h)) + noise();
+        luma = luma < 64 ? 64 : (luma > 940 ? 940 : luma);
+        mP010Y[(size_t)y * w + x] = (uint16_t)(luma << 6);
+        mY[(size_t)y * w + x] = (uint8_t)(((luma - 64) * 255) / 876);
+      }
+    }
+    for (unsigned int y = 0; y < h / 2; y++) {
+      for (unsigned int x = 0; x < w / 2; x++) {
+        int cb = 512 + (int)((int64_t)x * 192 / w) - 48 + noise();
+        int cr = 512 + (int)((int64_t)y * 192 / h) - 48 + noise();
+        mP010UV[(size_t)y * w + 2 * x] = (uint16_t)(cb << 6);
+        mP010UV[(size_t)y * w + 2 * x + 1] = (uint16_t)(cr << 6);
+        mU[(size_t)y * (w / 2) + x] = (uint8_t)(cb >> 2);
+        mV[(size_t)y * (w / 2) + x] = (uint8_t)(cr >> 2);
+      }
+    }
+
+    mHdrImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+    mHdrImg.cg = UHDR_CG_BT_2100;
+    mHdrImg.ct = UHDR_CT_PQ;
+    mHdrImg.range = UHDR_CR_LIMITED_RANGE;
+    mHdrImg.w = w;
+    mHdrImg.h = h;
+    mHdrImg.planes[UHDR_PLANE_Y] = mP010Y.data();
+    mHdrImg.planes[UHDR_PLANE_UV] = mP010UV.data();
+    mHdrImg.stride[UHDR_PLANE_Y] = w;
+    mHdrImg.stride[UHDR_PLANE_UV] = w;
+
+    mSdrImg.fmt = UHDR_IMG_FMT_12bppYCbCr420;
+    mSdrImg.cg = UHDR_CG_BT_709;
+    mSdrImg.ct = UHDR_CT_SRGB;
+    mSdrImg.range = UHDR_CR_FULL_RANGE;
+    mSdrImg.w = w;
+    mSdrImg.h = h;
+    mSdrImg.planes[UHDR_PLANE_Y] = mY.data();
+    mSdrImg.planes[UHDR_PLANE_U] = mU.data();
+    mSdrImg.planes[UHDR_PLANE_V] = mV.data();
+    mSdrImg.stride[UHDR_PLANE_Y] = w;
+    mSdrImg.stride[UHDR_PLANE_U] = w / 2;
+    mSdrImg.stride[UHDR_PLANE_V] = w / 2;
+  }
+
+  int64_t mRes;
+  uhdr_raw_image_t mHdrImg{};
+  uhdr_raw_image_t mSdrImg{};
+
+  // Encodes the intents with default settings on first use, empty on failure
+  const std::vector<uint8_t>& getEncoded() {
+    if (!mEncoded.empty()) return mEncoded;
+    uhdr_codec_private_t* enc = uhdr_create_encoder();
+    if (uhdr_enc_set_raw_image(enc, &mHdrImg, UHDR_HDR_IMG).error_code == UHDR_CODEC_OK &&
+        uhdr_enc_set_raw_image(enc, &mSdrImg, UHDR_SDR_IMG).error_code == UHDR_CODEC_OK &&
+        uhdr_encode(enc).error_code == UHDR_CODEC_OK) {
+      uhdr_compressed_image_t* out = uhdr_get_encoded_stream(enc);
+      const uint8_t* data = static_cast<const uint8_t*>(out->data);
+      mEncoded.assign(data, data + out->data_sz);
+    }
+    uhdr_release_encoder(enc);
+    return mEncoded;
+  }
+
+ private:
+  std::vector<uint16_t> mP010Y, mP010UV;
+  std::vector<uint8_t> mY, mU, mV;
+  std::vector<uint8_t> mEncoded;
+};
+
+// Resolution varies slowest, so holding one input at a time generates each once
+static SyntheticInput* getInput(int64_t res) {
+  static std::unique_ptr<SyntheticInput> input;
+  if (input == nullptr || input->mRes != res) {
+    input.reset();
+    input = std::make_unique<SyntheticInput>(res);
+  }
+  return input.get();
+}
+
+// Key of a run without its thread count, the first argument
+static std::string configKey(const char* group, const benchmark::State& s, int numArgs) {
+  std::string key = group;
+  for (int i = 1; i < numArgs; i++) key += "/" + std::to_string(s.range(i));
+  return key;
+}
+
+// Records the single threaded time of a configuration, or reports scaling against it
+static void reportScaling(benchmark::State& s, const std::string& key, int64_t threads,
+                          double secondsPerIteration) {
+  static std::map<std::string, double> singleThreaded;
+  if (threads == 1) {
+    singleThreaded[key] = secondsPerIteration;
+    return;
+  }
+  auto it = singleThreaded.find(key);
+  if (it == singleThreaded.end() || secondsPerIteration <= 0.0) return;
+  const double speedup = it->second / secondsPerIteration;
+  s.counters["speedup"] = speedup;
+  s.counters["efficiency"] = speedup / threads;
+}
+
+#define RET_IF_ERR(x, release, handle)                                      \
+  {                                                                         \
+    uhdr_error_info_t status = (x);                                         \
+    if (status.error_code != UHDR_CODEC_OK) {                               \
+      release(handle);                                                      \
+      s.SkipWithError(status.has_detail ? status.detail : "Unknown error"); \
+      return;                                                               \
+    }                                                                       \
+  }
+
+/* args: threads, preset, gain map scale factor, gpu, res */
+static void BM_UHDREncode_Matrix(benchmark::State& s) {
+  const int64_t threads = s.range(0);
+  const uhdr_enc_preset_t preset = (uhdr_enc_preset_t)s.range(1);
+  const int scaleFactor = (int)s.range(2);
+  const int enableGLES = (int)s.range(3);
+  const int64_t res = s.range(4);
+
+  SyntheticInput* input = getInput(res);
+  s.SetLabel(std::string(kResolutions[res].name) + ", " +
+             (preset == UHDR_USAGE_BEST_QUALITY ? "best_quality" : "realtime") +
+             ", scale factor: " + std::to_string(scaleFactor) +
+             ", enableGLES: " + (enableGLES ? "true" : "false") +
+             ", threads: " + std::to_string(threads));
+
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  auto start = std::chrono::steady_clock::now();
+  for (auto _ : s) {
+    RET_IF_ERR(uhdr_enc_set_raw_image(enc, &input->mHdrImg, UHDR_HDR_IMG), uhdr_release_encoder,
+               enc)
+    RET_IF_ERR(uhdr_enc_set_raw_image(enc, &input->mSdrImg, UHDR_SDR_IMG), uhdr_release_encoder,
+               enc)
+    RET_IF_ERR(uhdr_enc_set_preset(enc, preset), uhdr_release_encoder, enc)
+    RET_IF_ERR(uhdr_enc_set_gainmap_scale_factor(enc, scaleFactor), uhdr_release_encoder, enc)
+    RET_IF_ERR(uhdr_enc_set_num_threads(enc, (int)threads), uhdr_release_encoder, enc)
+    RET_IF_ERR(uhdr_enable_gpu_acceleration(enc, enableGLES), uhdr_release_encoder, enc)
+    RET_IF_ERR(uhdr_encode(enc), uhdr_release_encoder, enc)
+    uhdr_reset_encoder(enc);
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  uhdr_release_encoder(enc);
+
+  const int64_t pixels = (int64_t)kResolutions[res].width * kResolutions[res].height;
+  s.SetItemsProcessed(s.iterations() * pixels);
+  reportScaling(s, configKey("enc", s, 5), threads, elapsed.count() / s.iterations());
+}
+
+/* args: threads, output transfer, gpu, res */
+static void BM_UHDRDecode_Matrix(benchmark::State& s) {
+  const int64_t threads = s.range(0);
+  const uhdr_color_transfer_t ct = kOutputTransfers[s.range(1)];
+  const int enableGLES = (int)s.range(2);
+  const int64_t res = s.range(3);
+
+  const std::vector<uint8_t>& encoded = getInput(res)->getEncoded();
+  if (encoded.empty()) {
+    s.SkipWithError("unable to encode synthetic input");
+    return;
+  }
+  uhdr_compressed_image_t uhdrImg{};
+  uhdrImg.data = const_cast<uint8_t*>(encoded.data());
+  uhdrImg.data_sz = encoded.size();
+  uhdrImg.capacity = encoded.size();
+  uhdrImg.cg = UHDR_CG_UNSPECIFIED;
+  uhdrImg.ct = UHDR_CT_UNSPECIFIED;
+  uhdrImg.range = UHDR_CR_UNSPECIFIED;
+
+  s.SetLabel(std::string(kResolutions[res].name) + ", ColorTransfer: " + transferName(ct) +
+             ", enableGLES: " + (enableGLES ? "true" : "false") +
+             ", threads: " + std::to_string(threads));
+
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  auto start = std::chrono::steady_clock::now();
+  for (auto _ : s) {
+    RET_IF_ERR(uhdr_dec_set_image(dec, &uhdrImg), uhdr_release_decoder, dec)
+    RET_IF_ERR(uhdr_dec_set_out_color_transfer(dec, ct), uhdr_release_decoder, dec)
+    RET_IF_ERR(uhdr_dec_set_out_img_format(dec, outputFormat(ct)), uhdr_release_decoder, dec)
+    RET_IF_ERR(uhdr_dec_set_num_threads(dec, (int)threads), uhdr_release_decoder, dec)
+    RET_IF_ERR(uhdr_enable_gpu_acceleration(dec, enableGLES), uhdr_release_decoder, dec)
+    RET_IF_ERR(uhdr_decode(dec), uhdr_release_decoder, dec)
+    uhdr_reset_decoder(dec);
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  uhdr_release_decoder(dec);
+
+  const int64_t pixels = (int64_t)kResolutions[res].width * kResolutions[res].height;
+  s.SetItemsProcessed(s.iterations() * pixels);
+  reportScaling(s, configKey("dec", s, 4), threads, elapsed.count() / s.iterations());
+}
+
+/* args: numa placement, batch size, res */
+static void BM_UHDRDecode_Batch(benchmark::State& s) {
+  const int numa = (int)s.range(0);
+  const int64_t batchSize = s.range(1);
+  const int64_t res = s.range(2);
+
+  const std::vector<uint8_t>& encoded = getInput(res)->getEncoded();
+  if (encoded.empty()) {
+    s.SkipWithError("unable to encode synthetic input");
+    return;
+  }
+  uhdr_compressed_image_t uhdrImg{};
+  uhdrImg.data = const_cast<uint8_t*>(encoded.data());
+  uhdrImg.data_sz = encoded.size();
+  uhdrImg.capacity = encoded.size();
+  uhdrImg.cg = UHDR_CG_UNSPECIFIED;
+  uhdrImg.ct = UHDR_CT_UNSPECIFIED;
+  uhdrImg.range = UHDR_CR_UNSPECIFIED;
+
+  s.SetLabel(std::string(kResolutions[res].name) + ", numa: " + (numa ? "true" : "false") +
+             ", batch: " + std::to_string(batchSize));
+
+  std::vector<uhdr_codec_private_t*> decs(batchSize);
+  for (auto& dec : decs) dec = uhdr_create_decoder();
+  auto release = [&decs](int) {
+    for (auto dec : decs) uhdr_release_decoder(dec);
+  };
+  for (auto _ : s) {
+    for (auto dec : decs) {
+      RET_IF_ERR(uhdr_dec_set_image(dec, &uhdrImg), release, 0)
+      RET_IF_ERR(uhdr_enable_numa_placement(dec, numa), release, 0)
+    }
+    RET_IF_ERR(uhdr_decode_batch(decs.data(), (unsigned int)batchSize), release, 0)
+    for (auto dec : decs) uhdr_reset_decoder(dec);
+  }
+  release(0);
+
+  const int64_t pixels = (int64_t)kResolutions[res].width * kResolutions[res].height;
+  s.SetItemsProcessed(s.iterations() * batchSize * pixels);
+}
+
+/* args: numa placement, batch size, res */
+static void BM_UHDREncode_Batch(benchmark::State& s) {
+  const int numa = (int)s.range(0);
+  const int64_t batchSize = s.range(1);
+  const int64_t res = s.range(2);
+
+  SyntheticInput* input = getInput(res);
+  s.SetLabel(std::string(kResolutions[res].name) + ", numa: " + (numa ? "true" : "false") +
+             ", batch: " + std::to_string(batchSize));
+
+  std::vector<uhdr_codec_private_t*> encs(batchSize);
+  for (auto& enc : encs) enc = uhdr_create_encoder();
+  auto release = [&encs](int) {
+    for (auto enc : encs) uhdr_release_encoder(enc);
+  };
+  for (auto _ : s) {
+    for (auto enc : encs) {
+      RET_IF_ERR(uhdr_enc_set_raw_image(enc, &input->mHdrImg, UHDR_HDR_IMG), release, 0)
+      RET_IF_ERR(uhdr_enc_set_raw_image(enc, &input->mSdrImg, UHDR_SDR_IMG), release, 0)
+      RET_IF_ERR(uhdr_enable_numa_placement(enc, numa), release, 0)
+    }
+    RET_IF_ERR(uhdr_encode_batch(encs.data(), (unsigned int)batchSize), release, 0)
+    for (auto enc : encs) uhdr_reset_encoder(enc);
+  }
+  release(0);
+
+  const int64_t pixels = (int64_t)kResolutions[res].width * kResolutions[res].height;
+  s.SetItemsProcessed(s.iterations() * batchSize * pixels);
+}
+
+#undef RET_IF_ERR
+
+BENCHMARK(BM_UHDREncode_Matrix)
+    ->ArgNames({"threads", "preset", "scale", "gles", "res"})
+    ->ArgsProduct({kThreadCounts,
+                   {UHDR_USAGE_REALTIME, UHDR_USAGE_BEST_QUALITY},
+                   {1, 4},
+                   {0, 1},
+                   benchmark::CreateDenseRange(0, kNumResolutions - 1, 1)})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK(BM_UHDRDecode_Matrix)
+    ->ArgNames({"threads", "ct", "gles", "res"})
+    ->ArgsProduct({kThreadCounts,
+                   benchmark::CreateDenseRange(0, 3, 1),
+                   {0, 1},
+                   benchmark::CreateDenseRange(0, kNumResolutions - 1, 1)})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK(BM_UHDRDecode_Batch)
+    ->ArgNames({"numa", "batch", "res"})
+    ->ArgsProduct({{0, 1}, {8, 32}, benchmark::CreateDenseRange(0, 2, 1)})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK(BM_UHDREncode_Batch)
+    ->ArgNames({"numa", "batch", "res"})
+    ->ArgsProduct({{0, 1}, {8, 32}, benchmark::CreateDenseRange(0, 2, 1)})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
@@ -17,18 +17,29 @@
 #ifdef _WIN32
 #include <Windows.h>
 #else
+#include <fcntl.h>
 #include <sys/time.h>
+#include <unistd.h>
 #endif
 
 #include <string.h>
 
 #include <algorithm>
 #include <cfloat>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "ultrahdr_api.h"
 
@@ -232,6 +243,17 @@ static bool writeFile(const char* filename, uhdr_raw_image_t* img) {
         ofd.write(data, length);
       }
       return true;
+    } else if (img->fmt == UHDR_IMG_FMT_24bppYCbCrP010) {
+      const size_t length = img->w * 2;
+      char* data = static_cast<char*>(img->planes[UHDR_PLANE_Y]);
+      for (unsigned i = 0; i < img->h; i++, data += img->stride[UHDR_PLANE_Y] * 2) {
+        ofd.write(data, length);
+      }
+      data = static_cast<char*>(img->planes[UHDR_PLANE_UV]);
+      for (unsigned i = 0; i < img->h / 2; i++, data += img->stride[UHDR_PLANE_UV] * 2) {
+        ofd.write(data, length);
+      }
+      return true;
     } else if ((int)img->fmt == UHDR_IMG_FMT_24bppYCbCr444 ||
                (int)img->fmt == UHDR_IMG_FMT_48bppYCbCr444) {
       char* data = static_cast<char*>(img->planes[UHDR_PLANE_Y]);
@@ -390,8 +412,10 @@ class UltraHdrAppInput {
   bool writeGainMapMetadataToFile(uhdr_gainmap_metadata_t* metadata);
   bool convertRgba8888ToYUV444Image();
   bool convertRgba1010102ToYUV444Image();
+  uhdr_error_info_t setUpEncoder(uhdr_codec_private_t* handle);
   bool encode();
   bool decode();
+  bool benchmark(int iterations);
   void computeRGBHdrPSNR();
   void computeRGBSdrPSNR();
   void computeYUVHdrPSNR();
@@ -639,6 +663,65 @@ bool UltraHdrAppInput::fillUhdrImageHandle() {
   return false;
 }
 
+uhdr_error_info_t UltraHdrAppInput::setUpEncoder(uhdr_codec_private_t* handle) {
+#define RET_IF_ERR(x)                         \
+  {                                           \
+    uhdr_error_info_t status = (x);           \
+    if (status.error_code != UHDR_CODEC_OK) { \
+      return status;                          \
+    }                                         \
+  }
+  if (mHdrIntentRawFile != nullptr) {
+    if (mHdrCf == UHDR_IMG_FMT_24bppYCbCrP010) {
+      RET_IF_ERR(uhdr_enc_set_raw_image_ref(handle, &mRawP010Image, UHDR_HDR_IMG))
+    } else if (mHdrCf == UHDR_IMG_FMT_32bppRGBA1010102) {
+      RET_IF_ERR(uhdr_enc_set_raw_image_ref(handle, &mRawRgba1010102Image, UHDR_HDR_IMG))
+    } else if (mHdrCf == UHDR_IMG_FMT_64bppRGBAHalfFloat) {
+      RET_IF_ERR(uhdr_enc_set_raw_image_ref(handle, &mRawRgbaF16Image, UHDR_HDR_IMG))
+    }
+  }
+  if (mSdrIntentRawFile != nullptr) {
+    if (mSdrCf == UHDR_IMG_FMT_12bppYCbCr420) {
+      RET_IF_ERR(uhdr_enc_set_raw_image_ref(handle, &mRawYuv420Image, UHDR_SDR_IMG))
+    } else if (mSdrCf == UHDR_IMG_FMT_32bppRGBA8888) {
+      RET_IF_ERR(uhdr_enc_set_raw_image_ref(handle, &mRawRgba8888Image, UHDR_SDR_IMG))
+    }
+  }
+  if (mSdrIntentCompressedFile != nullptr) {
+    RET_IF_ERR(uhdr_enc_set_compressed_image(
+        handle, &mSdrIntentCompressedImage,
+        (mGainMapCompressedFile != nullptr && mGainMapMetadataCfgFile != nullptr) ? UHDR_BASE_IMG
+                                                                                  : UHDR_SDR_IMG))
+  }
+  if (mGainMapCompressedFile != nullptr && mGainMapMetadataCfgFile != nullptr) {
+    RET_IF_ERR(uhdr_enc_set_gainmap_image(handle, &mGainMapCompressedImage, &mGainMapMetadata))
+  }
+  if (mExifFile != nullptr) {
+    RET_IF_ERR(uhdr_enc_set_exif_data(handle, &mExifBlock))
+  }
+
+  RET_IF_ERR(uhdr_enc_set_quality(handle, mQuality, UHDR_BASE_IMG))
+  RET_IF_ERR(uhdr_enc_set_quality(handle, mMapCompressQuality, UHDR_GAIN_MAP_IMG))
+  RET_IF_ERR(uhdr_enc_set_using_multi_channel_gainmap(handle, mUseMultiChannelGainMap))
+  RET_IF_ERR(uhdr_enc_set_gainmap_scale_factor(handle, mMapDimensionScaleFactor))
+  RET_IF_ERR(uhdr_enc_set_gainmap_gamma(handle, mGamma))
+  RET_IF_ERR(uhdr_enc_set_preset(handle, mEncPreset))
+  if (mMinContentBoost != FLT_MIN || mMaxContentBoost != FLT_MAX) {
+    RET_IF_ERR(uhdr_enc_set_min_max_content_boost(handle, mMinContentBoost, mMaxContentBoost))
+  }
+  if (mTargetDispPeakBrightness != -1.0f) {
+    RET_IF_ERR(uhdr_enc_set_target_display_peak_brightness(handle, mTargetDispPeakBrightness))
+  }
+  if (mEnableGLES) {
+    RET_IF_ERR(uhdr_enable_gpu_acceleration(handle, mEnableGLES))
+  }
+#undef RET_IF_ERR
+
+  uhdr_error_info_t status{};
+  status.error_code = UHDR_CODEC_OK;
+  return status;
+}
+
 bool UltraHdrAppInput::encode() {
   if (mHdrIntentRawFile != nullptr) {
     if (mHdrCf == UHDR_IMG_FMT_24bppYCbCrP010) {
@@ -712,55 +795,26 @@ bool UltraHdrAppInput::encode() {
     }                                            \
   }
   uhdr_codec_private_t* handle = uhdr_create_encoder();
-  if (mHdrIntentRawFile != nullptr) {
-    if (mHdrCf == UHDR_IMG_FMT_24bppYCbCrP010) {
-      RET_IF_ERR(uhdr_enc_set_raw_image(handle, &mRawP010Image, UHDR_HDR_IMG))
-    } else if (mHdrCf == UHDR_IMG_FMT_32bppRGBA1010102) {
-      RET_IF_ERR(uhdr_enc_set_raw_image(handle, &mRawRgba1010102Image, UHDR_HDR_IMG))
-    } else if (mHdrCf == UHDR_IMG_FMT_64bppRGBAHalfFloat) {
-      RET_IF_ERR(uhdr_enc_set_raw_image(handle, &mRawRgbaF16Image, UHDR_HDR_IMG))
-    }
-  }
-  if (mSdrIntentRawFile != nullptr) {
-    if (mSdrCf == UHDR_IMG_FMT_12bppYCbCr420) {
-      RET_IF_ERR(uhdr_enc_set_raw_image(handle, &mRawYuv420Image, UHDR_SDR_IMG))
-    } else if (mSdrCf == UHDR_IMG_FMT_32bppRGBA8888) {
-      RET_IF_ERR(uhdr_enc_set_raw_image(handle, &mRawRgba8888Image, UHDR_SDR_IMG))
-    }
-  }
-  if (mSdrIntentCompressedFile != nullptr) {
-    RET_IF_ERR(uhdr_enc_set_compressed_image(
-        handle, &mSdrIntentCompressedImage,
-        (mGainMapCompressedFile != nullptr && mGainMapMetadataCfgFile != nullptr) ? UHDR_BASE_IMG
-                                                                                  : UHDR_SDR_IMG))
-  }
-  if (mGainMapCompressedFile != nullptr && mGainMapMetadataCfgFile != nullptr) {
-    RET_IF_ERR(uhdr_enc_set_gainmap_image(handle, &mGainMapCompressedImage, &mGainMapMetadata))
-  }
-  if (mExifFile != nullptr) {
-    RET_IF_ERR(uhdr_enc_set_exif_data(handle, &mExifBlock))
-  }
-
-  RET_IF_ERR(uhdr_enc_set_quality(handle, mQuality, UHDR_BASE_IMG))
-  RET_IF_ERR(uhdr_enc_set_quality(handle, mMapCompressQuality, UHDR_GAIN_MAP_IMG))
-  RET_IF_ERR(uhdr_enc_set_using_multi_channel_gainmap(handle, mUseMultiChannelGainMap))
-  RET_IF_ERR(uhdr_enc_set_gainmap_scale_factor(handle, mMapDimensionScaleFactor))
-  RET_IF_ERR(uhdr_enc_set_gainmap_gamma(handle, mGamma))
-  RET_IF_ERR(uhdr_enc_set_preset(handle, mEncPreset))
-  if (mMinContentBoost != FLT_MIN || mMaxContentBoost != FLT_MAX) {
-    RET_IF_ERR(uhdr_enc_set_min_max_content_boost(handle, mMinContentBoost, mMaxContentBoost))
-  }
-  if (mTargetDispPeakBrightness != -1.0f) {
-    RET_IF_ERR(uhdr_enc_set_target_display_peak_brightness(handle, mTargetDispPeakBrightness))
-  }
-  if (mEnableGLES) {
-    RET_IF_ERR(uhdr_enable_gpu_acceleration(handle, mEnableGLES))
-  }
+  RET_IF_ERR(setUpEncoder(handle))
 #ifdef PROFILE_ENABLE
   Profiler profileEncode;
   profileEncode.timerStart();
 #endif
+#ifdef _WIN32
   RET_IF_ERR(uhdr_encode(handle))
+#else
+  // the encoder writes the stream to the output file itself
+  int outFd = open(mOutputFile, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+  if (outFd < 0) {
+    std::cerr << "unable to write to file : " << mOutputFile << std::endl;
+    uhdr_release_encoder(handle);
+    return false;
+  }
+  uhdr_error_info_t encodeStatus = uhdr_enc_set_output_fd(handle, outFd);
+  if (encodeStatus.error_code == UHDR_CODEC_OK) encodeStatus = uhdr_encode(handle);
+  close(outFd);
+  RET_IF_ERR(encodeStatus)
+#endif
 #ifdef PROFILE_ENABLE
   profileEncode.timerStop();
   auto avgEncTime = profileEncode.elapsedTime() / 1000.f;
@@ -780,14 +834,20 @@ bool UltraHdrAppInput::encode() {
   mUhdrImage.range = output->range;
   uhdr_release_encoder(handle);
 
+#ifdef _WIN32
   return writeFile(mOutputFile, mUhdrImage.data, mUhdrImage.data_sz);
+#else
+  return true;
+#endif
 }
 
 bool UltraHdrAppInput::decode() {
+#ifdef _WIN32
   if (mMode == 1 && !fillUhdrImageHandle()) {
     std::cerr << " failed to load file " << mUhdrFile << std::endl;
     return false;
   }
+#endif
 
 #define RET_IF_ERR(x)                            \
   {                                              \
@@ -802,7 +862,23 @@ bool UltraHdrAppInput::decode() {
   }
 
   uhdr_codec_private_t* handle = uhdr_create_decoder();
-  RET_IF_ERR(uhdr_dec_set_image(handle, &mUhdrImage))
+#ifndef _WIN32
+  if (mMode == 1) {
+    // the file is decoded from a read-only mapping rather than read into memory
+    int inFd = open(mUhdrFile, O_RDONLY);
+    if (inFd < 0) {
+      std::cerr << " failed to load file " << mUhdrFile << std::endl;
+      uhdr_release_decoder(handle);
+      return false;
+    }
+    uhdr_error_info_t setStatus = uhdr_dec_set_image_fd(handle, inFd);
+    close(inFd);
+    RET_IF_ERR(setStatus)
+  } else
+#endif
+  {
+    RET_IF_ERR(uhdr_dec_set_image(handle, &mUhdrImage))
+  }
   RET_IF_ERR(uhdr_dec_set_out_color_transfer(handle, mOTf))
   RET_IF_ERR(uhdr_dec_set_out_img_format(handle, mOfmt))
   if (mEnableGLES) {
@@ -855,6 +931,112 @@ bool UltraHdrAppInput::decode() {
   return mMode == 1 ? writeFile(mOutputFile, &mDecodedUhdrRgbImage) : true;
 }
 
+static const char* kStageNames[UHDR_STAGE_COUNT] = {
+    "tone map",       "gainmap generate", "color convert", "base compress", "gainmap compress",
+    "gainmap append", "base decode",      "gainmap decode", "gainmap apply"};
+
+// Runs the encode or decode of the current mode repeatedly in this process. The first
+// kBenchWarmupRuns calls prime caches, pools and the gpu context and are not reported.
+static const int kBenchWarmupRuns = 2;
+
+bool UltraHdrAppInput::benchmark(int iterations) {
+  const bool isEncode = mMode == 0;
+  if (!isEncode && mUhdrImage.data == nullptr && !fillUhdrImageHandle()) {
+    std::cerr << " failed to load file " << mUhdrFile << std::endl;
+    return false;
+  }
+
+  // image dimensions, from the stream for encodings that take compressed inputs only
+  unsigned int width = 0, height = 0;
+  {
+    uhdr_codec_private_t* dec = uhdr_create_decoder();
+    if (uhdr_dec_set_image(dec, &mUhdrImage).error_code == UHDR_CODEC_OK &&
+        uhdr_dec_probe(dec).error_code == UHDR_CODEC_OK) {
+      width = uhdr_dec_get_image_width(dec);
+      height = uhdr_dec_get_image_height(dec);
+    }
+    uhdr_release_decoder(dec);
+  }
+
+  std::vector<double> wallMs;
+  double cpuMs = 0.0;
+  double stageMs[UHDR_STAGE_COUNT] = {};
+  unsigned int stageCalls[UHDR_STAGE_COUNT] = {};
+  size_t peakBytes = 0;
+  for (int i = -kBenchWarmupRuns; i < iterations; i++) {
+    uhdr_codec_private_t* handle = isEncode ? uhdr_create_encoder() : uhdr_create_decoder();
+    uhdr_error_info_t status = uhdr_enable_stats(handle, 1);
+    if (status.error_code == UHDR_CODEC_OK) {
+      if (isEncode) {
+        status = setUpEncoder(handle);
+      } else {
+        status = uhdr_dec_set_image(handle, &mUhdrImage);
+        if (status.error_code == UHDR_CODEC_OK) {
+          status = uhdr_dec_set_out_color_transfer(handle, mOTf);
+        }
+        if (status.error_code == UHDR_CODEC_OK) {
+          status = uhdr_dec_set_out_img_format(handle, mOfmt);
+        }
+        if (status.error_code == UHDR_CODEC_OK && mEnableGLES) {
+          status = uhdr_enable_gpu_acceleration(handle, mEnableGLES);
+        }
+      }
+    }
+    if (status.error_code == UHDR_CODEC_OK) {
+      status = isEncode ? uhdr_encode(handle) : uhdr_decode(handle);
+    }
+    if (status.error_code != UHDR_CODEC_OK) {
+      if (status.has_detail) std::cerr << status.detail << std::endl;
+      if (isEncode) {
+        uhdr_release_encoder(handle);
+      } else {
+        uhdr_release_decoder(handle);
+      }
+      return false;
+    }
+    uhdr_codec_stats_t* stats = isEncode ? uhdr_enc_get_stats(handle) : uhdr_dec_get_stats(handle);
+    if (i >= 0 && stats != nullptr) {
+      wallMs.push_back(stats->wall_ms);
+      cpuMs += stats->cpu_ms;
+      for (int j = 0; j < UHDR_STAGE_COUNT; j++) {
+        stageMs[j] += stats->stages[j].wall_ms;
+        stageCalls[j] += stats->stages[j].calls;
+      }
+      peakBytes = (std::max)(peakBytes, stats->peak_bytes);
+    }
+    if (isEncode) {
+      uhdr_release_encoder(handle);
+    } else {
+      uhdr_release_decoder(handle);
+    }
+  }
+  if (wallMs.empty()) return true;
+
+  const size_t runs = wallMs.size();
+  std::sort(wallMs.begin(), wallMs.end());
+  const double minMs = wallMs.front();
+  const double medianMs =
+      runs % 2 ? wallMs[runs / 2] : (wallMs[runs / 2 - 1] + wallMs[runs / 2]) / 2.0;
+  const double p99Ms = wallMs[(std::min)(runs - 1, (size_t)std::ceil(0.99 * runs) - 1)];
+  const double megaPixels = (double)width * height / 1e6;
+
+  printf("%s benchmark, res %u x %u, %zu runs after %d warmup runs \n",
+         isEncode ? "encode" : "decode", width, height, runs, kBenchWarmupRuns);
+  printf("  latency ms : min %.3f, median %.3f, p99 %.3f \n", minMs, medianMs, p99Ms);
+  printf("  cpu ms     : mean %.3f \n", cpuMs / runs);
+  if (medianMs > 0.0) {
+    printf("  throughput : %.2f MP/s at median latency \n", megaPixels * 1000.0 / medianMs);
+  }
+  printf("  peak image buffer bytes : %zu \n", peakBytes);
+  printf("  mean stage times ms : \n");
+  for (int j = 0; j < UHDR_STAGE_COUNT; j++) {
+    if (stageCalls[j] == 0) continue;
+    printf("    %-18s %10.3f  (%.1f calls per run) \n", kStageNames[j], stageMs[j] / runs,
+           (double)stageCalls[j] / runs);
+  }
+  return true;
+}
+
 #define CLIP3(x, min, max) ((x) < (min)) ? (min) : ((x) > (max)) ? (max) : (x)
 bool UltraHdrAppInput::convertP010ToRGBImage() {
   const float* coeffs = BT2020YUVtoRGBMatrix;
@@ -1384,7 +1566,7 @@ void UltraHdrAppInput::computeYUVSdrPSNR() {
 static void usage(const char* name) {
   fprintf(stderr, "\n## ultra hdr demo application. lib version: v%s \nUsage : %s \n",
           UHDR_LIB_VERSION_STR, name);
-  fprintf(stderr, "    -m    mode of operation. [0:encode, 1:decode] \n");
+  fprintf(stderr, "    -m    mode of operation. [0:encode, 1:decode, 2:batch] \n");
   fprintf(stderr, "\n## encoder options : \n");
   fprintf(stderr,
           "    -p    raw hdr intent input resource (10-bit), required for encoding scenarios 0, 1, "
@@ -1457,16 +1639,29 @@ static void usage(const char* name) {
       "    -o    output transfer function, optional. [0:linear, 1:hlg (default), 2:pq, 3:srgb] \n");
   fprintf(
       stderr,
-      "    -O    output color format, optional. [3:rgba8888, 4:rgbahalffloat, 5:rgba1010102 "
-      "(default)] \n"
+      "    -O    output color format, optional. [0:p010, 3:rgba8888, 4:rgbahalffloat, "
+      "5:rgba1010102 (default)] \n"
       "          It should be noted that not all combinations of output color format and output \n"
       "          transfer function are supported. \n"
       "          srgb output color transfer shall be paired with rgba8888 only. \n"
-      "          hlg, pq shall be paired with rgba1010102. \n"
+      "          hlg, pq shall be paired with rgba1010102 or p010. \n"
       "          linear shall be paired with rgbahalffloat. \n");
   fprintf(stderr,
           "    -u    enable gles acceleration, optional. [0:disable (default), 1:enable]. \n");
+  fprintf(stderr, "\n## batch options : \n");
+  fprintf(stderr,
+          "    -l    batch manifest, required. a file or '-' for stdin, with one job per \n"
+          "          line given as the options of an encode or decode ('-m 0 ...' or \n"
+          "          '-m 1 ...'), or a directory whose files are each decoded to '<file>.raw'. \n"
+          "          options of the batch command line other than resources are the defaults \n"
+          "          of every job. \n");
+  fprintf(stderr,
+          "    -n    images in flight, optional. [any positive integer (cpu count : default)] \n");
   fprintf(stderr, "\n## common options : \n");
+  fprintf(stderr,
+          "    -B    benchmark iterations, optional. runs the encode or decode this many times \n"
+          "          after warmup and prints min/median/p99 latency, throughput and mean stage \n"
+          "          times. [0:disable (default), any positive integer]. \n");
   fprintf(stderr,
           "    -z    output filename, optional. \n"
           "          in encoding mode, default output filename 'out.jpeg'. \n"
@@ -1532,14 +1727,27 @@ static void usage(const char* name) {
   fprintf(stderr, "    ultrahdr_app -m 1 -j cosmat_1920x1080_hdr.jpg \n");
   fprintf(stderr, "    ultrahdr_app -m 1 -j cosmat_1920x1080_hdr.jpg -o 3 -O 3\n");
   fprintf(stderr, "    ultrahdr_app -m 1 -j cosmat_1920x1080_hdr.jpg -o 1 -O 5\n");
+  fprintf(stderr, "\n## benchmark :\n");
+  fprintf(stderr,
+          "    ultrahdr_app -m 0 -p cosmat_1920x1080_p010.yuv -w 1920 -h 1080 -a 0 -B 20\n");
+  fprintf(stderr, "    ultrahdr_app -m 1 -j cosmat_1920x1080_hdr.jpg -B 20\n");
+  fprintf(stderr, "\n## batch :\n");
+  fprintf(stderr, "    ultrahdr_app -m 2 -l jobs.txt -n 4\n");
+  fprintf(stderr, "    ultrahdr_app -m 2 -l photos/ -o 3 -O 3\n");
+  fprintf(stderr, "    cat jobs.txt | ultrahdr_app -m 2 -l - -u 1\n");
   fprintf(stderr, "\n");
 }
 
-int main(int argc, char* argv[]) {
-  char opt_string[] = "p:y:i:g:f:w:h:C:c:t:q:o:O:m:j:e:a:b:z:R:s:M:Q:G:x:u:D:k:K:L:";
-  char *hdr_intent_raw_file = nullptr, *sdr_intent_raw_file = nullptr, *uhdr_file = nullptr,
-       *sdr_intent_compressed_file = nullptr, *gainmap_compressed_file = nullptr,
-       *gainmap_metadata_cfg_file = nullptr, *output_file = nullptr, *exif_file = nullptr;
+// Options of one run, from the command line or from a job line of a batch manifest
+struct AppOptions {
+  char* hdr_intent_raw_file = nullptr;
+  char* sdr_intent_raw_file = nullptr;
+  char* uhdr_file = nullptr;
+  char* sdr_intent_compressed_file = nullptr;
+  char* gainmap_compressed_file = nullptr;
+  char* gainmap_metadata_cfg_file = nullptr;
+  char* output_file = nullptr;
+  char* exif_file = nullptr;
   int width = 0, height = 0;
   uhdr_color_gamut_t hdr_cg = UHDR_CG_DISPLAY_P3;
   uhdr_color_gamut_t sdr_cg = UHDR_CG_BT_709;
@@ -1561,151 +1769,390 @@ int main(int argc, char* argv[]) {
   float min_content_boost = FLT_MIN;
   float max_content_boost = FLT_MAX;
   float target_disp_peak_brightness = -1.0f;
+  int bench_iterations = 0;
+  char* batch_manifest = nullptr;
+  int batch_inflight = 0;
+};
+
+static bool parseOptions(int argc, char* argv[], AppOptions& o) {
+  char opt_string[] = "p:y:i:g:f:w:h:C:c:t:q:o:O:m:j:e:a:b:z:R:s:M:Q:G:x:u:D:k:K:L:B:l:n:";
   int ch;
+  optind_s = 1;
   while ((ch = getopt_s(argc, argv, opt_string)) != -1) {
     switch (ch) {
       case 'a':
-        hdr_cf = static_cast<uhdr_img_fmt_t>(atoi(optarg_s));
+        o.hdr_cf = static_cast<uhdr_img_fmt_t>(atoi(optarg_s));
         break;
       case 'b':
-        sdr_cf = static_cast<uhdr_img_fmt_t>(atoi(optarg_s));
+        o.sdr_cf = static_cast<uhdr_img_fmt_t>(atoi(optarg_s));
         break;
       case 'p':
-        hdr_intent_raw_file = optarg_s;
+        o.hdr_intent_raw_file = optarg_s;
         break;
       case 'y':
-        sdr_intent_raw_file = optarg_s;
+        o.sdr_intent_raw_file = optarg_s;
         break;
       case 'i':
-        sdr_intent_compressed_file = optarg_s;
+        o.sdr_intent_compressed_file = optarg_s;
         break;
       case 'g':
-        gainmap_compressed_file = optarg_s;
+        o.gainmap_compressed_file = optarg_s;
         break;
       case 'f':
-        gainmap_metadata_cfg_file = optarg_s;
+        o.gainmap_metadata_cfg_file = optarg_s;
         break;
       case 'w':
-        width = atoi(optarg_s);
+        o.width = atoi(optarg_s);
         break;
       case 'h':
-        height = atoi(optarg_s);
+        o.height = atoi(optarg_s);
         break;
       case 'C':
-        hdr_cg = static_cast<uhdr_color_gamut_t>(atoi(optarg_s));
+        o.hdr_cg = static_cast<uhdr_color_gamut_t>(atoi(optarg_s));
         break;
       case 'c':
-        sdr_cg = static_cast<uhdr_color_gamut_t>(atoi(optarg_s));
+        o.sdr_cg = static_cast<uhdr_color_gamut_t>(atoi(optarg_s));
         break;
       case 't':
-        hdr_tf = static_cast<uhdr_color_transfer_t>(atoi(optarg_s));
+        o.hdr_tf = static_cast<uhdr_color_transfer_t>(atoi(optarg_s));
         break;
       case 'q':
-        quality = atoi(optarg_s);
+        o.quality = atoi(optarg_s);
         break;
       case 'O':
-        out_cf = static_cast<uhdr_img_fmt_t>(atoi(optarg_s));
+        o.out_cf = static_cast<uhdr_img_fmt_t>(atoi(optarg_s));
         break;
       case 'o':
-        out_tf = static_cast<uhdr_color_transfer_t>(atoi(optarg_s));
+        o.out_tf = static_cast<uhdr_color_transfer_t>(atoi(optarg_s));
         break;
       case 'm':
-        mode = atoi(optarg_s);
+        o.mode = atoi(optarg_s);
         break;
       case 'R':
-        use_full_range_color_hdr = atoi(optarg_s) == 1 ? true : false;
+        o.use_full_range_color_hdr = atoi(optarg_s) == 1 ? true : false;
         break;
       // TODO
       /*case 'r':
-        use_full_range_color_sdr = atoi(optarg_s) == 1 ? true : false;
+        o.use_full_range_color_sdr = atoi(optarg_s) == 1 ? true : false;
         break;*/
       case 's':
-        gainmap_scale_factor = atoi(optarg_s);
+        o.gainmap_scale_factor = atoi(optarg_s);
         break;
       case 'M':
-        use_multi_channel_gainmap = atoi(optarg_s) == 1 ? true : false;
+        o.use_multi_channel_gainmap = atoi(optarg_s) == 1 ? true : false;
         break;
       case 'Q':
-        gainmap_compression_quality = atoi(optarg_s);
+        o.gainmap_compression_quality = atoi(optarg_s);
         break;
       case 'G':
-        gamma = (float)atof(optarg_s);
+        o.gamma = (float)atof(optarg_s);
         break;
       case 'j':
-        uhdr_file = optarg_s;
+        o.uhdr_file = optarg_s;
         break;
       case 'e':
-        compute_psnr = atoi(optarg_s);
+        o.compute_psnr = atoi(optarg_s);
         break;
       case 'z':
-        output_file = optarg_s;
+        o.output_file = optarg_s;
         break;
       case 'x':
-        exif_file = optarg_s;
+        o.exif_file = optarg_s;
         break;
       case 'u':
-        enable_gles = atoi(optarg_s) == 1 ? true : false;
+        o.enable_gles = atoi(optarg_s) == 1 ? true : false;
         break;
       case 'D':
-        enc_preset = static_cast<uhdr_enc_preset_t>(atoi(optarg_s));
+        o.enc_preset = static_cast<uhdr_enc_preset_t>(atoi(optarg_s));
         break;
       case 'k':
-        min_content_boost = (float)atof(optarg_s);
+        o.min_content_boost = (float)atof(optarg_s);
         break;
       case 'K':
-        max_content_boost = (float)atof(optarg_s);
+        o.max_content_boost = (float)atof(optarg_s);
         break;
       case 'L':
-        target_disp_peak_brightness = (float)atof(optarg_s);
+        o.target_disp_peak_brightness = (float)atof(optarg_s);
+        break;
+      case 'B':
+        o.bench_iterations = atoi(optarg_s);
+        break;
+      case 'l':
+        o.batch_manifest = optarg_s;
+        break;
+      case 'n':
+        o.batch_inflight = atoi(optarg_s);
         break;
       default:
-        usage(argv[0]);
-        return -1;
+        return false;
     }
   }
-  if (mode == 0) {
-    if (width <= 0 && gainmap_metadata_cfg_file == nullptr) {
-      std::cerr << "did not receive valid image width for encoding. width :  " << width
-                << std::endl;
-      return -1;
+  return true;
+}
+
+static bool checkEncodeOptions(const AppOptions& o) {
+  if (o.width <= 0 && o.gainmap_metadata_cfg_file == nullptr) {
+    std::cerr << "did not receive valid image width for encoding. width :  " << o.width
+              << std::endl;
+    return false;
+  }
+  if (o.height <= 0 && o.gainmap_metadata_cfg_file == nullptr) {
+    std::cerr << "did not receive valid image height for encoding. height :  " << o.height
+              << std::endl;
+    return false;
+  }
+  if (o.hdr_intent_raw_file == nullptr &&
+      (o.sdr_intent_compressed_file == nullptr || o.gainmap_compressed_file == nullptr ||
+       o.gainmap_metadata_cfg_file == nullptr)) {
+    std::cerr << "did not receive raw resources for encoding." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static bool checkDecodeOptions(const AppOptions& o) {
+  if (o.uhdr_file == nullptr) {
+    std::cerr << "did not receive resources for decoding " << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static std::unique_ptr<UltraHdrAppInput> createEncodeInput(const AppOptions& o) {
+  return std::make_unique<UltraHdrAppInput>(
+      o.hdr_intent_raw_file, o.sdr_intent_raw_file, o.sdr_intent_compressed_file,
+      o.gainmap_compressed_file, o.gainmap_metadata_cfg_file, o.exif_file,
+      o.output_file ? o.output_file : "out.jpeg", o.width, o.height, o.hdr_cf, o.sdr_cf, o.hdr_cg,
+      o.sdr_cg, o.hdr_tf, o.quality, o.out_tf, o.out_cf, o.use_full_range_color_hdr,
+      o.gainmap_scale_factor, o.gainmap_compression_quality, o.use_multi_channel_gainmap, o.gamma,
+      o.enable_gles, o.enc_preset, o.min_content_boost, o.max_content_boost,
+      o.target_disp_peak_brightness);
+}
+
+static std::unique_ptr<UltraHdrAppInput> createDecodeInput(const AppOptions& o) {
+  return std::make_unique<UltraHdrAppInput>(o.gainmap_metadata_cfg_file, o.uhdr_file,
+                                            o.output_file ? o.output_file : "outrgb.raw",
+                                            o.out_tf, o.out_cf, o.enable_gles);
+}
+
+// One encode or decode of a batch. The options point into the tokens of the job line.
+struct BatchJob {
+  size_t id;
+  std::string line;
+  std::vector<std::string> tokens;
+  AppOptions options;
+};
+
+// Jobs in the order they are read, handed to the workers as they arrive so that a manifest read
+// from a pipe is processed while the producer is still writing it.
+class BatchQueue {
+ public:
+  void push(std::unique_ptr<BatchJob> job) {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mJobs.push_back(std::move(job));
     }
-    if (height <= 0 && gainmap_metadata_cfg_file == nullptr) {
-      std::cerr << "did not receive valid image height for encoding. height :  " << height
-                << std::endl;
-      return -1;
+    mCv.notify_one();
+  }
+
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mClosed = true;
     }
-    if (hdr_intent_raw_file == nullptr &&
-        (sdr_intent_compressed_file == nullptr || gainmap_compressed_file == nullptr ||
-         gainmap_metadata_cfg_file == nullptr)) {
-      std::cerr << "did not receive raw resources for encoding." << std::endl;
-      return -1;
+    mCv.notify_all();
+  }
+
+  // nullptr once the queue is closed and drained
+  std::unique_ptr<BatchJob> pop() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mCv.wait(lock, [this] { return mClosed || !mJobs.empty(); });
+    if (mJobs.empty()) return nullptr;
+    std::unique_ptr<BatchJob> job = std::move(mJobs.front());
+    mJobs.pop_front();
+    return job;
+  }
+
+ private:
+  std::mutex mMutex;
+  std::condition_variable mCv;
+  std::deque<std::unique_ptr<BatchJob>> mJobs;
+  bool mClosed = false;
+};
+
+struct BatchTotals {
+  std::mutex mutex;
+  size_t ok = 0, failed = 0;
+  size_t encodes = 0, decodes = 0;
+  double megaPixels = 0.0;
+};
+
+static void runBatchJob(const BatchJob& job, BatchTotals& totals) {
+  const AppOptions& o = job.options;
+  bool ok = false;
+  double megaPixels = 0.0;
+  if (o.mode == 0 && checkEncodeOptions(o)) {
+    ok = createEncodeInput(o)->encode();
+    megaPixels = (double)o.width * o.height / 1e6;
+  } else if (o.mode == 1 && checkDecodeOptions(o)) {
+    std::unique_ptr<UltraHdrAppInput> input = createDecodeInput(o);
+    ok = input->decode();
+    megaPixels = (double)input->mDecodedUhdrRgbImage.w * input->mDecodedUhdrRgbImage.h / 1e6;
+  } else if (o.mode != 0 && o.mode != 1) {
+    std::cerr << "batch jobs take mode 0 or 1, received " << o.mode << std::endl;
+  }
+
+  std::lock_guard<std::mutex> lock(totals.mutex);
+  if (ok) {
+    totals.ok++;
+    (o.mode == 0 ? totals.encodes : totals.decodes)++;
+    totals.megaPixels += megaPixels;
+  } else {
+    totals.failed++;
+  }
+  // one result line per job, for drivers that feed the manifest through a pipe
+  printf("%s %zu %s \n", ok ? "ok" : "failed", job.id, job.line.c_str());
+  fflush(stdout);
+}
+
+// Parses the options of a job. Options missing from them are taken from the command line of the
+// batch, except for the resources of an image.
+static std::unique_ptr<BatchJob> parseBatchJob(size_t id, std::vector<std::string> tokens,
+                                               const AppOptions& defaults) {
+  std::unique_ptr<BatchJob> job = std::make_unique<BatchJob>();
+  job->id = id;
+  job->tokens = std::move(tokens);
+  std::vector<char*> argv;
+  argv.push_back(const_cast<char*>("job"));
+  for (std::string& t : job->tokens) {
+    job->line += (job->line.empty() ? "" : " ") + t;
+    argv.push_back(&t[0]);
+  }
+  job->options = defaults;
+  AppOptions& o = job->options;
+  o.hdr_intent_raw_file = o.sdr_intent_raw_file = o.uhdr_file = nullptr;
+  o.sdr_intent_compressed_file = o.gainmap_compressed_file = o.gainmap_metadata_cfg_file = nullptr;
+  o.output_file = o.exif_file = o.batch_manifest = nullptr;
+  o.mode = -1;
+  if (!parseOptions((int)argv.size(), argv.data(), o)) o.mode = -1;
+  return job;
+}
+
+// Runs the encodes and decodes of a manifest with up to `inflight` images in flight. The library
+// tables, thread pool and gpu context are set up once and shared by all jobs of the process.
+static int runBatch(const AppOptions& opts) {
+  if (opts.batch_manifest == nullptr) {
+    std::cerr << "did not receive a manifest for batch mode " << std::endl;
+    return -1;
+  }
+  int inflight = opts.batch_inflight;
+  if (inflight <= 0) inflight = (std::max)(1u, std::thread::hardware_concurrency());
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+  inflight = 1;
+#endif
+
+  uhdr_preload(opts.enable_gles ? UHDR_PRELOAD_ALL : UHDR_PRELOAD_TABLES | UHDR_PRELOAD_THREADS);
+
+  BatchQueue queue;
+  BatchTotals totals;
+  std::vector<std::thread> workers;
+  if (inflight > 1) {
+    for (int i = 0; i < inflight; i++) {
+      workers.emplace_back([&queue, &totals] {
+        while (std::unique_ptr<BatchJob> job = queue.pop()) runBatchJob(*job, totals);
+      });
+    }
+  }
+  auto submit = [&](std::unique_ptr<BatchJob> job) {
+    if (workers.empty()) {
+      runBatchJob(*job, totals);
+    } else {
+      queue.push(std::move(job));
+    }
+  };
+
+  const auto start = std::chrono::steady_clock::now();
+  size_t id = 0;
+  bool readOk = true;
+  std::error_code ec;
+  const std::string manifest = opts.batch_manifest;
+  if (manifest != "-" && std::filesystem::is_directory(manifest, ec)) {
+    // every file of the directory is decoded next to itself
+    std::vector<std::string> files;
+    for (const auto& entry : std::filesystem::directory_iterator(manifest, ec)) {
+      if (entry.is_regular_file(ec)) files.push_back(entry.path().string());
+    }
+    std::sort(files.begin(), files.end());
+    for (const std::string& file : files) {
+      if (file.size() > 4 && file.compare(file.size() - 4, 4, ".raw") == 0) continue;
+      submit(parseBatchJob(id++, {"-m", "1", "-j", file, "-z", file + ".raw"}, opts));
+    }
+  } else {
+    std::ifstream ifs;
+    if (manifest != "-") {
+      ifs.open(manifest);
+      if (!ifs.good()) {
+        std::cerr << "unable to open manifest " << manifest << std::endl;
+        readOk = false;
+      }
     }
-    UltraHdrAppInput appInput(
-        hdr_intent_raw_file, sdr_intent_raw_file, sdr_intent_compressed_file,
-        gainmap_compressed_file, gainmap_metadata_cfg_file, exif_file,
-        output_file ? output_file : "out.jpeg", width, height, hdr_cf, sdr_cf, hdr_cg, sdr_cg,
-        hdr_tf, quality, out_tf, out_cf, use_full_range_color_hdr, gainmap_scale_factor,
-        gainmap_compression_quality, use_multi_channel_gainmap, gamma, enable_gles, enc_preset,
-        min_content_boost, max_content_boost, target_disp_peak_brightness);
+    std::istream& in = manifest == "-" ? std::cin : ifs;
+    std::string line;
+    while (readOk && std::getline(in, line)) {
+      const size_t first = line.find_first_not_of(" \t\r");
+      if (first == std::string::npos || line[first] == '#') continue;
+      std::istringstream iss(line);
+      std::vector<std::string> tokens;
+      std::string token;
+      while (iss >> token) tokens.push_back(token);
+      submit(parseBatchJob(id++, std::move(tokens), opts));
+    }
+  }
+  queue.close();
+  for (std::thread& worker : workers) worker.join();
+  const double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  printf("batch : %zu jobs, %zu ok (%zu encodes, %zu decodes), %zu failed, %d in flight \n", id,
+         totals.ok, totals.encodes, totals.decodes, totals.failed, inflight);
+  if (seconds > 0.0) {
+    printf("  wall %.3f s, %.2f images/s, %.2f MP/s \n", seconds, totals.ok / seconds,
+           totals.megaPixels / seconds);
+  }
+  return readOk && totals.failed == 0 ? 0 : -1;
+}
+
+int main(int argc, char* argv[]) {
+  AppOptions opts;
+  if (!parseOptions(argc, argv, opts)) {
+    usage(argv[0]);
+    return -1;
+  }
+  if (opts.mode == 0) {
+    if (!checkEncodeOptions(opts)) return -1;
+    std::unique_ptr<UltraHdrAppInput> input = createEncodeInput(opts);
+    UltraHdrAppInput& appInput = *input;
     if (!appInput.encode()) return -1;
-    if (compute_psnr == 1) {
+    if (opts.bench_iterations > 0 && !appInput.benchmark(opts.bench_iterations)) return -1;
+    if (opts.compute_psnr == 1) {
       if (!appInput.decode()) return -1;
-      if (out_cf == UHDR_IMG_FMT_32bppRGBA8888 && sdr_intent_raw_file != nullptr) {
-        if (sdr_cf == UHDR_IMG_FMT_12bppYCbCr420) {
+      if (opts.out_cf == UHDR_IMG_FMT_32bppRGBA8888 && opts.sdr_intent_raw_file != nullptr) {
+        if (opts.sdr_cf == UHDR_IMG_FMT_12bppYCbCr420) {
           appInput.convertYuv420ToRGBImage();
         }
         appInput.computeRGBSdrPSNR();
-        if (sdr_cf == UHDR_IMG_FMT_12bppYCbCr420) {
+        if (opts.sdr_cf == UHDR_IMG_FMT_12bppYCbCr420) {
           appInput.convertRgba8888ToYUV444Image();
           appInput.computeYUVSdrPSNR();
         }
-      } else if (out_cf == UHDR_IMG_FMT_32bppRGBA1010102 && hdr_intent_raw_file != nullptr &&
-                 hdr_cf != UHDR_IMG_FMT_64bppRGBAHalfFloat) {
-        if (hdr_cf == UHDR_IMG_FMT_24bppYCbCrP010) {
+      } else if (opts.out_cf == UHDR_IMG_FMT_32bppRGBA1010102 &&
+                 opts.hdr_intent_raw_file != nullptr &&
+                 opts.hdr_cf != UHDR_IMG_FMT_64bppRGBAHalfFloat) {
+        if (opts.hdr_cf == UHDR_IMG_FMT_24bppYCbCrP010) {
           appInput.convertP010ToRGBImage();
         }
         appInput.computeRGBHdrPSNR();
-        if (hdr_cf == UHDR_IMG_FMT_24bppYCbCrP010) {
+        if (opts.hdr_cf == UHDR_IMG_FMT_24bppYCbCrP010) {
           appInput.convertRgba1010102ToYUV444Image();
           appInput.computeYUVHdrPSNR();
         }
@@ -1713,17 +2160,15 @@ int main(int argc, char* argv[]) {
         std::cerr << "failed to compute psnr " << std::endl;
       }
     }
-  } else if (mode == 1) {
-    if (uhdr_file == nullptr) {
-      std::cerr << "did not receive resources for decoding " << std::endl;
-      return -1;
-    }
-    UltraHdrAppInput appInput(gainmap_metadata_cfg_file, uhdr_file,
-                              output_file ? output_file : "outrgb.raw", out_tf, out_cf,
-                              enable_gles);
-    if (!appInput.decode()) return -1;
+  } else if (opts.mode == 1) {
+    if (!checkDecodeOptions(opts)) return -1;
+    std::unique_ptr<UltraHdrAppInput> input = createDecodeInput(opts);
+    if (!input->decode()) return -1;
+    if (opts.bench_iterations > 0 && !input->benchmark(opts.bench_iterations)) return -1;
+  } else if (opts.mode == 2) {
+    return runBatch(opts);
   } else {
-    if (argc > 1) std::cerr << "did not receive valid mode of operation " << mode << std::endl;
+    if (argc > 1) std::cerr << "did not receive valid mode of operation " << opts.mode << std::endl;
     usage(argv[0]);
     return -1;
   }
@@ -24,8 +24,9 @@ mkdir -p ${build_dir}
 pushd ${build_dir}
 
 cmake $SRC/libultrahdr -DUHDR_BUILD_FUZZERS=1 -DUHDR_MAX_DIMENSION=1280
-make -j$(nproc) ultrahdr_dec_fuzzer ultrahdr_enc_fuzzer ultrahdr_legacy_fuzzer
+make -j$(nproc) ultrahdr_dec_fuzzer ultrahdr_enc_fuzzer ultrahdr_legacy_fuzzer ultrahdr_cost_fuzzer
 cp ${build_dir}/ultrahdr_dec_fuzzer $OUT/
 cp ${build_dir}/ultrahdr_enc_fuzzer $OUT/
 cp ${build_dir}/ultrahdr_legacy_fuzzer $OUT/
+cp ${build_dir}/ultrahdr_cost_fuzzer $OUT/
 popd
@@ -0,0 +1,154 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Decodes inputs with the codec stats enabled and aborts on any whose cost per output pixel is over
+// budget, so that libFuzzer keeps it as a finding. Crashes are left to ultrahdr_dec_fuzzer, this
+// one looks for inputs that are valid enough to decode but take far longer or far more memory per
+// pixel than a regular image does: extreme gain map ratios, huge metadata packets, tiny restart
+// intervals and the like.
+//
+// The budget of a decode is
+//   cpu time   <= UHDR_COST_FIXED_MS + UHDR_COST_MS_PER_MP * megapixels
+//   allocated  <= UHDR_COST_FIXED_BYTES + UHDR_COST_BYTES_PER_PIXEL * pixels
+// where pixels are those of the base image, or of the output once a decode got that far. Each
+// limit is read from the environment variable of its name, the defaults leave room for sanitizer
+// builds. With UHDR_COST_REPORT set, the figures of every input are printed, which turns the
+// binary run over a corpus directory into a benchmark of the cost per pixel.
+
+#include <fuzzer/FuzzedDataProvider.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "ultrahdr_api.h"
+#include "ultrahdr/ultrahdrcommon.h"
+
+using namespace ultrahdr;
+
+// Transfer functions for image data, sync with ultrahdr.h
+constexpr int kTfMin = UHDR_CT_LINEAR;
+constexpr int kTfMax = UHDR_CT_SRGB;
+
+// default budget, a regular decode of an unsanitized build stays well below a tenth of it
+constexpr double kDefaultFixedMs = 200.0;
+constexpr double kDefaultMsPerMegapixel = 4000.0;
+constexpr double kDefaultFixedBytes = 16.0 * 1024 * 1024;
+constexpr double kDefaultBytesPerPixel = 64.0;
+
+static double budgetFromEnv(const char* name, double fallback) {
+  const char* value = getenv(name);
+  if (value == nullptr || *value == '\0') return fallback;
+  char* end = nullptr;
+  double parsed = strtod(value, &end);
+  return (end != value && parsed >= 0.0) ? parsed : fallback;
+}
+
+struct CostBudget {
+  double fixedMs = budgetFromEnv("UHDR_COST_FIXED_MS", kDefaultFixedMs);
+  double msPerMegapixel = budgetFromEnv("UHDR_COST_MS_PER_MP", kDefaultMsPerMegapixel);
+  double fixedBytes = budgetFromEnv("UHDR_COST_FIXED_BYTES", kDefaultFixedBytes);
+  double bytesPerPixel = budgetFromEnv("UHDR_COST_BYTES_PER_PIXEL", kDefaultBytesPerPixel);
+  bool report = getenv("UHDR_COST_REPORT") != nullptr;
+};
+
+// indexed by uhdr_codec_stage
+static const char* kStageNames[UHDR_STAGE_COUNT] = {
+    "tone map",        "gain map generate", "color convert",
+    "base compress",   "gain map compress", "gain map append",
+    "base decode",     "gain map decode",   "gain map apply"};
+
+class UltraHdrCostFuzzer {
+ public:
+  UltraHdrCostFuzzer(const uint8_t* data, size_t size) : mFdp(data, size) {};
+  void process();
+
+ private:
+  static const CostBudget& budget() {
+    static const CostBudget kBudget;
+    return kBudget;
+  }
+
+  FuzzedDataProvider mFdp;
+};
+
+void UltraHdrCostFuzzer::process() {
+  auto output_ct =
+      static_cast<uhdr_color_transfer>(mFdp.ConsumeIntegralInRange<int8_t>(kTfMin, kTfMax));
+  auto displayBoost = mFdp.ConsumeFloatingPointInRange<float>(1.0f, 100.0f);
+  auto buffer = mFdp.ConsumeRemainingBytes<uint8_t>();
+
+  uhdr_compressed_image_t jpegImgR{
+      buffer.data(),       (unsigned int)buffer.size(), (unsigned int)buffer.size(),
+      UHDR_CG_UNSPECIFIED, UHDR_CT_UNSPECIFIED,         UHDR_CR_UNSPECIFIED};
+
+  uhdr_codec_private_t* dec_handle = uhdr_create_decoder();
+  if (dec_handle == nullptr) return;
+  uhdr_enable_stats(dec_handle, 1);
+  uhdr_dec_set_image(dec_handle, &jpegImgR);
+  uhdr_dec_set_out_color_transfer(dec_handle, output_ct);
+  if (output_ct == UHDR_CT_LINEAR)
+    uhdr_dec_set_out_img_format(dec_handle, UHDR_IMG_FMT_64bppRGBAHalfFloat);
+  else if (output_ct == UHDR_CT_SRGB)
+    uhdr_dec_set_out_img_format(dec_handle, UHDR_IMG_FMT_32bppRGBA8888);
+  else
+    uhdr_dec_set_out_img_format(dec_handle, UHDR_IMG_FMT_32bppRGBA1010102);
+  uhdr_dec_set_out_max_display_boost(dec_handle, displayBoost);
+
+  // no probe ahead of the decode, so that the parsing of the headers is part of its figures
+  uhdr_error_info_t status = uhdr_decode(dec_handle);
+  const uhdr_codec_stats_t* stats = uhdr_dec_get_stats(dec_handle);
+  if (stats == nullptr) {
+    uhdr_release_decoder(dec_handle);
+    return;
+  }
+
+  double pixels = 0.0;
+  if (uhdr_raw_image_t* output = uhdr_get_decoded_image(dec_handle)) {
+    pixels = (double)output->w * output->h;
+  } else {
+    const int width = uhdr_dec_get_image_width(dec_handle);
+    const int height = uhdr_dec_get_image_height(dec_handle);
+    if (width > 0 && height > 0) pixels = (double)width * height;
+  }
+  const CostBudget& limits = budget();
+  const double msBudget = limits.fixedMs + limits.msPerMegapixel * pixels / 1e6;
+  const double bytesBudget = limits.fixedBytes + limits.bytesPerPixel * pixels;
+  const bool overBudget = stats->cpu_ms > msBudget || (double)stats->bytes_allocated > bytesBudget;
+
+  if (limits.report || overBudget) {
+    fprintf(stderr,
+            "cost: %zu input bytes, %.0f output pixels, status %d, cpu %.2f ms (budget %.2f), "
+            "wall %.2f ms, %zu bytes allocated (budget %.0f), %u allocations\n",
+            buffer.size(), pixels, (int)status.error_code, stats->cpu_ms, msBudget,
+            stats->wall_ms, stats->bytes_allocated, bytesBudget, stats->num_allocations);
+    for (int i = 0; i < UHDR_STAGE_COUNT; i++) {
+      if (stats->stages[i].calls == 0) continue;
+      fprintf(stderr, "  %-18s cpu %9.2f ms  wall %9.2f ms  calls %u\n", kStageNames[i],
+              stats->stages[i].cpu_ms, stats->stages[i].wall_ms, stats->stages[i].calls);
+    }
+  }
+  uhdr_release_decoder(dec_handle);
+  if (overBudget) {
+    fprintf(stderr, "cost: input is over budget\n");
+    abort();
+  }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  UltraHdrCostFuzzer fuzzHandle(data, size);
+  fuzzHandle.process();
+  return 0;
+}
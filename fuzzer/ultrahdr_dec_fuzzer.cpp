@@ -57,6 +57,8 @@ void UltraHdrDecFuzzer::process() {
   auto applyResize = mFdp.ConsumeBool();
   int resizeWidth = mFdp.ConsumeIntegralInRange<int32_t>(-32, kMaxWidth + 128);
   int resizeHeight = mFdp.ConsumeIntegralInRange<int32_t>(-32, kMaxHeight + 128);
+  auto resizeFilter = static_cast<uhdr_resize_filter_t>(
+      mFdp.ConsumeIntegralInRange<int8_t>(UHDR_RESIZE_NEAREST - 1, UHDR_RESIZE_LANCZOS + 1));
 
   auto buffer = mFdp.ConsumeRemainingBytes<uint8_t>();
 
@@ -90,7 +92,9 @@ void UltraHdrDecFuzzer::process() {
     if (applyMirror) ON_ERR(uhdr_add_effect_mirror(dec_handle, direction))
     if (applyRotate) ON_ERR(uhdr_add_effect_rotate(dec_handle, degrees))
     if (applyCrop) ON_ERR(uhdr_add_effect_crop(dec_handle, left, right, top, bottom))
-    if (applyResize) ON_ERR(uhdr_add_effect_resize(dec_handle, resizeWidth, resizeHeight))
+    if (applyResize)
+      ON_ERR(uhdr_add_effect_resize_with_filter(dec_handle, resizeWidth, resizeHeight,
+                                                resizeFilter))
     uhdr_dec_probe(dec_handle);
     auto width = uhdr_dec_get_image_width(dec_handle);
     auto height = uhdr_dec_get_image_height(dec_handle);
@@ -108,7 +112,8 @@ void UltraHdrDecFuzzer::process() {
       ALOGV("added crop effect, crop-left %d, crop-right %d, crop-top %d, crop-bottom %d", left,
             right, top, bottom);
     if (applyResize)
-      ALOGV("added resize effect, resize wd %d, resize ht %d", resizeWidth, resizeHeight);
+      ALOGV("added resize effect, resize wd %d, resize ht %d, filter %d", resizeWidth, resizeHeight,
+            resizeFilter);
 
     uhdr_dec_get_exif(dec_handle);
     uhdr_dec_get_icc(dec_handle);
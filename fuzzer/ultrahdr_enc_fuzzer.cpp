@@ -175,6 +175,8 @@ void UltraHdrEncFuzzer::process() {
     auto applyResize = mFdp.ConsumeBool();
     int resizeWidth = mFdp.ConsumeIntegralInRange<int32_t>(-32, kMaxWidth + 128);
     int resizeHeight = mFdp.ConsumeIntegralInRange<int32_t>(-32, kMaxHeight + 128);
+    auto resizeFilter = static_cast<uhdr_resize_filter_t>(
+        mFdp.ConsumeIntegralInRange<int8_t>(UHDR_RESIZE_NEAREST - 1, UHDR_RESIZE_LANCZOS + 1));
 
     // exif
     char greeting[] = "Exif says hello world";
@@ -205,7 +207,8 @@ void UltraHdrEncFuzzer::process() {
       ALOGV("added crop effect, crop-left %d, crop-right %d, crop-top %d, crop-bottom %d", left,
             right, top, bottom);
     if (applyResize)
-      ALOGV("added resize effect, resize wd %d, resize ht %d", resizeWidth, resizeHeight);
+      ALOGV("added resize effect, resize wd %d, resize ht %d, filter %d", resizeWidth, resizeHeight,
+            resizeFilter);
 
     std::unique_ptr<uint64_t[]> bufferFpHdr = nullptr;
     std::unique_ptr<uint32_t[]> bufferHdr = nullptr;
@@ -369,7 +372,9 @@ void UltraHdrEncFuzzer::process() {
     if (applyMirror) ON_ERR(uhdr_add_effect_mirror(enc_handle, direction))
     if (applyRotate) ON_ERR(uhdr_add_effect_rotate(enc_handle, degrees))
     if (applyCrop) ON_ERR(uhdr_add_effect_crop(enc_handle, left, right, top, bottom))
-    if (applyResize) ON_ERR(uhdr_add_effect_resize(enc_handle, resizeWidth, resizeHeight))
+    if (applyResize)
+      ON_ERR(uhdr_add_effect_resize_with_filter(enc_handle, resizeWidth, resizeHeight,
+                                                resizeFilter))
 
     uhdr_error_info_t status = {UHDR_CODEC_OK, 0, ""};
     if (muxSwitch == 0 || muxSwitch == 1) {  // api 0 or api 1
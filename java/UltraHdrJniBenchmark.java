@@ -0,0 +1,209 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+import static com.google.media.codecs.ultrahdr.UltraHDRCommon.*;
+
+import java.io.File;
+import java.io.FileInputStream;
+import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.util.Arrays;
+
+import com.google.media.codecs.ultrahdr.UltraHDRDecoder;
+import com.google.media.codecs.ultrahdr.UltraHDRDecoder.RawImage;
+
+/**
+ * Measures what the Java wrapper adds on top of the native decoder: the cost of crossing the JNI
+ * boundary per call and the cost of handing the decoded pixels to Java. Each case runs a number
+ * of warm up iterations, so that the JIT has compiled the Java side, before the timed ones. The
+ * decode case times the same work as BM_UHDRDecode of the native benchmark, run both on the same
+ * input with the same output transfer and format to read off the wrapper overhead.
+ */
+public class UltraHdrJniBenchmark {
+    private static final int JNI_CALLS_PER_ITERATION = 100000;
+
+    private final byte[] mUhdrData;
+    private final int mOTF;
+    private final int mOfmt;
+    private final int mWarmup;
+    private final int mIterations;
+
+    public UltraHdrJniBenchmark(byte[] uhdrData, int oTF, int oFmt, int warmup, int iterations) {
+        mUhdrData = uhdrData;
+        mOTF = oTF;
+        mOfmt = oFmt;
+        mWarmup = warmup;
+        mIterations = iterations;
+    }
+
+    private interface Case {
+        void run(UltraHDRDecoder decoder) throws IOException;
+    }
+
+    private void configure(UltraHDRDecoder decoder) throws IOException {
+        decoder.reset();
+        decoder.setCompressedImage(mUhdrData, mUhdrData.length, UHDR_CG_UNSPECIFIED,
+                UHDR_CT_UNSPECIFIED, UHDR_CR_UNSPECIFIED);
+        decoder.setColorTransfer(mOTF);
+        decoder.setOutputFormat(mOfmt);
+    }
+
+    /**
+     * Runs a case and returns the times of its timed iterations in milliseconds, sorted
+     */
+    private double[] time(UltraHDRDecoder decoder, Case c) throws IOException {
+        double[] ms = new double[mIterations];
+        for (int i = 0; i < mWarmup + mIterations; i++) {
+            long start = System.nanoTime();
+            c.run(decoder);
+            long end = System.nanoTime();
+            if (i >= mWarmup) ms[i - mWarmup] = (end - start) / 1e6;
+        }
+        Arrays.sort(ms);
+        return ms;
+    }
+
+    private static void report(String name, double[] ms, double pixels, double reference) {
+        double median = ms[ms.length / 2];
+        String line = String.format("%-34s min %9.3f ms  median %9.3f ms  %8.2f MP/s", name, ms[0],
+                median, pixels / (median * 1e3));
+        if (reference > 0) {
+            line += String.format("  +%.3f ms over decode", median - reference);
+        }
+        System.out.println(line);
+    }
+
+    public void run() throws Exception {
+        try (UltraHDRDecoder decoder = new UltraHDRDecoder()) {
+            configure(decoder);
+            decoder.probe();
+            final int width = decoder.getImageWidth();
+            final int height = decoder.getImageHeight();
+            final double pixels = (double) width * height;
+            final int bpp = mOfmt == UHDR_IMG_FMT_64bppRGBAHalfFloat ? 8 : 4;
+            System.out.println(String.format("input %d bytes, %dx%d, %s", mUhdrData.length, width,
+                    height, getVersionString()));
+
+            // a native call that does no work past fetching the instance handle
+            double[] ms = time(decoder, d -> {
+                for (int i = 0; i < JNI_CALLS_PER_ITERATION; i++) d.getImageWidth();
+            });
+            System.out.println(String.format("%-34s median %9.1f ns per call", "jni call",
+                    ms[ms.length / 2] * 1e6 / JNI_CALLS_PER_ITERATION));
+
+            ms = time(decoder, d -> {
+                configure(d);
+                d.decode();
+            });
+            final double decodeMs = ms[ms.length / 2];
+            report("decode", ms, pixels, 0);
+
+            // native storage to a new byte array, then to a new int or long array
+            ms = time(decoder, d -> {
+                configure(d);
+                d.decode();
+                d.getDecodedImage();
+            });
+            report("decode, getDecodedImage()", ms, pixels, decodeMs);
+
+            // native storage straight into an array held across the calls
+            final RawImage[] reuse = new RawImage[1];
+            ms = time(decoder, d -> {
+                configure(d);
+                d.decode();
+                reuse[0] = d.getDecodedImage(reuse[0]);
+            });
+            report("decode, getDecodedImage(reuse)", ms, pixels, decodeMs);
+
+            // no copy, the decoder writes into the buffer
+            final ByteBuffer direct =
+                    ByteBuffer.allocateDirect(width * height * bpp).order(ByteOrder.nativeOrder());
+            ms = time(decoder, d -> {
+                configure(d);
+                d.setOutputBuffer(direct, mOfmt, width, height, width);
+                d.decode();
+            });
+            report("decode into direct buffer", ms, pixels, decodeMs);
+        }
+    }
+
+    public static void usage() {
+        System.out.println("\n## uhdr jni benchmark usage : \n");
+        System.out.println("    -i    ultrahdr image to decode, required.");
+        System.out.println("    -o    output transfer function, optional. [0:linear,"
+                + " 1:hlg (default), 2:pq, 3:srgb]");
+        System.out.println("    -O    output color format, optional. [3:rgba8888, 4:rgbahalffloat,"
+                + " 5:rgba1010102 (default)]");
+        System.out.println("    -w    warm up iterations per case, optional. [default: 10]");
+        System.out.println("    -n    timed iterations per case, optional. [default: 20]");
+        System.out.println("\n## example :");
+        System.out.println("    java -Djava.library.path=<path> -cp uhdr-java.jar:"
+                + "uhdr-java-benchmark.jar UltraHdrJniBenchmark -i ultrahdr.jpeg -o 3 -O 3\n");
+    }
+
+    public static void main(String[] args) throws Exception {
+        String uhdr_file = null;
+        int out_tf = UHDR_CT_HLG;
+        int out_cf = UHDR_IMG_FMT_32bppRGBA1010102;
+        int warmup = 10;
+        int iterations = 20;
+
+        for (int i = 0; i < args.length; i++) {
+            if (args[i].length() == 2 && args[i].charAt(0) == '-' && i + 1 < args.length) {
+                switch (args[i].charAt(1)) {
+                    case 'i':
+                        uhdr_file = args[++i];
+                        break;
+                    case 'o':
+                        out_tf = Integer.parseInt(args[++i]);
+                        break;
+                    case 'O':
+                        out_cf = Integer.parseInt(args[++i]);
+                        break;
+                    case 'w':
+                        warmup = Integer.parseInt(args[++i]);
+                        break;
+                    case 'n':
+                        iterations = Integer.parseInt(args[++i]);
+                        break;
+                    default:
+                        usage();
+                        return;
+                }
+            } else {
+                usage();
+                return;
+            }
+        }
+        if (uhdr_file == null || warmup < 0 || iterations <= 0) {
+            usage();
+            return;
+        }
+
+        File file = new File(uhdr_file);
+        byte[] data = new byte[(int) file.length()];
+        try (FileInputStream stream = new FileInputStream(file)) {
+            int read = 0;
+            while (read < data.length) {
+                int n = stream.read(data, read, data.length - read);
+                if (n < 0) throw new IOException("unexpected end of file " + uhdr_file);
+                read += n;
+            }
+        }
+        new UltraHdrJniBenchmark(data, out_tf, out_cf, warmup, iterations).run();
+    }
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+import static com.google.media.codecs.ultrahdr.UltraHDRCommon.*;
+
+import java.io.IOException;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.TimeUnit;
+
+import com.google.media.codecs.ultrahdr.UltraHDRDecoder;
+import com.google.media.codecs.ultrahdr.UltraHDREncoder;
+
+/**
+ * Checks of the Java wrapper that the native unit tests can not cover, run by ctest. Exits with
+ * a non zero status on the first failing check.
+ */
+public class UltraHdrJniTest {
+    // large enough that a single threaded encode or decode is still running when the next call
+    // is made
+    private static final int WIDTH = 4096;
+    private static final int HEIGHT = 2048;
+    private static final int ATTEMPTS = 5;
+    private static final long TIMEOUT_SECONDS = 120;
+
+    private interface AsyncCall<T> {
+        CompletableFuture<T> start() throws IOException;
+    }
+
+    private static void check(boolean cond, String msg) {
+        if (!cond) {
+            throw new AssertionError(msg);
+        }
+    }
+
+    private static void configureEncoder(UltraHDREncoder encoder, int[] hdr) throws IOException {
+        encoder.reset();
+        encoder.setRawImage(hdr, WIDTH, HEIGHT, WIDTH, UHDR_CG_BT2100, UHDR_CT_HLG,
+                UHDR_CR_FULL_RANGE, UHDR_IMG_FMT_32bppRGBA1010102, UHDR_HDR_IMG);
+        encoder.setNumThreads(1);
+    }
+
+    /**
+     * A second asynchronous call while the first is in flight is rejected, and the future of the
+     * first one still completes normally. Returns whether a rejection was observed, the first
+     * call may have finished before the second was made.
+     */
+    private static <T> boolean rejectsCallInFlight(AsyncCall<T> call) throws Exception {
+        CompletableFuture<T> first = call.start();
+        boolean rejected = false;
+        CompletableFuture<T> second = null;
+        try {
+            second = call.start();
+        } catch (IOException e) {
+            rejected = true;
+        }
+        first.get(TIMEOUT_SECONDS, TimeUnit.SECONDS);
+        if (second != null) {
+            check(first.isDone(), "second call accepted while the first was in flight");
+            second.get(TIMEOUT_SECONDS, TimeUnit.SECONDS);
+        }
+        return rejected;
+    }
+
+    private static byte[] testEncodeAsyncInFlight(int[] hdr) throws Exception {
+        try (UltraHDREncoder encoder = new UltraHDREncoder()) {
+            boolean rejected = false;
+            for (int i = 0; i < ATTEMPTS && !rejected; i++) {
+                configureEncoder(encoder, hdr);
+                rejected = rejectsCallInFlight(encoder::encodeAsync);
+            }
+            check(rejected, "encode finished before a second call could be made");
+            byte[] output = encoder.getOutput();
+            check(output != null && output.length > 0, "no output after the asynchronous encode");
+            return output;
+        }
+    }
+
+    private static void testDecodeAsyncInFlight(byte[] uhdr) throws Exception {
+        try (UltraHDRDecoder decoder = new UltraHDRDecoder()) {
+            boolean rejected = false;
+            for (int i = 0; i < ATTEMPTS && !rejected; i++) {
+                decoder.reset();
+                decoder.setCompressedImage(uhdr, uhdr.length, UHDR_CG_UNSPECIFIED,
+                        UHDR_CT_UNSPECIFIED, UHDR_CR_UNSPECIFIED);
+                decoder.setOutputFormat(UHDR_IMG_FMT_64bppRGBAHalfFloat);
+                decoder.setColorTransfer(UHDR_CT_LINEAR);
+                decoder.setNumThreads(1);
+                rejected = rejectsCallInFlight(decoder::decodeAsync);
+            }
+            check(rejected, "decode finished before a second call could be made");
+            check(decoder.getImageWidth() == WIDTH, "unexpected width after the asynchronous decode");
+        }
+    }
+
+    public static void main(String[] args) throws Exception {
+        // a horizontal ramp, packed 10 bit rgb with opaque alpha
+        int[] hdr = new int[WIDTH * HEIGHT];
+        for (int y = 0; y < HEIGHT; y++) {
+            for (int x = 0; x < WIDTH; x++) {
+                int v = x * 1023 / (WIDTH - 1);
+                hdr[y * WIDTH + x] = (3 << 30) | (v << 20) | (v << 10) | v;
+            }
+        }
+        byte[] uhdr = testEncodeAsyncInFlight(hdr);
+        testDecodeAsyncInFlight(uhdr);
+        System.out.println("all checks passed");
+    }
+}
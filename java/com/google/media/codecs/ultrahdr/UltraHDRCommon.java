@@ -198,6 +198,32 @@ public class UltraHDRCommon {
      */
     public static final int UHDR_GAIN_MAP_IMG = 3;
 
+    // Fields describing the slower code paths counted by the stats of a decode
+    /**
+     * Gain map applied without a vector row kernel
+     */
+    public static final int UHDR_SLOW_PATH_SCALAR_APPLY = 0;
+
+    /**
+     * Gain map sampled at a fractional map scale factor
+     */
+    public static final int UHDR_SLOW_PATH_FRACTIONAL_SCALE = 1;
+
+    /**
+     * Gain map resized for an aspect ratio off the base image
+     */
+    public static final int UHDR_SLOW_PATH_GAINMAP_RESIZE = 2;
+
+    /**
+     * Gpu acceleration enabled, work of the call ran on the cpu
+     */
+    public static final int UHDR_SLOW_PATH_GPU_FALLBACK = 3;
+
+    /**
+     * Strided image staged through a contiguous copy for the gpu
+     */
+    public static final int UHDR_SLOW_PATH_BUFFER_COPY = 4;
+
     private UltraHDRCommon() {
     }
 
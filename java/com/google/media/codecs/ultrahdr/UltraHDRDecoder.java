@@ -28,6 +28,7 @@ import static com.google.media.codecs.ultrahdr.UltraHDRCommon.UHDR_IMG_FMT_UNSPE
 import java.io.IOException;
 import java.nio.ByteBuffer;
 import java.nio.ByteOrder;
+import java.util.concurrent.CompletableFuture;
 
 /**
  * Ultra HDR decoding utility class.
@@ -173,6 +174,7 @@ public class UltraHDRDecoder implements AutoCloseable {
      */
     @Override
     public void close() throws Exception {
+        awaitPending();
         destroy();
         resetState();
     }
@@ -227,6 +229,43 @@ public class UltraHDRDecoder implements AutoCloseable {
         setOutputFormatNative(fmt);
     }
 
+    /**
+     * Set a caller owned direct {@link ByteBuffer} for the decoded image. When set,
+     * {@link UltraHDRDecoder#decode()} writes the final image straight into the buffer's native
+     * storage, starting at index 0, in native byte order. No intermediate copy is made and no
+     * Java array is allocated. The decoder keeps a reference to the buffer until
+     * {@link UltraHDRDecoder#reset()}. {@link UltraHDRDecoder#getDecodedImage()} remains usable,
+     * it returns a copy of the buffer contents.
+     *
+     * @param buff   direct buffer receiving the decoded image. Its capacity must be at least
+     *               stride * height * bytes per pixel
+     * @param fmt    color format of the buffer, must match the value configured via
+     *               {@link UltraHDRDecoder#setOutputFormat(int)}
+     * @param width  image width, must match the decoded image width
+     * @param height image height, must match the decoded image height
+     * @param stride buffer stride in pixels, must be >= width
+     * @throws IOException If parameters are not valid or current decoder instance is not valid
+     *                     or current decoder instance is not suitable for configuration
+     *                     exception is thrown
+     */
+    public void setOutputBuffer(ByteBuffer buff, int fmt, int width, int height, int stride)
+            throws IOException {
+        if (buff == null) {
+            throw new IOException("received null for output buffer handle");
+        }
+        if (!buff.isDirect()) {
+            throw new IOException("received non-direct buffer for output buffer handle");
+        }
+        if (width <= 0 || height <= 0) {
+            throw new IOException("received bad width and/or height, width or height is <= 0");
+        }
+        if (stride < width) {
+            throw new IOException("received bad stride, stride is < width");
+        }
+        setOutputBufferNative(buff, fmt, width, height, stride);
+        outputBuffer = buff;
+    }
+
     /**
      * Set output image color transfer characteristics. It should be noted that not all
      * combinations of output color format and output transfer function are supported.
@@ -260,6 +299,20 @@ public class UltraHDRDecoder implements AutoCloseable {
         setMaxDisplayBoostNative(displayBoost);
     }
 
+    /**
+     * Set number of threads used for decoding. The count includes the calling thread. If this is
+     * not configured or is set to 0, the library picks a value based on the number of cores
+     * available.
+     *
+     * @param numThreads number of threads. Any integer in range [0, 256]
+     * @throws IOException If parameters are not valid or current decoder instance is not valid
+     *                     or current decoder instance is not suitable for configuration
+     *                     exception is thrown
+     */
+    public void setNumThreads(int numThreads) throws IOException {
+        setNumThreadsNative(numThreads);
+    }
+
     /**
      * Enable/Disable GPU acceleration. If enabled, certain operations (if possible) of uhdr
      * decode will be offloaded to GPU.
@@ -274,6 +327,29 @@ public class UltraHDRDecoder implements AutoCloseable {
         enableGpuAccelerationNative(enable);
     }
 
+    /**
+     * Enable/Disable the collection of stats for the decode calls, see
+     * {@link UltraHDRDecoder#getSlowPathCounts()}. Collection is disabled by default.
+     *
+     * @param enable enable/disable stats collection
+     * @throws IOException If current decoder instance is not valid exception is thrown.
+     */
+    public void enableStats(int enable) throws IOException {
+        enableStatsNative(enable);
+    }
+
+    /**
+     * Get the number of times the last decode took each of the slower code paths, indexed by the
+     * UHDR_SLOW_PATH_* constants of {@link UltraHDRCommon}. Counts that stay above zero across
+     * the decodes of a device point at inputs or a platform that miss the fast paths.
+     *
+     * @return slow path counts, or null if stats are not enabled or no decode was made since
+     * @throws IOException If current decoder instance is not valid exception is thrown.
+     */
+    public int[] getSlowPathCounts() throws IOException {
+        return getSlowPathCountsNative();
+    }
+
     /**
      * This function parses the bitstream that is registered with the decoder context and makes
      * image information available to the client via getter functions. It does not decompress the
@@ -400,6 +476,66 @@ public class UltraHDRDecoder implements AutoCloseable {
         decodeNative();
     }
 
+    /**
+     * Asynchronous decode process call.
+     * <p>
+     * Queues {@link UltraHDRDecoder#decode()} on the library's shared thread pool and returns
+     * without waiting for it. The returned future completes with this decoder once the decode has
+     * finished, or exceptionally with an {@link IOException} if it failed. The future is
+     * completed on a pool thread, dependent stages that are not given an executor run there.
+     * <p>
+     * Until the future is complete the decoder must not be configured or queried, only
+     * {@link UltraHDRDecoder#reset()} and {@link UltraHDRDecoder#close()} may be called, they
+     * wait for the decode. With an output buffer set, see
+     * {@link UltraHDRDecoder#setOutputBuffer(ByteBuffer, int, int, int, int)}, the decoded image
+     * is in the buffer on completion and no copy to a Java array is made.
+     *
+     * @return future of the decode
+     * @throws IOException If the current decoder instance is not valid or an asynchronous decode
+     *                     of it is already in flight, exception is thrown
+     */
+    public CompletableFuture<UltraHDRDecoder> decodeAsync() throws IOException {
+        CompletableFuture<UltraHDRDecoder> previous = pending;
+        if (previous != null && !previous.isDone()) {
+            throw new IOException("an asynchronous decode of this instance is already in flight");
+        }
+        CompletableFuture<UltraHDRDecoder> future = new CompletableFuture<>();
+        pending = future;
+        try {
+            decodeAsyncNative(future);
+        } catch (IOException e) {
+            pending = previous;
+            throw e;
+        }
+        return future;
+    }
+
+    /**
+     * Decode a batch of images. Each decoder is configured as for
+     * {@link UltraHDRDecoder#decode()}, the images are then decoded concurrently on the library's
+     * shared thread pool, and the call returns once all of them are done. A decoder whose number
+     * of threads is not configured decodes its image on a single thread, as the images of the
+     * batch rather than the rows of an image are spread across the cores. The outputs are
+     * accessed per decoder as after {@link UltraHDRDecoder#decode()}.
+     *
+     * @param decoders decoder instances, each at most once
+     * @throws IOException If the batch is not valid or any of its images fails to decode,
+     *                     exception is thrown with the error of the first failing decoder
+     */
+    public static void decodeBatch(UltraHDRDecoder... decoders) throws IOException {
+        if (decoders == null || decoders.length == 0) {
+            throw new IOException("received empty batch of decoder instances");
+        }
+        long[] handles = new long[decoders.length];
+        for (int i = 0; i < decoders.length; i++) {
+            if (decoders[i] == null) {
+                throw new IOException("received null for decoder instance of the batch");
+            }
+            handles[i] = decoders[i].handle;
+        }
+        decodeBatchNative(handles);
+    }
+
     /**
      * Get decoded image data
      *
@@ -434,6 +570,65 @@ public class UltraHDRDecoder implements AutoCloseable {
         return null;
     }
 
+    /**
+     * Get decoded image data into caller owned storage. Unlike
+     * {@link UltraHDRDecoder#getDecodedImage()}, no storage is allocated if {@code reuse} can
+     * hold the image, which lets a caller decoding a stream of images recycle one descriptor:
+     * pass the descriptor returned for the previous image back in. The pixels are copied once,
+     * straight from the decoder's native storage into the descriptor's data array.
+     * <p>
+     * The descriptor is reused if it is a {@link RawImage64} for
+     * {@link UltraHDRCommon#UHDR_IMG_FMT_64bppRGBAHalfFloat} output, or a {@link RawImage32} for
+     * the 4 bytes-per-pixel formats, and its data array holds at least stride * height pixels.
+     * Otherwise a new descriptor is allocated. The nativeOrderBuffer field of the result is null.
+     *
+     * @param reuse descriptor to decode into, may be null
+     * @return Raw image descriptor containing decoded image data, {@code reuse} if it was
+     * reused
+     * @throws IOException If {@link UltraHDRDecoder#decode()} is not called or decoding process
+     *                     is not successful, exception is thrown
+     */
+    public RawImage getDecodedImage(RawImage reuse) throws IOException {
+        getDecodedImageInfoNative();
+        int size = imgStride * imgHeight;
+        RawImage img;
+        if (imgFormat == UHDR_IMG_FMT_64bppRGBAHalfFloat) {
+            RawImage64 img64 = null;
+            if (reuse instanceof RawImage64 && ((RawImage64) reuse).data != null
+                    && ((RawImage64) reuse).data.length >= size) {
+                img64 = (RawImage64) reuse;
+            } else {
+                img64 = new RawImage64(null, imgFormat, imgGamut, imgTransfer, imgRange,
+                        imgWidth, imgHeight, new long[size], imgStride);
+            }
+            copyDecodedImageNative(img64.data);
+            img = img64;
+        } else if (imgFormat == UHDR_IMG_FMT_32bppRGBA8888
+                || imgFormat == UHDR_IMG_FMT_32bppRGBA1010102) {
+            RawImage32 img32 = null;
+            if (reuse instanceof RawImage32 && ((RawImage32) reuse).data != null
+                    && ((RawImage32) reuse).data.length >= size) {
+                img32 = (RawImage32) reuse;
+            } else {
+                img32 = new RawImage32(null, imgFormat, imgGamut, imgTransfer, imgRange,
+                        imgWidth, imgHeight, new int[size], imgStride);
+            }
+            copyDecodedImageNative(img32.data);
+            img = img32;
+        } else {
+            return null;
+        }
+        img.nativeOrderBuffer = null;
+        img.fmt = imgFormat;
+        img.cg = imgGamut;
+        img.ct = imgTransfer;
+        img.range = imgRange;
+        img.w = imgWidth;
+        img.h = imgHeight;
+        img.stride = imgStride;
+        return img;
+    }
+
     /**
      * Get decoded gainmap image data
      *
@@ -465,15 +660,22 @@ public class UltraHDRDecoder implements AutoCloseable {
     /**
      * Reset decoder instance. Clears all previous settings and resets to default state and ready
      * for re-initialization and usage.
+     * <p>
+     * The native instance keeps the storage it has grown, for instance its decode buffers, so
+     * decoding a series of images of similar size with one instance, reset in between, avoids
+     * the allocations of creating a new instance per image.
      *
      * @throws IOException If the current decoder instance is not valid exception is thrown.
      */
     public void reset() throws IOException {
+        awaitPending();
         resetNative();
         resetState();
     }
 
     private void resetState() {
+        outputBuffer = null;
+
         maxContentBoost = 1.0f;
         minContentBoost = 1.0f;
         gamma = 1.0f;
@@ -501,6 +703,34 @@ public class UltraHDRDecoder implements AutoCloseable {
         gainmapFormat = UHDR_IMG_FMT_UNSPECIFIED;
     }
 
+    /**
+     * Waits for the future of an asynchronous decode, so that the native instance is not reset
+     * or released before its completion has run
+     */
+    private void awaitPending() {
+        CompletableFuture<UltraHDRDecoder> future = pending;
+        if (future != null) {
+            try {
+                future.join();
+            } catch (RuntimeException e) {
+                // the failure is reported to the holders of the future
+            }
+            pending = null;
+        }
+    }
+
+    /**
+     * Completion of {@link UltraHDRDecoder#decodeAsyncNative(CompletableFuture)}, called on a pool thread
+     * with the future of that call
+     */
+    private void onAsyncDone(CompletableFuture<UltraHDRDecoder> future, int errorCode, String detail) {
+        if (errorCode == 0) {
+            future.complete(this);
+        } else {
+            future.completeExceptionally(new IOException(detail));
+        }
+    }
+
     private static native int isUHDRImageNative(byte[] data, int size) throws IOException;
 
     private native void init() throws IOException;
@@ -512,12 +742,21 @@ public class UltraHDRDecoder implements AutoCloseable {
 
     private native void setOutputFormatNative(int fmt) throws IOException;
 
+    private native void setOutputBufferNative(ByteBuffer buff, int fmt, int width, int height,
+            int stride) throws IOException;
+
     private native void setColorTransferNative(int ct) throws IOException;
 
     private native void setMaxDisplayBoostNative(float displayBoost) throws IOException;
 
+    private native void setNumThreadsNative(int numThreads) throws IOException;
+
     private native void enableGpuAccelerationNative(int enable) throws IOException;
 
+    private native void enableStatsNative(int enable) throws IOException;
+
+    private native int[] getSlowPathCountsNative() throws IOException;
+
     private native void probeNative() throws IOException;
 
     private native int getImageWidthNative() throws IOException;
@@ -540,8 +779,19 @@ public class UltraHDRDecoder implements AutoCloseable {
 
     private native void decodeNative() throws IOException;
 
+    private native void decodeAsyncNative(CompletableFuture<UltraHDRDecoder> future)
+            throws IOException;
+
+    private static native void decodeBatchNative(long[] handles) throws IOException;
+
     private native byte[] getDecodedImageNative() throws IOException;
 
+    private native void getDecodedImageInfoNative() throws IOException;
+
+    private native void copyDecodedImageNative(int[] dst) throws IOException;
+
+    private native void copyDecodedImageNative(long[] dst) throws IOException;
+
     private native byte[] getDecodedGainMapImageNative() throws IOException;
 
     private native void resetNative() throws IOException;
@@ -551,6 +801,16 @@ public class UltraHDRDecoder implements AutoCloseable {
      */
     private long handle;
 
+    /**
+     * Caller owned output buffer. Held so that its native storage outlives the decode.
+     */
+    private ByteBuffer outputBuffer;
+
+    /**
+     * Future of the asynchronous decode in flight, if any
+     */
+    private volatile CompletableFuture<UltraHDRDecoder> pending;
+
     /**
      * gainmap metadata fields. Filled by {@link UltraHDRDecoder#getGainmapMetadataNative()}
      */
@@ -563,7 +823,8 @@ public class UltraHDRDecoder implements AutoCloseable {
     private float hdrCapacityMax;
 
     /**
-     * decoded image fields. Filled by {@link UltraHDRDecoder#getDecodedImageNative()}
+     * decoded image fields. Filled by {@link UltraHDRDecoder#getDecodedImageNative()} and
+     * {@link UltraHDRDecoder#getDecodedImageInfoNative()}
      */
     private byte[] decodedDataNativeOrder;
     private int[] decodedDataInt32;
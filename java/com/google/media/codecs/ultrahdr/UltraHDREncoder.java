@@ -16,13 +16,17 @@
 
 package com.google.media.codecs.ultrahdr;
 
+import static com.google.media.codecs.ultrahdr.UltraHDRCommon.UHDR_HDR_IMG;
 import static com.google.media.codecs.ultrahdr.UltraHDRCommon.UHDR_IMG_FMT_12bppYCbCr420;
 import static com.google.media.codecs.ultrahdr.UltraHDRCommon.UHDR_IMG_FMT_24bppYCbCrP010;
 import static com.google.media.codecs.ultrahdr.UltraHDRCommon.UHDR_IMG_FMT_32bppRGBA1010102;
 import static com.google.media.codecs.ultrahdr.UltraHDRCommon.UHDR_IMG_FMT_32bppRGBA8888;
 import static com.google.media.codecs.ultrahdr.UltraHDRCommon.UHDR_IMG_FMT_64bppRGBAHalfFloat;
+import static com.google.media.codecs.ultrahdr.UltraHDRCommon.UHDR_SDR_IMG;
 
 import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.util.concurrent.CompletableFuture;
 
 /**
  * Ultra HDR encoding utility class.
@@ -75,6 +79,7 @@ public class UltraHDREncoder implements AutoCloseable {
      */
     @Override
     public void close() throws Exception {
+        awaitPending();
         destroy();
     }
 
@@ -240,6 +245,136 @@ public class UltraHDREncoder implements AutoCloseable {
                 colorTransfer, colorRange, colorFormat, intent);
     }
 
+    /**
+     * Add raw image info to encoder context. This interface is used for adding packed formats
+     * held in a direct {@link ByteBuffer}. Unlike the array variants, the pixels are not copied.
+     * The encoder reads them in place from the buffer's native storage, so the buffer contents
+     * must not be modified until {@link UltraHDREncoder#encode()} returns. The encoder keeps a
+     * reference to the buffer until the next call for the same intent or until
+     * {@link UltraHDREncoder#reset()}. The pixel data is read from index 0 of the buffer, its
+     * position and limit are ignored.
+     *
+     * @param rgbBuff       direct buffer holding the pixels in native byte order
+     * @param width         image width
+     * @param height        image height
+     * @param rgbStride     rgb buffer stride in pixels
+     * @param colorGamut    color gamut of input image
+     * @param colorTransfer color transfer of input image
+     * @param colorRange    color range of input image
+     * @param colorFormat   color format of input image
+     * @param intent        {@link UltraHDRCommon#UHDR_HDR_IMG} for hdr intent,
+     *                      {@link UltraHDRCommon#UHDR_SDR_IMG} for sdr intent
+     * @throws IOException If parameters are not valid or current encoder instance is not valid
+     *                     or current encoder instance is not suitable for configuration
+     *                     exception is thrown
+     */
+    public void setRawImage(ByteBuffer rgbBuff, int width, int height, int rgbStride,
+            int colorGamut, int colorTransfer, int colorRange, int colorFormat, int intent)
+            throws IOException {
+        checkDirectBuffer(rgbBuff);
+        if (width <= 0 || height <= 0) {
+            throw new IOException("received bad width and/or height, width or height is <= 0");
+        }
+        if (rgbStride <= 0) {
+            throw new IOException("received bad stride, stride is <= 0");
+        }
+        if (colorFormat != UHDR_IMG_FMT_32bppRGBA8888
+                && colorFormat != UHDR_IMG_FMT_32bppRGBA1010102
+                && colorFormat != UHDR_IMG_FMT_64bppRGBAHalfFloat) {
+            throw new IOException("received unsupported color format. supported color formats are"
+                    + "{UHDR_IMG_FMT_32bppRGBA8888, UHDR_IMG_FMT_32bppRGBA1010102, "
+                    + "UHDR_IMG_FMT_64bppRGBAHalfFloat}");
+        }
+        setRawImageDirectNative(rgbBuff, null, null, width, height, rgbStride, 0, 0, colorGamut,
+                colorTransfer, colorRange, colorFormat, intent);
+        holdRawImage(intent, rgbBuff, null, null);
+    }
+
+    /**
+     * Add raw image info to encoder context. This interface is used for adding 16
+     * bits-per-sample pixel formats held in direct {@link ByteBuffer}s. The buffers are read in
+     * place, see {@link UltraHDREncoder#setRawImage(ByteBuffer, int, int, int, int, int, int,
+     * int, int)} for the lifetime rules.
+     *
+     * @param yBuff         direct buffer holding the luma samples in native byte order
+     * @param uvBuff        direct buffer holding the chroma samples in native byte order
+     * @param width         image width
+     * @param height        image height
+     * @param yStride       luma buffer stride in samples
+     * @param uvStride      Chroma buffer stride in samples
+     * @param colorGamut    color gamut of input image
+     * @param colorTransfer color transfer of input image
+     * @param colorRange    color range of input image
+     * @param colorFormat   color format of input image
+     * @param intent        {@link UltraHDRCommon#UHDR_HDR_IMG} for hdr intent
+     * @throws IOException If parameters are not valid or current encoder instance is not valid
+     *                     or current encoder instance is not suitable for configuration
+     *                     exception is thrown
+     */
+    public void setRawImage(ByteBuffer yBuff, ByteBuffer uvBuff, int width, int height,
+            int yStride, int uvStride, int colorGamut, int colorTransfer, int colorRange,
+            int colorFormat, int intent) throws IOException {
+        checkDirectBuffer(yBuff);
+        checkDirectBuffer(uvBuff);
+        if (width <= 0 || height <= 0) {
+            throw new IOException("received bad width and/or height, width or height is <= 0");
+        }
+        if (yStride <= 0 || uvStride <= 0) {
+            throw new IOException("received bad stride, stride is <= 0");
+        }
+        if (colorFormat != UHDR_IMG_FMT_24bppYCbCrP010) {
+            throw new IOException("received unsupported color format. supported color formats are"
+                    + "{UHDR_IMG_FMT_24bppYCbCrP010}");
+        }
+        setRawImageDirectNative(yBuff, uvBuff, null, width, height, yStride, uvStride, 0,
+                colorGamut, colorTransfer, colorRange, colorFormat, intent);
+        holdRawImage(intent, yBuff, uvBuff, null);
+    }
+
+    /**
+     * Add raw image info to encoder context. This interface is used for adding 8 bits-per-sample
+     * pixel formats held in direct {@link ByteBuffer}s. The buffers are read in place, see
+     * {@link UltraHDREncoder#setRawImage(ByteBuffer, int, int, int, int, int, int, int, int)}
+     * for the lifetime rules.
+     *
+     * @param yBuff         direct buffer holding the luma samples
+     * @param uBuff         direct buffer holding the Cb samples
+     * @param vBuff         direct buffer holding the Cr samples
+     * @param width         image width
+     * @param height        image height
+     * @param yStride       luma buffer stride
+     * @param uStride       Cb buffer stride
+     * @param vStride       Cr buffer stride
+     * @param colorGamut    color gamut of input image
+     * @param colorTransfer color transfer of input image
+     * @param colorRange    color range of input image
+     * @param colorFormat   color format of input image
+     * @param intent        {@link UltraHDRCommon#UHDR_SDR_IMG} for sdr intent
+     * @throws IOException If parameters are not valid or current encoder instance is not valid
+     *                     or current encoder instance is not suitable for configuration
+     *                     exception is thrown
+     */
+    public void setRawImage(ByteBuffer yBuff, ByteBuffer uBuff, ByteBuffer vBuff, int width,
+            int height, int yStride, int uStride, int vStride, int colorGamut, int colorTransfer,
+            int colorRange, int colorFormat, int intent) throws IOException {
+        checkDirectBuffer(yBuff);
+        checkDirectBuffer(uBuff);
+        checkDirectBuffer(vBuff);
+        if (width <= 0 || height <= 0) {
+            throw new IOException("received bad width and/or height, width or height is <= 0");
+        }
+        if (yStride <= 0 || uStride <= 0 || vStride <= 0) {
+            throw new IOException("received bad stride, stride is <= 0");
+        }
+        if (colorFormat != UHDR_IMG_FMT_12bppYCbCr420) {
+            throw new IOException("received unsupported color format. supported color formats are"
+                    + "{UHDR_IMG_FMT_12bppYCbCr420}");
+        }
+        setRawImageDirectNative(yBuff, uBuff, vBuff, width, height, yStride, uStride, vStride,
+                colorGamut, colorTransfer, colorRange, colorFormat, intent);
+        holdRawImage(intent, yBuff, uBuff, vBuff);
+    }
+
     /**
      * Add compressed image info to encoder context. The function goes through all the arguments
      * and checks for their sanity. If no anomalies are seen then the image info is added to
@@ -472,6 +607,55 @@ public class UltraHDREncoder implements AutoCloseable {
         setTargetDisplayPeakBrightnessNative(nits);
     }
 
+    /**
+     * Set number of threads used for encoding. The count includes the calling thread. If this is
+     * not configured or is set to 0, the library picks a value based on the number of cores
+     * available.
+     *
+     * @param numThreads number of threads. Any integer in range [0, 256]
+     * @throws IOException If parameters are not valid or current encoder instance
+     *                     is not valid or current encoder instance is not suitable
+     *                     for configuration exception is thrown
+     */
+    public void setNumThreads(int numThreads) throws IOException {
+        setNumThreadsNative(numThreads);
+    }
+
+    /**
+     * Set a caller owned direct {@link ByteBuffer} for the encoded stream. When set,
+     * {@link UltraHDREncoder#encode()} writes the stream straight into the buffer's native
+     * storage, starting at index 0, and {@link UltraHDREncoder#getOutputSize()} gives its length.
+     * No Java array is allocated, so a buffer can be reused across encodes. The encoder keeps a
+     * reference to the buffer until {@link UltraHDREncoder#reset()}. If the stream does not fit,
+     * the encode fails, a capacity of {@link UltraHDREncoder#getMaxOutputSize()} always suffices.
+     *
+     * @param buff direct buffer receiving the encoded stream
+     * @throws IOException If parameters are not valid or current encoder instance is not valid
+     *                     or current encoder instance is not suitable for configuration
+     *                     exception is thrown
+     */
+    public void setOutputBuffer(ByteBuffer buff) throws IOException {
+        if (buff == null) {
+            throw new IOException("received null for output buffer handle");
+        }
+        if (!buff.isDirect()) {
+            throw new IOException("received non-direct buffer for output buffer handle");
+        }
+        setOutputBufferNative(buff);
+        outputBuffer = buff;
+    }
+
+    /**
+     * Get an upper bound of the encoded stream size for the current configuration, to size the
+     * buffer of {@link UltraHDREncoder#setOutputBuffer(ByteBuffer)}. The raw images must be set.
+     *
+     * @return maximum size of the encoded stream in bytes, 0 if it cannot be computed yet
+     * @throws IOException If the current encoder instance is not valid exception is thrown
+     */
+    public long getMaxOutputSize() throws IOException {
+        return getMaxOutputSizeNative();
+    }
+
     /**
      * Encode process call.
      * <p>
@@ -486,6 +670,64 @@ public class UltraHDREncoder implements AutoCloseable {
         encodeNative();
     }
 
+    /**
+     * Asynchronous encode process call.
+     * <p>
+     * Queues {@link UltraHDREncoder#encode()} on the library's shared thread pool and returns
+     * without waiting for it. The returned future completes with this encoder once the encode has
+     * finished, or exceptionally with an {@link IOException} if it failed. The future is
+     * completed on a pool thread, dependent stages that are not given an executor run there.
+     * <p>
+     * Until the future is complete the encoder must not be configured or queried, only
+     * {@link UltraHDREncoder#reset()} and {@link UltraHDREncoder#close()} may be called, they
+     * wait for the encode. Direct buffers given to the encoder must not be modified meanwhile.
+     *
+     * @return future of the encode
+     * @throws IOException If the current encoder instance is not valid or an asynchronous encode
+     *                     of it is already in flight, exception is thrown
+     */
+    public CompletableFuture<UltraHDREncoder> encodeAsync() throws IOException {
+        CompletableFuture<UltraHDREncoder> previous = pending;
+        if (previous != null && !previous.isDone()) {
+            throw new IOException("an asynchronous encode of this instance is already in flight");
+        }
+        CompletableFuture<UltraHDREncoder> future = new CompletableFuture<>();
+        pending = future;
+        try {
+            encodeAsyncNative(future);
+        } catch (IOException e) {
+            pending = previous;
+            throw e;
+        }
+        return future;
+    }
+
+    /**
+     * Encode a batch of images. Each encoder is configured as for
+     * {@link UltraHDREncoder#encode()}, the images are then encoded concurrently on the library's
+     * shared thread pool, and the call returns once all of them are done. An encoder whose number
+     * of threads is not configured encodes its image on a single thread, as the images of the
+     * batch rather than the rows of an image are spread across the cores. The outputs are
+     * accessed per encoder as after {@link UltraHDREncoder#encode()}.
+     *
+     * @param encoders encoder instances, each at most once
+     * @throws IOException If the batch is not valid or any of its images fails to encode,
+     *                     exception is thrown with the error of the first failing encoder
+     */
+    public static void encodeBatch(UltraHDREncoder... encoders) throws IOException {
+        if (encoders == null || encoders.length == 0) {
+            throw new IOException("received empty batch of encoder instances");
+        }
+        long[] handles = new long[encoders.length];
+        for (int i = 0; i < encoders.length; i++) {
+            if (encoders[i] == null) {
+                throw new IOException("received null for encoder instance of the batch");
+            }
+            handles[i] = encoders[i].handle;
+        }
+        encodeBatchNative(handles);
+    }
+
     /**
      * Get encoded ultra hdr stream
      *
@@ -497,6 +739,18 @@ public class UltraHDREncoder implements AutoCloseable {
         return getOutputNative();
     }
 
+    /**
+     * Get the size of the encoded ultra hdr stream, for instance the number of bytes written to
+     * the buffer of {@link UltraHDREncoder#setOutputBuffer(ByteBuffer)}
+     *
+     * @return size of the encoded stream in bytes
+     * @throws IOException If {@link UltraHDREncoder#encode()} is not called or encoding process
+     *                     is not successful, exception is thrown
+     */
+    public long getOutputSize() throws IOException {
+        return getOutputSizeNative();
+    }
+
     /**
      * Reset encoder instance. Clears all previous settings and resets to default state and ready
      * for re-initialization and usage.
@@ -504,7 +758,54 @@ public class UltraHDREncoder implements AutoCloseable {
      * @throws IOException If the current encoder instance is not valid exception is thrown.
      */
     public void reset() throws IOException {
+        awaitPending();
         resetNative();
+        rawImageRefs[UHDR_HDR_IMG] = null;
+        rawImageRefs[UHDR_SDR_IMG] = null;
+        outputBuffer = null;
+    }
+
+    /**
+     * Waits for the future of an asynchronous encode, so that the native instance is not reset
+     * or released before its completion has run
+     */
+    private void awaitPending() {
+        CompletableFuture<UltraHDREncoder> future = pending;
+        if (future != null) {
+            try {
+                future.join();
+            } catch (RuntimeException e) {
+                // the failure is reported to the holders of the future
+            }
+            pending = null;
+        }
+    }
+
+    /**
+     * Completion of {@link UltraHDREncoder#encodeAsyncNative(CompletableFuture)}, called on a pool thread
+     * with the future of that call
+     */
+    private void onAsyncDone(CompletableFuture<UltraHDREncoder> future, int errorCode, String detail) {
+        if (errorCode == 0) {
+            future.complete(this);
+        } else {
+            future.completeExceptionally(new IOException(detail));
+        }
+    }
+
+    private static void checkDirectBuffer(ByteBuffer buff) throws IOException {
+        if (buff == null) {
+            throw new IOException("received null for image data handle");
+        }
+        if (!buff.isDirect()) {
+            throw new IOException("received non-direct buffer for image data handle");
+        }
+    }
+
+    private void holdRawImage(int intent, ByteBuffer p0, ByteBuffer p1, ByteBuffer p2) {
+        if (intent == UHDR_HDR_IMG || intent == UHDR_SDR_IMG) {
+            rawImageRefs[intent] = new ByteBuffer[]{p0, p1, p2};
+        }
     }
 
     private native void init() throws IOException;
@@ -527,6 +828,11 @@ public class UltraHDREncoder implements AutoCloseable {
             int height, int yStride, int uStride, int vStride, int colorGamut, int colorTransfer,
             int colorRange, int colorFormat, int intent) throws IOException;
 
+    private native void setRawImageDirectNative(ByteBuffer buff0, ByteBuffer buff1,
+            ByteBuffer buff2, int width, int height, int stride0, int stride1, int stride2,
+            int colorGamut, int colorTransfer, int colorRange, int colorFormat, int intent)
+            throws IOException;
+
     private native void setCompressedImageNative(byte[] data, int size, int colorGamut,
             int colorTransfer, int range, int intent) throws IOException;
 
@@ -553,10 +859,23 @@ public class UltraHDREncoder implements AutoCloseable {
 
     private native void setTargetDisplayPeakBrightnessNative(float nits) throws IOException;
 
+    private native void setNumThreadsNative(int numThreads) throws IOException;
+
+    private native void setOutputBufferNative(ByteBuffer buff) throws IOException;
+
+    private native long getMaxOutputSizeNative() throws IOException;
+
     private native void encodeNative() throws IOException;
 
+    private native void encodeAsyncNative(CompletableFuture<UltraHDREncoder> future)
+            throws IOException;
+
+    private static native void encodeBatchNative(long[] handles) throws IOException;
+
     private native byte[] getOutputNative() throws IOException;
 
+    private native long getOutputSizeNative() throws IOException;
+
     private native void resetNative() throws IOException;
 
     /**
@@ -564,6 +883,22 @@ public class UltraHDREncoder implements AutoCloseable {
      */
     private long handle;
 
+    /**
+     * Direct buffers the encoder reads in place, indexed by intent. Held so that their native
+     * storage outlives the encode.
+     */
+    private final ByteBuffer[][] rawImageRefs = new ByteBuffer[2][];
+
+    /**
+     * Caller owned output buffer. Held so that its native storage outlives the encode.
+     */
+    private ByteBuffer outputBuffer;
+
+    /**
+     * Future of the asynchronous encode in flight, if any
+     */
+    private volatile CompletableFuture<UltraHDREncoder> pending;
+
     static {
         System.loadLibrary("uhdrjni");
     }
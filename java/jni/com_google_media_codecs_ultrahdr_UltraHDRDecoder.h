@@ -47,6 +47,14 @@ JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_set
 JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_setOutputFormatNative
   (JNIEnv *, jobject, jint);
 
+/*
+ * Class:     com_google_media_codecs_ultrahdr_UltraHDRDecoder
+ * Method:    setOutputBufferNative
+ * Signature: (Ljava/nio/ByteBuffer;IIII)V
+ */
+JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_setOutputBufferNative
+  (JNIEnv *, jobject, jobject, jint, jint, jint, jint);
+
 /*
  * Class:     com_google_media_codecs_ultrahdr_UltraHDRDecoder
  * Method:    setColorTransferNative
@@ -63,6 +71,14 @@ JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_set
 JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_setMaxDisplayBoostNative
   (JNIEnv *, jobject, jfloat);
 
+/*
+ * Class:     com_google_media_codecs_ultrahdr_UltraHDRDecoder
+ * Method:    setNumThreadsNative
+ * Signature: (I)V
+ */
+JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_setNumThreadsNative
+  (JNIEnv *, jobject, jint);
+
 /*
  * Class:     com_google_media_codecs_ultrahdr_UltraHDRDecoder
  * Method:    enableGpuAccelerationNative
@@ -71,6 +87,22 @@ JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_set
 JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_enableGpuAccelerationNative
   (JNIEnv *, jobject, jint);
 
+/*
+ * Class:     com_google_media_codecs_ultrahdr_UltraHDRDecoder
+ * Method:    enableStatsNative
+ * Signature: (I)V
+ */
+JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_enableStatsNative
+  (JNIEnv *, jobject, jint);
+
+/*
+ * Class:     com_google_media_codecs_ultrahdr_UltraHDRDecoder
+ * Method:    getSlowPathCountsNative
+ * Signature: ()[I
+ */
+JNIEXPORT jintArray JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_getSlowPathCountsNative
+  (JNIEnv *, jobject);
+
 /*
  * Class:     com_google_media_codecs_ultrahdr_UltraHDRDecoder
  * Method:    probeNative
@@ -159,6 +191,22 @@ JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_get
 JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_decodeNative
   (JNIEnv *, jobject);
 
+/*
+ * Class:     com_google_media_codecs_ultrahdr_UltraHDRDecoder
+ * Method:    decodeAsyncNative
+ * Signature: (Ljava/util/concurrent/CompletableFuture;)V
+ */
+JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_decodeAsyncNative
+  (JNIEnv *, jobject, jobject);
+
+/*
+ * Class:     com_google_media_codecs_ultrahdr_UltraHDRDecoder
+ * Method:    decodeBatchNative
+ * Signature: ([J)V
+ */
+JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_decodeBatchNative
+  (JNIEnv *, jclass, jlongArray);
+
 /*
  * Class:     com_google_media_codecs_ultrahdr_UltraHDRDecoder
  * Method:    getDecodedImageNative
@@ -167,6 +215,30 @@ JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_dec
 JNIEXPORT jbyteArray JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_getDecodedImageNative
   (JNIEnv *, jobject);
 
+/*
+ * Class:     com_google_media_codecs_ultrahdr_UltraHDRDecoder
+ * Method:    getDecodedImageInfoNative
+ * Signature: ()V
+ */
+JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_getDecodedImageInfoNative
+  (JNIEnv *, jobject);
+
+/*
+ * Class:     com_google_media_codecs_ultrahdr_UltraHDRDecoder
+ * Method:    copyDecodedImageNative
+ * Signature: ([I)V
+ */
+JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_copyDecodedImageNative___3I
+  (JNIEnv *, jobject, jintArray);
+
+/*
+ * Class:     com_google_media_codecs_ultrahdr_UltraHDRDecoder
+ * Method:    copyDecodedImageNative
+ * Signature: ([J)V
+ */
+JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_copyDecodedImageNative___3J
+  (JNIEnv *, jobject, jlongArray);
+
 /*
  * Class:     com_google_media_codecs_ultrahdr_UltraHDRDecoder
  * Method:    getDecodedGainMapImageNative
@@ -65,6 +65,14 @@ JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_set
 JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setRawImageNative___3B_3B_3BIIIIIIIIII
   (JNIEnv *, jobject, jbyteArray, jbyteArray, jbyteArray, jint, jint, jint, jint, jint, jint, jint, jint, jint, jint);
 
+/*
+ * Class:     com_google_media_codecs_ultrahdr_UltraHDREncoder
+ * Method:    setRawImageDirectNative
+ * Signature: (Ljava/nio/ByteBuffer;Ljava/nio/ByteBuffer;Ljava/nio/ByteBuffer;IIIIIIIIII)V
+ */
+JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setRawImageDirectNative
+  (JNIEnv *, jobject, jobject, jobject, jobject, jint, jint, jint, jint, jint, jint, jint, jint, jint, jint);
+
 /*
  * Class:     com_google_media_codecs_ultrahdr_UltraHDREncoder
  * Method:    setCompressedImageNative
@@ -153,6 +161,30 @@ JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_set
 JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setTargetDisplayPeakBrightnessNative
   (JNIEnv *, jobject, jfloat);
 
+/*
+ * Class:     com_google_media_codecs_ultrahdr_UltraHDREncoder
+ * Method:    setNumThreadsNative
+ * Signature: (I)V
+ */
+JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setNumThreadsNative
+  (JNIEnv *, jobject, jint);
+
+/*
+ * Class:     com_google_media_codecs_ultrahdr_UltraHDREncoder
+ * Method:    setOutputBufferNative
+ * Signature: (Ljava/nio/ByteBuffer;)V
+ */
+JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setOutputBufferNative
+  (JNIEnv *, jobject, jobject);
+
+/*
+ * Class:     com_google_media_codecs_ultrahdr_UltraHDREncoder
+ * Method:    getMaxOutputSizeNative
+ * Signature: ()J
+ */
+JNIEXPORT jlong JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_getMaxOutputSizeNative
+  (JNIEnv *, jobject);
+
 /*
  * Class:     com_google_media_codecs_ultrahdr_UltraHDREncoder
  * Method:    encodeNative
@@ -161,6 +193,22 @@ JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_set
 JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_encodeNative
   (JNIEnv *, jobject);
 
+/*
+ * Class:     com_google_media_codecs_ultrahdr_UltraHDREncoder
+ * Method:    encodeAsyncNative
+ * Signature: (Ljava/util/concurrent/CompletableFuture;)V
+ */
+JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_encodeAsyncNative
+  (JNIEnv *, jobject, jobject);
+
+/*
+ * Class:     com_google_media_codecs_ultrahdr_UltraHDREncoder
+ * Method:    encodeBatchNative
+ * Signature: ([J)V
+ */
+JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_encodeBatchNative
+  (JNIEnv *, jclass, jlongArray);
+
 /*
  * Class:     com_google_media_codecs_ultrahdr_UltraHDREncoder
  * Method:    getOutputNative
@@ -169,6 +217,14 @@ JNIEXPORT void JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_enc
 JNIEXPORT jbyteArray JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_getOutputNative
   (JNIEnv *, jobject);
 
+/*
+ * Class:     com_google_media_codecs_ultrahdr_UltraHDREncoder
+ * Method:    getOutputSizeNative
+ * Signature: ()J
+ */
+JNIEXPORT jlong JNICALL Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_getOutputSizeNative
+  (JNIEnv *, jobject);
+
 /*
  * Class:     com_google_media_codecs_ultrahdr_UltraHDREncoder
  * Method:    resetNative
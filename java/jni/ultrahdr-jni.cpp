@@ -14,8 +14,8 @@
  * limitations under the License.
  */
 
-#include <cstring>
 #include <string>
+#include <vector>
 
 #include "com_google_media_codecs_ultrahdr_UltraHDRCommon.h"
 #include "com_google_media_codecs_ultrahdr_UltraHDRDecoder.h"
@@ -38,12 +38,8 @@ static_assert(sizeof(void *) <= sizeof(jlong),
     }                                                \
   }
 
-#define GET_HANDLE()                                                                         \
-  jclass clazz = env->GetObjectClass(thiz);                                                  \
-  RET_IF_TRUE(clazz == nullptr, "java/io/IOException", "GetObjectClass returned with error") \
-  jfieldID fid = env->GetFieldID(clazz, "handle", "J");                                      \
-  RET_IF_TRUE(fid == nullptr, "java/io/IOException",                                         \
-              "GetFieldID for field 'handle' returned with error")                           \
+#define GET_HANDLE(cls)             \
+  jfieldID fid = gFieldIds.cls##Handle; \
   jlong handle = env->GetLongField(thiz, fid);
 
 #define RET_VAL_IF_TRUE(cond, exception_class, msg, val) \
@@ -59,22 +55,177 @@ static_assert(sizeof(void *) <= sizeof(jlong),
     }                                                    \
   }
 
-#define GET_HANDLE_VAL(val)                                                                      \
-  jclass clazz = env->GetObjectClass(thiz);                                                      \
-  RET_VAL_IF_TRUE(clazz == nullptr, "java/io/IOException", "GetObjectClass returned with error", \
-                  (val))                                                                         \
-  jfieldID fid = env->GetFieldID(clazz, "handle", "J");                                          \
-  RET_VAL_IF_TRUE(fid == nullptr, "java/io/IOException",                                         \
-                  "GetFieldID for field 'handle' returned with error", (val))                    \
+#define GET_HANDLE_VAL(cls, val)    \
+  jfieldID fid = gFieldIds.cls##Handle; \
   jlong handle = env->GetLongField(thiz, fid);
 
+// Fields of the Java classes that the natives read and fill, indexed by the enums below
+enum DecoderIntField {
+  kImgWidth,
+  kImgHeight,
+  kImgStride,
+  kImgFormat,
+  kImgGamut,
+  kImgTransfer,
+  kImgRange,
+  kGainmapWidth,
+  kGainmapHeight,
+  kGainmapStride,
+  kGainmapFormat,
+  kDecoderIntFieldCount
+};
+
+static const char *const kDecoderIntFieldNames[kDecoderIntFieldCount] = {
+    "imgWidth",     "imgHeight",    "imgStride",     "imgFormat",     "imgGamut",     "imgTransfer",
+    "imgRange",     "gainmapWidth", "gainmapHeight", "gainmapStride", "gainmapFormat"};
+
+enum DecoderFloatField {
+  kMaxContentBoost,
+  kMinContentBoost,
+  kGamma,
+  kOffsetSdr,
+  kOffsetHdr,
+  kHdrCapacityMin,
+  kHdrCapacityMax,
+  kDecoderFloatFieldCount
+};
+
+static const char *const kDecoderFloatFieldNames[kDecoderFloatFieldCount] = {
+    "maxContentBoost", "minContentBoost", "gamma",         "offsetSdr",
+    "offsetHdr",       "hdrCapacityMin",  "hdrCapacityMax"};
+
+// Field and method ids stay valid for as long as their class is loaded, and the classes outlive
+// this library, so they are looked up once on load rather than by name on every call.
+static struct {
+  jfieldID encoderHandle;
+  jfieldID decoderHandle;
+  jfieldID decoderInt[kDecoderIntFieldCount];
+  jfieldID decoderFloat[kDecoderFloatFieldCount];
+  jmethodID encoderAsyncDone;
+  jmethodID decoderAsyncDone;
+} gFieldIds;
+
+// Completions of asynchronous calls run on library pool threads, which attach to this vm
+static JavaVM *gJavaVM;
+
+// onAsyncDone(CompletableFuture future, int errorCode, String detail) of the codec classes
+static const char *const kAsyncDoneSignature =
+    "(Ljava/util/concurrent/CompletableFuture;ILjava/lang/String;)V";
+
+// Global references held by an asynchronous call until its completion, the future is the one
+// returned for that call
+struct AsyncCall {
+  jobject codec;
+  jobject future;
+};
+
+// Returns the context of an asynchronous call, or nullptr with an exception pending
+static AsyncCall *newAsyncCall(JNIEnv *env, jobject thiz, jobject future) {
+  RET_VAL_IF_TRUE(future == nullptr, "java/io/IOException", "received null for future", nullptr)
+  jobject codec = env->NewGlobalRef(thiz);
+  RET_VAL_IF_TRUE(codec == nullptr, "java/lang/OutOfMemoryError", "Unable to reference instance",
+                  nullptr)
+  jobject future_ref = env->NewGlobalRef(future);
+  if (future_ref == nullptr) env->DeleteGlobalRef(codec);
+  RET_VAL_IF_TRUE(future_ref == nullptr, "java/lang/OutOfMemoryError",
+                  "Unable to reference future", nullptr)
+  return new AsyncCall{codec, future_ref};
+}
+
+static void deleteAsyncCall(JNIEnv *env, AsyncCall *call) {
+  env->DeleteGlobalRef(call->codec);
+  env->DeleteGlobalRef(call->future);
+  delete call;
+}
+
+#define SET_INT_FIELD(field, val) env->SetIntField(thiz, gFieldIds.decoderInt[field], (jint)(val));
+#define SET_FLOAT_FIELD(field, val) \
+  env->SetFloatField(thiz, gFieldIds.decoderFloat[field], (jfloat)(val));
+
+extern "C" JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *vm, void *reserved) {
+  JNIEnv *env = nullptr;
+  if (vm->GetEnv(reinterpret_cast<void **>(&env), JNI_VERSION_1_6) != JNI_OK) return JNI_ERR;
+  jclass encoder = env->FindClass("com/google/media/codecs/ultrahdr/UltraHDREncoder");
+  if (encoder == nullptr) return JNI_ERR;
+  gFieldIds.encoderHandle = env->GetFieldID(encoder, "handle", "J");
+  gFieldIds.encoderAsyncDone =
+      gFieldIds.encoderHandle == nullptr
+          ? nullptr
+          : env->GetMethodID(encoder, "onAsyncDone", kAsyncDoneSignature);
+  env->DeleteLocalRef(encoder);
+  if (gFieldIds.encoderAsyncDone == nullptr) return JNI_ERR;
+  jclass decoder = env->FindClass("com/google/media/codecs/ultrahdr/UltraHDRDecoder");
+  if (decoder == nullptr) return JNI_ERR;
+  bool found = (gFieldIds.decoderHandle = env->GetFieldID(decoder, "handle", "J")) != nullptr;
+  for (int i = 0; found && i < kDecoderIntFieldCount; i++) {
+    gFieldIds.decoderInt[i] = env->GetFieldID(decoder, kDecoderIntFieldNames[i], "I");
+    found = gFieldIds.decoderInt[i] != nullptr;
+  }
+  for (int i = 0; found && i < kDecoderFloatFieldCount; i++) {
+    gFieldIds.decoderFloat[i] = env->GetFieldID(decoder, kDecoderFloatFieldNames[i], "F");
+    found = gFieldIds.decoderFloat[i] != nullptr;
+  }
+  found = found && (gFieldIds.decoderAsyncDone =
+                        env->GetMethodID(decoder, "onAsyncDone", kAsyncDoneSignature)) != nullptr;
+  env->DeleteLocalRef(decoder);
+  gJavaVM = vm;
+  // a failed lookup leaves its exception pending, System.loadLibrary() reports it
+  return found ? JNI_VERSION_1_6 : JNI_ERR;
+}
+
+// Completion callback of uhdr_encode_async() / uhdr_decode_async(). user_ctx is the AsyncCall of
+// the Java call, whose future is handed the status before the references are released. The codec
+// is not touched past the Java call, as that may complete a future whose dependents close it.
+static void notifyAsyncDone(void *user_ctx, jmethodID on_done, uhdr_error_info_t status,
+                            const char *fallback_msg) {
+  JNIEnv *env = nullptr;
+  bool attached = false;
+  if (gJavaVM->GetEnv(reinterpret_cast<void **>(&env), JNI_VERSION_1_6) == JNI_EDETACHED) {
+#ifdef __ANDROID__
+    if (gJavaVM->AttachCurrentThread(&env, nullptr) != JNI_OK) return;
+#else
+    if (gJavaVM->AttachCurrentThread(reinterpret_cast<void **>(&env), nullptr) != JNI_OK) return;
+#endif
+    attached = true;
+  }
+  AsyncCall *call = static_cast<AsyncCall *>(user_ctx);
+  jstring detail = nullptr;
+  if (status.error_code != UHDR_CODEC_OK) {
+    detail = env->NewStringUTF(status.has_detail ? status.detail : fallback_msg);
+  }
+  env->CallVoidMethod(call->codec, on_done, call->future, (jint)status.error_code, detail);
+  env->ExceptionClear();
+  if (detail != nullptr) env->DeleteLocalRef(detail);
+  deleteAsyncCall(env, call);
+  if (attached) gJavaVM->DetachCurrentThread();
+}
+
+static void onEncodeDone(void *user_ctx, uhdr_codec_private_t *, uhdr_error_info_t status) {
+  notifyAsyncDone(user_ctx, gFieldIds.encoderAsyncDone, status,
+                  "uhdr_encode() returned with error");
+}
+
+static void onDecodeDone(void *user_ctx, uhdr_codec_private_t *, uhdr_error_info_t status) {
+  notifyAsyncDone(user_ctx, gFieldIds.decoderAsyncDone, status,
+                  "uhdr_decode() returned with error");
+}
+
+// Copies the native handles of a batch out of the Java array, returns false if they are not
+// accessible
+static bool getBatchHandles(JNIEnv *env, jlongArray handles,
+                            std::vector<uhdr_codec_private_t *> &codecs) {
+  jsize count = env->GetArrayLength(handles);
+  jlong *data = env->GetLongArrayElements(handles, nullptr);
+  if (data == nullptr) return false;
+  codecs.resize(count);
+  for (jsize i = 0; i < count; i++) codecs[i] = (uhdr_codec_private_t *)data[i];
+  env->ReleaseLongArrayElements(handles, data, JNI_ABORT);
+  return true;
+}
+
 extern "C" JNIEXPORT void JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_init(JNIEnv *env, jobject thiz) {
-  jclass clazz = env->GetObjectClass(thiz);
-  RET_IF_TRUE(clazz == nullptr, "java/io/IOException", "GetObjectClass returned with error")
-  jfieldID fid = env->GetFieldID(clazz, "handle", "J");
-  RET_IF_TRUE(fid == nullptr, "java/io/IOException",
-              "GetFieldID for field 'handle' returned with error")
+  jfieldID fid = gFieldIds.encoderHandle;
   uhdr_codec_private_t *handle = uhdr_create_encoder();
   RET_IF_TRUE(handle == nullptr, "java/lang/OutOfMemoryError",
               "Unable to allocate encoder instance")
@@ -83,7 +234,7 @@ Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_init(JNIEnv *env, jobject
 
 extern "C" JNIEXPORT void JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_destroy(JNIEnv *env, jobject thiz) {
-  GET_HANDLE()
+  GET_HANDLE(encoder)
   if (!handle) {
     uhdr_release_encoder((uhdr_codec_private_t *)handle);
     env->SetLongField(thiz, fid, (jlong)0);
@@ -94,7 +245,7 @@ extern "C" JNIEXPORT void JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setRawImageNative___3IIIIIIIII(
     JNIEnv *env, jobject thiz, jintArray rgb_buff, jint width, jint height, jint rgb_stride,
     jint color_gamut, jint color_transfer, jint color_range, jint color_format, jint intent) {
-  GET_HANDLE()
+  GET_HANDLE(encoder)
   RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid encoder instance")
   jsize length = env->GetArrayLength(rgb_buff);
   RET_IF_TRUE(length < height * rgb_stride, "java/io/IOException",
@@ -110,7 +261,7 @@ Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setRawImageNative___3IIIII
                        {(unsigned int)rgb_stride, 0u, 0u}};
   auto status =
       uhdr_enc_set_raw_image((uhdr_codec_private_t *)handle, &img, (uhdr_img_label_t)intent);
-  env->ReleaseIntArrayElements(rgb_buff, rgbBody, 0);
+  env->ReleaseIntArrayElements(rgb_buff, rgbBody, JNI_ABORT);
   RET_IF_TRUE(status.error_code != UHDR_CODEC_OK, "java/io/IOException",
               status.has_detail ? status.detail : "uhdr_enc_set_raw_image() returned with error")
 }
@@ -119,7 +270,7 @@ extern "C" JNIEXPORT void JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setRawImageNative___3JIIIIIIII(
     JNIEnv *env, jobject thiz, jlongArray rgb_buff, jint width, jint height, jint rgb_stride,
     jint color_gamut, jint color_transfer, jint color_range, jint color_format, jint intent) {
-  GET_HANDLE()
+  GET_HANDLE(encoder)
   RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid encoder instance")
   jsize length = env->GetArrayLength(rgb_buff);
   RET_IF_TRUE(length < height * rgb_stride, "java/io/IOException",
@@ -135,7 +286,7 @@ Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setRawImageNative___3JIIII
                        {(unsigned int)rgb_stride, 0u, 0u}};
   auto status =
       uhdr_enc_set_raw_image((uhdr_codec_private_t *)handle, &img, (uhdr_img_label_t)intent);
-  env->ReleaseLongArrayElements(rgb_buff, rgbBody, 0);
+  env->ReleaseLongArrayElements(rgb_buff, rgbBody, JNI_ABORT);
   RET_IF_TRUE(status.error_code != UHDR_CODEC_OK, "java/io/IOException",
               status.has_detail ? status.detail : "uhdr_enc_set_raw_image() returned with error")
 }
@@ -145,7 +296,7 @@ Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setRawImageNative___3S_3SI
     JNIEnv *env, jobject thiz, jshortArray y_buff, jshortArray uv_buff, jint width, jint height,
     jint y_stride, jint uv_stride, jint color_gamut, jint color_transfer, jint color_range,
     jint color_format, jint intent) {
-  GET_HANDLE()
+  GET_HANDLE(encoder)
   RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid encoder instance")
   jsize length = env->GetArrayLength(y_buff);
   RET_IF_TRUE(length < height * y_stride, "java/io/IOException",
@@ -165,8 +316,8 @@ Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setRawImageNative___3S_3SI
                        {(unsigned int)y_stride, (unsigned int)uv_stride, 0u}};
   auto status =
       uhdr_enc_set_raw_image((uhdr_codec_private_t *)handle, &img, (uhdr_img_label_t)intent);
-  env->ReleaseShortArrayElements(y_buff, lumaBody, 0);
-  env->ReleaseShortArrayElements(uv_buff, chromaBody, 0);
+  env->ReleaseShortArrayElements(y_buff, lumaBody, JNI_ABORT);
+  env->ReleaseShortArrayElements(uv_buff, chromaBody, JNI_ABORT);
   RET_IF_TRUE(status.error_code != UHDR_CODEC_OK, "java/io/IOException",
               status.has_detail ? status.detail : "uhdr_enc_set_raw_image() returned with error")
 }
@@ -176,7 +327,7 @@ Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setRawImageNative___3B_3B_
     JNIEnv *env, jobject thiz, jbyteArray y_buff, jbyteArray u_buff, jbyteArray v_buff, jint width,
     jint height, jint y_stride, jint u_stride, jint v_stride, jint color_gamut, jint color_transfer,
     jint color_range, jint color_format, jint intent) {
-  GET_HANDLE()
+  GET_HANDLE(encoder)
   RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid encoder instance")
   jsize length = env->GetArrayLength(y_buff);
   RET_IF_TRUE(length < height * y_stride, "java/io/IOException",
@@ -200,18 +351,75 @@ Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setRawImageNative___3B_3B_
                        {(unsigned int)y_stride, (unsigned int)u_stride, (unsigned int)v_stride}};
   auto status =
       uhdr_enc_set_raw_image((uhdr_codec_private_t *)handle, &img, (uhdr_img_label_t)intent);
-  env->ReleaseByteArrayElements(y_buff, lumaBody, 0);
-  env->ReleaseByteArrayElements(u_buff, cbBody, 0);
-  env->ReleaseByteArrayElements(v_buff, crBody, 0);
+  env->ReleaseByteArrayElements(y_buff, lumaBody, JNI_ABORT);
+  env->ReleaseByteArrayElements(u_buff, cbBody, JNI_ABORT);
+  env->ReleaseByteArrayElements(v_buff, crBody, JNI_ABORT);
   RET_IF_TRUE(status.error_code != UHDR_CODEC_OK, "java/io/IOException",
               status.has_detail ? status.detail : "uhdr_enc_set_raw_image() returned with error")
 }
 
+// Returns the native storage of a direct buffer, or nullptr if buff is not a direct buffer or its
+// capacity is less than size bytes
+static void *getDirectBufferAddress(JNIEnv *env, jobject buff, jlong size) {
+  if (buff == nullptr) return nullptr;
+  void *addr = env->GetDirectBufferAddress(buff);
+  if (addr == nullptr || env->GetDirectBufferCapacity(buff) < size) return nullptr;
+  return addr;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setRawImageDirectNative(
+    JNIEnv *env, jobject thiz, jobject buff0, jobject buff1, jobject buff2, jint width,
+    jint height, jint stride0, jint stride1, jint stride2, jint color_gamut, jint color_transfer,
+    jint color_range, jint color_format, jint intent) {
+  GET_HANDLE(encoder)
+  RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid encoder instance")
+  jlong chroma_height = (height + 1) / 2;
+  void *planes[3] = {nullptr, nullptr, nullptr};
+  if (color_format == UHDR_IMG_FMT_24bppYCbCrP010) {
+    planes[0] = getDirectBufferAddress(env, buff0, (jlong)stride0 * height * 2);
+    RET_IF_TRUE(planes[0] == nullptr, "java/io/IOException",
+                "raw image luma buffer is not direct or its capacity is less than required size")
+    planes[1] = getDirectBufferAddress(env, buff1, (jlong)stride1 * chroma_height * 2);
+    RET_IF_TRUE(planes[1] == nullptr, "java/io/IOException",
+                "raw image chroma buffer is not direct or its capacity is less than required size")
+  } else if (color_format == UHDR_IMG_FMT_12bppYCbCr420) {
+    planes[0] = getDirectBufferAddress(env, buff0, (jlong)stride0 * height);
+    RET_IF_TRUE(planes[0] == nullptr, "java/io/IOException",
+                "raw image luma buffer is not direct or its capacity is less than required size")
+    planes[1] = getDirectBufferAddress(env, buff1, (jlong)stride1 * chroma_height);
+    RET_IF_TRUE(planes[1] == nullptr, "java/io/IOException",
+                "raw image cb buffer is not direct or its capacity is less than required size")
+    planes[2] = getDirectBufferAddress(env, buff2, (jlong)stride2 * chroma_height);
+    RET_IF_TRUE(planes[2] == nullptr, "java/io/IOException",
+                "raw image cr buffer is not direct or its capacity is less than required size")
+  } else {
+    int bpp = color_format == UHDR_IMG_FMT_64bppRGBAHalfFloat ? 8 : 4;
+    planes[0] = getDirectBufferAddress(env, buff0, (jlong)stride0 * height * bpp);
+    RET_IF_TRUE(planes[0] == nullptr, "java/io/IOException",
+                "raw image rgb buffer is not direct or its capacity is less than required size")
+  }
+  uhdr_raw_image_t img{(uhdr_img_fmt_t)color_format,
+                       (uhdr_color_gamut_t)color_gamut,
+                       (uhdr_color_transfer_t)color_transfer,
+                       (uhdr_color_range_t)color_range,
+                       (unsigned int)width,
+                       (unsigned int)height,
+                       {planes[0], planes[1], planes[2]},
+                       {(unsigned int)stride0, (unsigned int)stride1, (unsigned int)stride2}};
+  // the java side holds the buffers until reset, so the planes are not copied
+  auto status =
+      uhdr_enc_set_raw_image_ref((uhdr_codec_private_t *)handle, &img, (uhdr_img_label_t)intent);
+  RET_IF_TRUE(
+      status.error_code != UHDR_CODEC_OK, "java/io/IOException",
+      status.has_detail ? status.detail : "uhdr_enc_set_raw_image_ref() returned with error")
+}
+
 extern "C" JNIEXPORT void JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setCompressedImageNative(
     JNIEnv *env, jobject thiz, jbyteArray data, jint size, jint color_gamut, jint color_transfer,
     jint range, jint intent) {
-  GET_HANDLE()
+  GET_HANDLE(encoder)
   RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid encoder instance")
   jsize length = env->GetArrayLength(data);
   RET_IF_TRUE(length < size, "java/io/IOException",
@@ -225,7 +433,7 @@ Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setCompressedImageNative(
                               (uhdr_color_range_t)range};
   auto status =
       uhdr_enc_set_compressed_image((uhdr_codec_private_t *)handle, &img, (uhdr_img_label_t)intent);
-  env->ReleaseByteArrayElements(data, body, 0);
+  env->ReleaseByteArrayElements(data, body, JNI_ABORT);
   RET_IF_TRUE(
       status.error_code != UHDR_CODEC_OK, "java/io/IOException",
       status.has_detail ? status.detail : "uhdr_enc_set_compressed_image() returned with error")
@@ -236,7 +444,7 @@ Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setGainMapImageInfoNative(
     JNIEnv *env, jobject thiz, jbyteArray data, jint size, jfloat max_content_boost,
     jfloat min_content_boost, jfloat gainmap_gamma, jfloat offset_sdr, jfloat offset_hdr,
     jfloat hdr_capacity_min, jfloat hdr_capacity_max) {
-  GET_HANDLE()
+  GET_HANDLE(encoder)
   RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid encoder instance")
   jsize length = env->GetArrayLength(data);
   RET_IF_TRUE(length < size, "java/io/IOException",
@@ -252,7 +460,7 @@ Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setGainMapImageInfoNative(
                                    offset_sdr,        offset_hdr,        hdr_capacity_min,
                                    hdr_capacity_max};
   auto status = uhdr_enc_set_gainmap_image((uhdr_codec_private_t *)handle, &img, &metadata);
-  env->ReleaseByteArrayElements(data, body, 0);
+  env->ReleaseByteArrayElements(data, body, JNI_ABORT);
   RET_IF_TRUE(
       status.error_code != UHDR_CODEC_OK, "java/io/IOException",
       status.has_detail ? status.detail : "uhdr_enc_set_gainmap_image() returned with error")
@@ -262,7 +470,7 @@ extern "C" JNIEXPORT void JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setExifDataNative(JNIEnv *env, jobject thiz,
                                                                         jbyteArray data,
                                                                         jint size) {
-  GET_HANDLE()
+  GET_HANDLE(encoder)
   RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid encoder instance")
   jsize length = env->GetArrayLength(data);
   RET_IF_TRUE(length < size, "java/io/IOException",
@@ -270,7 +478,7 @@ Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setExifDataNative(JNIEnv *
   jbyte *body = env->GetByteArrayElements(data, nullptr);
   uhdr_mem_block_t exif{body, (unsigned int)size, (unsigned int)length};
   auto status = uhdr_enc_set_exif_data((uhdr_codec_private_t *)handle, &exif);
-  env->ReleaseByteArrayElements(data, body, 0);
+  env->ReleaseByteArrayElements(data, body, JNI_ABORT);
   RET_IF_TRUE(status.error_code != UHDR_CODEC_OK, "java/io/IOException",
               status.has_detail ? status.detail : "uhdr_enc_set_exif_data() returned with error")
 }
@@ -280,7 +488,7 @@ Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setQualityFactorNative(JNI
                                                                              jobject thiz,
                                                                              jint quality_factor,
                                                                              jint intent) {
-  GET_HANDLE()
+  GET_HANDLE(encoder)
   RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid encoder instance")
   auto status = uhdr_enc_set_quality((uhdr_codec_private_t *)handle, quality_factor,
                                      (uhdr_img_label_t)intent);
@@ -291,7 +499,7 @@ Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setQualityFactorNative(JNI
 extern "C" JNIEXPORT void JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setMultiChannelGainMapEncodingNative(
     JNIEnv *env, jobject thiz, jboolean enable) {
-  GET_HANDLE()
+  GET_HANDLE(encoder)
   RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid encoder instance")
   auto status =
       uhdr_enc_set_using_multi_channel_gainmap((uhdr_codec_private_t *)handle, enable ? 1 : 0);
@@ -303,7 +511,7 @@ Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setMultiChannelGainMapEnco
 extern "C" JNIEXPORT void JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setGainMapScaleFactorNative(
     JNIEnv *env, jobject thiz, jint scale_factor) {
-  GET_HANDLE()
+  GET_HANDLE(encoder)
   RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid encoder instance")
   auto status = uhdr_enc_set_gainmap_scale_factor((uhdr_codec_private_t *)handle, scale_factor);
   RET_IF_TRUE(
@@ -315,7 +523,7 @@ extern "C" JNIEXPORT void JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setGainMapGammaNative(JNIEnv *env,
                                                                             jobject thiz,
                                                                             jfloat gamma) {
-  GET_HANDLE()
+  GET_HANDLE(encoder)
   RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid encoder instance")
   auto status = uhdr_enc_set_gainmap_gamma((uhdr_codec_private_t *)handle, gamma);
   RET_IF_TRUE(
@@ -326,7 +534,7 @@ Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setGainMapGammaNative(JNIE
 extern "C" JNIEXPORT void JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setEncPresetNative(JNIEnv *env, jobject thiz,
                                                                          jint preset) {
-  GET_HANDLE()
+  GET_HANDLE(encoder)
   RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid encoder instance")
   auto status = uhdr_enc_set_preset((uhdr_codec_private_t *)handle, (uhdr_enc_preset_t)preset);
   RET_IF_TRUE(status.error_code != UHDR_CODEC_OK, "java/io/IOException",
@@ -337,7 +545,7 @@ extern "C" JNIEXPORT void JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setOutputFormatNative(JNIEnv *env,
                                                                             jobject thiz,
                                                                             jint media_type) {
-  GET_HANDLE()
+  GET_HANDLE(encoder)
   RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid encoder instance")
   auto status =
       uhdr_enc_set_output_format((uhdr_codec_private_t *)handle, (uhdr_codec_t)media_type);
@@ -349,7 +557,7 @@ Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setOutputFormatNative(JNIE
 extern "C" JNIEXPORT void JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setMinMaxContentBoostNative(
     JNIEnv *env, jobject thiz, jfloat min_content_boost, jfloat max_content_boost) {
-  GET_HANDLE()
+  GET_HANDLE(encoder)
   RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid encoder instance")
   auto status = uhdr_enc_set_min_max_content_boost((uhdr_codec_private_t *)handle,
                                                    min_content_boost, max_content_boost);
@@ -361,7 +569,7 @@ Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setMinMaxContentBoostNativ
 extern "C" JNIEXPORT void JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setTargetDisplayPeakBrightnessNative(
     JNIEnv *env, jobject thiz, jfloat nits) {
-  GET_HANDLE()
+  GET_HANDLE(encoder)
   RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid encoder instance")
   auto status = uhdr_enc_set_target_display_peak_brightness((uhdr_codec_private_t *)handle, nits);
   RET_IF_TRUE(status.error_code != UHDR_CODEC_OK, "java/io/IOException",
@@ -370,18 +578,79 @@ Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setTargetDisplayPeakBright
                   : "uhdr_enc_set_target_display_peak_brightness() returned with error")
 }
 
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setNumThreadsNative(JNIEnv *env,
+                                                                          jobject thiz,
+                                                                          jint num_threads) {
+  GET_HANDLE(encoder)
+  RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid encoder instance")
+  auto status = uhdr_enc_set_num_threads((uhdr_codec_private_t *)handle, num_threads);
+  RET_IF_TRUE(status.error_code != UHDR_CODEC_OK, "java/io/IOException",
+              status.has_detail ? status.detail : "uhdr_enc_set_num_threads() returned with error")
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_setOutputBufferNative(JNIEnv *env,
+                                                                            jobject thiz,
+                                                                            jobject buff) {
+  GET_HANDLE(encoder)
+  RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid encoder instance")
+  void *data = getDirectBufferAddress(env, buff, 1);
+  RET_IF_TRUE(data == nullptr, "java/io/IOException", "output buffer is not direct or is empty")
+  uhdr_compressed_image_t img{};
+  img.data = data;
+  img.capacity = (size_t)env->GetDirectBufferCapacity(buff);
+  auto status = uhdr_enc_set_output_buffer((uhdr_codec_private_t *)handle, &img);
+  RET_IF_TRUE(
+      status.error_code != UHDR_CODEC_OK, "java/io/IOException",
+      status.has_detail ? status.detail : "uhdr_enc_set_output_buffer() returned with error")
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_getMaxOutputSizeNative(JNIEnv *env,
+                                                                             jobject thiz) {
+  GET_HANDLE_VAL(encoder, -1)
+  RET_VAL_IF_TRUE(handle == 0, "java/io/IOException", "invalid encoder instance", -1)
+  return (jlong)uhdr_enc_get_max_output_size((uhdr_codec_private_t *)handle);
+}
+
 extern "C" JNIEXPORT void JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_encodeNative(JNIEnv *env, jobject thiz) {
-  GET_HANDLE()
+  GET_HANDLE(encoder)
   RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid encoder instance")
   auto status = uhdr_encode((uhdr_codec_private_t *)handle);
   RET_IF_TRUE(status.error_code != UHDR_CODEC_OK, "java/io/IOException",
               status.has_detail ? status.detail : "uhdr_encode() returned with error")
 }
 
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_encodeAsyncNative(JNIEnv *env,
+                                                                        jobject thiz,
+                                                                        jobject future) {
+  GET_HANDLE(encoder)
+  RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid encoder instance")
+  AsyncCall *call = newAsyncCall(env, thiz, future);
+  if (call == nullptr) return;
+  auto status = uhdr_encode_async((uhdr_codec_private_t *)handle, onEncodeDone, call);
+  if (status.error_code != UHDR_CODEC_OK) deleteAsyncCall(env, call);
+  RET_IF_TRUE(status.error_code != UHDR_CODEC_OK, "java/io/IOException",
+              status.has_detail ? status.detail : "uhdr_encode_async() returned with error")
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_encodeBatchNative(JNIEnv *env, jclass clazz,
+                                                                        jlongArray handles) {
+  std::vector<uhdr_codec_private_t *> encs;
+  RET_IF_TRUE(!getBatchHandles(env, handles, encs), "java/io/IOException",
+              "unable to access encoder instances of the batch")
+  auto status = uhdr_encode_batch(encs.data(), (unsigned int)encs.size());
+  RET_IF_TRUE(status.error_code != UHDR_CODEC_OK, "java/io/IOException",
+              status.has_detail ? status.detail : "uhdr_encode_batch() returned with error")
+}
+
 extern "C" JNIEXPORT jbyteArray JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_getOutputNative(JNIEnv *env, jobject thiz) {
-  GET_HANDLE_VAL(nullptr)
+  GET_HANDLE_VAL(encoder, nullptr)
   RET_VAL_IF_TRUE(handle == 0, "java/io/IOException", "invalid encoder instance", nullptr)
   auto enc_output = uhdr_get_encoded_stream((uhdr_codec_private_t *)handle);
   RET_VAL_IF_TRUE(enc_output == nullptr, "java/io/IOException",
@@ -397,9 +666,22 @@ Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_getOutputNative(JNIEnv *en
   return output;
 }
 
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_getOutputSizeNative(JNIEnv *env,
+                                                                          jobject thiz) {
+  GET_HANDLE_VAL(encoder, -1)
+  RET_VAL_IF_TRUE(handle == 0, "java/io/IOException", "invalid encoder instance", -1)
+  auto enc_output = uhdr_get_encoded_stream((uhdr_codec_private_t *)handle);
+  RET_VAL_IF_TRUE(enc_output == nullptr, "java/io/IOException",
+                  "no output returned, may be call to uhdr_encode() was not made or encountered "
+                  "error during encoding process.",
+                  -1)
+  return (jlong)enc_output->data_sz;
+}
+
 extern "C" JNIEXPORT void JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDREncoder_resetNative(JNIEnv *env, jobject thiz) {
-  GET_HANDLE()
+  GET_HANDLE(encoder)
   RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid encoder instance")
   uhdr_reset_encoder((uhdr_codec_private_t *)handle);
 }
@@ -413,17 +695,13 @@ Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_isUHDRImageNative(JNIEnv *
                   "compressed image byteArray size is less than configured size", 0)
   jbyte *body = env->GetByteArrayElements(data, nullptr);
   auto status = is_uhdr_image(body, size);
-  env->ReleaseByteArrayElements(data, body, 0);
+  env->ReleaseByteArrayElements(data, body, JNI_ABORT);
   return status;
 }
 
 extern "C" JNIEXPORT void JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_init(JNIEnv *env, jobject thiz) {
-  jclass clazz = env->GetObjectClass(thiz);
-  RET_IF_TRUE(clazz == nullptr, "java/io/IOException", "GetObjectClass returned with error")
-  jfieldID fid = env->GetFieldID(clazz, "handle", "J");
-  RET_IF_TRUE(fid == nullptr, "java/io/IOException",
-              "GetFieldID for field 'handle' returned with error")
+  jfieldID fid = gFieldIds.decoderHandle;
   uhdr_codec_private_t *handle = uhdr_create_decoder();
   RET_IF_TRUE(handle == nullptr, "java/lang/OutOfMemoryError",
               "Unable to allocate decoder instance")
@@ -432,7 +710,7 @@ Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_init(JNIEnv *env, jobject
 
 extern "C" JNIEXPORT void JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_destroy(JNIEnv *env, jobject thiz) {
-  GET_HANDLE()
+  GET_HANDLE(decoder)
   if (!handle) {
     uhdr_release_decoder((uhdr_codec_private *)handle);
     env->SetLongField(thiz, fid, (jlong)0);
@@ -444,7 +722,7 @@ Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_setCompressedImageNative(
     JNIEnv *env, jobject thiz, jbyteArray data, jint size, jint color_gamut, jint color_transfer,
     jint range) {
   RET_IF_TRUE(size < 0, "java/io/IOException", "invalid compressed image size")
-  GET_HANDLE()
+  GET_HANDLE(decoder)
   RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid decoder instance")
   jsize length = env->GetArrayLength(data);
   RET_IF_TRUE(length < size, "java/io/IOException",
@@ -457,7 +735,7 @@ Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_setCompressedImageNative(
                               (uhdr_color_transfer_t)color_transfer,
                               (uhdr_color_range_t)range};
   uhdr_error_info_t status = uhdr_dec_set_image((uhdr_codec_private_t *)handle, &img);
-  env->ReleaseByteArrayElements(data, body, 0);
+  env->ReleaseByteArrayElements(data, body, JNI_ABORT);
   RET_IF_TRUE(status.error_code != UHDR_CODEC_OK, "java/io/IOException",
               status.has_detail ? status.detail : "uhdr_dec_set_image() returned with error")
 }
@@ -466,7 +744,7 @@ extern "C" JNIEXPORT void JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_setOutputFormatNative(JNIEnv *env,
                                                                             jobject thiz,
                                                                             jint fmt) {
-  GET_HANDLE()
+  GET_HANDLE(decoder)
   RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid decoder instance")
   uhdr_error_info_t status =
       uhdr_dec_set_out_img_format((uhdr_codec_private_t *)handle, (uhdr_img_fmt_t)fmt);
@@ -475,11 +753,34 @@ Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_setOutputFormatNative(JNIE
       status.has_detail ? status.detail : "uhdr_dec_set_out_img_format() returned with error")
 }
 
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_setOutputBufferNative(
+    JNIEnv *env, jobject thiz, jobject buff, jint fmt, jint width, jint height, jint stride) {
+  GET_HANDLE(decoder)
+  RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid decoder instance")
+  int bpp = fmt == UHDR_IMG_FMT_64bppRGBAHalfFloat ? 8 : 4;
+  void *data = getDirectBufferAddress(env, buff, (jlong)stride * height * bpp);
+  RET_IF_TRUE(data == nullptr, "java/io/IOException",
+              "output buffer is not direct or its capacity is less than required size")
+  uhdr_raw_image_t img{(uhdr_img_fmt_t)fmt,
+                       UHDR_CG_UNSPECIFIED,
+                       UHDR_CT_UNSPECIFIED,
+                       UHDR_CR_UNSPECIFIED,
+                       (unsigned int)width,
+                       (unsigned int)height,
+                       {data, nullptr, nullptr},
+                       {(unsigned int)stride, 0u, 0u}};
+  uhdr_error_info_t status = uhdr_dec_set_output_buffer((uhdr_codec_private_t *)handle, &img);
+  RET_IF_TRUE(
+      status.error_code != UHDR_CODEC_OK, "java/io/IOException",
+      status.has_detail ? status.detail : "uhdr_dec_set_output_buffer() returned with error")
+}
+
 extern "C" JNIEXPORT void JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_setColorTransferNative(JNIEnv *env,
                                                                              jobject thiz,
                                                                              jint ct) {
-  GET_HANDLE()
+  GET_HANDLE(decoder)
   RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid decoder instance")
   uhdr_error_info_t status =
       uhdr_dec_set_out_color_transfer((uhdr_codec_private_t *)handle, (uhdr_color_transfer_t)ct);
@@ -491,7 +792,7 @@ Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_setColorTransferNative(JNI
 extern "C" JNIEXPORT void JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_setMaxDisplayBoostNative(
     JNIEnv *env, jobject thiz, jfloat display_boost) {
-  GET_HANDLE()
+  GET_HANDLE(decoder)
   RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid decoder instance")
   uhdr_error_info_t status =
       uhdr_dec_set_out_max_display_boost((uhdr_codec_private_t *)handle, (float)display_boost);
@@ -500,11 +801,22 @@ Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_setMaxDisplayBoostNative(
                                 : "uhdr_dec_set_out_max_display_boost() returned with error")
 }
 
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_setNumThreadsNative(JNIEnv *env,
+                                                                          jobject thiz,
+                                                                          jint num_threads) {
+  GET_HANDLE(decoder)
+  RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid decoder instance")
+  uhdr_error_info_t status = uhdr_dec_set_num_threads((uhdr_codec_private_t *)handle, num_threads);
+  RET_IF_TRUE(status.error_code != UHDR_CODEC_OK, "java/io/IOException",
+              status.has_detail ? status.detail : "uhdr_dec_set_num_threads() returned with error")
+}
+
 extern "C" JNIEXPORT void JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_enableGpuAccelerationNative(JNIEnv *env,
                                                                                   jobject thiz,
                                                                                   jint enable) {
-  GET_HANDLE()
+  GET_HANDLE(decoder)
   RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid decoder instance")
   uhdr_error_info_t status = uhdr_enable_gpu_acceleration((uhdr_codec_private_t *)handle, enable);
   RET_IF_TRUE(
@@ -512,9 +824,35 @@ Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_enableGpuAccelerationNativ
       status.has_detail ? status.detail : "uhdr_enable_gpu_acceleration() returned with error")
 }
 
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_enableStatsNative(JNIEnv *env, jobject thiz,
+                                                                        jint enable) {
+  GET_HANDLE(decoder)
+  RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid decoder instance")
+  uhdr_error_info_t status = uhdr_enable_stats((uhdr_codec_private_t *)handle, enable);
+  RET_IF_TRUE(status.error_code != UHDR_CODEC_OK, "java/io/IOException",
+              status.has_detail ? status.detail : "uhdr_enable_stats() returned with error")
+}
+
+extern "C" JNIEXPORT jintArray JNICALL
+Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_getSlowPathCountsNative(JNIEnv *env,
+                                                                              jobject thiz) {
+  GET_HANDLE_VAL(decoder, nullptr)
+  RET_VAL_IF_TRUE(handle == 0, "java/io/IOException", "invalid decoder instance", nullptr)
+  uhdr_codec_stats_t *stats = uhdr_dec_get_stats((uhdr_codec_private_t *)handle);
+  if (stats == nullptr) return nullptr;
+  jint counts[UHDR_SLOW_PATH_COUNT];
+  for (int i = 0; i < UHDR_SLOW_PATH_COUNT; i++) counts[i] = (jint)stats->slow_paths[i];
+  jintArray data = env->NewIntArray(UHDR_SLOW_PATH_COUNT);
+  RET_VAL_IF_TRUE(data == nullptr, "java/io/IOException", "failed to allocate storage for output",
+                  nullptr)
+  env->SetIntArrayRegion(data, 0, UHDR_SLOW_PATH_COUNT, counts);
+  return data;
+}
+
 extern "C" JNIEXPORT void JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_probeNative(JNIEnv *env, jobject thiz) {
-  GET_HANDLE()
+  GET_HANDLE(decoder)
   RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid decoder instance")
   uhdr_error_info_t status = uhdr_dec_probe((uhdr_codec_private_t *)handle);
   RET_IF_TRUE(status.error_code != UHDR_CODEC_OK, "java/io/IOException",
@@ -524,7 +862,7 @@ Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_probeNative(JNIEnv *env, j
 extern "C" JNIEXPORT jint JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_getImageWidthNative(JNIEnv *env,
                                                                           jobject thiz) {
-  GET_HANDLE_VAL(-1)
+  GET_HANDLE_VAL(decoder, -1)
   auto val = uhdr_dec_get_image_width((uhdr_codec_private_t *)handle);
   RET_VAL_IF_TRUE(val == -1, "java/io/IOException",
                   "uhdr_dec_probe() is not yet called or it has returned with error", -1)
@@ -534,7 +872,7 @@ Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_getImageWidthNative(JNIEnv
 extern "C" JNIEXPORT jint JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_getImageHeightNative(JNIEnv *env,
                                                                            jobject thiz) {
-  GET_HANDLE_VAL(-1)
+  GET_HANDLE_VAL(decoder, -1)
   auto val = uhdr_dec_get_image_height((uhdr_codec_private_t *)handle);
   RET_VAL_IF_TRUE(val == -1, "java/io/IOException",
                   "uhdr_dec_probe() is not yet called or it has returned with error", -1)
@@ -544,7 +882,7 @@ Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_getImageHeightNative(JNIEn
 extern "C" JNIEXPORT jint JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_getGainMapWidthNative(JNIEnv *env,
                                                                             jobject thiz) {
-  GET_HANDLE_VAL(-1)
+  GET_HANDLE_VAL(decoder, -1)
   auto val = uhdr_dec_get_gainmap_width((uhdr_codec_private_t *)handle);
   RET_VAL_IF_TRUE(val == -1, "java/io/IOException",
                   "uhdr_dec_probe() is not yet called or it has returned with error", -1)
@@ -554,7 +892,7 @@ Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_getGainMapWidthNative(JNIE
 extern "C" JNIEXPORT jint JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_getGainMapHeightNative(JNIEnv *env,
                                                                              jobject thiz) {
-  GET_HANDLE_VAL(-1)
+  GET_HANDLE_VAL(decoder, -1)
   auto val = uhdr_dec_get_gainmap_height((uhdr_codec_private_t *)handle);
   RET_VAL_IF_TRUE(val == -1, "java/io/IOException",
                   "uhdr_dec_probe() is not yet called or it has returned with error", -1)
@@ -563,145 +901,196 @@ Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_getGainMapHeightNative(JNI
 
 extern "C" JNIEXPORT jbyteArray JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_getExifNative(JNIEnv *env, jobject thiz) {
-  GET_HANDLE_VAL(nullptr)
+  GET_HANDLE_VAL(decoder, nullptr)
   uhdr_mem_block_t *exifData = uhdr_dec_get_exif((uhdr_codec_private_t *)handle);
   RET_VAL_IF_TRUE(exifData == nullptr, "java/io/IOException",
                   "uhdr_dec_probe() is not yet called or it has returned with error", nullptr)
   jbyteArray data = env->NewByteArray(exifData->data_sz);
-  jbyte *dataptr = env->GetByteArrayElements(data, nullptr);
-  std::memcpy(dataptr, exifData->data, exifData->data_sz);
-  env->ReleaseByteArrayElements(data, dataptr, 0);
+  env->SetByteArrayRegion(data, 0, exifData->data_sz, (const jbyte *)exifData->data);
   return data;
 }
 
 extern "C" JNIEXPORT jbyteArray JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_getIccNative(JNIEnv *env, jobject thiz) {
-  GET_HANDLE_VAL(nullptr)
+  GET_HANDLE_VAL(decoder, nullptr)
   uhdr_mem_block_t *iccData = uhdr_dec_get_icc((uhdr_codec_private_t *)handle);
   RET_VAL_IF_TRUE(iccData == nullptr, "java/io/IOException",
                   "uhdr_dec_probe() is not yet called or it has returned with error", nullptr)
   jbyteArray data = env->NewByteArray(iccData->data_sz);
-  jbyte *dataptr = env->GetByteArrayElements(data, nullptr);
-  std::memcpy(dataptr, iccData->data, iccData->data_sz);
-  env->ReleaseByteArrayElements(data, dataptr, 0);
+  env->SetByteArrayRegion(data, 0, iccData->data_sz, (const jbyte *)iccData->data);
   return data;
 }
 
 extern "C" JNIEXPORT jbyteArray JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_getBaseImageNative(JNIEnv *env,
                                                                          jobject thiz) {
-  GET_HANDLE_VAL(nullptr)
+  GET_HANDLE_VAL(decoder, nullptr)
   uhdr_mem_block_t *baseImgData = uhdr_dec_get_base_image((uhdr_codec_private_t *)handle);
   RET_VAL_IF_TRUE(baseImgData == nullptr, "java/io/IOException",
                   "uhdr_dec_probe() is not yet called or it has returned with error", nullptr)
   jbyteArray data = env->NewByteArray(baseImgData->data_sz);
-  jbyte *dataptr = env->GetByteArrayElements(data, nullptr);
-  std::memcpy(dataptr, baseImgData->data, baseImgData->data_sz);
-  env->ReleaseByteArrayElements(data, dataptr, 0);
+  env->SetByteArrayRegion(data, 0, baseImgData->data_sz, (const jbyte *)baseImgData->data);
   return data;
 }
 
 extern "C" JNIEXPORT jbyteArray JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_getGainMapImageNative(JNIEnv *env,
                                                                             jobject thiz) {
-  GET_HANDLE_VAL(nullptr)
+  GET_HANDLE_VAL(decoder, nullptr)
   uhdr_mem_block_t *gainmapImgData = uhdr_dec_get_gainmap_image((uhdr_codec_private_t *)handle);
   RET_VAL_IF_TRUE(gainmapImgData == nullptr, "java/io/IOException",
                   "uhdr_dec_probe() is not yet called or it has returned with error", nullptr)
   jbyteArray data = env->NewByteArray(gainmapImgData->data_sz);
-  jbyte *dataptr = env->GetByteArrayElements(data, nullptr);
-  std::memcpy(dataptr, gainmapImgData->data, gainmapImgData->data_sz);
-  env->ReleaseByteArrayElements(data, dataptr, 0);
+  env->SetByteArrayRegion(data, 0, gainmapImgData->data_sz, (const jbyte *)gainmapImgData->data);
   return data;
 }
 
 extern "C" JNIEXPORT void JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_getGainmapMetadataNative(JNIEnv *env,
                                                                                jobject thiz) {
-  GET_HANDLE()
+  GET_HANDLE(decoder)
   RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid decoder instance")
   uhdr_gainmap_metadata_t *gainmap_metadata =
       uhdr_dec_get_gainmap_metadata((uhdr_codec_private_t *)handle);
   RET_IF_TRUE(gainmap_metadata == nullptr, "java/io/IOException",
               "uhdr_dec_probe() is not yet called or it has returned with error")
-#define SET_FLOAT_FIELD(name, val)                                    \
-  {                                                                   \
-    jfieldID fID = env->GetFieldID(clazz, name, "F");                 \
-    RET_IF_TRUE(fID == nullptr, "java/io/IOException",                \
-                "GetFieldID for field " #name " returned with error") \
-    env->SetFloatField(thiz, fID, (jfloat)val);                       \
-  }
-  SET_FLOAT_FIELD("maxContentBoost", gainmap_metadata->max_content_boost)
-  SET_FLOAT_FIELD("minContentBoost", gainmap_metadata->min_content_boost)
-  SET_FLOAT_FIELD("gamma", gainmap_metadata->gamma)
-  SET_FLOAT_FIELD("offsetSdr", gainmap_metadata->offset_sdr)
-  SET_FLOAT_FIELD("offsetHdr", gainmap_metadata->offset_hdr)
-  SET_FLOAT_FIELD("hdrCapacityMin", gainmap_metadata->hdr_capacity_min)
-  SET_FLOAT_FIELD("hdrCapacityMax", gainmap_metadata->hdr_capacity_max)
+  SET_FLOAT_FIELD(kMaxContentBoost, gainmap_metadata->max_content_boost)
+  SET_FLOAT_FIELD(kMinContentBoost, gainmap_metadata->min_content_boost)
+  SET_FLOAT_FIELD(kGamma, gainmap_metadata->gamma)
+  SET_FLOAT_FIELD(kOffsetSdr, gainmap_metadata->offset_sdr)
+  SET_FLOAT_FIELD(kOffsetHdr, gainmap_metadata->offset_hdr)
+  SET_FLOAT_FIELD(kHdrCapacityMin, gainmap_metadata->hdr_capacity_min)
+  SET_FLOAT_FIELD(kHdrCapacityMax, gainmap_metadata->hdr_capacity_max)
 }
 
 extern "C" JNIEXPORT void JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_decodeNative(JNIEnv *env, jobject thiz) {
-  GET_HANDLE()
+  GET_HANDLE(decoder)
   RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid decoder instance")
   auto status = uhdr_decode((uhdr_codec_private_t *)handle);
   RET_IF_TRUE(status.error_code != UHDR_CODEC_OK, "java/io/IOException",
               status.has_detail ? status.detail : "uhdr_decode() returned with error")
 }
 
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_decodeAsyncNative(JNIEnv *env,
+                                                                        jobject thiz,
+                                                                        jobject future) {
+  GET_HANDLE(decoder)
+  RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid decoder instance")
+  AsyncCall *call = newAsyncCall(env, thiz, future);
+  if (call == nullptr) return;
+  auto status = uhdr_decode_async((uhdr_codec_private_t *)handle, onDecodeDone, call);
+  if (status.error_code != UHDR_CODEC_OK) deleteAsyncCall(env, call);
+  RET_IF_TRUE(status.error_code != UHDR_CODEC_OK, "java/io/IOException",
+              status.has_detail ? status.detail : "uhdr_decode_async() returned with error")
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_decodeBatchNative(JNIEnv *env, jclass clazz,
+                                                                        jlongArray handles) {
+  std::vector<uhdr_codec_private_t *> decs;
+  RET_IF_TRUE(!getBatchHandles(env, handles, decs), "java/io/IOException",
+              "unable to access decoder instances of the batch")
+  auto status = uhdr_decode_batch(decs.data(), (unsigned int)decs.size());
+  RET_IF_TRUE(status.error_code != UHDR_CODEC_OK, "java/io/IOException",
+              status.has_detail ? status.detail : "uhdr_decode_batch() returned with error")
+}
+
 extern "C" JNIEXPORT jbyteArray JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_getDecodedImageNative(JNIEnv *env,
                                                                             jobject thiz) {
-  GET_HANDLE_VAL(nullptr)
+  GET_HANDLE_VAL(decoder, nullptr)
   uhdr_raw_image_t *decodedImg = uhdr_get_decoded_image((uhdr_codec_private_t *)handle);
   RET_VAL_IF_TRUE(decodedImg == nullptr, "java/io/IOException",
                   "uhdr_decode() is not yet called or it has returned with error", nullptr)
   int bpp = decodedImg->fmt == UHDR_IMG_FMT_64bppRGBAHalfFloat ? 8 : 4;
   jbyteArray data = env->NewByteArray(decodedImg->stride[UHDR_PLANE_PACKED] * decodedImg->h * bpp);
-  jbyte *dataptr = env->GetByteArrayElements(data, nullptr);
-  std::memcpy(dataptr, decodedImg->planes[UHDR_PLANE_PACKED],
-              decodedImg->stride[UHDR_PLANE_PACKED] * decodedImg->h * bpp);
-  env->ReleaseByteArrayElements(data, dataptr, 0);
-#define SET_INT_FIELD(name, val)                                                   \
-  {                                                                                \
-    jfieldID fID = env->GetFieldID(clazz, name, "I");                              \
-    RET_VAL_IF_TRUE(fID == nullptr, "java/io/IOException",                         \
-                    "GetFieldID for field " #name " returned with error", nullptr) \
-    env->SetIntField(thiz, fID, (jint)val);                                        \
-  }
-  SET_INT_FIELD("imgWidth", decodedImg->w)
-  SET_INT_FIELD("imgHeight", decodedImg->h)
-  SET_INT_FIELD("imgStride", decodedImg->stride[UHDR_PLANE_PACKED])
-  SET_INT_FIELD("imgFormat", decodedImg->fmt)
-  SET_INT_FIELD("imgGamut", decodedImg->cg)
-  SET_INT_FIELD("imgTransfer", decodedImg->ct)
-  SET_INT_FIELD("imgRange", decodedImg->range)
+  env->SetByteArrayRegion(data, 0, decodedImg->stride[UHDR_PLANE_PACKED] * decodedImg->h * bpp,
+                          (const jbyte *)decodedImg->planes[UHDR_PLANE_PACKED]);
+  SET_INT_FIELD(kImgWidth, decodedImg->w)
+  SET_INT_FIELD(kImgHeight, decodedImg->h)
+  SET_INT_FIELD(kImgStride, decodedImg->stride[UHDR_PLANE_PACKED])
+  SET_INT_FIELD(kImgFormat, decodedImg->fmt)
+  SET_INT_FIELD(kImgGamut, decodedImg->cg)
+  SET_INT_FIELD(kImgTransfer, decodedImg->ct)
+  SET_INT_FIELD(kImgRange, decodedImg->range)
   return data;
 }
 
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_getDecodedImageInfoNative(JNIEnv *env,
+                                                                                jobject thiz) {
+  GET_HANDLE(decoder)
+  RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid decoder instance")
+  uhdr_raw_image_t *decodedImg = uhdr_get_decoded_image((uhdr_codec_private_t *)handle);
+  RET_IF_TRUE(decodedImg == nullptr, "java/io/IOException",
+              "uhdr_decode() is not yet called or it has returned with error")
+  SET_INT_FIELD(kImgWidth, decodedImg->w)
+  SET_INT_FIELD(kImgHeight, decodedImg->h)
+  SET_INT_FIELD(kImgStride, decodedImg->stride[UHDR_PLANE_PACKED])
+  SET_INT_FIELD(kImgFormat, decodedImg->fmt)
+  SET_INT_FIELD(kImgGamut, decodedImg->cg)
+  SET_INT_FIELD(kImgTransfer, decodedImg->ct)
+  SET_INT_FIELD(kImgRange, decodedImg->range)
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_copyDecodedImageNative___3I(JNIEnv *env,
+                                                                                  jobject thiz,
+                                                                                  jintArray dst) {
+  GET_HANDLE(decoder)
+  RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid decoder instance")
+  uhdr_raw_image_t *decodedImg = uhdr_get_decoded_image((uhdr_codec_private_t *)handle);
+  RET_IF_TRUE(decodedImg == nullptr, "java/io/IOException",
+              "uhdr_decode() is not yet called or it has returned with error")
+  RET_IF_TRUE(decodedImg->fmt == UHDR_IMG_FMT_64bppRGBAHalfFloat, "java/io/IOException",
+              "decoded image has 8 bytes per pixel, cannot be copied to an intArray")
+  jlong count = (jlong)decodedImg->stride[UHDR_PLANE_PACKED] * decodedImg->h;
+  RET_IF_TRUE(env->GetArrayLength(dst) < count, "java/io/IOException",
+              "destination intArray size is less than decoded image size")
+  env->SetIntArrayRegion(dst, 0, (jsize)count,
+                         (const jint *)decodedImg->planes[UHDR_PLANE_PACKED]);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_copyDecodedImageNative___3J(
+    JNIEnv *env, jobject thiz, jlongArray dst) {
+  GET_HANDLE(decoder)
+  RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid decoder instance")
+  uhdr_raw_image_t *decodedImg = uhdr_get_decoded_image((uhdr_codec_private_t *)handle);
+  RET_IF_TRUE(decodedImg == nullptr, "java/io/IOException",
+              "uhdr_decode() is not yet called or it has returned with error")
+  RET_IF_TRUE(decodedImg->fmt != UHDR_IMG_FMT_64bppRGBAHalfFloat, "java/io/IOException",
+              "decoded image has 4 bytes per pixel, cannot be copied to a longArray")
+  jlong count = (jlong)decodedImg->stride[UHDR_PLANE_PACKED] * decodedImg->h;
+  RET_IF_TRUE(env->GetArrayLength(dst) < count, "java/io/IOException",
+              "destination longArray size is less than decoded image size")
+  env->SetLongArrayRegion(dst, 0, (jsize)count,
+                          (const jlong *)decodedImg->planes[UHDR_PLANE_PACKED]);
+}
+
 extern "C" JNIEXPORT jbyteArray JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_getDecodedGainMapImageNative(JNIEnv *env,
                                                                                    jobject thiz) {
-  GET_HANDLE_VAL(nullptr)
+  GET_HANDLE_VAL(decoder, nullptr)
   uhdr_raw_image_t *gainmapImg = uhdr_get_decoded_gainmap_image((uhdr_codec_private_t *)handle);
   RET_VAL_IF_TRUE(gainmapImg == nullptr, "java/io/IOException",
                   "uhdr_decode() is not yet called or it has returned with error", nullptr)
   int bpp = gainmapImg->fmt == UHDR_IMG_FMT_32bppRGBA8888 ? 4 : 1;
   jbyteArray data = env->NewByteArray(gainmapImg->stride[UHDR_PLANE_PACKED] * gainmapImg->h * bpp);
-  jbyte *dataptr = env->GetByteArrayElements(data, nullptr);
-  std::memcpy(dataptr, gainmapImg->planes[UHDR_PLANE_PACKED],
-              gainmapImg->stride[UHDR_PLANE_PACKED] * gainmapImg->h * bpp);
-  env->ReleaseByteArrayElements(data, dataptr, 0);
-  SET_INT_FIELD("gainmapWidth", gainmapImg->w)
-  SET_INT_FIELD("gainmapHeight", gainmapImg->h)
-  SET_INT_FIELD("gainmapStride", gainmapImg->stride[UHDR_PLANE_PACKED])
-  SET_INT_FIELD("gainmapFormat", gainmapImg->fmt)
+  env->SetByteArrayRegion(data, 0, gainmapImg->stride[UHDR_PLANE_PACKED] * gainmapImg->h * bpp,
+                          (const jbyte *)gainmapImg->planes[UHDR_PLANE_PACKED]);
+  SET_INT_FIELD(kGainmapWidth, gainmapImg->w)
+  SET_INT_FIELD(kGainmapHeight, gainmapImg->h)
+  SET_INT_FIELD(kGainmapStride, gainmapImg->stride[UHDR_PLANE_PACKED])
+  SET_INT_FIELD(kGainmapFormat, gainmapImg->fmt)
   return data;
 }
 
 extern "C" JNIEXPORT void JNICALL
 Java_com_google_media_codecs_ultrahdr_UltraHDRDecoder_resetNative(JNIEnv *env, jobject thiz) {
-  GET_HANDLE()
+  GET_HANDLE(decoder)
   RET_IF_TRUE(handle == 0, "java/io/IOException", "invalid decoder instance")
   uhdr_reset_decoder((uhdr_codec_private_t *)handle);
 }
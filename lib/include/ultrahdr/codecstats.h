@@ -0,0 +1,112 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ULTRAHDR_CODECSTATS_H
+#define ULTRAHDR_CODECSTATS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#include "ultrahdr_api.h"
+
+namespace ultrahdr {
+
+/*!\brief Phases of the gpu work of a call, see uhdr_gpu_stats */
+enum GpuPhase { kGpuUpload, kGpuShader, kGpuReadback };
+
+/*
+ * Timing and memory figures of the encode/decode calls of a codec context, see
+ * uhdr_enable_stats(). A call binds the stats of its context to the calling thread via Scope, the
+ * image buffers created while bound are accounted to it until they are released. Stages are timed
+ * with StageTimer, which may run on any thread.
+ */
+class CodecStats {
+ public:
+  CodecStats() = default;
+
+  CodecStats(const CodecStats&) = delete;
+  CodecStats& operator=(const CodecStats&) = delete;
+
+  /*!\brief Figures of the last call, nullptr if there was none since clear() */
+  uhdr_codec_stats_t* get() { return mValid ? &mStats : nullptr; }
+  void clear();
+
+  void setNumThreads(unsigned int num_threads);
+  void addStage(uhdr_codec_stage_t stage, double wall_ms, double cpu_ms);
+  void onAllocate(size_t bytes);
+  void onRelease(size_t bytes);
+  /*!\brief Adds time to a gpu phase, timer_query tells if it was measured on the gpu. Each time
+   * added to kGpuShader counts one pass. */
+  void addGpuTime(GpuPhase phase, double ms, bool timer_query);
+  void countSlowPath(uhdr_slow_path_t path);
+
+  /*!\brief Monotonic wall clock and process cpu clock, milliseconds */
+  static double wallMs();
+  static double cpuMs();
+
+  /*!\brief Stats bound to the calling thread, nullptr if none */
+  static CodecStats* current();
+
+  /*!\brief Times a call and binds the stats to the calling thread for the lifetime of the object.
+   * Figures of the earlier call are cleared. Binding nullptr disables collection for the call. */
+  class Scope {
+   public:
+    explicit Scope(CodecStats* stats);
+    ~Scope();
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+   private:
+    CodecStats* mStats;
+    CodecStats* mPrev;
+    double mWallStart = 0.0;
+    double mCpuStart = 0.0;
+  };
+
+ private:
+  std::mutex mMutex;
+  uhdr_codec_stats_t mStats{};
+  bool mValid = false;
+  int64_t mLiveBytes = 0;  // bytes of blocks accounted here and not yet released
+  int64_t mLiveBase = 0;   // mLiveBytes at the start of the call
+};
+
+/*!\brief Counts a slow path to stats, if not nullptr */
+inline void countSlowPath(CodecStats* stats, uhdr_slow_path_t path) {
+  if (stats != nullptr) stats->countSlowPath(path);
+}
+
+/*!\brief Adds the time from construction to destruction to a stage of stats, if not nullptr */
+class StageTimer {
+ public:
+  StageTimer(CodecStats* stats, uhdr_codec_stage_t stage);
+  ~StageTimer();
+
+  StageTimer(const StageTimer&) = delete;
+  StageTimer& operator=(const StageTimer&) = delete;
+
+ private:
+  CodecStats* mStats;
+  uhdr_codec_stage_t mStage;
+  double mWallStart = 0.0;
+  double mCpuStart = 0.0;
+};
+
+}  // namespace ultrahdr
+
+#endif  // ULTRAHDR_CODECSTATS_H
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ULTRAHDR_DECODERCACHE_H
+#define ULTRAHDR_DECODERCACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "ultrahdr_api.h"
+#include "ultrahdr/ultrahdrcommon.h"
+
+namespace ultrahdr {
+
+/*
+ * Results of uhdr_dec_probe() and decoded gain maps of compressed images, keyed by the compressed
+ * bytes, see uhdr_create_decoder_cache(). Entries are found by a hash of the bytes and keep a copy
+ * of them, which a lookup compares in full, so images whose hashes collide never share an entry.
+ * A cache is shared by any number of decoders and threads. Entries are evicted least recently used
+ * first once the bytes held exceed the capacity.
+ *
+ * Block locations are kept as offsets into the compressed image, so an entry serves every copy of
+ * the same bytes. Gain maps are held in blocks of the default heap, not in the arena of the
+ * decoder that decoded them, as they outlive the decode.
+ */
+class DecoderCache {
+ public:
+  struct Block {
+    size_t offset, size;
+  };
+
+  struct ProbeInfo {
+    int img_wd, img_ht, img_num_comp;
+    int gainmap_wd, gainmap_ht, gainmap_num_comp;
+    uhdr_gainmap_metadata_t metadata;
+    Block exif, icc, base_img, gainmap_img;
+  };
+
+  struct Key {
+    uint64_t hash;
+    size_t size;
+    const uint8_t* data;  // compressed image, of the caller in lookups, of the entry in the index
+
+    bool operator==(const Key& other) const {
+      return hash == other.hash && size == other.size &&
+             (size == 0 || data == other.data || memcmp(data, other.data, size) == 0);
+    }
+  };
+
+  DecoderCache(size_t capacity, bool keep_gainmaps);
+
+  DecoderCache(const DecoderCache&) = delete;
+  DecoderCache& operator=(const DecoderCache&) = delete;
+
+  /*!\brief Key of a compressed image. Reads 32 bytes per step, at memory bandwidth on large
+   * images. */
+  static Key keyOf(const void* data, size_t size);
+
+  bool keepsGainMaps() const { return mKeepGainMaps; }
+
+  bool findProbeInfo(const Key& key, ProbeInfo& info);
+  void storeProbeInfo(const Key& key, const ProbeInfo& info);
+
+  /*!\brief Gain map decoded at full size, nullptr if none is cached. variant tells decodes with
+   * different decoder settings apart, the fast idct for one. */
+  std::shared_ptr<const uhdr_raw_image_ext_t> findGainMap(const Key& key, int variant);
+  void storeGainMap(const Key& key, int variant, const uhdr_raw_image_t* gainmap);
+
+  void getStats(uhdr_decoder_cache_stats_t* stats);
+
+ private:
+  struct KeyHash {
+    size_t operator()(const Key& key) const { return (size_t)key.hash; }
+  };
+
+  struct Entry {
+    Key key;                     // data points at image
+    std::vector<uint8_t> image;  // copy of the compressed image
+    bool has_probe_info = false;
+    ProbeInfo probe_info;
+    int gainmap_variant = 0;
+    std::shared_ptr<const uhdr_raw_image_ext_t> gainmap;
+    size_t gainmap_bytes = 0;
+    size_t bytes = 0;  // of the entry as a whole, the copy of the image included
+  };
+
+  using EntryList = std::list<Entry>;
+
+  // most recently used first, moved to the front; call with mMutex held
+  EntryList::iterator touch(const Key& key, bool create);
+  void evict();
+
+  const size_t mCapacity;
+  const bool mKeepGainMaps;
+  std::mutex mMutex;
+  EntryList mEntries;
+  std::unordered_map<Key, EntryList::iterator, KeyHash> mIndex;
+  size_t mBytes = 0;
+  uhdr_decoder_cache_stats_t mStats{};
+};
+
+}  // namespace ultrahdr
+
+#endif  // ULTRAHDR_DECODERCACHE_H
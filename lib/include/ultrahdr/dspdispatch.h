@@ -0,0 +1,85 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ULTRAHDR_DSPDISPATCH_H
+#define ULTRAHDR_DSPDISPATCH_H
+
+#include <memory>
+
+#include "ultrahdr/editorhelper.h"
+#include "ultrahdr/gainmapmath.h"
+
+namespace ultrahdr {
+
+/*!\brief Instruction set extensions the library has kernels for, in increasing order */
+typedef enum uhdr_isa_level {
+  UHDR_ISA_NONE,      /**< scalar code only */
+  UHDR_ISA_NEON,      /**< arm advanced simd */
+  UHDR_ISA_NEON_FP16, /**< arm advanced simd with fp16 arithmetic, on top of the neon level */
+  UHDR_ISA_SSE41,     /**< x86 sse4.1 */
+  UHDR_ISA_AVX2,      /**< x86 avx2 and f16c */
+  UHDR_ISA_AVX512,    /**< x86 avx512f, on top of the avx2 level */
+  UHDR_ISA_RVV,       /**< risc-v vector extension 1.0 */
+  UHDR_ISA_SIMD128,   /**< webassembly 128 bit simd */
+  UHDR_ISA_LSX,       /**< loongarch 128 bit simd */
+  UHDR_ISA_LASX,      /**< loongarch 256 bit simd, on top of the lsx level */
+} uhdr_isa_level_t; /**< alias for enum uhdr_isa_level */
+
+/*!\brief Vector implementations of the dsp kernels, picked for the running cpu
+ *
+ * The library is built for the baseline isa of the target. x86 kernels that need more are
+ * compiled with per function target attributes and are only referenced here after cpuid reports
+ * the extension. RISC-V and LoongArch kernels are handled the same way, the vector extensions are
+ * looked up in the hwcaps. Arm builds enable neon at compile time, so its kernels are taken as is,
+ * while the arm64 fp16 arithmetic kernels are picked after the hwcaps report the extension.
+ * The same holds for WebAssembly builds with simd128, which has no runtime detection. A null entry
+ * means no vector implementation is usable and the caller runs the scalar code.
+ */
+typedef struct uhdr_dsp_functions {
+  uhdr_isa_level_t isa;
+
+  ApplyGainMapRowFn applyGainMapRow;
+  // computes linear output at half precision, for the approximate gain map application only
+  ApplyGainMapRowFn applyGainMapRowHalf;
+  GenerateGainMapRowFn generateGainMapRow;
+  ToneMapRowFn toneMapRow;
+  RgbaF16ToFloatRowFn rgbaF16ToFloatRow;
+  FloatToRgbaF16RowFn floatToRgbaF16Row;
+
+  uhdr_error_info_t (*convertYuv)(uhdr_raw_image_t* image, uhdr_color_gamut_t src_encoding,
+                                  uhdr_color_gamut_t dst_encoding);
+  uhdr_error_info_t (*convertRawInputToYcbcr)(uhdr_raw_image_t* src, uhdr_raw_image_t* dst);
+
+  void (*mirror_uint8_t)(uint8_t*, uint8_t*, int, int, int, int, uhdr_mirror_direction_t);
+  void (*mirror_uint16_t)(uint16_t*, uint16_t*, int, int, int, int, uhdr_mirror_direction_t);
+  void (*mirror_uint32_t)(uint32_t*, uint32_t*, int, int, int, int, uhdr_mirror_direction_t);
+  void (*mirror_uint64_t)(uint64_t*, uint64_t*, int, int, int, int, uhdr_mirror_direction_t);
+
+  void (*rotate_uint8_t)(uint8_t*, uint8_t*, int, int, int, int, int);
+  void (*rotate_uint16_t)(uint16_t*, uint16_t*, int, int, int, int, int);
+  void (*rotate_uint32_t)(uint32_t*, uint32_t*, int, int, int, int, int);
+  void (*rotate_uint64_t)(uint64_t*, uint64_t*, int, int, int, int, int);
+
+  ResampleColumnsFn resampleColumns;
+  ResampleRowRgbaFn resampleRowRgba;
+} uhdr_dsp_functions_t; /**< alias for struct uhdr_dsp_functions */
+
+/*!\brief Returns the kernels for the running cpu. The table is built once, on first use. */
+const uhdr_dsp_functions_t& getDspFunctions();
+
+}  // namespace ultrahdr
+
+#endif  // ULTRAHDR_DSPDISPATCH_H
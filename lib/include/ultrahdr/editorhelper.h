@@ -85,15 +85,16 @@ typedef struct uhdr_crop_effect : uhdr_effect_desc {
 
 /*!\brief resize effect descriptor */
 typedef struct uhdr_resize_effect : uhdr_effect_desc {
-  uhdr_resize_effect(int width, int height);
+  uhdr_resize_effect(int width, int height, uhdr_resize_filter_t filter = UHDR_RESIZE_NEAREST);
 
   std::string to_string() {
     return "effect : resize, metadata : dimensions w, h" + std::to_string(m_width) + " ," +
-           std::to_string(m_height);
+           std::to_string(m_height) + ", filter " + std::to_string(m_filter);
   }
 
   int m_width;
   int m_height;
+  uhdr_resize_filter_t m_filter;
 
   void (*m_resize_uint8_t)(uint8_t*, uint8_t*, int, int, int, int, int, int);
   void (*m_resize_uint16_t)(uint16_t*, uint16_t*, int, int, int, int, int, int);
@@ -101,6 +102,61 @@ typedef struct uhdr_resize_effect : uhdr_effect_desc {
   void (*m_resize_uint64_t)(uint64_t*, uint64_t*, int, int, int, int, int, int);
 } uhdr_resize_effect_t; /**< alias for struct uhdr_resize_effect */
 
+/*!\brief integer affine map from the pixel coordinates of an output plane to the input plane,
+ * src_x = xx * x + xy * y + x0, src_y = yx * x + yy * y + y0 */
+typedef struct uhdr_plane_map {
+  int w, h; /**< dimensions of the output plane */
+  int xx, xy, x0;
+  int yx, yy, y0;
+} uhdr_plane_map_t; /**< alias for struct uhdr_plane_map */
+
+/*!\brief rotate, mirror, crop and resize effects folded into a single pass
+ *
+ * None of these effects blend pixels, every output pixel is a copy of one input pixel. Any sequence
+ * of them reduces to one affine map per plane, so the whole list runs as one copy into one
+ * allocation. Subsampled chroma planes follow a map of their own, built with the halved parameters
+ * the effects use on them, which keeps the result identical to applying the effects in order.
+ */
+typedef struct uhdr_effect_chain {
+  uhdr_effect_chain(int w, int h);
+
+  // each returns false if the effect parameters are unsupported
+  bool rotate(int degree);
+  bool mirror(uhdr_mirror_direction_t direction);
+  bool crop(int left, int top, int wd, int ht);
+  bool resize(int dst_w, int dst_h);
+
+  int width() const { return m_luma.w; }
+  int height() const { return m_luma.h; }
+
+  uhdr_plane_map_t m_luma;
+  uhdr_plane_map_t m_chroma;
+  int m_count; /**< number of effects in the chain */
+} uhdr_effect_chain_t; /**< alias for struct uhdr_effect_chain */
+
+/*!\brief rotate, mirror, crop and resize effects on a gain map folded into a single resample
+ *
+ * A gain map is smooth and is filtered again when it is applied, so unlike #uhdr_effect_chain_t a
+ * blending resize need not run as its own pass. Any sequence of the effects reduces to a window of
+ * the input, resampled once to the output size at gain map resolution, and an orientation.
+ */
+typedef struct uhdr_gainmap_transform {
+  uhdr_gainmap_transform(int w, int h);
+
+  // each returns false if the effect parameters are unsupported
+  bool rotate(int degree);
+  bool mirror(uhdr_mirror_direction_t direction);
+  bool crop(int left, int top, int wd, int ht);
+  bool resize(int dst_w, int dst_h, uhdr_resize_filter_t filter);
+
+  int width() const { return m_orient.w; }
+  int height() const { return m_orient.h; }
+
+  uhdr_plane_map_t m_orient; /**< output onto the resampled window, rotations and mirrors only */
+  float m_left, m_top, m_width, m_height; /**< window of the input, in input pixels */
+  uhdr_resize_filter_t m_filter;          /**< filter of the last blending resize */
+} uhdr_gainmap_transform_t; /**< alias for struct uhdr_gainmap_transform */
+
 template <typename T>
 extern void rotate_buffer_clockwise(T* src_buffer, T* dst_buffer, int src_w, int src_h,
                                     int src_stride, int dst_stride, int degree);
@@ -115,6 +171,27 @@ extern void resize_buffer(T* src_buffer, T* dst_buffer, int src_w, int src_h, in
 
 std::unique_ptr<uhdr_raw_image_ext_t> resize_image(uhdr_raw_image_t* src, int dst_w, int dst_h);
 
+/*!\brief Weighs taps rows of count floats into dst, dst[i] = sum of weights[k] * rows[k][i].
+ * Returns the number of floats written, the caller finishes the rest. */
+typedef int (*ResampleColumnsFn)(const float* const* rows, const float* weights, int taps,
+                                 float* dst, int count);
+
+/*!\brief Filters a row of rgba float pixels. Output pixel x is the sum of weights[x * taps + k]
+ * times input pixel starts[x] + k. Returns the number of pixels written, the caller finishes the
+ * rest. */
+typedef int (*ResampleRowRgbaFn)(const float* src, const int* starts, const float* weights,
+                                 int taps, float* dst, int count);
+
+void resampleColumns(const float* const* rows, const float* weights, int taps, float* dst,
+                     int count);
+void resampleRowRgba(const float* src, const int* starts, const float* weights, int taps,
+                     float* dst, int count);
+
+/*!\brief Resamples every plane of src to dst_w x dst_h with a separable filter. Subsampled chroma
+ * planes are resampled at their own resolution. Returns nullptr for unsupported formats. */
+std::unique_ptr<uhdr_raw_image_ext_t> resample_image(uhdr_raw_image_t* src, int dst_w, int dst_h,
+                                                     uhdr_resize_filter_t filter);
+
 #if (defined(UHDR_ENABLE_INTRINSICS) && (defined(__ARM_NEON__) || defined(__ARM_NEON)))
 template <typename T>
 extern void mirror_buffer_neon(T* src_buffer, T* dst_buffer, int src_w, int src_h, int src_stride,
@@ -123,6 +200,58 @@ extern void mirror_buffer_neon(T* src_buffer, T* dst_buffer, int src_w, int src_
 template <typename T>
 extern void rotate_buffer_clockwise_neon(T* src_buffer, T* dst_buffer, int src_w, int src_h,
                                          int src_stride, int dst_stride, int degrees);
+
+int resampleColumns_neon(const float* const* rows, const float* weights, int taps, float* dst,
+                         int count);
+int resampleRowRgba_neon(const float* src, const int* starts, const float* weights, int taps,
+                         float* dst, int count);
+#endif
+
+#if (defined(UHDR_ENABLE_INTRINSICS) && \
+     (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)))
+template <typename T>
+extern void mirror_buffer_sse41(T* src_buffer, T* dst_buffer, int src_w, int src_h,
+                                int src_stride, int dst_stride, uhdr_mirror_direction_t direction);
+
+template <typename T>
+extern void rotate_buffer_clockwise_sse41(T* src_buffer, T* dst_buffer, int src_w, int src_h,
+                                          int src_stride, int dst_stride, int degrees);
+
+int resampleColumns_avx2(const float* const* rows, const float* weights, int taps, float* dst,
+                         int count);
+int resampleRowRgba_avx2(const float* src, const int* starts, const float* weights, int taps,
+                         float* dst, int count);
+#endif
+
+#if (defined(UHDR_ENABLE_INTRINSICS) && defined(UHDR_ENABLE_RVV))
+template <typename T>
+extern void mirror_buffer_rvv(T* src_buffer, T* dst_buffer, int src_w, int src_h, int src_stride,
+                              int dst_stride, uhdr_mirror_direction_t direction);
+
+template <typename T>
+extern void rotate_buffer_clockwise_rvv(T* src_buffer, T* dst_buffer, int src_w, int src_h,
+                                        int src_stride, int dst_stride, int degrees);
+#endif
+
+#if (defined(UHDR_ENABLE_INTRINSICS) && defined(__wasm_simd128__))
+template <typename T>
+extern void mirror_buffer_simd128(T* src_buffer, T* dst_buffer, int src_w, int src_h,
+                                  int src_stride, int dst_stride,
+                                  uhdr_mirror_direction_t direction);
+
+template <typename T>
+extern void rotate_buffer_clockwise_simd128(T* src_buffer, T* dst_buffer, int src_w, int src_h,
+                                            int src_stride, int dst_stride, int degrees);
+#endif
+
+#if (defined(UHDR_ENABLE_INTRINSICS) && defined(UHDR_ENABLE_LSX))
+template <typename T>
+extern void mirror_buffer_lsx(T* src_buffer, T* dst_buffer, int src_w, int src_h, int src_stride,
+                              int dst_stride, uhdr_mirror_direction_t direction);
+
+template <typename T>
+extern void rotate_buffer_clockwise_lsx(T* src_buffer, T* dst_buffer, int src_w, int src_h,
+                                        int src_stride, int dst_stride, int degrees);
 #endif
 
 #ifdef UHDR_ENABLE_GLES
@@ -144,6 +273,11 @@ std::unique_ptr<uhdr_raw_image_ext_t> apply_rotate_gles(ultrahdr::uhdr_rotate_ef
 std::unique_ptr<uhdr_raw_image_ext_t> apply_crop_gles(uhdr_raw_image_t* src, int left, int top,
                                                       int wd, int ht, uhdr_opengl_ctxt* gl_ctxt,
                                                       GLuint* srcTexture);
+
+std::unique_ptr<uhdr_raw_image_ext_t> apply_effect_chain_gles(const uhdr_effect_chain_t& chain,
+                                                              uhdr_raw_image_t* src,
+                                                              uhdr_opengl_ctxt* gl_ctxt,
+                                                              GLuint* srcTexture);
 #endif
 
 std::unique_ptr<uhdr_raw_image_ext_t> apply_rotate(ultrahdr::uhdr_rotate_effect_t* desc,
@@ -164,6 +298,29 @@ std::unique_ptr<uhdr_raw_image_ext_t> apply_crop(ultrahdr::uhdr_crop_effect_t* d
                                                  int ht, void* gl_ctxt = nullptr,
                                                  void* texture = nullptr);
 
+/*!\brief Crops without copying, the result is a view that shares the memory of src. A crop of a
+ * gpu texture runs as the overload above. */
+std::unique_ptr<uhdr_raw_image_ext_t> apply_crop(ultrahdr::uhdr_crop_effect_t* desc,
+                                                 uhdr_raw_image_ext_t* src, int left, int top,
+                                                 int wd, int ht, void* gl_ctxt = nullptr,
+                                                 void* texture = nullptr);
+
+/*!\brief Runs the chain in one pass. With a gpu texture of src, the pass runs on the texture and
+ * the memory of the result is left for the caller to read the texture into. */
+std::unique_ptr<uhdr_raw_image_ext_t> apply_effect_chain(const uhdr_effect_chain_t& chain,
+                                                         uhdr_raw_image_t* src,
+                                                         void* gl_ctxt = nullptr,
+                                                         void* texture = nullptr);
+
+/*!\brief As above, but a chain that only crops returns a view that shares the memory of src. */
+std::unique_ptr<uhdr_raw_image_ext_t> apply_effect_chain(const uhdr_effect_chain_t& chain,
+                                                         uhdr_raw_image_ext_t* src,
+                                                         void* gl_ctxt = nullptr,
+                                                         void* texture = nullptr);
+
+std::unique_ptr<uhdr_raw_image_ext_t> apply_gainmap_transform(
+    const uhdr_gainmap_transform_t& transform, uhdr_raw_image_t* src);
+
 }  // namespace ultrahdr
 
 #endif  // ULTRAHDR_EDITORHELPER_H
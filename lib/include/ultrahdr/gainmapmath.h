@@ -17,10 +17,14 @@
 #ifndef ULTRAHDR_GAINMAPMATH_H
 #define ULTRAHDR_GAINMAPMATH_H
 
+#include <algorithm>
 #include <array>
 #include <cmath>
 #include <cstring>
-#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 #include "ultrahdr_api.h"
 #include "ultrahdr/ultrahdrcommon.h"
@@ -77,6 +81,11 @@ typedef Color (*SceneToDisplayLuminanceFn)(Color, LuminanceFn);
 typedef Color (*GetPixelFn)(uhdr_raw_image_t*, size_t, size_t);
 typedef Color (*SamplePixelFn)(uhdr_raw_image_t*, size_t, size_t, size_t);
 typedef void (*PutPixelFn)(uhdr_raw_image_t*, size_t, size_t, Color&);
+// Row wise variants of the above, for count consecutive pixels of row y starting at column x. The
+// channels are planar, [0] for r or y, [1] for g or u and [2] for b or v.
+typedef void (*GetRowFn)(uhdr_raw_image_t*, size_t, size_t, size_t, float* [3]);
+typedef void (*SampleRowFn)(uhdr_raw_image_t*, size_t, size_t, size_t, size_t, float* [3]);
+typedef void (*PutRowFn)(uhdr_raw_image_t*, size_t, size_t, size_t, float* [3]);
 
 inline Color operator+=(Color& lhs, const Color& rhs) {
   lhs.r += rhs.r;
@@ -347,20 +356,44 @@ Color pqInvOetfLUT(Color e_gamma);
 constexpr int32_t kPqInvOETFPrecision = 12;
 constexpr int32_t kPqInvOETFNumEntries = 1 << kPqInvOETFPrecision;
 
-// util class to prepare look up tables for oetf/eotf functions
-class LookUpTable {
- public:
-  LookUpTable(size_t numEntries, std::function<float(float)> computeFunc) {
-    for (size_t idx = 0; idx < numEntries; idx++) {
-      float value = static_cast<float>(idx) / static_cast<float>(numEntries - 1);
-      table.push_back(computeFunc(value));
-    }
-  }
-  const std::vector<float>& getTable() const { return table; }
+// Tables backing srgbInvOetfLUT(), hlgOetfLUT(), pqOetfLUT(), hlgInvOetfLUT() and pqInvOetfLUT().
+// These are exposed for vector implementations that look up several entries at once. The tables
+// are precomputed constants, see transferfunctionluts.h.
+const float* getSrgbInvOetfLUT();
+const float* getHlgOetfLUT();
+const float* getPqOetfLUT();
+const float* getHlgInvOetfLUT();
+const float* getPqInvOetfLUT();
+
+// 10-bit hlg and pq code values of linear hdr colors, in units of sdr white. The scaling to the
+// peak luminance and for hlg the inverse ootf, see hlgInverseOotfApprox(), are folded into the
+// tables. They are indexed by the exponent and the upper mantissa bits of the float, so the steps
+// are relative to the value and stay fine over the dark end where both transfer functions are
+// steepest. Negative inputs and inputs below 2^kHdrCodeLUTMinExponent map to the first entry,
+// inputs from 2^kHdrCodeLUTMaxExponent on to the last one.
+constexpr int32_t kHdrCodeLUTMantissaBits = 10;
+constexpr int32_t kHdrCodeLUTMinExponent = -30;
+constexpr int32_t kHdrCodeLUTMaxExponent = 6;
+constexpr int32_t kHdrCodeLUTNumEntries =
+    (kHdrCodeLUTMaxExponent - kHdrCodeLUTMinExponent) << kHdrCodeLUTMantissaBits;
+// (float bits >> kHdrCodeLUTShift) - kHdrCodeLUTBias is the index of a positive input
+constexpr int32_t kHdrCodeLUTShift = 23 - kHdrCodeLUTMantissaBits;
+constexpr int32_t kHdrCodeLUTBias = (127 + kHdrCodeLUTMinExponent) << kHdrCodeLUTMantissaBits;
+
+inline int32_t hdrCodeLUTIndex(float e) {
+  int32_t bits;
+  memcpy(&bits, &e, sizeof bits);
+  return CLIP3((bits >> kHdrCodeLUTShift) - kHdrCodeLUTBias, 0, kHdrCodeLUTNumEntries - 1);
+}
 
- private:
-  std::vector<float> table;
-};
+// The tables hold kHdrCodeLUTNumEntries + 1 entries, the last one repeated, so that vector
+// implementations may gather 32-bit words at 16-bit offsets and mask the upper half.
+const uint16_t* getHlgCodeLUT();
+const uint16_t* getPqCodeLUT();
+
+// Packed 10-bit hlg or pq pixel of a linear hdr color with the tables above
+uint32_t hlgLinearToRgba1010102(Color e);
+uint32_t pqLinearToRgba1010102(Color e);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Color access functions
@@ -414,15 +447,44 @@ extern const std::array<float, 9> kYuvBt601ToBt2100;
 extern const std::array<float, 9> kYuvBt2100ToBt709;
 extern const std::array<float, 9> kYuvBt2100ToBt601;
 
-#if (defined(UHDR_ENABLE_INTRINSICS) && (defined(__ARM_NEON__) || defined(__ARM_NEON)))
+// The same conversions for the fixed point kernels. Coefficients are scaled by 2^14 and the two
+// that are always 1 and 0 are dropped, leaving {Y1, Y2, U1, U2, V1, V2, 0, 0}, see
+// yuvGamutConversionQ14(). This can cause an off by one error compared to the floating point
+// implementation.
+extern const int16_t kYuv709To601_coeffs_q14[8];
+extern const int16_t kYuv709To2100_coeffs_q14[8];
+extern const int16_t kYuv601To709_coeffs_q14[8];
+extern const int16_t kYuv601To2100_coeffs_q14[8];
+extern const int16_t kYuv2100To709_coeffs_q14[8];
+extern const int16_t kYuv2100To601_coeffs_q14[8];
+
+// Looks up the fixed point coefficients of a yuv encoding conversion. coeffs is set to nullptr if
+// the encodings are the same.
+uhdr_error_info_t getYuvConversionCoeffsQ14(uhdr_color_gamut_t src_encoding,
+                                            uhdr_color_gamut_t dst_encoding,
+                                            const int16_t** coeffs);
+
+// Weighted sum of the unbiased chroma samples, rounded and saturated the way the vector kernels
+// narrow their 32 bit products, so the scalar tails of the kernels stay bit exact with them.
+inline int yuvGamutConversionQ14(int u, int v, int16_t c1, int16_t c2) {
+  const int sum = (u * c1 + v * c2 + (1 << 13)) >> 14;
+  return CLIP3(sum, INT16_MIN, INT16_MAX);
+}
+
+// Fixed point conversion of a row of 8 bit samples, see transformYuv420_neon(). Converts the
+// pixels [x, width) of the row pair y * 2, y * 2 + 1 for 420 and of row y for 444.
+void transformYuv420RowQ14(uhdr_raw_image_t* image, const int16_t* coeffs, size_t x, size_t y);
+void transformYuv444RowQ14(uhdr_raw_image_t* image, const int16_t* coeffs, size_t x, size_t y);
+
+typedef void (*TransformYuvQ14Fn)(uhdr_raw_image_t* image, const int16_t* coeffs_ptr);
 
-extern const int16_t kYuv709To601_coeffs_neon[8];
-extern const int16_t kYuv709To2100_coeffs_neon[8];
-extern const int16_t kYuv601To709_coeffs_neon[8];
-extern const int16_t kYuv601To2100_coeffs_neon[8];
-extern const int16_t kYuv2100To709_coeffs_neon[8];
-extern const int16_t kYuv2100To601_coeffs_neon[8];
+// Converts a 420 or 444 image in place with the given fixed point kernels
+uhdr_error_info_t convertYuvQ14(uhdr_raw_image_t* image, uhdr_color_gamut_t src_encoding,
+                                uhdr_color_gamut_t dst_encoding,
+                                TransformYuvQ14Fn transform_yuv420,
+                                TransformYuvQ14Fn transform_yuv444);
 
+#if (defined(UHDR_ENABLE_INTRINSICS) && (defined(__ARM_NEON__) || defined(__ARM_NEON)))
 /*
  * The Y values are provided at half the width of U & V values to allow use of the widening
  * arithmetic instructions.
@@ -437,6 +499,41 @@ uhdr_error_info_t convertYuv_neon(uhdr_raw_image_t* image, uhdr_color_gamut_t sr
                                   uhdr_color_gamut_t dst_encoding);
 #endif
 
+#if (defined(UHDR_ENABLE_INTRINSICS) && \
+     (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)))
+// Any width is accepted, the columns past the last full vector are converted by the scalar code
+void transformYuv420_sse41(uhdr_raw_image_t* image, const int16_t* coeffs_ptr);
+void transformYuv444_sse41(uhdr_raw_image_t* image, const int16_t* coeffs_ptr);
+uhdr_error_info_t convertYuv_sse41(uhdr_raw_image_t* image, uhdr_color_gamut_t src_encoding,
+                                   uhdr_color_gamut_t dst_encoding);
+
+void transformYuv420_avx2(uhdr_raw_image_t* image, const int16_t* coeffs_ptr);
+void transformYuv444_avx2(uhdr_raw_image_t* image, const int16_t* coeffs_ptr);
+uhdr_error_info_t convertYuv_avx2(uhdr_raw_image_t* image, uhdr_color_gamut_t src_encoding,
+                                  uhdr_color_gamut_t dst_encoding);
+#endif
+
+#if (defined(UHDR_ENABLE_INTRINSICS) && defined(UHDR_ENABLE_RVV))
+void transformYuv420_rvv(uhdr_raw_image_t* image, const int16_t* coeffs_ptr);
+void transformYuv444_rvv(uhdr_raw_image_t* image, const int16_t* coeffs_ptr);
+uhdr_error_info_t convertYuv_rvv(uhdr_raw_image_t* image, uhdr_color_gamut_t src_encoding,
+                                 uhdr_color_gamut_t dst_encoding);
+#endif
+
+#if (defined(UHDR_ENABLE_INTRINSICS) && defined(__wasm_simd128__))
+void transformYuv420_simd128(uhdr_raw_image_t* image, const int16_t* coeffs_ptr);
+void transformYuv444_simd128(uhdr_raw_image_t* image, const int16_t* coeffs_ptr);
+uhdr_error_info_t convertYuv_simd128(uhdr_raw_image_t* image, uhdr_color_gamut_t src_encoding,
+                                     uhdr_color_gamut_t dst_encoding);
+#endif
+
+#if (defined(UHDR_ENABLE_INTRINSICS) && defined(UHDR_ENABLE_LSX))
+void transformYuv420_lsx(uhdr_raw_image_t* image, const int16_t* coeffs_ptr);
+void transformYuv444_lsx(uhdr_raw_image_t* image, const int16_t* coeffs_ptr);
+uhdr_error_info_t convertYuv_lsx(uhdr_raw_image_t* image, uhdr_color_gamut_t src_encoding,
+                                 uhdr_color_gamut_t dst_encoding);
+#endif
+
 // Performs a color gamut transformation on an yuv image.
 Color yuvColorGamutConversion(Color e_gamma, const std::array<float, 9>& coeffs);
 void transformYuv420(uhdr_raw_image_t* image, const std::array<float, 9>& coeffs);
@@ -445,45 +542,70 @@ void transformYuv444(uhdr_raw_image_t* image, const std::array<float, 9>& coeffs
 ////////////////////////////////////////////////////////////////////////////////
 // Gain map calculations
 
-constexpr int32_t kGainFactorPrecision = 10;
-constexpr int32_t kGainFactorNumEntries = 1 << kGainFactorPrecision;
+// The gain table is indexed by the gain map sample in units of 1 / kGainFactorSubSteps of an 8-bit
+// code, so every code lands on an entry of its own. The map gamma and the gain map weight are
+// folded into the table, a lookup is all that is left per pixel.
+constexpr int32_t kGainFactorSubSteps = 16;
+constexpr int32_t kGainFactorNumEntries = 255 * kGainFactorSubSteps + 1;
 
 struct GainLUT {
-  GainLUT(uhdr_gainmap_metadata_ext_t* metadata) {
-    this->mGammaInv = 1.0f / metadata->gamma;
+  GainLUT(uhdr_gainmap_metadata_ext_t* metadata, float gainmapWeight = 1.0f) {
+    const float gammaInv = 1.0f / metadata->gamma;
+    const float log2MinBoost = log2(metadata->min_content_boost);
+    const float log2MaxBoost = log2(metadata->max_content_boost);
     for (int32_t idx = 0; idx < kGainFactorNumEntries; idx++) {
       float value = static_cast<float>(idx) / static_cast<float>(kGainFactorNumEntries - 1);
-      float logBoost = log2(metadata->min_content_boost) * (1.0f - value) +
-                       log2(metadata->max_content_boost) * value;
-      mGainTable[idx] = exp2(logBoost);
-    }
-  }
-
-  GainLUT(uhdr_gainmap_metadata_ext_t* metadata, float gainmapWeight) {
-    this->mGammaInv = 1.0f / metadata->gamma;
-    for (int32_t idx = 0; idx < kGainFactorNumEntries; idx++) {
-      float value = static_cast<float>(idx) / static_cast<float>(kGainFactorNumEntries - 1);
-      float logBoost = log2(metadata->min_content_boost) * (1.0f - value) +
-                       log2(metadata->max_content_boost) * value;
+      if (gammaInv != 1.0f) value = pow(value, gammaInv);
+      float logBoost = log2MinBoost * (1.0f - value) + log2MaxBoost * value;
       mGainTable[idx] = exp2(logBoost * gainmapWeight);
     }
   }
 
   ~GainLUT() {}
 
-  float getGainFactor(float gain) {
-    if (mGammaInv != 1.0f) gain = pow(gain, mGammaInv);
+  // gain is the gain map sample in the range [0, 1], as encoded, i.e. before the map gamma
+  float getGainFactor(float gain) const {
     int32_t idx = static_cast<int32_t>(gain * (kGainFactorNumEntries - 1) + 0.5);
     // TODO() : Remove once conversion modules have appropriate clamping in place
     idx = CLIP3(idx, 0, kGainFactorNumEntries - 1);
     return mGainTable[idx];
   }
 
+  // gain factor of an 8-bit gain map code
+  float getGainFactorForCode(uint8_t code) const { return mGainTable[code * kGainFactorSubSteps]; }
+
+  const float* getGainTable() const { return mGainTable; }
+
  private:
   float mGainTable[kGainFactorNumEntries];
-  float mGammaInv;
 };
 
+/*
+ * Branchless log2 of a positive normal float, with an absolute error below 3e-6 on top of the
+ * rounding of the result. That is under a hundredth of the step the encoder quantizes log2 gains
+ * to. The exponent is taken from the bits and the mantissa, moved to [sqrt(0.5), sqrt(2)), goes
+ * through a degree 6 polynomial that is exact at 1. There are no calls, so it inlines into the
+ * gain loops of the realtime preset.
+ */
+inline float fastLog2(float x) {
+  int32_t bits;
+  memcpy(&bits, &x, sizeof bits);
+  // subtracting the bits of sqrt(0.5) splits the value at sqrt(0.5) instead of 1
+  const int32_t offset = bits - 0x3f3504f3;
+  const int32_t exponent = offset >> 23;
+  bits -= exponent * (1 << 23);
+  float m;
+  memcpy(&m, &bits, sizeof m);
+  const float t = m - 1.0f;
+  float p = -0.20659015f;
+  p = p * t + 0.32215470f;
+  p = p * t - 0.36749029f;
+  p = p * t + 0.47934803f;
+  p = p * t - 0.72113186f;
+  p = p * t + 1.44271350f;
+  return p * t + static_cast<float>(exponent);
+}
+
 /*
  * Calculate the 8-bit unsigned integer gain value for the given SDR and HDR
  * luminances in linear space and gainmap metadata fields.
@@ -522,6 +644,260 @@ Color sampleMap3Channel(uhdr_raw_image_t* map, float map_scale_factor, size_t x,
 Color sampleMap3Channel(uhdr_raw_image_t* map, size_t map_scale_factor, size_t x, size_t y,
                         ShepardsIDW& weightTables, bool has_alpha);
 
+/*
+ * Channels of a gain map as seen by the samplers below. Multi-channel maps are sampled from the
+ * planar copy of planar_gain_map(), whose channels are the three planes of a 4:4:4 image, so the
+ * samples of a channel are contiguous along a map row. Interleaved maps are read in place, a step
+ * of their channel count apart.
+ */
+struct GainMapPlanes {
+  explicit GainMapPlanes(const uhdr_raw_image_t* map);
+
+  // first sample of channel c in map row y
+  const uint8_t* row(int c, size_t y) const { return mPlane[c] + y * mStride[c]; }
+
+  const uint8_t* mPlane[3];
+  size_t mStride[3];  // bytes between map rows
+  size_t mStep;       // bytes between the samples of a channel within a row
+  int mOutChannels;
+};
+
+/*
+ * Planar copy of an rgb888 or rgba8888 gain map, described as a 4:4:4 image with one plane per
+ * channel and alpha dropped. nullptr for other formats. Only the samplers and the gain map
+ * application take the copy, the map is handed out interleaved.
+ */
+std::unique_ptr<uhdr_raw_image_ext_t> planar_gain_map(const uhdr_raw_image_t* map);
+
+/*
+ * Sample the gain map for count consecutive pixels of row y, starting at column x, for integer
+ * map scale factors. The results match sampleMap() and sampleMap3Channel() with ShepardsIDW, but
+ * the map samples are read once per map column rather than once per pixel. gains receives one
+ * value per pixel for single channel maps and three interleaved values per pixel otherwise.
+ */
+void sampleMapRow(uhdr_raw_image_t* map, size_t map_scale_factor, size_t x, size_t y,
+                  size_t count, ShepardsIDW& weightTables, float* gains);
+
+/*
+ * Gain map columns sampled by the pixel columns [0, width) of an image, for fractional map scale
+ * factors. Each pixel column keeps its two neighbouring map columns and its distances to them, so
+ * that sampleMapRow() does no coordinate math per pixel. The row terms are computed once per row.
+ */
+struct MapSampleColumns {
+  MapSampleColumns(const uhdr_raw_image_t* map, float mapScaleFactor, size_t width);
+
+  float mMapScaleFactor;
+  std::vector<uint32_t> mLower;  // map columns
+  std::vector<uint32_t> mUpper;
+  std::vector<float> mDistLower;  // signed distances to them, in map samples
+  std::vector<float> mDistUpper;
+};
+
+/*
+ * Row wise sampleMap() and sampleMap3Channel() for fractional map scale factors, with the output
+ * layout of the integer sampleMapRow(). Columns x + count must be covered by columns.
+ */
+void sampleMapRow(uhdr_raw_image_t* map, const MapSampleColumns& columns, size_t x, size_t y,
+                  size_t count, float* gains);
+
+/*
+ * Blocks of kBlockSize x kBlockSize gain map samples that hold a single value, along with the next
+ * sample row and column that pixels of the block interpolate with. Every pixel sampling a flat
+ * block takes its value, so rows can be filled over such blocks without interpolation.
+ */
+struct FlatGainMapBlocks {
+  static constexpr size_t kBlockSize = 8;
+
+  FlatGainMapBlocks(const uhdr_raw_image_t* map, float mapScaleFactor);
+
+  // Pixels [x, end) of row y sample one block, returns end <= x_end. value is set to the value of
+  // the block or -1 if it is not flat.
+  size_t span(size_t x, size_t y, size_t x_end, int32_t& value) const;
+
+  // Writes count pixels of value, in the output layout of sampleMapRow() and sampleMapRowFixed()
+  void fillRow(int32_t value, size_t count, float* gains) const;
+  void fillRowFixed(int32_t value, size_t count, uint32_t* gains) const;
+
+  int mOutChannels;
+  size_t mBlocksW, mBlocksH;
+  size_t mFlatBlocks;
+  int32_t mConstant;  // value of every block if the whole map is flat, -1 otherwise
+  std::vector<int32_t> mValues;  // per block, channels packed a byte each, -1 if not flat
+  std::vector<size_t> mColStart;  // first pixel column and row sampling each block column and row
+  std::vector<size_t> mRowStart;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Fixed point gain map application
+//
+// Integer rendition of applyGainLUT() for 8-bit sRGB outputs. Linear light is carried as unorm16.
+// SDR inputs are relative to sdr white, outputs are relative to the peak of the target display,
+// i.e. sdr white scaled by the display boost. The 1 / display boost normalization is folded into
+// the gain factors, which are stored in Q16. Gain map samples are interpolated in units of
+// 1 / kGainFixedSubSteps of an 8-bit code and index the gain table directly, so the map gamma costs
+// nothing per pixel.
+
+constexpr int32_t kFixedPointPrecision = 16;
+constexpr int32_t kUnorm16Max = (1 << 16) - 1;
+constexpr int32_t kGainFixedSubSteps = 16;
+constexpr int32_t kGainFixedNumEntries = 255 * kGainFixedSubSteps + 1;
+constexpr int32_t kSrgbOetfFixedPrecision = 12;
+constexpr int32_t kSrgbOetfFixedNumEntries = 1 << kSrgbOetfFixedPrecision;
+
+// sRGB eotf, 8-bit codes to unorm16
+uint16_t srgbInvOetfFixed(uint8_t e_gamma);
+
+// sRGB oetf, unorm16 to 8-bit codes
+uint8_t srgbOetfFixed(uint16_t e);
+
+struct GainLUTFixed {
+  GainLUTFixed(uhdr_gainmap_metadata_ext_t* metadata, float gainmapWeight, float displayBoost);
+
+  uint32_t getGainFactor(uint32_t gain) const {
+    return mGainTable[gain < kGainFixedNumEntries ? gain : kGainFixedNumEntries - 1];
+  }
+
+  int32_t getOffsetSdr() const { return mOffsetSdr; }
+  int32_t getOffsetHdr() const { return mOffsetHdr; }
+
+ private:
+  uint32_t mGainTable[kGainFixedNumEntries];
+  int32_t mOffsetSdr;  // unorm16, relative to sdr white
+  int32_t mOffsetHdr;  // unorm16, relative to display peak
+};
+
+// Integer copy of the ShepardsIDW tables, weights are in Q8 and sum to 256 for every position.
+struct ShepardsIDWFixed {
+  ShepardsIDWFixed(const ShepardsIDW& weightTables);
+
+  int mMapScaleFactor;
+  std::vector<uint16_t> mWeights;    // default
+  std::vector<uint16_t> mWeightsNR;  // no right
+  std::vector<uint16_t> mWeightsNB;  // no bottom
+  std::vector<uint16_t> mWeightsC;   // no right & bottom
+};
+
+/*
+ * Sample the gain map at the provided location, for integer map scale factors. One value is
+ * written for single channel maps and three for rgb maps, with 0 and kGainFixedNumEntries - 1
+ * matching 8-bit codes 0 and 255.
+ */
+void sampleMapFixed(uhdr_raw_image_t* map, size_t map_scale_factor, size_t x, size_t y,
+                    const ShepardsIDWFixed& weightTables, uint32_t gain[3]);
+
+// Row wise sampleMapFixed(), for count consecutive pixels of row y starting at column x. The output
+// layout is the one of sampleMapRow().
+void sampleMapRowFixed(uhdr_raw_image_t* map, size_t map_scale_factor, size_t x, size_t y,
+                       size_t count, const ShepardsIDWFixed& weightTables, uint32_t* gains);
+
+// Applies the gain to the unorm16 sdr value e, gain as returned by sampleMapFixed().
+uint16_t applyGainFixed(uint16_t e, uint32_t gain, const GainLUTFixed& gainLUT);
+
+/*
+ * Approximation of the whole float gain map application of a single channel gain map, for a fixed
+ * gain map weight and output transfer. With the gain shared by the channels and the hlg inverse
+ * ootf approximated per channel, each output channel only depends on the sdr value of the same
+ * channel and the gain. The table samples that mapping, from the sdr value (srgb transfer) and the
+ * gain map sample to the output value, encoded with the output transfer, or linear for
+ * UHDR_CT_LINEAR. Values in between are interpolated bilinearly, so no transfer function is
+ * evaluated per pixel. The sdr axis has a node per 8-bit code.
+ */
+struct GainMapOutputLUT {
+  static constexpr int kSdrNodes = 256;
+  static constexpr int kGainNodes = 65;
+
+  GainMapOutputLUT(uhdr_gainmap_metadata_ext_t* metadata, float gainmapWeight,
+                   uhdr_color_transfer_t outputCt);
+
+  // rgb_gamma_sdr as returned by p3YuvToRgb(), gain as returned by sampleMap()
+  Color lookup(Color rgb_gamma_sdr, float gain) const {
+    const float gainPos = CLIP3(gain * (kGainNodes - 1), 0.0f, static_cast<float>(kGainNodes - 1));
+    const int gainIdx = (std::min)(static_cast<int>(gainPos), kGainNodes - 2);
+    const float gainFrac = gainPos - gainIdx;
+    const float* row = mTable.data() + (size_t)gainIdx * kSdrNodes;
+    auto interpolate = [row, gainFrac](float e) {
+      const float pos = CLIP3(e * (kSdrNodes - 1), 0.0f, static_cast<float>(kSdrNodes - 1));
+      const int idx = (std::min)(static_cast<int>(pos), kSdrNodes - 2);
+      const float frac = pos - idx;
+      const float* p = row + idx;
+      const float lo = p[0] + (p[1] - p[0]) * frac;
+      const float hi = p[kSdrNodes] + (p[kSdrNodes + 1] - p[kSdrNodes]) * frac;
+      return lo + (hi - lo) * gainFrac;
+    };
+    return {{{interpolate(rgb_gamma_sdr.r), interpolate(rgb_gamma_sdr.g),
+              interpolate(rgb_gamma_sdr.b)}}};
+  }
+
+ private:
+  // sdr value varies fastest
+  std::vector<float> mTable;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Gain map table cache
+//
+// Process wide cache of the interpolation and gain tables of gain map application, keyed by the
+// inputs of each table. Decodes of images with the same map scale factor, metadata and display
+// boost share one copy of the tables instead of building them on every call. Cached tables are
+// never modified, a caller may use them for as long as it holds the returned reference. Each kind
+// of table keeps its kMaxEntries most recently used entries.
+
+class GainMapTableCache {
+ public:
+  static constexpr size_t kMaxEntries = 8;
+
+  static GainMapTableCache& getDefaultCache();
+
+  std::shared_ptr<ShepardsIDW> getIdwTable(int mapScaleFactor);
+  std::shared_ptr<ShepardsIDWFixed> getIdwTableFixed(int mapScaleFactor);
+  std::shared_ptr<GainLUT> getGainLUT(uhdr_gainmap_metadata_ext_t* metadata, float gainmapWeight);
+  std::shared_ptr<GainLUTFixed> getGainLUTFixed(uhdr_gainmap_metadata_ext_t* metadata,
+                                                float gainmapWeight, float displayBoost);
+  std::shared_ptr<GainMapOutputLUT> getGainMapOutputLUT(uhdr_gainmap_metadata_ext_t* metadata,
+                                                        float gainmapWeight,
+                                                        uhdr_color_transfer_t outputCt);
+
+  // drops all entries, tables still referenced by callers stay alive until released
+  void clear();
+
+ private:
+  // inputs of a table, compared bit wise
+  using Key = std::array<float, 7>;
+  template <typename T>
+  using Entries = std::list<std::pair<Key, std::shared_ptr<T>>>;
+
+  template <typename T, typename CreateFn>
+  std::shared_ptr<T> lookup(Entries<T>& entries, const Key& key, CreateFn create);
+
+  std::mutex mMutex;
+  Entries<ShepardsIDW> mIdwTables;
+  Entries<ShepardsIDWFixed> mIdwTablesFixed;
+  Entries<GainLUT> mGainLUTs;
+  Entries<GainLUTFixed> mGainLUTsFixed;
+  Entries<GainMapOutputLUT> mGainMapOutputLUTs;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Color blocks
+//
+// A ColorBlock holds up to kColorBlockSize colors with one array per channel. The block functions
+// process the first n colors of a block, n <= kColorBlockSize, with the per color math of the Color
+// function they stand for, as loops over the channel arrays that the compiler can vectorize.
+constexpr size_t kColorBlockSize = 64;
+
+struct ColorBlock {
+  alignas(64) float r[kColorBlockSize];
+  alignas(64) float g[kColorBlockSize];
+  alignas(64) float b[kColorBlockSize];
+};
+
+// Transforms the colors of the block in place.
+typedef void (*ColorBlockTransformFn)(ColorBlock& e, size_t n);
+// Writes the luminance of each color of the block to y.
+typedef void (*LuminanceBlockFn)(const ColorBlock& e, size_t n, float* y);
+
+void clipNegatives(ColorBlock& e, size_t n);
+
 ////////////////////////////////////////////////////////////////////////////////
 // function selectors
 
@@ -533,12 +909,44 @@ SceneToDisplayLuminanceFn getOotfFn(uhdr_color_transfer_t transfer);
 GetPixelFn getPixelFn(uhdr_img_fmt_t format);
 SamplePixelFn getSamplePixelFn(uhdr_img_fmt_t format);
 PutPixelFn putPixelFn(uhdr_img_fmt_t format);
+// The row accessors give the same results as the pixel accessors of the format, without an indirect
+// call per pixel.
+GetRowFn getRowFn(uhdr_img_fmt_t format);
+SampleRowFn getSampleRowFn(uhdr_img_fmt_t format);
+PutRowFn putRowFn(uhdr_img_fmt_t format);
+// Block variants of the above. getOetfBlockFn() gives the oetf of the transfer. The ootf returned
+// by getOotfBlockFn() does not depend on the luminance function.
+ColorBlockTransformFn getGamutConversionBlockFn(uhdr_color_gamut_t dst_gamut,
+                                                uhdr_color_gamut_t src_gamut);
+ColorBlockTransformFn getYuvToRgbBlockFn(uhdr_color_gamut_t gamut);
+LuminanceBlockFn getLuminanceBlockFn(uhdr_color_gamut_t gamut);
+ColorBlockTransformFn getInverseOetfBlockFn(uhdr_color_transfer_t transfer);
+ColorBlockTransformFn getOetfBlockFn(uhdr_color_transfer_t transfer);
+ColorBlockTransformFn getOotfBlockFn(uhdr_color_transfer_t transfer);
 
 ////////////////////////////////////////////////////////////////////////////////
 // common utils
 static const float kHdrOffset = 1e-7f;
 static const float kSdrOffset = 1e-7f;
 
+// Same as computeGain() and encodeGain(), with the logarithm computed by fastLog2()
+inline float computeGainFast(float sdr, float hdr) {
+  float gain = fastLog2((hdr + kHdrOffset) / (sdr + kSdrOffset));
+  if (sdr < 2.f / 255.0f) gain = (std::min)(gain, 2.3f);  // see computeGain()
+  return gain;
+}
+
+inline uint8_t encodeGainFast(float y_sdr, float y_hdr, uhdr_gainmap_metadata_ext_t* metadata,
+                              float log2MinContentBoost, float log2MaxContentBoost) {
+  float gain = y_sdr > 0.0f ? y_hdr / y_sdr : 1.0f;
+  gain = (std::min)((std::max)(gain, metadata->min_content_boost), metadata->max_content_boost);
+  float gain_normalized =
+      (fastLog2(gain) - log2MinContentBoost) / (log2MaxContentBoost - log2MinContentBoost);
+  gain_normalized = (std::max)(gain_normalized, 0.0f);  // the error may dip below min boost
+  if (metadata->gamma != 1.0f) gain_normalized = powf(gain_normalized, metadata->gamma);
+  return static_cast<uint8_t>((std::min)(gain_normalized * 255.0f, 255.0f));
+}
+
 static inline float clipNegatives(float value) { return (value < 0.0f) ? 0.0f : value; }
 
 static inline Color clipNegatives(Color e) {
@@ -594,10 +1002,283 @@ uhdr_error_info_t copy_raw_image(uhdr_raw_image_t* src, uhdr_raw_image_t* dst);
 std::unique_ptr<uhdr_raw_image_ext_t> convert_raw_input_to_ycbcr(
     uhdr_raw_image_t* src, bool chroma_sampling_enabled = false);
 
+// Allocates the output of convert_raw_input_to_ycbcr() for src, nullptr if src is not supported
+std::unique_ptr<uhdr_raw_image_ext_t> alloc_ycbcr_for_raw_input(
+    uhdr_raw_image_t* src, bool chroma_sampling_enabled = false);
+
+// Converts src into dst, an image allocated by alloc_ycbcr_for_raw_input() or a row band of one.
+// The format of dst selects the chroma sampling. Bands of 4:2:0 outputs start at even rows.
+uhdr_error_info_t convert_raw_input_to_ycbcr(uhdr_raw_image_t* src, uhdr_raw_image_t* dst);
+
+// Vector versions of convert_raw_input_to_ycbcr(src, dst) for rgba8888 input and 4:4:4 output.
+// Other inputs are left to the scalar code, the kernels return UHDR_CODEC_UNSUPPORTED_FEATURE.
 #if (defined(UHDR_ENABLE_INTRINSICS) && (defined(__ARM_NEON__) || defined(__ARM_NEON)))
-std::unique_ptr<uhdr_raw_image_ext_t> convert_raw_input_to_ycbcr_neon(uhdr_raw_image_t* src);
+uhdr_error_info_t convert_raw_input_to_ycbcr_neon(uhdr_raw_image_t* src, uhdr_raw_image_t* dst);
+#endif
+
+#if (defined(UHDR_ENABLE_INTRINSICS) && defined(UHDR_ENABLE_RVV))
+uhdr_error_info_t convert_raw_input_to_ycbcr_rvv(uhdr_raw_image_t* src, uhdr_raw_image_t* dst);
 #endif
 
+#if (defined(UHDR_ENABLE_INTRINSICS) && \
+     (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)))
+uhdr_error_info_t convert_raw_input_to_ycbcr_avx2(uhdr_raw_image_t* src, uhdr_raw_image_t* dst);
+#endif
+
+/*
+ * Applies the gain map to the leading pixels of row y of an 8-bit yuv420 sdr intent. The gain map
+ * is expected to be single channel and its scale factor an integer. The output is written to dest
+ * for UHDR_CT_LINEAR (rgba half float), UHDR_CT_HLG and UHDR_CT_PQ (rgba1010102). A non null
+ * gamut_matrix, see getGamutConversionMatrix(), converts the linear output to another gamut, out
+ * of gamut colors are clipped for the hlg and pq outputs. The functions stop short of the right
+ * edge of the row, where the gain map neighbourhood is clamped, and return the number of pixels
+ * written. The remaining pixels are left to the scalar implementation.
+ */
+typedef size_t (*ApplyGainMapRowFn)(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* gainmap_img,
+                                    uhdr_raw_image_t* dest, size_t map_scale_factor,
+                                    ShepardsIDW& idwTable, GainLUT& gainLUT,
+                                    uhdr_gainmap_metadata_ext_t* metadata,
+                                    uhdr_color_transfer_t output_ct, const float* gamut_matrix,
+                                    size_t y);
+
+#if (defined(UHDR_ENABLE_INTRINSICS) && \
+     (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)))
+size_t applyGainMapRowYuv420_sse41(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* gainmap_img,
+                                   uhdr_raw_image_t* dest, size_t map_scale_factor,
+                                   ShepardsIDW& idwTable, GainLUT& gainLUT,
+                                   uhdr_gainmap_metadata_ext_t* metadata,
+                                   uhdr_color_transfer_t output_ct, const float* gamut_matrix,
+                                   size_t y);
+
+size_t applyGainMapRowYuv420_avx2(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* gainmap_img,
+                                  uhdr_raw_image_t* dest, size_t map_scale_factor,
+                                  ShepardsIDW& idwTable, GainLUT& gainLUT,
+                                  uhdr_gainmap_metadata_ext_t* metadata,
+                                  uhdr_color_transfer_t output_ct, const float* gamut_matrix,
+                                  size_t y);
+
+size_t applyGainMapRowYuv420_avx512(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* gainmap_img,
+                                    uhdr_raw_image_t* dest, size_t map_scale_factor,
+                                    ShepardsIDW& idwTable, GainLUT& gainLUT,
+                                    uhdr_gainmap_metadata_ext_t* metadata,
+                                    uhdr_color_transfer_t output_ct, const float* gamut_matrix,
+                                    size_t y);
+#endif
+
+#if (defined(UHDR_ENABLE_INTRINSICS) && defined(UHDR_ENABLE_RVV))
+size_t applyGainMapRowYuv420_rvv(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* gainmap_img,
+                                 uhdr_raw_image_t* dest, size_t map_scale_factor,
+                                 ShepardsIDW& idwTable, GainLUT& gainLUT,
+                                 uhdr_gainmap_metadata_ext_t* metadata,
+                                 uhdr_color_transfer_t output_ct, const float* gamut_matrix,
+                                 size_t y);
+#endif
+
+#if (defined(UHDR_ENABLE_INTRINSICS) && defined(__wasm_simd128__))
+size_t applyGainMapRowYuv420_simd128(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* gainmap_img,
+                                     uhdr_raw_image_t* dest, size_t map_scale_factor,
+                                     ShepardsIDW& idwTable, GainLUT& gainLUT,
+                                     uhdr_gainmap_metadata_ext_t* metadata,
+                                     uhdr_color_transfer_t output_ct, const float* gamut_matrix,
+                                     size_t y);
+#endif
+
+#if (defined(UHDR_ENABLE_INTRINSICS) && defined(UHDR_ENABLE_LSX))
+size_t applyGainMapRowYuv420_lsx(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* gainmap_img,
+                                 uhdr_raw_image_t* dest, size_t map_scale_factor,
+                                 ShepardsIDW& idwTable, GainLUT& gainLUT,
+                                 uhdr_gainmap_metadata_ext_t* metadata,
+                                 uhdr_color_transfer_t output_ct, const float* gamut_matrix,
+                                 size_t y);
+
+size_t applyGainMapRowYuv420_lasx(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* gainmap_img,
+                                  uhdr_raw_image_t* dest, size_t map_scale_factor,
+                                  ShepardsIDW& idwTable, GainLUT& gainLUT,
+                                  uhdr_gainmap_metadata_ext_t* metadata,
+                                  uhdr_color_transfer_t output_ct, const float* gamut_matrix,
+                                  size_t y);
+#endif
+
+#if (defined(UHDR_ENABLE_INTRINSICS) && (defined(__ARM_NEON__) || defined(__ARM_NEON)))
+size_t applyGainMapRowYuv420_neon(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* gainmap_img,
+                                  uhdr_raw_image_t* dest, size_t map_scale_factor,
+                                  ShepardsIDW& idwTable, GainLUT& gainLUT,
+                                  uhdr_gainmap_metadata_ext_t* metadata,
+                                  uhdr_color_transfer_t output_ct, const float* gamut_matrix,
+                                  size_t y);
+#endif
+
+// Variant of the above that computes UHDR_CT_LINEAR output with fp16 vector arithmetic, for the
+// approximate gain map application. The base image samples and the gain are looked up at single
+// precision, applyGainRowF16_neon_fp16() applies the gain and the gamut conversion to blocks of
+// them. It is built for toolchains that support the extension, and only used after the running cpu
+// reports it.
+#if (defined(UHDR_ENABLE_INTRINSICS) && (defined(__ARM_NEON__) || defined(__ARM_NEON)) && \
+     defined(__aarch64__) && defined(UHDR_ENABLE_NEON_FP16))
+size_t applyGainMapRowYuv420_neon_fp16(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* gainmap_img,
+                                       uhdr_raw_image_t* dest, size_t map_scale_factor,
+                                       ShepardsIDW& idwTable, GainLUT& gainLUT,
+                                       uhdr_gainmap_metadata_ext_t* metadata,
+                                       uhdr_color_transfer_t output_ct, const float* gamut_matrix,
+                                       size_t y);
+
+void applyGainRowF16_neon_fp16(const float* r, const float* g, const float* b, const float* gain,
+                               size_t count, float offset_sdr, float offset_hdr,
+                               const float* gamut_matrix, uint64_t* dst);
+#endif
+
+/*
+ * Constants of the color conversions, shared by the vector kernels and the gpu shaders. yuv to rgb
+ * coefficients are stored as {Cr, GCb, GCr, Cb}, see srgbYuvToRgb(). The matrix of a gamut
+ * conversion, see getGamutConversionFn(), is stored row major.
+ */
+void getYuvToRgbCoeffs(uhdr_color_gamut_t gamut, float coeffs[4]);
+void getGamutConversionMatrix(ColorTransformFn fn, std::array<float, 9>& matrix);
+
+/*
+ * Color pipeline of the gain map generation, flattened into constants for the row kernels below.
+ * yuv to rgb coefficients are stored as {Cr, GCb, GCr, Cb}, see srgbYuvToRgb().
+ */
+struct GainMapRowParams {
+  float sdr_yuv_to_rgb[4];
+  float hdr_yuv_to_rgb[4];
+  const float* hdr_inv_oetf_lut;
+  int hdr_inv_oetf_entries;
+  float hdr_ootf_gamma;                   // 1.0f if the hdr intent has no ootf
+  std::array<float, 9> hdr_gamut_matrix;  // hdr gamut to sdr gamut, row major
+  std::array<float, 3> luminance;         // sdr gamut luminance weights
+  bool use_luminance;
+  bool multichannel;
+  float hdr_sample_to_nits;
+};
+
+/*
+ * Fills params for generating the gain map of an 8-bit yuv420 sdr intent and a p010 hdr intent
+ * with hlg or pq transfer. Returns false for other combinations, these are not handled by the
+ * vector kernels.
+ */
+bool getGainMapRowParams(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* hdr_intent,
+                         bool sdr_is_601, bool use_luminance, bool multichannel,
+                         float hdr_sample_to_nits, GainMapRowParams* params);
+
+// Box filters count samples of map row y starting at map column x, see sampleYuv420() and
+// sampleP010(). Output is planar, dst[0] for y, dst[1] for u and dst[2] for v. The image rows under
+// the map row are read once, front to back, so a call over a long run of pixels is cheaper per
+// pixel than many short calls.
+void sampleYuv420Row(uhdr_raw_image_t* image, size_t map_scale_factor, size_t x, size_t y,
+                     size_t count, float* dst[3]);
+void sampleP010Row(uhdr_raw_image_t* image, size_t map_scale_factor, size_t x, size_t y,
+                   size_t count, float* dst[3]);
+
+// Map pixels that the row kernels below box filter into contiguous planes ahead of the gain math
+constexpr size_t kGainMapRowChunk = 64;
+
+/*
+ * Computes the log2 gains of the leading pixels of map row y, see computeGain(). For multichannel
+ * maps the gains are written interleaved as rgb. The functions return the number of map pixels
+ * written, the remaining pixels are left to the scalar implementation.
+ */
+typedef size_t (*GenerateGainMapRowFn)(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* hdr_intent,
+                                       const GainMapRowParams& params, size_t map_scale_factor,
+                                       size_t map_width, size_t y, float* gains);
+
+#if (defined(UHDR_ENABLE_INTRINSICS) && \
+     (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)))
+size_t generateGainMapRow_sse41(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* hdr_intent,
+                                const GainMapRowParams& params, size_t map_scale_factor,
+                                size_t map_width, size_t y, float* gains);
+
+size_t generateGainMapRow_avx2(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* hdr_intent,
+                               const GainMapRowParams& params, size_t map_scale_factor,
+                               size_t map_width, size_t y, float* gains);
+
+size_t generateGainMapRow_avx512(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* hdr_intent,
+                                 const GainMapRowParams& params, size_t map_scale_factor,
+                                 size_t map_width, size_t y, float* gains);
+#endif
+
+#if (defined(UHDR_ENABLE_INTRINSICS) && (defined(__ARM_NEON__) || defined(__ARM_NEON)))
+size_t generateGainMapRow_neon(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* hdr_intent,
+                               const GainMapRowParams& params, size_t map_scale_factor,
+                               size_t map_width, size_t y, float* gains);
+#endif
+
+#if (defined(UHDR_ENABLE_INTRINSICS) && defined(UHDR_ENABLE_LSX))
+size_t generateGainMapRow_lsx(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* hdr_intent,
+                              const GainMapRowParams& params, size_t map_scale_factor,
+                              size_t map_width, size_t y, float* gains);
+
+size_t generateGainMapRow_lasx(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* hdr_intent,
+                               const GainMapRowParams& params, size_t map_scale_factor,
+                               size_t map_width, size_t y, float* gains);
+#endif
+
+/*
+ * Color pipeline of the hdr to sdr tone mapping, flattened into constants for the row kernels
+ * below. The sdr intent is always display p3 with srgb transfer, see JpegR::toneMap().
+ */
+struct ToneMapRowParams {
+  float hdr_yuv_to_rgb[4];  // {Cr, GCb, GCr, Cb}, see srgbYuvToRgb()
+  const float* hdr_inv_oetf_lut;
+  int hdr_inv_oetf_entries;
+  float hdr_ootf_gamma;                   // 1.0f if the hdr intent has no ootf
+  std::array<float, 9> hdr_gamut_matrix;  // hdr gamut to display p3, row major
+  float headroom;                         // hdr peak white relative to sdr white
+};
+
+/*
+ * Fills params for tone mapping a p010 hdr intent with hlg or pq transfer to an 8-bit yuv420 sdr
+ * intent. Returns false for other inputs, these are not handled by the vector kernels.
+ */
+bool getToneMapRowParams(uhdr_raw_image_t* hdr_intent, ToneMapRowParams* params);
+
+/*
+ * Tone maps the leading pixels of rows y and y + 1 of the hdr intent, y being even, and writes the
+ * luma of both rows and the 2x2 averaged chroma to the sdr intent. The functions return the number
+ * of columns written, the remaining columns are left to the scalar implementation.
+ */
+typedef size_t (*ToneMapRowFn)(uhdr_raw_image_t* hdr_intent, uhdr_raw_image_t* sdr_intent,
+                               const ToneMapRowParams& params, size_t y);
+
+#if (defined(UHDR_ENABLE_INTRINSICS) && \
+     (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)))
+size_t toneMapRowP010_avx2(uhdr_raw_image_t* hdr_intent, uhdr_raw_image_t* sdr_intent,
+                           const ToneMapRowParams& params, size_t y);
+#endif
+
+#if (defined(UHDR_ENABLE_INTRINSICS) && (defined(__ARM_NEON__) || defined(__ARM_NEON)))
+size_t toneMapRowP010_neon(uhdr_raw_image_t* hdr_intent, uhdr_raw_image_t* sdr_intent,
+                           const ToneMapRowParams& params, size_t y);
+#endif
+
+/*
+ * Convert count pixels of a UHDR_IMG_FMT_64bppRGBAHalfFloat row to planar rgb floats, dropping
+ * alpha, and back with opaque alpha. Widening is exact, so the kernels match halfToFloat(). The
+ * hardware narrowing rounds ties to even where floatToHalf() rounds them away from zero, so the
+ * kernels can differ from colorToRgbaF16() by one ulp. The functions return the number of pixels
+ * converted, the remaining pixels are left to the scalar implementation.
+ */
+typedef size_t (*RgbaF16ToFloatRowFn)(const uint64_t* src, size_t count, float* dst[3]);
+typedef size_t (*FloatToRgbaF16RowFn)(float* const src[3], size_t count, uint64_t* dst);
+
+#if (defined(UHDR_ENABLE_INTRINSICS) && \
+     (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)))
+size_t rgbaF16ToFloatRow_avx2(const uint64_t* src, size_t count, float* dst[3]);
+size_t floatToRgbaF16Row_avx2(float* const src[3], size_t count, uint64_t* dst);
+#endif
+
+// half float conversion is optional on armv7
+#if (defined(UHDR_ENABLE_INTRINSICS) && (defined(__ARM_NEON__) || defined(__ARM_NEON)) && \
+     defined(__aarch64__))
+size_t rgbaF16ToFloatRow_neon(const uint64_t* src, size_t count, float* dst[3]);
+size_t floatToRgbaF16Row_neon(float* const src[3], size_t count, uint64_t* dst);
+#endif
+
+// Row conversions of UHDR_IMG_FMT_64bppRGBAHalfFloat pixels, see RgbaF16ToFloatRowFn. These run
+// the kernels of the running cpu where available.
+void rgbaF16ToFloatRow(const uint64_t* src, size_t count, float* dst[3]);
+void floatToRgbaF16Row(float* const src[3], size_t count, uint64_t* dst);
+
 bool floatToSignedFraction(float v, int32_t* numerator, uint32_t* denominator);
 bool floatToUnsignedFraction(float v, uint32_t* numerator, uint32_t* denominator);
 
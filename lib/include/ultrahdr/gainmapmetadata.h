@@ -25,6 +25,8 @@
 namespace ultrahdr {
 constexpr uint8_t kIsMultiChannelMask = (1u << 7);
 constexpr uint8_t kUseBaseColorSpaceMask = (1u << 6);
+// Largest serialized metadata, three channels with a denominator per value
+constexpr size_t kGainmapMetadataMaxSize = 5 + 4 * 4 + 3 * 10 * 4;
 
 // Gain map metadata, for tone mapping between SDR and HDR.
 // This is the fraction version of {@code uhdr_gainmap_metadata_ext_t}.
@@ -52,9 +54,19 @@ struct uhdr_gainmap_metadata_frac {
   static uhdr_error_info_t encodeGainmapMetadata(const uhdr_gainmap_metadata_frac* in_metadata,
                                                  std::vector<uint8_t>& out_data);
 
+  // Serializes into a caller buffer, kGainmapMetadataMaxSize bytes always suffice. Sets out_size
+  // to the bytes written.
+  static uhdr_error_info_t encodeGainmapMetadata(const uhdr_gainmap_metadata_frac* in_metadata,
+                                                 uint8_t* out_data, size_t capacity,
+                                                 size_t& out_size);
+
   static uhdr_error_info_t decodeGainmapMetadata(const std::vector<uint8_t>& in_data,
                                                  uhdr_gainmap_metadata_frac* out_metadata);
 
+  // Parses the packet in place, without copying it.
+  static uhdr_error_info_t decodeGainmapMetadata(const uint8_t* in_data, size_t in_size,
+                                                 uhdr_gainmap_metadata_frac* out_metadata);
+
   static uhdr_error_info_t gainmapMetadataFractionToFloat(const uhdr_gainmap_metadata_frac* from,
                                                           uhdr_gainmap_metadata_ext_t* to);
 
@@ -260,6 +260,13 @@ class IccHelper {
   static void compute_lut_entry(const Matrix3x3& src_to_XYZD50, float rgb[3]);
   static std::shared_ptr<DataStruct> write_clut(const uint8_t* grid_points, const uint8_t* grid_16);
 
+  // Infers the gamut from the cicp or colorant tags, readIccColorGamut() has
+  // checked the identifier and the minimum size.
+  static uhdr_color_gamut_t parseIccColorGamut(void* icc_data, size_t icc_size);
+
+  static std::shared_ptr<DataStruct> buildIccProfile(const uhdr_color_transfer_t tf,
+                                                     const uhdr_color_gamut_t gamut);
+
   // Checks if a set of xyz tags is equivalent to a 3x3 Matrix. Each input
   // tag buffer assumed to be at least kColorantTagSize in size.
   static bool tagsEqualToMatrix(const Matrix3x3& matrix, const uint8_t* red_tag,
@@ -267,12 +274,14 @@ class IccHelper {
 
  public:
   // Output includes JPEG embedding identifier and chunk information, but not
-  // APPx information.
+  // APPx information. Profiles are built once per transfer and gamut and the
+  // same buffer is returned to every caller, it must not be written to.
   static std::shared_ptr<DataStruct> writeIccProfile(const uhdr_color_transfer_t tf,
                                                      const uhdr_color_gamut_t gamut);
   // NOTE: this function is not robust; it can infer gamuts that IccHelper
   // writes out but should not be considered a reference implementation for
-  // robust parsing of ICC profiles or their gamuts.
+  // robust parsing of ICC profiles or their gamuts. Results are cached per
+  // payload, repeated profiles are not parsed again.
   static uhdr_color_gamut_t readIccColorGamut(void* icc_data, size_t icc_size);
 };
 
@@ -32,6 +32,7 @@ extern "C" {
 #endif
 
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <vector>
 
@@ -48,11 +49,81 @@ typedef enum {
   DECODE_TO_RGB_CS = (1 << 18),   /**< Decode image to RGB Color Space  */
 } decode_mode_t;
 
+/*!\brief Rectangle of an image in pixels, [left, left + width) x [top, top + height) */
+typedef struct {
+  unsigned int left;
+  unsigned int top;
+  unsigned int width;
+  unsigned int height;
+} image_region_t;
+
+/*!\brief Header fields of a jpeg bitstream and views into its marker payloads. A payload pointer
+ * is nullptr if the corresponding block is absent. */
+typedef struct {
+  unsigned int width;
+  unsigned int height;
+  unsigned int numComponents;
+  const uint8_t* exifData;  /**< app1 payload, starting at the exif identifier code */
+  size_t exifSize;
+  const uint8_t* xmpData;  /**< app1 payload, starting at the xmp namespace */
+  size_t xmpSize;
+  const uint8_t* iccData;  /**< app2 payload, starting at the icc signature */
+  size_t iccSize;
+  const uint8_t* isoData;  /**< app2 payload, starting at the iso namespace */
+  size_t isoSize;
+  const uint8_t* mpfData;  /**< app2 payload, starting at the mpf signature */
+  size_t mpfSize;
+  size_t frameHeaderOffset; /**< offset of the SOFn marker */
+  size_t scanOffset; /**< offset of the entropy coded data of the first scan, 0 if unknown */
+} jpeg_header_view_t;
+
 /*!\brief Encapsulates a converter from JPEG to raw image format. This class is not thread-safe */
 class JpegDecoderHelper {
  public:
-  JpegDecoderHelper() = default;
-  ~JpegDecoderHelper() = default;
+  JpegDecoderHelper();
+  ~JpegDecoderHelper();
+
+  /*!\brief Runs parallelism instances of job, possibly concurrently, and waits for them */
+  using ParallelRunner = std::function<void(const std::function<void()>& job,
+                                            unsigned int parallelism)>;
+
+  /*!\brief Enables parallel decode of images with restart intervals. When the intervals of a
+   * sequential single scan image span whole mcu rows, decompressImage() splits the scan at its
+   * restart markers into runs of rows and decodes them by parallelism instances of a job, issued
+   * through runner, straight into the output planes. Other images decode as before. The output
+   * does not depend on parallelism.
+   *
+   * \param[in]  parallelism  number of concurrent segment decoders
+   * \param[in]  runner       executor for the segment decoders
+   */
+  void setParallelDecode(unsigned int parallelism, ParallelRunner runner) {
+    mParallelism = parallelism;
+    mParallelRunner = std::move(runner);
+  }
+
+  /*!\brief Offers #DECODE_TO_YCBCR_CS decodes of whole images to the decompress callback of
+   * backend before libjpeg, see #uhdr_jpeg_backend_t. Strip wise, streamed, region and scaled
+   * decodes are left to libjpeg.
+   *
+   * \param[in]  backend  jpeg codec backend, nullptr callback for libjpeg only
+   */
+  void setBackend(const uhdr_jpeg_backend_t& backend) { mBackend = backend; }
+
+  /*!\brief Selects the fast integer idct of libjpeg in place of the accurate one. It is quicker
+   * at some loss of accuracy. Default is the accurate idct.
+   *
+   * \param[in]  enable  true to use the fast idct
+   */
+  void setFastIdct(bool enable) { mDctMethod = enable ? JDCT_IFAST : JDCT_ISLOW; }
+
+  /*!\brief Replicates chroma samples in place of the fancy (triangle filtered) upsampling of
+   * libjpeg for #DECODE_TO_RGB_CS decodes. libjpeg then upsamples and converts to rgb in a single
+   * merged pass per row group, without full resolution chroma rows in between. #DECODE_TO_YCBCR_CS
+   * decodes deliver planar subsampled chroma and are not affected. Default is fancy upsampling.
+   *
+   * \param[in]  enable  true to replicate chroma samples
+   */
+  void setFastUpsampling(bool enable) { mFancyUpsampling = enable ? FALSE : TRUE; }
 
   /*!\brief This function decodes the bitstream that is passed to it to the desired format and
    * stores the results internally. The result is accessible via getter functions.
@@ -66,6 +137,34 @@ class JpegDecoderHelper {
   uhdr_error_info_t decompressImage(const void* image, size_t length,
                                     decode_mode_t mode = DECODE_TO_YCBCR_CS);
 
+  /*!\brief Supplies the input of a streamed decode piecewise, in order. On success, data and
+   * length describe the next piece. Returns false once the input is exhausted. May block until the
+   * next piece is available. */
+  using InputPuller = std::function<bool(const uint8_t*& data, size_t& length)>;
+
+  /*!\brief This function decodes a bitstream that arrives piecewise, as supplied by pull, so that
+   * the decode overlaps with the transfer of the input. The result is accessible via getter
+   * functions as after decompressImage(). Restart intervals are decoded sequentially, and the
+   * metadata blocks are located only once attachBitstream() is called.
+   *
+   * \param[in]  pull     input supplier
+   * \param[in]  mode     output decode format
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t decompressStream(const InputPuller& pull,
+                                     decode_mode_t mode = DECODE_TO_YCBCR_CS);
+
+  /*!\brief This function locates the metadata blocks of the bitstream last decoded with
+   * decompressStream() in image, which holds that bitstream as a whole.
+   *
+   * \param[in]  image    pointer to compressed image
+   * \param[in]  length   length of compressed image
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t attachBitstream(const void* image, size_t length);
+
   /*!\brief This function parses the bitstream that is passed to it and makes image information
    * available to the client via getter() functions. It does not decompress the image. That is done
    * by decompressImage().
@@ -79,6 +178,92 @@ class JpegDecoderHelper {
     return decompressImage(image, length, PARSE_STREAM);
   }
 
+  /*!\brief This function walks the markers of the bitstream up to the start of scan without
+   * involving libjpeg. Nothing is copied, the payloads in view point into image. Unlike
+   * parseImage(), the coding tables are not validated and only sequential and progressive 8 bit
+   * streams are accepted.
+   *
+   * \param[in]   image    pointer to compressed image
+   * \param[in]   length   length of compressed image
+   * \param[out]  view     header fields and payload views
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  static uhdr_error_info_t scanHeaders(const void* image, size_t length, jpeg_header_view_t& view);
+
+  /*!\brief This function decodes a rectangle of the bitstream. Rows above the region are skipped
+   * and columns outside of it are cropped by libjpeg, rows below it are not decoded at all. The
+   * result is accessible via getter functions and has the dimensions of the region.
+   *
+   * NOTE: For #DECODE_TO_YCBCR_CS, the result is #UHDR_IMG_FMT_24bppYCbCr444 for multi channel
+   * images, with the chroma samples replicated from the coded (subsampled) samples.
+   *
+   * \param[in]  image    pointer to compressed image
+   * \param[in]  length   length of compressed image
+   * \param[in]  mode     output decode format
+   * \param[in]  region   region to decode, must lie within the image
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t decompressImageRegion(const void* image, size_t length, decode_mode_t mode,
+                                          const image_region_t& region);
+
+  /*!\brief This function decodes the bitstream at a reduced size. The inverse DCT produces the
+   * downscaled image directly, so the cost of the decode falls with the scale. The result
+   * has dimensions ceil(width / scale_denom) x ceil(height / scale_denom) and the formats of
+   * decompressImageRegion().
+   *
+   * \param[in]  image        pointer to compressed image
+   * \param[in]  length       length of compressed image
+   * \param[in]  mode         output decode format
+   * \param[in]  scale_denom  downscale factor, one of 1, 2, 4 or 8
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t decompressImageScaled(const void* image, size_t length, decode_mode_t mode,
+                                          unsigned int scale_denom);
+
+  /*!\brief This function starts a strip wise decode of the bitstream. Unlike decompressImage(),
+   * only one strip of decoded rows is held in memory at a time. On success, image attributes and
+   * metadata blocks are accessible via getter functions and the rows are retrieved in order with
+   * decompressStrip().
+   *
+   * \param[in]  image         pointer to compressed image
+   * \param[in]  length        length of compressed image
+   * \param[in]  mode          output decode format
+   * \param[in]  strip_height  rows per strip. For #DECODE_TO_YCBCR_CS, this is rounded up to a
+   *                           multiple of the MCU height
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t startStripDecode(const void* image, size_t length, decode_mode_t mode,
+                                     unsigned int strip_height);
+
+  /*!\brief This function decodes the next strip of a decode started with startStripDecode(). On
+   * success, strip describes rows [row_start, row_start + strip->h) of the image. Once all rows
+   * have been returned, strip->h is 0. The strip memory is overwritten by the next call.
+   *
+   * \param[out]  strip      decoded strip descriptor
+   * \param[out]  row_start  index of the first image row held in strip
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t decompressStrip(uhdr_raw_image_t* strip, unsigned int& row_start);
+
+  /*!\brief Sets the image the next call to decompressImage() or decompressStream() writes its
+   * result to in place of internal storage, nullptr for none. The image is used only if its format,
+   * dimensions and plane layout are those of the result, planes that follow each other with the
+   * strides of the decode, otherwise the result is decoded to internal storage as usual. The
+   * setting applies to that one call. See isResultInOutputImage().
+   *
+   * \param[in]  img  output image descriptor, must stay valid while the result is accessed
+   */
+  void setOutputImage(uhdr_raw_image_t* img) { mOutputImage = img; }
+
+  /*!\brief returns true if the last decode wrote its result to the image set with
+   * setOutputImage() */
+  bool isResultInOutputImage() const { return mResultInOutputImage; }
+
   /*! Below public methods are only effective if a call to decompressImage() is made and it returned
    * true. */
 
@@ -88,12 +273,12 @@ class JpegDecoderHelper {
   /*!\brief returns pointer to decompressed image
    * \deprecated This function is deprecated instead use getDecompressedImage().
    */
-  void* getDecompressedImagePtr() { return mResultBuffer.data(); }
+  void* getDecompressedImagePtr() { return mResultData; }
 
   /*!\brief returns size of decompressed image
    * \deprecated This function is deprecated instead use getDecompressedImage().
    */
-  size_t getDecompressedImageSize() { return mResultBuffer.size(); }
+  size_t getDecompressedImageSize() { return mResultSize; }
 
   /*! Below public methods are only effective if a call to parseImage() or decompressImage() is made
    * and it returned true. */
@@ -104,32 +289,45 @@ class JpegDecoderHelper {
   /*!\brief returns image height */
   unsigned int getDecompressedImageHeight() { return mPlaneHeight[0]; }
 
+  /*!\brief returns width of the coded image. Differs from getDecompressedImageWidth() after a
+   * call to decompressImageRegion() */
+  unsigned int getImageWidth() { return mImageWidth; }
+
+  /*!\brief returns height of the coded image */
+  unsigned int getImageHeight() { return mImageHeight; }
+
+  /*!\brief returns number of image rows returned per decompressStrip() call */
+  unsigned int getStripHeight() { return mResultRows[0]; }
+
   /*!\brief returns number of components in image */
   unsigned int getNumComponentsInImage() { return mNumComponents; }
 
+  /*! Below blocks point into the bitstream passed to parseImage()/decompressImage() and are only
+   * valid as long as it is. Callers that need a block beyond that must copy it out. */
+
   /*!\brief returns pointer to xmp block present in input image */
-  void* getXMPPtr() { return mXMPBuffer.data(); }
+  void* getXMPPtr() { return const_cast<uint8_t*>(mHeaderView.xmpData); }
 
   /*!\brief returns size of xmp block */
-  size_t getXMPSize() { return mXMPBuffer.size(); }
+  size_t getXMPSize() { return mHeaderView.xmpSize; }
 
   /*!\brief returns pointer to exif block present in input image */
-  void* getEXIFPtr() { return mEXIFBuffer.data(); }
+  void* getEXIFPtr() { return const_cast<uint8_t*>(mHeaderView.exifData); }
 
   /*!\brief returns size of exif block */
-  size_t getEXIFSize() { return mEXIFBuffer.size(); }
+  size_t getEXIFSize() { return mHeaderView.exifSize; }
 
   /*!\brief returns pointer to icc block present in input image */
-  void* getICCPtr() { return mICCBuffer.data(); }
+  void* getICCPtr() { return const_cast<uint8_t*>(mHeaderView.iccData); }
 
   /*!\brief returns size of icc block */
-  size_t getICCSize() { return mICCBuffer.size(); }
+  size_t getICCSize() { return mHeaderView.iccSize; }
 
   /*!\brief returns pointer to iso block present in input image */
-  void* getIsoMetadataPtr() { return mIsoMetadataBuffer.data(); }
+  void* getIsoMetadataPtr() { return const_cast<uint8_t*>(mHeaderView.isoData); }
 
   /*!\brief returns size of iso block */
-  size_t getIsoMetadataSize() { return mIsoMetadataBuffer.size(); }
+  size_t getIsoMetadataSize() { return mHeaderView.isoSize; }
 
   /*!\brief returns the offset of exif data payload with reference to 'image' address that is passed
    * via parseImage()/decompressImage() call. Note this does not include jpeg marker (0xffe1) and
@@ -141,27 +339,91 @@ class JpegDecoderHelper {
   // max number of components supported
   static constexpr int kMaxNumComponents = 3;
 
-  uhdr_error_info_t decode(const void* image, size_t length, decode_mode_t mode);
-  uhdr_error_info_t decode(jpeg_decompress_struct* cinfo, uint8_t* dest);
-  uhdr_error_info_t decodeToCSYCbCr(jpeg_decompress_struct* cinfo, uint8_t* dest);
-  uhdr_error_info_t decodeToCSRGB(jpeg_decompress_struct* cinfo, uint8_t* dest);
+  // libjpeg state, kept across images
+  struct DecodeState;
+
+  // run of restart intervals of the scan, decodable without the rest of it
+  struct ScanSegment {
+    const uint8_t* data;       // entropy coded data of the run, without RSTn markers at its ends
+    size_t size;
+    unsigned int firstInterval;  // index of the first restart interval of the run
+    unsigned int rowStart;       // first image row of the run
+    unsigned int rows;
+  };
+
+  // pull, if not nullptr, supplies the input in place of image
+  uhdr_error_info_t decompress(const void* image, size_t length, decode_mode_t mode,
+                               unsigned int strip_height, const image_region_t* region,
+                               unsigned int scale_denom, const InputPuller* pull = nullptr);
+  uhdr_error_info_t decode(const void* image, size_t length, decode_mode_t mode,
+                           unsigned int strip_height, const image_region_t* region,
+                           unsigned int scale_denom, const InputPuller* pull);
+  // decodes area (the whole image if nullptr) of the image downscaled by scale_denom to
+  // interleaved samples, as libjpeg can neither crop nor scale raw data
+  uhdr_error_info_t decodeInterleaved(jpeg_decompress_struct* cinfo, decode_mode_t mode,
+                                      const image_region_t* area, unsigned int scale_denom);
+  uhdr_error_info_t decode(jpeg_decompress_struct* cinfo, uint8_t* dest, JDIMENSION row_end);
+  uhdr_error_info_t decodeToCSYCbCr(jpeg_decompress_struct* cinfo, uint8_t* dest,
+                                    JDIMENSION row_end);
+  // planes hold plane rows from the current output row of cinfo on
+  uhdr_error_info_t decodeToCSYCbCr(jpeg_decompress_struct* cinfo, uint8_t* const planes[],
+                                    JDIMENSION row_end);
+  // splits the scan at its restart markers, returns false if the image does not qualify
+  bool indexScanSegments(const jpeg_decompress_struct* cinfo, const uint8_t* image,
+                         size_t length, std::vector<ScanSegment>& segments);
+  uhdr_error_info_t decodeSegments(const jpeg_decompress_struct* cinfo, const uint8_t* image,
+                                   const std::vector<ScanSegment>& segments);
+  // decodes segment of the image of parent into the result buffer of parent
+  uhdr_error_info_t decodeSegment(JpegDecoderHelper& parent, const jpeg_decompress_struct* frame,
+                                  const uint8_t* image, const ScanSegment& segment);
+  uhdr_error_info_t decodeToCSRGB(jpeg_decompress_struct* cinfo, uint8_t* dest,
+                                  JDIMENSION row_end);
+  // decodes the whole image of cinfo to the result buffer with mBackend, returns false if the
+  // backend declined it
+  bool decodeWithBackend(jpeg_decompress_struct* cinfo, const void* image, size_t length);
+  void endStripDecode();
+  // returns the libjpeg state, creating it on first use. nullptr if that fails
+  DecodeState* acquireState();
+  // drops the libjpeg state, after an error it cannot be trusted to be reusable
+  void releaseState();
 
   // temporary storage
-  std::unique_ptr<uint8_t[]> mPlanesMCURow[kMaxNumComponents];
+  std::vector<uint8_t> mPlanesMCURow[kMaxNumComponents];  // capacity kept across images
+
+  // points mResultData at the output image if that has the layout of the result, else at
+  // mResultBuffer. Strip decodes, whole == false, always use mResultBuffer
+  void allocateResult(const j_decompress_ptr cinfo, size_t size, bool whole);
 
-  std::vector<JOCTET> mResultBuffer;       // buffer to store decoded data
-  std::vector<JOCTET> mXMPBuffer;          // buffer to store xmp data
-  std::vector<JOCTET> mEXIFBuffer;         // buffer to store exif data
-  std::vector<JOCTET> mICCBuffer;          // buffer to store icc data
-  std::vector<JOCTET> mIsoMetadataBuffer;  // buffer to store iso data
+  std::vector<JOCTET> mResultBuffer;  // buffer to store decoded data
+  uint8_t* mResultData = nullptr;     // decoded data, in mResultBuffer or in mOutputImage
+  size_t mResultSize = 0;
+  uhdr_raw_image_t* mOutputImage = nullptr;  // see setOutputImage()
+  bool mResultInOutputImage = false;
+  jpeg_header_view_t mHeaderView{};   // app payloads, views into the input bitstream
 
   // image attributes
   uhdr_img_fmt_t mOutFormat;
   unsigned int mNumComponents;
+  unsigned int mImageWidth;
+  unsigned int mImageHeight;
   unsigned int mPlaneWidth[kMaxNumComponents];
   unsigned int mPlaneHeight[kMaxNumComponents];
   unsigned int mPlaneHStride[kMaxNumComponents];
   unsigned int mPlaneVStride[kMaxNumComponents];
+  unsigned int mResultRows[kMaxNumComponents];  // rows of each plane held in mResultData
+
+  std::unique_ptr<DecodeState> mState;  // libjpeg state, nullptr until the first decode
+  bool mStripDecoding = false;           // a strip wise decode is ongoing
+
+  uhdr_jpeg_backend_t mBackend{};  // see setBackend()
+
+  J_DCT_METHOD mDctMethod = JDCT_ISLOW;
+  boolean mFancyUpsampling = TRUE;  // do_fancy_upsampling of rgb decodes
+
+  // parallel decode of images with restart intervals
+  unsigned int mParallelism = 0;
+  ParallelRunner mParallelRunner;
+  std::vector<std::unique_ptr<JpegDecoderHelper>> mSegmentWorkers;
 
   long mExifPayLoadOffset;  // Position of EXIF package, default value is -1 which means no EXIF
                             // package appears.
@@ -32,9 +32,12 @@ extern "C" {
 #endif
 
 #include <cstdint>
+#include <functional>
+#include <memory>
 #include <vector>
 
 #include "ultrahdr_api.h"
+#include "ultrahdr/editorhelper.h"
 
 namespace ultrahdr {
 
@@ -47,8 +50,69 @@ struct destination_mgr_impl : jpeg_destination_mgr {
 /*!\brief Encapsulates a converter from raw to jpg image format. This class is not thread-safe */
 class JpegEncoderHelper {
  public:
-  JpegEncoderHelper() = default;
-  ~JpegEncoderHelper() = default;
+  JpegEncoderHelper();
+  ~JpegEncoderHelper();
+
+  /*!\brief Runs parallelism instances of job, possibly concurrently, and waits for them */
+  using ParallelRunner = std::function<void(const std::function<void()>& job,
+                                            unsigned int parallelism)>;
+
+  /*!\brief Writes rows [rowStart, rowEnd) of a single plane image to dst, stride bytes apart */
+  using RowSource = std::function<void(unsigned int rowStart, unsigned int rowEnd, uint8_t* dst,
+                                       size_t stride)>;
+
+  /*!\brief Writes rows [rowStart, rowEnd) of a planar ycbcr image to the planes dst, strides
+   * bytes apart. Rows are of the luma plane, subsampled planes take their share of them */
+  using PlaneSource = std::function<uhdr_error_info_t(unsigned int rowStart, unsigned int rowEnd,
+                                                      uint8_t* const dst[3],
+                                                      const size_t strides[3])>;
+
+  /*!\brief default height of a strip in strip encode mode, in mcu rows */
+  static constexpr unsigned int kMcuRowsPerStrip = 32;
+
+  /*!\brief Enables strip encode mode for yuv and rgb inputs. The image is split into horizontal
+   * strips that are compressed independently and joined into one baseline jpeg, with a restart
+   * marker at every strip boundary. Strips are compressed by parallelism instances of a job,
+   * issued through runner. The strip layout depends only on the image dimensions and
+   * mcuRowsPerStrip, so the output does not change with parallelism.
+   *
+   * \param[in]  parallelism     number of concurrent strip encoders
+   * \param[in]  runner          executor for the strip encoders
+   * \param[in]  mcuRowsPerStrip strip height in mcu rows
+   */
+  void setStripEncode(unsigned int parallelism, ParallelRunner runner,
+                      unsigned int mcuRowsPerStrip = kMcuRowsPerStrip) {
+    mStripParallelism = parallelism;
+    mStripRunner = std::move(runner);
+    mMcuRowsPerStrip = mcuRowsPerStrip;
+  }
+
+  /*!\brief Returns true if an image of these dimensions and format is compressed in strips with
+   * the current configuration. */
+  bool encodesStrips(int width, int height, uhdr_img_fmt_t format) const {
+    return stripMcuRows(width, height, format) > 0;
+  }
+
+  /*!\brief Tunes the coding tools to preset. #UHDR_USAGE_REALTIME selects the fast integer dct,
+   * #UHDR_USAGE_BEST_QUALITY the accurate integer dct and huffman tables optimized for the image.
+   * Optimized tables differ from strip to strip, so they turn strip encode mode off. Without a
+   * call, the accurate integer dct and the standard huffman tables are used.
+   *
+   * \param[in]  preset  encoding preset
+   */
+  void setPreset(uhdr_enc_preset_t preset) {
+    mDctMethod = preset == UHDR_USAGE_REALTIME ? JDCT_IFAST : JDCT_ISLOW;
+    mOptimizeCoding = preset == UHDR_USAGE_BEST_QUALITY;
+  }
+
+  /*!\brief Offers whole images to the compress callback of backend before libjpeg, see
+   * #uhdr_jpeg_backend_t. The icc segment and the gain map comment are inserted after the start of
+   * image marker of the bitstream of the backend. Images produced by a RowSource or a PlaneSource
+   * are not offered.
+   *
+   * \param[in]  backend  jpeg codec backend, nullptr callback for libjpeg only
+   */
+  void setBackend(const uhdr_jpeg_backend_t& backend) { mBackend = backend; }
 
   /*!\brief This function encodes the raw image that is passed to it and stores the results
    * internally. The result is accessible via getter functions.
@@ -81,6 +145,126 @@ class JpegEncoderHelper {
                                   const int width, const int height, const uhdr_img_fmt_t format,
                                   const int qfactor, const void* iccBuffer, const size_t iccSize);
 
+  /*!\brief This function encodes an image whose rows are produced by source while the
+   * compression proceeds, so the image is never held whole. Rows are requested in order, a batch
+   * of up to a strip of rows at a time. In strip encode mode, every strip is produced by the job
+   * that compresses it, so source must then be safe to call concurrently for disjoint rows. The
+   * result is accessible via getter functions.
+   *
+   * \param[in]  source     producer of the rows of the image
+   * \param[in]  width      image width
+   * \param[in]  height     image height
+   * \param[in]  format     input raw image format, #UHDR_IMG_FMT_8bppYCbCr400 or
+   *                        #UHDR_IMG_FMT_24bppRGB888
+   * \param[in]  qfactor    quality factor [1 - 100, 1 being poorest and 100 being best quality]
+   * \param[in]  iccBuffer  pointer to icc segment that needs to be added to the compressed image
+   * \param[in]  iccSize    size of icc segment
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t compressImage(const RowSource& source, const int width, const int height,
+                                  const uhdr_img_fmt_t format, const int qfactor,
+                                  const void* iccBuffer, const size_t iccSize);
+
+  /*!\brief Planar counterpart of the RowSource overload, for ycbcr images. The image is produced
+   * a batch of whole mcu rows at a time into buffers of a batch, so a conversion feeding the
+   * compressor never needs a frame sized intermediate. The first failure of source ends the
+   * compression and is returned.
+   *
+   * \param[in]  source     producer of the rows of the image
+   * \param[in]  width      image width
+   * \param[in]  height     image height
+   * \param[in]  format     input raw image format, a planar 8 bit ycbcr format
+   * \param[in]  qfactor    quality factor [1 - 100, 1 being poorest and 100 being best quality]
+   * \param[in]  iccBuffer  pointer to icc segment that needs to be added to the compressed image
+   * \param[in]  iccSize    size of icc segment
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t compressImage(const PlaneSource& source, const int width, const int height,
+                                  const uhdr_img_fmt_t format, const int qfactor,
+                                  const void* iccBuffer, const size_t iccSize);
+
+  /*!\brief Starts the compression of an image whose rows are written by the caller, see
+   * writeRows() and finishImage(). Unlike the source overloads of compressImage(), the caller
+   * drives the compression, so the rows can be handed over as they are produced elsewhere. The
+   * image is compressed serially, strip encode mode and the backend are not used. An image that
+   * is not finished is dropped by the next call to startImage().
+   *
+   * \param[in]  width      image width
+   * \param[in]  height     image height
+   * \param[in]  format     input raw image format, a planar 8 bit ycbcr format,
+   *                        #UHDR_IMG_FMT_8bppYCbCr400 or #UHDR_IMG_FMT_24bppRGB888
+   * \param[in]  qfactor    quality factor [1 - 100, 1 being poorest and 100 being best quality]
+   * \param[in]  iccBuffer  pointer to icc segment that needs to be added to the compressed image
+   * \param[in]  iccSize    size of icc segment
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t startImage(const int width, const int height, const uhdr_img_fmt_t format,
+                               const int qfactor, const void* iccBuffer, const size_t iccSize);
+
+  /*!\brief Compresses the next rows of the image of startImage(). The rows are described by img,
+   * whose width and format are those of the image and whose height is the number of rows. Any
+   * number of rows can be written at a time, a multiple of the vertical chroma subsampling factor
+   * but for the last rows of the image. Rows are gathered up to a whole mcu row before they are
+   * compressed. A failure drops the image.
+   *
+   * \param[in]  img  rows of the image
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t writeRows(const uhdr_raw_image_t* img);
+
+  /*!\brief Completes the image of startImage() once all its rows are written. The result is
+   * accessible via getter functions.
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t finishImage();
+
+  /*!\brief This function rotates, mirrors and crops a jpeg bitstream without decoding its pixels.
+   * The quantized dct coefficients are moved block by block and adjusted in sign or transposed
+   * within the blocks, so the result carries no generation loss. The result is accessible via
+   * getter functions.
+   *
+   * Every block of the output must come from exactly one block of the input. Edges that the map
+   * flips onto the top left corner and the left and top edges of a crop must therefore lie on
+   * mcu boundaries of the input. Application segments are copied, except for the xmp, iso
+   * 21496-1 and mpf segments, which describe the layout of an ultrahdr image and are rewritten
+   * by the caller.
+   *
+   * \param[in]  image   pointer to compressed image
+   * \param[in]  length  length of compressed image
+   * \param[in]  map     map of the output pixels to the input pixels, made of rotations, mirrors
+   *                     and crops only, see #uhdr_effect_chain_t
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+   *         #UHDR_CODEC_UNSUPPORTED_FEATURE if the map can not be applied to whole blocks,
+   *         uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t transformImage(const void* image, size_t length, const uhdr_plane_map_t& map);
+
+  /*!\brief Keeps the quantized dct coefficients of the image of the last compressImage() call, so
+   * that requantizeImage() can compress it at other qualities without running the forward dct
+   * again. The image should be compressed at quality 100, whose quantizer steps are all 1, so that
+   * the coefficients kept are the rounded dct outputs.
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t keepCoefficients();
+
+  /*!\brief Compresses the image whose coefficients were kept by keepCoefficients() at quality
+   * qfactor. The coefficients are divided by the quantizer steps of qfactor in place of a forward
+   * dct, the application segments of the kept image are copied. The result is accessible via
+   * getter functions and is close to, but not bit exact with, a compressImage() call at qfactor.
+   *
+   * \param[in]  qfactor    quality factor [1 - 100, 1 being poorest and 100 being best quality]
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t requantizeImage(const int qfactor);
+
   /*! Below public methods are only effective if a call to compressImage() is made and it returned
    * true. */
 
@@ -101,20 +285,79 @@ class JpegEncoderHelper {
   // max number of components supported
   static constexpr int kMaxNumComponents = 3;
 
+  // libjpeg state, kept across images
+  struct CompressState;
+
+  // coefficients kept by keepCoefficients()
+  struct CoefficientImage;
+
+  // planes and strides are ignored if source or planeSource is not nullptr
   uhdr_error_info_t encode(const uint8_t* planes[3], const unsigned int strides[3], const int width,
                            const int height, const uhdr_img_fmt_t format, const int qfactor,
-                           const void* iccBuffer, const size_t iccSize);
+                           const void* iccBuffer, const size_t iccSize,
+                           const RowSource* source = nullptr,
+                           const PlaneSource* planeSource = nullptr);
+
+  // sets up the compression parameters and starts the compression of an image of a known format,
+  // to be called with the error handler of state armed
+  uhdr_error_info_t setupCompress(CompressState* state, const int width, const int height,
+                                  const uhdr_img_fmt_t format, const int qfactor,
+                                  const void* iccBuffer, const size_t iccSize);
+
+  uhdr_error_info_t encodeStrips(const uint8_t* planes[3], const unsigned int strides[3],
+                                 const int width, const int height, const uhdr_img_fmt_t format,
+                                 const int qfactor, const void* iccBuffer, const size_t iccSize,
+                                 const unsigned int mcuRowsPerStrip, const RowSource* source,
+                                 const PlaneSource* planeSource);
 
   uhdr_error_info_t compressYCbCr(jpeg_compress_struct* cinfo, const uint8_t* planes[3],
                                   const unsigned int strides[3]);
 
-  destination_mgr_impl mDestMgr;  // object for managing output
+  uhdr_error_info_t compressRows(jpeg_compress_struct* cinfo, const RowSource& source,
+                                 const bool isRgb);
+
+  uhdr_error_info_t compressPlaneRows(jpeg_compress_struct* cinfo, const PlaneSource& source);
+
+  // returns the strip height in mcu rows if the image is compressed in strips, else 0
+  unsigned int stripMcuRows(int width, int height, uhdr_img_fmt_t format) const;
+
+  // compresses the image with mBackend, returns false if the backend declined it
+  bool encodeWithBackend(const uint8_t* planes[3], const unsigned int strides[3], const int width,
+                         const int height, const uhdr_img_fmt_t format, const int qfactor,
+                         const void* iccBuffer, const size_t iccSize);
+
+  // returns the libjpeg state, creating it on first use. nullptr if that fails
+  CompressState* acquireState();
+  // drops the libjpeg state, after an error it cannot be trusted to be reusable
+  void releaseState();
+
+  std::unique_ptr<CompressState> mState;  // libjpeg state, nullptr until the first encode
+  std::unique_ptr<CoefficientImage> mCoefficients;  // nullptr until keepCoefficients()
+  destination_mgr_impl mDestMgr;          // object for managing output
 
   // temporary storage
   std::unique_ptr<uint8_t[]> mPlanesMCURow[kMaxNumComponents];
 
   unsigned int mPlaneWidth[kMaxNumComponents];
   unsigned int mPlaneHeight[kMaxNumComponents];
+
+  uhdr_jpeg_backend_t mBackend{};  // see setBackend()
+
+  // coding tools
+  J_DCT_METHOD mDctMethod = JDCT_ISLOW;
+  bool mOptimizeCoding = false;
+
+  // image whose rows are written by the caller, see startImage()
+  bool mRowsStarted = false;
+  unsigned int mRowsWritten = 0;
+  std::unique_ptr<uint8_t[]> mRowBuffer[kMaxNumComponents];  // an mcu row of every plane
+  size_t mRowBufferStride[kMaxNumComponents]{};
+
+  // strip encode mode
+  unsigned int mStripParallelism = 0;
+  ParallelRunner mStripRunner;
+  unsigned int mMcuRowsPerStrip = kMcuRowsPerStrip;
+  std::vector<std::unique_ptr<JpegEncoderHelper>> mStripEncoders;
 };
 
 } /* namespace ultrahdr  */
@@ -19,10 +19,12 @@
 
 #include <array>
 #include <cfloat>
+#include <functional>
 
 #include "ultrahdr_api.h"
 #include "ultrahdr/ultrahdr.h"
 #include "ultrahdr/ultrahdrcommon.h"
+#include "ultrahdr/editorhelper.h"
 #include "ultrahdr/jpegdecoderhelper.h"
 #include "ultrahdr/jpegencoderhelper.h"
 
@@ -51,6 +53,14 @@ static const uhdr_enc_preset_t kEncSpeedPresetAndroidDefault = UHDR_USAGE_REALTI
 // Default gamma value for gain map
 static const float kGainMapGammaDefault = 1.0f;
 
+// Bytes of hdr and sdr input sampled per gain map generation tile. 0 walks whole gain map rows
+static const int kGainMapTileSizeDefault = 256 * 1024;
+static const int kGainMapTileSizeMax = 64 * 1024 * 1024;
+
+// Number of worker threads. 0 lets the library pick a value based on core count
+static const int kNumThreadsDefault = 0;
+static const int kNumThreadsMax = 256;
+
 // The current JPEGR version that we encode to
 static const char* const kJpegrVersion = "1.0";
 
@@ -81,6 +91,116 @@ struct jpegr_info_struct {
 typedef struct jpeg_info_struct* j_info_ptr;
 typedef struct jpegr_info_struct* jr_info_ptr;
 
+/*!\brief Supplies the rows of a strip wise decode in order. On success, strip describes rows
+ * [row_start, row_start + strip->h) of the image, strip->h is 0 once all rows are supplied. */
+typedef std::function<uhdr_error_info_t(uhdr_raw_image_t* strip, unsigned int& row_start)>
+    PullStripFn;
+
+/*!\brief Receives the rows of a strip wise decode in order. strip describes rows
+ * [row_start, row_start + strip->h) of the image and is only valid for the duration of the call. */
+typedef std::function<uhdr_error_info_t(uhdr_raw_image_t* strip, unsigned int row_start)>
+    PushStripFn;
+
+/*!\brief Receives the decoded base image of a whole image decode before the gain map is applied
+ * to it. base is only valid for the duration of the call. */
+typedef std::function<uhdr_error_info_t(uhdr_raw_image_t* base)> BaseImageFn;
+
+/*!\brief Receives the gain map of a decode at full size as decoded, ahead of any effect. gainmap is
+ * only valid for the duration of the call. */
+typedef std::function<void(const uhdr_raw_image_t* gainmap)> GainMapFn;
+
+/*!\brief Processes rows [row_start, row_end) of an image. Calls for disjoint row ranges may run
+ * concurrently. */
+typedef std::function<void(unsigned int row_start, unsigned int row_end)> RowRangeFn;
+
+/*!\brief One output of JpegR::decodeJPEGRRenditions(). The fields have the meaning of the
+ * arguments of the same name of JpegR::decodeJPEGR(). */
+struct RenditionDesc {
+  uhdr_img_fmt_t output_format;
+  uhdr_color_transfer_t output_ct;
+  float max_display_boost;
+  uhdr_raw_image_t* dest;
+};
+
+/*!\brief One output of JpegR::encodeJPEGRLadder(), the jpeg qualities of its base image and gain
+ * map and the descriptor that receives it */
+struct QualityRung {
+  int quality;
+  int gainmap_quality;
+  uhdr_compressed_image_t* dest;
+};
+
+/*!\brief A gain map whose rows are produced on demand, see JpegR::generateGainMap() */
+struct GainMapRows {
+  unsigned int w;
+  unsigned int h;
+  uhdr_img_fmt_t fmt;              // #UHDR_IMG_FMT_8bppYCbCr400 or #UHDR_IMG_FMT_24bppRGB888
+  unsigned int row_alignment;      // row ranges start at multiples of this
+  bool costly;                     // true if the rows are computed from the intents, false if
+                                   // they are only encoded from gains computed up front
+  JpegEncoderHelper::RowSource produce;  // calls for disjoint row ranges may run concurrently
+};
+
+/*!\brief Receives a gain map as its rows become available to be produced */
+typedef std::function<uhdr_error_info_t(const GainMapRows& rows)> GainMapConsumerFn;
+
+/*
+ * State of the decode path that can outlive a JpegR object. A codec context keeps one across
+ * decode calls, so that repeated decodes of same sized images reuse the jpeg decoder buffers
+ * instead of reallocating them. Interpolation and gain tables are shared between contexts, see
+ * GainMapTableCache.
+ */
+struct JpegRDecodeCache {
+  JpegRDecodeCache();
+  ~JpegRDecodeCache();
+
+  JpegDecoderHelper mSdrDecoder;
+  JpegDecoderHelper mGainmapDecoder;
+  // mSdrDecoder holds the base image of the next decode, decoded ahead from streamed input in
+  // mode mSdrStreamedMode, see JpegDecoderHelper::decompressStream()
+  bool mSdrStreamed = false;
+  decode_mode_t mSdrStreamedMode = DECODE_TO_YCBCR_CS;
+  // mSdrDecoder and mGainmapDecoder hold the whole base image, decoded in mode mSourcesMode, and
+  // the gain map of the last decode, see decodeJPEGRSources()
+  bool mHoldsSources = false;
+  decode_mode_t mSourcesMode = DECODE_TO_YCBCR_CS;
+};
+
+class DataStruct;
+
+/*\brief State shared by the encodes of a batch, see uhdr_encode_batch(). It is written once ahead
+ * of the encodes and only read by them, so the encodes may run concurrently.
+ */
+struct JpegREncodeCache {
+  JpegREncodeCache();
+  ~JpegREncodeCache();
+
+  // icc profile of the base image, srgb transfer, indexed by color gamut
+  std::shared_ptr<DataStruct> mBaseIcc[UHDR_CG_BT_2100 + 1];
+};
+
+/*\brief State of an encode whose intents are handed over a strip of rows at a time, see
+ * JpegR::encodeJPEGRStreamRows(). The base image and the gain map are compressed as the strips
+ * arrive, so neither intent is held whole.
+ */
+struct JpegREncodeStream {
+  JpegREncodeStream(unsigned int intent_height, int base_quality)
+      : height(intent_height), quality(base_quality), metadata(kJpegrVersion) {}
+
+  unsigned int height;  // of the intents
+  int quality;          // of the base image
+  // layout of the intents, taken from the first strip
+  unsigned int width = 0;
+  bool has_sdr = false;
+  uhdr_raw_image_t hdr_desc{};
+  uhdr_raw_image_t sdr_desc{};
+  unsigned int rows = 0;  // of the intents received so far
+  uhdr_color_gamut_t base_cg = UHDR_CG_UNSPECIFIED;
+  uhdr_gainmap_metadata_ext_t metadata;
+  JpegEncoderHelper base_encoder;
+  JpegEncoderHelper gainmap_encoder;
+};
+
 class JpegR {
  public:
   JpegR(void* uhdrGLESCtxt = nullptr,
@@ -133,6 +253,83 @@ class JpegR {
   uhdr_error_info_t encodeJPEGR(uhdr_raw_image_t* hdr_intent, uhdr_raw_image_t* sdr_intent,
                                 uhdr_compressed_image_t* dest, int quality, uhdr_mem_block_t* exif);
 
+  /*!\brief Encodes the inputs of API-0 or API-1 at several qualities. The sdr intent, the gain map
+   * and the ycbcr intermediate of the base image are computed once, then base image and gain map
+   * are compressed for every rung concurrently. Each rung is the image encodeJPEGR() would produce
+   * at its qualities.
+   *
+   * \param[in]       hdr_intent        hdr intent raw input image descriptor
+   * \param[in]       sdr_intent        sdr intent raw input image descriptor, nullptr to tone map
+   *                                    the hdr intent as API-0 does
+   * \param[in, out]  rungs             qualities and output descriptors
+   * \param[in]       exif              optional exif metadata that needs to be inserted in
+   *                                    every output
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t encodeJPEGRLadder(uhdr_raw_image_t* hdr_intent, uhdr_raw_image_t* sdr_intent,
+                                      const std::vector<QualityRung>& rungs,
+                                      uhdr_mem_block_t* exif);
+
+  /*!\brief Encodes the inputs of API-0 or API-1 at the highest quality whose output fits a byte
+   * budget. The gain map and the ycbcr intermediate of the base image are computed once, as in
+   * encodeJPEGRLadder(). Base image and gain map are compressed once at quality 100, the trials of
+   * a binary search over the quality requantize the dct coefficients of these and only repeat the
+   * entropy coding. A trial quality applies to both images, capped at quality for the base image
+   * and at the gain map quality of the constructor for the gain map. If the output does not fit
+   * at quality 1, the output of quality 1 is produced.
+   *
+   * \param[in]       hdr_intent        hdr intent raw input image descriptor
+   * \param[in]       sdr_intent        sdr intent raw input image descriptor, nullptr to tone map
+   *                                    the hdr intent as API-0 does
+   * \param[in]       target_size       byte budget of the output
+   * \param[in]       quality           highest quality factor of the sdr intent
+   * \param[in]       exif              optional exif metadata that needs to be inserted in
+   *                                    compressed output
+   * \param[in, out]  dest              output image descriptor to store compressed ultrahdr image
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t encodeJPEGRTargetSize(uhdr_raw_image_t* hdr_intent,
+                                          uhdr_raw_image_t* sdr_intent, size_t target_size,
+                                          int quality, uhdr_mem_block_t* exif,
+                                          uhdr_compressed_image_t* dest);
+
+  /*!\brief Encodes a strip of rows of the inputs of API-0 or API-1. The strips are handed over
+   * top to bottom, the base image and the gain map are compressed as they arrive and the output
+   * is produced by encodeJPEGRStreamFinish(). The first strip fixes the layout of the intents,
+   * later strips must share it. Strips but the last span a multiple of the gain map scale factor
+   * rows, of two rows for subsampled intents, so that the gain map and the chroma samples of a
+   * strip only depend on its rows.
+   *
+   * The gain map is computed in one pass, as API-0 does, so its metadata does not depend on the
+   * content. An sdr intent is therefore only taken with the #UHDR_USAGE_REALTIME preset, which
+   * makes API-1 compute the same gain map. The output is the image encodeJPEGR() would produce
+   * but for the restart markers of its strip encode mode, which do not change the decoded pixels.
+   *
+   * \param[in]       hdr_rows          rows of the hdr intent
+   * \param[in]       sdr_rows          rows of the sdr intent, nullptr to tone map the hdr intent
+   *                                    as API-0 does. Either every strip has one or none
+   * \param[in, out]  stream            state of the encode
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t encodeJPEGRStreamRows(uhdr_raw_image_t* hdr_rows, uhdr_raw_image_t* sdr_rows,
+                                          JpegREncodeStream* stream);
+
+  /*!\brief Completes an encode of strips, see encodeJPEGRStreamRows(), once all rows of the
+   * intents are received.
+   *
+   * \param[in, out]  stream            state of the encode
+   * \param[in]       exif              optional exif metadata that needs to be inserted in
+   *                                    compressed output
+   * \param[in, out]  dest              output image descriptor to store compressed ultrahdr image
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t encodeJPEGRStreamFinish(JpegREncodeStream* stream, uhdr_mem_block_t* exif,
+                                            uhdr_compressed_image_t* dest);
+
   /*!\brief Encode API-2.
    *
    * Create ultrahdr jpeg image from raw hdr intent, raw sdr intent and compressed sdr intent.
@@ -230,10 +427,17 @@ class JpegR {
    *         ----------------------------------------------------------------------
    *         |             HDR_LINEAR          |          64bppRGBAHalfFloat      |
    *         ----------------------------------------------------------------------
-   *         |               HDR_PQ            |          32bppRGBA1010102        |
+   *         |               HDR_PQ            |  32bppRGBA1010102, 24bppYCbCrP010 |
    *         ----------------------------------------------------------------------
-   *         |               HDR_HLG           |          32bppRGBA1010102        |
+   *         |               HDR_HLG           |  32bppRGBA1010102, 24bppYCbCrP010 |
    *         ----------------------------------------------------------------------
+   *
+   * NOTE: 24bppYCbCrP010 output is full range, with the YCbCr matrix of the output color gamut,
+   * and expects even image dimensions. It suits hardware video encoders that take 4:2:0 input.
+   *
+   * NOTE: For SDR output, the base image is returned as is unless max_display_boost is greater
+   * than 1.0. In that case the gain map is applied and the result is normalized to the peak of the
+   * display, i.e. sdr white scaled by the display boost.
    */
   uhdr_error_info_t decodeJPEGR(uhdr_compressed_image_t* uhdr_compressed_img,
                                 uhdr_raw_image_t* dest, float max_display_boost = FLT_MAX,
@@ -242,6 +446,244 @@ class JpegR {
                                 uhdr_raw_image_t* gainmap_img = nullptr,
                                 uhdr_gainmap_metadata_t* gainmap_metadata = nullptr);
 
+  /*!\brief Strip wise variant of decodeJPEGR(). Instead of materializing the final rendition,
+   * the base image is decoded a strip of rows at a time, the gain map is applied to the strip and
+   * the resulting output rows are handed to emit_strip. Peak memory is thus proportional to the
+   * strip height rather than the image size. The gain map is decoded whole.
+   *
+   * NOTE: The strip height is rounded up to a multiple of the MCU height of the base image, the
+   * last strip may be shorter. Gain map application always runs on the cpu.
+   *
+   * \param[in]       uhdr_compressed_img      compressed ultrahdr image descriptor
+   * \param[in]       strip_height             requested rows per strip, must be > 0
+   * \param[in]       emit_strip               receives the output strips in order. An error
+   *                                           returned by it aborts the decode
+   * \param[in]       max_display_boost        see decodeJPEGR()
+   * \param[in]       output_ct                see decodeJPEGR()
+   * \param[in]       output_format            see decodeJPEGR()
+   * \param[in, out]  gainmap_img              see decodeJPEGR()
+   * \param[in, out]  gainmap_metadata         see decodeJPEGR()
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t decodeJPEGRInStrips(
+      uhdr_compressed_image_t* uhdr_compressed_img, unsigned int strip_height,
+      const PushStripFn& emit_strip, float max_display_boost = FLT_MAX,
+      uhdr_color_transfer_t output_ct = UHDR_CT_LINEAR,
+      uhdr_img_fmt_t output_format = UHDR_IMG_FMT_64bppRGBAHalfFloat,
+      uhdr_raw_image_t* gainmap_img = nullptr, uhdr_gainmap_metadata_t* gainmap_metadata = nullptr);
+
+  /*!\brief Whole image variant of decodeJPEGRInStrips(). The strips are written to their rows of
+   * dest in place, so the decode holds dest, the gain map and one strip of the base image, but
+   * neither a whole base image nor a separate output strip. The output is identical to that of
+   * decodeJPEGR().
+   *
+   * \param[in]       uhdr_compressed_img      compressed ultrahdr image descriptor
+   * \param[in]       strip_height             requested rows per strip, must be > 0
+   * \param[in, out]  dest                     output image of the image dimensions
+   * \param[in]       max_display_boost        see decodeJPEGR()
+   * \param[in]       output_ct                see decodeJPEGR()
+   * \param[in]       output_format            see decodeJPEGR()
+   * \param[in, out]  gainmap_img              see decodeJPEGR()
+   * \param[in, out]  gainmap_metadata         see decodeJPEGR()
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t decodeJPEGRStripWise(
+      uhdr_compressed_image_t* uhdr_compressed_img, unsigned int strip_height,
+      uhdr_raw_image_t* dest, float max_display_boost = FLT_MAX,
+      uhdr_color_transfer_t output_ct = UHDR_CT_LINEAR,
+      uhdr_img_fmt_t output_format = UHDR_IMG_FMT_64bppRGBAHalfFloat,
+      uhdr_raw_image_t* gainmap_img = nullptr, uhdr_gainmap_metadata_t* gainmap_metadata = nullptr);
+
+  /*!\brief Region of interest variant of decodeJPEGR(). Only the rows and columns of the base
+   * image that intersect roi are decoded and the gain map is applied over roi alone. dest receives
+   * a roi.width x roi.height rendition, identical to the corresponding rectangle of a full decode
+   * up to the upsampling of the base image chroma, which is replicated here.
+   *
+   * NOTE: The gain map is decoded whole, gainmap_img (if not nullptr) receives all of it. Gain map
+   * application always runs on the cpu.
+   *
+   * \param[in]       uhdr_compressed_img      compressed ultrahdr image descriptor
+   * \param[in]       roi                      region of the base image to decode, must lie within
+   *                                           the image
+   * \param[in, out]  dest                     output image descriptor, of roi dimensions
+   * \param[in]       max_display_boost        see decodeJPEGR()
+   * \param[in]       output_ct                see decodeJPEGR()
+   * \param[in]       output_format            see decodeJPEGR()
+   * \param[in, out]  gainmap_img              see decodeJPEGR()
+   * \param[in, out]  gainmap_metadata         see decodeJPEGR()
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t decodeJPEGRRegion(
+      uhdr_compressed_image_t* uhdr_compressed_img, const image_region_t& roi,
+      uhdr_raw_image_t* dest, float max_display_boost = FLT_MAX,
+      uhdr_color_transfer_t output_ct = UHDR_CT_LINEAR,
+      uhdr_img_fmt_t output_format = UHDR_IMG_FMT_64bppRGBAHalfFloat,
+      uhdr_raw_image_t* gainmap_img = nullptr, uhdr_gainmap_metadata_t* gainmap_metadata = nullptr);
+
+  /*!\brief Downscaled variant of decodeJPEGR(). Base image and gain map are both decoded at
+   * 1 / scale_denom of their size by libjpeg, the gain map is then applied at the reduced size.
+   * dest receives a ceil(width / scale_denom) x ceil(height / scale_denom) rendition.
+   *
+   * NOTE: Gain map application always runs on the cpu.
+   *
+   * \param[in]       uhdr_compressed_img      compressed ultrahdr image descriptor
+   * \param[in]       scale_denom              downscale factor, one of 1, 2, 4 or 8
+   * \param[in, out]  dest                     output image descriptor, of the scaled dimensions
+   * \param[in]       max_display_boost        see decodeJPEGR()
+   * \param[in]       output_ct                see decodeJPEGR()
+   * \param[in]       output_format            see decodeJPEGR()
+   * \param[in, out]  gainmap_img              receives the scaled gain map if not nullptr
+   * \param[in, out]  gainmap_metadata         see decodeJPEGR()
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t decodeJPEGRScaled(
+      uhdr_compressed_image_t* uhdr_compressed_img, unsigned int scale_denom,
+      uhdr_raw_image_t* dest, float max_display_boost = FLT_MAX,
+      uhdr_color_transfer_t output_ct = UHDR_CT_LINEAR,
+      uhdr_img_fmt_t output_format = UHDR_IMG_FMT_64bppRGBAHalfFloat,
+      uhdr_raw_image_t* gainmap_img = nullptr, uhdr_gainmap_metadata_t* gainmap_metadata = nullptr);
+
+  /*!\brief Decodes the base image and the gain map of an ultrahdr image without applying the gain
+   * map, for clients that composite the two themselves. No hdr rendition is computed.
+   *
+   * \param[in]       uhdr_compressed_img      compressed ultrahdr image descriptor
+   * \param[in, out]  dest                     receives the base image. dest->fmt selects the
+   *                                           layout, #UHDR_IMG_FMT_32bppRGBA8888 or the planar
+   *                                           YCbCr layout the base image is coded in, one of
+   *                                           #UHDR_IMG_FMT_12bppYCbCr420,
+   *                                           #UHDR_IMG_FMT_24bppYCbCr444 or
+   *                                           #UHDR_IMG_FMT_8bppYCbCr400
+   * \param[in, out]  gainmap_img              receives the gain map if not nullptr
+   * \param[in, out]  gainmap_metadata         receives the gain map metadata if not nullptr
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t decodeJPEGRBaseImage(uhdr_compressed_image_t* uhdr_compressed_img,
+                                         uhdr_raw_image_t* dest,
+                                         uhdr_raw_image_t* gainmap_img = nullptr,
+                                         uhdr_gainmap_metadata_t* gainmap_metadata = nullptr);
+
+  /*!\brief Decodes the gain map of an ultrahdr image alone, for clients that only analyze the gain
+   * map and its metadata. The base image is neither decoded nor parsed beyond the container.
+   *
+   * \param[in]       uhdr_compressed_img      compressed ultrahdr image descriptor
+   * \param[in]       scale_denom              downscale factor, one of 1, 2, 4 or 8. The gain map
+   *                                           is decoded at 1 / scale_denom of its size by libjpeg
+   * \param[in, out]  gainmap_img              receives the gain map, of the scaled dimensions
+   * \param[in, out]  gainmap_metadata         receives the gain map metadata if not nullptr
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t decodeJPEGRGainMap(uhdr_compressed_image_t* uhdr_compressed_img,
+                                       unsigned int scale_denom, uhdr_raw_image_t* gainmap_img,
+                                       uhdr_gainmap_metadata_t* gainmap_metadata = nullptr);
+
+  /*!\brief Decodes the inputs of gain map application once, for clients that render regions of
+   * the hdr output on demand with applyGainMapRegion(). The images are copied out of the decoders
+   * and owned by the caller. If the decode cache holds them from an earlier whole image decode in
+   * the same mode, they are copied from there without decoding again.
+   *
+   * \param[in]       uhdr_compressed_img      compressed ultrahdr image descriptor
+   * \param[in]       output_ct                color transfer of the renditions to come. The base
+   *                                           image is decoded to #UHDR_IMG_FMT_32bppRGBA8888 for
+   *                                           #UHDR_CT_SRGB, to the planar YCbCr layout it is
+   *                                           coded in otherwise
+   * \param[out]      sdr_intent               receives the base image
+   * \param[out]      gainmap_img              receives the gain map
+   * \param[out]      gainmap_metadata         receives the gain map metadata
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t decodeJPEGRSources(uhdr_compressed_image_t* uhdr_compressed_img,
+                                       uhdr_color_transfer_t output_ct,
+                                       std::unique_ptr<uhdr_raw_image_ext_t>& sdr_intent,
+                                       std::unique_ptr<uhdr_raw_image_ext_t>& gainmap_img,
+                                       uhdr_gainmap_metadata_ext_t* gainmap_metadata);
+
+  /*!\brief Applies the gain map over roi of the base image alone. dest receives the same pixels as
+   * the corresponding rectangle of applyGainMap() over the whole image.
+   *
+   * NOTE: Gain map application always runs on the cpu.
+   *
+   * \param[in]       sdr_intent               base image, see decodeJPEGRSources()
+   * \param[in]       gainmap_img              gain map image descriptor
+   * \param[in]       gainmap_metadata         gain map metadata descriptor
+   * \param[in]       roi                      region of the base image to render, must lie within
+   *                                           the image. Left and top must be even for a 4:2:0
+   *                                           base image
+   * \param[in]       max_display_boost        see decodeJPEGR()
+   * \param[in]       output_ct                see decodeJPEGR()
+   * \param[in]       output_format            see decodeJPEGR()
+   * \param[in, out]  dest                     output image descriptor, of roi dimensions
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t applyGainMapRegion(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* gainmap_img,
+                                       uhdr_gainmap_metadata_ext_t* gainmap_metadata,
+                                       const image_region_t& roi, float max_display_boost,
+                                       uhdr_color_transfer_t output_ct,
+                                       uhdr_img_fmt_t output_format, uhdr_raw_image_t* dest);
+
+  /*!\brief Decodes an ultrahdr image to several renditions at once. Base image and gain map are
+   * decoded once for all hdr renditions and once more for all sdr ones, which need the base image
+   * in rgb. Packed hdr renditions of the same effective display boost are rendered in a single
+   * sweep that computes the linear hdr pixel once and encodes it for each of them.
+   *
+   * NOTE: Gain map application always runs on the cpu. Shared sweeps always compute the exact
+   * output, see setApproximateGainMap().
+   *
+   * \param[in]       uhdr_compressed_img      compressed ultrahdr image descriptor
+   * \param[in, out]  renditions               outputs, each dest of the base image dimensions
+   * \param[in, out]  gainmap_img              see decodeJPEGR()
+   * \param[in, out]  gainmap_metadata         see decodeJPEGR()
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t decodeJPEGRRenditions(uhdr_compressed_image_t* uhdr_compressed_img,
+                                          const std::vector<RenditionDesc>& renditions,
+                                          uhdr_raw_image_t* gainmap_img = nullptr,
+                                          uhdr_gainmap_metadata_t* gainmap_metadata = nullptr);
+
+  /*!\brief Transcode API. Rotates, mirrors and crops the base image and the gain map of an
+   * ultrahdr image in the dct domain, see JpegEncoderHelper::transformImage(), and writes them
+   * back as an ultrahdr image with xmp, iso 21496-1 and mpf segments that describe the new
+   * layout. No pixel is decoded, so the images carry no generation loss. The gain map metadata
+   * and the other application segments of the images are kept.
+   *
+   * \param[in]       uhdr_compressed_img      compressed ultrahdr image descriptor
+   * \param[in]       base_map                 map of the output base image pixels to the input
+   * \param[in]       gainmap_map              map of the output gain map pixels to the input
+   * \param[in, out]  dest                     output image descriptor to store compressed ultrahdr
+   *                                           image
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+   *         #UHDR_CODEC_UNSUPPORTED_FEATURE if a map splits the blocks of an image,
+   *         uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t transcodeJPEGR(uhdr_compressed_image_t* uhdr_compressed_img,
+                                   const uhdr_plane_map_t& base_map,
+                                   const uhdr_plane_map_t& gainmap_map,
+                                   uhdr_compressed_image_t* dest);
+
+  /*!\brief Metadata rewrite API. Replaces the gain map metadata of an ultrahdr image. The xmp,
+   * iso 21496-1 and mpf segments are regenerated for the new metadata, all other segments and the
+   * entropy coded data of both images are copied byte for byte. Nothing is decoded.
+   *
+   * \param[in]       uhdr_compressed_img      compressed ultrahdr image descriptor
+   * \param[in]       metadata                 new gainmap metadata descriptor
+   * \param[in, out]  dest                     output image descriptor to store compressed ultrahdr
+   *                                           image
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t rewriteGainMapMetadata(uhdr_compressed_image_t* uhdr_compressed_img,
+                                           uhdr_gainmap_metadata_ext_t* metadata,
+                                           uhdr_compressed_image_t* dest);
+
   /*!\brief This function parses the bitstream and returns information that is useful for actual
    * decoding. This does not decode the image. That is handled by decodeJPEGR
    *
@@ -253,6 +695,54 @@ class JpegR {
   uhdr_error_info_t getJPEGRInfo(uhdr_compressed_image_t* uhdr_compressed_img,
                                  jr_info_ptr uhdr_image_info);
 
+  /*!\brief This function is a zero copy variant of getJPEGRInfo(). It locates the primary and gain
+   * map images and reads their headers in place, see JpegDecoderHelper::scanHeaders(). The gain
+   * map image is found via the mpf block of the primary image, the bitstream is only searched for
+   * it if the mpf block is absent or does not describe it. Image data is never visited and the
+   * outputs point into uhdr_compressed_img.
+   *
+   * \param[in]   uhdr_compressed_img      compressed ultrahdr image descriptor
+   * \param[out]  primary_image            primary image bitstream
+   * \param[out]  primary_view             primary image header fields and payload views
+   * \param[out]  gainmap_image            gain map image bitstream
+   * \param[out]  gainmap_view             gain map image header fields and payload views
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t getJPEGRInfoInPlace(uhdr_compressed_image_t* uhdr_compressed_img,
+                                        uhdr_compressed_image_t* primary_image,
+                                        jpeg_header_view_t* primary_view,
+                                        uhdr_compressed_image_t* gainmap_image,
+                                        jpeg_header_view_t* gainmap_view);
+
+  /*!\brief Tells ultrahdr images apart from other jpeg images by their markers alone. The primary
+   * image must carry the hdrgm xmp namespace or the iso 21496-1 urn and an mpf block that locates
+   * a secondary image, whose headers carry gain map metadata in either form. Only the headers of
+   * the two images are visited, nothing is allocated and the metadata values are not validated.
+   *
+   * \param[in]   data                     compressed image
+   * \param[in]   size                     size of the compressed image
+   *
+   * \return true if the image has the markers of an ultrahdr image, false otherwise.
+   */
+  static bool hasUltraHdrSignature(const void* data, size_t size);
+
+  /*!\brief Builds the process wide tables that encodes and decodes otherwise build on first use,
+   * the hlg and pq output code tables, the fixed point srgb tables, the icc profiles of the
+   * supported transfer and gamut pairs and the simd dispatch table. Safe to call concurrently with
+   * encodes and decodes.
+   *
+   * \return none
+   */
+  static void preloadTables();
+
+  /*!\brief Starts the threads of the library-owned pool that a call with the default thread count
+   * runs on, see getWorkerCount().
+   *
+   * \return none
+   */
+  static void preloadThreads();
+
   /*!\brief set gain map dimension scale factor
    * NOTE: Applicable only in encoding scenario
    *
@@ -271,6 +761,18 @@ class JpegR {
    */
   int getMapDimensionScaleFactor() { return this->mMapDimensionScaleFactor; }
 
+  /*!\brief Picks a gain map dimension scale factor for hdr_intent. The factor is raised with the
+   * image size and as far as the detail of the hdr luminance allows, more so for
+   * #UHDR_USAGE_REALTIME. The detail is estimated from a few sampled rows.
+   * NOTE: Applicable only in encoding scenario
+   *
+   * \param[in]       hdr_intent        hdr intent raw input image descriptor
+   * \param[in]       preset            encoding preset
+   *
+   * \return a power of two scale factor
+   */
+  static int selectMapDimensionScaleFactor(uhdr_raw_image_t* hdr_intent, uhdr_enc_preset_t preset);
+
   /*!\brief set gain map compression quality factor
    * NOTE: Applicable only in encoding scenario
    *
@@ -349,6 +851,232 @@ class JpegR {
     maxBoost = this->mMaxContentBoost;
   }
 
+  /*!\brief set the input footprint of a gain map generation tile
+   * NOTE: Applicable only in encoding scenario
+   *
+   * \param[in]       tileSize      bytes of hdr and sdr intent sampled per tile, 0 walks whole
+   *                                gain map rows
+   *
+   * \return none
+   */
+  void setGainMapTileSize(int tileSize) { this->mGainMapTileSize = tileSize; }
+
+  /*!\brief get the input footprint of a gain map generation tile
+   * NOTE: Applicable only in encoding scenario
+   *
+   * \return tile size in bytes
+   */
+  int getGainMapTileSize() { return this->mGainMapTileSize; }
+
+  /*!\brief enable or disable content boost estimation for the best quality preset
+   * NOTE: Applicable only in encoding scenario
+   *
+   * \param[in]       enable        estimate the content boosts from a sample of the gains and
+   *                                encode the gain map in one pass, instead of computing all gains
+   *                                before encoding them
+   *
+   * \return none
+   */
+  void setGainMapBoostEstimation(bool enable) { this->mGainMapBoostEstimation = enable; }
+
+  /*!\brief get content boost estimation setting
+   * NOTE: Applicable only in encoding scenario
+   *
+   * \return true if content boosts are estimated
+   */
+  bool getGainMapBoostEstimation() { return this->mGainMapBoostEstimation; }
+
+  /*!\brief set the factor by which the hdr intent of api-1 encodes is downscaled from the
+   * resolution of the sdr intent. The gain map is then generated from an hdr intent resampled to
+   * about its resolution, rather than from one at full resolution.
+   * NOTE: Applicable only in encoding scenario
+   *
+   * \param[in]       downscale     factor, it must divide the map scale factor. 1 for an hdr
+   *                                intent of the resolution of the sdr intent
+   *
+   * \return none
+   */
+  void setHdrIntentDownscale(unsigned int downscale) { this->mHdrIntentDownscale = downscale; }
+
+  /*!\brief set number of worker threads used by the row parallel stages
+   *
+   * \param[in]       numThreads    number of threads including the calling thread. 0 lets the
+   *                                library pick a value based on core count
+   *
+   * \return none
+   */
+  void setNumThreads(int numThreads) { this->mNumThreads = numThreads; }
+
+  /*!\brief get number of worker threads used by the row parallel stages
+   *
+   * \return configured number of threads, 0 if the library picks a value
+   */
+  int getNumThreads() { return this->mNumThreads; }
+
+  /*!\brief set external executor for the row parallel stages
+   *
+   * \param[in]       parallelFor   executor callback, nullptr selects the library thread pool
+   * \param[in]       executorCtx   opaque pointer passed back to parallelFor
+   *
+   * \return none
+   */
+  void setParallelExecutor(uhdr_parallel_for_fn_t parallelFor, void* executorCtx) {
+    this->mParallelFor = parallelFor;
+    this->mParallelForCtx = executorCtx;
+  }
+
+  /*!\brief set jpeg codec backend of the base image and gain map, see uhdr_set_jpeg_backend()
+   *
+   * \param[in]       backend       jpeg codec backend, callbacks set to nullptr select libjpeg
+   *
+   * \return none
+   */
+  void setJpegBackend(const uhdr_jpeg_backend_t& backend) { this->mJpegBackend = backend; }
+
+  /*!\brief set the core type of the worker threads, see uhdr_set_core_affinity()
+   *
+   * \param[in]       affinity      core type, #UHDR_CORES_ANY leaves placement to the scheduler
+   *
+   * \return none
+   */
+  void setCoreAffinity(uhdr_core_affinity_t affinity) { this->mCoreAffinity = affinity; }
+
+  /*!\brief select the fast integer idct for the base image and gain map decode
+   *
+   * \param[in]       enable        true for the fast idct, false for the accurate one
+   *
+   * \return none
+   */
+  void setFastIdct(bool enable) { this->mFastIdct = enable; }
+
+  /*!\brief replicate chroma samples in place of fancy upsampling when the base image is decoded
+   * to rgb, see JpegDecoderHelper::setFastUpsampling()
+   *
+   * \param[in]       enable        true for the fast upsampling, false for the fancy one
+   *
+   * \return none
+   */
+  void setFastUpsampling(bool enable) { this->mFastUpsampling = enable; }
+
+  /*!\brief decode the base image of whole image decodes into dest and apply the gain map over it
+   * in place, where base image and output share a pixel format. That holds for sdr output with a
+   * display boost, which then needs no memory for the base image past dest. The decode cache, if
+   * any, does not hold the base image of such decodes.
+   *
+   * \param[in]       enable        true to apply the gain map in place, false for a separate base
+   *                                image
+   *
+   * \return none
+   */
+  void setApplyGainMapInPlace(bool enable) { this->mApplyGainMapInPlace = enable; }
+
+  /*!\brief set the color gamut of the hdr output of decode calls. The conversion from the gamut of
+   * the base image is applied to the linear output of applyGainMap().
+   *
+   * \param[in]       cg            output color gamut, #UHDR_CG_UNSPECIFIED for the gamut of the
+   *                                base image
+   *
+   * \return none
+   */
+  void setOutputColorGamut(uhdr_color_gamut_t cg) { this->mOutputCg = cg; }
+
+  /*!\brief select the approximate gain map application of decode calls. For single channel gain
+   * maps, the float path of applyGainMap() then interpolates the mapping from the sdr pixel and the
+   * gain to the output pixel from a table instead of evaluating the transfer functions. Outputs
+   * are within a 10-bit code of the exact ones, except near black.
+   *
+   * \param[in]       enable        true for the approximation, false for the exact computation
+   *
+   * \return none
+   */
+  void setApproximateGainMap(bool enable) { this->mApproximateGainMap = enable; }
+
+  /*!\brief place the hdr output of whole image and region decode calls through a map of its
+   * pixels. Rotations, mirrors and crops of the output are then made while the gain map is applied,
+   * rather than in a pass over the decoded image. dest is of the dimensions of the map, which takes
+   * its pixels to the pixels of the decoded image or region. Only maps that permute and drop pixels
+   * are supported, and no P010 output.
+   *
+   * \param[in]       map           map owned by the caller, nullptr for an unmapped output
+   *
+   * \return none
+   */
+  void setOutputMap(const uhdr_plane_map_t* map) { this->mOutputMap = map; }
+
+  /*!\brief set state to be reused across decode calls
+   *
+   * \param[in]       cache         decode state owned by the caller, nullptr for per call state
+   *
+   * \return none
+   */
+  void setDecodeCache(JpegRDecodeCache* cache) { this->mDecodeCache = cache; }
+
+  /*!\brief set state shared with the other encodes of a batch
+   *
+   * \param[in]       cache         encode state owned by the caller, nullptr for per call state
+   *
+   * \return none
+   */
+  void setEncodeCache(const JpegREncodeCache* cache) { this->mEncodeCache = cache; }
+
+  /*!\brief set a receiver of the spans of API-4 encodes. When set, the entropy coded data of the
+   * base and gain map images is not copied to dest, the spans of the stream are listed in segments
+   * and dest only holds the generated markers and metadata the spans point into.
+   *
+   * \param[in]       segments      spans owned by the caller, nullptr for a contiguous stream
+   *
+   * \return none
+   */
+  void setOutputSegments(std::vector<uhdr_stream_segment_t>* segments) {
+    this->mOutputSegments = segments;
+  }
+
+  /*!\brief set a receiver of the base image of whole image decodes, see BaseImageFn
+   *
+   * \param[in]       baseImageFn   receiver owned by the caller, nullptr for none
+   *
+   * \return none
+   */
+  void setBaseImageCallback(const BaseImageFn* baseImageFn) { this->mBaseImageFn = baseImageFn; }
+
+  /*!\brief set the gain map of decodes at full size, decoded by an earlier decode of the same
+   * image with the same settings. The gain map bitstream is not decoded then.
+   *
+   * \param[in]       gainmap       gain map owned by the caller, nullptr to decode it
+   *
+   * \return none
+   */
+  void setPredecodedGainMap(const uhdr_raw_image_t* gainmap) { this->mPredecodedGainMap = gainmap; }
+
+  /*!\brief set a receiver of the gain map of decodes at full size, see GainMapFn
+   *
+   * \param[in]       gainMapFn     receiver owned by the caller, nullptr for none
+   *
+   * \return none
+   */
+  void setGainMapCallback(const GainMapFn* gainMapFn) { this->mGainMapFn = gainMapFn; }
+
+  /*!\brief set a receiver of the luminance statistics of the hdr output. applyGainMap() gathers
+   * them from the output rows as it writes them and overwrites stats once it completes. Gain map
+   * applications on the gpu are skipped while a receiver is set.
+   *
+   * \param[in]       stats         statistics owned by the caller, nullptr for none
+   *
+   * \return none
+   */
+  void setLuminanceStats(uhdr_luminance_stats_t* stats) { this->mLuminanceStats = stats; }
+
+  /*!\brief set receiver of the stage timings of encode/decode calls
+   *
+   * \param[in]       stats         stats owned by the caller, nullptr for none
+   *
+   * \return none
+   */
+  void setStats(CodecStats* stats) {
+    this->mStats = stats;
+    if (stats != nullptr) stats->setNumThreads(getWorkerCount());
+  }
+
   /* \brief Alias of Encode API-0.
    *
    * \deprecated This function is deprecated. Use its alias
@@ -428,12 +1156,42 @@ class JpegR {
    */
   uhdr_error_info_t toneMap(uhdr_raw_image_t* hdr_intent, uhdr_raw_image_t* sdr_intent);
 
+  /*!\brief This method validates the inputs of toneMap() and returns the function that tone maps
+   * a range of rows, without running it. The sdr intent color descriptors are set on success.
+   *
+   * NOTE: For UHDR_IMG_FMT_24bppYCbCrP010 hdr intent, row ranges must start at an even row.
+   *
+   * \param[in]            hdr_intent      hdr image descriptor
+   * \param[in, out]       sdr_intent      sdr image descriptor
+   * \param[out]           tone_map_rows   tone maps rows [row_start, row_end) of hdr intent into
+   *                                       sdr intent, valid while both descriptors are alive
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t prepareToneMap(uhdr_raw_image_t* hdr_intent, uhdr_raw_image_t* sdr_intent,
+                                   RowRangeFn& tone_map_rows);
+
+  /*!\brief Allocates the sdr intent that API-0 tone maps the hdr intent to and prepares the tone
+   * mapping, see prepareToneMap(). tone_map_rows is left empty if the sdr intent was tone mapped as
+   * a whole already.
+   *
+   * \param[in]            hdr_intent      hdr image descriptor
+   * \param[out]           sdr_intent      sdr image descriptor
+   * \param[out]           tone_map_rows   tone maps rows [row_start, row_end) of hdr intent into
+   *                                       sdr intent, valid while both descriptors are alive
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t prepareToneMappedSdrIntent(uhdr_raw_image_t* hdr_intent,
+                                               std::unique_ptr<uhdr_raw_image_ext_t>& sdr_intent,
+                                               RowRangeFn& tone_map_rows);
+
   /*!\brief This method takes hdr intent and sdr intent and computes gainmap coefficient.
    *
    * This method is called in the encoding pipeline. It takes uncompressed 8-bit and 10-bit yuv
    * images as input and calculates gainmap.
    *
-   * NOTE: The input images must be the same resolution.
+   * NOTE: The input images must be the same resolution, unless sdr_downscale is set.
    * NOTE: The SDR input is assumed to use the sRGB transfer function.
    *
    * \param[in]       sdr_intent               sdr intent raw input image descriptor
@@ -449,21 +1207,50 @@ class JpegR {
    *                                           combination of r, g, b channels; otherwise, gainmap
    *                                           calculation is based of the maximun value of r, g, b
    *                                           channels.
+   * \param[in]       prepare_sdr_rows         (optional) if set, it is called with a range of
+   *                                           even aligned image rows right before the gainmap
+   *                                           rows covering them are computed, so that the sdr
+   *                                           intent can be produced in the same sweep. Together
+   *                                           the calls cover every row of the image once.
+   * \param[in]       consume_rows             (optional) if set, the gainmap is not written to
+   *                                           gainmap_img. Instead consume_rows is called with a
+   *                                           producer of its rows once the metadata is known,
+   *                                           and must produce every row before returning.
+   * \param[in]       sdr_downscale            (optional) factor by which the sdr intent is
+   *                                           downscaled from the resolution of the hdr intent.
+   *                                           It must divide the map scale factor, the sdr intent
+   *                                           is then box filtered by the remaining factor.
+   * \param[in]       hdr_downscale            (optional) likewise, factor by which the hdr intent
+   *                                           is downscaled from the image resolution, which the
+   *                                           dimensions of the gain map follow.
    *
    * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
    */
   uhdr_error_info_t generateGainMap(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* hdr_intent,
                                     uhdr_gainmap_metadata_ext_t* gainmap_metadata,
                                     std::unique_ptr<uhdr_raw_image_ext_t>& gainmap_img,
-                                    bool sdr_is_601 = false, bool use_luminance = true);
+                                    bool sdr_is_601 = false, bool use_luminance = true,
+                                    const RowRangeFn& prepare_sdr_rows = nullptr,
+                                    const GainMapConsumerFn& consume_rows = nullptr,
+                                    unsigned int sdr_downscale = 1,
+                                    unsigned int hdr_downscale = 1);
 
  protected:
   /*!\brief This method takes sdr intent, gainmap image and gainmap metadata and computes hdr
    * intent. This method is called in the decoding pipeline. The output hdr intent image will have
-   * same color gamut as sdr intent.
+   * same color gamut as sdr intent, unless another one is set by setOutputColorGamut().
    *
    * NOTE: The SDR input is assumed to use the sRGB transfer function.
    *
+   * NOTE: For #UHDR_CT_SRGB output, sdr intent must be #UHDR_IMG_FMT_32bppRGBA8888. The output is
+   * computed in fixed point, see GainLUTFixed, and is normalized to the peak of the display.
+   *
+   * NOTE: The output is converted to the gamut set by setOutputColorGamut(), in linear light
+   * ahead of the output transfer. This is not available for #UHDR_CT_SRGB output.
+   *
+   * NOTE: #UHDR_IMG_FMT_24bppYCbCrP010 output is computed as #UHDR_IMG_FMT_32bppRGBA1010102 and
+   * converted a pair of rows at a time, while the rows are in cache.
+   *
    * \param[in]       sdr_intent               sdr intent raw input image descriptor
    * \param[in]       gainmap_img              gainmap image descriptor
    * \param[in]       gainmap_metadata         gainmap metadata descriptor
@@ -473,15 +1260,76 @@ class JpegR {
    *                                           display, the value must be greater than or equal
    *                                           to 1.0
    * \param[in, out]  dest                     output image descriptor to store output
+   * \param[in]       pull_sdr_strip           if not nullptr, the output is computed strip wise.
+   *                                           sdr_intent then only describes format and
+   *                                           dimensions of the base image, its rows are pulled
+   *                                           from here, and dest holds one strip of output rows
+   * \param[in]       push_dest_strip          receives each output strip of a strip wise call. If
+   *                                           nullptr, dest holds the whole output and each strip
+   *                                           is written to its rows in place
+   * \param[in]       col_offset               column of the base image at which the pulled
+   *                                           strips start, they span a width of dest->w
    *
    * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
    */
   uhdr_error_info_t applyGainMap(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* gainmap_img,
                                  uhdr_gainmap_metadata_ext_t* gainmap_metadata,
                                  uhdr_color_transfer_t output_ct, uhdr_img_fmt_t output_format,
-                                 float max_display_boost, uhdr_raw_image_t* dest);
+                                 float max_display_boost, uhdr_raw_image_t* dest,
+                                 const PullStripFn* pull_sdr_strip = nullptr,
+                                 const PushStripFn* push_dest_strip = nullptr,
+                                 unsigned int col_offset = 0);
 
  private:
+  // gain map and base image of an api-0 or api-1 encode, ready to be compressed
+  struct EncodeIntermediates {
+    uhdr_gainmap_metadata_ext_t metadata{kJpegrVersion};
+    std::unique_ptr<uhdr_raw_image_ext_t> gainmap;
+    std::unique_ptr<uhdr_raw_image_ext_t> tone_mapped_sdr_intent;  // api-0 only
+    std::unique_ptr<uhdr_raw_image_ext_t> sdr_intent_yuv_ext;
+    uhdr_raw_image_t* sdr_intent_yuv = nullptr;  // base image to compress
+    std::shared_ptr<DataStruct> icc;
+  };
+
+  // generates the gain map and converts the sdr intent for compression, sdr_intent nullptr tone
+  // maps the hdr intent as api-0 does
+  uhdr_error_info_t prepareEncodeIntermediates(uhdr_raw_image_t* hdr_intent,
+                                               uhdr_raw_image_t* sdr_intent,
+                                               EncodeIntermediates& out);
+
+  // shared implementation of the decodeJPEGR() variants, emit_strip selects strip wise mode, roi
+  // selects region mode and scale_denom > 1 selects scaled mode
+  uhdr_error_info_t decodeJPEGRImpl(uhdr_compressed_image_t* uhdr_compressed_img,
+                                    uhdr_raw_image_t* dest, unsigned int strip_height,
+                                    const PushStripFn* emit_strip, const image_region_t* roi,
+                                    unsigned int scale_denom, float max_display_boost,
+                                    uhdr_color_transfer_t output_ct, uhdr_img_fmt_t output_format,
+                                    uhdr_raw_image_t* gainmap_img,
+                                    uhdr_gainmap_metadata_t* gainmap_metadata);
+
+  // renders hdr renditions of the base image dimensions that share max_display_boost in one sweep,
+  // see decodeJPEGRRenditions()
+  uhdr_error_info_t applyGainMapRenditions(uhdr_raw_image_t* sdr_intent,
+                                           uhdr_raw_image_t* gainmap_img,
+                                           uhdr_gainmap_metadata_ext_t* gainmap_metadata,
+                                           float max_display_boost,
+                                           const std::vector<const RenditionDesc*>& renditions);
+
+  // returns true if the decode cache holds a base image decoded ahead in mode, the cache is
+  // consumed either way
+  bool takeStreamedBaseImage(decode_mode_t mode);
+
+  // marks the decoders of the decode cache as holding the whole images decoded in mode
+  void holdSources(decode_mode_t mode);
+
+  /*!\brief icc profile of the base image, from the encode cache when one is set
+   *
+   * \param[in]       cg                       color gamut of the base image
+   *
+   * \return icc profile with srgb transfer
+   */
+  std::shared_ptr<DataStruct> baseImageIcc(uhdr_color_gamut_t cg);
+
   /*!\brief compress gainmap image
    *
    * \param[in]       gainmap_img              gainmap image descriptor
@@ -491,8 +1339,39 @@ class JpegR {
    */
   uhdr_error_info_t compressGainMap(uhdr_raw_image_t* gainmap_img, JpegEncoderHelper* jpeg_enc_obj);
 
+  /*!\brief compress gainmap while its rows are produced. Rows that are costly to produce are
+   * streamed only if the encoder compresses them in parallel strips, else they are produced in
+   * parallel into an image first.
+   *
+   * \param[in]       rows                     gainmap rows
+   * \param[in]       jpeg_enc_obj             jpeg encoder object handle
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t compressGainMap(const GainMapRows& rows, JpegEncoderHelper* jpeg_enc_obj);
+
+  /*!\brief configure the gainmap encoder for a gainmap of the given dimensions
+   *
+   * \param[in]       width                    gainmap width
+   * \param[in]       height                   gainmap height
+   * \param[in]       jpeg_enc_obj             jpeg encoder object handle
+   *
+   * \return none
+   */
+  void configureGainMapEncoder(unsigned int width, unsigned int height,
+                               JpegEncoderHelper* jpeg_enc_obj);
+
+  /*!\brief produce all rows of a gainmap into an image, in parallel
+   *
+   * \param[in]       rows                     gainmap rows
+   *
+   * \return gainmap image
+   */
+  std::unique_ptr<uhdr_raw_image_ext_t> produceGainMap(const GainMapRows& rows);
+
   /*!\brief This method is called to separate base image and gain map image from compressed
-   * ultrahdr image
+   * ultrahdr image. The images are located through the mpf block of the primary image, the stream
+   * is scanned for them only if that block is absent or invalid.
    *
    * \param[in]            jpegr_image               compressed ultrahdr image descriptor
    * \param[in, out]       primary_image             sdr image descriptor
@@ -518,6 +1397,26 @@ class JpegR {
                                   unsigned int* img_width = nullptr,
                                   unsigned int* img_height = nullptr);
 
+  /*!\brief Assembles an ultrahdr jpeg image from a compressed base image and a compressed gain
+   * map image, adding an icc profile if the base image has none. Backs API-4 and the encodes that
+   * compress their own base or gain map image.
+   *
+   * \param[in]       base_img_compressed      sdr intent compressed input image descriptor
+   * \param[in]       gainmap_img_compressed   gainmap compressed image descriptor
+   * \param[in]       metadata                 gainmap metadata descriptor
+   * \param[in, out]  dest                     output image descriptor to store compressed ultrahdr
+   *                                           image
+   * \param[out]      segments                 spans of the stream, see appendGainMap(), may be
+   *                                           nullptr
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t assembleJPEGR(uhdr_compressed_image_t* base_img_compressed,
+                                  uhdr_compressed_image_t* gainmap_img_compressed,
+                                  uhdr_gainmap_metadata_ext_t* metadata,
+                                  uhdr_compressed_image_t* dest,
+                                  std::vector<uhdr_stream_segment_t>* segments);
+
   /*!\brief This method takes compressed sdr intent, compressed gainmap coefficient, gainmap
    * metadata and creates a ultrahdr image. This is done by first generating XMP packet from gainmap
    * metadata, then appending in the order,
@@ -539,6 +1438,10 @@ class JpegR {
    * \param[in]       metadata                 gainmap metadata descriptor
    * \param[in, out]  dest                     output image descriptor to store compressed ultrahdr
    *                                           image
+   * \param[out]      segments                 if not nullptr, the exif package and the entropy
+   *                                           coded data of both images are referenced in place
+   *                                           rather than written to dest. segments receives the
+   *                                           spans of the stream, in order.
    *
    * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
    */
@@ -546,10 +1449,44 @@ class JpegR {
                                   uhdr_compressed_image_t* gainmap_compressed,
                                   uhdr_mem_block_t* pExif, void* pIcc, size_t icc_size,
                                   uhdr_gainmap_metadata_ext_t* metadata,
-                                  uhdr_compressed_image_t* dest);
+                                  uhdr_compressed_image_t* dest,
+                                  std::vector<uhdr_stream_segment_t>* segments = nullptr);
+
+  /*!\brief Returns number of threads to be used by the row parallel stages */
+  unsigned int getWorkerCount();
+
+  /*!\brief Runs parallelism instances of job on the configured executor and waits for them */
+  void runParallel(const std::function<void()>& job, unsigned int parallelism);
+
+  /*!\brief Runs two independent tasks, concurrently if more than one worker is configured.
+   * Returns the status of the first task if it failed, the status of the second task otherwise */
+  uhdr_error_info_t runConcurrently(const std::function<uhdr_error_info_t()>& first,
+                                    const std::function<uhdr_error_info_t()>& second);
+
+  /*!\brief Runs independent tasks, concurrently if more than one worker is configured. Returns the
+   * status of the first failed task in list order, if any */
+  uhdr_error_info_t runConcurrently(const std::vector<std::function<uhdr_error_info_t()>>& tasks);
+
+  /*!\brief Runs fn over row bands of a width x height image, in parallel for large images. Bands
+   * other than the last are a multiple of two rows. Returns the status of a failed band, if any */
+  uhdr_error_info_t forEachRowBand(
+      unsigned int width, unsigned int height,
+      const std::function<uhdr_error_info_t(unsigned int row_start, unsigned int row_end)>& fn);
+
+  /*!\brief copy_raw_image(), in parallel row bands */
+  uhdr_error_info_t copyRawImage(uhdr_raw_image_t* src, uhdr_raw_image_t* dst);
+
+  /*!\brief copy of src into dest through the map of setOutputMap(), in parallel row bands */
+  uhdr_error_info_t placeMappedImage(uhdr_raw_image_t* src, uhdr_raw_image_t* dest);
+
+  /*!\brief convert_raw_input_to_ycbcr() on the vector kernel of the cpu if there is one, in
+   * parallel row bands */
+  uhdr_error_info_t convertRawInputToYcbcr(uhdr_raw_image_t* src,
+                                           std::unique_ptr<uhdr_raw_image_ext_t>& dst);
 
   /*!\brief This method is used to convert a raw image from one gamut space to another gamut space
-   * in-place.
+   * in-place. Row bands of the image are converted in parallel, on the vector kernel of the
+   * cpu if there is one.
    *
    * \param[in, out]  image              raw image descriptor
    * \param[in]       src_encoding       input gamut space
@@ -560,6 +1497,23 @@ class JpegR {
   uhdr_error_info_t convertYuv(uhdr_raw_image_t* image, uhdr_color_gamut_t src_encoding,
                                uhdr_color_gamut_t dst_encoding);
 
+  /*!\brief Compresses an rgba8888 sdr intent as a 4:4:4 base image. The conversion to ycbcr and
+   * to the gamut dst_encoding runs a strip at a time inside the compression, so no ycbcr copy of
+   * the whole image is held.
+   *
+   * \param[in]   sdr_intent    rgba8888 sdr intent
+   * \param[in]   dst_encoding  ycbcr encoding of the base image
+   * \param[in]   quality       quality factor of the base image
+   * \param[in]   icc           icc segment of the base image
+   * \param[out]  jpeg_enc_obj  encoder holding the compressed base image
+   *
+   * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+   */
+  uhdr_error_info_t compressRgbBaseImage(uhdr_raw_image_t* sdr_intent,
+                                         uhdr_color_gamut_t dst_encoding, int quality,
+                                         const std::shared_ptr<DataStruct>& icc,
+                                         JpegEncoderHelper* jpeg_enc_obj);
+
   /*
    * This method will check the validity of the input arguments.
    *
@@ -604,9 +1558,32 @@ class JpegR {
   bool mUseMultiChannelGainMap;     // enable multichannel gain map
   float mGamma;                     // gain map gamma parameter
   uhdr_enc_preset_t mEncPreset;     // encoding speed preset
+  bool mFastGainMath;               // polynomial log2 in gain computation, realtime preset only
   float mMinContentBoost;           // min content boost recommendation
   float mMaxContentBoost;           // max content boost recommendation
   float mTargetDispPeakBrightness;  // target display max luminance in nits
+  int mGainMapTileSize;             // input bytes per gain map generation tile
+  bool mGainMapBoostEstimation;     // estimate content boosts, encode gain map in one pass
+  unsigned int mHdrIntentDownscale;  // downscale of the hdr intent of api-1 encodes
+  int mNumThreads;                  // number of worker threads, 0 for auto
+  uhdr_parallel_for_fn_t mParallelFor;   // external executor, nullptr for library thread pool
+  void* mParallelForCtx;                 // external executor context
+  uhdr_jpeg_backend_t mJpegBackend;      // jpeg codec backend, see setJpegBackend()
+  uhdr_core_affinity_t mCoreAffinity;    // core type of the library thread pool jobs
+  JpegRDecodeCache* mDecodeCache;        // decode state reused across calls, may be nullptr
+  const JpegREncodeCache* mEncodeCache;  // encode state shared by a batch, may be nullptr
+  std::vector<uhdr_stream_segment_t>* mOutputSegments;  // spans of API-4 encodes, may be nullptr
+  bool mFastIdct;                        // decode with the fast integer idct
+  bool mFastUpsampling;                  // decode rgb base images with merged upsampling
+  bool mApplyGainMapInPlace;             // apply the gain map over a base image decoded to dest
+  uhdr_color_gamut_t mOutputCg;          // gamut of hdr output, unspecified for the base gamut
+  bool mApproximateGainMap;              // apply the gain map through a GainMapOutputLUT
+  const uhdr_plane_map_t* mOutputMap;    // placement of the hdr output, may be nullptr
+  const BaseImageFn* mBaseImageFn;       // receiver of the decoded base image, may be nullptr
+  const uhdr_raw_image_t* mPredecodedGainMap;  // gain map decoded ahead, may be nullptr
+  const GainMapFn* mGainMapFn;           // receiver of the decoded gain map, may be nullptr
+  uhdr_luminance_stats_t* mLuminanceStats;  // receiver of output luminance stats, may be nullptr
+  CodecStats* mStats;                    // receiver of stage timings, may be nullptr
 };
 
 /*
@@ -153,6 +153,48 @@ std::string generateXmpForPrimaryImage(size_t secondary_image_length,
  */
 std::string generateXmpForSecondaryImage(uhdr_gainmap_metadata_ext_t& metadata);
 
+// Upper bound of the packets written by writeXmpForPrimaryImage() and
+// writeXmpForSecondaryImage(), excluding the length of the metadata version string
+constexpr size_t kXmpPacketMaxSize = 1024;
+// Longest metadata version string the encoder writes to XMP
+constexpr size_t kXmpVersionMaxLength = 64;
+
+/*
+ * Writes the packet of generateXmpForPrimaryImage() into a caller buffer, without allocating.
+ *
+ * @param dst destination of the packet
+ * @param capacity size of dst in bytes
+ * @param secondary_image_length length of secondary image
+ * @param metadata JPEG/R metadata to encode as XMP
+ * @return bytes written, 0 if the packet does not fit in capacity bytes
+ */
+size_t writeXmpForPrimaryImage(char* dst, size_t capacity, size_t secondary_image_length,
+                               const uhdr_gainmap_metadata_ext_t& metadata);
+
+/*
+ * Writes the packet of generateXmpForSecondaryImage() into a caller buffer, without allocating.
+ *
+ * @param dst destination of the packet
+ * @param capacity size of dst in bytes
+ * @param metadata JPEG/R metadata to encode as XMP
+ * @return bytes written, 0 if the packet does not fit in capacity bytes
+ */
+size_t writeXmpForSecondaryImage(char* dst, size_t capacity,
+                                 const uhdr_gainmap_metadata_ext_t& metadata);
+
+/*
+ * Rewrites the xmp packet of a primary image for new gain map metadata. The hdrgm properties, the
+ * container directory and the declarations of their namespaces give way to those of
+ * generateXmpForPrimaryImage(), the rest of the packet is kept as it is.
+ *
+ * @param packet xmp packet of the primary image, without the namespace signature
+ * @param secondary_image_length length of secondary image
+ * @param metadata JPEG/R metadata to encode as XMP
+ * @return merged packet, empty if the packet is malformed or has no rdf:Description element
+ */
+std::string mergeXmpForPrimaryImage(std::string_view packet, size_t secondary_image_length,
+                                    const uhdr_gainmap_metadata_ext_t& metadata);
+
 }  // namespace ultrahdr
 
 #endif  // ULTRAHDR_JPEGRUTILS_H
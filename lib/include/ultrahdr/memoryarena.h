@@ -0,0 +1,119 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ULTRAHDR_MEMORYARENA_H
+#define ULTRAHDR_MEMORYARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+#include "ultrahdr_api.h"
+
+namespace ultrahdr {
+
+/*
+ * Per codec context source of large buffers. Blocks are drawn from an optional caller supplied
+ * allocator, and when pooling is enabled, released blocks are kept and handed out again for
+ * requests of similar size instead of going back to the allocator. This keeps the temporaries of
+ * repeated encode/decode calls from churning the heap.
+ *
+ * An arena is bound to the calling thread for the duration of a codec call via Scope. Blocks that
+ * are created while no arena is bound use the default heap.
+ *
+ * Blocks of the default heap start on a kBlockAlignment boundary. With huge pages enabled, blocks
+ * of at least kHugePageThreshold bytes are mapped from huge pages instead, see
+ * uhdr_enable_huge_pages().
+ */
+class MemoryArena {
+ public:
+  MemoryArena() = default;
+  ~MemoryArena();
+
+  MemoryArena(const MemoryArena&) = delete;
+  MemoryArena& operator=(const MemoryArena&) = delete;
+
+  static constexpr size_t kBlockAlignment = 64;             // a cache line, a full simd register
+  static constexpr size_t kHugePageThreshold = 16u << 20;  // smallest block mapped to huge pages
+
+  /*!\brief Identifies how a block is to be released. */
+  struct Releaser {
+    MemoryArena* arena = nullptr;
+    size_t capacity = 0;
+    uhdr_free_fn_t free_fn = nullptr;
+    void* alloc_ctx = nullptr;
+    bool mapped = false;  // mapped from huge pages rather than drawn from the heap
+
+    void operator()(uint8_t* ptr) const;
+  };
+
+  /*!\brief Returns a block of at least capacity bytes. On return, releaser describes how the block
+   * must be given back, and releaser.capacity holds its actual size. */
+  uint8_t* acquire(size_t capacity, Releaser& releaser);
+
+  /*!\brief Returns a zero initialized block of the default heap, aligned to kBlockAlignment. Mapped
+   * from huge pages if hugePages is set and the block is large enough. */
+  static uint8_t* allocate(size_t capacity, bool hugePages, Releaser& releaser);
+
+  void setAllocator(uhdr_alloc_fn_t alloc_fn, uhdr_free_fn_t free_fn, void* alloc_ctx);
+  void setPooling(bool enable);
+  void setHugePages(bool enable);
+  bool isActive() const { return mPooling || mHugePages || mAllocFn != nullptr; }
+
+  /*!\brief Releases all pooled blocks to their allocator. Blocks in use are not affected. */
+  void trim();
+
+  /*!\brief Arena bound to the calling thread, nullptr if none */
+  static MemoryArena* current();
+
+  /*!\brief Binds an arena to the calling thread for the lifetime of the object. Binding an
+   * inactive arena (or nullptr) leaves allocations on the default heap. */
+  class Scope {
+   public:
+    explicit Scope(MemoryArena* arena);
+    ~Scope();
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+   private:
+    MemoryArena* mPrev;
+  };
+
+ private:
+  struct PooledBlock {
+    uint8_t* ptr;
+    uhdr_free_fn_t free_fn;
+    void* alloc_ctx;
+    bool mapped;
+  };
+
+  void recycle(uint8_t* ptr, const Releaser& releaser);
+  static void release(uint8_t* ptr, const Releaser& releaser);
+
+  uhdr_alloc_fn_t mAllocFn = nullptr;
+  uhdr_free_fn_t mFreeFn = nullptr;
+  void* mAllocCtx = nullptr;
+  bool mPooling = false;
+  bool mHugePages = false;
+  std::multimap<size_t, PooledBlock> mFreeBlocks;  // keyed by capacity
+  std::mutex mMutex;
+};
+
+}  // namespace ultrahdr
+
+#endif  // ULTRAHDR_MEMORYARENA_H
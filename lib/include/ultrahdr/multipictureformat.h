@@ -72,6 +72,21 @@ size_t calculateMpfSize();
 std::shared_ptr<DataStruct> generateMpf(size_t primary_image_size, size_t primary_image_offset,
                                         size_t secondary_image_size, size_t secondary_image_offset);
 
+/*!\brief Reads the sizes and offsets of the first two images from the mp entries of a mpf block.
+ * As in generateMpf(), the offset of the secondary image is relative to the endianness field that
+ * follows the mpf signature.
+ *
+ * \param[in]   mpf                      mpf block, starting at the mpf signature
+ * \param[in]   mpf_size                 size of mpf block
+ * \param[out]  primary_image_size       size of primary image
+ * \param[out]  secondary_image_size     size of secondary image
+ * \param[out]  secondary_image_offset   offset of secondary image
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+ */
+uhdr_error_info_t parseMpf(const uint8_t* mpf, size_t mpf_size, size_t* primary_image_size,
+                           size_t* secondary_image_size, size_t* secondary_image_offset);
+
 }  // namespace ultrahdr
 
 #endif  // ULTRAHDR_MULTIPICTUREFORMAT_H
@@ -0,0 +1,228 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ULTRAHDR_THREADPOOL_H
+#define ULTRAHDR_THREADPOOL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ultrahdr_api.h"
+
+// WebAssembly builds without -pthread cannot start threads. The pool then runs all work on the
+// calling thread, see ThreadPool.
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define UHDR_NO_THREADS 1
+#endif
+
+namespace ultrahdr {
+
+/*
+ * Cancellation state of an encode or decode call, see uhdr_set_cancel_flag() and
+ * uhdr_set_deadline(). A call binds its token to the calling thread, parallel stages rebind it on
+ * their workers. JobQueue stops handing out rows and the jpeg helpers stop between scanlines once
+ * the token is cancelled, the stage then returns #UHDR_CODEC_CANCELLED.
+ */
+class CancelToken {
+ public:
+  /*!\brief Prepares the token for a call. The call is cancelled once *flag is non zero or once
+   * timeLimitMs milliseconds have passed. Either may be left out with nullptr or 0. */
+  void arm(const int* flag, unsigned int timeLimitMs);
+
+  /*!\brief Whether the call is cancelled. Once true, stays true until the next arm(). */
+  bool isCancelled() const;
+
+  /*!\brief Token bound to the calling thread, nullptr if none */
+  static CancelToken* current();
+
+  /*!\brief Whether the token bound to the calling thread is cancelled */
+  static bool cancelled() {
+    const CancelToken* token = current();
+    return token != nullptr && token->isCancelled();
+  }
+
+  /*!\brief #UHDR_CODEC_CANCELLED if the token bound to the calling thread is cancelled, no error
+   * otherwise */
+  static uhdr_error_info_t check();
+
+  /*!\brief Binds a token to the calling thread for the lifetime of the object */
+  class Scope {
+   public:
+    explicit Scope(CancelToken* token);
+    ~Scope();
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+   private:
+    CancelToken* mPrev;
+  };
+
+ private:
+  const int* mFlag = nullptr;
+  bool mHasDeadline = false;
+  std::chrono::steady_clock::time_point mDeadline;
+  mutable std::atomic<bool> mCancelled{false};
+};
+
+/*
+ * Core types and memory nodes of the cpu. On Linux and Android the cores this process may run on
+ * are ranked by the capacity the kernel exposes for its scheduler, or by their maximum frequency
+ * where that is missing. Cores of highest rank are the performance cores, cores of lowest rank the
+ * efficiency cores. Elsewhere, or when all cores rank alike, the cpu is reported as homogeneous.
+ * Likewise the cores are grouped by the NUMA node they belong to, on hosts of more than one node.
+ */
+class CpuTopology {
+ public:
+  /*!\brief Topology of the host, probed once */
+  static const CpuTopology& get();
+
+  /*!\brief Whether the cpu has cores of more than one type */
+  bool isHeterogeneous() const { return !mPerformanceCores.empty(); }
+
+  /*!\brief Cores of a type, empty for #UHDR_CORES_ANY or a homogeneous cpu */
+  const std::vector<int>& cores(uhdr_core_affinity_t affinity) const;
+
+  /*!\brief Cores of each NUMA node, empty on a host of a single node */
+  const std::vector<std::vector<int>>& numaNodes() const { return mNumaNodes; }
+
+ private:
+  CpuTopology();
+
+  std::vector<int> mPerformanceCores;
+  std::vector<int> mEfficiencyCores;
+  std::vector<std::vector<int>> mNumaNodes;
+};
+
+/*
+ * Restricts the calling thread to a set of cores for the lifetime of the object and restores its
+ * previous placement afterwards. Does nothing for an empty set, #UHDR_CORES_ANY or a homogeneous
+ * cpu. While pinned, the set is reported by current(), so that parallel stages started by the
+ * thread can place their jobs alike.
+ */
+class CoreAffinityScope {
+ public:
+  explicit CoreAffinityScope(uhdr_core_affinity_t affinity);
+  explicit CoreAffinityScope(const std::vector<int>& cores);
+  ~CoreAffinityScope();
+
+  CoreAffinityScope(const CoreAffinityScope&) = delete;
+  CoreAffinityScope& operator=(const CoreAffinityScope&) = delete;
+
+  /*!\brief Cores the calling thread is pinned to by a scope, nullptr if none */
+  static const std::vector<int>* current();
+
+ private:
+  bool mPinned = false;
+  std::vector<int> mCores;
+  std::vector<unsigned char> mPrevMask;  // cpu_set_t of the thread before pinning
+  const std::vector<int>* mPrevCores = nullptr;
+};
+
+/*
+ * Hands out contiguous row ranges of an image to worker threads. A range is claimed with a single
+ * atomic operation, no lock is taken. Chunks start large and shrink as the image drains (guided
+ * scheduling), so workers rarely meet on the counter early and still balance load at the tail.
+ * Every range other than the last is a multiple of rowAlignment rows. On a heterogeneous cpu the
+ * chunks are halved, so that a slow core that claims a range late does not finish long after the
+ * others. No range is handed out once the CancelToken bound to the calling thread is cancelled.
+ */
+class JobQueue {
+ public:
+  JobQueue(unsigned int numRows, unsigned int rowAlignment, unsigned int numWorkers);
+
+  bool dequeueJob(unsigned int& rowStart, unsigned int& rowEnd);
+  void reset();
+
+ private:
+  const unsigned int mNumRows;
+  const unsigned int mRowAlignment;
+  const unsigned int mNumWorkers;
+  const unsigned int mChunkDivisor;  // chunk is remaining rows / mChunkDivisor
+  std::atomic<unsigned int> mNextRow{0};
+};
+
+/*
+ * Persistent pool of worker threads. Worker threads are created on demand and are kept alive for
+ * the lifetime of the pool, so that the hot stages of encode/decode do not pay thread creation
+ * and teardown cost per image. In builds without threads (UHDR_NO_THREADS), run() executes the job
+ * once on the caller, which then drains the whole queue, and submit() and submitBlocking() run the
+ * task inline.
+ */
+class ThreadPool {
+ public:
+  ThreadPool() = default;
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  /*!\brief Runs job concurrently on (parallelism - 1) pool threads and on the calling thread.
+   * The call blocks until every instance of the job has returned. The job is expected to pull
+   * its work from a shared queue, so instances that start late simply find no work left. While
+   * waiting, the caller runs queued tasks itself, which makes it safe to call run() from a job.
+   *
+   * \param[in]  job          work to be executed
+   * \param[in]  parallelism  number of concurrent instances of job, including the caller
+   */
+  void run(const std::function<void()>& job, unsigned int parallelism);
+
+  /*!\brief Queues task to run on a pool thread and returns without waiting for it. Unlike the
+   * jobs of run(), such tasks are only picked by pool threads, never by a caller of run() waiting
+   * on its own jobs. Each task in flight is given a thread, up to one per core. The task must not
+   * wait on other threads for input, as later tasks may be queued behind it. Such tasks go through
+   * submitBlocking().
+   *
+   * \param[in]  task  work to be executed
+   */
+  void submit(std::function<void()> task);
+
+  /*!\brief Queues task like submit(), for a task that may block on input from other threads.
+   * Every such task in flight is given a thread of its own on top of the ones of submit(), so that
+   * tasks waiting on input never hold back the tasks of submit() or each other.
+   *
+   * \param[in]  task  work to be executed
+   */
+  void submitBlocking(std::function<void()> task);
+
+  /*!\brief Returns the library-owned pool shared by all encoder and decoder contexts. */
+  static ThreadPool& getDefaultPool();
+
+ private:
+  void ensureWorkers(size_t count);
+  size_t detachedWorkers() const;
+  void workerLoop();
+
+  bool mStop = false;
+  std::vector<std::thread> mWorkers;
+  std::deque<std::function<void()>> mTasks;
+  std::deque<std::function<void()>> mDetachedTasks;  // queued by submit()
+  size_t mDetachedCount = 0;                         // detached tasks queued or running
+  size_t mBlockingCount = 0;  // tasks of submitBlocking() queued or running
+  std::mutex mMutex;
+  std::condition_variable mCv;
+  std::condition_variable mDoneCv;
+};
+
+}  // namespace ultrahdr
+
+#endif  // ULTRAHDR_THREADPOOL_H
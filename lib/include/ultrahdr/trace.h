@@ -0,0 +1,63 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ULTRAHDR_TRACE_H
+#define ULTRAHDR_TRACE_H
+
+#include "ultrahdr_api.h"
+
+/*
+ * Named slices around the hot stages of the codec. A slice opens where UHDR_TRACE_SCOPE() is
+ * placed and closes at the end of the enclosing scope. Slices go to the callback registered with
+ * uhdr_set_trace_callback(), or on Android when none is registered, to ATrace. Without
+ * UHDR_ENABLE_TRACING the macro expands to nothing.
+ *
+ * name must be a string literal, begin and end events of a slice are reported on the same thread.
+ */
+#ifdef UHDR_ENABLE_TRACING
+
+namespace ultrahdr {
+
+void setTraceCallback(uhdr_trace_fn_t fn, void* ctx);
+void traceBegin(const char* name);
+void traceEnd(const char* name);
+
+class TraceScope {
+ public:
+  explicit TraceScope(const char* name) : mName(name) { traceBegin(name); }
+  ~TraceScope() { traceEnd(mName); }
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+ private:
+  const char* mName;
+};
+
+}  // namespace ultrahdr
+
+#define UHDR_TRACE_CONCAT_INNER(a, b) a##b
+#define UHDR_TRACE_CONCAT(a, b) UHDR_TRACE_CONCAT_INNER(a, b)
+#define UHDR_TRACE_SCOPE(name) \
+  ::ultrahdr::TraceScope UHDR_TRACE_CONCAT(uhdr_trace_scope_, __LINE__)(name)
+
+#else
+
+#define UHDR_TRACE_SCOPE(name)
+
+#endif
+
+#endif  // ULTRAHDR_TRACE_H
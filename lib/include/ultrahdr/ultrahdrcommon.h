@@ -24,13 +24,19 @@
 #include <GLES3/gl3.h>
 #endif
 
+#include <condition_variable>
 #include <deque>
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
 #include "ultrahdr_api.h"
+#include "ultrahdr/codecstats.h"
+#include "ultrahdr/memoryarena.h"
+#include "ultrahdr/threadpool.h"
 
 // ===============================================================================================
 // Function Macros
@@ -174,18 +180,47 @@ extern const int kMaxWidth, kMaxHeight;
 /**\brief uhdr memory block */
 typedef struct uhdr_memory_block {
   uhdr_memory_block(size_t capacity);
+  ~uhdr_memory_block();
 
-  std::unique_ptr<uint8_t[]> m_buffer; /**< data */
-  size_t m_capacity;                   /**< capacity */
-} uhdr_memory_block_t;                 /**< alias for struct uhdr_memory_block */
+  uhdr_memory_block(const uhdr_memory_block&) = delete;
+  uhdr_memory_block& operator=(const uhdr_memory_block&) = delete;
+
+  std::unique_ptr<uint8_t[], MemoryArena::Releaser> m_buffer; /**< data */
+  size_t m_capacity;                                          /**< capacity */
+  CodecStats* m_stats;                                        /**< accounted to, may be nullptr */
+} uhdr_memory_block_t; /**< alias for struct uhdr_memory_block */
 
 /**\brief extended raw image descriptor */
 typedef struct uhdr_raw_image_ext : uhdr_raw_image_t {
+  /*!\brief Allocates a w x h image. Strides are a multiple of align_stride_to pixels. For an
+   * align_stride_to above 1, the rows of every plane are further padded to a multiple of
+   * MemoryArena::kBlockAlignment bytes and start on such a boundary. Images read back from the
+   * gpu as a whole are allocated with 1, which keeps their rows packed. */
   uhdr_raw_image_ext(uhdr_img_fmt_t fmt, uhdr_color_gamut_t cg, uhdr_color_transfer_t ct,
                      uhdr_color_range_t range, unsigned w, unsigned h, unsigned align_stride_to);
 
+  /*!\brief Wraps the planes of an image that is owned by the caller. No memory is allocated, the
+   * planes must stay valid for the lifetime of this descriptor. */
+  explicit uhdr_raw_image_ext(const uhdr_raw_image_t& borrowed);
+
+  /*!\brief A w x h window of parent at (left, top). The planes point into the memory of parent,
+   * which is kept alive by the view, and keep its strides. Chroma planes of subsampled formats
+   * start at (left / 2, top / 2). */
+  uhdr_raw_image_ext(const uhdr_raw_image_ext& parent, unsigned left, unsigned top, unsigned w,
+                     unsigned h);
+
+  bool is_borrowed() const { return m_block == nullptr; }
+  bool is_view() const { return m_is_view; }
+  // bytes of the memory of the image, shared with its views, 0 if borrowed
+  size_t size_bytes() const { return m_block != nullptr ? m_block->m_capacity : 0; }
+
+  /*!\brief Detaches the memory from the arena and the stats of the context that allocated it, for
+   * an image that is to outlive the context. */
+  void detach();
+
  private:
-  std::unique_ptr<ultrahdr::uhdr_memory_block> m_block;
+  std::shared_ptr<ultrahdr::uhdr_memory_block> m_block;
+  bool m_is_view = false;
 } uhdr_raw_image_ext_t; /**< alias for struct uhdr_raw_image_ext */
 
 /**\brief extended compressed image descriptor */
@@ -193,6 +228,12 @@ typedef struct uhdr_compressed_image_ext : uhdr_compressed_image_t {
   uhdr_compressed_image_ext(uhdr_color_gamut_t cg, uhdr_color_transfer_t ct,
                             uhdr_color_range_t range, size_t sz);
 
+  /*!\brief Wraps a buffer that is owned by the caller. No memory is allocated, the data must stay
+   * valid for the lifetime of this descriptor. */
+  explicit uhdr_compressed_image_ext(const uhdr_compressed_image_t& borrowed);
+
+  bool is_borrowed() const { return m_block == nullptr; }
+
  private:
   std::unique_ptr<ultrahdr::uhdr_memory_block> m_block;
 } uhdr_compressed_image_ext_t; /**< alias for struct uhdr_compressed_image_ext */
@@ -229,6 +270,7 @@ typedef enum uhdr_effect_shader {
   UHDR_ROT_180,
   UHDR_ROT_270,
   UHDR_CROP,
+  UHDR_REMAP,
   UHDR_RESIZE,
 } uhdr_effect_shader_t;
 
@@ -237,25 +279,68 @@ typedef struct uhdr_opengl_ctxt {
   // EGL Context
   EGLDisplay mEGLDisplay; /**< EGL display connection */
   EGLContext mEGLContext; /**< EGL rendering context */
-  EGLSurface mEGLSurface; /**< EGL surface for rendering */
+  EGLSurface mEGLSurface; /**< EGL surface for rendering, none if surfaceless */
   EGLConfig mEGLConfig;   /**< EGL frame buffer configuration */
 
   // GLES Context
   GLuint mQuadVAO, mQuadVBO, mQuadEBO;           /**< GL objects */
   GLuint mShaderProgram[UHDR_RESIZE + 1];        /**< Shader programs */
   GLuint mDecodedImgTexture, mGainmapImgTexture; /**< GL Textures */
+  GLuint mUnpackBuffer;                          /**< Pixel buffer staging texture uploads */
+  GLuint mPackBuffer[2];                         /**< Pixel buffers receiving texture reads */
+  GLsync mPackFence[2];                          /**< Completion of the reads in flight */
+  size_t mPackSize[2];                           /**< Size of the reads in flight */
   uhdr_error_info_t mErrorStatus;                /**< Context status */
 
+  // Share group
+  bool mPooled;                                          /**< Context is in the library pool */
+  std::vector<std::pair<std::string, GLuint>> mPrograms; /**< Programs held, keyed by sources */
+
+  // Timing of the gpu phases of a call, see begin_gpu_phase()
+  CodecStats* mStats;     /**< Stats of the call, nullptr if none are collected */
+  int mTimerQuery;        /**< 1 if GL_EXT_disjoint_timer_query is usable, -1 if not probed */
+  int mGpuPhase;          /**< Phase being timed, -1 if none */
+  double mGpuPhaseStart;  /**< Cpu clock at the start of the phase, without timer queries */
+  std::vector<std::pair<int, GLuint>> mTimerQueries; /**< Queries of ended phases, not yet read */
+
+  // Context that was current on the thread before make_current()
+  EGLDisplay mPrevDisplay;
+  EGLContext mPrevContext;
+  EGLSurface mPrevDrawSurface, mPrevReadSurface;
+
   uhdr_opengl_ctxt();
   ~uhdr_opengl_ctxt();
 
   /*!\brief Initializes the OpenGL context. Mainly it prepares EGL. We want a GLES3.0 context and a
-   * surface that supports pbuffer. Once this is done and surface is made current, the gl state is
-   * initialized
+   * surface that supports pbuffer, or no surface at all if the display supports surfaceless
+   * contexts. Once this is done and the context is made current, the gl state is initialized.
+   * Hosts without a default display use the surfaceless platform of mesa, if available.
+   *
+   * By default the context joins a share group of the library, which holds the shader programs
+   * for all codec instances of the process. It is taken from a pool of idle contexts if there is
+   * one, and returned there by delete_opengl_ctxt().
+   *
+   * \param[in]   share_ctxt  context whose share group the new context joins instead,
+   *                          EGL_NO_CONTEXT for none. Textures of this context are then visible in
+   *                          share_ctxt. Such a context is neither pooled nor shares programs.
+   *
+   * \return none
+   */
+  void init_opengl_ctxt(EGLContext share_ctxt = EGL_NO_CONTEXT);
+
+  /*!\brief Makes the context current on the calling thread, remembering the context that was
+   * current before. Does nothing if the context is current already.
+   *
+   * \return true if the context is current, false otherwise.
+   */
+  bool make_current();
+
+  /*!\brief Restores the context that was current before make_current(), if this context is
+   * current on the calling thread
    *
    * \return none
    */
-  void init_opengl_ctxt();
+  void release_current();
 
   /*!\brief This method is used to compile a shader
    *
@@ -275,6 +360,18 @@ typedef struct uhdr_opengl_ctxt {
    */
   GLuint create_shader_program(const char* vertex_source, const char* fragment_source);
 
+  /*!\brief This method returns a shader program for the sources. The program is taken from the
+   * programs of the share group that no other context holds, else it is loaded from the program
+   * binary cache, see set_gl_program_cache_dir(), else it is compiled. The context holds the
+   * program until delete_opengl_ctxt(), the caller must not delete it.
+   *
+   * \param[in]   vertex_source      vertex shader source code
+   * \param[in]   fragment_source    fragment shader source code
+   *
+   * \return GLuint #shader_program_id if operation succeeds, 0 otherwise.
+   */
+  GLuint get_shader_program(const char* vertex_source, const char* fragment_source);
+
   /*!\brief This method is used to create a 2D texture for a raw image
    * NOTE: For multichannel planar image, this method assumes the channel data to be contiguous
    * NOTE: For any channel, this method assumes width and stride to be identical
@@ -288,6 +385,16 @@ typedef struct uhdr_opengl_ctxt {
    */
   GLuint create_texture(uhdr_img_fmt_t fmt, int w, int h, void* data);
 
+  /*!\brief This method is used to create a 2D texture for a raw image, as create_texture() above.
+   * The planes may have strides and need not be adjacent, they are packed into the pixel buffer
+   * that stages the upload instead of into an intermediate copy.
+   *
+   * \param[in]   img       raw image
+   *
+   * \return GLuint #texture_id if operation succeeds, 0 otherwise.
+   */
+  GLuint create_texture(uhdr_raw_image_t* img);
+
   /*!\breif This method is used to read data from texture into a raw image
    * NOTE: For any channel, this method assumes width and stride to be identical
    *
@@ -301,6 +408,53 @@ typedef struct uhdr_opengl_ctxt {
    */
   void read_texture(GLuint* texture, uhdr_img_fmt_t fmt, int w, int h, void* data);
 
+  /*!\brief This method starts reading data from texture into a pixel buffer and returns without
+   * waiting for the gpu. The read is completed by end_read_texture(), so that the transfers of
+   * both slots and any cpu work issued in between overlap.
+   * NOTE: For any channel, this method assumes width and stride to be identical
+   *
+   * \param[in]   texture    texture_id
+   * \param[in]   fmt        image format
+   * \param[in]   w          image width
+   * \param[in]   h          image height
+   * \param[in]   slot       pixel buffer to read into, 0 or 1
+   *
+   * \return none
+   */
+  void begin_read_texture(GLuint* texture, uhdr_img_fmt_t fmt, int w, int h, int slot);
+
+  /*!\brief This method waits for the read started by begin_read_texture() and copies the pixels
+   * into a raw image
+   *
+   * \param[in]   slot       pixel buffer passed to begin_read_texture()
+   * \param[in]   data       image data
+   *
+   * \return none
+   */
+  void end_read_texture(int slot, void* data);
+
+  /*!\brief Starts timing a phase of the gpu work of the call into mStats, see uhdr_gpu_stats.
+   * Phases do not nest, a phase in progress is ended first. Does nothing if mStats is nullptr.
+   *
+   * \param[in]   phase      phase
+   *
+   * \return none
+   */
+  void begin_gpu_phase(GpuPhase phase);
+
+  /*!\brief Ends the phase started by begin_gpu_phase(), if any
+   *
+   * \return none
+   */
+  void end_gpu_phase();
+
+  /*!\brief Adds the results of the timer queries of ended phases to mStats, waiting for the gpu
+   * to complete them. release_current() calls this.
+   *
+   * \return none
+   */
+  void collect_gpu_times();
+
   /*!\brief This method is used to set up quad buffers and arrays
    *
    * \return none
@@ -337,8 +491,47 @@ typedef struct uhdr_opengl_ctxt {
 
 } uhdr_opengl_ctxt_t; /**< alias for struct uhdr_opengl_ctxt */
 
+/*!\brief Sets the directory in which shader program binaries are stored, so that the programs
+ * of a later process are loaded instead of compiled. Binaries that the driver rejects are
+ * compiled afresh and rewritten.
+ *
+ * \param[in]   dir       directory path, nullptr or empty to disable the cache
+ *
+ * \return none
+ */
+void set_gl_program_cache_dir(const char* dir);
+
+/*!\brief Creates a context of the share group of the library and compiles the shader programs of
+ * gain map application for the common decodes. Both are then kept idle for codec instances.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, #UHDR_CODEC_ERROR otherwise.
+ */
+uhdr_error_info_t preload_gl_programs();
+
 bool isBufferDataContiguous(uhdr_raw_image_t* img);
 
+/*!\brief Copies the planes of a raw image with strides to or from a buffer, in which they are
+ * packed without strides in the layout of create_texture()
+ */
+void copyRawImagePlanes(uhdr_raw_image_t* img, uint8_t* buffer, bool to_buffer);
+
+#endif
+
+#ifdef UHDR_ENABLE_NVJPEG
+/*!\brief Creates a jpeg codec backend that runs on the current cuda device through nvJPEG, see
+ * uhdr_create_nvjpeg_backend()
+ *
+ * \return backend, nullptr if no device is present or its setup fails
+ */
+uhdr_jpeg_backend_t* create_nvjpeg_backend();
+
+/*!\brief Releases a backend of create_nvjpeg_backend() and its device resources
+ *
+ * \param[in]   backend   backend, may be nullptr
+ *
+ * \return none
+ */
+void release_nvjpeg_backend(uhdr_jpeg_backend_t* backend);
 #endif
 
 uhdr_error_info_t uhdr_validate_gainmap_metadata_descriptor(uhdr_gainmap_metadata_t* metadata);
@@ -349,14 +542,39 @@ uhdr_error_info_t uhdr_validate_gainmap_metadata_descriptor(uhdr_gainmap_metadat
 // Extensions of ultrahdr api definitions, so outside ultrahdr namespace
 // ===============================================================================================
 
+namespace ultrahdr {
+class DecoderCache;
+class JpegR;
+struct JpegRDecodeCache;
+struct JpegREncodeCache;
+struct JpegREncodeStream;
+struct input_stream;
+}
+
 struct uhdr_codec_private {
+  ultrahdr::MemoryArena m_arena;  // declared first, outlives the blocks held by this context
+  ultrahdr::CodecStats m_stats;   // likewise outlives the blocks accounted to it
+  bool m_stats_enabled = false;
   std::deque<ultrahdr::uhdr_effect_desc_t*> m_effects;
 #ifdef UHDR_ENABLE_GLES
   ultrahdr::uhdr_opengl_ctxt_t m_uhdr_gl_ctxt;
   bool m_enable_gles;
 #endif
+  uhdr_parallel_for_fn_t m_parallel_for;
+  void* m_parallel_for_ctx;
+  const int* m_cancel_flag;
+  unsigned int m_deadline_ms;
+  ultrahdr::CancelToken m_cancel;  // armed by each call from the two above
+  uhdr_jpeg_backend_t m_jpeg_backend{};  // persists across reset, all nullptr for libjpeg
+  uhdr_core_affinity_t m_core_affinity = UHDR_CORES_ANY;  // persists across reset
+  bool m_numa_placement = true;  // persists across reset, see uhdr_encode_batch()
   bool m_sailed;
 
+  // asynchronous encode/decode, see uhdr_encode_async()
+  std::mutex m_async_mutex;
+  std::condition_variable m_async_cv;
+  bool m_async_pending = false;
+
   virtual ~uhdr_codec_private();
 };
 
@@ -376,24 +594,110 @@ struct uhdr_encoder_private : uhdr_codec_private {
   float m_min_content_boost;
   float m_max_content_boost;
   float m_target_disp_max_brightness;
-
-  // internal data
+  int m_num_threads;
+  int m_gainmap_tile_size;
+  bool m_gainmap_boost_estimation;
+  bool m_auto_gainmap_scale_factor;
+  std::unique_ptr<ultrahdr::uhdr_compressed_image_ext_t> m_output_buffer;  // borrowed, caller owned
+  int m_output_fd;  // -1 if unset, see uhdr_enc_set_output_fd()
+  bool m_output_segments;  // see uhdr_enc_enable_output_segments()
+  // additional outputs of an encode, see uhdr_enc_add_quality_rung()
+  struct quality_rung {
+    int quality;
+    int gainmap_quality;
+    std::unique_ptr<ultrahdr::uhdr_compressed_image_ext_t> img;
+  };
+  std::vector<quality_rung> m_quality_rungs;
+  size_t m_target_size;  // 0 if unset, see uhdr_enc_set_target_size()
+  const ultrahdr::JpegREncodeCache* m_encode_cache;  // set while encoding in uhdr_encode_batch()
+  // encode of pushed rows, from uhdr_enc_start_stream() to uhdr_enc_finish_stream()
+  std::unique_ptr<ultrahdr::JpegR> m_stream_jpegr;
+  std::unique_ptr<ultrahdr::JpegREncodeStream> m_stream;
+
+  // internal data, output buffer keeps its capacity across reset
   std::unique_ptr<ultrahdr::uhdr_compressed_image_ext_t> m_compressed_output_buffer;
+  std::vector<uhdr_stream_segment_t> m_encoded_segments;  // spans of the stream after an encode
+  unsigned int m_hdr_intent_downscale;  // of the hdr intent to the sdr intent, after the effects
   uhdr_error_info_t m_encode_call_status;
 };
 
+// settings of a decoder captured by uhdr_create_decoder_profile(), never modified afterwards
+struct uhdr_decoder_profile {
+  uhdr_img_fmt_t m_output_fmt;
+  uhdr_color_transfer_t m_output_ct;
+  uhdr_color_gamut_t m_output_cg;
+  float m_output_max_disp_boost;
+  int m_num_threads;
+  bool m_apply_gainmap;
+  int m_gainmap_only_denom;
+  bool m_fast_idct;
+  bool m_fast_upsampling;
+  bool m_approximate_gainmap;
+  bool m_enable_gles;
+  bool m_gpu_output;
+  void* m_gpu_share_ctxt;
+  size_t m_memory_limit;
+  unsigned int m_deadline_ms;
+  uhdr_parallel_for_fn_t m_parallel_for;
+  void* m_parallel_for_ctx;
+};
+
+// handle of a decoder cache, see uhdr_create_decoder_cache()
+struct uhdr_decoder_cache {
+  std::shared_ptr<ultrahdr::DecoderCache> m_cache;
+};
+
 struct uhdr_decoder_private : uhdr_codec_private {
   // config data
   std::unique_ptr<ultrahdr::uhdr_compressed_image_ext_t> m_uhdr_compressed_img;
+  std::unique_ptr<ultrahdr::input_stream> m_input_stream;  // fed by uhdr_dec_push_data()
+  std::shared_ptr<void> m_input_mapping;  // backs m_uhdr_compressed_img after set_image_fd()
   uhdr_img_fmt_t m_output_fmt;
   uhdr_color_transfer_t m_output_ct;
+  uhdr_color_gamut_t m_output_cg;
   float m_output_max_disp_boost;
-
-  // internal data
+  int m_num_threads;
+  std::unique_ptr<ultrahdr::uhdr_raw_image_ext_t> m_output_buffer;  // borrowed, caller owned
+  uhdr_strip_fn_t m_strip_fn;
+  void* m_strip_ctx;
+  unsigned int m_strip_height;
+  uhdr_base_image_fn_t m_base_fn;
+  void* m_base_ctx;
+  bool m_apply_gainmap;
+  int m_gainmap_only_denom;  // 0 unless the gain map alone is decoded, see set_gainmap_only_decode
+  bool m_fast_idct;
+  bool m_fast_upsampling;
+  bool m_approximate_gainmap;
+  bool m_luminance_stats_enabled;
+  bool m_gpu_output;
+  void* m_gpu_share_ctxt;
+  size_t m_memory_limit;  // 0 if unset, see uhdr_dec_set_memory_limit()
+  // further outputs of uhdr_decode(), see uhdr_dec_add_rendition()
+  struct rendition_config {
+    uhdr_img_fmt_t fmt;
+    uhdr_color_transfer_t ct;
+    float display_boost;
+    std::unique_ptr<ultrahdr::uhdr_raw_image_ext_t> img;
+  };
+  std::vector<rendition_config> m_renditions;
+  // downscaled outputs of uhdr_decode(), see uhdr_dec_add_pyramid_level()
+  struct pyramid_level {
+    int w, h;
+    uhdr_resize_filter_t filter;
+    std::unique_ptr<ultrahdr::uhdr_raw_image_ext_t> img;
+  };
+  std::vector<pyramid_level> m_pyramid_levels;
+  std::unique_ptr<uhdr_decoder_profile> m_profile;  // restored by reset, see uhdr_dec_set_profile()
+  std::shared_ptr<ultrahdr::DecoderCache> m_cache;  // kept by reset, see uhdr_dec_set_cache()
+
+  // internal data, buffers and decode cache keep their capacity across reset
   bool m_probed;
+  bool m_cache_keyed;  // m_cache_hash holds the hash of the registered image
+  uint64_t m_cache_hash;
   std::unique_ptr<ultrahdr::uhdr_raw_image_ext_t> m_decoded_img_buffer;
   std::unique_ptr<ultrahdr::uhdr_raw_image_ext_t> m_gainmap_img_buffer;
-  int m_img_wd, m_img_ht;
+  std::unique_ptr<ultrahdr::JpegRDecodeCache> m_decode_cache;
+  int m_img_wd, m_img_ht, m_img_num_comp;
   int m_gainmap_wd, m_gainmap_ht, m_gainmap_num_comp;
   std::vector<uint8_t> m_exif;
   uhdr_mem_block_t m_exif_block;
@@ -404,8 +708,30 @@ struct uhdr_decoder_private : uhdr_codec_private {
   std::vector<uint8_t> m_gainmap_img;
   uhdr_mem_block_t m_gainmap_img_block;
   uhdr_gainmap_metadata_t m_metadata;
+  uhdr_decode_cost_t m_cost;
+  uhdr_luminance_stats_t m_luminance_stats;  // of the last decode, no pixels if none were gathered
   uhdr_error_info_t m_probe_call_status;
   uhdr_error_info_t m_decode_call_status;
+  bool m_output_on_gpu;  // decoded image left in the display texture, read back on first access
+#ifdef UHDR_ENABLE_GLES
+  bool m_use_gles;  // decode placed on the gpu, see acquire_gpu()
+#endif
+  std::unique_ptr<ultrahdr::uhdr_compressed_image_ext_t> m_transcoded_img;  // set by uhdr_transcode
+
+  // inputs of uhdr_dec_render_region() and uhdr_dec_rerender(), decoded on first use
+  std::unique_ptr<ultrahdr::uhdr_raw_image_ext_t> m_render_sdr_img;
+  std::unique_ptr<ultrahdr::uhdr_raw_image_ext_t> m_render_gainmap_img;
+  ultrahdr::uhdr_gainmap_metadata_ext_t m_render_metadata;
+  // regions rendered by uhdr_dec_render_region(), most recently used first
+  struct rendered_region {
+    int x, y, w, h;
+    float display_boost;
+    std::unique_ptr<ultrahdr::uhdr_raw_image_ext_t> img;  // rendition covering the region
+    uhdr_raw_image_t view;                                 // the region within img
+  };
+  std::list<rendered_region> m_rendered_regions;
+
+  ~uhdr_decoder_private();
 };
 
 #endif  // ULTRAHDR_ULTRAHDRCOMMON_H
@@ -0,0 +1,142 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "ultrahdr/codecstats.h"
+
+namespace ultrahdr {
+
+static thread_local CodecStats* t_current_stats = nullptr;
+
+void CodecStats::clear() {
+  std::unique_lock<std::mutex> lock{mMutex};
+  memset(&mStats, 0, sizeof mStats);
+  mValid = false;
+}
+
+void CodecStats::setNumThreads(unsigned int num_threads) {
+  std::unique_lock<std::mutex> lock{mMutex};
+  mStats.num_threads = num_threads;
+}
+
+void CodecStats::addStage(uhdr_codec_stage_t stage, double wall_ms, double cpu_ms) {
+  std::unique_lock<std::mutex> lock{mMutex};
+  mStats.stages[stage].wall_ms += wall_ms;
+  mStats.stages[stage].cpu_ms += cpu_ms;
+  mStats.stages[stage].calls++;
+}
+
+void CodecStats::onAllocate(size_t bytes) {
+  std::unique_lock<std::mutex> lock{mMutex};
+  mStats.bytes_allocated += bytes;
+  mStats.num_allocations++;
+  mLiveBytes += bytes;
+  // blocks of earlier calls released during this one can take the count below its start
+  int64_t held = (std::max)(int64_t(0), mLiveBytes - mLiveBase);
+  mStats.peak_bytes = (std::max)(mStats.peak_bytes, (size_t)held);
+}
+
+void CodecStats::onRelease(size_t bytes) {
+  std::unique_lock<std::mutex> lock{mMutex};
+  mLiveBytes -= bytes;
+}
+
+void CodecStats::addGpuTime(GpuPhase phase, double ms, bool timer_query) {
+  std::unique_lock<std::mutex> lock{mMutex};
+  uhdr_gpu_stats_t& gpu = mStats.gpu;
+  if (phase == kGpuUpload) {
+    gpu.upload_ms += ms;
+  } else if (phase == kGpuShader) {
+    gpu.shader_ms += ms;
+    gpu.passes++;
+  } else {
+    gpu.readback_ms += ms;
+  }
+  gpu.timer_queries = timer_query ? 1 : 0;
+}
+
+void CodecStats::countSlowPath(uhdr_slow_path_t path) {
+  std::unique_lock<std::mutex> lock{mMutex};
+  mStats.slow_paths[path]++;
+}
+
+double CodecStats::wallMs() {
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration<double, std::milli>(now).count();
+}
+
+double CodecStats::cpuMs() {
+#ifdef _WIN32
+  FILETIME creation, exit, kernel, user;
+  if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) return 0.0;
+  auto ticks = [](const FILETIME& t) {
+    return ((uint64_t)t.dwHighDateTime << 32) | t.dwLowDateTime;
+  };
+  return (ticks(kernel) + ticks(user)) / 1e4;  // 100 ns units
+#else
+  struct timespec ts;
+  if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0) return 0.0;
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+#endif
+}
+
+CodecStats* CodecStats::current() { return t_current_stats; }
+
+CodecStats::Scope::Scope(CodecStats* stats) : mStats(stats), mPrev(t_current_stats) {
+  t_current_stats = stats;
+  if (mStats == nullptr) return;
+  {
+    std::unique_lock<std::mutex> lock{mStats->mMutex};
+    memset(&mStats->mStats, 0, sizeof mStats->mStats);
+    mStats->mValid = true;
+    mStats->mLiveBase = mStats->mLiveBytes;
+  }
+  mWallStart = wallMs();
+  mCpuStart = cpuMs();
+}
+
+CodecStats::Scope::~Scope() {
+  t_current_stats = mPrev;
+  if (mStats == nullptr) return;
+  double wall_ms = wallMs() - mWallStart;
+  double cpu_ms = cpuMs() - mCpuStart;
+  std::unique_lock<std::mutex> lock{mStats->mMutex};
+  mStats->mStats.wall_ms = wall_ms;
+  mStats->mStats.cpu_ms = cpu_ms;
+}
+
+StageTimer::StageTimer(CodecStats* stats, uhdr_codec_stage_t stage)
+    : mStats(stats), mStage(stage) {
+  if (mStats == nullptr) return;
+  mWallStart = CodecStats::wallMs();
+  mCpuStart = CodecStats::cpuMs();
+}
+
+StageTimer::~StageTimer() {
+  if (mStats == nullptr) return;
+  mStats->addStage(mStage, CodecStats::wallMs() - mWallStart, CodecStats::cpuMs() - mCpuStart);
+}
+
+}  // namespace ultrahdr
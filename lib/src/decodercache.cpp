@@ -0,0 +1,160 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+
+#include "ultrahdr/decodercache.h"
+#include "ultrahdr/gainmapmath.h"
+
+namespace ultrahdr {
+
+// rounds of xxh64, the hash stays within the process so the native byte order is fine
+static const uint64_t kPrime1 = 0x9e3779b185ebca87ull;
+static const uint64_t kPrime2 = 0xc2b2ae3d27d4eb4full;
+static const uint64_t kPrime3 = 0x165667b19e3779f9ull;
+
+static inline uint64_t rotl64(uint64_t v, int r) { return (v << r) | (v >> (64 - r)); }
+
+static inline uint64_t load64(const uint8_t* p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof v);
+  return v;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t v) {
+  return rotl64(acc + v * kPrime2, 31) * kPrime1;
+}
+
+DecoderCache::Key DecoderCache::keyOf(const void* data, size_t size) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  const uint8_t* end = p + size;
+  uint64_t v1 = kPrime1 + kPrime2, v2 = kPrime2, v3 = 0, v4 = 0 - kPrime1;
+  // four independent lanes keep the multipliers busy
+  for (; end - p >= 32; p += 32) {
+    v1 = round64(v1, load64(p));
+    v2 = round64(v2, load64(p + 8));
+    v3 = round64(v3, load64(p + 16));
+    v4 = round64(v4, load64(p + 24));
+  }
+  uint64_t hash = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18) + size;
+  for (; end - p >= 8; p += 8) {
+    hash = rotl64(hash ^ round64(0, load64(p)), 27) * kPrime1 + kPrime3;
+  }
+  for (; p < end; p++) hash = rotl64(hash ^ (*p * kPrime1), 11) * kPrime2;
+  hash ^= hash >> 33;
+  hash *= kPrime2;
+  hash ^= hash >> 29;
+  hash *= kPrime3;
+  hash ^= hash >> 32;
+  return {hash, size, static_cast<const uint8_t*>(data)};
+}
+
+DecoderCache::DecoderCache(size_t capacity, bool keep_gainmaps)
+    : mCapacity(capacity), mKeepGainMaps(keep_gainmaps) {}
+
+DecoderCache::EntryList::iterator DecoderCache::touch(const Key& key, bool create) {
+  auto it = mIndex.find(key);
+  if (it != mIndex.end()) {
+    mEntries.splice(mEntries.begin(), mEntries, it->second);
+    return it->second;
+  }
+  if (!create) return mEntries.end();
+  // the entry keeps its own copy of the image, the bytes of the caller may go away
+  mEntries.emplace_front();
+  Entry& entry = mEntries.front();
+  entry.image.assign(key.data, key.data + key.size);
+  entry.key = {key.hash, key.size, entry.image.data()};
+  entry.bytes = sizeof(Entry) + key.size;
+  mBytes += entry.bytes;
+  mIndex[entry.key] = mEntries.begin();
+  return mEntries.begin();
+}
+
+void DecoderCache::evict() {
+  // the most recent entry stays even if it alone is over the capacity, it was just asked for
+  while (mBytes > mCapacity && mEntries.size() > 1) {
+    mBytes -= mEntries.back().bytes;
+    mIndex.erase(mEntries.back().key);
+    mEntries.pop_back();
+  }
+}
+
+bool DecoderCache::findProbeInfo(const Key& key, ProbeInfo& info) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  auto it = touch(key, false);
+  if (it == mEntries.end() || !it->has_probe_info) {
+    mStats.probe_misses++;
+    return false;
+  }
+  mStats.probe_hits++;
+  info = it->probe_info;
+  return true;
+}
+
+void DecoderCache::storeProbeInfo(const Key& key, const ProbeInfo& info) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  auto it = touch(key, true);
+  it->probe_info = info;
+  it->has_probe_info = true;
+  evict();
+}
+
+std::shared_ptr<const uhdr_raw_image_ext_t> DecoderCache::findGainMap(const Key& key,
+                                                                      int variant) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  auto it = touch(key, false);
+  if (it == mEntries.end() || it->gainmap == nullptr || it->gainmap_variant != variant) {
+    mStats.gainmap_misses++;
+    return nullptr;
+  }
+  mStats.gainmap_hits++;
+  return it->gainmap;
+}
+
+void DecoderCache::storeGainMap(const Key& key, int variant, const uhdr_raw_image_t* gainmap) {
+  if (!mKeepGainMaps) return;
+  std::shared_ptr<const uhdr_raw_image_ext_t> copy;
+  size_t bytes = 0;
+  {
+    // the copy outlives the decoder, its block must not come from the arena of the decoder nor
+    // be accounted to its stats
+    MemoryArena::Scope arena_scope(nullptr);
+    CodecStats::Scope stats_scope(nullptr);
+    copy = copy_raw_image(const_cast<uhdr_raw_image_t*>(gainmap));
+    if (copy == nullptr) return;
+    const size_t bpp = copy->fmt == UHDR_IMG_FMT_32bppRGBA8888  ? 4
+                       : copy->fmt == UHDR_IMG_FMT_24bppRGB888 ? 3
+                                                               : 1;
+    bytes = (size_t)copy->stride[UHDR_PLANE_PACKED] * copy->h * bpp;
+  }
+  std::lock_guard<std::mutex> lock(mMutex);
+  auto it = touch(key, true);
+  it->bytes = it->bytes - it->gainmap_bytes + bytes;
+  mBytes = mBytes - it->gainmap_bytes + bytes;
+  it->gainmap = std::move(copy);
+  it->gainmap_variant = variant;
+  it->gainmap_bytes = bytes;
+  evict();
+}
+
+void DecoderCache::getStats(uhdr_decoder_cache_stats_t* stats) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  *stats = mStats;
+  stats->entries = mEntries.size();
+  stats->bytes = mBytes;
+}
+
+}  // namespace ultrahdr
@@ -1053,6 +1053,37 @@ void rotate_buffer_clockwise_neon(T* src_buffer, T* dst_buffer, int src_w, int s
   }
 }
 
+// Kernels of the separable resize, see ResampleColumnsFn and ResampleRowRgbaFn
+int resampleColumns_neon(const float* const* rows, const float* weights, int taps, float* dst,
+                         int count) {
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    float32x4_t acc0 = vmulq_n_f32(vld1q_f32(rows[0] + i), weights[0]);
+    float32x4_t acc1 = vmulq_n_f32(vld1q_f32(rows[0] + i + 4), weights[0]);
+    for (int k = 1; k < taps; k++) {
+      acc0 = vmlaq_n_f32(acc0, vld1q_f32(rows[k] + i), weights[k]);
+      acc1 = vmlaq_n_f32(acc1, vld1q_f32(rows[k] + i + 4), weights[k]);
+    }
+    vst1q_f32(dst + i, acc0);
+    vst1q_f32(dst + i + 4, acc1);
+  }
+  return i;
+}
+
+int resampleRowRgba_neon(const float* src, const int* starts, const float* weights, int taps,
+                         float* dst, int count) {
+  for (int x = 0; x < count; x++) {
+    const float* s = src + (size_t)starts[x] * 4;
+    const float* w = weights + (size_t)x * taps;
+    float32x4_t acc = vmulq_n_f32(vld1q_f32(s), w[0]);
+    for (int k = 1; k < taps; k++) {
+      acc = vmlaq_n_f32(acc, vld1q_f32(s + 4 * k), w[k]);
+    }
+    vst1q_f32(dst + (size_t)x * 4, acc);
+  }
+  return count;
+}
+
 template void mirror_buffer_neon<uint8_t>(uint8_t*, uint8_t*, int, int, int, int,
                                           uhdr_mirror_direction_t);
 template void mirror_buffer_neon<uint16_t>(uint16_t*, uint16_t*, int, int, int, int,
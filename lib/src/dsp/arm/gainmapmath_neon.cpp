@@ -17,7 +17,10 @@
 #include "ultrahdr/gainmapmath.h"
 
 #include <arm_neon.h>
+#include <algorithm>
 #include <cassert>
+#include <cfloat>
+#include <cstring>
 
 #ifdef _MSC_VER
 #define ALIGNED(x) __declspec(align(x))
@@ -27,55 +30,6 @@
 
 namespace ultrahdr {
 
-// Scale all coefficients by 2^14 to avoid needing floating-point arithmetic. This can cause an off
-// by one error compared to the scalar floating-point implementation.
-
-// Removing conversion coefficients 1 and 0 from the group for each standard leaves 6 coefficients.
-// Pack them into a single 128-bit vector as follows, zeroing the remaining elements:
-// {Y1, Y2, U1, U2, V1, V2, 0, 0}
-
-// Yuv Bt709 -> Yuv Bt601
-// Y' = (1.0f * Y) + ( 0.101579f * U) + ( 0.196076f * V)
-// U' = (0.0f * Y) + ( 0.989854f * U) + (-0.110653f * V)
-// V' = (0.0f * Y) + (-0.072453f * U) + ( 0.983398f * V)
-ALIGNED(16)
-const int16_t kYuv709To601_coeffs_neon[8] = {1664, 3213, 16218, -1813, -1187, 16112, 0, 0};
-
-// Yuv Bt709 -> Yuv Bt2100
-// Y' = (1.0f * Y) + (-0.016969f * U) + ( 0.096312f * V)
-// U' = (0.0f * Y) + ( 0.995306f * U) + (-0.051192f * V)
-// V' = (0.0f * Y) + ( 0.011507f * U) + ( 1.002637f * V)
-ALIGNED(16)
-const int16_t kYuv709To2100_coeffs_neon[8] = {-278, 1578, 16307, -839, 189, 16427, 0, 0};
-
-// Yuv Bt601 -> Yuv Bt709
-// Y' = (1.0f * Y) + (-0.118188f * U) + (-0.212685f * V),
-// U' = (0.0f * Y) + ( 1.018640f * U) + ( 0.114618f * V),
-// V' = (0.0f * Y) + ( 0.075049f * U) + ( 1.025327f * V);
-ALIGNED(16)
-const int16_t kYuv601To709_coeffs_neon[8] = {-1936, -3485, 16689, 1878, 1230, 16799, 0, 0};
-
-// Yuv Bt601 -> Yuv Bt2100
-// Y' = (1.0f * Y) + (-0.128245f * U) + (-0.115879f * V)
-// U' = (0.0f * Y) + ( 1.010016f * U) + ( 0.061592f * V)
-// V' = (0.0f * Y) + ( 0.086969f * U) + ( 1.029350f * V)
-ALIGNED(16)
-const int16_t kYuv601To2100_coeffs_neon[8] = {-2101, -1899, 16548, 1009, 1425, 16865, 0, 0};
-
-// Yuv Bt2100 -> Yuv Bt709
-// Y' = (1.0f * Y) + ( 0.018149f * U) + (-0.095132f * V)
-// U' = (0.0f * Y) + ( 1.004123f * U) + ( 0.051267f * V)
-// V' = (0.0f * Y) + (-0.011524f * U) + ( 0.996782f * V)
-ALIGNED(16)
-const int16_t kYuv2100To709_coeffs_neon[8] = {297, -1559, 16452, 840, -189, 16331, 0, 0};
-
-// Yuv Bt2100 -> Yuv Bt601
-// Y' = (1.0f * Y) + ( 0.117887f * U) + ( 0.105521f * V)
-// U' = (0.0f * Y) + ( 0.995211f * U) + (-0.059549f * V)
-// V' = (0.0f * Y) + (-0.084085f * U) + ( 0.976518f * V)
-ALIGNED(16)
-const int16_t kYuv2100To601_coeffs_neon[8] = {1931, 1729, 16306, -976, -1378, 15999, 0, 0};
-
 static inline int16x8_t yConversion_neon(uint8x8_t y, int16x8_t u, int16x8_t v, int16x8_t coeffs) {
   int32x4_t lo = vmull_lane_s16(vget_low_s16(u), vget_low_s16(coeffs), 0);
   int32x4_t hi = vmull_lane_s16(vget_high_s16(u), vget_low_s16(coeffs), 0);
@@ -235,86 +189,8 @@ void transformYuv444_neon(uhdr_raw_image_t* image, const int16_t* coeffs_ptr) {
 
 uhdr_error_info_t convertYuv_neon(uhdr_raw_image_t* image, uhdr_color_gamut_t src_encoding,
                                   uhdr_color_gamut_t dst_encoding) {
-  uhdr_error_info_t status = g_no_error;
-  const int16_t* coeffs = nullptr;
-
-  switch (src_encoding) {
-    case UHDR_CG_BT_709:
-      switch (dst_encoding) {
-        case UHDR_CG_BT_709:
-          return status;
-        case UHDR_CG_DISPLAY_P3:
-          coeffs = kYuv709To601_coeffs_neon;
-          break;
-        case UHDR_CG_BT_2100:
-          coeffs = kYuv709To2100_coeffs_neon;
-          break;
-        default:
-          status.error_code = UHDR_CODEC_INVALID_PARAM;
-          status.has_detail = 1;
-          snprintf(status.detail, sizeof status.detail, "Unrecognized dest color gamut %d",
-                   dst_encoding);
-          return status;
-      }
-      break;
-    case UHDR_CG_DISPLAY_P3:
-      switch (dst_encoding) {
-        case UHDR_CG_BT_709:
-          coeffs = kYuv601To709_coeffs_neon;
-          break;
-        case UHDR_CG_DISPLAY_P3:
-          return status;
-        case UHDR_CG_BT_2100:
-          coeffs = kYuv601To2100_coeffs_neon;
-          break;
-        default:
-          status.error_code = UHDR_CODEC_INVALID_PARAM;
-          status.has_detail = 1;
-          snprintf(status.detail, sizeof status.detail, "Unrecognized dest color gamut %d",
-                   dst_encoding);
-          return status;
-      }
-      break;
-    case UHDR_CG_BT_2100:
-      switch (dst_encoding) {
-        case UHDR_CG_BT_709:
-          coeffs = kYuv2100To709_coeffs_neon;
-          break;
-        case UHDR_CG_DISPLAY_P3:
-          coeffs = kYuv2100To601_coeffs_neon;
-          break;
-        case UHDR_CG_BT_2100:
-          return status;
-        default:
-          status.error_code = UHDR_CODEC_INVALID_PARAM;
-          status.has_detail = 1;
-          snprintf(status.detail, sizeof status.detail, "Unrecognized dest color gamut %d",
-                   dst_encoding);
-          return status;
-      }
-      break;
-    default:
-      status.error_code = UHDR_CODEC_INVALID_PARAM;
-      status.has_detail = 1;
-      snprintf(status.detail, sizeof status.detail, "Unrecognized src color gamut %d",
-               src_encoding);
-      return status;
-  }
-
-  if (image->fmt == UHDR_IMG_FMT_12bppYCbCr420) {
-    transformYuv420_neon(image, coeffs);
-  } else if (image->fmt == UHDR_IMG_FMT_24bppYCbCr444) {
-    transformYuv444_neon(image, coeffs);
-  } else {
-    status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
-    status.has_detail = 1;
-    snprintf(status.detail, sizeof status.detail,
-             "No implementation available for performing gamut conversion for color format %d",
-             image->fmt);
-    return status;
-  }
-
-  return status;
+  return convertYuvQ14(image, src_encoding, dst_encoding, transformYuv420_neon,
+                       transformYuv444_neon);
 }
 
 // Scale all coefficients by 2^14 to avoid needing floating-point arithmetic. This can cause an off
@@ -454,26 +330,707 @@ static void ConvertRgba8888ToYuv444_neon(uhdr_raw_image_t* src, uhdr_raw_image_t
   } while (++h < src->h);
 }
 
-std::unique_ptr<uhdr_raw_image_ext_t> convert_raw_input_to_ycbcr_neon(uhdr_raw_image_t* src) {
-  if (src->fmt == UHDR_IMG_FMT_32bppRGBA8888) {
-    std::unique_ptr<uhdr_raw_image_ext_t> dst = nullptr;
-    const uint16_t* coeffs_ptr = nullptr;
+uhdr_error_info_t convert_raw_input_to_ycbcr_neon(uhdr_raw_image_t* src, uhdr_raw_image_t* dst) {
+  const uint16_t* coeffs_ptr = nullptr;
+  if (src->cg == UHDR_CG_BT_709) {
+    coeffs_ptr = kRgb709ToYuv_coeffs_neon;
+  } else if (src->cg == UHDR_CG_BT_2100) {
+    coeffs_ptr = kRgbDispP3ToYuv_coeffs_neon;
+  } else if (src->cg == UHDR_CG_DISPLAY_P3) {
+    coeffs_ptr = kRgb2100ToYuv_coeffs_neon;
+  }
+  if (src->fmt != UHDR_IMG_FMT_32bppRGBA8888 || dst->fmt != UHDR_IMG_FMT_24bppYCbCr444 ||
+      coeffs_ptr == nullptr) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "no neon conversion from fmt %d, gamut %d to fmt %d", src->fmt, src->cg, dst->fmt);
+    return status;
+  }
+  ConvertRgba8888ToYuv444_neon(src, dst, coeffs_ptr);
+  return g_no_error;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// applyGainMap row kernel
+
+// Rec.601 yuv <-> rgb coefficients, see p3YuvToRgb() and p3RgbToYuv()
+static const float kP3YR = 0.299f, kP3YG = 0.587f, kP3YB = 0.114f;
+static const float kP3Cb = 1.772f, kP3Cr = 1.402f;
+static const float kP3GCb = kP3YB * kP3Cb / kP3YG;
+static const float kP3GCr = kP3YR * kP3Cr / kP3YG;
+
+static inline float32x4_t div_neon(float32x4_t a, float32x4_t b) {
+#if defined(__aarch64__)
+  return vdivq_f32(a, b);
+#else
+  // two newton-raphson steps on the reciprocal estimate
+  float32x4_t r = vrecpeq_f32(b);
+  r = vmulq_f32(vrecpsq_f32(b, r), r);
+  r = vmulq_f32(vrecpsq_f32(b, r), r);
+  return vmulq_f32(a, r);
+#endif
+}
+
+static inline float32x4_t floor_neon(float32x4_t x) {
+  const float32x4_t t = vcvtq_f32_s32(vcvtq_s32_f32(x));
+  const uint32x4_t adjust = vcgtq_f32(t, x);
+  const uint32x4_t one = vreinterpretq_u32_f32(vdupq_n_f32(1.0f));
+  return vsubq_f32(t, vreinterpretq_f32_u32(vandq_u32(adjust, one)));
+}
+
+// Natural logarithm for x > 0, see Cephes logf(). Relative error is in the order of 1e-7.
+static inline float32x4_t log_neon(float32x4_t x) {
+  const float32x4_t one = vdupq_n_f32(1.0f);
+  const uint32x4_t bits = vreinterpretq_u32_f32(x);
+  float32x4_t e = vcvtq_f32_s32(
+      vsubq_s32(vreinterpretq_s32_u32(vshrq_n_u32(bits, 23)), vdupq_n_s32(127)));
+  float32x4_t m = vreinterpretq_f32_u32(
+      vorrq_u32(vandq_u32(bits, vdupq_n_u32(0x007fffff)), vdupq_n_u32(0x3f800000)));
+
+  // move the mantissa to [sqrt(0.5), sqrt(2))
+  const uint32x4_t big = vcgtq_f32(m, vdupq_n_f32(1.41421356f));
+  m = vbslq_f32(big, vmulq_f32(m, vdupq_n_f32(0.5f)), m);
+  e = vaddq_f32(e, vreinterpretq_f32_u32(vandq_u32(big, vreinterpretq_u32_f32(one))));
+
+  const float32x4_t t = vsubq_f32(m, one);
+  const float32x4_t z = vmulq_f32(t, t);
+  float32x4_t p = vdupq_n_f32(7.0376836292E-2f);
+  p = vaddq_f32(vmulq_f32(p, t), vdupq_n_f32(-1.1514610310E-1f));
+  p = vaddq_f32(vmulq_f32(p, t), vdupq_n_f32(1.1676998740E-1f));
+  p = vaddq_f32(vmulq_f32(p, t), vdupq_n_f32(-1.2420140846E-1f));
+  p = vaddq_f32(vmulq_f32(p, t), vdupq_n_f32(1.4249322787E-1f));
+  p = vaddq_f32(vmulq_f32(p, t), vdupq_n_f32(-1.6668057665E-1f));
+  p = vaddq_f32(vmulq_f32(p, t), vdupq_n_f32(2.0000714765E-1f));
+  p = vaddq_f32(vmulq_f32(p, t), vdupq_n_f32(-2.4999993993E-1f));
+  p = vaddq_f32(vmulq_f32(p, t), vdupq_n_f32(3.3333331174E-1f));
+  p = vmulq_f32(vmulq_f32(p, t), z);
+  p = vaddq_f32(p, vmulq_f32(e, vdupq_n_f32(-2.12194440e-4f)));
+  p = vsubq_f32(p, vmulq_f32(z, vdupq_n_f32(0.5f)));
+  return vaddq_f32(vaddq_f32(t, p), vmulq_f32(e, vdupq_n_f32(0.693359375f)));
+}
+
+// Natural exponent, see Cephes expf(). Inputs are clamped to the range of normal floats.
+static inline float32x4_t exp_neon(float32x4_t x) {
+  x = vminq_f32(vmaxq_f32(x, vdupq_n_f32(-87.3f)), vdupq_n_f32(88.3f));
+  const float32x4_t n = floor_neon(
+      vaddq_f32(vmulq_f32(x, vdupq_n_f32(1.44269504088896341f)), vdupq_n_f32(0.5f)));
+  x = vsubq_f32(x, vmulq_f32(n, vdupq_n_f32(0.693359375f)));
+  x = vsubq_f32(x, vmulq_f32(n, vdupq_n_f32(-2.12194440e-4f)));
+
+  const float32x4_t z = vmulq_f32(x, x);
+  float32x4_t p = vdupq_n_f32(1.9875691500E-4f);
+  p = vaddq_f32(vmulq_f32(p, x), vdupq_n_f32(1.3981999507E-3f));
+  p = vaddq_f32(vmulq_f32(p, x), vdupq_n_f32(8.3334519073E-3f));
+  p = vaddq_f32(vmulq_f32(p, x), vdupq_n_f32(4.1665795894E-2f));
+  p = vaddq_f32(vmulq_f32(p, x), vdupq_n_f32(1.6666665459E-1f));
+  p = vaddq_f32(vmulq_f32(p, x), vdupq_n_f32(5.0000001201E-1f));
+  p = vaddq_f32(vaddq_f32(vmulq_f32(p, z), x), vdupq_n_f32(1.0f));
+
+  const int32x4_t scale = vshlq_n_s32(vaddq_s32(vcvtq_s32_f32(n), vdupq_n_s32(127)), 23);
+  return vmulq_f32(p, vreinterpretq_f32_s32(scale));
+}
+
+// x^p for x > 0. Like std::pow() for a non-integer p, non-positive inputs do not produce a usable
+// result, they are mapped to 0 which is where the following table lookup clamps them anyway.
+static inline float32x4_t pow_neon(float32x4_t x, float p) {
+  const uint32x4_t positive = vcgtq_f32(x, vdupq_n_f32(0.0f));
+  x = vmaxq_f32(x, vdupq_n_f32(FLT_MIN));
+  const float32x4_t r = exp_neon(vmulq_f32(vdupq_n_f32(p), log_neon(x)));
+  return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(r), positive));
+}
+
+static inline float32x4_t gather_neon(const float* table, int32x4_t idx) {
+  float32x4_t r = vdupq_n_f32(table[vgetq_lane_s32(idx, 0)]);
+  r = vsetq_lane_f32(table[vgetq_lane_s32(idx, 1)], r, 1);
+  r = vsetq_lane_f32(table[vgetq_lane_s32(idx, 2)], r, 2);
+  r = vsetq_lane_f32(table[vgetq_lane_s32(idx, 3)], r, 3);
+  return r;
+}
+
+// Vector counterpart of the *LUT() transfer functions
+static inline float32x4_t lookup_neon(const float* table, int num_entries, float32x4_t e) {
+  int32x4_t idx = vcvtq_s32_f32(vaddq_f32(
+      vmulq_f32(e, vdupq_n_f32(static_cast<float>(num_entries - 1))), vdupq_n_f32(0.5f)));
+  idx = vminq_s32(vmaxq_s32(idx, vdupq_n_s32(0)), vdupq_n_s32(num_entries - 1));
+  return gather_neon(table, idx);
+}
+
+static inline float32x4_t clampPixelFloat_neon(float32x4_t e) {
+  return vminq_f32(vmaxq_f32(e, vdupq_n_f32(0.0f)), vdupq_n_f32(kMaxPixelFloat));
+}
+
+static inline float32x4_t loadMap_neon(const uint8_t* row, int32x4_t idx) {
+  uint32x4_t v = vdupq_n_u32(row[vgetq_lane_s32(idx, 0)]);
+  v = vsetq_lane_u32(row[vgetq_lane_s32(idx, 1)], v, 1);
+  v = vsetq_lane_u32(row[vgetq_lane_s32(idx, 2)], v, 2);
+  v = vsetq_lane_u32(row[vgetq_lane_s32(idx, 3)], v, 3);
+  return div_neon(vcvtq_f32_u32(v), vdupq_n_f32(255.0f));
+}
+
+// Vector counterpart of hdrCodeLUTIndex() and the code table lookup
+static inline uint32x4_t lookupCodes_neon(const uint16_t* table, float32x4_t e) {
+  int32x4_t idx = vsubq_s32(vshrq_n_s32(vreinterpretq_s32_f32(e), kHdrCodeLUTShift),
+                            vdupq_n_s32(kHdrCodeLUTBias));
+  idx = vminq_s32(vmaxq_s32(idx, vdupq_n_s32(0)), vdupq_n_s32(kHdrCodeLUTNumEntries - 1));
+  uint32x4_t v = vdupq_n_u32(table[vgetq_lane_s32(idx, 0)]);
+  v = vsetq_lane_u32(table[vgetq_lane_s32(idx, 1)], v, 1);
+  v = vsetq_lane_u32(table[vgetq_lane_s32(idx, 2)], v, 2);
+  v = vsetq_lane_u32(table[vgetq_lane_s32(idx, 3)], v, 3);
+  return v;
+}
+
+// See hlgLinearToRgba1010102() and pqLinearToRgba1010102()
+static inline uint32x4_t toRgba1010102_neon(const uint16_t* table, float32x4_t r, float32x4_t g,
+                                            float32x4_t b) {
+  uint32x4_t out =
+      vorrq_u32(lookupCodes_neon(table, r), vshlq_n_u32(lookupCodes_neon(table, g), 10));
+  out = vorrq_u32(out, vshlq_n_u32(lookupCodes_neon(table, b), 20));
+  return vorrq_u32(out, vdupq_n_u32(0xc0000000));  // alpha to 1.0
+}
+
+struct ApplyGainMapRowContext {
+  const uint8_t* map_top;
+  const uint8_t* map_bottom;
+  const float* weights;
+  int map_scale_factor;
+  const float* srgb_lut;
+  const uint16_t* code_lut;  // see getHlgCodeLUT() and getPqCodeLUT()
+  const float* gain_table;
+  float offset_sdr;
+  float offset_hdr;
+  uhdr_color_transfer_t output_ct;
+  const float* gamut_matrix;  // nullptr if the output stays in the base image gamut
+  uint8_t* dst;               // first pixel of the output row
+};
+
+static inline float32x4_t dot3_neon(const float* k, float32x4_t r, float32x4_t g,
+                                    float32x4_t b) {
+  return vmlaq_n_f32(vmlaq_n_f32(vmulq_n_f32(r, k[0]), g, k[1]), b, k[2]);
+}
+
+// Processes pixels [x, x + 4) of the row, starting from the normalized yuv samples
+static inline void applyGainMap4_neon(const ApplyGainMapRowContext& ctx, float32x4_t y_f,
+                                      float32x4_t u_f, float32x4_t v_f, size_t x) {
+  // yuv -> linear rgb
+  float32x4_t r = clampPixelFloat_neon(vaddq_f32(y_f, vmulq_f32(vdupq_n_f32(kP3Cr), v_f)));
+  float32x4_t g = clampPixelFloat_neon(
+      vsubq_f32(vsubq_f32(y_f, vmulq_f32(vdupq_n_f32(kP3GCb), u_f)),
+                vmulq_f32(vdupq_n_f32(kP3GCr), v_f)));
+  float32x4_t b = clampPixelFloat_neon(vaddq_f32(y_f, vmulq_f32(vdupq_n_f32(kP3Cb), u_f)));
+  r = lookup_neon(ctx.srgb_lut, kSrgbInvOETFNumEntries, r);
+  g = lookup_neon(ctx.srgb_lut, kSrgbInvOETFNumEntries, g);
+  b = lookup_neon(ctx.srgb_lut, kSrgbInvOETFNumEntries, b);
+
+  // sample gain map, see sampleMap() with ShepardsIDW
+  static const int32_t kLanes[4] = {0, 1, 2, 3};
+  const int32x4_t xs = vaddq_s32(vdupq_n_s32(static_cast<int32_t>(x)), vld1q_s32(kLanes));
+  const int32x4_t x_lower = vcvtq_s32_f32(
+      div_neon(vaddq_f32(vcvtq_f32_s32(xs), vdupq_n_f32(0.5f)),
+               vdupq_n_f32(static_cast<float>(ctx.map_scale_factor))));
+  const int32x4_t x_upper = vaddq_s32(x_lower, vdupq_n_s32(1));
+  const int32x4_t w_idx =
+      vshlq_n_s32(vsubq_s32(xs, vmulq_s32(x_lower, vdupq_n_s32(ctx.map_scale_factor))), 2);
+  const float32x4_t e1 = loadMap_neon(ctx.map_top, x_lower);
+  const float32x4_t e2 = loadMap_neon(ctx.map_bottom, x_lower);
+  const float32x4_t e3 = loadMap_neon(ctx.map_top, x_upper);
+  const float32x4_t e4 = loadMap_neon(ctx.map_bottom, x_upper);
+  float32x4_t gain = vmulq_f32(e1, gather_neon(ctx.weights, w_idx));
+  gain = vaddq_f32(gain, vmulq_f32(e2, gather_neon(ctx.weights + 1, w_idx)));
+  gain = vaddq_f32(gain, vmulq_f32(e3, gather_neon(ctx.weights + 2, w_idx)));
+  gain = vaddq_f32(gain, vmulq_f32(e4, gather_neon(ctx.weights + 3, w_idx)));
+
+  // apply gain, see applyGainLUT()
+  const float32x4_t gain_factor = lookup_neon(ctx.gain_table, kGainFactorNumEntries, gain);
+  const float32x4_t offset_sdr = vdupq_n_f32(ctx.offset_sdr);
+  const float32x4_t offset_hdr = vdupq_n_f32(ctx.offset_hdr);
+  r = vsubq_f32(vmulq_f32(vaddq_f32(r, offset_sdr), gain_factor), offset_hdr);
+  g = vsubq_f32(vmulq_f32(vaddq_f32(g, offset_sdr), gain_factor), offset_hdr);
+  b = vsubq_f32(vmulq_f32(vaddq_f32(b, offset_sdr), gain_factor), offset_hdr);
+  if (ctx.gamut_matrix != nullptr) {
+    // output gamut, see getGamutConversionMatrix()
+    const float32x4_t r_out = dot3_neon(ctx.gamut_matrix, r, g, b);
+    const float32x4_t g_out = dot3_neon(ctx.gamut_matrix + 3, r, g, b);
+    b = dot3_neon(ctx.gamut_matrix + 6, r, g, b);
+    r = r_out;
+    g = g_out;
+    // colors outside of the output gamut map to code 0 in the hlg and pq tables
+  }
+
+  if (ctx.output_ct == UHDR_CT_LINEAR) {
+    uint64_t* out = reinterpret_cast<uint64_t*>(ctx.dst) + x;
+#if defined(__aarch64__)
+    uint16x4x4_t rgba;
+    rgba.val[0] = vreinterpret_u16_f16(vcvt_f16_f32(r));
+    rgba.val[1] = vreinterpret_u16_f16(vcvt_f16_f32(g));
+    rgba.val[2] = vreinterpret_u16_f16(vcvt_f16_f32(b));
+    rgba.val[3] = vdup_n_u16(0x3c00);  // 1.0f
+    vst4_u16(reinterpret_cast<uint16_t*>(out), rgba);
+#else
+    // half float conversion is optional on armv7, convert with the scalar helper
+    float rgb[3][4];
+    vst1q_f32(rgb[0], r);
+    vst1q_f32(rgb[1], g);
+    vst1q_f32(rgb[2], b);
+    for (int i = 0; i < 4; i++) {
+      out[i] = colorToRgbaF16({{{rgb[0][i], rgb[1][i], rgb[2][i]}}});
+    }
+#endif
+  } else {
+    // scaling, inverse ootf, oetf and quantization in one lookup per component
+    vst1q_u32(reinterpret_cast<uint32_t*>(ctx.dst) + x, toRgba1010102_neon(ctx.code_lut, r, g, b));
+  }
+}
+
+size_t applyGainMapRowYuv420_neon(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* gainmap_img,
+                                  uhdr_raw_image_t* dest, size_t map_scale_factor,
+                                  ShepardsIDW& idwTable, GainLUT& gainLUT,
+                                  uhdr_gainmap_metadata_ext_t* metadata,
+                                  uhdr_color_transfer_t output_ct, const float* gamut_matrix,
+                                  size_t y) {
+  if (output_ct != UHDR_CT_LINEAR && output_ct != UHDR_CT_HLG && output_ct != UHDR_CT_PQ) return 0;
+
+  // pixels whose gain map neighbourhood is clamped at the right edge are left to the caller
+  const size_t map_w = gainmap_img->w;
+  if (map_w < 2) return 0;
+  const size_t width =
+      (std::min)(static_cast<size_t>(sdr_intent->w), (map_w - 1) * map_scale_factor);
+  const size_t vec_width = width & ~static_cast<size_t>(7);
+  if (vec_width == 0) return 0;
+
+  const uint8_t* y_row = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_Y]) +
+                         y * sdr_intent->stride[UHDR_PLANE_Y];
+  const uint8_t* u_row = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_U]) +
+                         (y / 2) * sdr_intent->stride[UHDR_PLANE_U];
+  const uint8_t* v_row = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_V]) +
+                         (y / 2) * sdr_intent->stride[UHDR_PLANE_V];
+
+  const size_t y_lower = (std::min)(y / map_scale_factor, static_cast<size_t>(gainmap_img->h) - 1);
+  const size_t y_upper =
+      (std::min)(y / map_scale_factor + 1, static_cast<size_t>(gainmap_img->h) - 1);
+  const uint8_t* map_data = static_cast<uint8_t*>(gainmap_img->planes[UHDR_PLANE_Y]);
+  const size_t map_stride = gainmap_img->stride[UHDR_PLANE_Y];
+
+  ApplyGainMapRowContext ctx;
+  ctx.map_top = map_data + y_lower * map_stride;
+  ctx.map_bottom = map_data + y_upper * map_stride;
+  ctx.weights = ((y_lower == y_upper) ? idwTable.mWeightsNB : idwTable.mWeights) +
+                (y % map_scale_factor) * map_scale_factor * 4;
+  ctx.map_scale_factor = static_cast<int>(map_scale_factor);
+  ctx.srgb_lut = getSrgbInvOetfLUT();
+  ctx.code_lut = output_ct == UHDR_CT_HLG  ? getHlgCodeLUT()
+                 : output_ct == UHDR_CT_PQ ? getPqCodeLUT()
+                                           : nullptr;
+  ctx.gain_table = gainLUT.getGainTable();
+  ctx.offset_sdr = metadata->offset_sdr;
+  ctx.offset_hdr = metadata->offset_hdr;
+  ctx.output_ct = output_ct;
+  ctx.gamut_matrix = gamut_matrix;
+  ctx.dst = static_cast<uint8_t*>(dest->planes[UHDR_PLANE_PACKED]) +
+            y * dest->stride[UHDR_PLANE_PACKED] * (output_ct == UHDR_CT_LINEAR ? 8 : 4);
+
+  const float32x4_t inv_255 = vdupq_n_f32(1 / 255.0f);
+  for (size_t x = 0; x < vec_width; x += 8) {
+    const uint16x8_t luma = vmovl_u8(vld1_u8(y_row + x));
+
+    // each chroma sample covers two horizontally adjacent luma samples
+    uint32_t cb, cr;
+    memcpy(&cb, u_row + x / 2, sizeof cb);
+    memcpy(&cr, v_row + x / 2, sizeof cr);
+    const uint8x8_t cb8 = vreinterpret_u8_u32(vdup_n_u32(cb));
+    const uint8x8_t cr8 = vreinterpret_u8_u32(vdup_n_u32(cr));
+    const int16x8_t u = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vzip_u8(cb8, cb8).val[0])),
+                                  vdupq_n_s16(128));
+    const int16x8_t v = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vzip_u8(cr8, cr8).val[0])),
+                                  vdupq_n_s16(128));
+
+    applyGainMap4_neon(ctx, vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(luma))), inv_255),
+                       vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(u))), inv_255),
+                       vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), inv_255), x);
+    applyGainMap4_neon(ctx, vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(luma))), inv_255),
+                       vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(u))), inv_255),
+                       vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), inv_255), x + 4);
+  }
+
+  return vec_width;
+}
+
+#if defined(__aarch64__) && defined(UHDR_ENABLE_NEON_FP16)
+// Linear base image samples and gain factors of pixels [x, x + 4) of the row, the part of
+// applyGainMap4_neon() ahead of the gain application
+static inline void sdrAndGain4_neon_fp16(const ApplyGainMapRowContext& ctx, float32x4_t y_f,
+                                         float32x4_t u_f, float32x4_t v_f, size_t x, float* r_dst,
+                                         float* g_dst, float* b_dst, float* gain_dst) {
+  // yuv -> linear rgb
+  float32x4_t r = clampPixelFloat_neon(vaddq_f32(y_f, vmulq_f32(vdupq_n_f32(kP3Cr), v_f)));
+  float32x4_t g = clampPixelFloat_neon(
+      vsubq_f32(vsubq_f32(y_f, vmulq_f32(vdupq_n_f32(kP3GCb), u_f)),
+                vmulq_f32(vdupq_n_f32(kP3GCr), v_f)));
+  float32x4_t b = clampPixelFloat_neon(vaddq_f32(y_f, vmulq_f32(vdupq_n_f32(kP3Cb), u_f)));
+  vst1q_f32(r_dst, lookup_neon(ctx.srgb_lut, kSrgbInvOETFNumEntries, r));
+  vst1q_f32(g_dst, lookup_neon(ctx.srgb_lut, kSrgbInvOETFNumEntries, g));
+  vst1q_f32(b_dst, lookup_neon(ctx.srgb_lut, kSrgbInvOETFNumEntries, b));
+
+  // sample gain map, see sampleMap() with ShepardsIDW
+  static const int32_t kLanes[4] = {0, 1, 2, 3};
+  const int32x4_t xs = vaddq_s32(vdupq_n_s32(static_cast<int32_t>(x)), vld1q_s32(kLanes));
+  const int32x4_t x_lower = vcvtq_s32_f32(
+      div_neon(vaddq_f32(vcvtq_f32_s32(xs), vdupq_n_f32(0.5f)),
+               vdupq_n_f32(static_cast<float>(ctx.map_scale_factor))));
+  const int32x4_t x_upper = vaddq_s32(x_lower, vdupq_n_s32(1));
+  const int32x4_t w_idx =
+      vshlq_n_s32(vsubq_s32(xs, vmulq_s32(x_lower, vdupq_n_s32(ctx.map_scale_factor))), 2);
+  float32x4_t gain = vmulq_f32(loadMap_neon(ctx.map_top, x_lower), gather_neon(ctx.weights, w_idx));
+  gain = vaddq_f32(gain, vmulq_f32(loadMap_neon(ctx.map_bottom, x_lower),
+                                   gather_neon(ctx.weights + 1, w_idx)));
+  gain = vaddq_f32(gain, vmulq_f32(loadMap_neon(ctx.map_top, x_upper),
+                                   gather_neon(ctx.weights + 2, w_idx)));
+  gain = vaddq_f32(gain, vmulq_f32(loadMap_neon(ctx.map_bottom, x_upper),
+                                   gather_neon(ctx.weights + 3, w_idx)));
+  vst1q_f32(gain_dst, lookup_neon(ctx.gain_table, kGainFactorNumEntries, gain));
+}
+
+// Linear output of applyGainMapRowYuv420_neon() with the gain applied in fp16. The lookups stay
+// in fp32, their indices need more precision than an fp16 mantissa has.
+size_t applyGainMapRowYuv420_neon_fp16(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* gainmap_img,
+                                       uhdr_raw_image_t* dest, size_t map_scale_factor,
+                                       ShepardsIDW& idwTable, GainLUT& gainLUT,
+                                       uhdr_gainmap_metadata_ext_t* metadata,
+                                       uhdr_color_transfer_t output_ct, const float* gamut_matrix,
+                                       size_t y) {
+  if (output_ct != UHDR_CT_LINEAR) {
+    return applyGainMapRowYuv420_neon(sdr_intent, gainmap_img, dest, map_scale_factor, idwTable,
+                                      gainLUT, metadata, output_ct, gamut_matrix, y);
+  }
+
+  // same coverage as applyGainMapRowYuv420_neon()
+  const size_t map_w = gainmap_img->w;
+  if (map_w < 2) return 0;
+  const size_t width =
+      (std::min)(static_cast<size_t>(sdr_intent->w), (map_w - 1) * map_scale_factor);
+  const size_t vec_width = width & ~static_cast<size_t>(7);
+  if (vec_width == 0) return 0;
+
+  const uint8_t* y_row = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_Y]) +
+                         y * sdr_intent->stride[UHDR_PLANE_Y];
+  const uint8_t* u_row = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_U]) +
+                         (y / 2) * sdr_intent->stride[UHDR_PLANE_U];
+  const uint8_t* v_row = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_V]) +
+                         (y / 2) * sdr_intent->stride[UHDR_PLANE_V];
+
+  const size_t y_lower = (std::min)(y / map_scale_factor, static_cast<size_t>(gainmap_img->h) - 1);
+  const size_t y_upper =
+      (std::min)(y / map_scale_factor + 1, static_cast<size_t>(gainmap_img->h) - 1);
+  const uint8_t* map_data = static_cast<uint8_t*>(gainmap_img->planes[UHDR_PLANE_Y]);
+  const size_t map_stride = gainmap_img->stride[UHDR_PLANE_Y];
+
+  ApplyGainMapRowContext ctx;
+  ctx.map_top = map_data + y_lower * map_stride;
+  ctx.map_bottom = map_data + y_upper * map_stride;
+  ctx.weights = ((y_lower == y_upper) ? idwTable.mWeightsNB : idwTable.mWeights) +
+                (y % map_scale_factor) * map_scale_factor * 4;
+  ctx.map_scale_factor = static_cast<int>(map_scale_factor);
+  ctx.srgb_lut = getSrgbInvOetfLUT();
+  ctx.code_lut = nullptr;
+  ctx.gain_table = gainLUT.getGainTable();
+  ctx.offset_sdr = metadata->offset_sdr;
+  ctx.offset_hdr = metadata->offset_hdr;
+  ctx.output_ct = output_ct;
+  ctx.gamut_matrix = gamut_matrix;
+  ctx.dst = static_cast<uint8_t*>(dest->planes[UHDR_PLANE_PACKED]) +
+            y * dest->stride[UHDR_PLANE_PACKED] * 8;
+
+  // the lookups of a block of pixels are staged at single precision, the block stays in l1
+  static const size_t kBlockWidth = 64;
+  alignas(16) float block[4][kBlockWidth];
+  const float32x4_t inv_255 = vdupq_n_f32(1 / 255.0f);
+  for (size_t x0 = 0; x0 < vec_width; x0 += kBlockWidth) {
+    const size_t count = (std::min)(kBlockWidth, vec_width - x0);
+    for (size_t i = 0; i < count; i += 8) {
+      const size_t x = x0 + i;
+      const uint16x8_t luma = vmovl_u8(vld1_u8(y_row + x));
+
+      // each chroma sample covers two horizontally adjacent luma samples
+      uint32_t cb, cr;
+      memcpy(&cb, u_row + x / 2, sizeof cb);
+      memcpy(&cr, v_row + x / 2, sizeof cr);
+      const uint8x8_t cb8 = vreinterpret_u8_u32(vdup_n_u32(cb));
+      const uint8x8_t cr8 = vreinterpret_u8_u32(vdup_n_u32(cr));
+      const int16x8_t u = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vzip_u8(cb8, cb8).val[0])),
+                                    vdupq_n_s16(128));
+      const int16x8_t v = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vzip_u8(cr8, cr8).val[0])),
+                                    vdupq_n_s16(128));
+
+      sdrAndGain4_neon_fp16(ctx, vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(luma))), inv_255),
+                            vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(u))), inv_255),
+                            vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), inv_255), x,
+                            block[0] + i, block[1] + i, block[2] + i, block[3] + i);
+      sdrAndGain4_neon_fp16(ctx, vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(luma))), inv_255),
+                            vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(u))), inv_255),
+                            vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), inv_255),
+                            x + 4, block[0] + i + 4, block[1] + i + 4, block[2] + i + 4,
+                            block[3] + i + 4);
+    }
+    applyGainRowF16_neon_fp16(block[0], block[1], block[2], block[3], count, ctx.offset_sdr,
+                              ctx.offset_hdr, ctx.gamut_matrix,
+                              reinterpret_cast<uint64_t*>(ctx.dst) + x0);
+  }
+
+  return vec_width;
+}
+#endif
+////////////////////////////////////////////////////////////////////////////////
+// generateGainMap row kernel
+
+// See computeGain()
+static inline float32x4_t computeGain_neon(float32x4_t sdr, float32x4_t hdr) {
+  const float32x4_t ratio = div_neon(vaddq_f32(hdr, vdupq_n_f32(kHdrOffset)),
+                                     vaddq_f32(sdr, vdupq_n_f32(kSdrOffset)));
+  const float32x4_t gain = vmulq_f32(log_neon(ratio), vdupq_n_f32(1.44269504088896341f));
+  const uint32x4_t dark = vcltq_f32(sdr, vdupq_n_f32(2.f / 255.0f));
+  return vbslq_f32(dark, vminq_f32(gain, vdupq_n_f32(2.3f)), gain);
+}
+
+static inline void yuvToRgb_neon(const float coeffs[4], float32x4_t y_f, float32x4_t u_f,
+                                 float32x4_t v_f, float32x4_t& r, float32x4_t& g,
+                                 float32x4_t& b) {
+  r = clampPixelFloat_neon(vmlaq_n_f32(y_f, v_f, coeffs[0]));
+  g = clampPixelFloat_neon(vmlsq_n_f32(vmlsq_n_f32(y_f, u_f, coeffs[1]), v_f, coeffs[2]));
+  b = clampPixelFloat_neon(vmlaq_n_f32(y_f, u_f, coeffs[3]));
+}
+
+size_t generateGainMapRow_neon(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* hdr_intent,
+                               const GainMapRowParams& params, size_t map_scale_factor,
+                               size_t map_width, size_t y, float* gains) {
+  const size_t vec_width = map_width & ~static_cast<size_t>(3);
+  float sdr_yuv[3][kGainMapRowChunk];
+  float hdr_yuv[3][kGainMapRowChunk];
+  float* sdr_planes[3] = {sdr_yuv[0], sdr_yuv[1], sdr_yuv[2]};
+  float* hdr_planes[3] = {hdr_yuv[0], hdr_yuv[1], hdr_yuv[2]};
+  const float* srgb_lut = getSrgbInvOetfLUT();
+  const float* m = params.hdr_gamut_matrix.data();
+  const float32x4_t zero = vdupq_n_f32(0.0f);
+
+  for (size_t x = 0; x < vec_width; x += 4) {
+    const size_t chunk_x = x % kGainMapRowChunk;
+    if (chunk_x == 0) {
+      const size_t len = (std::min)(kGainMapRowChunk, vec_width - x);
+      sampleYuv420Row(sdr_intent, map_scale_factor, x, y, len, sdr_planes);
+      sampleP010Row(hdr_intent, map_scale_factor, x, y, len, hdr_planes);
+    }
+
+    // sdr yuv -> linear rgb
+    float32x4_t sr, sg, sb;
+    yuvToRgb_neon(params.sdr_yuv_to_rgb, vld1q_f32(sdr_yuv[0] + chunk_x),
+                  vld1q_f32(sdr_yuv[1] + chunk_x), vld1q_f32(sdr_yuv[2] + chunk_x), sr, sg, sb);
+    sr = lookup_neon(srgb_lut, kSrgbInvOETFNumEntries, sr);
+    sg = lookup_neon(srgb_lut, kSrgbInvOETFNumEntries, sg);
+    sb = lookup_neon(srgb_lut, kSrgbInvOETFNumEntries, sb);
+
+    // hdr yuv -> linear rgb in sdr gamut
+    float32x4_t hr, hg, hb;
+    yuvToRgb_neon(params.hdr_yuv_to_rgb, vld1q_f32(hdr_yuv[0] + chunk_x),
+                  vld1q_f32(hdr_yuv[1] + chunk_x), vld1q_f32(hdr_yuv[2] + chunk_x), hr, hg, hb);
+    hr = lookup_neon(params.hdr_inv_oetf_lut, params.hdr_inv_oetf_entries, hr);
+    hg = lookup_neon(params.hdr_inv_oetf_lut, params.hdr_inv_oetf_entries, hg);
+    hb = lookup_neon(params.hdr_inv_oetf_lut, params.hdr_inv_oetf_entries, hb);
+    if (params.hdr_ootf_gamma != 1.0f) {
+      hr = pow_neon(hr, params.hdr_ootf_gamma);
+      hg = pow_neon(hg, params.hdr_ootf_gamma);
+      hb = pow_neon(hb, params.hdr_ootf_gamma);
+    }
+    const float32x4_t cr = dot3_neon(m, hr, hg, hb);
+    const float32x4_t cg = dot3_neon(m + 3, hr, hg, hb);
+    const float32x4_t cb = dot3_neon(m + 6, hr, hg, hb);
+    hr = vmaxq_f32(cr, zero);
+    hg = vmaxq_f32(cg, zero);
+    hb = vmaxq_f32(cb, zero);
 
-    if (src->cg == UHDR_CG_BT_709) {
-      coeffs_ptr = kRgb709ToYuv_coeffs_neon;
-    } else if (src->cg == UHDR_CG_BT_2100) {
-      coeffs_ptr = kRgbDispP3ToYuv_coeffs_neon;
-    } else if (src->cg == UHDR_CG_DISPLAY_P3) {
-      coeffs_ptr = kRgb2100ToYuv_coeffs_neon;
+    if (params.multichannel) {
+      float32x4x3_t out;
+      out.val[0] = computeGain_neon(vmulq_n_f32(sr, kSdrWhiteNits),
+                                    vmulq_n_f32(hr, params.hdr_sample_to_nits));
+      out.val[1] = computeGain_neon(vmulq_n_f32(sg, kSdrWhiteNits),
+                                    vmulq_n_f32(hg, params.hdr_sample_to_nits));
+      out.val[2] = computeGain_neon(vmulq_n_f32(sb, kSdrWhiteNits),
+                                    vmulq_n_f32(hb, params.hdr_sample_to_nits));
+      vst3q_f32(gains + x * 3, out);
     } else {
-      return dst;
+      float32x4_t sdr_y, hdr_y;
+      if (params.use_luminance) {
+        sdr_y = dot3_neon(params.luminance.data(), sr, sg, sb);
+        hdr_y = dot3_neon(params.luminance.data(), hr, hg, hb);
+      } else {
+        sdr_y = vmaxq_f32(sr, vmaxq_f32(sg, sb));
+        hdr_y = vmaxq_f32(hr, vmaxq_f32(hg, hb));
+      }
+      vst1q_f32(gains + x, computeGain_neon(vmulq_n_f32(sdr_y, kSdrWhiteNits),
+                                            vmulq_n_f32(hdr_y, params.hdr_sample_to_nits)));
     }
-    dst = std::make_unique<uhdr_raw_image_ext_t>(UHDR_IMG_FMT_24bppYCbCr444, src->cg, src->ct,
-                                                 UHDR_CR_FULL_RANGE, src->w, src->h, 64);
-    ConvertRgba8888ToYuv444_neon(src, dst.get(), coeffs_ptr);
-    return dst;
   }
-  return nullptr;
+
+  return vec_width;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// toneMap row kernel
+
+// See getP010Pixel()
+static inline float32x4_t convertP010_neon(uint16x4_t v, float32x4_t bias, float scale) {
+  return vmulq_n_f32(vsubq_f32(vcvtq_f32_u32(vmovl_u16(vshr_n_u16(v, 6))), bias), scale);
+}
+
+// See ScaleTo8Bit(), values are rounded half away from zero
+static inline uint16x4_t scaleTo8Bit_neon(float32x4_t v) {
+  v = vminq_f32(vmaxq_f32(vmulq_n_f32(v, 255.0f), vdupq_n_f32(0.0f)), vdupq_n_f32(255.0f));
+  return vmovn_u32(vcvtq_u32_f32(vaddq_f32(v, vdupq_n_f32(0.5f))));
+}
+
+// hdr yuv -> sdr yuv of 4 pixels, see JpegR::toneMap()
+static inline void toneMap4_neon(const ToneMapRowParams& params, float32x4_t y_f,
+                                 float32x4_t u_f, float32x4_t v_f, float32x4_t& y_out,
+                                 float32x4_t& u_out, float32x4_t& v_out) {
+  float32x4_t r, g, b;
+  yuvToRgb_neon(params.hdr_yuv_to_rgb, y_f, u_f, v_f, r, g, b);
+  r = lookup_neon(params.hdr_inv_oetf_lut, params.hdr_inv_oetf_entries, r);
+  g = lookup_neon(params.hdr_inv_oetf_lut, params.hdr_inv_oetf_entries, g);
+  b = lookup_neon(params.hdr_inv_oetf_lut, params.hdr_inv_oetf_entries, b);
+  if (params.hdr_ootf_gamma != 1.0f) {
+    r = pow_neon(r, params.hdr_ootf_gamma);
+    g = pow_neon(g, params.hdr_ootf_gamma);
+    b = pow_neon(b, params.hdr_ootf_gamma);
+  }
+
+  // globalTonemap(), the reinhard curve scales all channels by max_sdr / max_hdr
+  const float32x4_t one = vdupq_n_f32(1.0f);
+  const float32x4_t zero = vdupq_n_f32(0.0f);
+  r = vmulq_n_f32(r, params.headroom);
+  g = vmulq_n_f32(g, params.headroom);
+  b = vmulq_n_f32(b, params.headroom);
+  const float32x4_t max_hdr = vmaxq_f32(r, vmaxq_f32(g, b));
+  const float32x4_t scale =
+      div_neon(vmlaq_n_f32(one, max_hdr, 1.0f / (params.headroom * params.headroom)),
+               vaddq_f32(one, max_hdr));
+  r = vmaxq_f32(vmulq_f32(r, scale), zero);
+  g = vmaxq_f32(vmulq_f32(g, scale), zero);
+  b = vmaxq_f32(vmulq_f32(b, scale), zero);
+
+  const float* m = params.hdr_gamut_matrix.data();
+  float32x4_t sr = clampPixelFloat_neon(dot3_neon(m, r, g, b));
+  float32x4_t sg = clampPixelFloat_neon(dot3_neon(m + 3, r, g, b));
+  float32x4_t sb = clampPixelFloat_neon(dot3_neon(m + 6, r, g, b));
+
+  // srgbOetf()
+  const float32x4_t threshold = vdupq_n_f32(0.0031308f);
+  const float32x4_t high_offset = vdupq_n_f32(0.055f);
+  float32x4_t hi = vsubq_f32(vmulq_n_f32(pow_neon(sr, 1.0f / 2.4f), 1.055f), high_offset);
+  sr = vbslq_f32(vcleq_f32(sr, threshold), vmulq_n_f32(sr, 12.92f), hi);
+  hi = vsubq_f32(vmulq_n_f32(pow_neon(sg, 1.0f / 2.4f), 1.055f), high_offset);
+  sg = vbslq_f32(vcleq_f32(sg, threshold), vmulq_n_f32(sg, 12.92f), hi);
+  hi = vsubq_f32(vmulq_n_f32(pow_neon(sb, 1.0f / 2.4f), 1.055f), high_offset);
+  sb = vbslq_f32(vcleq_f32(sb, threshold), vmulq_n_f32(sb, 12.92f), hi);
+
+  // p3RgbToYuv(), chroma is biased to [0, 1]
+  static const float kP3Luma[3] = {kP3YR, kP3YG, kP3YB};
+  const float32x4_t half = vdupq_n_f32(0.5f);
+  y_out = dot3_neon(kP3Luma, sr, sg, sb);
+  u_out = vmlaq_n_f32(half, vsubq_f32(sb, y_out), 1.0f / kP3Cb);
+  v_out = vmlaq_n_f32(half, vsubq_f32(sr, y_out), 1.0f / kP3Cr);
+}
+
+size_t toneMapRowP010_neon(uhdr_raw_image_t* hdr_intent, uhdr_raw_image_t* sdr_intent,
+                           const ToneMapRowParams& params, size_t y) {
+  const size_t vec_width = hdr_intent->w & ~static_cast<size_t>(7);
+  const uint16_t* luma = static_cast<uint16_t*>(hdr_intent->planes[UHDR_PLANE_Y]);
+  const uint16_t* chroma = static_cast<uint16_t*>(hdr_intent->planes[UHDR_PLANE_UV]);
+  const uint16_t* y_rows[2] = {luma + y * hdr_intent->stride[UHDR_PLANE_Y],
+                               luma + (y + 1) * hdr_intent->stride[UHDR_PLANE_Y]};
+  const uint16_t* uv_row = chroma + (y / 2) * hdr_intent->stride[UHDR_PLANE_UV];
+  uint8_t* sdr_luma = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_Y]);
+  uint8_t* out_y[2] = {sdr_luma + y * sdr_intent->stride[UHDR_PLANE_Y],
+                       sdr_luma + (y + 1) * sdr_intent->stride[UHDR_PLANE_Y]};
+  uint8_t* out_u = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_U]) +
+                   (y / 2) * sdr_intent->stride[UHDR_PLANE_U];
+  uint8_t* out_v = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_V]) +
+                   (y / 2) * sdr_intent->stride[UHDR_PLANE_V];
+
+  // see getP010Pixel()
+  const bool full_range = hdr_intent->range == UHDR_CR_FULL_RANGE;
+  const float32x4_t bias = vdupq_n_f32(full_range ? 0.0f : 64.0f);
+  const float y_scale = full_range ? 1 / 1023.0f : 1 / 876.0f;
+  const float uv_scale = full_range ? 1 / 1023.0f : 1 / 896.0f;
+  const float32x4_t half = vdupq_n_f32(0.5f);
+
+  for (size_t x = 0; x < vec_width; x += 8) {
+    // each uv pair covers two horizontally adjacent pixels
+    const uint16x4x2_t uv = vld2_u16(uv_row + x);
+    const float32x4_t u4 = vsubq_f32(convertP010_neon(uv.val[0], bias, uv_scale), half);
+    const float32x4_t v4 = vsubq_f32(convertP010_neon(uv.val[1], bias, uv_scale), half);
+    const float32x4x2_t u_f = vzipq_f32(u4, u4);
+    const float32x4x2_t v_f = vzipq_f32(v4, v4);
+
+    float32x4_t u_sum[2] = {vdupq_n_f32(0.0f), vdupq_n_f32(0.0f)};
+    float32x4_t v_sum[2] = {vdupq_n_f32(0.0f), vdupq_n_f32(0.0f)};
+    for (int i = 0; i < 2; i++) {
+      const uint16x8_t y_u16 = vld1q_u16(y_rows[i] + x);
+      uint16x4_t y_out8[2];
+      for (int k = 0; k < 2; k++) {
+        const uint16x4_t y_half = k == 0 ? vget_low_u16(y_u16) : vget_high_u16(y_u16);
+        float32x4_t y_out, u_out, v_out;
+        toneMap4_neon(params, convertP010_neon(y_half, bias, y_scale), u_f.val[k], v_f.val[k],
+                      y_out, u_out, v_out);
+        y_out8[k] = scaleTo8Bit_neon(y_out);
+        u_sum[k] = vaddq_f32(u_sum[k], u_out);
+        v_sum[k] = vaddq_f32(v_sum[k], v_out);
+      }
+      vst1_u8(out_y[i] + x, vmovn_u16(vcombine_u16(y_out8[0], y_out8[1])));
+    }
+
+    // average the 2x2 blocks
+    const float32x4_t u_avg = vmulq_n_f32(
+        vcombine_f32(vpadd_f32(vget_low_f32(u_sum[0]), vget_high_f32(u_sum[0])),
+                     vpadd_f32(vget_low_f32(u_sum[1]), vget_high_f32(u_sum[1]))),
+        0.25f);
+    const float32x4_t v_avg = vmulq_n_f32(
+        vcombine_f32(vpadd_f32(vget_low_f32(v_sum[0]), vget_high_f32(v_sum[0])),
+                     vpadd_f32(vget_low_f32(v_sum[1]), vget_high_f32(v_sum[1]))),
+        0.25f);
+    const uint32x2_t uv_8 = vreinterpret_u32_u8(
+        vmovn_u16(vcombine_u16(scaleTo8Bit_neon(u_avg), scaleTo8Bit_neon(v_avg))));
+    const uint32_t u_packed = vget_lane_u32(uv_8, 0);
+    const uint32_t v_packed = vget_lane_u32(uv_8, 1);
+    memcpy(out_u + x / 2, &u_packed, sizeof u_packed);
+    memcpy(out_v + x / 2, &v_packed, sizeof v_packed);
+  }
+
+  return vec_width;
+}
+
+#if defined(__aarch64__)
+size_t rgbaF16ToFloatRow_neon(const uint64_t* src, size_t count, float* dst[3]) {
+  const size_t vec_count = count & ~static_cast<size_t>(3);
+  for (size_t x = 0; x < vec_count; x += 4) {
+    const uint16x4x4_t rgba = vld4_u16(reinterpret_cast<const uint16_t*>(src + x));
+    vst1q_f32(dst[0] + x, vcvt_f32_f16(vreinterpret_f16_u16(rgba.val[0])));
+    vst1q_f32(dst[1] + x, vcvt_f32_f16(vreinterpret_f16_u16(rgba.val[1])));
+    vst1q_f32(dst[2] + x, vcvt_f32_f16(vreinterpret_f16_u16(rgba.val[2])));
+  }
+  return vec_count;
+}
+
+size_t floatToRgbaF16Row_neon(float* const src[3], size_t count, uint64_t* dst) {
+  const size_t vec_count = count & ~static_cast<size_t>(3);
+  uint16x4x4_t rgba;
+  rgba.val[3] = vdup_n_u16(0x3c00);  // 1.0f
+  for (size_t x = 0; x < vec_count; x += 4) {
+    rgba.val[0] = vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(src[0] + x)));
+    rgba.val[1] = vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(src[1] + x)));
+    rgba.val[2] = vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(src[2] + x)));
+    vst4_u16(reinterpret_cast<uint16_t*>(dst + x), rgba);
+  }
+  return vec_count;
+}
+#endif
+
 }  // namespace ultrahdr
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// This file is built with the armv8.2 fp16 extension enabled and is only entered after the cpu
+// reports it, see dspdispatch.cpp. It deliberately includes no library headers, so that no inline
+// function shared with the rest of the library is emitted with the extension.
+
+#include <arm_neon.h>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_FP16_VECTOR_ARITHMETIC)
+
+namespace ultrahdr {
+
+static inline float16x8_t load8_f16(const float* src) {
+  return vcombine_f16(vcvt_f16_f32(vld1q_f32(src)), vcvt_f16_f32(vld1q_f32(src + 4)));
+}
+
+// see applyGainLUT(), (e + offset_sdr) * gain - offset_hdr is computed as
+// e * gain + (offset_sdr * gain - offset_hdr)
+void applyGainRowF16_neon_fp16(const float* r, const float* g, const float* b, const float* gain,
+                               size_t count, float offset_sdr, float offset_hdr,
+                               const float* gamut_matrix, uint64_t* dst) {
+  const float16x8_t osdr = vdupq_n_f16(static_cast<float16_t>(offset_sdr));
+  const float16x8_t neg_ohdr = vdupq_n_f16(static_cast<float16_t>(-offset_hdr));
+  float16x8_t m[9];
+  if (gamut_matrix != nullptr) {
+    for (int i = 0; i < 9; i++) m[i] = vdupq_n_f16(static_cast<float16_t>(gamut_matrix[i]));
+  }
+
+  for (size_t x = 0; x < count; x += 8) {
+    const float16x8_t gf = load8_f16(gain + x);
+    const float16x8_t k = vfmaq_f16(neg_ohdr, osdr, gf);
+    float16x8_t rh = vfmaq_f16(k, load8_f16(r + x), gf);
+    float16x8_t gh = vfmaq_f16(k, load8_f16(g + x), gf);
+    float16x8_t bh = vfmaq_f16(k, load8_f16(b + x), gf);
+    if (gamut_matrix != nullptr) {
+      // output gamut, see getGamutConversionMatrix()
+      const float16x8_t r_out = vfmaq_f16(vfmaq_f16(vmulq_f16(m[0], rh), m[1], gh), m[2], bh);
+      const float16x8_t g_out = vfmaq_f16(vfmaq_f16(vmulq_f16(m[3], rh), m[4], gh), m[5], bh);
+      bh = vfmaq_f16(vfmaq_f16(vmulq_f16(m[6], rh), m[7], gh), m[8], bh);
+      rh = r_out;
+      gh = g_out;
+    }
+
+    uint16x8x4_t rgba;
+    rgba.val[0] = vreinterpretq_u16_f16(rh);
+    rgba.val[1] = vreinterpretq_u16_f16(gh);
+    rgba.val[2] = vreinterpretq_u16_f16(bh);
+    rgba.val[3] = vdupq_n_u16(0x3c00);  // 1.0f
+    vst4q_u16(reinterpret_cast<uint16_t*>(dst + x), rgba);
+  }
+}
+
+}  // namespace ultrahdr
+
+#endif
@@ -0,0 +1,381 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ultrahdr/gainmapmath.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+
+// The library is built for the baseline isa of the target. The code below is compiled for lasx and
+// is only reached after the hwcaps report the extension. The pragma follows the includes, so that
+// the inline functions of the library headers keep the baseline.
+#pragma GCC target("lasx")
+#include <lasxintrin.h>
+
+namespace ultrahdr {
+
+// Rec.601 yuv -> rgb coefficients, see p3YuvToRgb()
+static const float kP3Cb = 1.772f, kP3Cr = 1.402f;
+static const float kP3GCb = 0.114f * kP3Cb / 0.587f;
+static const float kP3GCr = 0.299f * kP3Cr / 0.587f;
+
+static inline __m256 splat_lasx(float f) { return (__m256){f, f, f, f, f, f, f, f}; }
+
+// Natural logarithm for x > 0, see Cephes logf(). Relative error is in the order of 1e-7.
+static inline __m256 log_lasx(__m256 x) {
+  const __m256 one = splat_lasx(1.0f);
+  const __m256i bits = (__m256i)x;
+  __m256 e =
+      __lasx_xvffint_s_w(__lasx_xvsub_w(__lasx_xvsrli_w(bits, 23), __lasx_xvreplgr2vr_w(127)));
+  __m256 m = (__m256)__lasx_xvor_v(__lasx_xvand_v(bits, __lasx_xvreplgr2vr_w(0x007fffff)),
+                                   __lasx_xvreplgr2vr_w(0x3f800000));
+
+  // move the mantissa to [sqrt(0.5), sqrt(2))
+  const __m256i big = __lasx_xvfcmp_clt_s(splat_lasx(1.41421356f), m);
+  m = (__m256)__lasx_xvbitsel_v((__m256i)m, (__m256i)__lasx_xvfmul_s(m, splat_lasx(0.5f)), big);
+  e = __lasx_xvfadd_s(e, (__m256)__lasx_xvand_v(big, (__m256i)one));
+
+  const __m256 t = __lasx_xvfsub_s(m, one);
+  const __m256 z = __lasx_xvfmul_s(t, t);
+  __m256 p = splat_lasx(7.0376836292E-2f);
+  p = __lasx_xvfmadd_s(p, t, splat_lasx(-1.1514610310E-1f));
+  p = __lasx_xvfmadd_s(p, t, splat_lasx(1.1676998740E-1f));
+  p = __lasx_xvfmadd_s(p, t, splat_lasx(-1.2420140846E-1f));
+  p = __lasx_xvfmadd_s(p, t, splat_lasx(1.4249322787E-1f));
+  p = __lasx_xvfmadd_s(p, t, splat_lasx(-1.6668057665E-1f));
+  p = __lasx_xvfmadd_s(p, t, splat_lasx(2.0000714765E-1f));
+  p = __lasx_xvfmadd_s(p, t, splat_lasx(-2.4999993993E-1f));
+  p = __lasx_xvfmadd_s(p, t, splat_lasx(3.3333331174E-1f));
+  p = __lasx_xvfmul_s(__lasx_xvfmul_s(p, t), z);
+  p = __lasx_xvfmadd_s(e, splat_lasx(-2.12194440e-4f), p);
+  p = __lasx_xvfsub_s(p, __lasx_xvfmul_s(z, splat_lasx(0.5f)));
+  return __lasx_xvfmadd_s(e, splat_lasx(0.693359375f), __lasx_xvfadd_s(t, p));
+}
+
+// Natural exponent, see Cephes expf(). Inputs are clamped to the range of normal floats.
+static inline __m256 exp_lasx(__m256 x) {
+  x = __lasx_xvfmin_s(__lasx_xvfmax_s(x, splat_lasx(-87.3f)), splat_lasx(88.3f));
+  const __m256i n_i =
+      __lasx_xvftintrne_w_s(__lasx_xvfmul_s(x, splat_lasx(1.44269504088896341f)));
+  const __m256 n = __lasx_xvffint_s_w(n_i);
+  x = __lasx_xvfsub_s(x, __lasx_xvfmul_s(n, splat_lasx(0.693359375f)));
+  x = __lasx_xvfsub_s(x, __lasx_xvfmul_s(n, splat_lasx(-2.12194440e-4f)));
+
+  const __m256 z = __lasx_xvfmul_s(x, x);
+  __m256 p = splat_lasx(1.9875691500E-4f);
+  p = __lasx_xvfmadd_s(p, x, splat_lasx(1.3981999507E-3f));
+  p = __lasx_xvfmadd_s(p, x, splat_lasx(8.3334519073E-3f));
+  p = __lasx_xvfmadd_s(p, x, splat_lasx(4.1665795894E-2f));
+  p = __lasx_xvfmadd_s(p, x, splat_lasx(1.6666665459E-1f));
+  p = __lasx_xvfmadd_s(p, x, splat_lasx(5.0000001201E-1f));
+  p = __lasx_xvfadd_s(__lasx_xvfmadd_s(p, z, x), splat_lasx(1.0f));
+
+  const __m256i scale = __lasx_xvslli_w(__lasx_xvadd_w(n_i, __lasx_xvreplgr2vr_w(127)), 23);
+  return __lasx_xvfmul_s(p, (__m256)scale);
+}
+
+// x^p for x > 0. Like std::pow() for a non-integer p, non-positive inputs do not produce a usable
+// result, they are mapped to 0 which is where the following table lookup clamps them anyway.
+static inline __m256 pow_lasx(__m256 x, float p) {
+  const __m256i positive = __lasx_xvfcmp_clt_s(splat_lasx(0.0f), x);
+  x = __lasx_xvfmax_s(x, splat_lasx(FLT_MIN));
+  return (__m256)__lasx_xvand_v((__m256i)exp_lasx(__lasx_xvfmul_s(splat_lasx(p), log_lasx(x))),
+                                positive);
+}
+
+// lasx has no gather, the table reads go through the lanes of the index vector
+template <typename T>
+static inline __m256i gatherInt_lasx(const T* table, __m256i idx) {
+  alignas(32) int i[8];
+  __lasx_xvst(idx, i, 0);
+  return (__m256i)(v8i32){table[i[0]], table[i[1]], table[i[2]], table[i[3]],
+                          table[i[4]], table[i[5]], table[i[6]], table[i[7]]};
+}
+
+static inline __m256 gather_lasx(const float* table, __m256i idx) {
+  alignas(32) int i[8];
+  __lasx_xvst(idx, i, 0);
+  return (__m256){table[i[0]], table[i[1]], table[i[2]], table[i[3]],
+                  table[i[4]], table[i[5]], table[i[6]], table[i[7]]};
+}
+
+// Vector counterpart of the *LUT() transfer functions
+static inline __m256 lookup_lasx(const float* table, int num_entries, __m256 e) {
+  __m256i idx = __lasx_xvftintrz_w_s(__lasx_xvfmadd_s(
+      e, splat_lasx(static_cast<float>(num_entries - 1)), splat_lasx(0.5f)));
+  idx = __lasx_xvmin_w(__lasx_xvmaxi_w(idx, 0), __lasx_xvreplgr2vr_w(num_entries - 1));
+  return gather_lasx(table, idx);
+}
+
+static inline __m256 clampPixelFloat_lasx(__m256 e) {
+  return __lasx_xvfmin_s(__lasx_xvfmax_s(e, splat_lasx(0.0f)), splat_lasx(kMaxPixelFloat));
+}
+
+static inline __m256 loadChroma_lasx(const uint8_t* src) {
+  // each chroma sample covers two horizontally adjacent luma samples
+  const int c0 = src[0] - 128, c1 = src[1] - 128, c2 = src[2] - 128, c3 = src[3] - 128;
+  return __lasx_xvfmul_s(__lasx_xvffint_s_w((__m256i)(v8i32){c0, c0, c1, c1, c2, c2, c3, c3}),
+                         splat_lasx(1 / 255.0f));
+}
+
+static inline __m256 loadMap_lasx(const uint8_t* row, __m256i idx) {
+  return __lasx_xvfdiv_s(__lasx_xvffint_s_w(gatherInt_lasx(row, idx)), splat_lasx(255.0f));
+}
+
+// Vector counterpart of hdrCodeLUTIndex() and the code table lookup
+static inline __m256i lookupCodes_lasx(const uint16_t* table, __m256 e) {
+  __m256i idx = __lasx_xvsub_w(__lasx_xvsrai_w((__m256i)e, kHdrCodeLUTShift),
+                               __lasx_xvreplgr2vr_w(kHdrCodeLUTBias));
+  idx = __lasx_xvmin_w(__lasx_xvmaxi_w(idx, 0), __lasx_xvreplgr2vr_w(kHdrCodeLUTNumEntries - 1));
+  return gatherInt_lasx(table, idx);
+}
+
+// See hlgLinearToRgba1010102() and pqLinearToRgba1010102()
+static inline __m256i toRgba1010102_lasx(const uint16_t* table, __m256 r, __m256 g, __m256 b) {
+  __m256i out =
+      __lasx_xvor_v(lookupCodes_lasx(table, r), __lasx_xvslli_w(lookupCodes_lasx(table, g), 10));
+  out = __lasx_xvor_v(out, __lasx_xvslli_w(lookupCodes_lasx(table, b), 20));
+  // alpha to 1.0
+  return __lasx_xvor_v(out, __lasx_xvreplgr2vr_w(static_cast<int>(0xc0000000)));
+}
+
+static inline __m256 dot3_lasx(const float* k, __m256 r, __m256 g, __m256 b) {
+  return __lasx_xvfmadd_s(
+      splat_lasx(k[2]), b,
+      __lasx_xvfmadd_s(splat_lasx(k[1]), g, __lasx_xvfmul_s(splat_lasx(k[0]), r)));
+}
+
+size_t applyGainMapRowYuv420_lasx(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* gainmap_img,
+                                  uhdr_raw_image_t* dest, size_t map_scale_factor,
+                                  ShepardsIDW& idwTable, GainLUT& gainLUT,
+                                  uhdr_gainmap_metadata_ext_t* metadata,
+                                  uhdr_color_transfer_t output_ct, const float* gamut_matrix,
+                                  size_t y) {
+  if (output_ct != UHDR_CT_LINEAR && output_ct != UHDR_CT_HLG && output_ct != UHDR_CT_PQ) return 0;
+
+  // pixels whose gain map neighbourhood is clamped at the right edge are left to the caller
+  const size_t map_w = gainmap_img->w;
+  if (map_w < 2) return 0;
+  const size_t width =
+      (std::min)(static_cast<size_t>(sdr_intent->w), (map_w - 1) * map_scale_factor);
+  const size_t vec_width = width & ~static_cast<size_t>(7);
+  if (vec_width == 0) return 0;
+
+  const uint8_t* y_row = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_Y]) +
+                         y * sdr_intent->stride[UHDR_PLANE_Y];
+  const uint8_t* u_row = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_U]) +
+                         (y / 2) * sdr_intent->stride[UHDR_PLANE_U];
+  const uint8_t* v_row = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_V]) +
+                         (y / 2) * sdr_intent->stride[UHDR_PLANE_V];
+
+  const size_t y_lower = (std::min)(y / map_scale_factor, static_cast<size_t>(gainmap_img->h) - 1);
+  const size_t y_upper =
+      (std::min)(y / map_scale_factor + 1, static_cast<size_t>(gainmap_img->h) - 1);
+  const uint8_t* map_data = static_cast<uint8_t*>(gainmap_img->planes[UHDR_PLANE_Y]);
+  const size_t map_stride = gainmap_img->stride[UHDR_PLANE_Y];
+  const uint8_t* map_top = map_data + y_lower * map_stride;
+  const uint8_t* map_bottom = map_data + y_upper * map_stride;
+  const float* weights = (y_lower == y_upper) ? idwTable.mWeightsNB : idwTable.mWeights;
+  weights += (y % map_scale_factor) * map_scale_factor * 4;
+
+  const float* srgb_lut = getSrgbInvOetfLUT();
+  const uint16_t* code_lut = output_ct == UHDR_CT_HLG  ? getHlgCodeLUT()
+                            : output_ct == UHDR_CT_PQ ? getPqCodeLUT()
+                                                      : nullptr;
+  const float* gain_table = gainLUT.getGainTable();
+
+  const __m256i lanes = (__m256i)(v8i32){0, 1, 2, 3, 4, 5, 6, 7};
+  const __m256i scale_i = __lasx_xvreplgr2vr_w(static_cast<int>(map_scale_factor));
+  const __m256 scale_f = splat_lasx(static_cast<float>(map_scale_factor));
+  const __m256 offset_sdr = splat_lasx(metadata->offset_sdr);
+  const __m256 offset_hdr = splat_lasx(metadata->offset_hdr);
+  const __m256 inv_255 = splat_lasx(1 / 255.0f);
+
+  uint8_t* dst = static_cast<uint8_t*>(dest->planes[UHDR_PLANE_PACKED]);
+  const size_t dst_offset = y * dest->stride[UHDR_PLANE_PACKED];
+
+  for (size_t x = 0; x < vec_width; x += 8) {
+    // yuv -> linear rgb
+    const __m256i luma = __lasx_vext2xv_wu_bu(__lasx_xvldrepl_d(y_row + x, 0));
+    const __m256 y_f = __lasx_xvfmul_s(__lasx_xvffint_s_w(luma), inv_255);
+    const __m256 u_f = loadChroma_lasx(u_row + x / 2);
+    const __m256 v_f = loadChroma_lasx(v_row + x / 2);
+    __m256 r = clampPixelFloat_lasx(__lasx_xvfmadd_s(splat_lasx(kP3Cr), v_f, y_f));
+    __m256 g = clampPixelFloat_lasx(__lasx_xvfsub_s(
+        __lasx_xvfsub_s(y_f, __lasx_xvfmul_s(splat_lasx(kP3GCb), u_f)),
+        __lasx_xvfmul_s(splat_lasx(kP3GCr), v_f)));
+    __m256 b = clampPixelFloat_lasx(__lasx_xvfmadd_s(splat_lasx(kP3Cb), u_f, y_f));
+    r = lookup_lasx(srgb_lut, kSrgbInvOETFNumEntries, r);
+    g = lookup_lasx(srgb_lut, kSrgbInvOETFNumEntries, g);
+    b = lookup_lasx(srgb_lut, kSrgbInvOETFNumEntries, b);
+
+    // sample gain map, see sampleMap() with ShepardsIDW
+    const __m256i xs = __lasx_xvadd_w(__lasx_xvreplgr2vr_w(static_cast<int>(x)), lanes);
+    const __m256i x_lower = __lasx_xvftintrz_w_s(
+        __lasx_xvfdiv_s(__lasx_xvfadd_s(__lasx_xvffint_s_w(xs), splat_lasx(0.5f)), scale_f));
+    const __m256i x_upper = __lasx_xvaddi_wu(x_lower, 1);
+    const __m256i w_idx =
+        __lasx_xvslli_w(__lasx_xvsub_w(xs, __lasx_xvmul_w(x_lower, scale_i)), 2);
+    const __m256 e1 = loadMap_lasx(map_top, x_lower);
+    const __m256 e2 = loadMap_lasx(map_bottom, x_lower);
+    const __m256 e3 = loadMap_lasx(map_top, x_upper);
+    const __m256 e4 = loadMap_lasx(map_bottom, x_upper);
+    __m256 gain = __lasx_xvfmul_s(e1, gather_lasx(weights, w_idx));
+    gain = __lasx_xvfmadd_s(e2, gather_lasx(weights + 1, w_idx), gain);
+    gain = __lasx_xvfmadd_s(e3, gather_lasx(weights + 2, w_idx), gain);
+    gain = __lasx_xvfmadd_s(e4, gather_lasx(weights + 3, w_idx), gain);
+
+    // apply gain, see applyGainLUT()
+    const __m256 gain_factor = lookup_lasx(gain_table, kGainFactorNumEntries, gain);
+    r = __lasx_xvfsub_s(__lasx_xvfmul_s(__lasx_xvfadd_s(r, offset_sdr), gain_factor), offset_hdr);
+    g = __lasx_xvfsub_s(__lasx_xvfmul_s(__lasx_xvfadd_s(g, offset_sdr), gain_factor), offset_hdr);
+    b = __lasx_xvfsub_s(__lasx_xvfmul_s(__lasx_xvfadd_s(b, offset_sdr), gain_factor), offset_hdr);
+    if (gamut_matrix != nullptr) {
+      // output gamut, see getGamutConversionMatrix()
+      const __m256 r_out = dot3_lasx(gamut_matrix, r, g, b);
+      const __m256 g_out = dot3_lasx(gamut_matrix + 3, r, g, b);
+      b = dot3_lasx(gamut_matrix + 6, r, g, b);
+      r = r_out;
+      g = g_out;
+      // colors outside of the output gamut map to code 0 in the hlg and pq tables
+    }
+
+    if (output_ct == UHDR_CT_LINEAR) {
+      alignas(32) float rgb[3][8];
+      __lasx_xvst((__m256i)r, rgb[0], 0);
+      __lasx_xvst((__m256i)g, rgb[1], 0);
+      __lasx_xvst((__m256i)b, rgb[2], 0);
+      uint64_t* out = reinterpret_cast<uint64_t*>(dst) + dst_offset + x;
+      for (int i = 0; i < 8; i++) {
+        out[i] = colorToRgbaF16({{{rgb[0][i], rgb[1][i], rgb[2][i]}}});
+      }
+    } else {
+      // scaling, inverse ootf, oetf and quantization in one lookup per component
+      __lasx_xvst(toRgba1010102_lasx(code_lut, r, g, b),
+                  dst + (dst_offset + x) * sizeof(uint32_t), 0);
+    }
+  }
+
+  return vec_width;
+}
+
+// See computeGain()
+static inline __m256 computeGain_lasx(__m256 sdr, __m256 hdr) {
+  const __m256 ratio = __lasx_xvfdiv_s(__lasx_xvfadd_s(hdr, splat_lasx(kHdrOffset)),
+                                       __lasx_xvfadd_s(sdr, splat_lasx(kSdrOffset)));
+  const __m256 gain = __lasx_xvfmul_s(log_lasx(ratio), splat_lasx(1.44269504088896341f));
+  const __m256i dark = __lasx_xvfcmp_clt_s(sdr, splat_lasx(2.f / 255.0f));
+  return (__m256)__lasx_xvbitsel_v((__m256i)gain,
+                                   (__m256i)__lasx_xvfmin_s(gain, splat_lasx(2.3f)), dark);
+}
+
+static inline void yuvToRgb_lasx(const float coeffs[4], const float* y, const float* u,
+                                 const float* v, __m256& r, __m256& g, __m256& b) {
+  const __m256 y_f = (__m256)__lasx_xvld(y, 0);
+  const __m256 u_f = (__m256)__lasx_xvld(u, 0);
+  const __m256 v_f = (__m256)__lasx_xvld(v, 0);
+  r = clampPixelFloat_lasx(__lasx_xvfmadd_s(splat_lasx(coeffs[0]), v_f, y_f));
+  g = clampPixelFloat_lasx(
+      __lasx_xvfsub_s(__lasx_xvfsub_s(y_f, __lasx_xvfmul_s(splat_lasx(coeffs[1]), u_f)),
+                      __lasx_xvfmul_s(splat_lasx(coeffs[2]), v_f)));
+  b = clampPixelFloat_lasx(__lasx_xvfmadd_s(splat_lasx(coeffs[3]), u_f, y_f));
+}
+
+size_t generateGainMapRow_lasx(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* hdr_intent,
+                               const GainMapRowParams& params, size_t map_scale_factor,
+                               size_t map_width, size_t y, float* gains) {
+  const size_t vec_width = map_width & ~static_cast<size_t>(7);
+  alignas(32) float sdr_yuv[3][kGainMapRowChunk];
+  alignas(32) float hdr_yuv[3][kGainMapRowChunk];
+  float* sdr_planes[3] = {sdr_yuv[0], sdr_yuv[1], sdr_yuv[2]};
+  float* hdr_planes[3] = {hdr_yuv[0], hdr_yuv[1], hdr_yuv[2]};
+  const float* srgb_lut = getSrgbInvOetfLUT();
+  const float* m = params.hdr_gamut_matrix.data();
+  const __m256 sdr_nits = splat_lasx(kSdrWhiteNits);
+  const __m256 hdr_nits = splat_lasx(params.hdr_sample_to_nits);
+  const __m256 zero = splat_lasx(0.0f);
+
+  for (size_t x = 0; x < vec_width; x += 8) {
+    const size_t chunk_x = x % kGainMapRowChunk;
+    if (chunk_x == 0) {
+      const size_t len = (std::min)(kGainMapRowChunk, vec_width - x);
+      sampleYuv420Row(sdr_intent, map_scale_factor, x, y, len, sdr_planes);
+      sampleP010Row(hdr_intent, map_scale_factor, x, y, len, hdr_planes);
+    }
+
+    // sdr yuv -> linear rgb
+    __m256 sr, sg, sb;
+    yuvToRgb_lasx(params.sdr_yuv_to_rgb, sdr_yuv[0] + chunk_x, sdr_yuv[1] + chunk_x,
+                  sdr_yuv[2] + chunk_x, sr, sg, sb);
+    sr = lookup_lasx(srgb_lut, kSrgbInvOETFNumEntries, sr);
+    sg = lookup_lasx(srgb_lut, kSrgbInvOETFNumEntries, sg);
+    sb = lookup_lasx(srgb_lut, kSrgbInvOETFNumEntries, sb);
+
+    // hdr yuv -> linear rgb in sdr gamut
+    __m256 hr, hg, hb;
+    yuvToRgb_lasx(params.hdr_yuv_to_rgb, hdr_yuv[0] + chunk_x, hdr_yuv[1] + chunk_x,
+                  hdr_yuv[2] + chunk_x, hr, hg, hb);
+    hr = lookup_lasx(params.hdr_inv_oetf_lut, params.hdr_inv_oetf_entries, hr);
+    hg = lookup_lasx(params.hdr_inv_oetf_lut, params.hdr_inv_oetf_entries, hg);
+    hb = lookup_lasx(params.hdr_inv_oetf_lut, params.hdr_inv_oetf_entries, hb);
+    if (params.hdr_ootf_gamma != 1.0f) {
+      hr = pow_lasx(hr, params.hdr_ootf_gamma);
+      hg = pow_lasx(hg, params.hdr_ootf_gamma);
+      hb = pow_lasx(hb, params.hdr_ootf_gamma);
+    }
+    const __m256 cr = dot3_lasx(m, hr, hg, hb);
+    const __m256 cg = dot3_lasx(m + 3, hr, hg, hb);
+    const __m256 cb = dot3_lasx(m + 6, hr, hg, hb);
+    hr = __lasx_xvfmax_s(cr, zero);
+    hg = __lasx_xvfmax_s(cg, zero);
+    hb = __lasx_xvfmax_s(cb, zero);
+
+    if (params.multichannel) {
+      alignas(32) float out[3][8];
+      const __m256 gr =
+          computeGain_lasx(__lasx_xvfmul_s(sr, sdr_nits), __lasx_xvfmul_s(hr, hdr_nits));
+      const __m256 gg =
+          computeGain_lasx(__lasx_xvfmul_s(sg, sdr_nits), __lasx_xvfmul_s(hg, hdr_nits));
+      const __m256 gb =
+          computeGain_lasx(__lasx_xvfmul_s(sb, sdr_nits), __lasx_xvfmul_s(hb, hdr_nits));
+      __lasx_xvst((__m256i)gr, out[0], 0);
+      __lasx_xvst((__m256i)gg, out[1], 0);
+      __lasx_xvst((__m256i)gb, out[2], 0);
+      for (int i = 0; i < 8; i++) {
+        gains[(x + i) * 3] = out[0][i];
+        gains[(x + i) * 3 + 1] = out[1][i];
+        gains[(x + i) * 3 + 2] = out[2][i];
+      }
+    } else {
+      __m256 sdr_y, hdr_y;
+      if (params.use_luminance) {
+        sdr_y = dot3_lasx(params.luminance.data(), sr, sg, sb);
+        hdr_y = dot3_lasx(params.luminance.data(), hr, hg, hb);
+      } else {
+        sdr_y = __lasx_xvfmax_s(sr, __lasx_xvfmax_s(sg, sb));
+        hdr_y = __lasx_xvfmax_s(hr, __lasx_xvfmax_s(hg, hb));
+      }
+      const __m256 gain =
+          computeGain_lasx(__lasx_xvfmul_s(sdr_y, sdr_nits), __lasx_xvfmul_s(hdr_y, hdr_nits));
+      __lasx_xvst((__m256i)gain, gains + x, 0);
+    }
+  }
+
+  return vec_width;
+}
+
+}  // namespace ultrahdr
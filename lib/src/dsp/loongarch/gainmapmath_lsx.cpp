@@ -0,0 +1,470 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ultrahdr/gainmapmath.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+
+// The library is built for the baseline isa of the target. The code below is compiled for lsx and
+// is only reached after the hwcaps report the extension. The pragma follows the includes, so that
+// the inline functions of the library headers keep the baseline.
+#pragma GCC target("lsx")
+#include <lsxintrin.h>
+
+namespace ultrahdr {
+
+// Rec.601 yuv -> rgb coefficients, see p3YuvToRgb()
+static const float kP3Cb = 1.772f, kP3Cr = 1.402f;
+static const float kP3GCb = 0.114f * kP3Cb / 0.587f;
+static const float kP3GCr = 0.299f * kP3Cr / 0.587f;
+
+static inline __m128 splat_lsx(float f) { return (__m128){f, f, f, f}; }
+
+// Natural logarithm for x > 0, see Cephes logf(). Relative error is in the order of 1e-7.
+static inline __m128 log_lsx(__m128 x) {
+  const __m128 one = splat_lsx(1.0f);
+  const __m128i bits = (__m128i)x;
+  __m128 e = __lsx_vffint_s_w(__lsx_vsub_w(__lsx_vsrli_w(bits, 23), __lsx_vreplgr2vr_w(127)));
+  __m128 m = (__m128)__lsx_vor_v(__lsx_vand_v(bits, __lsx_vreplgr2vr_w(0x007fffff)),
+                                 __lsx_vreplgr2vr_w(0x3f800000));
+
+  // move the mantissa to [sqrt(0.5), sqrt(2))
+  const __m128i big = __lsx_vfcmp_clt_s(splat_lsx(1.41421356f), m);
+  m = (__m128)__lsx_vbitsel_v((__m128i)m, (__m128i)__lsx_vfmul_s(m, splat_lsx(0.5f)), big);
+  e = __lsx_vfadd_s(e, (__m128)__lsx_vand_v(big, (__m128i)one));
+
+  const __m128 t = __lsx_vfsub_s(m, one);
+  const __m128 z = __lsx_vfmul_s(t, t);
+  __m128 p = splat_lsx(7.0376836292E-2f);
+  p = __lsx_vfmadd_s(p, t, splat_lsx(-1.1514610310E-1f));
+  p = __lsx_vfmadd_s(p, t, splat_lsx(1.1676998740E-1f));
+  p = __lsx_vfmadd_s(p, t, splat_lsx(-1.2420140846E-1f));
+  p = __lsx_vfmadd_s(p, t, splat_lsx(1.4249322787E-1f));
+  p = __lsx_vfmadd_s(p, t, splat_lsx(-1.6668057665E-1f));
+  p = __lsx_vfmadd_s(p, t, splat_lsx(2.0000714765E-1f));
+  p = __lsx_vfmadd_s(p, t, splat_lsx(-2.4999993993E-1f));
+  p = __lsx_vfmadd_s(p, t, splat_lsx(3.3333331174E-1f));
+  p = __lsx_vfmul_s(__lsx_vfmul_s(p, t), z);
+  p = __lsx_vfmadd_s(e, splat_lsx(-2.12194440e-4f), p);
+  p = __lsx_vfsub_s(p, __lsx_vfmul_s(z, splat_lsx(0.5f)));
+  return __lsx_vfmadd_s(e, splat_lsx(0.693359375f), __lsx_vfadd_s(t, p));
+}
+
+// Natural exponent, see Cephes expf(). Inputs are clamped to the range of normal floats.
+static inline __m128 exp_lsx(__m128 x) {
+  x = __lsx_vfmin_s(__lsx_vfmax_s(x, splat_lsx(-87.3f)), splat_lsx(88.3f));
+  const __m128i n_i = __lsx_vftintrne_w_s(__lsx_vfmul_s(x, splat_lsx(1.44269504088896341f)));
+  const __m128 n = __lsx_vffint_s_w(n_i);
+  x = __lsx_vfsub_s(x, __lsx_vfmul_s(n, splat_lsx(0.693359375f)));
+  x = __lsx_vfsub_s(x, __lsx_vfmul_s(n, splat_lsx(-2.12194440e-4f)));
+
+  const __m128 z = __lsx_vfmul_s(x, x);
+  __m128 p = splat_lsx(1.9875691500E-4f);
+  p = __lsx_vfmadd_s(p, x, splat_lsx(1.3981999507E-3f));
+  p = __lsx_vfmadd_s(p, x, splat_lsx(8.3334519073E-3f));
+  p = __lsx_vfmadd_s(p, x, splat_lsx(4.1665795894E-2f));
+  p = __lsx_vfmadd_s(p, x, splat_lsx(1.6666665459E-1f));
+  p = __lsx_vfmadd_s(p, x, splat_lsx(5.0000001201E-1f));
+  p = __lsx_vfadd_s(__lsx_vfmadd_s(p, z, x), splat_lsx(1.0f));
+
+  const __m128i scale = __lsx_vslli_w(__lsx_vadd_w(n_i, __lsx_vreplgr2vr_w(127)), 23);
+  return __lsx_vfmul_s(p, (__m128)scale);
+}
+
+// x^p for x > 0. Like std::pow() for a non-integer p, non-positive inputs do not produce a usable
+// result, they are mapped to 0 which is where the following table lookup clamps them anyway.
+static inline __m128 pow_lsx(__m128 x, float p) {
+  const __m128i positive = __lsx_vfcmp_clt_s(splat_lsx(0.0f), x);
+  x = __lsx_vfmax_s(x, splat_lsx(FLT_MIN));
+  return (__m128)__lsx_vand_v((__m128i)exp_lsx(__lsx_vfmul_s(splat_lsx(p), log_lsx(x))),
+                              positive);
+}
+
+static inline __m128 gather_lsx(const float* table, __m128i idx) {
+  return (__m128){table[__lsx_vpickve2gr_w(idx, 0)], table[__lsx_vpickve2gr_w(idx, 1)],
+                  table[__lsx_vpickve2gr_w(idx, 2)], table[__lsx_vpickve2gr_w(idx, 3)]};
+}
+
+// Vector counterpart of the *LUT() transfer functions
+static inline __m128 lookup_lsx(const float* table, int num_entries, __m128 e) {
+  __m128i idx = __lsx_vftintrz_w_s(__lsx_vfmadd_s(
+      e, splat_lsx(static_cast<float>(num_entries - 1)), splat_lsx(0.5f)));
+  idx = __lsx_vmin_w(__lsx_vmaxi_w(idx, 0), __lsx_vreplgr2vr_w(num_entries - 1));
+  return gather_lsx(table, idx);
+}
+
+static inline __m128 clampPixelFloat_lsx(__m128 e) {
+  return __lsx_vfmin_s(__lsx_vfmax_s(e, splat_lsx(0.0f)), splat_lsx(kMaxPixelFloat));
+}
+
+static inline __m128 loadChroma_lsx(const uint8_t* src) {
+  // each chroma sample covers two horizontally adjacent luma samples
+  const int c0 = src[0] - 128, c1 = src[1] - 128;
+  return __lsx_vfmul_s(__lsx_vffint_s_w((__m128i)(v4i32){c0, c0, c1, c1}),
+                       splat_lsx(1 / 255.0f));
+}
+
+static inline __m128 loadMap_lsx(const uint8_t* row, __m128i idx) {
+  const __m128i v =
+      (__m128i)(v4i32){row[__lsx_vpickve2gr_w(idx, 0)], row[__lsx_vpickve2gr_w(idx, 1)],
+                       row[__lsx_vpickve2gr_w(idx, 2)], row[__lsx_vpickve2gr_w(idx, 3)]};
+  return __lsx_vfdiv_s(__lsx_vffint_s_w(v), splat_lsx(255.0f));
+}
+
+// Vector counterpart of hdrCodeLUTIndex() and the code table lookup
+static inline __m128i lookupCodes_lsx(const uint16_t* table, __m128 e) {
+  __m128i idx = __lsx_vsub_w(__lsx_vsrai_w((__m128i)e, kHdrCodeLUTShift),
+                             __lsx_vreplgr2vr_w(kHdrCodeLUTBias));
+  idx = __lsx_vmin_w(__lsx_vmaxi_w(idx, 0), __lsx_vreplgr2vr_w(kHdrCodeLUTNumEntries - 1));
+  return (__m128i)(v4i32){table[__lsx_vpickve2gr_w(idx, 0)], table[__lsx_vpickve2gr_w(idx, 1)],
+                          table[__lsx_vpickve2gr_w(idx, 2)], table[__lsx_vpickve2gr_w(idx, 3)]};
+}
+
+// See hlgLinearToRgba1010102() and pqLinearToRgba1010102()
+static inline __m128i toRgba1010102_lsx(const uint16_t* table, __m128 r, __m128 g, __m128 b) {
+  __m128i out =
+      __lsx_vor_v(lookupCodes_lsx(table, r), __lsx_vslli_w(lookupCodes_lsx(table, g), 10));
+  out = __lsx_vor_v(out, __lsx_vslli_w(lookupCodes_lsx(table, b), 20));
+  return __lsx_vor_v(out, __lsx_vreplgr2vr_w(static_cast<int>(0xc0000000)));  // alpha to 1.0
+}
+
+static inline __m128 dot3_lsx(const float* k, __m128 r, __m128 g, __m128 b) {
+  return __lsx_vfmadd_s(splat_lsx(k[2]), b,
+                        __lsx_vfmadd_s(splat_lsx(k[1]), g, __lsx_vfmul_s(splat_lsx(k[0]), r)));
+}
+
+size_t applyGainMapRowYuv420_lsx(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* gainmap_img,
+                                 uhdr_raw_image_t* dest, size_t map_scale_factor,
+                                 ShepardsIDW& idwTable, GainLUT& gainLUT,
+                                 uhdr_gainmap_metadata_ext_t* metadata,
+                                 uhdr_color_transfer_t output_ct, const float* gamut_matrix,
+                                 size_t y) {
+  if (output_ct != UHDR_CT_LINEAR && output_ct != UHDR_CT_HLG && output_ct != UHDR_CT_PQ) return 0;
+
+  // pixels whose gain map neighbourhood is clamped at the right edge are left to the caller
+  const size_t map_w = gainmap_img->w;
+  if (map_w < 2) return 0;
+  const size_t width =
+      (std::min)(static_cast<size_t>(sdr_intent->w), (map_w - 1) * map_scale_factor);
+  const size_t vec_width = width & ~static_cast<size_t>(3);
+  if (vec_width == 0) return 0;
+
+  const uint8_t* y_row = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_Y]) +
+                         y * sdr_intent->stride[UHDR_PLANE_Y];
+  const uint8_t* u_row = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_U]) +
+                         (y / 2) * sdr_intent->stride[UHDR_PLANE_U];
+  const uint8_t* v_row = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_V]) +
+                         (y / 2) * sdr_intent->stride[UHDR_PLANE_V];
+
+  const size_t y_lower = (std::min)(y / map_scale_factor, static_cast<size_t>(gainmap_img->h) - 1);
+  const size_t y_upper =
+      (std::min)(y / map_scale_factor + 1, static_cast<size_t>(gainmap_img->h) - 1);
+  const uint8_t* map_data = static_cast<uint8_t*>(gainmap_img->planes[UHDR_PLANE_Y]);
+  const size_t map_stride = gainmap_img->stride[UHDR_PLANE_Y];
+  const uint8_t* map_top = map_data + y_lower * map_stride;
+  const uint8_t* map_bottom = map_data + y_upper * map_stride;
+  const float* weights = (y_lower == y_upper) ? idwTable.mWeightsNB : idwTable.mWeights;
+  weights += (y % map_scale_factor) * map_scale_factor * 4;
+
+  const float* srgb_lut = getSrgbInvOetfLUT();
+  const uint16_t* code_lut = output_ct == UHDR_CT_HLG  ? getHlgCodeLUT()
+                            : output_ct == UHDR_CT_PQ ? getPqCodeLUT()
+                                                      : nullptr;
+  const float* gain_table = gainLUT.getGainTable();
+
+  const __m128i lanes = (__m128i)(v4i32){0, 1, 2, 3};
+  const __m128i scale_i = __lsx_vreplgr2vr_w(static_cast<int>(map_scale_factor));
+  const __m128 scale_f = splat_lsx(static_cast<float>(map_scale_factor));
+  const __m128 offset_sdr = splat_lsx(metadata->offset_sdr);
+  const __m128 offset_hdr = splat_lsx(metadata->offset_hdr);
+  const __m128 inv_255 = splat_lsx(1 / 255.0f);
+
+  uint8_t* dst = static_cast<uint8_t*>(dest->planes[UHDR_PLANE_PACKED]);
+  const size_t dst_offset = y * dest->stride[UHDR_PLANE_PACKED];
+
+  for (size_t x = 0; x < vec_width; x += 4) {
+    // yuv -> linear rgb
+    const __m128i luma =
+        __lsx_vsllwil_wu_hu(__lsx_vsllwil_hu_bu(__lsx_vldrepl_w(y_row + x, 0), 0), 0);
+    const __m128 y_f = __lsx_vfmul_s(__lsx_vffint_s_w(luma), inv_255);
+    const __m128 u_f = loadChroma_lsx(u_row + x / 2);
+    const __m128 v_f = loadChroma_lsx(v_row + x / 2);
+    __m128 r = clampPixelFloat_lsx(__lsx_vfmadd_s(splat_lsx(kP3Cr), v_f, y_f));
+    __m128 g = clampPixelFloat_lsx(__lsx_vfsub_s(
+        __lsx_vfsub_s(y_f, __lsx_vfmul_s(splat_lsx(kP3GCb), u_f)),
+        __lsx_vfmul_s(splat_lsx(kP3GCr), v_f)));
+    __m128 b = clampPixelFloat_lsx(__lsx_vfmadd_s(splat_lsx(kP3Cb), u_f, y_f));
+    r = lookup_lsx(srgb_lut, kSrgbInvOETFNumEntries, r);
+    g = lookup_lsx(srgb_lut, kSrgbInvOETFNumEntries, g);
+    b = lookup_lsx(srgb_lut, kSrgbInvOETFNumEntries, b);
+
+    // sample gain map, see sampleMap() with ShepardsIDW
+    const __m128i xs = __lsx_vadd_w(__lsx_vreplgr2vr_w(static_cast<int>(x)), lanes);
+    const __m128i x_lower = __lsx_vftintrz_w_s(
+        __lsx_vfdiv_s(__lsx_vfadd_s(__lsx_vffint_s_w(xs), splat_lsx(0.5f)), scale_f));
+    const __m128i x_upper = __lsx_vaddi_wu(x_lower, 1);
+    const __m128i w_idx = __lsx_vslli_w(__lsx_vsub_w(xs, __lsx_vmul_w(x_lower, scale_i)), 2);
+    const __m128 e1 = loadMap_lsx(map_top, x_lower);
+    const __m128 e2 = loadMap_lsx(map_bottom, x_lower);
+    const __m128 e3 = loadMap_lsx(map_top, x_upper);
+    const __m128 e4 = loadMap_lsx(map_bottom, x_upper);
+    __m128 gain = __lsx_vfmul_s(e1, gather_lsx(weights, w_idx));
+    gain = __lsx_vfmadd_s(e2, gather_lsx(weights + 1, w_idx), gain);
+    gain = __lsx_vfmadd_s(e3, gather_lsx(weights + 2, w_idx), gain);
+    gain = __lsx_vfmadd_s(e4, gather_lsx(weights + 3, w_idx), gain);
+
+    // apply gain, see applyGainLUT()
+    const __m128 gain_factor = lookup_lsx(gain_table, kGainFactorNumEntries, gain);
+    r = __lsx_vfsub_s(__lsx_vfmul_s(__lsx_vfadd_s(r, offset_sdr), gain_factor), offset_hdr);
+    g = __lsx_vfsub_s(__lsx_vfmul_s(__lsx_vfadd_s(g, offset_sdr), gain_factor), offset_hdr);
+    b = __lsx_vfsub_s(__lsx_vfmul_s(__lsx_vfadd_s(b, offset_sdr), gain_factor), offset_hdr);
+    if (gamut_matrix != nullptr) {
+      // output gamut, see getGamutConversionMatrix()
+      const __m128 r_out = dot3_lsx(gamut_matrix, r, g, b);
+      const __m128 g_out = dot3_lsx(gamut_matrix + 3, r, g, b);
+      b = dot3_lsx(gamut_matrix + 6, r, g, b);
+      r = r_out;
+      g = g_out;
+      // colors outside of the output gamut map to code 0 in the hlg and pq tables
+    }
+
+    if (output_ct == UHDR_CT_LINEAR) {
+      alignas(16) float rgb[3][4];
+      __lsx_vst((__m128i)r, rgb[0], 0);
+      __lsx_vst((__m128i)g, rgb[1], 0);
+      __lsx_vst((__m128i)b, rgb[2], 0);
+      uint64_t* out = reinterpret_cast<uint64_t*>(dst) + dst_offset + x;
+      for (int i = 0; i < 4; i++) {
+        out[i] = colorToRgbaF16({{{rgb[0][i], rgb[1][i], rgb[2][i]}}});
+      }
+    } else {
+      // scaling, inverse ootf, oetf and quantization in one lookup per component
+      __lsx_vst(toRgba1010102_lsx(code_lut, r, g, b), dst + (dst_offset + x) * sizeof(uint32_t),
+                0);
+    }
+  }
+
+  return vec_width;
+}
+
+// See computeGain()
+static inline __m128 computeGain_lsx(__m128 sdr, __m128 hdr) {
+  const __m128 ratio = __lsx_vfdiv_s(__lsx_vfadd_s(hdr, splat_lsx(kHdrOffset)),
+                                     __lsx_vfadd_s(sdr, splat_lsx(kSdrOffset)));
+  const __m128 gain = __lsx_vfmul_s(log_lsx(ratio), splat_lsx(1.44269504088896341f));
+  const __m128i dark = __lsx_vfcmp_clt_s(sdr, splat_lsx(2.f / 255.0f));
+  return (__m128)__lsx_vbitsel_v((__m128i)gain,
+                                 (__m128i)__lsx_vfmin_s(gain, splat_lsx(2.3f)), dark);
+}
+
+static inline void yuvToRgb_lsx(const float coeffs[4], const float* y, const float* u,
+                                const float* v, __m128& r, __m128& g, __m128& b) {
+  const __m128 y_f = (__m128)__lsx_vld(y, 0);
+  const __m128 u_f = (__m128)__lsx_vld(u, 0);
+  const __m128 v_f = (__m128)__lsx_vld(v, 0);
+  r = clampPixelFloat_lsx(__lsx_vfmadd_s(splat_lsx(coeffs[0]), v_f, y_f));
+  g = clampPixelFloat_lsx(
+      __lsx_vfsub_s(__lsx_vfsub_s(y_f, __lsx_vfmul_s(splat_lsx(coeffs[1]), u_f)),
+                    __lsx_vfmul_s(splat_lsx(coeffs[2]), v_f)));
+  b = clampPixelFloat_lsx(__lsx_vfmadd_s(splat_lsx(coeffs[3]), u_f, y_f));
+}
+
+size_t generateGainMapRow_lsx(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* hdr_intent,
+                              const GainMapRowParams& params, size_t map_scale_factor,
+                              size_t map_width, size_t y, float* gains) {
+  const size_t vec_width = map_width & ~static_cast<size_t>(3);
+  alignas(16) float sdr_yuv[3][kGainMapRowChunk];
+  alignas(16) float hdr_yuv[3][kGainMapRowChunk];
+  float* sdr_planes[3] = {sdr_yuv[0], sdr_yuv[1], sdr_yuv[2]};
+  float* hdr_planes[3] = {hdr_yuv[0], hdr_yuv[1], hdr_yuv[2]};
+  const float* srgb_lut = getSrgbInvOetfLUT();
+  const float* m = params.hdr_gamut_matrix.data();
+  const __m128 sdr_nits = splat_lsx(kSdrWhiteNits);
+  const __m128 hdr_nits = splat_lsx(params.hdr_sample_to_nits);
+  const __m128 zero = splat_lsx(0.0f);
+
+  for (size_t x = 0; x < vec_width; x += 4) {
+    const size_t chunk_x = x % kGainMapRowChunk;
+    if (chunk_x == 0) {
+      const size_t len = (std::min)(kGainMapRowChunk, vec_width - x);
+      sampleYuv420Row(sdr_intent, map_scale_factor, x, y, len, sdr_planes);
+      sampleP010Row(hdr_intent, map_scale_factor, x, y, len, hdr_planes);
+    }
+
+    // sdr yuv -> linear rgb
+    __m128 sr, sg, sb;
+    yuvToRgb_lsx(params.sdr_yuv_to_rgb, sdr_yuv[0] + chunk_x, sdr_yuv[1] + chunk_x,
+                 sdr_yuv[2] + chunk_x, sr, sg, sb);
+    sr = lookup_lsx(srgb_lut, kSrgbInvOETFNumEntries, sr);
+    sg = lookup_lsx(srgb_lut, kSrgbInvOETFNumEntries, sg);
+    sb = lookup_lsx(srgb_lut, kSrgbInvOETFNumEntries, sb);
+
+    // hdr yuv -> linear rgb in sdr gamut
+    __m128 hr, hg, hb;
+    yuvToRgb_lsx(params.hdr_yuv_to_rgb, hdr_yuv[0] + chunk_x, hdr_yuv[1] + chunk_x,
+                 hdr_yuv[2] + chunk_x, hr, hg, hb);
+    hr = lookup_lsx(params.hdr_inv_oetf_lut, params.hdr_inv_oetf_entries, hr);
+    hg = lookup_lsx(params.hdr_inv_oetf_lut, params.hdr_inv_oetf_entries, hg);
+    hb = lookup_lsx(params.hdr_inv_oetf_lut, params.hdr_inv_oetf_entries, hb);
+    if (params.hdr_ootf_gamma != 1.0f) {
+      hr = pow_lsx(hr, params.hdr_ootf_gamma);
+      hg = pow_lsx(hg, params.hdr_ootf_gamma);
+      hb = pow_lsx(hb, params.hdr_ootf_gamma);
+    }
+    const __m128 cr = dot3_lsx(m, hr, hg, hb);
+    const __m128 cg = dot3_lsx(m + 3, hr, hg, hb);
+    const __m128 cb = dot3_lsx(m + 6, hr, hg, hb);
+    hr = __lsx_vfmax_s(cr, zero);
+    hg = __lsx_vfmax_s(cg, zero);
+    hb = __lsx_vfmax_s(cb, zero);
+
+    if (params.multichannel) {
+      alignas(16) float out[3][4];
+      const __m128 gr = computeGain_lsx(__lsx_vfmul_s(sr, sdr_nits), __lsx_vfmul_s(hr, hdr_nits));
+      const __m128 gg = computeGain_lsx(__lsx_vfmul_s(sg, sdr_nits), __lsx_vfmul_s(hg, hdr_nits));
+      const __m128 gb = computeGain_lsx(__lsx_vfmul_s(sb, sdr_nits), __lsx_vfmul_s(hb, hdr_nits));
+      __lsx_vst((__m128i)gr, out[0], 0);
+      __lsx_vst((__m128i)gg, out[1], 0);
+      __lsx_vst((__m128i)gb, out[2], 0);
+      for (int i = 0; i < 4; i++) {
+        gains[(x + i) * 3] = out[0][i];
+        gains[(x + i) * 3 + 1] = out[1][i];
+        gains[(x + i) * 3 + 2] = out[2][i];
+      }
+    } else {
+      __m128 sdr_y, hdr_y;
+      if (params.use_luminance) {
+        sdr_y = dot3_lsx(params.luminance.data(), sr, sg, sb);
+        hdr_y = dot3_lsx(params.luminance.data(), hr, hg, hb);
+      } else {
+        sdr_y = __lsx_vfmax_s(sr, __lsx_vfmax_s(sg, sb));
+        hdr_y = __lsx_vfmax_s(hr, __lsx_vfmax_s(hg, hb));
+      }
+      const __m128 gain =
+          computeGain_lsx(__lsx_vfmul_s(sdr_y, sdr_nits), __lsx_vfmul_s(hdr_y, hdr_nits));
+      __lsx_vst((__m128i)gain, gains + x, 0);
+    }
+  }
+
+  return vec_width;
+}
+
+// c1 * u + c2 * v of 8 unbiased chroma samples, rounded and saturated like yuvGamutConversionQ14()
+static inline __m128i yuvConversion_lsx(__m128i u, __m128i v, __m128i c1, __m128i c2) {
+  __m128i lo = __lsx_vmadd_w(__lsx_vmul_w(__lsx_vsllwil_w_h(u, 0), c1), __lsx_vsllwil_w_h(v, 0),
+                             c2);
+  __m128i hi = __lsx_vmadd_w(__lsx_vmul_w(__lsx_vexth_w_h(u), c1), __lsx_vexth_w_h(v), c2);
+  lo = __lsx_vsat_w(__lsx_vsrari_w(lo, 14), 15);
+  hi = __lsx_vsat_w(__lsx_vsrari_w(hi, 14), 15);
+  return __lsx_vpickev_h(hi, lo);
+}
+
+// Narrows two vectors of 16 bit values to 8 bits with unsigned saturation, lo in the low half
+static inline __m128i packus_lsx(__m128i lo, __m128i hi) {
+  lo = __lsx_vsat_hu(__lsx_vmaxi_h(lo, 0), 7);
+  hi = __lsx_vsat_hu(__lsx_vmaxi_h(hi, 0), 7);
+  return __lsx_vpickev_b(hi, lo);
+}
+
+// Adds the luma offsets of 16 pixels to a row and narrows back with saturation
+static inline void addLuma_lsx(uint8_t* row, __m128i dy_lo, __m128i dy_hi) {
+  const __m128i luma = __lsx_vld(row, 0);
+  const __m128i lo = __lsx_vadd_h(__lsx_vsllwil_hu_bu(luma, 0), dy_lo);
+  const __m128i hi = __lsx_vadd_h(__lsx_vexth_hu_bu(luma), dy_hi);
+  __lsx_vst(packus_lsx(lo, hi), row, 0);
+}
+
+static inline __m128i loadUnbiasedChroma_lsx(const uint8_t* src) {
+  // 128 bias for UV given we are using libjpeg
+  return __lsx_vsub_h(__lsx_vsllwil_hu_bu(__lsx_vldrepl_d(src, 0), 0), __lsx_vreplgr2vr_h(128));
+}
+
+// Stores the 8 bit narrowing of 8 values of 16 bit
+static inline void store8_lsx(uint8_t* dst, __m128i v) {
+  __lsx_vstelm_d(packus_lsx(v, v), dst, 0, 0);
+}
+
+void transformYuv420_lsx(uhdr_raw_image_t* image, const int16_t* coeffs_ptr) {
+  const __m128i c_y[2] = {__lsx_vreplgr2vr_w(coeffs_ptr[0]), __lsx_vreplgr2vr_w(coeffs_ptr[1])};
+  const __m128i c_u[2] = {__lsx_vreplgr2vr_w(coeffs_ptr[2]), __lsx_vreplgr2vr_w(coeffs_ptr[3])};
+  const __m128i c_v[2] = {__lsx_vreplgr2vr_w(coeffs_ptr[4]), __lsx_vreplgr2vr_w(coeffs_ptr[5])};
+  const __m128i bias = __lsx_vreplgr2vr_h(128);
+  const size_t vec_width = (image->w / 2) & ~size_t(7);
+
+  for (size_t h = 0; h < image->h / 2; ++h) {
+    uint8_t* y0_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_Y]) + h * 2 * image->stride[UHDR_PLANE_Y];
+    uint8_t* y1_ptr = y0_ptr + image->stride[UHDR_PLANE_Y];
+    uint8_t* u_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_U]) + h * image->stride[UHDR_PLANE_U];
+    uint8_t* v_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_V]) + h * image->stride[UHDR_PLANE_V];
+
+    for (size_t w = 0; w < vec_width; w += 8) {
+      const __m128i u = loadUnbiasedChroma_lsx(u_ptr + w);
+      const __m128i v = loadUnbiasedChroma_lsx(v_ptr + w);
+
+      // the luma offset only depends on chroma, each one is shared by a 2x2 block
+      const __m128i dy = yuvConversion_lsx(u, v, c_y[0], c_y[1]);
+      const __m128i dy_lo = __lsx_vilvl_h(dy, dy);
+      const __m128i dy_hi = __lsx_vilvh_h(dy, dy);
+      addLuma_lsx(y0_ptr + w * 2, dy_lo, dy_hi);
+      addLuma_lsx(y1_ptr + w * 2, dy_lo, dy_hi);
+
+      store8_lsx(u_ptr + w, __lsx_vadd_h(yuvConversion_lsx(u, v, c_u[0], c_u[1]), bias));
+      store8_lsx(v_ptr + w, __lsx_vadd_h(yuvConversion_lsx(u, v, c_v[0], c_v[1]), bias));
+    }
+    transformYuv420RowQ14(image, coeffs_ptr, vec_width, h);
+  }
+}
+
+void transformYuv444_lsx(uhdr_raw_image_t* image, const int16_t* coeffs_ptr) {
+  const __m128i c_y[2] = {__lsx_vreplgr2vr_w(coeffs_ptr[0]), __lsx_vreplgr2vr_w(coeffs_ptr[1])};
+  const __m128i c_u[2] = {__lsx_vreplgr2vr_w(coeffs_ptr[2]), __lsx_vreplgr2vr_w(coeffs_ptr[3])};
+  const __m128i c_v[2] = {__lsx_vreplgr2vr_w(coeffs_ptr[4]), __lsx_vreplgr2vr_w(coeffs_ptr[5])};
+  const __m128i bias = __lsx_vreplgr2vr_h(128);
+  const size_t vec_width = image->w & ~size_t(7);
+
+  for (size_t h = 0; h < image->h; ++h) {
+    uint8_t* y_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_Y]) + h * image->stride[UHDR_PLANE_Y];
+    uint8_t* u_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_U]) + h * image->stride[UHDR_PLANE_U];
+    uint8_t* v_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_V]) + h * image->stride[UHDR_PLANE_V];
+
+    for (size_t w = 0; w < vec_width; w += 8) {
+      const __m128i u = loadUnbiasedChroma_lsx(u_ptr + w);
+      const __m128i v = loadUnbiasedChroma_lsx(v_ptr + w);
+      const __m128i luma = __lsx_vsllwil_hu_bu(__lsx_vldrepl_d(y_ptr + w, 0), 0);
+
+      store8_lsx(y_ptr + w, __lsx_vadd_h(luma, yuvConversion_lsx(u, v, c_y[0], c_y[1])));
+      store8_lsx(u_ptr + w, __lsx_vadd_h(yuvConversion_lsx(u, v, c_u[0], c_u[1]), bias));
+      store8_lsx(v_ptr + w, __lsx_vadd_h(yuvConversion_lsx(u, v, c_v[0], c_v[1]), bias));
+    }
+    transformYuv444RowQ14(image, coeffs_ptr, vec_width, h);
+  }
+}
+
+uhdr_error_info_t convertYuv_lsx(uhdr_raw_image_t* image, uhdr_color_gamut_t src_encoding,
+                                 uhdr_color_gamut_t dst_encoding) {
+  return convertYuvQ14(image, src_encoding, dst_encoding, transformYuv420_lsx,
+                       transformYuv444_lsx);
+}
+
+}  // namespace ultrahdr
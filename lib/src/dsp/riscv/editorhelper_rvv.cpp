@@ -0,0 +1,179 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ultrahdr/editorhelper.h"
+
+#include <riscv_vector.h>
+#include <cstddef>
+#include <cstring>
+
+// The library is built for the baseline isa of the target. The kernels in this file are compiled
+// for the vector extension individually and are only reached after a runtime check of the cpu
+// features.
+#define UHDR_TARGET_RVV __attribute__((target("arch=+v")))
+
+namespace ultrahdr {
+
+// Vector type and accesses for elements of T. Strides are in bytes and may be negative.
+template <typename T>
+struct rvv_ops;
+
+template <>
+struct rvv_ops<uint8_t> {
+  UHDR_TARGET_RVV static inline size_t setvl(size_t n) { return __riscv_vsetvl_e8m1(n); }
+
+  UHDR_TARGET_RVV static inline vuint8m1_t load_strided(const uint8_t* p, ptrdiff_t stride,
+                                                        size_t vl) {
+    return __riscv_vlse8_v_u8m1(p, stride, vl);
+  }
+
+  UHDR_TARGET_RVV static inline void store(uint8_t* p, vuint8m1_t v, size_t vl) {
+    __riscv_vse8_v_u8m1(p, v, vl);
+  }
+};
+
+template <>
+struct rvv_ops<uint16_t> {
+  UHDR_TARGET_RVV static inline size_t setvl(size_t n) { return __riscv_vsetvl_e16m1(n); }
+
+  UHDR_TARGET_RVV static inline vuint16m1_t load_strided(const uint16_t* p, ptrdiff_t stride,
+                                                         size_t vl) {
+    return __riscv_vlse16_v_u16m1(p, stride, vl);
+  }
+
+  UHDR_TARGET_RVV static inline void store(uint16_t* p, vuint16m1_t v, size_t vl) {
+    __riscv_vse16_v_u16m1(p, v, vl);
+  }
+};
+
+template <>
+struct rvv_ops<uint32_t> {
+  UHDR_TARGET_RVV static inline size_t setvl(size_t n) { return __riscv_vsetvl_e32m1(n); }
+
+  UHDR_TARGET_RVV static inline vuint32m1_t load_strided(const uint32_t* p, ptrdiff_t stride,
+                                                         size_t vl) {
+    return __riscv_vlse32_v_u32m1(p, stride, vl);
+  }
+
+  UHDR_TARGET_RVV static inline void store(uint32_t* p, vuint32m1_t v, size_t vl) {
+    __riscv_vse32_v_u32m1(p, v, vl);
+  }
+};
+
+template <>
+struct rvv_ops<uint64_t> {
+  UHDR_TARGET_RVV static inline size_t setvl(size_t n) { return __riscv_vsetvl_e64m1(n); }
+
+  UHDR_TARGET_RVV static inline vuint64m1_t load_strided(const uint64_t* p, ptrdiff_t stride,
+                                                         size_t vl) {
+    return __riscv_vlse64_v_u64m1(p, stride, vl);
+  }
+
+  UHDR_TARGET_RVV static inline void store(uint64_t* p, vuint64m1_t v, size_t vl) {
+    __riscv_vse64_v_u64m1(p, v, vl);
+  }
+};
+
+// dst[j] = src[w - 1 - j], read with a negative stride
+template <typename T>
+UHDR_TARGET_RVV static void reverse_row(const T* src, T* dst, int w) {
+  using ops = rvv_ops<T>;
+  for (size_t j = 0; j < (size_t)w;) {
+    const size_t vl = ops::setvl(w - j);
+    ops::store(dst + j, ops::load_strided(src + w - 1 - j, -(ptrdiff_t)sizeof(T), vl), vl);
+    j += vl;
+  }
+}
+
+template <typename T>
+UHDR_TARGET_RVV void mirror_buffer_rvv(T* src_buffer, T* dst_buffer, int src_w, int src_h,
+                                       int src_stride, int dst_stride,
+                                       uhdr_mirror_direction_t direction) {
+  if (direction == UHDR_MIRROR_VERTICAL) {
+    for (int i = 0; i < src_h; i++) {
+      memcpy(&dst_buffer[(size_t)(src_h - i - 1) * dst_stride],
+             &src_buffer[(size_t)i * src_stride], src_w * sizeof(T));
+    }
+  } else if (direction == UHDR_MIRROR_HORIZONTAL) {
+    for (int i = 0; i < src_h; i++) {
+      reverse_row(&src_buffer[(size_t)i * src_stride], &dst_buffer[(size_t)i * dst_stride], src_w);
+    }
+  }
+}
+
+// Rotates by 90 or 270 degrees. Output rows are assembled from strided loads down a source column.
+// The output is filled in vertical strips one vector wide, so the source rows a strip reads stay
+// in cache while its rows are written.
+template <typename T>
+UHDR_TARGET_RVV static void rotate_buffer_transpose_rvv(T* src_buffer, T* dst_buffer, int src_w,
+                                                        int src_h, int src_stride, int dst_stride,
+                                                        int degree) {
+  using ops = rvv_ops<T>;
+  const int dst_w = src_h, dst_h = src_w;
+  const ptrdiff_t row_bytes = (ptrdiff_t)src_stride * sizeof(T);
+
+  for (size_t j0 = 0; j0 < (size_t)dst_w;) {
+    const size_t vl = ops::setvl(dst_w - j0);
+    for (int i = 0; i < dst_h; i++) {
+      T* dst = &dst_buffer[(size_t)i * dst_stride + j0];
+      if (degree == 90) {
+        // dst[i][j] = src[src_h - 1 - j][i]
+        ops::store(dst,
+                   ops::load_strided(&src_buffer[(size_t)(src_h - 1 - j0) * src_stride + i],
+                                     -row_bytes, vl),
+                   vl);
+      } else {
+        // dst[i][j] = src[j][src_w - 1 - i]
+        ops::store(dst,
+                   ops::load_strided(&src_buffer[j0 * src_stride + (src_w - 1 - i)], row_bytes,
+                                     vl),
+                   vl);
+      }
+    }
+    j0 += vl;
+  }
+}
+
+template <typename T>
+UHDR_TARGET_RVV void rotate_buffer_clockwise_rvv(T* src_buffer, T* dst_buffer, int src_w,
+                                                 int src_h, int src_stride, int dst_stride,
+                                                 int degrees) {
+  if (degrees == 90 || degrees == 270) {
+    rotate_buffer_transpose_rvv(src_buffer, dst_buffer, src_w, src_h, src_stride, dst_stride,
+                                degrees);
+  } else if (degrees == 180) {
+    for (int i = 0; i < src_h; i++) {
+      reverse_row(&src_buffer[(size_t)(src_h - 1 - i) * src_stride],
+                  &dst_buffer[(size_t)i * dst_stride], src_w);
+    }
+  }
+}
+
+template void mirror_buffer_rvv<uint8_t>(uint8_t*, uint8_t*, int, int, int, int,
+                                         uhdr_mirror_direction_t);
+template void mirror_buffer_rvv<uint16_t>(uint16_t*, uint16_t*, int, int, int, int,
+                                          uhdr_mirror_direction_t);
+template void mirror_buffer_rvv<uint32_t>(uint32_t*, uint32_t*, int, int, int, int,
+                                          uhdr_mirror_direction_t);
+template void mirror_buffer_rvv<uint64_t>(uint64_t*, uint64_t*, int, int, int, int,
+                                          uhdr_mirror_direction_t);
+
+template void rotate_buffer_clockwise_rvv<uint8_t>(uint8_t*, uint8_t*, int, int, int, int, int);
+template void rotate_buffer_clockwise_rvv<uint16_t>(uint16_t*, uint16_t*, int, int, int, int, int);
+template void rotate_buffer_clockwise_rvv<uint32_t>(uint32_t*, uint32_t*, int, int, int, int, int);
+template void rotate_buffer_clockwise_rvv<uint64_t>(uint64_t*, uint64_t*, int, int, int, int, int);
+
+}  // namespace ultrahdr
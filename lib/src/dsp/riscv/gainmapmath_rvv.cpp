@@ -0,0 +1,481 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ultrahdr/gainmapmath.h"
+
+#include <riscv_vector.h>
+#include <algorithm>
+#include <cfloat>
+
+// The library is built for the baseline isa of the target. The kernels in this file are compiled
+// for the vector extension individually and are only reached after a runtime check of the cpu
+// features. They are vector length agnostic, any VLEN the hardware offers is used.
+#define UHDR_TARGET_RVV __attribute__((target("arch=+v")))
+
+namespace ultrahdr {
+
+// Rec.601 yuv -> rgb coefficients, see p3YuvToRgb()
+static const float kP3Cb = 1.772f, kP3Cr = 1.402f;
+static const float kP3GCb = 0.114f * kP3Cb / 0.587f;
+static const float kP3GCr = 0.299f * kP3Cr / 0.587f;
+
+// Upper bound of the lanes processed per iteration of the gain map kernel. Half float output is
+// converted by the scalar helper through a buffer of this size.
+static const size_t kMaxGainMapLanes = 64;
+
+// Natural logarithm for x > 0, see Cephes logf(). Relative error is in the order of 1e-7.
+UHDR_TARGET_RVV static inline vfloat32m2_t log_rvv(vfloat32m2_t x, size_t vl) {
+  const vuint32m2_t bits = __riscv_vreinterpret_v_f32m2_u32m2(x);
+  vfloat32m2_t e = __riscv_vfcvt_f_x_v_f32m2(
+      __riscv_vsub_vx_i32m2(
+          __riscv_vreinterpret_v_u32m2_i32m2(__riscv_vsrl_vx_u32m2(bits, 23, vl)), 127, vl),
+      vl);
+  vfloat32m2_t m = __riscv_vreinterpret_v_u32m2_f32m2(
+      __riscv_vor_vx_u32m2(__riscv_vand_vx_u32m2(bits, 0x007fffff, vl), 0x3f800000, vl));
+
+  // move the mantissa to [sqrt(0.5), sqrt(2))
+  const vbool16_t big = __riscv_vmfgt_vf_f32m2_b16(m, 1.41421356f, vl);
+  m = __riscv_vmerge_vvm_f32m2(m, __riscv_vfmul_vf_f32m2(m, 0.5f, vl), big, vl);
+  e = __riscv_vmerge_vvm_f32m2(e, __riscv_vfadd_vf_f32m2(e, 1.0f, vl), big, vl);
+
+  const vfloat32m2_t t = __riscv_vfsub_vf_f32m2(m, 1.0f, vl);
+  const vfloat32m2_t z = __riscv_vfmul_vv_f32m2(t, t, vl);
+  vfloat32m2_t p = __riscv_vfmv_v_f_f32m2(7.0376836292E-2f, vl);
+  p = __riscv_vfadd_vf_f32m2(__riscv_vfmul_vv_f32m2(p, t, vl), -1.1514610310E-1f, vl);
+  p = __riscv_vfadd_vf_f32m2(__riscv_vfmul_vv_f32m2(p, t, vl), 1.1676998740E-1f, vl);
+  p = __riscv_vfadd_vf_f32m2(__riscv_vfmul_vv_f32m2(p, t, vl), -1.2420140846E-1f, vl);
+  p = __riscv_vfadd_vf_f32m2(__riscv_vfmul_vv_f32m2(p, t, vl), 1.4249322787E-1f, vl);
+  p = __riscv_vfadd_vf_f32m2(__riscv_vfmul_vv_f32m2(p, t, vl), -1.6668057665E-1f, vl);
+  p = __riscv_vfadd_vf_f32m2(__riscv_vfmul_vv_f32m2(p, t, vl), 2.0000714765E-1f, vl);
+  p = __riscv_vfadd_vf_f32m2(__riscv_vfmul_vv_f32m2(p, t, vl), -2.4999993993E-1f, vl);
+  p = __riscv_vfadd_vf_f32m2(__riscv_vfmul_vv_f32m2(p, t, vl), 3.3333331174E-1f, vl);
+  p = __riscv_vfmul_vv_f32m2(__riscv_vfmul_vv_f32m2(p, t, vl), z, vl);
+  p = __riscv_vfadd_vv_f32m2(p, __riscv_vfmul_vf_f32m2(e, -2.12194440e-4f, vl), vl);
+  p = __riscv_vfsub_vv_f32m2(p, __riscv_vfmul_vf_f32m2(z, 0.5f, vl), vl);
+  return __riscv_vfadd_vv_f32m2(__riscv_vfadd_vv_f32m2(t, p, vl),
+                                __riscv_vfmul_vf_f32m2(e, 0.693359375f, vl), vl);
+}
+
+// Natural exponent, see Cephes expf(). Inputs are clamped to the range of normal floats.
+UHDR_TARGET_RVV static inline vfloat32m2_t exp_rvv(vfloat32m2_t x, size_t vl) {
+  x = __riscv_vfmin_vf_f32m2(__riscv_vfmax_vf_f32m2(x, -87.3f, vl), 88.3f, vl);
+  // the default rounding mode, round to nearest even, is in effect
+  const vint32m2_t n_i =
+      __riscv_vfcvt_x_f_v_i32m2(__riscv_vfmul_vf_f32m2(x, 1.44269504088896341f, vl), vl);
+  const vfloat32m2_t n = __riscv_vfcvt_f_x_v_f32m2(n_i, vl);
+  x = __riscv_vfsub_vv_f32m2(x, __riscv_vfmul_vf_f32m2(n, 0.693359375f, vl), vl);
+  x = __riscv_vfsub_vv_f32m2(x, __riscv_vfmul_vf_f32m2(n, -2.12194440e-4f, vl), vl);
+
+  const vfloat32m2_t z = __riscv_vfmul_vv_f32m2(x, x, vl);
+  vfloat32m2_t p = __riscv_vfmv_v_f_f32m2(1.9875691500E-4f, vl);
+  p = __riscv_vfadd_vf_f32m2(__riscv_vfmul_vv_f32m2(p, x, vl), 1.3981999507E-3f, vl);
+  p = __riscv_vfadd_vf_f32m2(__riscv_vfmul_vv_f32m2(p, x, vl), 8.3334519073E-3f, vl);
+  p = __riscv_vfadd_vf_f32m2(__riscv_vfmul_vv_f32m2(p, x, vl), 4.1665795894E-2f, vl);
+  p = __riscv_vfadd_vf_f32m2(__riscv_vfmul_vv_f32m2(p, x, vl), 1.6666665459E-1f, vl);
+  p = __riscv_vfadd_vf_f32m2(__riscv_vfmul_vv_f32m2(p, x, vl), 5.0000001201E-1f, vl);
+  p = __riscv_vfadd_vf_f32m2(
+      __riscv_vfadd_vv_f32m2(__riscv_vfmul_vv_f32m2(p, z, vl), x, vl), 1.0f, vl);
+
+  const vint32m2_t scale = __riscv_vsll_vx_i32m2(__riscv_vadd_vx_i32m2(n_i, 127, vl), 23, vl);
+  return __riscv_vfmul_vv_f32m2(p, __riscv_vreinterpret_v_i32m2_f32m2(scale), vl);
+}
+
+// x^p for x > 0. Like std::pow() for a non-integer p, non-positive inputs do not produce a usable
+// result, they are mapped to 0 which is where the following table lookup clamps them anyway.
+UHDR_TARGET_RVV static inline vfloat32m2_t pow_rvv(vfloat32m2_t x, float p, size_t vl) {
+  const vbool16_t positive = __riscv_vmfgt_vf_f32m2_b16(x, 0.0f, vl);
+  x = __riscv_vfmax_vf_f32m2(x, FLT_MIN, vl);
+  const vfloat32m2_t r = exp_rvv(__riscv_vfmul_vf_f32m2(log_rvv(x, vl), p, vl), vl);
+  return __riscv_vmerge_vvm_f32m2(__riscv_vfmv_v_f_f32m2(0.0f, vl), r, positive, vl);
+}
+
+// table[idx], indexed loads take byte offsets
+UHDR_TARGET_RVV static inline vfloat32m2_t gather_rvv(const float* table, vuint32m2_t idx,
+                                                      size_t vl) {
+  return __riscv_vluxei32_v_f32m2(table, __riscv_vsll_vx_u32m2(idx, 2, vl), vl);
+}
+
+// Vector counterpart of the *LUT() transfer functions
+UHDR_TARGET_RVV static inline vfloat32m2_t lookup_rvv(const float* table, int num_entries,
+                                                      vfloat32m2_t e, size_t vl) {
+  vint32m2_t idx = __riscv_vfcvt_rtz_x_f_v_i32m2(
+      __riscv_vfadd_vf_f32m2(
+          __riscv_vfmul_vf_f32m2(e, static_cast<float>(num_entries - 1), vl), 0.5f, vl),
+      vl);
+  idx = __riscv_vmin_vx_i32m2(__riscv_vmax_vx_i32m2(idx, 0, vl), num_entries - 1, vl);
+  return gather_rvv(table, __riscv_vreinterpret_v_i32m2_u32m2(idx), vl);
+}
+
+UHDR_TARGET_RVV static inline vfloat32m2_t clampPixelFloat_rvv(vfloat32m2_t e, size_t vl) {
+  return __riscv_vfmin_vf_f32m2(__riscv_vfmax_vf_f32m2(e, 0.0f, vl), kMaxPixelFloat, vl);
+}
+
+// Each chroma sample covers two horizontally adjacent luma samples, half_x holds the chroma
+// column of every lane
+UHDR_TARGET_RVV static inline vfloat32m2_t loadChroma_rvv(const uint8_t* row, vuint32m2_t half_x,
+                                                          size_t vl) {
+  const vuint32m2_t c = __riscv_vzext_vf4_u32m2(__riscv_vluxei32_v_u8mf2(row, half_x, vl), vl);
+  const vint32m2_t unbiased =
+      __riscv_vsub_vx_i32m2(__riscv_vreinterpret_v_u32m2_i32m2(c), 128, vl);
+  return __riscv_vfmul_vf_f32m2(__riscv_vfcvt_f_x_v_f32m2(unbiased, vl), 1 / 255.0f, vl);
+}
+
+UHDR_TARGET_RVV static inline vfloat32m2_t loadMap_rvv(const uint8_t* row, vuint32m2_t idx,
+                                                       size_t vl) {
+  const vuint32m2_t v = __riscv_vzext_vf4_u32m2(__riscv_vluxei32_v_u8mf2(row, idx, vl), vl);
+  return __riscv_vfdiv_vf_f32m2(__riscv_vfcvt_f_xu_v_f32m2(v, vl), 255.0f, vl);
+}
+
+// Vector counterpart of hdrCodeLUTIndex() and the code table lookup
+UHDR_TARGET_RVV static inline vuint32m2_t lookupCodes_rvv(const uint16_t* table, vfloat32m2_t e,
+                                                          size_t vl) {
+  vint32m2_t idx = __riscv_vsub_vx_i32m2(
+      __riscv_vsra_vx_i32m2(__riscv_vreinterpret_v_f32m2_i32m2(e), kHdrCodeLUTShift, vl),
+      kHdrCodeLUTBias, vl);
+  idx = __riscv_vmin_vx_i32m2(__riscv_vmax_vx_i32m2(idx, 0, vl), kHdrCodeLUTNumEntries - 1, vl);
+  const vuint32m2_t offsets = __riscv_vsll_vx_u32m2(__riscv_vreinterpret_v_i32m2_u32m2(idx), 1, vl);
+  return __riscv_vzext_vf2_u32m2(__riscv_vluxei32_v_u16m1(table, offsets, vl), vl);
+}
+
+// See hlgLinearToRgba1010102() and pqLinearToRgba1010102()
+UHDR_TARGET_RVV static inline vuint32m2_t toRgba1010102_rvv(const uint16_t* table, vfloat32m2_t r,
+                                                            vfloat32m2_t g, vfloat32m2_t b,
+                                                            size_t vl) {
+  vuint32m2_t out = lookupCodes_rvv(table, r, vl);
+  out = __riscv_vor_vv_u32m2(out, __riscv_vsll_vx_u32m2(lookupCodes_rvv(table, g, vl), 10, vl), vl);
+  out = __riscv_vor_vv_u32m2(out, __riscv_vsll_vx_u32m2(lookupCodes_rvv(table, b, vl), 20, vl), vl);
+  return __riscv_vor_vx_u32m2(out, 0xc0000000u, vl);  // alpha to 1.0
+}
+
+UHDR_TARGET_RVV static inline vfloat32m2_t dot3_rvv(const float* k, vfloat32m2_t r,
+                                                    vfloat32m2_t g, vfloat32m2_t b, size_t vl) {
+  vfloat32m2_t acc = __riscv_vfmul_vf_f32m2(r, k[0], vl);
+  acc = __riscv_vfmacc_vf_f32m2(acc, k[1], g, vl);
+  return __riscv_vfmacc_vf_f32m2(acc, k[2], b, vl);
+}
+
+UHDR_TARGET_RVV size_t applyGainMapRowYuv420_rvv(
+    uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* gainmap_img, uhdr_raw_image_t* dest,
+    size_t map_scale_factor, ShepardsIDW& idwTable, GainLUT& gainLUT,
+    uhdr_gainmap_metadata_ext_t* metadata, uhdr_color_transfer_t output_ct,
+    const float* gamut_matrix, size_t y) {
+  if (output_ct != UHDR_CT_LINEAR && output_ct != UHDR_CT_HLG && output_ct != UHDR_CT_PQ) return 0;
+
+  // pixels whose gain map neighbourhood is clamped at the right edge are left to the caller
+  const size_t map_w = gainmap_img->w;
+  if (map_w < 2) return 0;
+  const size_t width =
+      (std::min)(static_cast<size_t>(sdr_intent->w), (map_w - 1) * map_scale_factor);
+
+  const uint8_t* y_row = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_Y]) +
+                         y * sdr_intent->stride[UHDR_PLANE_Y];
+  const uint8_t* u_row = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_U]) +
+                         (y / 2) * sdr_intent->stride[UHDR_PLANE_U];
+  const uint8_t* v_row = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_V]) +
+                         (y / 2) * sdr_intent->stride[UHDR_PLANE_V];
+
+  const size_t y_lower = (std::min)(y / map_scale_factor, static_cast<size_t>(gainmap_img->h) - 1);
+  const size_t y_upper =
+      (std::min)(y / map_scale_factor + 1, static_cast<size_t>(gainmap_img->h) - 1);
+  const uint8_t* map_data = static_cast<uint8_t*>(gainmap_img->planes[UHDR_PLANE_Y]);
+  const size_t map_stride = gainmap_img->stride[UHDR_PLANE_Y];
+  const uint8_t* map_top = map_data + y_lower * map_stride;
+  const uint8_t* map_bottom = map_data + y_upper * map_stride;
+  const float* weights = (y_lower == y_upper) ? idwTable.mWeightsNB : idwTable.mWeights;
+  weights += (y % map_scale_factor) * map_scale_factor * 4;
+
+  const float* srgb_lut = getSrgbInvOetfLUT();
+  const uint16_t* code_lut = output_ct == UHDR_CT_HLG  ? getHlgCodeLUT()
+                            : output_ct == UHDR_CT_PQ ? getPqCodeLUT()
+                                                      : nullptr;
+  const float* gain_table = gainLUT.getGainTable();
+  const uint32_t scale_i = static_cast<uint32_t>(map_scale_factor);
+  const float scale_f = static_cast<float>(map_scale_factor);
+
+  uint8_t* dst = static_cast<uint8_t*>(dest->planes[UHDR_PLANE_PACKED]);
+  const size_t dst_offset = y * dest->stride[UHDR_PLANE_PACKED];
+
+  for (size_t x = 0; x < width;) {
+    const size_t vl = __riscv_vsetvl_e32m2((std::min)(width - x, kMaxGainMapLanes));
+    const vuint32m2_t xs = __riscv_vadd_vx_u32m2(__riscv_vid_v_u32m2(vl),
+                                                 static_cast<uint32_t>(x), vl);
+
+    // yuv -> linear rgb
+    const vuint32m2_t luma = __riscv_vzext_vf4_u32m2(__riscv_vle8_v_u8mf2(y_row + x, vl), vl);
+    const vfloat32m2_t y_f =
+        __riscv_vfmul_vf_f32m2(__riscv_vfcvt_f_xu_v_f32m2(luma, vl), 1 / 255.0f, vl);
+    const vuint32m2_t half_x = __riscv_vsrl_vx_u32m2(xs, 1, vl);
+    const vfloat32m2_t u_f = loadChroma_rvv(u_row, half_x, vl);
+    const vfloat32m2_t v_f = loadChroma_rvv(v_row, half_x, vl);
+    vfloat32m2_t r = clampPixelFloat_rvv(
+        __riscv_vfadd_vv_f32m2(y_f, __riscv_vfmul_vf_f32m2(v_f, kP3Cr, vl), vl), vl);
+    vfloat32m2_t g = clampPixelFloat_rvv(
+        __riscv_vfsub_vv_f32m2(
+            __riscv_vfsub_vv_f32m2(y_f, __riscv_vfmul_vf_f32m2(u_f, kP3GCb, vl), vl),
+            __riscv_vfmul_vf_f32m2(v_f, kP3GCr, vl), vl),
+        vl);
+    vfloat32m2_t b = clampPixelFloat_rvv(
+        __riscv_vfadd_vv_f32m2(y_f, __riscv_vfmul_vf_f32m2(u_f, kP3Cb, vl), vl), vl);
+    r = lookup_rvv(srgb_lut, kSrgbInvOETFNumEntries, r, vl);
+    g = lookup_rvv(srgb_lut, kSrgbInvOETFNumEntries, g, vl);
+    b = lookup_rvv(srgb_lut, kSrgbInvOETFNumEntries, b, vl);
+
+    // sample gain map, see sampleMap() with ShepardsIDW
+    const vuint32m2_t x_lower = __riscv_vfcvt_rtz_xu_f_v_u32m2(
+        __riscv_vfdiv_vf_f32m2(
+            __riscv_vfadd_vf_f32m2(__riscv_vfcvt_f_xu_v_f32m2(xs, vl), 0.5f, vl), scale_f, vl),
+        vl);
+    const vuint32m2_t x_upper = __riscv_vadd_vx_u32m2(x_lower, 1, vl);
+    const vuint32m2_t w_idx = __riscv_vsll_vx_u32m2(
+        __riscv_vsub_vv_u32m2(xs, __riscv_vmul_vx_u32m2(x_lower, scale_i, vl), vl), 2, vl);
+    const vfloat32m2_t e1 = loadMap_rvv(map_top, x_lower, vl);
+    const vfloat32m2_t e2 = loadMap_rvv(map_bottom, x_lower, vl);
+    const vfloat32m2_t e3 = loadMap_rvv(map_top, x_upper, vl);
+    const vfloat32m2_t e4 = loadMap_rvv(map_bottom, x_upper, vl);
+    vfloat32m2_t gain = __riscv_vfmul_vv_f32m2(e1, gather_rvv(weights, w_idx, vl), vl);
+    gain = __riscv_vfadd_vv_f32m2(
+        gain, __riscv_vfmul_vv_f32m2(e2, gather_rvv(weights + 1, w_idx, vl), vl), vl);
+    gain = __riscv_vfadd_vv_f32m2(
+        gain, __riscv_vfmul_vv_f32m2(e3, gather_rvv(weights + 2, w_idx, vl), vl), vl);
+    gain = __riscv_vfadd_vv_f32m2(
+        gain, __riscv_vfmul_vv_f32m2(e4, gather_rvv(weights + 3, w_idx, vl), vl), vl);
+
+    // apply gain, see applyGainLUT()
+    const vfloat32m2_t gain_factor = lookup_rvv(gain_table, kGainFactorNumEntries, gain, vl);
+    r = __riscv_vfsub_vf_f32m2(
+        __riscv_vfmul_vv_f32m2(__riscv_vfadd_vf_f32m2(r, metadata->offset_sdr, vl), gain_factor,
+                               vl),
+        metadata->offset_hdr, vl);
+    g = __riscv_vfsub_vf_f32m2(
+        __riscv_vfmul_vv_f32m2(__riscv_vfadd_vf_f32m2(g, metadata->offset_sdr, vl), gain_factor,
+                               vl),
+        metadata->offset_hdr, vl);
+    b = __riscv_vfsub_vf_f32m2(
+        __riscv_vfmul_vv_f32m2(__riscv_vfadd_vf_f32m2(b, metadata->offset_sdr, vl), gain_factor,
+                               vl),
+        metadata->offset_hdr, vl);
+    if (gamut_matrix != nullptr) {
+      // output gamut, see getGamutConversionMatrix()
+      const vfloat32m2_t r_out = dot3_rvv(gamut_matrix, r, g, b, vl);
+      const vfloat32m2_t g_out = dot3_rvv(gamut_matrix + 3, r, g, b, vl);
+      b = dot3_rvv(gamut_matrix + 6, r, g, b, vl);
+      r = r_out;
+      g = g_out;
+      // colors outside of the output gamut map to code 0 in the hlg and pq tables
+    }
+
+    if (output_ct == UHDR_CT_LINEAR) {
+      // half float vectors need zvfh, which the vector extension does not imply
+      float rgb[3][kMaxGainMapLanes];
+      __riscv_vse32_v_f32m2(rgb[0], r, vl);
+      __riscv_vse32_v_f32m2(rgb[1], g, vl);
+      __riscv_vse32_v_f32m2(rgb[2], b, vl);
+      uint64_t* out = reinterpret_cast<uint64_t*>(dst) + dst_offset + x;
+      for (size_t i = 0; i < vl; i++) {
+        out[i] = colorToRgbaF16({{{rgb[0][i], rgb[1][i], rgb[2][i]}}});
+      }
+    } else {
+      // scaling, inverse ootf, oetf and quantization in one lookup per component
+      __riscv_vse32_v_u32m2(reinterpret_cast<uint32_t*>(dst) + dst_offset + x,
+                            toRgba1010102_rvv(code_lut, r, g, b, vl), vl);
+    }
+    x += vl;
+  }
+
+  return width;
+}
+
+// 8 bit samples minus the 128 bias, widened to 16 bit
+UHDR_TARGET_RVV static inline vint16m2_t loadUnbiasedChroma_rvv(const uint8_t* src, size_t vl) {
+  const vuint16m2_t samples = __riscv_vzext_vf2_u16m2(__riscv_vle8_v_u8m1(src, vl), vl);
+  return __riscv_vsub_vx_i16m2(__riscv_vreinterpret_v_u16m2_i16m2(samples), 128, vl);
+}
+
+// c1 * u + c2 * v of unbiased chroma samples, rounded and saturated like yuvGamutConversionQ14()
+UHDR_TARGET_RVV static inline vint16m2_t yuvConversion_rvv(vint16m2_t u, vint16m2_t v, int16_t c1,
+                                                           int16_t c2, size_t vl) {
+  vint32m4_t acc = __riscv_vwmul_vx_i32m4(u, c1, vl);
+  acc = __riscv_vwmacc_vx_i32m4(acc, c2, v, vl);
+  return __riscv_vnclip_wx_i16m2(acc, 14, __RISCV_VXRM_RNU, vl);
+}
+
+UHDR_TARGET_RVV static inline vuint8m1_t clampToUint8_rvv(vint16m2_t v, size_t vl) {
+  const vuint16m2_t positive = __riscv_vreinterpret_v_i16m2_u16m2(__riscv_vmax_vx_i16m2(v, 0, vl));
+  return __riscv_vnclipu_wx_u8m1(positive, 0, __RISCV_VXRM_RNU, vl);
+}
+
+// Adds the luma offsets to 2 * vl pixels of a row, each offset is shared by two horizontally
+// adjacent pixels
+UHDR_TARGET_RVV static inline void addLuma420_rvv(uint8_t* row, vint16m2_t dy, size_t vl) {
+  for (int i = 0; i < 2; i++) {
+    const vuint16m2_t luma = __riscv_vzext_vf2_u16m2(__riscv_vlse8_v_u8m1(row + i, 2, vl), vl);
+    const vint16m2_t sum = __riscv_vadd_vv_i16m2(__riscv_vreinterpret_v_u16m2_i16m2(luma), dy, vl);
+    __riscv_vsse8_v_u8m1(row + i, 2, clampToUint8_rvv(sum, vl), vl);
+  }
+}
+
+UHDR_TARGET_RVV void transformYuv420_rvv(uhdr_raw_image_t* image, const int16_t* coeffs_ptr) {
+  const size_t chroma_w = image->w / 2;
+
+  for (size_t h = 0; h < image->h / 2; ++h) {
+    uint8_t* y0_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_Y]) + h * 2 * image->stride[UHDR_PLANE_Y];
+    uint8_t* y1_ptr = y0_ptr + image->stride[UHDR_PLANE_Y];
+    uint8_t* u_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_U]) + h * image->stride[UHDR_PLANE_U];
+    uint8_t* v_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_V]) + h * image->stride[UHDR_PLANE_V];
+
+    for (size_t w = 0; w < chroma_w;) {
+      const size_t vl = __riscv_vsetvl_e8m1(chroma_w - w);
+      const vint16m2_t u = loadUnbiasedChroma_rvv(u_ptr + w, vl);
+      const vint16m2_t v = loadUnbiasedChroma_rvv(v_ptr + w, vl);
+
+      // the luma offset only depends on chroma, each one is shared by a 2x2 block
+      const vint16m2_t dy = yuvConversion_rvv(u, v, coeffs_ptr[0], coeffs_ptr[1], vl);
+      addLuma420_rvv(y0_ptr + w * 2, dy, vl);
+      addLuma420_rvv(y1_ptr + w * 2, dy, vl);
+
+      const vint16m2_t new_u = __riscv_vadd_vx_i16m2(
+          yuvConversion_rvv(u, v, coeffs_ptr[2], coeffs_ptr[3], vl), 128, vl);
+      const vint16m2_t new_v = __riscv_vadd_vx_i16m2(
+          yuvConversion_rvv(u, v, coeffs_ptr[4], coeffs_ptr[5], vl), 128, vl);
+      __riscv_vse8_v_u8m1(u_ptr + w, clampToUint8_rvv(new_u, vl), vl);
+      __riscv_vse8_v_u8m1(v_ptr + w, clampToUint8_rvv(new_v, vl), vl);
+      w += vl;
+    }
+  }
+}
+
+UHDR_TARGET_RVV void transformYuv444_rvv(uhdr_raw_image_t* image, const int16_t* coeffs_ptr) {
+  for (size_t h = 0; h < image->h; ++h) {
+    uint8_t* y_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_Y]) + h * image->stride[UHDR_PLANE_Y];
+    uint8_t* u_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_U]) + h * image->stride[UHDR_PLANE_U];
+    uint8_t* v_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_V]) + h * image->stride[UHDR_PLANE_V];
+
+    for (size_t w = 0; w < image->w;) {
+      const size_t vl = __riscv_vsetvl_e8m1(image->w - w);
+      const vint16m2_t u = loadUnbiasedChroma_rvv(u_ptr + w, vl);
+      const vint16m2_t v = loadUnbiasedChroma_rvv(v_ptr + w, vl);
+      const vuint16m2_t luma = __riscv_vzext_vf2_u16m2(__riscv_vle8_v_u8m1(y_ptr + w, vl), vl);
+
+      const vint16m2_t new_y =
+          __riscv_vadd_vv_i16m2(__riscv_vreinterpret_v_u16m2_i16m2(luma),
+                                yuvConversion_rvv(u, v, coeffs_ptr[0], coeffs_ptr[1], vl), vl);
+      const vint16m2_t new_u = __riscv_vadd_vx_i16m2(
+          yuvConversion_rvv(u, v, coeffs_ptr[2], coeffs_ptr[3], vl), 128, vl);
+      const vint16m2_t new_v = __riscv_vadd_vx_i16m2(
+          yuvConversion_rvv(u, v, coeffs_ptr[4], coeffs_ptr[5], vl), 128, vl);
+      __riscv_vse8_v_u8m1(y_ptr + w, clampToUint8_rvv(new_y, vl), vl);
+      __riscv_vse8_v_u8m1(u_ptr + w, clampToUint8_rvv(new_u, vl), vl);
+      __riscv_vse8_v_u8m1(v_ptr + w, clampToUint8_rvv(new_v, vl), vl);
+      w += vl;
+    }
+  }
+}
+
+uhdr_error_info_t convertYuv_rvv(uhdr_raw_image_t* image, uhdr_color_gamut_t src_encoding,
+                                 uhdr_color_gamut_t dst_encoding) {
+  return convertYuvQ14(image, src_encoding, dst_encoding, transformYuv420_rvv,
+                       transformYuv444_rvv);
+}
+
+// Q14 rgb -> yuv coefficients {yr, yg, yb, ur, ug, ub = vr, vg, vb}, the negative terms are
+// stored as magnitudes. See the matrices of srgbRgbToYuv(), p3RgbToYuv() and bt2100RgbToYuv().
+static const uint16_t kRgb709ToYuv_coeffs_rvv[8] = {3484, 11717, 1183, 1877,
+                                                    6315, 8192,  7441, 751};
+static const uint16_t kRgbDispP3ToYuv_coeffs_rvv[8] = {3752, 11333, 1299, 2037,
+                                                       6155, 8192,  7350, 842};
+static const uint16_t kRgb2100ToYuv_coeffs_rvv[8] = {4304, 11108, 972, 2288,
+                                                     5904, 8192,  7533, 659};
+
+// One channel of vl rgba8888 pixels, widened to 16 bit
+UHDR_TARGET_RVV static inline vuint16m2_t loadChannel_rvv(const uint8_t* rgba, size_t vl) {
+  return __riscv_vzext_vf2_u16m2(__riscv_vlse8_v_u8m1(rgba, 4, vl), vl);
+}
+
+// Same arithmetic as ConvertRgba8888ToYuv444_neon(), luma is rounded and chroma carries the
+// rounding in its bias
+UHDR_TARGET_RVV static void ConvertRgba8888ToYuv444_rvv(uhdr_raw_image_t* src,
+                                                        uhdr_raw_image_t* dst,
+                                                        const uint16_t* coeffs) {
+  const uint32_t bias = (128 << 14) + 8191;
+
+  for (size_t h = 0; h < src->h; h++) {
+    const uint8_t* rgba_ptr = static_cast<uint8_t*>(src->planes[UHDR_PLANE_PACKED]) +
+                              (size_t)src->stride[UHDR_PLANE_PACKED] * 4 * h;
+    uint8_t* y_ptr =
+        static_cast<uint8_t*>(dst->planes[UHDR_PLANE_Y]) + (size_t)dst->stride[UHDR_PLANE_Y] * h;
+    uint8_t* u_ptr =
+        static_cast<uint8_t*>(dst->planes[UHDR_PLANE_U]) + (size_t)dst->stride[UHDR_PLANE_U] * h;
+    uint8_t* v_ptr =
+        static_cast<uint8_t*>(dst->planes[UHDR_PLANE_V]) + (size_t)dst->stride[UHDR_PLANE_V] * h;
+
+    for (size_t w = 0; w < src->w;) {
+      const size_t vl = __riscv_vsetvl_e8m1(src->w - w);
+      const vuint16m2_t r = loadChannel_rvv(rgba_ptr + w * 4, vl);
+      const vuint16m2_t g = loadChannel_rvv(rgba_ptr + w * 4 + 1, vl);
+      const vuint16m2_t b = loadChannel_rvv(rgba_ptr + w * 4 + 2, vl);
+
+      vuint32m4_t y = __riscv_vwmulu_vx_u32m4(r, coeffs[0], vl);
+      y = __riscv_vwmaccu_vx_u32m4(y, coeffs[1], g, vl);
+      y = __riscv_vwmaccu_vx_u32m4(y, coeffs[2], b, vl);
+
+      vuint32m4_t cb = __riscv_vwmaccu_vx_u32m4(__riscv_vmv_v_x_u32m4(bias, vl), coeffs[5], b, vl);
+      cb = __riscv_vsub_vv_u32m4(cb, __riscv_vwmulu_vx_u32m4(r, coeffs[3], vl), vl);
+      cb = __riscv_vsub_vv_u32m4(cb, __riscv_vwmulu_vx_u32m4(g, coeffs[4], vl), vl);
+
+      vuint32m4_t cr = __riscv_vwmaccu_vx_u32m4(__riscv_vmv_v_x_u32m4(bias, vl), coeffs[5], r, vl);
+      cr = __riscv_vsub_vv_u32m4(cr, __riscv_vwmulu_vx_u32m4(g, coeffs[6], vl), vl);
+      cr = __riscv_vsub_vv_u32m4(cr, __riscv_vwmulu_vx_u32m4(b, coeffs[7], vl), vl);
+
+      const vuint16m2_t y16 = __riscv_vnclipu_wx_u16m2(y, 14, __RISCV_VXRM_RNU, vl);
+      const vuint16m2_t cb16 = __riscv_vnsrl_wx_u16m2(cb, 14, vl);
+      const vuint16m2_t cr16 = __riscv_vnsrl_wx_u16m2(cr, 14, vl);
+      __riscv_vse8_v_u8m1(y_ptr + w, __riscv_vnclipu_wx_u8m1(y16, 0, __RISCV_VXRM_RNU, vl), vl);
+      __riscv_vse8_v_u8m1(u_ptr + w, __riscv_vnclipu_wx_u8m1(cb16, 0, __RISCV_VXRM_RNU, vl), vl);
+      __riscv_vse8_v_u8m1(v_ptr + w, __riscv_vnclipu_wx_u8m1(cr16, 0, __RISCV_VXRM_RNU, vl), vl);
+      w += vl;
+    }
+  }
+}
+
+uhdr_error_info_t convert_raw_input_to_ycbcr_rvv(uhdr_raw_image_t* src, uhdr_raw_image_t* dst) {
+  const uint16_t* coeffs = nullptr;
+  if (src->cg == UHDR_CG_BT_709) {
+    coeffs = kRgb709ToYuv_coeffs_rvv;
+  } else if (src->cg == UHDR_CG_DISPLAY_P3) {
+    coeffs = kRgbDispP3ToYuv_coeffs_rvv;
+  } else if (src->cg == UHDR_CG_BT_2100) {
+    coeffs = kRgb2100ToYuv_coeffs_rvv;
+  }
+  if (src->fmt != UHDR_IMG_FMT_32bppRGBA8888 || dst->fmt != UHDR_IMG_FMT_24bppYCbCr444 ||
+      coeffs == nullptr) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "no rvv conversion from fmt %d, gamut %d to fmt %d", src->fmt, src->cg, dst->fmt);
+    return status;
+  }
+  ConvertRgba8888ToYuv444_rvv(src, dst, coeffs);
+  return g_no_error;
+}
+
+}  // namespace ultrahdr
@@ -0,0 +1,255 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ultrahdr/editorhelper.h"
+
+#include <wasm_simd128.h>
+#include <cstring>
+
+namespace ultrahdr {
+
+static inline v128_t unpacklo8(v128_t a, v128_t b) {
+  return wasm_i8x16_shuffle(a, b, 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);
+}
+
+static inline v128_t unpacklo16(v128_t a, v128_t b) {
+  return wasm_i16x8_shuffle(a, b, 0, 8, 1, 9, 2, 10, 3, 11);
+}
+
+static inline v128_t unpackhi16(v128_t a, v128_t b) {
+  return wasm_i16x8_shuffle(a, b, 4, 12, 5, 13, 6, 14, 7, 15);
+}
+
+static inline v128_t unpacklo32(v128_t a, v128_t b) { return wasm_i32x4_shuffle(a, b, 0, 4, 1, 5); }
+
+static inline v128_t unpackhi32(v128_t a, v128_t b) { return wasm_i32x4_shuffle(a, b, 2, 6, 3, 7); }
+
+static inline v128_t unpacklo64(v128_t a, v128_t b) { return wasm_i64x2_shuffle(a, b, 0, 2); }
+
+static inline v128_t unpackhi64(v128_t a, v128_t b) { return wasm_i64x2_shuffle(a, b, 1, 3); }
+
+// Block of the rotations, N x N elements of T. Rows of 8 bit elements are 8 bytes wide, the others
+// fill a register.
+template <typename T>
+struct transpose_block;
+
+template <>
+struct transpose_block<uint8_t> {
+  static constexpr int N = 8;
+
+  static inline v128_t load(const uint8_t* p) { return wasm_v128_load64_zero(p); }
+
+  static inline void store(uint8_t* p, v128_t v) { wasm_v128_store64_lane(p, v, 0); }
+
+  static inline void transpose(v128_t a[N]) {
+    const v128_t b0 = unpacklo8(a[0], a[1]);
+    const v128_t b1 = unpacklo8(a[2], a[3]);
+    const v128_t b2 = unpacklo8(a[4], a[5]);
+    const v128_t b3 = unpacklo8(a[6], a[7]);
+    const v128_t c0 = unpacklo16(b0, b1);
+    const v128_t c1 = unpackhi16(b0, b1);
+    const v128_t c2 = unpacklo16(b2, b3);
+    const v128_t c3 = unpackhi16(b2, b3);
+    const v128_t d0 = unpacklo32(c0, c2);
+    const v128_t d1 = unpackhi32(c0, c2);
+    const v128_t d2 = unpacklo32(c1, c3);
+    const v128_t d3 = unpackhi32(c1, c3);
+    a[0] = d0;
+    a[1] = unpackhi64(d0, d0);
+    a[2] = d1;
+    a[3] = unpackhi64(d1, d1);
+    a[4] = d2;
+    a[5] = unpackhi64(d2, d2);
+    a[6] = d3;
+    a[7] = unpackhi64(d3, d3);
+  }
+};
+
+template <>
+struct transpose_block<uint16_t> {
+  static constexpr int N = 8;
+
+  static inline v128_t load(const uint16_t* p) { return wasm_v128_load(p); }
+
+  static inline void store(uint16_t* p, v128_t v) { wasm_v128_store(p, v); }
+
+  static inline void transpose(v128_t a[N]) {
+    v128_t b[8], c[8];
+    for (int i = 0; i < 4; i++) {
+      b[2 * i] = unpacklo16(a[2 * i], a[2 * i + 1]);
+      b[2 * i + 1] = unpackhi16(a[2 * i], a[2 * i + 1]);
+    }
+    for (int i = 0; i < 2; i++) {
+      c[4 * i + 0] = unpacklo32(b[4 * i], b[4 * i + 2]);
+      c[4 * i + 1] = unpackhi32(b[4 * i], b[4 * i + 2]);
+      c[4 * i + 2] = unpacklo32(b[4 * i + 1], b[4 * i + 3]);
+      c[4 * i + 3] = unpackhi32(b[4 * i + 1], b[4 * i + 3]);
+    }
+    for (int i = 0; i < 4; i++) {
+      a[2 * i] = unpacklo64(c[i], c[i + 4]);
+      a[2 * i + 1] = unpackhi64(c[i], c[i + 4]);
+    }
+  }
+};
+
+template <>
+struct transpose_block<uint32_t> {
+  static constexpr int N = 4;
+
+  static inline v128_t load(const uint32_t* p) { return wasm_v128_load(p); }
+
+  static inline void store(uint32_t* p, v128_t v) { wasm_v128_store(p, v); }
+
+  static inline void transpose(v128_t a[N]) {
+    const v128_t b0 = unpacklo32(a[0], a[1]);
+    const v128_t b1 = unpacklo32(a[2], a[3]);
+    const v128_t b2 = unpackhi32(a[0], a[1]);
+    const v128_t b3 = unpackhi32(a[2], a[3]);
+    a[0] = unpacklo64(b0, b1);
+    a[1] = unpackhi64(b0, b1);
+    a[2] = unpacklo64(b2, b3);
+    a[3] = unpackhi64(b2, b3);
+  }
+};
+
+template <>
+struct transpose_block<uint64_t> {
+  static constexpr int N = 2;
+
+  static inline v128_t load(const uint64_t* p) { return wasm_v128_load(p); }
+
+  static inline void store(uint64_t* p, v128_t v) { wasm_v128_store(p, v); }
+
+  static inline void transpose(v128_t a[N]) {
+    const v128_t b0 = unpacklo64(a[0], a[1]);
+    a[1] = unpackhi64(a[0], a[1]);
+    a[0] = b0;
+  }
+};
+
+// Reverses the order of the elements of T in a register
+template <typename T>
+static inline v128_t reverse_elements(v128_t v) {
+  if (sizeof(T) == 8) return wasm_i64x2_shuffle(v, v, 1, 0);
+  if (sizeof(T) == 4) return wasm_i32x4_shuffle(v, v, 3, 2, 1, 0);
+  if (sizeof(T) == 2) return wasm_i16x8_shuffle(v, v, 7, 6, 5, 4, 3, 2, 1, 0);
+  return wasm_i8x16_shuffle(v, v, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+}
+
+// dst[j] = src[w - 1 - j]
+template <typename T>
+static void reverse_row(const T* src, T* dst, int w) {
+  constexpr int kLanes = 16 / sizeof(T);
+  int j = 0;
+  for (; j + kLanes <= w; j += kLanes) {
+    wasm_v128_store(dst + j, reverse_elements<T>(wasm_v128_load(src + w - j - kLanes)));
+  }
+  for (; j < w; j++) dst[j] = src[w - 1 - j];
+}
+
+template <typename T>
+void mirror_buffer_simd128(T* src_buffer, T* dst_buffer, int src_w, int src_h, int src_stride,
+                           int dst_stride, uhdr_mirror_direction_t direction) {
+  if (direction == UHDR_MIRROR_VERTICAL) {
+    for (int i = 0; i < src_h; i++) {
+      memcpy(&dst_buffer[(size_t)(src_h - i - 1) * dst_stride],
+             &src_buffer[(size_t)i * src_stride], src_w * sizeof(T));
+    }
+  } else if (direction == UHDR_MIRROR_HORIZONTAL) {
+    for (int i = 0; i < src_h; i++) {
+      reverse_row(&src_buffer[(size_t)i * src_stride], &dst_buffer[(size_t)i * dst_stride], src_w);
+    }
+  }
+}
+
+// Rotates by 90 or 270 degrees. Output blocks are read as N rows of the input, transposed in
+// registers and written as N rows of the output, so both sides are accessed a row at a time.
+template <typename T>
+static void rotate_buffer_transpose_simd128(T* src_buffer, T* dst_buffer, int src_w, int src_h,
+                                            int src_stride, int dst_stride, int degree) {
+  using block = transpose_block<T>;
+  constexpr int N = block::N;
+  const int dst_w = src_h, dst_h = src_w;
+  const int blocked_w = dst_w - dst_w % N, blocked_h = dst_h - dst_h % N;
+  v128_t a[N];
+
+  for (int i0 = 0; i0 < blocked_h; i0 += N) {
+    for (int j0 = 0; j0 < blocked_w; j0 += N) {
+      if (degree == 90) {
+        // dst[i][j] = src[src_h - 1 - j][i]
+        for (int k = 0; k < N; k++) {
+          a[k] = block::load(&src_buffer[(size_t)(src_h - 1 - j0 - k) * src_stride + i0]);
+        }
+        block::transpose(a);
+        for (int m = 0; m < N; m++) {
+          block::store(&dst_buffer[(size_t)(i0 + m) * dst_stride + j0], a[m]);
+        }
+      } else {
+        // dst[i][j] = src[j][src_w - 1 - i]
+        for (int k = 0; k < N; k++) {
+          a[k] = block::load(&src_buffer[(size_t)(j0 + k) * src_stride + src_w - i0 - N]);
+        }
+        block::transpose(a);
+        for (int m = 0; m < N; m++) {
+          block::store(&dst_buffer[(size_t)(i0 + N - 1 - m) * dst_stride + j0], a[m]);
+        }
+      }
+    }
+  }
+
+  // right columns and bottom rows of the output that do not fill a block
+  for (int i = 0; i < dst_h; i++) {
+    for (int j = i < blocked_h ? blocked_w : 0; j < dst_w; j++) {
+      dst_buffer[(size_t)i * dst_stride + j] =
+          degree == 90 ? src_buffer[(size_t)(src_h - 1 - j) * src_stride + i]
+                       : src_buffer[(size_t)j * src_stride + (src_w - 1 - i)];
+    }
+  }
+}
+
+template <typename T>
+void rotate_buffer_clockwise_simd128(T* src_buffer, T* dst_buffer, int src_w, int src_h,
+                                     int src_stride, int dst_stride, int degrees) {
+  if (degrees == 90 || degrees == 270) {
+    rotate_buffer_transpose_simd128(src_buffer, dst_buffer, src_w, src_h, src_stride, dst_stride,
+                                    degrees);
+  } else if (degrees == 180) {
+    for (int i = 0; i < src_h; i++) {
+      reverse_row(&src_buffer[(size_t)(src_h - 1 - i) * src_stride],
+                  &dst_buffer[(size_t)i * dst_stride], src_w);
+    }
+  }
+}
+
+template void mirror_buffer_simd128<uint8_t>(uint8_t*, uint8_t*, int, int, int, int,
+                                             uhdr_mirror_direction_t);
+template void mirror_buffer_simd128<uint16_t>(uint16_t*, uint16_t*, int, int, int, int,
+                                              uhdr_mirror_direction_t);
+template void mirror_buffer_simd128<uint32_t>(uint32_t*, uint32_t*, int, int, int, int,
+                                              uhdr_mirror_direction_t);
+template void mirror_buffer_simd128<uint64_t>(uint64_t*, uint64_t*, int, int, int, int,
+                                              uhdr_mirror_direction_t);
+
+template void rotate_buffer_clockwise_simd128<uint8_t>(uint8_t*, uint8_t*, int, int, int, int,
+                                                       int);
+template void rotate_buffer_clockwise_simd128<uint16_t>(uint16_t*, uint16_t*, int, int, int, int,
+                                                        int);
+template void rotate_buffer_clockwise_simd128<uint32_t>(uint32_t*, uint32_t*, int, int, int, int,
+                                                        int);
+template void rotate_buffer_clockwise_simd128<uint64_t>(uint64_t*, uint64_t*, int, int, int, int,
+                                                        int);
+
+}  // namespace ultrahdr
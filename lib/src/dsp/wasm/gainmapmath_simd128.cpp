@@ -0,0 +1,320 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ultrahdr/gainmapmath.h"
+
+#include <wasm_simd128.h>
+#include <algorithm>
+#include <cstring>
+
+// WebAssembly has no runtime feature detection, the module is built with -msimd128 as a whole
+// and the kernels in this file are taken as is, like the neon ones.
+
+namespace ultrahdr {
+
+// Rec.601 yuv -> rgb coefficients, see p3YuvToRgb()
+static const float kP3Cb = 1.772f, kP3Cr = 1.402f;
+static const float kP3GCb = 0.114f * kP3Cb / 0.587f;
+static const float kP3GCr = 0.299f * kP3Cr / 0.587f;
+
+static inline v128_t gather_simd128(const float* table, v128_t idx) {
+  return wasm_f32x4_make(table[wasm_i32x4_extract_lane(idx, 0)],
+                         table[wasm_i32x4_extract_lane(idx, 1)],
+                         table[wasm_i32x4_extract_lane(idx, 2)],
+                         table[wasm_i32x4_extract_lane(idx, 3)]);
+}
+
+// Vector counterpart of the *LUT() transfer functions
+static inline v128_t lookup_simd128(const float* table, int num_entries, v128_t e) {
+  v128_t idx = wasm_i32x4_trunc_sat_f32x4(wasm_f32x4_add(
+      wasm_f32x4_mul(e, wasm_f32x4_splat(static_cast<float>(num_entries - 1))),
+      wasm_f32x4_splat(0.5f)));
+  idx = wasm_i32x4_min(wasm_i32x4_max(idx, wasm_i32x4_splat(0)),
+                       wasm_i32x4_splat(num_entries - 1));
+  return gather_simd128(table, idx);
+}
+
+static inline v128_t clampPixelFloat_simd128(v128_t e) {
+  return wasm_f32x4_pmin(wasm_f32x4_pmax(e, wasm_f32x4_splat(0.0f)),
+                         wasm_f32x4_splat(kMaxPixelFloat));
+}
+
+static inline v128_t loadChroma_simd128(const uint8_t* src) {
+  uint16_t packed;
+  memcpy(&packed, src, sizeof packed);
+  const v128_t c = wasm_i32x4_sub(wasm_i32x4_make(packed & 0xff, packed & 0xff, packed >> 8,
+                                                  packed >> 8),
+                                  wasm_i32x4_splat(128));
+  // each chroma sample covers two horizontally adjacent luma samples
+  return wasm_f32x4_mul(wasm_f32x4_convert_i32x4(c), wasm_f32x4_splat(1 / 255.0f));
+}
+
+static inline v128_t loadMap_simd128(const uint8_t* row, v128_t idx) {
+  const v128_t v = wasm_i32x4_make(
+      row[wasm_i32x4_extract_lane(idx, 0)], row[wasm_i32x4_extract_lane(idx, 1)],
+      row[wasm_i32x4_extract_lane(idx, 2)], row[wasm_i32x4_extract_lane(idx, 3)]);
+  return wasm_f32x4_div(wasm_f32x4_convert_i32x4(v), wasm_f32x4_splat(255.0f));
+}
+
+// Vector counterpart of hdrCodeLUTIndex() and the code table lookup
+static inline v128_t lookupCodes_simd128(const uint16_t* table, v128_t e) {
+  v128_t idx = wasm_i32x4_sub(wasm_i32x4_shr(e, kHdrCodeLUTShift),
+                              wasm_i32x4_splat(kHdrCodeLUTBias));
+  idx = wasm_i32x4_min(wasm_i32x4_max(idx, wasm_i32x4_splat(0)),
+                       wasm_i32x4_splat(kHdrCodeLUTNumEntries - 1));
+  return wasm_i32x4_make(
+      table[wasm_i32x4_extract_lane(idx, 0)], table[wasm_i32x4_extract_lane(idx, 1)],
+      table[wasm_i32x4_extract_lane(idx, 2)], table[wasm_i32x4_extract_lane(idx, 3)]);
+}
+
+// See hlgLinearToRgba1010102() and pqLinearToRgba1010102()
+static inline v128_t toRgba1010102_simd128(const uint16_t* table, v128_t r, v128_t g, v128_t b) {
+  v128_t out = wasm_v128_or(lookupCodes_simd128(table, r),
+                            wasm_i32x4_shl(lookupCodes_simd128(table, g), 10));
+  out = wasm_v128_or(out, wasm_i32x4_shl(lookupCodes_simd128(table, b), 20));
+  return wasm_v128_or(out, wasm_i32x4_splat(static_cast<int>(0xc0000000)));  // alpha to 1.0
+}
+
+static inline v128_t dot3_simd128(const float* k, v128_t r, v128_t g, v128_t b) {
+  return wasm_f32x4_add(wasm_f32x4_add(wasm_f32x4_mul(wasm_f32x4_splat(k[0]), r),
+                                       wasm_f32x4_mul(wasm_f32x4_splat(k[1]), g)),
+                        wasm_f32x4_mul(wasm_f32x4_splat(k[2]), b));
+}
+
+size_t applyGainMapRowYuv420_simd128(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* gainmap_img,
+                                     uhdr_raw_image_t* dest, size_t map_scale_factor,
+                                     ShepardsIDW& idwTable, GainLUT& gainLUT,
+                                     uhdr_gainmap_metadata_ext_t* metadata,
+                                     uhdr_color_transfer_t output_ct, const float* gamut_matrix,
+                                     size_t y) {
+  if (output_ct != UHDR_CT_LINEAR && output_ct != UHDR_CT_HLG && output_ct != UHDR_CT_PQ) return 0;
+
+  // pixels whose gain map neighbourhood is clamped at the right edge are left to the caller
+  const size_t map_w = gainmap_img->w;
+  if (map_w < 2) return 0;
+  const size_t width =
+      (std::min)(static_cast<size_t>(sdr_intent->w), (map_w - 1) * map_scale_factor);
+  const size_t vec_width = width & ~static_cast<size_t>(3);
+  if (vec_width == 0) return 0;
+
+  const uint8_t* y_row = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_Y]) +
+                         y * sdr_intent->stride[UHDR_PLANE_Y];
+  const uint8_t* u_row = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_U]) +
+                         (y / 2) * sdr_intent->stride[UHDR_PLANE_U];
+  const uint8_t* v_row = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_V]) +
+                         (y / 2) * sdr_intent->stride[UHDR_PLANE_V];
+
+  const size_t y_lower = (std::min)(y / map_scale_factor, static_cast<size_t>(gainmap_img->h) - 1);
+  const size_t y_upper =
+      (std::min)(y / map_scale_factor + 1, static_cast<size_t>(gainmap_img->h) - 1);
+  const uint8_t* map_data = static_cast<uint8_t*>(gainmap_img->planes[UHDR_PLANE_Y]);
+  const size_t map_stride = gainmap_img->stride[UHDR_PLANE_Y];
+  const uint8_t* map_top = map_data + y_lower * map_stride;
+  const uint8_t* map_bottom = map_data + y_upper * map_stride;
+  const float* weights = (y_lower == y_upper) ? idwTable.mWeightsNB : idwTable.mWeights;
+  weights += (y % map_scale_factor) * map_scale_factor * 4;
+
+  const float* srgb_lut = getSrgbInvOetfLUT();
+  const uint16_t* code_lut = output_ct == UHDR_CT_HLG  ? getHlgCodeLUT()
+                            : output_ct == UHDR_CT_PQ ? getPqCodeLUT()
+                                                      : nullptr;
+  const float* gain_table = gainLUT.getGainTable();
+
+  const v128_t lanes = wasm_i32x4_make(0, 1, 2, 3);
+  const v128_t scale_i = wasm_i32x4_splat(static_cast<int>(map_scale_factor));
+  const v128_t scale_f = wasm_f32x4_splat(static_cast<float>(map_scale_factor));
+  const v128_t offset_sdr = wasm_f32x4_splat(metadata->offset_sdr);
+  const v128_t offset_hdr = wasm_f32x4_splat(metadata->offset_hdr);
+  const v128_t inv_255 = wasm_f32x4_splat(1 / 255.0f);
+
+  uint8_t* dst = static_cast<uint8_t*>(dest->planes[UHDR_PLANE_PACKED]);
+  const size_t dst_offset = y * dest->stride[UHDR_PLANE_PACKED];
+
+  for (size_t x = 0; x < vec_width; x += 4) {
+    // yuv -> linear rgb
+    const v128_t luma = wasm_u32x4_extend_low_u16x8(
+        wasm_u16x8_extend_low_u8x16(wasm_v128_load32_zero(y_row + x)));
+    const v128_t y_f = wasm_f32x4_mul(wasm_f32x4_convert_i32x4(luma), inv_255);
+    const v128_t u_f = loadChroma_simd128(u_row + x / 2);
+    const v128_t v_f = loadChroma_simd128(v_row + x / 2);
+    v128_t r = clampPixelFloat_simd128(
+        wasm_f32x4_add(y_f, wasm_f32x4_mul(wasm_f32x4_splat(kP3Cr), v_f)));
+    v128_t g = clampPixelFloat_simd128(
+        wasm_f32x4_sub(wasm_f32x4_sub(y_f, wasm_f32x4_mul(wasm_f32x4_splat(kP3GCb), u_f)),
+                       wasm_f32x4_mul(wasm_f32x4_splat(kP3GCr), v_f)));
+    v128_t b = clampPixelFloat_simd128(
+        wasm_f32x4_add(y_f, wasm_f32x4_mul(wasm_f32x4_splat(kP3Cb), u_f)));
+    r = lookup_simd128(srgb_lut, kSrgbInvOETFNumEntries, r);
+    g = lookup_simd128(srgb_lut, kSrgbInvOETFNumEntries, g);
+    b = lookup_simd128(srgb_lut, kSrgbInvOETFNumEntries, b);
+
+    // sample gain map, see sampleMap() with ShepardsIDW
+    const v128_t xs = wasm_i32x4_add(wasm_i32x4_splat(static_cast<int>(x)), lanes);
+    const v128_t x_lower = wasm_i32x4_trunc_sat_f32x4(wasm_f32x4_div(
+        wasm_f32x4_add(wasm_f32x4_convert_i32x4(xs), wasm_f32x4_splat(0.5f)), scale_f));
+    const v128_t x_upper = wasm_i32x4_add(x_lower, wasm_i32x4_splat(1));
+    const v128_t w_idx = wasm_i32x4_shl(wasm_i32x4_sub(xs, wasm_i32x4_mul(x_lower, scale_i)), 2);
+    const v128_t e1 = loadMap_simd128(map_top, x_lower);
+    const v128_t e2 = loadMap_simd128(map_bottom, x_lower);
+    const v128_t e3 = loadMap_simd128(map_top, x_upper);
+    const v128_t e4 = loadMap_simd128(map_bottom, x_upper);
+    v128_t gain = wasm_f32x4_mul(e1, gather_simd128(weights, w_idx));
+    gain = wasm_f32x4_add(gain, wasm_f32x4_mul(e2, gather_simd128(weights + 1, w_idx)));
+    gain = wasm_f32x4_add(gain, wasm_f32x4_mul(e3, gather_simd128(weights + 2, w_idx)));
+    gain = wasm_f32x4_add(gain, wasm_f32x4_mul(e4, gather_simd128(weights + 3, w_idx)));
+
+    // apply gain, see applyGainLUT()
+    const v128_t gain_factor = lookup_simd128(gain_table, kGainFactorNumEntries, gain);
+    r = wasm_f32x4_sub(wasm_f32x4_mul(wasm_f32x4_add(r, offset_sdr), gain_factor), offset_hdr);
+    g = wasm_f32x4_sub(wasm_f32x4_mul(wasm_f32x4_add(g, offset_sdr), gain_factor), offset_hdr);
+    b = wasm_f32x4_sub(wasm_f32x4_mul(wasm_f32x4_add(b, offset_sdr), gain_factor), offset_hdr);
+    if (gamut_matrix != nullptr) {
+      // output gamut, see getGamutConversionMatrix()
+      const v128_t r_out = dot3_simd128(gamut_matrix, r, g, b);
+      const v128_t g_out = dot3_simd128(gamut_matrix + 3, r, g, b);
+      b = dot3_simd128(gamut_matrix + 6, r, g, b);
+      r = r_out;
+      g = g_out;
+      // colors outside of the output gamut map to code 0 in the hlg and pq tables
+    }
+
+    if (output_ct == UHDR_CT_LINEAR) {
+      // simd128 has no half float conversions, convert with the scalar helper
+      float rgb[3][4];
+      wasm_v128_store(rgb[0], r);
+      wasm_v128_store(rgb[1], g);
+      wasm_v128_store(rgb[2], b);
+      uint64_t* out = reinterpret_cast<uint64_t*>(dst) + dst_offset + x;
+      for (int i = 0; i < 4; i++) {
+        out[i] = colorToRgbaF16({{{rgb[0][i], rgb[1][i], rgb[2][i]}}});
+      }
+    } else {
+      // scaling, inverse ootf, oetf and quantization in one lookup per component
+      wasm_v128_store(dst + (dst_offset + x) * sizeof(uint32_t),
+                      toRgba1010102_simd128(code_lut, r, g, b));
+    }
+  }
+
+  return vec_width;
+}
+
+// c1 * u + c2 * v of 8 unbiased chroma samples, rounded and saturated like yuvGamutConversionQ14()
+static inline v128_t yuvConversion_simd128(v128_t u, v128_t v, v128_t coeffs) {
+  const v128_t round = wasm_i32x4_splat(1 << 13);
+  // u and v interleaved, so that each 32 bit lane of the dot product is c1 * u + c2 * v
+  const v128_t uv_lo = wasm_i16x8_shuffle(u, v, 0, 8, 1, 9, 2, 10, 3, 11);
+  const v128_t uv_hi = wasm_i16x8_shuffle(u, v, 4, 12, 5, 13, 6, 14, 7, 15);
+  v128_t lo = wasm_i32x4_dot_i16x8(uv_lo, coeffs);
+  v128_t hi = wasm_i32x4_dot_i16x8(uv_hi, coeffs);
+  lo = wasm_i32x4_shr(wasm_i32x4_add(lo, round), 14);
+  hi = wasm_i32x4_shr(wasm_i32x4_add(hi, round), 14);
+  return wasm_i16x8_narrow_i32x4(lo, hi);
+}
+
+// Adds the luma offsets of 16 pixels to a row and narrows back with saturation
+static inline void addLuma_simd128(uint8_t* row, v128_t dy_lo, v128_t dy_hi) {
+  const v128_t luma = wasm_v128_load(row);
+  const v128_t lo = wasm_i16x8_add(wasm_u16x8_extend_low_u8x16(luma), dy_lo);
+  const v128_t hi = wasm_i16x8_add(wasm_u16x8_extend_high_u8x16(luma), dy_hi);
+  wasm_v128_store(row, wasm_u8x16_narrow_i16x8(lo, hi));
+}
+
+static inline v128_t loadUnbiasedChroma_simd128(const uint8_t* src) {
+  // 128 bias for UV given we are using libjpeg
+  return wasm_i16x8_sub(wasm_u16x8_extend_low_u8x16(wasm_v128_load64_zero(src)),
+                        wasm_i16x8_splat(128));
+}
+
+// Stores the low 8 bytes of the saturated narrowing of v
+static inline void storeNarrow_simd128(uint8_t* dst, v128_t v) {
+  wasm_v128_store64_lane(dst, wasm_u8x16_narrow_i16x8(v, v), 0);
+}
+
+// Q14 coefficients of u and v, repeated for wasm_i32x4_dot_i16x8() on interleaved samples
+static inline v128_t coeffPair(const int16_t* coeffs) {
+  return wasm_i16x8_make(coeffs[0], coeffs[1], coeffs[0], coeffs[1], coeffs[0], coeffs[1],
+                         coeffs[0], coeffs[1]);
+}
+
+void transformYuv420_simd128(uhdr_raw_image_t* image, const int16_t* coeffs_ptr) {
+  const v128_t coeffs_y = coeffPair(coeffs_ptr);
+  const v128_t coeffs_u = coeffPair(coeffs_ptr + 2);
+  const v128_t coeffs_v = coeffPair(coeffs_ptr + 4);
+  const v128_t bias = wasm_i16x8_splat(128);
+  const size_t vec_width = (image->w / 2) & ~size_t(7);
+
+  for (size_t h = 0; h < image->h / 2; ++h) {
+    uint8_t* y0_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_Y]) + h * 2 * image->stride[UHDR_PLANE_Y];
+    uint8_t* y1_ptr = y0_ptr + image->stride[UHDR_PLANE_Y];
+    uint8_t* u_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_U]) + h * image->stride[UHDR_PLANE_U];
+    uint8_t* v_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_V]) + h * image->stride[UHDR_PLANE_V];
+
+    for (size_t w = 0; w < vec_width; w += 8) {
+      const v128_t u = loadUnbiasedChroma_simd128(u_ptr + w);
+      const v128_t v = loadUnbiasedChroma_simd128(v_ptr + w);
+
+      // the luma offset only depends on chroma, each one is shared by a 2x2 block
+      const v128_t dy = yuvConversion_simd128(u, v, coeffs_y);
+      const v128_t dy_lo = wasm_i16x8_shuffle(dy, dy, 0, 0, 1, 1, 2, 2, 3, 3);
+      const v128_t dy_hi = wasm_i16x8_shuffle(dy, dy, 4, 4, 5, 5, 6, 6, 7, 7);
+      addLuma_simd128(y0_ptr + w * 2, dy_lo, dy_hi);
+      addLuma_simd128(y1_ptr + w * 2, dy_lo, dy_hi);
+
+      storeNarrow_simd128(u_ptr + w, wasm_i16x8_add(yuvConversion_simd128(u, v, coeffs_u), bias));
+      storeNarrow_simd128(v_ptr + w, wasm_i16x8_add(yuvConversion_simd128(u, v, coeffs_v), bias));
+    }
+    transformYuv420RowQ14(image, coeffs_ptr, vec_width, h);
+  }
+}
+
+void transformYuv444_simd128(uhdr_raw_image_t* image, const int16_t* coeffs_ptr) {
+  const v128_t coeffs_y = coeffPair(coeffs_ptr);
+  const v128_t coeffs_u = coeffPair(coeffs_ptr + 2);
+  const v128_t coeffs_v = coeffPair(coeffs_ptr + 4);
+  const v128_t bias = wasm_i16x8_splat(128);
+  const size_t vec_width = image->w & ~size_t(7);
+
+  for (size_t h = 0; h < image->h; ++h) {
+    uint8_t* y_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_Y]) + h * image->stride[UHDR_PLANE_Y];
+    uint8_t* u_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_U]) + h * image->stride[UHDR_PLANE_U];
+    uint8_t* v_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_V]) + h * image->stride[UHDR_PLANE_V];
+
+    for (size_t w = 0; w < vec_width; w += 8) {
+      const v128_t u = loadUnbiasedChroma_simd128(u_ptr + w);
+      const v128_t v = loadUnbiasedChroma_simd128(v_ptr + w);
+      const v128_t luma = wasm_u16x8_extend_low_u8x16(wasm_v128_load64_zero(y_ptr + w));
+
+      storeNarrow_simd128(y_ptr + w, wasm_i16x8_add(luma, yuvConversion_simd128(u, v, coeffs_y)));
+      storeNarrow_simd128(u_ptr + w, wasm_i16x8_add(yuvConversion_simd128(u, v, coeffs_u), bias));
+      storeNarrow_simd128(v_ptr + w, wasm_i16x8_add(yuvConversion_simd128(u, v, coeffs_v), bias));
+    }
+    transformYuv444RowQ14(image, coeffs_ptr, vec_width, h);
+  }
+}
+
+uhdr_error_info_t convertYuv_simd128(uhdr_raw_image_t* image, uhdr_color_gamut_t src_encoding,
+                                     uhdr_color_gamut_t dst_encoding) {
+  return convertYuvQ14(image, src_encoding, dst_encoding, transformYuv420_simd128,
+                       transformYuv444_simd128);
+}
+
+}  // namespace ultrahdr
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ultrahdr/editorhelper.h"
+
+#include <immintrin.h>
+
+// The library is built for the baseline isa of the target. The kernels in this file are compiled
+// for avx2 individually and are only reached after a runtime check of the cpu features.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define UHDR_TARGET_AVX2
+#else
+#define UHDR_TARGET_AVX2 __attribute__((target("avx2,f16c")))
+#endif
+
+namespace ultrahdr {
+
+// Products are summed in the order of the scalar code and without fused multiply adds, so the
+// results are bit exact with it.
+UHDR_TARGET_AVX2 int resampleColumns_avx2(const float* const* rows, const float* weights, int taps,
+                                          float* dst, int count) {
+  int i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m256 w = _mm256_set1_ps(weights[0]);
+    __m256 acc0 = _mm256_mul_ps(w, _mm256_loadu_ps(rows[0] + i));
+    __m256 acc1 = _mm256_mul_ps(w, _mm256_loadu_ps(rows[0] + i + 8));
+    for (int k = 1; k < taps; k++) {
+      w = _mm256_set1_ps(weights[k]);
+      acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(w, _mm256_loadu_ps(rows[k] + i)));
+      acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(w, _mm256_loadu_ps(rows[k] + i + 8)));
+    }
+    _mm256_storeu_ps(dst + i, acc0);
+    _mm256_storeu_ps(dst + i + 8, acc1);
+  }
+  for (; i + 8 <= count; i += 8) {
+    __m256 acc = _mm256_mul_ps(_mm256_set1_ps(weights[0]), _mm256_loadu_ps(rows[0] + i));
+    for (int k = 1; k < taps; k++) {
+      acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(weights[k]),
+                                             _mm256_loadu_ps(rows[k] + i)));
+    }
+    _mm256_storeu_ps(dst + i, acc);
+  }
+  return i;
+}
+
+// two output pixels per vector, one in each 128 bit lane
+UHDR_TARGET_AVX2 static inline __m256 load_pair(const float* lo, const float* hi) {
+  return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(lo)), _mm_loadu_ps(hi), 1);
+}
+
+UHDR_TARGET_AVX2 static inline __m256 set_pair(float lo, float hi) {
+  return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(lo)), _mm_set1_ps(hi), 1);
+}
+
+UHDR_TARGET_AVX2 int resampleRowRgba_avx2(const float* src, const int* starts,
+                                          const float* weights, int taps, float* dst, int count) {
+  int x = 0;
+  for (; x + 2 <= count; x += 2) {
+    const float* s0 = src + (size_t)starts[x] * 4;
+    const float* s1 = src + (size_t)starts[x + 1] * 4;
+    const float* w0 = weights + (size_t)x * taps;
+    const float* w1 = w0 + taps;
+    __m256 acc = _mm256_mul_ps(set_pair(w0[0], w1[0]), load_pair(s0, s1));
+    for (int k = 1; k < taps; k++) {
+      acc = _mm256_add_ps(acc,
+                          _mm256_mul_ps(set_pair(w0[k], w1[k]), load_pair(s0 + 4 * k, s1 + 4 * k)));
+    }
+    _mm256_storeu_ps(dst + (size_t)x * 4, acc);
+  }
+  return x;
+}
+
+}  // namespace ultrahdr
@@ -0,0 +1,264 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ultrahdr/editorhelper.h"
+
+#include <smmintrin.h>
+#include <cstring>
+
+// The library is built for the baseline isa of the target. The kernels in this file are compiled
+// for sse4.1 individually and are only reached after a runtime check of the cpu features.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define UHDR_TARGET_SSE41
+#else
+#define UHDR_TARGET_SSE41 __attribute__((target("sse4.1")))
+#endif
+
+namespace ultrahdr {
+
+// Block of the rotations, N x N elements of T. Rows of 8 bit elements are 8 bytes wide, the others
+// fill a register.
+template <typename T>
+struct transpose_block;
+
+template <>
+struct transpose_block<uint8_t> {
+  static constexpr int N = 8;
+
+  UHDR_TARGET_SSE41 static inline __m128i load(const uint8_t* p) {
+    return _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+  }
+
+  UHDR_TARGET_SSE41 static inline void store(uint8_t* p, __m128i v) {
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(p), v);
+  }
+
+  UHDR_TARGET_SSE41 static inline void transpose(__m128i a[N]) {
+    const __m128i b0 = _mm_unpacklo_epi8(a[0], a[1]);
+    const __m128i b1 = _mm_unpacklo_epi8(a[2], a[3]);
+    const __m128i b2 = _mm_unpacklo_epi8(a[4], a[5]);
+    const __m128i b3 = _mm_unpacklo_epi8(a[6], a[7]);
+    const __m128i c0 = _mm_unpacklo_epi16(b0, b1);
+    const __m128i c1 = _mm_unpackhi_epi16(b0, b1);
+    const __m128i c2 = _mm_unpacklo_epi16(b2, b3);
+    const __m128i c3 = _mm_unpackhi_epi16(b2, b3);
+    const __m128i d0 = _mm_unpacklo_epi32(c0, c2);
+    const __m128i d1 = _mm_unpackhi_epi32(c0, c2);
+    const __m128i d2 = _mm_unpacklo_epi32(c1, c3);
+    const __m128i d3 = _mm_unpackhi_epi32(c1, c3);
+    a[0] = d0;
+    a[1] = _mm_srli_si128(d0, 8);
+    a[2] = d1;
+    a[3] = _mm_srli_si128(d1, 8);
+    a[4] = d2;
+    a[5] = _mm_srli_si128(d2, 8);
+    a[6] = d3;
+    a[7] = _mm_srli_si128(d3, 8);
+  }
+};
+
+template <>
+struct transpose_block<uint16_t> {
+  static constexpr int N = 8;
+
+  UHDR_TARGET_SSE41 static inline __m128i load(const uint16_t* p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  }
+
+  UHDR_TARGET_SSE41 static inline void store(uint16_t* p, __m128i v) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v);
+  }
+
+  UHDR_TARGET_SSE41 static inline void transpose(__m128i a[N]) {
+    __m128i b[8], c[8];
+    for (int i = 0; i < 4; i++) {
+      b[2 * i] = _mm_unpacklo_epi16(a[2 * i], a[2 * i + 1]);
+      b[2 * i + 1] = _mm_unpackhi_epi16(a[2 * i], a[2 * i + 1]);
+    }
+    for (int i = 0; i < 2; i++) {
+      c[4 * i + 0] = _mm_unpacklo_epi32(b[4 * i], b[4 * i + 2]);
+      c[4 * i + 1] = _mm_unpackhi_epi32(b[4 * i], b[4 * i + 2]);
+      c[4 * i + 2] = _mm_unpacklo_epi32(b[4 * i + 1], b[4 * i + 3]);
+      c[4 * i + 3] = _mm_unpackhi_epi32(b[4 * i + 1], b[4 * i + 3]);
+    }
+    for (int i = 0; i < 4; i++) {
+      a[2 * i] = _mm_unpacklo_epi64(c[i], c[i + 4]);
+      a[2 * i + 1] = _mm_unpackhi_epi64(c[i], c[i + 4]);
+    }
+  }
+};
+
+template <>
+struct transpose_block<uint32_t> {
+  static constexpr int N = 4;
+
+  UHDR_TARGET_SSE41 static inline __m128i load(const uint32_t* p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  }
+
+  UHDR_TARGET_SSE41 static inline void store(uint32_t* p, __m128i v) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v);
+  }
+
+  UHDR_TARGET_SSE41 static inline void transpose(__m128i a[N]) {
+    const __m128i b0 = _mm_unpacklo_epi32(a[0], a[1]);
+    const __m128i b1 = _mm_unpacklo_epi32(a[2], a[3]);
+    const __m128i b2 = _mm_unpackhi_epi32(a[0], a[1]);
+    const __m128i b3 = _mm_unpackhi_epi32(a[2], a[3]);
+    a[0] = _mm_unpacklo_epi64(b0, b1);
+    a[1] = _mm_unpackhi_epi64(b0, b1);
+    a[2] = _mm_unpacklo_epi64(b2, b3);
+    a[3] = _mm_unpackhi_epi64(b2, b3);
+  }
+};
+
+template <>
+struct transpose_block<uint64_t> {
+  static constexpr int N = 2;
+
+  UHDR_TARGET_SSE41 static inline __m128i load(const uint64_t* p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  }
+
+  UHDR_TARGET_SSE41 static inline void store(uint64_t* p, __m128i v) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v);
+  }
+
+  UHDR_TARGET_SSE41 static inline void transpose(__m128i a[N]) {
+    const __m128i b0 = _mm_unpacklo_epi64(a[0], a[1]);
+    a[1] = _mm_unpackhi_epi64(a[0], a[1]);
+    a[0] = b0;
+  }
+};
+
+// Reverses the order of the elements of T in a register
+template <typename T>
+UHDR_TARGET_SSE41 static inline __m128i reverse_elements(__m128i v) {
+  if (sizeof(T) == 8) return _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+  if (sizeof(T) == 4) return _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+  if (sizeof(T) == 2) {
+    return _mm_shuffle_epi8(v, _mm_setr_epi8(14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1));
+  }
+  return _mm_shuffle_epi8(v, _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0));
+}
+
+// dst[j] = src[w - 1 - j]
+template <typename T>
+UHDR_TARGET_SSE41 static void reverse_row(const T* src, T* dst, int w) {
+  constexpr int kLanes = 16 / sizeof(T);
+  int j = 0;
+  for (; j + kLanes <= w; j += kLanes) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + w - j - kLanes));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + j), reverse_elements<T>(v));
+  }
+  for (; j < w; j++) dst[j] = src[w - 1 - j];
+}
+
+template <typename T>
+UHDR_TARGET_SSE41 void mirror_buffer_sse41(T* src_buffer, T* dst_buffer, int src_w, int src_h,
+                                           int src_stride, int dst_stride,
+                                           uhdr_mirror_direction_t direction) {
+  if (direction == UHDR_MIRROR_VERTICAL) {
+    for (int i = 0; i < src_h; i++) {
+      memcpy(&dst_buffer[(size_t)(src_h - i - 1) * dst_stride],
+             &src_buffer[(size_t)i * src_stride], src_w * sizeof(T));
+    }
+  } else if (direction == UHDR_MIRROR_HORIZONTAL) {
+    for (int i = 0; i < src_h; i++) {
+      reverse_row(&src_buffer[(size_t)i * src_stride], &dst_buffer[(size_t)i * dst_stride], src_w);
+    }
+  }
+}
+
+// Rotates by 90 or 270 degrees. Output blocks are read as N rows of the input, transposed in
+// registers and written as N rows of the output, so both sides are accessed a row at a time.
+template <typename T>
+UHDR_TARGET_SSE41 static void rotate_buffer_transpose_sse41(T* src_buffer, T* dst_buffer,
+                                                            int src_w, int src_h, int src_stride,
+                                                            int dst_stride, int degree) {
+  using block = transpose_block<T>;
+  constexpr int N = block::N;
+  const int dst_w = src_h, dst_h = src_w;
+  const int blocked_w = dst_w - dst_w % N, blocked_h = dst_h - dst_h % N;
+  __m128i a[N];
+
+  for (int i0 = 0; i0 < blocked_h; i0 += N) {
+    for (int j0 = 0; j0 < blocked_w; j0 += N) {
+      if (degree == 90) {
+        // dst[i][j] = src[src_h - 1 - j][i]
+        for (int k = 0; k < N; k++) {
+          a[k] = block::load(&src_buffer[(size_t)(src_h - 1 - j0 - k) * src_stride + i0]);
+        }
+        block::transpose(a);
+        for (int m = 0; m < N; m++) {
+          block::store(&dst_buffer[(size_t)(i0 + m) * dst_stride + j0], a[m]);
+        }
+      } else {
+        // dst[i][j] = src[j][src_w - 1 - i]
+        for (int k = 0; k < N; k++) {
+          a[k] = block::load(&src_buffer[(size_t)(j0 + k) * src_stride + src_w - i0 - N]);
+        }
+        block::transpose(a);
+        for (int m = 0; m < N; m++) {
+          block::store(&dst_buffer[(size_t)(i0 + N - 1 - m) * dst_stride + j0], a[m]);
+        }
+      }
+    }
+  }
+
+  // right columns and bottom rows of the output that do not fill a block
+  for (int i = 0; i < dst_h; i++) {
+    for (int j = i < blocked_h ? blocked_w : 0; j < dst_w; j++) {
+      dst_buffer[(size_t)i * dst_stride + j] =
+          degree == 90 ? src_buffer[(size_t)(src_h - 1 - j) * src_stride + i]
+                       : src_buffer[(size_t)j * src_stride + (src_w - 1 - i)];
+    }
+  }
+}
+
+template <typename T>
+UHDR_TARGET_SSE41 void rotate_buffer_clockwise_sse41(T* src_buffer, T* dst_buffer, int src_w,
+                                                     int src_h, int src_stride, int dst_stride,
+                                                     int degrees) {
+  if (degrees == 90 || degrees == 270) {
+    rotate_buffer_transpose_sse41(src_buffer, dst_buffer, src_w, src_h, src_stride, dst_stride,
+                                  degrees);
+  } else if (degrees == 180) {
+    for (int i = 0; i < src_h; i++) {
+      reverse_row(&src_buffer[(size_t)(src_h - 1 - i) * src_stride],
+                  &dst_buffer[(size_t)i * dst_stride], src_w);
+    }
+  }
+}
+
+template void mirror_buffer_sse41<uint8_t>(uint8_t*, uint8_t*, int, int, int, int,
+                                           uhdr_mirror_direction_t);
+template void mirror_buffer_sse41<uint16_t>(uint16_t*, uint16_t*, int, int, int, int,
+                                            uhdr_mirror_direction_t);
+template void mirror_buffer_sse41<uint32_t>(uint32_t*, uint32_t*, int, int, int, int,
+                                            uhdr_mirror_direction_t);
+template void mirror_buffer_sse41<uint64_t>(uint64_t*, uint64_t*, int, int, int, int,
+                                            uhdr_mirror_direction_t);
+
+template void rotate_buffer_clockwise_sse41<uint8_t>(uint8_t*, uint8_t*, int, int, int, int, int);
+template void rotate_buffer_clockwise_sse41<uint16_t>(uint16_t*, uint16_t*, int, int, int, int,
+                                                      int);
+template void rotate_buffer_clockwise_sse41<uint32_t>(uint32_t*, uint32_t*, int, int, int, int,
+                                                      int);
+template void rotate_buffer_clockwise_sse41<uint64_t>(uint64_t*, uint64_t*, int, int, int, int,
+                                                      int);
+
+}  // namespace ultrahdr
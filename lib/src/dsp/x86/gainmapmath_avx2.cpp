@@ -0,0 +1,769 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ultrahdr/gainmapmath.h"
+
+#include <immintrin.h>
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+
+// The library is built for the baseline isa of the target. The kernels in this file are compiled
+// for avx2 individually and are only reached after a runtime check of the cpu features.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define UHDR_TARGET_AVX2
+#else
+#define UHDR_TARGET_AVX2 __attribute__((target("avx2,f16c")))
+#endif
+
+namespace ultrahdr {
+
+// Rec.601 yuv <-> rgb coefficients, see p3YuvToRgb() and p3RgbToYuv()
+static const float kP3YR = 0.299f, kP3YG = 0.587f, kP3YB = 0.114f;
+static const float kP3Cb = 1.772f, kP3Cr = 1.402f;
+static const float kP3GCb = kP3YB * kP3Cb / kP3YG;
+static const float kP3GCr = kP3YR * kP3Cr / kP3YG;
+
+// Natural logarithm for x > 0, see Cephes logf(). Relative error is in the order of 1e-7.
+UHDR_TARGET_AVX2 static inline __m256 log_avx2(__m256 x) {
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256i bits = _mm256_castps_si256(x);
+  __m256 e = _mm256_cvtepi32_ps(
+      _mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+  __m256 m = _mm256_castsi256_ps(_mm256_or_si256(
+      _mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)), _mm256_set1_epi32(0x3f800000)));
+
+  // move the mantissa to [sqrt(0.5), sqrt(2))
+  const __m256 big = _mm256_cmp_ps(m, _mm256_set1_ps(1.41421356f), _CMP_GT_OQ);
+  m = _mm256_blendv_ps(m, _mm256_mul_ps(m, _mm256_set1_ps(0.5f)), big);
+  e = _mm256_add_ps(e, _mm256_and_ps(big, one));
+
+  const __m256 t = _mm256_sub_ps(m, one);
+  const __m256 z = _mm256_mul_ps(t, t);
+  __m256 p = _mm256_set1_ps(7.0376836292E-2f);
+  p = _mm256_add_ps(_mm256_mul_ps(p, t), _mm256_set1_ps(-1.1514610310E-1f));
+  p = _mm256_add_ps(_mm256_mul_ps(p, t), _mm256_set1_ps(1.1676998740E-1f));
+  p = _mm256_add_ps(_mm256_mul_ps(p, t), _mm256_set1_ps(-1.2420140846E-1f));
+  p = _mm256_add_ps(_mm256_mul_ps(p, t), _mm256_set1_ps(1.4249322787E-1f));
+  p = _mm256_add_ps(_mm256_mul_ps(p, t), _mm256_set1_ps(-1.6668057665E-1f));
+  p = _mm256_add_ps(_mm256_mul_ps(p, t), _mm256_set1_ps(2.0000714765E-1f));
+  p = _mm256_add_ps(_mm256_mul_ps(p, t), _mm256_set1_ps(-2.4999993993E-1f));
+  p = _mm256_add_ps(_mm256_mul_ps(p, t), _mm256_set1_ps(3.3333331174E-1f));
+  p = _mm256_mul_ps(_mm256_mul_ps(p, t), z);
+  p = _mm256_add_ps(p, _mm256_mul_ps(e, _mm256_set1_ps(-2.12194440e-4f)));
+  p = _mm256_sub_ps(p, _mm256_mul_ps(z, _mm256_set1_ps(0.5f)));
+  return _mm256_add_ps(_mm256_add_ps(t, p), _mm256_mul_ps(e, _mm256_set1_ps(0.693359375f)));
+}
+
+// Natural exponent, see Cephes expf(). Inputs are clamped to the range of normal floats.
+UHDR_TARGET_AVX2 static inline __m256 exp_avx2(__m256 x) {
+  x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-87.3f)), _mm256_set1_ps(88.3f));
+  const __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)),
+                                   _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  x = _mm256_sub_ps(x, _mm256_mul_ps(n, _mm256_set1_ps(0.693359375f)));
+  x = _mm256_sub_ps(x, _mm256_mul_ps(n, _mm256_set1_ps(-2.12194440e-4f)));
+
+  const __m256 z = _mm256_mul_ps(x, x);
+  __m256 p = _mm256_set1_ps(1.9875691500E-4f);
+  p = _mm256_add_ps(_mm256_mul_ps(p, x), _mm256_set1_ps(1.3981999507E-3f));
+  p = _mm256_add_ps(_mm256_mul_ps(p, x), _mm256_set1_ps(8.3334519073E-3f));
+  p = _mm256_add_ps(_mm256_mul_ps(p, x), _mm256_set1_ps(4.1665795894E-2f));
+  p = _mm256_add_ps(_mm256_mul_ps(p, x), _mm256_set1_ps(1.6666665459E-1f));
+  p = _mm256_add_ps(_mm256_mul_ps(p, x), _mm256_set1_ps(5.0000001201E-1f));
+  p = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(p, z), x), _mm256_set1_ps(1.0f));
+
+  const __m256i scale = _mm256_slli_epi32(
+      _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(p, _mm256_castsi256_ps(scale));
+}
+
+// x^p for x > 0. Like std::pow() for a non-integer p, non-positive inputs do not produce a usable
+// result, they are mapped to 0 which is where the following table lookup clamps them anyway.
+UHDR_TARGET_AVX2 static inline __m256 pow_avx2(__m256 x, float p) {
+  const __m256 positive = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GT_OQ);
+  x = _mm256_max_ps(x, _mm256_set1_ps(FLT_MIN));
+  return _mm256_and_ps(exp_avx2(_mm256_mul_ps(_mm256_set1_ps(p), log_avx2(x))), positive);
+}
+
+// Vector counterpart of the *LUT() transfer functions
+UHDR_TARGET_AVX2 static inline __m256 lookup_avx2(const float* table, int num_entries, __m256 e) {
+  __m256i idx = _mm256_cvttps_epi32(_mm256_add_ps(
+      _mm256_mul_ps(e, _mm256_set1_ps(static_cast<float>(num_entries - 1))), _mm256_set1_ps(0.5f)));
+  idx = _mm256_min_epi32(_mm256_max_epi32(idx, _mm256_setzero_si256()),
+                         _mm256_set1_epi32(num_entries - 1));
+  return _mm256_i32gather_ps(table, idx, 4);
+}
+
+UHDR_TARGET_AVX2 static inline __m256 clampPixelFloat_avx2(__m256 e) {
+  return _mm256_min_ps(_mm256_max_ps(e, _mm256_setzero_ps()), _mm256_set1_ps(kMaxPixelFloat));
+}
+
+UHDR_TARGET_AVX2 static inline __m256 loadChroma_avx2(const uint8_t* src) {
+  uint32_t packed;
+  memcpy(&packed, src, sizeof packed);
+  __m128i c = _mm_sub_epi32(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(static_cast<int>(packed))),
+                            _mm_set1_epi32(128));
+  // each chroma sample covers two horizontally adjacent luma samples
+  __m256i c2 = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi32(c, c)),
+                                       _mm_unpackhi_epi32(c, c), 1);
+  return _mm256_mul_ps(_mm256_cvtepi32_ps(c2), _mm256_set1_ps(1 / 255.0f));
+}
+
+UHDR_TARGET_AVX2 static inline __m256 loadMap_avx2(const uint8_t* row, __m256i idx) {
+  __m256i v = _mm256_and_si256(_mm256_i32gather_epi32(reinterpret_cast<const int*>(row), idx, 1),
+                               _mm256_set1_epi32(0xff));
+  return _mm256_div_ps(_mm256_cvtepi32_ps(v), _mm256_set1_ps(255.0f));
+}
+
+// Vector counterpart of hdrCodeLUTIndex() and the code table lookup. The gather reads 32 bits at
+// 16-bit offsets, which the extra entry at the end of the tables allows for.
+UHDR_TARGET_AVX2 static inline __m256i lookupCodes_avx2(const uint16_t* table, __m256 e) {
+  __m256i idx = _mm256_sub_epi32(_mm256_srai_epi32(_mm256_castps_si256(e), kHdrCodeLUTShift),
+                                 _mm256_set1_epi32(kHdrCodeLUTBias));
+  idx = _mm256_min_epi32(_mm256_max_epi32(idx, _mm256_setzero_si256()),
+                         _mm256_set1_epi32(kHdrCodeLUTNumEntries - 1));
+  return _mm256_and_si256(_mm256_i32gather_epi32(reinterpret_cast<const int*>(table), idx, 2),
+                          _mm256_set1_epi32(0xffff));
+}
+
+// See hlgLinearToRgba1010102() and pqLinearToRgba1010102()
+UHDR_TARGET_AVX2 static inline __m256i toRgba1010102_avx2(const uint16_t* table, __m256 r,
+                                                          __m256 g, __m256 b) {
+  __m256i out = _mm256_or_si256(lookupCodes_avx2(table, r),
+                                _mm256_slli_epi32(lookupCodes_avx2(table, g), 10));
+  out = _mm256_or_si256(out, _mm256_slli_epi32(lookupCodes_avx2(table, b), 20));
+  return _mm256_or_si256(out, _mm256_set1_epi32(static_cast<int>(0xc0000000)));  // alpha to 1.0
+}
+
+UHDR_TARGET_AVX2 static inline __m256 dot3_avx2(const float* k, __m256 r, __m256 g, __m256 b) {
+  return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(k[0]), r),
+                                     _mm256_mul_ps(_mm256_set1_ps(k[1]), g)),
+                       _mm256_mul_ps(_mm256_set1_ps(k[2]), b));
+}
+
+UHDR_TARGET_AVX2 size_t applyGainMapRowYuv420_avx2(
+    uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* gainmap_img, uhdr_raw_image_t* dest,
+    size_t map_scale_factor, ShepardsIDW& idwTable, GainLUT& gainLUT,
+    uhdr_gainmap_metadata_ext_t* metadata, uhdr_color_transfer_t output_ct,
+    const float* gamut_matrix, size_t y) {
+  if (output_ct != UHDR_CT_LINEAR && output_ct != UHDR_CT_HLG && output_ct != UHDR_CT_PQ) return 0;
+
+  // gain map samples are gathered 4 bytes at a time, so stay clear of the last map columns
+  const size_t map_w = gainmap_img->w;
+  if (map_w < 5) return 0;
+  const size_t width =
+      (std::min)(static_cast<size_t>(sdr_intent->w), (map_w - 4) * map_scale_factor);
+  const size_t vec_width = width & ~static_cast<size_t>(7);
+  if (vec_width == 0) return 0;
+
+  const uint8_t* y_row = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_Y]) +
+                         y * sdr_intent->stride[UHDR_PLANE_Y];
+  const uint8_t* u_row = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_U]) +
+                         (y / 2) * sdr_intent->stride[UHDR_PLANE_U];
+  const uint8_t* v_row = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_V]) +
+                         (y / 2) * sdr_intent->stride[UHDR_PLANE_V];
+
+  const size_t y_lower = (std::min)(y / map_scale_factor, static_cast<size_t>(gainmap_img->h) - 1);
+  const size_t y_upper =
+      (std::min)(y / map_scale_factor + 1, static_cast<size_t>(gainmap_img->h) - 1);
+  const uint8_t* map_data = static_cast<uint8_t*>(gainmap_img->planes[UHDR_PLANE_Y]);
+  const size_t map_stride = gainmap_img->stride[UHDR_PLANE_Y];
+  const uint8_t* map_top = map_data + y_lower * map_stride;
+  const uint8_t* map_bottom = map_data + y_upper * map_stride;
+  const float* weights = (y_lower == y_upper) ? idwTable.mWeightsNB : idwTable.mWeights;
+  weights += (y % map_scale_factor) * map_scale_factor * 4;
+
+  const float* srgb_lut = getSrgbInvOetfLUT();
+  const uint16_t* code_lut = output_ct == UHDR_CT_HLG  ? getHlgCodeLUT()
+                            : output_ct == UHDR_CT_PQ ? getPqCodeLUT()
+                                                      : nullptr;
+  const float* gain_table = gainLUT.getGainTable();
+
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i scale_i = _mm256_set1_epi32(static_cast<int>(map_scale_factor));
+  const __m256 scale_f = _mm256_set1_ps(static_cast<float>(map_scale_factor));
+  const __m256 offset_sdr = _mm256_set1_ps(metadata->offset_sdr);
+  const __m256 offset_hdr = _mm256_set1_ps(metadata->offset_hdr);
+  const __m256 inv_255 = _mm256_set1_ps(1 / 255.0f);
+
+  uint8_t* dst = static_cast<uint8_t*>(dest->planes[UHDR_PLANE_PACKED]);
+  const size_t dst_offset = y * dest->stride[UHDR_PLANE_PACKED];
+
+  for (size_t x = 0; x < vec_width; x += 8) {
+    // yuv -> linear rgb
+    const __m256 y_f = _mm256_mul_ps(
+        _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(
+            reinterpret_cast<const __m128i*>(y_row + x)))),
+        inv_255);
+    const __m256 u_f = loadChroma_avx2(u_row + x / 2);
+    const __m256 v_f = loadChroma_avx2(v_row + x / 2);
+    __m256 r = clampPixelFloat_avx2(_mm256_add_ps(y_f, _mm256_mul_ps(_mm256_set1_ps(kP3Cr), v_f)));
+    __m256 g = clampPixelFloat_avx2(
+        _mm256_sub_ps(_mm256_sub_ps(y_f, _mm256_mul_ps(_mm256_set1_ps(kP3GCb), u_f)),
+                      _mm256_mul_ps(_mm256_set1_ps(kP3GCr), v_f)));
+    __m256 b = clampPixelFloat_avx2(_mm256_add_ps(y_f, _mm256_mul_ps(_mm256_set1_ps(kP3Cb), u_f)));
+    r = lookup_avx2(srgb_lut, kSrgbInvOETFNumEntries, r);
+    g = lookup_avx2(srgb_lut, kSrgbInvOETFNumEntries, g);
+    b = lookup_avx2(srgb_lut, kSrgbInvOETFNumEntries, b);
+
+    // sample gain map, see sampleMap() with ShepardsIDW
+    const __m256i xs = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(x)), lanes);
+    const __m256i x_lower = _mm256_cvttps_epi32(
+        _mm256_div_ps(_mm256_add_ps(_mm256_cvtepi32_ps(xs), _mm256_set1_ps(0.5f)), scale_f));
+    const __m256i x_upper = _mm256_add_epi32(x_lower, _mm256_set1_epi32(1));
+    const __m256i w_idx =
+        _mm256_slli_epi32(_mm256_sub_epi32(xs, _mm256_mullo_epi32(x_lower, scale_i)), 2);
+    const __m256 e1 = loadMap_avx2(map_top, x_lower);
+    const __m256 e2 = loadMap_avx2(map_bottom, x_lower);
+    const __m256 e3 = loadMap_avx2(map_top, x_upper);
+    const __m256 e4 = loadMap_avx2(map_bottom, x_upper);
+    __m256 gain = _mm256_mul_ps(e1, _mm256_i32gather_ps(weights, w_idx, 4));
+    gain = _mm256_add_ps(gain, _mm256_mul_ps(e2, _mm256_i32gather_ps(weights + 1, w_idx, 4)));
+    gain = _mm256_add_ps(gain, _mm256_mul_ps(e3, _mm256_i32gather_ps(weights + 2, w_idx, 4)));
+    gain = _mm256_add_ps(gain, _mm256_mul_ps(e4, _mm256_i32gather_ps(weights + 3, w_idx, 4)));
+
+    // apply gain, see applyGainLUT()
+    const __m256 gain_factor = lookup_avx2(gain_table, kGainFactorNumEntries, gain);
+    r = _mm256_sub_ps(_mm256_mul_ps(_mm256_add_ps(r, offset_sdr), gain_factor), offset_hdr);
+    g = _mm256_sub_ps(_mm256_mul_ps(_mm256_add_ps(g, offset_sdr), gain_factor), offset_hdr);
+    b = _mm256_sub_ps(_mm256_mul_ps(_mm256_add_ps(b, offset_sdr), gain_factor), offset_hdr);
+    if (gamut_matrix != nullptr) {
+      // output gamut, see getGamutConversionMatrix()
+      const __m256 r_out = dot3_avx2(gamut_matrix, r, g, b);
+      const __m256 g_out = dot3_avx2(gamut_matrix + 3, r, g, b);
+      b = dot3_avx2(gamut_matrix + 6, r, g, b);
+      r = r_out;
+      g = g_out;
+      // colors outside of the output gamut map to code 0 in the hlg and pq tables
+    }
+
+    if (output_ct == UHDR_CT_LINEAR) {
+      const __m128i r_h = _mm256_cvtps_ph(r, _MM_FROUND_TO_NEAREST_INT);
+      const __m128i g_h = _mm256_cvtps_ph(g, _MM_FROUND_TO_NEAREST_INT);
+      const __m128i b_h = _mm256_cvtps_ph(b, _MM_FROUND_TO_NEAREST_INT);
+      const __m128i a_h = _mm_set1_epi16(0x3c00);  // 1.0f
+      const __m128i rg_lo = _mm_unpacklo_epi16(r_h, g_h);
+      const __m128i ba_lo = _mm_unpacklo_epi16(b_h, a_h);
+      const __m128i rg_hi = _mm_unpackhi_epi16(r_h, g_h);
+      const __m128i ba_hi = _mm_unpackhi_epi16(b_h, a_h);
+      __m128i* out = reinterpret_cast<__m128i*>(dst + (dst_offset + x) * sizeof(uint64_t));
+      _mm_storeu_si128(out, _mm_unpacklo_epi32(rg_lo, ba_lo));
+      _mm_storeu_si128(out + 1, _mm_unpackhi_epi32(rg_lo, ba_lo));
+      _mm_storeu_si128(out + 2, _mm_unpacklo_epi32(rg_hi, ba_hi));
+      _mm_storeu_si128(out + 3, _mm_unpackhi_epi32(rg_hi, ba_hi));
+    } else {
+      // scaling, inverse ootf, oetf and quantization in one lookup per component
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + (dst_offset + x) * sizeof(uint32_t)),
+                          toRgba1010102_avx2(code_lut, r, g, b));
+    }
+  }
+
+  return vec_width;
+}
+
+// See computeGain()
+UHDR_TARGET_AVX2 static inline __m256 computeGain_avx2(__m256 sdr, __m256 hdr) {
+  const __m256 ratio = _mm256_div_ps(_mm256_add_ps(hdr, _mm256_set1_ps(kHdrOffset)),
+                                     _mm256_add_ps(sdr, _mm256_set1_ps(kSdrOffset)));
+  const __m256 gain = _mm256_mul_ps(log_avx2(ratio), _mm256_set1_ps(1.44269504088896341f));
+  const __m256 dark = _mm256_cmp_ps(sdr, _mm256_set1_ps(2.f / 255.0f), _CMP_LT_OQ);
+  return _mm256_blendv_ps(gain, _mm256_min_ps(gain, _mm256_set1_ps(2.3f)), dark);
+}
+
+UHDR_TARGET_AVX2 static inline void yuvToRgb_avx2(const float coeffs[4], const float* y,
+                                                  const float* u, const float* v, __m256& r,
+                                                  __m256& g, __m256& b) {
+  const __m256 y_f = _mm256_load_ps(y);
+  const __m256 u_f = _mm256_load_ps(u);
+  const __m256 v_f = _mm256_load_ps(v);
+  r = clampPixelFloat_avx2(_mm256_add_ps(y_f, _mm256_mul_ps(_mm256_set1_ps(coeffs[0]), v_f)));
+  g = clampPixelFloat_avx2(
+      _mm256_sub_ps(_mm256_sub_ps(y_f, _mm256_mul_ps(_mm256_set1_ps(coeffs[1]), u_f)),
+                    _mm256_mul_ps(_mm256_set1_ps(coeffs[2]), v_f)));
+  b = clampPixelFloat_avx2(_mm256_add_ps(y_f, _mm256_mul_ps(_mm256_set1_ps(coeffs[3]), u_f)));
+}
+
+UHDR_TARGET_AVX2 size_t generateGainMapRow_avx2(uhdr_raw_image_t* sdr_intent,
+                                                uhdr_raw_image_t* hdr_intent,
+                                                const GainMapRowParams& params,
+                                                size_t map_scale_factor, size_t map_width,
+                                                size_t y, float* gains) {
+  const size_t vec_width = map_width & ~static_cast<size_t>(7);
+  alignas(32) float sdr_yuv[3][kGainMapRowChunk];
+  alignas(32) float hdr_yuv[3][kGainMapRowChunk];
+  float* sdr_planes[3] = {sdr_yuv[0], sdr_yuv[1], sdr_yuv[2]};
+  float* hdr_planes[3] = {hdr_yuv[0], hdr_yuv[1], hdr_yuv[2]};
+  const float* srgb_lut = getSrgbInvOetfLUT();
+  const float* m = params.hdr_gamut_matrix.data();
+  const __m256 sdr_nits = _mm256_set1_ps(kSdrWhiteNits);
+  const __m256 hdr_nits = _mm256_set1_ps(params.hdr_sample_to_nits);
+  const __m256 zero = _mm256_setzero_ps();
+
+  for (size_t x = 0; x < vec_width; x += 8) {
+    const size_t chunk_x = x % kGainMapRowChunk;
+    if (chunk_x == 0) {
+      const size_t len = (std::min)(kGainMapRowChunk, vec_width - x);
+      sampleYuv420Row(sdr_intent, map_scale_factor, x, y, len, sdr_planes);
+      sampleP010Row(hdr_intent, map_scale_factor, x, y, len, hdr_planes);
+    }
+
+    // sdr yuv -> linear rgb
+    __m256 sr, sg, sb;
+    yuvToRgb_avx2(params.sdr_yuv_to_rgb, sdr_yuv[0] + chunk_x, sdr_yuv[1] + chunk_x,
+                  sdr_yuv[2] + chunk_x, sr, sg, sb);
+    sr = lookup_avx2(srgb_lut, kSrgbInvOETFNumEntries, sr);
+    sg = lookup_avx2(srgb_lut, kSrgbInvOETFNumEntries, sg);
+    sb = lookup_avx2(srgb_lut, kSrgbInvOETFNumEntries, sb);
+
+    // hdr yuv -> linear rgb in sdr gamut
+    __m256 hr, hg, hb;
+    yuvToRgb_avx2(params.hdr_yuv_to_rgb, hdr_yuv[0] + chunk_x, hdr_yuv[1] + chunk_x,
+                  hdr_yuv[2] + chunk_x, hr, hg, hb);
+    hr = lookup_avx2(params.hdr_inv_oetf_lut, params.hdr_inv_oetf_entries, hr);
+    hg = lookup_avx2(params.hdr_inv_oetf_lut, params.hdr_inv_oetf_entries, hg);
+    hb = lookup_avx2(params.hdr_inv_oetf_lut, params.hdr_inv_oetf_entries, hb);
+    if (params.hdr_ootf_gamma != 1.0f) {
+      hr = pow_avx2(hr, params.hdr_ootf_gamma);
+      hg = pow_avx2(hg, params.hdr_ootf_gamma);
+      hb = pow_avx2(hb, params.hdr_ootf_gamma);
+    }
+    const __m256 cr = dot3_avx2(m, hr, hg, hb);
+    const __m256 cg = dot3_avx2(m + 3, hr, hg, hb);
+    const __m256 cb = dot3_avx2(m + 6, hr, hg, hb);
+    hr = _mm256_max_ps(cr, zero);
+    hg = _mm256_max_ps(cg, zero);
+    hb = _mm256_max_ps(cb, zero);
+
+    if (params.multichannel) {
+      alignas(32) float out[3][8];
+      _mm256_store_ps(out[0], computeGain_avx2(_mm256_mul_ps(sr, sdr_nits),
+                                               _mm256_mul_ps(hr, hdr_nits)));
+      _mm256_store_ps(out[1], computeGain_avx2(_mm256_mul_ps(sg, sdr_nits),
+                                               _mm256_mul_ps(hg, hdr_nits)));
+      _mm256_store_ps(out[2], computeGain_avx2(_mm256_mul_ps(sb, sdr_nits),
+                                               _mm256_mul_ps(hb, hdr_nits)));
+      for (int i = 0; i < 8; i++) {
+        gains[(x + i) * 3] = out[0][i];
+        gains[(x + i) * 3 + 1] = out[1][i];
+        gains[(x + i) * 3 + 2] = out[2][i];
+      }
+    } else {
+      __m256 sdr_y, hdr_y;
+      if (params.use_luminance) {
+        sdr_y = dot3_avx2(params.luminance.data(), sr, sg, sb);
+        hdr_y = dot3_avx2(params.luminance.data(), hr, hg, hb);
+      } else {
+        sdr_y = _mm256_max_ps(sr, _mm256_max_ps(sg, sb));
+        hdr_y = _mm256_max_ps(hr, _mm256_max_ps(hg, hb));
+      }
+      _mm256_storeu_ps(gains + x, computeGain_avx2(_mm256_mul_ps(sdr_y, sdr_nits),
+                                                   _mm256_mul_ps(hdr_y, hdr_nits)));
+    }
+  }
+
+  return vec_width;
+}
+
+UHDR_TARGET_AVX2 static inline __m256 loadP010_avx2(const uint16_t* src, __m256 bias,
+                                                  __m256 scale) {
+  const __m128i v = _mm_srli_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src)), 6);
+  return _mm256_mul_ps(_mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(v)), bias), scale);
+}
+
+// See ScaleTo8Bit(), values are rounded half away from zero
+UHDR_TARGET_AVX2 static inline __m256i scaleTo8Bit_avx2(__m256 v) {
+  v = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(v, _mm256_set1_ps(255.0f)), _mm256_setzero_ps()),
+                    _mm256_set1_ps(255.0f));
+  return _mm256_cvttps_epi32(_mm256_add_ps(v, _mm256_set1_ps(0.5f)));
+}
+
+// hdr yuv -> sdr yuv of 8 pixels, see JpegR::toneMap()
+UHDR_TARGET_AVX2 static inline void toneMap8_avx2(const ToneMapRowParams& params, __m256 y_f,
+                                                  __m256 u_f, __m256 v_f, __m256& y_out,
+                                                  __m256& u_out, __m256& v_out) {
+  const float* c = params.hdr_yuv_to_rgb;
+  __m256 r = clampPixelFloat_avx2(_mm256_add_ps(y_f, _mm256_mul_ps(_mm256_set1_ps(c[0]), v_f)));
+  __m256 g = clampPixelFloat_avx2(
+      _mm256_sub_ps(_mm256_sub_ps(y_f, _mm256_mul_ps(_mm256_set1_ps(c[1]), u_f)),
+                    _mm256_mul_ps(_mm256_set1_ps(c[2]), v_f)));
+  __m256 b = clampPixelFloat_avx2(_mm256_add_ps(y_f, _mm256_mul_ps(_mm256_set1_ps(c[3]), u_f)));
+  r = lookup_avx2(params.hdr_inv_oetf_lut, params.hdr_inv_oetf_entries, r);
+  g = lookup_avx2(params.hdr_inv_oetf_lut, params.hdr_inv_oetf_entries, g);
+  b = lookup_avx2(params.hdr_inv_oetf_lut, params.hdr_inv_oetf_entries, b);
+  if (params.hdr_ootf_gamma != 1.0f) {
+    r = pow_avx2(r, params.hdr_ootf_gamma);
+    g = pow_avx2(g, params.hdr_ootf_gamma);
+    b = pow_avx2(b, params.hdr_ootf_gamma);
+  }
+
+  // globalTonemap(), the reinhard curve scales all channels by max_sdr / max_hdr
+  const __m256 headroom = _mm256_set1_ps(params.headroom);
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 zero = _mm256_setzero_ps();
+  r = _mm256_mul_ps(r, headroom);
+  g = _mm256_mul_ps(g, headroom);
+  b = _mm256_mul_ps(b, headroom);
+  const __m256 max_hdr = _mm256_max_ps(r, _mm256_max_ps(g, b));
+  const __m256 scale = _mm256_div_ps(
+      _mm256_add_ps(one, _mm256_div_ps(max_hdr, _mm256_mul_ps(headroom, headroom))),
+      _mm256_add_ps(one, max_hdr));
+  r = _mm256_max_ps(_mm256_mul_ps(r, scale), zero);
+  g = _mm256_max_ps(_mm256_mul_ps(g, scale), zero);
+  b = _mm256_max_ps(_mm256_mul_ps(b, scale), zero);
+
+  const float* m = params.hdr_gamut_matrix.data();
+  __m256 sr = clampPixelFloat_avx2(dot3_avx2(m, r, g, b));
+  __m256 sg = clampPixelFloat_avx2(dot3_avx2(m + 3, r, g, b));
+  __m256 sb = clampPixelFloat_avx2(dot3_avx2(m + 6, r, g, b));
+
+  // srgbOetf()
+  const __m256 threshold = _mm256_set1_ps(0.0031308f);
+  const __m256 low_slope = _mm256_set1_ps(12.92f);
+  const __m256 high_offset = _mm256_set1_ps(0.055f);
+  const __m256 high_scale = _mm256_set1_ps(1.055f);
+  __m256 lo = _mm256_mul_ps(sr, low_slope);
+  __m256 hi = _mm256_sub_ps(_mm256_mul_ps(high_scale, pow_avx2(sr, 1.0f / 2.4f)), high_offset);
+  sr = _mm256_blendv_ps(hi, lo, _mm256_cmp_ps(sr, threshold, _CMP_LE_OQ));
+  lo = _mm256_mul_ps(sg, low_slope);
+  hi = _mm256_sub_ps(_mm256_mul_ps(high_scale, pow_avx2(sg, 1.0f / 2.4f)), high_offset);
+  sg = _mm256_blendv_ps(hi, lo, _mm256_cmp_ps(sg, threshold, _CMP_LE_OQ));
+  lo = _mm256_mul_ps(sb, low_slope);
+  hi = _mm256_sub_ps(_mm256_mul_ps(high_scale, pow_avx2(sb, 1.0f / 2.4f)), high_offset);
+  sb = _mm256_blendv_ps(hi, lo, _mm256_cmp_ps(sb, threshold, _CMP_LE_OQ));
+
+  // p3RgbToYuv(), chroma is biased to [0, 1]
+  static const float kP3Luma[3] = {kP3YR, kP3YG, kP3YB};
+  const __m256 half = _mm256_set1_ps(0.5f);
+  y_out = dot3_avx2(kP3Luma, sr, sg, sb);
+  u_out = _mm256_add_ps(_mm256_div_ps(_mm256_sub_ps(sb, y_out), _mm256_set1_ps(kP3Cb)), half);
+  v_out = _mm256_add_ps(_mm256_div_ps(_mm256_sub_ps(sr, y_out), _mm256_set1_ps(kP3Cr)), half);
+}
+
+UHDR_TARGET_AVX2 size_t toneMapRowP010_avx2(uhdr_raw_image_t* hdr_intent,
+                                            uhdr_raw_image_t* sdr_intent,
+                                            const ToneMapRowParams& params, size_t y) {
+  const size_t vec_width = hdr_intent->w & ~static_cast<size_t>(7);
+  const uint16_t* luma = static_cast<uint16_t*>(hdr_intent->planes[UHDR_PLANE_Y]);
+  const uint16_t* chroma = static_cast<uint16_t*>(hdr_intent->planes[UHDR_PLANE_UV]);
+  const uint16_t* y_rows[2] = {luma + y * hdr_intent->stride[UHDR_PLANE_Y],
+                               luma + (y + 1) * hdr_intent->stride[UHDR_PLANE_Y]};
+  const uint16_t* uv_row = chroma + (y / 2) * hdr_intent->stride[UHDR_PLANE_UV];
+  uint8_t* sdr_luma = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_Y]);
+  uint8_t* out_y[2] = {sdr_luma + y * sdr_intent->stride[UHDR_PLANE_Y],
+                       sdr_luma + (y + 1) * sdr_intent->stride[UHDR_PLANE_Y]};
+  uint8_t* out_u = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_U]) +
+                   (y / 2) * sdr_intent->stride[UHDR_PLANE_U];
+  uint8_t* out_v = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_V]) +
+                   (y / 2) * sdr_intent->stride[UHDR_PLANE_V];
+
+  // see getP010Pixel()
+  const bool full_range = hdr_intent->range == UHDR_CR_FULL_RANGE;
+  const __m256 bias = _mm256_set1_ps(full_range ? 0.0f : 64.0f);
+  const __m256 y_scale = _mm256_set1_ps(full_range ? 1 / 1023.0f : 1 / 876.0f);
+  const __m256 uv_scale = _mm256_set1_ps(full_range ? 1 / 1023.0f : 1 / 896.0f);
+  const __m256 half = _mm256_set1_ps(0.5f);
+  const __m256i chroma_order = _mm256_setr_epi32(0, 1, 4, 5, 0, 1, 4, 5);
+
+  for (size_t x = 0; x < vec_width; x += 8) {
+    // each uv pair covers two horizontally adjacent pixels
+    const __m256 uv_f = _mm256_sub_ps(loadP010_avx2(uv_row + x, bias, uv_scale), half);
+    const __m256 u_f = _mm256_shuffle_ps(uv_f, uv_f, _MM_SHUFFLE(2, 2, 0, 0));
+    const __m256 v_f = _mm256_shuffle_ps(uv_f, uv_f, _MM_SHUFFLE(3, 3, 1, 1));
+
+    __m256 u_sum = _mm256_setzero_ps(), v_sum = _mm256_setzero_ps();
+    for (int i = 0; i < 2; i++) {
+      __m256 y_out, u_out, v_out;
+      toneMap8_avx2(params, loadP010_avx2(y_rows[i] + x, bias, y_scale), u_f, v_f, y_out, u_out,
+                    v_out);
+      const __m256i y_i = scaleTo8Bit_avx2(y_out);
+      const __m128i y_16 =
+          _mm_packs_epi32(_mm256_castsi256_si128(y_i), _mm256_extracti128_si256(y_i, 1));
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(out_y[i] + x), _mm_packus_epi16(y_16, y_16));
+      u_sum = _mm256_add_ps(u_sum, u_out);
+      v_sum = _mm256_add_ps(v_sum, v_out);
+    }
+
+    // average the 2x2 blocks
+    const __m256 quarter = _mm256_set1_ps(0.25f);
+    const __m256 u_avg = _mm256_mul_ps(
+        _mm256_permutevar8x32_ps(_mm256_hadd_ps(u_sum, u_sum), chroma_order), quarter);
+    const __m256 v_avg = _mm256_mul_ps(
+        _mm256_permutevar8x32_ps(_mm256_hadd_ps(v_sum, v_sum), chroma_order), quarter);
+    const __m256i u_i = scaleTo8Bit_avx2(u_avg);
+    const __m256i v_i = scaleTo8Bit_avx2(v_avg);
+    const __m128i uv_16 =
+        _mm_packs_epi32(_mm256_castsi256_si128(u_i), _mm256_castsi256_si128(v_i));
+    const __m128i uv_8 = _mm_packus_epi16(uv_16, uv_16);
+    const uint32_t u_packed = static_cast<uint32_t>(_mm_cvtsi128_si32(uv_8));
+    const uint32_t v_packed = static_cast<uint32_t>(_mm_extract_epi32(uv_8, 1));
+    memcpy(out_u + x / 2, &u_packed, sizeof u_packed);
+    memcpy(out_v + x / 2, &v_packed, sizeof v_packed);
+  }
+
+  return vec_width;
+}
+
+UHDR_TARGET_AVX2 size_t rgbaF16ToFloatRow_avx2(const uint64_t* src, size_t count, float* dst[3]) {
+  const size_t vec_count = count & ~static_cast<size_t>(7);
+  // gathers the halves of two pixels by channel, {r0 r1 g0 g1 b0 b1 a0 a1}
+  const __m128i by_channel = _mm_setr_epi8(0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15);
+  for (size_t x = 0; x < vec_count; x += 8) {
+    const __m128i* in = reinterpret_cast<const __m128i*>(src + x);
+    const __m128i p01 = _mm_shuffle_epi8(_mm_loadu_si128(in), by_channel);
+    const __m128i p23 = _mm_shuffle_epi8(_mm_loadu_si128(in + 1), by_channel);
+    const __m128i p45 = _mm_shuffle_epi8(_mm_loadu_si128(in + 2), by_channel);
+    const __m128i p67 = _mm_shuffle_epi8(_mm_loadu_si128(in + 3), by_channel);
+    const __m128i rg_lo = _mm_unpacklo_epi32(p01, p23);
+    const __m128i ba_lo = _mm_unpackhi_epi32(p01, p23);
+    const __m128i rg_hi = _mm_unpacklo_epi32(p45, p67);
+    const __m128i ba_hi = _mm_unpackhi_epi32(p45, p67);
+    _mm256_storeu_ps(dst[0] + x, _mm256_cvtph_ps(_mm_unpacklo_epi64(rg_lo, rg_hi)));
+    _mm256_storeu_ps(dst[1] + x, _mm256_cvtph_ps(_mm_unpackhi_epi64(rg_lo, rg_hi)));
+    _mm256_storeu_ps(dst[2] + x, _mm256_cvtph_ps(_mm_unpacklo_epi64(ba_lo, ba_hi)));
+  }
+  return vec_count;
+}
+
+UHDR_TARGET_AVX2 size_t floatToRgbaF16Row_avx2(float* const src[3], size_t count, uint64_t* dst) {
+  const size_t vec_count = count & ~static_cast<size_t>(7);
+  const __m128i a_h = _mm_set1_epi16(0x3c00);  // 1.0f
+  for (size_t x = 0; x < vec_count; x += 8) {
+    const __m128i r_h = _mm256_cvtps_ph(_mm256_loadu_ps(src[0] + x), _MM_FROUND_TO_NEAREST_INT);
+    const __m128i g_h = _mm256_cvtps_ph(_mm256_loadu_ps(src[1] + x), _MM_FROUND_TO_NEAREST_INT);
+    const __m128i b_h = _mm256_cvtps_ph(_mm256_loadu_ps(src[2] + x), _MM_FROUND_TO_NEAREST_INT);
+    const __m128i rg_lo = _mm_unpacklo_epi16(r_h, g_h);
+    const __m128i ba_lo = _mm_unpacklo_epi16(b_h, a_h);
+    const __m128i rg_hi = _mm_unpackhi_epi16(r_h, g_h);
+    const __m128i ba_hi = _mm_unpackhi_epi16(b_h, a_h);
+    __m128i* out = reinterpret_cast<__m128i*>(dst + x);
+    _mm_storeu_si128(out, _mm_unpacklo_epi32(rg_lo, ba_lo));
+    _mm_storeu_si128(out + 1, _mm_unpackhi_epi32(rg_lo, ba_lo));
+    _mm_storeu_si128(out + 2, _mm_unpacklo_epi32(rg_hi, ba_hi));
+    _mm_storeu_si128(out + 3, _mm_unpackhi_epi32(rg_hi, ba_hi));
+  }
+  return vec_count;
+}
+
+// Packs the Q14 coefficients of u and v for _mm256_madd_epi16() on interleaved u, v samples
+static inline int coeffPair(const int16_t* coeffs) {
+  return static_cast<int>(static_cast<uint16_t>(coeffs[0]) |
+                          (static_cast<uint32_t>(static_cast<uint16_t>(coeffs[1])) << 16));
+}
+
+// c1 * u + c2 * v of 16 unbiased chroma samples, rounded and saturated like
+// yuvGamutConversionQ14(). Unpacking and packing both stay within the lanes, so the order holds.
+UHDR_TARGET_AVX2 static inline __m256i yuvConversion_avx2(__m256i u, __m256i v, __m256i coeffs) {
+  const __m256i round = _mm256_set1_epi32(1 << 13);
+  __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(u, v), coeffs);
+  __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(u, v), coeffs);
+  lo = _mm256_srai_epi32(_mm256_add_epi32(lo, round), 14);
+  hi = _mm256_srai_epi32(_mm256_add_epi32(hi, round), 14);
+  return _mm256_packs_epi32(lo, hi);
+}
+
+UHDR_TARGET_AVX2 static inline __m256i loadBytes_avx2(const uint8_t* src) {
+  return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src)));
+}
+
+// Narrows 16 words to bytes with saturation and stores them
+UHDR_TARGET_AVX2 static inline void storeBytes_avx2(uint8_t* dst, __m256i x) {
+  const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(x, x), 0x08);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm256_castsi256_si128(packed));
+}
+
+UHDR_TARGET_AVX2 void transformYuv420_avx2(uhdr_raw_image_t* image, const int16_t* coeffs_ptr) {
+  const __m256i coeffs_y = _mm256_set1_epi32(coeffPair(coeffs_ptr));
+  const __m256i coeffs_u = _mm256_set1_epi32(coeffPair(coeffs_ptr + 2));
+  const __m256i coeffs_v = _mm256_set1_epi32(coeffPair(coeffs_ptr + 4));
+  // 128 bias for UV given we are using libjpeg
+  const __m256i bias = _mm256_set1_epi16(128);
+  const size_t vec_width = (image->w / 2) & ~size_t(15);
+
+  for (size_t h = 0; h < image->h / 2; ++h) {
+    uint8_t* y0_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_Y]) + h * 2 * image->stride[UHDR_PLANE_Y];
+    uint8_t* y1_ptr = y0_ptr + image->stride[UHDR_PLANE_Y];
+    uint8_t* u_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_U]) + h * image->stride[UHDR_PLANE_U];
+    uint8_t* v_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_V]) + h * image->stride[UHDR_PLANE_V];
+
+    for (size_t w = 0; w < vec_width; w += 16) {
+      const __m256i u = _mm256_sub_epi16(loadBytes_avx2(u_ptr + w), bias);
+      const __m256i v = _mm256_sub_epi16(loadBytes_avx2(v_ptr + w), bias);
+
+      // the luma offset only depends on chroma, each one is shared by a 2x2 block
+      const __m256i dy = yuvConversion_avx2(u, v, coeffs_y);
+      const __m256i dy_lo = _mm256_unpacklo_epi16(dy, dy);
+      const __m256i dy_hi = _mm256_unpackhi_epi16(dy, dy);
+      const __m256i dy_0 = _mm256_permute2x128_si256(dy_lo, dy_hi, 0x20);
+      const __m256i dy_1 = _mm256_permute2x128_si256(dy_lo, dy_hi, 0x31);
+      for (uint8_t* row : {y0_ptr + w * 2, y1_ptr + w * 2}) {
+        storeBytes_avx2(row, _mm256_add_epi16(loadBytes_avx2(row), dy_0));
+        storeBytes_avx2(row + 16, _mm256_add_epi16(loadBytes_avx2(row + 16), dy_1));
+      }
+
+      storeBytes_avx2(u_ptr + w, _mm256_add_epi16(yuvConversion_avx2(u, v, coeffs_u), bias));
+      storeBytes_avx2(v_ptr + w, _mm256_add_epi16(yuvConversion_avx2(u, v, coeffs_v), bias));
+    }
+    transformYuv420RowQ14(image, coeffs_ptr, vec_width, h);
+  }
+}
+
+UHDR_TARGET_AVX2 void transformYuv444_avx2(uhdr_raw_image_t* image, const int16_t* coeffs_ptr) {
+  const __m256i coeffs_y = _mm256_set1_epi32(coeffPair(coeffs_ptr));
+  const __m256i coeffs_u = _mm256_set1_epi32(coeffPair(coeffs_ptr + 2));
+  const __m256i coeffs_v = _mm256_set1_epi32(coeffPair(coeffs_ptr + 4));
+  const __m256i bias = _mm256_set1_epi16(128);
+  const size_t vec_width = image->w & ~size_t(15);
+
+  for (size_t h = 0; h < image->h; ++h) {
+    uint8_t* y_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_Y]) + h * image->stride[UHDR_PLANE_Y];
+    uint8_t* u_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_U]) + h * image->stride[UHDR_PLANE_U];
+    uint8_t* v_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_V]) + h * image->stride[UHDR_PLANE_V];
+
+    for (size_t w = 0; w < vec_width; w += 16) {
+      const __m256i u = _mm256_sub_epi16(loadBytes_avx2(u_ptr + w), bias);
+      const __m256i v = _mm256_sub_epi16(loadBytes_avx2(v_ptr + w), bias);
+      const __m256i luma = loadBytes_avx2(y_ptr + w);
+
+      storeBytes_avx2(y_ptr + w, _mm256_add_epi16(luma, yuvConversion_avx2(u, v, coeffs_y)));
+      storeBytes_avx2(u_ptr + w, _mm256_add_epi16(yuvConversion_avx2(u, v, coeffs_u), bias));
+      storeBytes_avx2(v_ptr + w, _mm256_add_epi16(yuvConversion_avx2(u, v, coeffs_v), bias));
+    }
+    transformYuv444RowQ14(image, coeffs_ptr, vec_width, h);
+  }
+}
+
+uhdr_error_info_t convertYuv_avx2(uhdr_raw_image_t* image, uhdr_color_gamut_t src_encoding,
+                                  uhdr_color_gamut_t dst_encoding) {
+  return convertYuvQ14(image, src_encoding, dst_encoding, transformYuv420_avx2,
+                       transformYuv444_avx2);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// rgba8888 -> yuv444 conversion
+
+// Q14 rgb -> yuv coefficients {yr, yg, yb, ur, ug, ub = vr, vg, vb}, the negative terms are
+// stored as magnitudes. See the matrices of srgbRgbToYuv(), p3RgbToYuv() and bt2100RgbToYuv(),
+// display p3 is encoded with the bt.601 matrix.
+static const int16_t kRgb709ToYuv_coeffs_avx2[8] = {3484, 11717, 1183, 1877, 6315, 8192, 7441, 751};
+static const int16_t kRgbDispP3ToYuv_coeffs_avx2[8] = {4899, 9617, 1868, 2765,
+                                                       5427, 8192, 6860, 1332};
+static const int16_t kRgb2100ToYuv_coeffs_avx2[8] = {4304, 11108, 972, 2288, 5904, 8192, 7533, 659};
+
+// Luma is rounded, chroma carries the rounding in its bias, as jsimd_rgb_ycc_convert does
+static const int kRgbToYuvBias = (128 << 14) + 8191;
+
+static inline void rgbaToYuv444Pixel(const uint8_t* rgba, const int16_t* k, uint8_t* y, uint8_t* u,
+                                     uint8_t* v) {
+  const int r = rgba[0], g = rgba[1], b = rgba[2];
+  *y = static_cast<uint8_t>((k[0] * r + k[1] * g + k[2] * b + (1 << 13)) >> 14);
+  *u = static_cast<uint8_t>((kRgbToYuvBias - k[3] * r - k[4] * g + k[5] * b) >> 14);
+  *v = static_cast<uint8_t>((kRgbToYuvBias + k[5] * r - k[6] * g - k[7] * b) >> 14);
+}
+
+// One component of 8 rgba pixels. rg holds r | g << 16 and b0 holds b | 0 << 16 per pixel, so a
+// multiply add with the coefficient pairs sums all three terms.
+UHDR_TARGET_AVX2 static inline __m256i rgbDot_avx2(__m256i rg, __m256i b0, __m256i k_rg,
+                                                   __m256i k_b, __m256i bias) {
+  return _mm256_srai_epi32(
+      _mm256_add_epi32(_mm256_add_epi32(_mm256_madd_epi16(rg, k_rg), _mm256_madd_epi16(b0, k_b)),
+                       bias),
+      14);
+}
+
+// Narrows two vectors of 8 dwords to 16 bytes, in pixel order
+UHDR_TARGET_AVX2 static inline void storeDwords_avx2(uint8_t* dst, __m256i lo, __m256i hi) {
+  storeBytes_avx2(dst, _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xd8));
+}
+
+static inline int pairOf(int lo, int hi) {
+  return static_cast<int>(static_cast<uint16_t>(lo) | (static_cast<uint32_t>(hi) << 16));
+}
+
+UHDR_TARGET_AVX2 static void convertRgba8888ToYuv444_avx2(uhdr_raw_image_t* src,
+                                                          uhdr_raw_image_t* dst, const int16_t* k) {
+  const __m256i k_y_rg = _mm256_set1_epi32(pairOf(k[0], k[1]));
+  const __m256i k_y_b = _mm256_set1_epi32(pairOf(k[2], 0));
+  const __m256i k_u_rg = _mm256_set1_epi32(pairOf(-k[3], -k[4]));
+  const __m256i k_u_b = _mm256_set1_epi32(pairOf(k[5], 0));
+  const __m256i k_v_rg = _mm256_set1_epi32(pairOf(k[5], -k[6]));
+  const __m256i k_v_b = _mm256_set1_epi32(pairOf(-k[7], 0));
+  const __m256i round_y = _mm256_set1_epi32(1 << 13);
+  const __m256i bias_uv = _mm256_set1_epi32(kRgbToYuvBias);
+  const __m256i mask_r = _mm256_set1_epi32(0xff);
+  const __m256i mask_g = _mm256_set1_epi32(0xff00);
+  const size_t vec_width = src->w & ~size_t(15);
+
+  for (size_t h = 0; h < src->h; h++) {
+    const uint8_t* rgba_ptr = static_cast<uint8_t*>(src->planes[UHDR_PLANE_PACKED]) +
+                              (size_t)src->stride[UHDR_PLANE_PACKED] * 4 * h;
+    uint8_t* y_ptr =
+        static_cast<uint8_t*>(dst->planes[UHDR_PLANE_Y]) + (size_t)dst->stride[UHDR_PLANE_Y] * h;
+    uint8_t* u_ptr =
+        static_cast<uint8_t*>(dst->planes[UHDR_PLANE_U]) + (size_t)dst->stride[UHDR_PLANE_U] * h;
+    uint8_t* v_ptr =
+        static_cast<uint8_t*>(dst->planes[UHDR_PLANE_V]) + (size_t)dst->stride[UHDR_PLANE_V] * h;
+
+    for (size_t w = 0; w < vec_width; w += 16) {
+      __m256i rg[2], b0[2];
+      for (int i = 0; i < 2; i++) {
+        const __m256i px =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rgba_ptr + (w + i * 8) * 4));
+        rg[i] = _mm256_or_si256(_mm256_and_si256(px, mask_r),
+                                _mm256_slli_epi32(_mm256_and_si256(px, mask_g), 8));
+        b0[i] = _mm256_and_si256(_mm256_srli_epi32(px, 16), mask_r);
+      }
+      storeDwords_avx2(y_ptr + w, rgbDot_avx2(rg[0], b0[0], k_y_rg, k_y_b, round_y),
+                       rgbDot_avx2(rg[1], b0[1], k_y_rg, k_y_b, round_y));
+      storeDwords_avx2(u_ptr + w, rgbDot_avx2(rg[0], b0[0], k_u_rg, k_u_b, bias_uv),
+                       rgbDot_avx2(rg[1], b0[1], k_u_rg, k_u_b, bias_uv));
+      storeDwords_avx2(v_ptr + w, rgbDot_avx2(rg[0], b0[0], k_v_rg, k_v_b, bias_uv),
+                       rgbDot_avx2(rg[1], b0[1], k_v_rg, k_v_b, bias_uv));
+    }
+    for (size_t w = vec_width; w < src->w; w++) {
+      rgbaToYuv444Pixel(rgba_ptr + w * 4, k, y_ptr + w, u_ptr + w, v_ptr + w);
+    }
+  }
+}
+
+uhdr_error_info_t convert_raw_input_to_ycbcr_avx2(uhdr_raw_image_t* src, uhdr_raw_image_t* dst) {
+  const int16_t* coeffs = nullptr;
+  if (src->cg == UHDR_CG_BT_709) {
+    coeffs = kRgb709ToYuv_coeffs_avx2;
+  } else if (src->cg == UHDR_CG_DISPLAY_P3) {
+    coeffs = kRgbDispP3ToYuv_coeffs_avx2;
+  } else if (src->cg == UHDR_CG_BT_2100) {
+    coeffs = kRgb2100ToYuv_coeffs_avx2;
+  }
+  if (src->fmt != UHDR_IMG_FMT_32bppRGBA8888 || dst->fmt != UHDR_IMG_FMT_24bppYCbCr444 ||
+      coeffs == nullptr) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "no avx2 conversion from fmt %d, gamut %d to fmt %d", src->fmt, src->cg, dst->fmt);
+    return status;
+  }
+  convertRgba8888ToYuv444_avx2(src, dst, coeffs);
+  return g_no_error;
+}
+
+}  // namespace ultrahdr
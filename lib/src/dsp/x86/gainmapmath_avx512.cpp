@@ -0,0 +1,394 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ultrahdr/gainmapmath.h"
+
+#include <immintrin.h>
+#include <algorithm>
+#include <cfloat>
+
+// The library is built for the baseline isa of the target. The kernels in this file are compiled
+// for avx512f individually and are only reached after a runtime check of the cpu features.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define UHDR_TARGET_AVX512
+#else
+#define UHDR_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+
+// gcc 12 reports the _mm512_undefined_*() placeholders of the unmasked intrinsics as used
+// uninitialized once they are inlined
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+namespace ultrahdr {
+
+// Rec.601 yuv -> rgb coefficients, see p3YuvToRgb()
+static const float kP3Cb = 1.772f, kP3Cr = 1.402f;
+static const float kP3GCb = 0.114f * kP3Cb / 0.587f;
+static const float kP3GCr = 0.299f * kP3Cr / 0.587f;
+
+// Natural logarithm for x > 0, see Cephes logf(). Relative error is in the order of 1e-7.
+UHDR_TARGET_AVX512 static inline __m512 log_avx512(__m512 x) {
+  const __m512 one = _mm512_set1_ps(1.0f);
+  const __m512i bits = _mm512_castps_si512(x);
+  __m512 e = _mm512_cvtepi32_ps(
+      _mm512_sub_epi32(_mm512_srli_epi32(bits, 23), _mm512_set1_epi32(127)));
+  __m512 m = _mm512_castsi512_ps(_mm512_or_si512(
+      _mm512_and_si512(bits, _mm512_set1_epi32(0x007fffff)), _mm512_set1_epi32(0x3f800000)));
+
+  // move the mantissa to [sqrt(0.5), sqrt(2))
+  const __mmask16 big = _mm512_cmp_ps_mask(m, _mm512_set1_ps(1.41421356f), _CMP_GT_OQ);
+  m = _mm512_mask_mul_ps(m, big, m, _mm512_set1_ps(0.5f));
+  e = _mm512_mask_add_ps(e, big, e, one);
+
+  const __m512 t = _mm512_sub_ps(m, one);
+  const __m512 z = _mm512_mul_ps(t, t);
+  __m512 p = _mm512_set1_ps(7.0376836292E-2f);
+  p = _mm512_add_ps(_mm512_mul_ps(p, t), _mm512_set1_ps(-1.1514610310E-1f));
+  p = _mm512_add_ps(_mm512_mul_ps(p, t), _mm512_set1_ps(1.1676998740E-1f));
+  p = _mm512_add_ps(_mm512_mul_ps(p, t), _mm512_set1_ps(-1.2420140846E-1f));
+  p = _mm512_add_ps(_mm512_mul_ps(p, t), _mm512_set1_ps(1.4249322787E-1f));
+  p = _mm512_add_ps(_mm512_mul_ps(p, t), _mm512_set1_ps(-1.6668057665E-1f));
+  p = _mm512_add_ps(_mm512_mul_ps(p, t), _mm512_set1_ps(2.0000714765E-1f));
+  p = _mm512_add_ps(_mm512_mul_ps(p, t), _mm512_set1_ps(-2.4999993993E-1f));
+  p = _mm512_add_ps(_mm512_mul_ps(p, t), _mm512_set1_ps(3.3333331174E-1f));
+  p = _mm512_mul_ps(_mm512_mul_ps(p, t), z);
+  p = _mm512_add_ps(p, _mm512_mul_ps(e, _mm512_set1_ps(-2.12194440e-4f)));
+  p = _mm512_sub_ps(p, _mm512_mul_ps(z, _mm512_set1_ps(0.5f)));
+  return _mm512_add_ps(_mm512_add_ps(t, p), _mm512_mul_ps(e, _mm512_set1_ps(0.693359375f)));
+}
+
+// Natural exponent, see Cephes expf(). Inputs are clamped to the range of normal floats.
+UHDR_TARGET_AVX512 static inline __m512 exp_avx512(__m512 x) {
+  x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(-87.3f)), _mm512_set1_ps(88.3f));
+  const __m512 n = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(1.44269504088896341f)),
+                                        _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  x = _mm512_sub_ps(x, _mm512_mul_ps(n, _mm512_set1_ps(0.693359375f)));
+  x = _mm512_sub_ps(x, _mm512_mul_ps(n, _mm512_set1_ps(-2.12194440e-4f)));
+
+  const __m512 z = _mm512_mul_ps(x, x);
+  __m512 p = _mm512_set1_ps(1.9875691500E-4f);
+  p = _mm512_add_ps(_mm512_mul_ps(p, x), _mm512_set1_ps(1.3981999507E-3f));
+  p = _mm512_add_ps(_mm512_mul_ps(p, x), _mm512_set1_ps(8.3334519073E-3f));
+  p = _mm512_add_ps(_mm512_mul_ps(p, x), _mm512_set1_ps(4.1665795894E-2f));
+  p = _mm512_add_ps(_mm512_mul_ps(p, x), _mm512_set1_ps(1.6666665459E-1f));
+  p = _mm512_add_ps(_mm512_mul_ps(p, x), _mm512_set1_ps(5.0000001201E-1f));
+  p = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(p, z), x), _mm512_set1_ps(1.0f));
+
+  const __m512i scale = _mm512_slli_epi32(
+      _mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127)), 23);
+  return _mm512_mul_ps(p, _mm512_castsi512_ps(scale));
+}
+
+// x^p for x > 0. Like std::pow() for a non-integer p, non-positive inputs do not produce a usable
+// result, they are mapped to 0 which is where the following table lookup clamps them anyway.
+UHDR_TARGET_AVX512 static inline __m512 pow_avx512(__m512 x, float p) {
+  const __mmask16 positive = _mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_GT_OQ);
+  x = _mm512_max_ps(x, _mm512_set1_ps(FLT_MIN));
+  return _mm512_maskz_mov_ps(positive,
+                             exp_avx512(_mm512_mul_ps(_mm512_set1_ps(p), log_avx512(x))));
+}
+
+// Vector counterpart of the *LUT() transfer functions
+UHDR_TARGET_AVX512 static inline __m512 lookup_avx512(const float* table, int num_entries,
+                                                      __m512 e) {
+  __m512i idx = _mm512_cvttps_epi32(_mm512_add_ps(
+      _mm512_mul_ps(e, _mm512_set1_ps(static_cast<float>(num_entries - 1))), _mm512_set1_ps(0.5f)));
+  idx = _mm512_min_epi32(_mm512_max_epi32(idx, _mm512_setzero_si512()),
+                         _mm512_set1_epi32(num_entries - 1));
+  return _mm512_i32gather_ps(idx, table, 4);
+}
+
+UHDR_TARGET_AVX512 static inline __m512 clampPixelFloat_avx512(__m512 e) {
+  return _mm512_min_ps(_mm512_max_ps(e, _mm512_setzero_ps()), _mm512_set1_ps(kMaxPixelFloat));
+}
+
+UHDR_TARGET_AVX512 static inline __m512 loadChroma_avx512(const uint8_t* src) {
+  const __m128i c = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src));
+  // each chroma sample covers two horizontally adjacent luma samples
+  const __m512i c2 =
+      _mm512_sub_epi32(_mm512_cvtepu8_epi32(_mm_unpacklo_epi8(c, c)), _mm512_set1_epi32(128));
+  return _mm512_mul_ps(_mm512_cvtepi32_ps(c2), _mm512_set1_ps(1 / 255.0f));
+}
+
+UHDR_TARGET_AVX512 static inline __m512 loadMap_avx512(const uint8_t* row, __m512i idx) {
+  __m512i v = _mm512_and_si512(_mm512_i32gather_epi32(idx, row, 1), _mm512_set1_epi32(0xff));
+  return _mm512_div_ps(_mm512_cvtepi32_ps(v), _mm512_set1_ps(255.0f));
+}
+
+// Vector counterpart of hdrCodeLUTIndex() and the code table lookup. The gather reads 32 bits at
+// 16-bit offsets, which the extra entry at the end of the tables allows for.
+UHDR_TARGET_AVX512 static inline __m512i lookupCodes_avx512(const uint16_t* table, __m512 e) {
+  __m512i idx = _mm512_sub_epi32(_mm512_srai_epi32(_mm512_castps_si512(e), kHdrCodeLUTShift),
+                                 _mm512_set1_epi32(kHdrCodeLUTBias));
+  idx = _mm512_min_epi32(_mm512_max_epi32(idx, _mm512_setzero_si512()),
+                         _mm512_set1_epi32(kHdrCodeLUTNumEntries - 1));
+  return _mm512_and_si512(_mm512_i32gather_epi32(idx, table, 2), _mm512_set1_epi32(0xffff));
+}
+
+// See hlgLinearToRgba1010102() and pqLinearToRgba1010102()
+UHDR_TARGET_AVX512 static inline __m512i toRgba1010102_avx512(const uint16_t* table, __m512 r,
+                                                              __m512 g, __m512 b) {
+  __m512i out = _mm512_or_si512(lookupCodes_avx512(table, r),
+                                _mm512_slli_epi32(lookupCodes_avx512(table, g), 10));
+  out = _mm512_or_si512(out, _mm512_slli_epi32(lookupCodes_avx512(table, b), 20));
+  return _mm512_or_si512(out, _mm512_set1_epi32(static_cast<int>(0xc0000000)));  // alpha to 1.0
+}
+
+// Writes 16 rgba half float pixels
+UHDR_TARGET_AVX512 static inline void storeRgbaF16_avx512(uint8_t* dst, __m512 r, __m512 g,
+                                                          __m512 b) {
+  const __m512i r_h = _mm512_cvtepu16_epi32(_mm512_cvtps_ph(r, _MM_FROUND_TO_NEAREST_INT));
+  const __m512i g_h = _mm512_cvtepu16_epi32(_mm512_cvtps_ph(g, _MM_FROUND_TO_NEAREST_INT));
+  const __m512i b_h = _mm512_cvtepu16_epi32(_mm512_cvtps_ph(b, _MM_FROUND_TO_NEAREST_INT));
+  const __m512i rg = _mm512_or_si512(r_h, _mm512_slli_epi32(g_h, 16));
+  const __m512i ba = _mm512_or_si512(b_h, _mm512_set1_epi32(0x3c000000));  // alpha to 1.0
+  // interleave the 32 bit rg and ba halves of the pixels
+  const __m512i lo_order =
+      _mm512_setr_epi32(0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);
+  const __m512i hi_order =
+      _mm512_setr_epi32(8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31);
+  _mm512_storeu_si512(dst, _mm512_permutex2var_epi32(rg, lo_order, ba));
+  _mm512_storeu_si512(dst + 64, _mm512_permutex2var_epi32(rg, hi_order, ba));
+}
+
+UHDR_TARGET_AVX512 static inline __m512 dot3_avx512(const float* k, __m512 r, __m512 g,
+                                                    __m512 b) {
+  return _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(_mm512_set1_ps(k[0]), r),
+                                     _mm512_mul_ps(_mm512_set1_ps(k[1]), g)),
+                       _mm512_mul_ps(_mm512_set1_ps(k[2]), b));
+}
+
+UHDR_TARGET_AVX512 size_t applyGainMapRowYuv420_avx512(
+    uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* gainmap_img, uhdr_raw_image_t* dest,
+    size_t map_scale_factor, ShepardsIDW& idwTable, GainLUT& gainLUT,
+    uhdr_gainmap_metadata_ext_t* metadata, uhdr_color_transfer_t output_ct,
+    const float* gamut_matrix, size_t y) {
+  if (output_ct != UHDR_CT_LINEAR && output_ct != UHDR_CT_HLG && output_ct != UHDR_CT_PQ) return 0;
+
+  // gain map samples are gathered 4 bytes at a time, so stay clear of the last map columns
+  const size_t map_w = gainmap_img->w;
+  if (map_w < 5) return 0;
+  const size_t width =
+      (std::min)(static_cast<size_t>(sdr_intent->w), (map_w - 4) * map_scale_factor);
+  const size_t vec_width = width & ~static_cast<size_t>(15);
+  if (vec_width == 0) return 0;
+
+  const uint8_t* y_row = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_Y]) +
+                         y * sdr_intent->stride[UHDR_PLANE_Y];
+  const uint8_t* u_row = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_U]) +
+                         (y / 2) * sdr_intent->stride[UHDR_PLANE_U];
+  const uint8_t* v_row = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_V]) +
+                         (y / 2) * sdr_intent->stride[UHDR_PLANE_V];
+
+  const size_t y_lower = (std::min)(y / map_scale_factor, static_cast<size_t>(gainmap_img->h) - 1);
+  const size_t y_upper =
+      (std::min)(y / map_scale_factor + 1, static_cast<size_t>(gainmap_img->h) - 1);
+  const uint8_t* map_data = static_cast<uint8_t*>(gainmap_img->planes[UHDR_PLANE_Y]);
+  const size_t map_stride = gainmap_img->stride[UHDR_PLANE_Y];
+  const uint8_t* map_top = map_data + y_lower * map_stride;
+  const uint8_t* map_bottom = map_data + y_upper * map_stride;
+  const float* weights = (y_lower == y_upper) ? idwTable.mWeightsNB : idwTable.mWeights;
+  weights += (y % map_scale_factor) * map_scale_factor * 4;
+
+  const float* srgb_lut = getSrgbInvOetfLUT();
+  const uint16_t* code_lut = output_ct == UHDR_CT_HLG  ? getHlgCodeLUT()
+                            : output_ct == UHDR_CT_PQ ? getPqCodeLUT()
+                                                      : nullptr;
+  const float* gain_table = gainLUT.getGainTable();
+
+  const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  const __m512i scale_i = _mm512_set1_epi32(static_cast<int>(map_scale_factor));
+  const __m512 scale_f = _mm512_set1_ps(static_cast<float>(map_scale_factor));
+  const __m512 offset_sdr = _mm512_set1_ps(metadata->offset_sdr);
+  const __m512 offset_hdr = _mm512_set1_ps(metadata->offset_hdr);
+  const __m512 inv_255 = _mm512_set1_ps(1 / 255.0f);
+
+  uint8_t* dst = static_cast<uint8_t*>(dest->planes[UHDR_PLANE_PACKED]);
+  const size_t dst_offset = y * dest->stride[UHDR_PLANE_PACKED];
+
+  for (size_t x = 0; x < vec_width; x += 16) {
+    // yuv -> linear rgb
+    const __m512 y_f = _mm512_mul_ps(
+        _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(y_row + x)))),
+        inv_255);
+    const __m512 u_f = loadChroma_avx512(u_row + x / 2);
+    const __m512 v_f = loadChroma_avx512(v_row + x / 2);
+    __m512 r =
+        clampPixelFloat_avx512(_mm512_add_ps(y_f, _mm512_mul_ps(_mm512_set1_ps(kP3Cr), v_f)));
+    __m512 g = clampPixelFloat_avx512(
+        _mm512_sub_ps(_mm512_sub_ps(y_f, _mm512_mul_ps(_mm512_set1_ps(kP3GCb), u_f)),
+                      _mm512_mul_ps(_mm512_set1_ps(kP3GCr), v_f)));
+    __m512 b =
+        clampPixelFloat_avx512(_mm512_add_ps(y_f, _mm512_mul_ps(_mm512_set1_ps(kP3Cb), u_f)));
+    r = lookup_avx512(srgb_lut, kSrgbInvOETFNumEntries, r);
+    g = lookup_avx512(srgb_lut, kSrgbInvOETFNumEntries, g);
+    b = lookup_avx512(srgb_lut, kSrgbInvOETFNumEntries, b);
+
+    // sample gain map, see sampleMap() with ShepardsIDW
+    const __m512i xs = _mm512_add_epi32(_mm512_set1_epi32(static_cast<int>(x)), lanes);
+    const __m512i x_lower = _mm512_cvttps_epi32(
+        _mm512_div_ps(_mm512_add_ps(_mm512_cvtepi32_ps(xs), _mm512_set1_ps(0.5f)), scale_f));
+    const __m512i x_upper = _mm512_add_epi32(x_lower, _mm512_set1_epi32(1));
+    const __m512i w_idx =
+        _mm512_slli_epi32(_mm512_sub_epi32(xs, _mm512_mullo_epi32(x_lower, scale_i)), 2);
+    const __m512 e1 = loadMap_avx512(map_top, x_lower);
+    const __m512 e2 = loadMap_avx512(map_bottom, x_lower);
+    const __m512 e3 = loadMap_avx512(map_top, x_upper);
+    const __m512 e4 = loadMap_avx512(map_bottom, x_upper);
+    __m512 gain = _mm512_mul_ps(e1, _mm512_i32gather_ps(w_idx, weights, 4));
+    gain = _mm512_add_ps(gain, _mm512_mul_ps(e2, _mm512_i32gather_ps(w_idx, weights + 1, 4)));
+    gain = _mm512_add_ps(gain, _mm512_mul_ps(e3, _mm512_i32gather_ps(w_idx, weights + 2, 4)));
+    gain = _mm512_add_ps(gain, _mm512_mul_ps(e4, _mm512_i32gather_ps(w_idx, weights + 3, 4)));
+
+    // apply gain, see applyGainLUT()
+    const __m512 gain_factor = lookup_avx512(gain_table, kGainFactorNumEntries, gain);
+    r = _mm512_sub_ps(_mm512_mul_ps(_mm512_add_ps(r, offset_sdr), gain_factor), offset_hdr);
+    g = _mm512_sub_ps(_mm512_mul_ps(_mm512_add_ps(g, offset_sdr), gain_factor), offset_hdr);
+    b = _mm512_sub_ps(_mm512_mul_ps(_mm512_add_ps(b, offset_sdr), gain_factor), offset_hdr);
+    if (gamut_matrix != nullptr) {
+      // output gamut, see getGamutConversionMatrix()
+      const __m512 r_out = dot3_avx512(gamut_matrix, r, g, b);
+      const __m512 g_out = dot3_avx512(gamut_matrix + 3, r, g, b);
+      b = dot3_avx512(gamut_matrix + 6, r, g, b);
+      r = r_out;
+      g = g_out;
+      // colors outside of the output gamut map to code 0 in the hlg and pq tables
+    }
+
+    if (output_ct == UHDR_CT_LINEAR) {
+      storeRgbaF16_avx512(dst + (dst_offset + x) * sizeof(uint64_t), r, g, b);
+    } else {
+      // scaling, inverse ootf, oetf and quantization in one lookup per component
+      _mm512_storeu_si512(dst + (dst_offset + x) * sizeof(uint32_t),
+                          toRgba1010102_avx512(code_lut, r, g, b));
+    }
+  }
+
+  return vec_width;
+}
+
+// See computeGain()
+UHDR_TARGET_AVX512 static inline __m512 computeGain_avx512(__m512 sdr, __m512 hdr) {
+  const __m512 ratio = _mm512_div_ps(_mm512_add_ps(hdr, _mm512_set1_ps(kHdrOffset)),
+                                     _mm512_add_ps(sdr, _mm512_set1_ps(kSdrOffset)));
+  const __m512 gain = _mm512_mul_ps(log_avx512(ratio), _mm512_set1_ps(1.44269504088896341f));
+  const __mmask16 dark = _mm512_cmp_ps_mask(sdr, _mm512_set1_ps(2.f / 255.0f), _CMP_LT_OQ);
+  return _mm512_mask_min_ps(gain, dark, gain, _mm512_set1_ps(2.3f));
+}
+
+UHDR_TARGET_AVX512 static inline void yuvToRgb_avx512(const float coeffs[4], const float* y,
+                                                      const float* u, const float* v, __m512& r,
+                                                      __m512& g, __m512& b) {
+  const __m512 y_f = _mm512_load_ps(y);
+  const __m512 u_f = _mm512_load_ps(u);
+  const __m512 v_f = _mm512_load_ps(v);
+  r = clampPixelFloat_avx512(_mm512_add_ps(y_f, _mm512_mul_ps(_mm512_set1_ps(coeffs[0]), v_f)));
+  g = clampPixelFloat_avx512(
+      _mm512_sub_ps(_mm512_sub_ps(y_f, _mm512_mul_ps(_mm512_set1_ps(coeffs[1]), u_f)),
+                    _mm512_mul_ps(_mm512_set1_ps(coeffs[2]), v_f)));
+  b = clampPixelFloat_avx512(_mm512_add_ps(y_f, _mm512_mul_ps(_mm512_set1_ps(coeffs[3]), u_f)));
+}
+
+UHDR_TARGET_AVX512 size_t generateGainMapRow_avx512(uhdr_raw_image_t* sdr_intent,
+                                                    uhdr_raw_image_t* hdr_intent,
+                                                    const GainMapRowParams& params,
+                                                    size_t map_scale_factor, size_t map_width,
+                                                    size_t y, float* gains) {
+  const size_t vec_width = map_width & ~static_cast<size_t>(15);
+  alignas(64) float sdr_yuv[3][kGainMapRowChunk];
+  alignas(64) float hdr_yuv[3][kGainMapRowChunk];
+  float* sdr_planes[3] = {sdr_yuv[0], sdr_yuv[1], sdr_yuv[2]};
+  float* hdr_planes[3] = {hdr_yuv[0], hdr_yuv[1], hdr_yuv[2]};
+  const float* srgb_lut = getSrgbInvOetfLUT();
+  const float* m = params.hdr_gamut_matrix.data();
+  const __m512 sdr_nits = _mm512_set1_ps(kSdrWhiteNits);
+  const __m512 hdr_nits = _mm512_set1_ps(params.hdr_sample_to_nits);
+  const __m512 zero = _mm512_setzero_ps();
+
+  for (size_t x = 0; x < vec_width; x += 16) {
+    const size_t chunk_x = x % kGainMapRowChunk;
+    if (chunk_x == 0) {
+      const size_t len = (std::min)(kGainMapRowChunk, vec_width - x);
+      sampleYuv420Row(sdr_intent, map_scale_factor, x, y, len, sdr_planes);
+      sampleP010Row(hdr_intent, map_scale_factor, x, y, len, hdr_planes);
+    }
+
+    // sdr yuv -> linear rgb
+    __m512 sr, sg, sb;
+    yuvToRgb_avx512(params.sdr_yuv_to_rgb, sdr_yuv[0] + chunk_x, sdr_yuv[1] + chunk_x,
+                    sdr_yuv[2] + chunk_x, sr, sg, sb);
+    sr = lookup_avx512(srgb_lut, kSrgbInvOETFNumEntries, sr);
+    sg = lookup_avx512(srgb_lut, kSrgbInvOETFNumEntries, sg);
+    sb = lookup_avx512(srgb_lut, kSrgbInvOETFNumEntries, sb);
+
+    // hdr yuv -> linear rgb in sdr gamut
+    __m512 hr, hg, hb;
+    yuvToRgb_avx512(params.hdr_yuv_to_rgb, hdr_yuv[0] + chunk_x, hdr_yuv[1] + chunk_x,
+                    hdr_yuv[2] + chunk_x, hr, hg, hb);
+    hr = lookup_avx512(params.hdr_inv_oetf_lut, params.hdr_inv_oetf_entries, hr);
+    hg = lookup_avx512(params.hdr_inv_oetf_lut, params.hdr_inv_oetf_entries, hg);
+    hb = lookup_avx512(params.hdr_inv_oetf_lut, params.hdr_inv_oetf_entries, hb);
+    if (params.hdr_ootf_gamma != 1.0f) {
+      hr = pow_avx512(hr, params.hdr_ootf_gamma);
+      hg = pow_avx512(hg, params.hdr_ootf_gamma);
+      hb = pow_avx512(hb, params.hdr_ootf_gamma);
+    }
+    const __m512 cr = dot3_avx512(m, hr, hg, hb);
+    const __m512 cg = dot3_avx512(m + 3, hr, hg, hb);
+    const __m512 cb = dot3_avx512(m + 6, hr, hg, hb);
+    hr = _mm512_max_ps(cr, zero);
+    hg = _mm512_max_ps(cg, zero);
+    hb = _mm512_max_ps(cb, zero);
+
+    if (params.multichannel) {
+      // scatter straight into the interleaved rgb gains
+      const __m512i rgb_idx = _mm512_mullo_epi32(
+          _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15),
+          _mm512_set1_epi32(3));
+      float* out = gains + x * 3;
+      _mm512_i32scatter_ps(out, rgb_idx,
+                           computeGain_avx512(_mm512_mul_ps(sr, sdr_nits),
+                                              _mm512_mul_ps(hr, hdr_nits)),
+                           4);
+      _mm512_i32scatter_ps(out + 1, rgb_idx,
+                           computeGain_avx512(_mm512_mul_ps(sg, sdr_nits),
+                                              _mm512_mul_ps(hg, hdr_nits)),
+                           4);
+      _mm512_i32scatter_ps(out + 2, rgb_idx,
+                           computeGain_avx512(_mm512_mul_ps(sb, sdr_nits),
+                                              _mm512_mul_ps(hb, hdr_nits)),
+                           4);
+    } else {
+      __m512 sdr_y, hdr_y;
+      if (params.use_luminance) {
+        sdr_y = dot3_avx512(params.luminance.data(), sr, sg, sb);
+        hdr_y = dot3_avx512(params.luminance.data(), hr, hg, hb);
+      } else {
+        sdr_y = _mm512_max_ps(sr, _mm512_max_ps(sg, sb));
+        hdr_y = _mm512_max_ps(hr, _mm512_max_ps(hg, hb));
+      }
+      _mm512_storeu_ps(gains + x, computeGain_avx512(_mm512_mul_ps(sdr_y, sdr_nits),
+                                                     _mm512_mul_ps(hdr_y, hdr_nits)));
+    }
+  }
+
+  return vec_width;
+}
+
+}  // namespace ultrahdr
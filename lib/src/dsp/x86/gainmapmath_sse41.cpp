@@ -0,0 +1,475 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ultrahdr/gainmapmath.h"
+
+#include <smmintrin.h>
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+
+// The library is built for the baseline isa of the target. The kernels in this file are compiled
+// for sse4.1 individually and are only reached after a runtime check of the cpu features.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define UHDR_TARGET_SSE41
+#else
+#define UHDR_TARGET_SSE41 __attribute__((target("sse4.1")))
+#endif
+
+namespace ultrahdr {
+
+// Rec.601 yuv -> rgb coefficients, see p3YuvToRgb()
+static const float kP3Cb = 1.772f, kP3Cr = 1.402f;
+static const float kP3GCb = 0.114f * kP3Cb / 0.587f;
+static const float kP3GCr = 0.299f * kP3Cr / 0.587f;
+
+// Natural logarithm for x > 0, see Cephes logf(). Relative error is in the order of 1e-7.
+UHDR_TARGET_SSE41 static inline __m128 log_sse41(__m128 x) {
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128i bits = _mm_castps_si128(x);
+  __m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+  __m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)),
+                                           _mm_set1_epi32(0x3f800000)));
+
+  // move the mantissa to [sqrt(0.5), sqrt(2))
+  const __m128 big = _mm_cmpgt_ps(m, _mm_set1_ps(1.41421356f));
+  m = _mm_blendv_ps(m, _mm_mul_ps(m, _mm_set1_ps(0.5f)), big);
+  e = _mm_add_ps(e, _mm_and_ps(big, one));
+
+  const __m128 t = _mm_sub_ps(m, one);
+  const __m128 z = _mm_mul_ps(t, t);
+  __m128 p = _mm_set1_ps(7.0376836292E-2f);
+  p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(-1.1514610310E-1f));
+  p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(1.1676998740E-1f));
+  p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(-1.2420140846E-1f));
+  p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(1.4249322787E-1f));
+  p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(-1.6668057665E-1f));
+  p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(2.0000714765E-1f));
+  p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(-2.4999993993E-1f));
+  p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(3.3333331174E-1f));
+  p = _mm_mul_ps(_mm_mul_ps(p, t), z);
+  p = _mm_add_ps(p, _mm_mul_ps(e, _mm_set1_ps(-2.12194440e-4f)));
+  p = _mm_sub_ps(p, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+  return _mm_add_ps(_mm_add_ps(t, p), _mm_mul_ps(e, _mm_set1_ps(0.693359375f)));
+}
+
+// Natural exponent, see Cephes expf(). Inputs are clamped to the range of normal floats.
+UHDR_TARGET_SSE41 static inline __m128 exp_sse41(__m128 x) {
+  x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-87.3f)), _mm_set1_ps(88.3f));
+  const __m128 n = _mm_round_ps(_mm_mul_ps(x, _mm_set1_ps(1.44269504088896341f)),
+                                _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  x = _mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(0.693359375f)));
+  x = _mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(-2.12194440e-4f)));
+
+  const __m128 z = _mm_mul_ps(x, x);
+  __m128 p = _mm_set1_ps(1.9875691500E-4f);
+  p = _mm_add_ps(_mm_mul_ps(p, x), _mm_set1_ps(1.3981999507E-3f));
+  p = _mm_add_ps(_mm_mul_ps(p, x), _mm_set1_ps(8.3334519073E-3f));
+  p = _mm_add_ps(_mm_mul_ps(p, x), _mm_set1_ps(4.1665795894E-2f));
+  p = _mm_add_ps(_mm_mul_ps(p, x), _mm_set1_ps(1.6666665459E-1f));
+  p = _mm_add_ps(_mm_mul_ps(p, x), _mm_set1_ps(5.0000001201E-1f));
+  p = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p, z), x), _mm_set1_ps(1.0f));
+
+  const __m128i scale =
+      _mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23);
+  return _mm_mul_ps(p, _mm_castsi128_ps(scale));
+}
+
+// x^p for x > 0. Like std::pow() for a non-integer p, non-positive inputs do not produce a usable
+// result, they are mapped to 0 which is where the following table lookup clamps them anyway.
+UHDR_TARGET_SSE41 static inline __m128 pow_sse41(__m128 x, float p) {
+  const __m128 positive = _mm_cmpgt_ps(x, _mm_setzero_ps());
+  x = _mm_max_ps(x, _mm_set1_ps(FLT_MIN));
+  return _mm_and_ps(exp_sse41(_mm_mul_ps(_mm_set1_ps(p), log_sse41(x))), positive);
+}
+
+UHDR_TARGET_SSE41 static inline __m128 gather_sse41(const float* table, __m128i idx) {
+  return _mm_setr_ps(table[_mm_extract_epi32(idx, 0)], table[_mm_extract_epi32(idx, 1)],
+                     table[_mm_extract_epi32(idx, 2)], table[_mm_extract_epi32(idx, 3)]);
+}
+
+// Vector counterpart of the *LUT() transfer functions
+UHDR_TARGET_SSE41 static inline __m128 lookup_sse41(const float* table, int num_entries,
+                                                    __m128 e) {
+  __m128i idx = _mm_cvttps_epi32(_mm_add_ps(
+      _mm_mul_ps(e, _mm_set1_ps(static_cast<float>(num_entries - 1))), _mm_set1_ps(0.5f)));
+  idx = _mm_min_epi32(_mm_max_epi32(idx, _mm_setzero_si128()), _mm_set1_epi32(num_entries - 1));
+  return gather_sse41(table, idx);
+}
+
+UHDR_TARGET_SSE41 static inline __m128 clampPixelFloat_sse41(__m128 e) {
+  return _mm_min_ps(_mm_max_ps(e, _mm_setzero_ps()), _mm_set1_ps(kMaxPixelFloat));
+}
+
+UHDR_TARGET_SSE41 static inline __m128 loadChroma_sse41(const uint8_t* src) {
+  uint16_t packed;
+  memcpy(&packed, src, sizeof packed);
+  __m128i c =
+      _mm_sub_epi32(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed)), _mm_set1_epi32(128));
+  // each chroma sample covers two horizontally adjacent luma samples
+  return _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi32(c, c)), _mm_set1_ps(1 / 255.0f));
+}
+
+UHDR_TARGET_SSE41 static inline __m128 loadMap_sse41(const uint8_t* row, __m128i idx) {
+  __m128i v = _mm_setr_epi32(row[_mm_extract_epi32(idx, 0)], row[_mm_extract_epi32(idx, 1)],
+                             row[_mm_extract_epi32(idx, 2)], row[_mm_extract_epi32(idx, 3)]);
+  return _mm_div_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(255.0f));
+}
+
+// Vector counterpart of hdrCodeLUTIndex() and the code table lookup
+UHDR_TARGET_SSE41 static inline __m128i lookupCodes_sse41(const uint16_t* table, __m128 e) {
+  __m128i idx = _mm_sub_epi32(_mm_srai_epi32(_mm_castps_si128(e), kHdrCodeLUTShift),
+                              _mm_set1_epi32(kHdrCodeLUTBias));
+  idx = _mm_min_epi32(_mm_max_epi32(idx, _mm_setzero_si128()),
+                      _mm_set1_epi32(kHdrCodeLUTNumEntries - 1));
+  return _mm_setr_epi32(table[_mm_extract_epi32(idx, 0)], table[_mm_extract_epi32(idx, 1)],
+                        table[_mm_extract_epi32(idx, 2)], table[_mm_extract_epi32(idx, 3)]);
+}
+
+// See hlgLinearToRgba1010102() and pqLinearToRgba1010102()
+UHDR_TARGET_SSE41 static inline __m128i toRgba1010102_sse41(const uint16_t* table, __m128 r,
+                                                            __m128 g, __m128 b) {
+  __m128i out =
+      _mm_or_si128(lookupCodes_sse41(table, r), _mm_slli_epi32(lookupCodes_sse41(table, g), 10));
+  out = _mm_or_si128(out, _mm_slli_epi32(lookupCodes_sse41(table, b), 20));
+  return _mm_or_si128(out, _mm_set1_epi32(static_cast<int>(0xc0000000)));  // alpha to 1.0
+}
+
+UHDR_TARGET_SSE41 static inline __m128 dot3_sse41(const float* k, __m128 r, __m128 g, __m128 b) {
+  return _mm_add_ps(
+      _mm_add_ps(_mm_mul_ps(_mm_set1_ps(k[0]), r), _mm_mul_ps(_mm_set1_ps(k[1]), g)),
+      _mm_mul_ps(_mm_set1_ps(k[2]), b));
+}
+
+UHDR_TARGET_SSE41 size_t applyGainMapRowYuv420_sse41(
+    uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* gainmap_img, uhdr_raw_image_t* dest,
+    size_t map_scale_factor, ShepardsIDW& idwTable, GainLUT& gainLUT,
+    uhdr_gainmap_metadata_ext_t* metadata, uhdr_color_transfer_t output_ct,
+    const float* gamut_matrix, size_t y) {
+  if (output_ct != UHDR_CT_LINEAR && output_ct != UHDR_CT_HLG && output_ct != UHDR_CT_PQ) return 0;
+
+  // pixels whose gain map neighbourhood is clamped at the right edge are left to the caller
+  const size_t map_w = gainmap_img->w;
+  if (map_w < 2) return 0;
+  const size_t width =
+      (std::min)(static_cast<size_t>(sdr_intent->w), (map_w - 1) * map_scale_factor);
+  const size_t vec_width = width & ~static_cast<size_t>(3);
+  if (vec_width == 0) return 0;
+
+  const uint8_t* y_row = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_Y]) +
+                         y * sdr_intent->stride[UHDR_PLANE_Y];
+  const uint8_t* u_row = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_U]) +
+                         (y / 2) * sdr_intent->stride[UHDR_PLANE_U];
+  const uint8_t* v_row = static_cast<uint8_t*>(sdr_intent->planes[UHDR_PLANE_V]) +
+                         (y / 2) * sdr_intent->stride[UHDR_PLANE_V];
+
+  const size_t y_lower = (std::min)(y / map_scale_factor, static_cast<size_t>(gainmap_img->h) - 1);
+  const size_t y_upper =
+      (std::min)(y / map_scale_factor + 1, static_cast<size_t>(gainmap_img->h) - 1);
+  const uint8_t* map_data = static_cast<uint8_t*>(gainmap_img->planes[UHDR_PLANE_Y]);
+  const size_t map_stride = gainmap_img->stride[UHDR_PLANE_Y];
+  const uint8_t* map_top = map_data + y_lower * map_stride;
+  const uint8_t* map_bottom = map_data + y_upper * map_stride;
+  const float* weights = (y_lower == y_upper) ? idwTable.mWeightsNB : idwTable.mWeights;
+  weights += (y % map_scale_factor) * map_scale_factor * 4;
+
+  const float* srgb_lut = getSrgbInvOetfLUT();
+  const uint16_t* code_lut = output_ct == UHDR_CT_HLG  ? getHlgCodeLUT()
+                            : output_ct == UHDR_CT_PQ ? getPqCodeLUT()
+                                                      : nullptr;
+  const float* gain_table = gainLUT.getGainTable();
+
+  const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+  const __m128i scale_i = _mm_set1_epi32(static_cast<int>(map_scale_factor));
+  const __m128 scale_f = _mm_set1_ps(static_cast<float>(map_scale_factor));
+  const __m128 offset_sdr = _mm_set1_ps(metadata->offset_sdr);
+  const __m128 offset_hdr = _mm_set1_ps(metadata->offset_hdr);
+  const __m128 inv_255 = _mm_set1_ps(1 / 255.0f);
+
+  uint8_t* dst = static_cast<uint8_t*>(dest->planes[UHDR_PLANE_PACKED]);
+  const size_t dst_offset = y * dest->stride[UHDR_PLANE_PACKED];
+
+  for (size_t x = 0; x < vec_width; x += 4) {
+    // yuv -> linear rgb
+    uint32_t luma;
+    memcpy(&luma, y_row + x, sizeof luma);
+    const __m128 y_f = _mm_mul_ps(
+        _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(static_cast<int>(luma)))), inv_255);
+    const __m128 u_f = loadChroma_sse41(u_row + x / 2);
+    const __m128 v_f = loadChroma_sse41(v_row + x / 2);
+    __m128 r = clampPixelFloat_sse41(_mm_add_ps(y_f, _mm_mul_ps(_mm_set1_ps(kP3Cr), v_f)));
+    __m128 g = clampPixelFloat_sse41(
+        _mm_sub_ps(_mm_sub_ps(y_f, _mm_mul_ps(_mm_set1_ps(kP3GCb), u_f)),
+                   _mm_mul_ps(_mm_set1_ps(kP3GCr), v_f)));
+    __m128 b = clampPixelFloat_sse41(_mm_add_ps(y_f, _mm_mul_ps(_mm_set1_ps(kP3Cb), u_f)));
+    r = lookup_sse41(srgb_lut, kSrgbInvOETFNumEntries, r);
+    g = lookup_sse41(srgb_lut, kSrgbInvOETFNumEntries, g);
+    b = lookup_sse41(srgb_lut, kSrgbInvOETFNumEntries, b);
+
+    // sample gain map, see sampleMap() with ShepardsIDW
+    const __m128i xs = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(x)), lanes);
+    const __m128i x_lower = _mm_cvttps_epi32(
+        _mm_div_ps(_mm_add_ps(_mm_cvtepi32_ps(xs), _mm_set1_ps(0.5f)), scale_f));
+    const __m128i x_upper = _mm_add_epi32(x_lower, _mm_set1_epi32(1));
+    const __m128i w_idx = _mm_slli_epi32(_mm_sub_epi32(xs, _mm_mullo_epi32(x_lower, scale_i)), 2);
+    const __m128 e1 = loadMap_sse41(map_top, x_lower);
+    const __m128 e2 = loadMap_sse41(map_bottom, x_lower);
+    const __m128 e3 = loadMap_sse41(map_top, x_upper);
+    const __m128 e4 = loadMap_sse41(map_bottom, x_upper);
+    __m128 gain = _mm_mul_ps(e1, gather_sse41(weights, w_idx));
+    gain = _mm_add_ps(gain, _mm_mul_ps(e2, gather_sse41(weights + 1, w_idx)));
+    gain = _mm_add_ps(gain, _mm_mul_ps(e3, gather_sse41(weights + 2, w_idx)));
+    gain = _mm_add_ps(gain, _mm_mul_ps(e4, gather_sse41(weights + 3, w_idx)));
+
+    // apply gain, see applyGainLUT()
+    const __m128 gain_factor = lookup_sse41(gain_table, kGainFactorNumEntries, gain);
+    r = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(r, offset_sdr), gain_factor), offset_hdr);
+    g = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(g, offset_sdr), gain_factor), offset_hdr);
+    b = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(b, offset_sdr), gain_factor), offset_hdr);
+    if (gamut_matrix != nullptr) {
+      // output gamut, see getGamutConversionMatrix()
+      const __m128 r_out = dot3_sse41(gamut_matrix, r, g, b);
+      const __m128 g_out = dot3_sse41(gamut_matrix + 3, r, g, b);
+      b = dot3_sse41(gamut_matrix + 6, r, g, b);
+      r = r_out;
+      g = g_out;
+      // colors outside of the output gamut map to code 0 in the hlg and pq tables
+    }
+
+    if (output_ct == UHDR_CT_LINEAR) {
+      // f16c is not implied by sse4.1, convert with the scalar helper
+      float rgb[3][4];
+      _mm_storeu_ps(rgb[0], r);
+      _mm_storeu_ps(rgb[1], g);
+      _mm_storeu_ps(rgb[2], b);
+      uint64_t* out = reinterpret_cast<uint64_t*>(dst) + dst_offset + x;
+      for (int i = 0; i < 4; i++) {
+        out[i] = colorToRgbaF16({{{rgb[0][i], rgb[1][i], rgb[2][i]}}});
+      }
+    } else {
+      // scaling, inverse ootf, oetf and quantization in one lookup per component
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + (dst_offset + x) * sizeof(uint32_t)),
+                       toRgba1010102_sse41(code_lut, r, g, b));
+    }
+  }
+
+  return vec_width;
+}
+
+// See computeGain()
+UHDR_TARGET_SSE41 static inline __m128 computeGain_sse41(__m128 sdr, __m128 hdr) {
+  const __m128 ratio = _mm_div_ps(_mm_add_ps(hdr, _mm_set1_ps(kHdrOffset)),
+                                  _mm_add_ps(sdr, _mm_set1_ps(kSdrOffset)));
+  const __m128 gain = _mm_mul_ps(log_sse41(ratio), _mm_set1_ps(1.44269504088896341f));
+  const __m128 dark = _mm_cmplt_ps(sdr, _mm_set1_ps(2.f / 255.0f));
+  return _mm_blendv_ps(gain, _mm_min_ps(gain, _mm_set1_ps(2.3f)), dark);
+}
+
+UHDR_TARGET_SSE41 static inline void yuvToRgb_sse41(const float coeffs[4], const float* y,
+                                                    const float* u, const float* v, __m128& r,
+                                                    __m128& g, __m128& b) {
+  const __m128 y_f = _mm_load_ps(y);
+  const __m128 u_f = _mm_load_ps(u);
+  const __m128 v_f = _mm_load_ps(v);
+  r = clampPixelFloat_sse41(_mm_add_ps(y_f, _mm_mul_ps(_mm_set1_ps(coeffs[0]), v_f)));
+  g = clampPixelFloat_sse41(_mm_sub_ps(_mm_sub_ps(y_f, _mm_mul_ps(_mm_set1_ps(coeffs[1]), u_f)),
+                                       _mm_mul_ps(_mm_set1_ps(coeffs[2]), v_f)));
+  b = clampPixelFloat_sse41(_mm_add_ps(y_f, _mm_mul_ps(_mm_set1_ps(coeffs[3]), u_f)));
+}
+
+UHDR_TARGET_SSE41 size_t generateGainMapRow_sse41(uhdr_raw_image_t* sdr_intent,
+                                                  uhdr_raw_image_t* hdr_intent,
+                                                  const GainMapRowParams& params,
+                                                  size_t map_scale_factor, size_t map_width,
+                                                  size_t y, float* gains) {
+  const size_t vec_width = map_width & ~static_cast<size_t>(3);
+  alignas(16) float sdr_yuv[3][kGainMapRowChunk];
+  alignas(16) float hdr_yuv[3][kGainMapRowChunk];
+  float* sdr_planes[3] = {sdr_yuv[0], sdr_yuv[1], sdr_yuv[2]};
+  float* hdr_planes[3] = {hdr_yuv[0], hdr_yuv[1], hdr_yuv[2]};
+  const float* srgb_lut = getSrgbInvOetfLUT();
+  const float* m = params.hdr_gamut_matrix.data();
+  const __m128 sdr_nits = _mm_set1_ps(kSdrWhiteNits);
+  const __m128 hdr_nits = _mm_set1_ps(params.hdr_sample_to_nits);
+  const __m128 zero = _mm_setzero_ps();
+
+  for (size_t x = 0; x < vec_width; x += 4) {
+    const size_t chunk_x = x % kGainMapRowChunk;
+    if (chunk_x == 0) {
+      const size_t len = (std::min)(kGainMapRowChunk, vec_width - x);
+      sampleYuv420Row(sdr_intent, map_scale_factor, x, y, len, sdr_planes);
+      sampleP010Row(hdr_intent, map_scale_factor, x, y, len, hdr_planes);
+    }
+
+    // sdr yuv -> linear rgb
+    __m128 sr, sg, sb;
+    yuvToRgb_sse41(params.sdr_yuv_to_rgb, sdr_yuv[0] + chunk_x, sdr_yuv[1] + chunk_x,
+                   sdr_yuv[2] + chunk_x, sr, sg, sb);
+    sr = lookup_sse41(srgb_lut, kSrgbInvOETFNumEntries, sr);
+    sg = lookup_sse41(srgb_lut, kSrgbInvOETFNumEntries, sg);
+    sb = lookup_sse41(srgb_lut, kSrgbInvOETFNumEntries, sb);
+
+    // hdr yuv -> linear rgb in sdr gamut
+    __m128 hr, hg, hb;
+    yuvToRgb_sse41(params.hdr_yuv_to_rgb, hdr_yuv[0] + chunk_x, hdr_yuv[1] + chunk_x,
+                   hdr_yuv[2] + chunk_x, hr, hg, hb);
+    hr = lookup_sse41(params.hdr_inv_oetf_lut, params.hdr_inv_oetf_entries, hr);
+    hg = lookup_sse41(params.hdr_inv_oetf_lut, params.hdr_inv_oetf_entries, hg);
+    hb = lookup_sse41(params.hdr_inv_oetf_lut, params.hdr_inv_oetf_entries, hb);
+    if (params.hdr_ootf_gamma != 1.0f) {
+      hr = pow_sse41(hr, params.hdr_ootf_gamma);
+      hg = pow_sse41(hg, params.hdr_ootf_gamma);
+      hb = pow_sse41(hb, params.hdr_ootf_gamma);
+    }
+    const __m128 cr = dot3_sse41(m, hr, hg, hb);
+    const __m128 cg = dot3_sse41(m + 3, hr, hg, hb);
+    const __m128 cb = dot3_sse41(m + 6, hr, hg, hb);
+    hr = _mm_max_ps(cr, zero);
+    hg = _mm_max_ps(cg, zero);
+    hb = _mm_max_ps(cb, zero);
+
+    if (params.multichannel) {
+      alignas(16) float out[3][4];
+      _mm_store_ps(out[0], computeGain_sse41(_mm_mul_ps(sr, sdr_nits), _mm_mul_ps(hr, hdr_nits)));
+      _mm_store_ps(out[1], computeGain_sse41(_mm_mul_ps(sg, sdr_nits), _mm_mul_ps(hg, hdr_nits)));
+      _mm_store_ps(out[2], computeGain_sse41(_mm_mul_ps(sb, sdr_nits), _mm_mul_ps(hb, hdr_nits)));
+      for (int i = 0; i < 4; i++) {
+        gains[(x + i) * 3] = out[0][i];
+        gains[(x + i) * 3 + 1] = out[1][i];
+        gains[(x + i) * 3 + 2] = out[2][i];
+      }
+    } else {
+      __m128 sdr_y, hdr_y;
+      if (params.use_luminance) {
+        sdr_y = dot3_sse41(params.luminance.data(), sr, sg, sb);
+        hdr_y = dot3_sse41(params.luminance.data(), hr, hg, hb);
+      } else {
+        sdr_y = _mm_max_ps(sr, _mm_max_ps(sg, sb));
+        hdr_y = _mm_max_ps(hr, _mm_max_ps(hg, hb));
+      }
+      _mm_storeu_ps(gains + x,
+                    computeGain_sse41(_mm_mul_ps(sdr_y, sdr_nits), _mm_mul_ps(hdr_y, hdr_nits)));
+    }
+  }
+
+  return vec_width;
+}
+
+// Packs the Q14 coefficients of u and v for _mm_madd_epi16() on interleaved u, v samples
+static inline int coeffPair(const int16_t* coeffs) {
+  return static_cast<int>(static_cast<uint16_t>(coeffs[0]) |
+                          (static_cast<uint32_t>(static_cast<uint16_t>(coeffs[1])) << 16));
+}
+
+// c1 * u + c2 * v of 8 unbiased chroma samples, rounded and saturated like yuvGamutConversionQ14()
+UHDR_TARGET_SSE41 static inline __m128i yuvConversion_sse41(__m128i u, __m128i v, __m128i coeffs) {
+  const __m128i round = _mm_set1_epi32(1 << 13);
+  __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(u, v), coeffs);
+  __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(u, v), coeffs);
+  lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 14);
+  hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 14);
+  return _mm_packs_epi32(lo, hi);
+}
+
+// Adds the luma offsets of 16 pixels to a row and narrows back with saturation
+UHDR_TARGET_SSE41 static inline void addLuma_sse41(uint8_t* row, __m128i dy_lo, __m128i dy_hi) {
+  const __m128i luma = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row));
+  const __m128i lo = _mm_add_epi16(_mm_cvtepu8_epi16(luma), dy_lo);
+  const __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(luma, _mm_setzero_si128()), dy_hi);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(row), _mm_packus_epi16(lo, hi));
+}
+
+UHDR_TARGET_SSE41 static inline __m128i loadUnbiasedChroma_sse41(const uint8_t* src) {
+  // 128 bias for UV given we are using libjpeg
+  const __m128i samples = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src));
+  return _mm_sub_epi16(_mm_cvtepu8_epi16(samples), _mm_set1_epi16(128));
+}
+
+UHDR_TARGET_SSE41 void transformYuv420_sse41(uhdr_raw_image_t* image, const int16_t* coeffs_ptr) {
+  const __m128i coeffs_y = _mm_set1_epi32(coeffPair(coeffs_ptr));
+  const __m128i coeffs_u = _mm_set1_epi32(coeffPair(coeffs_ptr + 2));
+  const __m128i coeffs_v = _mm_set1_epi32(coeffPair(coeffs_ptr + 4));
+  const __m128i bias = _mm_set1_epi16(128);
+  const size_t vec_width = (image->w / 2) & ~size_t(7);
+
+  for (size_t h = 0; h < image->h / 2; ++h) {
+    uint8_t* y0_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_Y]) + h * 2 * image->stride[UHDR_PLANE_Y];
+    uint8_t* y1_ptr = y0_ptr + image->stride[UHDR_PLANE_Y];
+    uint8_t* u_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_U]) + h * image->stride[UHDR_PLANE_U];
+    uint8_t* v_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_V]) + h * image->stride[UHDR_PLANE_V];
+
+    for (size_t w = 0; w < vec_width; w += 8) {
+      const __m128i u = loadUnbiasedChroma_sse41(u_ptr + w);
+      const __m128i v = loadUnbiasedChroma_sse41(v_ptr + w);
+
+      // the luma offset only depends on chroma, each one is shared by a 2x2 block
+      const __m128i dy = yuvConversion_sse41(u, v, coeffs_y);
+      const __m128i dy_lo = _mm_unpacklo_epi16(dy, dy);
+      const __m128i dy_hi = _mm_unpackhi_epi16(dy, dy);
+      addLuma_sse41(y0_ptr + w * 2, dy_lo, dy_hi);
+      addLuma_sse41(y1_ptr + w * 2, dy_lo, dy_hi);
+
+      const __m128i new_u = _mm_add_epi16(yuvConversion_sse41(u, v, coeffs_u), bias);
+      const __m128i new_v = _mm_add_epi16(yuvConversion_sse41(u, v, coeffs_v), bias);
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(u_ptr + w), _mm_packus_epi16(new_u, new_u));
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(v_ptr + w), _mm_packus_epi16(new_v, new_v));
+    }
+    transformYuv420RowQ14(image, coeffs_ptr, vec_width, h);
+  }
+}
+
+UHDR_TARGET_SSE41 void transformYuv444_sse41(uhdr_raw_image_t* image, const int16_t* coeffs_ptr) {
+  const __m128i coeffs_y = _mm_set1_epi32(coeffPair(coeffs_ptr));
+  const __m128i coeffs_u = _mm_set1_epi32(coeffPair(coeffs_ptr + 2));
+  const __m128i coeffs_v = _mm_set1_epi32(coeffPair(coeffs_ptr + 4));
+  const __m128i bias = _mm_set1_epi16(128);
+  const size_t vec_width = image->w & ~size_t(7);
+
+  for (size_t h = 0; h < image->h; ++h) {
+    uint8_t* y_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_Y]) + h * image->stride[UHDR_PLANE_Y];
+    uint8_t* u_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_U]) + h * image->stride[UHDR_PLANE_U];
+    uint8_t* v_ptr =
+        static_cast<uint8_t*>(image->planes[UHDR_PLANE_V]) + h * image->stride[UHDR_PLANE_V];
+
+    for (size_t w = 0; w < vec_width; w += 8) {
+      const __m128i u = loadUnbiasedChroma_sse41(u_ptr + w);
+      const __m128i v = loadUnbiasedChroma_sse41(v_ptr + w);
+      const __m128i luma = _mm_cvtepu8_epi16(
+          _mm_loadl_epi64(reinterpret_cast<const __m128i*>(y_ptr + w)));
+
+      const __m128i new_y = _mm_add_epi16(luma, yuvConversion_sse41(u, v, coeffs_y));
+      const __m128i new_u = _mm_add_epi16(yuvConversion_sse41(u, v, coeffs_u), bias);
+      const __m128i new_v = _mm_add_epi16(yuvConversion_sse41(u, v, coeffs_v), bias);
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(y_ptr + w), _mm_packus_epi16(new_y, new_y));
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(u_ptr + w), _mm_packus_epi16(new_u, new_u));
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(v_ptr + w), _mm_packus_epi16(new_v, new_v));
+    }
+    transformYuv444RowQ14(image, coeffs_ptr, vec_width, h);
+  }
+}
+
+uhdr_error_info_t convertYuv_sse41(uhdr_raw_image_t* image, uhdr_color_gamut_t src_encoding,
+                                   uhdr_color_gamut_t dst_encoding) {
+  return convertYuvQ14(image, src_encoding, dst_encoding, transformYuv420_sse41,
+                       transformYuv444_sse41);
+}
+
+}  // namespace ultrahdr
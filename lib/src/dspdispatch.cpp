@@ -0,0 +1,272 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ultrahdr/dspdispatch.h"
+
+#if (defined(UHDR_ENABLE_INTRINSICS) && \
+     (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)))
+#define UHDR_DSP_X86 1
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#elif (defined(UHDR_ENABLE_INTRINSICS) && (defined(__ARM_NEON__) || defined(__ARM_NEON)))
+#define UHDR_DSP_NEON 1
+#if defined(__aarch64__) && defined(UHDR_ENABLE_NEON_FP16)
+#if defined(__linux__)
+#include <sys/auxv.h>
+#elif defined(__APPLE__)
+#include <sys/sysctl.h>
+#endif
+#endif
+#elif (defined(UHDR_ENABLE_INTRINSICS) && defined(UHDR_ENABLE_RVV))
+#define UHDR_DSP_RVV 1
+#if defined(__linux__) && !defined(__riscv_vector)
+#include <sys/auxv.h>
+#endif
+#elif (defined(UHDR_ENABLE_INTRINSICS) && defined(__wasm_simd128__))
+#define UHDR_DSP_WASM 1
+#elif (defined(UHDR_ENABLE_INTRINSICS) && defined(UHDR_ENABLE_LSX))
+#define UHDR_DSP_LOONGARCH 1
+#if defined(__linux__)
+#include <sys/auxv.h>
+#endif
+#endif
+
+namespace ultrahdr {
+
+#ifdef UHDR_DSP_X86
+static void cpuid(int leaf, int subleaf, unsigned int regs[4]) {
+#if defined(_MSC_VER) && !defined(__clang__)
+  __cpuidex(reinterpret_cast<int*>(regs), leaf, subleaf);
+#else
+  __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static uint64_t xgetbv() {
+#if defined(_MSC_VER) && !defined(__clang__)
+  return _xgetbv(0);
+#else
+  uint32_t eax, edx;
+  __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+}
+
+// AVX2 level also implies F16C, which the avx2 kernels use for half float conversions. AVX512
+// level is reported on top of AVX2, the avx512 kernels cover only part of the table.
+static uhdr_isa_level_t detectIsaLevel() {
+  unsigned int regs[4];
+  cpuid(0, 0, regs);
+  const unsigned int max_leaf = regs[0];
+  if (max_leaf < 1) return UHDR_ISA_NONE;
+  cpuid(1, 0, regs);
+  const bool has_sse41 = (regs[2] >> 19) & 1;
+  const bool has_f16c = (regs[2] >> 29) & 1;
+  // avx state must be enabled by the os as well, see Intel SDM Vol. 1, Section 14.3
+  const bool has_osxsave = (regs[2] >> 27) & 1;
+  const bool has_avx = (regs[2] >> 28) & 1;
+  bool has_avx2 = false, has_avx512f = false;
+  if (has_osxsave && has_avx && max_leaf >= 7) {
+    const uint64_t xcr0 = xgetbv();
+    cpuid(7, 0, regs);
+    if ((xcr0 & 0x6) == 0x6) has_avx2 = (regs[1] >> 5) & 1;
+    // opmask and upper zmm state as well
+    if ((xcr0 & 0xe6) == 0xe6) has_avx512f = (regs[1] >> 16) & 1;
+  }
+  if (has_avx2 && has_f16c && has_avx512f) return UHDR_ISA_AVX512;
+  if (has_avx2 && has_f16c) return UHDR_ISA_AVX2;
+  if (has_sse41) return UHDR_ISA_SSE41;
+  return UHDR_ISA_NONE;
+}
+#elif defined(UHDR_DSP_NEON)
+// HWCAP_ASIMDHP of AT_HWCAP on arm64 linux, FEAT_FP16 in the sysctls on apple platforms
+static uhdr_isa_level_t detectIsaLevel() {
+#if defined(__aarch64__) && defined(UHDR_ENABLE_NEON_FP16)
+#if defined(__ARM_FEATURE_FP16_VECTOR_ARITHMETIC)
+  return UHDR_ISA_NEON_FP16;
+#elif defined(__linux__)
+  return (getauxval(AT_HWCAP) & (1ul << 10)) ? UHDR_ISA_NEON_FP16 : UHDR_ISA_NEON;
+#elif defined(__APPLE__)
+  int has_fp16 = 0;
+  size_t size = sizeof(has_fp16);
+  if (sysctlbyname("hw.optional.arm.FEAT_FP16", &has_fp16, &size, nullptr, 0) == 0 && has_fp16) {
+    return UHDR_ISA_NEON_FP16;
+  }
+  return UHDR_ISA_NEON;
+#else
+  return UHDR_ISA_NEON;
+#endif
+#else
+  return UHDR_ISA_NEON;
+#endif
+}
+#elif defined(UHDR_DSP_RVV)
+// The single letter extensions are reported as bits of AT_HWCAP, 'V' is bit 21
+static uhdr_isa_level_t detectIsaLevel() {
+#if defined(__riscv_vector)
+  return UHDR_ISA_RVV;
+#elif defined(__linux__)
+  return (getauxval(AT_HWCAP) & (1ul << ('V' - 'A'))) ? UHDR_ISA_RVV : UHDR_ISA_NONE;
+#else
+  return UHDR_ISA_NONE;
+#endif
+}
+#elif defined(UHDR_DSP_WASM)
+static uhdr_isa_level_t detectIsaLevel() { return UHDR_ISA_SIMD128; }
+#elif defined(UHDR_DSP_LOONGARCH)
+// HWCAP_LOONGARCH_LSX and HWCAP_LOONGARCH_LASX of AT_HWCAP
+static const unsigned long kHwcapLsx = 1ul << 4, kHwcapLasx = 1ul << 5;
+
+static uhdr_isa_level_t detectIsaLevel() {
+#if defined(__loongarch_asx)
+  return UHDR_ISA_LASX;
+#elif defined(__linux__)
+  const unsigned long hwcap = getauxval(AT_HWCAP);
+  if (hwcap & kHwcapLasx) return UHDR_ISA_LASX;
+#if defined(__loongarch_sx)
+  return UHDR_ISA_LSX;
+#else
+  return (hwcap & kHwcapLsx) ? UHDR_ISA_LSX : UHDR_ISA_NONE;
+#endif
+#elif defined(__loongarch_sx)
+  return UHDR_ISA_LSX;
+#else
+  return UHDR_ISA_NONE;
+#endif
+}
+#else
+static uhdr_isa_level_t detectIsaLevel() { return UHDR_ISA_NONE; }
+#endif
+
+static uhdr_dsp_functions_t initDspFunctions() {
+  uhdr_dsp_functions_t fns{};
+  fns.isa = detectIsaLevel();
+#ifdef UHDR_DSP_X86
+  if (fns.isa >= UHDR_ISA_SSE41) {
+    // the block transposes stay in 128 bit registers, avx2 offers no wider shuffle across lanes
+    fns.mirror_uint8_t = mirror_buffer_sse41<uint8_t>;
+    fns.mirror_uint16_t = mirror_buffer_sse41<uint16_t>;
+    fns.mirror_uint32_t = mirror_buffer_sse41<uint32_t>;
+    fns.mirror_uint64_t = mirror_buffer_sse41<uint64_t>;
+    fns.rotate_uint8_t = rotate_buffer_clockwise_sse41<uint8_t>;
+    fns.rotate_uint16_t = rotate_buffer_clockwise_sse41<uint16_t>;
+    fns.rotate_uint32_t = rotate_buffer_clockwise_sse41<uint32_t>;
+    fns.rotate_uint64_t = rotate_buffer_clockwise_sse41<uint64_t>;
+  }
+  if (fns.isa >= UHDR_ISA_AVX2) {
+    fns.applyGainMapRow = applyGainMapRowYuv420_avx2;
+    fns.generateGainMapRow = generateGainMapRow_avx2;
+    fns.toneMapRow = toneMapRowP010_avx2;
+    fns.rgbaF16ToFloatRow = rgbaF16ToFloatRow_avx2;
+    fns.floatToRgbaF16Row = floatToRgbaF16Row_avx2;
+    fns.convertYuv = convertYuv_avx2;
+    fns.convertRawInputToYcbcr = convert_raw_input_to_ycbcr_avx2;
+    fns.resampleColumns = resampleColumns_avx2;
+    fns.resampleRowRgba = resampleRowRgba_avx2;
+  }
+  switch (fns.isa) {
+    case UHDR_ISA_AVX512:
+      fns.applyGainMapRow = applyGainMapRowYuv420_avx512;
+      fns.generateGainMapRow = generateGainMapRow_avx512;
+      break;
+    case UHDR_ISA_SSE41:
+      fns.applyGainMapRow = applyGainMapRowYuv420_sse41;
+      fns.generateGainMapRow = generateGainMapRow_sse41;
+      fns.convertYuv = convertYuv_sse41;
+      break;
+    default:
+      break;
+  }
+#elif defined(UHDR_DSP_NEON)
+  fns.applyGainMapRow = applyGainMapRowYuv420_neon;
+  fns.generateGainMapRow = generateGainMapRow_neon;
+  fns.toneMapRow = toneMapRowP010_neon;
+#if defined(__aarch64__)
+  fns.rgbaF16ToFloatRow = rgbaF16ToFloatRow_neon;
+  fns.floatToRgbaF16Row = floatToRgbaF16Row_neon;
+#endif
+#if defined(__aarch64__) && defined(UHDR_ENABLE_NEON_FP16)
+  if (fns.isa == UHDR_ISA_NEON_FP16) fns.applyGainMapRowHalf = applyGainMapRowYuv420_neon_fp16;
+#endif
+  fns.convertYuv = convertYuv_neon;
+  fns.convertRawInputToYcbcr = convert_raw_input_to_ycbcr_neon;
+  fns.mirror_uint8_t = mirror_buffer_neon<uint8_t>;
+  fns.mirror_uint16_t = mirror_buffer_neon<uint16_t>;
+  fns.mirror_uint32_t = mirror_buffer_neon<uint32_t>;
+  fns.mirror_uint64_t = mirror_buffer_neon<uint64_t>;
+  fns.rotate_uint8_t = rotate_buffer_clockwise_neon<uint8_t>;
+  fns.rotate_uint16_t = rotate_buffer_clockwise_neon<uint16_t>;
+  fns.rotate_uint32_t = rotate_buffer_clockwise_neon<uint32_t>;
+  fns.rotate_uint64_t = rotate_buffer_clockwise_neon<uint64_t>;
+  fns.resampleColumns = resampleColumns_neon;
+  fns.resampleRowRgba = resampleRowRgba_neon;
+#elif defined(UHDR_DSP_RVV)
+  if (fns.isa == UHDR_ISA_RVV) {
+    fns.applyGainMapRow = applyGainMapRowYuv420_rvv;
+    fns.convertYuv = convertYuv_rvv;
+    fns.convertRawInputToYcbcr = convert_raw_input_to_ycbcr_rvv;
+    fns.mirror_uint8_t = mirror_buffer_rvv<uint8_t>;
+    fns.mirror_uint16_t = mirror_buffer_rvv<uint16_t>;
+    fns.mirror_uint32_t = mirror_buffer_rvv<uint32_t>;
+    fns.mirror_uint64_t = mirror_buffer_rvv<uint64_t>;
+    fns.rotate_uint8_t = rotate_buffer_clockwise_rvv<uint8_t>;
+    fns.rotate_uint16_t = rotate_buffer_clockwise_rvv<uint16_t>;
+    fns.rotate_uint32_t = rotate_buffer_clockwise_rvv<uint32_t>;
+    fns.rotate_uint64_t = rotate_buffer_clockwise_rvv<uint64_t>;
+  }
+#elif defined(UHDR_DSP_WASM)
+  fns.applyGainMapRow = applyGainMapRowYuv420_simd128;
+  fns.convertYuv = convertYuv_simd128;
+  fns.mirror_uint8_t = mirror_buffer_simd128<uint8_t>;
+  fns.mirror_uint16_t = mirror_buffer_simd128<uint16_t>;
+  fns.mirror_uint32_t = mirror_buffer_simd128<uint32_t>;
+  fns.mirror_uint64_t = mirror_buffer_simd128<uint64_t>;
+  fns.rotate_uint8_t = rotate_buffer_clockwise_simd128<uint8_t>;
+  fns.rotate_uint16_t = rotate_buffer_clockwise_simd128<uint16_t>;
+  fns.rotate_uint32_t = rotate_buffer_clockwise_simd128<uint32_t>;
+  fns.rotate_uint64_t = rotate_buffer_clockwise_simd128<uint64_t>;
+#elif defined(UHDR_DSP_LOONGARCH)
+  if (fns.isa >= UHDR_ISA_LSX) {
+    fns.applyGainMapRow = applyGainMapRowYuv420_lsx;
+    fns.generateGainMapRow = generateGainMapRow_lsx;
+    fns.convertYuv = convertYuv_lsx;
+    fns.mirror_uint8_t = mirror_buffer_lsx<uint8_t>;
+    fns.mirror_uint16_t = mirror_buffer_lsx<uint16_t>;
+    fns.mirror_uint32_t = mirror_buffer_lsx<uint32_t>;
+    fns.mirror_uint64_t = mirror_buffer_lsx<uint64_t>;
+    fns.rotate_uint8_t = rotate_buffer_clockwise_lsx<uint8_t>;
+    fns.rotate_uint16_t = rotate_buffer_clockwise_lsx<uint16_t>;
+    fns.rotate_uint32_t = rotate_buffer_clockwise_lsx<uint32_t>;
+    fns.rotate_uint64_t = rotate_buffer_clockwise_lsx<uint64_t>;
+  }
+  if (fns.isa >= UHDR_ISA_LASX) {
+    // the yuv conversion and the block transposes stay on lsx, like sse4.1 on x86
+    fns.applyGainMapRow = applyGainMapRowYuv420_lasx;
+    fns.generateGainMapRow = generateGainMapRow_lasx;
+  }
+#endif
+  return fns;
+}
+
+const uhdr_dsp_functions_t& getDspFunctions() {
+  static const uhdr_dsp_functions_t kDspFunctions = initDspFunctions();
+  return kDspFunctions;
+}
+
+}  // namespace ultrahdr
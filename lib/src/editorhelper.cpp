@@ -14,10 +14,13 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <cstring>
 #include <cstdint>
 #include <cmath>
+#include <vector>
 
+#include "ultrahdr/dspdispatch.h"
 #include "ultrahdr/editorhelper.h"
 #include "ultrahdr/gainmapmath.h"
 
@@ -26,12 +29,22 @@ namespace ultrahdr {
 template <typename T>
 void rotate_buffer_clockwise(T* src_buffer, T* dst_buffer, int src_w, int src_h, int src_stride,
                              int dst_stride, int degree) {
+  // The 90 and 270 degree rotations read the source column wise. They are done in tiles so the
+  // source rows touched by a tile stay in cache until all of their elements are consumed.
+  constexpr int kTileSize = 32;
   if (degree == 90) {
     int dst_w = src_h;
     int dst_h = src_w;
-    for (int i = 0; i < dst_h; i++) {
-      for (int j = 0; j < dst_w; j++) {
-        dst_buffer[i * dst_stride + j] = src_buffer[(src_h - j - 1) * src_stride + i];
+    for (int i0 = 0; i0 < dst_h; i0 += kTileSize) {
+      const int i1 = std::min(i0 + kTileSize, dst_h);
+      for (int j0 = 0; j0 < dst_w; j0 += kTileSize) {
+        const int j1 = std::min(j0 + kTileSize, dst_w);
+        for (int i = i0; i < i1; i++) {
+          for (int j = j0; j < j1; j++) {
+            dst_buffer[(size_t)i * dst_stride + j] =
+                src_buffer[(size_t)(src_h - j - 1) * src_stride + i];
+          }
+        }
       }
     }
   } else if (degree == 180) {
@@ -45,9 +58,16 @@ void rotate_buffer_clockwise(T* src_buffer, T* dst_buffer, int src_w, int src_h,
   } else if (degree == 270) {
     int dst_w = src_h;
     int dst_h = src_w;
-    for (int i = 0; i < dst_h; i++) {
-      for (int j = 0; j < dst_w; j++) {
-        dst_buffer[i * dst_stride + j] = src_buffer[j * src_stride + (src_w - i - 1)];
+    for (int i0 = 0; i0 < dst_h; i0 += kTileSize) {
+      const int i1 = std::min(i0 + kTileSize, dst_h);
+      for (int j0 = 0; j0 < dst_w; j0 += kTileSize) {
+        const int j1 = std::min(j0 + kTileSize, dst_w);
+        for (int i = i0; i < i1; i++) {
+          for (int j = j0; j < j1; j++) {
+            dst_buffer[(size_t)i * dst_stride + j] =
+                src_buffer[(size_t)j * src_stride + (src_w - i - 1)];
+          }
+        }
       }
     }
   }
@@ -151,6 +171,287 @@ std::unique_ptr<uhdr_raw_image_ext_t> resize_image(uhdr_raw_image_t* src, int ds
   return dst;
 }
 
+// Resampling filters of the resize effect, f(x) for a distance x in input samples
+static float resize_filter_bilinear(float x) {
+  x = std::fabs(x);
+  return x < 1.0f ? 1.0f - x : 0.0f;
+}
+
+// Keys cubic convolution with a = -0.5
+static float resize_filter_bicubic(float x) {
+  const float a = -0.5f;
+  x = std::fabs(x);
+  if (x < 1.0f) return ((a + 2.0f) * x - (a + 3.0f)) * x * x + 1.0f;
+  if (x < 2.0f) return ((a * x - 5.0f * a) * x + 8.0f * a) * x - 4.0f * a;
+  return 0.0f;
+}
+
+static float resize_filter_lanczos(float x) {
+  const float kPi = 3.14159265358979f;
+  x = std::fabs(x);
+  if (x < 1e-6f) return 1.0f;
+  if (x >= 3.0f) return 0.0f;
+  const float px = kPi * x;
+  return 3.0f * std::sin(px) * std::sin(px / 3.0f) / (px * px);
+}
+
+// Taps of one axis of a separable resize of the window [origin, origin + extent) of the input.
+// Output sample i weighs the input samples starts[i] to starts[i] + taps - 1. Samples past the
+// edges of the input are folded onto the edge sample.
+struct resample_axis_t {
+  int taps;
+  std::vector<int> starts;
+  std::vector<float> weights; /**< taps per output sample, normalized to a sum of one */
+};
+
+static resample_axis_t build_resample_axis(int src_len, int dst_len, uhdr_resize_filter_t filter,
+                                           float origin, float extent) {
+  float (*fn)(float) = resize_filter_bilinear;
+  float support = 1.0f;
+  if (filter == UHDR_RESIZE_BICUBIC) {
+    fn = resize_filter_bicubic;
+    support = 2.0f;
+  } else if (filter == UHDR_RESIZE_LANCZOS) {
+    fn = resize_filter_lanczos;
+    support = 3.0f;
+  }
+  const float scale = extent / dst_len;
+  // a downscale stretches the filter over the input, so that every input sample contributes
+  const float stretch = (std::max)(scale, 1.0f);
+  const float reach = support * stretch;
+  const int span = (int)std::ceil(2.0f * reach);
+
+  resample_axis_t axis;
+  axis.taps = (std::min)(src_len, span);
+  axis.starts.resize(dst_len);
+  axis.weights.assign((size_t)dst_len * axis.taps, 0.0f);
+  for (int i = 0; i < dst_len; i++) {
+    const float center = origin + (i + 0.5f) * scale - 0.5f;
+    const int first = (int)std::floor(center - reach) + 1;
+    const int last = (std::min)((int)std::floor(center + reach), first + span - 1);
+    const int start = (std::max)(0, (std::min)(first, src_len - axis.taps));
+    float* w = &axis.weights[(size_t)i * axis.taps];
+    float sum = 0.0f;
+    for (int j = first; j <= last; j++) {
+      const float wt = fn((j - center) / stretch);
+      w[(std::max)(0, (std::min)(j, src_len - 1)) - start] += wt;
+      sum += wt;
+    }
+    if (sum != 0.0f) {
+      for (int k = 0; k < axis.taps; k++) w[k] /= sum;
+    }
+    axis.starts[i] = start;
+  }
+  return axis;
+}
+
+void resampleColumns(const float* const* rows, const float* weights, int taps, float* dst,
+                     int count) {
+  ResampleColumnsFn resample_columns = getDspFunctions().resampleColumns;
+  int i = resample_columns != nullptr ? resample_columns(rows, weights, taps, dst, count) : 0;
+  for (; i < count; i++) {
+    float acc = weights[0] * rows[0][i];
+    for (int k = 1; k < taps; k++) acc += weights[k] * rows[k][i];
+    dst[i] = acc;
+  }
+}
+
+// Filters a row of pixels of any number of interleaved channels, see ResampleRowRgbaFn
+static void resample_row(const float* src, const int* starts, const float* weights, int taps,
+                         int channels, float* dst, int x, int count) {
+  for (; x < count; x++) {
+    const float* s = src + (size_t)starts[x] * channels;
+    const float* w = weights + (size_t)x * taps;
+    for (int c = 0; c < channels; c++) {
+      float acc = w[0] * s[c];
+      for (int k = 1; k < taps; k++) acc += w[k] * s[k * channels + c];
+      dst[(size_t)x * channels + c] = acc;
+    }
+  }
+}
+
+void resampleRowRgba(const float* src, const int* starts, const float* weights, int taps,
+                     float* dst, int count) {
+  ResampleRowRgbaFn resample_row_rgba = getDspFunctions().resampleRowRgba;
+  int x = resample_row_rgba != nullptr
+              ? resample_row_rgba(src, starts, weights, taps, dst, count)
+              : 0;
+  resample_row(src, starts, weights, taps, 4, dst, x, count);
+}
+
+// Widen a row of count pixels of a plane to floats, channels interleaved, and narrow it back
+typedef void (*LoadRowFn)(const void* src, int count, float* dst);
+typedef void (*StoreRowFn)(const float* src, int count, void* dst);
+
+// samples of kBits bits, stored kShift bits up in a T
+template <typename T, int kChannels, int kBits, int kShift>
+static void load_row(const void* src, int count, float* dst) {
+  const T* s = static_cast<const T*>(src);
+  for (int i = 0; i < count * kChannels; i++) dst[i] = (float)(s[i] >> kShift);
+}
+
+template <typename T, int kChannels, int kBits, int kShift>
+static void store_row(const float* src, int count, void* dst) {
+  const float kMax = (float)((1 << kBits) - 1);
+  T* d = static_cast<T*>(dst);
+  for (int i = 0; i < count * kChannels; i++) {
+    const float v = (std::max)(0.0f, (std::min)(src[i] + 0.5f, kMax));
+    d[i] = (T)((unsigned)v << kShift);
+  }
+}
+
+static void load_row_rgba1010102(const void* src, int count, float* dst) {
+  const uint32_t* s = static_cast<const uint32_t*>(src);
+  for (int i = 0; i < count; i++) {
+    dst[4 * i + 0] = (float)(s[i] & 0x3ff);
+    dst[4 * i + 1] = (float)((s[i] >> 10) & 0x3ff);
+    dst[4 * i + 2] = (float)((s[i] >> 20) & 0x3ff);
+    dst[4 * i + 3] = (float)(s[i] >> 30);
+  }
+}
+
+static void store_row_rgba1010102(const float* src, int count, void* dst) {
+  uint32_t* d = static_cast<uint32_t*>(dst);
+  for (int i = 0; i < count; i++) {
+    uint32_t c[4];
+    for (int j = 0; j < 4; j++) {
+      const float kMax = j == 3 ? 3.0f : 1023.0f;
+      c[j] = (uint32_t)(std::max)(0.0f, (std::min)(src[4 * i + j] + 0.5f, kMax));
+    }
+    d[i] = c[0] | (c[1] << 10) | (c[2] << 20) | (c[3] << 30);
+  }
+}
+
+static void load_row_rgba_f16(const void* src, int count, float* dst) {
+  const uint16_t* s = static_cast<const uint16_t*>(src);
+  for (int i = 0; i < count * 4; i++) dst[i] = halfToFloat(s[i]);
+}
+
+static void store_row_rgba_f16(const float* src, int count, void* dst) {
+  uint16_t* d = static_cast<uint16_t*>(dst);
+  for (int i = 0; i < count * 4; i++) d[i] = floatToHalf(src[i]);
+}
+
+// Resizes the window [left, left + wd) x [top, top + ht) of one plane, strides in bytes. Rows are
+// filtered horizontally as the vertical filter first needs them and kept in a ring of taps rows,
+// so the working set is a few rows of the output.
+static void resample_plane(const uint8_t* src, size_t src_stride, int src_w, int src_h,
+                           uint8_t* dst, size_t dst_stride, int dst_w, int dst_h, int channels,
+                           LoadRowFn load, StoreRowFn store, uhdr_resize_filter_t filter,
+                           float left, float top, float wd, float ht) {
+  if (src_w <= 0 || src_h <= 0 || dst_w <= 0 || dst_h <= 0) return;
+  const resample_axis_t ax = build_resample_axis(src_w, dst_w, filter, left, wd);
+  const resample_axis_t ay = build_resample_axis(src_h, dst_h, filter, top, ht);
+  const size_t row_len = (size_t)dst_w * channels;
+  std::vector<float> line((size_t)src_w * channels);
+  std::vector<float> ring(ay.taps * row_len);
+  std::vector<float> out(row_len);
+  std::vector<const float*> rows(ay.taps);
+
+  int next = 0;  // next input row to filter horizontally
+  for (int y = 0; y < dst_h; y++) {
+    const int start = ay.starts[y];
+    for (next = (std::max)(next, start); next < start + ay.taps; next++) {
+      load(src + next * src_stride, src_w, line.data());
+      float* slot = &ring[(next % ay.taps) * row_len];
+      if (channels == 4) {
+        resampleRowRgba(line.data(), ax.starts.data(), ax.weights.data(), ax.taps, slot, dst_w);
+      } else {
+        resample_row(line.data(), ax.starts.data(), ax.weights.data(), ax.taps, channels, slot, 0,
+                     dst_w);
+      }
+    }
+    for (int k = 0; k < ay.taps; k++) rows[k] = &ring[((start + k) % ay.taps) * row_len];
+    resampleColumns(rows.data(), &ay.weights[(size_t)y * ay.taps], ay.taps, out.data(),
+                    (int)row_len);
+    store(out.data(), dst_w, dst + y * dst_stride);
+  }
+}
+
+// resample_image() of a window of src, in luma pixels
+static std::unique_ptr<uhdr_raw_image_ext_t> resample_window(uhdr_raw_image_t* src, int dst_w,
+                                                             int dst_h, uhdr_resize_filter_t filter,
+                                                             float left, float top, float wd,
+                                                             float ht) {
+  LoadRowFn load;
+  StoreRowFn store;
+  int channels = 1, planes = 1, bytes = 1;
+  bool subsampled = false;
+  switch (src->fmt) {
+    case UHDR_IMG_FMT_24bppYCbCrP010:
+      load = load_row<uint16_t, 1, 10, 6>;
+      store = store_row<uint16_t, 1, 10, 6>;
+      bytes = 2;
+      break;
+    case UHDR_IMG_FMT_12bppYCbCr420:
+      load = load_row<uint8_t, 1, 8, 0>;
+      store = store_row<uint8_t, 1, 8, 0>;
+      planes = 3;
+      subsampled = true;
+      break;
+    case UHDR_IMG_FMT_8bppYCbCr400:
+      load = load_row<uint8_t, 1, 8, 0>;
+      store = store_row<uint8_t, 1, 8, 0>;
+      break;
+    case UHDR_IMG_FMT_24bppYCbCr444:
+      load = load_row<uint8_t, 1, 8, 0>;
+      store = store_row<uint8_t, 1, 8, 0>;
+      planes = 3;
+      break;
+    case UHDR_IMG_FMT_30bppYCbCr444:
+      load = load_row<uint16_t, 1, 10, 0>;
+      store = store_row<uint16_t, 1, 10, 0>;
+      planes = 3;
+      bytes = 2;
+      break;
+    case UHDR_IMG_FMT_32bppRGBA8888:
+      load = load_row<uint8_t, 4, 8, 0>;
+      store = store_row<uint8_t, 4, 8, 0>;
+      channels = 4;
+      bytes = 4;
+      break;
+    case UHDR_IMG_FMT_32bppRGBA1010102:
+      load = load_row_rgba1010102;
+      store = store_row_rgba1010102;
+      channels = 4;
+      bytes = 4;
+      break;
+    case UHDR_IMG_FMT_64bppRGBAHalfFloat:
+      load = load_row_rgba_f16;
+      store = store_row_rgba_f16;
+      channels = 4;
+      bytes = 8;
+      break;
+    default:
+      return nullptr;
+  }
+
+  std::unique_ptr<uhdr_raw_image_ext_t> dst = std::make_unique<uhdr_raw_image_ext_t>(
+      src->fmt, src->cg, src->ct, src->range, dst_w, dst_h, 64);
+  for (int i = 0; i < planes; i++) {
+    const int div = (subsampled && i > 0) ? 2 : 1;
+    resample_plane(static_cast<uint8_t*>(src->planes[i]), (size_t)src->stride[i] * bytes,
+                   src->w / div, src->h / div, static_cast<uint8_t*>(dst->planes[i]),
+                   (size_t)dst->stride[i] * bytes, dst_w / div, dst_h / div, channels, load, store,
+                   filter, left / div, top / div, wd / div, ht / div);
+  }
+  if (src->fmt == UHDR_IMG_FMT_24bppYCbCrP010) {
+    // interleaved chroma, a sample per two luma samples in both directions
+    resample_plane(static_cast<uint8_t*>(src->planes[UHDR_PLANE_UV]),
+                   (size_t)src->stride[UHDR_PLANE_UV] * bytes, src->w / 2, src->h / 2,
+                   static_cast<uint8_t*>(dst->planes[UHDR_PLANE_UV]),
+                   (size_t)dst->stride[UHDR_PLANE_UV] * bytes, dst_w / 2, dst_h / 2, 2,
+                   load_row<uint16_t, 2, 10, 6>, store_row<uint16_t, 2, 10, 6>, filter, left / 2,
+                   top / 2, wd / 2, ht / 2);
+  }
+  return dst;
+}
+
+std::unique_ptr<uhdr_raw_image_ext_t> resample_image(uhdr_raw_image_t* src, int dst_w, int dst_h,
+                                                     uhdr_resize_filter_t filter) {
+  return resample_window(src, dst_w, dst_h, filter, 0.0f, 0.0f, (float)src->w, (float)src->h);
+}
+
 template void mirror_buffer<uint8_t>(uint8_t*, uint8_t*, int, int, int, int,
                                      uhdr_mirror_direction_t);
 template void mirror_buffer<uint16_t>(uint16_t*, uint16_t*, int, int, int, int,
@@ -171,31 +472,19 @@ template void resize_buffer<uint32_t>(uint32_t*, uint32_t*, int, int, int, int,
 template void resize_buffer<uint64_t>(uint64_t*, uint64_t*, int, int, int, int, int, int);
 
 uhdr_mirror_effect::uhdr_mirror_effect(uhdr_mirror_direction_t direction) : m_direction{direction} {
-#if (defined(UHDR_ENABLE_INTRINSICS) && (defined(__ARM_NEON__) || defined(__ARM_NEON)))
-  m_mirror_uint8_t = mirror_buffer_neon<uint8_t>;
-  m_mirror_uint16_t = mirror_buffer_neon<uint16_t>;
-  m_mirror_uint32_t = mirror_buffer_neon<uint32_t>;
-  m_mirror_uint64_t = mirror_buffer_neon<uint64_t>;
-#else
-  m_mirror_uint8_t = mirror_buffer<uint8_t>;
-  m_mirror_uint16_t = mirror_buffer<uint16_t>;
-  m_mirror_uint32_t = mirror_buffer<uint32_t>;
-  m_mirror_uint64_t = mirror_buffer<uint64_t>;
-#endif
+  const uhdr_dsp_functions_t& dsp = getDspFunctions();
+  m_mirror_uint8_t = dsp.mirror_uint8_t ? dsp.mirror_uint8_t : mirror_buffer<uint8_t>;
+  m_mirror_uint16_t = dsp.mirror_uint16_t ? dsp.mirror_uint16_t : mirror_buffer<uint16_t>;
+  m_mirror_uint32_t = dsp.mirror_uint32_t ? dsp.mirror_uint32_t : mirror_buffer<uint32_t>;
+  m_mirror_uint64_t = dsp.mirror_uint64_t ? dsp.mirror_uint64_t : mirror_buffer<uint64_t>;
 }
 
 uhdr_rotate_effect::uhdr_rotate_effect(int degree) : m_degree{degree} {
-#if (defined(UHDR_ENABLE_INTRINSICS) && (defined(__ARM_NEON__) || defined(__ARM_NEON)))
-  m_rotate_uint8_t = rotate_buffer_clockwise_neon<uint8_t>;
-  m_rotate_uint16_t = rotate_buffer_clockwise_neon<uint16_t>;
-  m_rotate_uint32_t = rotate_buffer_clockwise_neon<uint32_t>;
-  m_rotate_uint64_t = rotate_buffer_clockwise_neon<uint64_t>;
-#else
-  m_rotate_uint8_t = rotate_buffer_clockwise<uint8_t>;
-  m_rotate_uint16_t = rotate_buffer_clockwise<uint16_t>;
-  m_rotate_uint32_t = rotate_buffer_clockwise<uint32_t>;
-  m_rotate_uint64_t = rotate_buffer_clockwise<uint64_t>;
-#endif
+  const uhdr_dsp_functions_t& dsp = getDspFunctions();
+  m_rotate_uint8_t = dsp.rotate_uint8_t ? dsp.rotate_uint8_t : rotate_buffer_clockwise<uint8_t>;
+  m_rotate_uint16_t = dsp.rotate_uint16_t ? dsp.rotate_uint16_t : rotate_buffer_clockwise<uint16_t>;
+  m_rotate_uint32_t = dsp.rotate_uint32_t ? dsp.rotate_uint32_t : rotate_buffer_clockwise<uint32_t>;
+  m_rotate_uint64_t = dsp.rotate_uint64_t ? dsp.rotate_uint64_t : rotate_buffer_clockwise<uint64_t>;
 }
 
 uhdr_crop_effect::uhdr_crop_effect(int left, int right, int top, int bottom)
@@ -206,13 +495,302 @@ uhdr_crop_effect::uhdr_crop_effect(int left, int right, int top, int bottom)
   m_crop_uint64_t = crop_buffer<uint64_t>;
 }
 
-uhdr_resize_effect::uhdr_resize_effect(int width, int height) : m_width{width}, m_height{height} {
+uhdr_resize_effect::uhdr_resize_effect(int width, int height, uhdr_resize_filter_t filter)
+    : m_width{width}, m_height{height}, m_filter{filter} {
   m_resize_uint8_t = resize_buffer<uint8_t>;
   m_resize_uint16_t = resize_buffer<uint16_t>;
   m_resize_uint32_t = resize_buffer<uint32_t>;
   m_resize_uint64_t = resize_buffer<uint64_t>;
 }
 
+// Appends an effect, given as the map of its output plane onto its input plane, to the map of the
+// chain so far
+static void compose_plane_map(uhdr_plane_map_t& m, const uhdr_plane_map_t& e) {
+  uhdr_plane_map_t r;
+  r.w = e.w;
+  r.h = e.h;
+  r.xx = m.xx * e.xx + m.xy * e.yx;
+  r.xy = m.xx * e.xy + m.xy * e.yy;
+  r.x0 = m.xx * e.x0 + m.xy * e.y0 + m.x0;
+  r.yx = m.yx * e.xx + m.yy * e.yx;
+  r.yy = m.yx * e.xy + m.yy * e.yy;
+  r.y0 = m.yx * e.x0 + m.yy * e.y0 + m.y0;
+  m = r;
+}
+
+static void rotate_plane_map(uhdr_plane_map_t& m, int degree) {
+  const int w = m.w, h = m.h;
+  if (degree == 90) {
+    compose_plane_map(m, {h, w, 0, 1, 0, -1, 0, h - 1});
+  } else if (degree == 180) {
+    compose_plane_map(m, {w, h, -1, 0, w - 1, 0, -1, h - 1});
+  } else {
+    compose_plane_map(m, {h, w, 0, -1, w - 1, 1, 0, 0});
+  }
+}
+
+static void mirror_plane_map(uhdr_plane_map_t& m, uhdr_mirror_direction_t direction) {
+  const int w = m.w, h = m.h;
+  if (direction == UHDR_MIRROR_VERTICAL) {
+    compose_plane_map(m, {w, h, 1, 0, 0, 0, -1, h - 1});
+  } else {
+    compose_plane_map(m, {w, h, -1, 0, w - 1, 0, 1, 0});
+  }
+}
+
+static void crop_plane_map(uhdr_plane_map_t& m, int left, int top, int wd, int ht) {
+  compose_plane_map(m, {wd, ht, 1, 0, left, 0, 1, top});
+}
+
+// nearest sample at an integer step, the same as resize_buffer()
+static void resize_plane_map(uhdr_plane_map_t& m, int dst_w, int dst_h) {
+  const int step_x = dst_w > 0 ? m.w / dst_w : 0;
+  const int step_y = dst_h > 0 ? m.h / dst_h : 0;
+  compose_plane_map(m, {dst_w, dst_h, step_x, 0, 0, 0, step_y, 0});
+}
+
+uhdr_effect_chain::uhdr_effect_chain(int w, int h)
+    : m_luma{w, h, 1, 0, 0, 0, 1, 0}, m_chroma{w / 2, h / 2, 1, 0, 0, 0, 1, 0}, m_count{0} {}
+
+bool uhdr_effect_chain::rotate(int degree) {
+  if (degree != 90 && degree != 180 && degree != 270) return false;
+  rotate_plane_map(m_luma, degree);
+  rotate_plane_map(m_chroma, degree);
+  m_count++;
+  return true;
+}
+
+bool uhdr_effect_chain::mirror(uhdr_mirror_direction_t direction) {
+  if (direction != UHDR_MIRROR_VERTICAL && direction != UHDR_MIRROR_HORIZONTAL) return false;
+  mirror_plane_map(m_luma, direction);
+  mirror_plane_map(m_chroma, direction);
+  m_count++;
+  return true;
+}
+
+bool uhdr_effect_chain::crop(int left, int top, int wd, int ht) {
+  if (left < 0 || top < 0 || wd <= 0 || ht <= 0 || left + wd > m_luma.w || top + ht > m_luma.h) {
+    return false;
+  }
+  crop_plane_map(m_luma, left, top, wd, ht);
+  crop_plane_map(m_chroma, left / 2, top / 2, wd / 2, ht / 2);
+  m_count++;
+  return true;
+}
+
+bool uhdr_effect_chain::resize(int dst_w, int dst_h) {
+  if (dst_w <= 0 || dst_h <= 0) return false;
+  resize_plane_map(m_luma, dst_w, dst_h);
+  resize_plane_map(m_chroma, dst_w / 2, dst_h / 2);
+  m_count++;
+  return true;
+}
+
+// The rotations and mirrors of m for an output of w x h, the offsets keep the input at the origin
+static uhdr_plane_map_t orient_plane_map(const uhdr_plane_map_t& m, int w, int h) {
+  uhdr_plane_map_t r = m;
+  r.w = w;
+  r.h = h;
+  r.x0 = (m.xx < 0 ? w - 1 : 0) + (m.xy < 0 ? h - 1 : 0);
+  r.y0 = (m.yx < 0 ? w - 1 : 0) + (m.yy < 0 ? h - 1 : 0);
+  return r;
+}
+
+uhdr_gainmap_transform::uhdr_gainmap_transform(int w, int h)
+    : m_orient{w, h, 1, 0, 0, 0, 1, 0},
+      m_left{0.0f},
+      m_top{0.0f},
+      m_width{(float)w},
+      m_height{(float)h},
+      m_filter{UHDR_RESIZE_BILINEAR} {}
+
+bool uhdr_gainmap_transform::rotate(int degree) {
+  if (degree != 90 && degree != 180 && degree != 270) return false;
+  rotate_plane_map(m_orient, degree);
+  return true;
+}
+
+bool uhdr_gainmap_transform::mirror(uhdr_mirror_direction_t direction) {
+  if (direction != UHDR_MIRROR_VERTICAL && direction != UHDR_MIRROR_HORIZONTAL) return false;
+  mirror_plane_map(m_orient, direction);
+  return true;
+}
+
+bool uhdr_gainmap_transform::crop(int left, int top, int wd, int ht) {
+  if (left < 0 || top < 0 || wd <= 0 || ht <= 0 || left + wd > width() ||
+      top + ht > height()) {
+    return false;
+  }
+  // the corners of the crop in the resampled window, whose pixels each span px x py of the input
+  const uhdr_plane_map_t& m = m_orient;
+  const int ax = m.xx * left + m.xy * top + m.x0, ay = m.yx * left + m.yy * top + m.y0;
+  const int right = left + wd - 1, bottom = top + ht - 1;
+  const int bx = m.xx * right + m.xy * bottom + m.x0, by = m.yx * right + m.yy * bottom + m.y0;
+  const float px = m_width / (m.xx != 0 ? width() : height());
+  const float py = m_height / (m.yy != 0 ? height() : width());
+  m_left += (std::min)(ax, bx) * px;
+  m_top += (std::min)(ay, by) * py;
+  m_width = (std::abs(bx - ax) + 1) * px;
+  m_height = (std::abs(by - ay) + 1) * py;
+  m_orient = orient_plane_map(m_orient, wd, ht);
+  return true;
+}
+
+bool uhdr_gainmap_transform::resize(int dst_w, int dst_h, uhdr_resize_filter_t filter) {
+  if (dst_w <= 0 || dst_h <= 0) return false;
+  if (filter == UHDR_RESIZE_NEAREST) {
+    // resize_buffer() samples every step-th pixel from the top left, which keeps step * dst pixels
+    // of the input, or only the first one when it upscales
+    const int step_x = width() / dst_w, step_y = height() / dst_h;
+    crop(0, 0, step_x > 0 ? step_x * dst_w : 1, step_y > 0 ? step_y * dst_h : 1);
+  } else {
+    m_filter = filter;
+  }
+  m_orient = orient_plane_map(m_orient, dst_w, dst_h);
+  return true;
+}
+
+// Copies every output pixel from where the map points. When output rows come from input columns
+// the copy runs in tiles, so the lines read for one output row are still cached for the next.
+template <typename T>
+static void remap_buffer(const T* src_buffer, T* dst_buffer, int src_stride, int dst_stride,
+                         const uhdr_plane_map_t& m) {
+  const ptrdiff_t step = (ptrdiff_t)m.yx * src_stride + m.xx;
+  auto row_start = [&](int y) {
+    return src_buffer + (ptrdiff_t)(m.yy * y + m.y0) * src_stride + (m.xy * y + m.x0);
+  };
+
+  if (m.xy == 0 && m.yx == 0) {
+    for (int y = 0; y < m.h; y++) {
+      const T* src_row = row_start(y);
+      T* dst_row = dst_buffer + (size_t)y * dst_stride;
+      if (step == 1) {
+        memcpy(dst_row, src_row, m.w * sizeof(T));
+      } else {
+        for (int x = 0; x < m.w; x++) dst_row[x] = src_row[x * step];
+      }
+    }
+    return;
+  }
+
+  constexpr int kTile = 64;
+  for (int ty = 0; ty < m.h; ty += kTile) {
+    const int th = (std::min)(kTile, m.h - ty);
+    for (int tx = 0; tx < m.w; tx += kTile) {
+      const int tw = (std::min)(kTile, m.w - tx);
+      for (int y = ty; y < ty + th; y++) {
+        const T* src_row = row_start(y) + tx * step;
+        T* dst_row = dst_buffer + (size_t)y * dst_stride + tx;
+        for (int x = 0; x < tw; x++) dst_row[x] = src_row[x * step];
+      }
+    }
+  }
+}
+
+std::unique_ptr<uhdr_raw_image_ext_t> apply_effect_chain(const uhdr_effect_chain_t& chain,
+                                                         uhdr_raw_image_t* src,
+                                                         [[maybe_unused]] void* gl_ctxt,
+                                                         [[maybe_unused]] void* texture) {
+#ifdef UHDR_ENABLE_GLES
+  if ((src->fmt == UHDR_IMG_FMT_32bppRGBA1010102 || src->fmt == UHDR_IMG_FMT_32bppRGBA8888 ||
+       src->fmt == UHDR_IMG_FMT_64bppRGBAHalfFloat || src->fmt == UHDR_IMG_FMT_8bppYCbCr400) &&
+      gl_ctxt != nullptr && *static_cast<GLuint*>(texture) != 0) {
+    return apply_effect_chain_gles(chain, src, static_cast<ultrahdr::uhdr_opengl_ctxt*>(gl_ctxt),
+                                   static_cast<GLuint*>(texture));
+  }
+#endif
+  const uhdr_plane_map_t& luma = chain.m_luma;
+  const uhdr_plane_map_t& chroma = chain.m_chroma;
+  std::unique_ptr<uhdr_raw_image_ext_t> dst = std::make_unique<uhdr_raw_image_ext_t>(
+      src->fmt, src->cg, src->ct, src->range, luma.w, luma.h, 64);
+
+  if (src->fmt == UHDR_IMG_FMT_24bppYCbCrP010) {
+    remap_buffer(static_cast<uint16_t*>(src->planes[UHDR_PLANE_Y]),
+                 static_cast<uint16_t*>(dst->planes[UHDR_PLANE_Y]), src->stride[UHDR_PLANE_Y],
+                 dst->stride[UHDR_PLANE_Y], luma);
+    remap_buffer(static_cast<uint32_t*>(src->planes[UHDR_PLANE_UV]),
+                 static_cast<uint32_t*>(dst->planes[UHDR_PLANE_UV]), src->stride[UHDR_PLANE_UV] / 2,
+                 dst->stride[UHDR_PLANE_UV] / 2, chroma);
+  } else if (src->fmt == UHDR_IMG_FMT_12bppYCbCr420 || src->fmt == UHDR_IMG_FMT_8bppYCbCr400) {
+    remap_buffer(static_cast<uint8_t*>(src->planes[UHDR_PLANE_Y]),
+                 static_cast<uint8_t*>(dst->planes[UHDR_PLANE_Y]), src->stride[UHDR_PLANE_Y],
+                 dst->stride[UHDR_PLANE_Y], luma);
+    if (src->fmt == UHDR_IMG_FMT_12bppYCbCr420) {
+      for (int i = 1; i < 3; i++) {
+        remap_buffer(static_cast<uint8_t*>(src->planes[i]), static_cast<uint8_t*>(dst->planes[i]),
+                     src->stride[i], dst->stride[i], chroma);
+      }
+    }
+  } else if (src->fmt == UHDR_IMG_FMT_32bppRGBA1010102 || src->fmt == UHDR_IMG_FMT_32bppRGBA8888) {
+    remap_buffer(static_cast<uint32_t*>(src->planes[UHDR_PLANE_PACKED]),
+                 static_cast<uint32_t*>(dst->planes[UHDR_PLANE_PACKED]),
+                 src->stride[UHDR_PLANE_PACKED], dst->stride[UHDR_PLANE_PACKED], luma);
+  } else if (src->fmt == UHDR_IMG_FMT_64bppRGBAHalfFloat) {
+    remap_buffer(static_cast<uint64_t*>(src->planes[UHDR_PLANE_PACKED]),
+                 static_cast<uint64_t*>(dst->planes[UHDR_PLANE_PACKED]),
+                 src->stride[UHDR_PLANE_PACKED], dst->stride[UHDR_PLANE_PACKED], luma);
+  } else if (src->fmt == UHDR_IMG_FMT_24bppYCbCr444) {
+    for (int i = 0; i < 3; i++) {
+      remap_buffer(static_cast<uint8_t*>(src->planes[i]), static_cast<uint8_t*>(dst->planes[i]),
+                   src->stride[i], dst->stride[i], luma);
+    }
+  } else if (src->fmt == UHDR_IMG_FMT_30bppYCbCr444) {
+    for (int i = 0; i < 3; i++) {
+      remap_buffer(static_cast<uint16_t*>(src->planes[i]), static_cast<uint16_t*>(dst->planes[i]),
+                   src->stride[i], dst->stride[i], luma);
+    }
+  } else {
+    return nullptr;
+  }
+  return dst;
+}
+
+// formats whose crop is a plane offset, the same that the cpu effects support
+static bool is_view_supported(uhdr_img_fmt_t fmt) {
+  return fmt == UHDR_IMG_FMT_24bppYCbCrP010 || fmt == UHDR_IMG_FMT_12bppYCbCr420 ||
+         fmt == UHDR_IMG_FMT_8bppYCbCr400 || fmt == UHDR_IMG_FMT_32bppRGBA1010102 ||
+         fmt == UHDR_IMG_FMT_32bppRGBA8888 || fmt == UHDR_IMG_FMT_64bppRGBAHalfFloat ||
+         fmt == UHDR_IMG_FMT_24bppYCbCr444 || fmt == UHDR_IMG_FMT_30bppYCbCr444;
+}
+
+std::unique_ptr<uhdr_raw_image_ext_t> apply_effect_chain(const uhdr_effect_chain_t& chain,
+                                                         uhdr_raw_image_ext_t* src, void* gl_ctxt,
+                                                         void* texture) {
+  bool on_texture = false;
+#ifdef UHDR_ENABLE_GLES
+  on_texture = gl_ctxt != nullptr && *static_cast<GLuint*>(texture) != 0;
+#endif
+  const uhdr_plane_map_t& luma = chain.m_luma;
+  const uhdr_plane_map_t& chroma = chain.m_chroma;
+  bool crop_only = !on_texture && is_view_supported(src->fmt) && luma.xx == 1 && luma.xy == 0 &&
+                   luma.yx == 0 && luma.yy == 1;
+  if (src->fmt == UHDR_IMG_FMT_24bppYCbCrP010 || src->fmt == UHDR_IMG_FMT_12bppYCbCr420) {
+    // a view places the chroma window at half the luma offset, the chain may not after odd crops
+    crop_only = crop_only && chroma.xx == 1 && chroma.xy == 0 && chroma.yx == 0 &&
+                chroma.yy == 1 && chroma.x0 == luma.x0 / 2 && chroma.y0 == luma.y0 / 2;
+  }
+  if (!crop_only) {
+    return apply_effect_chain(chain, static_cast<uhdr_raw_image_t*>(src), gl_ctxt, texture);
+  }
+  return std::make_unique<uhdr_raw_image_ext_t>(*src, luma.x0, luma.y0, luma.w, luma.h);
+}
+
+std::unique_ptr<uhdr_raw_image_ext_t> apply_gainmap_transform(
+    const uhdr_gainmap_transform_t& transform, uhdr_raw_image_t* src) {
+  const uhdr_plane_map_t& m = transform.m_orient;
+  const bool transposed = m.xx == 0;
+  const int w = transposed ? transform.height() : transform.width();
+  const int h = transposed ? transform.width() : transform.height();
+  auto window = resample_window(src, w, h, transform.m_filter, transform.m_left, transform.m_top,
+                                transform.m_width, transform.m_height);
+  if (window == nullptr || (m.xx == 1 && m.yy == 1)) return window;
+
+  uhdr_effect_chain_t chain(w, h);
+  chain.m_luma = m;
+  chain.m_chroma = orient_plane_map(m, m.w / 2, m.h / 2);
+  return apply_effect_chain(chain, window.get());
+}
+
 std::unique_ptr<uhdr_raw_image_ext_t> apply_rotate(ultrahdr::uhdr_rotate_effect_t* desc,
                                                    uhdr_raw_image_t* src,
                                                    [[maybe_unused]] void* gl_ctxt,
@@ -420,6 +998,20 @@ std::unique_ptr<uhdr_raw_image_ext_t> apply_crop(ultrahdr::uhdr_crop_effect_t* d
   return dst;
 }
 
+std::unique_ptr<uhdr_raw_image_ext_t> apply_crop(ultrahdr::uhdr_crop_effect_t* desc,
+                                                 uhdr_raw_image_ext_t* src, int left, int top,
+                                                 int wd, int ht, void* gl_ctxt, void* texture) {
+  bool on_texture = false;
+#ifdef UHDR_ENABLE_GLES
+  on_texture = gl_ctxt != nullptr && *static_cast<GLuint*>(texture) != 0;
+#endif
+  if (on_texture || !is_view_supported(src->fmt)) {
+    return apply_crop(desc, static_cast<uhdr_raw_image_t*>(src), left, top, wd, ht, gl_ctxt,
+                      texture);
+  }
+  return std::make_unique<uhdr_raw_image_ext_t>(*src, left, top, wd, ht);
+}
+
 std::unique_ptr<uhdr_raw_image_ext_t> apply_resize(ultrahdr::uhdr_resize_effect_t* desc,
                                                    uhdr_raw_image_t* src, int dst_w, int dst_h,
                                                    [[maybe_unused]] void* gl_ctxt,
@@ -432,6 +1024,9 @@ std::unique_ptr<uhdr_raw_image_ext_t> apply_resize(ultrahdr::uhdr_resize_effect_
                              static_cast<GLuint*>(texture));
   }
 #endif
+  if (desc->m_filter != UHDR_RESIZE_NEAREST) {
+    return resample_image(src, dst_w, dst_h, desc->m_filter);
+  }
   std::unique_ptr<uhdr_raw_image_ext_t> dst = std::make_unique<uhdr_raw_image_ext_t>(
       src->fmt, src->cg, src->ct, src->range, dst_w, dst_h, 64);
 
@@ -14,9 +14,12 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <cmath>
 
 #include "ultrahdr/gainmapmath.h"
+#include "ultrahdr/dspdispatch.h"
+#include "ultrahdr/transferfunctionluts.h"
 
 namespace ultrahdr {
 
@@ -129,12 +132,13 @@ Color srgbInvOetf(Color e_gamma) {
   return {{{srgbInvOetf(e_gamma.r), srgbInvOetf(e_gamma.g), srgbInvOetf(e_gamma.b)}}};
 }
 
+const float* getSrgbInvOetfLUT() { return kSrgbInvOetfTable; }
+
 float srgbInvOetfLUT(float e_gamma) {
   int32_t value = static_cast<int32_t>(e_gamma * (kSrgbInvOETFNumEntries - 1) + 0.5);
   // TODO() : Remove once conversion modules have appropriate clamping in place
   value = CLIP3(value, 0, kSrgbInvOETFNumEntries - 1);
-  static LookUpTable kSrgbLut(kSrgbInvOETFNumEntries, static_cast<float (*)(float)>(srgbInvOetf));
-  return kSrgbLut.getTable()[value];
+  return kSrgbInvOetfTable[value];
 }
 
 Color srgbInvOetfLUT(Color e_gamma) {
@@ -251,12 +255,13 @@ float hlgOetf(float e) {
 
 Color hlgOetf(Color e) { return {{{hlgOetf(e.r), hlgOetf(e.g), hlgOetf(e.b)}}}; }
 
+const float* getHlgOetfLUT() { return kHlgOetfTable; }
+
 float hlgOetfLUT(float e) {
   int32_t value = static_cast<int32_t>(e * (kHlgOETFNumEntries - 1) + 0.5);
   // TODO() : Remove once conversion modules have appropriate clamping in place
   value = CLIP3(value, 0, kHlgOETFNumEntries - 1);
-  static LookUpTable kHlgLut(kHlgOETFNumEntries, static_cast<float (*)(float)>(hlgOetf));
-  return kHlgLut.getTable()[value];
+  return kHlgOetfTable[value];
 }
 
 Color hlgOetfLUT(Color e) { return {{{hlgOetfLUT(e.r), hlgOetfLUT(e.g), hlgOetfLUT(e.b)}}}; }
@@ -274,12 +279,13 @@ Color hlgInvOetf(Color e_gamma) {
   return {{{hlgInvOetf(e_gamma.r), hlgInvOetf(e_gamma.g), hlgInvOetf(e_gamma.b)}}};
 }
 
+const float* getHlgInvOetfLUT() { return kHlgInvOetfTable; }
+
 float hlgInvOetfLUT(float e_gamma) {
   int32_t value = static_cast<int32_t>(e_gamma * (kHlgInvOETFNumEntries - 1) + 0.5);
   // TODO() : Remove once conversion modules have appropriate clamping in place
   value = CLIP3(value, 0, kHlgInvOETFNumEntries - 1);
-  static LookUpTable kHlgInvLut(kHlgInvOETFNumEntries, static_cast<float (*)(float)>(hlgInvOetf));
-  return kHlgInvLut.getTable()[value];
+  return kHlgInvOetfTable[value];
 }
 
 Color hlgInvOetfLUT(Color e_gamma) {
@@ -323,12 +329,13 @@ float pqOetf(float e) {
 
 Color pqOetf(Color e) { return {{{pqOetf(e.r), pqOetf(e.g), pqOetf(e.b)}}}; }
 
+const float* getPqOetfLUT() { return kPqOetfTable; }
+
 float pqOetfLUT(float e) {
   int32_t value = static_cast<int32_t>(e * (kPqOETFNumEntries - 1) + 0.5);
   // TODO() : Remove once conversion modules have appropriate clamping in place
   value = CLIP3(value, 0, kPqOETFNumEntries - 1);
-  static LookUpTable kPqLut(kPqOETFNumEntries, static_cast<float (*)(float)>(pqOetf));
-  return kPqLut.getTable()[value];
+  return kPqOetfTable[value];
 }
 
 Color pqOetfLUT(Color e) { return {{{pqOetfLUT(e.r), pqOetfLUT(e.g), pqOetfLUT(e.b)}}}; }
@@ -342,18 +349,59 @@ Color pqInvOetf(Color e_gamma) {
   return {{{pqInvOetf(e_gamma.r), pqInvOetf(e_gamma.g), pqInvOetf(e_gamma.b)}}};
 }
 
+const float* getPqInvOetfLUT() { return kPqInvOetfTable; }
+
 float pqInvOetfLUT(float e_gamma) {
   int32_t value = static_cast<int32_t>(e_gamma * (kPqInvOETFNumEntries - 1) + 0.5);
   // TODO() : Remove once conversion modules have appropriate clamping in place
   value = CLIP3(value, 0, kPqInvOETFNumEntries - 1);
-  static LookUpTable kPqInvLut(kPqInvOETFNumEntries, static_cast<float (*)(float)>(pqInvOetf));
-  return kPqInvLut.getTable()[value];
+  return kPqInvOetfTable[value];
 }
 
 Color pqInvOetfLUT(Color e_gamma) {
   return {{{pqInvOetfLUT(e_gamma.r), pqInvOetfLUT(e_gamma.g), pqInvOetfLUT(e_gamma.b)}}};
 }
 
+typedef std::array<uint16_t, kHdrCodeLUTNumEntries + 1> HdrCodeTable;
+
+// Samples every bucket of the float bits at its center, see hdrCodeLUTIndex()
+template <typename TransferFn>
+static HdrCodeTable buildHdrCodeTable(TransferFn transfer) {
+  HdrCodeTable table;
+  for (int32_t idx = 0; idx < kHdrCodeLUTNumEntries; idx++) {
+    int32_t bits = ((idx + kHdrCodeLUTBias) << kHdrCodeLUTShift) | (1 << (kHdrCodeLUTShift - 1));
+    float value;
+    memcpy(&value, &bits, sizeof value);
+    table[idx] = static_cast<uint16_t>(CLIP3(transfer(value) * 1023 + 0.5f, 0.0f, 1023.0f));
+  }
+  table[kHdrCodeLUTNumEntries] = table[kHdrCodeLUTNumEntries - 1];
+  return table;
+}
+
+const uint16_t* getHlgCodeLUT() {
+  static const HdrCodeTable kHlgCodeTable = buildHdrCodeTable([](float e) {
+    return hlgOetf(std::pow(e * kSdrWhiteNits / kHlgMaxNits, 1.0f / kOotfGamma));
+  });
+  return kHlgCodeTable.data();
+}
+
+const uint16_t* getPqCodeLUT() {
+  static const HdrCodeTable kPqCodeTable =
+      buildHdrCodeTable([](float e) { return pqOetf(e * kSdrWhiteNits / kPqMaxNits); });
+  return kPqCodeTable.data();
+}
+
+static inline uint32_t codesToRgba1010102(const uint16_t* table, Color e) {
+  uint32_t r = table[hdrCodeLUTIndex(e.r)];
+  uint32_t g = table[hdrCodeLUTIndex(e.g)];
+  uint32_t b = table[hdrCodeLUTIndex(e.b)];
+  return (r | (g << 10) | (b << 20) | (0x3 << 30));  // Set alpha to 1.0
+}
+
+uint32_t hlgLinearToRgba1010102(Color e) { return codesToRgba1010102(getHlgCodeLUT(), e); }
+
+uint32_t pqLinearToRgba1010102(Color e) { return codesToRgba1010102(getPqCodeLUT(), e); }
+
 ////////////////////////////////////////////////////////////////////////////////
 // Color access functions
 
@@ -497,8 +545,9 @@ Color getRgbaF16Pixel(uhdr_raw_image_t* image, size_t x, size_t y) {
   return sanitizePixel(pixel);
 }
 
-static Color samplePixels(uhdr_raw_image_t* image, size_t map_scale_factor, size_t x, size_t y,
-                          GetPixelFn get_pixel_fn) {
+template <GetPixelFn get_pixel_fn>
+static inline Color samplePixels(uhdr_raw_image_t* image, size_t map_scale_factor, size_t x,
+                                 size_t y) {
   Color e = {{{0.0f, 0.0f, 0.0f}}};
   for (size_t dy = 0; dy < map_scale_factor; ++dy) {
     for (size_t dx = 0; dx < map_scale_factor; ++dx) {
@@ -509,36 +558,133 @@ static Color samplePixels(uhdr_raw_image_t* image, size_t map_scale_factor, size
   return e / static_cast<float>(map_scale_factor * map_scale_factor);
 }
 
+// The row samplers below stream the map_scale_factor image rows under a run of map pixels once.
+// Each image row adds its samples to column sums of a span of columns, an unstrided loop the
+// compiler vectorizes, and the column sums are then reduced into per pixel sums. The sums are
+// integers below 2^24 for any scale factor up to 128, so accumulating them in the float outputs is
+// exact and the results equal those of a pixel by pixel box filter.
+static constexpr size_t kSampleSpan = 256;
+
+// Adds the column sums of the span starting at image column col0 to the pixel sums of dst, the
+// pixel of column col being (col - col0_of_run) / s.
+static inline void reduceColumnSums(const uint32_t* col_sums, size_t len, size_t k0, size_t s,
+                                    float* dst) {
+  for (size_t k = 0; k < len; k++) dst[(k0 + k) / s] += static_cast<float>(col_sums[k]);
+}
+
+void sampleYuv420Row(uhdr_raw_image_t* image, size_t map_scale_factor, size_t x, size_t y,
+                     size_t count, float* dst[3]) {
+  const uint8_t* luma_data = reinterpret_cast<uint8_t*>(image->planes[UHDR_PLANE_Y]);
+  const uint8_t* cb_data = reinterpret_cast<uint8_t*>(image->planes[UHDR_PLANE_U]);
+  const uint8_t* cr_data = reinterpret_cast<uint8_t*>(image->planes[UHDR_PLANE_V]);
+  const size_t s = map_scale_factor;
+  const int n = static_cast<int>(s * s);
+  const float norm = 1.0f / (255.0f * n);
+  const size_t col0 = x * s, row_len = count * s;
+  uint32_t sum_y[kSampleSpan], sum_u[kSampleSpan], sum_v[kSampleSpan];
+
+  for (int c = 0; c < 3; c++) std::fill_n(dst[c], count, 0.0f);
+  for (size_t k0 = 0; k0 < row_len; k0 += kSampleSpan) {
+    const size_t len = (std::min)(kSampleSpan, row_len - k0);
+    const size_t col = col0 + k0;
+    std::fill_n(sum_y, len, 0u);
+    std::fill_n(sum_u, len, 0u);
+    std::fill_n(sum_v, len, 0u);
+    for (size_t dy = 0; dy < s; dy++) {
+      const size_t row = y * s + dy;
+      const uint8_t* luma = luma_data + row * image->stride[UHDR_PLANE_Y] + col;
+      const uint8_t* cb = cb_data + (row / 2) * image->stride[UHDR_PLANE_U];
+      const uint8_t* cr = cr_data + (row / 2) * image->stride[UHDR_PLANE_V];
+      for (size_t k = 0; k < len; k++) sum_y[k] += luma[k];
+      for (size_t k = 0; k < len; k++) {
+        sum_u[k] += cb[(col + k) / 2];
+        sum_v[k] += cr[(col + k) / 2];
+      }
+    }
+    reduceColumnSums(sum_y, len, k0, s, dst[0]);
+    reduceColumnSums(sum_u, len, k0, s, dst[1]);
+    reduceColumnSums(sum_v, len, k0, s, dst[2]);
+  }
+  const float bias = static_cast<float>(128 * n);
+  for (size_t i = 0; i < count; i++) {
+    dst[0][i] = dst[0][i] * norm;
+    dst[1][i] = (dst[1][i] - bias) * norm;
+    dst[2][i] = (dst[2][i] - bias) * norm;
+  }
+}
+
+void sampleP010Row(uhdr_raw_image_t* image, size_t map_scale_factor, size_t x, size_t y,
+                   size_t count, float* dst[3]) {
+  const uint16_t* luma_data = reinterpret_cast<uint16_t*>(image->planes[UHDR_PLANE_Y]);
+  const uint16_t* chroma_data = reinterpret_cast<uint16_t*>(image->planes[UHDR_PLANE_UV]);
+  const size_t s = map_scale_factor;
+  const int n = static_cast<int>(s * s);
+  const bool full_range = image->range == UHDR_CR_FULL_RANGE;
+  const float bias = static_cast<float>(full_range ? 0 : 64 * n);
+  const float norm_y = 1.0f / ((full_range ? 1023.0f : 876.0f) * n);
+  const float norm_uv = 1.0f / ((full_range ? 1023.0f : 896.0f) * n);
+  const size_t col0 = x * s, row_len = count * s;
+  uint32_t sum_y[kSampleSpan], sum_u[kSampleSpan], sum_v[kSampleSpan];
+
+  for (int c = 0; c < 3; c++) std::fill_n(dst[c], count, 0.0f);
+  for (size_t k0 = 0; k0 < row_len; k0 += kSampleSpan) {
+    const size_t len = (std::min)(kSampleSpan, row_len - k0);
+    const size_t col = col0 + k0;
+    std::fill_n(sum_y, len, 0u);
+    std::fill_n(sum_u, len, 0u);
+    std::fill_n(sum_v, len, 0u);
+    for (size_t dy = 0; dy < s; dy++) {
+      const size_t row = y * s + dy;
+      const uint16_t* luma = luma_data + row * image->stride[UHDR_PLANE_Y] + col;
+      const uint16_t* chroma = chroma_data + (row >> 1) * image->stride[UHDR_PLANE_UV];
+      for (size_t k = 0; k < len; k++) sum_y[k] += luma[k] >> 6;
+      for (size_t k = 0; k < len; k++) {
+        const size_t c = (col + k) & ~size_t(1);
+        sum_u[k] += chroma[c] >> 6;
+        sum_v[k] += chroma[c + 1] >> 6;
+      }
+    }
+    reduceColumnSums(sum_y, len, k0, s, dst[0]);
+    reduceColumnSums(sum_u, len, k0, s, dst[1]);
+    reduceColumnSums(sum_v, len, k0, s, dst[2]);
+  }
+  for (size_t i = 0; i < count; i++) {
+    dst[0][i] = (dst[0][i] - bias) * norm_y;
+    dst[1][i] = (dst[1][i] - bias) * norm_uv - 0.5f;
+    dst[2][i] = (dst[2][i] - bias) * norm_uv - 0.5f;
+  }
+}
+
 Color sampleYuv444(uhdr_raw_image_t* image, size_t map_scale_factor, size_t x, size_t y) {
-  return samplePixels(image, map_scale_factor, x, y, getYuv444Pixel);
+  return samplePixels<getYuv444Pixel>(image, map_scale_factor, x, y);
 }
 
 Color sampleYuv422(uhdr_raw_image_t* image, size_t map_scale_factor, size_t x, size_t y) {
-  return samplePixels(image, map_scale_factor, x, y, getYuv422Pixel);
+  return samplePixels<getYuv422Pixel>(image, map_scale_factor, x, y);
 }
 
 Color sampleYuv420(uhdr_raw_image_t* image, size_t map_scale_factor, size_t x, size_t y) {
-  return samplePixels(image, map_scale_factor, x, y, getYuv420Pixel);
+  return samplePixels<getYuv420Pixel>(image, map_scale_factor, x, y);
 }
 
 Color sampleP010(uhdr_raw_image_t* image, size_t map_scale_factor, size_t x, size_t y) {
-  return samplePixels(image, map_scale_factor, x, y, getP010Pixel);
+  return samplePixels<getP010Pixel>(image, map_scale_factor, x, y);
 }
 
 Color sampleYuv44410bit(uhdr_raw_image_t* image, size_t map_scale_factor, size_t x, size_t y) {
-  return samplePixels(image, map_scale_factor, x, y, getYuv444Pixel10bit);
+  return samplePixels<getYuv444Pixel10bit>(image, map_scale_factor, x, y);
 }
 
 Color sampleRgba8888(uhdr_raw_image_t* image, size_t map_scale_factor, size_t x, size_t y) {
-  return samplePixels(image, map_scale_factor, x, y, getRgba8888Pixel);
+  return samplePixels<getRgba8888Pixel>(image, map_scale_factor, x, y);
 }
 
 Color sampleRgba1010102(uhdr_raw_image_t* image, size_t map_scale_factor, size_t x, size_t y) {
-  return samplePixels(image, map_scale_factor, x, y, getRgba1010102Pixel);
+  return samplePixels<getRgba1010102Pixel>(image, map_scale_factor, x, y);
 }
 
 Color sampleRgbaF16(uhdr_raw_image_t* image, size_t map_scale_factor, size_t x, size_t y) {
-  return samplePixels(image, map_scale_factor, x, y, getRgbaF16Pixel);
+  return samplePixels<getRgbaF16Pixel>(image, map_scale_factor, x, y);
 }
 
 void putRgba8888Pixel(uhdr_raw_image_t* image, size_t x, size_t y, Color& pixel) {
@@ -601,6 +747,108 @@ void putYuv444Pixel(uhdr_raw_image_t* image, size_t x, size_t y, Color& pixel) {
   cr_data[x + y * cr_stride] = uint8_t(pixel.v);
 }
 
+// The pixel accessors are defined above in this file, so the row accessors call them directly and
+// the compiler inlines them into the row loops.
+template <GetPixelFn get_pixel_fn>
+static void getPixelRow(uhdr_raw_image_t* image, size_t x, size_t y, size_t count,
+                        float* dst[3]) {
+  for (size_t i = 0; i < count; i++) {
+    Color pixel = get_pixel_fn(image, x + i, y);
+    dst[0][i] = pixel.r;
+    dst[1][i] = pixel.g;
+    dst[2][i] = pixel.b;
+  }
+}
+
+template <GetPixelFn get_pixel_fn>
+static void samplePixelRow(uhdr_raw_image_t* image, size_t map_scale_factor, size_t x, size_t y,
+                           size_t count, float* dst[3]) {
+  for (size_t i = 0; i < count; i++) {
+    Color pixel = samplePixels<get_pixel_fn>(image, map_scale_factor, x + i, y);
+    dst[0][i] = pixel.r;
+    dst[1][i] = pixel.g;
+    dst[2][i] = pixel.b;
+  }
+}
+
+template <PutPixelFn put_pixel_fn>
+static void putPixelRow(uhdr_raw_image_t* image, size_t x, size_t y, size_t count,
+                        float* src[3]) {
+  for (size_t i = 0; i < count; i++) {
+    Color pixel = {{{src[0][i], src[1][i], src[2][i]}}};
+    put_pixel_fn(image, x + i, y, pixel);
+  }
+}
+
+void rgbaF16ToFloatRow(const uint64_t* src, size_t count, float* dst[3]) {
+  RgbaF16ToFloatRowFn rgba_f16_to_float_row = getDspFunctions().rgbaF16ToFloatRow;
+  size_t i = rgba_f16_to_float_row != nullptr ? rgba_f16_to_float_row(src, count, dst) : 0;
+  for (; i < count; i++) {
+    dst[0][i] = halfToFloat(src[i] & 0xffff);
+    dst[1][i] = halfToFloat((src[i] >> 16) & 0xffff);
+    dst[2][i] = halfToFloat((src[i] >> 32) & 0xffff);
+  }
+}
+
+void floatToRgbaF16Row(float* const src[3], size_t count, uint64_t* dst) {
+  FloatToRgbaF16RowFn float_to_rgba_f16_row = getDspFunctions().floatToRgbaF16Row;
+  size_t i = float_to_rgba_f16_row != nullptr ? float_to_rgba_f16_row(src, count, dst) : 0;
+  for (; i < count; i++) {
+    dst[i] = colorToRgbaF16({{{src[0][i], src[1][i], src[2][i]}}});
+  }
+}
+
+// Clamps the widened samples the way sanitizePixel() does for getRgbaF16Pixel().
+static void sanitizeRow(size_t count, float* dst[3]) {
+  for (int c = 0; c < 3; c++) {
+    for (size_t i = 0; i < count; i++) {
+      float v = dst[c][i];
+      dst[c][i] = std::isfinite(v) ? clampPixelFloatLinear(v) : mapNonFiniteFloats(v);
+    }
+  }
+}
+
+static void getRgbaF16Row(uhdr_raw_image_t* image, size_t x, size_t y, size_t count,
+                          float* dst[3]) {
+  const uint64_t* rgbData = static_cast<const uint64_t*>(image->planes[UHDR_PLANE_PACKED]);
+  rgbaF16ToFloatRow(rgbData + x + y * image->stride[UHDR_PLANE_PACKED], count, dst);
+  sanitizeRow(count, dst);
+}
+
+// Widens the box filter rows a span at a time. Every pixel accumulates its samples in the order of
+// samplePixels(), so the result is bit exact with sampleRgbaF16().
+static void sampleRgbaF16Row(uhdr_raw_image_t* image, size_t map_scale_factor, size_t x, size_t y,
+                             size_t count, float* dst[3]) {
+  constexpr size_t kSpan = 256;
+  float span[3][kSpan];
+  float* span_dst[3] = {span[0], span[1], span[2]};
+  const uint64_t* rgbData = static_cast<const uint64_t*>(image->planes[UHDR_PLANE_PACKED]);
+  const size_t s = map_scale_factor;
+  const size_t row_len = count * s;
+
+  for (int c = 0; c < 3; c++) std::fill_n(dst[c], count, 0.0f);
+  for (size_t dy = 0; dy < s; dy++) {
+    const uint64_t* row = rgbData + x * s + (y * s + dy) * image->stride[UHDR_PLANE_PACKED];
+    for (size_t k0 = 0; k0 < row_len; k0 += kSpan) {
+      const size_t len = (std::min)(kSpan, row_len - k0);
+      rgbaF16ToFloatRow(row + k0, len, span_dst);
+      sanitizeRow(len, span_dst);
+      for (size_t k = 0; k < len; k++) {
+        const size_t i = (k0 + k) / s;
+        dst[0][i] += span[0][k];
+        dst[1][i] += span[1][k];
+        dst[2][i] += span[2][k];
+      }
+    }
+  }
+  const float n = static_cast<float>(s * s);
+  for (size_t i = 0; i < count; i++) {
+    dst[0][i] /= n;
+    dst[1][i] /= n;
+    dst[2][i] /= n;
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Color space conversions
 // Sample, See,
@@ -763,6 +1011,175 @@ void transformYuv444(uhdr_raw_image_t* image, const std::array<float, 9>& coeffs
   }
 }
 
+// Yuv Bt709 -> Yuv Bt601
+// Y' = (1.0f * Y) + ( 0.101579f * U) + ( 0.196076f * V)
+// U' = (0.0f * Y) + ( 0.989854f * U) + (-0.110653f * V)
+// V' = (0.0f * Y) + (-0.072453f * U) + ( 0.983398f * V)
+const int16_t kYuv709To601_coeffs_q14[8] = {1664, 3213, 16218, -1813, -1187, 16112, 0, 0};
+
+// Yuv Bt709 -> Yuv Bt2100
+// Y' = (1.0f * Y) + (-0.016969f * U) + ( 0.096312f * V)
+// U' = (0.0f * Y) + ( 0.995306f * U) + (-0.051192f * V)
+// V' = (0.0f * Y) + ( 0.011507f * U) + ( 1.002637f * V)
+const int16_t kYuv709To2100_coeffs_q14[8] = {-278, 1578, 16307, -839, 189, 16427, 0, 0};
+
+// Yuv Bt601 -> Yuv Bt709
+// Y' = (1.0f * Y) + (-0.118188f * U) + (-0.212685f * V),
+// U' = (0.0f * Y) + ( 1.018640f * U) + ( 0.114618f * V),
+// V' = (0.0f * Y) + ( 0.075049f * U) + ( 1.025327f * V);
+const int16_t kYuv601To709_coeffs_q14[8] = {-1936, -3485, 16689, 1878, 1230, 16799, 0, 0};
+
+// Yuv Bt601 -> Yuv Bt2100
+// Y' = (1.0f * Y) + (-0.128245f * U) + (-0.115879f * V)
+// U' = (0.0f * Y) + ( 1.010016f * U) + ( 0.061592f * V)
+// V' = (0.0f * Y) + ( 0.086969f * U) + ( 1.029350f * V)
+const int16_t kYuv601To2100_coeffs_q14[8] = {-2101, -1899, 16548, 1009, 1425, 16865, 0, 0};
+
+// Yuv Bt2100 -> Yuv Bt709
+// Y' = (1.0f * Y) + ( 0.018149f * U) + (-0.095132f * V)
+// U' = (0.0f * Y) + ( 1.004123f * U) + ( 0.051267f * V)
+// V' = (0.0f * Y) + (-0.011524f * U) + ( 0.996782f * V)
+const int16_t kYuv2100To709_coeffs_q14[8] = {297, -1559, 16452, 840, -189, 16331, 0, 0};
+
+// Yuv Bt2100 -> Yuv Bt601
+// Y' = (1.0f * Y) + ( 0.117887f * U) + ( 0.105521f * V)
+// U' = (0.0f * Y) + ( 0.995211f * U) + (-0.059549f * V)
+// V' = (0.0f * Y) + (-0.084085f * U) + ( 0.976518f * V)
+const int16_t kYuv2100To601_coeffs_q14[8] = {1931, 1729, 16306, -976, -1378, 15999, 0, 0};
+
+uhdr_error_info_t getYuvConversionCoeffsQ14(uhdr_color_gamut_t src_encoding,
+                                            uhdr_color_gamut_t dst_encoding,
+                                            const int16_t** coeffs) {
+  uhdr_error_info_t status = g_no_error;
+  *coeffs = nullptr;
+
+  switch (src_encoding) {
+    case UHDR_CG_BT_709:
+      switch (dst_encoding) {
+        case UHDR_CG_BT_709:
+          return status;
+        case UHDR_CG_DISPLAY_P3:
+          *coeffs = kYuv709To601_coeffs_q14;
+          break;
+        case UHDR_CG_BT_2100:
+          *coeffs = kYuv709To2100_coeffs_q14;
+          break;
+        default:
+          status.error_code = UHDR_CODEC_INVALID_PARAM;
+          status.has_detail = 1;
+          snprintf(status.detail, sizeof status.detail, "Unrecognized dest color gamut %d",
+                   dst_encoding);
+          return status;
+      }
+      break;
+    case UHDR_CG_DISPLAY_P3:
+      switch (dst_encoding) {
+        case UHDR_CG_BT_709:
+          *coeffs = kYuv601To709_coeffs_q14;
+          break;
+        case UHDR_CG_DISPLAY_P3:
+          return status;
+        case UHDR_CG_BT_2100:
+          *coeffs = kYuv601To2100_coeffs_q14;
+          break;
+        default:
+          status.error_code = UHDR_CODEC_INVALID_PARAM;
+          status.has_detail = 1;
+          snprintf(status.detail, sizeof status.detail, "Unrecognized dest color gamut %d",
+                   dst_encoding);
+          return status;
+      }
+      break;
+    case UHDR_CG_BT_2100:
+      switch (dst_encoding) {
+        case UHDR_CG_BT_709:
+          *coeffs = kYuv2100To709_coeffs_q14;
+          break;
+        case UHDR_CG_DISPLAY_P3:
+          *coeffs = kYuv2100To601_coeffs_q14;
+          break;
+        case UHDR_CG_BT_2100:
+          return status;
+        default:
+          status.error_code = UHDR_CODEC_INVALID_PARAM;
+          status.has_detail = 1;
+          snprintf(status.detail, sizeof status.detail, "Unrecognized dest color gamut %d",
+                   dst_encoding);
+          return status;
+      }
+      break;
+    default:
+      status.error_code = UHDR_CODEC_INVALID_PARAM;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail, "Unrecognized src color gamut %d",
+               src_encoding);
+      return status;
+  }
+  return status;
+}
+
+static inline uint8_t clampToUint8(int value) { return static_cast<uint8_t>(CLIP3(value, 0, 255)); }
+
+void transformYuv420RowQ14(uhdr_raw_image_t* image, const int16_t* coeffs, size_t x, size_t y) {
+  uint8_t* y0_ptr = static_cast<uint8_t*>(image->planes[UHDR_PLANE_Y]) +
+                    y * 2 * image->stride[UHDR_PLANE_Y];
+  uint8_t* y1_ptr = y0_ptr + image->stride[UHDR_PLANE_Y];
+  uint8_t* u_ptr = static_cast<uint8_t*>(image->planes[UHDR_PLANE_U]) +
+                   y * image->stride[UHDR_PLANE_U];
+  uint8_t* v_ptr = static_cast<uint8_t*>(image->planes[UHDR_PLANE_V]) +
+                   y * image->stride[UHDR_PLANE_V];
+  for (; x < image->w / 2; ++x) {
+    const int u = u_ptr[x] - 128, v = v_ptr[x] - 128;
+    const int dy = yuvGamutConversionQ14(u, v, coeffs[0], coeffs[1]);
+    y0_ptr[x * 2] = clampToUint8(y0_ptr[x * 2] + dy);
+    y0_ptr[x * 2 + 1] = clampToUint8(y0_ptr[x * 2 + 1] + dy);
+    y1_ptr[x * 2] = clampToUint8(y1_ptr[x * 2] + dy);
+    y1_ptr[x * 2 + 1] = clampToUint8(y1_ptr[x * 2 + 1] + dy);
+    u_ptr[x] = clampToUint8(yuvGamutConversionQ14(u, v, coeffs[2], coeffs[3]) + 128);
+    v_ptr[x] = clampToUint8(yuvGamutConversionQ14(u, v, coeffs[4], coeffs[5]) + 128);
+  }
+}
+
+void transformYuv444RowQ14(uhdr_raw_image_t* image, const int16_t* coeffs, size_t x, size_t y) {
+  uint8_t* y_ptr =
+      static_cast<uint8_t*>(image->planes[UHDR_PLANE_Y]) + y * image->stride[UHDR_PLANE_Y];
+  uint8_t* u_ptr =
+      static_cast<uint8_t*>(image->planes[UHDR_PLANE_U]) + y * image->stride[UHDR_PLANE_U];
+  uint8_t* v_ptr =
+      static_cast<uint8_t*>(image->planes[UHDR_PLANE_V]) + y * image->stride[UHDR_PLANE_V];
+  for (; x < image->w; ++x) {
+    const int u = u_ptr[x] - 128, v = v_ptr[x] - 128;
+    y_ptr[x] = clampToUint8(y_ptr[x] + yuvGamutConversionQ14(u, v, coeffs[0], coeffs[1]));
+    u_ptr[x] = clampToUint8(yuvGamutConversionQ14(u, v, coeffs[2], coeffs[3]) + 128);
+    v_ptr[x] = clampToUint8(yuvGamutConversionQ14(u, v, coeffs[4], coeffs[5]) + 128);
+  }
+}
+
+uhdr_error_info_t convertYuvQ14(uhdr_raw_image_t* image, uhdr_color_gamut_t src_encoding,
+                                uhdr_color_gamut_t dst_encoding,
+                                TransformYuvQ14Fn transform_yuv420,
+                                TransformYuvQ14Fn transform_yuv444) {
+  const int16_t* coeffs = nullptr;
+  UHDR_ERR_CHECK(getYuvConversionCoeffsQ14(src_encoding, dst_encoding, &coeffs));
+  if (coeffs == nullptr) return g_no_error;
+
+  if (image->fmt == UHDR_IMG_FMT_12bppYCbCr420) {
+    transform_yuv420(image, coeffs);
+  } else if (image->fmt == UHDR_IMG_FMT_24bppYCbCr444) {
+    transform_yuv444(image, coeffs);
+  } else {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "No implementation available for performing gamut conversion for color format %d",
+             image->fmt);
+    return status;
+  }
+
+  return g_no_error;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Gain map calculations
 
@@ -1099,6 +1516,543 @@ Color sampleMap3Channel(uhdr_raw_image_t* map, size_t map_scale_factor, size_t x
   return rgb1 * weights[0] + rgb2 * weights[1] + rgb3 * weights[2] + rgb4 * weights[3];
 }
 
+GainMapPlanes::GainMapPlanes(const uhdr_raw_image_t* map) {
+  if (map->fmt == UHDR_IMG_FMT_24bppYCbCr444) {
+    // planar copy of planar_gain_map()
+    for (int c = 0; c < 3; c++) {
+      mPlane[c] = static_cast<const uint8_t*>(map->planes[c]);
+      mStride[c] = map->stride[c];
+    }
+    mStep = 1;
+    mOutChannels = 3;
+    return;
+  }
+  const int channels = map->fmt == UHDR_IMG_FMT_8bppYCbCr400   ? 1
+                       : map->fmt == UHDR_IMG_FMT_32bppRGBA8888 ? 4
+                                                                 : 3;
+  const uint8_t* data = static_cast<const uint8_t*>(map->planes[UHDR_PLANE_PACKED]);
+  for (int c = 0; c < 3; c++) {
+    mPlane[c] = data + (std::min)(c, channels - 1);
+    mStride[c] = (size_t)map->stride[UHDR_PLANE_PACKED] * channels;
+  }
+  mStep = channels;
+  mOutChannels = channels == 1 ? 1 : 3;
+}
+
+std::unique_ptr<uhdr_raw_image_ext_t> planar_gain_map(const uhdr_raw_image_t* map) {
+  if (map->fmt != UHDR_IMG_FMT_24bppRGB888 && map->fmt != UHDR_IMG_FMT_32bppRGBA8888) {
+    return nullptr;
+  }
+  const size_t channels = map->fmt == UHDR_IMG_FMT_32bppRGBA8888 ? 4 : 3;
+  std::unique_ptr<uhdr_raw_image_ext_t> planar = std::make_unique<uhdr_raw_image_ext_t>(
+      UHDR_IMG_FMT_24bppYCbCr444, map->cg, map->ct, map->range, map->w, map->h, 64);
+  for (size_t y = 0; y < map->h; y++) {
+    const uint8_t* src = static_cast<const uint8_t*>(map->planes[UHDR_PLANE_PACKED]) +
+                         y * map->stride[UHDR_PLANE_PACKED] * channels;
+    uint8_t* r = static_cast<uint8_t*>(planar->planes[0]) + y * planar->stride[0];
+    uint8_t* g = static_cast<uint8_t*>(planar->planes[1]) + y * planar->stride[1];
+    uint8_t* b = static_cast<uint8_t*>(planar->planes[2]) + y * planar->stride[2];
+    for (size_t x = 0; x < map->w; x++, src += channels) {
+      r[x] = src[0];
+      g[x] = src[1];
+      b[x] = src[2];
+    }
+  }
+  return planar;
+}
+
+// Every output pixel of a row interpolates between the same two map rows, and the pixels of one map
+// column span share all four neighbours. The neighbours are therefore read and converted once per
+// map column and the weights are walked linearly, with the same arithmetic as sampleMap().
+void sampleMapRow(uhdr_raw_image_t* map, size_t map_scale_factor, size_t x, size_t y,
+                  size_t count, ShepardsIDW& weightTables, float* gains) {
+  const GainMapPlanes planes(map);
+  const int outChannels = planes.mOutChannels;
+  const size_t step = planes.mStep;
+  const size_t y_lower = std::min(y / map_scale_factor, (size_t)map->h - 1);
+  const size_t y_upper = std::min(y / map_scale_factor + 1, (size_t)map->h - 1);
+  const uint8_t* top[3];
+  const uint8_t* bottom[3];
+  for (int c = 0; c < outChannels; c++) {
+    top[c] = planes.row(c, y_lower);
+    bottom[c] = planes.row(c, y_upper);
+  }
+  const size_t weights_row = (y % map_scale_factor) * map_scale_factor * 4;
+
+  const size_t x_end = x + count;
+  while (x < x_end) {
+    const size_t x_lower = std::min(x / map_scale_factor, (size_t)map->w - 1);
+    const size_t x_upper = std::min(x / map_scale_factor + 1, (size_t)map->w - 1);
+    const float* weights = weightTables.mWeights;
+    if (x_lower == x_upper && y_lower == y_upper)
+      weights = weightTables.mWeightsC;
+    else if (x_lower == x_upper)
+      weights = weightTables.mWeightsNR;
+    else if (y_lower == y_upper)
+      weights = weightTables.mWeightsNB;
+    weights += weights_row;
+
+    float e1[3], e2[3], e3[3], e4[3];
+    for (int c = 0; c < outChannels; c++) {
+      e1[c] = mapUintToFloat(top[c][x_lower * step]);
+      e2[c] = mapUintToFloat(bottom[c][x_lower * step]);
+      e3[c] = mapUintToFloat(top[c][x_upper * step]);
+      e4[c] = mapUintToFloat(bottom[c][x_upper * step]);
+    }
+    const size_t span_end = std::min(x_end, (x / map_scale_factor + 1) * map_scale_factor);
+    for (; x < span_end; x++) {
+      const float* w = weights + (x % map_scale_factor) * 4;
+      for (int c = 0; c < outChannels; c++) {
+        *gains++ = e1[c] * w[0] + e2[c] * w[1] + e3[c] * w[2] + e4[c] * w[3];
+      }
+    }
+  }
+}
+
+MapSampleColumns::MapSampleColumns(const uhdr_raw_image_t* map, float mapScaleFactor,
+                                   size_t width)
+    : mMapScaleFactor(mapScaleFactor),
+      mLower(width),
+      mUpper(width),
+      mDistLower(width),
+      mDistUpper(width) {
+  for (size_t x = 0; x < width; x++) {
+    // as in sampleMap()
+    const float x_map = static_cast<float>(x) / mapScaleFactor;
+    const size_t x_lower = std::min(static_cast<size_t>(floor(x_map)), (size_t)map->w - 1);
+    const size_t x_upper = std::min(static_cast<size_t>(floor(x_map)) + 1, (size_t)map->w - 1);
+    mLower[x] = static_cast<uint32_t>(x_lower);
+    mUpper[x] = static_cast<uint32_t>(x_upper);
+    mDistLower[x] = x_map - static_cast<float>(x_lower);
+    mDistUpper[x] = x_map - static_cast<float>(x_upper);
+  }
+}
+
+void sampleMapRow(uhdr_raw_image_t* map, const MapSampleColumns& columns, size_t x, size_t y,
+                  size_t count, float* gains) {
+  const GainMapPlanes planes(map);
+  const int outChannels = planes.mOutChannels;
+  const size_t step = planes.mStep;
+  const float y_map = static_cast<float>(y) / columns.mMapScaleFactor;
+  const size_t y_lower = std::min(static_cast<size_t>(floor(y_map)), (size_t)map->h - 1);
+  const size_t y_upper = std::min(static_cast<size_t>(floor(y_map)) + 1, (size_t)map->h - 1);
+  const float dist_top = y_map - static_cast<float>(y_lower);
+  const float dist_bottom = y_map - static_cast<float>(y_upper);
+  const uint8_t* top[3];
+  const uint8_t* bottom[3];
+  for (int c = 0; c < outChannels; c++) {
+    top[c] = planes.row(c, y_lower);
+    bottom[c] = planes.row(c, y_upper);
+  }
+
+  for (const size_t x_end = x + count; x < x_end; x++) {
+    const size_t lower = columns.mLower[x] * step, upper = columns.mUpper[x] * step;
+    const float dist[4] = {pythDistance(columns.mDistLower[x], dist_top),
+                           pythDistance(columns.mDistLower[x], dist_bottom),
+                           pythDistance(columns.mDistUpper[x], dist_top),
+                           pythDistance(columns.mDistUpper[x], dist_bottom)};
+    // Shepard's method, a pixel on a map sample takes its value
+    int on_sample = -1;
+    for (int i = 0; i < 4 && on_sample < 0; i++) {
+      if (dist[i] == 0.0f) on_sample = i;
+    }
+    if (on_sample >= 0) {
+      const size_t col = on_sample < 2 ? lower : upper;
+      for (int c = 0; c < outChannels; c++) {
+        *gains++ = mapUintToFloat((on_sample % 2 == 0 ? top : bottom)[c][col]);
+      }
+      continue;
+    }
+    const float weight[4] = {1.0f / dist[0], 1.0f / dist[1], 1.0f / dist[2], 1.0f / dist[3]};
+    const float total_weight = weight[0] + weight[1] + weight[2] + weight[3];
+    for (int c = 0; c < outChannels; c++) {
+      *gains++ = mapUintToFloat(top[c][lower]) * (weight[0] / total_weight) +
+                 mapUintToFloat(bottom[c][lower]) * (weight[1] / total_weight) +
+                 mapUintToFloat(top[c][upper]) * (weight[2] / total_weight) +
+                 mapUintToFloat(bottom[c][upper]) * (weight[3] / total_weight);
+    }
+  }
+}
+
+// First pixel whose map coordinate, as computed in sampleMap(), reaches the first sample of each
+// block
+static std::vector<size_t> blockStarts(size_t blocks, float mapScaleFactor) {
+  std::vector<size_t> starts(blocks);
+  for (size_t b = 0; b < blocks; b++) {
+    const float target = static_cast<float>(b * FlatGainMapBlocks::kBlockSize);
+    size_t p = static_cast<size_t>(ceil(target * mapScaleFactor));
+    while (p > 0 && floor(static_cast<float>(p - 1) / mapScaleFactor) >= target) p--;
+    while (floor(static_cast<float>(p) / mapScaleFactor) < target) p++;
+    starts[b] = p;
+  }
+  return starts;
+}
+
+FlatGainMapBlocks::FlatGainMapBlocks(const uhdr_raw_image_t* map, float mapScaleFactor) {
+  const GainMapPlanes planes(map);
+  const size_t step = planes.mStep;
+  mOutChannels = planes.mOutChannels;
+  mBlocksW = (map->w + kBlockSize - 1) / kBlockSize;
+  mBlocksH = (map->h + kBlockSize - 1) / kBlockSize;
+  mValues.resize(mBlocksW * mBlocksH);
+  mFlatBlocks = 0;
+
+  for (size_t by = 0; by < mBlocksH; by++) {
+    const size_t y0 = by * kBlockSize, y1 = std::min(y0 + kBlockSize, (size_t)map->h - 1);
+    for (size_t bx = 0; bx < mBlocksW; bx++) {
+      const size_t x0 = bx * kBlockSize, x1 = std::min(x0 + kBlockSize, (size_t)map->w - 1);
+      uint8_t first[3];
+      for (int c = 0; c < mOutChannels; c++) first[c] = planes.row(c, y0)[x0 * step];
+      bool flat = true;
+      for (int c = 0; c < mOutChannels && flat; c++) {
+        for (size_t y = y0; y <= y1 && flat; y++) {
+          const uint8_t* row = planes.row(c, y);
+          for (size_t x = x0; x <= x1 && flat; x++) flat = row[x * step] == first[c];
+        }
+      }
+      int32_t value = -1;
+      if (flat) {
+        value = 0;
+        for (int c = 0; c < mOutChannels; c++) value |= first[c] << (8 * c);
+        mFlatBlocks++;
+      }
+      mValues[by * mBlocksW + bx] = value;
+    }
+  }
+  mConstant = mValues[0];
+  for (int32_t value : mValues) {
+    if (value != mConstant) mConstant = -1;
+  }
+  mColStart = blockStarts(mBlocksW, mapScaleFactor);
+  mRowStart = blockStarts(mBlocksH, mapScaleFactor);
+}
+
+size_t FlatGainMapBlocks::span(size_t x, size_t y, size_t x_end, int32_t& value) const {
+  // pixels past the map sample its last row and column
+  const size_t bx = std::upper_bound(mColStart.begin(), mColStart.end(), x) - mColStart.begin() - 1;
+  const size_t by = std::upper_bound(mRowStart.begin(), mRowStart.end(), y) - mRowStart.begin() - 1;
+  value = mValues[by * mBlocksW + bx];
+  return bx + 1 < mBlocksW ? std::min(x_end, mColStart[bx + 1]) : x_end;
+}
+
+void FlatGainMapBlocks::fillRow(int32_t value, size_t count, float* gains) const {
+  float gain[3];
+  for (int c = 0; c < mOutChannels; c++) gain[c] = mapUintToFloat((value >> (8 * c)) & 0xff);
+  for (size_t i = 0; i < count; i++) {
+    for (int c = 0; c < mOutChannels; c++) *gains++ = gain[c];
+  }
+}
+
+void FlatGainMapBlocks::fillRowFixed(int32_t value, size_t count, uint32_t* gains) const {
+  // the fixed point weights add up to 256, see sampleMapRowFixed()
+  uint32_t gain[3];
+  for (int c = 0; c < mOutChannels; c++) gain[c] = ((value >> (8 * c)) & 0xff) << 4;
+  for (size_t i = 0; i < count; i++) {
+    for (int c = 0; c < mOutChannels; c++) *gains++ = gain[c];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Fixed point gain map application
+
+uint16_t srgbInvOetfFixed(uint8_t e_gamma) {
+  static const std::array<uint16_t, 256> kSrgbInvOetfFixed = []() {
+    std::array<uint16_t, 256> table;
+    for (size_t idx = 0; idx < table.size(); idx++) {
+      float value = srgbInvOetf(static_cast<float>(idx) / 255.0f);
+      table[idx] = static_cast<uint16_t>(CLIP3(value * kUnorm16Max + 0.5f, 0, kUnorm16Max));
+    }
+    return table;
+  }();
+  return kSrgbInvOetfFixed[e_gamma];
+}
+
+uint8_t srgbOetfFixed(uint16_t e) {
+  static const std::array<uint8_t, kSrgbOetfFixedNumEntries> kSrgbOetfFixed = []() {
+    constexpr int kShift = kFixedPointPrecision - kSrgbOetfFixedPrecision;
+    std::array<uint8_t, kSrgbOetfFixedNumEntries> table;
+    for (size_t idx = 0; idx < table.size(); idx++) {
+      // sample every bucket at its center, so that truncating the input rounds to nearest
+      float value = static_cast<float>((idx << kShift) + (1 << (kShift - 1))) / kUnorm16Max;
+      table[idx] = static_cast<uint8_t>(CLIP3(srgbOetf(value) * 255.0f + 0.5f, 0, 255));
+    }
+    return table;
+  }();
+  return kSrgbOetfFixed[e >> (kFixedPointPrecision - kSrgbOetfFixedPrecision)];
+}
+
+GainLUTFixed::GainLUTFixed(uhdr_gainmap_metadata_ext_t* metadata, float gainmapWeight,
+                           float displayBoost) {
+  const float gammaInv = 1.0f / metadata->gamma;
+  const float log2MinBoost = log2(metadata->min_content_boost);
+  const float log2MaxBoost = log2(metadata->max_content_boost);
+  for (int32_t idx = 0; idx < kGainFixedNumEntries; idx++) {
+    float value = static_cast<float>(idx) / static_cast<float>(kGainFixedNumEntries - 1);
+    if (gammaInv != 1.0f) value = pow(value, gammaInv);
+    float logBoost = log2MinBoost * (1.0f - value) + log2MaxBoost * value;
+    float factor = exp2(logBoost * gainmapWeight) / displayBoost;
+    // keep (kUnorm16Max + offset) * factor within int64 and the result well within int32
+    factor = (std::min)(factor, static_cast<float>(1 << 14));
+    mGainTable[idx] = static_cast<uint32_t>(factor * (1 << kFixedPointPrecision) + 0.5f);
+  }
+  const float offsetSdr = CLIP3(metadata->offset_sdr, -1.0f, 1.0f);
+  const float offsetHdr = CLIP3(metadata->offset_hdr / displayBoost, -1.0f, 1.0f);
+  mOffsetSdr = static_cast<int32_t>(std::round(offsetSdr * kUnorm16Max));
+  mOffsetHdr = static_cast<int32_t>(std::round(offsetHdr * kUnorm16Max));
+}
+
+GainMapOutputLUT::GainMapOutputLUT(uhdr_gainmap_metadata_ext_t* metadata, float gainmapWeight,
+                                   uhdr_color_transfer_t outputCt) {
+  GainLUT gainLUT(metadata, gainmapWeight);
+  mTable.resize((size_t)kGainNodes * kSdrNodes);
+  float* node = mTable.data();
+  for (int g = 0; g < kGainNodes; g++) {
+    const float gain = static_cast<float>(g) / (kGainNodes - 1);
+    for (int e = 0; e < kSdrNodes; e++) {
+      const float sdr = srgbInvOetf(static_cast<float>(e) / (kSdrNodes - 1));
+      Color hdr = applyGainLUT({{{sdr, sdr, sdr}}}, gain, gainLUT, metadata);
+      if (outputCt == UHDR_CT_HLG) {
+        hdr.r = (std::max)(hdr.r, 0.0f);
+        hdr = hlgOetf(hlgInverseOotfApprox(hdr * kSdrWhiteNits / kHlgMaxNits));
+      } else if (outputCt == UHDR_CT_PQ) {
+        hdr = pqOetf(hdr * kSdrWhiteNits / kPqMaxNits);
+      }
+      *node++ = hdr.r;
+    }
+  }
+}
+
+static void toFixedWeights(const float* weights, uint16_t* fixedWeights, int count) {
+  for (int i = 0; i < count; i += 4) {
+    int sum = 0, largest = i;
+    for (int j = i; j < i + 4; j++) {
+      fixedWeights[j] = static_cast<uint16_t>(weights[j] * 256.0f + 0.5f);
+      sum += fixedWeights[j];
+      if (weights[j] > weights[largest]) largest = j;
+    }
+    // absorb the rounding error in the dominant weight
+    fixedWeights[largest] = static_cast<uint16_t>(fixedWeights[largest] + 256 - sum);
+  }
+}
+
+ShepardsIDWFixed::ShepardsIDWFixed(const ShepardsIDW& weightTables)
+    : mMapScaleFactor{weightTables.mMapScaleFactor} {
+  const int size = mMapScaleFactor * mMapScaleFactor * 4;
+  mWeights.resize(size);
+  mWeightsNR.resize(size);
+  mWeightsNB.resize(size);
+  mWeightsC.resize(size);
+  toFixedWeights(weightTables.mWeights, mWeights.data(), size);
+  toFixedWeights(weightTables.mWeightsNR, mWeightsNR.data(), size);
+  toFixedWeights(weightTables.mWeightsNB, mWeightsNB.data(), size);
+  toFixedWeights(weightTables.mWeightsC, mWeightsC.data(), size);
+}
+
+void sampleMapFixed(uhdr_raw_image_t* map, size_t map_scale_factor, size_t x, size_t y,
+                    const ShepardsIDWFixed& weightTables, uint32_t gain[3]) {
+  size_t x_lower = x / map_scale_factor;
+  size_t x_upper = x_lower + 1;
+  size_t y_lower = y / map_scale_factor;
+  size_t y_upper = y_lower + 1;
+
+  x_lower = std::min(x_lower, (size_t)map->w - 1);
+  x_upper = std::min(x_upper, (size_t)map->w - 1);
+  y_lower = std::min(y_lower, (size_t)map->h - 1);
+  y_upper = std::min(y_upper, (size_t)map->h - 1);
+
+  const uint16_t* weights = weightTables.mWeights.data();
+  if (x_lower == x_upper && y_lower == y_upper)
+    weights = weightTables.mWeightsC.data();
+  else if (x_lower == x_upper)
+    weights = weightTables.mWeightsNR.data();
+  else if (y_lower == y_upper)
+    weights = weightTables.mWeightsNB.data();
+  weights += (y % map_scale_factor) * map_scale_factor * 4 + (x % map_scale_factor) * 4;
+
+  const GainMapPlanes planes(map);
+  const size_t step = planes.mStep;
+
+  // weights sum to 256, rescale the interpolated code to kGainFixedSubSteps steps per code
+  constexpr int kShift = 4;
+  static_assert(kGainFixedSubSteps << kShift == 256, "kShift has to track kGainFixedSubSteps");
+  for (int c = 0; c < planes.mOutChannels; c++) {
+    const uint8_t* top = planes.row(c, y_lower);
+    const uint8_t* bottom = planes.row(c, y_upper);
+    uint32_t sum = top[x_lower * step] * weights[0] + bottom[x_lower * step] * weights[1] +
+                   top[x_upper * step] * weights[2] + bottom[x_upper * step] * weights[3];
+    gain[c] = (sum + (1 << (kShift - 1))) >> kShift;
+  }
+}
+
+void sampleMapRowFixed(uhdr_raw_image_t* map, size_t map_scale_factor, size_t x, size_t y,
+                       size_t count, const ShepardsIDWFixed& weightTables, uint32_t* gains) {
+  const GainMapPlanes planes(map);
+  const int outChannels = planes.mOutChannels;
+  const size_t step = planes.mStep;
+  const size_t y_lower = std::min(y / map_scale_factor, (size_t)map->h - 1);
+  const size_t y_upper = std::min(y / map_scale_factor + 1, (size_t)map->h - 1);
+  const uint8_t* top[3];
+  const uint8_t* bottom[3];
+  for (int c = 0; c < outChannels; c++) {
+    top[c] = planes.row(c, y_lower);
+    bottom[c] = planes.row(c, y_upper);
+  }
+  const size_t weights_row = (y % map_scale_factor) * map_scale_factor * 4;
+
+  // see sampleMapFixed()
+  constexpr int kShift = 4;
+  const size_t x_end = x + count;
+  while (x < x_end) {
+    const size_t x_lower = std::min(x / map_scale_factor, (size_t)map->w - 1);
+    const size_t x_upper = std::min(x / map_scale_factor + 1, (size_t)map->w - 1);
+    const uint16_t* weights = weightTables.mWeights.data();
+    if (x_lower == x_upper && y_lower == y_upper)
+      weights = weightTables.mWeightsC.data();
+    else if (x_lower == x_upper)
+      weights = weightTables.mWeightsNR.data();
+    else if (y_lower == y_upper)
+      weights = weightTables.mWeightsNB.data();
+    weights += weights_row;
+
+    uint32_t e1[3], e2[3], e3[3], e4[3];
+    for (int c = 0; c < outChannels; c++) {
+      e1[c] = top[c][x_lower * step];
+      e2[c] = bottom[c][x_lower * step];
+      e3[c] = top[c][x_upper * step];
+      e4[c] = bottom[c][x_upper * step];
+    }
+    const size_t span_end = std::min(x_end, (x / map_scale_factor + 1) * map_scale_factor);
+    for (; x < span_end; x++) {
+      const uint16_t* w = weights + (x % map_scale_factor) * 4;
+      for (int c = 0; c < outChannels; c++) {
+        uint32_t sum = e1[c] * w[0] + e2[c] * w[1] + e3[c] * w[2] + e4[c] * w[3];
+        *gains++ = (sum + (1 << (kShift - 1))) >> kShift;
+      }
+    }
+  }
+}
+
+uint16_t applyGainFixed(uint16_t e, uint32_t gain, const GainLUTFixed& gainLUT) {
+  int64_t value = static_cast<int64_t>(e + gainLUT.getOffsetSdr()) * gainLUT.getGainFactor(gain);
+  value = ((value + (1 << (kFixedPointPrecision - 1))) >> kFixedPointPrecision) -
+          gainLUT.getOffsetHdr();
+  return static_cast<uint16_t>(CLIP3(value, 0, kUnorm16Max));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Gain map table cache
+
+GainMapTableCache& GainMapTableCache::getDefaultCache() {
+  static GainMapTableCache cache;
+  return cache;
+}
+
+template <typename T, typename CreateFn>
+std::shared_ptr<T> GainMapTableCache::lookup(Entries<T>& entries, const Key& key,
+                                             CreateFn create) {
+  std::lock_guard<std::mutex> lock{mMutex};
+  for (auto it = entries.begin(); it != entries.end(); ++it) {
+    if (memcmp(it->first.data(), key.data(), sizeof(Key)) == 0) {
+      entries.splice(entries.begin(), entries, it);  // most recently used first
+      return it->second;
+    }
+  }
+  std::shared_ptr<T> table = create();
+  entries.emplace_front(key, table);
+  if (entries.size() > kMaxEntries) entries.pop_back();
+  return table;
+}
+
+std::shared_ptr<ShepardsIDW> GainMapTableCache::getIdwTable(int mapScaleFactor) {
+  const Key key{static_cast<float>(mapScaleFactor)};
+  return lookup(mIdwTables, key,
+                [mapScaleFactor]() { return std::make_shared<ShepardsIDW>(mapScaleFactor); });
+}
+
+std::shared_ptr<ShepardsIDWFixed> GainMapTableCache::getIdwTableFixed(int mapScaleFactor) {
+  // the fixed point table is derived from the float one, which is fetched before taking the lock
+  std::shared_ptr<ShepardsIDW> idwTable = getIdwTable(mapScaleFactor);
+  const Key key{static_cast<float>(mapScaleFactor)};
+  return lookup(mIdwTablesFixed, key,
+                [&idwTable]() { return std::make_shared<ShepardsIDWFixed>(*idwTable); });
+}
+
+std::shared_ptr<GainLUT> GainMapTableCache::getGainLUT(uhdr_gainmap_metadata_ext_t* metadata,
+                                                       float gainmapWeight) {
+  const Key key{metadata->min_content_boost, metadata->max_content_boost, metadata->gamma,
+                gainmapWeight};
+  return lookup(mGainLUTs, key, [metadata, gainmapWeight]() {
+    return std::make_shared<GainLUT>(metadata, gainmapWeight);
+  });
+}
+
+std::shared_ptr<GainLUTFixed> GainMapTableCache::getGainLUTFixed(
+    uhdr_gainmap_metadata_ext_t* metadata, float gainmapWeight, float displayBoost) {
+  const Key key{metadata->min_content_boost,
+                metadata->max_content_boost,
+                metadata->gamma,
+                gainmapWeight,
+                metadata->offset_sdr,
+                metadata->offset_hdr,
+                displayBoost};
+  return lookup(mGainLUTsFixed, key, [metadata, gainmapWeight, displayBoost]() {
+    return std::make_shared<GainLUTFixed>(metadata, gainmapWeight, displayBoost);
+  });
+}
+
+std::shared_ptr<GainMapOutputLUT> GainMapTableCache::getGainMapOutputLUT(
+    uhdr_gainmap_metadata_ext_t* metadata, float gainmapWeight, uhdr_color_transfer_t outputCt) {
+  const Key key{metadata->min_content_boost,
+                metadata->max_content_boost,
+                metadata->gamma,
+                gainmapWeight,
+                metadata->offset_sdr,
+                metadata->offset_hdr,
+                static_cast<float>(outputCt)};
+  return lookup(mGainMapOutputLUTs, key, [metadata, gainmapWeight, outputCt]() {
+    return std::make_shared<GainMapOutputLUT>(metadata, gainmapWeight, outputCt);
+  });
+}
+
+void GainMapTableCache::clear() {
+  std::lock_guard<std::mutex> lock{mMutex};
+  mIdwTables.clear();
+  mIdwTablesFixed.clear();
+  mGainLUTs.clear();
+  mGainLUTsFixed.clear();
+  mGainMapOutputLUTs.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Color blocks
+
+// The Color functions are defined above in this file, so they are inlined into the block loops.
+template <ColorTransformFn fn>
+static void transformBlock(ColorBlock& e, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    Color c = fn({{{e.r[i], e.g[i], e.b[i]}}});
+    e.r[i] = c.r;
+    e.g[i] = c.g;
+    e.b[i] = c.b;
+  }
+}
+
+template <LuminanceFn fn>
+static void luminanceBlock(const ColorBlock& e, size_t n, float* y) {
+  for (size_t i = 0; i < n; i++) y[i] = fn({{{e.r[i], e.g[i], e.b[i]}}});
+}
+
+static void identityBlock(ColorBlock&, size_t) {}
+
+// the approximation does not use the luminance function
+static Color hlgOotfApproxBlockOp(Color e) { return hlgOotfApprox(e, nullptr); }
+
+void clipNegatives(ColorBlock& e, size_t n) {
+  for (size_t i = 0; i < n; i++) e.r[i] = clipNegatives(e.r[i]);
+  for (size_t i = 0; i < n; i++) e.g[i] = clipNegatives(e.g[i]);
+  for (size_t i = 0; i < n; i++) e.b[i] = clipNegatives(e.b[i]);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // function selectors
 
@@ -1288,6 +2242,299 @@ SamplePixelFn getSamplePixelFn(uhdr_img_fmt_t format) {
   return nullptr;
 }
 
+GetRowFn getRowFn(uhdr_img_fmt_t format) {
+  switch (format) {
+    case UHDR_IMG_FMT_24bppYCbCr444:
+      return getPixelRow<getYuv444Pixel>;
+    case UHDR_IMG_FMT_16bppYCbCr422:
+      return getPixelRow<getYuv422Pixel>;
+    case UHDR_IMG_FMT_12bppYCbCr420:
+      return getPixelRow<getYuv420Pixel>;
+    case UHDR_IMG_FMT_24bppYCbCrP010:
+      return getPixelRow<getP010Pixel>;
+    case UHDR_IMG_FMT_30bppYCbCr444:
+      return getPixelRow<getYuv444Pixel10bit>;
+    case UHDR_IMG_FMT_32bppRGBA8888:
+      return getPixelRow<getRgba8888Pixel>;
+    case UHDR_IMG_FMT_32bppRGBA1010102:
+      return getPixelRow<getRgba1010102Pixel>;
+    case UHDR_IMG_FMT_64bppRGBAHalfFloat:
+      return getRgbaF16Row;
+    case UHDR_IMG_FMT_8bppYCbCr400:
+      return getPixelRow<getYuv400Pixel>;
+    case UHDR_IMG_FMT_24bppRGB888:
+      return getPixelRow<getRgb888Pixel>;
+    default:
+      return nullptr;
+  }
+  return nullptr;
+}
+
+PutRowFn putRowFn(uhdr_img_fmt_t format) {
+  switch (format) {
+    case UHDR_IMG_FMT_24bppYCbCr444:
+      return putPixelRow<putYuv444Pixel>;
+    case UHDR_IMG_FMT_32bppRGBA8888:
+      return putPixelRow<putRgba8888Pixel>;
+    case UHDR_IMG_FMT_8bppYCbCr400:
+      return putPixelRow<putYuv400Pixel>;
+    case UHDR_IMG_FMT_24bppRGB888:
+      return putPixelRow<putRgb888Pixel>;
+    default:
+      return nullptr;
+  }
+  return nullptr;
+}
+
+SampleRowFn getSampleRowFn(uhdr_img_fmt_t format) {
+  switch (format) {
+    case UHDR_IMG_FMT_24bppYCbCr444:
+      return samplePixelRow<getYuv444Pixel>;
+    case UHDR_IMG_FMT_16bppYCbCr422:
+      return samplePixelRow<getYuv422Pixel>;
+    case UHDR_IMG_FMT_12bppYCbCr420:
+      return sampleYuv420Row;
+    case UHDR_IMG_FMT_24bppYCbCrP010:
+      return sampleP010Row;
+    case UHDR_IMG_FMT_30bppYCbCr444:
+      return samplePixelRow<getYuv444Pixel10bit>;
+    case UHDR_IMG_FMT_32bppRGBA8888:
+      return samplePixelRow<getRgba8888Pixel>;
+    case UHDR_IMG_FMT_32bppRGBA1010102:
+      return samplePixelRow<getRgba1010102Pixel>;
+    case UHDR_IMG_FMT_64bppRGBAHalfFloat:
+      return sampleRgbaF16Row;
+    default:
+      return nullptr;
+  }
+  return nullptr;
+}
+
+ColorBlockTransformFn getGamutConversionBlockFn(uhdr_color_gamut_t dst_gamut,
+                                                uhdr_color_gamut_t src_gamut) {
+  switch (dst_gamut) {
+    case UHDR_CG_BT_709:
+      switch (src_gamut) {
+        case UHDR_CG_BT_709:
+          return identityBlock;
+        case UHDR_CG_DISPLAY_P3:
+          return transformBlock<p3ToBt709>;
+        case UHDR_CG_BT_2100:
+          return transformBlock<bt2100ToBt709>;
+        case UHDR_CG_UNSPECIFIED:
+          return nullptr;
+      }
+      break;
+    case UHDR_CG_DISPLAY_P3:
+      switch (src_gamut) {
+        case UHDR_CG_BT_709:
+          return transformBlock<bt709ToP3>;
+        case UHDR_CG_DISPLAY_P3:
+          return identityBlock;
+        case UHDR_CG_BT_2100:
+          return transformBlock<bt2100ToP3>;
+        case UHDR_CG_UNSPECIFIED:
+          return nullptr;
+      }
+      break;
+    case UHDR_CG_BT_2100:
+      switch (src_gamut) {
+        case UHDR_CG_BT_709:
+          return transformBlock<bt709ToBt2100>;
+        case UHDR_CG_DISPLAY_P3:
+          return transformBlock<p3ToBt2100>;
+        case UHDR_CG_BT_2100:
+          return identityBlock;
+        case UHDR_CG_UNSPECIFIED:
+          return nullptr;
+      }
+      break;
+    case UHDR_CG_UNSPECIFIED:
+      return nullptr;
+  }
+  return nullptr;
+}
+
+ColorBlockTransformFn getYuvToRgbBlockFn(uhdr_color_gamut_t gamut) {
+  switch (gamut) {
+    case UHDR_CG_BT_709:
+      return transformBlock<srgbYuvToRgb>;
+    case UHDR_CG_DISPLAY_P3:
+      return transformBlock<p3YuvToRgb>;
+    case UHDR_CG_BT_2100:
+      return transformBlock<bt2100YuvToRgb>;
+    case UHDR_CG_UNSPECIFIED:
+      return nullptr;
+  }
+  return nullptr;
+}
+
+LuminanceBlockFn getLuminanceBlockFn(uhdr_color_gamut_t gamut) {
+  switch (gamut) {
+    case UHDR_CG_BT_709:
+      return luminanceBlock<srgbLuminance>;
+    case UHDR_CG_DISPLAY_P3:
+      return luminanceBlock<p3Luminance>;
+    case UHDR_CG_BT_2100:
+      return luminanceBlock<bt2100Luminance>;
+    case UHDR_CG_UNSPECIFIED:
+      return nullptr;
+  }
+  return nullptr;
+}
+
+ColorBlockTransformFn getInverseOetfBlockFn(uhdr_color_transfer_t transfer) {
+  switch (transfer) {
+    case UHDR_CT_LINEAR:
+      return identityBlock;
+    case UHDR_CT_HLG:
+#if USE_HLG_INVOETF_LUT
+      return transformBlock<hlgInvOetfLUT>;
+#else
+      return transformBlock<hlgInvOetf>;
+#endif
+    case UHDR_CT_PQ:
+#if USE_PQ_INVOETF_LUT
+      return transformBlock<pqInvOetfLUT>;
+#else
+      return transformBlock<pqInvOetf>;
+#endif
+    case UHDR_CT_SRGB:
+#if USE_SRGB_INVOETF_LUT
+      return transformBlock<srgbInvOetfLUT>;
+#else
+      return transformBlock<srgbInvOetf>;
+#endif
+    case UHDR_CT_UNSPECIFIED:
+      return nullptr;
+  }
+  return nullptr;
+}
+
+ColorBlockTransformFn getOetfBlockFn(uhdr_color_transfer_t transfer) {
+  switch (transfer) {
+    case UHDR_CT_LINEAR:
+      return identityBlock;
+    case UHDR_CT_HLG:
+#if USE_HLG_OETF_LUT
+      return transformBlock<hlgOetfLUT>;
+#else
+      return transformBlock<hlgOetf>;
+#endif
+    case UHDR_CT_PQ:
+#if USE_PQ_OETF_LUT
+      return transformBlock<pqOetfLUT>;
+#else
+      return transformBlock<pqOetf>;
+#endif
+    case UHDR_CT_SRGB:
+      return transformBlock<srgbOetf>;
+    case UHDR_CT_UNSPECIFIED:
+      return nullptr;
+  }
+  return nullptr;
+}
+
+ColorBlockTransformFn getOotfBlockFn(uhdr_color_transfer_t transfer) {
+  switch (transfer) {
+    case UHDR_CT_LINEAR:
+      return identityBlock;
+    case UHDR_CT_HLG:
+      return transformBlock<hlgOotfApproxBlockOp>;
+    case UHDR_CT_PQ:
+      return identityBlock;
+    case UHDR_CT_SRGB:
+      return identityBlock;
+    case UHDR_CT_UNSPECIFIED:
+      return nullptr;
+  }
+  return nullptr;
+}
+
+void getYuvToRgbCoeffs(uhdr_color_gamut_t gamut, float coeffs[4]) {
+  switch (gamut) {
+    case UHDR_CG_BT_709:
+      coeffs[0] = kSrgbCr, coeffs[1] = kSrgbGCb, coeffs[2] = kSrgbGCr, coeffs[3] = kSrgbCb;
+      break;
+    case UHDR_CG_DISPLAY_P3:
+      coeffs[0] = kP3Cr, coeffs[1] = kP3GCb, coeffs[2] = kP3GCr, coeffs[3] = kP3Cb;
+      break;
+    default:
+      coeffs[0] = kBt2100Cr, coeffs[1] = kBt2100GCb, coeffs[2] = kBt2100GCr, coeffs[3] = kBt2100Cb;
+      break;
+  }
+}
+
+// inverse oetf table and ootf of the transfers handled by the vector kernels
+static bool getHdrLinearizeParams(uhdr_color_transfer_t transfer, const float** lut,
+                                  int* entries, float* ootf_gamma) {
+  if (transfer == UHDR_CT_HLG) {
+    *lut = getHlgInvOetfLUT();
+    *entries = kHlgInvOETFNumEntries;
+    *ootf_gamma = kOotfGamma;
+  } else if (transfer == UHDR_CT_PQ) {
+    *lut = getPqInvOetfLUT();
+    *entries = kPqInvOETFNumEntries;
+    *ootf_gamma = 1.0f;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// the conversions are linear, the matrix columns are the images of the unit vectors
+void getGamutConversionMatrix(ColorTransformFn fn, std::array<float, 9>& matrix) {
+  for (int i = 0; i < 3; i++) {
+    Color unit = {{{i == 0 ? 1.0f : 0.0f, i == 1 ? 1.0f : 0.0f, i == 2 ? 1.0f : 0.0f}}};
+    Color col = fn(unit);
+    matrix[i] = col.r;
+    matrix[3 + i] = col.g;
+    matrix[6 + i] = col.b;
+  }
+}
+
+bool getGainMapRowParams(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* hdr_intent,
+                         bool sdr_is_601, bool use_luminance, bool multichannel,
+                         float hdr_sample_to_nits, GainMapRowParams* params) {
+  if (sdr_intent->fmt != UHDR_IMG_FMT_12bppYCbCr420 ||
+      hdr_intent->fmt != UHDR_IMG_FMT_24bppYCbCrP010)
+    return false;
+  if (!getHdrLinearizeParams(hdr_intent->ct, &params->hdr_inv_oetf_lut,
+                             &params->hdr_inv_oetf_entries, &params->hdr_ootf_gamma))
+    return false;
+  ColorTransformFn gamutConversionFn = getGamutConversionFn(sdr_intent->cg, hdr_intent->cg);
+  LuminanceFn luminanceFn = getLuminanceFn(sdr_intent->cg);
+  if (gamutConversionFn == nullptr || luminanceFn == nullptr ||
+      getYuvToRgbFn(hdr_intent->cg) == nullptr)
+    return false;
+
+  getYuvToRgbCoeffs(sdr_is_601 ? UHDR_CG_DISPLAY_P3 : sdr_intent->cg, params->sdr_yuv_to_rgb);
+  getYuvToRgbCoeffs(hdr_intent->cg, params->hdr_yuv_to_rgb);
+  getGamutConversionMatrix(gamutConversionFn, params->hdr_gamut_matrix);
+  for (int i = 0; i < 3; i++) {
+    Color unit = {{{i == 0 ? 1.0f : 0.0f, i == 1 ? 1.0f : 0.0f, i == 2 ? 1.0f : 0.0f}}};
+    params->luminance[i] = luminanceFn(unit);
+  }
+  params->use_luminance = use_luminance;
+  params->multichannel = multichannel;
+  params->hdr_sample_to_nits = hdr_sample_to_nits;
+  return true;
+}
+
+bool getToneMapRowParams(uhdr_raw_image_t* hdr_intent, ToneMapRowParams* params) {
+  if (hdr_intent->fmt != UHDR_IMG_FMT_24bppYCbCrP010) return false;
+  if (!getHdrLinearizeParams(hdr_intent->ct, &params->hdr_inv_oetf_lut,
+                             &params->hdr_inv_oetf_entries, &params->hdr_ootf_gamma))
+    return false;
+  ColorTransformFn gamutConversionFn = getGamutConversionFn(UHDR_CG_DISPLAY_P3, hdr_intent->cg);
+  if (gamutConversionFn == nullptr || getYuvToRgbFn(hdr_intent->cg) == nullptr) return false;
+
+  getYuvToRgbCoeffs(hdr_intent->cg, params->hdr_yuv_to_rgb);
+  getGamutConversionMatrix(gamutConversionFn, params->hdr_gamut_matrix);
+  params->headroom = getReferenceDisplayPeakLuminanceInNits(hdr_intent->ct) / kSdrWhiteNits;
+  return true;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // common utils
 
@@ -1308,9 +2555,37 @@ uint64_t colorToRgbaF16(Color e_gamma) {
          (((uint64_t)floatToHalf(e_gamma.b)) << 32) | (((uint64_t)floatToHalf(1.0f)) << 48);
 }
 
+std::unique_ptr<uhdr_raw_image_ext_t> alloc_ycbcr_for_raw_input(uhdr_raw_image_t* src,
+                                                                bool chroma_sampling_enabled) {
+  uhdr_img_fmt_t fmt;
+  if (src->fmt == UHDR_IMG_FMT_32bppRGBA1010102) {
+    fmt = chroma_sampling_enabled ? UHDR_IMG_FMT_24bppYCbCrP010 : UHDR_IMG_FMT_30bppYCbCr444;
+  } else if (src->fmt == UHDR_IMG_FMT_32bppRGBA8888) {
+    fmt = chroma_sampling_enabled ? UHDR_IMG_FMT_12bppYCbCr420 : UHDR_IMG_FMT_24bppYCbCr444;
+  } else if (src->fmt == UHDR_IMG_FMT_12bppYCbCr420 || src->fmt == UHDR_IMG_FMT_24bppYCbCrP010) {
+    return std::make_unique<uhdr_raw_image_ext_t>(src->fmt, src->cg, src->ct, src->range, src->w,
+                                                  src->h, 64);
+  } else {
+    return nullptr;
+  }
+  if (src->cg != UHDR_CG_BT_709 && src->cg != UHDR_CG_BT_2100 && src->cg != UHDR_CG_DISPLAY_P3) {
+    return nullptr;
+  }
+  return std::make_unique<uhdr_raw_image_ext_t>(fmt, src->cg, src->ct, UHDR_CR_FULL_RANGE, src->w,
+                                                src->h, 64);
+}
+
 std::unique_ptr<uhdr_raw_image_ext_t> convert_raw_input_to_ycbcr(uhdr_raw_image_t* src,
                                                                  bool chroma_sampling_enabled) {
-  std::unique_ptr<uhdr_raw_image_ext_t> dst = nullptr;
+  std::unique_ptr<uhdr_raw_image_ext_t> dst =
+      alloc_ycbcr_for_raw_input(src, chroma_sampling_enabled);
+  if (dst == nullptr) return nullptr;
+  auto status = convert_raw_input_to_ycbcr(src, dst.get());
+  if (status.error_code != UHDR_CODEC_OK) return nullptr;
+  return dst;
+}
+
+uhdr_error_info_t convert_raw_input_to_ycbcr(uhdr_raw_image_t* src, uhdr_raw_image_t* dst) {
   Color (*rgbToyuv)(Color) = nullptr;
 
   if (src->fmt == UHDR_IMG_FMT_32bppRGBA1010102 || src->fmt == UHDR_IMG_FMT_32bppRGBA8888) {
@@ -1321,14 +2596,16 @@ std::unique_ptr<uhdr_raw_image_ext_t> convert_raw_input_to_ycbcr(uhdr_raw_image_
     } else if (src->cg == UHDR_CG_DISPLAY_P3) {
       rgbToyuv = p3RgbToYuv;
     } else {
-      return dst;
+      uhdr_error_info_t status;
+      status.error_code = UHDR_CODEC_INVALID_PARAM;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "unsupported color gamut %d in convert_raw_input_to_ycbcr", src->cg);
+      return status;
     }
   }
 
-  if (src->fmt == UHDR_IMG_FMT_32bppRGBA1010102 && chroma_sampling_enabled) {
-    dst = std::make_unique<uhdr_raw_image_ext_t>(UHDR_IMG_FMT_24bppYCbCrP010, src->cg, src->ct,
-                                                 UHDR_CR_FULL_RANGE, src->w, src->h, 64);
-
+  if (src->fmt == UHDR_IMG_FMT_32bppRGBA1010102 && dst->fmt == UHDR_IMG_FMT_24bppYCbCrP010) {
     uint32_t* rgbData = static_cast<uint32_t*>(src->planes[UHDR_PLANE_PACKED]);
     unsigned int srcStride = src->stride[UHDR_PLANE_PACKED];
 
@@ -1383,10 +2660,8 @@ std::unique_ptr<uhdr_raw_image_ext_t> convert_raw_input_to_ycbcr(uhdr_raw_image_
         vData[dst->stride[UHDR_PLANE_UV] * (i / 2) + j] = uint16_t(pixel[0].v) << 6;
       }
     }
-  } else if (src->fmt == UHDR_IMG_FMT_32bppRGBA1010102) {
-    dst = std::make_unique<uhdr_raw_image_ext_t>(UHDR_IMG_FMT_30bppYCbCr444, src->cg, src->ct,
-                                                 UHDR_CR_FULL_RANGE, src->w, src->h, 64);
-
+  } else if (src->fmt == UHDR_IMG_FMT_32bppRGBA1010102 &&
+             dst->fmt == UHDR_IMG_FMT_30bppYCbCr444) {
     uint32_t* rgbData = static_cast<uint32_t*>(src->planes[UHDR_PLANE_PACKED]);
     unsigned int srcStride = src->stride[UHDR_PLANE_PACKED];
 
@@ -1421,9 +2696,7 @@ std::unique_ptr<uhdr_raw_image_ext_t> convert_raw_input_to_ycbcr(uhdr_raw_image_
         vData[dst->stride[UHDR_PLANE_V] * i + j] = uint16_t(pixel.v);
       }
     }
-  } else if (src->fmt == UHDR_IMG_FMT_32bppRGBA8888 && chroma_sampling_enabled) {
-    dst = std::make_unique<uhdr_raw_image_ext_t>(UHDR_IMG_FMT_12bppYCbCr420, src->cg, src->ct,
-                                                 UHDR_CR_FULL_RANGE, src->w, src->h, 64);
+  } else if (src->fmt == UHDR_IMG_FMT_32bppRGBA8888 && dst->fmt == UHDR_IMG_FMT_12bppYCbCr420) {
     uint32_t* rgbData = static_cast<uint32_t*>(src->planes[UHDR_PLANE_PACKED]);
     unsigned int srcStride = src->stride[UHDR_PLANE_PACKED];
 
@@ -1476,9 +2749,7 @@ std::unique_ptr<uhdr_raw_image_ext_t> convert_raw_input_to_ycbcr(uhdr_raw_image_
         vData[dst->stride[UHDR_PLANE_V] * (i / 2) + (j / 2)] = uint8_t(pixel[0].v);
       }
     }
-  } else if (src->fmt == UHDR_IMG_FMT_32bppRGBA8888) {
-    dst = std::make_unique<uhdr_raw_image_ext_t>(UHDR_IMG_FMT_24bppYCbCr444, src->cg, src->ct,
-                                                 UHDR_CR_FULL_RANGE, src->w, src->h, 64);
+  } else if (src->fmt == UHDR_IMG_FMT_32bppRGBA8888 && dst->fmt == UHDR_IMG_FMT_24bppYCbCr444) {
     uint32_t* rgbData = static_cast<uint32_t*>(src->planes[UHDR_PLANE_PACKED]);
     unsigned int srcStride = src->stride[UHDR_PLANE_PACKED];
 
@@ -1512,12 +2783,17 @@ std::unique_ptr<uhdr_raw_image_ext_t> convert_raw_input_to_ycbcr(uhdr_raw_image_
       }
     }
   } else if (src->fmt == UHDR_IMG_FMT_12bppYCbCr420 || src->fmt == UHDR_IMG_FMT_24bppYCbCrP010) {
-    dst = std::make_unique<ultrahdr::uhdr_raw_image_ext_t>(src->fmt, src->cg, src->ct, src->range,
-                                                           src->w, src->h, 64);
-    auto status = copy_raw_image(src, dst.get());
-    if (status.error_code != UHDR_CODEC_OK) return nullptr;
+    return copy_raw_image(src, dst);
+  } else {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "unsupported conversion in convert_raw_input_to_ycbcr, src fmt %d, dst fmt %d",
+             src->fmt, dst->fmt);
+    return status;
   }
-  return dst;
+  return g_no_error;
 }
 
 std::unique_ptr<uhdr_raw_image_ext_t> copy_raw_image(uhdr_raw_image_t* src) {
@@ -1588,6 +2864,17 @@ uhdr_error_info_t copy_raw_image(uhdr_raw_image_t* src, uhdr_raw_image_t* dst) {
         v_src += src->stride[UHDR_PLANE_V];
       }
       return g_no_error;
+    } else if (src->fmt == UHDR_IMG_FMT_24bppYCbCr444) {
+      for (int p = UHDR_PLANE_Y; p <= UHDR_PLANE_V; p++) {
+        uint8_t* plane_dst = static_cast<uint8_t*>(dst->planes[p]);
+        uint8_t* plane_src = static_cast<uint8_t*>(src->planes[p]);
+        for (size_t i = 0; i < src->h; i++) {
+          memcpy(plane_dst, plane_src, src->w);
+          plane_dst += dst->stride[p];
+          plane_src += src->stride[p];
+        }
+      }
+      return g_no_error;
     } else if (src->fmt == UHDR_IMG_FMT_8bppYCbCr400 || src->fmt == UHDR_IMG_FMT_32bppRGBA8888 ||
                src->fmt == UHDR_IMG_FMT_64bppRGBAHalfFloat ||
                src->fmt == UHDR_IMG_FMT_32bppRGBA1010102 || src->fmt == UHDR_IMG_FMT_24bppRGB888) {
@@ -22,84 +22,52 @@
 
 namespace ultrahdr {
 
-void streamWriteU8(std::vector<uint8_t> &data, uint8_t value) { data.push_back(value); }
-
-void streamWriteU16(std::vector<uint8_t> &data, uint16_t value) {
-  data.push_back((value >> 8) & 0xff);
-  data.push_back(value & 0xff);
+// Big endian field writers and readers over raw buffers. Callers size the buffer for all fields
+// of the packet up front, so the accessors carry no bounds checks.
+static inline void streamWriteU8(uint8_t *&data, uint8_t value) { *data++ = value; }
+
+static inline void streamWriteU16(uint8_t *&data, uint16_t value) {
+  data[0] = (value >> 8) & 0xff;
+  data[1] = value & 0xff;
+  data += 2;
 }
 
-void streamWriteU32(std::vector<uint8_t> &data, uint32_t value) {
-  data.push_back((value >> 24) & 0xff);
-  data.push_back((value >> 16) & 0xff);
-  data.push_back((value >> 8) & 0xff);
-  data.push_back(value & 0xff);
+static inline void streamWriteU32(uint8_t *&data, uint32_t value) {
+  data[0] = (value >> 24) & 0xff;
+  data[1] = (value >> 16) & 0xff;
+  data[2] = (value >> 8) & 0xff;
+  data[3] = value & 0xff;
+  data += 4;
 }
 
-void streamWriteS32(std::vector<uint8_t> &data, int32_t value) {
-  data.push_back((value >> 24) & 0xff);
-  data.push_back((value >> 16) & 0xff);
-  data.push_back((value >> 8) & 0xff);
-  data.push_back(value & 0xff);
+static inline void streamWriteS32(uint8_t *&data, int32_t value) {
+  streamWriteU32(data, static_cast<uint32_t>(value));
 }
 
-uhdr_error_info_t streamReadU8(const std::vector<uint8_t> &data, uint8_t &value, size_t &pos) {
-  if (pos >= data.size()) {
-    uhdr_error_info_t status;
-    status.error_code = UHDR_CODEC_MEM_ERROR;
-    status.has_detail = 1;
-    snprintf(status.detail, sizeof status.detail,
-             "attempting to read byte at position %d when the buffer size is %d", (int)pos,
-             (int)data.size());
-    return status;
-  }
-  value = data[pos++];
-  return g_no_error;
+static inline void streamReadU16(const uint8_t *&data, uint16_t &value) {
+  value = static_cast<uint16_t>(data[0] << 8 | data[1]);
+  data += 2;
 }
 
-uhdr_error_info_t streamReadU16(const std::vector<uint8_t> &data, uint16_t &value, size_t &pos) {
-  if (pos + 1 >= data.size()) {
-    uhdr_error_info_t status;
-    status.error_code = UHDR_CODEC_MEM_ERROR;
-    status.has_detail = 1;
-    snprintf(status.detail, sizeof status.detail,
-             "attempting to read 2 bytes from position %d when the buffer size is %d", (int)pos,
-             (int)data.size());
-    return status;
-  }
-  value = (data[pos] << 8 | data[pos + 1]);
-  pos += 2;
-  return g_no_error;
+static inline void streamReadU32(const uint8_t *&data, uint32_t &value) {
+  value = (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | data[3];
+  data += 4;
 }
 
-uhdr_error_info_t streamReadU32(const std::vector<uint8_t> &data, uint32_t &value, size_t &pos) {
-  if (pos + 3 >= data.size()) {
-    uhdr_error_info_t status;
-    status.error_code = UHDR_CODEC_MEM_ERROR;
-    status.has_detail = 1;
-    snprintf(status.detail, sizeof status.detail,
-             "attempting to read 4 bytes from position %d when the buffer size is %d", (int)pos,
-             (int)data.size());
-    return status;
-  }
-  value = (data[pos] << 24 | data[pos + 1] << 16 | data[pos + 2] << 8 | data[pos + 3]);
-  pos += 4;
-  return g_no_error;
+static inline void streamReadS32(const uint8_t *&data, int32_t &value) {
+  uint32_t bits;
+  streamReadU32(data, bits);
+  value = static_cast<int32_t>(bits);
 }
 
-uhdr_error_info_t streamReadS32(const std::vector<uint8_t> &data, int32_t &value, size_t &pos) {
-  if (pos + 3 >= data.size()) {
-    uhdr_error_info_t status;
-    status.error_code = UHDR_CODEC_MEM_ERROR;
-    status.has_detail = 1;
-    snprintf(status.detail, sizeof status.detail,
-             "attempting to read 4 bytes from position %d when the buffer size is %d", (int)pos,
-             (int)data.size());
-    return status;
-  }
-  value = (data[pos] << 24 | data[pos + 1] << 16 | data[pos + 2] << 8 | data[pos + 3]);
-  pos += 4;
-  return g_no_error;
+static uhdr_error_info_t shortBufferError(size_t needed, size_t size) {
+  uhdr_error_info_t status;
+  status.error_code = UHDR_CODEC_MEM_ERROR;
+  status.has_detail = 1;
+  snprintf(status.detail, sizeof status.detail,
+           "gain map metadata needs at least %d bytes when the buffer size is %d", (int)needed,
+           (int)size);
+  return status;
 }
 
 bool uhdr_gainmap_metadata_frac::allChannelsIdentical() const {
@@ -117,6 +85,16 @@ bool uhdr_gainmap_metadata_frac::allChannelsIdentical() const {
 
 uhdr_error_info_t uhdr_gainmap_metadata_frac::encodeGainmapMetadata(
     const uhdr_gainmap_metadata_frac *in_metadata, std::vector<uint8_t> &out_data) {
+  uint8_t packet[kGainmapMetadataMaxSize];
+  size_t size = 0;
+  UHDR_ERR_CHECK(encodeGainmapMetadata(in_metadata, packet, sizeof packet, size));
+  out_data.insert(out_data.end(), packet, packet + size);
+  return g_no_error;
+}
+
+uhdr_error_info_t uhdr_gainmap_metadata_frac::encodeGainmapMetadata(
+    const uhdr_gainmap_metadata_frac *in_metadata, uint8_t *out_data, size_t capacity,
+    size_t &out_size) {
   if (in_metadata == nullptr) {
     uhdr_error_info_t status;
     status.error_code = UHDR_CODEC_INVALID_PARAM;
@@ -126,10 +104,6 @@ uhdr_error_info_t uhdr_gainmap_metadata_frac::encodeGainmapMetadata(
     return status;
   }
 
-  const uint16_t min_version = 0, writer_version = 0;
-  streamWriteU16(out_data, min_version);
-  streamWriteU16(out_data, writer_version);
-
   uint8_t flags = 0u;
   // Always write three channels for now for simplicity.
   // TODO(maryla): the draft says that this specifies the count of channels of the
@@ -162,43 +136,65 @@ uhdr_error_info_t uhdr_gainmap_metadata_frac::encodeGainmapMetadata(
   if (useCommonDenominator) {
     flags |= 8;
   }
-  streamWriteU8(out_data, flags);
+
+  const size_t size = useCommonDenominator ? 5 + 3 * 4 + channelCount * 5 * 4
+                                           : 5 + 4 * 4 + channelCount * 10 * 4;
+  if (out_data == nullptr || capacity < size) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_MEM_ERROR;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "gain map metadata needs %zu bytes, output buffer holds %zu", size, capacity);
+    return status;
+  }
+
+  const uint16_t min_version = 0, writer_version = 0;
+  uint8_t *out = out_data;
+  streamWriteU16(out, min_version);
+  streamWriteU16(out, writer_version);
+  streamWriteU8(out, flags);
 
   if (useCommonDenominator) {
-    streamWriteU32(out_data, denom);
-    streamWriteU32(out_data, in_metadata->baseHdrHeadroomN);
-    streamWriteU32(out_data, in_metadata->alternateHdrHeadroomN);
+    streamWriteU32(out, denom);
+    streamWriteU32(out, in_metadata->baseHdrHeadroomN);
+    streamWriteU32(out, in_metadata->alternateHdrHeadroomN);
     for (int c = 0; c < channelCount; ++c) {
-      streamWriteS32(out_data, in_metadata->gainMapMinN[c]);
-      streamWriteS32(out_data, in_metadata->gainMapMaxN[c]);
-      streamWriteU32(out_data, in_metadata->gainMapGammaN[c]);
-      streamWriteS32(out_data, in_metadata->baseOffsetN[c]);
-      streamWriteS32(out_data, in_metadata->alternateOffsetN[c]);
+      streamWriteS32(out, in_metadata->gainMapMinN[c]);
+      streamWriteS32(out, in_metadata->gainMapMaxN[c]);
+      streamWriteU32(out, in_metadata->gainMapGammaN[c]);
+      streamWriteS32(out, in_metadata->baseOffsetN[c]);
+      streamWriteS32(out, in_metadata->alternateOffsetN[c]);
     }
   } else {
-    streamWriteU32(out_data, in_metadata->baseHdrHeadroomN);
-    streamWriteU32(out_data, in_metadata->baseHdrHeadroomD);
-    streamWriteU32(out_data, in_metadata->alternateHdrHeadroomN);
-    streamWriteU32(out_data, in_metadata->alternateHdrHeadroomD);
+    streamWriteU32(out, in_metadata->baseHdrHeadroomN);
+    streamWriteU32(out, in_metadata->baseHdrHeadroomD);
+    streamWriteU32(out, in_metadata->alternateHdrHeadroomN);
+    streamWriteU32(out, in_metadata->alternateHdrHeadroomD);
     for (int c = 0; c < channelCount; ++c) {
-      streamWriteS32(out_data, in_metadata->gainMapMinN[c]);
-      streamWriteU32(out_data, in_metadata->gainMapMinD[c]);
-      streamWriteS32(out_data, in_metadata->gainMapMaxN[c]);
-      streamWriteU32(out_data, in_metadata->gainMapMaxD[c]);
-      streamWriteU32(out_data, in_metadata->gainMapGammaN[c]);
-      streamWriteU32(out_data, in_metadata->gainMapGammaD[c]);
-      streamWriteS32(out_data, in_metadata->baseOffsetN[c]);
-      streamWriteU32(out_data, in_metadata->baseOffsetD[c]);
-      streamWriteS32(out_data, in_metadata->alternateOffsetN[c]);
-      streamWriteU32(out_data, in_metadata->alternateOffsetD[c]);
+      streamWriteS32(out, in_metadata->gainMapMinN[c]);
+      streamWriteU32(out, in_metadata->gainMapMinD[c]);
+      streamWriteS32(out, in_metadata->gainMapMaxN[c]);
+      streamWriteU32(out, in_metadata->gainMapMaxD[c]);
+      streamWriteU32(out, in_metadata->gainMapGammaN[c]);
+      streamWriteU32(out, in_metadata->gainMapGammaD[c]);
+      streamWriteS32(out, in_metadata->baseOffsetN[c]);
+      streamWriteU32(out, in_metadata->baseOffsetD[c]);
+      streamWriteS32(out, in_metadata->alternateOffsetN[c]);
+      streamWriteU32(out, in_metadata->alternateOffsetD[c]);
     }
   }
+  out_size = size;
 
   return g_no_error;
 }
 
 uhdr_error_info_t uhdr_gainmap_metadata_frac::decodeGainmapMetadata(
     const std::vector<uint8_t> &in_data, uhdr_gainmap_metadata_frac *out_metadata) {
+  return decodeGainmapMetadata(in_data.data(), in_data.size(), out_metadata);
+}
+
+uhdr_error_info_t uhdr_gainmap_metadata_frac::decodeGainmapMetadata(
+    const uint8_t *in_data, size_t in_size, uhdr_gainmap_metadata_frac *out_metadata) {
   if (out_metadata == nullptr) {
     uhdr_error_info_t status;
     status.error_code = UHDR_CODEC_INVALID_PARAM;
@@ -208,10 +204,11 @@ uhdr_error_info_t uhdr_gainmap_metadata_frac::decodeGainmapMetadata(
     return status;
   }
 
-  size_t pos = 0;
+  if (in_data == nullptr || in_size < 2) return shortBufferError(2, in_size);
+  const uint8_t *in = in_data;
   uint16_t min_version = 0xffff;
   uint16_t writer_version = 0xffff;
-  UHDR_ERR_CHECK(streamReadU16(in_data, min_version, pos))
+  streamReadU16(in, min_version);
   if (min_version != 0) {
     uhdr_error_info_t status;
     status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
@@ -220,10 +217,9 @@ uhdr_error_info_t uhdr_gainmap_metadata_frac::decodeGainmapMetadata(
              "received unexpected minimum version %d, expected 0", min_version);
     return status;
   }
-  UHDR_ERR_CHECK(streamReadU16(in_data, writer_version, pos))
-
-  uint8_t flags = 0xff;
-  UHDR_ERR_CHECK(streamReadU8(in_data, flags, pos))
+  if (in_size < 5) return shortBufferError(5, in_size);
+  streamReadU16(in, writer_version);
+  const uint8_t flags = *in++;
   uint8_t channelCount = ((flags & kIsMultiChannelMask) != 0) * 2 + 1;
   if (!(channelCount == 1 || channelCount == 3)) {
     uhdr_error_info_t status;
@@ -236,44 +232,47 @@ uhdr_error_info_t uhdr_gainmap_metadata_frac::decodeGainmapMetadata(
   out_metadata->useBaseColorSpace = (flags & kUseBaseColorSpaceMask) != 0;
   out_metadata->backwardDirection = (flags & 4) != 0;
   const bool useCommonDenominator = (flags & 8) != 0;
+  const size_t size = useCommonDenominator ? 5 + 3 * 4 + channelCount * 5 * 4
+                                           : 5 + 4 * 4 + channelCount * 10 * 4;
+  if (in_size < size) return shortBufferError(size, in_size);
 
   if (useCommonDenominator) {
     uint32_t commonDenominator = 1u;
-    UHDR_ERR_CHECK(streamReadU32(in_data, commonDenominator, pos))
+    streamReadU32(in, commonDenominator);
 
-    UHDR_ERR_CHECK(streamReadU32(in_data, out_metadata->baseHdrHeadroomN, pos))
+    streamReadU32(in, out_metadata->baseHdrHeadroomN);
     out_metadata->baseHdrHeadroomD = commonDenominator;
-    UHDR_ERR_CHECK(streamReadU32(in_data, out_metadata->alternateHdrHeadroomN, pos))
+    streamReadU32(in, out_metadata->alternateHdrHeadroomN);
     out_metadata->alternateHdrHeadroomD = commonDenominator;
 
     for (int c = 0; c < channelCount; ++c) {
-      UHDR_ERR_CHECK(streamReadS32(in_data, out_metadata->gainMapMinN[c], pos))
+      streamReadS32(in, out_metadata->gainMapMinN[c]);
       out_metadata->gainMapMinD[c] = commonDenominator;
-      UHDR_ERR_CHECK(streamReadS32(in_data, out_metadata->gainMapMaxN[c], pos))
+      streamReadS32(in, out_metadata->gainMapMaxN[c]);
       out_metadata->gainMapMaxD[c] = commonDenominator;
-      UHDR_ERR_CHECK(streamReadU32(in_data, out_metadata->gainMapGammaN[c], pos))
+      streamReadU32(in, out_metadata->gainMapGammaN[c]);
       out_metadata->gainMapGammaD[c] = commonDenominator;
-      UHDR_ERR_CHECK(streamReadS32(in_data, out_metadata->baseOffsetN[c], pos))
+      streamReadS32(in, out_metadata->baseOffsetN[c]);
       out_metadata->baseOffsetD[c] = commonDenominator;
-      UHDR_ERR_CHECK(streamReadS32(in_data, out_metadata->alternateOffsetN[c], pos))
+      streamReadS32(in, out_metadata->alternateOffsetN[c]);
       out_metadata->alternateOffsetD[c] = commonDenominator;
     }
   } else {
-    UHDR_ERR_CHECK(streamReadU32(in_data, out_metadata->baseHdrHeadroomN, pos))
-    UHDR_ERR_CHECK(streamReadU32(in_data, out_metadata->baseHdrHeadroomD, pos))
-    UHDR_ERR_CHECK(streamReadU32(in_data, out_metadata->alternateHdrHeadroomN, pos))
-    UHDR_ERR_CHECK(streamReadU32(in_data, out_metadata->alternateHdrHeadroomD, pos))
+    streamReadU32(in, out_metadata->baseHdrHeadroomN);
+    streamReadU32(in, out_metadata->baseHdrHeadroomD);
+    streamReadU32(in, out_metadata->alternateHdrHeadroomN);
+    streamReadU32(in, out_metadata->alternateHdrHeadroomD);
     for (int c = 0; c < channelCount; ++c) {
-      UHDR_ERR_CHECK(streamReadS32(in_data, out_metadata->gainMapMinN[c], pos))
-      UHDR_ERR_CHECK(streamReadU32(in_data, out_metadata->gainMapMinD[c], pos))
-      UHDR_ERR_CHECK(streamReadS32(in_data, out_metadata->gainMapMaxN[c], pos))
-      UHDR_ERR_CHECK(streamReadU32(in_data, out_metadata->gainMapMaxD[c], pos))
-      UHDR_ERR_CHECK(streamReadU32(in_data, out_metadata->gainMapGammaN[c], pos))
-      UHDR_ERR_CHECK(streamReadU32(in_data, out_metadata->gainMapGammaD[c], pos))
-      UHDR_ERR_CHECK(streamReadS32(in_data, out_metadata->baseOffsetN[c], pos))
-      UHDR_ERR_CHECK(streamReadU32(in_data, out_metadata->baseOffsetD[c], pos))
-      UHDR_ERR_CHECK(streamReadS32(in_data, out_metadata->alternateOffsetN[c], pos))
-      UHDR_ERR_CHECK(streamReadU32(in_data, out_metadata->alternateOffsetD[c], pos))
+      streamReadS32(in, out_metadata->gainMapMinN[c]);
+      streamReadU32(in, out_metadata->gainMapMinD[c]);
+      streamReadS32(in, out_metadata->gainMapMaxN[c]);
+      streamReadU32(in, out_metadata->gainMapMaxD[c]);
+      streamReadU32(in, out_metadata->gainMapGammaN[c]);
+      streamReadU32(in, out_metadata->gainMapGammaD[c]);
+      streamReadS32(in, out_metadata->baseOffsetN[c]);
+      streamReadU32(in, out_metadata->baseOffsetD[c]);
+      streamReadS32(in, out_metadata->alternateOffsetN[c]);
+      streamReadU32(in, out_metadata->alternateOffsetD[c]);
     }
   }
 
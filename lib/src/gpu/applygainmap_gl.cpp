@@ -17,6 +17,7 @@
 #include "ultrahdr/ultrahdrcommon.h"
 #include "ultrahdr/gainmapmath.h"
 #include "ultrahdr/jpegr.h"
+#include "ultrahdr/trace.h"
 
 namespace ultrahdr {
 
@@ -109,7 +110,7 @@ static const std::string p3YUVToRGBShader = R"__SHADER__(
   }
 )__SHADER__";
 
-static const std::string sRGBEOTFShader = R"__SHADER__(
+extern const std::string sRGBEOTFShader = R"__SHADER__(
   float sRGBEOTF(float e_gamma) {
     return e_gamma <= 0.04045 ? e_gamma / 12.92 : pow((e_gamma + 0.055) / 1.055, 2.4);
   }
@@ -280,7 +281,8 @@ uhdr_error_info_t applyGainMapGLES(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_
                                    uhdr_gainmap_metadata_ext_t* gainmap_metadata,
                                    uhdr_color_transfer_t output_ct, float display_boost,
                                    uhdr_raw_image_t* dest, uhdr_opengl_ctxt_t* opengl_ctxt) {
-  GLuint shaderProgram = 0;   // shader program
+  UHDR_TRACE_SCOPE("applyGainMapGLES");
+  GLuint shaderProgram = 0;   // shader program, held by the context
   GLuint yuvTexture = 0;      // sdr intent texture
   GLuint frameBuffer = 0;
 
@@ -288,19 +290,16 @@ uhdr_error_info_t applyGainMapGLES(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_
   if (opengl_ctxt->mErrorStatus.error_code != UHDR_CODEC_OK) { \
     if (frameBuffer) glDeleteFramebuffers(1, &frameBuffer);    \
     if (yuvTexture) glDeleteTextures(1, &yuvTexture);          \
-    if (shaderProgram) glDeleteProgram(shaderProgram);         \
     return opengl_ctxt->mErrorStatus;                          \
   }
 
-  shaderProgram = opengl_ctxt->create_shader_program(
+  shaderProgram = opengl_ctxt->get_shader_program(
       vertex_shader.c_str(),
       getApplyGainMapFragmentShader(sdr_intent->fmt, gainmap_img->fmt, output_ct).c_str());
   RET_IF_ERR()
 
-  yuvTexture = opengl_ctxt->create_texture(sdr_intent->fmt, sdr_intent->w, sdr_intent->h,
-                                           sdr_intent->planes[0]);
-  opengl_ctxt->mGainmapImgTexture = opengl_ctxt->create_texture(
-      gainmap_img->fmt, gainmap_img->w, gainmap_img->h, gainmap_img->planes[0]);
+  yuvTexture = opengl_ctxt->create_texture(sdr_intent);
+  opengl_ctxt->mGainmapImgTexture = opengl_ctxt->create_texture(gainmap_img);
   opengl_ctxt->mDecodedImgTexture = opengl_ctxt->create_texture(
       output_ct == UHDR_CT_LINEAR ? UHDR_IMG_FMT_64bppRGBAHalfFloat : UHDR_IMG_FMT_32bppRGBA1010102,
       sdr_intent->w, sdr_intent->h, nullptr);
@@ -357,7 +356,9 @@ uhdr_error_info_t applyGainMapGLES(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_
   opengl_ctxt->check_gl_errors("binding values to uniforms");
   RET_IF_ERR()
 
+  opengl_ctxt->begin_gpu_phase(kGpuShader);
   glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+  opengl_ctxt->end_gpu_phase();
 
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
@@ -368,9 +369,27 @@ uhdr_error_info_t applyGainMapGLES(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_
 
   if (frameBuffer) glDeleteFramebuffers(1, &frameBuffer);
   if (yuvTexture) glDeleteTextures(1, &yuvTexture);
-  if (shaderProgram) glDeleteProgram(shaderProgram);
 
   return opengl_ctxt->mErrorStatus;
 }
 
+uhdr_error_info_t preload_gl_programs() {
+  UHDR_TRACE_SCOPE("preload_gl_programs");
+  // the context and its programs go to the idle pool of the share group on destruction, from
+  // where the first gpu decodes take them
+  uhdr_opengl_ctxt_t opengl_ctxt;
+  opengl_ctxt.init_opengl_ctxt();
+  if (opengl_ctxt.mErrorStatus.error_code != UHDR_CODEC_OK) return opengl_ctxt.mErrorStatus;
+  // variants of the common decodes, a 4:2:0 base image with a single or multi channel gain map
+  for (uhdr_img_fmt_t gm_fmt : {UHDR_IMG_FMT_8bppYCbCr400, UHDR_IMG_FMT_24bppYCbCr444}) {
+    for (uhdr_color_transfer_t ct : {UHDR_CT_HLG, UHDR_CT_PQ, UHDR_CT_LINEAR}) {
+      opengl_ctxt.get_shader_program(
+          vertex_shader.c_str(),
+          getApplyGainMapFragmentShader(UHDR_IMG_FMT_12bppYCbCr420, gm_fmt, ct).c_str());
+      if (opengl_ctxt.mErrorStatus.error_code != UHDR_CODEC_OK) return opengl_ctxt.mErrorStatus;
+    }
+  }
+  return g_no_error;
+}
+
 }  // namespace ultrahdr
@@ -113,6 +113,23 @@ static const std::string crop_fragmentSource = R"__SHADER__(#version 300 es
   }
 )__SHADER__";
 
+// output pixel (x, y) copies the texel of a uhdr_plane_map_t, see uhdr_effect_chain_t
+static const std::string remap_fragmentSource = R"__SHADER__(#version 300 es
+  precision highp float;
+  precision highp int;
+  precision highp sampler2D;
+  out vec4 outColor;
+  uniform sampler2D srcTexture;
+  uniform ivec3 mapX; // src_x = mapX.x * x + mapX.y * y + mapX.z
+  uniform ivec3 mapY; // src_y = mapY.x * x + mapY.y * y + mapY.z
+  void main() {
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    ivec2 texelCoord = ivec2(mapX.x * p.x + mapX.y * p.y + mapX.z,
+                             mapY.x * p.x + mapY.y * p.y + mapY.z);
+    outColor = texelFetch(srcTexture, texelCoord, 0);
+  }
+)__SHADER__";
+
 static const std::string resizeShader = R"__SHADER__(
   uniform sampler2D srcTexture;
   uniform int srcWidth;
@@ -184,13 +201,13 @@ std::unique_ptr<uhdr_raw_image_ext_t> apply_mirror_gles(ultrahdr::uhdr_mirror_ef
   if (desc->m_direction == UHDR_MIRROR_HORIZONTAL) {
     if (gl_ctxt->mShaderProgram[UHDR_MIR_HORZ] == 0) {
       gl_ctxt->mShaderProgram[UHDR_MIR_HORZ] =
-          gl_ctxt->create_shader_program(vertex_shader.c_str(), mirror_horz_fragmentSource.c_str());
+          gl_ctxt->get_shader_program(vertex_shader.c_str(), mirror_horz_fragmentSource.c_str());
     }
     shaderProgram = &gl_ctxt->mShaderProgram[UHDR_MIR_HORZ];
   } else if (desc->m_direction == UHDR_MIRROR_VERTICAL) {
     if (gl_ctxt->mShaderProgram[UHDR_MIR_VERT] == 0) {
       gl_ctxt->mShaderProgram[UHDR_MIR_VERT] =
-          gl_ctxt->create_shader_program(vertex_shader.c_str(), mirror_vert_fragmentSource.c_str());
+          gl_ctxt->get_shader_program(vertex_shader.c_str(), mirror_vert_fragmentSource.c_str());
     }
     shaderProgram = &gl_ctxt->mShaderProgram[UHDR_MIR_VERT];
   }
@@ -207,7 +224,9 @@ std::unique_ptr<uhdr_raw_image_ext_t> apply_mirror_gles(ultrahdr::uhdr_mirror_ef
   gl_ctxt->check_gl_errors("binding values to uniform");
   RET_IF_ERR()
 
+  gl_ctxt->begin_gpu_phase(kGpuShader);
   glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+  gl_ctxt->end_gpu_phase();
   RET_IF_ERR()
 
   std::swap(*srcTexture, dstTexture);
@@ -227,12 +246,12 @@ std::unique_ptr<uhdr_raw_image_ext_t> apply_rotate_gles(ultrahdr::uhdr_rotate_ef
     if (desc->m_degree == 90) {
       if (gl_ctxt->mShaderProgram[UHDR_ROT_90] == 0) {
         gl_ctxt->mShaderProgram[UHDR_ROT_90] =
-            gl_ctxt->create_shader_program(vertex_shader.c_str(), rotate_90_fragmentSource.c_str());
+            gl_ctxt->get_shader_program(vertex_shader.c_str(), rotate_90_fragmentSource.c_str());
       }
       shaderProgram = &gl_ctxt->mShaderProgram[UHDR_ROT_90];
     } else {
       if (gl_ctxt->mShaderProgram[UHDR_ROT_270] == 0) {
-        gl_ctxt->mShaderProgram[UHDR_ROT_270] = gl_ctxt->create_shader_program(
+        gl_ctxt->mShaderProgram[UHDR_ROT_270] = gl_ctxt->get_shader_program(
             vertex_shader.c_str(), rotate_270_fragmentSource.c_str());
       }
       shaderProgram = &gl_ctxt->mShaderProgram[UHDR_ROT_270];
@@ -242,7 +261,7 @@ std::unique_ptr<uhdr_raw_image_ext_t> apply_rotate_gles(ultrahdr::uhdr_rotate_ef
                                                  src->h, 1);
     if (gl_ctxt->mShaderProgram[UHDR_ROT_180] == 0) {
       gl_ctxt->mShaderProgram[UHDR_ROT_180] =
-          gl_ctxt->create_shader_program(vertex_shader.c_str(), rotate_180_fragmentSource.c_str());
+          gl_ctxt->get_shader_program(vertex_shader.c_str(), rotate_180_fragmentSource.c_str());
     }
     shaderProgram = &gl_ctxt->mShaderProgram[UHDR_ROT_180];
   } else {
@@ -261,7 +280,9 @@ std::unique_ptr<uhdr_raw_image_ext_t> apply_rotate_gles(ultrahdr::uhdr_rotate_ef
   gl_ctxt->check_gl_errors("binding values to uniform");
   RET_IF_ERR()
 
+  gl_ctxt->begin_gpu_phase(kGpuShader);
   glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+  gl_ctxt->end_gpu_phase();
   RET_IF_ERR()
 
   std::swap(*srcTexture, dstTexture);
@@ -279,7 +300,7 @@ std::unique_ptr<uhdr_raw_image_ext_t> apply_crop_gles(uhdr_raw_image_t* src, int
 
   if (gl_ctxt->mShaderProgram[UHDR_CROP] == 0) {
     gl_ctxt->mShaderProgram[UHDR_CROP] =
-        gl_ctxt->create_shader_program(vertex_shader.c_str(), crop_fragmentSource.c_str());
+        gl_ctxt->get_shader_program(vertex_shader.c_str(), crop_fragmentSource.c_str());
   }
   dstTexture = gl_ctxt->create_texture(src->fmt, wd, ht, NULL);
   frameBuffer = gl_ctxt->setup_framebuffer(dstTexture);
@@ -302,7 +323,48 @@ std::unique_ptr<uhdr_raw_image_ext_t> apply_crop_gles(uhdr_raw_image_t* src, int
   gl_ctxt->check_gl_errors("binding values to uniform");
   RET_IF_ERR()
 
+  gl_ctxt->begin_gpu_phase(kGpuShader);
+  glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+  gl_ctxt->end_gpu_phase();
+  RET_IF_ERR()
+
+  std::swap(*srcTexture, dstTexture);
+  release_resources(&dstTexture, &frameBuffer);
+  return dst;
+}
+
+std::unique_ptr<uhdr_raw_image_ext_t> apply_effect_chain_gles(const uhdr_effect_chain_t& chain,
+                                                              uhdr_raw_image_t* src,
+                                                              uhdr_opengl_ctxt* gl_ctxt,
+                                                              GLuint* srcTexture) {
+  const uhdr_plane_map_t& m = chain.m_luma;
+  std::unique_ptr<uhdr_raw_image_ext_t> dst =
+      std::make_unique<uhdr_raw_image_ext_t>(src->fmt, src->cg, src->ct, src->range, m.w, m.h, 1);
+
+  if (gl_ctxt->mShaderProgram[UHDR_REMAP] == 0) {
+    gl_ctxt->mShaderProgram[UHDR_REMAP] =
+        gl_ctxt->get_shader_program(vertex_shader.c_str(), remap_fragmentSource.c_str());
+  }
+  GLuint dstTexture = gl_ctxt->create_texture(src->fmt, m.w, m.h, NULL);
+  GLuint frameBuffer = gl_ctxt->setup_framebuffer(dstTexture);
+
+  glViewport(0, 0, m.w, m.h);
+  glUseProgram(gl_ctxt->mShaderProgram[UHDR_REMAP]);
+  RET_IF_ERR()
+
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, *srcTexture);
+  glUniform1i(glGetUniformLocation(gl_ctxt->mShaderProgram[UHDR_REMAP], "srcTexture"), 0);
+  glUniform3i(glGetUniformLocation(gl_ctxt->mShaderProgram[UHDR_REMAP], "mapX"), m.xx, m.xy,
+              m.x0);
+  glUniform3i(glGetUniformLocation(gl_ctxt->mShaderProgram[UHDR_REMAP], "mapY"), m.yx, m.yy,
+              m.y0);
+  gl_ctxt->check_gl_errors("binding values to uniform");
+  RET_IF_ERR()
+
+  gl_ctxt->begin_gpu_phase(kGpuShader);
   glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+  gl_ctxt->end_gpu_phase();
   RET_IF_ERR()
 
   std::swap(*srcTexture, dstTexture);
@@ -328,7 +390,7 @@ std::unique_ptr<uhdr_raw_image_ext_t> apply_resize_gles(uhdr_raw_image_t* src, i
   )__SHADER__");
   if (gl_ctxt->mShaderProgram[UHDR_RESIZE] == 0) {
     gl_ctxt->mShaderProgram[UHDR_RESIZE] =
-        gl_ctxt->create_shader_program(vertex_shader.c_str(), shader_code.c_str());
+        gl_ctxt->get_shader_program(vertex_shader.c_str(), shader_code.c_str());
   }
   GLuint dstTexture = gl_ctxt->create_texture(src->fmt, dst_w, dst_h, NULL);
   GLuint frameBuffer = gl_ctxt->setup_framebuffer(dstTexture);
@@ -350,7 +412,9 @@ std::unique_ptr<uhdr_raw_image_ext_t> apply_resize_gles(uhdr_raw_image_t* src, i
   gl_ctxt->check_gl_errors("binding values to uniform");
   RET_IF_ERR()
 
+  gl_ctxt->begin_gpu_phase(kGpuShader);
   glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+  gl_ctxt->end_gpu_phase();
   RET_IF_ERR()
 
   std::swap(*srcTexture, dstTexture);
@@ -0,0 +1,687 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+
+#include "ultrahdr/ultrahdrcommon.h"
+#include "ultrahdr/gainmapmath.h"
+#include "ultrahdr/trace.h"
+
+namespace ultrahdr {
+
+extern const std::string vertex_shader;
+extern const std::string sRGBEOTFShader;
+bool isBufferDataContiguous(uhdr_raw_image_t* img);
+
+// Fragments address pixels by gl_FragCoord, whose rows match the rows of the render target as
+// read back by glReadPixels(). The samplers are read with texelFetch() only.
+static const std::string shaderHeader = R"__SHADER__(#version 300 es
+  precision highp float;
+  precision highp int;
+  precision highp usampler2D;
+
+  out vec4 FragColor;
+  in vec2 TexCoord;
+
+  uniform ivec2 imgSize;
+)__SHADER__";
+
+// 8-bit yuv planes stacked in one texture, see create_texture(). kSdrHSub and kSdrVSub are the
+// chroma subsampling factors.
+static const std::string getSdrYuvPixelShader = R"__SHADER__(
+  uniform sampler2D sdrTexture;
+
+  float fetchSdrSample(int index) {
+    return texelFetch(sdrTexture, ivec2(index % imgSize.x, index / imgSize.x), 0).r;
+  }
+
+  vec3 getSdrPixel(ivec2 p) {
+    int uvWidth = imgSize.x / kSdrHSub;
+    int uvSize = uvWidth * (imgSize.y / kSdrVSub);
+    int uIndex = imgSize.x * imgSize.y + (p.y / kSdrVSub) * uvWidth + p.x / kSdrHSub;
+    return vec3(texelFetch(sdrTexture, p, 0).r, fetchSdrSample(uIndex) - 128.0 / 255.0,
+                fetchSdrSample(uIndex + uvSize) - 128.0 / 255.0);
+  }
+)__SHADER__";
+
+static const std::string getSdrRgbPixelShader = R"__SHADER__(
+  uniform sampler2D sdrTexture;
+
+  vec3 getSdrPixel(ivec2 p) { return texelFetch(sdrTexture, p, 0).rgb; }
+)__SHADER__";
+
+// 10-bit yuv samples are normalized as (sample - yuvBias) * yuvScale, with chroma centered at 0
+static const std::string normalizeYuv10bitShader = R"__SHADER__(
+  uniform vec3 yuvBias, yuvScale;
+
+  vec3 normalizeYuv(uvec3 yuv) { return (vec3(yuv) - yuvBias) * yuvScale - vec3(0.0, 0.5, 0.5); }
+)__SHADER__";
+
+static const std::string getHdrP010PixelShader = R"__SHADER__(
+  uniform usampler2D hdrTexture;
+
+  vec3 getHdrPixel(ivec2 p) {
+    ivec2 uv = ivec2(p.x & ~1, imgSize.y + p.y / 2);
+    uvec3 yuv = uvec3(texelFetch(hdrTexture, p, 0).r, texelFetch(hdrTexture, uv, 0).r,
+                      texelFetch(hdrTexture, uv + ivec2(1, 0), 0).r);
+    return normalizeYuv(yuv >> 6u);
+  }
+)__SHADER__";
+
+static const std::string getHdrYuv44410bitPixelShader = R"__SHADER__(
+  uniform usampler2D hdrTexture;
+
+  vec3 getHdrPixel(ivec2 p) {
+    uvec3 yuv = uvec3(texelFetch(hdrTexture, p, 0).r,
+                      texelFetch(hdrTexture, p + ivec2(0, imgSize.y), 0).r,
+                      texelFetch(hdrTexture, p + ivec2(0, 2 * imgSize.y), 0).r);
+    return normalizeYuv(yuv);
+  }
+)__SHADER__";
+
+static const std::string getHdrRgba1010102PixelShader = R"__SHADER__(
+  uniform sampler2D hdrTexture;
+
+  vec3 getHdrPixel(ivec2 p) { return texelFetch(hdrTexture, p, 0).rgb; }
+)__SHADER__";
+
+// matches sanitizePixel()
+static const std::string getHdrRgbaF16PixelShader = R"__SHADER__(
+  uniform sampler2D hdrTexture;
+
+  vec3 getHdrPixel(ivec2 p) {
+    vec3 e = texelFetch(hdrTexture, p, 0).rgb;
+    return clamp(mix(e, vec3(0.0), isnan(e)), 0.0, 10000.0 / 203.0);
+  }
+)__SHADER__";
+
+// coefficients are {Cr, GCb, GCr, Cb}, see getYuvToRgbCoeffs()
+static const std::string yuvToRgbShader = R"__SHADER__(
+  vec3 yuvToRgb(const vec3 e, const vec4 k) {
+    return clamp(vec3(e.x + k.x * e.z, e.x - k.y * e.y - k.z * e.z, e.x + k.w * e.y), 0.0, 1.0);
+  }
+)__SHADER__";
+
+static const std::string hlgInverseOETFShader = R"__SHADER__(
+  float InverseOETF(const float e_gamma) {
+    const float kHlgA = 0.17883277;
+    const float kHlgB = 0.28466892;
+    const float kHlgC = 0.55991073;
+    return e_gamma <= 0.5 ? e_gamma * e_gamma / 3.0
+                          : (exp((e_gamma - kHlgC) / kHlgA) + kHlgB) / 12.0;
+  }
+
+  vec3 InverseOETF(const vec3 e_gamma) {
+    return vec3(InverseOETF(e_gamma.r), InverseOETF(e_gamma.g), InverseOETF(e_gamma.b));
+  }
+)__SHADER__";
+
+static const std::string pqInverseOETFShader = R"__SHADER__(
+  vec3 InverseOETF(const vec3 e_gamma) {
+    const float kPqM1 = (2610.0 / 4096.0) / 4.0;
+    const float kPqM2 = (2523.0 / 4096.0) * 128.0;
+    const float kPqC1 = (3424.0 / 4096.0);
+    const float kPqC2 = (2413.0 / 4096.0) * 32.0;
+    const float kPqC3 = (2392.0 / 4096.0) * 32.0;
+    vec3 tmp = pow(e_gamma, vec3(1.0 / kPqM2));
+    return pow(max(tmp - kPqC1, 0.0) / (kPqC2 - kPqC3 * tmp), vec3(1.0 / kPqM1));
+  }
+)__SHADER__";
+
+static const std::string linearInverseOETFShader = R"__SHADER__(
+  vec3 InverseOETF(const vec3 e_gamma) { return e_gamma; }
+)__SHADER__";
+
+// hdr intent to linear rgb, the hlg ootf is approximated per channel like hlgOotfApprox()
+static const std::string linearizeHdrShader = R"__SHADER__(
+  uniform vec4 hdrYuvToRgb;
+  uniform float ootfGamma;
+  uniform mat3 gamutMatrix;
+
+  vec3 linearizeHdr(vec3 e) {
+    if (kHdrIsYuv) e = yuvToRgb(e, hdrYuvToRgb);
+    vec3 rgb = InverseOETF(e);
+    if (ootfGamma != 1.0) rgb = pow(rgb, vec3(ootfGamma));
+    return rgb;
+  }
+)__SHADER__";
+
+static const std::string encodeGainShader = R"__SHADER__(
+  uniform float minBoost, maxBoost, logMinBoost, logMaxBoost, gamma;
+
+  vec3 gain(const vec3 sdr, const vec3 hdr) {
+    vec3 boost = clamp(mix(vec3(1.0), hdr / sdr, greaterThan(sdr, vec3(0.0))), minBoost, maxBoost);
+    vec3 gainNormalized = (log2(boost) - logMinBoost) / (logMaxBoost - logMinBoost);
+    return floor(pow(max(gainNormalized, 0.0), vec3(gamma)) * 255.0) / 255.0;
+  }
+)__SHADER__";
+
+static const std::string computeGainShader = R"__SHADER__(
+  uniform float sdrOffset, hdrOffset;
+
+  vec3 gain(const vec3 sdr, const vec3 hdr) {
+    vec3 logBoost = log2((hdr + hdrOffset) / (sdr + sdrOffset));
+    return mix(logBoost, min(logBoost, 2.3), lessThan(sdr, vec3(2.0 / 255.0)));
+  }
+)__SHADER__";
+
+static const std::string generateGainMapShader = R"__SHADER__(
+  uniform int mapScale;
+  uniform vec4 sdrYuvToRgb;
+  uniform vec3 luminance;
+  uniform float sdrToNits, hdrToNits;
+
+  void main() {
+    ivec2 base = ivec2(gl_FragCoord.xy) * mapScale;
+    vec3 sdr = vec3(0.0), hdr = vec3(0.0);
+    for (int dy = 0; dy < mapScale; dy++) {
+      for (int dx = 0; dx < mapScale; dx++) {
+        sdr += getSdrPixel(base + ivec2(dx, dy));
+        hdr += getHdrPixel(base + ivec2(dx, dy));
+      }
+    }
+    float count = float(mapScale * mapScale);
+    sdr /= count;
+    hdr /= count;
+
+    if (kSdrIsYuv) sdr = yuvToRgb(sdr, sdrYuvToRgb);
+    sdr = sRGBEOTF(sdr);
+    hdr = max(gamutMatrix * linearizeHdr(hdr), 0.0);
+
+    if (kGainMode == 1) {
+      sdr = vec3(max(sdr.r, max(sdr.g, sdr.b)));
+      hdr = vec3(max(hdr.r, max(hdr.g, hdr.b)));
+    } else if (kGainMode == 2) {
+      sdr = vec3(dot(sdr, luminance));
+      hdr = vec3(dot(hdr, luminance));
+    }
+    FragColor = vec4(gain(sdr * sdrToNits, hdr * hdrToNits), 1.0);
+  }
+)__SHADER__";
+
+// globalTonemap() followed by the conversion to the display p3 sdr intent
+static const std::string toneMapShader = R"__SHADER__(
+  uniform float headroom, hdrScale;
+
+  float sRGBOETF(const float e) {
+    return e <= 0.0031308 ? 12.92 * e : 1.055 * pow(e, 1.0 / 2.4) - 0.055;
+  }
+
+  vec3 toneMap(ivec2 p) {
+    vec3 rgb = linearizeHdr(getHdrPixel(p)) * hdrScale;
+    float maxHdr = max(rgb.r, max(rgb.g, rgb.b));
+    float maxSdr = maxHdr * (1.0 + maxHdr / (headroom * headroom)) / (1.0 + maxHdr);
+    rgb = mix(vec3(0.0), rgb * (maxSdr / maxHdr), greaterThan(rgb, vec3(0.0)));
+    rgb = clamp(gamutMatrix * rgb, 0.0, 1.0);
+    return vec3(sRGBOETF(rgb.r), sRGBOETF(rgb.g), sRGBOETF(rgb.b));
+  }
+
+  vec3 p3RgbToYuv(const vec3 e) {
+    float y = dot(e, vec3(0.299, 0.587, 0.114));
+    return vec3(y, (e.b - y) / 1.772 + 0.5, (e.r - y) / 1.402 + 0.5);
+  }
+)__SHADER__";
+
+static const std::string toneMapRgbMainShader = R"__SHADER__(
+  void main() { FragColor = vec4(toneMap(ivec2(gl_FragCoord.xy)), 1.0); }
+)__SHADER__";
+
+// Renders the yuv planes stacked in one texture, see create_texture(). A chroma sample averages
+// the chroma of the pixels it covers.
+static const std::string toneMapYuvMainShader = R"__SHADER__(
+  void main() {
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    int index = p.y * imgSize.x + p.x;
+    int lumaSize = imgSize.x * imgSize.y;
+    if (index < lumaSize) {
+      FragColor = vec4(p3RgbToYuv(toneMap(ivec2(index % imgSize.x, index / imgSize.x))).x);
+      return;
+    }
+    int uvWidth = imgSize.x / kSdrHSub;
+    int uvSize = uvWidth * (imgSize.y / kSdrVSub);
+    int plane = (index - lumaSize) / uvSize;
+    int uvIndex = index - lumaSize - plane * uvSize;
+    ivec2 base = ivec2(uvIndex % uvWidth * kSdrHSub, uvIndex / uvWidth * kSdrVSub);
+    float sum = 0.0;
+    for (int dy = 0; dy < kSdrVSub; dy++) {
+      for (int dx = 0; dx < kSdrHSub; dx++) {
+        vec3 yuv = p3RgbToYuv(toneMap(base + ivec2(dx, dy)));
+        sum += plane == 0 ? yuv.y : yuv.z;
+      }
+    }
+    FragColor = vec4(sum / float(kSdrHSub * kSdrVSub));
+  }
+)__SHADER__";
+
+static bool isGLESYuvFormat(uhdr_img_fmt_t fmt) {
+  return fmt == UHDR_IMG_FMT_12bppYCbCr420 || fmt == UHDR_IMG_FMT_16bppYCbCr422 ||
+         fmt == UHDR_IMG_FMT_24bppYCbCr444;
+}
+
+static std::string getSdrFormatConstants(uhdr_img_fmt_t fmt) {
+  int h_sub = fmt == UHDR_IMG_FMT_24bppYCbCr444 ? 1 : 2;
+  int v_sub = fmt == UHDR_IMG_FMT_12bppYCbCr420 ? 2 : 1;
+  return "const bool kSdrIsYuv = " + std::string(isGLESYuvFormat(fmt) ? "true" : "false") +
+         ";\nconst int kSdrHSub = " + std::to_string(h_sub) +
+         ";\nconst int kSdrVSub = " + std::to_string(v_sub) + ";\n";
+}
+
+static std::string getHdrPixelShader(uhdr_raw_image_t* hdr_intent) {
+  std::string shader_code = "const bool kHdrIsYuv = ";
+  shader_code.append(isPixelFormatRgb(hdr_intent->fmt) ? "false;\n" : "true;\n");
+  if (hdr_intent->fmt == UHDR_IMG_FMT_24bppYCbCrP010) {
+    shader_code.append(normalizeYuv10bitShader);
+    shader_code.append(getHdrP010PixelShader);
+  } else if (hdr_intent->fmt == UHDR_IMG_FMT_30bppYCbCr444) {
+    shader_code.append(normalizeYuv10bitShader);
+    shader_code.append(getHdrYuv44410bitPixelShader);
+  } else if (hdr_intent->fmt == UHDR_IMG_FMT_32bppRGBA1010102) {
+    shader_code.append(getHdrRgba1010102PixelShader);
+  } else {
+    shader_code.append(getHdrRgbaF16PixelShader);
+  }
+  shader_code.append(yuvToRgbShader);
+  if (hdr_intent->ct == UHDR_CT_HLG) {
+    shader_code.append(hlgInverseOETFShader);
+  } else if (hdr_intent->ct == UHDR_CT_PQ) {
+    shader_code.append(pqInverseOETFShader);
+  } else {
+    shader_code.append(linearInverseOETFShader);
+  }
+  shader_code.append(linearizeHdrShader);
+  return shader_code;
+}
+
+std::string getGenerateGainMapFragmentShader(uhdr_raw_image_t* sdr_intent,
+                                             uhdr_raw_image_t* hdr_intent, bool use_luminance,
+                                             bool multichannel, bool encode) {
+  std::string shader_code = shaderHeader;
+  shader_code.append(getSdrFormatConstants(sdr_intent->fmt));
+  shader_code.append("const int kGainMode = ");
+  shader_code.append(multichannel ? "0;\n" : use_luminance ? "2;\n" : "1;\n");
+  shader_code.append(isGLESYuvFormat(sdr_intent->fmt) ? getSdrYuvPixelShader
+                                                      : getSdrRgbPixelShader);
+  shader_code.append(getHdrPixelShader(hdr_intent));
+  shader_code.append(sRGBEOTFShader);
+  shader_code.append(encode ? encodeGainShader : computeGainShader);
+  shader_code.append(generateGainMapShader);
+  return shader_code;
+}
+
+std::string getToneMapFragmentShader(uhdr_raw_image_t* hdr_intent, uhdr_img_fmt_t sdr_fmt) {
+  std::string shader_code = shaderHeader;
+  shader_code.append(getSdrFormatConstants(sdr_fmt));
+  shader_code.append(getHdrPixelShader(hdr_intent));
+  shader_code.append(toneMapShader);
+  shader_code.append(isGLESYuvFormat(sdr_fmt) ? toneMapYuvMainShader : toneMapRgbMainShader);
+  return shader_code;
+}
+
+static bool hasGLExtension(const char* name) {
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (GLint i = 0; i < count; i++) {
+    const char* ext = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+    if (ext != nullptr && strcmp(ext, name) == 0) return true;
+  }
+  return false;
+}
+
+static uhdr_error_info_t unsupportedOnGLES(const char* what) {
+  uhdr_error_info_t status;
+  status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
+  status.has_detail = 1;
+  snprintf(status.detail, sizeof status.detail, "%s is not supported by the gles implementation",
+           what);
+  return status;
+}
+
+// The encoder calls from any of its worker threads, the context is bound for the duration of a
+// call unless the caller has it current already
+namespace {
+struct ScopedGLESCtxtBinding {
+  explicit ScopedGLESCtxtBinding(uhdr_opengl_ctxt_t* opengl_ctxt)
+      : ctxt(opengl_ctxt), was_current(eglGetCurrentContext() == opengl_ctxt->mEGLContext) {
+    bound = was_current || ctxt->make_current();
+  }
+  ~ScopedGLESCtxtBinding() {
+    if (bound && !was_current) ctxt->release_current();
+  }
+  uhdr_opengl_ctxt_t* ctxt;
+  bool was_current;
+  bool bound;
+};
+}  // namespace
+
+// Sets the uniforms of the hdr intent shared by the tone map and gain map shaders
+static bool setHdrUniforms(GLuint program, uhdr_raw_image_t* hdr_intent,
+                           uhdr_color_gamut_t dst_gamut) {
+  ColorTransformFn gamutConversionFn = getGamutConversionFn(dst_gamut, hdr_intent->cg);
+  if (gamutConversionFn == nullptr || getYuvToRgbFn(hdr_intent->cg) == nullptr) return false;
+  float yuv_to_rgb[4];
+  std::array<float, 9> gamut_matrix;
+  getYuvToRgbCoeffs(hdr_intent->cg, yuv_to_rgb);
+  getGamutConversionMatrix(gamutConversionFn, gamut_matrix);
+
+  bool full_range = hdr_intent->range == UHDR_CR_FULL_RANGE;
+  float bias = full_range ? 0.0f : 64.0f;
+  float scale_y = full_range ? 1.0f / 1023.0f : 1.0f / 876.0f;
+  float scale_uv = full_range ? 1.0f / 1023.0f : 1.0f / 896.0f;
+
+  glUniform2i(glGetUniformLocation(program, "imgSize"), hdr_intent->w, hdr_intent->h);
+  glUniform3f(glGetUniformLocation(program, "yuvBias"), bias, bias, bias);
+  glUniform3f(glGetUniformLocation(program, "yuvScale"), scale_y, scale_uv, scale_uv);
+  glUniform4fv(glGetUniformLocation(program, "hdrYuvToRgb"), 1, yuv_to_rgb);
+  // system gamma of the hlg reference ootf, see hlgOotfApprox()
+  glUniform1f(glGetUniformLocation(program, "ootfGamma"),
+              hdr_intent->ct == UHDR_CT_HLG ? 1.2f : 1.0f);
+  glUniformMatrix3fv(glGetUniformLocation(program, "gamutMatrix"), 1, GL_TRUE,
+                     gamut_matrix.data());
+  return true;
+}
+
+static bool isGLESHdrIntentSupported(uhdr_raw_image_t* hdr_intent) {
+  if (hdr_intent->ct != UHDR_CT_HLG && hdr_intent->ct != UHDR_CT_PQ &&
+      hdr_intent->ct != UHDR_CT_LINEAR)
+    return false;
+  if (hdr_intent->fmt == UHDR_IMG_FMT_24bppYCbCrP010) {
+    return hdr_intent->w % 2 == 0 && hdr_intent->h % 2 == 0;
+  }
+  return hdr_intent->fmt == UHDR_IMG_FMT_30bppYCbCr444 ||
+         hdr_intent->fmt == UHDR_IMG_FMT_32bppRGBA1010102 ||
+         hdr_intent->fmt == UHDR_IMG_FMT_64bppRGBAHalfFloat;
+}
+
+static bool isGLESTextureSizeSupported(uhdr_img_fmt_t fmt, unsigned int w, unsigned int h) {
+  GLint max_size = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+  unsigned int rows = h;
+  if (fmt == UHDR_IMG_FMT_12bppYCbCr420 || fmt == UHDR_IMG_FMT_24bppYCbCrP010) {
+    rows = h * 3 / 2;
+  } else if (fmt == UHDR_IMG_FMT_16bppYCbCr422) {
+    rows = h * 2;
+  } else if (fmt == UHDR_IMG_FMT_24bppYCbCr444 || fmt == UHDR_IMG_FMT_30bppYCbCr444) {
+    rows = h * 3;
+  }
+  return w <= (unsigned int)max_size && rows <= (unsigned int)max_size;
+}
+
+uhdr_error_info_t toneMapGLES(uhdr_raw_image_t* hdr_intent, uhdr_raw_image_t* sdr_intent,
+                              uhdr_opengl_ctxt_t* opengl_ctxt) {
+  UHDR_TRACE_SCOPE("toneMapGLES");
+  if (!isGLESHdrIntentSupported(hdr_intent)) return unsupportedOnGLES("hdr intent");
+  if (sdr_intent->fmt != UHDR_IMG_FMT_12bppYCbCr420 &&
+      sdr_intent->fmt != UHDR_IMG_FMT_24bppYCbCr444 &&
+      sdr_intent->fmt != UHDR_IMG_FMT_32bppRGBA8888)
+    return unsupportedOnGLES("sdr intent color format");
+
+  ScopedGLESCtxtBinding binding(opengl_ctxt);
+  if (!binding.bound) return unsupportedOnGLES("binding the context on this thread");
+  if (opengl_ctxt->mErrorStatus.error_code != UHDR_CODEC_OK) return opengl_ctxt->mErrorStatus;
+  if (!isGLESTextureSizeSupported(hdr_intent->fmt, hdr_intent->w, hdr_intent->h) ||
+      !isGLESTextureSizeSupported(sdr_intent->fmt, sdr_intent->w, sdr_intent->h))
+    return unsupportedOnGLES("image size");
+
+  GLuint shaderProgram = 0;  // shader program, held by the context
+  GLuint hdrTexture = 0;     // hdr intent texture
+  GLuint sdrTexture = 0;     // sdr intent texture, render target
+  GLuint frameBuffer = 0;
+
+#define RET_IF_ERR()                                           \
+  if (opengl_ctxt->mErrorStatus.error_code != UHDR_CODEC_OK) { \
+    if (frameBuffer) glDeleteFramebuffers(1, &frameBuffer);    \
+    if (hdrTexture) glDeleteTextures(1, &hdrTexture);          \
+    if (sdrTexture) glDeleteTextures(1, &sdrTexture);          \
+    return opengl_ctxt->mErrorStatus;                          \
+  }
+
+  shaderProgram = opengl_ctxt->get_shader_program(
+      vertex_shader.c_str(), getToneMapFragmentShader(hdr_intent, sdr_intent->fmt).c_str());
+  RET_IF_ERR()
+
+  hdrTexture = opengl_ctxt->create_texture(hdr_intent);
+  sdrTexture = opengl_ctxt->create_texture(sdr_intent->fmt, sdr_intent->w, sdr_intent->h, nullptr);
+  RET_IF_ERR()
+
+  frameBuffer = opengl_ctxt->setup_framebuffer(sdrTexture);
+  RET_IF_ERR()
+
+  // yuv planes are rendered stacked in a single channel texture
+  const bool is_yuv = isGLESYuvFormat(sdr_intent->fmt);
+  const unsigned int rows = sdr_intent->fmt == UHDR_IMG_FMT_12bppYCbCr420   ? sdr_intent->h * 3 / 2
+                            : sdr_intent->fmt == UHDR_IMG_FMT_24bppYCbCr444 ? sdr_intent->h * 3
+                                                                            : sdr_intent->h;
+  glViewport(0, 0, sdr_intent->w, rows);
+  glUseProgram(shaderProgram);
+
+  float hdr_white_nits = getReferenceDisplayPeakLuminanceInNits(hdr_intent->ct);
+  float headroom = hdr_white_nits / kSdrWhiteNits;
+  if (!setHdrUniforms(shaderProgram, hdr_intent, UHDR_CG_DISPLAY_P3)) {
+    if (frameBuffer) glDeleteFramebuffers(1, &frameBuffer);
+    if (hdrTexture) glDeleteTextures(1, &hdrTexture);
+    if (sdrTexture) glDeleteTextures(1, &sdrTexture);
+    return unsupportedOnGLES("hdr intent color gamut");
+  }
+  glUniform1f(glGetUniformLocation(shaderProgram, "headroom"), headroom);
+  glUniform1f(glGetUniformLocation(shaderProgram, "hdrScale"),
+              hdr_intent->ct != UHDR_CT_LINEAR ? headroom : 1.0f);
+
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, hdrTexture);
+  glUniform1i(glGetUniformLocation(shaderProgram, "hdrTexture"), 0);
+
+  opengl_ctxt->check_gl_errors("binding values to uniforms");
+  RET_IF_ERR()
+
+  opengl_ctxt->begin_gpu_phase(kGpuShader);
+  glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+  opengl_ctxt->end_gpu_phase();
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  opengl_ctxt->check_gl_errors("tone mapping hdr intent");
+  RET_IF_ERR()
+
+  uhdr_img_fmt_t read_fmt = is_yuv ? UHDR_IMG_FMT_8bppYCbCr400 : UHDR_IMG_FMT_32bppRGBA8888;
+  if (isBufferDataContiguous(sdr_intent)) {
+    opengl_ctxt->read_texture(&sdrTexture, read_fmt, sdr_intent->w, rows, sdr_intent->planes[0]);
+  } else {
+    countSlowPath(opengl_ctxt->mStats, UHDR_SLOW_PATH_BUFFER_COPY);
+    std::vector<uint8_t> buffer((size_t)sdr_intent->w * rows * (is_yuv ? 1 : 4));
+    opengl_ctxt->read_texture(&sdrTexture, read_fmt, sdr_intent->w, rows, buffer.data());
+    copyRawImagePlanes(sdr_intent, buffer.data(), false);
+  }
+  RET_IF_ERR()
+
+  if (frameBuffer) glDeleteFramebuffers(1, &frameBuffer);
+  if (hdrTexture) glDeleteTextures(1, &hdrTexture);
+  if (sdrTexture) glDeleteTextures(1, &sdrTexture);
+#undef RET_IF_ERR
+
+  return opengl_ctxt->mErrorStatus;
+}
+
+uhdr_error_info_t generateGainMapGLES(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* hdr_intent,
+                                      bool sdr_is_601, bool use_luminance, bool multichannel,
+                                      int map_scale_factor,
+                                      uhdr_gainmap_metadata_ext_t* gainmap_metadata,
+                                      uhdr_raw_image_t* gainmap_img, float* gains,
+                                      uhdr_opengl_ctxt_t* opengl_ctxt) {
+  UHDR_TRACE_SCOPE("generateGainMapGLES");
+  if (!isGLESHdrIntentSupported(hdr_intent)) return unsupportedOnGLES("hdr intent");
+  if (!isGLESYuvFormat(sdr_intent->fmt) && sdr_intent->fmt != UHDR_IMG_FMT_32bppRGBA8888)
+    return unsupportedOnGLES("sdr intent color format");
+  if ((sdr_intent->fmt == UHDR_IMG_FMT_12bppYCbCr420 && sdr_intent->h % 2 != 0) ||
+      (sdr_intent->fmt != UHDR_IMG_FMT_24bppYCbCr444 && isGLESYuvFormat(sdr_intent->fmt) &&
+       sdr_intent->w % 2 != 0))
+    return unsupportedOnGLES("odd sdr intent dimensions");
+  LuminanceFn luminanceFn = getLuminanceFn(sdr_intent->cg);
+  if (luminanceFn == nullptr || getYuvToRgbFn(sdr_intent->cg) == nullptr)
+    return unsupportedOnGLES("sdr intent color gamut");
+
+  ScopedGLESCtxtBinding binding(opengl_ctxt);
+  if (!binding.bound) return unsupportedOnGLES("binding the context on this thread");
+  if (opengl_ctxt->mErrorStatus.error_code != UHDR_CODEC_OK) return opengl_ctxt->mErrorStatus;
+  if (!isGLESTextureSizeSupported(hdr_intent->fmt, hdr_intent->w, hdr_intent->h) ||
+      !isGLESTextureSizeSupported(sdr_intent->fmt, sdr_intent->w, sdr_intent->h) ||
+      !isGLESTextureSizeSupported(gainmap_img->fmt, gainmap_img->w, gainmap_img->h))
+    return unsupportedOnGLES("image size");
+  // log2 gains are rendered to a half float target, which gles 3.0 does not require
+  const bool encode = gainmap_metadata != nullptr;
+  if (!encode && !hasGLExtension("GL_EXT_color_buffer_float") &&
+      !hasGLExtension("GL_EXT_color_buffer_half_float"))
+    return unsupportedOnGLES("rendering to half float");
+
+  GLuint shaderProgram = 0;  // shader program, held by the context
+  GLuint sdrTexture = 0;     // sdr intent texture
+  GLuint hdrTexture = 0;     // hdr intent texture
+  GLuint mapTexture = 0;     // gain map texture, render target
+  GLuint frameBuffer = 0;
+
+#define RET_IF_ERR()                                           \
+  if (opengl_ctxt->mErrorStatus.error_code != UHDR_CODEC_OK) { \
+    if (frameBuffer) glDeleteFramebuffers(1, &frameBuffer);    \
+    if (sdrTexture) glDeleteTextures(1, &sdrTexture);          \
+    if (hdrTexture) glDeleteTextures(1, &hdrTexture);          \
+    if (mapTexture) glDeleteTextures(1, &mapTexture);          \
+    return opengl_ctxt->mErrorStatus;                          \
+  }
+
+  shaderProgram = opengl_ctxt->get_shader_program(
+      vertex_shader.c_str(), getGenerateGainMapFragmentShader(sdr_intent, hdr_intent,
+                                                              use_luminance, multichannel, encode)
+                                 .c_str());
+  RET_IF_ERR()
+
+  // single channel gains are written to the red channel of an r8 target when encoded, the other
+  // targets are rgba
+  uhdr_img_fmt_t map_fmt = !encode        ? UHDR_IMG_FMT_64bppRGBAHalfFloat
+                           : multichannel ? UHDR_IMG_FMT_32bppRGBA8888
+                                          : UHDR_IMG_FMT_8bppYCbCr400;
+  sdrTexture = opengl_ctxt->create_texture(sdr_intent);
+  hdrTexture = opengl_ctxt->create_texture(hdr_intent);
+  mapTexture = opengl_ctxt->create_texture(map_fmt, gainmap_img->w, gainmap_img->h, nullptr);
+  RET_IF_ERR()
+
+  frameBuffer = opengl_ctxt->setup_framebuffer(mapTexture);
+  RET_IF_ERR()
+
+  glViewport(0, 0, gainmap_img->w, gainmap_img->h);
+  glUseProgram(shaderProgram);
+
+  float sdr_yuv_to_rgb[4];
+  getYuvToRgbCoeffs(sdr_is_601 ? UHDR_CG_DISPLAY_P3 : sdr_intent->cg, sdr_yuv_to_rgb);
+  float luminance[3];
+  for (int i = 0; i < 3; i++) {
+    Color unit = {{{i == 0 ? 1.0f : 0.0f, i == 1 ? 1.0f : 0.0f, i == 2 ? 1.0f : 0.0f}}};
+    luminance[i] = luminanceFn(unit);
+  }
+  float hdr_white_nits = getReferenceDisplayPeakLuminanceInNits(hdr_intent->ct);
+  if (!setHdrUniforms(shaderProgram, hdr_intent, sdr_intent->cg)) {
+    if (frameBuffer) glDeleteFramebuffers(1, &frameBuffer);
+    if (sdrTexture) glDeleteTextures(1, &sdrTexture);
+    if (hdrTexture) glDeleteTextures(1, &hdrTexture);
+    if (mapTexture) glDeleteTextures(1, &mapTexture);
+    return unsupportedOnGLES("hdr intent color gamut");
+  }
+  glUniform1i(glGetUniformLocation(shaderProgram, "mapScale"), map_scale_factor);
+  glUniform4fv(glGetUniformLocation(shaderProgram, "sdrYuvToRgb"), 1, sdr_yuv_to_rgb);
+  glUniform3fv(glGetUniformLocation(shaderProgram, "luminance"), 1, luminance);
+  glUniform1f(glGetUniformLocation(shaderProgram, "sdrToNits"), kSdrWhiteNits);
+  glUniform1f(glGetUniformLocation(shaderProgram, "hdrToNits"),
+              hdr_intent->ct == UHDR_CT_LINEAR ? kSdrWhiteNits : hdr_white_nits);
+  if (encode) {
+    glUniform1f(glGetUniformLocation(shaderProgram, "minBoost"),
+                gainmap_metadata->min_content_boost);
+    glUniform1f(glGetUniformLocation(shaderProgram, "maxBoost"),
+                gainmap_metadata->max_content_boost);
+    glUniform1f(glGetUniformLocation(shaderProgram, "logMinBoost"),
+                log2(gainmap_metadata->min_content_boost));
+    glUniform1f(glGetUniformLocation(shaderProgram, "logMaxBoost"),
+                log2(gainmap_metadata->max_content_boost));
+    glUniform1f(glGetUniformLocation(shaderProgram, "gamma"), gainmap_metadata->gamma);
+  } else {
+    glUniform1f(glGetUniformLocation(shaderProgram, "sdrOffset"), kSdrOffset);
+    glUniform1f(glGetUniformLocation(shaderProgram, "hdrOffset"), kHdrOffset);
+  }
+
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, sdrTexture);
+  glUniform1i(glGetUniformLocation(shaderProgram, "sdrTexture"), 0);
+
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, hdrTexture);
+  glUniform1i(glGetUniformLocation(shaderProgram, "hdrTexture"), 1);
+
+  opengl_ctxt->check_gl_errors("binding values to uniforms");
+  RET_IF_ERR()
+
+  opengl_ctxt->begin_gpu_phase(kGpuShader);
+  glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+  opengl_ctxt->end_gpu_phase();
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  opengl_ctxt->check_gl_errors("generating gain map");
+  RET_IF_ERR()
+
+  const size_t map_pixels = (size_t)gainmap_img->w * gainmap_img->h;
+  if (!encode) {
+    std::vector<uint64_t> buffer(map_pixels);
+    opengl_ctxt->read_texture(&mapTexture, map_fmt, gainmap_img->w, gainmap_img->h,
+                              buffer.data());
+    const int channels = multichannel ? 3 : 1;
+    for (size_t i = 0; i < map_pixels; i++) {
+      for (int c = 0; c < channels; c++) {
+        gains[i * channels + c] = halfToFloat((buffer[i] >> (16 * c)) & 0xffff);
+      }
+    }
+  } else if (multichannel) {
+    std::vector<uint32_t> buffer(map_pixels);
+    opengl_ctxt->read_texture(&mapTexture, map_fmt, gainmap_img->w, gainmap_img->h,
+                              buffer.data());
+    for (unsigned int y = 0; y < gainmap_img->h; y++) {
+      uint8_t* dst = static_cast<uint8_t*>(gainmap_img->planes[UHDR_PLANE_PACKED]) +
+                     (size_t)y * gainmap_img->stride[UHDR_PLANE_PACKED] * 3;
+      const uint32_t* src = buffer.data() + (size_t)y * gainmap_img->w;
+      for (unsigned int x = 0; x < gainmap_img->w; x++) {
+        dst[x * 3] = src[x] & 0xff;
+        dst[x * 3 + 1] = (src[x] >> 8) & 0xff;
+        dst[x * 3 + 2] = (src[x] >> 16) & 0xff;
+      }
+    }
+  } else if (isBufferDataContiguous(gainmap_img)) {
+    opengl_ctxt->read_texture(&mapTexture, map_fmt, gainmap_img->w, gainmap_img->h,
+                              gainmap_img->planes[UHDR_PLANE_Y]);
+  } else {
+    countSlowPath(opengl_ctxt->mStats, UHDR_SLOW_PATH_BUFFER_COPY);
+    std::vector<uint8_t> buffer(map_pixels);
+    opengl_ctxt->read_texture(&mapTexture, map_fmt, gainmap_img->w, gainmap_img->h,
+                              buffer.data());
+    copyRawImagePlanes(gainmap_img, buffer.data(), false);
+  }
+  RET_IF_ERR()
+
+  if (frameBuffer) glDeleteFramebuffers(1, &frameBuffer);
+  if (sdrTexture) glDeleteTextures(1, &sdrTexture);
+  if (hdrTexture) glDeleteTextures(1, &hdrTexture);
+  if (mapTexture) glDeleteTextures(1, &mapTexture);
+#undef RET_IF_ERR
+
+  return opengl_ctxt->mErrorStatus;
+}
+
+}  // namespace ultrahdr
@@ -14,10 +14,141 @@
  * limitations under the License.
  */
 
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
 #include "ultrahdr/ultrahdrcommon.h"
 
+#include <EGL/eglext.h>  // after egl.h, which it depends on
+
 namespace ultrahdr {
 
+namespace {
+
+// The contexts of the library share one group, anchored by a root context that is never made
+// current. A program compiled for one codec instance thus serves all others, and contexts
+// released by codec instances are kept for the next ones instead of being destroyed.
+struct uhdr_gl_pooled_ctxt {
+  EGLContext context;
+  EGLSurface surface;
+  GLuint vao, vbo, ebo;
+};
+
+struct uhdr_gl_share_group {
+  std::mutex mutex;
+  EGLDisplay display = EGL_NO_DISPLAY;
+  EGLConfig config = 0;
+  EGLContext root = EGL_NO_CONTEXT;
+  bool surfaceless = false;  // contexts are made current without a pbuffer surface
+  std::vector<uhdr_gl_pooled_ctxt> idle_contexts;
+  std::map<std::string, std::vector<GLuint>> idle_programs;  // keyed by shader sources
+  std::string program_cache_dir;
+};
+
+constexpr size_t kMaxIdleContexts = 4;
+constexpr size_t kMaxIdlePrograms = 4;  // per shader variant
+
+// lives until exit, egl objects are reclaimed with the process
+uhdr_gl_share_group& get_share_group() {
+  static uhdr_gl_share_group* group = new uhdr_gl_share_group();
+  return *group;
+}
+
+bool has_egl_extension(const char* extensions, const char* name) {
+  if (extensions == nullptr) return false;
+  const size_t len = strlen(name);
+  for (const char* p = strstr(extensions, name); p != nullptr; p = strstr(p + len, name)) {
+    if ((p == extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0')) return true;
+  }
+  return false;
+}
+
+// Headless hosts have no default display, a display of the surfaceless platform is opened then.
+// Returns an initialized display or EGL_NO_DISPLAY.
+EGLDisplay open_display() {
+  EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  if (display != EGL_NO_DISPLAY && eglInitialize(display, NULL, NULL)) return display;
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+  const char* client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+  if (!has_egl_extension(client_extensions, "EGL_MESA_platform_surfaceless")) {
+    return EGL_NO_DISPLAY;
+  }
+  PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+      reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+          eglGetProcAddress("eglGetPlatformDisplayEXT"));
+  if (get_platform_display == nullptr) return EGL_NO_DISPLAY;
+  display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+  if (display != EGL_NO_DISPLAY && eglInitialize(display, NULL, NULL)) return display;
+#endif
+  return EGL_NO_DISPLAY;
+}
+
+// program binaries are only valid for the driver that produced them
+std::string program_binary_path(const std::string& dir, const std::string& key) {
+  const char* renderer = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+  const char* version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+  std::string id = key + (renderer ? renderer : "") + (version ? version : "");
+  uint64_t hash = 0xcbf29ce484222325ull;  // fnv-1a
+  for (unsigned char c : id) hash = (hash ^ c) * 0x100000001b3ull;
+  char name[32];
+  snprintf(name, sizeof name, "/uhdr_%016llx.bin", (unsigned long long)hash);
+  return dir + name;
+}
+
+GLuint load_program_binary(const std::string& path) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == nullptr) return 0;
+  uint32_t header[2];  // binary format, binary length
+  std::vector<uint8_t> binary;
+  if (fread(header, sizeof header, 1, file) == 1 && header[1] > 0) {
+    binary.resize(header[1]);
+    if (fread(binary.data(), binary.size(), 1, file) != 1) binary.clear();
+  }
+  fclose(file);
+  if (binary.empty()) return 0;
+
+  GLuint program = glCreateProgram();
+  glProgramBinary(program, header[0], binary.data(), (GLsizei)binary.size());
+  GLint linkStatus = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
+  if (linkStatus != GL_TRUE) {
+    glDeleteProgram(program);
+    program = 0;
+  }
+  glGetError();  // a rejected binary is not an error of the context
+  return program;
+}
+
+void store_program_binary(const std::string& path, GLuint program) {
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) return;
+  std::vector<uint8_t> binary(length);
+  GLenum format = 0;
+  glGetProgramBinary(program, length, &length, &format, binary.data());
+  if (glGetError() != GL_NO_ERROR || length <= 0) return;
+
+  // written aside and renamed, so that concurrent processes never load a partial binary
+  std::string tmp_path = path + ".tmp";
+  FILE* file = fopen(tmp_path.c_str(), "wb");
+  if (file == nullptr) return;
+  uint32_t header[2] = {format, (uint32_t)length};
+  bool ok = fwrite(header, sizeof header, 1, file) == 1 &&
+            fwrite(binary.data(), length, 1, file) == 1;
+  ok = fclose(file) == 0 && ok;
+  if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) remove(tmp_path.c_str());
+}
+
+}  // namespace
+
+void set_gl_program_cache_dir(const char* dir) {
+  uhdr_gl_share_group& group = get_share_group();
+  std::lock_guard<std::mutex> lock(group.mutex);
+  group.program_cache_dir = dir != nullptr ? dir : "";
+}
+
 uhdr_opengl_ctxt::uhdr_opengl_ctxt() {
   mEGLDisplay = EGL_NO_DISPLAY;
   mEGLContext = EGL_NO_CONTEXT;
@@ -29,14 +160,29 @@ uhdr_opengl_ctxt::uhdr_opengl_ctxt() {
   mErrorStatus = g_no_error;
   mDecodedImgTexture = 0;
   mGainmapImgTexture = 0;
+  mUnpackBuffer = 0;
+  for (int i = 0; i < 2; i++) {
+    mPackBuffer[i] = 0;
+    mPackFence[i] = 0;
+    mPackSize[i] = 0;
+  }
   for (int i = 0; i < UHDR_RESIZE + 1; i++) {
     mShaderProgram[i] = 0;
   }
+  mPooled = false;
+  mStats = nullptr;
+  mTimerQuery = -1;
+  mGpuPhase = -1;
+  mGpuPhaseStart = 0.0;
+  mPrevDisplay = EGL_NO_DISPLAY;
+  mPrevContext = EGL_NO_CONTEXT;
+  mPrevDrawSurface = EGL_NO_SURFACE;
+  mPrevReadSurface = EGL_NO_SURFACE;
 }
 
 uhdr_opengl_ctxt::~uhdr_opengl_ctxt() { delete_opengl_ctxt(); }
 
-void uhdr_opengl_ctxt::init_opengl_ctxt() {
+void uhdr_opengl_ctxt::init_opengl_ctxt(EGLContext share_ctxt) {
 #define RET_IF_TRUE(cond, msg)                                          \
   {                                                                     \
     if (cond) {                                                         \
@@ -48,32 +194,85 @@ void uhdr_opengl_ctxt::init_opengl_ctxt() {
     }                                                                   \
   }
 
-  mEGLDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
-  RET_IF_TRUE(mEGLDisplay == EGL_NO_DISPLAY, "eglGetDisplay() failed")
-
-  RET_IF_TRUE(!eglInitialize(mEGLDisplay, NULL, NULL), "eglInitialize() failed")
-
-  EGLint num_config;
-  EGLint attribs[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT,
-                      EGL_NONE};
-  RET_IF_TRUE(!eglChooseConfig(mEGLDisplay, attribs, &mEGLConfig, 1, &num_config) || num_config < 1,
-              "eglChooseConfig() failed")
-
   EGLint context_attribs[] = {EGL_CONTEXT_CLIENT_VERSION, 3, EGL_NONE};
-  mEGLContext = eglCreateContext(mEGLDisplay, mEGLConfig, EGL_NO_CONTEXT, context_attribs);
-  RET_IF_TRUE(mEGLContext == EGL_NO_CONTEXT, "eglCreateContext() failed")
+  uhdr_gl_share_group& group = get_share_group();
+  {
+    std::lock_guard<std::mutex> lock(group.mutex);
+    if (group.root == EGL_NO_CONTEXT) {
+      EGLDisplay display = open_display();
+      RET_IF_TRUE(display == EGL_NO_DISPLAY, "eglInitialize() failed")
+
+      // all rendering goes to framebuffer objects, the surface only serves eglMakeCurrent()
+      bool surfaceless = has_egl_extension(eglQueryString(display, EGL_EXTENSIONS),
+                                           "EGL_KHR_surfaceless_context");
+      EGLint num_config;
+      EGLint attribs[] = {EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+                          EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT, EGL_NONE};
+      EGLConfig config;
+      RET_IF_TRUE(!eglChooseConfig(display, attribs, &config, 1, &num_config) || num_config < 1,
+                  "eglChooseConfig() failed")
+
+      group.root = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+      RET_IF_TRUE(group.root == EGL_NO_CONTEXT, "eglCreateContext() failed")
+      group.display = display;
+      group.config = config;
+      group.surfaceless = surfaceless;
+    }
+    mEGLDisplay = group.display;
+    mEGLConfig = group.config;
+    mPooled = share_ctxt == EGL_NO_CONTEXT;
+    if (mPooled && !group.idle_contexts.empty()) {
+      uhdr_gl_pooled_ctxt& idle = group.idle_contexts.back();
+      mEGLContext = idle.context;
+      mEGLSurface = idle.surface;
+      mQuadVAO = idle.vao;
+      mQuadVBO = idle.vbo;
+      mQuadEBO = idle.ebo;
+      group.idle_contexts.pop_back();
+    }
+  }
 
-  EGLint pbuffer_attribs[] = {
-      EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE,
-  };
-  mEGLSurface = eglCreatePbufferSurface(mEGLDisplay, mEGLConfig, pbuffer_attribs);
-  RET_IF_TRUE(mEGLSurface == EGL_NO_SURFACE, "eglCreatePbufferSurface() failed")
+  if (mEGLContext == EGL_NO_CONTEXT) {
+    mEGLContext = eglCreateContext(mEGLDisplay, mEGLConfig, mPooled ? group.root : share_ctxt,
+                                   context_attribs);
+    RET_IF_TRUE(mEGLContext == EGL_NO_CONTEXT, "eglCreateContext() failed")
+
+    if (!group.surfaceless) {
+      EGLint pbuffer_attribs[] = {
+          EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE,
+      };
+      mEGLSurface = eglCreatePbufferSurface(mEGLDisplay, mEGLConfig, pbuffer_attribs);
+      RET_IF_TRUE(mEGLSurface == EGL_NO_SURFACE, "eglCreatePbufferSurface() failed")
+    }
+  }
 
-  RET_IF_TRUE(!eglMakeCurrent(mEGLDisplay, mEGLSurface, mEGLSurface, mEGLContext),
-              "eglMakeCurrent() failed")
+  RET_IF_TRUE(!make_current(), "eglMakeCurrent() failed")
 #undef RET_IF_TRUE
 
-  setup_quad();
+  if (!mQuadVAO) setup_quad();
+}
+
+bool uhdr_opengl_ctxt::make_current() {
+  if (eglGetCurrentContext() == mEGLContext) return true;
+  mPrevDisplay = eglGetCurrentDisplay();
+  mPrevContext = eglGetCurrentContext();
+  mPrevDrawSurface = eglGetCurrentSurface(EGL_DRAW);
+  mPrevReadSurface = eglGetCurrentSurface(EGL_READ);
+  return eglMakeCurrent(mEGLDisplay, mEGLSurface, mEGLSurface, mEGLContext) == EGL_TRUE;
+}
+
+void uhdr_opengl_ctxt::release_current() {
+  if (mEGLContext == EGL_NO_CONTEXT || eglGetCurrentContext() != mEGLContext) return;
+  collect_gpu_times();
+  if (mPrevContext != EGL_NO_CONTEXT) {
+    eglMakeCurrent(mPrevDisplay, mPrevDrawSurface, mPrevReadSurface, mPrevContext);
+  } else {
+    eglMakeCurrent(mEGLDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  }
+  mPrevDisplay = EGL_NO_DISPLAY;
+  mPrevContext = EGL_NO_CONTEXT;
+  mPrevDrawSurface = EGL_NO_SURFACE;
+  mPrevReadSurface = EGL_NO_SURFACE;
 }
 
 GLuint uhdr_opengl_ctxt::compile_shader(GLenum type, const char* source) {
@@ -153,6 +352,7 @@ GLuint uhdr_opengl_ctxt::create_shader_program(const char* vertex_source,
   glAttachShader(program, fragmentShader);
   glDeleteShader(fragmentShader);
 
+  if (mPooled) glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
   glLinkProgram(program);
   GLint linkStatus;
   glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
@@ -180,38 +380,144 @@ GLuint uhdr_opengl_ctxt::create_shader_program(const char* vertex_source,
   return program;
 }
 
-GLuint uhdr_opengl_ctxt::create_texture(uhdr_img_fmt_t fmt, int w, int h, void* data) {
+GLuint uhdr_opengl_ctxt::get_shader_program(const char* vertex_source,
+                                            const char* fragment_source) {
+  std::string key = std::string(vertex_source) + fragment_source;
+  for (const auto& it : mPrograms) {
+    if (it.first == key) return it.second;
+  }
+
+  GLuint program = 0;
+  std::string binary_path;
+  if (mPooled) {
+    uhdr_gl_share_group& group = get_share_group();
+    std::lock_guard<std::mutex> lock(group.mutex);
+    auto it = group.idle_programs.find(key);
+    if (it != group.idle_programs.end() && !it->second.empty()) {
+      program = it->second.back();
+      it->second.pop_back();
+    } else if (!group.program_cache_dir.empty()) {
+      binary_path = program_binary_path(group.program_cache_dir, key);
+    }
+  }
+  if (program == 0 && !binary_path.empty()) program = load_program_binary(binary_path);
+  if (program == 0) {
+    program = create_shader_program(vertex_source, fragment_source);
+    if (program == 0) return 0;
+    if (!binary_path.empty()) store_program_binary(binary_path, program);
+  }
+  mPrograms.emplace_back(std::move(key), program);
+  return program;
+}
+
+// Planes of a raw image in the order create_texture() stacks them. Widths, heights and strides
+// are in samples of bytes_per_sample bytes.
+static int getRawImagePlanes(uhdr_raw_image_t* img, unsigned int w[3], unsigned int h[3],
+                             size_t* bytes_per_sample) {
+  int planes = 3;
+  *bytes_per_sample = 1;
+  for (int i = 0; i < 3; i++) w[i] = img->w, h[i] = img->h;
+  switch (img->fmt) {
+    case UHDR_IMG_FMT_12bppYCbCr420:
+      w[1] = w[2] = img->w / 2, h[1] = h[2] = img->h / 2;
+      break;
+    case UHDR_IMG_FMT_16bppYCbCr422:
+      w[1] = w[2] = img->w / 2;
+      break;
+    case UHDR_IMG_FMT_24bppYCbCr444:
+      break;
+    case UHDR_IMG_FMT_24bppYCbCrP010:
+      planes = 2, h[1] = img->h / 2, *bytes_per_sample = 2;
+      break;
+    case UHDR_IMG_FMT_30bppYCbCr444:
+      *bytes_per_sample = 2;
+      break;
+    case UHDR_IMG_FMT_8bppYCbCr400:
+      planes = 1;
+      break;
+    case UHDR_IMG_FMT_24bppRGB888:
+      planes = 1, *bytes_per_sample = 3;
+      break;
+    case UHDR_IMG_FMT_64bppRGBAHalfFloat:
+      planes = 1, *bytes_per_sample = 8;
+      break;
+    default:
+      planes = 1, *bytes_per_sample = 4;
+      break;
+  }
+  return planes;
+}
+
+void copyRawImagePlanes(uhdr_raw_image_t* img, uint8_t* buffer, bool to_buffer) {
+  unsigned int w[3], h[3];
+  size_t bytes;
+  int planes = getRawImagePlanes(img, w, h, &bytes);
+  for (int i = 0; i < planes; i++) {
+    uint8_t* plane = static_cast<uint8_t*>(img->planes[i]);
+    for (unsigned int y = 0; y < h[i]; y++) {
+      uint8_t* row = plane + (size_t)y * img->stride[i] * bytes;
+      if (to_buffer) {
+        memcpy(buffer, row, w[i] * bytes);
+      } else {
+        memcpy(row, buffer, w[i] * bytes);
+      }
+      buffer += w[i] * bytes;
+    }
+  }
+}
+
+// Creates the texture of create_texture() from data, or from the planes of img with their strides
+static GLuint create_texture_from(uhdr_opengl_ctxt* ctxt, uhdr_img_fmt_t fmt, int w, int h,
+                                  const void* data, uhdr_raw_image_t* img) {
   GLuint textureID;
+  GLint internalFormat;
+  GLenum format, type;
+  size_t size = (size_t)w * h;
 
-  glGenTextures(1, &textureID);
-  glBindTexture(GL_TEXTURE_2D, textureID);
   switch (fmt) {
     case UHDR_IMG_FMT_12bppYCbCr420:
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, w, h * 3 / 2, 0, GL_RED, GL_UNSIGNED_BYTE, data);
+      internalFormat = GL_R8, format = GL_RED, type = GL_UNSIGNED_BYTE;
+      h = h * 3 / 2;
+      size = (size_t)w * h;
       break;
     case UHDR_IMG_FMT_8bppYCbCr400:
-      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, w, h, 0, GL_RED, GL_UNSIGNED_BYTE, data);
-      glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+      internalFormat = GL_R8, format = GL_RED, type = GL_UNSIGNED_BYTE;
       break;
     case UHDR_IMG_FMT_32bppRGBA8888:
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+      internalFormat = GL_RGBA, format = GL_RGBA, type = GL_UNSIGNED_BYTE;
+      size *= 4;
       break;
     case UHDR_IMG_FMT_64bppRGBAHalfFloat:
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, w, h, 0, GL_RGBA, GL_HALF_FLOAT, data);
+      internalFormat = GL_RGBA16F, format = GL_RGBA, type = GL_HALF_FLOAT;
+      size *= 8;
       break;
     case UHDR_IMG_FMT_32bppRGBA1010102:
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB10_A2, w, h, 0, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV,
-                   data);
+      internalFormat = GL_RGB10_A2, format = GL_RGBA, type = GL_UNSIGNED_INT_2_10_10_10_REV;
+      size *= 4;
       break;
     case UHDR_IMG_FMT_24bppRGB888:
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+      internalFormat = GL_RGB, format = GL_RGB, type = GL_UNSIGNED_BYTE;
+      size *= 3;
       break;
     case UHDR_IMG_FMT_24bppYCbCr444:
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, w, h * 3, 0, GL_RED, GL_UNSIGNED_BYTE, data);
+      internalFormat = GL_R8, format = GL_RED, type = GL_UNSIGNED_BYTE;
+      h = h * 3;
+      size = (size_t)w * h;
       break;
     case UHDR_IMG_FMT_16bppYCbCr422:
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, w, h * 2, 0, GL_RED, GL_UNSIGNED_BYTE, data);
+      internalFormat = GL_R8, format = GL_RED, type = GL_UNSIGNED_BYTE;
+      h = h * 2;
+      size = (size_t)w * h;
+      break;
+    case UHDR_IMG_FMT_24bppYCbCrP010:
+      internalFormat = GL_R16UI, format = GL_RED_INTEGER, type = GL_UNSIGNED_SHORT;
+      h = h * 3 / 2;
+      size = (size_t)w * h * 2;
+      break;
+    case UHDR_IMG_FMT_30bppYCbCr444:
+      internalFormat = GL_R16UI, format = GL_RED_INTEGER, type = GL_UNSIGNED_SHORT;
+      h = h * 3;
+      size = (size_t)w * h * 2;
       break;
     case UHDR_IMG_FMT_16bppYCbCr440:
       [[fallthrough]];
@@ -219,23 +525,62 @@ GLuint uhdr_opengl_ctxt::create_texture(uhdr_img_fmt_t fmt, int w, int h, void*
       [[fallthrough]];
     case UHDR_IMG_FMT_10bppYCbCr410:
       [[fallthrough]];
-    case UHDR_IMG_FMT_30bppYCbCr444:
-      [[fallthrough]];
     default:
-      mErrorStatus.error_code = UHDR_CODEC_INVALID_PARAM;
-      mErrorStatus.has_detail = 1;
-      snprintf(mErrorStatus.detail, sizeof mErrorStatus.detail,
+      ctxt->mErrorStatus.error_code = UHDR_CODEC_INVALID_PARAM;
+      ctxt->mErrorStatus.has_detail = 1;
+      snprintf(ctxt->mErrorStatus.detail, sizeof ctxt->mErrorStatus.detail,
                "unsupported color format option in create_texture(), color format %d", fmt);
-      glDeleteTextures(1, &textureID);
       return 0;
   }
+
+  // stage the pixels in a pixel buffer, the texture then sources them by dma instead of the
+  // driver copying and converting client memory before glTexImage2D() returns. The buffer is
+  // orphaned on every upload, so the copy never waits on an earlier upload still in flight.
+  // Planes with strides are packed while staging, which is the one copy a contiguous image takes.
+  std::vector<uint8_t> packed;
+  const void* pixels = data;
+  const bool upload = data != nullptr || img != nullptr;
+  if (upload) {
+    ctxt->begin_gpu_phase(kGpuUpload);
+    if (!ctxt->mUnpackBuffer) glGenBuffers(1, &ctxt->mUnpackBuffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ctxt->mUnpackBuffer);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    void* staging = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                     GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (staging != nullptr) {
+      if (img != nullptr) {
+        copyRawImagePlanes(img, static_cast<uint8_t*>(staging), true);
+      } else {
+        memcpy(staging, data, size);
+      }
+      if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER)) pixels = nullptr;
+      else if (img != nullptr) staging = nullptr;  // contents are undefined, pack them again
+    }
+    if (img != nullptr && staging == nullptr) {
+      packed.resize(size);
+      copyRawImagePlanes(img, packed.data(), true);
+      pixels = packed.data();
+    }
+    if (pixels != nullptr) glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  }
+
+  glGenTextures(1, &textureID);
+  glBindTexture(GL_TEXTURE_2D, textureID);
+  // rows of the single channel formats are not padded to 4 bytes
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, w, h, 0, format, type, pixels);
+  if (upload) ctxt->end_gpu_phase();
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  // integer textures are incomplete with linear filtering
+  GLint filter = format == GL_RED_INTEGER ? GL_NEAREST : GL_LINEAR;
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
 
-  check_gl_errors("create_texture()");
-  if (mErrorStatus.error_code != UHDR_CODEC_OK) {
+  ctxt->check_gl_errors("create_texture()");
+  if (ctxt->mErrorStatus.error_code != UHDR_CODEC_OK) {
     glDeleteTextures(1, &textureID);
     return 0;
   }
@@ -243,6 +588,87 @@ GLuint uhdr_opengl_ctxt::create_texture(uhdr_img_fmt_t fmt, int w, int h, void*
   return textureID;
 }
 
+GLuint uhdr_opengl_ctxt::create_texture(uhdr_img_fmt_t fmt, int w, int h, void* data) {
+  return create_texture_from(this, fmt, w, h, data, nullptr);
+}
+
+GLuint uhdr_opengl_ctxt::create_texture(uhdr_raw_image_t* img) {
+  if (isBufferDataContiguous(img)) {
+    return create_texture_from(this, img->fmt, img->w, img->h, img->planes[0], nullptr);
+  }
+  countSlowPath(mStats, UHDR_SLOW_PATH_BUFFER_COPY);
+  return create_texture_from(this, img->fmt, img->w, img->h, nullptr, img);
+}
+
+// GL_EXT_disjoint_timer_query, gles 3.0 itself reads query results as 32 bits only
+#ifndef GL_TIME_ELAPSED_EXT
+#define GL_TIME_ELAPSED_EXT 0x88BF
+#endif
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
+typedef void(GL_APIENTRY* get_query_object_ui64_fn)(GLuint id, GLenum pname, GLuint64* params);
+
+static get_query_object_ui64_fn get_query_object_ui64() {
+  static const get_query_object_ui64_fn fn =
+      reinterpret_cast<get_query_object_ui64_fn>(eglGetProcAddress("glGetQueryObjectui64vEXT"));
+  return fn;
+}
+
+void uhdr_opengl_ctxt::begin_gpu_phase(GpuPhase phase) {
+  if (mStats == nullptr) return;
+  end_gpu_phase();
+  if (mTimerQuery < 0) {
+    const char* exts = reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+    mTimerQuery = exts != nullptr && strstr(exts, "GL_EXT_disjoint_timer_query") != nullptr &&
+                          get_query_object_ui64() != nullptr
+                      ? 1
+                      : 0;
+  }
+  mGpuPhase = phase;
+  if (mTimerQuery) {
+    GLuint query = 0;
+    glGenQueries(1, &query);
+    glBeginQuery(GL_TIME_ELAPSED_EXT, query);
+    mTimerQueries.emplace_back(phase, query);
+  } else {
+    // work queued before the phase is not counted to it
+    glFinish();
+    mGpuPhaseStart = CodecStats::wallMs();
+  }
+}
+
+void uhdr_opengl_ctxt::end_gpu_phase() {
+  if (mGpuPhase < 0) return;
+  if (mTimerQuery) {
+    glEndQuery(GL_TIME_ELAPSED_EXT);
+  } else if (mStats != nullptr) {
+    glFinish();
+    mStats->addGpuTime(static_cast<GpuPhase>(mGpuPhase), CodecStats::wallMs() - mGpuPhaseStart,
+                       false);
+  }
+  mGpuPhase = -1;
+}
+
+void uhdr_opengl_ctxt::collect_gpu_times() {
+  end_gpu_phase();
+  if (mTimerQueries.empty()) return;
+  std::vector<GLuint64> elapsed(mTimerQueries.size(), 0);
+  for (size_t i = 0; i < mTimerQueries.size(); i++) {
+    get_query_object_ui64()(mTimerQueries[i].second, GL_QUERY_RESULT, &elapsed[i]);
+    glDeleteQueries(1, &mTimerQueries[i].second);
+  }
+  // set if the gpu clock changed or the like while the queries ran, reading it clears it
+  GLint disjoint = 0;
+  glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+  if (mStats != nullptr && !disjoint) {
+    for (size_t i = 0; i < mTimerQueries.size(); i++) {
+      mStats->addGpuTime(static_cast<GpuPhase>(mTimerQueries[i].first), elapsed[i] / 1e6, true);
+    }
+  }
+  mTimerQueries.clear();
+}
+
 void uhdr_opengl_ctxt::setup_quad() {
   const float quadVertices[] = { // Positions    // TexCoords
                                 -1.0f,  1.0f,    0.0f, 1.0f,
@@ -338,69 +764,146 @@ void uhdr_opengl_ctxt::check_gl_errors(const char* msg) {
 }
 
 void uhdr_opengl_ctxt::read_texture(GLuint* texture, uhdr_img_fmt_t fmt, int w, int h, void* data) {
-  GLuint frm_buffer;
-  glGenFramebuffers(1, &frm_buffer);
-  glBindFramebuffer(GL_FRAMEBUFFER, frm_buffer);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *texture, 0);
+  begin_read_texture(texture, fmt, w, h, 0);
+  end_read_texture(0, data);
+}
+
+void uhdr_opengl_ctxt::begin_read_texture(GLuint* texture, uhdr_img_fmt_t fmt, int w, int h,
+                                          int slot) {
+  size_t size = (size_t)w * h;
+  GLenum format = GL_RGBA, type;
   if (fmt == UHDR_IMG_FMT_32bppRGBA8888) {
-    glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, data);
+    type = GL_UNSIGNED_BYTE;
+    size *= 4;
   } else if (fmt == UHDR_IMG_FMT_32bppRGBA1010102) {
-    glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV, data);
+    type = GL_UNSIGNED_INT_2_10_10_10_REV;
+    size *= 4;
   } else if (fmt == UHDR_IMG_FMT_64bppRGBAHalfFloat) {
-    glReadPixels(0, 0, w, h, GL_RGBA, GL_HALF_FLOAT, data);
+    type = GL_HALF_FLOAT;
+    size *= 8;
   } else if (fmt == UHDR_IMG_FMT_8bppYCbCr400) {
-    glPixelStorei(GL_PACK_ALIGNMENT, 1);
-    glReadPixels(0, 0, w, h, GL_RED, GL_UNSIGNED_BYTE, data);
-    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    format = GL_RED;
+    type = GL_UNSIGNED_BYTE;
+  } else {
+    return;
   }
+
+  GLuint frm_buffer;
+  glGenFramebuffers(1, &frm_buffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, frm_buffer);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *texture, 0);
+  if (!mPackBuffer[slot]) glGenBuffers(1, &mPackBuffer[slot]);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, mPackBuffer[slot]);
+  glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+  if (format == GL_RED) glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  begin_gpu_phase(kGpuReadback);
+  glReadPixels(0, 0, w, h, format, type, nullptr);
+  end_gpu_phase();
+  if (format == GL_RED) glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  if (mPackFence[slot]) glDeleteSync(mPackFence[slot]);
+  mPackFence[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  mPackSize[slot] = size;
+  glFlush();
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
   glDeleteFramebuffers(1, &frm_buffer);
 }
 
+void uhdr_opengl_ctxt::end_read_texture(int slot, void* data) {
+  if (!mPackFence[slot]) return;
+  glClientWaitSync(mPackFence[slot], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+  glDeleteSync(mPackFence[slot]);
+  mPackFence[slot] = 0;
+
+  // the wait is gpu work timed by the phases, the copy out of the buffer is timed here
+  const double start = mStats != nullptr ? CodecStats::wallMs() : 0.0;
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, mPackBuffer[slot]);
+  void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, mPackSize[slot], GL_MAP_READ_BIT);
+  if (pixels != nullptr) {
+    memcpy(data, pixels, mPackSize[slot]);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  } else {
+    mErrorStatus.error_code = UHDR_CODEC_ERROR;
+    mErrorStatus.has_detail = 1;
+    snprintf(mErrorStatus.detail, sizeof mErrorStatus.detail,
+             "glMapBufferRange() failed, received gl error code 0x%x", glGetError());
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  if (mStats != nullptr) {
+    mStats->addGpuTime(kGpuReadback, CodecStats::wallMs() - start, mTimerQuery == 1);
+  }
+  check_gl_errors("end_read_texture()");
+}
+
 void uhdr_opengl_ctxt::reset_opengl_ctxt() {
   delete_opengl_ctxt();
   mErrorStatus = g_no_error;
 }
 
 void uhdr_opengl_ctxt::delete_opengl_ctxt() {
-  if (mQuadVAO) {
-    glDeleteVertexArrays(1, &mQuadVAO);
-    mQuadVAO = 0;
-  }
-  if (mQuadVBO) {
-    glDeleteBuffers(1, &mQuadVBO);
-    mQuadVBO = 0;
-  }
-  if (mQuadEBO) {
-    glDeleteBuffers(1, &mQuadEBO);
-    mQuadEBO = 0;
-  }
-  if (mEGLSurface != EGL_NO_SURFACE) {
-    eglDestroySurface(mEGLDisplay, mEGLSurface);
-    mEGLSurface = EGL_NO_SURFACE;
+  uhdr_gl_share_group& group = get_share_group();
+  bool reuse = false;
+  // pending timer queries are deleted unread
+  mStats = nullptr;
+  // objects can only be deleted with the context current. A context current on another thread
+  // is left to egl, which destroys it and its objects once it is released there.
+  if (mEGLContext != EGL_NO_CONTEXT && make_current()) {
+    for (int i = 0; i < 2; i++) {
+      if (mPackFence[i]) glDeleteSync(mPackFence[i]);
+      if (mPackBuffer[i]) glDeleteBuffers(1, &mPackBuffer[i]);
+    }
+    if (mUnpackBuffer) glDeleteBuffers(1, &mUnpackBuffer);
+    if (mDecodedImgTexture) glDeleteTextures(1, &mDecodedImgTexture);
+    if (mGainmapImgTexture) glDeleteTextures(1, &mGainmapImgTexture);
+    reuse = mPooled && mQuadVAO && mQuadVBO && mQuadEBO;
+    if (!reuse) {
+      if (mQuadVAO) glDeleteVertexArrays(1, &mQuadVAO);
+      if (mQuadVBO) glDeleteBuffers(1, &mQuadVBO);
+      if (mQuadEBO) glDeleteBuffers(1, &mQuadEBO);
+    }
+    std::lock_guard<std::mutex> lock(group.mutex);
+    for (auto& it : mPrograms) {
+      std::vector<GLuint>& idle = group.idle_programs[it.first];
+      if (mPooled && idle.size() < kMaxIdlePrograms) {
+        idle.push_back(it.second);
+      } else {
+        glDeleteProgram(it.second);
+      }
+    }
+    glFlush();
+    release_current();
+    if (reuse && group.idle_contexts.size() < kMaxIdleContexts) {
+      group.idle_contexts.push_back({mEGLContext, mEGLSurface, mQuadVAO, mQuadVBO, mQuadEBO});
+    } else {
+      reuse = false;
+    }
   }
-  if (mEGLContext != EGL_NO_CONTEXT) {
-    eglDestroyContext(mEGLDisplay, mEGLContext);
-    mEGLContext = EGL_NO_CONTEXT;
+  if (!reuse) {
+    if (mEGLSurface != EGL_NO_SURFACE) eglDestroySurface(mEGLDisplay, mEGLSurface);
+    if (mEGLContext != EGL_NO_CONTEXT) eglDestroyContext(mEGLDisplay, mEGLContext);
   }
+
+  mEGLSurface = EGL_NO_SURFACE;
+  mEGLContext = EGL_NO_CONTEXT;
   mEGLConfig = 0;
-  if (mEGLDisplay != EGL_NO_DISPLAY) {
-    eglTerminate(mEGLDisplay);
-    mEGLDisplay = EGL_NO_DISPLAY;
-  }
-  if (mDecodedImgTexture) {
-    glDeleteTextures(1, &mDecodedImgTexture);
-    mDecodedImgTexture = 0;
-  }
-  if (mGainmapImgTexture) {
-    glDeleteTextures(1, &mGainmapImgTexture);
-    mGainmapImgTexture = 0;
+  mEGLDisplay = EGL_NO_DISPLAY;
+  mQuadVAO = 0;
+  mQuadVBO = 0;
+  mQuadEBO = 0;
+  for (int i = 0; i < 2; i++) {
+    mPackFence[i] = 0;
+    mPackBuffer[i] = 0;
   }
+  mUnpackBuffer = 0;
+  mDecodedImgTexture = 0;
+  mGainmapImgTexture = 0;
   for (int i = 0; i < UHDR_RESIZE + 1; i++) {
-    if (mShaderProgram[i]) {
-      glDeleteProgram(mShaderProgram[i]);
-      mShaderProgram[i] = 0;
-    }
+    mShaderProgram[i] = 0;
   }
+  mPrograms.clear();
+  mPooled = false;
+  mTimerQuery = -1;
+  mGpuPhase = -1;
+  mTimerQueries.clear();
 }
 }  // namespace ultrahdr
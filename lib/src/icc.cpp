@@ -16,6 +16,7 @@
 
 #include <cstring>
 #include <cmath>
+#include <mutex>
 
 #include "ultrahdr/ultrahdrcommon.h"
 #include "ultrahdr/icc.h"
@@ -409,6 +410,26 @@ std::shared_ptr<DataStruct> IccHelper::write_mAB_or_mBA_tag(uint32_t type, bool
 
 std::shared_ptr<DataStruct> IccHelper::writeIccProfile(uhdr_color_transfer_t tf,
                                                        uhdr_color_gamut_t gamut) {
+  if (tf < UHDR_CT_LINEAR || tf > UHDR_CT_SRGB || gamut < UHDR_CG_BT_709 ||
+      gamut > UHDR_CG_BT_2100) {
+    return buildIccProfile(tf, gamut);
+  }
+
+  // the profile depends only on the transfer and gamut, build each one once per process
+  static std::mutex mutex;
+  static std::shared_ptr<DataStruct> profiles[UHDR_CT_SRGB + 1][UHDR_CG_BT_2100 + 1];
+  std::lock_guard<std::mutex> lock(mutex);
+  std::shared_ptr<DataStruct>& profile = profiles[tf][gamut];
+  if (profile == nullptr) {
+    std::shared_ptr<DataStruct> built = buildIccProfile(tf, gamut);
+    if (built->getBytesWritten() != built->getLength()) return built;
+    profile = built;
+  }
+  return profile;
+}
+
+std::shared_ptr<DataStruct> IccHelper::buildIccProfile(uhdr_color_transfer_t tf,
+                                                       uhdr_color_gamut_t gamut) {
   ICCHeader header;
 
   std::vector<std::pair<uint32_t, std::shared_ptr<DataStruct>>> tags;
@@ -554,7 +575,7 @@ std::shared_ptr<DataStruct> IccHelper::writeIccProfile(uhdr_color_transfer_t tf,
   // Write identifier, chunk count, and chunk ID
   if (!dataStruct->write(kICCIdentifier, sizeof(kICCIdentifier)) || !dataStruct->write8(1) ||
       !dataStruct->write8(1)) {
-    ALOGE("writeIccProfile(): error in identifier");
+    ALOGE("buildIccProfile(): error in identifier");
     return dataStruct;
   }
 
@@ -565,7 +586,7 @@ std::shared_ptr<DataStruct> IccHelper::writeIccProfile(uhdr_color_transfer_t tf,
   header.tag_count = Endian_SwapBE32(tags.size());
 
   if (!dataStruct->write(&header, sizeof(header))) {
-    ALOGE("writeIccProfile(): error in header");
+    ALOGE("buildIccProfile(): error in header");
     return dataStruct;
   }
 
@@ -583,7 +604,7 @@ std::shared_ptr<DataStruct> IccHelper::writeIccProfile(uhdr_color_transfer_t tf,
         Endian_SwapBE32(last_tag_size),
     };
     if (!dataStruct->write(tag_table_entry, sizeof(tag_table_entry))) {
-      ALOGE("writeIccProfile(): error in writing tag table");
+      ALOGE("buildIccProfile(): error in writing tag table");
       return dataStruct;
     }
   }
@@ -591,7 +612,7 @@ std::shared_ptr<DataStruct> IccHelper::writeIccProfile(uhdr_color_transfer_t tf,
   // Write the tags.
   for (const auto& tag : tags) {
     if (!dataStruct->write(tag.second->getData(), tag.second->getLength())) {
-      ALOGE("writeIccProfile(): error in writing tags");
+      ALOGE("buildIccProfile(): error in writing tags");
       return dataStruct;
     }
   }
@@ -638,10 +659,14 @@ bool IccHelper::tagsEqualToMatrix(const Matrix3x3& matrix, const uint8_t* red_ta
   return true;
 }
 
-uhdr_color_gamut_t IccHelper::readIccColorGamut(void* icc_data, size_t icc_size) {
-  // Each tag table entry consists of 3 fields of 4 bytes each.
-  static const size_t kTagTableEntrySize = 12;
+// fnv-1a over the icc payload, keys the gamut cache of readIccColorGamut()
+static uint64_t iccPayloadHash(const uint8_t* data, size_t size) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < size; i++) hash = (hash ^ data[i]) * 0x100000001b3ull;
+  return hash;
+}
 
+uhdr_color_gamut_t IccHelper::readIccColorGamut(void* icc_data, size_t icc_size) {
   if (icc_data == nullptr || icc_size < sizeof(ICCHeader) + kICCIdentifierSize) {
     return UHDR_CG_UNSPECIFIED;
   }
@@ -650,6 +675,44 @@ uhdr_color_gamut_t IccHelper::readIccColorGamut(void* icc_data, size_t icc_size)
     return UHDR_CG_UNSPECIFIED;
   }
 
+  // profiles written by this library for base images match byte for byte
+  static const uhdr_color_gamut_t kGamuts[] = {UHDR_CG_BT_709, UHDR_CG_DISPLAY_P3, UHDR_CG_BT_2100};
+  for (uhdr_color_gamut_t gamut : kGamuts) {
+    std::shared_ptr<DataStruct> profile = writeIccProfile(UHDR_CT_SRGB, gamut);
+    if (profile->getLength() == icc_size && memcmp(profile->getData(), icc_data, icc_size) == 0) {
+      return gamut;
+    }
+  }
+
+  // other profiles are parsed once, a gallery tends to carry the same profile on every image
+  struct GamutCacheEntry {
+    uint64_t hash;
+    size_t size;
+    uhdr_color_gamut_t gamut;
+  };
+  static const size_t kGamutCacheSize = 16;
+  static std::mutex mutex;
+  static GamutCacheEntry cache[kGamutCacheSize] = {};
+  static size_t cacheNext = 0;
+
+  const uint64_t hash = iccPayloadHash(reinterpret_cast<const uint8_t*>(icc_data), icc_size);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const GamutCacheEntry& entry : cache) {
+      if (entry.size == icc_size && entry.hash == hash) return entry.gamut;
+    }
+  }
+  uhdr_color_gamut_t gamut = parseIccColorGamut(icc_data, icc_size);
+  std::lock_guard<std::mutex> lock(mutex);
+  cache[cacheNext] = {hash, icc_size, gamut};
+  cacheNext = (cacheNext + 1) % kGamutCacheSize;
+  return gamut;
+}
+
+uhdr_color_gamut_t IccHelper::parseIccColorGamut(void* icc_data, size_t icc_size) {
+  // Each tag table entry consists of 3 fields of 4 bytes each.
+  static const size_t kTagTableEntrySize = 12;
+
   uint8_t* icc_bytes = reinterpret_cast<uint8_t*>(icc_data) + kICCIdentifierSize;
   auto alignment_needs = alignof(ICCHeader);
   uint8_t* aligned_block = nullptr;
@@ -17,17 +17,19 @@
 #include <errno.h>
 #include <setjmp.h>
 
+#include <atomic>
 #include <cmath>
 #include <cstring>
 
 #include "ultrahdr/ultrahdrcommon.h"
 #include "ultrahdr/jpegdecoderhelper.h"
+#include "ultrahdr/threadpool.h"
+#include "ultrahdr/trace.h"
 
 using namespace std;
 
 namespace ultrahdr {
 
-static const uint32_t kAPP0Marker = JPEG_APP0;      // JFIF
 static const uint32_t kAPP1Marker = JPEG_APP0 + 1;  // EXIF, XMP
 static const uint32_t kAPP2Marker = JPEG_APP0 + 2;  // ICC, ISO Metadata
 
@@ -49,6 +51,8 @@ static constexpr uint8_t kIsoMetadataNameSpace[] = {
     'o', ':', 't', 's', ':', '2', '1', '4', '9', '6', ':', '-', '1', '\0',
 };
 
+static constexpr uint8_t kMpfSig[] = {'M', 'P', 'F', '\0'};
+
 const int kMinWidth = 8;
 const int kMinHeight = 8;
 
@@ -110,6 +114,142 @@ jpeg_source_mgr_impl::jpeg_source_mgr_impl(const uint8_t* ptr, size_t len)
   term_source = jpegr_term_source;
 }
 
+/*!\brief module for managing input held in several buffers */
+struct jpeg_chunked_source_mgr : jpeg_source_mgr {
+  static constexpr int kMaxChunks = 5;
+
+  jpeg_chunked_source_mgr();
+  ~jpeg_chunked_source_mgr() = default;
+
+  const uint8_t* mChunks[kMaxChunks];
+  size_t mChunkLengths[kMaxChunks];
+  int mNumChunks = 0;
+  int mNextChunk = 0;
+  int mRestartOffset = 0;  // number of the first RSTn marker of the input is mRestartOffset & 7
+};
+
+static void jpegr_init_chunked_source(j_decompress_ptr cinfo) {
+  jpeg_chunked_source_mgr* src = static_cast<jpeg_chunked_source_mgr*>(cinfo->src);
+  src->mNextChunk = 0;
+  src->bytes_in_buffer = 0;
+}
+
+static boolean jpegr_fill_chunked_input_buffer(j_decompress_ptr cinfo) {
+  static const JOCTET kFakeEOI[2] = {0xFF, JPEG_EOI};
+  jpeg_chunked_source_mgr* src = static_cast<jpeg_chunked_source_mgr*>(cinfo->src);
+
+  while (src->mNextChunk < src->mNumChunks && src->mChunkLengths[src->mNextChunk] == 0) {
+    src->mNextChunk++;
+  }
+  if (src->mNextChunk < src->mNumChunks) {
+    src->next_input_byte = src->mChunks[src->mNextChunk];
+    src->bytes_in_buffer = src->mChunkLengths[src->mNextChunk];
+    src->mNextChunk++;
+  } else {
+    // input is exhausted, end the image as libjpeg's own source managers do
+    src->next_input_byte = kFakeEOI;
+    src->bytes_in_buffer = sizeof kFakeEOI;
+  }
+  return TRUE;
+}
+
+static void jpegr_skip_chunked_input_data(j_decompress_ptr cinfo, long num_bytes) {
+  jpeg_chunked_source_mgr* src = static_cast<jpeg_chunked_source_mgr*>(cinfo->src);
+
+  if (num_bytes <= 0) return;
+  while (num_bytes > static_cast<long>(src->bytes_in_buffer)) {
+    num_bytes -= static_cast<long>(src->bytes_in_buffer);
+    jpegr_fill_chunked_input_buffer(cinfo);
+  }
+  src->next_input_byte += num_bytes;
+  src->bytes_in_buffer -= num_bytes;
+}
+
+static boolean jpegr_resync_chunked_to_restart(j_decompress_ptr cinfo, int desired) {
+  jpeg_chunked_source_mgr* src = static_cast<jpeg_chunked_source_mgr*>(cinfo->src);
+
+  // the input starts mid scan, its markers are numbered from mRestartOffset on
+  if (cinfo->unread_marker == JPEG_RST0 + ((desired + src->mRestartOffset) & 7)) {
+    cinfo->unread_marker = 0;
+    return TRUE;
+  }
+  return jpeg_resync_to_restart(cinfo, desired);
+}
+
+jpeg_chunked_source_mgr::jpeg_chunked_source_mgr() {
+  init_source = jpegr_init_chunked_source;
+  fill_input_buffer = jpegr_fill_chunked_input_buffer;
+  skip_input_data = jpegr_skip_chunked_input_data;
+  resync_to_restart = jpegr_resync_chunked_to_restart;
+  term_source = jpegr_term_source;
+  next_input_byte = nullptr;
+  bytes_in_buffer = 0;
+}
+
+/*!\brief module for managing input that arrives piecewise */
+struct jpeg_stream_source_mgr : jpeg_source_mgr {
+  jpeg_stream_source_mgr();
+  ~jpeg_stream_source_mgr() = default;
+
+  const JpegDecoderHelper::InputPuller* mPull = nullptr;
+};
+
+static void jpegr_init_stream_source(j_decompress_ptr cinfo) {
+  jpeg_stream_source_mgr* src = static_cast<jpeg_stream_source_mgr*>(cinfo->src);
+  src->bytes_in_buffer = 0;
+}
+
+static boolean jpegr_fill_stream_input_buffer(j_decompress_ptr cinfo) {
+  static const JOCTET kFakeEOI[2] = {0xFF, JPEG_EOI};
+  jpeg_stream_source_mgr* src = static_cast<jpeg_stream_source_mgr*>(cinfo->src);
+
+  // blocks until the next piece arrives
+  const uint8_t* data;
+  size_t length;
+  while ((*src->mPull)(data, length)) {
+    if (length != 0) {
+      src->next_input_byte = data;
+      src->bytes_in_buffer = length;
+      return TRUE;
+    }
+  }
+  src->next_input_byte = kFakeEOI;
+  src->bytes_in_buffer = sizeof kFakeEOI;
+  return TRUE;
+}
+
+static void jpegr_skip_stream_input_data(j_decompress_ptr cinfo, long num_bytes) {
+  jpeg_stream_source_mgr* src = static_cast<jpeg_stream_source_mgr*>(cinfo->src);
+
+  if (num_bytes <= 0) return;
+  while (num_bytes > static_cast<long>(src->bytes_in_buffer)) {
+    num_bytes -= static_cast<long>(src->bytes_in_buffer);
+    jpegr_fill_stream_input_buffer(cinfo);
+  }
+  src->next_input_byte += num_bytes;
+  src->bytes_in_buffer -= num_bytes;
+}
+
+jpeg_stream_source_mgr::jpeg_stream_source_mgr() {
+  init_source = jpegr_init_stream_source;
+  fill_input_buffer = jpegr_fill_stream_input_buffer;
+  skip_input_data = jpegr_skip_stream_input_data;
+  resync_to_restart = jpeg_resync_to_restart;
+  term_source = jpegr_term_source;
+  next_input_byte = nullptr;
+  bytes_in_buffer = 0;
+}
+
+struct JpegDecoderHelper::DecodeState {
+  DecodeState() : mgr(nullptr, 0) {}
+
+  jpeg_source_mgr_impl mgr;
+  jpeg_chunked_source_mgr chunkedMgr;  // input of a segment decode
+  jpeg_stream_source_mgr streamMgr;    // input of a streamed decode
+  jpeg_decompress_struct cinfo;
+  jpeg_error_mgr_impl err;
+};
+
 static void jpegrerror_exit(j_common_ptr cinfo) {
   jpeg_error_mgr_impl* err = reinterpret_cast<jpeg_error_mgr_impl*>(cinfo->err);
   longjmp(err->setjmp_buffer, 1);
@@ -122,28 +262,6 @@ static void output_message(j_common_ptr cinfo) {
   ALOGE("%s\n", buffer);
 }
 
-static void jpeg_extract_marker_payload(const j_decompress_ptr cinfo, const uint32_t marker_code,
-                                        const uint8_t* marker_fourcc_code,
-                                        const uint32_t fourcc_length,
-                                        std::vector<JOCTET>& destination,
-                                        long& markerPayloadOffsetRelativeToSourceBuffer) {
-  unsigned int pos = 2; /* position after reading SOI marker (0xffd8) */
-  markerPayloadOffsetRelativeToSourceBuffer = -1;
-
-  for (jpeg_marker_struct* marker = cinfo->marker_list; marker; marker = marker->next) {
-    pos += 4; /* position after reading next marker and its size (0xFFXX, [SIZE = 2 bytes]) */
-
-    if (marker->marker == marker_code && marker->data_length > fourcc_length &&
-        !memcmp(marker->data, marker_fourcc_code, fourcc_length)) {
-      destination.resize(marker->data_length);
-      memcpy(static_cast<void*>(destination.data()), marker->data, marker->data_length);
-      markerPayloadOffsetRelativeToSourceBuffer = pos;
-      return;
-    }
-    pos += marker->original_length; /* position after marker's payload */
-  }
-}
-
 static uhdr_img_fmt_t getOutputSamplingFormat(const j_decompress_ptr cinfo) {
   if (cinfo->num_components == 1)
     return UHDR_IMG_FMT_8bppYCbCr400;
@@ -172,16 +290,264 @@ static uhdr_img_fmt_t getOutputSamplingFormat(const j_decompress_ptr cinfo) {
   return UHDR_IMG_FMT_UNSPECIFIED;
 }
 
+static uhdr_img_fmt_t getOutputFormat(const j_decompress_ptr cinfo) {
+  switch (cinfo->out_color_space) {
+    case JCS_GRAYSCALE:
+      [[fallthrough]];
+    case JCS_YCbCr:
+      return getOutputSamplingFormat(cinfo);
+#ifdef JCS_ALPHA_EXTENSIONS
+    case JCS_EXT_RGBA:
+      return UHDR_IMG_FMT_32bppRGBA8888;
+#endif
+    case JCS_RGB:
+      return UHDR_IMG_FMT_24bppRGB888;
+    default:
+      return UHDR_IMG_FMT_UNSPECIFIED;
+  }
+}
+
+static bool isMarkerPayloadOf(const uint8_t* payload, size_t size, const uint8_t* fourcc_code,
+                              size_t fourcc_length) {
+  return size > fourcc_length && !memcmp(payload, fourcc_code, fourcc_length);
+}
+
+uhdr_error_info_t JpegDecoderHelper::scanHeaders(const void* image, size_t length,
+                                                 jpeg_header_view_t& view) {
+  const uint8_t* data = static_cast<const uint8_t*>(image);
+  uhdr_error_info_t status;
+  status.error_code = UHDR_CODEC_ERROR;
+  status.has_detail = 1;
+  memset(&view, 0, sizeof view);
+
+  if (data == nullptr || length < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+    snprintf(status.detail, sizeof status.detail, "received bitstream without a jpeg soi marker");
+    return status;
+  }
+  bool frameHeaderSeen = false;
+  size_t pos = 2; /* position after reading SOI marker (0xffd8) */
+  while (true) {
+    if (pos >= length || data[pos] != 0xFF) {
+      snprintf(status.detail, sizeof status.detail,
+               "expected a jpeg marker at offset %zd before start of scan", pos);
+      return status;
+    }
+    // a marker may be preceded by any number of fill bytes
+    while (pos < length && data[pos] == 0xFF) pos++;
+    if (pos >= length) {
+      snprintf(status.detail, sizeof status.detail, "bitstream ends before start of scan");
+      return status;
+    }
+    const uint8_t marker = data[pos++];
+    if (marker == 0xDA) { /* SOS */
+      if (length - pos >= 2) {
+        const size_t segmentLength = (static_cast<size_t>(data[pos]) << 8) | data[pos + 1];
+        if (segmentLength >= 2 && segmentLength < length - pos) {
+          view.scanOffset = pos + segmentLength;
+        }
+      }
+      break;
+    }
+    if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD9)) {
+      snprintf(status.detail, sizeof status.detail,
+               "unexpected jpeg marker 0xff%02x at offset %zd before start of scan", marker,
+               pos - 2);
+      return status;
+    }
+    if (length - pos < 2) {
+      snprintf(status.detail, sizeof status.detail, "bitstream ends before start of scan");
+      return status;
+    }
+    const size_t segmentLength = (static_cast<size_t>(data[pos]) << 8) | data[pos + 1];
+    if (segmentLength < 2 || segmentLength > length - pos) {
+      snprintf(status.detail, sizeof status.detail,
+               "jpeg marker 0xff%02x at offset %zd has bad segment length %zd", marker, pos - 2,
+               segmentLength);
+      return status;
+    }
+    const uint8_t* payload = data + pos + 2;
+    const size_t size = segmentLength - 2;
+
+    if (marker == kAPP1Marker) {
+      if (view.xmpData == nullptr &&
+          isMarkerPayloadOf(payload, size, kXmpNameSpace, sizeof kXmpNameSpace)) {
+        view.xmpData = payload;
+        view.xmpSize = size;
+      } else if (view.exifData == nullptr &&
+                 isMarkerPayloadOf(payload, size, kExifIdCode, sizeof kExifIdCode)) {
+        view.exifData = payload;
+        view.exifSize = size;
+      }
+    } else if (marker == kAPP2Marker) {
+      if (view.iccData == nullptr && isMarkerPayloadOf(payload, size, kICCSig, sizeof kICCSig)) {
+        view.iccData = payload;
+        view.iccSize = size;
+      } else if (view.isoData == nullptr &&
+                 isMarkerPayloadOf(payload, size, kIsoMetadataNameSpace,
+                                   sizeof kIsoMetadataNameSpace)) {
+        view.isoData = payload;
+        view.isoSize = size;
+      } else if (view.mpfData == nullptr &&
+                 isMarkerPayloadOf(payload, size, kMpfSig, sizeof kMpfSig)) {
+        view.mpfData = payload;
+        view.mpfSize = size;
+      }
+    } else if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 &&
+               marker != 0xCC) {
+      // SOFn, the range is shared with DHT (0xffc4), JPG (0xffc8) and DAC (0xffcc)
+      if (frameHeaderSeen || (marker > 0xC2 && marker != 0xC9 && marker != 0xCA)) {
+        snprintf(status.detail, sizeof status.detail,
+                 "unsupported or repeated jpeg frame header 0xff%02x at offset %zd", marker,
+                 pos - 2);
+        return status;
+      }
+      if (size < 6 || payload[0] != 8 || size < 6 + 3 * static_cast<size_t>(payload[5])) {
+        snprintf(status.detail, sizeof status.detail,
+                 "received bad jpeg frame header at offset %zd", pos - 2);
+        return status;
+      }
+      view.height = (payload[1] << 8) | payload[2];
+      view.width = (payload[3] << 8) | payload[4];
+      view.numComponents = payload[5];
+      view.frameHeaderOffset = pos - 2;
+      if (view.width < 1 || view.height < 1) {
+        snprintf(status.detail, sizeof status.detail,
+                 "received bad image width or height, wd = %d, ht = %d. wd and height shall be "
+                 ">= 1",
+                 view.width, view.height);
+        return status;
+      }
+      if ((int)view.width > kMaxWidth || (int)view.height > kMaxHeight) {
+        snprintf(
+            status.detail, sizeof status.detail,
+            "max width, max supported by library are %d, %d respectively. Current image width and "
+            "height are %d, %d. Recompile library with updated max supported dimensions to proceed",
+            kMaxWidth, kMaxHeight, view.width, view.height);
+        return status;
+      }
+      if (view.numComponents != 1 && view.numComponents != 3) {
+        snprintf(
+            status.detail, sizeof status.detail,
+            "ultrahdr primary image and supplimentary images are images encoded with 1 component "
+            "(grayscale) or 3 components (YCbCr / RGB). Unrecognized number of components %d",
+            view.numComponents);
+        return status;
+      }
+      for (unsigned int i = 0, product = 0; i < view.numComponents; i++) {
+        const int h_samp_factor = payload[6 + 3 * i + 1] >> 4;
+        const int v_samp_factor = payload[6 + 3 * i + 1] & 0xF;
+        if (h_samp_factor < 1 || h_samp_factor > 4 || v_samp_factor < 1 || v_samp_factor > 4) {
+          snprintf(status.detail, sizeof status.detail,
+                   "received bad sampling factors for component index %u, sample factor h = %d, "
+                   "v = %d, these are expected to be with in range [1-4]",
+                   i, h_samp_factor, v_samp_factor);
+          return status;
+        }
+        product += h_samp_factor * v_samp_factor;
+        if (product > 10) {
+          snprintf(status.detail, sizeof status.detail,
+                   "received bad sampling factors for components, sum of product of "
+                   "h_samp_factor, v_samp_factor across all components exceeds 10");
+          return status;
+        }
+      }
+      frameHeaderSeen = true;
+    }
+    pos += segmentLength;
+  }
+  if (!frameHeaderSeen) {
+    snprintf(status.detail, sizeof status.detail, "no jpeg frame header before start of scan");
+    return status;
+  }
+  return g_no_error;
+}
+
+JpegDecoderHelper::JpegDecoderHelper() = default;
+
+JpegDecoderHelper::~JpegDecoderHelper() { releaseState(); }
+
 uhdr_error_info_t JpegDecoderHelper::decompressImage(const void* image, size_t length,
                                                      decode_mode_t mode) {
-  if (image == nullptr) {
+  return decompress(image, length, mode, 0, nullptr, 1);
+}
+
+uhdr_error_info_t JpegDecoderHelper::decompressStream(const InputPuller& pull,
+                                                      decode_mode_t mode) {
+  return decompress(nullptr, 0, mode, 0, nullptr, 1, &pull);
+}
+
+uhdr_error_info_t JpegDecoderHelper::attachBitstream(const void* image, size_t length) {
+  UHDR_ERR_CHECK(scanHeaders(image, length, mHeaderView))
+  if (mHeaderView.exifData != nullptr) {
+    mExifPayLoadOffset = mHeaderView.exifData - static_cast<const uint8_t*>(image);
+  }
+  return g_no_error;
+}
+
+uhdr_error_info_t JpegDecoderHelper::decompressImageRegion(const void* image, size_t length,
+                                                           decode_mode_t mode,
+                                                           const image_region_t& region) {
+  if (mode == PARSE_STREAM) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "region decode requires a decode mode");
+    return status;
+  }
+  return decompress(image, length, mode, 0, &region, 1);
+}
+
+uhdr_error_info_t JpegDecoderHelper::decompressImageScaled(const void* image, size_t length,
+                                                           decode_mode_t mode,
+                                                           unsigned int scale_denom) {
+  if (mode == PARSE_STREAM || (scale_denom != 1 && scale_denom != 2 && scale_denom != 4 &&
+                               scale_denom != 8)) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "scaled decode requires a decode mode and a scale denominator of 1, 2, 4 or 8, "
+             "received mode %d, scale denominator %u",
+             mode, scale_denom);
+    return status;
+  }
+  return decompress(image, length, mode, 0, nullptr, scale_denom);
+}
+
+uhdr_error_info_t JpegDecoderHelper::startStripDecode(const void* image, size_t length,
+                                                      decode_mode_t mode,
+                                                      unsigned int strip_height) {
+  if (strip_height == 0) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received bad strip height %u", strip_height);
+    return status;
+  }
+  if (mode == PARSE_STREAM) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "strip wise decode requires a decode mode");
+    return status;
+  }
+  return decompress(image, length, mode, strip_height, nullptr, 1);
+}
+
+uhdr_error_info_t JpegDecoderHelper::decompress(const void* image, size_t length,
+                                                decode_mode_t mode, unsigned int strip_height,
+                                                const image_region_t* region,
+                                                unsigned int scale_denom,
+                                                const InputPuller* pull) {
+  UHDR_TRACE_SCOPE("JpegDecoderHelper::decompress");
+  if (pull == nullptr && image == nullptr) {
     uhdr_error_info_t status;
     status.error_code = UHDR_CODEC_INVALID_PARAM;
     status.has_detail = 1;
     snprintf(status.detail, sizeof status.detail, "received nullptr for compressed image data");
     return status;
   }
-  if (length <= 0) {
+  if (pull == nullptr && length <= 0) {
     uhdr_error_info_t status;
     status.error_code = UHDR_CODEC_INVALID_PARAM;
     status.has_detail = 1;
@@ -190,62 +556,126 @@ uhdr_error_info_t JpegDecoderHelper::decompressImage(const void* image, size_t l
   }
 
   // reset context
+  endStripDecode();
   mResultBuffer.clear();
-  mXMPBuffer.clear();
-  mEXIFBuffer.clear();
-  mICCBuffer.clear();
-  mIsoMetadataBuffer.clear();
+  mResultData = nullptr;
+  mResultSize = 0;
+  mResultInOutputImage = false;
+  memset(&mHeaderView, 0, sizeof mHeaderView);
   mOutFormat = UHDR_IMG_FMT_UNSPECIFIED;
   mNumComponents = 1;
+  mImageWidth = 0;
+  mImageHeight = 0;
   for (int i = 0; i < kMaxNumComponents; i++) {
-    mPlanesMCURow[i].reset();
+    mPlanesMCURow[i].clear();
     mPlaneWidth[i] = 0;
     mPlaneHeight[i] = 0;
     mPlaneHStride[i] = 0;
     mPlaneVStride[i] = 0;
+    mResultRows[i] = 0;
   }
   mExifPayLoadOffset = -1;
 
-  return decode(image, length, mode);
+  uhdr_error_info_t status = decode(image, length, mode, strip_height, region, scale_denom, pull);
+  mOutputImage = nullptr;
+  return status;
 }
 
-uhdr_error_info_t JpegDecoderHelper::decode(const void* image, size_t length, decode_mode_t mode) {
-  jpeg_source_mgr_impl mgr(static_cast<const uint8_t*>(image), length);
-  jpeg_decompress_struct cinfo;
-  jpeg_error_mgr_impl myerr;
-  uhdr_error_info_t status = g_no_error;
+void JpegDecoderHelper::allocateResult(const j_decompress_ptr cinfo, size_t size, bool whole) {
+  const uhdr_raw_image_t* out = mOutputImage;
+  const int planes = cinfo->raw_data_out ? cinfo->num_components : 1;
+  bool fits = whole && out != nullptr && out->fmt == getOutputFormat(cinfo) &&
+              out->w == mPlaneWidth[0] && out->h == mPlaneHeight[0];
+  // the planes of the result follow each other without padding rows
+  uint8_t* data = fits ? static_cast<uint8_t*>(out->planes[0]) : nullptr;
+  size_t offset = 0;
+  for (int i = 0; fits && i < planes; i++) {
+    fits = out->planes[i] == data + offset && out->stride[i] == mPlaneHStride[i] &&
+           mResultRows[i] == mPlaneHeight[i];
+    offset += (size_t)mPlaneHStride[i] * mResultRows[i];
+  }
+  mResultInOutputImage = fits;
+  if (!fits) {
+    mResultBuffer.resize(size);
+    data = mResultBuffer.data();
+  }
+  mResultData = data;
+  mResultSize = size;
+}
 
-  cinfo.err = jpeg_std_error(&myerr);
-  myerr.error_exit = jpegrerror_exit;
-  myerr.output_message = output_message;
+void JpegDecoderHelper::endStripDecode() {
+  if (mStripDecoding) {
+    jpeg_abort_decompress(&mState->cinfo);
+    mStripDecoding = false;
+  }
+}
+
+JpegDecoderHelper::DecodeState* JpegDecoderHelper::acquireState() {
+  if (mState == nullptr) {
+    mState = std::make_unique<DecodeState>();
+    mState->cinfo.err = jpeg_std_error(&mState->err);
+    mState->err.error_exit = jpegrerror_exit;
+    mState->err.output_message = output_message;
+    if (0 != setjmp(mState->err.setjmp_buffer)) {
+      mState.reset();
+      return nullptr;
+    }
+    jpeg_create_decompress(&mState->cinfo);
+  }
+  return mState.get();
+}
+
+void JpegDecoderHelper::releaseState() {
+  if (mState != nullptr) {
+    jpeg_destroy_decompress(&mState->cinfo);
+    mState.reset();
+  }
+  mStripDecoding = false;
+}
+
+static uhdr_error_info_t stateCreationError() {
+  uhdr_error_info_t status;
+  status.error_code = UHDR_CODEC_MEM_ERROR;
+  status.has_detail = 1;
+  snprintf(status.detail, sizeof status.detail, "failed to create libjpeg decompressor");
+  return status;
+}
+
+uhdr_error_info_t JpegDecoderHelper::decode(const void* image, size_t length, decode_mode_t mode,
+                                            unsigned int strip_height,
+                                            const image_region_t* region,
+                                            unsigned int scale_denom, const InputPuller* pull) {
+  // the libjpeg state and its table storage are reused across images
+  DecodeState* state = acquireState();
+  if (state == nullptr) return stateCreationError();
+  jpeg_source_mgr_impl& mgr = state->mgr;
+  jpeg_decompress_struct& cinfo = state->cinfo;
+  jpeg_error_mgr_impl& myerr = state->err;
+  uhdr_error_info_t status = g_no_error;
 
+  mgr.mBufferPtr = static_cast<const uint8_t*>(image);
+  mgr.mBufferLength = length;
+  state->streamMgr.mPull = pull;
   if (0 == setjmp(myerr.setjmp_buffer)) {
-    jpeg_create_decompress(&cinfo);
-    cinfo.src = &mgr;
-    jpeg_save_markers(&cinfo, kAPP0Marker, 0xFFFF);
-    jpeg_save_markers(&cinfo, kAPP1Marker, 0xFFFF);
-    jpeg_save_markers(&cinfo, kAPP2Marker, 0xFFFF);
+    cinfo.src = pull != nullptr ? static_cast<jpeg_source_mgr*>(&state->streamMgr) : &mgr;
     int ret_val = jpeg_read_header(&cinfo, TRUE /* require an image to be present */);
     if (JPEG_HEADER_OK != ret_val) {
       status.error_code = UHDR_CODEC_ERROR;
       status.has_detail = 1;
       snprintf(status.detail, sizeof status.detail,
                "jpeg_read_header(...) returned %d, expected %d", ret_val, JPEG_HEADER_OK);
-      jpeg_destroy_decompress(&cinfo);
+      jpeg_abort_decompress(&cinfo);
       return status;
     }
-    long payloadOffset = -1;
-    jpeg_extract_marker_payload(&cinfo, kAPP1Marker, kXmpNameSpace,
-                                sizeof kXmpNameSpace / sizeof kXmpNameSpace[0], mXMPBuffer,
-                                payloadOffset);
-    jpeg_extract_marker_payload(&cinfo, kAPP1Marker, kExifIdCode,
-                                sizeof kExifIdCode / sizeof kExifIdCode[0], mEXIFBuffer,
-                                mExifPayLoadOffset);
-    jpeg_extract_marker_payload(&cinfo, kAPP2Marker, kICCSig, sizeof kICCSig / sizeof kICCSig[0],
-                                mICCBuffer, payloadOffset);
-    jpeg_extract_marker_payload(&cinfo, kAPP2Marker, kIsoMetadataNameSpace,
-                                sizeof kIsoMetadataNameSpace / sizeof kIsoMetadataNameSpace[0],
-                                mIsoMetadataBuffer, payloadOffset);
+    // app payloads are referenced in place rather than saved by libjpeg, a streamed input is not
+    // in place yet, see attachBitstream()
+    if (pull == nullptr) {
+      status = attachBitstream(image, length);
+      if (status.error_code != UHDR_CODEC_OK) {
+        jpeg_abort_decompress(&cinfo);
+        return status;
+      }
+    }
 
     if (cinfo.image_width < 1 || cinfo.image_height < 1) {
       status.error_code = UHDR_CODEC_ERROR;
@@ -253,7 +683,7 @@ uhdr_error_info_t JpegDecoderHelper::decode(const void* image, size_t length, de
       snprintf(status.detail, sizeof status.detail,
                "received bad image width or height, wd = %d, ht = %d. wd and height shall be >= 1",
                cinfo.image_width, cinfo.image_height);
-      jpeg_destroy_decompress(&cinfo);
+      jpeg_abort_decompress(&cinfo);
       return status;
     }
     if ((int)cinfo.image_width > kMaxWidth || (int)cinfo.image_height > kMaxHeight) {
@@ -264,7 +694,7 @@ uhdr_error_info_t JpegDecoderHelper::decode(const void* image, size_t length, de
           "max width, max supported by library are %d, %d respectively. Current image width and "
           "height are %d, %d. Recompile library with updated max supported dimensions to proceed",
           kMaxWidth, kMaxHeight, cinfo.image_width, cinfo.image_height);
-      jpeg_destroy_decompress(&cinfo);
+      jpeg_abort_decompress(&cinfo);
       return status;
     }
     if (cinfo.num_components != 1 && cinfo.num_components != 3) {
@@ -275,7 +705,7 @@ uhdr_error_info_t JpegDecoderHelper::decode(const void* image, size_t length, de
           "ultrahdr primary image and supplimentary images are images encoded with 1 component "
           "(grayscale) or 3 components (YCbCr / RGB). Unrecognized number of components %d",
           cinfo.num_components);
-      jpeg_destroy_decompress(&cinfo);
+      jpeg_abort_decompress(&cinfo);
       return status;
     }
 
@@ -287,7 +717,7 @@ uhdr_error_info_t JpegDecoderHelper::decode(const void* image, size_t length, de
                  "received bad horizontal sampling factor for component index %d, sample factor h "
                  "= %d, this is expected to be with in range [1-4]",
                  i, cinfo.comp_info[i].h_samp_factor);
-        jpeg_destroy_decompress(&cinfo);
+        jpeg_abort_decompress(&cinfo);
         return status;
       }
       if (cinfo.comp_info[i].v_samp_factor < 1 || cinfo.comp_info[i].v_samp_factor > 4) {
@@ -297,7 +727,7 @@ uhdr_error_info_t JpegDecoderHelper::decode(const void* image, size_t length, de
                  "received bad vertical sampling factor for component index %d, sample factor v = "
                  "%d, this is expected to be with in range [1-4]",
                  i, cinfo.comp_info[i].v_samp_factor);
-        jpeg_destroy_decompress(&cinfo);
+        jpeg_abort_decompress(&cinfo);
         return status;
       }
       product += cinfo.comp_info[i].h_samp_factor * cinfo.comp_info[i].v_samp_factor;
@@ -307,12 +737,14 @@ uhdr_error_info_t JpegDecoderHelper::decode(const void* image, size_t length, de
         snprintf(status.detail, sizeof status.detail,
                  "received bad sampling factors for components, sum of product of h_samp_factor, "
                  "v_samp_factor across all components exceeds 10");
-        jpeg_destroy_decompress(&cinfo);
+        jpeg_abort_decompress(&cinfo);
         return status;
       }
     }
 
     mNumComponents = cinfo.num_components;
+    mImageWidth = cinfo.image_width;
+    mImageHeight = cinfo.image_height;
     for (int i = 0; i < cinfo.num_components; i++) {
       mPlaneWidth[i] = std::ceil(((float)cinfo.image_width * cinfo.comp_info[i].h_samp_factor) /
                                  cinfo.max_h_samp_factor);
@@ -331,7 +763,7 @@ uhdr_error_info_t JpegDecoderHelper::decode(const void* image, size_t length, de
                  "width %d, cb height %d, cr width %d, cr height %d",
                  (int)mPlaneWidth[0], (int)mPlaneHeight[0], (int)mPlaneWidth[1],
                  (int)mPlaneHeight[1], (int)mPlaneWidth[2], (int)mPlaneHeight[2]);
-        jpeg_destroy_decompress(&cinfo);
+        jpeg_abort_decompress(&cinfo);
         return status;
       }
       if (mPlaneWidth[1] != mPlaneWidth[2] || mPlaneHeight[1] != mPlaneHeight[2]) {
@@ -342,13 +774,20 @@ uhdr_error_info_t JpegDecoderHelper::decode(const void* image, size_t length, de
                  "%d, cr height %d",
                  (int)mPlaneWidth[1], (int)mPlaneHeight[1], (int)mPlaneWidth[2],
                  (int)mPlaneHeight[2]);
-        jpeg_destroy_decompress(&cinfo);
+        jpeg_abort_decompress(&cinfo);
         return status;
       }
     }
 
     if (PARSE_STREAM == mode) {
-      jpeg_destroy_decompress(&cinfo);
+      jpeg_abort_decompress(&cinfo);
+      return status;
+    }
+
+    if (region != nullptr || scale_denom > 1) {
+      status = decodeInterleaved(&cinfo, mode, region, scale_denom);
+      // rows below the region are of no interest
+      jpeg_abort_decompress(&cinfo);
       return status;
     }
 
@@ -363,7 +802,7 @@ uhdr_error_info_t JpegDecoderHelper::decode(const void* image, size_t length, de
         snprintf(status.detail, sizeof status.detail,
                  "expected input color space to be JCS_YCbCr or JCS_RGB but got %d",
                  cinfo.jpeg_color_space);
-        jpeg_destroy_decompress(&cinfo);
+        jpeg_abort_decompress(&cinfo);
         return status;
       }
       mPlaneHStride[0] = cinfo.image_width;
@@ -372,13 +811,15 @@ uhdr_error_info_t JpegDecoderHelper::decode(const void* image, size_t length, de
         mPlaneHStride[i] = 0;
         mPlaneVStride[i] = 0;
       }
+      mResultRows[0] = strip_height ? (std::min)(strip_height, mPlaneVStride[0]) : mPlaneVStride[0];
 #ifdef JCS_ALPHA_EXTENSIONS
-      mResultBuffer.resize((size_t)mPlaneHStride[0] * mPlaneVStride[0] * 4);
       cinfo.out_color_space = JCS_EXT_RGBA;
+      allocateResult(&cinfo, (size_t)mPlaneHStride[0] * mResultRows[0] * 4, strip_height == 0);
 #else
-      mResultBuffer.resize((size_t)mPlaneHStride[0] * mPlaneVStride[0] * 3);
       cinfo.out_color_space = JCS_RGB;
+      allocateResult(&cinfo, (size_t)mPlaneHStride[0] * mResultRows[0] * 3, strip_height == 0);
 #endif
+      cinfo.do_fancy_upsampling = mFancyUpsampling;
     } else if (DECODE_TO_YCBCR_CS == mode) {
       if (cinfo.jpeg_color_space != JCS_YCbCr && cinfo.jpeg_color_space != JCS_GRAYSCALE) {
         status.error_code = UHDR_CODEC_ERROR;
@@ -386,60 +827,111 @@ uhdr_error_info_t JpegDecoderHelper::decode(const void* image, size_t length, de
         snprintf(status.detail, sizeof status.detail,
                  "expected input color space to be JCS_YCbCr or JCS_GRAYSCALE but got %d",
                  cinfo.jpeg_color_space);
-        jpeg_destroy_decompress(&cinfo);
+        jpeg_abort_decompress(&cinfo);
         return status;
       }
+      // strips span whole mcu rows, as raw data is read one mcu row at a time
+      const unsigned int mcu_rows = DCTSIZE * cinfo.max_v_samp_factor;
+      const unsigned int strip_rows =
+          (std::min)(ALIGNM(strip_height, mcu_rows), ALIGNM(cinfo.image_height, mcu_rows));
       size_t size = 0;
       for (int i = 0; i < cinfo.num_components; i++) {
         mPlaneHStride[i] = ALIGNM(mPlaneWidth[i], cinfo.max_h_samp_factor);
         mPlaneVStride[i] = ALIGNM(mPlaneHeight[i], cinfo.max_v_samp_factor);
-        size += (size_t)mPlaneHStride[i] * mPlaneVStride[i];
+        mResultRows[i] = strip_rows ? strip_rows * cinfo.comp_info[i].v_samp_factor /
+                                          cinfo.max_v_samp_factor
+                                    : mPlaneVStride[i];
+        size += (size_t)mPlaneHStride[i] * mResultRows[i];
       }
-      mResultBuffer.resize(size);
       cinfo.out_color_space = cinfo.jpeg_color_space;
       cinfo.raw_data_out = TRUE;
+      allocateResult(&cinfo, size, strip_height == 0);
+      if (strip_height == 0 && pull == nullptr && mBackend.decompress != nullptr &&
+          decodeWithBackend(&cinfo, image, length)) {
+        jpeg_abort_decompress(&cinfo);
+        return status;
+      }
+    }
+    cinfo.dct_method = mDctMethod;
+    std::vector<ScanSegment> segments;
+    if (strip_height == 0 && pull == nullptr &&
+        indexScanSegments(&cinfo, static_cast<const uint8_t*>(image), length, segments)) {
+      status = decodeSegments(&cinfo, static_cast<const uint8_t*>(image), segments);
+      jpeg_abort_decompress(&cinfo);
+      return status;
     }
-    cinfo.dct_method = JDCT_ISLOW;
     jpeg_start_decompress(&cinfo);
-    status = decode(&cinfo, static_cast<uint8_t*>(mResultBuffer.data()));
+    if (strip_height != 0) {
+      // rows are decoded on demand by decompressStrip()
+      mOutFormat = getOutputFormat(&cinfo);
+      mStripDecoding = true;
+      return status;
+    }
+    status = decode(&cinfo, mResultData, cinfo.image_height);
     if (status.error_code != UHDR_CODEC_OK) {
-      jpeg_destroy_decompress(&cinfo);
+      jpeg_abort_decompress(&cinfo);
       return status;
     }
   } else {
     status.error_code = UHDR_CODEC_ERROR;
     status.has_detail = 1;
     cinfo.err->format_message((j_common_ptr)&cinfo, status.detail);
-    jpeg_destroy_decompress(&cinfo);
+    releaseState();
     return status;
   }
   jpeg_finish_decompress(&cinfo);
-  jpeg_destroy_decompress(&cinfo);
   return status;
 }
 
-uhdr_error_info_t JpegDecoderHelper::decode(jpeg_decompress_struct* cinfo, uint8_t* dest) {
+bool JpegDecoderHelper::decodeWithBackend(jpeg_decompress_struct* cinfo, const void* image,
+                                          size_t length) {
+  const uhdr_img_fmt_t format = getOutputFormat(cinfo);
+  if (format == UHDR_IMG_FMT_UNSPECIFIED) return false;
+  uhdr_compressed_image_t src{};
+  src.data = const_cast<void*>(image);
+  src.data_sz = src.capacity = length;
+  src.cg = UHDR_CG_UNSPECIFIED;
+  src.ct = UHDR_CT_UNSPECIFIED;
+  src.range = UHDR_CR_UNSPECIFIED;
+  uhdr_raw_image_t dst{};
+  dst.fmt = format;
+  dst.cg = UHDR_CG_UNSPECIFIED;
+  dst.ct = UHDR_CT_UNSPECIFIED;
+  dst.range = UHDR_CR_UNSPECIFIED;
+  dst.w = mImageWidth;
+  dst.h = mImageHeight;
+  uint8_t* plane = mResultData;
+  for (unsigned int i = 0; i < mNumComponents; i++) {
+    dst.planes[i] = plane;
+    dst.stride[i] = mPlaneHStride[i];
+    plane += (size_t)mPlaneHStride[i] * mResultRows[i];
+  }
+  if (mBackend.decompress(mBackend.backend_ctx, &src, &dst) != 0) return false;
+  mOutFormat = format;
+  return true;
+}
+
+uhdr_error_info_t JpegDecoderHelper::decode(jpeg_decompress_struct* cinfo, uint8_t* dest,
+                                            JDIMENSION row_end) {
   uhdr_error_info_t status = g_no_error;
+  mOutFormat = getOutputFormat(cinfo);
   switch (cinfo->out_color_space) {
     case JCS_GRAYSCALE:
       [[fallthrough]];
     case JCS_YCbCr:
-      mOutFormat = getOutputSamplingFormat(cinfo);
       if (mOutFormat == UHDR_IMG_FMT_UNSPECIFIED) {
         status.error_code = UHDR_CODEC_ERROR;
         status.has_detail = 1;
         snprintf(status.detail, sizeof status.detail,
                  "unrecognized subsampling format for output color space JCS_YCbCr");
       }
-      return decodeToCSYCbCr(cinfo, dest);
+      return decodeToCSYCbCr(cinfo, dest, row_end);
 #ifdef JCS_ALPHA_EXTENSIONS
     case JCS_EXT_RGBA:
-      mOutFormat = UHDR_IMG_FMT_32bppRGBA8888;
-      return decodeToCSRGB(cinfo, dest);
+      [[fallthrough]];
 #endif
     case JCS_RGB:
-      mOutFormat = UHDR_IMG_FMT_24bppRGB888;
-      return decodeToCSRGB(cinfo, dest);
+      return decodeToCSRGB(cinfo, dest, row_end);
     default:
       status.error_code = UHDR_CODEC_ERROR;
       status.has_detail = 1;
@@ -449,10 +941,12 @@ uhdr_error_info_t JpegDecoderHelper::decode(jpeg_decompress_struct* cinfo, uint8
   return status;
 }
 
-uhdr_error_info_t JpegDecoderHelper::decodeToCSRGB(jpeg_decompress_struct* cinfo, uint8_t* dest) {
+uhdr_error_info_t JpegDecoderHelper::decodeToCSRGB(jpeg_decompress_struct* cinfo, uint8_t* dest,
+                                                   JDIMENSION row_end) {
   JSAMPLE* out = (JSAMPLE*)dest;
 
-  while (cinfo->output_scanline < cinfo->image_height) {
+  while (cinfo->output_scanline < row_end) {
+    if (CancelToken::cancelled()) return CancelToken::check();
     JDIMENSION read_lines = jpeg_read_scanlines(cinfo, &out, 1);
     if (1 != read_lines) {
       uhdr_error_info_t status;
@@ -471,32 +965,49 @@ uhdr_error_info_t JpegDecoderHelper::decodeToCSRGB(jpeg_decompress_struct* cinfo
   return g_no_error;
 }
 
-uhdr_error_info_t JpegDecoderHelper::decodeToCSYCbCr(jpeg_decompress_struct* cinfo, uint8_t* dest) {
+uhdr_error_info_t JpegDecoderHelper::decodeToCSYCbCr(jpeg_decompress_struct* cinfo, uint8_t* dest,
+                                                     JDIMENSION row_end) {
+  uint8_t* planes[kMaxNumComponents]{};
+
+  for (int i = 0, plane_offset = 0; i < cinfo->num_components; i++) {
+    planes[i] = dest + plane_offset;
+    plane_offset += mPlaneHStride[i] * mResultRows[i];
+  }
+  return decodeToCSYCbCr(cinfo, planes, row_end);
+}
+
+uhdr_error_info_t JpegDecoderHelper::decodeToCSYCbCr(jpeg_decompress_struct* cinfo,
+                                                     uint8_t* const planes[],
+                                                     JDIMENSION row_end) {
   JSAMPROW mcuRows[kMaxNumComponents][4 * DCTSIZE];
   JSAMPROW mcuRowsTmp[kMaxNumComponents][4 * DCTSIZE];
-  uint8_t* planes[kMaxNumComponents]{};
   size_t alignedPlaneWidth[kMaxNumComponents]{};
   JSAMPARRAY subImage[kMaxNumComponents];
+  // planes hold plane rows [planeRowStart, planeRowStart + planeRows) of each component
+  JDIMENSION planeRowStart[kMaxNumComponents]{};
+  JDIMENSION planeRows[kMaxNumComponents]{};
 
-  for (int i = 0, plane_offset = 0; i < cinfo->num_components; i++) {
-    planes[i] = dest + plane_offset;
-    plane_offset += mPlaneHStride[i] * mPlaneVStride[i];
+  for (int i = 0; i < cinfo->num_components; i++) {
+    planeRowStart[i] =
+        std::ceil(((float)cinfo->output_scanline * cinfo->comp_info[i].v_samp_factor) /
+                  cinfo->max_v_samp_factor);
+    planeRows[i] = (std::min)(mResultRows[i], mPlaneVStride[i] - planeRowStart[i]);
     alignedPlaneWidth[i] = ALIGNM(mPlaneHStride[i], DCTSIZE);
     if (mPlaneHStride[i] != alignedPlaneWidth[i]) {
-      mPlanesMCURow[i] = std::make_unique<uint8_t[]>(alignedPlaneWidth[i] * DCTSIZE *
-                                                     cinfo->comp_info[i].v_samp_factor);
-      uint8_t* mem = mPlanesMCURow[i].get();
+      mPlanesMCURow[i].resize(alignedPlaneWidth[i] * DCTSIZE * cinfo->comp_info[i].v_samp_factor);
+      uint8_t* mem = mPlanesMCURow[i].data();
       for (int j = 0; j < DCTSIZE * cinfo->comp_info[i].v_samp_factor;
            j++, mem += alignedPlaneWidth[i]) {
         mcuRowsTmp[i][j] = mem;
       }
     } else if (mPlaneVStride[i] % DCTSIZE != 0) {
-      mPlanesMCURow[i] = std::make_unique<uint8_t[]>(alignedPlaneWidth[i]);
+      mPlanesMCURow[i].resize(alignedPlaneWidth[i]);
     }
     subImage[i] = mPlaneHStride[i] == alignedPlaneWidth[i] ? mcuRows[i] : mcuRowsTmp[i];
   }
 
-  while (cinfo->output_scanline < cinfo->image_height) {
+  while (cinfo->output_scanline < row_end) {
+    if (CancelToken::cancelled()) return CancelToken::check();
     JDIMENSION mcu_scanline_start[kMaxNumComponents];
 
     for (int i = 0; i < cinfo->num_components; i++) {
@@ -505,12 +1016,12 @@ uhdr_error_info_t JpegDecoderHelper::decodeToCSYCbCr(jpeg_decompress_struct* cin
                     cinfo->max_v_samp_factor);
 
       for (int j = 0; j < cinfo->comp_info[i].v_samp_factor * DCTSIZE; j++) {
-        JDIMENSION scanline = mcu_scanline_start[i] + j;
+        JDIMENSION scanline = mcu_scanline_start[i] + j - planeRowStart[i];
 
-        if (scanline < mPlaneVStride[i]) {
+        if (scanline < planeRows[i]) {
           mcuRows[i][j] = planes[i] + (size_t)scanline * mPlaneHStride[i];
         } else {
-          mcuRows[i][j] = mPlanesMCURow[i].get();
+          mcuRows[i][j] = mPlanesMCURow[i].data();
         }
       }
     }
@@ -529,8 +1040,8 @@ uhdr_error_info_t JpegDecoderHelper::decodeToCSYCbCr(jpeg_decompress_struct* cin
     for (int i = 0; i < cinfo->num_components; i++) {
       if (mPlaneHStride[i] != alignedPlaneWidth[i]) {
         for (int j = 0; j < cinfo->comp_info[i].v_samp_factor * DCTSIZE; j++) {
-          JDIMENSION scanline = mcu_scanline_start[i] + j;
-          if (scanline < mPlaneVStride[i]) {
+          JDIMENSION scanline = mcu_scanline_start[i] + j - planeRowStart[i];
+          if (scanline < planeRows[i]) {
             memcpy(mcuRows[i][j], mcuRowsTmp[i][j], mPlaneWidth[i]);
           }
         }
@@ -540,6 +1051,299 @@ uhdr_error_info_t JpegDecoderHelper::decodeToCSYCbCr(jpeg_decompress_struct* cin
   return g_no_error;
 }
 
+bool JpegDecoderHelper::indexScanSegments(const jpeg_decompress_struct* cinfo,
+                                          const uint8_t* image, size_t length,
+                                          std::vector<ScanSegment>& segments) {
+  if (!mParallelRunner || mParallelism < 2 || cinfo->restart_interval == 0 ||
+      cinfo->progressive_mode || cinfo->arith_code ||
+      cinfo->comps_in_scan != cinfo->num_components || mHeaderView.scanOffset == 0) {
+    return false;
+  }
+  if (cinfo->raw_data_out) {
+    if (getOutputFormat(const_cast<j_decompress_ptr>(cinfo)) == UHDR_IMG_FMT_UNSPECIFIED) {
+      return false;
+    }
+  } else {
+    // fancy upsampling of vertically subsampled chroma looks across the runs of rows
+    for (int i = 0; i < cinfo->num_components; i++) {
+      if (cinfo->comp_info[i].v_samp_factor != cinfo->max_v_samp_factor) return false;
+    }
+  }
+
+  // the mcu of a single component scan is one block, whatever the sampling factors
+  const bool interleaved = cinfo->comps_in_scan > 1;
+  const unsigned int mcuWidth = DCTSIZE * (interleaved ? cinfo->max_h_samp_factor : 1);
+  const unsigned int mcuHeight = DCTSIZE * (interleaved ? cinfo->max_v_samp_factor : 1);
+  const unsigned int mcusPerRow = (cinfo->image_width + mcuWidth - 1) / mcuWidth;
+  if (cinfo->restart_interval % mcusPerRow != 0) return false;
+  // runs must start at an mcu row boundary of the raw data reader
+  const unsigned int rowsPerInterval = cinfo->restart_interval / mcusPerRow * mcuHeight;
+  if (rowsPerInterval % (DCTSIZE * cinfo->max_v_samp_factor) != 0) return false;
+  const unsigned int numIntervals = (cinfo->image_height + rowsPerInterval - 1) / rowsPerInterval;
+  const unsigned int intervalsPerSegment =
+      (numIntervals + 2 * mParallelism - 1) / (2 * mParallelism);
+  if (intervalsPerSegment >= numIntervals) return false;
+
+  // offsets of the RSTn markers, the scan ends at the first other marker
+  std::vector<size_t> markers;
+  markers.reserve(numIntervals - 1);
+  size_t pos = mHeaderView.scanOffset, scanEnd = 0;
+  while (scanEnd == 0) {
+    const void* ff = memchr(image + pos, 0xFF, length - pos);
+    if (ff == nullptr) return false;
+    pos = static_cast<const uint8_t*>(ff) - image;
+    if (pos + 1 >= length) return false;
+    const uint8_t marker = image[pos + 1];
+    if (marker == 0x00 || marker == 0xFF) { /* stuffed zero or fill byte */
+      pos++;
+    } else if (marker >= JPEG_RST0 && marker <= JPEG_RST0 + 7) {
+      if (marker != JPEG_RST0 + (markers.size() & 7)) return false;
+      markers.push_back(pos);
+      pos += 2;
+    } else {
+      scanEnd = pos;
+    }
+  }
+  if (markers.size() + 1 != numIntervals) return false;
+
+  segments.clear();
+  for (unsigned int first = 0; first < numIntervals; first += intervalsPerSegment) {
+    const unsigned int last = (std::min)(first + intervalsPerSegment, numIntervals);
+    const size_t start = first == 0 ? mHeaderView.scanOffset : markers[first - 1] + 2;
+    const size_t end = last == numIntervals ? scanEnd : markers[last - 1];
+    ScanSegment segment;
+    segment.data = image + start;
+    segment.size = end - start;
+    segment.firstInterval = first;
+    segment.rowStart = first * rowsPerInterval;
+    segment.rows = (std::min)(last * rowsPerInterval, cinfo->image_height) - segment.rowStart;
+    segments.push_back(segment);
+  }
+  return true;
+}
+
+uhdr_error_info_t JpegDecoderHelper::decodeSegments(const jpeg_decompress_struct* cinfo,
+                                                    const uint8_t* image,
+                                                    const std::vector<ScanSegment>& segments) {
+  mOutFormat = getOutputFormat(const_cast<j_decompress_ptr>(cinfo));
+  // one worker per job, each keeps its libjpeg state and row buffers across images
+  if (mSegmentWorkers.size() < mParallelism) mSegmentWorkers.resize(mParallelism);
+  for (auto& worker : mSegmentWorkers) {
+    if (worker == nullptr) worker = std::make_unique<JpegDecoderHelper>();
+  }
+  std::vector<uhdr_error_info_t> segmentStatus(segments.size(), g_no_error);
+  std::atomic<unsigned int> nextJob{0};
+  std::atomic<size_t> nextSegment{0};
+  std::function<void()> job = [&]() {
+    const unsigned int jobIndex = nextJob++;
+    if (jobIndex >= mSegmentWorkers.size()) return;
+    JpegDecoderHelper& worker = *mSegmentWorkers[jobIndex];
+    for (size_t k = nextSegment++; k < segments.size(); k = nextSegment++) {
+      segmentStatus[k] = worker.decodeSegment(*this, cinfo, image, segments[k]);
+    }
+  };
+  mParallelRunner(job, mParallelism);
+  for (const auto& it : segmentStatus) UHDR_ERR_CHECK(it)
+  return g_no_error;
+}
+
+uhdr_error_info_t JpegDecoderHelper::decodeSegment(JpegDecoderHelper& parent,
+                                                   const jpeg_decompress_struct* frame,
+                                                   const uint8_t* image,
+                                                   const ScanSegment& segment) {
+  UHDR_TRACE_SCOPE("JpegDecoderHelper::decodeSegment");
+  // the segment is presented to libjpeg as an image of its own: the headers of the parent with
+  // the frame height of the segment, followed by its share of the scan
+  const size_t sofPos = parent.mHeaderView.frameHeaderOffset;
+  const size_t scanPos = parent.mHeaderView.scanOffset;
+  const JOCTET height[2]{static_cast<JOCTET>(segment.rows >> 8),
+                         static_cast<JOCTET>(segment.rows & 0xFF)};
+  const JOCTET eoi[2]{0xFF, JPEG_EOI};
+  DecodeState* state = acquireState();
+  if (state == nullptr) return stateCreationError();
+  jpeg_chunked_source_mgr& mgr = state->chunkedMgr;
+  mgr.mChunks[0] = image;
+  mgr.mChunkLengths[0] = sofPos + 5;
+  mgr.mChunks[1] = height;
+  mgr.mChunkLengths[1] = sizeof height;
+  mgr.mChunks[2] = image + sofPos + 7;
+  mgr.mChunkLengths[2] = scanPos - sofPos - 7;
+  mgr.mChunks[3] = segment.data;
+  mgr.mChunkLengths[3] = segment.size;
+  mgr.mChunks[4] = eoi;
+  mgr.mChunkLengths[4] = sizeof eoi;
+  mgr.mNumChunks = 5;
+  mgr.mRestartOffset = segment.firstInterval;
+
+  jpeg_decompress_struct& cinfo = state->cinfo;
+  uhdr_error_info_t status = g_no_error;
+
+  if (0 == setjmp(state->err.setjmp_buffer)) {
+    cinfo.src = &mgr;
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = frame->out_color_space;
+    cinfo.raw_data_out = frame->raw_data_out;
+    cinfo.dct_method = frame->dct_method;
+    jpeg_start_decompress(&cinfo);
+
+    uint8_t* dest = parent.mResultData;
+    if (cinfo.raw_data_out) {
+      uint8_t* planes[kMaxNumComponents]{};
+      for (int i = 0; i < cinfo.num_components; i++) {
+        const unsigned int rowStart =
+            segment.rowStart * cinfo.comp_info[i].v_samp_factor / cinfo.max_v_samp_factor;
+        planes[i] = dest + (size_t)rowStart * parent.mPlaneHStride[i];
+        dest += (size_t)parent.mPlaneHStride[i] * parent.mResultRows[i];
+        mPlaneWidth[i] = parent.mPlaneWidth[i];
+        mPlaneHStride[i] = parent.mPlaneHStride[i];
+        mPlaneVStride[i] = parent.mPlaneVStride[i] - rowStart;
+        mResultRows[i] = mPlaneVStride[i];
+      }
+      status = decodeToCSYCbCr(&cinfo, planes, cinfo.image_height);
+    } else {
+#ifdef JCS_ALPHA_EXTENSIONS
+      const size_t channels = 4;
+#else
+      const size_t channels = 3;
+#endif
+      mPlaneHStride[0] = parent.mPlaneHStride[0];
+      status = decodeToCSRGB(&cinfo, dest + (size_t)segment.rowStart * mPlaneHStride[0] * channels,
+                             cinfo.image_height);
+    }
+  } else {
+    status.error_code = UHDR_CODEC_ERROR;
+    status.has_detail = 1;
+    cinfo.err->format_message((j_common_ptr)&cinfo, status.detail);
+    releaseState();
+    return status;
+  }
+  // trailing markers are of no interest
+  jpeg_abort_decompress(&cinfo);
+  return status;
+}
+
+uhdr_error_info_t JpegDecoderHelper::decodeInterleaved(jpeg_decompress_struct* cinfo,
+                                                       decode_mode_t mode,
+                                                       const image_region_t* area,
+                                                       unsigned int scale_denom) {
+  uhdr_error_info_t status = g_no_error;
+  if (DECODE_STREAM == mode) {
+    mode = cinfo->num_components == 1 ? DECODE_TO_YCBCR_CS : DECODE_TO_RGB_CS;
+  }
+
+  unsigned int channels;
+  if (DECODE_TO_RGB_CS == mode) {
+    if (cinfo->jpeg_color_space != JCS_YCbCr && cinfo->jpeg_color_space != JCS_RGB) {
+      status.error_code = UHDR_CODEC_ERROR;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "expected input color space to be JCS_YCbCr or JCS_RGB but got %d",
+               cinfo->jpeg_color_space);
+      return status;
+    }
+#ifdef JCS_ALPHA_EXTENSIONS
+    cinfo->out_color_space = JCS_EXT_RGBA;
+    channels = 4;
+#else
+    cinfo->out_color_space = JCS_RGB;
+    channels = 3;
+#endif
+    cinfo->do_fancy_upsampling = mFancyUpsampling;
+  } else {
+    if (cinfo->jpeg_color_space != JCS_YCbCr && cinfo->jpeg_color_space != JCS_GRAYSCALE) {
+      status.error_code = UHDR_CODEC_ERROR;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "expected input color space to be JCS_YCbCr or JCS_GRAYSCALE but got %d",
+               cinfo->jpeg_color_space);
+      return status;
+    }
+    // libjpeg cannot crop or skip raw data, and the raw path here assumes unscaled blocks. Decode
+    // to interleaved samples instead, replicating chroma so that every pixel sees exactly the
+    // sample a raw decode would give it.
+    cinfo->out_color_space = cinfo->jpeg_color_space;
+    cinfo->do_fancy_upsampling = FALSE;
+    channels = cinfo->num_components;
+  }
+  cinfo->dct_method = mDctMethod;
+  cinfo->scale_num = 1;
+  cinfo->scale_denom = scale_denom;
+  jpeg_calc_output_dimensions(cinfo);
+
+  const image_region_t region =
+      area != nullptr ? *area : image_region_t{0, 0, cinfo->output_width, cinfo->output_height};
+  if (region.width == 0 || region.height == 0 || region.left >= cinfo->output_width ||
+      region.top >= cinfo->output_height || region.width > cinfo->output_width - region.left ||
+      region.height > cinfo->output_height - region.top) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "region left %u, top %u, width %u, height %u does not lie within image of "
+             "dimensions %ux%u",
+             region.left, region.top, region.width, region.height, cinfo->output_width,
+             cinfo->output_height);
+    return status;
+  }
+  jpeg_start_decompress(cinfo);
+
+  // the crop is widened to iMCU column boundaries by libjpeg
+  JDIMENSION crop_left = region.left, crop_width = region.width;
+  if (crop_width != cinfo->output_width) jpeg_crop_scanline(cinfo, &crop_left, &crop_width);
+  if (region.top > 0) {
+    JDIMENSION skipped = jpeg_skip_scanlines(cinfo, region.top);
+    if (skipped != region.top) {
+      status.error_code = UHDR_CODEC_ERROR;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "jpeg_skip_scanlines returned %d, expected %d", skipped, region.top);
+      return status;
+    }
+  }
+
+  mOutFormat = DECODE_TO_RGB_CS == mode ? getOutputFormat(cinfo)
+               : channels == 1          ? UHDR_IMG_FMT_8bppYCbCr400
+                                        : UHDR_IMG_FMT_24bppYCbCr444;
+  const unsigned int planes = DECODE_TO_RGB_CS == mode ? 1 : channels;
+  for (unsigned int i = 0; i < kMaxNumComponents; i++) {
+    const bool used = i < planes;
+    mPlaneWidth[i] = used ? region.width : 0;
+    mPlaneHeight[i] = used ? region.height : 0;
+    mPlaneHStride[i] = mPlaneWidth[i];
+    mPlaneVStride[i] = mPlaneHeight[i];
+    mResultRows[i] = mPlaneHeight[i];
+  }
+  const size_t plane_size = (size_t)region.width * region.height;
+  mResultBuffer.resize(plane_size * channels);
+  mResultData = mResultBuffer.data();
+  mResultSize = mResultBuffer.size();
+
+  std::vector<JSAMPLE> row((size_t)crop_width * channels);
+  for (unsigned int y = 0; y < region.height; y++) {
+    if (CancelToken::cancelled()) return CancelToken::check();
+    JSAMPROW row_ptr = row.data();
+    JDIMENSION read_lines = jpeg_read_scanlines(cinfo, &row_ptr, 1);
+    if (1 != read_lines) {
+      status.error_code = UHDR_CODEC_ERROR;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail, "jpeg_read_scanlines returned %d, expected %d",
+               read_lines, 1);
+      return status;
+    }
+    const JSAMPLE* src = row.data() + (size_t)(region.left - crop_left) * channels;
+    uint8_t* dst = mResultData + (size_t)y * region.width * (planes == 1 ? channels : 1);
+    if (planes == 1) {
+      memcpy(dst, src, (size_t)region.width * channels);
+    } else {
+      for (unsigned int x = 0; x < region.width; x++) {
+        for (unsigned int c = 0; c < channels; c++) {
+          dst[c * plane_size + x] = src[x * channels + c];
+        }
+      }
+    }
+  }
+  return status;
+}
+
 uhdr_raw_image_t JpegDecoderHelper::getDecompressedImage() {
   uhdr_raw_image_t img;
 
@@ -549,14 +1353,47 @@ uhdr_raw_image_t JpegDecoderHelper::getDecompressedImage() {
   img.range = UHDR_CR_FULL_RANGE;
   img.w = mPlaneWidth[0];
   img.h = mPlaneHeight[0];
-  uint8_t* data = mResultBuffer.data();
+  uint8_t* data = mResultData;
   for (int i = 0; i < 3; i++) {
     img.planes[i] = data;
     img.stride[i] = mPlaneHStride[i];
-    data += (size_t)mPlaneHStride[i] * mPlaneVStride[i];
+    data += (size_t)mPlaneHStride[i] * mResultRows[i];
   }
 
   return img;
 }
 
+uhdr_error_info_t JpegDecoderHelper::decompressStrip(uhdr_raw_image_t* strip,
+                                                     unsigned int& row_start) {
+  UHDR_TRACE_SCOPE("JpegDecoderHelper::decompressStrip");
+  *strip = getDecompressedImage();
+  strip->h = 0;
+  row_start = mPlaneHeight[0];
+  if (!mStripDecoding) return g_no_error;
+
+  jpeg_decompress_struct& cinfo = mState->cinfo;
+  uhdr_error_info_t status = g_no_error;
+  row_start = cinfo.output_scanline;
+  if (0 == setjmp(mState->err.setjmp_buffer)) {
+    JDIMENSION row_end = (std::min)(cinfo.output_scanline + mResultRows[0], cinfo.image_height);
+    status = decode(&cinfo, mResultData, row_end);
+  } else {
+    status.error_code = UHDR_CODEC_ERROR;
+    status.has_detail = 1;
+    cinfo.err->format_message((j_common_ptr)&cinfo, status.detail);
+    releaseState();
+    return status;
+  }
+  if (status.error_code != UHDR_CODEC_OK) {
+    endStripDecode();
+    return status;
+  }
+  strip->h = (std::min)(cinfo.output_scanline, cinfo.image_height) - row_start;
+  if (cinfo.output_scanline >= cinfo.image_height) {
+    // all rows are out, trailing markers are of no interest
+    endStripDecode();
+  }
+  return status;
+}
+
 }  // namespace ultrahdr
@@ -17,19 +17,27 @@
 #include <errno.h>
 #include <setjmp.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <cstring>
-#include <map>
 #include <memory>
 #include <string>
 
 #include "ultrahdr/ultrahdrcommon.h"
 #include "ultrahdr/jpegencoderhelper.h"
+#include "ultrahdr/threadpool.h"
+#include "ultrahdr/trace.h"
 
 namespace ultrahdr {
 
-/*!\brief map of sub sampling format and jpeg h_samp_factor, v_samp_factor */
-std::map<uhdr_img_fmt_t, std::vector<int>> sample_factors = {
+/*!\brief sub sampling format and jpeg h_samp_factor, v_samp_factor of its components */
+struct sample_factor_entry {
+  uhdr_img_fmt_t fmt;
+  int factors[8];
+};
+
+static constexpr sample_factor_entry kSampleFactors[] = {
     {UHDR_IMG_FMT_8bppYCbCr400,
      {1 /*h0*/, 1 /*v0*/, 0 /*h1*/, 0 /*v1*/, 0 /*h2*/, 0 /*v2*/, 1 /*maxh*/, 1 /*maxv*/}},
     {UHDR_IMG_FMT_24bppYCbCr444,
@@ -48,6 +56,13 @@ std::map<uhdr_img_fmt_t, std::vector<int>> sample_factors = {
      {1 /*h0*/, 1 /*v0*/, 1 /*h1*/, 1 /*v1*/, 1 /*h2*/, 1 /*v2*/, 1 /*maxh*/, 1 /*maxv*/}},
 };
 
+static const sample_factor_entry* findSampleFactors(uhdr_img_fmt_t format) {
+  for (const sample_factor_entry& entry : kSampleFactors) {
+    if (entry.fmt == format) return &entry;
+  }
+  return nullptr;
+}
+
 /*!\brief jpeg encoder library destination manager callback functions implementation */
 
 /*!\brief  called by jpeg_start_compress() before any data is actually written. This function is
@@ -104,6 +119,83 @@ static void outputErrorMessage(j_common_ptr cinfo) {
   ALOGE("%s\n", buffer);
 }
 
+/*!\brief libjpeg state of an encoder, kept across images along with the tables it holds */
+struct JpegEncoderHelper::CompressState {
+  jpeg_compress_struct cinfo;
+  jpeg_error_mgr_impl err;
+
+  // configuration the compression parameters were set up for
+  bool configured = false;
+  uhdr_img_fmt_t format = UHDR_IMG_FMT_UNSPECIFIED;
+  int qfactor = -1;
+  J_DCT_METHOD dctMethod = JDCT_ISLOW;
+  bool optimizeCoding = false;
+};
+
+/*!\brief Quantized dct coefficients of a compressed image, see keepCoefficients() */
+struct JpegEncoderHelper::CoefficientImage {
+  struct Component {
+    int hSampFactor;
+    int vSampFactor;
+    JDIMENSION widthInBlocks;
+    JDIMENSION heightInBlocks;
+    UINT16 quantval[DCTSIZE2];  // quantizer steps the coefficients were divided by
+    std::vector<JCOEF> blocks;  // widthInBlocks x heightInBlocks blocks, in raster order
+  };
+  JDIMENSION width;
+  JDIMENSION height;
+  J_COLOR_SPACE colorSpace;
+  std::vector<Component> components;
+  std::vector<uint8_t> stream;  // the compressed image, its application segments are copied
+};
+
+JpegEncoderHelper::JpegEncoderHelper() = default;
+
+JpegEncoderHelper::~JpegEncoderHelper() { releaseState(); }
+
+JpegEncoderHelper::CompressState* JpegEncoderHelper::acquireState() {
+  if (mState == nullptr) {
+    mState = std::make_unique<CompressState>();
+    mState->cinfo.err = jpeg_std_error(&mState->err);
+    mState->err.error_exit = jpegrerror_exit;
+    mState->err.output_message = outputErrorMessage;
+    if (0 != setjmp(mState->err.setjmp_buffer)) {
+      mState.reset();
+      return nullptr;
+    }
+    jpeg_create_compress(&mState->cinfo);
+  }
+  return mState.get();
+}
+
+void JpegEncoderHelper::releaseState() {
+  if (mState != nullptr) {
+    jpeg_destroy_compress(&mState->cinfo);
+    mState.reset();
+  }
+}
+
+/*!\brief Locates the frame header and the scan of a jpeg stream written by libjpeg. On success,
+ * sofPos and sosPos are the offsets of the SOF0 and SOS markers, and scanPos is the offset of the
+ * entropy coded data. */
+static bool findScan(const std::vector<JOCTET>& jpeg, size_t& sofPos, size_t& sosPos,
+                     size_t& scanPos) {
+  size_t pos = 2; /* position after reading SOI marker (0xffd8) */
+  sofPos = 0;
+  while (pos + 4 <= jpeg.size() && jpeg[pos] == 0xFF) {
+    const size_t segmentLength = (static_cast<size_t>(jpeg[pos + 2]) << 8) | jpeg[pos + 3];
+    if (jpeg[pos + 1] == 0xC0) sofPos = pos; /* SOF0 */
+    if (jpeg[pos + 1] == 0xDA) {             /* SOS */
+      sosPos = pos;
+      scanPos = pos + 2 + segmentLength;
+      return sofPos != 0 && scanPos + 2 <= jpeg.size() && jpeg[jpeg.size() - 2] == 0xFF &&
+             jpeg[jpeg.size() - 1] == 0xD9; /* EOI */
+    }
+    pos += 2 + segmentLength;
+  }
+  return false;
+}
+
 uhdr_error_info_t JpegEncoderHelper::compressImage(const uhdr_raw_image_t* img, const int qfactor,
                                                    const void* iccBuffer, const size_t iccSize) {
   const uint8_t* planes[3]{reinterpret_cast<uint8_t*>(img->planes[UHDR_PLANE_Y]),
@@ -119,9 +211,242 @@ uhdr_error_info_t JpegEncoderHelper::compressImage(const uint8_t* planes[3],
                                                    const int height, const uhdr_img_fmt_t format,
                                                    const int qfactor, const void* iccBuffer,
                                                    const size_t iccSize) {
+  UHDR_TRACE_SCOPE("JpegEncoderHelper::compressImage");
   return encode(planes, strides, width, height, format, qfactor, iccBuffer, iccSize);
 }
 
+uhdr_error_info_t JpegEncoderHelper::compressImage(const RowSource& source, const int width,
+                                                   const int height, const uhdr_img_fmt_t format,
+                                                   const int qfactor, const void* iccBuffer,
+                                                   const size_t iccSize) {
+  UHDR_TRACE_SCOPE("JpegEncoderHelper::compressImage");
+  if (format != UHDR_IMG_FMT_8bppYCbCr400 && format != UHDR_IMG_FMT_24bppRGB888) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "rows can only be streamed for single plane formats, received format %d", format);
+    return status;
+  }
+  const uint8_t* planes[3]{};
+  const unsigned int strides[3]{};
+  return encode(planes, strides, width, height, format, qfactor, iccBuffer, iccSize, &source);
+}
+
+uhdr_error_info_t JpegEncoderHelper::compressImage(const PlaneSource& source, const int width,
+                                                   const int height, const uhdr_img_fmt_t format,
+                                                   const int qfactor, const void* iccBuffer,
+                                                   const size_t iccSize) {
+  UHDR_TRACE_SCOPE("JpegEncoderHelper::compressImage");
+  if (format == UHDR_IMG_FMT_8bppYCbCr400 || format == UHDR_IMG_FMT_24bppRGB888) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "planes can only be streamed for planar ycbcr formats, received format %d", format);
+    return status;
+  }
+  const uint8_t* planes[3]{};
+  const unsigned int strides[3]{};
+  return encode(planes, strides, width, height, format, qfactor, iccBuffer, iccSize, nullptr,
+                &source);
+}
+
+uhdr_error_info_t JpegEncoderHelper::startImage(const int width, const int height,
+                                                const uhdr_img_fmt_t format, const int qfactor,
+                                                const void* iccBuffer, const size_t iccSize) {
+  UHDR_TRACE_SCOPE("JpegEncoderHelper::startImage");
+  uhdr_error_info_t status = g_no_error;
+
+  const sample_factor_entry* entry = findSampleFactors(format);
+  if (entry == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "unrecognized input format %d", format);
+    return status;
+  }
+  CompressState* state = acquireState();
+  if (state == nullptr) {
+    status.error_code = UHDR_CODEC_MEM_ERROR;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "failed to create libjpeg compressor");
+    return status;
+  }
+  if (mRowsStarted) jpeg_abort_compress(&state->cinfo);
+  mRowsStarted = false;
+
+  if (0 == setjmp(state->err.setjmp_buffer)) {
+    status = setupCompress(state, width, height, format, qfactor, iccBuffer, iccSize);
+    if (status.error_code != UHDR_CODEC_OK) return status;
+  } else {
+    status.error_code = UHDR_CODEC_ERROR;
+    status.has_detail = 1;
+    state->cinfo.err->format_message((j_common_ptr)&state->cinfo, status.detail);
+    releaseState();
+    return status;
+  }
+
+  // raw data input takes whole mcu rows, rows are gathered in a buffer of one. As in
+  // compressPlaneRows(), luma is padded with zeros and chroma with 128 to whole blocks.
+  if (format != UHDR_IMG_FMT_24bppRGB888) {
+    for (int i = 0; i < state->cinfo.num_components; i++) {
+      mRowBufferStride[i] = ALIGNM(mPlaneWidth[i], DCTSIZE);
+      const size_t size = mRowBufferStride[i] * DCTSIZE * state->cinfo.comp_info[i].v_samp_factor;
+      mRowBuffer[i] = std::make_unique<uint8_t[]>(size);
+      memset(mRowBuffer[i].get(), i > 0 ? 128 : 0, size);
+    }
+  }
+  mRowsWritten = 0;
+  mRowsStarted = true;
+  return status;
+}
+
+uhdr_error_info_t JpegEncoderHelper::writeRows(const uhdr_raw_image_t* img) {
+  UHDR_TRACE_SCOPE("JpegEncoderHelper::writeRows");
+  uhdr_error_info_t status = g_no_error;
+
+  if (!mRowsStarted) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "no image was started to write rows to");
+    return status;
+  }
+  jpeg_compress_struct& cinfo = mState->cinfo;
+  const unsigned int maxV = cinfo.max_v_samp_factor;
+  if (img->w != cinfo.image_width || img->h > cinfo.image_height - mRowsWritten ||
+      mRowsWritten % maxV != 0) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "received %u rows of width %u at row %u of an image of dimensions %ux%u, rows are "
+             "written in multiples of %u but for the last ones",
+             img->h, img->w, mRowsWritten, cinfo.image_width, cinfo.image_height, maxV);
+    return status;
+  }
+  if (CancelToken::cancelled()) {
+    jpeg_abort_compress(&cinfo);
+    mRowsStarted = false;
+    return CancelToken::check();
+  }
+
+  if (0 == setjmp(mState->err.setjmp_buffer)) {
+    if (cinfo.in_color_space == JCS_RGB) {
+      const uint8_t* data = static_cast<const uint8_t*>(img->planes[UHDR_PLANE_PACKED]);
+      const size_t stride = (size_t)img->stride[UHDR_PLANE_PACKED] * 3;
+      for (unsigned int j = 0; j < img->h; j++) {
+        JSAMPROW row = const_cast<JSAMPROW>(data + j * stride);
+        if (1 != jpeg_write_scanlines(&cinfo, &row, 1)) {
+          status.error_code = UHDR_CODEC_ERROR;
+          status.has_detail = 1;
+          snprintf(status.detail, sizeof status.detail, "jpeg_write_scanlines failed at row %u",
+                   mRowsWritten);
+          jpeg_abort_compress(&cinfo);
+          mRowsStarted = false;
+          return status;
+        }
+        mRowsWritten++;
+      }
+      return status;
+    }
+
+    const unsigned int mcuHeight = DCTSIZE * maxV;
+    JSAMPROW mcuRows[kMaxNumComponents][2 * DCTSIZE];
+    JSAMPARRAY subImage[kMaxNumComponents];
+    for (int i = 0; i < cinfo.num_components; i++) {
+      for (int r = 0; r < DCTSIZE * cinfo.comp_info[i].v_samp_factor; r++) {
+        mcuRows[i][r] = mRowBuffer[i].get() + r * mRowBufferStride[i];
+      }
+      subImage[i] = mcuRows[i];
+    }
+    for (unsigned int j = 0; j < img->h;) {
+      const unsigned int rowInMcu = mRowsWritten % mcuHeight;
+      const unsigned int rows = (std::min)(img->h - j, mcuHeight - rowInMcu);
+      const bool last = mRowsWritten + rows == cinfo.image_height;
+      for (int i = 0; i < cinfo.num_components; i++) {
+        const unsigned int v = cinfo.comp_info[i].v_samp_factor;
+        const size_t srcRow = (size_t)j * v / maxV;
+        const size_t dstRow = (size_t)rowInMcu * v / maxV;
+        const size_t count = ((size_t)(j + rows) * v + maxV - 1) / maxV - srcRow;
+        const uint8_t* src = static_cast<const uint8_t*>(img->planes[i]);
+        for (size_t r = 0; r < count; r++) {
+          memcpy(mcuRows[i][dstRow + r], src + (srcRow + r) * img->stride[i], mPlaneWidth[i]);
+        }
+        // the rows below the image of its last mcu row
+        if (last) {
+          for (size_t r = dstRow + count; r < (size_t)DCTSIZE * v; r++) {
+            memset(mcuRows[i][r], i > 0 ? 128 : 0, mRowBufferStride[i]);
+          }
+        }
+      }
+      j += rows;
+      mRowsWritten += rows;
+      if (last || mRowsWritten % mcuHeight == 0) {
+        if (mcuHeight != jpeg_write_raw_data(&cinfo, subImage, mcuHeight)) {
+          status.error_code = UHDR_CODEC_ERROR;
+          status.has_detail = 1;
+          snprintf(status.detail, sizeof status.detail, "jpeg_write_raw_data failed at row %u",
+                   mRowsWritten - rows);
+          jpeg_abort_compress(&cinfo);
+          mRowsStarted = false;
+          return status;
+        }
+      }
+    }
+  } else {
+    status.error_code = UHDR_CODEC_ERROR;
+    status.has_detail = 1;
+    cinfo.err->format_message((j_common_ptr)&cinfo, status.detail);
+    mRowsStarted = false;
+    releaseState();
+  }
+  return status;
+}
+
+uhdr_error_info_t JpegEncoderHelper::finishImage() {
+  UHDR_TRACE_SCOPE("JpegEncoderHelper::finishImage");
+  uhdr_error_info_t status = g_no_error;
+
+  if (!mRowsStarted) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "no image was started to finish");
+    return status;
+  }
+  jpeg_compress_struct& cinfo = mState->cinfo;
+  mRowsStarted = false;
+  if (mRowsWritten != cinfo.image_height) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "image finished after %u of its %u rows were written", mRowsWritten,
+             cinfo.image_height);
+    jpeg_abort_compress(&cinfo);
+    return status;
+  }
+  if (0 == setjmp(mState->err.setjmp_buffer)) {
+    jpeg_finish_compress(&cinfo);
+  } else {
+    status.error_code = UHDR_CODEC_ERROR;
+    status.has_detail = 1;
+    cinfo.err->format_message((j_common_ptr)&cinfo, status.detail);
+    releaseState();
+  }
+  return status;
+}
+
+unsigned int JpegEncoderHelper::stripMcuRows(int width, int height, uhdr_img_fmt_t format) const {
+  const sample_factor_entry* entry = findSampleFactors(format);
+  if (!mStripRunner || mOptimizeCoding || width <= 0 || entry == nullptr) return 0;
+  const int* factors = entry->factors;
+  // a restart interval spans one strip, it must fit the 16 bit field of the DRI segment
+  const unsigned int mcusPerRow = (width + DCTSIZE * factors[6] - 1) / (DCTSIZE * factors[6]);
+  const unsigned int mcuRowsPerStrip = (std::min)(mMcuRowsPerStrip, 0xFFFFu / mcusPerRow);
+  if (mcuRowsPerStrip > 0 && (unsigned int)height > mcuRowsPerStrip * DCTSIZE * factors[7]) {
+    return mcuRowsPerStrip;
+  }
+  return 0;
+}
+
 uhdr_compressed_image_t JpegEncoderHelper::getCompressedImage() {
   uhdr_compressed_image_t img;
 
@@ -137,86 +462,61 @@ uhdr_compressed_image_t JpegEncoderHelper::getCompressedImage() {
 uhdr_error_info_t JpegEncoderHelper::encode(const uint8_t* planes[3], const unsigned int strides[3],
                                             const int width, const int height,
                                             const uhdr_img_fmt_t format, const int qfactor,
-                                            const void* iccBuffer, const size_t iccSize) {
-  jpeg_compress_struct cinfo;
-  jpeg_error_mgr_impl myerr;
+                                            const void* iccBuffer, const size_t iccSize,
+                                            const RowSource* source,
+                                            const PlaneSource* planeSource) {
   uhdr_error_info_t status = g_no_error;
 
-  if (sample_factors.find(format) == sample_factors.end()) {
+  const sample_factor_entry* entry = findSampleFactors(format);
+  if (entry == nullptr) {
     status.error_code = UHDR_CODEC_INVALID_PARAM;
     status.has_detail = 1;
     snprintf(status.detail, sizeof status.detail, "unrecognized input format %d", format);
     return status;
   }
-  std::vector<int>& factors = sample_factors.find(format)->second;
 
-  cinfo.err = jpeg_std_error(&myerr);
-  myerr.error_exit = jpegrerror_exit;
-  myerr.output_message = outputErrorMessage;
+  if (source == nullptr && planeSource == nullptr && mBackend.compress != nullptr &&
+      encodeWithBackend(planes, strides, width, height, format, qfactor, iccBuffer, iccSize)) {
+    return status;
+  }
 
-  if (0 == setjmp(myerr.setjmp_buffer)) {
-    jpeg_create_compress(&cinfo);
+  if (const unsigned int mcuRowsPerStrip = stripMcuRows(width, height, format)) {
+    return encodeStrips(planes, strides, width, height, format, qfactor, iccBuffer, iccSize,
+                        mcuRowsPerStrip, source, planeSource);
+  }
 
-    // initialize destination manager
-    mDestMgr.init_destination = &initDestination;
-    mDestMgr.empty_output_buffer = &emptyOutputBuffer;
-    mDestMgr.term_destination = &terminateDestination;
-    mDestMgr.mResultBuffer.clear();
-    cinfo.dest = reinterpret_cast<struct jpeg_destination_mgr*>(&mDestMgr);
+  // the libjpeg state is reused across images, the compression parameters and the quantization
+  // tables are only set up again when the configuration changes
+  CompressState* state = acquireState();
+  if (state == nullptr) {
+    status.error_code = UHDR_CODEC_MEM_ERROR;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "failed to create libjpeg compressor");
+    return status;
+  }
+  jpeg_compress_struct& cinfo = state->cinfo;
 
-    // initialize configuration parameters
-    cinfo.image_width = width;
-    cinfo.image_height = height;
-    bool isGainMapImg = true;
-    if (format == UHDR_IMG_FMT_24bppRGB888) {
-      cinfo.input_components = 3;
-      cinfo.in_color_space = JCS_RGB;
-    } else {
-      if (format == UHDR_IMG_FMT_8bppYCbCr400) {
-        cinfo.input_components = 1;
-        cinfo.in_color_space = JCS_GRAYSCALE;
-      } else if (format == UHDR_IMG_FMT_12bppYCbCr420 || format == UHDR_IMG_FMT_24bppYCbCr444 ||
-                 format == UHDR_IMG_FMT_16bppYCbCr422 || format == UHDR_IMG_FMT_16bppYCbCr440 ||
-                 format == UHDR_IMG_FMT_12bppYCbCr411 || format == UHDR_IMG_FMT_10bppYCbCr410) {
-        cinfo.input_components = 3;
-        cinfo.in_color_space = JCS_YCbCr;
-        isGainMapImg = false;
-      } else {
-        status.error_code = UHDR_CODEC_ERROR;
-        status.has_detail = 1;
-        snprintf(status.detail, sizeof status.detail,
-                 "unrecognized input color format for encoding, color format %d", format);
-        jpeg_destroy_compress(&cinfo);
+  if (0 == setjmp(state->err.setjmp_buffer)) {
+    status = setupCompress(state, width, height, format, qfactor, iccBuffer, iccSize);
+    if (status.error_code != UHDR_CODEC_OK) return status;
+    if (source != nullptr) {
+      status = compressRows(&cinfo, *source, format == UHDR_IMG_FMT_24bppRGB888);
+      if (status.error_code != UHDR_CODEC_OK) {
+        jpeg_abort_compress(&cinfo);
         return status;
       }
-    }
-    jpeg_set_defaults(&cinfo);
-    jpeg_set_quality(&cinfo, qfactor, TRUE);
-    for (int i = 0; i < cinfo.num_components; i++) {
-      cinfo.comp_info[i].h_samp_factor = factors[i * 2];
-      cinfo.comp_info[i].v_samp_factor = factors[i * 2 + 1];
-      mPlaneWidth[i] =
-          std::ceil(((float)cinfo.image_width * cinfo.comp_info[i].h_samp_factor) / factors[6]);
-      mPlaneHeight[i] =
-          std::ceil(((float)cinfo.image_height * cinfo.comp_info[i].v_samp_factor) / factors[7]);
-    }
-    if (format != UHDR_IMG_FMT_24bppRGB888) cinfo.raw_data_in = TRUE;
-    cinfo.dct_method = JDCT_ISLOW;
-
-    // start compress
-    jpeg_start_compress(&cinfo, TRUE);
-    if (iccBuffer != nullptr && iccSize > 0) {
-      jpeg_write_marker(&cinfo, JPEG_APP0 + 2, static_cast<const JOCTET*>(iccBuffer), iccSize);
-    }
-    if (isGainMapImg) {
-      char comment[255];
-      snprintf(comment, sizeof comment,
-               "Source: google libuhdr v%s, Coder: libjpeg v%d, Attrib: GainMap Image",
-               UHDR_LIB_VERSION_STR, JPEG_LIB_VERSION);
-      jpeg_write_marker(&cinfo, JPEG_COM, reinterpret_cast<JOCTET*>(comment), strlen(comment));
-    }
-    if (format == UHDR_IMG_FMT_24bppRGB888) {
+    } else if (planeSource != nullptr) {
+      status = compressPlaneRows(&cinfo, *planeSource);
+      if (status.error_code != UHDR_CODEC_OK) {
+        jpeg_abort_compress(&cinfo);
+        return status;
+      }
+    } else if (format == UHDR_IMG_FMT_24bppRGB888) {
       while (cinfo.next_scanline < cinfo.image_height) {
+        if (CancelToken::cancelled()) {
+          jpeg_abort_compress(&cinfo);
+          return CancelToken::check();
+        }
         JSAMPROW row_pointer[]{
             const_cast<JSAMPROW>(&planes[0][cinfo.next_scanline * strides[0] * 3])};
         JDIMENSION processed = jpeg_write_scanlines(&cinfo, row_pointer, 1);
@@ -225,14 +525,14 @@ uhdr_error_info_t JpegEncoderHelper::encode(const uint8_t* planes[3], const unsi
           status.has_detail = 1;
           snprintf(status.detail, sizeof status.detail,
                    "jpeg_read_scanlines returned %d, expected %d", processed, 1);
-          jpeg_destroy_compress(&cinfo);
+          jpeg_abort_compress(&cinfo);
           return status;
         }
       }
     } else {
       status = compressYCbCr(&cinfo, planes, strides);
       if (status.error_code != UHDR_CODEC_OK) {
-        jpeg_destroy_compress(&cinfo);
+        jpeg_abort_compress(&cinfo);
         return status;
       }
     }
@@ -240,12 +540,605 @@ uhdr_error_info_t JpegEncoderHelper::encode(const uint8_t* planes[3], const unsi
     status.error_code = UHDR_CODEC_ERROR;
     status.has_detail = 1;
     cinfo.err->format_message((j_common_ptr)&cinfo, status.detail);
-    jpeg_destroy_compress(&cinfo);
+    releaseState();
     return status;
   }
 
   jpeg_finish_compress(&cinfo);
-  jpeg_destroy_compress(&cinfo);
+  return status;
+}
+
+uhdr_error_info_t JpegEncoderHelper::setupCompress(CompressState* state, const int width,
+                                                 const int height, const uhdr_img_fmt_t format,
+                                                 const int qfactor, const void* iccBuffer,
+                                                 const size_t iccSize) {
+  uhdr_error_info_t status = g_no_error;
+  jpeg_compress_struct& cinfo = state->cinfo;
+  const int (&factors)[8] = findSampleFactors(format)->factors;
+
+  // initialize destination manager
+  mDestMgr.init_destination = &initDestination;
+  mDestMgr.empty_output_buffer = &emptyOutputBuffer;
+  mDestMgr.term_destination = &terminateDestination;
+  mDestMgr.mResultBuffer.clear();
+  cinfo.dest = reinterpret_cast<struct jpeg_destination_mgr*>(&mDestMgr);
+
+  // initialize configuration parameters
+  cinfo.image_width = width;
+  cinfo.image_height = height;
+  bool isGainMapImg = true;
+  if (format == UHDR_IMG_FMT_24bppRGB888) {
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+  } else {
+    if (format == UHDR_IMG_FMT_8bppYCbCr400) {
+      cinfo.input_components = 1;
+      cinfo.in_color_space = JCS_GRAYSCALE;
+    } else if (format == UHDR_IMG_FMT_12bppYCbCr420 || format == UHDR_IMG_FMT_24bppYCbCr444 ||
+               format == UHDR_IMG_FMT_16bppYCbCr422 || format == UHDR_IMG_FMT_16bppYCbCr440 ||
+               format == UHDR_IMG_FMT_12bppYCbCr411 || format == UHDR_IMG_FMT_10bppYCbCr410) {
+      cinfo.input_components = 3;
+      cinfo.in_color_space = JCS_YCbCr;
+      isGainMapImg = false;
+    } else {
+      status.error_code = UHDR_CODEC_ERROR;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "unrecognized input color format for encoding, color format %d", format);
+      return status;
+    }
+  }
+  if (!state->configured || state->format != format || state->qfactor != qfactor ||
+      state->dctMethod != mDctMethod || state->optimizeCoding != mOptimizeCoding) {
+    state->configured = false;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, qfactor, TRUE);
+    for (int i = 0; i < cinfo.num_components; i++) {
+      cinfo.comp_info[i].h_samp_factor = factors[i * 2];
+      cinfo.comp_info[i].v_samp_factor = factors[i * 2 + 1];
+    }
+    if (format != UHDR_IMG_FMT_24bppRGB888) cinfo.raw_data_in = TRUE;
+    cinfo.dct_method = mDctMethod;
+    cinfo.optimize_coding = mOptimizeCoding ? TRUE : FALSE;
+    state->format = format;
+    state->qfactor = qfactor;
+    state->dctMethod = mDctMethod;
+    state->optimizeCoding = mOptimizeCoding;
+    state->configured = true;
+  }
+  for (int i = 0; i < cinfo.num_components; i++) {
+    mPlaneWidth[i] =
+        std::ceil(((float)cinfo.image_width * cinfo.comp_info[i].h_samp_factor) / factors[6]);
+    mPlaneHeight[i] =
+        std::ceil(((float)cinfo.image_height * cinfo.comp_info[i].v_samp_factor) / factors[7]);
+  }
+
+  // start compress
+  jpeg_start_compress(&cinfo, TRUE);
+  if (iccBuffer != nullptr && iccSize > 0) {
+    jpeg_write_marker(&cinfo, JPEG_APP0 + 2, static_cast<const JOCTET*>(iccBuffer), iccSize);
+  }
+  if (isGainMapImg) {
+    char comment[255];
+    snprintf(comment, sizeof comment,
+             "Source: google libuhdr v%s, Coder: libjpeg v%d, Attrib: GainMap Image",
+             UHDR_LIB_VERSION_STR, JPEG_LIB_VERSION);
+    jpeg_write_marker(&cinfo, JPEG_COM, reinterpret_cast<JOCTET*>(comment), strlen(comment));
+  }
+  return status;
+}
+
+static void appendMarker(std::vector<JOCTET>& jpeg, int marker, const void* payload,
+                         size_t size) {
+  const size_t length = size + 2;
+  const JOCTET header[]{0xFF, static_cast<JOCTET>(marker), static_cast<JOCTET>(length >> 8),
+                        static_cast<JOCTET>(length & 0xFF)};
+  jpeg.insert(jpeg.end(), header, header + sizeof header);
+  jpeg.insert(jpeg.end(), static_cast<const JOCTET*>(payload),
+              static_cast<const JOCTET*>(payload) + size);
+}
+
+bool JpegEncoderHelper::encodeWithBackend(const uint8_t* planes[3], const unsigned int strides[3],
+                                          const int width, const int height,
+                                          const uhdr_img_fmt_t format, const int qfactor,
+                                          const void* iccBuffer, const size_t iccSize) {
+  if (format != UHDR_IMG_FMT_8bppYCbCr400 && format != UHDR_IMG_FMT_12bppYCbCr420 &&
+      format != UHDR_IMG_FMT_16bppYCbCr422 && format != UHDR_IMG_FMT_24bppYCbCr444 &&
+      format != UHDR_IMG_FMT_24bppRGB888) {
+    return false;
+  }
+  // a marker segment carries at most 65533 bytes of payload
+  if (iccBuffer != nullptr && iccSize > 0xFFFD) return false;
+  uhdr_raw_image_t img{};
+  img.fmt = format;
+  img.cg = UHDR_CG_UNSPECIFIED;
+  img.ct = UHDR_CT_UNSPECIFIED;
+  img.range = UHDR_CR_UNSPECIFIED;
+  img.w = width;
+  img.h = height;
+  for (int i = 0; i < 3; i++) {
+    img.planes[i] = const_cast<uint8_t*>(planes[i]);
+    img.stride[i] = strides[i];
+  }
+  uhdr_compressed_image_t out{};
+  if (mBackend.compress(mBackend.backend_ctx, &img, qfactor, &out) != 0) return false;
+  const JOCTET* data = static_cast<const JOCTET*>(out.data);
+  // a bitstream without a start of image marker in front is left to libjpeg
+  if (data == nullptr || out.data_sz < 4 || data[0] != 0xFF || data[1] != 0xD8) return false;
+
+  std::vector<JOCTET>& result = mDestMgr.mResultBuffer;
+  result.clear();
+  result.insert(result.end(), data, data + 2);
+  if (iccBuffer != nullptr && iccSize > 0) {
+    appendMarker(result, JPEG_APP0 + 2, iccBuffer, iccSize);
+  }
+  if (format == UHDR_IMG_FMT_8bppYCbCr400 || format == UHDR_IMG_FMT_24bppRGB888) {
+    char comment[255];
+    snprintf(comment, sizeof comment,
+             "Source: google libuhdr v%s, Coder: backend, Attrib: GainMap Image",
+             UHDR_LIB_VERSION_STR);
+    appendMarker(result, JPEG_COM, comment, strlen(comment));
+  }
+  result.insert(result.end(), data + 2, data + out.data_sz);
+  return true;
+}
+
+uhdr_error_info_t JpegEncoderHelper::encodeStrips(const uint8_t* planes[3],
+                                                  const unsigned int strides[3], const int width,
+                                                  const int height, const uhdr_img_fmt_t format,
+                                                  const int qfactor, const void* iccBuffer,
+                                                  const size_t iccSize,
+                                                  const unsigned int mcuRowsPerStrip,
+                                                  const RowSource* source,
+                                                  const PlaneSource* planeSource) {
+  const int* factors = findSampleFactors(format)->factors;
+  // rgb input is one interleaved plane of 3 bytes per pixel
+  const bool isRgb = format == UHDR_IMG_FMT_24bppRGB888;
+  const int numPlanes = format == UHDR_IMG_FMT_8bppYCbCr400 || isRgb ? 1 : 3;
+  const unsigned int mcusPerRow = (width + DCTSIZE * factors[6] - 1) / (DCTSIZE * factors[6]);
+  const int stripHeight = mcuRowsPerStrip * DCTSIZE * factors[7];
+  const unsigned int numStrips = (height + stripHeight - 1) / stripHeight;
+
+  // Each strip is a complete jpeg of its own. The tables only depend on the quality factor, so
+  // the entropy coded data of all strips can be put together under the header of strip 0.
+  // strip encoders are kept across images along with their libjpeg state
+  std::vector<std::unique_ptr<JpegEncoderHelper>>& strips = mStripEncoders;
+  if (strips.size() < numStrips) strips.resize(numStrips);
+  for (unsigned int k = 0; k < numStrips; k++) {
+    if (strips[k] == nullptr) strips[k] = std::make_unique<JpegEncoderHelper>();
+    strips[k]->mDctMethod = mDctMethod;
+  }
+  std::vector<uhdr_error_info_t> stripStatus(numStrips, g_no_error);
+  std::atomic<unsigned int> nextStrip{0};
+  std::function<void()> job = [&]() {
+    for (unsigned int k = nextStrip++; k < numStrips; k = nextStrip++) {
+      const int top = k * stripHeight;
+      const uint8_t* stripPlanes[kMaxNumComponents]{};
+      const int rows = (std::min)(stripHeight, height - top);
+      if (source != nullptr) {
+        // the strip is produced by its own job, right before it is compressed
+        RowSource stripSource = [source, top](unsigned int rowStart, unsigned int rowEnd,
+                                              uint8_t* dst, size_t stride) {
+          (*source)(top + rowStart, top + rowEnd, dst, stride);
+        };
+        stripStatus[k] = strips[k]->encode(stripPlanes, strides, width, rows, format, qfactor,
+                                          k == 0 ? iccBuffer : nullptr, k == 0 ? iccSize : 0,
+                                          &stripSource);
+        continue;
+      }
+      if (planeSource != nullptr) {
+        PlaneSource stripSource = [planeSource, top](unsigned int rowStart, unsigned int rowEnd,
+                                                     uint8_t* const dst[3],
+                                                     const size_t dstStrides[3]) {
+          return (*planeSource)(top + rowStart, top + rowEnd, dst, dstStrides);
+        };
+        stripStatus[k] = strips[k]->encode(stripPlanes, strides, width, rows, format, qfactor,
+                                          k == 0 ? iccBuffer : nullptr, k == 0 ? iccSize : 0,
+                                          nullptr, &stripSource);
+        continue;
+      }
+      for (int i = 0; i < numPlanes; i++) {
+        stripPlanes[i] = planes[i] + (size_t)(top / factors[7] * factors[i * 2 + 1]) * strides[i] *
+                                         (isRgb ? 3 : 1);
+      }
+      stripStatus[k] = strips[k]->encode(stripPlanes, strides, width, rows, format, qfactor,
+                                        k == 0 ? iccBuffer : nullptr, k == 0 ? iccSize : 0);
+    }
+  };
+  // dispatch as many jobs as the other stages do, the idle ones find no strip left
+  mStripRunner(job, (std::max)(1u, mStripParallelism));
+  for (const auto& it : stripStatus) UHDR_ERR_CHECK(it)
+
+  std::vector<size_t> scanPos(numStrips);
+  size_t sofPos = 0, sosPos = 0, size = 6 /* DRI */;
+  for (unsigned int k = 0; k < numStrips; k++) {
+    size_t stripSofPos, stripSosPos;
+    if (!findScan(strips[k]->mDestMgr.mResultBuffer, stripSofPos, stripSosPos, scanPos[k])) {
+      uhdr_error_info_t err;
+      err.error_code = UHDR_CODEC_ERROR;
+      err.has_detail = 1;
+      snprintf(err.detail, sizeof err.detail, "unexpected layout of encoded strip %u", k);
+      return err;
+    }
+    if (k == 0) {
+      sofPos = stripSofPos;
+      sosPos = stripSosPos;
+    }
+    size += strips[k]->mDestMgr.mResultBuffer.size() - (k == 0 ? 0 : scanPos[k]);
+  }
+
+  std::vector<JOCTET>& out = mDestMgr.mResultBuffer;
+  const std::vector<JOCTET>& first = strips[0]->mDestMgr.mResultBuffer;
+  const unsigned int restartInterval = mcusPerRow * mcuRowsPerStrip;
+  const JOCTET dri[6]{0xFF, 0xDD, 0x00, 0x04, static_cast<JOCTET>(restartInterval >> 8),
+                      static_cast<JOCTET>(restartInterval & 0xFF)};
+  out.clear();
+  out.reserve(size);
+  out.insert(out.end(), first.begin(), first.begin() + sosPos);
+  out[sofPos + 5] = static_cast<JOCTET>(height >> 8); /* frame height of SOF0 */
+  out[sofPos + 6] = static_cast<JOCTET>(height & 0xFF);
+  out.insert(out.end(), dri, dri + sizeof dri);
+  for (unsigned int k = 0; k < numStrips; k++) {
+    const std::vector<JOCTET>& strip = strips[k]->mDestMgr.mResultBuffer;
+    if (k > 0) {
+      out.push_back(0xFF);
+      out.push_back(static_cast<JOCTET>(0xD0 + ((k - 1) & 7))); /* RSTn */
+    }
+    // strip 0 contributes its SOS segment as well, every strip drops its EOI
+    out.insert(out.end(), strip.begin() + (k == 0 ? sosPos : scanPos[k]), strip.end() - 2);
+  }
+  out.push_back(0xFF);
+  out.push_back(0xD9); /* EOI */
+  return g_no_error;
+}
+
+static constexpr uint8_t kXmpNameSpace[] = "http://ns.adobe.com/xap/1.0/";
+static constexpr uint8_t kIsoNameSpace[] = "urn:iso:std:iso:ts:21496:-1";
+static constexpr uint8_t kMpfSig[] = "MPF";
+
+static bool hasSignature(const uint8_t* payload, size_t size, const uint8_t* sig, size_t sigSize) {
+  return size >= sigSize && memcmp(payload, sig, sigSize) == 0;
+}
+
+/*!\brief Returns true for the application segments that transformImage() does not copy, those
+ * that describe the ultrahdr layout and those that libjpeg writes by itself. */
+static bool isDroppedSegment(const jpeg_compress_struct& dstinfo, int marker,
+                             const uint8_t* payload, size_t size) {
+  static constexpr uint8_t kJfifSig[] = {'J', 'F', 'I', 'F', '\0'};
+  static constexpr uint8_t kAdobeSig[] = {'A', 'd', 'o', 'b', 'e'};
+  if (marker == JPEG_APP0) {
+    return dstinfo.write_JFIF_header && hasSignature(payload, size, kJfifSig, sizeof kJfifSig);
+  }
+  if (marker == JPEG_APP0 + 14) {
+    return dstinfo.write_Adobe_marker && hasSignature(payload, size, kAdobeSig, sizeof kAdobeSig);
+  }
+  if (marker == JPEG_APP0 + 1) {
+    return hasSignature(payload, size, kXmpNameSpace, sizeof kXmpNameSpace);
+  }
+  if (marker == JPEG_APP0 + 2) {
+    return hasSignature(payload, size, kIsoNameSpace, sizeof kIsoNameSpace) ||
+           hasSignature(payload, size, kMpfSig, sizeof kMpfSig);
+  }
+  return false;
+}
+
+/*!\brief Copies the application and comment segments of image ahead of the start of scan to
+ * dstinfo, save those isDroppedSegment() rejects. The payloads are written from image directly,
+ * so libjpeg does not have to buffer them while reading the header. */
+static void copyRetainedSegments(j_compress_ptr dstinfo, const uint8_t* image, size_t length) {
+  size_t pos = 2; /* position after reading SOI marker (0xffd8) */
+  while (pos < length && image[pos] == 0xFF) {
+    // a marker may be preceded by any number of fill bytes
+    while (pos < length && image[pos] == 0xFF) pos++;
+    if (pos >= length || length - pos < 3) return;
+    const int marker = image[pos++];
+    if (marker == 0xDA) return; /* SOS */
+    const size_t segmentLength = (static_cast<size_t>(image[pos]) << 8) | image[pos + 1];
+    if (segmentLength < 2 || segmentLength > length - pos) return;
+    const uint8_t* payload = image + pos + 2;
+    const size_t size = segmentLength - 2;
+    if ((marker == JPEG_COM || (marker >= JPEG_APP0 && marker <= JPEG_APP0 + 15)) &&
+        !isDroppedSegment(*dstinfo, marker, payload, size)) {
+      jpeg_write_marker(dstinfo, marker, payload, static_cast<unsigned int>(size));
+    }
+    pos += segmentLength;
+  }
+}
+
+/*!\brief Moves one block of coefficients. Mirroring a block negates its odd frequencies along the
+ * mirrored axis, transposing a block transposes its coefficients. */
+static void transformBlock(const JCOEF* src, JCOEF* dst, bool transpose, bool negateOddU,
+                           bool negateOddV) {
+  for (int v = 0; v < DCTSIZE; v++) {
+    for (int u = 0; u < DCTSIZE; u++) {
+      JCOEF coeff = transpose ? src[u * DCTSIZE + v] : src[v * DCTSIZE + u];
+      if ((negateOddU && (u & 1)) != (negateOddV && (v & 1))) coeff = -coeff;
+      dst[v * DCTSIZE + u] = coeff;
+    }
+  }
+}
+
+uhdr_error_info_t JpegEncoderHelper::transformImage(const void* image, size_t length,
+                                                    const uhdr_plane_map_t& map) {
+  UHDR_TRACE_SCOPE("JpegEncoderHelper::transformImage");
+  uhdr_error_info_t status = g_no_error;
+
+  // rotations and mirrors leave one non zero entry of magnitude 1 in every row of the map
+  const bool transpose = map.xx == 0;
+  if (map.w <= 0 || map.h <= 0 || std::abs(map.xx) + std::abs(map.xy) != 1 ||
+      std::abs(map.yx) + std::abs(map.yy) != 1 || (map.xx == 0) != (map.yy == 0)) {
+    status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "only rotations, mirrors and crops can be applied to a compressed image");
+    return status;
+  }
+
+  jpeg_decompress_struct srcinfo;
+  jpeg_compress_struct dstinfo;
+  jpeg_error_mgr_impl err;
+  memset(&srcinfo, 0, sizeof srcinfo);
+  memset(&dstinfo, 0, sizeof dstinfo);
+  srcinfo.err = jpeg_std_error(&err);
+  dstinfo.err = &err;
+  err.error_exit = jpegrerror_exit;
+  err.output_message = outputErrorMessage;
+  auto release = [&]() {
+    jpeg_destroy_compress(&dstinfo);
+    jpeg_destroy_decompress(&srcinfo);
+  };
+
+  if (0 == setjmp(err.setjmp_buffer)) {
+    jpeg_create_decompress(&srcinfo);
+    jpeg_create_compress(&dstinfo);
+    jpeg_mem_src(&srcinfo, const_cast<unsigned char*>(static_cast<const unsigned char*>(image)),
+                 static_cast<unsigned long>(length));
+    // application and comment segments are skipped by libjpeg and copied from image later on
+    jpeg_read_header(&srcinfo, TRUE);
+
+    // Locate the input block of output block (0, 0) of every component. The map is followed in
+    // luma pixel units on doubled coordinates, where the edges of the pixels are integers. A
+    // transpose swaps the sampling factors, so blocks map onto blocks of the same size.
+    const int numComponents = srcinfo.num_components;
+    const int dstMaxH = transpose ? srcinfo.max_v_samp_factor : srcinfo.max_h_samp_factor;
+    const int dstMaxV = transpose ? srcinfo.max_h_samp_factor : srcinfo.max_v_samp_factor;
+    const long cx = 2L * map.x0 + 1 - map.xx - map.xy;
+    const long cy = 2L * map.y0 + 1 - map.yx - map.yy;
+    int blockX0[MAX_COMPONENTS], blockY0[MAX_COMPONENTS];
+    JDIMENSION dstWidthInBlocks[MAX_COMPONENTS], dstHeightInBlocks[MAX_COMPONENTS];
+    for (int ci = 0; ci < numComponents; ci++) {
+      const jpeg_component_info& comp = srcinfo.comp_info[ci];
+      const int h = comp.h_samp_factor, v = comp.v_samp_factor;
+      const int dh = transpose ? v : h, dv = transpose ? h : v;
+      bool aligned = srcinfo.max_h_samp_factor % h == 0 && srcinfo.max_v_samp_factor % v == 0;
+      if (aligned) {
+        const long ex = 2L * DCTSIZE * (dstMaxH / dh), ey = 2L * DCTSIZE * (dstMaxV / dv);
+        const long srcX = cx + (std::min)(0L, map.xx * ex + map.xy * ey);
+        const long srcY = cy + (std::min)(0L, map.yx * ex + map.yy * ey);
+        const long spanX = 2L * DCTSIZE * (srcinfo.max_h_samp_factor / h);
+        const long spanY = 2L * DCTSIZE * (srcinfo.max_v_samp_factor / v);
+        aligned = srcX % spanX == 0 && srcY % spanY == 0;
+        blockX0[ci] = static_cast<int>(srcX / spanX);
+        blockY0[ci] = static_cast<int>(srcY / spanY);
+        dstWidthInBlocks[ci] = (map.w * dh + DCTSIZE * dstMaxH - 1) / (DCTSIZE * dstMaxH);
+        dstHeightInBlocks[ci] = (map.h * dv + DCTSIZE * dstMaxV - 1) / (DCTSIZE * dstMaxV);
+        // the corner blocks of the output bound the input blocks that are read
+        for (int corner = 0; corner < 4 && aligned; corner++) {
+          const long bx = (corner & 1) ? dstWidthInBlocks[ci] - 1 : 0;
+          const long by = (corner & 2) ? dstHeightInBlocks[ci] - 1 : 0;
+          const long sbx = blockX0[ci] + map.xx * bx + map.xy * by;
+          const long sby = blockY0[ci] + map.yx * bx + map.yy * by;
+          aligned = sbx >= 0 && sbx < comp.width_in_blocks && sby >= 0 &&
+                    sby < comp.height_in_blocks;
+        }
+      }
+      if (!aligned) {
+        release();
+        status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
+        status.has_detail = 1;
+        snprintf(status.detail, sizeof status.detail,
+                 "effects split the blocks of component %d, edges that are flipped or cropped "
+                 "must lie on mcu boundaries of the %ux%u image",
+                 ci, srcinfo.image_width, srcinfo.image_height);
+        return status;
+      }
+    }
+
+    jvirt_barray_ptr* srcArrays = jpeg_read_coefficients(&srcinfo);
+    jpeg_copy_critical_parameters(&srcinfo, &dstinfo);
+    dstinfo.image_width = map.w;
+    dstinfo.image_height = map.h;
+    dstinfo.optimize_coding = TRUE;
+    if (transpose) {
+      for (int ci = 0; ci < numComponents; ci++) {
+        std::swap(dstinfo.comp_info[ci].h_samp_factor, dstinfo.comp_info[ci].v_samp_factor);
+      }
+      for (int i = 0; i < NUM_QUANT_TBLS; i++) {
+        JQUANT_TBL* table = dstinfo.quant_tbl_ptrs[i];
+        if (table == nullptr) continue;
+        for (int v = 0; v < DCTSIZE; v++) {
+          for (int u = v + 1; u < DCTSIZE; u++) {
+            std::swap(table->quantval[v * DCTSIZE + u], table->quantval[u * DCTSIZE + v]);
+          }
+        }
+      }
+    }
+    jvirt_barray_ptr dstArrays[MAX_COMPONENTS];
+    for (int ci = 0; ci < numComponents; ci++) {
+      const jpeg_component_info& comp = dstinfo.comp_info[ci];
+      const JDIMENSION h = comp.h_samp_factor, v = comp.v_samp_factor;
+      dstArrays[ci] = (*dstinfo.mem->request_virt_barray)(
+          reinterpret_cast<j_common_ptr>(&dstinfo), JPOOL_IMAGE, TRUE,
+          (dstWidthInBlocks[ci] + h - 1) / h * h, (dstHeightInBlocks[ci] + v - 1) / v * v, v);
+    }
+
+    mDestMgr.init_destination = &initDestination;
+    mDestMgr.empty_output_buffer = &emptyOutputBuffer;
+    mDestMgr.term_destination = &terminateDestination;
+    mDestMgr.mResultBuffer.clear();
+    dstinfo.dest = reinterpret_cast<struct jpeg_destination_mgr*>(&mDestMgr);
+    jpeg_write_coefficients(&dstinfo, dstArrays);
+    copyRetainedSegments(&dstinfo, static_cast<const uint8_t*>(image), length);
+
+    const bool negateOddU = transpose ? map.yx < 0 : map.xx < 0;
+    const bool negateOddV = transpose ? map.xy < 0 : map.yy < 0;
+    for (int ci = 0; ci < numComponents; ci++) {
+      for (JDIMENSION by = 0; by < dstHeightInBlocks[ci]; by++) {
+        JBLOCKROW dstRow = (*dstinfo.mem->access_virt_barray)(
+            reinterpret_cast<j_common_ptr>(&dstinfo), dstArrays[ci], by, 1, TRUE)[0];
+        JBLOCKROW srcRow = nullptr;
+        for (JDIMENSION bx = 0; bx < dstWidthInBlocks[ci]; bx++) {
+          const int sbx = blockX0[ci] + map.xx * (int)bx + map.xy * (int)by;
+          const int sby = blockY0[ci] + map.yx * (int)bx + map.yy * (int)by;
+          // without a transpose, an output row reads one input row
+          if (transpose || srcRow == nullptr) {
+            srcRow = (*srcinfo.mem->access_virt_barray)(reinterpret_cast<j_common_ptr>(&srcinfo),
+                                                        srcArrays[ci], sby, 1, FALSE)[0];
+          }
+          transformBlock(srcRow[sbx], dstRow[bx], transpose, negateOddU, negateOddV);
+        }
+      }
+    }
+
+    jpeg_finish_compress(&dstinfo);
+    jpeg_finish_decompress(&srcinfo);
+  } else {
+    status.error_code = UHDR_CODEC_ERROR;
+    status.has_detail = 1;
+    err.format_message(reinterpret_cast<j_common_ptr>(&srcinfo), status.detail);
+  }
+  release();
+  return status;
+}
+
+uhdr_error_info_t JpegEncoderHelper::keepCoefficients() {
+  UHDR_TRACE_SCOPE("JpegEncoderHelper::keepCoefficients");
+  uhdr_error_info_t status = g_no_error;
+  auto image = std::make_unique<CoefficientImage>();
+  image->stream.assign(mDestMgr.mResultBuffer.begin(), mDestMgr.mResultBuffer.end());
+
+  jpeg_decompress_struct srcinfo;
+  jpeg_error_mgr_impl err;
+  memset(&srcinfo, 0, sizeof srcinfo);
+  srcinfo.err = jpeg_std_error(&err);
+  err.error_exit = jpegrerror_exit;
+  err.output_message = outputErrorMessage;
+
+  if (0 == setjmp(err.setjmp_buffer)) {
+    jpeg_create_decompress(&srcinfo);
+    jpeg_mem_src(&srcinfo, image->stream.data(), static_cast<unsigned long>(image->stream.size()));
+    jpeg_read_header(&srcinfo, TRUE);
+    jvirt_barray_ptr* srcArrays = jpeg_read_coefficients(&srcinfo);
+    image->width = srcinfo.image_width;
+    image->height = srcinfo.image_height;
+    image->colorSpace = srcinfo.jpeg_color_space;
+    image->components.resize(srcinfo.num_components);
+    for (int ci = 0; ci < srcinfo.num_components; ci++) {
+      const jpeg_component_info& comp = srcinfo.comp_info[ci];
+      CoefficientImage::Component& dst = image->components[ci];
+      dst.hSampFactor = comp.h_samp_factor;
+      dst.vSampFactor = comp.v_samp_factor;
+      dst.widthInBlocks = comp.width_in_blocks;
+      dst.heightInBlocks = comp.height_in_blocks;
+      memcpy(dst.quantval, comp.quant_table->quantval, sizeof dst.quantval);
+      dst.blocks.resize((size_t)comp.width_in_blocks * comp.height_in_blocks * DCTSIZE2);
+      for (JDIMENSION by = 0; by < comp.height_in_blocks; by++) {
+        JBLOCKROW srcRow = (*srcinfo.mem->access_virt_barray)(
+            reinterpret_cast<j_common_ptr>(&srcinfo), srcArrays[ci], by, 1, FALSE)[0];
+        memcpy(&dst.blocks[(size_t)by * comp.width_in_blocks * DCTSIZE2], srcRow,
+               comp.width_in_blocks * sizeof(JBLOCK));
+      }
+    }
+    jpeg_finish_decompress(&srcinfo);
+  } else {
+    status.error_code = UHDR_CODEC_ERROR;
+    status.has_detail = 1;
+    err.format_message(reinterpret_cast<j_common_ptr>(&srcinfo), status.detail);
+  }
+  jpeg_destroy_decompress(&srcinfo);
+  if (status.error_code == UHDR_CODEC_OK) mCoefficients = std::move(image);
+  return status;
+}
+
+// Rounds coef * srcStep / dstStep to the nearest integer, halves away from zero as the forward
+// quantization of libjpeg does
+static inline JCOEF requantizeCoefficient(JCOEF coef, int srcStep, int dstStep) {
+  const int value = coef * srcStep;
+  return static_cast<JCOEF>(value >= 0 ? (value + dstStep / 2) / dstStep
+                                       : -((-value + dstStep / 2) / dstStep));
+}
+
+uhdr_error_info_t JpegEncoderHelper::requantizeImage(const int qfactor) {
+  UHDR_TRACE_SCOPE("JpegEncoderHelper::requantizeImage");
+  uhdr_error_info_t status = g_no_error;
+  if (mCoefficients == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "no coefficients to requantize, keepCoefficients() has not been called");
+    return status;
+  }
+  const CoefficientImage& image = *mCoefficients;
+  const int numComponents = (int)image.components.size();
+
+  jpeg_compress_struct dstinfo;
+  jpeg_error_mgr_impl err;
+  memset(&dstinfo, 0, sizeof dstinfo);
+  dstinfo.err = jpeg_std_error(&err);
+  err.error_exit = jpegrerror_exit;
+  err.output_message = outputErrorMessage;
+
+  if (0 == setjmp(err.setjmp_buffer)) {
+    jpeg_create_compress(&dstinfo);
+    dstinfo.image_width = image.width;
+    dstinfo.image_height = image.height;
+    dstinfo.input_components = numComponents;
+    dstinfo.in_color_space = image.colorSpace;
+    jpeg_set_defaults(&dstinfo);
+    jpeg_set_colorspace(&dstinfo, image.colorSpace);
+    jpeg_set_quality(&dstinfo, qfactor, TRUE);
+    dstinfo.optimize_coding = mOptimizeCoding ? TRUE : FALSE;
+    jvirt_barray_ptr dstArrays[MAX_COMPONENTS];
+    for (int ci = 0; ci < numComponents; ci++) {
+      const CoefficientImage::Component& comp = image.components[ci];
+      const JDIMENSION h = comp.hSampFactor, v = comp.vSampFactor;
+      dstinfo.comp_info[ci].h_samp_factor = comp.hSampFactor;
+      dstinfo.comp_info[ci].v_samp_factor = comp.vSampFactor;
+      dstArrays[ci] = (*dstinfo.mem->request_virt_barray)(
+          reinterpret_cast<j_common_ptr>(&dstinfo), JPOOL_IMAGE, TRUE,
+          (comp.widthInBlocks + h - 1) / h * h, (comp.heightInBlocks + v - 1) / v * v, v);
+    }
+
+    mDestMgr.init_destination = &initDestination;
+    mDestMgr.empty_output_buffer = &emptyOutputBuffer;
+    mDestMgr.term_destination = &terminateDestination;
+    mDestMgr.mResultBuffer.clear();
+    dstinfo.dest = reinterpret_cast<struct jpeg_destination_mgr*>(&mDestMgr);
+    jpeg_write_coefficients(&dstinfo, dstArrays);
+    copyRetainedSegments(&dstinfo, image.stream.data(), image.stream.size());
+
+    for (int ci = 0; ci < numComponents; ci++) {
+      const CoefficientImage::Component& comp = image.components[ci];
+      const UINT16* dstSteps =
+          dstinfo.quant_tbl_ptrs[dstinfo.comp_info[ci].quant_tbl_no]->quantval;
+      for (JDIMENSION by = 0; by < comp.heightInBlocks; by++) {
+        JBLOCKROW dstRow = (*dstinfo.mem->access_virt_barray)(
+            reinterpret_cast<j_common_ptr>(&dstinfo), dstArrays[ci], by, 1, TRUE)[0];
+        const JCOEF* src = &comp.blocks[(size_t)by * comp.widthInBlocks * DCTSIZE2];
+        for (JDIMENSION bx = 0; bx < comp.widthInBlocks; bx++, src += DCTSIZE2) {
+          for (int k = 0; k < DCTSIZE2; k++) {
+            dstRow[bx][k] = requantizeCoefficient(src[k], comp.quantval[k], dstSteps[k]);
+          }
+        }
+      }
+    }
+    jpeg_finish_compress(&dstinfo);
+  } else {
+    status.error_code = UHDR_CODEC_ERROR;
+    status.has_detail = 1;
+    err.format_message(reinterpret_cast<j_common_ptr>(&dstinfo), status.detail);
+  }
+  jpeg_destroy_compress(&dstinfo);
   return status;
 }
 
@@ -280,6 +1173,7 @@ uhdr_error_info_t JpegEncoderHelper::compressYCbCr(jpeg_compress_struct* cinfo,
   }
 
   while (cinfo->next_scanline < cinfo->image_height) {
+    if (CancelToken::cancelled()) return CancelToken::check();
     JDIMENSION mcu_scanline_start[kMaxNumComponents];
 
     for (int i = 0; i < cinfo->num_components; i++) {
@@ -314,4 +1208,107 @@ uhdr_error_info_t JpegEncoderHelper::compressYCbCr(jpeg_compress_struct* cinfo,
   return g_no_error;
 }
 
+uhdr_error_info_t JpegEncoderHelper::compressRows(jpeg_compress_struct* cinfo,
+                                                  const RowSource& source, const bool isRgb) {
+  // Rows are produced in batches of whole mcu rows, up to a strip of them. Grayscale rows are
+  // padded with zeros to whole blocks, as raw data input requires.
+  const unsigned int height = cinfo->image_height;
+  const unsigned int batchRows =
+      (std::min)(mMcuRowsPerStrip * DCTSIZE, (unsigned int)ALIGNM(height, DCTSIZE));
+  const size_t stride =
+      isRgb ? (size_t)cinfo->image_width * 3 : ALIGNM(cinfo->image_width, DCTSIZE);
+  std::unique_ptr<uint8_t[]> batch = std::make_unique<uint8_t[]>(stride * batchRows);
+  JSAMPROW mcuRows[DCTSIZE];
+  JSAMPARRAY subImage[1]{mcuRows};
+
+  for (unsigned int y = 0; y < height; y += batchRows) {
+    if (CancelToken::cancelled()) return CancelToken::check();
+    const unsigned int rows = (std::min)(batchRows, height - y);
+    source(y, y + rows, batch.get(), stride);
+    if (isRgb) {
+      for (unsigned int j = 0; j < rows; j++) {
+        JSAMPROW row = batch.get() + j * stride;
+        if (1 != jpeg_write_scanlines(cinfo, &row, 1)) {
+          uhdr_error_info_t status;
+          status.error_code = UHDR_CODEC_ERROR;
+          status.has_detail = 1;
+          snprintf(status.detail, sizeof status.detail, "jpeg_write_scanlines failed at row %u",
+                   y + j);
+          return status;
+        }
+      }
+      continue;
+    }
+    const unsigned int paddedRows = ALIGNM(rows, DCTSIZE);
+    memset(batch.get() + rows * stride, 0, (paddedRows - rows) * stride);
+    for (unsigned int j = 0; j < paddedRows; j += DCTSIZE) {
+      for (int r = 0; r < DCTSIZE; r++) mcuRows[r] = batch.get() + (j + r) * stride;
+      if (DCTSIZE != jpeg_write_raw_data(cinfo, subImage, DCTSIZE)) {
+        uhdr_error_info_t status;
+        status.error_code = UHDR_CODEC_ERROR;
+        status.has_detail = 1;
+        snprintf(status.detail, sizeof status.detail, "jpeg_write_raw_data failed at row %u",
+                 y + j);
+        return status;
+      }
+    }
+  }
+  return g_no_error;
+}
+
+uhdr_error_info_t JpegEncoderHelper::compressPlaneRows(jpeg_compress_struct* cinfo,
+                                                       const PlaneSource& source) {
+  // Rows are produced in batches of whole mcu rows, up to a strip of them. As in compressYCbCr(),
+  // luma is padded with zeros and chroma with 128 to whole blocks.
+  const unsigned int height = cinfo->image_height;
+  const unsigned int maxV = cinfo->max_v_samp_factor;
+  const unsigned int mcuHeight = DCTSIZE * maxV;
+  const unsigned int batchRows =
+      (std::min)(mMcuRowsPerStrip * mcuHeight, (unsigned int)ALIGNM(height, mcuHeight));
+  std::unique_ptr<uint8_t[]> batch[kMaxNumComponents];
+  uint8_t* dst[kMaxNumComponents]{};
+  size_t stride[kMaxNumComponents]{};
+  JSAMPROW mcuRows[kMaxNumComponents][2 * DCTSIZE];
+  JSAMPARRAY subImage[kMaxNumComponents];
+
+  for (int i = 0; i < cinfo->num_components; i++) {
+    const size_t planeRows = (size_t)batchRows * cinfo->comp_info[i].v_samp_factor / maxV;
+    stride[i] = ALIGNM(mPlaneWidth[i], DCTSIZE);
+    batch[i] = std::make_unique<uint8_t[]>(stride[i] * planeRows);
+    dst[i] = batch[i].get();
+    if (i > 0) memset(dst[i], 128, stride[i] * planeRows);
+    subImage[i] = mcuRows[i];
+  }
+
+  for (unsigned int y = 0; y < height; y += batchRows) {
+    if (CancelToken::cancelled()) return CancelToken::check();
+    const unsigned int rows = (std::min)(batchRows, height - y);
+    UHDR_ERR_CHECK(source(y, y + rows, dst, stride));
+    const unsigned int paddedRows = ALIGNM(rows, mcuHeight);
+    for (int i = 0; i < cinfo->num_components && paddedRows > rows; i++) {
+      const int v = cinfo->comp_info[i].v_samp_factor;
+      const size_t written = ((size_t)rows * v + maxV - 1) / maxV;
+      memset(dst[i] + written * stride[i], i > 0 ? 128 : 0,
+             ((size_t)paddedRows * v / maxV - written) * stride[i]);
+    }
+    for (unsigned int j = 0; j < paddedRows; j += mcuHeight) {
+      for (int i = 0; i < cinfo->num_components; i++) {
+        const int v = cinfo->comp_info[i].v_samp_factor;
+        for (int r = 0; r < DCTSIZE * v; r++) {
+          mcuRows[i][r] = dst[i] + ((size_t)j * v / maxV + r) * stride[i];
+        }
+      }
+      if (mcuHeight != jpeg_write_raw_data(cinfo, subImage, mcuHeight)) {
+        uhdr_error_info_t status;
+        status.error_code = UHDR_CODEC_ERROR;
+        status.has_detail = 1;
+        snprintf(status.detail, sizeof status.detail, "jpeg_write_raw_data failed at row %u",
+                 y + j);
+        return status;
+      }
+    }
+  }
+  return g_no_error;
+}
+
 }  // namespace ultrahdr
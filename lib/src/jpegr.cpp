@@ -21,18 +21,23 @@
 #include <unistd.h>
 #endif
 
-#include <condition_variable>
-#include <deque>
+#include <atomic>
 #include <functional>
+#include <memory>
 #include <mutex>
+#include <string_view>
 #include <thread>
 
+#include "ultrahdr/dspdispatch.h"
 #include "ultrahdr/editorhelper.h"
 #include "ultrahdr/gainmapmetadata.h"
 #include "ultrahdr/ultrahdrcommon.h"
 #include "ultrahdr/jpegr.h"
 #include "ultrahdr/icc.h"
+#include "ultrahdr/memoryarena.h"
 #include "ultrahdr/multipictureformat.h"
+#include "ultrahdr/threadpool.h"
+#include "ultrahdr/trace.h"
 
 #include "image_io/base/data_segment_data_source.h"
 #include "image_io/jpeg/jpeg_info.h"
@@ -50,72 +55,26 @@ uhdr_error_info_t applyGainMapGLES(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_
                                    uhdr_gainmap_metadata_ext_t* gainmap_metadata,
                                    uhdr_color_transfer_t output_ct, float display_boost,
                                    uhdr_raw_image_t* dest, uhdr_opengl_ctxt_t* opengl_ctxt);
+uhdr_error_info_t toneMapGLES(uhdr_raw_image_t* hdr_intent, uhdr_raw_image_t* sdr_intent,
+                              uhdr_opengl_ctxt_t* opengl_ctxt);
+uhdr_error_info_t generateGainMapGLES(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* hdr_intent,
+                                      bool sdr_is_601, bool use_luminance, bool multichannel,
+                                      int map_scale_factor,
+                                      uhdr_gainmap_metadata_ext_t* gainmap_metadata,
+                                      uhdr_raw_image_t* gainmap_img, float* gains,
+                                      uhdr_opengl_ctxt_t* opengl_ctxt);
 #endif
 
 // Gain map metadata
 static const bool kWriteXmpMetadata = true;
 static const bool kWriteIso21496_1Metadata = false;
 
-static const string kXmpNameSpace = "http://ns.adobe.com/xap/1.0/";
-static const string kIsoNameSpace = "urn:iso:std:iso:ts:21496:-1";
+static constexpr std::string_view kXmpNameSpace = "http://ns.adobe.com/xap/1.0/";
+static constexpr std::string_view kIsoNameSpace = "urn:iso:std:iso:ts:21496:-1";
 
 static_assert(kWriteXmpMetadata || kWriteIso21496_1Metadata,
               "Must write gain map metadata in XMP format, or iso 21496-1 format, or both.");
 
-class JobQueue {
- public:
-  bool dequeueJob(unsigned int& rowStart, unsigned int& rowEnd);
-  void enqueueJob(unsigned int rowStart, unsigned int rowEnd);
-  void markQueueForEnd();
-  void reset();
-
- private:
-  bool mQueuedAllJobs = false;
-  std::deque<std::tuple<unsigned int, unsigned int>> mJobs;
-  std::mutex mMutex;
-  std::condition_variable mCv;
-};
-
-bool JobQueue::dequeueJob(unsigned int& rowStart, unsigned int& rowEnd) {
-  std::unique_lock<std::mutex> lock{mMutex};
-  while (true) {
-    if (mJobs.empty()) {
-      if (mQueuedAllJobs) {
-        return false;
-      } else {
-        mCv.wait_for(lock, std::chrono::milliseconds(100));
-      }
-    } else {
-      auto it = mJobs.begin();
-      rowStart = std::get<0>(*it);
-      rowEnd = std::get<1>(*it);
-      mJobs.erase(it);
-      return true;
-    }
-  }
-  return false;
-}
-
-void JobQueue::enqueueJob(unsigned int rowStart, unsigned int rowEnd) {
-  std::unique_lock<std::mutex> lock{mMutex};
-  mJobs.push_back(std::make_tuple(rowStart, rowEnd));
-  lock.unlock();
-  mCv.notify_one();
-}
-
-void JobQueue::markQueueForEnd() {
-  std::unique_lock<std::mutex> lock{mMutex};
-  mQueuedAllJobs = true;
-  lock.unlock();
-  mCv.notify_all();
-}
-
-void JobQueue::reset() {
-  std::unique_lock<std::mutex> lock{mMutex};
-  mJobs.clear();
-  mQueuedAllJobs = false;
-}
-
 /*
  * MessageWriter implementation for ALOG functions.
  */
@@ -127,7 +86,13 @@ class AlogMessageWriter : public MessageWriter {
   }
 };
 
-unsigned int GetCPUCoreCount() { return (std::max)(1u, std::thread::hardware_concurrency()); }
+unsigned int GetCPUCoreCount() {
+#ifdef UHDR_NO_THREADS
+  return 1;
+#else
+  return (std::max)(1u, std::thread::hardware_concurrency());
+#endif
+}
 
 JpegR::JpegR(void* uhdrGLESCtxt, int mapDimensionScaleFactor, int mapCompressQuality,
              bool useMultiChannelGainMap, float gamma, uhdr_enc_preset_t preset,
@@ -138,37 +103,219 @@ JpegR::JpegR(void* uhdrGLESCtxt, int mapDimensionScaleFactor, int mapCompressQua
   mUseMultiChannelGainMap = useMultiChannelGainMap;
   mGamma = gamma;
   mEncPreset = preset;
+  mFastGainMath = preset == UHDR_USAGE_REALTIME;
   mMinContentBoost = minContentBoost;
   mMaxContentBoost = maxContentBoost;
   mTargetDispPeakBrightness = targetDispPeakBrightness;
+  mGainMapTileSize = kGainMapTileSizeDefault;
+  mGainMapBoostEstimation = false;
+  mHdrIntentDownscale = 1;
+  mNumThreads = kNumThreadsDefault;
+  mParallelFor = nullptr;
+  mParallelForCtx = nullptr;
+  mJpegBackend = uhdr_jpeg_backend_t{};
+  mCoreAffinity = UHDR_CORES_ANY;
+  mDecodeCache = nullptr;
+  mEncodeCache = nullptr;
+  mOutputSegments = nullptr;
+  mFastIdct = false;
+  mFastUpsampling = false;
+  mApplyGainMapInPlace = false;
+  mOutputCg = UHDR_CG_UNSPECIFIED;
+  mApproximateGainMap = false;
+  mOutputMap = nullptr;
+  mBaseImageFn = nullptr;
+  mPredecodedGainMap = nullptr;
+  mGainMapFn = nullptr;
+  mLuminanceStats = nullptr;
+  mStats = nullptr;
 }
 
-/*
- * Helper function copies the JPEG image from without EXIF.
- *
- * @param pDest destination of the data to be written.
- * @param pSource source of data being written.
- * @param exif_pos position of the EXIF package, which is aligned with jpegdecoder.getEXIFPos().
- *                 (4 bytes offset to FF sign, the byte after FF E1 XX XX <this byte>).
- * @param exif_size exif size without the initial 4 bytes, aligned with jpegdecoder.getEXIFSize().
- */
-static void copyJpegWithoutExif(uhdr_compressed_image_t* pDest, uhdr_compressed_image_t* pSource,
-                                size_t exif_pos, size_t exif_size) {
-  const size_t exif_offset = 4;  // exif_pos has 4 bytes offset to the FF sign
-  pDest->data_sz = pSource->data_sz - exif_size - exif_offset;
-  pDest->data = new uint8_t[pDest->data_sz];
-  pDest->capacity = pDest->data_sz;
-  pDest->cg = pSource->cg;
-  pDest->ct = pSource->ct;
-  pDest->range = pSource->range;
-  memcpy(pDest->data, pSource->data, exif_pos - exif_offset);
-  memcpy((uint8_t*)pDest->data + exif_pos - exif_offset,
-         (uint8_t*)pSource->data + exif_pos + exif_size, pSource->data_sz - exif_pos - exif_size);
+JpegRDecodeCache::JpegRDecodeCache() = default;
+JpegRDecodeCache::~JpegRDecodeCache() = default;
+
+JpegREncodeCache::JpegREncodeCache() {
+  for (auto cg : {UHDR_CG_BT_709, UHDR_CG_DISPLAY_P3, UHDR_CG_BT_2100}) {
+    mBaseIcc[cg] = IccHelper::writeIccProfile(UHDR_CT_SRGB, cg);
+  }
 }
 
-/* Encode API-0 */
-uhdr_error_info_t JpegR::encodeJPEGR(uhdr_raw_image_t* hdr_intent, uhdr_compressed_image_t* dest,
-                                     int quality, uhdr_mem_block_t* exif) {
+JpegREncodeCache::~JpegREncodeCache() = default;
+
+std::shared_ptr<DataStruct> JpegR::baseImageIcc(uhdr_color_gamut_t cg) {
+  if (mEncodeCache != nullptr && cg >= 0 && cg <= UHDR_CG_BT_2100 && mEncodeCache->mBaseIcc[cg]) {
+    return mEncodeCache->mBaseIcc[cg];
+  }
+  return IccHelper::writeIccProfile(UHDR_CT_SRGB, cg);
+}
+
+unsigned int JpegR::getWorkerCount() {
+  if (mNumThreads > 0) return (std::min)((unsigned int)mNumThreads, (unsigned int)kNumThreadsMax);
+  if (mParallelFor == nullptr && mCoreAffinity != UHDR_CORES_ANY) {
+    const CpuTopology& topology = CpuTopology::get();
+    if (topology.isHeterogeneous()) {
+      unsigned int cores = (unsigned int)topology.cores(mCoreAffinity).size();
+      // background work stays narrow, so that it does not fill the efficiency cluster either
+      return mCoreAffinity == UHDR_CORES_PERFORMANCE ? (std::min)(cores, 4u)
+                                                     : (std::max)(1u, (std::min)(cores / 2, 2u));
+    }
+  }
+  return (std::min)(GetCPUCoreCount(), 4u);
+}
+
+static void RunJob(void* job_ctx, [[maybe_unused]] int index) {
+  (*static_cast<const std::function<void()>*>(job_ctx))();
+}
+
+void JpegR::runParallel(const std::function<void()>& job, unsigned int parallelism) {
+  // jobs stop on the cancellation of the call, whichever thread runs them
+  const std::function<void()>* run = &job;
+  std::function<void()> bound_job;
+  if (CancelToken* cancel = CancelToken::current()) {
+    bound_job = [&job, cancel]() {
+      CancelToken::Scope cancel_scope(cancel);
+      job();
+    };
+    run = &bound_job;
+  }
+  if (mParallelFor != nullptr) {
+    mParallelFor(mParallelForCtx, 0, (int)parallelism, RunJob,
+                 const_cast<std::function<void()>*>(run));
+    return;
+  }
+  // each instance pins the thread it lands on, pool threads and the caller alike. Without a core
+  // type of its own, the stage stays on the cores its caller is pinned to, e.g. a NUMA node
+  const std::vector<int>* cores = CoreAffinityScope::current();
+  if (mCoreAffinity != UHDR_CORES_ANY && CpuTopology::get().isHeterogeneous()) {
+    cores = &CpuTopology::get().cores(mCoreAffinity);
+  }
+  std::function<void()> placed_job;
+  if (cores != nullptr) {
+    placed_job = [run, cores]() {
+      CoreAffinityScope affinity_scope(*cores);
+      (*run)();
+    };
+    run = &placed_job;
+  }
+  ThreadPool::getDefaultPool().run(*run, parallelism);
+}
+
+uhdr_error_info_t JpegR::runConcurrently(const std::function<uhdr_error_info_t()>& first,
+                                         const std::function<uhdr_error_info_t()>& second) {
+  return runConcurrently({first, second});
+}
+
+uhdr_error_info_t JpegR::runConcurrently(
+    const std::vector<std::function<uhdr_error_info_t()>>& tasks) {
+  const int count = (int)tasks.size();
+  if (getWorkerCount() < 2) {
+    for (const auto& task : tasks) UHDR_ERR_CHECK(task())
+    return g_no_error;
+  }
+  std::vector<uhdr_error_info_t> status(count, g_no_error);
+  std::atomic<int> nextTask{0};
+  // tasks allocate their outputs, keep them on the caller's arena whichever thread runs them
+  MemoryArena* arena = MemoryArena::current();
+  std::function<void()> job = [&]() {
+    MemoryArena::Scope arena_scope(arena);
+    for (int task = nextTask++; task < count; task = nextTask++) status[task] = tasks[task]();
+  };
+  // dispatch as many jobs as the other stages do, the idle ones find no task left
+  runParallel(job, getWorkerCount());
+  for (const auto& task_status : status) {
+    if (task_status.error_code != UHDR_CODEC_OK) return task_status;
+  }
+  return g_no_error;
+}
+
+// Below this many pixels an image is copied or converted on the calling thread
+static const size_t kRowBandMinPixels = 512 * 1024;
+
+uhdr_error_info_t JpegR::forEachRowBand(
+    unsigned int width, unsigned int height,
+    const std::function<uhdr_error_info_t(unsigned int row_start, unsigned int row_end)>& fn) {
+  const unsigned int threads = getWorkerCount();
+  if (threads < 2 || (size_t)width * height < kRowBandMinPixels) return fn(0, height);
+  JobQueue jobQueue(height, 2, threads);
+  std::atomic<bool> failed{false};
+  uhdr_error_info_t status = g_no_error;
+  std::function<void()> job = [&]() {
+    unsigned int rowStart, rowEnd;
+    while (!failed.load(std::memory_order_relaxed) && jobQueue.dequeueJob(rowStart, rowEnd)) {
+      uhdr_error_info_t band_status = fn(rowStart, rowEnd);
+      // the first failure is kept, it is read once all jobs returned
+      if (band_status.error_code != UHDR_CODEC_OK && !failed.exchange(true)) status = band_status;
+    }
+  };
+  runParallel(job, threads);
+  // bands skipped by the cancellation are left as they were
+  if (status.error_code == UHDR_CODEC_OK) status = CancelToken::check();
+  return status;
+}
+
+uhdr_error_info_t JpegR::copyRawImage(uhdr_raw_image_t* src, uhdr_raw_image_t* dst) {
+  UHDR_TRACE_SCOPE("JpegR::copyRawImage");
+  if (src->planes[UHDR_PLANE_Y] == dst->planes[UHDR_PLANE_Y]) {
+    // decoded into dst in place, see JpegDecoderHelper::setOutputImage()
+    dst->cg = src->cg;
+    dst->ct = src->ct;
+    dst->range = src->range;
+    return g_no_error;
+  }
+  if (dst->w != src->w || dst->h != src->h) return copy_raw_image(src, dst);
+  const uhdr_raw_image_ext_t src_ext(*src), dst_ext(*dst);
+  uhdr_error_info_t status =
+      forEachRowBand(src->w, src->h, [&](unsigned int row_start, unsigned int row_end) {
+        uhdr_raw_image_ext_t src_band(src_ext, 0, row_start, src->w, row_end - row_start);
+        uhdr_raw_image_ext_t dst_band(dst_ext, 0, row_start, dst->w, row_end - row_start);
+        return copy_raw_image(&src_band, &dst_band);
+      });
+  if (status.error_code != UHDR_CODEC_OK) return status;
+  // the bands take the descriptors of the source, the destination does so too
+  dst->cg = src->cg;
+  dst->ct = src->ct;
+  dst->range = src->range;
+  return g_no_error;
+}
+
+#ifndef UHDR_DECODER_ONLY
+uhdr_error_info_t JpegR::convertRawInputToYcbcr(uhdr_raw_image_t* src,
+                                                std::unique_ptr<uhdr_raw_image_ext_t>& dst) {
+  UHDR_TRACE_SCOPE("JpegR::convertRawInputToYcbcr");
+  dst = alloc_ycbcr_for_raw_input(src);
+  if (dst == nullptr) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "unsupported input format %d or color gamut %d for ycbcr conversion", src->fmt,
+             src->cg);
+    return status;
+  }
+  auto convertRawInputToYcbcrFn = getDspFunctions().convertRawInputToYcbcr;
+  const uhdr_raw_image_ext_t src_ext(*src);
+  return forEachRowBand(src->w, src->h, [&](unsigned int row_start, unsigned int row_end) {
+    uhdr_raw_image_ext_t src_band(src_ext, 0, row_start, src->w, row_end - row_start);
+    uhdr_raw_image_ext_t dst_band(*dst, 0, row_start, dst->w, row_end - row_start);
+    if (convertRawInputToYcbcrFn != nullptr) {
+      uhdr_error_info_t status = convertRawInputToYcbcrFn(&src_band, &dst_band);
+      if (status.error_code != UHDR_CODEC_UNSUPPORTED_FEATURE) return status;
+    }
+    return convert_raw_input_to_ycbcr(&src_band, &dst_band);
+  });
+}
+
+// Writes marker prefix, marker and 2 byte big endian segment length in one go
+static uhdr_error_info_t writeSegmentHeader(uhdr_compressed_image_t* dest, uint8_t marker,
+                                            size_t length, size_t& pos) {
+  const uint8_t header[4] = {JpegMarker::kStart, marker, static_cast<uint8_t>((length >> 8) & 0xff),
+                             static_cast<uint8_t>(length & 0xff)};
+  return Write(dest, header, sizeof header, pos);
+}
+
+uhdr_error_info_t JpegR::prepareToneMappedSdrIntent(
+    uhdr_raw_image_t* hdr_intent, std::unique_ptr<uhdr_raw_image_ext_t>& sdr_intent,
+    RowRangeFn& toneMapRows) {
   uhdr_img_fmt_t sdr_intent_fmt;
   if (hdr_intent->fmt == UHDR_IMG_FMT_24bppYCbCrP010) {
     sdr_intent_fmt = UHDR_IMG_FMT_12bppYCbCr420;
@@ -185,46 +332,103 @@ uhdr_error_info_t JpegR::encodeJPEGR(uhdr_raw_image_t* hdr_intent, uhdr_compress
              hdr_intent->fmt);
     return status;
   }
-  std::unique_ptr<uhdr_raw_image_ext_t> sdr_intent = std::make_unique<uhdr_raw_image_ext_t>(
-      sdr_intent_fmt, UHDR_CG_UNSPECIFIED, UHDR_CT_UNSPECIFIED, UHDR_CR_UNSPECIFIED, hdr_intent->w,
-      hdr_intent->h, 64);
+  sdr_intent = std::make_unique<uhdr_raw_image_ext_t>(sdr_intent_fmt, UHDR_CG_UNSPECIFIED,
+                                                      UHDR_CT_UNSPECIFIED, UHDR_CR_UNSPECIFIED,
+                                                      hdr_intent->w, hdr_intent->h, 64);
 
-  // tone map
-  UHDR_ERR_CHECK(toneMap(hdr_intent, sdr_intent.get()));
+  // tone map and generate gain map in a single sweep over the hdr intent, the rows of the sdr
+  // intent are produced right before the gain map rows that read them
+  UHDR_ERR_CHECK(prepareToneMap(hdr_intent, sdr_intent.get(), toneMapRows));
+#ifdef UHDR_ENABLE_GLES
+  // on the gpu the sdr intent is tone mapped as a whole, ahead of the gain map
+  if (mUhdrGLESCtxt != nullptr) {
+    uhdr_error_info_t status;
+    {
+      StageTimer timer(mStats, UHDR_STAGE_TONE_MAP);
+      status = toneMapGLES(hdr_intent, sdr_intent.get(),
+                           static_cast<uhdr_opengl_ctxt_t*>(mUhdrGLESCtxt));
+    }
+    if (status.error_code == UHDR_CODEC_OK) {
+      toneMapRows = nullptr;
+    } else if (status.error_code != UHDR_CODEC_UNSUPPORTED_FEATURE) {
+      return status;
+    } else {
+      countSlowPath(mStats, UHDR_SLOW_PATH_GPU_FALLBACK);
+    }
+  }
+#endif
+  return g_no_error;
+}
 
+/* Encode API-0 */
+uhdr_error_info_t JpegR::encodeJPEGR(uhdr_raw_image_t* hdr_intent, uhdr_compressed_image_t* dest,
+                                     int quality, uhdr_mem_block_t* exif) {
+  UHDR_TRACE_SCOPE("JpegR::encodeJPEGR");
   // If hdr intent is tonemapped internally, it is observed from quality pov,
-  // generateGainMapOnePass() is sufficient
+  // generateGainMapOnePass() is sufficient. The jpeg coding tools still follow the config option.
+  const uhdr_enc_preset_t jpeg_preset = mEncPreset;
   mEncPreset = UHDR_USAGE_REALTIME;  // overriding the config option
 
-  // generate gain map
+  std::unique_ptr<uhdr_raw_image_ext_t> sdr_intent;
+  RowRangeFn toneMapRows;
+  UHDR_ERR_CHECK(prepareToneMappedSdrIntent(hdr_intent, sdr_intent, toneMapRows));
+  // A gain map that is compressed in strips is compressed while its rows are generated. Otherwise
+  // it is kept, so that its compression can overlap the base image compression.
   uhdr_gainmap_metadata_ext_t metadata(kJpegrVersion);
   std::unique_ptr<uhdr_raw_image_ext_t> gainmap;
+  JpegEncoderHelper jpeg_enc_obj_gm;
+  jpeg_enc_obj_gm.setPreset(jpeg_preset);
+  jpeg_enc_obj_gm.setBackend(mJpegBackend);
+  bool gainmap_compressed_in_place = false;
+  GainMapConsumerFn consumeGainMap = [&](const GainMapRows& rows) -> uhdr_error_info_t {
+    configureGainMapEncoder(rows.w, rows.h, &jpeg_enc_obj_gm);
+    if (!jpeg_enc_obj_gm.encodesStrips(rows.w, rows.h, rows.fmt)) {
+      gainmap = produceGainMap(rows);
+      return g_no_error;
+    }
+    gainmap_compressed_in_place = true;
+    return compressGainMap(rows, &jpeg_enc_obj_gm);
+  };
   UHDR_ERR_CHECK(generateGainMap(sdr_intent.get(), hdr_intent, &metadata, gainmap,
                                  /* sdr_is_601 */ false,
-                                 /* use_luminance */ false));
+                                 /* use_luminance */ false, toneMapRows, consumeGainMap));
 
   // compress gain map
-  JpegEncoderHelper jpeg_enc_obj_gm;
-  UHDR_ERR_CHECK(compressGainMap(gainmap.get(), &jpeg_enc_obj_gm));
-  uhdr_compressed_image_t gainmap_compressed = jpeg_enc_obj_gm.getCompressedImage();
-
-  std::shared_ptr<DataStruct> icc = IccHelper::writeIccProfile(UHDR_CT_SRGB, sdr_intent->cg);
+  auto encode_gainmap = [&]() -> uhdr_error_info_t {
+    if (gainmap_compressed_in_place) return g_no_error;
+    return compressGainMap(gainmap.get(), &jpeg_enc_obj_gm);
+  };
 
-  // compress sdr image
+  // compress sdr image, it only reads the sdr intent, so it can overlap the gain map compression
+  std::shared_ptr<DataStruct> icc = baseImageIcc(sdr_intent->cg);
   std::unique_ptr<uhdr_raw_image_ext_t> sdr_intent_yuv_ext;
   uhdr_raw_image_t* sdr_intent_yuv = sdr_intent.get();
-  if (isPixelFormatRgb(sdr_intent->fmt)) {
-#if (defined(UHDR_ENABLE_INTRINSICS) && (defined(__ARM_NEON__) || defined(__ARM_NEON)))
-    sdr_intent_yuv_ext = convert_raw_input_to_ycbcr_neon(sdr_intent.get());
-#else
-    sdr_intent_yuv_ext = convert_raw_input_to_ycbcr(sdr_intent.get());
-#endif
-    sdr_intent_yuv = sdr_intent_yuv_ext.get();
-  }
-
   JpegEncoderHelper jpeg_enc_obj_sdr;
-  UHDR_ERR_CHECK(
-      jpeg_enc_obj_sdr.compressImage(sdr_intent_yuv, quality, icc->getData(), icc->getLength()));
+  jpeg_enc_obj_sdr.setPreset(jpeg_preset);
+  jpeg_enc_obj_sdr.setBackend(mJpegBackend);
+  jpeg_enc_obj_sdr.setStripEncode(getWorkerCount(), [this](const std::function<void()>& job,
+                                                           unsigned int parallelism) {
+    runParallel(job, parallelism);
+  });
+  auto encode_sdr = [&]() -> uhdr_error_info_t {
+    // a backend takes whole images, without one rgba input is converted a strip at a time
+    if (sdr_intent->fmt == UHDR_IMG_FMT_32bppRGBA8888 && mJpegBackend.compress == nullptr) {
+      StageTimer timer(mStats, UHDR_STAGE_BASE_COMPRESS);
+      return compressRgbBaseImage(sdr_intent.get(), sdr_intent->cg, quality, icc,
+                                  &jpeg_enc_obj_sdr);
+    }
+    if (isPixelFormatRgb(sdr_intent->fmt)) {
+      StageTimer timer(mStats, UHDR_STAGE_COLOR_CONVERT);
+      UHDR_ERR_CHECK(convertRawInputToYcbcr(sdr_intent.get(), sdr_intent_yuv_ext));
+      sdr_intent_yuv = sdr_intent_yuv_ext.get();
+    }
+    StageTimer timer(mStats, UHDR_STAGE_BASE_COMPRESS);
+    return jpeg_enc_obj_sdr.compressImage(sdr_intent_yuv, quality, icc->getData(),
+                                          icc->getLength());
+  };
+
+  UHDR_ERR_CHECK(runConcurrently(encode_gainmap, encode_sdr));
+  uhdr_compressed_image_t gainmap_compressed = jpeg_enc_obj_gm.getCompressedImage();
   uhdr_compressed_image_t sdr_intent_compressed = jpeg_enc_obj_sdr.getCompressedImage();
   sdr_intent_compressed.cg = sdr_intent_yuv->cg;
 
@@ -238,40 +442,64 @@ uhdr_error_info_t JpegR::encodeJPEGR(uhdr_raw_image_t* hdr_intent, uhdr_compress
 uhdr_error_info_t JpegR::encodeJPEGR(uhdr_raw_image_t* hdr_intent, uhdr_raw_image_t* sdr_intent,
                                      uhdr_compressed_image_t* dest, int quality,
                                      uhdr_mem_block_t* exif) {
-  // generate gain map
+  UHDR_TRACE_SCOPE("JpegR::encodeJPEGR");
+  // generate and compress gain map
   uhdr_gainmap_metadata_ext_t metadata(kJpegrVersion);
-  std::unique_ptr<uhdr_raw_image_ext_t> gainmap;
-  UHDR_ERR_CHECK(generateGainMap(sdr_intent, hdr_intent, &metadata, gainmap));
-
-  // compress gain map
   JpegEncoderHelper jpeg_enc_obj_gm;
-  UHDR_ERR_CHECK(compressGainMap(gainmap.get(), &jpeg_enc_obj_gm));
-  uhdr_compressed_image_t gainmap_compressed = jpeg_enc_obj_gm.getCompressedImage();
-
-  std::shared_ptr<DataStruct> icc = IccHelper::writeIccProfile(UHDR_CT_SRGB, sdr_intent->cg);
+  jpeg_enc_obj_gm.setPreset(mEncPreset);
+  jpeg_enc_obj_gm.setBackend(mJpegBackend);
+  auto encode_gainmap = [&]() -> uhdr_error_info_t {
+    std::unique_ptr<uhdr_raw_image_ext_t> gainmap;
+    return generateGainMap(sdr_intent, hdr_intent, &metadata, gainmap, /* sdr_is_601 */ false,
+                           /* use_luminance */ true, /* prepare_sdr_rows */ nullptr,
+                           [&](const GainMapRows& rows) -> uhdr_error_info_t {
+                             return compressGainMap(rows, &jpeg_enc_obj_gm);
+                           },
+                           /* sdr_downscale */ 1, mHdrIntentDownscale);
+  };
 
+  std::shared_ptr<DataStruct> icc = baseImageIcc(sdr_intent->cg);
   std::unique_ptr<uhdr_raw_image_ext_t> sdr_intent_yuv_ext;
   uhdr_raw_image_t* sdr_intent_yuv = sdr_intent;
-  if (isPixelFormatRgb(sdr_intent->fmt)) {
-#if (defined(UHDR_ENABLE_INTRINSICS) && (defined(__ARM_NEON__) || defined(__ARM_NEON)))
-    sdr_intent_yuv_ext = convert_raw_input_to_ycbcr_neon(sdr_intent);
-#else
-    sdr_intent_yuv_ext = convert_raw_input_to_ycbcr(sdr_intent);
-#endif
-    sdr_intent_yuv = sdr_intent_yuv_ext.get();
-  }
+  JpegEncoderHelper jpeg_enc_obj_sdr;
+  jpeg_enc_obj_sdr.setPreset(mEncPreset);
+  jpeg_enc_obj_sdr.setBackend(mJpegBackend);
+  jpeg_enc_obj_sdr.setStripEncode(getWorkerCount(), [this](const std::function<void()>& job,
+                                                           unsigned int parallelism) {
+    runParallel(job, parallelism);
+  });
+  auto encode_sdr = [&]() -> uhdr_error_info_t {
+    // a backend takes whole images, without one rgba input is converted a strip at a time
+    if (sdr_intent->fmt == UHDR_IMG_FMT_32bppRGBA8888 && mJpegBackend.compress == nullptr) {
+      StageTimer timer(mStats, UHDR_STAGE_BASE_COMPRESS);
+      return compressRgbBaseImage(sdr_intent, UHDR_CG_DISPLAY_P3, quality, icc, &jpeg_enc_obj_sdr);
+    }
+    {
+      StageTimer timer(mStats, UHDR_STAGE_COLOR_CONVERT);
+      if (isPixelFormatRgb(sdr_intent->fmt)) {
+        UHDR_ERR_CHECK(convertRawInputToYcbcr(sdr_intent, sdr_intent_yuv_ext));
+        sdr_intent_yuv = sdr_intent_yuv_ext.get();
+      }
 
-  // convert to bt601 YUV encoding for JPEG encode
-#if (defined(UHDR_ENABLE_INTRINSICS) && (defined(__ARM_NEON__) || defined(__ARM_NEON)))
-  UHDR_ERR_CHECK(convertYuv_neon(sdr_intent_yuv, sdr_intent_yuv->cg, UHDR_CG_DISPLAY_P3));
-#else
-  UHDR_ERR_CHECK(convertYuv(sdr_intent_yuv, sdr_intent_yuv->cg, UHDR_CG_DISPLAY_P3));
-#endif
+      // convert to bt601 YUV encoding for JPEG encode
+      UHDR_ERR_CHECK(convertYuv(sdr_intent_yuv, sdr_intent_yuv->cg, UHDR_CG_DISPLAY_P3));
+    }
 
-  // compress sdr image
-  JpegEncoderHelper jpeg_enc_obj_sdr;
-  UHDR_ERR_CHECK(
-      jpeg_enc_obj_sdr.compressImage(sdr_intent_yuv, quality, icc->getData(), icc->getLength()));
+    // compress sdr image
+    StageTimer timer(mStats, UHDR_STAGE_BASE_COMPRESS);
+    return jpeg_enc_obj_sdr.compressImage(sdr_intent_yuv, quality, icc->getData(),
+                                          icc->getLength());
+  };
+
+  // the gamut conversion of a yuv sdr intent happens in place, on the buffer that gain map
+  // generation reads. Only overlap the two when the base image is compressed from its own copy.
+  if (!isPixelFormatRgb(sdr_intent->fmt) && sdr_intent->cg != UHDR_CG_DISPLAY_P3) {
+    UHDR_ERR_CHECK(encode_gainmap());
+    UHDR_ERR_CHECK(encode_sdr());
+  } else {
+    UHDR_ERR_CHECK(runConcurrently(encode_gainmap, encode_sdr));
+  }
+  uhdr_compressed_image_t gainmap_compressed = jpeg_enc_obj_gm.getCompressedImage();
   uhdr_compressed_image_t sdr_intent_compressed = jpeg_enc_obj_sdr.getCompressedImage();
   sdr_intent_compressed.cg = sdr_intent_yuv->cg;
 
@@ -281,13 +509,346 @@ uhdr_error_info_t JpegR::encodeJPEGR(uhdr_raw_image_t* hdr_intent, uhdr_raw_imag
   return g_no_error;
 }
 
+/* Encode API-0 and API-1, a strip of rows at a time */
+uhdr_error_info_t JpegR::encodeJPEGRStreamRows(uhdr_raw_image_t* hdr_rows,
+                                               uhdr_raw_image_t* sdr_rows,
+                                               JpegREncodeStream* stream) {
+  UHDR_TRACE_SCOPE("JpegR::encodeJPEGRStreamRows");
+  if (stream->width == 0) {
+    // the first strip fixes the layout of the intents and starts both compressions
+    if (sdr_rows != nullptr && mEncPreset != UHDR_USAGE_REALTIME) {
+      uhdr_error_info_t status;
+      status.error_code = UHDR_CODEC_INVALID_OPERATION;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "an sdr intent is only streamed with preset UHDR_USAGE_REALTIME, the gain map of "
+               "other presets depends on the whole image");
+      return status;
+    }
+    uhdr_img_fmt_t sdr_fmt;
+    if (sdr_rows != nullptr) {
+      sdr_fmt = sdr_rows->fmt;
+    } else if (hdr_rows->fmt == UHDR_IMG_FMT_24bppYCbCrP010) {
+      sdr_fmt = UHDR_IMG_FMT_12bppYCbCr420;
+    } else if (hdr_rows->fmt == UHDR_IMG_FMT_30bppYCbCr444) {
+      sdr_fmt = UHDR_IMG_FMT_24bppYCbCr444;
+    } else {
+      sdr_fmt = UHDR_IMG_FMT_32bppRGBA8888;
+    }
+    // as in encodeJPEGR(), the jpeg coding tools still follow the config option
+    const uhdr_enc_preset_t jpeg_preset = mEncPreset;
+    mEncPreset = UHDR_USAGE_REALTIME;
+    unsigned int map_width = hdr_rows->w / mMapDimensionScaleFactor;
+    unsigned int map_height = stream->height / mMapDimensionScaleFactor;
+    if (map_width == 0 || map_height == 0) {
+      // as generateGainMap() does for whole images
+      int scaleFactor = (std::min)(hdr_rows->w, stream->height);
+      scaleFactor = (scaleFactor >= DCTSIZE) ? (scaleFactor / DCTSIZE) : 1;
+      setMapDimensionScaleFactor(scaleFactor);
+      map_width = hdr_rows->w / mMapDimensionScaleFactor;
+      map_height = stream->height / mMapDimensionScaleFactor;
+    }
+    stream->width = hdr_rows->w;
+    stream->has_sdr = sdr_rows != nullptr;
+    stream->hdr_desc = *hdr_rows;
+    if (sdr_rows != nullptr) stream->sdr_desc = *sdr_rows;
+    stream->base_cg = sdr_rows != nullptr ? sdr_rows->cg : UHDR_CG_DISPLAY_P3;
+    std::shared_ptr<DataStruct> icc = baseImageIcc(stream->base_cg);
+    stream->base_encoder.setPreset(jpeg_preset);
+    UHDR_ERR_CHECK(stream->base_encoder.startImage(
+        stream->width, stream->height,
+        sdr_fmt == UHDR_IMG_FMT_12bppYCbCr420 ? sdr_fmt : UHDR_IMG_FMT_24bppYCbCr444,
+        stream->quality, icc->getData(), icc->getLength()));
+    stream->gainmap_encoder.setPreset(jpeg_preset);
+    UHDR_ERR_CHECK(stream->gainmap_encoder.startImage(
+        map_width, map_height,
+        mUseMultiChannelGainMap ? UHDR_IMG_FMT_24bppRGB888 : UHDR_IMG_FMT_8bppYCbCr400,
+        mMapCompressQuality, nullptr, 0));
+  }
+
+  auto sameLayout = [](const uhdr_raw_image_t* a, const uhdr_raw_image_t& b) {
+    return a->fmt == b.fmt && a->cg == b.cg && a->ct == b.ct && a->range == b.range && a->w == b.w;
+  };
+  if (!sameLayout(hdr_rows, stream->hdr_desc) || (sdr_rows != nullptr) != stream->has_sdr ||
+      (sdr_rows != nullptr &&
+       (!sameLayout(sdr_rows, stream->sdr_desc) || sdr_rows->h != hdr_rows->h))) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "the intents of the strip at row %u differ in layout from the first strip",
+             stream->rows);
+    return status;
+  }
+  const bool subsampled = hdr_rows->fmt == UHDR_IMG_FMT_24bppYCbCrP010 ||
+                          (sdr_rows != nullptr && sdr_rows->fmt == UHDR_IMG_FMT_12bppYCbCr420);
+  const unsigned int scale = mMapDimensionScaleFactor;
+  if (hdr_rows->h > stream->height - stream->rows ||
+      (stream->rows + hdr_rows->h < stream->height &&
+       (hdr_rows->h % scale != 0 || (subsampled && hdr_rows->h % 2 != 0)))) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "received strip of %u rows at row %u of intents of %u rows, strips but the last span "
+             "a multiple of %u rows",
+             hdr_rows->h, stream->rows, stream->height,
+             subsampled && scale % 2 != 0 ? scale * 2 : scale);
+    return status;
+  }
+  if (hdr_rows->h == 0) return g_no_error;
+
+  std::unique_ptr<uhdr_raw_image_ext_t> tone_mapped_sdr_rows;
+  uhdr_raw_image_t* sdr_intent = sdr_rows;
+  RowRangeFn toneMapRows;
+  if (sdr_rows == nullptr) {
+    UHDR_ERR_CHECK(prepareToneMappedSdrIntent(hdr_rows, tone_mapped_sdr_rows, toneMapRows));
+    sdr_intent = tone_mapped_sdr_rows.get();
+  }
+
+  // gain map rows of the strip, rows below the gain map footprint are only tone mapped
+  if (hdr_rows->h >= scale) {
+    std::unique_ptr<uhdr_raw_image_ext_t> gainmap;
+    UHDR_ERR_CHECK(generateGainMap(sdr_intent, hdr_rows, &stream->metadata, gainmap,
+                                   /* sdr_is_601 */ false, /* use_luminance */ stream->has_sdr,
+                                   toneMapRows, nullptr));
+    StageTimer timer(mStats, UHDR_STAGE_GAINMAP_COMPRESS);
+    UHDR_ERR_CHECK(stream->gainmap_encoder.writeRows(gainmap.get()));
+  } else if (toneMapRows) {
+    StageTimer timer(mStats, UHDR_STAGE_TONE_MAP);
+    toneMapRows(0, hdr_rows->h);
+  }
+
+  // base image rows of the strip, converted to bt601 ycbcr as encodeJPEGR() does
+  std::unique_ptr<uhdr_raw_image_ext_t> base_rows_ext;
+  uhdr_raw_image_t* base_rows = sdr_intent;
+  {
+    StageTimer timer(mStats, UHDR_STAGE_COLOR_CONVERT);
+    if (isPixelFormatRgb(sdr_intent->fmt)) {
+      UHDR_ERR_CHECK(convertRawInputToYcbcr(sdr_intent, base_rows_ext));
+      base_rows = base_rows_ext.get();
+    } else if (sdr_intent->cg != UHDR_CG_DISPLAY_P3) {
+      // the conversion is in place, the rows of the caller are left untouched
+      base_rows_ext = copy_raw_image(sdr_intent);
+      if (base_rows_ext == nullptr) {
+        uhdr_error_info_t status;
+        status.error_code = UHDR_CODEC_MEM_ERROR;
+        status.has_detail = 1;
+        snprintf(status.detail, sizeof status.detail,
+                 "failed to allocate memory for a copy of the sdr intent rows");
+        return status;
+      }
+      base_rows = base_rows_ext.get();
+    }
+    UHDR_ERR_CHECK(convertYuv(base_rows, sdr_intent->cg, UHDR_CG_DISPLAY_P3));
+  }
+  StageTimer timer(mStats, UHDR_STAGE_BASE_COMPRESS);
+  UHDR_ERR_CHECK(stream->base_encoder.writeRows(base_rows));
+  stream->rows += hdr_rows->h;
+  return g_no_error;
+}
+
+uhdr_error_info_t JpegR::encodeJPEGRStreamFinish(JpegREncodeStream* stream,
+                                                 uhdr_mem_block_t* exif,
+                                                 uhdr_compressed_image_t* dest) {
+  UHDR_TRACE_SCOPE("JpegR::encodeJPEGRStreamFinish");
+  if (stream->width == 0 || stream->rows != stream->height) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "encode finished after %u of the %u rows of the intents were received", stream->rows,
+             stream->height);
+    return status;
+  }
+  UHDR_ERR_CHECK(stream->base_encoder.finishImage());
+  UHDR_ERR_CHECK(stream->gainmap_encoder.finishImage());
+  uhdr_compressed_image_t gainmap_compressed = stream->gainmap_encoder.getCompressedImage();
+  uhdr_compressed_image_t sdr_intent_compressed = stream->base_encoder.getCompressedImage();
+  sdr_intent_compressed.cg = stream->base_cg;
+
+  // append gain map, no ICC since JPEG encode already did it
+  return appendGainMap(&sdr_intent_compressed, &gainmap_compressed, exif, /* icc */ nullptr,
+                       /* icc size */ 0, &stream->metadata, dest);
+}
+
+uhdr_error_info_t JpegR::prepareEncodeIntermediates(uhdr_raw_image_t* hdr_intent,
+                                                    uhdr_raw_image_t* sdr_intent,
+                                                    EncodeIntermediates& out) {
+  const uhdr_enc_preset_t jpeg_preset = mEncPreset;
+  RowRangeFn toneMapRows;
+  unsigned int hdr_downscale = mHdrIntentDownscale;
+  if (sdr_intent == nullptr) {
+    // api-0, see encodeJPEGR()
+    mEncPreset = UHDR_USAGE_REALTIME;
+    hdr_downscale = 1;
+    UHDR_ERR_CHECK(prepareToneMappedSdrIntent(hdr_intent, out.tone_mapped_sdr_intent, toneMapRows));
+    sdr_intent = out.tone_mapped_sdr_intent.get();
+  }
+
+  UHDR_ERR_CHECK(generateGainMap(sdr_intent, hdr_intent, &out.metadata, out.gainmap,
+                                 /* sdr_is_601 */ false,
+                                 /* use_luminance */ out.tone_mapped_sdr_intent == nullptr,
+                                 toneMapRows,
+                                 [&](const GainMapRows& rows) -> uhdr_error_info_t {
+                                   out.gainmap = produceGainMap(rows);
+                                   return g_no_error;
+                                 },
+                                 /* sdr_downscale */ 1, hdr_downscale));
+  mEncPreset = jpeg_preset;
+
+  out.icc = baseImageIcc(sdr_intent->cg);
+  out.sdr_intent_yuv = sdr_intent;
+  StageTimer timer(mStats, UHDR_STAGE_COLOR_CONVERT);
+  if (isPixelFormatRgb(sdr_intent->fmt)) {
+    UHDR_ERR_CHECK(convertRawInputToYcbcr(sdr_intent, out.sdr_intent_yuv_ext));
+    out.sdr_intent_yuv = out.sdr_intent_yuv_ext.get();
+  }
+  if (out.tone_mapped_sdr_intent == nullptr) {
+    UHDR_ERR_CHECK(convertYuv(out.sdr_intent_yuv, out.sdr_intent_yuv->cg, UHDR_CG_DISPLAY_P3));
+  }
+  return g_no_error;
+}
+
+/* Encode API-0 or API-1 at several qualities */
+uhdr_error_info_t JpegR::encodeJPEGRLadder(uhdr_raw_image_t* hdr_intent,
+                                           uhdr_raw_image_t* sdr_intent,
+                                           const std::vector<QualityRung>& rungs,
+                                           uhdr_mem_block_t* exif) {
+  UHDR_TRACE_SCOPE("JpegR::encodeJPEGRLadder");
+  // the gain map and the ycbcr intermediate of the base image are shared by the rungs
+  EncodeIntermediates in;
+  UHDR_ERR_CHECK(prepareEncodeIntermediates(hdr_intent, sdr_intent, in));
+
+  // base image and gain map of every rung are independent tasks
+  std::vector<JpegEncoderHelper> encoders(2 * rungs.size());
+  std::vector<std::function<uhdr_error_info_t()>> tasks;
+  for (size_t i = 0; i < rungs.size(); i++) {
+    JpegEncoderHelper* enc_sdr = &encoders[2 * i];
+    JpegEncoderHelper* enc_gm = &encoders[2 * i + 1];
+    const QualityRung& rung = rungs[i];
+    tasks.push_back([&, enc_sdr]() -> uhdr_error_info_t {
+      enc_sdr->setPreset(mEncPreset);
+      enc_sdr->setBackend(mJpegBackend);
+      enc_sdr->setStripEncode(getWorkerCount(), [this](const std::function<void()>& job,
+                                                       unsigned int parallelism) {
+        runParallel(job, parallelism);
+      });
+      StageTimer timer(mStats, UHDR_STAGE_BASE_COMPRESS);
+      return enc_sdr->compressImage(in.sdr_intent_yuv, rung.quality, in.icc->getData(),
+                                    in.icc->getLength());
+    });
+    tasks.push_back([&, enc_gm]() -> uhdr_error_info_t {
+      enc_gm->setPreset(mEncPreset);
+      enc_gm->setBackend(mJpegBackend);
+      configureGainMapEncoder(in.gainmap->w, in.gainmap->h, enc_gm);
+      StageTimer timer(mStats, UHDR_STAGE_GAINMAP_COMPRESS);
+      return enc_gm->compressImage(in.gainmap.get(), rung.gainmap_quality, nullptr, 0);
+    });
+  }
+  UHDR_ERR_CHECK(runConcurrently(tasks));
+
+  for (size_t i = 0; i < rungs.size(); i++) {
+    uhdr_compressed_image_t sdr_intent_compressed = encoders[2 * i].getCompressedImage();
+    uhdr_compressed_image_t gainmap_compressed = encoders[2 * i + 1].getCompressedImage();
+    sdr_intent_compressed.cg = in.sdr_intent_yuv->cg;
+    UHDR_ERR_CHECK(appendGainMap(&sdr_intent_compressed, &gainmap_compressed, exif,
+                                 /* icc */ nullptr, /* icc size */ 0, &in.metadata, rungs[i].dest));
+  }
+  return g_no_error;
+}
+
+// Room for the segments appendGainMap() adds besides the exif package and the two images
+static const size_t kAppendedSegmentsMaxSize = 64 * 1024;
+
+/* Encode API-0 or API-1 to a target size */
+uhdr_error_info_t JpegR::encodeJPEGRTargetSize(uhdr_raw_image_t* hdr_intent,
+                                               uhdr_raw_image_t* sdr_intent, size_t target_size,
+                                               int quality, uhdr_mem_block_t* exif,
+                                               uhdr_compressed_image_t* dest) {
+  UHDR_TRACE_SCOPE("JpegR::encodeJPEGRTargetSize");
+  EncodeIntermediates in;
+  UHDR_ERR_CHECK(prepareEncodeIntermediates(hdr_intent, sdr_intent, in));
+
+  // the forward dct runs once, at quality 100, the trials requantize its coefficients
+  JpegEncoderHelper jpeg_enc_obj_sdr, jpeg_enc_obj_gm;
+  jpeg_enc_obj_sdr.setPreset(mEncPreset);
+  jpeg_enc_obj_sdr.setBackend(mJpegBackend);
+  jpeg_enc_obj_sdr.setStripEncode(getWorkerCount(), [this](const std::function<void()>& job,
+                                                           unsigned int parallelism) {
+    runParallel(job, parallelism);
+  });
+  jpeg_enc_obj_gm.setPreset(mEncPreset);
+  jpeg_enc_obj_gm.setBackend(mJpegBackend);
+  configureGainMapEncoder(in.gainmap->w, in.gainmap->h, &jpeg_enc_obj_gm);
+  auto dct_sdr = [&]() -> uhdr_error_info_t {
+    StageTimer timer(mStats, UHDR_STAGE_BASE_COMPRESS);
+    UHDR_ERR_CHECK(jpeg_enc_obj_sdr.compressImage(in.sdr_intent_yuv, 100, in.icc->getData(),
+                                                  in.icc->getLength()));
+    return jpeg_enc_obj_sdr.keepCoefficients();
+  };
+  auto dct_gainmap = [&]() -> uhdr_error_info_t {
+    StageTimer timer(mStats, UHDR_STAGE_GAINMAP_COMPRESS);
+    UHDR_ERR_CHECK(jpeg_enc_obj_gm.compressImage(in.gainmap.get(), 100, nullptr, 0));
+    return jpeg_enc_obj_gm.keepCoefficients();
+  };
+  UHDR_ERR_CHECK(runConcurrently(dct_sdr, dct_gainmap));
+
+  // a trial stream is assembled in scratch memory, dest only receives the chosen one
+  std::unique_ptr<uhdr_compressed_image_ext_t> scratch;
+  auto encodeAt = [&](int trial_quality, uhdr_compressed_image_t* out) -> uhdr_error_info_t {
+    auto requantize_sdr = [&]() -> uhdr_error_info_t {
+      StageTimer timer(mStats, UHDR_STAGE_BASE_COMPRESS);
+      return jpeg_enc_obj_sdr.requantizeImage((std::min)(trial_quality, quality));
+    };
+    auto requantize_gainmap = [&]() -> uhdr_error_info_t {
+      StageTimer timer(mStats, UHDR_STAGE_GAINMAP_COMPRESS);
+      return jpeg_enc_obj_gm.requantizeImage((std::min)(trial_quality, mMapCompressQuality));
+    };
+    UHDR_ERR_CHECK(runConcurrently(requantize_sdr, requantize_gainmap));
+    uhdr_compressed_image_t sdr_intent_compressed = jpeg_enc_obj_sdr.getCompressedImage();
+    uhdr_compressed_image_t gainmap_compressed = jpeg_enc_obj_gm.getCompressedImage();
+    sdr_intent_compressed.cg = in.sdr_intent_yuv->cg;
+    if (out == nullptr) {
+      const size_t size = sdr_intent_compressed.data_sz + gainmap_compressed.data_sz +
+                          (exif != nullptr ? exif->data_sz : 0) + kAppendedSegmentsMaxSize;
+      if (scratch == nullptr || scratch->capacity < size) {
+        scratch = std::make_unique<uhdr_compressed_image_ext_t>(
+            UHDR_CG_UNSPECIFIED, UHDR_CT_UNSPECIFIED, UHDR_CR_UNSPECIFIED, size);
+      }
+      out = scratch.get();
+    }
+    return appendGainMap(&sdr_intent_compressed, &gainmap_compressed, exif, /* icc */ nullptr,
+                         /* icc size */ 0, &in.metadata, out);
+  };
+
+  // binary search for the highest quality that fits, the stream size grows with the quality
+  int lo = 1, hi = (std::max)(quality, mMapCompressQuality), best = 1;
+  while (lo <= hi) {
+    const int mid = (lo + hi + 1) / 2;
+    UHDR_ERR_CHECK(encodeAt(mid, nullptr));
+    if (scratch->data_sz <= target_size) {
+      best = mid;
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return encodeAt(best, dest);
+}
+
 /* Encode API-2 */
 uhdr_error_info_t JpegR::encodeJPEGR(uhdr_raw_image_t* hdr_intent, uhdr_raw_image_t* sdr_intent,
                                      uhdr_compressed_image_t* sdr_intent_compressed,
                                      uhdr_compressed_image_t* dest) {
+  UHDR_TRACE_SCOPE("JpegR::encodeJPEGR");
   JpegDecoderHelper jpeg_dec_obj_sdr;
-  UHDR_ERR_CHECK(jpeg_dec_obj_sdr.decompressImage(sdr_intent_compressed->data,
-                                                  sdr_intent_compressed->data_sz, PARSE_STREAM));
+  jpeg_dec_obj_sdr.setBackend(mJpegBackend);
+  {
+    StageTimer timer(mStats, UHDR_STAGE_BASE_DECODE);
+    UHDR_ERR_CHECK(jpeg_dec_obj_sdr.decompressImage(sdr_intent_compressed->data,
+                                                    sdr_intent_compressed->data_sz, PARSE_STREAM));
+  }
   if (hdr_intent->w != jpeg_dec_obj_sdr.getDecompressedImageWidth() ||
       hdr_intent->h != jpeg_dec_obj_sdr.getDecompressedImageHeight()) {
     uhdr_error_info_t status;
@@ -301,27 +862,57 @@ uhdr_error_info_t JpegR::encodeJPEGR(uhdr_raw_image_t* hdr_intent, uhdr_raw_imag
     return status;
   }
 
-  // generate gain map
+  // generate and compress gain map
   uhdr_gainmap_metadata_ext_t metadata(kJpegrVersion);
   std::unique_ptr<uhdr_raw_image_ext_t> gainmap;
-  UHDR_ERR_CHECK(generateGainMap(sdr_intent, hdr_intent, &metadata, gainmap));
-
-  // compress gain map
   JpegEncoderHelper jpeg_enc_obj_gm;
-  UHDR_ERR_CHECK(compressGainMap(gainmap.get(), &jpeg_enc_obj_gm));
+  jpeg_enc_obj_gm.setPreset(mEncPreset);
+  jpeg_enc_obj_gm.setBackend(mJpegBackend);
+  UHDR_ERR_CHECK(generateGainMap(sdr_intent, hdr_intent, &metadata, gainmap,
+                                 /* sdr_is_601 */ false, /* use_luminance */ true,
+                                 /* prepare_sdr_rows */ nullptr,
+                                 [&](const GainMapRows& rows) -> uhdr_error_info_t {
+                                   return compressGainMap(rows, &jpeg_enc_obj_gm);
+                                 }));
   uhdr_compressed_image_t gainmap_compressed = jpeg_enc_obj_gm.getCompressedImage();
 
-  return encodeJPEGR(sdr_intent_compressed, &gainmap_compressed, &metadata, dest);
+  // the gain map lives in a local encoder, so the stream is always assembled contiguously
+  return assembleJPEGR(sdr_intent_compressed, &gainmap_compressed, &metadata, dest,
+                       /* segments */ nullptr);
 }
 
 /* Encode API-3 */
 uhdr_error_info_t JpegR::encodeJPEGR(uhdr_raw_image_t* hdr_intent,
                                      uhdr_compressed_image_t* sdr_intent_compressed,
                                      uhdr_compressed_image_t* dest) {
+  UHDR_TRACE_SCOPE("JpegR::encodeJPEGR");
+  // The gain map only sees box filtered sdr samples, so the input jpeg is decoded at the largest
+  // idct scale that divides the map scale factor. The scaled idct does most of the filtering.
+  unsigned int sdr_downscale = 1;
+  const unsigned int map_scale = mMapDimensionScaleFactor;
+  if (hdr_intent->w / map_scale > 0 && hdr_intent->h / map_scale > 0) {
+    for (unsigned int denom : {8u, 4u, 2u}) {
+      if (map_scale % denom == 0) {
+        sdr_downscale = denom;
+        break;
+      }
+    }
+  }
+
   // decode input jpeg, gamut is going to be bt601.
   JpegDecoderHelper jpeg_dec_obj_sdr;
-  UHDR_ERR_CHECK(jpeg_dec_obj_sdr.decompressImage(sdr_intent_compressed->data,
-                                                  sdr_intent_compressed->data_sz));
+  jpeg_dec_obj_sdr.setBackend(mJpegBackend);
+  {
+    StageTimer timer(mStats, UHDR_STAGE_BASE_DECODE);
+    if (sdr_downscale > 1) {
+      UHDR_ERR_CHECK(jpeg_dec_obj_sdr.decompressImageScaled(sdr_intent_compressed->data,
+                                                            sdr_intent_compressed->data_sz,
+                                                            DECODE_TO_YCBCR_CS, sdr_downscale));
+    } else {
+      UHDR_ERR_CHECK(jpeg_dec_obj_sdr.decompressImage(sdr_intent_compressed->data,
+                                                      sdr_intent_compressed->data_sz));
+    }
+  }
 
   uhdr_raw_image_t sdr_intent = jpeg_dec_obj_sdr.getDecompressedImage();
   if (jpeg_dec_obj_sdr.getICCSize() > 0) {
@@ -351,28 +942,36 @@ uhdr_error_info_t JpegR::encodeJPEGR(uhdr_raw_image_t* hdr_intent,
     sdr_intent.cg = sdr_intent_compressed->cg;
   }
 
-  if (hdr_intent->w != sdr_intent.w || hdr_intent->h != sdr_intent.h) {
+  if (hdr_intent->w != jpeg_dec_obj_sdr.getImageWidth() ||
+      hdr_intent->h != jpeg_dec_obj_sdr.getImageHeight()) {
     uhdr_error_info_t status;
     status.error_code = UHDR_CODEC_INVALID_PARAM;
     status.has_detail = 1;
     snprintf(status.detail, sizeof status.detail,
              "sdr intent resolution %dx%d and hdr intent resolution %dx%d do not match",
-             sdr_intent.w, sdr_intent.h, hdr_intent->w, hdr_intent->h);
+             jpeg_dec_obj_sdr.getImageWidth(), jpeg_dec_obj_sdr.getImageHeight(), hdr_intent->w,
+             hdr_intent->h);
     return status;
   }
 
-  // generate gain map
+  // generate and compress gain map
   uhdr_gainmap_metadata_ext_t metadata(kJpegrVersion);
   std::unique_ptr<uhdr_raw_image_ext_t> gainmap;
-  UHDR_ERR_CHECK(
-      generateGainMap(&sdr_intent, hdr_intent, &metadata, gainmap, true /* sdr_is_601 */));
-
-  // compress gain map
   JpegEncoderHelper jpeg_enc_obj_gm;
-  UHDR_ERR_CHECK(compressGainMap(gainmap.get(), &jpeg_enc_obj_gm));
+  jpeg_enc_obj_gm.setPreset(mEncPreset);
+  jpeg_enc_obj_gm.setBackend(mJpegBackend);
+  UHDR_ERR_CHECK(generateGainMap(&sdr_intent, hdr_intent, &metadata, gainmap,
+                                 /* sdr_is_601 */ true, /* use_luminance */ true,
+                                 /* prepare_sdr_rows */ nullptr,
+                                 [&](const GainMapRows& rows) -> uhdr_error_info_t {
+                                   return compressGainMap(rows, &jpeg_enc_obj_gm);
+                                 },
+                                 sdr_downscale));
   uhdr_compressed_image_t gainmap_compressed = jpeg_enc_obj_gm.getCompressedImage();
 
-  return encodeJPEGR(sdr_intent_compressed, &gainmap_compressed, &metadata, dest);
+  // the gain map lives in a local encoder, so the stream is always assembled contiguously
+  return assembleJPEGR(sdr_intent_compressed, &gainmap_compressed, &metadata, dest,
+                       /* segments */ nullptr);
 }
 
 /* Encode API-4 */
@@ -380,6 +979,16 @@ uhdr_error_info_t JpegR::encodeJPEGR(uhdr_compressed_image_t* base_img_compresse
                                      uhdr_compressed_image_t* gainmap_img_compressed,
                                      uhdr_gainmap_metadata_ext_t* metadata,
                                      uhdr_compressed_image_t* dest) {
+  UHDR_TRACE_SCOPE("JpegR::encodeJPEGR");
+  return assembleJPEGR(base_img_compressed, gainmap_img_compressed, metadata, dest,
+                       mOutputSegments);
+}
+
+uhdr_error_info_t JpegR::assembleJPEGR(uhdr_compressed_image_t* base_img_compressed,
+                                       uhdr_compressed_image_t* gainmap_img_compressed,
+                                       uhdr_gainmap_metadata_ext_t* metadata,
+                                       uhdr_compressed_image_t* dest,
+                                       std::vector<uhdr_stream_segment_t>* segments) {
   // We just want to check if ICC is present, so don't do a full decode. Note,
   // this doesn't verify that the ICC is valid.
   JpegDecoderHelper decoder;
@@ -388,7 +997,8 @@ uhdr_error_info_t JpegR::encodeJPEGR(uhdr_compressed_image_t* base_img_compresse
   // Add ICC if not already present.
   if (decoder.getICCSize() > 0) {
     UHDR_ERR_CHECK(appendGainMap(base_img_compressed, gainmap_img_compressed, /* exif */ nullptr,
-                                 /* icc */ nullptr, /* icc size */ 0, metadata, dest));
+                                 /* icc */ nullptr, /* icc size */ 0, metadata, dest,
+                                 segments));
   } else {
     if (base_img_compressed->cg <= UHDR_CG_UNSPECIFIED ||
         base_img_compressed->cg > UHDR_CG_BT_2100) {
@@ -399,17 +1009,18 @@ uhdr_error_info_t JpegR::encodeJPEGR(uhdr_compressed_image_t* base_img_compresse
                base_img_compressed->cg);
       return status;
     }
-    std::shared_ptr<DataStruct> newIcc =
-        IccHelper::writeIccProfile(UHDR_CT_SRGB, base_img_compressed->cg);
+    std::shared_ptr<DataStruct> newIcc = baseImageIcc(base_img_compressed->cg);
     UHDR_ERR_CHECK(appendGainMap(base_img_compressed, gainmap_img_compressed, /* exif */ nullptr,
-                                 newIcc->getData(), newIcc->getLength(), metadata, dest));
+                                 newIcc->getData(), newIcc->getLength(), metadata, dest,
+                                 segments));
   }
 
   return g_no_error;
 }
 
-uhdr_error_info_t JpegR::convertYuv(uhdr_raw_image_t* image, uhdr_color_gamut_t src_encoding,
-                                    uhdr_color_gamut_t dst_encoding) {
+static uhdr_error_info_t convertYuvFloat(uhdr_raw_image_t* image,
+                                         uhdr_color_gamut_t src_encoding,
+                                         uhdr_color_gamut_t dst_encoding) {
   const std::array<float, 9>* coeffs_ptr = nullptr;
   uhdr_error_info_t status = g_no_error;
 
@@ -492,32 +1103,242 @@ uhdr_error_info_t JpegR::convertYuv(uhdr_raw_image_t* image, uhdr_color_gamut_t
   return status;
 }
 
-uhdr_error_info_t JpegR::compressGainMap(uhdr_raw_image_t* gainmap_img,
-                                         JpegEncoderHelper* jpeg_enc_obj) {
-  return jpeg_enc_obj->compressImage(gainmap_img, mMapCompressQuality, nullptr, 0);
+uhdr_error_info_t JpegR::convertYuv(uhdr_raw_image_t* image, uhdr_color_gamut_t src_encoding,
+                                    uhdr_color_gamut_t dst_encoding) {
+  UHDR_TRACE_SCOPE("JpegR::convertYuv");
+  auto convertYuvFn = getDspFunctions().convertYuv;
+  if (convertYuvFn == nullptr) convertYuvFn = convertYuvFloat;
+  if (src_encoding == dst_encoding) return convertYuvFn(image, src_encoding, dst_encoding);
+  // every row is transformed on its own, bands of 4:2:0 images start at even rows
+  const uhdr_raw_image_ext_t image_ext(*image);
+  return forEachRowBand(image->w, image->h, [&](unsigned int row_start, unsigned int row_end) {
+    uhdr_raw_image_ext_t band(image_ext, 0, row_start, image->w, row_end - row_start);
+    return convertYuvFn(&band, src_encoding, dst_encoding);
+  });
 }
 
-uhdr_error_info_t JpegR::generateGainMap(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* hdr_intent,
-                                         uhdr_gainmap_metadata_ext_t* gainmap_metadata,
-                                         std::unique_ptr<uhdr_raw_image_ext_t>& gainmap_img,
-                                         bool sdr_is_601, bool use_luminance) {
-  uhdr_error_info_t status = g_no_error;
-
-  if (sdr_intent->fmt != UHDR_IMG_FMT_24bppYCbCr444 &&
-      sdr_intent->fmt != UHDR_IMG_FMT_16bppYCbCr422 &&
-      sdr_intent->fmt != UHDR_IMG_FMT_12bppYCbCr420 &&
-      sdr_intent->fmt != UHDR_IMG_FMT_32bppRGBA8888) {
-    status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
+uhdr_error_info_t JpegR::compressRgbBaseImage(uhdr_raw_image_t* sdr_intent,
+                                              uhdr_color_gamut_t dst_encoding, int quality,
+                                              const std::shared_ptr<DataStruct>& icc,
+                                              JpegEncoderHelper* jpeg_enc_obj) {
+  UHDR_TRACE_SCOPE("JpegR::compressRgbBaseImage");
+  if (sdr_intent->fmt != UHDR_IMG_FMT_32bppRGBA8888 ||
+      (sdr_intent->cg != UHDR_CG_BT_709 && sdr_intent->cg != UHDR_CG_BT_2100 &&
+       sdr_intent->cg != UHDR_CG_DISPLAY_P3)) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
     status.has_detail = 1;
     snprintf(status.detail, sizeof status.detail,
-             "generate gainmap method expects sdr intent color format to be one of "
-             "{UHDR_IMG_FMT_24bppYCbCr444, UHDR_IMG_FMT_16bppYCbCr422, "
-             "UHDR_IMG_FMT_12bppYCbCr420, UHDR_IMG_FMT_32bppRGBA8888}. Received %d",
-             sdr_intent->fmt);
+             "unsupported input format %d or color gamut %d for ycbcr conversion", sdr_intent->fmt,
+             sdr_intent->cg);
     return status;
   }
-  if (hdr_intent->fmt != UHDR_IMG_FMT_24bppYCbCrP010 &&
-      hdr_intent->fmt != UHDR_IMG_FMT_30bppYCbCr444 &&
+  auto convertRawInputToYcbcrFn = getDspFunctions().convertRawInputToYcbcr;
+  auto convertYuvFn = getDspFunctions().convertYuv;
+  if (convertYuvFn == nullptr) convertYuvFn = convertYuvFloat;
+  const uhdr_raw_image_ext_t src_ext(*sdr_intent);
+  // strips are converted by the jobs that compress them, each into buffers of its own
+  JpegEncoderHelper::PlaneSource source =
+      [&](unsigned int row_start, unsigned int row_end, uint8_t* const dst[3],
+          const size_t strides[3]) -> uhdr_error_info_t {
+    uhdr_raw_image_ext_t src_band(src_ext, 0, row_start, sdr_intent->w, row_end - row_start);
+    uhdr_raw_image_t dst_band{};
+    dst_band.fmt = UHDR_IMG_FMT_24bppYCbCr444;
+    dst_band.cg = sdr_intent->cg;
+    dst_band.ct = sdr_intent->ct;
+    dst_band.range = UHDR_CR_FULL_RANGE;
+    dst_band.w = sdr_intent->w;
+    dst_band.h = row_end - row_start;
+    for (int i = 0; i < 3; i++) {
+      dst_band.planes[i] = dst[i];
+      dst_band.stride[i] = (unsigned int)strides[i];
+    }
+    auto convert = [&]() {
+      if (convertRawInputToYcbcrFn != nullptr) {
+        uhdr_error_info_t status = convertRawInputToYcbcrFn(&src_band, &dst_band);
+        if (status.error_code != UHDR_CODEC_UNSUPPORTED_FEATURE) return status;
+      }
+      return convert_raw_input_to_ycbcr(&src_band, &dst_band);
+    };
+    UHDR_ERR_CHECK(convert());
+    return convertYuvFn(&dst_band, sdr_intent->cg, dst_encoding);
+  };
+  return jpeg_enc_obj->compressImage(source, sdr_intent->w, sdr_intent->h,
+                                     UHDR_IMG_FMT_24bppYCbCr444, quality, icc->getData(),
+                                     icc->getLength());
+}
+
+// Gain maps from this many pixels on are compressed in strips, as the base image is. Smaller ones
+// are compressed in one pass while the base image compression runs alongside.
+static const size_t kGainMapStripEncodeMinPixels = 2 * 1024 * 1024;
+
+void JpegR::configureGainMapEncoder(unsigned int width, unsigned int height,
+                                    JpegEncoderHelper* jpeg_enc_obj) {
+  if ((size_t)width * height >= kGainMapStripEncodeMinPixels) {
+    jpeg_enc_obj->setStripEncode(getWorkerCount(), [this](const std::function<void()>& job,
+                                                          unsigned int parallelism) {
+      runParallel(job, parallelism);
+    });
+  }
+}
+
+uhdr_error_info_t JpegR::compressGainMap(uhdr_raw_image_t* gainmap_img,
+                                         JpegEncoderHelper* jpeg_enc_obj) {
+  StageTimer timer(mStats, UHDR_STAGE_GAINMAP_COMPRESS);
+  configureGainMapEncoder(gainmap_img->w, gainmap_img->h, jpeg_enc_obj);
+  return jpeg_enc_obj->compressImage(gainmap_img, mMapCompressQuality, nullptr, 0);
+}
+
+uhdr_error_info_t JpegR::compressGainMap(const GainMapRows& rows,
+                                         JpegEncoderHelper* jpeg_enc_obj) {
+  configureGainMapEncoder(rows.w, rows.h, jpeg_enc_obj);
+  // Strips produce their rows concurrently. A serial encoder would also produce them serially,
+  // which only pays off for rows that are cheap to produce. A jpeg backend takes whole images.
+  if (mJpegBackend.compress != nullptr ||
+      (rows.costly && !jpeg_enc_obj->encodesStrips(rows.w, rows.h, rows.fmt))) {
+    std::unique_ptr<uhdr_raw_image_ext_t> gainmap_img = produceGainMap(rows);
+    return compressGainMap(gainmap_img.get(), jpeg_enc_obj);
+  }
+  StageTimer timer(mStats, UHDR_STAGE_GAINMAP_COMPRESS);
+  return jpeg_enc_obj->compressImage(rows.produce, rows.w, rows.h, rows.fmt, mMapCompressQuality,
+                                     nullptr, 0);
+}
+
+std::unique_ptr<uhdr_raw_image_ext_t> JpegR::produceGainMap(const GainMapRows& rows) {
+  auto gainmap_img =
+      std::make_unique<uhdr_raw_image_ext_t>(rows.fmt, UHDR_CG_UNSPECIFIED, UHDR_CT_UNSPECIFIED,
+                                             UHDR_CR_UNSPECIFIED, rows.w, rows.h, 64);
+  uint8_t* data = static_cast<uint8_t*>(gainmap_img->planes[UHDR_PLANE_PACKED]);
+  const size_t stride = (size_t)gainmap_img->stride[UHDR_PLANE_PACKED] *
+                        (rows.fmt == UHDR_IMG_FMT_24bppRGB888 ? 3 : 1);
+  const int threads = getWorkerCount();
+  JobQueue jobQueue(rows.h, rows.row_alignment, threads);
+  std::function<void()> produceRows = [&rows, data, stride, &jobQueue]() -> void {
+    unsigned int rowStart, rowEnd;
+    while (jobQueue.dequeueJob(rowStart, rowEnd)) {
+      rows.produce(rowStart, rowEnd, data + rowStart * stride, stride);
+    }
+  };
+  runParallel(produceRows, threads);
+  return gainmap_img;
+}
+
+// The first pass of the two pass gainmap keeps log2 gains in signed Q4.11 fixed point. Its range
+// [-16, 16) covers the clamped content boosts and its step is far below that of the 8 bit map.
+static const float kLog2GainScale = 2048.0f;
+
+static inline int16_t quantizeLog2Gain(float gain) {
+  const float q = std::round(gain * kLog2GainScale);
+  return static_cast<int16_t>((std::min)((std::max)(-32768.0f, q), 32767.0f));
+}
+
+// With content boost estimation, the boosts are taken from a histogram of the gains of every
+// kBoostEstimationRowStride-th gainmap row. Its bins hold kBoostEstimationBinSize fixed point
+// gains, 1/64 in log2, and kBoostEstimationTail of the samples at either end are left out.
+static const int kBoostEstimationRowStride = 8;
+static const int kBoostEstimationBinSize = 32;
+static const int kBoostEstimationBins = 65536 / kBoostEstimationBinSize;
+static const float kBoostEstimationTail = 0.0001f;
+
+// Bits of storage per pixel of a raw image, averaged over all planes
+static size_t storageBitsPerPixel(uhdr_img_fmt_t fmt) {
+  switch (fmt) {
+    case UHDR_IMG_FMT_12bppYCbCr420:
+      return 12;
+    case UHDR_IMG_FMT_16bppYCbCr422:
+      return 16;
+    case UHDR_IMG_FMT_24bppYCbCr444:
+    case UHDR_IMG_FMT_24bppYCbCrP010:
+      return 24;
+    case UHDR_IMG_FMT_30bppYCbCr444:
+      return 48;
+    case UHDR_IMG_FMT_64bppRGBAHalfFloat:
+      return 64;
+    default:
+      return 32;
+  }
+}
+
+// The automatic gain map scale factor is the smallest power of two whose map fits a pixel budget,
+// raised while the detail the map drops stays below a tolerance. Both are looser for the realtime
+// preset. The detail is measured on this many evenly spaced rows of the hdr intent.
+static const unsigned int kAutoMapSampledRows = 32;
+static const size_t kAutoMapMaxPixelsRealtime = 1024 * 1024;
+static const size_t kAutoMapMaxPixelsBestQuality = 4 * 1024 * 1024;
+static const float kAutoMapToleranceRealtime = 0.02f;
+static const float kAutoMapToleranceBestQuality = 0.006f;
+
+int JpegR::selectMapDimensionScaleFactor(uhdr_raw_image_t* hdr_intent, uhdr_enc_preset_t preset) {
+  const bool realtime = preset == UHDR_USAGE_REALTIME;
+  const size_t max_pixels = realtime ? kAutoMapMaxPixelsRealtime : kAutoMapMaxPixelsBestQuality;
+  const float tolerance = realtime ? kAutoMapToleranceRealtime : kAutoMapToleranceBestQuality;
+  const int max_factor = realtime ? 16 : 8;
+  const size_t width = hdr_intent->w, height = hdr_intent->h;
+
+  int factor = 1;
+  while (factor < max_factor && (width / factor) * (height / factor) > max_pixels) factor *= 2;
+  GetPixelFn get_pixel_fn = getPixelFn(hdr_intent->fmt);
+  if (get_pixel_fn == nullptr || width < 2) return factor;
+
+  // Gains follow the hdr luminance, as ratios. Luma codes of hlg and pq are close to logarithmic,
+  // linear input is taken to log2 and scaled to about the same range.
+  const bool is_rgb = isPixelFormatRgb(hdr_intent->fmt);
+  const bool is_linear = hdr_intent->ct == UHDR_CT_LINEAR;
+  const unsigned int rows = (std::min)(kAutoMapSampledRows, hdr_intent->h);
+  std::vector<float> luma(width);
+  std::vector<double> deviation(max_factor + 1, 0.0);  // indexed by factor
+  std::vector<size_t> samples(max_factor + 1, 0);
+  for (unsigned int i = 0; i < rows; i++) {
+    const size_t y = (2 * (size_t)i + 1) * height / (2 * rows);
+    for (size_t x = 0; x < width; x++) {
+      Color pixel = get_pixel_fn(hdr_intent, x, y);
+      float l = is_rgb ? 0.2627f * pixel.r + 0.6780f * pixel.g + 0.0593f * pixel.b : pixel.y;
+      if (is_linear) l = log2((std::max)(l, 1.0f / 4096.0f)) / 24.0f;
+      luma[x] = l;
+    }
+    // a map at factor f holds one value per f samples, what deviates from it is lost
+    for (int f = 2; f <= max_factor; f *= 2) {
+      for (size_t x0 = 0; x0 + f <= width; x0 += f) {
+        float mean = 0.0f;
+        for (int k = 0; k < f; k++) mean += luma[x0 + k];
+        mean /= f;
+        for (int k = 0; k < f; k++) deviation[f] += std::fabs(luma[x0 + k] - mean);
+        samples[f] += f;
+      }
+    }
+  }
+  for (int f = max_factor; f > factor; f /= 2) {
+    if (samples[f] > 0 && deviation[f] <= tolerance * samples[f]) return f;
+  }
+  return factor;
+}
+
+uhdr_error_info_t JpegR::generateGainMap(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* hdr_intent,
+                                         uhdr_gainmap_metadata_ext_t* gainmap_metadata,
+                                         std::unique_ptr<uhdr_raw_image_ext_t>& gainmap_img,
+                                         bool sdr_is_601, bool use_luminance,
+                                         const RowRangeFn& prepare_sdr_rows,
+                                         const GainMapConsumerFn& consume_rows,
+                                         unsigned int sdr_downscale, unsigned int hdr_downscale) {
+  UHDR_TRACE_SCOPE("JpegR::generateGainMap");
+  StageTimer timer(mStats, UHDR_STAGE_GAINMAP_GENERATE);
+  uhdr_error_info_t status = g_no_error;
+
+  if (sdr_intent->fmt != UHDR_IMG_FMT_24bppYCbCr444 &&
+      sdr_intent->fmt != UHDR_IMG_FMT_16bppYCbCr422 &&
+      sdr_intent->fmt != UHDR_IMG_FMT_12bppYCbCr420 &&
+      sdr_intent->fmt != UHDR_IMG_FMT_32bppRGBA8888) {
+    status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "generate gainmap method expects sdr intent color format to be one of "
+             "{UHDR_IMG_FMT_24bppYCbCr444, UHDR_IMG_FMT_16bppYCbCr422, "
+             "UHDR_IMG_FMT_12bppYCbCr420, UHDR_IMG_FMT_32bppRGBA8888}. Received %d",
+             sdr_intent->fmt);
+    return status;
+  }
+  if (hdr_intent->fmt != UHDR_IMG_FMT_24bppYCbCrP010 &&
+      hdr_intent->fmt != UHDR_IMG_FMT_30bppYCbCr444 &&
       hdr_intent->fmt != UHDR_IMG_FMT_32bppRGBA1010102 &&
       hdr_intent->fmt != UHDR_IMG_FMT_64bppRGBAHalfFloat) {
     status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
@@ -540,7 +1361,7 @@ uhdr_error_info_t JpegR::generateGainMap(uhdr_raw_image_t* sdr_intent, uhdr_raw_
     }
   }*/
 
-  ColorTransformFn hdrInvOetf = getInverseOetfFn(hdr_intent->ct);
+  ColorBlockTransformFn hdrInvOetf = getInverseOetfBlockFn(hdr_intent->ct);
   if (hdrInvOetf == nullptr) {
     status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
     status.has_detail = 1;
@@ -550,17 +1371,7 @@ uhdr_error_info_t JpegR::generateGainMap(uhdr_raw_image_t* sdr_intent, uhdr_raw_
     return status;
   }
 
-  LuminanceFn hdrLuminanceFn = getLuminanceFn(hdr_intent->cg);
-  if (hdrLuminanceFn == nullptr) {
-    status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
-    status.has_detail = 1;
-    snprintf(status.detail, sizeof status.detail,
-             "No implementation available for calculating luminance for color gamut %d",
-             hdr_intent->cg);
-    return status;
-  }
-
-  SceneToDisplayLuminanceFn hdrOotfFn = getOotfFn(hdr_intent->ct);
+  ColorBlockTransformFn hdrOotfFn = getOotfBlockFn(hdr_intent->ct);
   if (hdrOotfFn == nullptr) {
     status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
     status.has_detail = 1;
@@ -581,7 +1392,8 @@ uhdr_error_info_t JpegR::generateGainMap(uhdr_raw_image_t* sdr_intent, uhdr_raw_
     return status;
   }
 
-  ColorTransformFn hdrGamutConversionFn = getGamutConversionFn(sdr_intent->cg, hdr_intent->cg);
+  ColorBlockTransformFn hdrGamutConversionFn =
+      getGamutConversionBlockFn(sdr_intent->cg, hdr_intent->cg);
   if (hdrGamutConversionFn == nullptr) {
     status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
     status.has_detail = 1;
@@ -591,7 +1403,7 @@ uhdr_error_info_t JpegR::generateGainMap(uhdr_raw_image_t* sdr_intent, uhdr_raw_
     return status;
   }
 
-  ColorTransformFn sdrYuvToRgbFn = getYuvToRgbFn(sdr_intent->cg);
+  ColorBlockTransformFn sdrYuvToRgbFn = getYuvToRgbBlockFn(sdr_intent->cg);
   if (sdrYuvToRgbFn == nullptr) {
     status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
     status.has_detail = 1;
@@ -601,7 +1413,7 @@ uhdr_error_info_t JpegR::generateGainMap(uhdr_raw_image_t* sdr_intent, uhdr_raw_
     return status;
   }
 
-  ColorTransformFn hdrYuvToRgbFn = getYuvToRgbFn(hdr_intent->cg);
+  ColorBlockTransformFn hdrYuvToRgbFn = getYuvToRgbBlockFn(hdr_intent->cg);
   if (hdrYuvToRgbFn == nullptr) {
     status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
     status.has_detail = 1;
@@ -611,7 +1423,7 @@ uhdr_error_info_t JpegR::generateGainMap(uhdr_raw_image_t* sdr_intent, uhdr_raw_
     return status;
   }
 
-  LuminanceFn luminanceFn = getLuminanceFn(sdr_intent->cg);
+  LuminanceBlockFn luminanceFn = getLuminanceBlockFn(sdr_intent->cg);
   if (luminanceFn == nullptr) {
     status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
     status.has_detail = 1;
@@ -621,8 +1433,8 @@ uhdr_error_info_t JpegR::generateGainMap(uhdr_raw_image_t* sdr_intent, uhdr_raw_
     return status;
   }
 
-  SamplePixelFn sdr_sample_pixel_fn = getSamplePixelFn(sdr_intent->fmt);
-  if (sdr_sample_pixel_fn == nullptr) {
+  SampleRowFn sdr_sample_row_fn = getSampleRowFn(sdr_intent->fmt);
+  if (sdr_sample_row_fn == nullptr) {
     status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
     status.has_detail = 1;
     snprintf(status.detail, sizeof status.detail,
@@ -630,8 +1442,8 @@ uhdr_error_info_t JpegR::generateGainMap(uhdr_raw_image_t* sdr_intent, uhdr_raw_
     return status;
   }
 
-  SamplePixelFn hdr_sample_pixel_fn = getSamplePixelFn(hdr_intent->fmt);
-  if (hdr_sample_pixel_fn == nullptr) {
+  SampleRowFn hdr_sample_row_fn = getSampleRowFn(hdr_intent->fmt);
+  if (hdr_sample_row_fn == nullptr) {
     status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
     status.has_detail = 1;
     snprintf(status.detail, sizeof status.detail,
@@ -640,14 +1452,37 @@ uhdr_error_info_t JpegR::generateGainMap(uhdr_raw_image_t* sdr_intent, uhdr_raw_
   }
 
   if (sdr_is_601) {
-    sdrYuvToRgbFn = p3YuvToRgb;
-  }
+    sdrYuvToRgbFn = getYuvToRgbBlockFn(UHDR_CG_DISPLAY_P3);
+  }
+
+  // Converts the box filtered samples of a block of gain map pixels to linear rgb, the hdr samples
+  // in the sdr gamut. We are assuming the SDR input is always sRGB transfer.
+  ColorBlockTransformFn sdrInvOetf = getInverseOetfBlockFn(UHDR_CT_SRGB);
+  auto linearizeBlocks = [sdr_intent, hdr_intent, sdrYuvToRgbFn, sdrInvOetf, hdrYuvToRgbFn,
+                          hdrInvOetf, hdrOotfFn, hdrGamutConversionFn](ColorBlock& sdr,
+                                                                       ColorBlock& hdr, size_t n) {
+    if (!isPixelFormatRgb(sdr_intent->fmt)) sdrYuvToRgbFn(sdr, n);
+    sdrInvOetf(sdr, n);
+    if (!isPixelFormatRgb(hdr_intent->fmt)) hdrYuvToRgbFn(hdr, n);
+    hdrInvOetf(hdr, n);
+    hdrOotfFn(hdr, n);
+    hdrGamutConversionFn(hdr, n);
+    clipNegatives(hdr, n);
+  };
 
-  unsigned int image_width = sdr_intent->w;
-  unsigned int image_height = sdr_intent->h;
+  if (hdr_downscale == 0 || mMapDimensionScaleFactor % hdr_downscale != 0) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "hdr intent downscale %u does not divide the gainmap scale factor %d", hdr_downscale,
+             mMapDimensionScaleFactor);
+    return status;
+  }
+  unsigned int image_width = hdr_intent->w * hdr_downscale;
+  unsigned int image_height = hdr_intent->h * hdr_downscale;
   unsigned int map_width = image_width / mMapDimensionScaleFactor;
   unsigned int map_height = image_height / mMapDimensionScaleFactor;
-  if (map_width == 0 || map_height == 0) {
+  if ((map_width == 0 || map_height == 0) && hdr_downscale == 1) {
     int scaleFactor = (std::min)(image_width, image_height);
     scaleFactor = (scaleFactor >= DCTSIZE) ? (scaleFactor / DCTSIZE) : 1;
     ALOGW(
@@ -658,16 +1493,138 @@ uhdr_error_info_t JpegR::generateGainMap(uhdr_raw_image_t* sdr_intent, uhdr_raw_
     map_width = image_width / mMapDimensionScaleFactor;
     map_height = image_height / mMapDimensionScaleFactor;
   }
+  if (sdr_downscale == 0 || mMapDimensionScaleFactor % sdr_downscale != 0 ||
+      (size_t)sdr_intent->w * sdr_downscale < (size_t)map_width * mMapDimensionScaleFactor ||
+      (size_t)sdr_intent->h * sdr_downscale < (size_t)map_height * mMapDimensionScaleFactor) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "sdr intent of dimensions %ux%u, downscaled by %u, does not cover the gainmap of "
+             "dimensions %ux%u at scale factor %d",
+             sdr_intent->w, sdr_intent->h, sdr_downscale, map_width, map_height,
+             mMapDimensionScaleFactor);
+    return status;
+  }
+  // box filter sizes of the intents
+  const size_t sdr_scale = mMapDimensionScaleFactor / sdr_downscale;
+  const size_t hdr_scale = mMapDimensionScaleFactor / hdr_downscale;
+
+  const uhdr_img_fmt_t map_fmt =
+      mUseMultiChannelGainMap ? UHDR_IMG_FMT_24bppRGB888 : UHDR_IMG_FMT_8bppYCbCr400;
+  const size_t map_channels = mUseMultiChannelGainMap ? 3 : 1;
+  gainmap_img.reset();
+
+  // The gainmap is walked in tiles whose sdr and hdr input footprint fits mGainMapTileSize bytes,
+  // so that the box filters of a tile read image rows that are still in cache. Tiles are as square
+  // as possible in the image and span whole gainmap rows if the budget allows.
+  size_t tile_w = map_width, tile_h = 1;
+  if (mGainMapTileSize > 0) {
+    const size_t bits_per_map_pixel = sdr_scale * sdr_scale * storageBitsPerPixel(sdr_intent->fmt) +
+                                      hdr_scale * hdr_scale * storageBitsPerPixel(hdr_intent->fmt);
+    const size_t tile_pixels =
+        (std::max)(static_cast<size_t>(mGainMapTileSize) * 8 / bits_per_map_pixel, size_t{1});
+    tile_w = (std::min)(static_cast<size_t>(std::sqrt(static_cast<double>(tile_pixels))),
+                        static_cast<size_t>(map_width));
+    if (tile_w >= kColorBlockSize) tile_w -= tile_w % kColorBlockSize;
+    tile_w = (std::max)(tile_w, size_t{1});
+    tile_h = (std::max)(tile_pixels / tile_w, size_t{1});
+    tile_h = (std::min)(tile_h, static_cast<size_t>(map_height));
+  }
+  // With prepare_sdr_rows, the sdr rows under each band of tiles are produced right before the band
+  // is computed, while the hdr rows read by both are still in cache. Even band heights keep the
+  // first row of every range even, and the last band also covers the rows below the gainmap
+  // footprint.
+  if (prepare_sdr_rows) tile_h += tile_h % 2;
+  const unsigned int map_rows_per_job = prepare_sdr_rows ? 2 : 1;
+  auto prepareSdrRows = [this, &prepare_sdr_rows, image_height, map_height](size_t y0,
+                                                                            size_t y1) -> void {
+    if (!prepare_sdr_rows) return;
+    const size_t scale = mMapDimensionScaleFactor;
+    prepare_sdr_rows(y0 * scale, y1 >= map_height ? image_height : y1 * scale);
+  };
+  // Calls block_fn(y, bx, n) for the blocks of gainmap rows [row_start, row_end), tile by tile.
+  // Tiles are clipped to the row range, so the job queues keep their fine grained row ranges.
+  auto forEachBlock = [map_width, tile_h, prepareSdrRows](size_t row_start, size_t row_end,
+                                                         size_t tile_width, auto&& block_fn) {
+    for (size_t ty = row_start; ty < row_end; ty += tile_h) {
+      const size_t ty_end = (std::min)(ty + tile_h, row_end);
+      prepareSdrRows(ty, ty_end);
+      for (size_t tx = 0; tx < map_width; tx += tile_width) {
+        const size_t tx_end = (std::min)(tx + tile_width, static_cast<size_t>(map_width));
+        for (size_t y = ty; y < ty_end; ++y) {
+          for (size_t bx = tx; bx < tx_end; bx += kColorBlockSize) {
+            block_fn(y, bx, (std::min)(kColorBlockSize, tx_end - bx));
+          }
+        }
+      }
+    }
+  };
+
+  // Generates the map on the gpu. With gains nullptr, the gains are encoded into gainmap_img with
+  // the boosts of gainmap_metadata, else their log2 values are written to gains. Returns false if
+  // the gpu can not generate the map, which is left to the cpu then. Sdr rows that are yet to be
+  // prepared are only available to the cpu.
+  std::function<bool(float*)> generateOnGpu = nullptr;
+#ifdef UHDR_ENABLE_GLES
+  if (mUhdrGLESCtxt != nullptr && !prepare_sdr_rows && sdr_downscale == 1 && hdr_downscale == 1) {
+    generateOnGpu = [this, sdr_intent, hdr_intent, gainmap_metadata, map_fmt, map_width,
+                     map_height, sdr_is_601, use_luminance, &gainmap_img,
+                     &status](float* gains) -> bool {
+      // the gains are read back through the descriptor of the map, which only holds the map if
+      // they are encoded
+      gainmap_img = std::make_unique<uhdr_raw_image_ext_t>(map_fmt, UHDR_CG_UNSPECIFIED,
+                                                           UHDR_CT_UNSPECIFIED, UHDR_CR_UNSPECIFIED,
+                                                           map_width, map_height, 64);
+      uhdr_error_info_t gles_status = generateGainMapGLES(
+          sdr_intent, hdr_intent, sdr_is_601, use_luminance, mUseMultiChannelGainMap,
+          mMapDimensionScaleFactor, gains == nullptr ? gainmap_metadata : nullptr,
+          gainmap_img.get(), gains, static_cast<uhdr_opengl_ctxt_t*>(mUhdrGLESCtxt));
+      if (gains != nullptr || gles_status.error_code == UHDR_CODEC_UNSUPPORTED_FEATURE) {
+        gainmap_img.reset();
+      }
+      if (gles_status.error_code == UHDR_CODEC_UNSUPPORTED_FEATURE) {
+        countSlowPath(mStats, UHDR_SLOW_PATH_GPU_FALLBACK);
+        return false;
+      }
+      status = gles_status;
+      return true;
+    };
+  } else if (mUhdrGLESCtxt != nullptr) {
+    countSlowPath(mStats, UHDR_SLOW_PATH_GPU_FALLBACK);
+  }
+#endif
 
-  gainmap_img = std::make_unique<uhdr_raw_image_ext_t>(
-      mUseMultiChannelGainMap ? UHDR_IMG_FMT_24bppRGB888 : UHDR_IMG_FMT_8bppYCbCr400,
-      UHDR_CG_UNSPECIFIED, UHDR_CT_UNSPECIFIED, UHDR_CR_UNSPECIFIED, map_width, map_height, 64);
-  uhdr_raw_image_ext_t* dest = gainmap_img.get();
+  // Hands the rows of the map to consume_rows, or produces them into gainmap_img. A map that the
+  // gpu wrote to gainmap_img is copied from there.
+  auto deliverRows = [this, map_fmt, map_width, map_height, map_channels, map_rows_per_job,
+                      &gainmap_img, &consume_rows](const JpegEncoderHelper::RowSource& produce,
+                                                   bool costly) -> uhdr_error_info_t {
+    GainMapRows rows{map_width, map_height, map_fmt, map_rows_per_job, costly, produce};
+    if (gainmap_img != nullptr) {
+      if (!consume_rows) return g_no_error;
+      const uhdr_raw_image_ext_t* img = gainmap_img.get();
+      rows.costly = false;
+      rows.produce = [img, map_channels](unsigned int rowStart, unsigned int rowEnd, uint8_t* dst,
+                                         size_t stride) {
+        const size_t src_stride = img->stride[UHDR_PLANE_PACKED] * map_channels;
+        const uint8_t* src = static_cast<const uint8_t*>(img->planes[UHDR_PLANE_PACKED]);
+        for (size_t y = rowStart; y < rowEnd; y++) {
+          memcpy(dst + (y - rowStart) * stride, src + y * src_stride, img->w * map_channels);
+        }
+      };
+      uhdr_error_info_t consume_status = consume_rows(rows);
+      gainmap_img.reset();
+      return consume_status;
+    }
+    if (consume_rows) return consume_rows(rows);
+    gainmap_img = produceGainMap(rows);
+    return g_no_error;
+  };
 
-  auto generateGainMapOnePass = [this, sdr_intent, hdr_intent, gainmap_metadata, dest, map_height,
-                                 hdrInvOetf, hdrLuminanceFn, hdrOotfFn, hdrGamutConversionFn,
-                                 luminanceFn, sdrYuvToRgbFn, hdrYuvToRgbFn, sdr_sample_pixel_fn,
-                                 hdr_sample_pixel_fn, hdr_white_nits, use_luminance]() -> void {
+  auto generateGainMapOnePass = [this, sdr_intent, hdr_intent, gainmap_metadata, linearizeBlocks,
+                                 luminanceFn, sdr_sample_row_fn, hdr_sample_row_fn,
+                                 hdr_white_nits, use_luminance, sdr_scale, hdr_scale, tile_w,
+                                 forEachBlock, deliverRows, &generateOnGpu, &status]() -> void {
     gainmap_metadata->max_content_boost = hdr_white_nits / kSdrWhiteNits;
     gainmap_metadata->min_content_boost = 1.0f;
     gainmap_metadata->gamma = mGamma;
@@ -683,217 +1640,292 @@ uhdr_error_info_t JpegR::generateGainMap(uhdr_raw_image_t* sdr_intent, uhdr_raw_
     float log2MinBoost = log2(gainmap_metadata->min_content_boost);
     float log2MaxBoost = log2(gainmap_metadata->max_content_boost);
 
-    const int threads = (std::min)(GetCPUCoreCount(), 4u);
-    const int jobSizeInRows = 1;
-    unsigned int rowStep = threads == 1 ? map_height : jobSizeInRows;
-    JobQueue jobQueue;
-    std::function<void()> generateMap =
-        [this, sdr_intent, hdr_intent, gainmap_metadata, dest, hdrInvOetf, hdrLuminanceFn,
-         hdrOotfFn, hdrGamutConversionFn, luminanceFn, sdrYuvToRgbFn, hdrYuvToRgbFn,
-         sdr_sample_pixel_fn, hdr_sample_pixel_fn, hdr_white_nits, log2MinBoost, log2MaxBoost,
-         use_luminance, &jobQueue]() -> void {
-      unsigned int rowStart, rowEnd;
-      const bool isHdrIntentRgb = isPixelFormatRgb(hdr_intent->fmt);
-      const bool isSdrIntentRgb = isPixelFormatRgb(sdr_intent->fmt);
+    if (generateOnGpu && generateOnGpu(nullptr)) {
+      if (status.error_code == UHDR_CODEC_OK) status = deliverRows(nullptr, false);
+      return;
+    }
+
+    JpegEncoderHelper::RowSource generateRows =
+        [this, sdr_intent, hdr_intent, gainmap_metadata, linearizeBlocks, luminanceFn,
+         sdr_sample_row_fn, hdr_sample_row_fn, hdr_white_nits, log2MinBoost, log2MaxBoost,
+         use_luminance, sdr_scale, hdr_scale, tile_w,
+         forEachBlock](unsigned int rowStart, unsigned int rowEnd, uint8_t* dst,
+                       size_t stride) -> void {
       const float hdrSampleToNitsFactor =
           hdr_intent->ct == UHDR_CT_LINEAR ? kSdrWhiteNits : hdr_white_nits;
-      while (jobQueue.dequeueJob(rowStart, rowEnd)) {
-        for (size_t y = rowStart; y < rowEnd; ++y) {
-          for (size_t x = 0; x < dest->w; ++x) {
-            Color sdr_rgb_gamma;
-
-            if (isSdrIntentRgb) {
-              sdr_rgb_gamma = sdr_sample_pixel_fn(sdr_intent, mMapDimensionScaleFactor, x, y);
-            } else {
-              Color sdr_yuv_gamma = sdr_sample_pixel_fn(sdr_intent, mMapDimensionScaleFactor, x, y);
-              sdr_rgb_gamma = sdrYuvToRgbFn(sdr_yuv_gamma);
-            }
-
-            // We are assuming the SDR input is always sRGB transfer.
-#if USE_SRGB_INVOETF_LUT
-            Color sdr_rgb = srgbInvOetfLUT(sdr_rgb_gamma);
-#else
-            Color sdr_rgb = srgbInvOetf(sdr_rgb_gamma);
-#endif
-
-            Color hdr_rgb_gamma;
-
-            if (isHdrIntentRgb) {
-              hdr_rgb_gamma = hdr_sample_pixel_fn(hdr_intent, mMapDimensionScaleFactor, x, y);
-            } else {
-              Color hdr_yuv_gamma = hdr_sample_pixel_fn(hdr_intent, mMapDimensionScaleFactor, x, y);
-              hdr_rgb_gamma = hdrYuvToRgbFn(hdr_yuv_gamma);
-            }
-            Color hdr_rgb = hdrInvOetf(hdr_rgb_gamma);
-            hdr_rgb = hdrOotfFn(hdr_rgb, hdrLuminanceFn);
-            hdr_rgb = hdrGamutConversionFn(hdr_rgb);
-            hdr_rgb = clipNegatives(hdr_rgb);
+      ColorBlock sdr, hdr;
+      float sdr_y[kColorBlockSize], hdr_y[kColorBlockSize];
+      float* sdr_dst[3] = {sdr.r, sdr.g, sdr.b};
+      float* hdr_dst[3] = {hdr.r, hdr.g, hdr.b};
+      forEachBlock(rowStart, rowEnd, tile_w, [&](size_t y, size_t bx, size_t n) {
+        sdr_sample_row_fn(sdr_intent, sdr_scale, bx, y, n, sdr_dst);
+        hdr_sample_row_fn(hdr_intent, hdr_scale, bx, y, n, hdr_dst);
+        linearizeBlocks(sdr, hdr, n);
+        if (use_luminance) {
+          luminanceFn(sdr, n, sdr_y);
+          luminanceFn(hdr, n, hdr_y);
+        }
+        // the realtime preset trades the exact logarithm for a polynomial, see fastLog2(). The
+        // choice is made per block, so that the pixel loop calls the inline variant directly.
+        auto gainLoop = [&](auto encodeGainFn) {
+          for (size_t j = 0; j < n; ++j) {
+            const size_t x = bx + j;
+            Color sdr_rgb = {{{sdr.r[j], sdr.g[j], sdr.b[j]}}};
+            Color hdr_rgb = {{{hdr.r[j], hdr.g[j], hdr.b[j]}}};
 
             if (mUseMultiChannelGainMap) {
               Color sdr_rgb_nits = sdr_rgb * kSdrWhiteNits;
               Color hdr_rgb_nits = hdr_rgb * hdrSampleToNitsFactor;
-              size_t pixel_idx = (x + y * dest->stride[UHDR_PLANE_PACKED]) * 3;
-
-              reinterpret_cast<uint8_t*>(dest->planes[UHDR_PLANE_PACKED])[pixel_idx] = encodeGain(
-                  sdr_rgb_nits.r, hdr_rgb_nits.r, gainmap_metadata, log2MinBoost, log2MaxBoost);
-              reinterpret_cast<uint8_t*>(dest->planes[UHDR_PLANE_PACKED])[pixel_idx + 1] =
-                  encodeGain(sdr_rgb_nits.g, hdr_rgb_nits.g, gainmap_metadata, log2MinBoost,
-                             log2MaxBoost);
-              reinterpret_cast<uint8_t*>(dest->planes[UHDR_PLANE_PACKED])[pixel_idx + 2] =
-                  encodeGain(sdr_rgb_nits.b, hdr_rgb_nits.b, gainmap_metadata, log2MinBoost,
-                             log2MaxBoost);
+              uint8_t* pixel = dst + (y - rowStart) * stride + x * 3;
+
+              pixel[0] = encodeGainFn(sdr_rgb_nits.r, hdr_rgb_nits.r, gainmap_metadata,
+                                      log2MinBoost, log2MaxBoost);
+              pixel[1] = encodeGainFn(sdr_rgb_nits.g, hdr_rgb_nits.g, gainmap_metadata,
+                                      log2MinBoost, log2MaxBoost);
+              pixel[2] = encodeGainFn(sdr_rgb_nits.b, hdr_rgb_nits.b, gainmap_metadata,
+                                      log2MinBoost, log2MaxBoost);
             } else {
               float sdr_y_nits;
               float hdr_y_nits;
               if (use_luminance) {
-                sdr_y_nits = luminanceFn(sdr_rgb) * kSdrWhiteNits;
-                hdr_y_nits = luminanceFn(hdr_rgb) * hdrSampleToNitsFactor;
+                sdr_y_nits = sdr_y[j] * kSdrWhiteNits;
+                hdr_y_nits = hdr_y[j] * hdrSampleToNitsFactor;
               } else {
                 sdr_y_nits = fmax(sdr_rgb.r, fmax(sdr_rgb.g, sdr_rgb.b)) * kSdrWhiteNits;
-                hdr_y_nits = fmax(hdr_rgb.r, fmax(hdr_rgb.g, hdr_rgb.b)) * hdrSampleToNitsFactor;
+                hdr_y_nits =
+                    fmax(hdr_rgb.r, fmax(hdr_rgb.g, hdr_rgb.b)) * hdrSampleToNitsFactor;
               }
 
-              size_t pixel_idx = x + y * dest->stride[UHDR_PLANE_Y];
-
-              reinterpret_cast<uint8_t*>(dest->planes[UHDR_PLANE_Y])[pixel_idx] =
-                  encodeGain(sdr_y_nits, hdr_y_nits, gainmap_metadata, log2MinBoost, log2MaxBoost);
+              dst[(y - rowStart) * stride + x] = encodeGainFn(sdr_y_nits, hdr_y_nits,
+                                                              gainmap_metadata, log2MinBoost,
+                                                              log2MaxBoost);
             }
           }
+        };
+        if (mFastGainMath) {
+          gainLoop([](float s, float h, uhdr_gainmap_metadata_ext_t* m, float lo, float hi) {
+            return encodeGainFast(s, h, m, lo, hi);
+          });
+        } else {
+          gainLoop([](float s, float h, uhdr_gainmap_metadata_ext_t* m, float lo, float hi) {
+            return encodeGain(s, h, m, lo, hi);
+          });
         }
-      }
+      });
     };
 
     // generate map
-    std::vector<std::thread> workers;
-    for (int th = 0; th < threads - 1; th++) {
-      workers.push_back(std::thread(generateMap));
-    }
-
-    for (unsigned int rowStart = 0; rowStart < map_height;) {
-      unsigned int rowEnd = (std::min)(rowStart + rowStep, map_height);
-      jobQueue.enqueueJob(rowStart, rowEnd);
-      rowStart = rowEnd;
-    }
-    jobQueue.markQueueForEnd();
-    generateMap();
-    std::for_each(workers.begin(), workers.end(), [](std::thread& t) { t.join(); });
+    status = deliverRows(generateRows, true);
   };
 
   auto generateGainMapTwoPass =
-      [this, sdr_intent, hdr_intent, gainmap_metadata, dest, map_width, map_height, hdrInvOetf,
-       hdrLuminanceFn, hdrOotfFn, hdrGamutConversionFn, luminanceFn, sdrYuvToRgbFn, hdrYuvToRgbFn,
-       sdr_sample_pixel_fn, hdr_sample_pixel_fn, hdr_white_nits, use_luminance]() -> void {
-    uhdr_memory_block_t gainmap_mem((size_t)map_width * map_height * sizeof(float) *
-                                    (mUseMultiChannelGainMap ? 3 : 1));
-    float* gainmap_data = reinterpret_cast<float*>(gainmap_mem.m_buffer.get());
+      [this, sdr_intent, hdr_intent, gainmap_metadata, map_width, map_height, linearizeBlocks,
+       luminanceFn, sdr_sample_row_fn, hdr_sample_row_fn, hdr_white_nits, use_luminance,
+       sdr_is_601, sdr_downscale, hdr_downscale, sdr_scale, hdr_scale, tile_w, map_rows_per_job,
+       forEachBlock, deliverRows,
+       &prepare_sdr_rows, &generateOnGpu, &status]() -> void {
+    const int channels = mUseMultiChannelGainMap ? 3 : 1;
+    const size_t row_size = (size_t)map_width * channels;
     float gainmap_min[3] = {127.0f, 127.0f, 127.0f};
     float gainmap_max[3] = {-128.0f, -128.0f, -128.0f};
-    std::mutex gainmap_minmax;
-
-    const int threads = (std::min)(GetCPUCoreCount(), 4u);
-    const int jobSizeInRows = 1;
-    unsigned int rowStep = threads == 1 ? map_height : jobSizeInRows;
-    JobQueue jobQueue;
-    std::function<void()> generateMap =
-        [this, sdr_intent, hdr_intent, gainmap_data, map_width, hdrInvOetf, hdrLuminanceFn,
-         hdrOotfFn, hdrGamutConversionFn, luminanceFn, sdrYuvToRgbFn, hdrYuvToRgbFn,
-         sdr_sample_pixel_fn, hdr_sample_pixel_fn, hdr_white_nits, use_luminance, &gainmap_min,
-         &gainmap_max, &gainmap_minmax, &jobQueue]() -> void {
-      unsigned int rowStart, rowEnd;
-      const bool isHdrIntentRgb = isPixelFormatRgb(hdr_intent->fmt);
-      const bool isSdrIntentRgb = isPixelFormatRgb(sdr_intent->fmt);
-      const float hdrSampleToNitsFactor =
-          hdr_intent->ct == UHDR_CT_LINEAR ? kSdrWhiteNits : hdr_white_nits;
-      float gainmap_min_th[3] = {127.0f, 127.0f, 127.0f};
-      float gainmap_max_th[3] = {-128.0f, -128.0f, -128.0f};
-
-      while (jobQueue.dequeueJob(rowStart, rowEnd)) {
-        for (size_t y = rowStart; y < rowEnd; ++y) {
-          for (size_t x = 0; x < map_width; ++x) {
-            Color sdr_rgb_gamma;
-
-            if (isSdrIntentRgb) {
-              sdr_rgb_gamma = sdr_sample_pixel_fn(sdr_intent, mMapDimensionScaleFactor, x, y);
-            } else {
-              Color sdr_yuv_gamma = sdr_sample_pixel_fn(sdr_intent, mMapDimensionScaleFactor, x, y);
-              sdr_rgb_gamma = sdrYuvToRgbFn(sdr_yuv_gamma);
-            }
-
-            // We are assuming the SDR input is always sRGB transfer.
-#if USE_SRGB_INVOETF_LUT
-            Color sdr_rgb = srgbInvOetfLUT(sdr_rgb_gamma);
-#else
-            Color sdr_rgb = srgbInvOetf(sdr_rgb_gamma);
+    const float hdrSampleToNitsFactor =
+        hdr_intent->ct == UHDR_CT_LINEAR ? kSdrWhiteNits : hdr_white_nits;
+
+    GainMapRowParams row_params;
+    GenerateGainMapRowFn generate_gain_map_row = nullptr;
+#if USE_SRGB_INVOETF_LUT && USE_HLG_INVOETF_LUT && USE_PQ_INVOETF_LUT
+    // the row kernels filter both intents by the same factor
+    if (sdr_downscale == 1 && hdr_downscale == 1 &&
+        getGainMapRowParams(sdr_intent, hdr_intent, sdr_is_601, use_luminance,
+                            mUseMultiChannelGainMap, hdrSampleToNitsFactor, &row_params)) {
+      generate_gain_map_row = getDspFunctions().generateGainMapRow;
+    }
 #endif
 
-            Color hdr_rgb_gamma;
-
-            if (isHdrIntentRgb) {
-              hdr_rgb_gamma = hdr_sample_pixel_fn(hdr_intent, mMapDimensionScaleFactor, x, y);
-            } else {
-              Color hdr_yuv_gamma = hdr_sample_pixel_fn(hdr_intent, mMapDimensionScaleFactor, x, y);
-              hdr_rgb_gamma = hdrYuvToRgbFn(hdr_yuv_gamma);
+    // Calls emit(y, i, c, gain) with the log2 gain of every channel c of the gainmap rows
+    // [rowStart, rowEnd), i being the index of the gain in a row of map_width * channels gains.
+    // gain_row is scratch for a row of gains if the row kernel is used.
+    auto computeGains = [this, sdr_intent, hdr_intent, map_width, channels, row_size,
+                         linearizeBlocks, luminanceFn, sdr_sample_row_fn, hdr_sample_row_fn,
+                         hdrSampleToNitsFactor, use_luminance, generate_gain_map_row, sdr_scale,
+                         hdr_scale, tile_w, forEachBlock,
+                         &row_params](size_t rowStart, size_t rowEnd, float* gain_row,
+                                      auto&& emit) -> void {
+      ColorBlock sdr, hdr;
+      float sdr_y[kColorBlockSize], hdr_y[kColorBlockSize];
+      float* sdr_dst[3] = {sdr.r, sdr.g, sdr.b};
+      float* hdr_dst[3] = {hdr.r, hdr.g, hdr.b};
+
+      // the row kernels walk whole gainmap rows, blocks cover the columns they leave
+      const size_t tile_width = generate_gain_map_row != nullptr ? map_width : tile_w;
+      size_t x_done = 0;
+      forEachBlock(rowStart, rowEnd, tile_width, [&](size_t y, size_t bx, size_t n) {
+        if (generate_gain_map_row != nullptr) {
+          if (bx == 0) {
+            x_done = generate_gain_map_row(sdr_intent, hdr_intent, row_params,
+                                           mMapDimensionScaleFactor, map_width, y, gain_row);
+            for (size_t i = 0; i < x_done * channels; i++) {
+              emit(y, i, static_cast<int>(i % channels), gain_row[i]);
             }
-            Color hdr_rgb = hdrInvOetf(hdr_rgb_gamma);
-            hdr_rgb = hdrOotfFn(hdr_rgb, hdrLuminanceFn);
-            hdr_rgb = hdrGamutConversionFn(hdr_rgb);
-            hdr_rgb = clipNegatives(hdr_rgb);
+          }
+          if (bx + n <= x_done) return;
+          if (bx < x_done) {
+            n -= x_done - bx;
+            bx = x_done;
+          }
+        }
+        sdr_sample_row_fn(sdr_intent, sdr_scale, bx, y, n, sdr_dst);
+        hdr_sample_row_fn(hdr_intent, hdr_scale, bx, y, n, hdr_dst);
+        linearizeBlocks(sdr, hdr, n);
+        if (use_luminance) {
+          luminanceFn(sdr, n, sdr_y);
+          luminanceFn(hdr, n, hdr_y);
+        }
+        // the realtime preset trades the exact logarithm for a polynomial, see fastLog2(). The
+        // choice is made per block, so that the pixel loop calls the inline variant directly.
+        auto gainLoop = [&](auto computeGainFn) {
+          for (size_t j = 0; j < n; ++j) {
+            const size_t x = bx + j;
+            Color sdr_rgb = {{{sdr.r[j], sdr.g[j], sdr.b[j]}}};
+            Color hdr_rgb = {{{hdr.r[j], hdr.g[j], hdr.b[j]}}};
 
             if (mUseMultiChannelGainMap) {
               Color sdr_rgb_nits = sdr_rgb * kSdrWhiteNits;
               Color hdr_rgb_nits = hdr_rgb * hdrSampleToNitsFactor;
-              size_t pixel_idx = (x + y * map_width) * 3;
-
-              gainmap_data[pixel_idx] = computeGain(sdr_rgb_nits.r, hdr_rgb_nits.r);
-              gainmap_data[pixel_idx + 1] = computeGain(sdr_rgb_nits.g, hdr_rgb_nits.g);
-              gainmap_data[pixel_idx + 2] = computeGain(sdr_rgb_nits.b, hdr_rgb_nits.b);
-              for (int i = 0; i < 3; i++) {
-                gainmap_min_th[i] = (std::min)(gainmap_data[pixel_idx + i], gainmap_min_th[i]);
-                gainmap_max_th[i] = (std::max)(gainmap_data[pixel_idx + i], gainmap_max_th[i]);
-              }
+
+              emit(y, x * 3, 0, computeGainFn(sdr_rgb_nits.r, hdr_rgb_nits.r));
+              emit(y, x * 3 + 1, 1, computeGainFn(sdr_rgb_nits.g, hdr_rgb_nits.g));
+              emit(y, x * 3 + 2, 2, computeGainFn(sdr_rgb_nits.b, hdr_rgb_nits.b));
             } else {
               float sdr_y_nits;
               float hdr_y_nits;
 
               if (use_luminance) {
-                sdr_y_nits = luminanceFn(sdr_rgb) * kSdrWhiteNits;
-                hdr_y_nits = luminanceFn(hdr_rgb) * hdrSampleToNitsFactor;
+                sdr_y_nits = sdr_y[j] * kSdrWhiteNits;
+                hdr_y_nits = hdr_y[j] * hdrSampleToNitsFactor;
               } else {
                 sdr_y_nits = fmax(sdr_rgb.r, fmax(sdr_rgb.g, sdr_rgb.b)) * kSdrWhiteNits;
                 hdr_y_nits = fmax(hdr_rgb.r, fmax(hdr_rgb.g, hdr_rgb.b)) * hdrSampleToNitsFactor;
               }
 
-              size_t pixel_idx = x + y * map_width;
-              gainmap_data[pixel_idx] = computeGain(sdr_y_nits, hdr_y_nits);
-              gainmap_min_th[0] = (std::min)(gainmap_data[pixel_idx], gainmap_min_th[0]);
-              gainmap_max_th[0] = (std::max)(gainmap_data[pixel_idx], gainmap_max_th[0]);
+              emit(y, x, 0, computeGainFn(sdr_y_nits, hdr_y_nits));
             }
           }
+        };
+        if (mFastGainMath) {
+          gainLoop([](float s, float h) { return computeGainFast(s, h); });
+        } else {
+          gainLoop([](float s, float h) { return computeGain(s, h); });
+        }
+      });
+    };
+    auto allocGainRow = [generate_gain_map_row, row_size]() -> std::unique_ptr<float[]> {
+      if (generate_gain_map_row == nullptr) return nullptr;
+      return std::unique_ptr<float[]>(new float[row_size]);
+    };
+
+    const int threads = getWorkerCount();
+    std::atomic<int> next_slot{0};
+    JobQueue jobQueue(map_height, map_rows_per_job, threads);
+
+    // The boosts are estimated from a sample of the gains if enabled, so that the map is encoded
+    // as its gains are computed. Sdr rows that are yet to be prepared can not be sampled up front,
+    // and a gpu computes all gains quicker than the sample, both keep to two passes.
+    const bool estimate_boosts = mGainMapBoostEstimation && !prepare_sdr_rows && !generateOnGpu;
+    uhdr_memory_block_t gainmap_mem(
+        estimate_boosts ? 0 : (size_t)map_height * row_size * sizeof(int16_t));
+    int16_t* gainmap_data = reinterpret_cast<int16_t*>(gainmap_mem.m_buffer.get());
+
+    if (estimate_boosts) {
+      // histogram of the gains of every kBoostEstimationRowStride-th gainmap row, per job
+      const unsigned int sampled_rows =
+          (map_height + kBoostEstimationRowStride - 1) / kBoostEstimationRowStride;
+      std::vector<std::vector<uint32_t>> histograms(
+          threads, std::vector<uint32_t>(kBoostEstimationBins, 0));
+      JobQueue sampleQueue(sampled_rows, 1, threads);
+      std::function<void()> sampleGains = [computeGains, allocGainRow, &histograms, &next_slot,
+                                           &sampleQueue]() -> void {
+        unsigned int rowStart, rowEnd;
+        std::vector<uint32_t>& histogram = histograms[next_slot++];
+        std::unique_ptr<float[]> gain_row = allocGainRow();
+        auto countGain = [&histogram](size_t, size_t, int, float gain) {
+          histogram[(quantizeLog2Gain(gain) + 32768) / kBoostEstimationBinSize]++;
+        };
+        while (sampleQueue.dequeueJob(rowStart, rowEnd)) {
+          for (size_t r = rowStart; r < rowEnd; r++) {
+            const size_t y = r * kBoostEstimationRowStride;
+            computeGains(y, y + 1, gain_row.get(), countGain);
+          }
         }
+      };
+      runParallel(sampleGains, threads);
+
+      // the boosts span the gains but for a small share at either end, so that a few outliers do
+      // not cost the precision of all other gains
+      std::vector<uint32_t>& histogram = histograms[0];
+      uint64_t total = 0;
+      for (int i = 0; i < kBoostEstimationBins; i++) {
+        for (int t = 1; t < threads; t++) histogram[i] += histograms[t][i];
+        total += histogram[i];
       }
-      {
-        std::unique_lock<std::mutex> lock{gainmap_minmax};
-        for (int index = 0; index < (mUseMultiChannelGainMap ? 3 : 1); index++) {
-          gainmap_min[index] = (std::min)(gainmap_min[index], gainmap_min_th[index]);
-          gainmap_max[index] = (std::max)(gainmap_max[index], gainmap_max_th[index]);
+      const uint64_t tail = static_cast<uint64_t>(total * kBoostEstimationTail);
+      int lo = 0, hi = kBoostEstimationBins - 1;
+      for (uint64_t count = histogram[lo]; count <= tail && lo < hi; count += histogram[++lo]) {
+      }
+      for (uint64_t count = histogram[hi]; count <= tail && hi > lo; count += histogram[--hi]) {
+      }
+      gainmap_min[0] = (lo * kBoostEstimationBinSize - 32768) / kLog2GainScale;
+      gainmap_max[0] = ((hi + 1) * kBoostEstimationBinSize - 32768) / kLog2GainScale;
+    } else {
+      // every job keeps the range of its gains in a slot of its own, merged once all are done
+      struct GainRange {
+        float min[3] = {127.0f, 127.0f, 127.0f};
+        float max[3] = {-128.0f, -128.0f, -128.0f};
+      };
+      std::vector<GainRange> gain_ranges(threads);
+      std::function<void()> generateMap = [gainmap_data, row_size, computeGains, allocGainRow,
+                                           &gain_ranges, &next_slot, &jobQueue]() -> void {
+        unsigned int rowStart, rowEnd;
+        GainRange& range = gain_ranges[next_slot++];
+        std::unique_ptr<float[]> gain_row = allocGainRow();
+        auto storeGain = [&range, gainmap_data, row_size](size_t y, size_t i, int c, float gain) {
+          range.min[c] = (std::min)(gain, range.min[c]);
+          range.max[c] = (std::max)(gain, range.max[c]);
+          gainmap_data[y * row_size + i] = quantizeLog2Gain(gain);
+        };
+        while (jobQueue.dequeueJob(rowStart, rowEnd)) {
+          computeGains(rowStart, rowEnd, gain_row.get(), storeGain);
+        }
+      };
+
+      // generate map
+      bool generated_on_gpu = false;
+      if (generateOnGpu) {
+        std::unique_ptr<float[]> gains(new float[(size_t)map_height * row_size]);
+        generated_on_gpu = generateOnGpu(gains.get());
+        if (generated_on_gpu) {
+          if (status.error_code != UHDR_CODEC_OK) return;
+          GainRange& range = gain_ranges[0];
+          for (size_t i = 0; i < (size_t)map_height * row_size; i++) {
+            const int c = i % channels;
+            range.min[c] = (std::min)(gains[i], range.min[c]);
+            range.max[c] = (std::max)(gains[i], range.max[c]);
+            gainmap_data[i] = quantizeLog2Gain(gains[i]);
+          }
+        }
+      }
+      if (!generated_on_gpu) runParallel(generateMap, threads);
+      if (CancelToken::cancelled()) {
+        status = CancelToken::check();
+        return;
+      }
+      for (const GainRange& range : gain_ranges) {
+        for (int c = 0; c < channels; c++) {
+          gainmap_min[c] = (std::min)(gainmap_min[c], range.min[c]);
+          gainmap_max[c] = (std::max)(gainmap_max[c], range.max[c]);
         }
       }
-    };
-
-    // generate map
-    std::vector<std::thread> workers;
-    for (int th = 0; th < threads - 1; th++) {
-      workers.push_back(std::thread(generateMap));
-    }
-
-    for (unsigned int rowStart = 0; rowStart < map_height;) {
-      unsigned int rowEnd = (std::min)(rowStart + rowStep, map_height);
-      jobQueue.enqueueJob(rowStart, rowEnd);
-      rowStart = rowEnd;
     }
-    jobQueue.markQueueForEnd();
-    generateMap();
-    std::for_each(workers.begin(), workers.end(), [](std::thread& t) { t.join(); });
 
     float min_content_boost_log2 = gainmap_min[0];
     float max_content_boost_log2 = gainmap_max[0];
@@ -918,49 +1950,6 @@ uhdr_error_info_t JpegR::generateGainMap(uhdr_raw_image_t* sdr_intent, uhdr_raw_
       max_content_boost_log2 += 0.1f;  // to avoid div by zero during affine transform
     }
 
-    std::function<void()> encodeMap = [this, gainmap_data, map_width, dest, min_content_boost_log2,
-                                       max_content_boost_log2, &jobQueue]() -> void {
-      unsigned int rowStart, rowEnd;
-
-      while (jobQueue.dequeueJob(rowStart, rowEnd)) {
-        if (mUseMultiChannelGainMap) {
-          for (size_t j = rowStart; j < rowEnd; j++) {
-            size_t dst_pixel_idx = j * dest->stride[UHDR_PLANE_PACKED] * 3;
-            size_t src_pixel_idx = j * map_width * 3;
-            for (size_t i = 0; i < map_width * 3; i++) {
-              reinterpret_cast<uint8_t*>(dest->planes[UHDR_PLANE_PACKED])[dst_pixel_idx + i] =
-                  affineMapGain(gainmap_data[src_pixel_idx + i], min_content_boost_log2,
-                                max_content_boost_log2, this->mGamma);
-            }
-          }
-        } else {
-          for (size_t j = rowStart; j < rowEnd; j++) {
-            size_t dst_pixel_idx = j * dest->stride[UHDR_PLANE_Y];
-            size_t src_pixel_idx = j * map_width;
-            for (size_t i = 0; i < map_width; i++) {
-              reinterpret_cast<uint8_t*>(dest->planes[UHDR_PLANE_Y])[dst_pixel_idx + i] =
-                  affineMapGain(gainmap_data[src_pixel_idx + i], min_content_boost_log2,
-                                max_content_boost_log2, this->mGamma);
-            }
-          }
-        }
-      }
-    };
-    workers.clear();
-    jobQueue.reset();
-    rowStep = threads == 1 ? map_height : 1;
-    for (int th = 0; th < threads - 1; th++) {
-      workers.push_back(std::thread(encodeMap));
-    }
-    for (unsigned int rowStart = 0; rowStart < map_height;) {
-      unsigned int rowEnd = (std::min)(rowStart + rowStep, map_height);
-      jobQueue.enqueueJob(rowStart, rowEnd);
-      rowStart = rowEnd;
-    }
-    jobQueue.markQueueForEnd();
-    encodeMap();
-    std::for_each(workers.begin(), workers.end(), [](std::thread& t) { t.join(); });
-
     gainmap_metadata->max_content_boost = exp2(max_content_boost_log2);
     gainmap_metadata->min_content_boost = exp2(min_content_boost_log2);
     gainmap_metadata->gamma = this->mGamma;
@@ -972,6 +1961,58 @@ uhdr_error_info_t JpegR::generateGainMap(uhdr_raw_image_t* sdr_intent, uhdr_raw_
     } else {
       gainmap_metadata->hdr_capacity_max = hdr_white_nits / kSdrWhiteNits;
     }
+
+    if (estimate_boosts) {
+      // the gains are encoded as they are computed, in the single pass over the images
+      JpegEncoderHelper::RowSource generateRows =
+          [this, computeGains, allocGainRow, min_content_boost_log2, max_content_boost_log2](
+              unsigned int rowStart, unsigned int rowEnd, uint8_t* dst, size_t stride) -> void {
+        std::unique_ptr<float[]> gain_row = allocGainRow();
+        auto encodeGainLog2 = [this, dst, stride, rowStart, min_content_boost_log2,
+                               max_content_boost_log2](size_t y, size_t i, int, float gain) {
+          dst[(y - rowStart) * stride + i] =
+              affineMapGain(gain, min_content_boost_log2, max_content_boost_log2, this->mGamma);
+        };
+        computeGains(rowStart, rowEnd, gain_row.get(), encodeGainLog2);
+      };
+      status = deliverRows(generateRows, true);
+      return;
+    }
+
+    // Only the fixed point gains between the smallest and the largest one occur. If the map has
+    // more samples than that span, the affine map and its pow() are evaluated once per value.
+    int q_min = quantizeLog2Gain(gainmap_min[0]), q_max = quantizeLog2Gain(gainmap_max[0]);
+    for (int index = 1; index < channels; index++) {
+      q_min = (std::min)(q_min, static_cast<int>(quantizeLog2Gain(gainmap_min[index])));
+      q_max = (std::max)(q_max, static_cast<int>(quantizeLog2Gain(gainmap_max[index])));
+    }
+    std::vector<uint8_t> encoded_gains;
+    if (q_max >= q_min && (size_t)(q_max - q_min + 1) < map_height * row_size) {
+      encoded_gains.resize(q_max - q_min + 1);
+      for (int q = q_min; q <= q_max; q++) {
+        encoded_gains[q - q_min] = affineMapGain(q / kLog2GainScale, min_content_boost_log2,
+                                                 max_content_boost_log2, this->mGamma);
+      }
+    }
+
+    JpegEncoderHelper::RowSource encodeRows =
+        [this, gainmap_data, row_size, min_content_boost_log2, max_content_boost_log2, q_min,
+         &encoded_gains](unsigned int rowStart, unsigned int rowEnd, uint8_t* dst,
+                         size_t stride) -> void {
+      for (size_t j = rowStart; j < rowEnd; j++) {
+        uint8_t* dst_row = dst + (j - rowStart) * stride;
+        const int16_t* src_row = gainmap_data + j * row_size;
+        if (!encoded_gains.empty()) {
+          for (size_t i = 0; i < row_size; i++) dst_row[i] = encoded_gains[src_row[i] - q_min];
+        } else {
+          for (size_t i = 0; i < row_size; i++) {
+            dst_row[i] = affineMapGain(src_row[i] / kLog2GainScale, min_content_boost_log2,
+                                       max_content_boost_log2, this->mGamma);
+          }
+        }
+      }
+    };
+    status = deliverRows(encodeRows, false);
   };
 
   if (mEncPreset == UHDR_USAGE_REALTIME) {
@@ -1032,7 +2073,10 @@ uhdr_error_info_t JpegR::appendGainMap(uhdr_compressed_image_t* sdr_intent_compr
                                        uhdr_compressed_image_t* gainmap_compressed,
                                        uhdr_mem_block_t* pExif, void* pIcc, size_t icc_size,
                                        uhdr_gainmap_metadata_ext_t* metadata,
-                                       uhdr_compressed_image_t* dest) {
+                                       uhdr_compressed_image_t* dest,
+                                       std::vector<uhdr_stream_segment_t>* segments) {
+  UHDR_TRACE_SCOPE("JpegR::appendGainMap");
+  StageTimer timer(mStats, UHDR_STAGE_GAINMAP_APPEND);
   const size_t xmpNameSpaceLength = kXmpNameSpace.size() + 1;  // need to count the null terminator
   const size_t isoNameSpaceLength = kIsoNameSpace.size() + 1;  // need to count the null terminator
 
@@ -1041,31 +2085,44 @@ uhdr_error_info_t JpegR::appendGainMap(uhdr_compressed_image_t* sdr_intent_compr
   // image xmp                                                                                   //
   /////////////////////////////////////////////////////////////////////////////////////////////////
 
-  // XMP
-  string xmp_secondary;
+  // XMP, the packets are formatted on the stack, the version string is the only variable length
+  // text in them
+  if (kWriteXmpMetadata && metadata->version.size() > kXmpVersionMaxLength) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "gain map metadata version string is %zu characters long, at most %zu are supported",
+             metadata->version.size(), kXmpVersionMaxLength);
+    return status;
+  }
+  char xmp_secondary[kXmpPacketMaxSize + kXmpVersionMaxLength];
+  size_t xmp_secondary_size = 0;
   size_t xmp_secondary_length;
   if (kWriteXmpMetadata) {
-    xmp_secondary = generateXmpForSecondaryImage(*metadata);
+    xmp_secondary_size = writeXmpForSecondaryImage(xmp_secondary, sizeof xmp_secondary, *metadata);
     // xmp_secondary_length = 2 bytes representing the length of the package +
     //  + xmpNameSpaceLength = 29 bytes length
-    //  + length of xmp packet = xmp_secondary.size()
-    xmp_secondary_length = 2 + xmpNameSpaceLength + xmp_secondary.size();
+    //  + length of xmp packet = xmp_secondary_size
+    xmp_secondary_length = 2 + xmpNameSpaceLength + xmp_secondary_size;
   }
 
   // ISO
   uhdr_gainmap_metadata_frac iso_secondary_metadata;
-  std::vector<uint8_t> iso_secondary_data;
+  uint8_t iso_secondary_data[kGainmapMetadataMaxSize];
+  size_t iso_secondary_data_size = 0;
   size_t iso_secondary_length;
   if (kWriteIso21496_1Metadata) {
     UHDR_ERR_CHECK(uhdr_gainmap_metadata_frac::gainmapMetadataFloatToFraction(
         metadata, &iso_secondary_metadata));
 
-    UHDR_ERR_CHECK(uhdr_gainmap_metadata_frac::encodeGainmapMetadata(&iso_secondary_metadata,
-                                                                     iso_secondary_data));
+    UHDR_ERR_CHECK(uhdr_gainmap_metadata_frac::encodeGainmapMetadata(
+        &iso_secondary_metadata, iso_secondary_data, sizeof iso_secondary_data,
+        iso_secondary_data_size));
     // iso_secondary_length = 2 bytes representing the length of the package +
     //  + isoNameSpaceLength = 28 bytes length
-    //  + length of iso metadata packet = iso_secondary_data.size()
-    iso_secondary_length = 2 + isoNameSpaceLength + iso_secondary_data.size();
+    //  + length of iso metadata packet = iso_secondary_data_size
+    iso_secondary_length = 2 + isoNameSpaceLength + iso_secondary_data_size;
   }
 
   size_t secondary_image_size = 2 /* 2 bytes length of APP1 sign */ + gainmap_compressed->data_sz;
@@ -1085,15 +2142,11 @@ uhdr_error_info_t JpegR::appendGainMap(uhdr_compressed_image_t* sdr_intent_compr
   exif_from_jpg.data = nullptr;
   exif_from_jpg.data_sz = 0;
 
-  uhdr_compressed_image_t new_jpg_image;
-  new_jpg_image.data = nullptr;
-  new_jpg_image.data_sz = 0;
-  new_jpg_image.capacity = 0;
-  new_jpg_image.cg = UHDR_CG_UNSPECIFIED;
-  new_jpg_image.ct = UHDR_CT_UNSPECIFIED;
-  new_jpg_image.range = UHDR_CR_UNSPECIFIED;
-
-  std::unique_ptr<uint8_t[]> dest_data;
+  // The primary image is streamed to dest as two spans around its exif segment (if any), so an
+  // embedded exif package is relocated without staging a copy of the whole image.
+  uint8_t* primary_data = static_cast<uint8_t*>(sdr_intent_compressed->data);
+  size_t primary_head_end = sdr_intent_compressed->data_sz;
+  size_t primary_tail_start = sdr_intent_compressed->data_sz;
   if (decoder.getEXIFPos() >= 0) {
     if (pExif != nullptr) {
       uhdr_error_info_t status;
@@ -1104,18 +2157,32 @@ uhdr_error_info_t JpegR::appendGainMap(uhdr_compressed_image_t* sdr_intent_compr
                "contains exif, unsure which one to use");
       return status;
     }
-    copyJpegWithoutExif(&new_jpg_image, sdr_intent_compressed, decoder.getEXIFPos(),
-                        decoder.getEXIFSize());
-    dest_data.reset(reinterpret_cast<uint8_t*>(new_jpg_image.data));
+    const size_t exif_offset = 4;  // exif_pos has 4 bytes offset to the FF sign
+    primary_head_end = decoder.getEXIFPos() - exif_offset;
+    primary_tail_start = decoder.getEXIFPos() + decoder.getEXIFSize();
     exif_from_jpg.data = decoder.getEXIFPtr();
     exif_from_jpg.data_sz = decoder.getEXIFSize();
     pExif = &exif_from_jpg;
   }
+  const size_t primary_jpg_size =
+      sdr_intent_compressed->data_sz - (primary_tail_start - primary_head_end);
+
+  // pos is the write offset in dest, referenced counts the bytes of the spans that are listed in
+  // segments instead of being written. Their sum is the offset in the stream.
+  size_t pos = 0, referenced = 0, run_start = 0;
+  if (segments != nullptr) segments->clear();
+  auto writeSpan = [&](const void* data, size_t size) -> uhdr_error_info_t {
+    if (segments == nullptr) return Write(dest, data, size, pos);
+    if (size == 0) return g_no_error;
+    if (pos > run_start) {
+      segments->push_back({static_cast<uint8_t*>(dest->data) + run_start, pos - run_start});
+    }
+    segments->push_back({data, size});
+    run_start = pos;
+    referenced += size;
+    return g_no_error;
+  };
 
-  uhdr_compressed_image_t* final_primary_jpg_image_ptr =
-      new_jpg_image.data_sz == 0 ? sdr_intent_compressed : &new_jpg_image;
-
-  size_t pos = 0;
   // Begin primary image
   // Write SOI
   UHDR_ERR_CHECK(Write(dest, &photos_editing_formats::image_io::JpegMarker::kStart, 1, pos));
@@ -1124,81 +2191,57 @@ uhdr_error_info_t JpegR::appendGainMap(uhdr_compressed_image_t* sdr_intent_compr
   // Write EXIF
   if (pExif != nullptr) {
     const size_t length = 2 + pExif->data_sz;
-    const uint8_t lengthH = ((length >> 8) & 0xff);
-    const uint8_t lengthL = (length & 0xff);
-    UHDR_ERR_CHECK(Write(dest, &photos_editing_formats::image_io::JpegMarker::kStart, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, &photos_editing_formats::image_io::JpegMarker::kAPP1, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, &lengthH, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, &lengthL, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, pExif->data, pExif->data_sz, pos));
+    UHDR_ERR_CHECK(writeSegmentHeader(dest, JpegMarker::kAPP1, length, pos));
+    UHDR_ERR_CHECK(writeSpan(pExif->data, pExif->data_sz));
   }
 
   // Prepare and write XMP
   if (kWriteXmpMetadata) {
-    const string xmp_primary = generateXmpForPrimaryImage(secondary_image_size, *metadata);
-    const size_t length = 2 + xmpNameSpaceLength + xmp_primary.size();
-    const uint8_t lengthH = ((length >> 8) & 0xff);
-    const uint8_t lengthL = (length & 0xff);
-    UHDR_ERR_CHECK(Write(dest, &photos_editing_formats::image_io::JpegMarker::kStart, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, &photos_editing_formats::image_io::JpegMarker::kAPP1, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, &lengthH, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, &lengthL, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, (void*)kXmpNameSpace.c_str(), xmpNameSpaceLength, pos));
-    UHDR_ERR_CHECK(Write(dest, (void*)xmp_primary.c_str(), xmp_primary.size(), pos));
+    char xmp_primary[kXmpPacketMaxSize + kXmpVersionMaxLength];
+    const size_t xmp_primary_size =
+        writeXmpForPrimaryImage(xmp_primary, sizeof xmp_primary, secondary_image_size, *metadata);
+    const size_t length = 2 + xmpNameSpaceLength + xmp_primary_size;
+    UHDR_ERR_CHECK(writeSegmentHeader(dest, JpegMarker::kAPP1, length, pos));
+    UHDR_ERR_CHECK(Write(dest, (void*)kXmpNameSpace.data(), xmpNameSpaceLength, pos));
+    UHDR_ERR_CHECK(Write(dest, xmp_primary, xmp_primary_size, pos));
   }
 
   // Write ICC
   if (pIcc != nullptr && icc_size > 0) {
     const size_t length = icc_size + 2;
-    const uint8_t lengthH = ((length >> 8) & 0xff);
-    const uint8_t lengthL = (length & 0xff);
-    UHDR_ERR_CHECK(Write(dest, &photos_editing_formats::image_io::JpegMarker::kStart, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, &photos_editing_formats::image_io::JpegMarker::kAPP2, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, &lengthH, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, &lengthL, 1, pos));
+    UHDR_ERR_CHECK(writeSegmentHeader(dest, JpegMarker::kAPP2, length, pos));
     UHDR_ERR_CHECK(Write(dest, pIcc, icc_size, pos));
   }
 
   // Prepare and write ISO 21496-1 metadata
   if (kWriteIso21496_1Metadata) {
     const size_t length = 2 + isoNameSpaceLength + 4;
-    uint8_t zero = 0;
-    const uint8_t lengthH = ((length >> 8) & 0xff);
-    const uint8_t lengthL = (length & 0xff);
-    UHDR_ERR_CHECK(Write(dest, &photos_editing_formats::image_io::JpegMarker::kStart, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, &photos_editing_formats::image_io::JpegMarker::kAPP2, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, &lengthH, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, &lengthL, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, (void*)kIsoNameSpace.c_str(), isoNameSpaceLength, pos));
-    UHDR_ERR_CHECK(Write(dest, &zero, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, &zero, 1, pos));  // 2 bytes minimum_version: (00 00)
-    UHDR_ERR_CHECK(Write(dest, &zero, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, &zero, 1, pos));  // 2 bytes writer_version: (00 00)
+    // 2 bytes minimum_version: (00 00), 2 bytes writer_version: (00 00)
+    const uint8_t versions[4] = {0, 0, 0, 0};
+    UHDR_ERR_CHECK(writeSegmentHeader(dest, JpegMarker::kAPP2, length, pos));
+    UHDR_ERR_CHECK(Write(dest, (void*)kIsoNameSpace.data(), isoNameSpaceLength, pos));
+    UHDR_ERR_CHECK(Write(dest, versions, sizeof versions, pos));
   }
 
   // Prepare and write MPF
   {
     const size_t length = 2 + calculateMpfSize();
-    const uint8_t lengthH = ((length >> 8) & 0xff);
-    const uint8_t lengthL = (length & 0xff);
-    size_t primary_image_size = pos + length + final_primary_jpg_image_ptr->data_sz;
+    size_t primary_image_size = pos + referenced + length + primary_jpg_size;
     // between APP2 + package size + signature
     // ff e2 00 58 4d 50 46 00
     // 2 + 2 + 4 = 8 (bytes)
     // and ff d8 sign of the secondary image
-    size_t secondary_image_offset = primary_image_size - pos - 8;
+    size_t secondary_image_offset = primary_image_size - (pos + referenced) - 8;
     std::shared_ptr<DataStruct> mpf = generateMpf(primary_image_size, 0, /* primary_image_offset */
                                                   secondary_image_size, secondary_image_offset);
-    UHDR_ERR_CHECK(Write(dest, &photos_editing_formats::image_io::JpegMarker::kStart, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, &photos_editing_formats::image_io::JpegMarker::kAPP2, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, &lengthH, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, &lengthL, 1, pos));
+    UHDR_ERR_CHECK(writeSegmentHeader(dest, JpegMarker::kAPP2, length, pos));
     UHDR_ERR_CHECK(Write(dest, (void*)mpf->getData(), mpf->getLength(), pos));
   }
 
   // Write primary image
-  UHDR_ERR_CHECK(Write(dest, (uint8_t*)final_primary_jpg_image_ptr->data + 2,
-                       final_primary_jpg_image_ptr->data_sz - 2, pos));
+  UHDR_ERR_CHECK(writeSpan(primary_data + 2, primary_head_end - 2));
+  UHDR_ERR_CHECK(writeSpan(primary_data + primary_tail_start,
+                           sdr_intent_compressed->data_sz - primary_tail_start));
   // Finish primary image
 
   // Begin secondary image (gain map)
@@ -1209,153 +2252,1436 @@ uhdr_error_info_t JpegR::appendGainMap(uhdr_compressed_image_t* sdr_intent_compr
   // Prepare and write XMP
   if (kWriteXmpMetadata) {
     const size_t length = xmp_secondary_length;
-    const uint8_t lengthH = ((length >> 8) & 0xff);
-    const uint8_t lengthL = (length & 0xff);
-    UHDR_ERR_CHECK(Write(dest, &photos_editing_formats::image_io::JpegMarker::kStart, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, &photos_editing_formats::image_io::JpegMarker::kAPP1, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, &lengthH, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, &lengthL, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, (void*)kXmpNameSpace.c_str(), xmpNameSpaceLength, pos));
-    UHDR_ERR_CHECK(Write(dest, (void*)xmp_secondary.c_str(), xmp_secondary.size(), pos));
+    UHDR_ERR_CHECK(writeSegmentHeader(dest, JpegMarker::kAPP1, length, pos));
+    UHDR_ERR_CHECK(Write(dest, (void*)kXmpNameSpace.data(), xmpNameSpaceLength, pos));
+    UHDR_ERR_CHECK(Write(dest, xmp_secondary, xmp_secondary_size, pos));
   }
 
   // Prepare and write ISO 21496-1 metadata
   if (kWriteIso21496_1Metadata) {
     const size_t length = iso_secondary_length;
-    const uint8_t lengthH = ((length >> 8) & 0xff);
-    const uint8_t lengthL = (length & 0xff);
-    UHDR_ERR_CHECK(Write(dest, &photos_editing_formats::image_io::JpegMarker::kStart, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, &photos_editing_formats::image_io::JpegMarker::kAPP2, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, &lengthH, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, &lengthL, 1, pos));
-    UHDR_ERR_CHECK(Write(dest, (void*)kIsoNameSpace.c_str(), isoNameSpaceLength, pos));
-    UHDR_ERR_CHECK(Write(dest, (void*)iso_secondary_data.data(), iso_secondary_data.size(), pos));
+    UHDR_ERR_CHECK(writeSegmentHeader(dest, JpegMarker::kAPP2, length, pos));
+    UHDR_ERR_CHECK(Write(dest, (void*)kIsoNameSpace.data(), isoNameSpaceLength, pos));
+    UHDR_ERR_CHECK(Write(dest, iso_secondary_data, iso_secondary_data_size, pos));
   }
 
   // Write secondary image
   UHDR_ERR_CHECK(
-      Write(dest, (uint8_t*)gainmap_compressed->data + 2, gainmap_compressed->data_sz - 2, pos));
+      writeSpan((uint8_t*)gainmap_compressed->data + 2, gainmap_compressed->data_sz - 2));
 
   // Set back length
+  if (segments != nullptr && pos > run_start) {
+    segments->push_back({static_cast<uint8_t*>(dest->data) + run_start, pos - run_start});
+  }
   dest->data_sz = pos;
 
   // Done!
   return g_no_error;
 }
 
-uhdr_error_info_t JpegR::getJPEGRInfo(uhdr_compressed_image_t* uhdr_compressed_img,
-                                      jr_info_ptr uhdr_image_info) {
-  uhdr_compressed_image_t primary_image, gainmap;
-
-  UHDR_ERR_CHECK(extractPrimaryImageAndGainMap(uhdr_compressed_img, &primary_image, &gainmap))
+uhdr_error_info_t JpegR::transcodeJPEGR(uhdr_compressed_image_t* uhdr_compressed_img,
+                                        const uhdr_plane_map_t& base_map,
+                                        const uhdr_plane_map_t& gainmap_map,
+                                        uhdr_compressed_image_t* dest) {
+  UHDR_TRACE_SCOPE("JpegR::transcodeJPEGR");
+  uhdr_compressed_image_t primary_image, gainmap_image;
+  jpeg_header_view_t primary_view, gainmap_view;
+  UHDR_ERR_CHECK(getJPEGRInfoInPlace(uhdr_compressed_img, &primary_image, &primary_view,
+                                     &gainmap_image, &gainmap_view))
 
-  UHDR_ERR_CHECK(parseJpegInfo(&primary_image, uhdr_image_info->primaryImgInfo,
-                               &uhdr_image_info->width, &uhdr_image_info->height))
-  if (uhdr_image_info->gainmapImgInfo != nullptr) {
-    UHDR_ERR_CHECK(parseJpegInfo(&gainmap, uhdr_image_info->gainmapImgInfo))
-  }
+  uhdr_gainmap_metadata_ext_t metadata(kJpegrVersion);
+  UHDR_ERR_CHECK(parseGainMapMetadata(const_cast<uint8_t*>(gainmap_view.isoData),
+                                      gainmap_view.isoSize,
+                                      const_cast<uint8_t*>(gainmap_view.xmpData),
+                                      gainmap_view.xmpSize, &metadata))
+
+  JpegEncoderHelper base_transform, gainmap_transform;
+  UHDR_ERR_CHECK(runConcurrently(
+      [&]() {
+        return base_transform.transformImage(primary_image.data, primary_image.data_sz, base_map);
+      },
+      [&]() {
+        return gainmap_transform.transformImage(gainmap_image.data, gainmap_image.data_sz,
+                                                gainmap_map);
+      }))
+
+  // exif and icc are carried over inside the transformed base image
+  uhdr_compressed_image_t base = base_transform.getCompressedImage();
+  uhdr_compressed_image_t gainmap = gainmap_transform.getCompressedImage();
+  UHDR_ERR_CHECK(appendGainMap(&base, &gainmap, /* exif */ nullptr, /* icc */ nullptr,
+                               /* icc size */ 0, &metadata, dest))
+  dest->cg = uhdr_compressed_img->cg;
+  dest->ct = uhdr_compressed_img->ct;
+  dest->range = uhdr_compressed_img->range;
 
   return g_no_error;
 }
 
-uhdr_error_info_t JpegR::parseGainMapMetadata(uint8_t* iso_data, size_t iso_size, uint8_t* xmp_data,
-                                              size_t xmp_size,
-                                              uhdr_gainmap_metadata_ext_t* uhdr_metadata) {
-  if (iso_size > 0) {
-    if (iso_size < kIsoNameSpace.size() + 1) {
-      uhdr_error_info_t status;
-      status.error_code = UHDR_CODEC_ERROR;
-      status.has_detail = 1;
-      snprintf(status.detail, sizeof status.detail,
-               "iso block size needs to be atleast %zd but got %zd", kIsoNameSpace.size() + 1,
-               iso_size);
-      return status;
-    }
-    uhdr_gainmap_metadata_frac decodedMetadata;
-    std::vector<uint8_t> iso_vec;
-    for (size_t i = kIsoNameSpace.size() + 1; i < iso_size; i++) {
-      iso_vec.push_back(iso_data[i]);
+// Collects the application and comment segments of a jpeg image ahead of its first other marker
+// that survive a rewrite of the ultrahdr segments, as (offset, size) pairs including the marker.
+// Xmp packets with gain map metadata, iso 21496-1 blocks and the mpf block are dropped, the first
+// of those xmp packets is reported in gainmap_xmp when given. Returns the offset of the first
+// marker that is not an application or comment segment.
+static size_t collectRetainedSegments(const uint8_t* image, size_t length,
+                                      std::vector<std::pair<size_t, size_t>>& retained,
+                                      std::pair<size_t, size_t>* gainmap_xmp = nullptr) {
+  constexpr std::string_view kGainMapXmpNameSpace = "http://ns.adobe.com/hdr-gain-map/1.0/";
+  constexpr uint8_t kMpfSignature[] = {'M', 'P', 'F', '\0'};
+  size_t pos = 2; /* position after reading SOI marker (0xffd8) */
+  while (length - pos >= 4 && image[pos] == 0xFF) {
+    const uint8_t marker = image[pos + 1];
+    const bool isApp = marker >= JpegMarker::kAPP0 && marker <= JpegMarker::kAPP0 + 15;
+    if (!isApp && marker != 0xFE /* COM */) break;
+    const size_t segmentLength = (static_cast<size_t>(image[pos + 2]) << 8) | image[pos + 3];
+    if (segmentLength < 2 || segmentLength > length - pos - 2) break;
+    std::string_view payload(reinterpret_cast<const char*>(image + pos + 4), segmentLength - 2);
+    bool dropped = false;
+    if (marker == JpegMarker::kAPP1) {
+      dropped = payload.compare(0, kXmpNameSpace.size() + 1,
+                                std::string_view(kXmpNameSpace.data(),
+                                                 kXmpNameSpace.size() + 1)) == 0 &&
+                payload.find(kGainMapXmpNameSpace) != std::string_view::npos;
+      if (dropped && gainmap_xmp != nullptr && gainmap_xmp->second == 0) {
+        *gainmap_xmp = {pos, segmentLength + 2};
+      }
+    } else if (marker == JpegMarker::kAPP2) {
+      dropped = payload.compare(0, kIsoNameSpace.size() + 1,
+                                std::string_view(kIsoNameSpace.data(),
+                                                 kIsoNameSpace.size() + 1)) == 0 ||
+                payload.compare(0, sizeof kMpfSignature,
+                                std::string_view(reinterpret_cast<const char*>(kMpfSignature),
+                                                 sizeof kMpfSignature)) == 0;
     }
+    if (!dropped) retained.emplace_back(pos, segmentLength + 2);
+    pos += segmentLength + 2;
+  }
+  return pos;
+}
+
+uhdr_error_info_t JpegR::rewriteGainMapMetadata(uhdr_compressed_image_t* uhdr_compressed_img,
+                                                uhdr_gainmap_metadata_ext_t* metadata,
+                                                uhdr_compressed_image_t* dest) {
+  UHDR_TRACE_SCOPE("JpegR::rewriteGainMapMetadata");
+  uhdr_compressed_image_t primary_image, gainmap_image;
+  jpeg_header_view_t primary_view, gainmap_view;
+  UHDR_ERR_CHECK(getJPEGRInfoInPlace(uhdr_compressed_img, &primary_image, &primary_view,
+                                     &gainmap_image, &gainmap_view))
+  if (metadata->version.size() > kXmpVersionMaxLength) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "gain map metadata version string is %zu characters long, at most %zu are supported",
+             metadata->version.size(), kXmpVersionMaxLength);
+    return status;
+  }
+
+  const uint8_t* primary = static_cast<const uint8_t*>(primary_image.data);
+  const uint8_t* gainmap = static_cast<const uint8_t*>(gainmap_image.data);
+  std::vector<std::pair<size_t, size_t>> primary_segments, gainmap_segments;
+  std::pair<size_t, size_t> primary_xmp{0, 0};
+  const size_t primary_body =
+      collectRetainedSegments(primary, primary_image.data_sz, primary_segments, &primary_xmp);
+  const size_t gainmap_body =
+      collectRetainedSegments(gainmap, gainmap_image.data_sz, gainmap_segments);
+  size_t gainmap_retained = 0;
+  for (const auto& segment : gainmap_segments) gainmap_retained += segment.second;
+
+  const size_t xmpNameSpaceLength = kXmpNameSpace.size() + 1;  // need to count the null terminator
+  const size_t isoNameSpaceLength = kIsoNameSpace.size() + 1;  // need to count the null terminator
+
+  // the gain map image leads with fresh xmp and iso blocks, its other segments and its body are
+  // copied as they are
+  char xmp_secondary[kXmpPacketMaxSize + kXmpVersionMaxLength];
+  size_t xmp_secondary_size = 0;
+  if (kWriteXmpMetadata) {
+    xmp_secondary_size = writeXmpForSecondaryImage(xmp_secondary, sizeof xmp_secondary, *metadata);
+  }
+  uint8_t iso_secondary_data[kGainmapMetadataMaxSize];
+  size_t iso_secondary_data_size = 0;
+  if (kWriteIso21496_1Metadata) {
+    uhdr_gainmap_metadata_frac iso_secondary_metadata;
+    UHDR_ERR_CHECK(uhdr_gainmap_metadata_frac::gainmapMetadataFloatToFraction(
+        metadata, &iso_secondary_metadata));
+    UHDR_ERR_CHECK(uhdr_gainmap_metadata_frac::encodeGainmapMetadata(
+        &iso_secondary_metadata, iso_secondary_data, sizeof iso_secondary_data,
+        iso_secondary_data_size));
+  }
+  size_t secondary_image_size = 2 + gainmap_retained + (gainmap_image.data_sz - gainmap_body);
+  if (kWriteXmpMetadata) secondary_image_size += 4 + xmpNameSpaceLength + xmp_secondary_size;
+  if (kWriteIso21496_1Metadata) {
+    secondary_image_size += 4 + isoNameSpaceLength + iso_secondary_data_size;
+  }
+
+  // the layout is that of appendGainMap(), exif leads, the regenerated segments follow and the
+  // other segments of the image come after them
+  auto isExif = [primary](const std::pair<size_t, size_t>& segment) {
+    constexpr uint8_t kExifIdentifier[] = {'E', 'x', 'i', 'f', 0, 0};
+    return primary[segment.first + 1] == JpegMarker::kAPP1 &&
+           segment.second >= 4 + sizeof kExifIdentifier &&
+           memcmp(primary + segment.first + 4, kExifIdentifier, sizeof kExifIdentifier) == 0;
+  };
+  size_t pos = 0;
+  // Begin primary image
+  UHDR_ERR_CHECK(Write(dest, primary, 2, pos));
+  for (const auto& segment : primary_segments) {
+    if (isExif(segment)) {
+      UHDR_ERR_CHECK(Write(dest, primary + segment.first, segment.second, pos));
+    }
+  }
+  if (kWriteXmpMetadata) {
+    // the properties other writers put in the packet of the primary image are kept, only the gain
+    // map ones are regenerated
+    char xmp_primary_buffer[kXmpPacketMaxSize + kXmpVersionMaxLength];
+    std::string xmp_merged;
+    if (primary_xmp.second != 0) {
+      xmp_merged = mergeXmpForPrimaryImage(
+          std::string_view(reinterpret_cast<const char*>(primary) + primary_xmp.first + 4 +
+                               xmpNameSpaceLength,
+                           primary_xmp.second - 4 - xmpNameSpaceLength),
+          secondary_image_size, *metadata);
+    }
+    const char* xmp_primary = xmp_primary_buffer;
+    size_t xmp_primary_size = 0;
+    if (!xmp_merged.empty()) {
+      xmp_primary = xmp_merged.data();
+      xmp_primary_size = xmp_merged.size();
+    } else {
+      xmp_primary_size = writeXmpForPrimaryImage(xmp_primary_buffer, sizeof xmp_primary_buffer,
+                                                 secondary_image_size, *metadata);
+    }
+    const size_t length = 2 + xmpNameSpaceLength + xmp_primary_size;
+    if (length > 0xFFFF) {
+      uhdr_error_info_t status;
+      status.error_code = UHDR_CODEC_ERROR;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "xmp packet of the primary image grows to %zu bytes with the gain map metadata, "
+               "more than an app1 segment holds",
+               xmp_primary_size);
+      return status;
+    }
+    UHDR_ERR_CHECK(writeSegmentHeader(dest, JpegMarker::kAPP1, length, pos));
+    UHDR_ERR_CHECK(Write(dest, (void*)kXmpNameSpace.data(), xmpNameSpaceLength, pos));
+    UHDR_ERR_CHECK(Write(dest, xmp_primary, xmp_primary_size, pos));
+  }
+  if (kWriteIso21496_1Metadata) {
+    const size_t length = 2 + isoNameSpaceLength + 4;
+    // 2 bytes minimum_version: (00 00), 2 bytes writer_version: (00 00)
+    const uint8_t versions[4] = {0, 0, 0, 0};
+    UHDR_ERR_CHECK(writeSegmentHeader(dest, JpegMarker::kAPP2, length, pos));
+    UHDR_ERR_CHECK(Write(dest, (void*)kIsoNameSpace.data(), isoNameSpaceLength, pos));
+    UHDR_ERR_CHECK(Write(dest, versions, sizeof versions, pos));
+  }
+  {
+    const size_t length = 2 + calculateMpfSize();
+    size_t primary_image_size = pos + 2 + length + (primary_image.data_sz - primary_body);
+    for (const auto& segment : primary_segments) {
+      if (!isExif(segment)) primary_image_size += segment.second;
+    }
+    // the offset is relative to the endianness field, 8 bytes into the mpf segment
+    const size_t secondary_image_offset = primary_image_size - pos - 8;
+    std::shared_ptr<DataStruct> mpf = generateMpf(primary_image_size, 0, /* primary_image_offset */
+                                                  secondary_image_size, secondary_image_offset);
+    UHDR_ERR_CHECK(writeSegmentHeader(dest, JpegMarker::kAPP2, length, pos));
+    UHDR_ERR_CHECK(Write(dest, (void*)mpf->getData(), mpf->getLength(), pos));
+  }
+  for (const auto& segment : primary_segments) {
+    if (!isExif(segment)) {
+      UHDR_ERR_CHECK(Write(dest, primary + segment.first, segment.second, pos));
+    }
+  }
+  UHDR_ERR_CHECK(
+      Write(dest, primary + primary_body, primary_image.data_sz - primary_body, pos));
+
+  // Begin secondary image (gain map)
+  UHDR_ERR_CHECK(Write(dest, gainmap, 2, pos));
+  if (kWriteXmpMetadata) {
+    const size_t length = 2 + xmpNameSpaceLength + xmp_secondary_size;
+    UHDR_ERR_CHECK(writeSegmentHeader(dest, JpegMarker::kAPP1, length, pos));
+    UHDR_ERR_CHECK(Write(dest, (void*)kXmpNameSpace.data(), xmpNameSpaceLength, pos));
+    UHDR_ERR_CHECK(Write(dest, xmp_secondary, xmp_secondary_size, pos));
+  }
+  if (kWriteIso21496_1Metadata) {
+    const size_t length = 2 + isoNameSpaceLength + iso_secondary_data_size;
+    UHDR_ERR_CHECK(writeSegmentHeader(dest, JpegMarker::kAPP2, length, pos));
+    UHDR_ERR_CHECK(Write(dest, (void*)kIsoNameSpace.data(), isoNameSpaceLength, pos));
+    UHDR_ERR_CHECK(Write(dest, iso_secondary_data, iso_secondary_data_size, pos));
+  }
+  for (const auto& segment : gainmap_segments) {
+    UHDR_ERR_CHECK(Write(dest, gainmap + segment.first, segment.second, pos));
+  }
+  UHDR_ERR_CHECK(
+      Write(dest, gainmap + gainmap_body, gainmap_image.data_sz - gainmap_body, pos));
+
+  dest->data_sz = pos;
+  dest->cg = uhdr_compressed_img->cg;
+  dest->ct = uhdr_compressed_img->ct;
+  dest->range = uhdr_compressed_img->range;
+
+  return g_no_error;
+}
+#endif  // UHDR_DECODER_ONLY
+
+uhdr_error_info_t JpegR::getJPEGRInfo(uhdr_compressed_image_t* uhdr_compressed_img,
+                                      jr_info_ptr uhdr_image_info) {
+  uhdr_compressed_image_t primary_image, gainmap;
+
+  UHDR_ERR_CHECK(extractPrimaryImageAndGainMap(uhdr_compressed_img, &primary_image, &gainmap))
+
+  UHDR_ERR_CHECK(parseJpegInfo(&primary_image, uhdr_image_info->primaryImgInfo,
+                               &uhdr_image_info->width, &uhdr_image_info->height))
+  if (uhdr_image_info->gainmapImgInfo != nullptr) {
+    UHDR_ERR_CHECK(parseJpegInfo(&gainmap, uhdr_image_info->gainmapImgInfo))
+  }
+
+  return g_no_error;
+}
+
+// Locates the secondary image of data through the mpf block of the primary image, returns false
+// if the block is absent or does not describe a jpeg image within data
+static bool locateSecondaryImage(const uint8_t* data, size_t size,
+                                 const jpeg_header_view_t& primary_view, size_t& primary_size,
+                                 size_t& secondary_offset, size_t& secondary_size) {
+  if (primary_view.mpfData == nullptr ||
+      parseMpf(primary_view.mpfData, primary_view.mpfSize, &primary_size, &secondary_size,
+               &secondary_offset)
+              .error_code != UHDR_CODEC_OK) {
+    return false;
+  }
+  // offset is relative to the endianness field that follows the mpf signature
+  secondary_offset += (primary_view.mpfData - data) + sizeof(kMpfSig);
+  return primary_size > 0 && primary_size <= size && secondary_offset < size &&
+         secondary_size >= 2 && secondary_size <= size - secondary_offset &&
+         data[secondary_offset] == 0xFF && data[secondary_offset + 1] == 0xD8;
+}
+
+// true if the header view has gain map metadata in iso 21496-1 or xmp form
+static bool hasGainMapMetadata(const jpeg_header_view_t& view) {
+  constexpr std::string_view kGainMapXmpNameSpace = "http://ns.adobe.com/hdr-gain-map/1.0/";
+  if (view.isoData != nullptr) return true;
+  return view.xmpData != nullptr &&
+         std::string_view(reinterpret_cast<const char*>(view.xmpData), view.xmpSize)
+                 .find(kGainMapXmpNameSpace) != std::string_view::npos;
+}
+
+bool JpegR::hasUltraHdrSignature(const void* data, size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  jpeg_header_view_t primary_view, gainmap_view;
+  size_t primary_size, secondary_offset, secondary_size;
+  return JpegDecoderHelper::scanHeaders(bytes, size, primary_view).error_code == UHDR_CODEC_OK &&
+         hasGainMapMetadata(primary_view) &&
+         locateSecondaryImage(bytes, size, primary_view, primary_size, secondary_offset,
+                              secondary_size) &&
+         JpegDecoderHelper::scanHeaders(bytes + secondary_offset, secondary_size, gainmap_view)
+                 .error_code == UHDR_CODEC_OK &&
+         hasGainMapMetadata(gainmap_view);
+}
+
+void JpegR::preloadTables() {
+  getHlgCodeLUT();
+  getPqCodeLUT();
+  srgbInvOetfFixed(0);
+  srgbOetfFixed(0);
+  getDspFunctions();
+  CpuTopology::get();
+  for (int tf = UHDR_CT_LINEAR; tf <= UHDR_CT_SRGB; tf++) {
+    for (int cg = UHDR_CG_BT_709; cg <= UHDR_CG_BT_2100; cg++) {
+      IccHelper::writeIccProfile((uhdr_color_transfer_t)tf, (uhdr_color_gamut_t)cg);
+    }
+  }
+}
+
+void JpegR::preloadThreads() {
+  // run() spawns the missing threads before queueing the instances of the job
+  ThreadPool::getDefaultPool().run([]() {}, (std::min)(GetCPUCoreCount(), 4u));
+}
+
+uhdr_error_info_t JpegR::getJPEGRInfoInPlace(uhdr_compressed_image_t* uhdr_compressed_img,
+                                             uhdr_compressed_image_t* primary_image,
+                                             jpeg_header_view_t* primary_view,
+                                             uhdr_compressed_image_t* gainmap_image,
+                                             jpeg_header_view_t* gainmap_view) {
+  uint8_t* data = static_cast<uint8_t*>(uhdr_compressed_img->data);
+  const size_t size = uhdr_compressed_img->data_sz;
+  UHDR_ERR_CHECK(JpegDecoderHelper::scanHeaders(data, size, *primary_view))
+
+  // extractPrimaryImageAndGainMap() would scan the primary headers again
+  size_t primary_size, secondary_size, secondary_offset;
+  if (locateSecondaryImage(data, size, *primary_view, primary_size, secondary_offset,
+                           secondary_size)) {
+    primary_image->data = data;
+    primary_image->data_sz = primary_size;
+    gainmap_image->data = data + secondary_offset;
+    gainmap_image->data_sz = secondary_size;
+  } else {
+    UHDR_ERR_CHECK(extractPrimaryImageAndGainMap(uhdr_compressed_img, primary_image, gainmap_image))
+  }
+  primary_image->capacity = primary_image->data_sz;
+  gainmap_image->capacity = gainmap_image->data_sz;
+  UHDR_ERR_CHECK(
+      JpegDecoderHelper::scanHeaders(gainmap_image->data, gainmap_image->data_sz, *gainmap_view))
+
+  return g_no_error;
+}
+
+uhdr_error_info_t JpegR::parseGainMapMetadata(uint8_t* iso_data, size_t iso_size, uint8_t* xmp_data,
+                                              size_t xmp_size,
+                                              uhdr_gainmap_metadata_ext_t* uhdr_metadata) {
+  if (iso_size > 0) {
+    if (iso_size < kIsoNameSpace.size() + 1) {
+      uhdr_error_info_t status;
+      status.error_code = UHDR_CODEC_ERROR;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "iso block size needs to be atleast %zd but got %zd", kIsoNameSpace.size() + 1,
+               iso_size);
+      return status;
+    }
+    uhdr_gainmap_metadata_frac decodedMetadata;
+    UHDR_ERR_CHECK(uhdr_gainmap_metadata_frac::decodeGainmapMetadata(
+        iso_data + kIsoNameSpace.size() + 1, iso_size - kIsoNameSpace.size() - 1,
+        &decodedMetadata));
+    UHDR_ERR_CHECK(uhdr_gainmap_metadata_frac::gainmapMetadataFractionToFloat(&decodedMetadata,
+                                                                              uhdr_metadata));
+  } else if (xmp_size > 0) {
+    UHDR_ERR_CHECK(getMetadataFromXMP(xmp_data, xmp_size, uhdr_metadata));
+  } else {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "received no valid buffer to parse gainmap metadata");
+    return status;
+  }
+
+  return g_no_error;
+}
+
+/* Decode API */
+uhdr_error_info_t JpegR::decodeJPEGR(uhdr_compressed_image_t* uhdr_compressed_img,
+                                     uhdr_raw_image_t* dest, float max_display_boost,
+                                     uhdr_color_transfer_t output_ct, uhdr_img_fmt_t output_format,
+                                     uhdr_raw_image_t* gainmap_img,
+                                     uhdr_gainmap_metadata_t* gainmap_metadata) {
+  return decodeJPEGRImpl(uhdr_compressed_img, dest, 0, nullptr, nullptr, 1, max_display_boost,
+                         output_ct, output_format, gainmap_img, gainmap_metadata);
+}
+
+uhdr_error_info_t JpegR::decodeJPEGRInStrips(uhdr_compressed_image_t* uhdr_compressed_img,
+                                             unsigned int strip_height,
+                                             const PushStripFn& emit_strip,
+                                             float max_display_boost,
+                                             uhdr_color_transfer_t output_ct,
+                                             uhdr_img_fmt_t output_format,
+                                             uhdr_raw_image_t* gainmap_img,
+                                             uhdr_gainmap_metadata_t* gainmap_metadata) {
+  if (strip_height == 0) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received bad strip height %u", strip_height);
+    return status;
+  }
+  return decodeJPEGRImpl(uhdr_compressed_img, nullptr, strip_height, &emit_strip, nullptr, 1,
+                         max_display_boost, output_ct, output_format, gainmap_img,
+                         gainmap_metadata);
+}
+
+uhdr_error_info_t JpegR::decodeJPEGRStripWise(uhdr_compressed_image_t* uhdr_compressed_img,
+                                              unsigned int strip_height, uhdr_raw_image_t* dest,
+                                              float max_display_boost,
+                                              uhdr_color_transfer_t output_ct,
+                                              uhdr_img_fmt_t output_format,
+                                              uhdr_raw_image_t* gainmap_img,
+                                              uhdr_gainmap_metadata_t* gainmap_metadata) {
+  if (strip_height == 0) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received bad strip height %u", strip_height);
+    return status;
+  }
+  return decodeJPEGRImpl(uhdr_compressed_img, dest, strip_height, nullptr, nullptr, 1,
+                         max_display_boost, output_ct, output_format, gainmap_img,
+                         gainmap_metadata);
+}
+
+uhdr_error_info_t JpegR::decodeJPEGRRegion(uhdr_compressed_image_t* uhdr_compressed_img,
+                                           const image_region_t& roi, uhdr_raw_image_t* dest,
+                                           float max_display_boost,
+                                           uhdr_color_transfer_t output_ct,
+                                           uhdr_img_fmt_t output_format,
+                                           uhdr_raw_image_t* gainmap_img,
+                                           uhdr_gainmap_metadata_t* gainmap_metadata) {
+  return decodeJPEGRImpl(uhdr_compressed_img, dest, 0, nullptr, &roi, 1, max_display_boost,
+                         output_ct, output_format, gainmap_img, gainmap_metadata);
+}
+
+uhdr_error_info_t JpegR::decodeJPEGRScaled(uhdr_compressed_image_t* uhdr_compressed_img,
+                                           unsigned int scale_denom, uhdr_raw_image_t* dest,
+                                           float max_display_boost,
+                                           uhdr_color_transfer_t output_ct,
+                                           uhdr_img_fmt_t output_format,
+                                           uhdr_raw_image_t* gainmap_img,
+                                           uhdr_gainmap_metadata_t* gainmap_metadata) {
+  return decodeJPEGRImpl(uhdr_compressed_img, dest, 0, nullptr, nullptr, scale_denom,
+                         max_display_boost, output_ct, output_format, gainmap_img,
+                         gainmap_metadata);
+}
+
+uhdr_error_info_t JpegR::decodeJPEGRBaseImage(uhdr_compressed_image_t* uhdr_compressed_img,
+                                              uhdr_raw_image_t* dest,
+                                              uhdr_raw_image_t* gainmap_img,
+                                              uhdr_gainmap_metadata_t* gainmap_metadata) {
+  UHDR_TRACE_SCOPE("JpegR::decodeJPEGRBaseImage");
+  if (dest->fmt != UHDR_IMG_FMT_32bppRGBA8888 && dest->fmt != UHDR_IMG_FMT_12bppYCbCr420 &&
+      dest->fmt != UHDR_IMG_FMT_24bppYCbCr444 && dest->fmt != UHDR_IMG_FMT_8bppYCbCr400) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "base image output expects color format to be one of {UHDR_IMG_FMT_32bppRGBA8888, "
+             "UHDR_IMG_FMT_12bppYCbCr420, UHDR_IMG_FMT_24bppYCbCr444, UHDR_IMG_FMT_8bppYCbCr400}. "
+             "Received %d",
+             dest->fmt);
+    return status;
+  }
+
+  uhdr_compressed_image_t primary_jpeg_image, gainmap_jpeg_image;
+  UHDR_ERR_CHECK(
+      extractPrimaryImageAndGainMap(uhdr_compressed_img, &primary_jpeg_image, &gainmap_jpeg_image))
+
+  JpegDecoderHelper local_dec_obj_sdr, local_dec_obj_gm;
+  JpegDecoderHelper& jpeg_dec_obj_sdr =
+      mDecodeCache ? mDecodeCache->mSdrDecoder : local_dec_obj_sdr;
+  JpegDecoderHelper& jpeg_dec_obj_gm =
+      mDecodeCache ? mDecodeCache->mGainmapDecoder : local_dec_obj_gm;
+  jpeg_dec_obj_sdr.setParallelDecode(getWorkerCount(), [this](const std::function<void()>& job,
+                                                               unsigned int parallelism) {
+    runParallel(job, parallelism);
+  });
+  jpeg_dec_obj_sdr.setFastIdct(mFastIdct);
+  jpeg_dec_obj_sdr.setBackend(mJpegBackend);
+  jpeg_dec_obj_gm.setFastIdct(mFastIdct);
+  jpeg_dec_obj_gm.setBackend(mJpegBackend);
+  jpeg_dec_obj_sdr.setFastUpsampling(mFastUpsampling);
+  const bool decode_gainmap = gainmap_img != nullptr || gainmap_metadata != nullptr;
+  const decode_mode_t sdr_decode_mode =
+      dest->fmt == UHDR_IMG_FMT_32bppRGBA8888 ? DECODE_TO_RGB_CS : DECODE_TO_YCBCR_CS;
+  const bool sdr_streamed = takeStreamedBaseImage(sdr_decode_mode);
+  if (mDecodeCache != nullptr) mDecodeCache->mHoldsSources = false;
+  // the images are decoded into the outputs directly where their layouts allow
+  if (!sdr_streamed) jpeg_dec_obj_sdr.setOutputImage(dest);
+  if (decode_gainmap) jpeg_dec_obj_gm.setOutputImage(gainmap_img);
+  UHDR_ERR_CHECK(runConcurrently(
+      [&]() {
+        StageTimer timer(mStats, UHDR_STAGE_BASE_DECODE);
+        if (sdr_streamed) {
+          return jpeg_dec_obj_sdr.attachBitstream(primary_jpeg_image.data,
+                                                  primary_jpeg_image.data_sz);
+        }
+        return jpeg_dec_obj_sdr.decompressImage(primary_jpeg_image.data,
+                                                primary_jpeg_image.data_sz, sdr_decode_mode);
+      },
+      [&]() {
+        if (!decode_gainmap) return g_no_error;
+        StageTimer timer(mStats, UHDR_STAGE_GAINMAP_DECODE);
+        return jpeg_dec_obj_gm.decompressImage(gainmap_jpeg_image.data,
+                                               gainmap_jpeg_image.data_sz, DECODE_STREAM);
+      }))
+  // sources in the outputs are not the decoders' to hold
+  if (decode_gainmap && !jpeg_dec_obj_sdr.isResultInOutputImage() &&
+      !jpeg_dec_obj_gm.isResultInOutputImage()) {
+    holdSources(sdr_decode_mode);
+  }
+  uhdr_raw_image_t sdr_intent = jpeg_dec_obj_sdr.getDecompressedImage();
+  if (sdr_intent.fmt != dest->fmt) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "base image is coded in color format %d, requested output color format %d",
+             sdr_intent.fmt, dest->fmt);
+    return status;
+  }
+  sdr_intent.cg =
+      IccHelper::readIccColorGamut(jpeg_dec_obj_sdr.getICCPtr(), jpeg_dec_obj_sdr.getICCSize());
+  sdr_intent.ct = UHDR_CT_SRGB;
+  sdr_intent.range = UHDR_CR_FULL_RANGE;
+  if (mBaseImageFn != nullptr) UHDR_ERR_CHECK((*mBaseImageFn)(&sdr_intent))
+  UHDR_ERR_CHECK(copyRawImage(&sdr_intent, dest));
+
+  if (gainmap_img != nullptr) {
+    uhdr_raw_image_t gainmap = jpeg_dec_obj_gm.getDecompressedImage();
+    UHDR_ERR_CHECK(copyRawImage(&gainmap, gainmap_img));
+  }
+  if (gainmap_metadata != nullptr) {
+    uhdr_gainmap_metadata_ext_t uhdr_metadata;
+    UHDR_ERR_CHECK(parseGainMapMetadata(static_cast<uint8_t*>(jpeg_dec_obj_gm.getIsoMetadataPtr()),
+                                        jpeg_dec_obj_gm.getIsoMetadataSize(),
+                                        static_cast<uint8_t*>(jpeg_dec_obj_gm.getXMPPtr()),
+                                        jpeg_dec_obj_gm.getXMPSize(), &uhdr_metadata))
+    gainmap_metadata->min_content_boost = uhdr_metadata.min_content_boost;
+    gainmap_metadata->max_content_boost = uhdr_metadata.max_content_boost;
+    gainmap_metadata->gamma = uhdr_metadata.gamma;
+    gainmap_metadata->offset_sdr = uhdr_metadata.offset_sdr;
+    gainmap_metadata->offset_hdr = uhdr_metadata.offset_hdr;
+    gainmap_metadata->hdr_capacity_min = uhdr_metadata.hdr_capacity_min;
+    gainmap_metadata->hdr_capacity_max = uhdr_metadata.hdr_capacity_max;
+  }
+  return g_no_error;
+}
+
+uhdr_error_info_t JpegR::decodeJPEGRGainMap(uhdr_compressed_image_t* uhdr_compressed_img,
+                                            unsigned int scale_denom,
+                                            uhdr_raw_image_t* gainmap_img,
+                                            uhdr_gainmap_metadata_t* gainmap_metadata) {
+  UHDR_TRACE_SCOPE("JpegR::decodeJPEGRGainMap");
+  uhdr_compressed_image_t primary_jpeg_image, gainmap_jpeg_image;
+  UHDR_ERR_CHECK(
+      extractPrimaryImageAndGainMap(uhdr_compressed_img, &primary_jpeg_image, &gainmap_jpeg_image))
+
+  if (gainmap_metadata != nullptr) {
+    jpeg_header_view_t gainmap_view;
+    UHDR_ERR_CHECK(JpegDecoderHelper::scanHeaders(gainmap_jpeg_image.data,
+                                                  gainmap_jpeg_image.data_sz, gainmap_view))
+    uhdr_gainmap_metadata_ext_t uhdr_metadata;
+    UHDR_ERR_CHECK(parseGainMapMetadata(const_cast<uint8_t*>(gainmap_view.isoData),
+                                        gainmap_view.isoSize,
+                                        const_cast<uint8_t*>(gainmap_view.xmpData),
+                                        gainmap_view.xmpSize, &uhdr_metadata))
+    gainmap_metadata->min_content_boost = uhdr_metadata.min_content_boost;
+    gainmap_metadata->max_content_boost = uhdr_metadata.max_content_boost;
+    gainmap_metadata->gamma = uhdr_metadata.gamma;
+    gainmap_metadata->offset_sdr = uhdr_metadata.offset_sdr;
+    gainmap_metadata->offset_hdr = uhdr_metadata.offset_hdr;
+    gainmap_metadata->hdr_capacity_min = uhdr_metadata.hdr_capacity_min;
+    gainmap_metadata->hdr_capacity_max = uhdr_metadata.hdr_capacity_max;
+  }
+
+  // a gain map decoded ahead is at full size
+  if (mPredecodedGainMap != nullptr && scale_denom == 1) {
+    uhdr_raw_image_t gainmap = *mPredecodedGainMap;
+    return copyRawImage(&gainmap, gainmap_img);
+  }
+
+  JpegDecoderHelper local_dec_obj_gm;
+  JpegDecoderHelper& jpeg_dec_obj_gm =
+      mDecodeCache ? mDecodeCache->mGainmapDecoder : local_dec_obj_gm;
+  jpeg_dec_obj_gm.setFastIdct(mFastIdct);
+  jpeg_dec_obj_gm.setBackend(mJpegBackend);
+  if (mDecodeCache != nullptr) mDecodeCache->mHoldsSources = false;
+  jpeg_dec_obj_gm.setOutputImage(gainmap_img);
+  {
+    StageTimer timer(mStats, UHDR_STAGE_GAINMAP_DECODE);
+    UHDR_ERR_CHECK(jpeg_dec_obj_gm.decompressImageScaled(
+        gainmap_jpeg_image.data, gainmap_jpeg_image.data_sz, DECODE_STREAM, scale_denom))
+  }
+  uhdr_raw_image_t gainmap = jpeg_dec_obj_gm.getDecompressedImage();
+  if (mGainMapFn != nullptr && scale_denom == 1) (*mGainMapFn)(&gainmap);
+  return copyRawImage(&gainmap, gainmap_img);
+}
+
+uhdr_error_info_t JpegR::decodeJPEGRSources(uhdr_compressed_image_t* uhdr_compressed_img,
+                                            uhdr_color_transfer_t output_ct,
+                                            std::unique_ptr<uhdr_raw_image_ext_t>& sdr_intent,
+                                            std::unique_ptr<uhdr_raw_image_ext_t>& gainmap_img,
+                                            uhdr_gainmap_metadata_ext_t* gainmap_metadata) {
+  UHDR_TRACE_SCOPE("JpegR::decodeJPEGRSources");
+  uhdr_compressed_image_t primary_jpeg_image, gainmap_jpeg_image;
+  UHDR_ERR_CHECK(
+      extractPrimaryImageAndGainMap(uhdr_compressed_img, &primary_jpeg_image, &gainmap_jpeg_image))
+
+  JpegDecoderHelper local_dec_obj_sdr, local_dec_obj_gm;
+  JpegDecoderHelper& jpeg_dec_obj_sdr =
+      mDecodeCache ? mDecodeCache->mSdrDecoder : local_dec_obj_sdr;
+  JpegDecoderHelper& jpeg_dec_obj_gm =
+      mDecodeCache ? mDecodeCache->mGainmapDecoder : local_dec_obj_gm;
+  jpeg_dec_obj_sdr.setParallelDecode(getWorkerCount(), [this](const std::function<void()>& job,
+                                                               unsigned int parallelism) {
+    runParallel(job, parallelism);
+  });
+  jpeg_dec_obj_sdr.setFastIdct(mFastIdct);
+  jpeg_dec_obj_sdr.setBackend(mJpegBackend);
+  jpeg_dec_obj_gm.setFastIdct(mFastIdct);
+  jpeg_dec_obj_gm.setBackend(mJpegBackend);
+  jpeg_dec_obj_sdr.setFastUpsampling(mFastUpsampling);
+  const decode_mode_t sdr_decode_mode =
+      (output_ct == UHDR_CT_SRGB) ? DECODE_TO_RGB_CS : DECODE_TO_YCBCR_CS;
+  if (mDecodeCache == nullptr || !mDecodeCache->mHoldsSources ||
+      mDecodeCache->mSourcesMode != sdr_decode_mode) {
+    if (mDecodeCache != nullptr) mDecodeCache->mHoldsSources = false;
+    const bool sdr_streamed = takeStreamedBaseImage(sdr_decode_mode);
+    UHDR_ERR_CHECK(runConcurrently(
+        [&]() {
+          StageTimer timer(mStats, UHDR_STAGE_BASE_DECODE);
+          if (sdr_streamed) {
+            return jpeg_dec_obj_sdr.attachBitstream(primary_jpeg_image.data,
+                                                    primary_jpeg_image.data_sz);
+          }
+          return jpeg_dec_obj_sdr.decompressImage(primary_jpeg_image.data,
+                                                  primary_jpeg_image.data_sz, sdr_decode_mode);
+        },
+        [&]() {
+          StageTimer timer(mStats, UHDR_STAGE_GAINMAP_DECODE);
+          return jpeg_dec_obj_gm.decompressImage(gainmap_jpeg_image.data,
+                                                 gainmap_jpeg_image.data_sz, DECODE_STREAM);
+        }))
+    holdSources(sdr_decode_mode);
+  }
+
+  // the decoders pad their planes to whole mcus, the chroma of the last odd row and column of a
+  // subsampled image is kept along
+  auto take_image = [this](uhdr_raw_image_t img, std::unique_ptr<uhdr_raw_image_ext_t>& dst) {
+    const unsigned int w = img.w, h = img.h;
+    if (img.fmt == UHDR_IMG_FMT_12bppYCbCr420) {
+      img.w = ALIGNM(w, 2);
+      img.h = ALIGNM(h, 2);
+    }
+    dst = std::make_unique<uhdr_raw_image_ext_t>(img.fmt, img.cg, img.ct, img.range, img.w, img.h,
+                                                 1);
+    UHDR_ERR_CHECK(copyRawImage(&img, dst.get()))
+    dst->w = w;
+    dst->h = h;
+    return g_no_error;
+  };
+  uhdr_raw_image_t sdr = jpeg_dec_obj_sdr.getDecompressedImage();
+  sdr.cg =
+      IccHelper::readIccColorGamut(jpeg_dec_obj_sdr.getICCPtr(), jpeg_dec_obj_sdr.getICCSize());
+  sdr.ct = UHDR_CT_SRGB;
+  sdr.range = UHDR_CR_FULL_RANGE;
+  UHDR_ERR_CHECK(take_image(sdr, sdr_intent))
+  UHDR_ERR_CHECK(take_image(jpeg_dec_obj_gm.getDecompressedImage(), gainmap_img))
+
+  return parseGainMapMetadata(static_cast<uint8_t*>(jpeg_dec_obj_gm.getIsoMetadataPtr()),
+                              jpeg_dec_obj_gm.getIsoMetadataSize(),
+                              static_cast<uint8_t*>(jpeg_dec_obj_gm.getXMPPtr()),
+                              jpeg_dec_obj_gm.getXMPSize(), gainmap_metadata);
+}
+
+uhdr_error_info_t JpegR::applyGainMapRegion(uhdr_raw_image_t* sdr_intent,
+                                            uhdr_raw_image_t* gainmap_img,
+                                            uhdr_gainmap_metadata_ext_t* gainmap_metadata,
+                                            const image_region_t& roi, float max_display_boost,
+                                            uhdr_color_transfer_t output_ct,
+                                            uhdr_img_fmt_t output_format, uhdr_raw_image_t* dest) {
+  UHDR_TRACE_SCOPE("JpegR::applyGainMapRegion");
+  const bool subsampled = sdr_intent->fmt == UHDR_IMG_FMT_12bppYCbCr420;
+  if (roi.width == 0 || roi.height == 0 || roi.left >= sdr_intent->w ||
+      roi.top >= sdr_intent->h || roi.width > sdr_intent->w - roi.left ||
+      roi.height > sdr_intent->h - roi.top || (subsampled && (roi.left % 2 || roi.top % 2)) ||
+      dest->w != roi.width || dest->h != roi.height) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "received bad region %ux%u at (%u, %u) of a %ux%u image of color format %d, for an "
+             "output of %ux%u",
+             roi.width, roi.height, roi.left, roi.top, sdr_intent->w, sdr_intent->h,
+             sdr_intent->fmt, dest->w, dest->h);
+    return status;
+  }
+
+  // the gain map is sampled in the coordinates of the whole base image, the region is handed over
+  // as the only strip
+  const uhdr_raw_image_ext_t sdr_image(*sdr_intent);
+  uhdr_raw_image_ext_t sdr_roi(sdr_image, roi.left, roi.top, roi.width, roi.height);
+  bool pulled = false;
+  PullStripFn pull_roi = [&sdr_roi, &pulled, &roi](uhdr_raw_image_t* strip,
+                                                   unsigned int& row_start) {
+    *strip = sdr_roi;
+    strip->h = pulled ? 0 : sdr_roi.h;
+    row_start = roi.top;
+    pulled = true;
+    return g_no_error;
+  };
+  PushStripFn push_roi = [](uhdr_raw_image_t*, unsigned int) { return g_no_error; };
+  return applyGainMap(sdr_intent, gainmap_img, gainmap_metadata, output_ct, output_format,
+                      max_display_boost, dest, &pull_roi, &push_roi, roi.left);
+}
+
+void JpegR::holdSources(decode_mode_t mode) {
+  if (mDecodeCache == nullptr) return;
+  mDecodeCache->mHoldsSources = true;
+  mDecodeCache->mSourcesMode = mode;
+}
+
+bool JpegR::takeStreamedBaseImage(decode_mode_t mode) {
+  if (mDecodeCache == nullptr || !mDecodeCache->mSdrStreamed) return false;
+  mDecodeCache->mSdrStreamed = false;
+  return mDecodeCache->mSdrStreamedMode == mode;
+}
+
+uhdr_error_info_t JpegR::decodeJPEGRImpl(uhdr_compressed_image_t* uhdr_compressed_img,
+                                         uhdr_raw_image_t* dest, unsigned int strip_height,
+                                         const PushStripFn* emit_strip,
+                                         const image_region_t* roi, unsigned int scale_denom,
+                                         float max_display_boost,
+                                         uhdr_color_transfer_t output_ct,
+                                         uhdr_img_fmt_t output_format,
+                                         uhdr_raw_image_t* gainmap_img,
+                                         uhdr_gainmap_metadata_t* gainmap_metadata) {
+  UHDR_TRACE_SCOPE("JpegR::decodeJPEGR");
+  uhdr_compressed_image_t primary_jpeg_image, gainmap_jpeg_image;
+  UHDR_ERR_CHECK(
+      extractPrimaryImageAndGainMap(uhdr_compressed_img, &primary_jpeg_image, &gainmap_jpeg_image))
+
+  JpegDecoderHelper local_dec_obj_sdr, local_dec_obj_gm;
+  JpegDecoderHelper& jpeg_dec_obj_sdr =
+      mDecodeCache ? mDecodeCache->mSdrDecoder : local_dec_obj_sdr;
+  JpegDecoderHelper& jpeg_dec_obj_gm =
+      mDecodeCache ? mDecodeCache->mGainmapDecoder : local_dec_obj_gm;
+  jpeg_dec_obj_sdr.setParallelDecode(getWorkerCount(), [this](const std::function<void()>& job,
+                                                               unsigned int parallelism) {
+    runParallel(job, parallelism);
+  });
+  jpeg_dec_obj_sdr.setFastIdct(mFastIdct);
+  jpeg_dec_obj_sdr.setBackend(mJpegBackend);
+  jpeg_dec_obj_gm.setFastIdct(mFastIdct);
+  jpeg_dec_obj_gm.setBackend(mJpegBackend);
+  jpeg_dec_obj_sdr.setFastUpsampling(mFastUpsampling);
+  const decode_mode_t sdr_decode_mode =
+      (output_ct == UHDR_CT_SRGB) ? DECODE_TO_RGB_CS : DECODE_TO_YCBCR_CS;
+  // the base image is decoded a strip at a time, for emit_strip or into the rows of dest
+  const bool strip_wise = strip_height > 0;
+  // a base image decoded ahead serves whole image decodes only
+  const bool sdr_streamed = takeStreamedBaseImage(sdr_decode_mode) && !strip_wise &&
+                            roi == nullptr && scale_denom == 1;
+  auto decode_sdr = [&]() -> uhdr_error_info_t {
+    StageTimer timer(mStats, UHDR_STAGE_BASE_DECODE);
+    if (sdr_streamed) {
+      return jpeg_dec_obj_sdr.attachBitstream(primary_jpeg_image.data,
+                                              primary_jpeg_image.data_sz);
+    } else if (strip_wise) {
+      return jpeg_dec_obj_sdr.startStripDecode(primary_jpeg_image.data, primary_jpeg_image.data_sz,
+                                               sdr_decode_mode, strip_height);
+    } else if (roi != nullptr) {
+      return jpeg_dec_obj_sdr.decompressImageRegion(
+          primary_jpeg_image.data, primary_jpeg_image.data_sz, sdr_decode_mode, *roi);
+    } else if (scale_denom > 1) {
+      return jpeg_dec_obj_sdr.decompressImageScaled(
+          primary_jpeg_image.data, primary_jpeg_image.data_sz, sdr_decode_mode, scale_denom);
+    }
+    return jpeg_dec_obj_sdr.decompressImage(primary_jpeg_image.data, primary_jpeg_image.data_sz,
+                                            sdr_decode_mode);
+  };
+
+  // sdr output is the base image as is, unless a display boost is configured
+  const bool apply_gainmap = output_ct != UHDR_CT_SRGB ||
+                             (max_display_boost > 1.0f && max_display_boost != FLT_MAX);
+
+  // The metadata is read from the gain map headers ahead of the decodes. A display boost of at
+  // most hdr_capacity_min weighs the gain map out of the output, which then does not depend on
+  // the gain map samples, so the gain map is only decoded if it is asked for.
+  jpeg_header_view_t gainmap_view;
+  uhdr_gainmap_metadata_ext_t uhdr_metadata;
+  bool weighed_out = false;
+  if (gainmap_metadata != nullptr || apply_gainmap) {
+    UHDR_ERR_CHECK(JpegDecoderHelper::scanHeaders(gainmap_jpeg_image.data,
+                                                  gainmap_jpeg_image.data_sz, gainmap_view))
+    UHDR_ERR_CHECK(parseGainMapMetadata(const_cast<uint8_t*>(gainmap_view.isoData),
+                                        gainmap_view.isoSize,
+                                        const_cast<uint8_t*>(gainmap_view.xmpData),
+                                        gainmap_view.xmpSize, &uhdr_metadata))
+    if (gainmap_metadata != nullptr) {
+      gainmap_metadata->min_content_boost = uhdr_metadata.min_content_boost;
+      gainmap_metadata->max_content_boost = uhdr_metadata.max_content_boost;
+      gainmap_metadata->gamma = uhdr_metadata.gamma;
+      gainmap_metadata->offset_sdr = uhdr_metadata.offset_sdr;
+      gainmap_metadata->offset_hdr = uhdr_metadata.offset_hdr;
+      gainmap_metadata->hdr_capacity_min = uhdr_metadata.hdr_capacity_min;
+      gainmap_metadata->hdr_capacity_max = uhdr_metadata.hdr_capacity_max;
+    }
+    const float display_boost = (std::min)(max_display_boost, uhdr_metadata.hdr_capacity_max);
+    weighed_out = apply_gainmap && display_boost != uhdr_metadata.hdr_capacity_max &&
+                  display_boost <= uhdr_metadata.hdr_capacity_min;
+  }
+  // a gain map decoded ahead is at full size
+  const bool gainmap_predecoded = mPredecodedGainMap != nullptr && scale_denom == 1;
+  const bool decode_gainmap =
+      !gainmap_predecoded && (gainmap_img != nullptr || (apply_gainmap && !weighed_out));
+  auto decode_gainmap_image = [&]() -> uhdr_error_info_t {
+    if (!decode_gainmap) return g_no_error;
+    StageTimer timer(mStats, UHDR_STAGE_GAINMAP_DECODE);
+    // a scaled decode scales the gain map alike, which keeps the map scale factor
+    return jpeg_dec_obj_gm.decompressImageScaled(gainmap_jpeg_image.data,
+                                                 gainmap_jpeg_image.data_sz, DECODE_STREAM,
+                                                 scale_denom);
+  };
+
+  if (mDecodeCache != nullptr) mDecodeCache->mHoldsSources = false;
+  // sdr output of a whole image is decoded into the outputs directly where their layouts allow
+  const bool whole_image =
+      !strip_wise && roi == nullptr && scale_denom == 1 && mOutputMap == nullptr;
+  if (!apply_gainmap && whole_image) {
+    if (!sdr_streamed) jpeg_dec_obj_sdr.setOutputImage(dest);
+    if (decode_gainmap) jpeg_dec_obj_gm.setOutputImage(gainmap_img);
+  } else if (mApplyGainMapInPlace && whole_image && !sdr_streamed &&
+             sdr_decode_mode == DECODE_TO_RGB_CS && output_format == UHDR_IMG_FMT_32bppRGBA8888) {
+    // the base image decodes to the output format, the gain map is applied over it in dest. The
+    // fixed point sdr pipeline reads each pixel ahead of writing it
+    jpeg_dec_obj_sdr.setOutputImage(dest);
+  }
+  if (strip_wise) {
+    // a strip wise decode only reads the base image header here, nothing to overlap with
+    UHDR_ERR_CHECK(decode_sdr())
+    UHDR_ERR_CHECK(decode_gainmap_image())
+  } else {
+    // the two bitstreams are independent
+    UHDR_ERR_CHECK(runConcurrently(decode_sdr, decode_gainmap_image))
+    // sources in the outputs are not the decoders' to hold
+    if (decode_gainmap && roi == nullptr && scale_denom == 1 &&
+        !jpeg_dec_obj_sdr.isResultInOutputImage() && !jpeg_dec_obj_gm.isResultInOutputImage()) {
+      holdSources(sdr_decode_mode);
+    }
+  }
+
+  uhdr_raw_image_t gainmap;
+  std::unique_ptr<uhdr_raw_image_ext_t> blank_gainmap;
+  if (gainmap_predecoded) {
+    gainmap = *mPredecodedGainMap;
+    if (gainmap_img != nullptr) {
+      UHDR_ERR_CHECK(copyRawImage(&gainmap, gainmap_img));
+    }
+  } else if (decode_gainmap) {
+    gainmap = jpeg_dec_obj_gm.getDecompressedImage();
+    if (mGainMapFn != nullptr && scale_denom == 1) (*mGainMapFn)(&gainmap);
+    if (gainmap_img != nullptr) {
+      UHDR_ERR_CHECK(copyRawImage(&gainmap, gainmap_img));
+    }
+  } else if (apply_gainmap) {
+    // a weighed out gain map stands in as a blank one of its geometry, with the scaling of a
+    // scaled decode
+    blank_gainmap = std::make_unique<uhdr_raw_image_ext_t>(
+        UHDR_IMG_FMT_8bppYCbCr400, UHDR_CG_UNSPECIFIED, UHDR_CT_UNSPECIFIED, UHDR_CR_UNSPECIFIED,
+        (gainmap_view.width + scale_denom - 1) / scale_denom,
+        (gainmap_view.height + scale_denom - 1) / scale_denom, 1);
+    memset(blank_gainmap->planes[UHDR_PLANE_Y], 0,
+           (size_t)blank_gainmap->stride[UHDR_PLANE_Y] * blank_gainmap->h);
+    gainmap = *blank_gainmap;
+  }
+
+  uhdr_raw_image_t sdr_intent = jpeg_dec_obj_sdr.getDecompressedImage();
+  sdr_intent.cg =
+      IccHelper::readIccColorGamut(jpeg_dec_obj_sdr.getICCPtr(), jpeg_dec_obj_sdr.getICCSize());
+  if (!strip_wise) {
+    // the base image can be shown while the gain map is applied
+    if (mBaseImageFn != nullptr) {
+      uhdr_raw_image_t base = sdr_intent;
+      base.ct = UHDR_CT_SRGB;
+      base.range = UHDR_CR_FULL_RANGE;
+      UHDR_ERR_CHECK((*mBaseImageFn)(&base))
+    }
+    if (!apply_gainmap) {
+      if (mOutputMap != nullptr) return placeMappedImage(&sdr_intent, dest);
+      UHDR_ERR_CHECK(copyRawImage(&sdr_intent, dest));
+      return g_no_error;
+    }
+
+    if (roi != nullptr) {
+      // the gain map is sampled in the coordinates of the whole base image, the decoded rectangle
+      // is handed over as the only strip
+      uhdr_raw_image_t sdr_geometry = sdr_intent;
+      sdr_geometry.w = jpeg_dec_obj_sdr.getImageWidth();
+      sdr_geometry.h = jpeg_dec_obj_sdr.getImageHeight();
+      bool pulled = false;
+      PullStripFn pull_roi = [&sdr_intent, &pulled, roi](uhdr_raw_image_t* strip,
+                                                         unsigned int& row_start) {
+        *strip = sdr_intent;
+        strip->h = pulled ? 0 : sdr_intent.h;
+        row_start = roi->top;
+        pulled = true;
+        return g_no_error;
+      };
+      PushStripFn push_roi = [](uhdr_raw_image_t*, unsigned int) { return g_no_error; };
+      UHDR_ERR_CHECK(applyGainMap(&sdr_geometry, &gainmap, &uhdr_metadata, output_ct,
+                                  output_format, max_display_boost, dest, &pull_roi, &push_roi,
+                                  roi->left));
+      return g_no_error;
+    }
+
+    UHDR_ERR_CHECK(applyGainMap(&sdr_intent, &gainmap, &uhdr_metadata, output_ct, output_format,
+                                max_display_boost, dest));
+
+    return g_no_error;
+  }
+
+  // a whole image dest takes the strips in place
+  std::unique_ptr<uhdr_raw_image_ext_t> dest_whole;
+  if (emit_strip == nullptr) {
+    if (dest == nullptr || dest->w != sdr_intent.w || dest->h != sdr_intent.h) {
+      uhdr_error_info_t status;
+      status.error_code = UHDR_CODEC_INVALID_PARAM;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "strip wise decode to a whole image requires an output of the image dimensions "
+               "%ux%u",
+               sdr_intent.w, sdr_intent.h);
+      return status;
+    }
+    dest_whole = std::make_unique<uhdr_raw_image_ext_t>(*dest);
+  }
+
+  if (!apply_gainmap) {
+    uhdr_raw_image_t strip;
+    unsigned int row_start;
+    while (true) {
+      {
+        StageTimer timer(mStats, UHDR_STAGE_BASE_DECODE);
+        UHDR_ERR_CHECK(jpeg_dec_obj_sdr.decompressStrip(&strip, row_start));
+      }
+      if (strip.h == 0) break;
+      strip.cg = sdr_intent.cg;
+      strip.ct = output_ct;
+      strip.range = UHDR_CR_UNSPECIFIED;
+      if (emit_strip != nullptr) {
+        UHDR_ERR_CHECK((*emit_strip)(&strip, row_start));
+      } else {
+        uhdr_raw_image_ext_t dest_rows(*dest_whole, 0, row_start, strip.w, strip.h);
+        UHDR_ERR_CHECK(copyRawImage(&strip, &dest_rows));
+        dest->cg = dest_rows.cg;
+        dest->ct = dest_rows.ct;
+        dest->range = dest_rows.range;
+      }
+    }
+    return g_no_error;
+  }
+
+  PullStripFn pull_sdr_strip = [&jpeg_dec_obj_sdr](uhdr_raw_image_t* strip,
+                                                   unsigned int& row_start) {
+    return jpeg_dec_obj_sdr.decompressStrip(strip, row_start);
+  };
+  if (emit_strip == nullptr) {
+    UHDR_ERR_CHECK(applyGainMap(&sdr_intent, &gainmap, &uhdr_metadata, output_ct, output_format,
+                                max_display_boost, dest, &pull_sdr_strip, nullptr));
+    return g_no_error;
+  }
+  uhdr_raw_image_ext_t dest_strip(output_format, UHDR_CG_UNSPECIFIED, output_ct,
+                                  UHDR_CR_UNSPECIFIED, sdr_intent.w,
+                                  jpeg_dec_obj_sdr.getStripHeight(), 1);
+  UHDR_ERR_CHECK(applyGainMap(&sdr_intent, &gainmap, &uhdr_metadata, output_ct, output_format,
+                              max_display_boost, &dest_strip, &pull_sdr_strip, emit_strip));
+
+  return g_no_error;
+}
+
+// Gain map samples of pixels [x, x + count) of row y of the base image. Pixels of flat blocks take
+// the value of the block, the others are interpolated with the weight tables for integer map scale
+// factors and through columns for fractional ones.
+static void sampleGainMapRow(uhdr_raw_image_t* gainmap_img, const FlatGainMapBlocks& flat,
+                             size_t map_scale_factor, ShepardsIDW& idwTable,
+                             const MapSampleColumns* columns, size_t x, size_t y, size_t count,
+                             float* gains) {
+  const size_t x_end = x + count;
+  while (x < x_end) {
+    int32_t value = -1;
+    const size_t span_end = flat.mFlatBlocks > 0 ? flat.span(x, y, x_end, value) : x_end;
+    if (value >= 0) {
+      flat.fillRow(value, span_end - x, gains);
+    } else if (columns == nullptr) {
+      sampleMapRow(gainmap_img, map_scale_factor, x, y, span_end - x, idwTable, gains);
+    } else {
+      sampleMapRow(gainmap_img, *columns, x, y, span_end - x, gains);
+    }
+    gains += (span_end - x) * flat.mOutChannels;
+    x = span_end;
+  }
+}
+
+// Linear hdr color of pixel x of a row of the float applyGainMap() pipeline, in units of sdr white
+// and in the output gamut. sdr holds the planar yuv samples of the row and gains the gain map
+// samples of the row, interleaved for multichannel maps.
+template <int kGainChannels>
+static inline Color gainMapPixelToLinear(float* const sdr[3], const float* gains,
+                                         GainLUT& gainLUT, uhdr_gainmap_metadata_ext_t* metadata,
+                                         [[maybe_unused]] float gainmap_weight,
+                                         ColorTransformFn gamut_conversion, size_t x) {
+  Color yuv_gamma_sdr = {{{sdr[0][x], sdr[1][x], sdr[2][x]}}};
+  // Assuming the sdr image is a decoded JPEG, we should always use Rec.601 YUV coefficients
+  Color rgb_gamma_sdr = p3YuvToRgb(yuv_gamma_sdr);
+  // We are assuming the SDR base image is always sRGB transfer.
+#if USE_SRGB_INVOETF_LUT
+  Color rgb_sdr = srgbInvOetfLUT(rgb_gamma_sdr);
+#else
+  Color rgb_sdr = srgbInvOetf(rgb_gamma_sdr);
+#endif
+  Color rgb_hdr;
+  if constexpr (kGainChannels == 1) {
+    float gain = gains[x];
+#if USE_APPLY_GAIN_LUT
+    rgb_hdr = applyGainLUT(rgb_sdr, gain, gainLUT, metadata);
+#else
+    rgb_hdr = applyGain(rgb_sdr, gain, metadata, gainmap_weight);
+#endif
+  } else {
+    Color gain = {{{gains[3 * x], gains[3 * x + 1], gains[3 * x + 2]}}};
+#if USE_APPLY_GAIN_LUT
+    rgb_hdr = applyGainLUT(rgb_sdr, gain, gainLUT, metadata);
+#else
+    rgb_hdr = applyGain(rgb_sdr, gain, metadata, gainmap_weight);
+#endif
+  }
+  if (gamut_conversion != nullptr) rgb_hdr = gamut_conversion(rgb_hdr);
+  return rgb_hdr;
+}
+
+// Packed 10-bit hlg or pq pixel of a linear hdr color from gainMapPixelToLinear(). Negative
+// components, as a gamut conversion leaves them for colors outside of the output gamut, are
+// clipped ahead of the transfer function.
+template <uhdr_color_transfer_t kOutputCt>
+static inline uint32_t linearToRgba1010102(Color rgb_hdr) {
+  static_assert(kOutputCt == UHDR_CT_HLG || kOutputCt == UHDR_CT_PQ, "unexpected output transfer");
+#if USE_HLG_OETF_LUT && USE_PQ_OETF_LUT
+  // scaling, inverse ootf, oetf and quantization in one lookup per component
+  return kOutputCt == UHDR_CT_HLG ? hlgLinearToRgba1010102(rgb_hdr)
+                                  : pqLinearToRgba1010102(rgb_hdr);
+#else
+  rgb_hdr.r = (std::max)(rgb_hdr.r, 0.0f);
+  rgb_hdr.g = (std::max)(rgb_hdr.g, 0.0f);
+  rgb_hdr.b = (std::max)(rgb_hdr.b, 0.0f);
+  if constexpr (kOutputCt == UHDR_CT_HLG) {
+    rgb_hdr = hlgInverseOotfApprox(rgb_hdr * kSdrWhiteNits / kHlgMaxNits);
+    return colorToRgba1010102(hlgOetf(rgb_hdr));
+  } else {
+    return colorToRgba1010102(pqOetf(rgb_hdr * kSdrWhiteNits / kPqMaxNits));
+  }
+#endif
+}
+
+// Scalar part of a row of the float applyGainMap() pipeline, pixels [x, width) of row y, see
+// gainMapPixelToLinear(). Instantiated per gain map channel count and output transfer, so that the
+// pixel loop does not branch on them.
+template <int kGainChannels, uhdr_color_transfer_t kOutputCt>
+static void applyGainMapPixels(float* const sdr[3], const float* gains, GainLUT& gainLUT,
+                               uhdr_gainmap_metadata_ext_t* metadata, float gainmap_weight,
+                               ColorTransformFn gamut_conversion, uhdr_raw_image_t* dest, size_t y,
+                               size_t x, size_t width) {
+  [[maybe_unused]] const size_t x0 = x;
+  for (; x < width; ++x) {
+    Color rgb_hdr = gainMapPixelToLinear<kGainChannels>(sdr, gains, gainLUT, metadata,
+                                                        gainmap_weight, gamut_conversion, x);
+    if constexpr (kOutputCt == UHDR_CT_LINEAR) {
+      // the sdr samples of x are consumed, the row is narrowed to half floats after the loop
+      sdr[0][x] = rgb_hdr.r;
+      sdr[1][x] = rgb_hdr.g;
+      sdr[2][x] = rgb_hdr.b;
+    } else {
+      size_t pixel_idx = x + y * dest->stride[UHDR_PLANE_PACKED];
+      reinterpret_cast<uint32_t*>(dest->planes[UHDR_PLANE_PACKED])[pixel_idx] =
+          linearToRgba1010102<kOutputCt>(rgb_hdr);
+    }
+  }
+  if constexpr (kOutputCt == UHDR_CT_LINEAR) {
+    if (x0 < width) {
+      float* const rgb_hdr[3] = {sdr[0] + x0, sdr[1] + x0, sdr[2] + x0};
+      uint64_t* rgba_f16 = reinterpret_cast<uint64_t*>(dest->planes[UHDR_PLANE_PACKED]) + x0 +
+                           y * dest->stride[UHDR_PLANE_PACKED];
+      floatToRgbaF16Row(rgb_hdr, width - x0, rgba_f16);
+    }
+  }
+}
+
+typedef void (*ApplyGainMapPixelsFn)(float* const sdr[3], const float* gains, GainLUT& gainLUT,
+                                     uhdr_gainmap_metadata_ext_t* metadata, float gainmap_weight,
+                                     ColorTransformFn gamut_conversion, uhdr_raw_image_t* dest,
+                                     size_t y, size_t x, size_t width);
+
+template <int kGainChannels>
+static ApplyGainMapPixelsFn getApplyGainMapPixelsFn(uhdr_color_transfer_t output_ct) {
+  switch (output_ct) {
+    case UHDR_CT_LINEAR:
+      return applyGainMapPixels<kGainChannels, UHDR_CT_LINEAR>;
+    case UHDR_CT_HLG:
+      return applyGainMapPixels<kGainChannels, UHDR_CT_HLG>;
+    case UHDR_CT_PQ:
+      return applyGainMapPixels<kGainChannels, UHDR_CT_PQ>;
+    default:
+      return nullptr;
+  }
+}
+
+static ApplyGainMapPixelsFn getApplyGainMapPixelsFn(bool multichannel,
+                                                    uhdr_color_transfer_t output_ct) {
+  return multichannel ? getApplyGainMapPixelsFn<3>(output_ct)
+                      : getApplyGainMapPixelsFn<1>(output_ct);
+}
+
+// Linear hdr colors of a row of the base image, see gainMapPixelToLinear(). The colors replace the
+// sdr samples in sdr.
+template <int kGainChannels>
+static void gainMapRowToLinear(float* const sdr[3], const float* gains, GainLUT& gainLUT,
+                               uhdr_gainmap_metadata_ext_t* metadata, float gainmap_weight,
+                               ColorTransformFn gamut_conversion, size_t width) {
+  for (size_t x = 0; x < width; ++x) {
+    Color rgb_hdr = gainMapPixelToLinear<kGainChannels>(sdr, gains, gainLUT, metadata,
+                                                        gainmap_weight, gamut_conversion, x);
+    sdr[0][x] = rgb_hdr.r;
+    sdr[1][x] = rgb_hdr.g;
+    sdr[2][x] = rgb_hdr.b;
+  }
+}
+
+typedef void (*GainMapRowToLinearFn)(float* const sdr[3], const float* gains, GainLUT& gainLUT,
+                                     uhdr_gainmap_metadata_ext_t* metadata, float gainmap_weight,
+                                     ColorTransformFn gamut_conversion, size_t width);
+
+// Approximate counterpart of applyGainMapPixels() for single channel gain maps. The mapping from
+// the sdr pixel and the gain to the output pixel is interpolated from outputLUT.
+template <uhdr_color_transfer_t kOutputCt>
+static void applyGainMapPixelsApprox(float* const sdr[3], const float* gains,
+                                     const GainMapOutputLUT& outputLUT, uhdr_raw_image_t* dest,
+                                     size_t y, size_t x, size_t width) {
+  [[maybe_unused]] const size_t x0 = x;
+  for (; x < width; ++x) {
+    Color rgb_gamma_sdr = p3YuvToRgb({{{sdr[0][x], sdr[1][x], sdr[2][x]}}});
+    Color rgb_hdr = outputLUT.lookup(rgb_gamma_sdr, gains[x]);
+    if constexpr (kOutputCt == UHDR_CT_LINEAR) {
+      sdr[0][x] = rgb_hdr.r;
+      sdr[1][x] = rgb_hdr.g;
+      sdr[2][x] = rgb_hdr.b;
+    } else {
+      size_t pixel_idx = x + y * dest->stride[UHDR_PLANE_PACKED];
+      reinterpret_cast<uint32_t*>(dest->planes[UHDR_PLANE_PACKED])[pixel_idx] =
+          colorToRgba1010102(rgb_hdr);
+    }
+  }
+  if constexpr (kOutputCt == UHDR_CT_LINEAR) {
+    if (x0 < width) {
+      float* const rgb_hdr[3] = {sdr[0] + x0, sdr[1] + x0, sdr[2] + x0};
+      uint64_t* rgba_f16 = reinterpret_cast<uint64_t*>(dest->planes[UHDR_PLANE_PACKED]) + x0 +
+                           y * dest->stride[UHDR_PLANE_PACKED];
+      floatToRgbaF16Row(rgb_hdr, width - x0, rgba_f16);
+    }
+  }
+}
+
+typedef void (*ApplyGainMapPixelsApproxFn)(float* const sdr[3], const float* gains,
+                                           const GainMapOutputLUT& outputLUT,
+                                           uhdr_raw_image_t* dest, size_t y, size_t x,
+                                           size_t width);
+
+static ApplyGainMapPixelsApproxFn getApplyGainMapPixelsApproxFn(uhdr_color_transfer_t output_ct) {
+  switch (output_ct) {
+    case UHDR_CT_LINEAR:
+      return applyGainMapPixelsApprox<UHDR_CT_LINEAR>;
+    case UHDR_CT_HLG:
+      return applyGainMapPixelsApprox<UHDR_CT_HLG>;
+    case UHDR_CT_PQ:
+      return applyGainMapPixelsApprox<UHDR_CT_PQ>;
+    default:
+      return nullptr;
+  }
+}
+
+// true if map only permutes and drops pixels, that is for rotations, mirrors and crops
+static bool isPixelPermutation(const uhdr_plane_map_t& map) {
+  return (map.xy == 0 && map.yx == 0 && std::abs(map.xx) == 1 && std::abs(map.yy) == 1) ||
+         (map.xx == 0 && map.yy == 0 && std::abs(map.xy) == 1 && std::abs(map.yx) == 1);
+}
+
+// Places the first width pixels of row y of the decoded image in dest, at the pixels that map
+// takes to them. map is a pixel permutation, so each pixel has at most one place, found by
+// inverting map. The pixels of a row run along a row of dest or, for rotations, along a column.
+template <typename T>
+static void placeMappedPixels(const uhdr_plane_map_t& map, const T* row, int y, int width,
+                              uhdr_raw_image_t* dest) {
+  int dst_x, dst_y, step_x, step_y;
+  if (map.xy == 0) {
+    dst_x = -map.x0 * map.xx;
+    dst_y = (y - map.y0) * map.yy;
+    step_x = map.xx;
+    step_y = 0;
+  } else {
+    dst_x = (y - map.y0) * map.yx;
+    dst_y = -map.x0 * map.xy;
+    step_x = 0;
+    step_y = map.xy;
+  }
+  // pixels [begin, end) of the row land inside dest
+  int begin = 0, end = width;
+  auto clip = [&begin, &end](int start, int step, int size) {
+    if (step == 0) {
+      if (start < 0 || start >= size) end = 0;
+    } else if (step > 0) {
+      begin = (std::max)(begin, -start);
+      end = (std::min)(end, size - start);
+    } else {
+      begin = (std::max)(begin, start - size + 1);
+      end = (std::min)(end, start + 1);
+    }
+  };
+  clip(dst_x, step_x, (int)dest->w);
+  clip(dst_y, step_y, (int)dest->h);
+  T* dst = static_cast<T*>(dest->planes[UHDR_PLANE_PACKED]);
+  const ptrdiff_t stride = dest->stride[UHDR_PLANE_PACKED];
+  const ptrdiff_t step = step_y * stride + step_x;
+  T* out = dst + (ptrdiff_t)dst_y * stride + dst_x + begin * step;
+  for (int x = begin; x < end; x++, out += step) *out = row[x];
+}
 
-    UHDR_ERR_CHECK(uhdr_gainmap_metadata_frac::decodeGainmapMetadata(iso_vec, &decodedMetadata));
-    UHDR_ERR_CHECK(uhdr_gainmap_metadata_frac::gainmapMetadataFractionToFloat(&decodedMetadata,
-                                                                              uhdr_metadata));
-  } else if (xmp_size > 0) {
-    UHDR_ERR_CHECK(getMetadataFromXMP(xmp_data, xmp_size, uhdr_metadata));
+static void placeMappedRow(const uhdr_plane_map_t& map, const void* row, size_t y, size_t width,
+                           uhdr_raw_image_t* dest) {
+  if (dest->fmt == UHDR_IMG_FMT_64bppRGBAHalfFloat) {
+    placeMappedPixels(map, static_cast<const uint64_t*>(row), (int)y, (int)width, dest);
   } else {
+    placeMappedPixels(map, static_cast<const uint32_t*>(row), (int)y, (int)width, dest);
+  }
+}
+
+// Copies the packed pixels of src to their places in dest through the output map, see
+// setOutputMap(). Outputs without a gain map pass take this copy instead.
+uhdr_error_info_t JpegR::placeMappedImage(uhdr_raw_image_t* src, uhdr_raw_image_t* dest) {
+  if (src->fmt != dest->fmt || src->fmt != UHDR_IMG_FMT_32bppRGBA8888 ||
+      !isPixelPermutation(*mOutputMap) || dest->w != (unsigned int)mOutputMap->w ||
+      dest->h != (unsigned int)mOutputMap->h) {
     uhdr_error_info_t status;
-    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
     status.has_detail = 1;
     snprintf(status.detail, sizeof status.detail,
-             "received no valid buffer to parse gainmap metadata");
+             "unsupported output map of %dx%d for an output of color format %d, dimensions %ux%u",
+             mOutputMap->w, mOutputMap->h, dest->fmt, dest->w, dest->h);
     return status;
   }
-
+  UHDR_ERR_CHECK(forEachRowBand(src->w, src->h, [&](unsigned int row_start, unsigned int row_end) {
+    for (size_t y = row_start; y < row_end; y++) {
+      placeMappedRow(*mOutputMap,
+                     static_cast<uint32_t*>(src->planes[UHDR_PLANE_PACKED]) +
+                         y * src->stride[UHDR_PLANE_PACKED],
+                     y, src->w, dest);
+    }
+    return g_no_error;
+  }))
+  dest->cg = src->cg;
+  dest->ct = src->ct;
+  dest->range = src->range;
   return g_no_error;
 }
 
-/* Decode API */
-uhdr_error_info_t JpegR::decodeJPEGR(uhdr_compressed_image_t* uhdr_compressed_img,
-                                     uhdr_raw_image_t* dest, float max_display_boost,
-                                     uhdr_color_transfer_t output_ct, uhdr_img_fmt_t output_format,
-                                     uhdr_raw_image_t* gainmap_img,
-                                     uhdr_gainmap_metadata_t* gainmap_metadata) {
-  uhdr_compressed_image_t primary_jpeg_image, gainmap_jpeg_image;
-  UHDR_ERR_CHECK(
-      extractPrimaryImageAndGainMap(uhdr_compressed_img, &primary_jpeg_image, &gainmap_jpeg_image))
-
-  JpegDecoderHelper jpeg_dec_obj_sdr;
-  UHDR_ERR_CHECK(jpeg_dec_obj_sdr.decompressImage(
-      primary_jpeg_image.data, primary_jpeg_image.data_sz,
-      (output_ct == UHDR_CT_SRGB) ? DECODE_TO_RGB_CS : DECODE_TO_YCBCR_CS));
+// Luminance statistics of the rows a job of applyGainMap() wrote, see uhdr_luminance_stats_t
+struct LuminanceTotals {
+  double sum = 0.0;
+  float max = 0.0f;
+  size_t count = 0;
+  size_t histogram[UHDR_LUMINANCE_HISTOGRAM_BINS] = {};
+
+  void add(float y) {
+    y = (std::max)(y, 0.0f);
+    sum += y;
+    max = (std::max)(max, y);
+    count++;
+    // half stop bins from the exponent and the mantissa of the float, without a log2 per pixel
+    int32_t bits;
+    memcpy(&bits, &y, sizeof bits);
+    const int32_t exponent = (bits >> 23) - 127;
+    const int32_t upper_half = (bits & 0x7fffff) >= 0x3504f3 ? 1 : 0;  // mantissa >= sqrt(2)
+    const int32_t bin = 2 * (exponent - UHDR_LUMINANCE_HISTOGRAM_MIN_LOG2) + upper_half;
+    histogram[CLIP3(bin, 0, UHDR_LUMINANCE_HISTOGRAM_BINS - 1)]++;
+  }
+};
 
-  JpegDecoderHelper jpeg_dec_obj_gm;
-  uhdr_raw_image_t gainmap;
-  if (gainmap_img != nullptr || output_ct != UHDR_CT_SRGB) {
-    UHDR_ERR_CHECK(jpeg_dec_obj_gm.decompressImage(gainmap_jpeg_image.data,
-                                                   gainmap_jpeg_image.data_sz, DECODE_STREAM));
-    gainmap = jpeg_dec_obj_gm.getDecompressedImage();
-    if (gainmap_img != nullptr) {
-      UHDR_ERR_CHECK(copy_raw_image(&gainmap, gainmap_img));
+// Gathers the luminance of the hdr output of applyGainMap(). The jobs read their output rows back
+// right after writing them, while the rows are in cache, which covers the vector row kernels and
+// the scalar paths alike. 8-bit and 10-bit codes are linearized through a table made per call, half
+// floats are linear already. Per job totals are merged once the job runs out of rows.
+class OutputLuminanceStats {
+ public:
+  OutputLuminanceStats(uhdr_img_fmt_t fmt, uhdr_color_transfer_t ct, uhdr_color_gamut_t cg,
+                       float display_boost)
+      : mFmt(fmt) {
+    LuminanceFn luminance = getLuminanceFn(cg);
+    if (luminance == nullptr) luminance = srgbLuminance;
+    mWeights[0] = luminance({{{1.0f, 0.0f, 0.0f}}});
+    mWeights[1] = luminance({{{0.0f, 1.0f, 0.0f}}});
+    mWeights[2] = luminance({{{0.0f, 0.0f, 1.0f}}});
+    if (fmt == UHDR_IMG_FMT_32bppRGBA8888) {
+      // srgb output is relative to the display peak
+      mLinear.resize(256);
+      for (size_t i = 0; i < mLinear.size(); i++) {
+        mLinear[i] = srgbInvOetf(i / 255.0f) * display_boost;
+      }
+    } else if (fmt == UHDR_IMG_FMT_32bppRGBA1010102) {
+      // the inverse of linearToRgba1010102()
+      mLinear.resize(1024);
+      for (size_t i = 0; i < mLinear.size(); i++) {
+        const float e = i / 1023.0f;
+        if (ct == UHDR_CT_HLG) {
+          const float scene = hlgInvOetf(e);
+          mLinear[i] = hlgOotfApprox({{{scene, scene, scene}}}, nullptr).r * kHlgMaxNits /
+                       kSdrWhiteNits;
+        } else {
+          mLinear[i] = pqInvOetf(e) * kPqMaxNits / kSdrWhiteNits;
+        }
+      }
     }
   }
 
-  uhdr_gainmap_metadata_ext_t uhdr_metadata;
-  if (gainmap_metadata != nullptr || output_ct != UHDR_CT_SRGB) {
-    UHDR_ERR_CHECK(parseGainMapMetadata(static_cast<uint8_t*>(jpeg_dec_obj_gm.getIsoMetadataPtr()),
-                                        jpeg_dec_obj_gm.getIsoMetadataSize(),
-                                        static_cast<uint8_t*>(jpeg_dec_obj_gm.getXMPPtr()),
-                                        jpeg_dec_obj_gm.getXMPSize(), &uhdr_metadata))
-    if (gainmap_metadata != nullptr) {
-      gainmap_metadata->min_content_boost = uhdr_metadata.min_content_boost;
-      gainmap_metadata->max_content_boost = uhdr_metadata.max_content_boost;
-      gainmap_metadata->gamma = uhdr_metadata.gamma;
-      gainmap_metadata->offset_sdr = uhdr_metadata.offset_sdr;
-      gainmap_metadata->offset_hdr = uhdr_metadata.offset_hdr;
-      gainmap_metadata->hdr_capacity_min = uhdr_metadata.hdr_capacity_min;
-      gainmap_metadata->hdr_capacity_max = uhdr_metadata.hdr_capacity_max;
+  // adds the luminance of the first width pixels of row y of rows to totals
+  void addRow(const uhdr_raw_image_t* rows, size_t y, size_t width, LuminanceTotals& totals) const {
+    const size_t offset = y * rows->stride[UHDR_PLANE_PACKED];
+    if (mFmt == UHDR_IMG_FMT_64bppRGBAHalfFloat) {
+      const uint64_t* row = static_cast<const uint64_t*>(rows->planes[UHDR_PLANE_PACKED]) + offset;
+      for (size_t x = 0; x < width; x++) {
+        const uint64_t p = row[x];
+        totals.add(mWeights[0] * halfToFloat(p & 0xffff) +
+                   mWeights[1] * halfToFloat((p >> 16) & 0xffff) +
+                   mWeights[2] * halfToFloat((p >> 32) & 0xffff));
+      }
+    } else if (mFmt == UHDR_IMG_FMT_32bppRGBA8888) {
+      const uint8_t* row =
+          static_cast<const uint8_t*>(rows->planes[UHDR_PLANE_PACKED]) + offset * 4;
+      for (size_t x = 0; x < width; x++) {
+        totals.add(mWeights[0] * mLinear[row[4 * x]] + mWeights[1] * mLinear[row[4 * x + 1]] +
+                   mWeights[2] * mLinear[row[4 * x + 2]]);
+      }
+    } else {
+      const uint32_t* row = static_cast<const uint32_t*>(rows->planes[UHDR_PLANE_PACKED]) + offset;
+      for (size_t x = 0; x < width; x++) {
+        const uint32_t p = row[x];
+        totals.add(mWeights[0] * mLinear[p & 0x3ff] + mWeights[1] * mLinear[(p >> 10) & 0x3ff] +
+                   mWeights[2] * mLinear[(p >> 20) & 0x3ff]);
+      }
     }
   }
 
-  uhdr_raw_image_t sdr_intent = jpeg_dec_obj_sdr.getDecompressedImage();
-  sdr_intent.cg =
-      IccHelper::readIccColorGamut(jpeg_dec_obj_sdr.getICCPtr(), jpeg_dec_obj_sdr.getICCSize());
-  if (output_ct == UHDR_CT_SRGB) {
-    UHDR_ERR_CHECK(copy_raw_image(&sdr_intent, dest));
-    return g_no_error;
+  // adds the totals of a job, called by the jobs as they finish
+  void merge(const LuminanceTotals& totals) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mTotals.sum += totals.sum;
+    mTotals.max = (std::max)(mTotals.max, totals.max);
+    mTotals.count += totals.count;
+    for (int i = 0; i < UHDR_LUMINANCE_HISTOGRAM_BINS; i++) {
+      mTotals.histogram[i] += totals.histogram[i];
+    }
   }
 
-  UHDR_ERR_CHECK(applyGainMap(&sdr_intent, &gainmap, &uhdr_metadata, output_ct, output_format,
-                              max_display_boost, dest));
+  void store(uhdr_luminance_stats_t* stats) const {
+    stats->max_luminance = mTotals.max;
+    stats->mean_luminance = mTotals.count > 0 ? (float)(mTotals.sum / mTotals.count) : 0.0f;
+    stats->num_pixels = mTotals.count;
+    for (int i = 0; i < UHDR_LUMINANCE_HISTOGRAM_BINS; i++) {
+      stats->histogram[i] = mTotals.histogram[i];
+    }
+  }
 
-  return g_no_error;
-}
+ private:
+  const uhdr_img_fmt_t mFmt;
+  float mWeights[3];
+  std::vector<float> mLinear;  // linear component of each code of the packed formats
+  std::mutex mMutex;
+  LuminanceTotals mTotals;
+};
 
 uhdr_error_info_t JpegR::applyGainMap(uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* gainmap_img,
                                       uhdr_gainmap_metadata_ext_t* gainmap_metadata,
                                       uhdr_color_transfer_t output_ct,
-                                      [[maybe_unused]] uhdr_img_fmt_t output_format,
-                                      float max_display_boost, uhdr_raw_image_t* dest) {
+                                      uhdr_img_fmt_t output_format, float max_display_boost,
+                                      uhdr_raw_image_t* dest,
+                                      const PullStripFn* pull_sdr_strip,
+                                      const PushStripFn* push_dest_strip,
+                                      unsigned int col_offset) {
+  UHDR_TRACE_SCOPE("JpegR::applyGainMap");
+  StageTimer timer(mStats, UHDR_STAGE_GAINMAP_APPLY);
   if (gainmap_metadata->version.compare(kJpegrVersion)) {
     uhdr_error_info_t status;
     status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
@@ -1366,7 +3692,18 @@ uhdr_error_info_t JpegR::applyGainMap(uhdr_raw_image_t* sdr_intent, uhdr_raw_ima
     return status;
   }
   UHDR_ERR_CHECK(uhdr_validate_gainmap_metadata_descriptor(gainmap_metadata));
-  if (sdr_intent->fmt != UHDR_IMG_FMT_24bppYCbCr444 &&
+  if (output_ct == UHDR_CT_SRGB) {
+    if (sdr_intent->fmt != UHDR_IMG_FMT_32bppRGBA8888) {
+      uhdr_error_info_t status;
+      status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "apply gainmap method expects base image color format to be "
+               "UHDR_IMG_FMT_32bppRGBA8888 for sdr output. Received %d",
+               sdr_intent->fmt);
+      return status;
+    }
+  } else if (sdr_intent->fmt != UHDR_IMG_FMT_24bppYCbCr444 &&
       sdr_intent->fmt != UHDR_IMG_FMT_16bppYCbCr422 &&
       sdr_intent->fmt != UHDR_IMG_FMT_12bppYCbCr420) {
     uhdr_error_info_t status;
@@ -1392,23 +3729,72 @@ uhdr_error_info_t JpegR::applyGainMap(uhdr_raw_image_t* sdr_intent, uhdr_raw_ima
              gainmap_img->fmt);
     return status;
   }
+  // the linear output is converted if the output gamut differs from the base image gamut, an
+  // untagged base image is taken as bt.709
+  const uhdr_color_gamut_t base_cg =
+      sdr_intent->cg == UHDR_CG_UNSPECIFIED ? UHDR_CG_BT_709 : sdr_intent->cg;
+  ColorTransformFn gamut_conversion = nullptr;
+  std::array<float, 9> gamut_matrix;
+  if (mOutputCg != UHDR_CG_UNSPECIFIED && mOutputCg != base_cg) {
+    gamut_conversion = getGamutConversionFn(mOutputCg, base_cg);
+    if (gamut_conversion == nullptr || output_ct == UHDR_CT_SRGB) {
+      uhdr_error_info_t status;
+      status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "unsupported conversion of the output from color gamut %d to %d for color "
+               "transfer %d",
+               base_cg, mOutputCg, output_ct);
+      return status;
+    }
+    getGamutConversionMatrix(gamut_conversion, gamut_matrix);
+  }
+
+  // P010 output is converted from rgb a pair of rows at a time
+  const bool ycbcr_output = output_format == UHDR_IMG_FMT_24bppYCbCrP010;
+  if (ycbcr_output && ((output_ct != UHDR_CT_HLG && output_ct != UHDR_CT_PQ) || dest->w % 2 != 0 ||
+                       dest->h % 2 != 0)) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "UHDR_IMG_FMT_24bppYCbCrP010 output expects hlg or pq color transfer and even "
+             "dimensions. Received color transfer %d, dimensions %ux%u",
+             output_ct, dest->w, dest->h);
+    return status;
+  }
+  // a mapped output is written a row at a time through the map, see setOutputMap()
+  const uhdr_plane_map_t* output_map = mOutputMap;
+  if (output_map != nullptr &&
+      (ycbcr_output || !isPixelPermutation(*output_map) || dest->w != (unsigned int)output_map->w ||
+       dest->h != (unsigned int)output_map->h)) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "unsupported output map of %dx%d for an output of color format %d, dimensions %ux%u",
+             output_map->w, output_map->h, output_format, dest->w, dest->h);
+    return status;
+  }
 
 #ifdef UHDR_ENABLE_GLES
-  if (mUhdrGLESCtxt != nullptr) {
+  if (mUhdrGLESCtxt != nullptr && output_ct != UHDR_CT_SRGB && !ycbcr_output &&
+      gamut_conversion == nullptr && pull_sdr_strip == nullptr && output_map == nullptr &&
+      mLuminanceStats == nullptr) {
     if (((sdr_intent->fmt == UHDR_IMG_FMT_12bppYCbCr420 && sdr_intent->w % 2 == 0 &&
           sdr_intent->h % 2 == 0) ||
          (sdr_intent->fmt == UHDR_IMG_FMT_16bppYCbCr422 && sdr_intent->w % 2 == 0) ||
          (sdr_intent->fmt == UHDR_IMG_FMT_24bppYCbCr444)) &&
-        isBufferDataContiguous(sdr_intent) && isBufferDataContiguous(gainmap_img) &&
         isBufferDataContiguous(dest)) {
-      // TODO: both inputs and outputs of GLES implementation assumes that raw image is contiguous
-      // and without strides. If not, handle the same by using temp copy
+      // inputs with strides are packed while staging their upload. The output stays on the gpu
+      // and is read back later, which assumes a contiguous raw image
       float display_boost = (std::min)(max_display_boost, gainmap_metadata->hdr_capacity_max);
 
       return applyGainMapGLES(sdr_intent, gainmap_img, gainmap_metadata, output_ct, display_boost,
                               dest, static_cast<uhdr_opengl_ctxt_t*>(mUhdrGLESCtxt));
     }
   }
+  if (mUhdrGLESCtxt != nullptr) countSlowPath(mStats, UHDR_SLOW_PATH_GPU_FALLBACK);
 #endif
 
   std::unique_ptr<uhdr_raw_image_ext_t> resized_gainmap = nullptr;
@@ -1430,15 +3816,41 @@ uhdr_error_info_t JpegR::applyGainMap(uhdr_raw_image_t* sdr_intent, uhdr_raw_ima
         return status;
       }
       gainmap_img = resized_gainmap.get();
+      countSlowPath(mStats, UHDR_SLOW_PATH_GAINMAP_RESIZE);
     }
   }
+  // Subsampled multi-channel maps are sampled from a planar copy, see GainMapPlanes. A map at the
+  // resolution of the image is read in place, every pixel takes its own sample in order.
+  std::unique_ptr<uhdr_raw_image_ext_t> planar_gainmap;
+  if (gainmap_img->w < sdr_intent->w) planar_gainmap = planar_gain_map(gainmap_img);
+  if (planar_gainmap != nullptr) gainmap_img = planar_gainmap.get();
 
   float map_scale_factor = (float)sdr_intent->w / gainmap_img->w;
   int map_scale_factor_rnd = (std::max)(1, (int)std::roundf(map_scale_factor));
 
-  dest->cg = sdr_intent->cg;
-  // Table will only be used when map scale factor is integer.
-  ShepardsIDW idwTable(map_scale_factor_rnd);
+  dest->cg = gamut_conversion != nullptr ? mOutputCg : sdr_intent->cg;
+  if (ycbcr_output) {
+    // the ycbcr matrix follows the output gamut, an untagged base image is taken as bt.709
+    if (dest->cg == UHDR_CG_UNSPECIFIED) dest->cg = UHDR_CG_BT_709;
+    dest->range = UHDR_CR_FULL_RANGE;
+  }
+  // Tables are shared with other decodes through the process wide cache. The interpolation table
+  // will only be used when map scale factor is integer, fractional ones sample the gain map
+  // through per column tables made once per call. The tables are in the coordinates of the whole
+  // base image, which strips and regions index with their offsets.
+  GainMapTableCache& tableCache = GainMapTableCache::getDefaultCache();
+  std::shared_ptr<ShepardsIDW> idw_table = tableCache.getIdwTable(map_scale_factor_rnd);
+  ShepardsIDW& idwTable = *idw_table;
+  const bool use_idw = map_scale_factor == floorf(map_scale_factor);
+  std::unique_ptr<MapSampleColumns> map_columns;
+  if (!use_idw) {
+    map_columns = std::make_unique<MapSampleColumns>(gainmap_img, map_scale_factor, sdr_intent->w);
+    countSlowPath(mStats, UHDR_SLOW_PATH_FRACTIONAL_SCALE);
+  }
+  const MapSampleColumns* mapColumns = map_columns.get();
+  // blocks of the gain map holding one value are filled in without interpolation, a constant map
+  // fills the row gains once per job
+  const FlatGainMapBlocks flatBlocks(gainmap_img, map_scale_factor);
   float display_boost = (std::min)(max_display_boost, gainmap_metadata->hdr_capacity_max);
 
   float gainmap_weight;
@@ -1451,10 +3863,178 @@ uhdr_error_info_t JpegR::applyGainMap(uhdr_raw_image_t* sdr_intent, uhdr_raw_ima
   } else {
     gainmap_weight = 1.0f;
   }
-  GainLUT gainLUT(gainmap_metadata, gainmap_weight);
+  // at a zero weight every gain applies as 1.0, the map is not sampled at all
+  const int32_t constant_gain = gainmap_weight == 0.0f ? 0 : flatBlocks.mConstant;
+  // the output rows are packed, P010 output is gathered from the rgb rows it is converted from
+  std::unique_ptr<OutputLuminanceStats> luminance_stats;
+  if (mLuminanceStats != nullptr) {
+    luminance_stats = std::make_unique<OutputLuminanceStats>(
+        ycbcr_output ? UHDR_IMG_FMT_32bppRGBA1010102 : output_format, output_ct, dest->cg,
+        display_boost);
+  }
+  OutputLuminanceStats* luminance = luminance_stats.get();
+
+  // A whole image is processed in a single pass. A strip wise call makes a pass per strip of base
+  // image rows, which the jobs see through pass with rows relative to pass.rowOffset and columns
+  // relative to pass.colOffset.
+  struct {
+    uhdr_raw_image_t* sdr;
+    uhdr_raw_image_t* dest;
+    size_t rowOffset;
+    size_t colOffset;
+    JobQueue* jobQueue;
+  } pass{sdr_intent, dest, 0, 0, nullptr};
+  const int threads = getWorkerCount();
+  // jobs of a P010 output cover whole row pairs
+  const unsigned int row_alignment = ycbcr_output && map_scale_factor_rnd % 2 != 0
+                                         ? 2 * map_scale_factor_rnd
+                                         : map_scale_factor_rnd;
+  auto runPasses = [&](const std::function<void()>& job) -> uhdr_error_info_t {
+    if (pull_sdr_strip == nullptr) {
+      JobQueue jobQueue(sdr_intent->h, row_alignment, threads);
+      pass.jobQueue = &jobQueue;
+      runParallel(job, threads);
+      return CancelToken::check();
+    }
+    uhdr_raw_image_t sdr_strip, dest_strip = *dest;
+    std::unique_ptr<uhdr_raw_image_ext_t> dest_whole, dest_rows;
+    if (push_dest_strip == nullptr) dest_whole = std::make_unique<uhdr_raw_image_ext_t>(*dest);
+    unsigned int row_start;
+    while (true) {
+      UHDR_ERR_CHECK((*pull_sdr_strip)(&sdr_strip, row_start))
+      if (sdr_strip.h == 0) break;
+      // rows of dest the strip is written to, from its first one for a whole image dest
+      const unsigned int dest_first_row = push_dest_strip == nullptr ? row_start : 0;
+      if ((output_map == nullptr && (size_t)dest_first_row + sdr_strip.h > dest->h) ||
+          (ycbcr_output && sdr_strip.h % 2 != 0)) {
+        uhdr_error_info_t status;
+        status.error_code = UHDR_CODEC_ERROR;
+        status.has_detail = 1;
+        snprintf(status.detail, sizeof status.detail,
+                 "received strip of %u rows at row %u, output holds %u rows", sdr_strip.h,
+                 dest_first_row, dest->h);
+        return status;
+      }
+      if (push_dest_strip == nullptr) {
+        // dest holds the whole image, the strip is written to its rows in place
+        dest_rows = std::make_unique<uhdr_raw_image_ext_t>(*dest_whole, 0, row_start, dest->w,
+                                                           sdr_strip.h);
+        dest_strip = *dest_rows;
+      } else if (output_map == nullptr) {
+        dest_strip.h = sdr_strip.h;
+      }
+      JobQueue jobQueue(sdr_strip.h, row_alignment, threads);
+      pass.sdr = &sdr_strip;
+      pass.dest = &dest_strip;
+      pass.rowOffset = row_start;
+      pass.colOffset = col_offset;
+      pass.jobQueue = &jobQueue;
+      runParallel(job, threads);
+      UHDR_ERR_CHECK(CancelToken::check());
+      if (push_dest_strip != nullptr) {
+        UHDR_ERR_CHECK((*push_dest_strip)(&dest_strip, row_start))
+      }
+    }
+    return g_no_error;
+  };
+
+  if (output_ct == UHDR_CT_SRGB) {
+    // 8-bit output, the whole pipeline stays in fixed point from sdr codes to output codes
+    std::shared_ptr<GainLUTFixed> gain_lut_fixed =
+        tableCache.getGainLUTFixed(gainmap_metadata, gainmap_weight, display_boost);
+    const GainLUTFixed& gainLUTFixed = *gain_lut_fixed;
+    std::shared_ptr<ShepardsIDWFixed> idw_table_fixed =
+        tableCache.getIdwTableFixed(map_scale_factor_rnd);
+    const ShepardsIDWFixed& idwTableFixed = *idw_table_fixed;
+    const bool is_multichannel = gainmap_img->fmt != UHDR_IMG_FMT_8bppYCbCr400;
+
+    std::function<void()> applyRecMapFixed = [&pass, gainmap_img, &idwTableFixed, &gainLUTFixed,
+                                              map_scale_factor_rnd, mapColumns, &flatBlocks,
+                                              constant_gain, is_multichannel, output_map,
+                                              luminance]() -> void {
+      auto toGainFixed = [](float gain) {
+        return static_cast<uint32_t>(
+            CLIP3(gain * (kGainFixedNumEntries - 1) + 0.5f, 0, kGainFixedNumEntries - 1));
+      };
+      const uhdr_raw_image_t* sdr_rows = pass.sdr;
+      uhdr_raw_image_t* dest_rows = pass.dest;
+      unsigned int rowStart, rowEnd;
+      // gain map samples of the current row, fractional map scale factors sample them in float
+      const int gain_channels = is_multichannel ? 3 : 1;
+      std::vector<uint32_t> row_gains(sdr_rows->w * gain_channels);
+      std::vector<float> row_gains_float(mapColumns != nullptr ? row_gains.size() : 0);
+      const bool constant = constant_gain >= 0;
+      if (constant) flatBlocks.fillRowFixed(constant_gain, sdr_rows->w, row_gains.data());
+      // rows of a mapped output are made here and placed in dest from there
+      std::vector<uint32_t> mapped_row(output_map != nullptr ? sdr_rows->w : 0);
+      LuminanceTotals luminance_totals;
+
+      while (pass.jobQueue->dequeueJob(rowStart, rowEnd)) {
+        for (size_t y = rowStart; y < rowEnd; ++y) {
+          const size_t map_y = y + pass.rowOffset;
+          const size_t map_x0 = pass.colOffset;
+          const uint8_t* src = static_cast<uint8_t*>(sdr_rows->planes[UHDR_PLANE_PACKED]) +
+                               y * sdr_rows->stride[UHDR_PLANE_PACKED] * 4;
+          uint8_t* dst = output_map != nullptr
+                             ? reinterpret_cast<uint8_t*>(mapped_row.data())
+                             : static_cast<uint8_t*>(dest_rows->planes[UHDR_PLANE_PACKED]) +
+                                   y * dest_rows->stride[UHDR_PLANE_PACKED] * 4;
+          for (size_t x = 0; x < sdr_rows->w && !constant;) {
+            int32_t value = -1;
+            const size_t span_end =
+                flatBlocks.mFlatBlocks > 0
+                    ? flatBlocks.span(map_x0 + x, map_y, map_x0 + sdr_rows->w, value) - map_x0
+                    : sdr_rows->w;
+            uint32_t* gains = row_gains.data() + x * gain_channels;
+            if (value >= 0) {
+              flatBlocks.fillRowFixed(value, span_end - x, gains);
+            } else if (mapColumns == nullptr) {
+              sampleMapRowFixed(gainmap_img, map_scale_factor_rnd, map_x0 + x, map_y,
+                                span_end - x, idwTableFixed, gains);
+            } else {
+              sampleMapRow(gainmap_img, *mapColumns, map_x0 + x, map_y, span_end - x,
+                           row_gains_float.data());
+              for (size_t i = 0; i < (span_end - x) * gain_channels; i++) {
+                gains[i] = toGainFixed(row_gains_float[i]);
+              }
+            }
+            x = span_end;
+          }
+          for (size_t x = 0; x < sdr_rows->w; ++x) {
+            uint32_t gain[3];
+            const uint32_t* row_gain = row_gains.data() + x * gain_channels;
+            for (int c = 0; c < gain_channels; c++) gain[c] = row_gain[c];
+            if (!is_multichannel) gain[1] = gain[2] = gain[0];
+
+            for (int c = 0; c < 3; c++) {
+              uint16_t e = applyGainFixed(srgbInvOetfFixed(src[4 * x + c]), gain[c], gainLUTFixed);
+              dst[4 * x + c] = srgbOetfFixed(e);
+            }
+            dst[4 * x + 3] = src[4 * x + 3];
+          }
+          if (luminance != nullptr) {
+            uhdr_raw_image_t out_row = *dest_rows;
+            out_row.planes[UHDR_PLANE_PACKED] = dst;
+            luminance->addRow(&out_row, 0, sdr_rows->w, luminance_totals);
+          }
+          if (output_map != nullptr) {
+            placeMappedRow(*output_map, mapped_row.data(), y, sdr_rows->w, dest_rows);
+          }
+        }
+      }
+      if (luminance != nullptr) luminance->merge(luminance_totals);
+    };
+
+    UHDR_ERR_CHECK(runPasses(applyRecMapFixed))
+    if (luminance != nullptr) luminance->store(mLuminanceStats);
+    return g_no_error;
+  }
 
-  GetPixelFn get_pixel_fn = getPixelFn(sdr_intent->fmt);
-  if (get_pixel_fn == nullptr) {
+  std::shared_ptr<GainLUT> gain_lut = tableCache.getGainLUT(gainmap_metadata, gainmap_weight);
+  GainLUT& gainLUT = *gain_lut;
+
+  GetRowFn get_row_fn = getRowFn(sdr_intent->fmt);
+  if (get_row_fn == nullptr) {
     uhdr_error_info_t status;
     status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
     status.has_detail = 1;
@@ -1463,126 +4043,385 @@ uhdr_error_info_t JpegR::applyGainMap(uhdr_raw_image_t* sdr_intent, uhdr_raw_ima
     return status;
   }
 
-  JobQueue jobQueue;
-  std::function<void()> applyRecMap = [sdr_intent, gainmap_img, dest, &jobQueue, &idwTable,
-                                       output_ct, &gainLUT, gainmap_metadata,
-#if !USE_APPLY_GAIN_LUT
-                                       gainmap_weight,
+  // The row kernels cover the common case of a jpeg decoded sdr intent and a single channel gain
+  // map; everything else and the right edge of each row take the scalar path below.
+  ApplyGainMapRowFn apply_gain_map_row = nullptr;
+#if USE_SRGB_INVOETF_LUT && USE_APPLY_GAIN_LUT && USE_HLG_OETF_LUT && USE_PQ_OETF_LUT
+  if (sdr_intent->fmt == UHDR_IMG_FMT_12bppYCbCr420 &&
+      gainmap_img->fmt == UHDR_IMG_FMT_8bppYCbCr400 &&
+      map_scale_factor == floorf(map_scale_factor)) {
+    apply_gain_map_row = getDspFunctions().applyGainMapRow;
+    // half precision arithmetic is within the error the approximate mode already accepts
+    if (mApproximateGainMap && output_ct == UHDR_CT_LINEAR &&
+        getDspFunctions().applyGainMapRowHalf != nullptr) {
+      apply_gain_map_row = getDspFunctions().applyGainMapRowHalf;
+    }
+  }
 #endif
-                                       map_scale_factor, get_pixel_fn]() -> void {
-    unsigned int width = sdr_intent->w;
-    unsigned int rowStart, rowEnd;
+  if (apply_gain_map_row == nullptr) countSlowPath(mStats, UHDR_SLOW_PATH_SCALAR_APPLY);
 
-    while (jobQueue.dequeueJob(rowStart, rowEnd)) {
-      for (size_t y = rowStart; y < rowEnd; ++y) {
-        for (size_t x = 0; x < width; ++x) {
-          Color yuv_gamma_sdr = get_pixel_fn(sdr_intent, x, y);
-          // Assuming the sdr image is a decoded JPEG, we should always use Rec.601 YUV coefficients
-          Color rgb_gamma_sdr = p3YuvToRgb(yuv_gamma_sdr);
-          // We are assuming the SDR base image is always sRGB transfer.
-#if USE_SRGB_INVOETF_LUT
-          Color rgb_sdr = srgbInvOetfLUT(rgb_gamma_sdr);
-#else
-          Color rgb_sdr = srgbInvOetf(rgb_gamma_sdr);
-#endif
-          Color rgb_hdr;
-          if (gainmap_img->fmt == UHDR_IMG_FMT_8bppYCbCr400) {
-            float gain;
+  const bool is_multichannel = gainmap_img->fmt != UHDR_IMG_FMT_8bppYCbCr400;
+  ApplyGainMapPixelsFn apply_gain_map_pixels = getApplyGainMapPixelsFn(is_multichannel, output_ct);
+  if (apply_gain_map_pixels == nullptr) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "No implementation available for applying the gain map for color transfer %d",
+             output_ct);
+    return status;
+  }
 
-            if (map_scale_factor != floorf(map_scale_factor)) {
-              gain = sampleMap(gainmap_img, map_scale_factor, x, y);
-            } else {
-              gain = sampleMap(gainmap_img, map_scale_factor, x, y, idwTable);
-            }
+  // In the approximate mode the scalar path of single channel gain maps reads the whole mapping
+  // from a table. The row kernels are left in place, they are exact and faster still.
+  std::shared_ptr<GainMapOutputLUT> output_lut;
+  ApplyGainMapPixelsApproxFn apply_gain_map_pixels_approx = nullptr;
+  if (mApproximateGainMap && !is_multichannel && gamut_conversion == nullptr) {
+    apply_gain_map_pixels_approx = getApplyGainMapPixelsApproxFn(output_ct);
+    output_lut = tableCache.getGainMapOutputLUT(gainmap_metadata, gainmap_weight, output_ct);
+  }
+  const GainMapOutputLUT* outputLUT = output_lut.get();
 
-#if USE_APPLY_GAIN_LUT
-            rgb_hdr = applyGainLUT(rgb_sdr, gain, gainLUT, gainmap_metadata);
-#else
-            rgb_hdr = applyGain(rgb_sdr, gain, gainmap_metadata, gainmap_weight);
-#endif
-          } else {
-            Color gain;
+  // the dispatched kernel covers a subset of the conversions, the scalar one the rest. Formats
+  // and gamut are fixed above, the conversion of a row pair does not fail otherwise.
+  auto convert_fn = getDspFunctions().convertRawInputToYcbcr;
+  auto convert_rgb_pair = [convert_fn](uhdr_raw_image_t* src, uhdr_raw_image_t* dst) {
+    if (convert_fn == nullptr ||
+        convert_fn(src, dst).error_code == UHDR_CODEC_UNSUPPORTED_FEATURE) {
+      convert_raw_input_to_ycbcr(src, dst);
+    }
+  };
 
-            if (map_scale_factor != floorf(map_scale_factor)) {
-              gain = sampleMap3Channel(gainmap_img, map_scale_factor, x, y,
-                                       gainmap_img->fmt == UHDR_IMG_FMT_32bppRGBA8888);
-            } else {
-              gain = sampleMap3Channel(gainmap_img, map_scale_factor, x, y, idwTable,
-                                       gainmap_img->fmt == UHDR_IMG_FMT_32bppRGBA8888);
-            }
+  std::function<void()> applyRecMap = [&pass, gainmap_img, &idwTable, output_ct, &gainLUT,
+                                       gainmap_metadata, gainmap_weight, apply_gain_map_row,
+                                       apply_gain_map_pixels, map_scale_factor_rnd, mapColumns,
+                                       &flatBlocks, constant_gain, is_multichannel, get_row_fn,
+                                       ycbcr_output, convert_rgb_pair, gamut_conversion,
+                                       &gamut_matrix, apply_gain_map_pixels_approx, outputLUT,
+                                       output_map, luminance]() -> void {
+    uhdr_raw_image_t* sdr_rows = pass.sdr;
+    uhdr_raw_image_t* dest_rows = pass.dest;
+    unsigned int width = sdr_rows->w;
+    unsigned int rowStart, rowEnd;
 
-#if USE_APPLY_GAIN_LUT
-            rgb_hdr = applyGainLUT(rgb_sdr, gain, gainLUT, gainmap_metadata);
-#else
-            rgb_hdr = applyGain(rgb_sdr, gain, gainmap_metadata, gainmap_weight);
-#endif
-          }
+    // the row kernels address every image with the same pixel index, so they are handed the gain
+    // map starting at the gain map sample of the first pixel of the pass
+    ApplyGainMapRowFn row_fn = nullptr;
+    uhdr_raw_image_t gainmap_rows = *gainmap_img;
+    const size_t map_row_offset = pass.rowOffset / map_scale_factor_rnd;
+    const size_t map_col_offset = pass.colOffset / map_scale_factor_rnd;
+    if (apply_gain_map_row != nullptr && pass.rowOffset % map_scale_factor_rnd == 0 &&
+        pass.colOffset % map_scale_factor_rnd == 0 && map_row_offset < gainmap_img->h &&
+        map_col_offset < gainmap_img->w) {
+      row_fn = apply_gain_map_row;
+      gainmap_rows.planes[UHDR_PLANE_Y] = static_cast<uint8_t*>(gainmap_img->planes[UHDR_PLANE_Y]) +
+                                          map_row_offset * gainmap_img->stride[UHDR_PLANE_Y] +
+                                          map_col_offset;
+      gainmap_rows.w -= map_col_offset;
+      gainmap_rows.h -= map_row_offset;
+    }
 
-          size_t pixel_idx = x + y * dest->stride[UHDR_PLANE_PACKED];
+    // gain map samples of the current row
+    const int gain_channels = is_multichannel ? 3 : 1;
+    std::vector<float> row_gains((size_t)width * gain_channels);
+    const bool constant = constant_gain >= 0;
+    if (constant) flatBlocks.fillRow(constant_gain, width, row_gains.data());
+    // sdr samples of the current row
+    std::vector<float> row_samples((size_t)width * 3);
+    float* sdr_row[3] = {row_samples.data(), row_samples.data() + width,
+                         row_samples.data() + 2 * width};
+
+    // For P010 output, rows are written to a two row rgb scratch. Its row views have a zero
+    // stride, so that the kernels writing row y land in the scratch row of the parity of y.
+    std::unique_ptr<uhdr_raw_image_ext_t> rgb_pair;
+    uhdr_raw_image_t rgb_row[2];
+    const uhdr_raw_image_ext_t dest_ext(*dest_rows);
+    if (ycbcr_output) {
+      rgb_pair = std::make_unique<uhdr_raw_image_ext_t>(UHDR_IMG_FMT_32bppRGBA1010102,
+                                                        dest_rows->cg, output_ct,
+                                                        UHDR_CR_FULL_RANGE, width, 2, 1);
+      for (int i = 0; i < 2; i++) {
+        rgb_row[i] = *rgb_pair;
+        rgb_row[i].planes[UHDR_PLANE_PACKED] =
+            static_cast<uint32_t*>(rgb_pair->planes[UHDR_PLANE_PACKED]) +
+            i * rgb_pair->stride[UHDR_PLANE_PACKED];
+        rgb_row[i].stride[UHDR_PLANE_PACKED] = 0;
+      }
+    }
+    // rows of a mapped output are written to a one row scratch of the same zero stride views, and
+    // placed in dest from there
+    std::unique_ptr<uhdr_raw_image_ext_t> mapped_scratch;
+    uhdr_raw_image_t mapped_row;
+    if (output_map != nullptr) {
+      mapped_scratch = std::make_unique<uhdr_raw_image_ext_t>(
+          dest_rows->fmt, dest_rows->cg, output_ct, dest_rows->range, width, 1, 1);
+      mapped_row = *mapped_scratch;
+      mapped_row.stride[UHDR_PLANE_PACKED] = 0;
+    }
+    LuminanceTotals luminance_totals;
 
-          switch (output_ct) {
-            case UHDR_CT_LINEAR: {
-              uint64_t rgba_f16 = colorToRgbaF16(rgb_hdr);
-              reinterpret_cast<uint64_t*>(dest->planes[UHDR_PLANE_PACKED])[pixel_idx] = rgba_f16;
-              break;
-            }
-            case UHDR_CT_HLG: {
-#if USE_HLG_OETF_LUT
-              ColorTransformFn hdrOetf = hlgOetfLUT;
-#else
-              ColorTransformFn hdrOetf = hlgOetf;
-#endif
-              rgb_hdr = rgb_hdr * kSdrWhiteNits / kHlgMaxNits;
-              rgb_hdr = hlgInverseOotfApprox(rgb_hdr);
-              Color rgb_gamma_hdr = hdrOetf(rgb_hdr);
-              uint32_t rgba_1010102 = colorToRgba1010102(rgb_gamma_hdr);
-              reinterpret_cast<uint32_t*>(dest->planes[UHDR_PLANE_PACKED])[pixel_idx] =
-                  rgba_1010102;
-              break;
-            }
-            case UHDR_CT_PQ: {
-#if USE_PQ_OETF_LUT
-              ColorTransformFn hdrOetf = pqOetfLUT;
-#else
-              ColorTransformFn hdrOetf = pqOetf;
-#endif
-              rgb_hdr = rgb_hdr * kSdrWhiteNits / kPqMaxNits;
-              Color rgb_gamma_hdr = hdrOetf(rgb_hdr);
-              uint32_t rgba_1010102 = colorToRgba1010102(rgb_gamma_hdr);
-              reinterpret_cast<uint32_t*>(dest->planes[UHDR_PLANE_PACKED])[pixel_idx] =
-                  rgba_1010102;
-              break;
-            }
-            default: {
-            }
-              // Should be impossible to hit after input validation.
+    while (pass.jobQueue->dequeueJob(rowStart, rowEnd)) {
+      for (size_t y = rowStart; y < rowEnd; ++y) {
+        const size_t map_y = y + pass.rowOffset;
+        const size_t map_x0 = pass.colOffset;
+        uhdr_raw_image_t* out_rows =
+            ycbcr_output ? &rgb_row[y % 2] : output_map != nullptr ? &mapped_row : dest_rows;
+        size_t x = 0;
+        if (row_fn != nullptr) {
+          x = row_fn(sdr_rows, &gainmap_rows, out_rows, map_scale_factor_rnd, idwTable, gainLUT,
+                     gainmap_metadata, output_ct,
+                     gamut_conversion != nullptr ? gamut_matrix.data() : nullptr, y);
+        }
+        if (x < width && !constant) {
+          sampleGainMapRow(gainmap_img, flatBlocks, map_scale_factor_rnd, idwTable, mapColumns,
+                           map_x0 + x, map_y, width - x, row_gains.data() + x * gain_channels);
+        }
+        if (x < width) {
+          float* sdr_dst[3] = {sdr_row[0] + x, sdr_row[1] + x, sdr_row[2] + x};
+          get_row_fn(sdr_rows, x, y, width - x, sdr_dst);
+        }
+        if (apply_gain_map_pixels_approx != nullptr) {
+          apply_gain_map_pixels_approx(sdr_row, row_gains.data(), *outputLUT, out_rows, y, x,
+                                       width);
+        } else {
+          apply_gain_map_pixels(sdr_row, row_gains.data(), gainLUT, gainmap_metadata,
+                                gainmap_weight, gamut_conversion, out_rows, y, x, width);
+        }
+        if (luminance != nullptr) luminance->addRow(out_rows, y, width, luminance_totals);
+        if (ycbcr_output && y % 2 == 1) {
+          uhdr_raw_image_ext_t dest_pair(dest_ext, 0, y - 1, width, 2);
+          convert_rgb_pair(rgb_pair.get(), &dest_pair);
+        }
+        if (output_map != nullptr) {
+          placeMappedRow(*output_map, mapped_row.planes[UHDR_PLANE_PACKED], y, width, dest_rows);
+        }
+      }
+    }
+    if (luminance != nullptr) luminance->merge(luminance_totals);
+  };
+
+  UHDR_ERR_CHECK(runPasses(applyRecMap))
+  if (luminance != nullptr) luminance->store(mLuminanceStats);
+  return g_no_error;
+}
+
+uhdr_error_info_t JpegR::applyGainMapRenditions(
+    uhdr_raw_image_t* sdr_intent, uhdr_raw_image_t* gainmap_img,
+    uhdr_gainmap_metadata_ext_t* gainmap_metadata, float max_display_boost,
+    const std::vector<const RenditionDesc*>& renditions) {
+  UHDR_TRACE_SCOPE("JpegR::applyGainMapRenditions");
+  const uhdr_color_gamut_t base_cg =
+      sdr_intent->cg == UHDR_CG_UNSPECIFIED ? UHDR_CG_BT_709 : sdr_intent->cg;
+  ColorTransformFn gamut_conversion = nullptr;
+  if (mOutputCg != UHDR_CG_UNSPECIFIED && mOutputCg != base_cg) {
+    gamut_conversion = getGamutConversionFn(mOutputCg, base_cg);
+  }
+  GetRowFn get_row_fn = getRowFn(sdr_intent->fmt);
+  const float primary_aspect_ratio = (float)sdr_intent->w / sdr_intent->h;
+  const float gainmap_aspect_ratio = (float)gainmap_img->w / gainmap_img->h;
+
+  // anything off the common path, including all invalid input, is left to applyGainMap()
+  bool shared = gainmap_metadata->version.compare(kJpegrVersion) == 0 &&
+                (sdr_intent->fmt == UHDR_IMG_FMT_24bppYCbCr444 ||
+                 sdr_intent->fmt == UHDR_IMG_FMT_16bppYCbCr422 ||
+                 sdr_intent->fmt == UHDR_IMG_FMT_12bppYCbCr420) &&
+                (gainmap_img->fmt == UHDR_IMG_FMT_8bppYCbCr400 ||
+                 gainmap_img->fmt == UHDR_IMG_FMT_24bppRGB888 ||
+                 gainmap_img->fmt == UHDR_IMG_FMT_32bppRGBA8888) &&
+                fabs(primary_aspect_ratio - gainmap_aspect_ratio) / primary_aspect_ratio <= 0.01f &&
+                (mOutputCg == UHDR_CG_UNSPECIFIED || mOutputCg == base_cg ||
+                 gamut_conversion != nullptr) &&
+                get_row_fn != nullptr;
+  for (const RenditionDesc* r : renditions) {
+    shared = shared && r->dest->w == sdr_intent->w && r->dest->h == sdr_intent->h &&
+             ((r->output_ct == UHDR_CT_LINEAR &&
+               r->output_format == UHDR_IMG_FMT_64bppRGBAHalfFloat) ||
+              ((r->output_ct == UHDR_CT_HLG || r->output_ct == UHDR_CT_PQ) &&
+               r->output_format == UHDR_IMG_FMT_32bppRGBA1010102));
+  }
+  if (!shared) {
+    for (const RenditionDesc* r : renditions) {
+      UHDR_ERR_CHECK(applyGainMap(sdr_intent, gainmap_img, gainmap_metadata, r->output_ct,
+                                  r->output_format, r->max_display_boost, r->dest))
+    }
+    return g_no_error;
+  }
+  UHDR_ERR_CHECK(uhdr_validate_gainmap_metadata_descriptor(gainmap_metadata));
+  StageTimer timer(mStats, UHDR_STAGE_GAINMAP_APPLY);
+  // Subsampled multi-channel maps are sampled from a planar copy, see GainMapPlanes. A map at the
+  // resolution of the image is read in place, every pixel takes its own sample in order.
+  std::unique_ptr<uhdr_raw_image_ext_t> planar_gainmap;
+  if (gainmap_img->w < sdr_intent->w) planar_gainmap = planar_gain_map(gainmap_img);
+  if (planar_gainmap != nullptr) gainmap_img = planar_gainmap.get();
+
+  const float map_scale_factor = (float)sdr_intent->w / gainmap_img->w;
+  const int map_scale_factor_rnd = (std::max)(1, (int)std::roundf(map_scale_factor));
+  const bool use_idw = map_scale_factor == floorf(map_scale_factor);
+  const bool is_multichannel = gainmap_img->fmt != UHDR_IMG_FMT_8bppYCbCr400;
+  GainMapTableCache& tableCache = GainMapTableCache::getDefaultCache();
+  std::shared_ptr<ShepardsIDW> idw_table = tableCache.getIdwTable(map_scale_factor_rnd);
+  ShepardsIDW& idwTable = *idw_table;
+  std::unique_ptr<MapSampleColumns> map_columns;
+  if (!use_idw) {
+    map_columns = std::make_unique<MapSampleColumns>(gainmap_img, map_scale_factor, sdr_intent->w);
+    countSlowPath(mStats, UHDR_SLOW_PATH_FRACTIONAL_SCALE);
+  }
+  const FlatGainMapBlocks flatBlocks(gainmap_img, map_scale_factor);
+  const float display_boost = (std::min)(max_display_boost, gainmap_metadata->hdr_capacity_max);
+  float gainmap_weight = 1.0f;
+  if (display_boost != gainmap_metadata->hdr_capacity_max) {
+    gainmap_weight =
+        (log2(display_boost) - log2(gainmap_metadata->hdr_capacity_min)) /
+        (log2(gainmap_metadata->hdr_capacity_max) - log2(gainmap_metadata->hdr_capacity_min));
+    gainmap_weight = CLIP3(0.0f, gainmap_weight, 1.0f);
+  }
+  const int32_t constant_gain = gainmap_weight == 0.0f ? 0 : flatBlocks.mConstant;
+  std::shared_ptr<GainLUT> gain_lut = tableCache.getGainLUT(gainmap_metadata, gainmap_weight);
+  GainLUT& gainLUT = *gain_lut;
+  GainMapRowToLinearFn row_to_linear =
+      is_multichannel ? gainMapRowToLinear<3> : gainMapRowToLinear<1>;
+  for (const RenditionDesc* r : renditions) {
+    r->dest->cg = gamut_conversion != nullptr ? mOutputCg : sdr_intent->cg;
+  }
+
+  const int threads = getWorkerCount();
+  JobQueue jobQueue(sdr_intent->h, map_scale_factor_rnd, threads);
+  std::function<void()> applyRecMap = [&]() -> void {
+    const size_t width = sdr_intent->w;
+    std::vector<float> row_gains(width * (is_multichannel ? 3 : 1));
+    const bool constant = constant_gain >= 0;
+    if (constant) flatBlocks.fillRow(constant_gain, width, row_gains.data());
+    std::vector<float> row_samples(width * 3);
+    float* row[3] = {row_samples.data(), row_samples.data() + width,
+                     row_samples.data() + 2 * width};
+    unsigned int rowStart, rowEnd;
+    while (jobQueue.dequeueJob(rowStart, rowEnd)) {
+      for (size_t y = rowStart; y < rowEnd; ++y) {
+        if (!constant) {
+          sampleGainMapRow(gainmap_img, flatBlocks, map_scale_factor_rnd, idwTable,
+                           map_columns.get(), 0, y, width, row_gains.data());
+        }
+        get_row_fn(sdr_intent, 0, y, width, row);
+        row_to_linear(row, row_gains.data(), gainLUT, gainmap_metadata, gainmap_weight,
+                      gamut_conversion, width);
+        // the linear row is computed once, each rendition only encodes it
+        for (const RenditionDesc* r : renditions) {
+          const size_t offset = y * r->dest->stride[UHDR_PLANE_PACKED];
+          if (r->output_ct == UHDR_CT_LINEAR) {
+            uint64_t* dst = reinterpret_cast<uint64_t*>(r->dest->planes[UHDR_PLANE_PACKED]);
+            floatToRgbaF16Row(row, width, dst + offset);
+            continue;
+          }
+          uint32_t* dst = reinterpret_cast<uint32_t*>(r->dest->planes[UHDR_PLANE_PACKED]) + offset;
+          for (size_t x = 0; x < width; ++x) {
+            Color rgb_hdr = {{{row[0][x], row[1][x], row[2][x]}}};
+            dst[x] = r->output_ct == UHDR_CT_HLG ? linearToRgba1010102<UHDR_CT_HLG>(rgb_hdr)
+                                                 : linearToRgba1010102<UHDR_CT_PQ>(rgb_hdr);
           }
         }
       }
     }
   };
+  runParallel(applyRecMap, threads);
+  return CancelToken::check();
+}
 
-  const int threads = (std::min)(GetCPUCoreCount(), 4u);
-  std::vector<std::thread> workers;
-  for (int th = 0; th < threads - 1; th++) {
-    workers.push_back(std::thread(applyRecMap));
+uhdr_error_info_t JpegR::decodeJPEGRRenditions(uhdr_compressed_image_t* uhdr_compressed_img,
+                                               const std::vector<RenditionDesc>& renditions,
+                                               uhdr_raw_image_t* gainmap_img,
+                                               uhdr_gainmap_metadata_t* gainmap_metadata) {
+  UHDR_TRACE_SCOPE("JpegR::decodeJPEGRRenditions");
+  std::unique_ptr<uhdr_raw_image_ext_t> sdr_intent, gainmap;
+  uhdr_gainmap_metadata_ext_t metadata;
+  bool has_hdr = false, has_sdr = false;
+  for (const RenditionDesc& r : renditions) {
+    (r.output_ct == UHDR_CT_SRGB ? has_sdr : has_hdr) = true;
+  }
+
+  if (has_hdr) {
+    UHDR_ERR_CHECK(
+        decodeJPEGRSources(uhdr_compressed_img, UHDR_CT_LINEAR, sdr_intent, gainmap, &metadata))
+    // packed renditions of the same effective display boost share a sweep, P010 ones are
+    // converted from rgb in applyGainMap() and rendered alone
+    std::vector<bool> done(renditions.size(), false);
+    for (size_t i = 0; i < renditions.size(); i++) {
+      const RenditionDesc& r = renditions[i];
+      if (r.output_ct == UHDR_CT_SRGB || done[i]) continue;
+      std::vector<const RenditionDesc*> group{&r};
+      const float boost = (std::min)(r.max_display_boost, metadata.hdr_capacity_max);
+      for (size_t j = i + 1; j < renditions.size(); j++) {
+        const RenditionDesc& other = renditions[j];
+        if (r.output_format != UHDR_IMG_FMT_24bppYCbCrP010 && !done[j] &&
+            other.output_ct != UHDR_CT_SRGB &&
+            other.output_format != UHDR_IMG_FMT_24bppYCbCrP010 &&
+            (std::min)(other.max_display_boost, metadata.hdr_capacity_max) == boost) {
+          group.push_back(&other);
+          done[j] = true;
+        }
+      }
+      if (group.size() > 1) {
+        UHDR_ERR_CHECK(applyGainMapRenditions(sdr_intent.get(), gainmap.get(), &metadata,
+                                              r.max_display_boost, group))
+      } else {
+        UHDR_ERR_CHECK(applyGainMap(sdr_intent.get(), gainmap.get(), &metadata, r.output_ct,
+                                    r.output_format, r.max_display_boost, r.dest))
+      }
+    }
   }
-  const unsigned int rowStep = threads == 1 ? sdr_intent->h : map_scale_factor_rnd;
-  for (unsigned int rowStart = 0; rowStart < sdr_intent->h;) {
-    unsigned int rowEnd = (std::min)(rowStart + rowStep, sdr_intent->h);
-    jobQueue.enqueueJob(rowStart, rowEnd);
-    rowStart = rowEnd;
+
+  if (has_sdr) {
+    // sdr renditions start from the base image decoded to rgb
+    UHDR_ERR_CHECK(
+        decodeJPEGRSources(uhdr_compressed_img, UHDR_CT_SRGB, sdr_intent, gainmap, &metadata))
+    for (const RenditionDesc& r : renditions) {
+      if (r.output_ct != UHDR_CT_SRGB) continue;
+      if (r.max_display_boost > 1.0f && r.max_display_boost != FLT_MAX) {
+        UHDR_ERR_CHECK(applyGainMap(sdr_intent.get(), gainmap.get(), &metadata, r.output_ct,
+                                    r.output_format, r.max_display_boost, r.dest))
+      } else {
+        UHDR_ERR_CHECK(copyRawImage(sdr_intent.get(), r.dest))
+      }
+    }
   }
-  jobQueue.markQueueForEnd();
-  applyRecMap();
-  std::for_each(workers.begin(), workers.end(), [](std::thread& t) { t.join(); });
 
+  if (gainmap_img != nullptr && gainmap != nullptr) {
+    UHDR_ERR_CHECK(copyRawImage(gainmap.get(), gainmap_img))
+  }
+  if (gainmap_metadata != nullptr) {
+    gainmap_metadata->min_content_boost = metadata.min_content_boost;
+    gainmap_metadata->max_content_boost = metadata.max_content_boost;
+    gainmap_metadata->gamma = metadata.gamma;
+    gainmap_metadata->offset_sdr = metadata.offset_sdr;
+    gainmap_metadata->offset_hdr = metadata.offset_hdr;
+    gainmap_metadata->hdr_capacity_min = metadata.hdr_capacity_min;
+    gainmap_metadata->hdr_capacity_max = metadata.hdr_capacity_max;
+  }
   return g_no_error;
 }
 
 uhdr_error_info_t JpegR::extractPrimaryImageAndGainMap(uhdr_compressed_image_t* jpegr_image,
                                                        uhdr_compressed_image_t* primary_image,
                                                        uhdr_compressed_image_t* gainmap_image) {
+  // the mpf index of the primary image records where both images are, so only its headers are
+  // read. The whole stream is walked only if the index is absent or does not check out.
+  uint8_t* data = static_cast<uint8_t*>(jpegr_image->data);
+  jpeg_header_view_t primary_view;
+  size_t primary_size, secondary_offset, secondary_size;
+  if (JpegDecoderHelper::scanHeaders(data, jpegr_image->data_sz, primary_view).error_code ==
+          UHDR_CODEC_OK &&
+      locateSecondaryImage(data, jpegr_image->data_sz, primary_view, primary_size,
+                           secondary_offset, secondary_size)) {
+    if (primary_image != nullptr) {
+      primary_image->data = data;
+      primary_image->data_sz = primary_size;
+    }
+    if (gainmap_image != nullptr) {
+      gainmap_image->data = data + secondary_offset;
+      gainmap_image->data_sz = secondary_size;
+    }
+    return g_no_error;
+  }
+
   MessageHandler msg_handler;
   msg_handler.SetMessageWriter(make_unique<AlogMessageWriter>(AlogMessageWriter()));
 
@@ -1691,6 +4530,7 @@ uhdr_error_info_t JpegR::parseJpegInfo(uhdr_compressed_image_t* jpeg_image, j_in
   return g_no_error;
 }
 
+#ifndef UHDR_DECODER_ONLY
 static float ReinhardMap(float y_hdr, float headroom) {
   float out = 1.0f + y_hdr / (headroom * headroom);
   out /= 1.0f + y_hdr;
@@ -1732,6 +4572,37 @@ uint8_t ScaleTo8Bit(float value) {
 }
 
 uhdr_error_info_t JpegR::toneMap(uhdr_raw_image_t* hdr_intent, uhdr_raw_image_t* sdr_intent) {
+  UHDR_TRACE_SCOPE("JpegR::toneMap");
+  StageTimer timer(mStats, UHDR_STAGE_TONE_MAP);
+  RowRangeFn toneMapRows;
+  UHDR_ERR_CHECK(prepareToneMap(hdr_intent, sdr_intent, toneMapRows));
+
+#ifdef UHDR_ENABLE_GLES
+  if (mUhdrGLESCtxt != nullptr) {
+    uhdr_error_info_t status =
+        toneMapGLES(hdr_intent, sdr_intent, static_cast<uhdr_opengl_ctxt_t*>(mUhdrGLESCtxt));
+    if (status.error_code != UHDR_CODEC_UNSUPPORTED_FEATURE) return status;
+    countSlowPath(mStats, UHDR_SLOW_PATH_GPU_FALLBACK);
+  }
+#endif
+
+  const int threads = getWorkerCount();
+  // for 420 subsampling, process 2 rows at once
+  const int jobSizeInRows = hdr_intent->fmt == UHDR_IMG_FMT_24bppYCbCrP010 ? 2 : 1;
+  JobQueue jobQueue(hdr_intent->h, jobSizeInRows, threads);
+  std::function<void()> toneMapInternal = [&toneMapRows, &jobQueue]() -> void {
+    unsigned int rowStart, rowEnd;
+    while (jobQueue.dequeueJob(rowStart, rowEnd)) toneMapRows(rowStart, rowEnd);
+  };
+
+  // tone map
+  runParallel(toneMapInternal, threads);
+
+  return CancelToken::check();
+}
+
+uhdr_error_info_t JpegR::prepareToneMap(uhdr_raw_image_t* hdr_intent, uhdr_raw_image_t* sdr_intent,
+                                        RowRangeFn& tone_map_rows) {
   if (hdr_intent->fmt != UHDR_IMG_FMT_24bppYCbCrP010 &&
       hdr_intent->fmt != UHDR_IMG_FMT_30bppYCbCr444 &&
       hdr_intent->fmt != UHDR_IMG_FMT_32bppRGBA1010102 &&
@@ -1841,8 +4712,8 @@ uhdr_error_info_t JpegR::toneMap(uhdr_raw_image_t* hdr_intent, uhdr_raw_image_t*
     return status;
   }
 
-  GetPixelFn get_pixel_fn = getPixelFn(hdr_intent->fmt);
-  if (get_pixel_fn == nullptr) {
+  GetRowFn get_row_fn = getRowFn(hdr_intent->fmt);
+  if (get_row_fn == nullptr) {
     uhdr_error_info_t status;
     status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
     status.has_detail = 1;
@@ -1851,10 +4722,10 @@ uhdr_error_info_t JpegR::toneMap(uhdr_raw_image_t* hdr_intent, uhdr_raw_image_t*
     return status;
   }
 
-  PutPixelFn put_pixel_fn = putPixelFn(sdr_intent->fmt);
+  PutRowFn put_row_fn = putRowFn(sdr_intent->fmt);
   // for subsampled formats, we are writing to raw image buffers directly instead of using
-  // put_pixel_fn
-  if (put_pixel_fn == nullptr && sdr_intent->fmt != UHDR_IMG_FMT_12bppYCbCr420) {
+  // put_row_fn
+  if (put_row_fn == nullptr && sdr_intent->fmt != UHDR_IMG_FMT_12bppYCbCr420) {
     uhdr_error_info_t status;
     status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
     status.has_detail = 1;
@@ -1869,18 +4740,16 @@ uhdr_error_info_t JpegR::toneMap(uhdr_raw_image_t* hdr_intent, uhdr_raw_image_t*
 
   ColorTransformFn hdrGamutConversionFn = getGamutConversionFn(sdr_intent->cg, hdr_intent->cg);
 
-  unsigned int height = hdr_intent->h;
-  const int threads = (std::min)(GetCPUCoreCount(), 4u);
-  // for 420 subsampling, process 2 rows at once
-  const int jobSizeInRows = hdr_intent->fmt == UHDR_IMG_FMT_24bppYCbCrP010 ? 2 : 1;
-  unsigned int rowStep = threads == 1 ? height : jobSizeInRows;
-  JobQueue jobQueue;
-  std::function<void()> toneMapInternal;
+  ToneMapRowParams row_params;
+  ToneMapRowFn tone_map_row = nullptr;
+#if USE_HLG_INVOETF_LUT && USE_PQ_INVOETF_LUT
+  if (getToneMapRowParams(hdr_intent, &row_params)) tone_map_row = getDspFunctions().toneMapRow;
+#endif
 
-  toneMapInternal = [hdr_intent, sdr_intent, hdrInvOetf, hdrGamutConversionFn, hdrYuvToRgbFn,
-                     hdr_white_nits, get_pixel_fn, put_pixel_fn, hdrLuminanceFn, hdrOotfFn,
-                     &jobQueue]() -> void {
-    unsigned int rowStart, rowEnd;
+  // rows are processed in pairs for 420 subsampling, so rowStart must be even for p010 input
+  tone_map_rows = [hdr_intent, sdr_intent, hdrInvOetf, hdrGamutConversionFn, hdrYuvToRgbFn,
+                   hdr_white_nits, get_row_fn, put_row_fn, hdrLuminanceFn, hdrOotfFn, tone_map_row,
+                   row_params](unsigned int rowStart, unsigned int rowEnd) -> void {
     const int hfactor = hdr_intent->fmt == UHDR_IMG_FMT_24bppYCbCrP010 ? 2 : 1;
     const int vfactor = hdr_intent->fmt == UHDR_IMG_FMT_24bppYCbCrP010 ? 2 : 1;
     const bool isHdrIntentRgb = isPixelFormatRgb(hdr_intent->fmt);
@@ -1892,81 +4761,88 @@ uhdr_error_info_t JpegR::toneMap(uhdr_raw_image_t* hdr_intent, uhdr_raw_image_t*
     size_t luma_stride = sdr_intent->stride[UHDR_PLANE_Y];
     size_t cb_stride = sdr_intent->stride[UHDR_PLANE_U];
     size_t cr_stride = sdr_intent->stride[UHDR_PLANE_V];
+    // hdr input and sdr output samples of the vfactor rows being processed
+    const size_t width = hdr_intent->w;
+    std::vector<float> row_samples(width * 6 * vfactor);
+    float* hdr_row[2][3];
+    float* sdr_row[2][3];
+    for (int i = 0; i < vfactor; i++) {
+      for (int c = 0; c < 3; c++) {
+        hdr_row[i][c] = row_samples.data() + (i * 3 + c) * width;
+        sdr_row[i][c] = row_samples.data() + ((vfactor + i) * 3 + c) * width;
+      }
+    }
 
-    while (jobQueue.dequeueJob(rowStart, rowEnd)) {
-      for (size_t y = rowStart; y < rowEnd; y += vfactor) {
-        for (size_t x = 0; x < hdr_intent->w; x += hfactor) {
-          // meant for p010 input
-          float sdr_u_gamma = 0.0f;
-          float sdr_v_gamma = 0.0f;
-
-          for (int i = 0; i < vfactor; i++) {
-            for (int j = 0; j < hfactor; j++) {
-              Color hdr_rgb_gamma;
-
-              if (isHdrIntentRgb) {
-                hdr_rgb_gamma = get_pixel_fn(hdr_intent, x + j, y + i);
-              } else {
-                Color hdr_yuv_gamma = get_pixel_fn(hdr_intent, x + j, y + i);
-                hdr_rgb_gamma = hdrYuvToRgbFn(hdr_yuv_gamma);
-              }
-              Color hdr_rgb = hdrInvOetf(hdr_rgb_gamma);
-              hdr_rgb = hdrOotfFn(hdr_rgb, hdrLuminanceFn);
-
-              GlobalTonemapOutputs tonemap_outputs = globalTonemap(
-                  {hdr_rgb.r, hdr_rgb.g, hdr_rgb.b}, hdr_white_nits / kSdrWhiteNits, is_normalized);
-              Color sdr_rgb_linear_bt2100 = {
-                  {{tonemap_outputs.rgb_out[0], tonemap_outputs.rgb_out[1],
-                    tonemap_outputs.rgb_out[2]}}};
-              Color sdr_rgb = hdrGamutConversionFn(sdr_rgb_linear_bt2100);
-
-              // Hard clip out-of-gamut values;
-              sdr_rgb = clampPixelFloat(sdr_rgb);
-
-              Color sdr_rgb_gamma = srgbOetf(sdr_rgb);
-              if (isSdrIntentRgb) {
-                put_pixel_fn(sdr_intent, (x + j), (y + i), sdr_rgb_gamma);
+    for (size_t y = rowStart; y < rowEnd; y += vfactor) {
+      size_t x = 0;
+      if (tone_map_row != nullptr) x = tone_map_row(hdr_intent, sdr_intent, row_params, y);
+      if (x >= width) continue;
+      const size_t x0 = x;
+      for (int i = 0; i < vfactor; i++) {
+        float* hdr_dst[3] = {hdr_row[i][0] + x0, hdr_row[i][1] + x0, hdr_row[i][2] + x0};
+        get_row_fn(hdr_intent, x0, y + i, width - x0, hdr_dst);
+      }
+      for (; x < width; x += hfactor) {
+        // meant for p010 input
+        float sdr_u_gamma = 0.0f;
+        float sdr_v_gamma = 0.0f;
+
+        for (int i = 0; i < vfactor; i++) {
+          for (int j = 0; j < hfactor; j++) {
+            Color hdr_rgb_gamma = {
+                {{hdr_row[i][0][x + j], hdr_row[i][1][x + j], hdr_row[i][2][x + j]}}};
+            if (!isHdrIntentRgb) hdr_rgb_gamma = hdrYuvToRgbFn(hdr_rgb_gamma);
+            Color hdr_rgb = hdrInvOetf(hdr_rgb_gamma);
+            hdr_rgb = hdrOotfFn(hdr_rgb, hdrLuminanceFn);
+
+            GlobalTonemapOutputs tonemap_outputs = globalTonemap(
+                {hdr_rgb.r, hdr_rgb.g, hdr_rgb.b}, hdr_white_nits / kSdrWhiteNits, is_normalized);
+            Color sdr_rgb_linear_bt2100 = {
+                {{tonemap_outputs.rgb_out[0], tonemap_outputs.rgb_out[1],
+                  tonemap_outputs.rgb_out[2]}}};
+            Color sdr_rgb = hdrGamutConversionFn(sdr_rgb_linear_bt2100);
+
+            // Hard clip out-of-gamut values;
+            sdr_rgb = clampPixelFloat(sdr_rgb);
+
+            Color sdr_rgb_gamma = srgbOetf(sdr_rgb);
+            if (isSdrIntentRgb) {
+              sdr_row[i][0][x + j] = sdr_rgb_gamma.r;
+              sdr_row[i][1][x + j] = sdr_rgb_gamma.g;
+              sdr_row[i][2][x + j] = sdr_rgb_gamma.b;
+            } else {
+              Color sdr_yuv_gamma = p3RgbToYuv(sdr_rgb_gamma);
+              sdr_yuv_gamma += {{{0.0f, 0.5f, 0.5f}}};
+              if (sdr_intent->fmt != UHDR_IMG_FMT_12bppYCbCr420) {
+                sdr_row[i][0][x + j] = sdr_yuv_gamma.y;
+                sdr_row[i][1][x + j] = sdr_yuv_gamma.u;
+                sdr_row[i][2][x + j] = sdr_yuv_gamma.v;
               } else {
-                Color sdr_yuv_gamma = p3RgbToYuv(sdr_rgb_gamma);
-                sdr_yuv_gamma += {{{0.0f, 0.5f, 0.5f}}};
-                if (sdr_intent->fmt != UHDR_IMG_FMT_12bppYCbCr420) {
-                  put_pixel_fn(sdr_intent, (x + j), (y + i), sdr_yuv_gamma);
-                } else {
-                  size_t out_y_idx = (y + i) * luma_stride + x + j;
-                  luma_data[out_y_idx] = ScaleTo8Bit(sdr_yuv_gamma.y);
-
-                  sdr_u_gamma += sdr_yuv_gamma.u;
-                  sdr_v_gamma += sdr_yuv_gamma.v;
-                }
+                size_t out_y_idx = (y + i) * luma_stride + x + j;
+                luma_data[out_y_idx] = ScaleTo8Bit(sdr_yuv_gamma.y);
+
+                sdr_u_gamma += sdr_yuv_gamma.u;
+                sdr_v_gamma += sdr_yuv_gamma.v;
               }
             }
           }
-          if (sdr_intent->fmt == UHDR_IMG_FMT_12bppYCbCr420) {
-            sdr_u_gamma /= (hfactor * vfactor);
-            sdr_v_gamma /= (hfactor * vfactor);
-            cb_data[x / hfactor + (y / vfactor) * cb_stride] = ScaleTo8Bit(sdr_u_gamma);
-            cr_data[x / hfactor + (y / vfactor) * cr_stride] = ScaleTo8Bit(sdr_v_gamma);
-          }
+        }
+        if (sdr_intent->fmt == UHDR_IMG_FMT_12bppYCbCr420) {
+          sdr_u_gamma /= (hfactor * vfactor);
+          sdr_v_gamma /= (hfactor * vfactor);
+          cb_data[x / hfactor + (y / vfactor) * cb_stride] = ScaleTo8Bit(sdr_u_gamma);
+          cr_data[x / hfactor + (y / vfactor) * cr_stride] = ScaleTo8Bit(sdr_v_gamma);
+        }
+      }
+      if (sdr_intent->fmt != UHDR_IMG_FMT_12bppYCbCr420) {
+        for (int i = 0; i < vfactor; i++) {
+          float* sdr_src[3] = {sdr_row[i][0] + x0, sdr_row[i][1] + x0, sdr_row[i][2] + x0};
+          put_row_fn(sdr_intent, x0, y + i, width - x0, sdr_src);
         }
       }
     }
   };
 
-  // tone map
-  std::vector<std::thread> workers;
-  for (int th = 0; th < threads - 1; th++) {
-    workers.push_back(std::thread(toneMapInternal));
-  }
-
-  for (unsigned int rowStart = 0; rowStart < height;) {
-    unsigned int rowEnd = (std::min)(rowStart + rowStep, height);
-    jobQueue.enqueueJob(rowStart, rowEnd);
-    rowStart = rowEnd;
-  }
-  jobQueue.markQueueForEnd();
-  toneMapInternal();
-  std::for_each(workers.begin(), workers.end(), [](std::thread& t) { t.join(); });
-
   return g_no_error;
 }
 
@@ -2092,6 +4968,7 @@ status_t JpegR::areInputArgumentsValid(jr_uncompressed_ptr p010_image_ptr,
   }
   return areInputArgumentsValid(p010_image_ptr, yuv420_image_ptr, hdr_tf, dest_ptr);
 }
+#endif  // UHDR_DECODER_ONLY
 
 uhdr_color_transfer_t map_legacy_ct_to_ct(ultrahdr::ultrahdr_transfer_function ct) {
   switch (ct) {
@@ -2134,6 +5011,7 @@ ultrahdr::ultrahdr_color_gamut map_cg_to_legacy_cg(uhdr_color_gamut_t cg) {
   }
 }
 
+#ifndef UHDR_DECODER_ONLY
 /* Encode API-0 */
 status_t JpegR::encodeJPEGR(jr_uncompressed_ptr p010_image_ptr, ultrahdr_transfer_function hdr_tf,
                             jr_compressed_ptr dest, int quality, jr_exif_ptr exif) {
@@ -2479,6 +5357,7 @@ status_t JpegR::encodeJPEGR(jr_compressed_ptr yuv420jpg_image_ptr,
 
   return result.error_code == UHDR_CODEC_OK ? JPEGR_NO_ERROR : JPEGR_UNKNOWN_ERROR;
 }
+#endif  // UHDR_DECODER_ONLY
 
 /* Decode API */
 status_t JpegR::getJPEGRInfo(jr_compressed_ptr jpegr_image_ptr, jr_info_ptr jpegr_image_info_ptr) {
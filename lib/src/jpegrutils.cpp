@@ -15,14 +15,18 @@
  */
 
 #include <algorithm>
+#include <charconv>
+#include <clocale>
 #include <cmath>
+#include <cstdlib>
+#include <sstream>
+#include <string_view>
 
 #include "ultrahdr/ultrahdrcommon.h"
 #include "ultrahdr/jpegr.h"
 #include "ultrahdr/jpegrutils.h"
 
 #include "image_io/xml/xml_reader.h"
-#include "image_io/xml/xml_writer.h"
 #include "image_io/base/message_handler.h"
 #include "image_io/xml/xml_element_rules.h"
 #include "image_io/xml/xml_handler.h"
@@ -32,18 +36,17 @@ using namespace photos_editing_formats::image_io;
 using namespace std;
 
 namespace ultrahdr {
-/*
- * Helper function used for generating XMP metadata.
- *
- * @param prefix The prefix part of the name.
- * @param suffix The suffix part of the name.
- * @return A name of the form "prefix:suffix".
- */
-static inline string Name(const string& prefix, const string& suffix) {
-  std::stringstream ss;
-  ss << prefix << ":" << suffix;
-  return ss.str();
-}
+// GainMap XMP constants - element and attribute names, all in the "hdrgm" namespace. These are
+// compile time constants, so loading the library runs no constructors for them.
+static constexpr string_view kMapVersion = "hdrgm:Version";
+static constexpr string_view kMapGainMapMin = "hdrgm:GainMapMin";
+static constexpr string_view kMapGainMapMax = "hdrgm:GainMapMax";
+static constexpr string_view kMapGamma = "hdrgm:Gamma";
+static constexpr string_view kMapOffsetSdr = "hdrgm:OffsetSDR";
+static constexpr string_view kMapOffsetHdr = "hdrgm:OffsetHDR";
+static constexpr string_view kMapHDRCapacityMin = "hdrgm:HDRCapacityMin";
+static constexpr string_view kMapHDRCapacityMax = "hdrgm:HDRCapacityMax";
+static constexpr string_view kMapBaseRenditionIsHDR = "hdrgm:BaseRenditionIsHDR";
 
 DataStruct::DataStruct(size_t s) {
   data = malloc(s);
@@ -358,178 +361,225 @@ class XMPXmlHandler : public XmlHandler {
   }
 
  private:
-  static const string containerName;
+  static constexpr string_view containerName = "rdf:Description";
 
-  static const string versionAttrName;
+  static constexpr string_view versionAttrName = kMapVersion;
   string versionStr;
   bool versionFound;
-  static const string maxContentBoostAttrName;
+  static constexpr string_view maxContentBoostAttrName = kMapGainMapMax;
   string maxContentBoostStr;
   bool maxContentBoostFound;
-  static const string minContentBoostAttrName;
+  static constexpr string_view minContentBoostAttrName = kMapGainMapMin;
   string minContentBoostStr;
   bool minContentBoostFound;
-  static const string gammaAttrName;
+  static constexpr string_view gammaAttrName = kMapGamma;
   string gammaStr;
   bool gammaFound;
-  static const string offsetSdrAttrName;
+  static constexpr string_view offsetSdrAttrName = kMapOffsetSdr;
   string offsetSdrStr;
   bool offsetSdrFound;
-  static const string offsetHdrAttrName;
+  static constexpr string_view offsetHdrAttrName = kMapOffsetHdr;
   string offsetHdrStr;
   bool offsetHdrFound;
-  static const string hdrCapacityMinAttrName;
+  static constexpr string_view hdrCapacityMinAttrName = kMapHDRCapacityMin;
   string hdrCapacityMinStr;
   bool hdrCapacityMinFound;
-  static const string hdrCapacityMaxAttrName;
+  static constexpr string_view hdrCapacityMaxAttrName = kMapHDRCapacityMax;
   string hdrCapacityMaxStr;
   bool hdrCapacityMaxFound;
-  static const string baseRenditionIsHdrAttrName;
+  static constexpr string_view baseRenditionIsHdrAttrName = kMapBaseRenditionIsHDR;
   string baseRenditionIsHdrStr;
   bool baseRenditionIsHdrFound;
 
-  string lastAttributeName;
+  string_view lastAttributeName;
   ParseState state;
 };
 
-// GContainer XMP constants - URI and namespace prefix
-const string kContainerUri = "http://ns.google.com/photos/1.0/container/";
-const string kContainerPrefix = "Container";
-
-// GContainer XMP constants - element and attribute names
-const string kConDirectory = Name(kContainerPrefix, "Directory");
-const string kConItem = Name(kContainerPrefix, "Item");
-
-// GContainer XMP constants - names for XMP handlers
-const string XMPXmlHandler::containerName = "rdf:Description";
-// Item XMP constants - URI and namespace prefix
-const string kItemUri = "http://ns.google.com/photos/1.0/container/item/";
-const string kItemPrefix = "Item";
-
-// Item XMP constants - element and attribute names
-const string kItemLength = Name(kItemPrefix, "Length");
-const string kItemMime = Name(kItemPrefix, "Mime");
-const string kItemSemantic = Name(kItemPrefix, "Semantic");
-
-// Item XMP constants - element and attribute values
-const string kSemanticPrimary = "Primary";
-const string kSemanticGainMap = "GainMap";
-const string kMimeImageJpeg = "image/jpeg";
-
-// GainMap XMP constants - URI and namespace prefix
-const string kGainMapUri = "http://ns.adobe.com/hdr-gain-map/1.0/";
-const string kGainMapPrefix = "hdrgm";
-
-// GainMap XMP constants - element and attribute names
-const string kMapVersion = Name(kGainMapPrefix, "Version");
-const string kMapGainMapMin = Name(kGainMapPrefix, "GainMapMin");
-const string kMapGainMapMax = Name(kGainMapPrefix, "GainMapMax");
-const string kMapGamma = Name(kGainMapPrefix, "Gamma");
-const string kMapOffsetSdr = Name(kGainMapPrefix, "OffsetSDR");
-const string kMapOffsetHdr = Name(kGainMapPrefix, "OffsetHDR");
-const string kMapHDRCapacityMin = Name(kGainMapPrefix, "HDRCapacityMin");
-const string kMapHDRCapacityMax = Name(kGainMapPrefix, "HDRCapacityMax");
-const string kMapBaseRenditionIsHDR = Name(kGainMapPrefix, "BaseRenditionIsHDR");
-
-// GainMap XMP constants - names for XMP handlers
-const string XMPXmlHandler::versionAttrName = kMapVersion;
-const string XMPXmlHandler::minContentBoostAttrName = kMapGainMapMin;
-const string XMPXmlHandler::maxContentBoostAttrName = kMapGainMapMax;
-const string XMPXmlHandler::gammaAttrName = kMapGamma;
-const string XMPXmlHandler::offsetSdrAttrName = kMapOffsetSdr;
-const string XMPXmlHandler::offsetHdrAttrName = kMapOffsetHdr;
-const string XMPXmlHandler::hdrCapacityMinAttrName = kMapHDRCapacityMin;
-const string XMPXmlHandler::hdrCapacityMaxAttrName = kMapHDRCapacityMax;
-const string XMPXmlHandler::baseRenditionIsHdrAttrName = kMapBaseRenditionIsHDR;
+// Single pass reader of the gain map attributes for the layout generateXmpForSecondaryImage()
+// writes, one rdf:Description element that carries the hdrgm attributes and has no children.
+// Values are parsed in place. scan() rejects any other layout as well as values the stream
+// extraction of XMPXmlHandler could read differently, getMetadataFromXMP() then falls back to it.
+class XMPGainMapScanner {
+ public:
+  bool scan(const char* data, size_t size) {
+    constexpr string_view kOpenTag = "<rdf:Description";
+    constexpr string_view kCloseTag = "</rdf:Description>";
+    const string_view xmp(data, size);
+    size_t pos = xmp.find(kOpenTag);
+    if (pos == string_view::npos || xmp.find(kOpenTag, pos + 1) != string_view::npos) return false;
+    pos += kOpenTag.size();
+    if (pos >= size || (!isSpace(xmp[pos]) && xmp[pos] != '/' && xmp[pos] != '>')) return false;
+
+    while (true) {
+      while (pos < size && isSpace(xmp[pos])) pos++;
+      if (pos >= size) return false;
+      if (xmp[pos] == '/') {
+        return pos + 1 < size && xmp[pos + 1] == '>' && parseValues();
+      }
+      if (xmp[pos] == '>') {
+        pos++;
+        while (pos < size && isSpace(xmp[pos])) pos++;
+        return xmp.compare(pos, kCloseTag.size(), kCloseTag) == 0 && parseValues();
+      }
+      const size_t nameStart = pos;
+      while (pos < size && !isSpace(xmp[pos]) && xmp[pos] != '=') {
+        if (xmp[pos] == '<' || xmp[pos] == '>' || xmp[pos] == '/') return false;
+        pos++;
+      }
+      const string_view name = xmp.substr(nameStart, pos - nameStart);
+      while (pos < size && isSpace(xmp[pos])) pos++;
+      if (name.empty() || pos >= size || xmp[pos] != '=') return false;
+      pos++;
+      while (pos < size && isSpace(xmp[pos])) pos++;
+      if (pos >= size || (xmp[pos] != '"' && xmp[pos] != '\'')) return false;
+      const size_t valueEnd = xmp.find(xmp[pos], pos + 1);
+      if (valueEnd == string_view::npos) return false;
+      const string_view value = xmp.substr(pos + 1, valueEnd - pos - 1);
+      if (value.find_first_of("<&") != string_view::npos) return false;
+      pos = valueEnd + 1;
+      for (int i = 0; i < kNumAttrs; i++) {
+        if (name == kAttrNames[i]) {
+          mValue[i] = value;
+          mFound[i] = true;
+          break;
+        }
+      }
+    }
+  }
 
-uhdr_error_info_t getMetadataFromXMP(uint8_t* xmp_data, size_t xmp_size,
-                                     uhdr_gainmap_metadata_ext_t* metadata) {
-  string nameSpace = "http://ns.adobe.com/xap/1.0/\0";
+  bool getVersion(string* version, bool* present) {
+    *present = mFound[kVersion];
+    *version = string(mValue[kVersion]);
+    return true;
+  }
 
-  if (xmp_size < nameSpace.size() + 2) {
-    uhdr_error_info_t status;
-    status.error_code = UHDR_CODEC_ERROR;
-    status.has_detail = 1;
-    snprintf(status.detail, sizeof status.detail,
-             "size of xmp block is expected to be atleast %zd bytes, received only %zd bytes",
-             nameSpace.size() + 2, xmp_size);
-    return status;
+  bool getMaxContentBoost(float* max_content_boost, bool* present) {
+    return getLog2Value(kGainMapMax, max_content_boost, present);
   }
 
-  if (strncmp(reinterpret_cast<char*>(xmp_data), nameSpace.c_str(), nameSpace.size())) {
-    uhdr_error_info_t status;
-    status.error_code = UHDR_CODEC_ERROR;
-    status.has_detail = 1;
-    snprintf(status.detail, sizeof status.detail,
-             "mismatch in namespace of xmp block. Expected %s, Got %.*s", nameSpace.c_str(),
-             (int)nameSpace.size(), reinterpret_cast<char*>(xmp_data));
-    return status;
+  bool getMinContentBoost(float* min_content_boost, bool* present) {
+    return getLog2Value(kGainMapMin, min_content_boost, present);
   }
 
-  // Position the pointers to the start of XMP XML portion
-  xmp_data += nameSpace.size() + 1;
-  xmp_size -= nameSpace.size() + 1;
-  XMPXmlHandler handler;
+  bool getGamma(float* gamma, bool* present) { return getValue(kGamma, gamma, present); }
 
-  // xml parser fails to parse packet header, wrapper. remove them before handing the data to
-  // parser. if there is no packet header, do nothing otherwise go to the position of '<' without
-  // '?' after it.
-  size_t offset = 0;
-  for (size_t i = 0; i < xmp_size - 1; ++i) {
-    if (xmp_data[i] == '<') {
-      if (xmp_data[i + 1] != '?') {
-        offset = i;
-        break;
-      }
+  bool getOffsetSdr(float* offset_sdr, bool* present) {
+    return getValue(kOffsetSdr, offset_sdr, present);
+  }
+
+  bool getOffsetHdr(float* offset_hdr, bool* present) {
+    return getValue(kOffsetHdr, offset_hdr, present);
+  }
+
+  bool getHdrCapacityMin(float* hdr_capacity_min, bool* present) {
+    return getLog2Value(kHdrCapacityMin, hdr_capacity_min, present);
+  }
+
+  bool getHdrCapacityMax(float* hdr_capacity_max, bool* present) {
+    return getLog2Value(kHdrCapacityMax, hdr_capacity_max, present);
+  }
+
+  bool getBaseRenditionIsHdr(bool* base_rendition_is_hdr, bool* present) {
+    *present = mFound[kBaseRenditionIsHdr];
+    *base_rendition_is_hdr = mValue[kBaseRenditionIsHdr] == "True";
+    return mFound[kBaseRenditionIsHdr];
+  }
+
+ private:
+  enum {
+    kVersion,
+    kGainMapMin,
+    kGainMapMax,
+    kGamma,
+    kOffsetSdr,
+    kOffsetHdr,
+    kHdrCapacityMin,
+    kHdrCapacityMax,
+    kBaseRenditionIsHdr,
+    kNumAttrs
+  };
+  static constexpr string_view kAttrNames[kNumAttrs] = {
+      kMapVersion,   kMapGainMapMin,     kMapGainMapMax,     kMapGamma,
+      kMapOffsetSdr, kMapOffsetHdr,      kMapHDRCapacityMin, kMapHDRCapacityMax,
+      kMapBaseRenditionIsHDR,
+  };
+
+  static bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+  static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+  // a finite decimal number throughout: an optional '-', digits with an optional fraction and an
+  // optional exponent. strtof() alone would also take leading whitespace, a '+', hex and inf.
+  static bool parseNumber(string_view text, float* value) {
+    size_t i = 0, digits = 0;
+    if (i < text.size() && text[i] == '-') i++;
+    for (; i < text.size() && isDigit(text[i]); i++) digits++;
+    if (i < text.size() && text[i] == '.') {
+      for (i++; i < text.size() && isDigit(text[i]); i++) digits++;
     }
+    if (digits == 0) return false;
+    if (i < text.size() && (text[i] == 'e' || text[i] == 'E')) {
+      i++;
+      if (i < text.size() && (text[i] == '+' || text[i] == '-')) i++;
+      size_t exponent_digits = 0;
+      for (; i < text.size() && isDigit(text[i]); i++) exponent_digits++;
+      if (exponent_digits == 0) return false;
+    }
+    if (i != text.size()) return false;
+
+    // strtof() reads the decimal point of the current locale
+    std::string number(text);
+    const size_t point = number.find('.');
+    if (point != std::string::npos) number[point] = *localeconv()->decimal_point;
+    char* end = nullptr;
+    *value = strtof(number.c_str(), &end);
+    return end == number.c_str() + number.size() && std::isfinite(*value);
   }
-  xmp_data += offset;
-  xmp_size -= offset;
 
-  // If there is no packet wrapper, do nothing other wise go to the position of last '>' without '?'
-  // before it.
-  offset = 0;
-  for (size_t i = xmp_size - 1; i >= 1; --i) {
-    if (xmp_data[i] == '>') {
-      if (xmp_data[i - 1] != '?') {
-        offset = xmp_size - (i + 1);
-        break;
-      }
+  // converts the attributes found, the stream extraction of XMPXmlHandler accepts leading
+  // whitespace, trailing characters and a leading '+', so only values that are numbers throughout
+  // are taken here
+  bool parseValues() {
+    for (int i = kGainMapMin; i <= kHdrCapacityMax; i++) {
+      if (mFound[i] && !parseNumber(mValue[i], &mNumber[i])) return false;
     }
+    if (mFound[kBaseRenditionIsHdr] && mValue[kBaseRenditionIsHdr] != "False" &&
+        mValue[kBaseRenditionIsHdr] != "True") {
+      return false;
+    }
+    return true;
   }
-  xmp_size -= offset;
 
-  // remove padding
-  while (xmp_data[xmp_size - 1] != '>' && xmp_size > 1) {
-    xmp_size--;
+  bool getValue(int index, float* value, bool* present) {
+    *present = mFound[index];
+    if (mFound[index]) *value = mNumber[index];
+    return mFound[index];
   }
 
-  string str(reinterpret_cast<const char*>(xmp_data), xmp_size);
-  MessageHandler msg_handler;
-  unique_ptr<XmlRule> rule(new XmlElementRule);
-  XmlReader reader(&handler, &msg_handler);
-  reader.StartParse(std::move(rule));
-  reader.Parse(str);
-  reader.FinishParse();
-  if (reader.HasErrors()) {
-    uhdr_error_info_t status;
-    status.error_code = UHDR_CODEC_UNKNOWN_ERROR;
-    status.has_detail = 1;
-    snprintf(status.detail, sizeof status.detail, "xml parser returned with error");
-    return status;
+  bool getLog2Value(int index, float* value, bool* present) {
+    *present = mFound[index];
+    if (mFound[index]) *value = exp2(mNumber[index]);
+    return mFound[index];
   }
 
-  // Apply default values to any not-present fields, except for Version,
-  // maxContentBoost, and hdrCapacityMax, which are required. Return false if
-  // we encounter a present field that couldn't be parsed, since this
-  // indicates it is invalid (eg. string where there should be a float).
+  string_view mValue[kNumAttrs];
+  bool mFound[kNumAttrs] = {};
+  float mNumber[kNumAttrs] = {};
+};
+
+// Apply default values to any not-present fields, except for Version, maxContentBoost, and
+// hdrCapacityMax, which are required. Fails if a present field couldn't be parsed, since this
+// indicates it is invalid (eg. string where there should be a float).
+template <typename AttributeSource>
+static uhdr_error_info_t getMetadataFromAttributes(AttributeSource& handler,
+                                                   uhdr_gainmap_metadata_ext_t* metadata) {
   bool present = false;
   if (!handler.getVersion(&metadata->version, &present) || !present) {
     uhdr_error_info_t status;
     status.error_code = UHDR_CODEC_ERROR;
     status.has_detail = 1;
     snprintf(status.detail, sizeof status.detail, "xml parse error, could not find attribute %s",
-             kMapVersion.c_str());
+             kMapVersion.data());
     return status;
   }
   if (!handler.getMaxContentBoost(&metadata->max_content_boost, &present) || !present) {
@@ -537,7 +587,7 @@ uhdr_error_info_t getMetadataFromXMP(uint8_t* xmp_data, size_t xmp_size,
     status.error_code = UHDR_CODEC_ERROR;
     status.has_detail = 1;
     snprintf(status.detail, sizeof status.detail, "xml parse error, could not find attribute %s",
-             kMapGainMapMax.c_str());
+             kMapGainMapMax.data());
     return status;
   }
   if (!handler.getHdrCapacityMax(&metadata->hdr_capacity_max, &present) || !present) {
@@ -545,7 +595,7 @@ uhdr_error_info_t getMetadataFromXMP(uint8_t* xmp_data, size_t xmp_size,
     status.error_code = UHDR_CODEC_ERROR;
     status.has_detail = 1;
     snprintf(status.detail, sizeof status.detail, "xml parse error, could not find attribute %s",
-             kMapHDRCapacityMax.c_str());
+             kMapHDRCapacityMax.data());
     return status;
   }
   if (!handler.getMinContentBoost(&metadata->min_content_boost, &present)) {
@@ -554,7 +604,7 @@ uhdr_error_info_t getMetadataFromXMP(uint8_t* xmp_data, size_t xmp_size,
       status.error_code = UHDR_CODEC_ERROR;
       status.has_detail = 1;
       snprintf(status.detail, sizeof status.detail, "xml parse error, unable to parse attribute %s",
-               kMapGainMapMin.c_str());
+               kMapGainMapMin.data());
       return status;
     }
     metadata->min_content_boost = 1.0f;
@@ -565,7 +615,7 @@ uhdr_error_info_t getMetadataFromXMP(uint8_t* xmp_data, size_t xmp_size,
       status.error_code = UHDR_CODEC_ERROR;
       status.has_detail = 1;
       snprintf(status.detail, sizeof status.detail, "xml parse error, unable to parse attribute %s",
-               kMapGamma.c_str());
+               kMapGamma.data());
       return status;
     }
     metadata->gamma = 1.0f;
@@ -576,7 +626,7 @@ uhdr_error_info_t getMetadataFromXMP(uint8_t* xmp_data, size_t xmp_size,
       status.error_code = UHDR_CODEC_ERROR;
       status.has_detail = 1;
       snprintf(status.detail, sizeof status.detail, "xml parse error, unable to parse attribute %s",
-               kMapOffsetSdr.c_str());
+               kMapOffsetSdr.data());
       return status;
     }
     metadata->offset_sdr = 1.0f / 64.0f;
@@ -587,7 +637,7 @@ uhdr_error_info_t getMetadataFromXMP(uint8_t* xmp_data, size_t xmp_size,
       status.error_code = UHDR_CODEC_ERROR;
       status.has_detail = 1;
       snprintf(status.detail, sizeof status.detail, "xml parse error, unable to parse attribute %s",
-               kMapOffsetHdr.c_str());
+               kMapOffsetHdr.data());
       return status;
     }
     metadata->offset_hdr = 1.0f / 64.0f;
@@ -598,7 +648,7 @@ uhdr_error_info_t getMetadataFromXMP(uint8_t* xmp_data, size_t xmp_size,
       status.error_code = UHDR_CODEC_ERROR;
       status.has_detail = 1;
       snprintf(status.detail, sizeof status.detail, "xml parse error, unable to parse attribute %s",
-               kMapHDRCapacityMin.c_str());
+               kMapHDRCapacityMin.data());
       return status;
     }
     metadata->hdr_capacity_min = 1.0f;
@@ -611,7 +661,7 @@ uhdr_error_info_t getMetadataFromXMP(uint8_t* xmp_data, size_t xmp_size,
       status.error_code = UHDR_CODEC_ERROR;
       status.has_detail = 1;
       snprintf(status.detail, sizeof status.detail, "xml parse error, unable to parse attribute %s",
-               kMapBaseRenditionIsHDR.c_str());
+               kMapBaseRenditionIsHDR.data());
       return status;
     }
     base_rendition_is_hdr = false;
@@ -627,69 +677,423 @@ uhdr_error_info_t getMetadataFromXMP(uint8_t* xmp_data, size_t xmp_size,
   return g_no_error;
 }
 
+uhdr_error_info_t getMetadataFromXMP(uint8_t* xmp_data, size_t xmp_size,
+                                     uhdr_gainmap_metadata_ext_t* metadata) {
+  string nameSpace = "http://ns.adobe.com/xap/1.0/\0";
+
+  if (xmp_size < nameSpace.size() + 2) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_ERROR;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "size of xmp block is expected to be atleast %zd bytes, received only %zd bytes",
+             nameSpace.size() + 2, xmp_size);
+    return status;
+  }
+
+  if (strncmp(reinterpret_cast<char*>(xmp_data), nameSpace.c_str(), nameSpace.size())) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_ERROR;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "mismatch in namespace of xmp block. Expected %s, Got %.*s", nameSpace.c_str(),
+             (int)nameSpace.size(), reinterpret_cast<char*>(xmp_data));
+    return status;
+  }
+
+  // Position the pointers to the start of XMP XML portion
+  xmp_data += nameSpace.size() + 1;
+  xmp_size -= nameSpace.size() + 1;
+
+  // xml parser fails to parse packet header, wrapper. remove them before handing the data to
+  // parser. if there is no packet header, do nothing otherwise go to the position of '<' without
+  // '?' after it.
+  size_t offset = 0;
+  for (size_t i = 0; i < xmp_size - 1; ++i) {
+    if (xmp_data[i] == '<') {
+      if (xmp_data[i + 1] != '?') {
+        offset = i;
+        break;
+      }
+    }
+  }
+  xmp_data += offset;
+  xmp_size -= offset;
+
+  // If there is no packet wrapper, do nothing other wise go to the position of last '>' without '?'
+  // before it.
+  offset = 0;
+  for (size_t i = xmp_size - 1; i >= 1; --i) {
+    if (xmp_data[i] == '>') {
+      if (xmp_data[i - 1] != '?') {
+        offset = xmp_size - (i + 1);
+        break;
+      }
+    }
+  }
+  xmp_size -= offset;
+
+  // remove padding
+  while (xmp_data[xmp_size - 1] != '>' && xmp_size > 1) {
+    xmp_size--;
+  }
+
+  XMPGainMapScanner scanner;
+  if (scanner.scan(reinterpret_cast<const char*>(xmp_data), xmp_size)) {
+    return getMetadataFromAttributes(scanner, metadata);
+  }
+
+  XMPXmlHandler handler;
+  string str(reinterpret_cast<const char*>(xmp_data), xmp_size);
+  MessageHandler msg_handler;
+  unique_ptr<XmlRule> rule(new XmlElementRule);
+  XmlReader reader(&handler, &msg_handler);
+  reader.StartParse(std::move(rule));
+  reader.Parse(str);
+  reader.FinishParse();
+  if (reader.HasErrors()) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_UNKNOWN_ERROR;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "xml parser returned with error");
+    return status;
+  }
+
+  return getMetadataFromAttributes(handler, metadata);
+}
+
+// Fixed text of the packets of generateXmpForPrimaryImage() / generateXmpForSecondaryImage(), in
+// the layout the image_io xml writer produces. Only the version, the numbers and the gain map
+// length vary between encodes.
+static const char kXmpPrimaryHead[] =
+    "<x:xmpmeta\n"
+    "  xmlns:x=\"adobe:ns:meta/\"\n"
+    "  x:xmptk=\"Adobe XMP Core 5.1.2\">\n"
+    "  <rdf:RDF\n"
+    "    xmlns:rdf=\"http://www.w3.org/1999/02/22-rdf-syntax-ns#\">\n"
+    "    <rdf:Description";
+static const char kXmpPrimaryNamespaces[] =
+    "\n"
+    "      xmlns:Container=\"http://ns.google.com/photos/1.0/container/\"\n"
+    "      xmlns:Item=\"http://ns.google.com/photos/1.0/container/item/\"\n"
+    "      xmlns:hdrgm=\"http://ns.adobe.com/hdr-gain-map/1.0/\"\n"
+    "      hdrgm:Version=\"";
+static const char kXmpPrimaryDirectoryHead[] =
+    "<Container:Directory>\n"
+    "        <rdf:Seq>\n"
+    "          <rdf:li\n"
+    "            rdf:parseType=\"Resource\">\n"
+    "            <Container:Item\n"
+    "              Item:Semantic=\"Primary\"\n"
+    "              Item:Mime=\"image/jpeg\"/>\n"
+    "          </rdf:li>\n"
+    "          <rdf:li\n"
+    "            rdf:parseType=\"Resource\">\n"
+    "            <Container:Item\n"
+    "              Item:Semantic=\"GainMap\"\n"
+    "              Item:Mime=\"image/jpeg\"\n"
+    "              Item:Length=\"";
+static const char kXmpPrimaryDirectoryTail[] =
+    "\"/>\n"
+    "          </rdf:li>\n"
+    "        </rdf:Seq>\n"
+    "      </Container:Directory>";
+static const char kXmpPrimaryTail[] =
+    "\n"
+    "    </rdf:Description>\n"
+    "  </rdf:RDF>\n"
+    "</x:xmpmeta>\n";
+static const char kXmpSecondaryHead[] =
+    "<x:xmpmeta\n"
+    "  xmlns:x=\"adobe:ns:meta/\"\n"
+    "  x:xmptk=\"Adobe XMP Core 5.1.2\">\n"
+    "  <rdf:RDF\n"
+    "    xmlns:rdf=\"http://www.w3.org/1999/02/22-rdf-syntax-ns#\">\n"
+    "    <rdf:Description\n"
+    "      xmlns:hdrgm=\"http://ns.adobe.com/hdr-gain-map/1.0/\"\n"
+    "      hdrgm:Version=\"";
+static const char kXmpSecondaryTail[] =
+    "\"\n"
+    "      hdrgm:BaseRenditionIsHDR=\"False\"/>\n"
+    "  </rdf:RDF>\n"
+    "</x:xmpmeta>\n";
+
+// Appends to a caller buffer of fixed capacity, the first write that does not fit fails the packet
+class XmpTemplateWriter {
+ public:
+  XmpTemplateWriter(char* dst, size_t capacity) : mDst(dst), mCapacity(capacity), mPos(0) {}
+
+  template <size_t N>
+  void text(const char (&literal)[N]) {
+    append(literal, N - 1);
+  }
+
+  void text(const string& str) { append(str.data(), str.size()); }
+
+  // formatted as an ostream does by default, %g with 6 significant digits
+  void number(float value) {
+    char buf[32];
+    auto result =
+        std::to_chars(buf, buf + sizeof buf, (double)value, std::chars_format::general, 6);
+    append(buf, result.ptr - buf);
+  }
+
+  void number(size_t value) {
+    char buf[32];
+    auto result = std::to_chars(buf, buf + sizeof buf, value);
+    append(buf, result.ptr - buf);
+  }
+
+  // attribute of the rdf:Description element of the secondary image, after the version
+  void attribute(const char* name, float value) {
+    text("\"\n      hdrgm:");
+    append(name, strlen(name));
+    text("=\"");
+    number(value);
+  }
+
+  size_t finish() const { return mDst != nullptr ? mPos : 0; }
+
+ private:
+  void append(const char* src, size_t size) {
+    if (mDst == nullptr) return;
+    if (size > mCapacity - mPos) {
+      mDst = nullptr;
+      return;
+    }
+    memcpy(mDst + mPos, src, size);
+    mPos += size;
+  }
+
+  char* mDst;
+  size_t mCapacity;
+  size_t mPos;
+};
+
+size_t writeXmpForPrimaryImage(char* dst, size_t capacity, size_t secondary_image_length,
+                               const uhdr_gainmap_metadata_ext_t& metadata) {
+  XmpTemplateWriter writer(dst, capacity);
+  writer.text(kXmpPrimaryHead);
+  writer.text(kXmpPrimaryNamespaces);
+  writer.text(metadata.version);
+  writer.text("\">\n      ");
+  writer.text(kXmpPrimaryDirectoryHead);
+  writer.number(secondary_image_length);
+  writer.text(kXmpPrimaryDirectoryTail);
+  writer.text(kXmpPrimaryTail);
+  return writer.finish();
+}
+
+static bool isXmlSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+// Offset one past the markup that opens at pos, quoted attribute values skipped, npos if the
+// markup is not terminated
+static size_t markupEnd(string_view xmp, size_t pos) {
+  const char* terminator = nullptr;
+  if (xmp.compare(pos, 4, "<!--") == 0) {
+    terminator = "-->";
+  } else if (xmp.compare(pos, 9, "<![CDATA[") == 0) {
+    terminator = "]]>";
+  } else if (xmp.compare(pos, 2, "<?") == 0 || xmp.compare(pos, 2, "<!") == 0) {
+    terminator = xmp[pos + 1] == '?' ? "?>" : ">";
+  }
+  if (terminator != nullptr) {
+    const size_t end = xmp.find(terminator, pos + 2);
+    return end == string_view::npos ? end : end + strlen(terminator);
+  }
+  char quote = 0;
+  for (size_t i = pos + 1; i < xmp.size(); i++) {
+    if (quote != 0) {
+      if (xmp[i] == quote) quote = 0;
+    } else if (xmp[i] == '"' || xmp[i] == '\'') {
+      quote = xmp[i];
+    } else if (xmp[i] == '>') {
+      return i + 1;
+    }
+  }
+  return string_view::npos;
+}
+
+// Element name of a start or end tag
+static string_view tagName(string_view tag) {
+  const size_t begin = tag[1] == '/' ? 2 : 1;
+  size_t end = begin;
+  while (end < tag.size() && !isXmlSpace(tag[end]) && tag[end] != '/' && tag[end] != '>') end++;
+  return tag.substr(begin, end - begin);
+}
+
+static bool isSelfClosing(string_view tag) { return tag.size() >= 2 && tag[tag.size() - 2] == '/'; }
+
+// Offset one past the end of the element whose start tag spans [open, close), npos if the
+// element is not closed
+static size_t elementEnd(string_view xmp, size_t open, size_t close) {
+  if (isSelfClosing(xmp.substr(open, close - open))) return close;
+  const string_view name = tagName(xmp.substr(open, close - open));
+  int depth = 1;
+  for (size_t pos = xmp.find('<', close); pos != string_view::npos; pos = xmp.find('<', pos)) {
+    const size_t end = markupEnd(xmp, pos);
+    if (end == string_view::npos) break;
+    const string_view tag = xmp.substr(pos, end - pos);
+    pos = end;
+    if (tag[1] == '!' || tag[1] == '?' || tagName(tag) != name) continue;
+    if (tag[1] == '/') {
+      if (--depth == 0) return end;
+    } else if (!isSelfClosing(tag)) {
+      depth++;
+    }
+  }
+  return string_view::npos;
+}
+
+// Properties owned by the gain map metadata of the primary image, along with the namespaces
+// declared for them
+static bool isGainMapAttribute(string_view name) {
+  return name.substr(0, 6) == "hdrgm:" || name == "xmlns:hdrgm" || name == "xmlns:Container" ||
+         name == "xmlns:Item";
+}
+
+// Appends the attributes of a start tag, except those of the gain map metadata, with their
+// leading white space. Returns the offset of the end of the tag, npos if the tag is malformed.
+static size_t copyAttributes(string_view tag, size_t nameLength, string& out) {
+  size_t pos = 1 + nameLength;
+  while (true) {
+    const size_t begin = pos;
+    while (pos < tag.size() && isXmlSpace(tag[pos])) pos++;
+    if (pos >= tag.size() || tag[pos] == '/' || tag[pos] == '>') return begin;
+    const size_t nameBegin = pos;
+    while (pos < tag.size() && !isXmlSpace(tag[pos]) && tag[pos] != '=') pos++;
+    const string_view name = tag.substr(nameBegin, pos - nameBegin);
+    while (pos < tag.size() && isXmlSpace(tag[pos])) pos++;
+    if (pos >= tag.size() || tag[pos] != '=') return string_view::npos;
+    pos++;
+    while (pos < tag.size() && isXmlSpace(tag[pos])) pos++;
+    if (pos >= tag.size() || (tag[pos] != '"' && tag[pos] != '\'')) return string_view::npos;
+    const size_t valueEnd = tag.find(tag[pos], pos + 1);
+    if (valueEnd == string_view::npos) return string_view::npos;
+    pos = valueEnd + 1;
+    if (!isGainMapAttribute(name)) out.append(tag.substr(begin, pos - begin));
+  }
+}
+
+string mergeXmpForPrimaryImage(string_view packet, size_t secondary_image_length,
+                               const uhdr_gainmap_metadata_ext_t& metadata) {
+  string fresh(kXmpPacketMaxSize + metadata.version.size(), '\0');
+  fresh.resize(writeXmpForPrimaryImage(&fresh[0], fresh.size(), secondary_image_length, metadata));
+  const size_t directoryBegin = fresh.find(kXmpPrimaryDirectoryHead);
+  const size_t directoryEnd = fresh.rfind(kXmpPrimaryTail);
+  if (directoryBegin == string::npos || directoryEnd == string::npos) return {};
+  const string_view directory(fresh.data() + directoryBegin, directoryEnd - directoryBegin);
+
+  // the metadata goes to the description holding the container directory, the first one when
+  // there is no directory yet
+  size_t directoryPos = string_view::npos, target = string_view::npos, first = string_view::npos;
+  for (size_t pos = packet.find('<'); pos != string_view::npos; pos = packet.find('<', pos)) {
+    const size_t close = markupEnd(packet, pos);
+    if (close == string_view::npos) return {};
+    const string_view tag = packet.substr(pos, close - pos);
+    if (tag[1] != '!' && tag[1] != '?' && tag[1] != '/') {
+      const string_view name = tagName(tag);
+      if (name == "rdf:Description") {
+        if (first == string_view::npos) first = pos;
+        if (!isSelfClosing(tag)) target = pos;
+      } else if (name == "Container:Directory") {
+        directoryPos = pos;
+        break;
+      }
+    }
+    pos = close;
+  }
+  if (directoryPos == string_view::npos) target = first;
+  if (target == string_view::npos) return {};
+
+  string merged;
+  merged.reserve(packet.size() + sizeof kXmpPrimaryNamespaces + metadata.version.size() +
+                 directory.size() + 32);
+  bool written = false, directoryWritten = false;
+  size_t pos = 0;
+  while (pos < packet.size()) {
+    const size_t open = packet.find('<', pos);
+    if (open == string_view::npos) {
+      merged.append(packet.substr(pos));
+      break;
+    }
+    merged.append(packet.substr(pos, open - pos));
+    const size_t close = markupEnd(packet, open);
+    if (close == string_view::npos) return {};
+    const string_view tag = packet.substr(open, close - open);
+    pos = close;
+    if (tag[1] == '!' || tag[1] == '?' || tag[1] == '/') {
+      merged.append(tag);
+      continue;
+    }
+    const string_view name = tagName(tag);
+    if (name == "Container:Directory" || name.substr(0, 6) == "hdrgm:") {
+      // the directory is regenerated in place, other gain map elements are dropped along with the
+      // white space ahead of them
+      pos = elementEnd(packet, open, close);
+      if (pos == string_view::npos) return {};
+      if (open == directoryPos && written) {
+        merged.append(directory);
+        directoryWritten = true;
+      } else {
+        while (!merged.empty() && isXmlSpace(merged.back())) merged.pop_back();
+      }
+      continue;
+    }
+    if (name != "rdf:Description") {
+      merged.append(tag);
+      continue;
+    }
+    merged.append(tag.substr(0, 1 + name.size()));
+    const size_t end = copyAttributes(tag, name.size(), merged);
+    if (end == string_view::npos) return {};
+    if (open != target) {
+      merged.append(tag.substr(end));
+      continue;
+    }
+    merged.append(kXmpPrimaryNamespaces);
+    merged.append(metadata.version);
+    merged.push_back('"');
+    written = true;
+    if (directoryPos != string_view::npos) {
+      merged.append(tag.substr(end));
+    } else {
+      merged.append(">\n      ");
+      merged.append(directory);
+      directoryWritten = true;
+      if (isSelfClosing(tag)) merged.append("\n    </rdf:Description>");
+    }
+  }
+  return written && directoryWritten ? merged : string();
+}
+
+size_t writeXmpForSecondaryImage(char* dst, size_t capacity,
+                                 const uhdr_gainmap_metadata_ext_t& metadata) {
+  XmpTemplateWriter writer(dst, capacity);
+  writer.text(kXmpSecondaryHead);
+  writer.text(metadata.version);
+  writer.attribute("GainMapMin", log2(metadata.min_content_boost));
+  writer.attribute("GainMapMax", log2(metadata.max_content_boost));
+  writer.attribute("Gamma", metadata.gamma);
+  writer.attribute("OffsetSDR", metadata.offset_sdr);
+  writer.attribute("OffsetHDR", metadata.offset_hdr);
+  writer.attribute("HDRCapacityMin", log2(metadata.hdr_capacity_min));
+  writer.attribute("HDRCapacityMax", log2(metadata.hdr_capacity_max));
+  writer.text(kXmpSecondaryTail);
+  return writer.finish();
+}
+
 string generateXmpForPrimaryImage(size_t secondary_image_length,
                                   uhdr_gainmap_metadata_ext_t& metadata) {
-  const vector<string> kConDirSeq({kConDirectory, string("rdf:Seq")});
-  const vector<string> kLiItem({string("rdf:li"), kConItem});
-
-  std::stringstream ss;
-  photos_editing_formats::image_io::XmlWriter writer(ss);
-  writer.StartWritingElement("x:xmpmeta");
-  writer.WriteXmlns("x", "adobe:ns:meta/");
-  writer.WriteAttributeNameAndValue("x:xmptk", "Adobe XMP Core 5.1.2");
-  writer.StartWritingElement("rdf:RDF");
-  writer.WriteXmlns("rdf", "http://www.w3.org/1999/02/22-rdf-syntax-ns#");
-  writer.StartWritingElement("rdf:Description");
-  writer.WriteXmlns(kContainerPrefix, kContainerUri);
-  writer.WriteXmlns(kItemPrefix, kItemUri);
-  writer.WriteXmlns(kGainMapPrefix, kGainMapUri);
-  writer.WriteAttributeNameAndValue(kMapVersion, metadata.version);
-
-  writer.StartWritingElements(kConDirSeq);
-
-  size_t item_depth = writer.StartWritingElement("rdf:li");
-  writer.WriteAttributeNameAndValue("rdf:parseType", "Resource");
-  writer.StartWritingElement(kConItem);
-  writer.WriteAttributeNameAndValue(kItemSemantic, kSemanticPrimary);
-  writer.WriteAttributeNameAndValue(kItemMime, kMimeImageJpeg);
-  writer.FinishWritingElementsToDepth(item_depth);
-
-  writer.StartWritingElement("rdf:li");
-  writer.WriteAttributeNameAndValue("rdf:parseType", "Resource");
-  writer.StartWritingElement(kConItem);
-  writer.WriteAttributeNameAndValue(kItemSemantic, kSemanticGainMap);
-  writer.WriteAttributeNameAndValue(kItemMime, kMimeImageJpeg);
-  writer.WriteAttributeNameAndValue(kItemLength, secondary_image_length);
-
-  writer.FinishWriting();
-
-  return ss.str();
+  string xmp(kXmpPacketMaxSize + metadata.version.size(), '\0');
+  xmp.resize(writeXmpForPrimaryImage(&xmp[0], xmp.size(), secondary_image_length, metadata));
+  return xmp;
 }
 
 string generateXmpForSecondaryImage(uhdr_gainmap_metadata_ext_t& metadata) {
-  const vector<string> kConDirSeq({kConDirectory, string("rdf:Seq")});
-
-  std::stringstream ss;
-  photos_editing_formats::image_io::XmlWriter writer(ss);
-  writer.StartWritingElement("x:xmpmeta");
-  writer.WriteXmlns("x", "adobe:ns:meta/");
-  writer.WriteAttributeNameAndValue("x:xmptk", "Adobe XMP Core 5.1.2");
-  writer.StartWritingElement("rdf:RDF");
-  writer.WriteXmlns("rdf", "http://www.w3.org/1999/02/22-rdf-syntax-ns#");
-  writer.StartWritingElement("rdf:Description");
-  writer.WriteXmlns(kGainMapPrefix, kGainMapUri);
-  writer.WriteAttributeNameAndValue(kMapVersion, metadata.version);
-  writer.WriteAttributeNameAndValue(kMapGainMapMin, log2(metadata.min_content_boost));
-  writer.WriteAttributeNameAndValue(kMapGainMapMax, log2(metadata.max_content_boost));
-  writer.WriteAttributeNameAndValue(kMapGamma, metadata.gamma);
-  writer.WriteAttributeNameAndValue(kMapOffsetSdr, metadata.offset_sdr);
-  writer.WriteAttributeNameAndValue(kMapOffsetHdr, metadata.offset_hdr);
-  writer.WriteAttributeNameAndValue(kMapHDRCapacityMin, log2(metadata.hdr_capacity_min));
-  writer.WriteAttributeNameAndValue(kMapHDRCapacityMax, log2(metadata.hdr_capacity_max));
-  writer.WriteAttributeNameAndValue(kMapBaseRenditionIsHDR, "False");
-  writer.FinishWriting();
-
-  return ss.str();
+  string xmp(kXmpPacketMaxSize + metadata.version.size(), '\0');
+  xmp.resize(writeXmpForSecondaryImage(&xmp[0], xmp.size(), metadata));
+  return xmp;
 }
 
 }  // namespace ultrahdr
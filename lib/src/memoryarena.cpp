@@ -0,0 +1,183 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#include <cstring>
+#include <new>
+
+#include "ultrahdr/memoryarena.h"
+
+namespace ultrahdr {
+
+static thread_local MemoryArena* t_current_arena = nullptr;
+
+MemoryArena::~MemoryArena() { trim(); }
+
+void MemoryArena::Releaser::operator()(uint8_t* ptr) const {
+  if (ptr == nullptr) return;
+  if (arena != nullptr) {
+    arena->recycle(ptr, *this);
+  } else {
+    release(ptr, *this);
+  }
+}
+
+void MemoryArena::release(uint8_t* ptr, const Releaser& releaser) {
+  if (releaser.free_fn != nullptr) {
+    releaser.free_fn(releaser.alloc_ctx, ptr);
+  } else if (releaser.mapped) {
+#if defined(__linux__)
+    munmap(ptr, releaser.capacity);
+#endif
+  } else {
+    ::operator delete[](ptr, std::align_val_t(kBlockAlignment));
+  }
+}
+
+#if defined(__linux__)
+// Maps capacity bytes, rounded up to whole huge pages. Explicit huge pages need a pool reserved by
+// the administrator, without one the mapping is left to transparent huge pages. nullptr on failure
+static uint8_t* MapHugePages(size_t& capacity) {
+  static const size_t kHugePageSize = 2u << 20;
+  const size_t size = (capacity + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+  void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (ptr == MAP_FAILED) {
+    ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) return nullptr;
+#ifdef MADV_HUGEPAGE
+    madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+  }
+  capacity = size;
+  return static_cast<uint8_t*>(ptr);
+}
+#endif
+
+uint8_t* MemoryArena::allocate(size_t capacity, [[maybe_unused]] bool hugePages,
+                               Releaser& releaser) {
+  releaser.capacity = capacity;
+#if defined(__linux__)
+  if (hugePages && capacity >= kHugePageThreshold) {
+    // fresh mappings read as zero, no need to clear them
+    if (uint8_t* ptr = MapHugePages(releaser.capacity)) {
+      releaser.mapped = true;
+      return ptr;
+    }
+  }
+#endif
+  uint8_t* ptr =
+      static_cast<uint8_t*>(::operator new[](capacity, std::align_val_t(kBlockAlignment)));
+  memset(ptr, 0, capacity);
+  return ptr;
+}
+
+uint8_t* MemoryArena::acquire(size_t capacity, Releaser& releaser) {
+  uint8_t* ptr = nullptr;
+  bool hugePages;
+  releaser = Releaser{};
+  {
+    std::unique_lock<std::mutex> lock{mMutex};
+    if (mPooling) {
+      // best fit, but do not hand out blocks that would waste more than half their size
+      auto it = mFreeBlocks.lower_bound(capacity);
+      if (it != mFreeBlocks.end() && it->first / 2 <= capacity) {
+        ptr = it->second.ptr;
+        releaser.capacity = it->first;
+        releaser.free_fn = it->second.free_fn;
+        releaser.alloc_ctx = it->second.alloc_ctx;
+        releaser.mapped = it->second.mapped;
+        mFreeBlocks.erase(it);
+      }
+      releaser.arena = this;
+    }
+    if (ptr == nullptr && mAllocFn != nullptr) {
+      ptr = static_cast<uint8_t*>(mAllocFn(mAllocCtx, capacity));
+      if (ptr != nullptr) {
+        releaser.capacity = capacity;
+        releaser.free_fn = mFreeFn;
+        releaser.alloc_ctx = mAllocCtx;
+      }
+    }
+    hugePages = mHugePages;
+  }
+  if (ptr == nullptr) return allocate(capacity, hugePages, releaser);
+  // keep the zero initialized contract of heap backed blocks
+  memset(ptr, 0, capacity);
+  return ptr;
+}
+
+void MemoryArena::recycle(uint8_t* ptr, const Releaser& releaser) {
+  {
+    std::unique_lock<std::mutex> lock{mMutex};
+    if (mPooling) {
+      mFreeBlocks.emplace(releaser.capacity,
+                          PooledBlock{ptr, releaser.free_fn, releaser.alloc_ctx, releaser.mapped});
+      return;
+    }
+  }
+  release(ptr, releaser);
+}
+
+void MemoryArena::setAllocator(uhdr_alloc_fn_t alloc_fn, uhdr_free_fn_t free_fn,
+                               void* alloc_ctx) {
+  std::unique_lock<std::mutex> lock{mMutex};
+  mAllocFn = alloc_fn;
+  mFreeFn = alloc_fn ? free_fn : nullptr;
+  mAllocCtx = alloc_fn ? alloc_ctx : nullptr;
+}
+
+void MemoryArena::setPooling(bool enable) {
+  {
+    std::unique_lock<std::mutex> lock{mMutex};
+    mPooling = enable;
+  }
+  if (!enable) trim();
+}
+
+void MemoryArena::setHugePages(bool enable) {
+  std::unique_lock<std::mutex> lock{mMutex};
+  mHugePages = enable;
+}
+
+void MemoryArena::trim() {
+  std::multimap<size_t, PooledBlock> blocks;
+  {
+    std::unique_lock<std::mutex> lock{mMutex};
+    blocks.swap(mFreeBlocks);
+  }
+  for (auto& it : blocks) {
+    Releaser releaser;
+    releaser.capacity = it.first;
+    releaser.free_fn = it.second.free_fn;
+    releaser.alloc_ctx = it.second.alloc_ctx;
+    releaser.mapped = it.second.mapped;
+    release(it.second.ptr, releaser);
+  }
+}
+
+MemoryArena* MemoryArena::current() { return t_current_arena; }
+
+MemoryArena::Scope::Scope(MemoryArena* arena) : mPrev(t_current_arena) {
+  t_current_arena = (arena != nullptr && arena->isActive()) ? arena : nullptr;
+}
+
+MemoryArena::Scope::~Scope() { t_current_arena = mPrev; }
+
+}  // namespace ultrahdr
@@ -90,4 +90,67 @@ std::shared_ptr<DataStruct> generateMpf(size_t primary_image_size, size_t primar
   return dataStruct;
 }
 
+uhdr_error_info_t parseMpf(const uint8_t* mpf, size_t mpf_size, size_t* primary_image_size,
+                           size_t* secondary_image_size, size_t* secondary_image_offset) {
+  uhdr_error_info_t status;
+  status.error_code = UHDR_CODEC_ERROR;
+  status.has_detail = 1;
+
+  if (mpf_size < sizeof(kMpfSig) + kMpEndianSize + sizeof(uint32_t) ||
+      memcmp(mpf, kMpfSig, sizeof(kMpfSig))) {
+    snprintf(status.detail, sizeof status.detail, "received bad mpf block of size %zd", mpf_size);
+    return status;
+  }
+  // offsets within the block are relative to the endianness field
+  const uint8_t* base = mpf + sizeof(kMpfSig);
+  const size_t size = mpf_size - sizeof(kMpfSig);
+  bool bigEndian;
+  if (!memcmp(base, kMpBigEndian, kMpEndianSize)) {
+    bigEndian = true;
+  } else if (!memcmp(base, kMpLittleEndian, kMpEndianSize)) {
+    bigEndian = false;
+  } else {
+    snprintf(status.detail, sizeof status.detail, "received mpf block with unknown endianness");
+    return status;
+  }
+  auto read16 = [&](size_t pos) -> uint32_t {
+    return bigEndian ? (base[pos] << 8) | base[pos + 1] : (base[pos + 1] << 8) | base[pos];
+  };
+  auto read32 = [&](size_t pos) -> uint32_t {
+    return bigEndian ? (read16(pos) << 16) | read16(pos + 2)
+                     : (read16(pos + 2) << 16) | read16(pos);
+  };
+
+  const size_t ifdOffset = read32(kMpEndianSize);
+  if (ifdOffset > size - sizeof(uint16_t)) {
+    snprintf(status.detail, sizeof status.detail, "mpf index ifd offset %zd is out of bounds",
+             ifdOffset);
+    return status;
+  }
+  const size_t tagCount = read16(ifdOffset);
+  if (tagCount > (size - ifdOffset - sizeof(uint16_t)) / kTagSize) {
+    snprintf(status.detail, sizeof status.detail, "mpf index ifd has bad tag count %zd",
+             tagCount);
+    return status;
+  }
+  for (size_t i = 0; i < tagCount; i++) {
+    const size_t tag = ifdOffset + sizeof(uint16_t) + i * kTagSize;
+    if (read16(tag) != kMPEntryTag) continue;
+    const size_t entriesSize = read32(tag + 4);
+    const size_t entriesOffset = read32(tag + 8);
+    if (entriesSize < kNumPictures * kMPEntrySize || entriesOffset > size ||
+        kNumPictures * kMPEntrySize > size - entriesOffset) {
+      snprintf(status.detail, sizeof status.detail,
+               "mpf has bad mp entries, size %zd, offset %zd", entriesSize, entriesOffset);
+      return status;
+    }
+    *primary_image_size = read32(entriesOffset + 4);
+    *secondary_image_size = read32(entriesOffset + kMPEntrySize + 4);
+    *secondary_image_offset = read32(entriesOffset + kMPEntrySize + 8);
+    return g_no_error;
+  }
+  snprintf(status.detail, sizeof status.detail, "mpf block does not contain mp entries");
+  return status;
+}
+
 }  // namespace ultrahdr
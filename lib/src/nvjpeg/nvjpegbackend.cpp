@@ -0,0 +1,237 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cuda_runtime_api.h>
+#include <nvjpeg.h>
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "ultrahdr/ultrahdrcommon.h"
+
+namespace ultrahdr {
+
+namespace {
+
+// Device side state of the backend. The jpeg states of nvJPEG are not reentrant, so the base
+// image and the gain map of a call, which the library may offer concurrently, take turns on the
+// device. The transfers of one image are queued on a single stream and overlap nothing else.
+struct nvjpeg_backend {
+  uhdr_jpeg_backend_t hooks;
+  std::mutex mutex;
+  cudaStream_t stream = nullptr;
+  nvjpegHandle_t handle = nullptr;
+  nvjpegJpegState_t dec_state = nullptr;
+  nvjpegEncoderState_t enc_state = nullptr;
+  nvjpegEncoderParams_t enc_params = nullptr;
+  unsigned char* planes[3]{};  // device planes, grown on demand
+  size_t plane_sizes[3]{};
+};
+
+// the bitstream handed back by compress() stays valid until the next call of the same thread
+thread_local std::vector<unsigned char> t_bitstream;
+
+struct plane_layout {
+  int count;
+  unsigned int w[3], h[3];
+  unsigned int bytes_per_pixel;
+};
+
+bool get_plane_layout(uhdr_img_fmt_t fmt, unsigned int w, unsigned int h, plane_layout& layout,
+                      nvjpegChromaSubsampling_t& css) {
+  unsigned int cw = w, ch = h;
+  layout.count = 3;
+  layout.bytes_per_pixel = 1;
+  switch (fmt) {
+    case UHDR_IMG_FMT_8bppYCbCr400:
+      layout.count = 1;
+      css = NVJPEG_CSS_GRAY;
+      break;
+    case UHDR_IMG_FMT_12bppYCbCr420:
+      cw = (w + 1) / 2;
+      ch = (h + 1) / 2;
+      css = NVJPEG_CSS_420;
+      break;
+    case UHDR_IMG_FMT_16bppYCbCr422:
+      cw = (w + 1) / 2;
+      css = NVJPEG_CSS_422;
+      break;
+    case UHDR_IMG_FMT_24bppYCbCr444:
+      css = NVJPEG_CSS_444;
+      break;
+    case UHDR_IMG_FMT_24bppRGB888:
+      // interleaved, a single plane of three bytes per pixel
+      layout.count = 1;
+      layout.bytes_per_pixel = 3;
+      css = NVJPEG_CSS_444;
+      break;
+    default:
+      return false;
+  }
+  for (int i = 0; i < layout.count; i++) {
+    layout.w[i] = i == 0 ? w * layout.bytes_per_pixel : cw;
+    layout.h[i] = i == 0 ? h : ch;
+  }
+  return true;
+}
+
+bool reserve_planes(nvjpeg_backend* backend, const plane_layout& layout) {
+  for (int i = 0; i < layout.count; i++) {
+    const size_t size = (size_t)layout.w[i] * layout.h[i];
+    if (backend->plane_sizes[i] >= size) continue;
+    if (backend->planes[i] != nullptr) cudaFree(backend->planes[i]);
+    backend->planes[i] = nullptr;
+    backend->plane_sizes[i] = 0;
+    if (cudaMalloc(reinterpret_cast<void**>(&backend->planes[i]), size) != cudaSuccess) {
+      return false;
+    }
+    backend->plane_sizes[i] = size;
+  }
+  return true;
+}
+
+int nvjpeg_compress(void* ctx, const uhdr_raw_image_t* img, int quality,
+                    uhdr_compressed_image_t* dst) {
+  nvjpeg_backend* backend = static_cast<nvjpeg_backend*>(ctx);
+  plane_layout layout;
+  nvjpegChromaSubsampling_t css;
+  if (!get_plane_layout(img->fmt, img->w, img->h, layout, css)) return -1;
+
+  std::lock_guard<std::mutex> lock(backend->mutex);
+  if (!reserve_planes(backend, layout)) return -1;
+  nvjpegImage_t source{};
+  for (int i = 0; i < layout.count; i++) {
+    const size_t stride = (size_t)img->stride[i] * (i == 0 ? layout.bytes_per_pixel : 1);
+    if (cudaMemcpy2DAsync(backend->planes[i], layout.w[i], img->planes[i], stride, layout.w[i],
+                          layout.h[i], cudaMemcpyHostToDevice, backend->stream) != cudaSuccess) {
+      return -1;
+    }
+    source.channel[i] = backend->planes[i];
+    source.pitch[i] = layout.w[i];
+  }
+  nvjpegEncoderParams_t params = backend->enc_params;
+  if (nvjpegEncoderParamsSetQuality(params, quality, backend->stream) != NVJPEG_STATUS_SUCCESS ||
+      nvjpegEncoderParamsSetSamplingFactors(params, css, backend->stream) !=
+          NVJPEG_STATUS_SUCCESS) {
+    return -1;
+  }
+  nvjpegStatus_t status;
+  if (img->fmt == UHDR_IMG_FMT_24bppRGB888) {
+    status = nvjpegEncodeImage(backend->handle, backend->enc_state, params, &source,
+                               NVJPEG_INPUT_RGBI, img->w, img->h, backend->stream);
+  } else {
+    status = nvjpegEncodeYUV(backend->handle, backend->enc_state, params, &source, css, img->w,
+                             img->h, backend->stream);
+  }
+  if (status != NVJPEG_STATUS_SUCCESS) return -1;
+  size_t length = 0;
+  if (nvjpegEncodeRetrieveBitstream(backend->handle, backend->enc_state, nullptr, &length,
+                                    backend->stream) != NVJPEG_STATUS_SUCCESS) {
+    return -1;
+  }
+  t_bitstream.resize(length);
+  if (nvjpegEncodeRetrieveBitstream(backend->handle, backend->enc_state, t_bitstream.data(),
+                                    &length, backend->stream) != NVJPEG_STATUS_SUCCESS ||
+      cudaStreamSynchronize(backend->stream) != cudaSuccess) {
+    return -1;
+  }
+  dst->data = t_bitstream.data();
+  dst->data_sz = dst->capacity = length;
+  return 0;
+}
+
+int nvjpeg_decompress(void* ctx, const uhdr_compressed_image_t* src, uhdr_raw_image_t* dst) {
+  nvjpeg_backend* backend = static_cast<nvjpeg_backend*>(ctx);
+  plane_layout layout;
+  nvjpegChromaSubsampling_t css;
+  if (dst->fmt == UHDR_IMG_FMT_24bppRGB888 ||
+      !get_plane_layout(dst->fmt, dst->w, dst->h, layout, css)) {
+    return -1;
+  }
+  const unsigned char* data = static_cast<const unsigned char*>(src->data);
+
+  std::lock_guard<std::mutex> lock(backend->mutex);
+  // progressive and arithmetic coded images, among others, are left to libjpeg
+  int components = 0;
+  nvjpegChromaSubsampling_t stream_css;
+  int widths[NVJPEG_MAX_COMPONENT], heights[NVJPEG_MAX_COMPONENT];
+  if (nvjpegGetImageInfo(backend->handle, data, src->data_sz, &components, &stream_css, widths,
+                         heights) != NVJPEG_STATUS_SUCCESS ||
+      stream_css != css || widths[0] != (int)dst->w || heights[0] != (int)dst->h) {
+    return -1;
+  }
+  if (!reserve_planes(backend, layout)) return -1;
+  nvjpegImage_t output{};
+  for (int i = 0; i < layout.count; i++) {
+    output.channel[i] = backend->planes[i];
+    output.pitch[i] = layout.w[i];
+  }
+  const nvjpegOutputFormat_t format = layout.count == 1 ? NVJPEG_OUTPUT_Y : NVJPEG_OUTPUT_YUV;
+  if (nvjpegDecode(backend->handle, backend->dec_state, data, src->data_sz, format, &output,
+                   backend->stream) != NVJPEG_STATUS_SUCCESS) {
+    return -1;
+  }
+  for (int i = 0; i < layout.count; i++) {
+    if (cudaMemcpy2DAsync(dst->planes[i], dst->stride[i], backend->planes[i], layout.w[i],
+                          layout.w[i], layout.h[i], cudaMemcpyDeviceToHost,
+                          backend->stream) != cudaSuccess) {
+      return -1;
+    }
+  }
+  return cudaStreamSynchronize(backend->stream) == cudaSuccess ? 0 : -1;
+}
+
+}  // namespace
+
+uhdr_jpeg_backend_t* create_nvjpeg_backend() {
+  int devices = 0;
+  if (cudaGetDeviceCount(&devices) != cudaSuccess || devices == 0) return nullptr;
+  nvjpeg_backend* backend = new nvjpeg_backend();
+  backend->hooks.compress = nvjpeg_compress;
+  backend->hooks.decompress = nvjpeg_decompress;
+  backend->hooks.backend_ctx = backend;
+  bool ok = cudaStreamCreateWithFlags(&backend->stream, cudaStreamNonBlocking) == cudaSuccess &&
+            nvjpegCreateSimple(&backend->handle) == NVJPEG_STATUS_SUCCESS &&
+            nvjpegJpegStateCreate(backend->handle, &backend->dec_state) ==
+                NVJPEG_STATUS_SUCCESS &&
+            nvjpegEncoderStateCreate(backend->handle, &backend->enc_state, backend->stream) ==
+                NVJPEG_STATUS_SUCCESS &&
+            nvjpegEncoderParamsCreate(backend->handle, &backend->enc_params, backend->stream) ==
+                NVJPEG_STATUS_SUCCESS;
+  if (!ok) {
+    release_nvjpeg_backend(&backend->hooks);
+    return nullptr;
+  }
+  return &backend->hooks;
+}
+
+void release_nvjpeg_backend(uhdr_jpeg_backend_t* hooks) {
+  if (hooks == nullptr) return;
+  nvjpeg_backend* backend = static_cast<nvjpeg_backend*>(hooks->backend_ctx);
+  if (backend->stream != nullptr) cudaStreamSynchronize(backend->stream);
+  for (unsigned char* plane : backend->planes) {
+    if (plane != nullptr) cudaFree(plane);
+  }
+  if (backend->enc_params != nullptr) nvjpegEncoderParamsDestroy(backend->enc_params);
+  if (backend->enc_state != nullptr) nvjpegEncoderStateDestroy(backend->enc_state);
+  if (backend->dec_state != nullptr) nvjpegJpegStateDestroy(backend->dec_state);
+  if (backend->handle != nullptr) nvjpegDestroy(backend->handle);
+  if (backend->stream != nullptr) cudaStreamDestroy(backend->stream);
+  delete backend;
+}
+
+}  // namespace ultrahdr
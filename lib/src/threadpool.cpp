@@ -0,0 +1,351 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "ultrahdr/threadpool.h"
+
+namespace ultrahdr {
+
+static thread_local CancelToken* t_current_cancel_token = nullptr;
+
+void CancelToken::arm(const int* flag, unsigned int timeLimitMs) {
+  mFlag = flag;
+  mHasDeadline = timeLimitMs != 0;
+  if (mHasDeadline) {
+    mDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeLimitMs);
+  }
+  mCancelled.store(false, std::memory_order_relaxed);
+}
+
+bool CancelToken::isCancelled() const {
+  if (mCancelled.load(std::memory_order_relaxed)) return true;
+  bool cancelled = false;
+  if (mFlag != nullptr) {
+    // written by the caller from any thread while the call runs
+#if defined(__GNUC__) || defined(__clang__)
+    cancelled = __atomic_load_n(mFlag, __ATOMIC_RELAXED) != 0;
+#else
+    cancelled = *static_cast<const volatile int*>(mFlag) != 0;
+#endif
+  }
+  if (!cancelled && mHasDeadline) cancelled = std::chrono::steady_clock::now() >= mDeadline;
+  if (cancelled) mCancelled.store(true, std::memory_order_relaxed);
+  return cancelled;
+}
+
+CancelToken* CancelToken::current() { return t_current_cancel_token; }
+
+uhdr_error_info_t CancelToken::check() {
+  uhdr_error_info_t status = {UHDR_CODEC_OK, 0, ""};
+  if (!cancelled()) return status;
+  status.error_code = UHDR_CODEC_CANCELLED;
+  status.has_detail = 1;
+  snprintf(status.detail, sizeof status.detail,
+           "the call was cancelled through its cancel flag or deadline");
+  return status;
+}
+
+CancelToken::Scope::Scope(CancelToken* token) : mPrev(t_current_cancel_token) {
+  t_current_cancel_token = token;
+}
+
+CancelToken::Scope::~Scope() { t_current_cancel_token = mPrev; }
+
+#if defined(__linux__)
+// capacity of a core, relative to the others. 0 if unknown
+static unsigned long ReadCoreCapacity(int cpu) {
+  static const char* const kSources[] = {"/sys/devices/system/cpu/cpu%d/cpu_capacity",
+                                         "/sys/devices/system/cpu/cpu%d/cpufreq/cpuinfo_max_freq"};
+  for (const char* source : kSources) {
+    char path[96];
+    snprintf(path, sizeof path, source, cpu);
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) continue;
+    unsigned long value = 0;
+    bool ok = fscanf(file, "%lu", &value) == 1;
+    fclose(file);
+    if (ok && value > 0) return value;
+  }
+  return 0;
+}
+
+// cores of a NUMA node as listed by the kernel, e.g. "0-7,16-23"
+static std::vector<int> ReadNodeCores(int node) {
+  std::vector<int> cores;
+  char path[64];
+  snprintf(path, sizeof path, "/sys/devices/system/node/node%d/cpulist", node);
+  FILE* file = fopen(path, "r");
+  if (file == nullptr) return cores;
+  int first, last;
+  while (fscanf(file, "%d", &first) == 1) {
+    last = first;
+    int separator = fgetc(file);
+    if (separator == '-') {
+      if (fscanf(file, "%d", &last) != 1) break;
+      separator = fgetc(file);
+    }
+    for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) cores.push_back(cpu);
+    if (separator != ',') break;
+  }
+  fclose(file);
+  return cores;
+}
+#endif
+
+CpuTopology::CpuTopology() {
+#if defined(__linux__)
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof allowed, &allowed) != 0) return;
+
+  if (DIR* dir = opendir("/sys/devices/system/node")) {
+    while (dirent* entry = readdir(dir)) {
+      int node;
+      if (sscanf(entry->d_name, "node%d", &node) != 1) continue;
+      std::vector<int> cores;
+      for (int cpu : ReadNodeCores(node)) {
+        if (CPU_ISSET(cpu, &allowed)) cores.push_back(cpu);
+      }
+      if (!cores.empty()) mNumaNodes.push_back(std::move(cores));
+    }
+    closedir(dir);
+    if (mNumaNodes.size() < 2) {
+      mNumaNodes.clear();
+    } else {
+      std::sort(mNumaNodes.begin(), mNumaNodes.end());
+    }
+  }
+
+  std::vector<std::pair<int, unsigned long>> capacities;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, &allowed)) continue;
+    unsigned long capacity = ReadCoreCapacity(cpu);
+    if (capacity == 0) return;  // a partial ranking is no ranking
+    capacities.emplace_back(cpu, capacity);
+  }
+  if (capacities.empty()) return;
+  auto [lowest, highest] = std::minmax_element(
+      capacities.begin(), capacities.end(),
+      [](const auto& a, const auto& b) { return a.second < b.second; });
+  const unsigned long minCapacity = lowest->second, maxCapacity = highest->second;
+  if (minCapacity == maxCapacity) return;
+  for (const auto& [cpu, capacity] : capacities) {
+    if (capacity == maxCapacity) mPerformanceCores.push_back(cpu);
+    if (capacity == minCapacity) mEfficiencyCores.push_back(cpu);
+  }
+#endif
+}
+
+const CpuTopology& CpuTopology::get() {
+  static const CpuTopology topology;
+  return topology;
+}
+
+const std::vector<int>& CpuTopology::cores(uhdr_core_affinity_t affinity) const {
+  static const std::vector<int> kNone;
+  if (affinity == UHDR_CORES_PERFORMANCE) return mPerformanceCores;
+  if (affinity == UHDR_CORES_EFFICIENCY) return mEfficiencyCores;
+  return kNone;
+}
+
+static thread_local const std::vector<int>* t_pinned_cores = nullptr;
+
+CoreAffinityScope::CoreAffinityScope(uhdr_core_affinity_t affinity)
+    : CoreAffinityScope(CpuTopology::get().cores(affinity)) {}
+
+CoreAffinityScope::CoreAffinityScope([[maybe_unused]] const std::vector<int>& cores) {
+#if defined(__linux__)
+  if (cores.empty()) return;
+  cpu_set_t prev, mask;
+  if (sched_getaffinity(0, sizeof prev, &prev) != 0) return;
+  CPU_ZERO(&mask);
+  for (int cpu : cores) CPU_SET(cpu, &mask);
+  if (sched_setaffinity(0, sizeof mask, &mask) != 0) return;
+  mPrevMask.resize(sizeof prev);
+  memcpy(mPrevMask.data(), &prev, sizeof prev);
+  mPinned = true;
+  mCores = cores;
+  mPrevCores = t_pinned_cores;
+  t_pinned_cores = &mCores;
+#endif
+}
+
+CoreAffinityScope::~CoreAffinityScope() {
+#if defined(__linux__)
+  if (!mPinned) return;
+  t_pinned_cores = mPrevCores;
+  cpu_set_t prev;
+  memcpy(&prev, mPrevMask.data(), sizeof prev);
+  sched_setaffinity(0, sizeof prev, &prev);
+#endif
+}
+
+const std::vector<int>* CoreAffinityScope::current() { return t_pinned_cores; }
+
+JobQueue::JobQueue(unsigned int numRows, unsigned int rowAlignment, unsigned int numWorkers)
+    : mNumRows(numRows),
+      mRowAlignment((std::max)(rowAlignment, 1u)),
+      mNumWorkers((std::max)(numWorkers, 1u)),
+      mChunkDivisor(mNumWorkers * (CpuTopology::get().isHeterogeneous() ? 4 : 2)) {}
+
+bool JobQueue::dequeueJob(unsigned int& rowStart, unsigned int& rowEnd) {
+  if (CancelToken::cancelled()) return false;
+  unsigned int start = mNextRow.load(std::memory_order_relaxed);
+  while (start < mNumRows) {
+    unsigned int remaining = mNumRows - start;
+    unsigned int chunk = mNumWorkers == 1 ? remaining : remaining / mChunkDivisor;
+    chunk = (std::max)(chunk / mRowAlignment, 1u) * mRowAlignment;
+    unsigned int end = (std::min)(start + chunk, mNumRows);
+    if (mNextRow.compare_exchange_weak(start, end, std::memory_order_relaxed)) {
+      rowStart = start;
+      rowEnd = end;
+      return true;
+    }
+  }
+  return false;
+}
+
+void JobQueue::reset() { mNextRow.store(0, std::memory_order_relaxed); }
+
+ThreadPool::~ThreadPool() {
+  {
+    std::unique_lock<std::mutex> lock{mMutex};
+    mStop = true;
+  }
+  mCv.notify_all();
+  for (auto& worker : mWorkers) worker.join();
+}
+
+ThreadPool& ThreadPool::getDefaultPool() {
+  static ThreadPool pool;
+  return pool;
+}
+
+void ThreadPool::ensureWorkers(size_t count) {
+  // caller holds mMutex
+  while (mWorkers.size() < count) {
+    mWorkers.emplace_back(&ThreadPool::workerLoop, this);
+  }
+}
+
+void ThreadPool::workerLoop() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock{mMutex};
+      mCv.wait(lock,
+               [this] { return mStop || !mTasks.empty() || !mDetachedTasks.empty(); });
+      // jobs of run() first, a caller is blocked on them
+      std::deque<std::function<void()>>& queue = !mTasks.empty() ? mTasks : mDetachedTasks;
+      if (queue.empty()) return;
+      task = std::move(queue.front());
+      queue.pop_front();
+    }
+    task();
+  }
+}
+
+void ThreadPool::run(const std::function<void()>& job, unsigned int parallelism) {
+#ifdef UHDR_NO_THREADS
+  parallelism = 1;
+#endif
+  if (parallelism <= 1) {
+    job();
+    return;
+  }
+
+  unsigned int pending = parallelism - 1;  // guarded by mMutex
+  std::unique_lock<std::mutex> lock{mMutex};
+  ensureWorkers(parallelism - 1);
+  for (unsigned int i = 0; i < parallelism - 1; i++) {
+    mTasks.emplace_back([this, &job, &pending]() {
+      job();
+      std::unique_lock<std::mutex> doneLock{mMutex};
+      if (--pending == 0) mDoneCv.notify_all();
+    });
+  }
+  lock.unlock();
+  mCv.notify_all();
+
+  job();
+
+  // Instead of idling until the remaining instances finish, the caller drains queued tasks. When
+  // run() is called from within a job, the pool threads may all be busy, and the nested call
+  // still makes progress because its instances can always be run by the caller itself.
+  lock.lock();
+  while (pending > 0) {
+    if (mTasks.empty()) {
+      mDoneCv.wait(lock);
+      continue;
+    }
+    std::function<void()> task = std::move(mTasks.front());
+    mTasks.pop_front();
+    lock.unlock();
+    task();
+    lock.lock();
+  }
+}
+
+size_t ThreadPool::detachedWorkers() const {
+  // caller holds mMutex
+  size_t cores = (std::max)(1u, std::thread::hardware_concurrency());
+  return (std::min)(mDetachedCount, cores) + mBlockingCount;
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+#ifdef UHDR_NO_THREADS
+  task();
+#else
+  std::unique_lock<std::mutex> lock{mMutex};
+  mDetachedCount++;
+  ensureWorkers(detachedWorkers());
+  mDetachedTasks.emplace_back([this, task = std::move(task)]() {
+    task();
+    std::unique_lock<std::mutex> doneLock{mMutex};
+    mDetachedCount--;
+  });
+  lock.unlock();
+  mCv.notify_one();
+#endif
+}
+
+void ThreadPool::submitBlocking(std::function<void()> task) {
+#ifdef UHDR_NO_THREADS
+  task();
+#else
+  // a blocked task holds one thread at most, the others stay available to the rest of the queue
+  std::unique_lock<std::mutex> lock{mMutex};
+  mBlockingCount++;
+  ensureWorkers(detachedWorkers());
+  mDetachedTasks.emplace_back([this, task = std::move(task)]() {
+    task();
+    std::unique_lock<std::mutex> doneLock{mMutex};
+    mBlockingCount--;
+  });
+  lock.unlock();
+  mCv.notify_one();
+#endif
+}
+
+}  // namespace ultrahdr
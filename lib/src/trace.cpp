@@ -0,0 +1,64 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef UHDR_ENABLE_TRACING
+
+#if defined(__ANDROID__) && __ANDROID_API__ >= 23
+#include <android/trace.h>
+#define UHDR_HAS_ATRACE 1
+#endif
+
+#include <atomic>
+
+#include "ultrahdr/trace.h"
+
+namespace ultrahdr {
+
+// ctx is published before fn and read after it, see setTraceCallback()
+static std::atomic<uhdr_trace_fn_t> g_trace_fn{nullptr};
+static std::atomic<void*> g_trace_ctx{nullptr};
+
+void setTraceCallback(uhdr_trace_fn_t fn, void* ctx) {
+  g_trace_fn.store(nullptr, std::memory_order_release);
+  g_trace_ctx.store(ctx, std::memory_order_release);
+  g_trace_fn.store(fn, std::memory_order_release);
+}
+
+void traceBegin(const char* name) {
+  uhdr_trace_fn_t fn = g_trace_fn.load(std::memory_order_acquire);
+  if (fn != nullptr) {
+    fn(g_trace_ctx.load(std::memory_order_acquire), name, 1);
+    return;
+  }
+#ifdef UHDR_HAS_ATRACE
+  ATrace_beginSection(name);
+#endif
+}
+
+void traceEnd(const char* name) {
+  uhdr_trace_fn_t fn = g_trace_fn.load(std::memory_order_acquire);
+  if (fn != nullptr) {
+    fn(g_trace_ctx.load(std::memory_order_acquire), name, 0);
+    return;
+  }
+#ifdef UHDR_HAS_ATRACE
+  ATrace_endSection();
+#endif
+}
+
+}  // namespace ultrahdr
+
+#endif  // UHDR_ENABLE_TRACING
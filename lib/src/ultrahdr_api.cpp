@@ -14,15 +14,31 @@
  * limitations under the License.
  */
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <cstdio>
 #include <cstring>
+#include <numeric>
+#include <optional>
+#include <thread>
 
 #include "ultrahdr_api.h"
 #include "ultrahdr/ultrahdrcommon.h"
+#include "ultrahdr/decodercache.h"
 #include "ultrahdr/gainmapmath.h"
 #include "ultrahdr/editorhelper.h"
 #include "ultrahdr/jpegr.h"
 #include "ultrahdr/jpegrutils.h"
+#include "ultrahdr/threadpool.h"
+#include "ultrahdr/trace.h"
 
 #include "image_io/base/data_segment_data_source.h"
 #include "image_io/jpeg/jpeg_info.h"
@@ -35,8 +51,18 @@ using namespace photos_editing_formats::image_io;
 namespace ultrahdr {
 
 uhdr_memory_block::uhdr_memory_block(size_t capacity) {
-  m_buffer = std::make_unique<uint8_t[]>(capacity);
+  MemoryArena::Releaser releaser;
+  MemoryArena* arena = MemoryArena::current();
+  uint8_t* data = arena ? arena->acquire(capacity, releaser)
+                        : MemoryArena::allocate(capacity, false, releaser);
+  m_buffer = std::unique_ptr<uint8_t[], MemoryArena::Releaser>(data, releaser);
   m_capacity = capacity;
+  m_stats = CodecStats::current();
+  if (m_stats != nullptr) m_stats->onAllocate(capacity);
+}
+
+uhdr_memory_block::~uhdr_memory_block() {
+  if (m_stats != nullptr) m_stats->onRelease(m_capacity);
 }
 
 uhdr_raw_image_ext::uhdr_raw_image_ext(uhdr_img_fmt_t fmt_, uhdr_color_gamut_t cg_,
@@ -50,8 +76,6 @@ uhdr_raw_image_ext::uhdr_raw_image_ext(uhdr_img_fmt_t fmt_, uhdr_color_gamut_t c
   this->w = w_;
   this->h = h_;
 
-  int aligned_width = ALIGNM(w_, align_stride_to);
-
   size_t bpp = 1;
   if (fmt_ == UHDR_IMG_FMT_24bppYCbCrP010 || fmt_ == UHDR_IMG_FMT_30bppYCbCr444) {
     bpp = 2;
@@ -63,6 +87,16 @@ uhdr_raw_image_ext::uhdr_raw_image_ext(uhdr_img_fmt_t fmt_, uhdr_color_gamut_t c
     bpp = 8;
   }
 
+  int aligned_width = ALIGNM(w_, align_stride_to);
+  if (align_stride_to > 1) {
+    // rows of every plane start on a block alignment boundary, so simd kernels load whole aligned
+    // vectors and may run past the width into the padding. Subsampled chroma rows are half as wide
+    const size_t block = MemoryArena::kBlockAlignment;
+    size_t row_multiple = block / std::gcd(block, bpp);
+    if (fmt_ == UHDR_IMG_FMT_12bppYCbCr420) row_multiple *= 2;
+    aligned_width = ALIGNM(aligned_width, (int)row_multiple);
+  }
+
   size_t plane_1_sz = bpp * aligned_width * h_;
   size_t plane_2_sz;
   size_t plane_3_sz;
@@ -108,6 +142,53 @@ uhdr_raw_image_ext::uhdr_raw_image_ext(uhdr_img_fmt_t fmt_, uhdr_color_gamut_t c
   }
 }
 
+uhdr_raw_image_ext::uhdr_raw_image_ext(const uhdr_raw_image_t& borrowed)
+    : uhdr_raw_image_t(borrowed) {}
+
+uhdr_raw_image_ext::uhdr_raw_image_ext(const uhdr_raw_image_ext& parent, unsigned left,
+                                       unsigned top, unsigned w_, unsigned h_)
+    : uhdr_raw_image_t(parent), m_block(parent.m_block), m_is_view(true) {
+  this->w = w_;
+  this->h = h_;
+
+  size_t bpp = 1;
+  if (fmt == UHDR_IMG_FMT_24bppYCbCrP010 || fmt == UHDR_IMG_FMT_30bppYCbCr444) {
+    bpp = 2;
+  } else if (fmt == UHDR_IMG_FMT_24bppRGB888) {
+    bpp = 3;
+  } else if (fmt == UHDR_IMG_FMT_32bppRGBA8888 || fmt == UHDR_IMG_FMT_32bppRGBA1010102) {
+    bpp = 4;
+  } else if (fmt == UHDR_IMG_FMT_64bppRGBAHalfFloat) {
+    bpp = 8;
+  }
+
+  uint8_t* y = static_cast<uint8_t*>(parent.planes[UHDR_PLANE_Y]);
+  this->planes[UHDR_PLANE_Y] = y + bpp * ((size_t)top * parent.stride[UHDR_PLANE_Y] + left);
+  if (fmt == UHDR_IMG_FMT_24bppYCbCrP010) {
+    // interleaved u and v, a chroma sample is two values wide
+    uint8_t* uv = static_cast<uint8_t*>(parent.planes[UHDR_PLANE_UV]);
+    this->planes[UHDR_PLANE_UV] =
+        uv + bpp * ((size_t)(top / 2) * parent.stride[UHDR_PLANE_UV] + (left / 2) * 2);
+  } else if (fmt == UHDR_IMG_FMT_30bppYCbCr444 || fmt == UHDR_IMG_FMT_24bppYCbCr444 ||
+             fmt == UHDR_IMG_FMT_12bppYCbCr420) {
+    const bool subsampled = fmt == UHDR_IMG_FMT_12bppYCbCr420;
+    const size_t x = subsampled ? left / 2 : left;
+    const size_t row = subsampled ? top / 2 : top;
+    for (int i = UHDR_PLANE_U; i <= UHDR_PLANE_V; i++) {
+      uint8_t* c = static_cast<uint8_t*>(parent.planes[i]);
+      this->planes[i] = c + bpp * (row * parent.stride[i] + x);
+    }
+  }
+}
+
+void uhdr_raw_image_ext::detach() {
+  if (m_block == nullptr) return;
+  // released straight to its allocator rather than recycled into the arena
+  m_block->m_buffer.get_deleter().arena = nullptr;
+  if (m_block->m_stats != nullptr) m_block->m_stats->onRelease(m_block->m_capacity);
+  m_block->m_stats = nullptr;
+}
+
 uhdr_compressed_image_ext::uhdr_compressed_image_ext(uhdr_color_gamut_t cg_,
                                                      uhdr_color_transfer_t ct_,
                                                      uhdr_color_range_t range_, size_t size) {
@@ -120,30 +201,96 @@ uhdr_compressed_image_ext::uhdr_compressed_image_ext(uhdr_color_gamut_t cg_,
   this->range = range_;
 }
 
+uhdr_compressed_image_ext::uhdr_compressed_image_ext(const uhdr_compressed_image_t& borrowed)
+    : uhdr_compressed_image_t(borrowed) {}
+
+#ifndef UHDR_DECODER_ONLY
+// Replaces the hdr intent and the sdr intent, if present, by fn() of them
+template <typename Fn>
+static bool replace_raw_images(uhdr_encoder_private* enc, Fn fn) {
+  auto hdr_entry = enc->m_raw_images.find(UHDR_HDR_IMG);
+  auto sdr_entry = enc->m_raw_images.find(UHDR_SDR_IMG);
+  const bool has_sdr = sdr_entry != enc->m_raw_images.end();
+  std::unique_ptr<ultrahdr::uhdr_raw_image_ext_t> hdr_img = fn(hdr_entry->second.get());
+  std::unique_ptr<ultrahdr::uhdr_raw_image_ext_t> sdr_img =
+      has_sdr ? fn(sdr_entry->second.get()) : nullptr;
+  if (hdr_img == nullptr || (has_sdr && sdr_img == nullptr)) return false;
+  hdr_entry->second = std::move(hdr_img);
+  if (has_sdr) sdr_entry->second = std::move(sdr_img);
+  return true;
+}
+
+// Runs the effects of transform as one resample of each intent to the output size. With an sdr
+// intent, the hdr intent only feeds the gain map. It is then resampled straight to the gain map
+// resolution, and neither intent takes a full size copy besides the base image.
+static uhdr_error_info_t resample_raw_images(uhdr_encoder_private* enc,
+                                             const ultrahdr::uhdr_gainmap_transform_t& transform) {
+  auto hdr_entry = enc->m_raw_images.find(UHDR_HDR_IMG);
+  auto sdr_entry = enc->m_raw_images.find(UHDR_SDR_IMG);
+  const bool has_sdr = sdr_entry != enc->m_raw_images.end();
+  ultrahdr::uhdr_gainmap_transform_t hdr_transform = transform;
+  unsigned int hdr_downscale = 1;
+  // the auto scale factor is chosen from the hdr intent at the output size
+  const int scale = enc->m_gainmap_scale_factor;
+  if (has_sdr && !enc->m_auto_gainmap_scale_factor && scale > 1) {
+    const int map_w = transform.width() / scale, map_h = transform.height() / scale;
+    const bool subsampled = hdr_entry->second->fmt == UHDR_IMG_FMT_24bppYCbCrP010;
+    if (map_w > 0 && map_h > 0 && (!subsampled || (map_w % 2 == 0 && map_h % 2 == 0)) &&
+        hdr_transform.resize(map_w, map_h, transform.m_filter)) {
+      hdr_downscale = scale;
+    }
+  }
+
+  std::unique_ptr<ultrahdr::uhdr_raw_image_ext_t> hdr_img =
+      apply_gainmap_transform(hdr_transform, hdr_entry->second.get());
+  std::unique_ptr<ultrahdr::uhdr_raw_image_ext_t> sdr_img =
+      has_sdr ? apply_gainmap_transform(transform, sdr_entry->second.get()) : nullptr;
+  if (hdr_img == nullptr || (has_sdr && sdr_img == nullptr)) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_UNKNOWN_ERROR;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "encountered unknown error while applying effects, unsupported color format");
+    return status;
+  }
+  hdr_entry->second = std::move(hdr_img);
+  if (has_sdr) sdr_entry->second = std::move(sdr_img);
+  enc->m_hdr_intent_downscale = hdr_downscale;
+  return g_no_error;
+}
+
+// The effects only move pixels, so the list is validated and folded into one effect chain first,
+// then the images are copied once. A chain that only crops shares the memory of the images. A
+// resize with a blending filter does not fold into the chain, the list then runs as one resample,
+// see resample_raw_images().
 uhdr_error_info_t apply_effects(uhdr_encoder_private* enc) {
+  if (enc->m_effects.empty()) return g_no_error;
+
+  ultrahdr::uhdr_raw_image_ext_t* hdr_raw_entry =
+      enc->m_raw_images.find(UHDR_HDR_IMG)->second.get();
+  auto sdr_entry = enc->m_raw_images.find(UHDR_SDR_IMG);
+  ultrahdr::uhdr_raw_image_ext_t* sdr_raw_entry =
+      sdr_entry != enc->m_raw_images.end() ? sdr_entry->second.get() : nullptr;
+  ultrahdr::uhdr_effect_chain_t chain(hdr_raw_entry->w, hdr_raw_entry->h);
+  ultrahdr::uhdr_gainmap_transform_t transform(hdr_raw_entry->w, hdr_raw_entry->h);
+  auto run_chain = [&chain](ultrahdr::uhdr_raw_image_ext_t* img) {
+    return apply_effect_chain(chain, img);
+  };
+  bool resampled = false;
+
   for (auto& it : enc->m_effects) {
-    std::unique_ptr<ultrahdr::uhdr_raw_image_ext_t> hdr_img = nullptr;
-    std::unique_ptr<ultrahdr::uhdr_raw_image_ext_t> sdr_img = nullptr;
+    bool supported = true;
 
     if (nullptr != dynamic_cast<uhdr_rotate_effect_t*>(it)) {
-      auto& hdr_raw_entry = enc->m_raw_images.find(UHDR_HDR_IMG)->second;
-      hdr_img = apply_rotate(dynamic_cast<uhdr_rotate_effect_t*>(it), hdr_raw_entry.get());
-      if (enc->m_raw_images.find(UHDR_SDR_IMG) != enc->m_raw_images.end()) {
-        auto& sdr_raw_entry = enc->m_raw_images.find(UHDR_SDR_IMG)->second;
-        sdr_img = apply_rotate(dynamic_cast<uhdr_rotate_effect_t*>(it), sdr_raw_entry.get());
-      }
+      int degree = dynamic_cast<uhdr_rotate_effect_t*>(it)->m_degree;
+      supported = chain.rotate(degree) && transform.rotate(degree);
     } else if (nullptr != dynamic_cast<uhdr_mirror_effect_t*>(it)) {
-      auto& hdr_raw_entry = enc->m_raw_images.find(UHDR_HDR_IMG)->second;
-      hdr_img = apply_mirror(dynamic_cast<uhdr_mirror_effect_t*>(it), hdr_raw_entry.get());
-      if (enc->m_raw_images.find(UHDR_SDR_IMG) != enc->m_raw_images.end()) {
-        auto& sdr_raw_entry = enc->m_raw_images.find(UHDR_SDR_IMG)->second;
-        sdr_img = apply_mirror(dynamic_cast<uhdr_mirror_effect_t*>(it), sdr_raw_entry.get());
-      }
+      uhdr_mirror_direction_t direction = dynamic_cast<uhdr_mirror_effect_t*>(it)->m_direction;
+      supported = chain.mirror(direction) && transform.mirror(direction);
     } else if (nullptr != dynamic_cast<uhdr_crop_effect_t*>(it)) {
       auto crop_effect = dynamic_cast<uhdr_crop_effect_t*>(it);
-      auto& hdr_raw_entry = enc->m_raw_images.find(UHDR_HDR_IMG)->second;
       int left = (std::max)(0, crop_effect->m_left);
-      int right = (std::min)((int)hdr_raw_entry->w, crop_effect->m_right);
+      int right = (std::min)(chain.width(), crop_effect->m_right);
       int crop_width = right - left;
       if (crop_width <= 0) {
         uhdr_error_info_t status;
@@ -166,7 +313,7 @@ uhdr_error_info_t apply_effects(uhdr_encoder_private* enc) {
       }
 
       int top = (std::max)(0, crop_effect->m_top);
-      int bottom = (std::min)((int)hdr_raw_entry->h, crop_effect->m_bottom);
+      int bottom = (std::min)(chain.height(), crop_effect->m_bottom);
       int crop_height = bottom - top;
       if (crop_height <= 0) {
         uhdr_error_info_t status;
@@ -187,10 +334,7 @@ uhdr_error_info_t apply_effects(uhdr_encoder_private* enc) {
                  crop_height);
         return status;
       }
-      hdr_img = apply_crop(dynamic_cast<ultrahdr::uhdr_crop_effect_t*>(it), hdr_raw_entry.get(),
-                           left, top, crop_width, crop_height);
-      if (enc->m_raw_images.find(UHDR_SDR_IMG) != enc->m_raw_images.end()) {
-        auto& sdr_raw_entry = enc->m_raw_images.find(UHDR_SDR_IMG)->second;
+      if (sdr_raw_entry != nullptr) {
         if (crop_width % 2 != 0 && sdr_raw_entry->fmt == UHDR_IMG_FMT_12bppYCbCr420) {
           uhdr_error_info_t status;
           status.error_code = UHDR_CODEC_INVALID_PARAM;
@@ -211,14 +355,13 @@ uhdr_error_info_t apply_effects(uhdr_encoder_private* enc) {
                    crop_height);
           return status;
         }
-        sdr_img = apply_crop(dynamic_cast<ultrahdr::uhdr_crop_effect_t*>(it), sdr_raw_entry.get(),
-                             left, top, crop_width, crop_height);
       }
+      supported = chain.crop(left, top, crop_width, crop_height) &&
+                  transform.crop(left, top, crop_width, crop_height);
     } else if (nullptr != dynamic_cast<uhdr_resize_effect_t*>(it)) {
       auto resize_effect = dynamic_cast<uhdr_resize_effect_t*>(it);
       int dst_w = resize_effect->m_width;
       int dst_h = resize_effect->m_height;
-      auto& hdr_raw_entry = enc->m_raw_images.find(UHDR_HDR_IMG)->second;
       if (dst_w <= 0 || dst_h <= 0 || dst_w > ultrahdr::kMaxWidth || dst_h > ultrahdr::kMaxHeight) {
         uhdr_error_info_t status;
         status.error_code = UHDR_CODEC_INVALID_PARAM;
@@ -237,10 +380,7 @@ uhdr_error_info_t apply_effects(uhdr_encoder_private* enc) {
                  dst_w, dst_h);
         return status;
       }
-      hdr_img =
-          apply_resize(dynamic_cast<uhdr_resize_effect_t*>(it), hdr_raw_entry.get(), dst_w, dst_h);
-      if (enc->m_raw_images.find(UHDR_SDR_IMG) != enc->m_raw_images.end()) {
-        auto& sdr_raw_entry = enc->m_raw_images.find(UHDR_SDR_IMG)->second;
+      if (sdr_raw_entry != nullptr) {
         if ((dst_w % 2 != 0 || dst_h % 2 != 0) &&
             sdr_raw_entry->fmt == UHDR_IMG_FMT_12bppYCbCr420) {
           uhdr_error_info_t status;
@@ -251,13 +391,18 @@ uhdr_error_info_t apply_effects(uhdr_encoder_private* enc) {
                    dst_w, dst_h);
           return status;
         }
-        sdr_img = apply_resize(dynamic_cast<uhdr_resize_effect_t*>(it), sdr_raw_entry.get(), dst_w,
-                               dst_h);
+      }
+      supported = transform.resize(dst_w, dst_h, resize_effect->m_filter);
+      if (resize_effect->m_filter == UHDR_RESIZE_NEAREST) {
+        supported = supported && chain.resize(dst_w, dst_h);
+      } else {
+        // the chain only keeps track of the dimensions from here
+        resampled = true;
+        chain = ultrahdr::uhdr_effect_chain_t(dst_w, dst_h);
       }
     }
 
-    if (hdr_img == nullptr ||
-        (enc->m_raw_images.find(UHDR_SDR_IMG) != enc->m_raw_images.end() && sdr_img == nullptr)) {
+    if (!supported) {
       uhdr_error_info_t status;
       status.error_code = UHDR_CODEC_UNKNOWN_ERROR;
       status.has_detail = 1;
@@ -265,126 +410,212 @@ uhdr_error_info_t apply_effects(uhdr_encoder_private* enc) {
                "encountered unknown error while applying effect %s", it->to_string().c_str());
       return status;
     }
-    enc->m_raw_images.insert_or_assign(UHDR_HDR_IMG, std::move(hdr_img));
-    if (sdr_img != nullptr) {
-      enc->m_raw_images.insert_or_assign(UHDR_SDR_IMG, std::move(sdr_img));
-    }
+  }
+
+  if (resampled) return resample_raw_images(enc, transform);
+  if (chain.m_count > 0 && !replace_raw_images(enc, run_chain)) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_UNKNOWN_ERROR;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "encountered unknown error while applying effects, unsupported color format");
+    return status;
   }
 
   return g_no_error;
 }
+#endif  // UHDR_DECODER_ONLY
 
 bool is_resize_effect(const ultrahdr::uhdr_effect_desc_t* effect) {
   return dynamic_cast<const ultrahdr::uhdr_resize_effect_t*>(effect) != nullptr;
 }
 
-uhdr_error_info_t apply_effects(uhdr_decoder_private* dec) {
+// crop rectangles of the display image and of its gain map, [left, right) x [top, bottom)
+struct crop_bounds_t {
+  int left, top, right, bottom;
+  int gm_left, gm_top, gm_right, gm_bottom;
+};
+
+// clamps a crop effect to the display image and maps it onto the gain map
+uhdr_error_info_t get_crop_bounds(const uhdr_crop_effect_t* crop, unsigned int disp_w,
+                                  unsigned int disp_h, unsigned int gm_w, unsigned int gm_h,
+                                  crop_bounds_t& b) {
+  b.left = (std::max)(0, crop->m_left);
+  b.right = (std::min)((int)disp_w, crop->m_right);
+  if (b.right <= b.left) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(
+        status.detail, sizeof status.detail,
+        "unexpected crop dimensions. crop right is <= crop left, after crop image width is %d",
+        b.right - b.left);
+    return status;
+  }
+
+  b.top = (std::max)(0, crop->m_top);
+  b.bottom = (std::min)((int)disp_h, crop->m_bottom);
+  if (b.bottom <= b.top) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(
+        status.detail, sizeof status.detail,
+        "unexpected crop dimensions. crop bottom is <= crop top, after crop image height is %d",
+        b.bottom - b.top);
+    return status;
+  }
+
+  float wd_ratio = ((float)disp_w) / gm_w;
+  float ht_ratio = ((float)disp_h) / gm_h;
+  b.gm_left = (int)(b.left / wd_ratio);
+  b.gm_right = (int)(b.right / wd_ratio);
+  if (b.gm_right <= b.gm_left) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "unexpected crop dimensions. crop right is <= crop left for gainmap image, after "
+             "crop gainmap image width is %d",
+             b.gm_right - b.gm_left);
+    return status;
+  }
+
+  b.gm_top = (int)(b.top / ht_ratio);
+  b.gm_bottom = (int)(b.bottom / ht_ratio);
+  if (b.gm_bottom <= b.gm_top) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "unexpected crop dimensions. crop bottom is <= crop top for gainmap image, after "
+             "crop gainmap image height is %d",
+             b.gm_bottom - b.gm_top);
+    return status;
+  }
+  return g_no_error;
+}
+
+#ifdef UHDR_ENABLE_GLES
+// The decoders of a process share one gpu. For a small image, the uploads, read backs and context
+// switch of the gpu path cost more than the cpu takes to apply the gain map, and a decode that
+// finds the gpu busy with others would queue behind them while the cpu idles. Such decodes run on
+// the cpu, so that a batch keeps both busy: large images on the gpu, the rest on worker threads.
+static const int kGpuDecodeMinPixels = 512 * 512;
+static const int kGpuDecodesMax = 2;
+static std::atomic<int> g_gpu_decodes{0};
+
+// Places a decode on the gpu. Returns true if it runs there, to be paired with release_gpu().
+bool acquire_gpu(uhdr_decoder_private* dec) {
+  if (!dec->m_enable_gles) return false;
+  // the gpu renders packed rgb only, P010 output is converted on the cpu
+  if (dec->m_output_fmt == UHDR_IMG_FMT_24bppYCbCrP010) return false;
+  // as is a conversion of the output gamut
+  if (dec->m_output_cg != UHDR_CG_UNSPECIFIED) return false;
+  // the texture output has to be rendered on the gpu
+  if (dec->m_gpu_output) {
+    g_gpu_decodes.fetch_add(1);
+    return true;
+  }
+  if ((int64_t)dec->m_img_wd * dec->m_img_ht < kGpuDecodeMinPixels) return false;
+  int decodes = g_gpu_decodes.load();
+  while (decodes < kGpuDecodesMax) {
+    if (g_gpu_decodes.compare_exchange_weak(decodes, decodes + 1)) return true;
+  }
+  return false;
+}
+
+void release_gpu() { g_gpu_decodes.fetch_sub(1); }
+#endif
+
+uhdr_error_info_t apply_effects(uhdr_decoder_private* dec, size_t first_effect = 0) {
   void *gl_ctxt = nullptr, *disp_texture_ptr = nullptr, *gm_texture_ptr = nullptr;
 #ifdef UHDR_ENABLE_GLES
-  if (dec->m_enable_gles) {
+  if (dec->m_use_gles) {
     gl_ctxt = &dec->m_uhdr_gl_ctxt;
     bool texture_created =
         dec->m_uhdr_gl_ctxt.mDecodedImgTexture != 0 && dec->m_uhdr_gl_ctxt.mGainmapImgTexture != 0;
     bool resize_effect_present = std::find_if(dec->m_effects.begin(), dec->m_effects.end(),
                                               is_resize_effect) != dec->m_effects.end();
-    if (!texture_created && resize_effect_present &&
-        isBufferDataContiguous(dec->m_decoded_img_buffer.get()) &&
-        isBufferDataContiguous(dec->m_gainmap_img_buffer.get())) {
-      dec->m_uhdr_gl_ctxt.mDecodedImgTexture = dec->m_uhdr_gl_ctxt.create_texture(
-          dec->m_decoded_img_buffer->fmt, dec->m_decoded_img_buffer->w,
-          dec->m_decoded_img_buffer->h, dec->m_decoded_img_buffer->planes[0]);
-      dec->m_uhdr_gl_ctxt.mGainmapImgTexture = dec->m_uhdr_gl_ctxt.create_texture(
-          dec->m_gainmap_img_buffer->fmt, dec->m_gainmap_img_buffer->w,
-          dec->m_gainmap_img_buffer->h, dec->m_gainmap_img_buffer->planes[0]);
+    if (!texture_created && resize_effect_present) {
+      dec->m_uhdr_gl_ctxt.mDecodedImgTexture =
+          dec->m_uhdr_gl_ctxt.create_texture(dec->m_decoded_img_buffer.get());
+      dec->m_uhdr_gl_ctxt.mGainmapImgTexture =
+          dec->m_uhdr_gl_ctxt.create_texture(dec->m_gainmap_img_buffer.get());
     }
     disp_texture_ptr = &dec->m_uhdr_gl_ctxt.mDecodedImgTexture;
     gm_texture_ptr = &dec->m_uhdr_gl_ctxt.mGainmapImgTexture;
   }
 #endif
-  for (auto& it : dec->m_effects) {
+  // the effects are folded into one pass per image, see apply_effects() of the encoder. On the
+  // gpu the pass runs on the textures, which are read back once after the last effect.
+  const bool on_gpu = gl_ctxt != nullptr;
+  ultrahdr::uhdr_effect_chain_t disp_chain(dec->m_decoded_img_buffer->w,
+                                           dec->m_decoded_img_buffer->h);
+  ultrahdr::uhdr_effect_chain_t gm_chain(dec->m_gainmap_img_buffer->w,
+                                         dec->m_gainmap_img_buffer->h);
+  // a blending resize breaks the chains. The gain map then takes all the effects in one resample
+  // at its own resolution, rather than a pass and a buffer per resize.
+  const bool gm_resampled =
+      !on_gpu && std::find_if(dec->m_effects.begin() + first_effect, dec->m_effects.end(),
+                            [](ultrahdr::uhdr_effect_desc_t* effect) {
+                              auto resize_effect = dynamic_cast<uhdr_resize_effect_t*>(effect);
+                              return resize_effect != nullptr &&
+                                     resize_effect->m_filter != UHDR_RESIZE_NEAREST;
+                            }) != dec->m_effects.end();
+  ultrahdr::uhdr_gainmap_transform_t gm_transform(gm_chain.width(), gm_chain.height());
+  // runs the effects folded so far, the chains restart on the result
+  auto run_chains = [&]() {
+    if (disp_chain.m_count == 0) return true;
+    auto disp_img = apply_effect_chain(disp_chain, dec->m_decoded_img_buffer.get(), gl_ctxt,
+                                       disp_texture_ptr);
+    if (disp_img == nullptr) return false;
+    if (!gm_resampled) {
+      auto gm_img =
+          apply_effect_chain(gm_chain, dec->m_gainmap_img_buffer.get(), gl_ctxt, gm_texture_ptr);
+      if (gm_img == nullptr) return false;
+      dec->m_gainmap_img_buffer = std::move(gm_img);
+    }
+    dec->m_decoded_img_buffer = std::move(disp_img);
+    disp_chain = ultrahdr::uhdr_effect_chain_t(disp_chain.width(), disp_chain.height());
+    gm_chain = ultrahdr::uhdr_effect_chain_t(gm_chain.width(), gm_chain.height());
+    return true;
+  };
+  for (size_t i = first_effect; i < dec->m_effects.size(); i++) {
+    ultrahdr::uhdr_effect_desc_t* it = dec->m_effects[i];
     std::unique_ptr<ultrahdr::uhdr_raw_image_ext_t> disp_img = nullptr;
     std::unique_ptr<ultrahdr::uhdr_raw_image_ext_t> gm_img = nullptr;
+    bool supported = true;
+    bool run_now = false;
 
     if (nullptr != dynamic_cast<uhdr_rotate_effect_t*>(it)) {
-      disp_img = apply_rotate(dynamic_cast<uhdr_rotate_effect_t*>(it),
-                              dec->m_decoded_img_buffer.get(), gl_ctxt, disp_texture_ptr);
-      gm_img = apply_rotate(dynamic_cast<uhdr_rotate_effect_t*>(it),
-                            dec->m_gainmap_img_buffer.get(), gl_ctxt, gm_texture_ptr);
+      auto rotate_effect = dynamic_cast<uhdr_rotate_effect_t*>(it);
+      supported = disp_chain.rotate(rotate_effect->m_degree) &&
+                  gm_chain.rotate(rotate_effect->m_degree) &&
+                  gm_transform.rotate(rotate_effect->m_degree);
     } else if (nullptr != dynamic_cast<uhdr_mirror_effect_t*>(it)) {
-      disp_img = apply_mirror(dynamic_cast<uhdr_mirror_effect_t*>(it),
-                              dec->m_decoded_img_buffer.get(), gl_ctxt, disp_texture_ptr);
-      gm_img = apply_mirror(dynamic_cast<uhdr_mirror_effect_t*>(it),
-                            dec->m_gainmap_img_buffer.get(), gl_ctxt, gm_texture_ptr);
+      auto mirror_effect = dynamic_cast<uhdr_mirror_effect_t*>(it);
+      supported = disp_chain.mirror(mirror_effect->m_direction) &&
+                  gm_chain.mirror(mirror_effect->m_direction) &&
+                  gm_transform.mirror(mirror_effect->m_direction);
     } else if (nullptr != dynamic_cast<uhdr_crop_effect_t*>(it)) {
       auto crop_effect = dynamic_cast<uhdr_crop_effect_t*>(it);
-      uhdr_raw_image_t* disp = dec->m_decoded_img_buffer.get();
-      uhdr_raw_image_t* gm = dec->m_gainmap_img_buffer.get();
-      int left = (std::max)(0, crop_effect->m_left);
-      int right = (std::min)((int)disp->w, crop_effect->m_right);
-      if (right <= left) {
-        uhdr_error_info_t status;
-        status.error_code = UHDR_CODEC_INVALID_PARAM;
-        status.has_detail = 1;
-        snprintf(
-            status.detail, sizeof status.detail,
-            "unexpected crop dimensions. crop right is <= crop left, after crop image width is %d",
-            right - left);
-        return status;
-      }
-
-      int top = (std::max)(0, crop_effect->m_top);
-      int bottom = (std::min)((int)disp->h, crop_effect->m_bottom);
-      if (bottom <= top) {
-        uhdr_error_info_t status;
-        status.error_code = UHDR_CODEC_INVALID_PARAM;
-        status.has_detail = 1;
-        snprintf(
-            status.detail, sizeof status.detail,
-            "unexpected crop dimensions. crop bottom is <= crop top, after crop image height is %d",
-            bottom - top);
-        return status;
-      }
-
-      float wd_ratio = ((float)disp->w) / gm->w;
-      float ht_ratio = ((float)disp->h) / gm->h;
-      int gm_left = (int)(left / wd_ratio);
-      int gm_right = (int)(right / wd_ratio);
-      if (gm_right <= gm_left) {
-        uhdr_error_info_t status;
-        status.error_code = UHDR_CODEC_INVALID_PARAM;
-        status.has_detail = 1;
-        snprintf(status.detail, sizeof status.detail,
-                 "unexpected crop dimensions. crop right is <= crop left for gainmap image, after "
-                 "crop gainmap image width is %d",
-                 gm_right - gm_left);
-        return status;
-      }
-
-      int gm_top = (int)(top / ht_ratio);
-      int gm_bottom = (int)(bottom / ht_ratio);
-      if (gm_bottom <= gm_top) {
-        uhdr_error_info_t status;
-        status.error_code = UHDR_CODEC_INVALID_PARAM;
-        status.has_detail = 1;
-        snprintf(status.detail, sizeof status.detail,
-                 "unexpected crop dimensions. crop bottom is <= crop top for gainmap image, after "
-                 "crop gainmap image height is %d",
-                 gm_bottom - gm_top);
-        return status;
-      }
-
-      disp_img = apply_crop(dynamic_cast<ultrahdr::uhdr_crop_effect_t*>(it), disp, left, top,
-                            right - left, bottom - top, gl_ctxt, disp_texture_ptr);
-      gm_img = apply_crop(dynamic_cast<ultrahdr::uhdr_crop_effect_t*>(it), gm, gm_left, gm_top,
-                          (gm_right - gm_left), (gm_bottom - gm_top), gl_ctxt, gm_texture_ptr);
+      crop_bounds_t b;
+      uhdr_error_info_t status =
+          get_crop_bounds(crop_effect, disp_chain.width(), disp_chain.height(), gm_chain.width(),
+                          gm_chain.height(), b);
+      if (status.error_code != UHDR_CODEC_OK) return status;
+
+      supported =
+          disp_chain.crop(b.left, b.top, b.right - b.left, b.bottom - b.top) &&
+          gm_chain.crop(b.gm_left, b.gm_top, b.gm_right - b.gm_left, b.gm_bottom - b.gm_top) &&
+          gm_transform.crop(b.gm_left, b.gm_top, b.gm_right - b.gm_left, b.gm_bottom - b.gm_top);
     } else if (nullptr != dynamic_cast<uhdr_resize_effect_t*>(it)) {
       auto resize_effect = dynamic_cast<uhdr_resize_effect_t*>(it);
       int dst_w = resize_effect->m_width;
       int dst_h = resize_effect->m_height;
-      float wd_ratio =
-          ((float)dec->m_decoded_img_buffer.get()->w) / dec->m_gainmap_img_buffer.get()->w;
-      float ht_ratio =
-          ((float)dec->m_decoded_img_buffer.get()->h) / dec->m_gainmap_img_buffer.get()->h;
+      float wd_ratio = ((float)disp_chain.width()) / gm_chain.width();
+      float ht_ratio = ((float)disp_chain.height()) / gm_chain.height();
       int dst_gm_w = (int)(dst_w / wd_ratio);
       int dst_gm_h = (int)(dst_h / ht_ratio);
       if (dst_w <= 0 || dst_h <= 0 || dst_gm_w <= 0 || dst_gm_h <= 0 ||
@@ -398,15 +629,30 @@ uhdr_error_info_t apply_effects(uhdr_decoder_private* dec) {
                  ultrahdr::kMaxWidth, ultrahdr::kMaxHeight, dst_w, dst_h, dst_gm_w, dst_gm_h);
         return status;
       }
-      disp_img =
-          apply_resize(dynamic_cast<uhdr_resize_effect_t*>(it), dec->m_decoded_img_buffer.get(),
-                       dst_w, dst_h, gl_ctxt, disp_texture_ptr);
-      gm_img =
-          apply_resize(dynamic_cast<uhdr_resize_effect_t*>(it), dec->m_gainmap_img_buffer.get(),
-                       dst_gm_w, dst_gm_h, gl_ctxt, gm_texture_ptr);
+      supported = gm_transform.resize(dst_gm_w, dst_gm_h, resize_effect->m_filter);
+      // a blending filter does not fold into the chains, the display image is resampled here. The
+      // gpu resize always blends.
+      if (on_gpu || resize_effect->m_filter != UHDR_RESIZE_NEAREST) {
+        run_now = true;
+        supported = supported && run_chains();
+        disp_chain = ultrahdr::uhdr_effect_chain_t(dst_w, dst_h);
+        gm_chain = ultrahdr::uhdr_effect_chain_t(dst_gm_w, dst_gm_h);
+      } else {
+        supported = supported && disp_chain.resize(dst_w, dst_h) &&
+                    gm_chain.resize(dst_gm_w, dst_gm_h);
+      }
+      if (run_now && supported) {
+        disp_img = apply_resize(resize_effect, dec->m_decoded_img_buffer.get(), dst_w, dst_h,
+                                gl_ctxt, disp_texture_ptr);
+        if (!gm_resampled) {
+          gm_img = apply_resize(resize_effect, dec->m_gainmap_img_buffer.get(), dst_gm_w,
+                                dst_gm_h, gl_ctxt, gm_texture_ptr);
+        }
+      }
     }
 
-    if (disp_img == nullptr || gm_img == nullptr) {
+    if (!supported ||
+        (run_now && (disp_img == nullptr || (gm_img == nullptr && !gm_resampled)))) {
       uhdr_error_info_t status;
       status.error_code = UHDR_CODEC_UNKNOWN_ERROR;
       status.has_detail = 1;
@@ -414,12 +660,68 @@ uhdr_error_info_t apply_effects(uhdr_decoder_private* dec) {
                "encountered unknown error while applying effect %s", it->to_string().c_str());
       return status;
     }
-    dec->m_decoded_img_buffer = std::move(disp_img);
+    if (run_now) {
+      dec->m_decoded_img_buffer = std::move(disp_img);
+      if (!gm_resampled) dec->m_gainmap_img_buffer = std::move(gm_img);
+    }
+  }
+
+  if (gm_resampled) {
+    auto gm_img = apply_gainmap_transform(gm_transform, dec->m_gainmap_img_buffer.get());
+    if (gm_img == nullptr) {
+      uhdr_error_info_t status;
+      status.error_code = UHDR_CODEC_UNKNOWN_ERROR;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "encountered unknown error while applying effects to the gainmap image, "
+               "unsupported color format");
+      return status;
+    }
     dec->m_gainmap_img_buffer = std::move(gm_img);
   }
+  if (!run_chains()) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_UNKNOWN_ERROR;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "encountered unknown error while applying effects, unsupported color format");
+    return status;
+  }
   return g_no_error;
 }
 
+// Folds the effects of dec into the chains if all of them only move and drop pixels, that is
+// rotations, mirrors and crops. Returns false otherwise, and for effects with bad parameters, which
+// are left to apply_effects() to report.
+bool fold_pixel_effects(uhdr_decoder_private* dec, uhdr_effect_chain_t& disp_chain,
+                        uhdr_effect_chain_t& gm_chain) {
+  for (ultrahdr::uhdr_effect_desc_t* it : dec->m_effects) {
+    if (auto rotate_effect = dynamic_cast<uhdr_rotate_effect_t*>(it)) {
+      if (!disp_chain.rotate(rotate_effect->m_degree) ||
+          !gm_chain.rotate(rotate_effect->m_degree)) {
+        return false;
+      }
+    } else if (auto mirror_effect = dynamic_cast<uhdr_mirror_effect_t*>(it)) {
+      if (!disp_chain.mirror(mirror_effect->m_direction) ||
+          !gm_chain.mirror(mirror_effect->m_direction)) {
+        return false;
+      }
+    } else if (auto crop_effect = dynamic_cast<uhdr_crop_effect_t*>(it)) {
+      crop_bounds_t b;
+      if (get_crop_bounds(crop_effect, disp_chain.width(), disp_chain.height(), gm_chain.width(),
+                          gm_chain.height(), b)
+                  .error_code != UHDR_CODEC_OK ||
+          !disp_chain.crop(b.left, b.top, b.right - b.left, b.bottom - b.top) ||
+          !gm_chain.crop(b.gm_left, b.gm_top, b.gm_right - b.gm_left, b.gm_bottom - b.gm_top)) {
+        return false;
+      }
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
 uhdr_error_info_t uhdr_validate_gainmap_metadata_descriptor(uhdr_gainmap_metadata_t* metadata) {
   uhdr_error_info_t status = g_no_error;
 
@@ -484,6 +786,138 @@ uhdr_error_info_t uhdr_validate_gainmap_metadata_descriptor(uhdr_gainmap_metadat
   return status;
 }
 
+// Runs op on the library pool. The context is busy until op has returned, its completion callback
+// runs after that, so that the callback may release the context. op only waits on the base image
+// decode of a complete input stream, which runs on a thread of its own, so the async calls are
+// never held back by streams waiting on input.
+uhdr_error_info_t run_async(uhdr_codec_private_t* codec,
+                            uhdr_error_info_t (*op)(uhdr_codec_private_t*),
+                            uhdr_completion_fn_t on_done, void* user_ctx) {
+  {
+    std::lock_guard<std::mutex> lock(codec->m_async_mutex);
+    if (codec->m_async_pending) {
+      uhdr_error_info_t status;
+      status.error_code = UHDR_CODEC_INVALID_OPERATION;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "an asynchronous encode/decode of the context is still in flight");
+      return status;
+    }
+    codec->m_async_pending = true;
+  }
+  ThreadPool::getDefaultPool().submit([codec, op, on_done, user_ctx]() {
+    uhdr_error_info_t status = op(codec);
+    {
+      std::lock_guard<std::mutex> lock(codec->m_async_mutex);
+      codec->m_async_pending = false;
+      codec->m_async_cv.notify_all();
+    }
+    if (on_done != nullptr) on_done(user_ctx, codec, status);
+  });
+  return g_no_error;
+}
+
+void wait_async(uhdr_codec_private_t* codec) {
+  std::unique_lock<std::mutex> lock(codec->m_async_mutex);
+  codec->m_async_cv.wait(lock, [codec] { return !codec->m_async_pending; });
+}
+
+// Compressed image pushed piecewise by uhdr_dec_push_data(). The base image is decoded from the
+// chunks on the library pool as they arrive.
+struct input_stream {
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<std::vector<uint8_t>> chunks;  // chunk storage does not move once pushed
+  size_t size = 0;
+  bool complete = false;  // final chunk pushed
+  bool aborted = false;   // decoder reset or released, the decode drains its input
+  bool decoding = false;  // base image decode in flight
+  decode_mode_t mode = DECODE_TO_YCBCR_CS;
+  uhdr_error_info_t status = g_no_error;  // of the base image decode
+};
+
+// The base image is returned as is with gain map application disabled, and for sdr output in a
+// planar ycbcr format, which passes the planes of libjpeg through without color conversion and
+// chroma upsampling
+bool is_base_image_output(const uhdr_decoder_private* dec) {
+  const bool ycbcr_output = dec->m_output_fmt == UHDR_IMG_FMT_12bppYCbCr420 ||
+                            dec->m_output_fmt == UHDR_IMG_FMT_24bppYCbCr444 ||
+                            dec->m_output_fmt == UHDR_IMG_FMT_8bppYCbCr400;
+  return !dec->m_apply_gainmap || (ycbcr_output && dec->m_output_ct == UHDR_CT_SRGB);
+}
+
+// starts the base image decode of the stream of dec, in the mode of the current output setup
+void start_input_stream(uhdr_decoder_private* dec) {
+  if (dec->m_decode_cache == nullptr) {
+    dec->m_decode_cache = std::make_unique<JpegRDecodeCache>();
+  }
+  input_stream* stream = dec->m_input_stream.get();
+  if (!is_base_image_output(dec)) {
+    stream->mode = dec->m_output_ct == UHDR_CT_SRGB ? DECODE_TO_RGB_CS : DECODE_TO_YCBCR_CS;
+  } else {
+    stream->mode =
+        dec->m_output_fmt == UHDR_IMG_FMT_32bppRGBA8888 ? DECODE_TO_RGB_CS : DECODE_TO_YCBCR_CS;
+  }
+  stream->decoding = true;
+  JpegDecoderHelper* sdr_decoder = &dec->m_decode_cache->mSdrDecoder;
+  sdr_decoder->setFastIdct(dec->m_fast_idct);
+  sdr_decoder->setFastUpsampling(dec->m_fast_upsampling);
+  // the decode waits on uhdr_dec_push_data(), it must not hold a thread of the async work
+  ThreadPool::getDefaultPool().submitBlocking([stream, sdr_decoder]() {
+    size_t next = 0;
+    JpegDecoderHelper::InputPuller pull = [stream, &next](const uint8_t*& data, size_t& length) {
+      std::unique_lock<std::mutex> lock(stream->mutex);
+      stream->cv.wait(lock, [stream, &next] {
+        return next < stream->chunks.size() || stream->complete || stream->aborted;
+      });
+      if (stream->aborted || next == stream->chunks.size()) return false;
+      data = stream->chunks[next].data();
+      length = stream->chunks[next].size();
+      next++;
+      return true;
+    };
+    uhdr_error_info_t status = sdr_decoder->decompressStream(pull, stream->mode);
+    std::lock_guard<std::mutex> lock(stream->mutex);
+    stream->status = status;
+    stream->decoding = false;
+    stream->cv.notify_all();
+  });
+}
+
+// waits for the base image decode of the complete stream of dec and registers the image as
+// uhdr_dec_set_image() does
+void finish_input_stream(uhdr_decoder_private* dec) {
+  input_stream* stream = dec->m_input_stream.get();
+  {
+    std::unique_lock<std::mutex> lock(stream->mutex);
+    stream->cv.wait(lock, [stream] { return !stream->decoding; });
+  }
+  dec->m_uhdr_compressed_img = std::make_unique<uhdr_compressed_image_ext_t>(
+      UHDR_CG_UNSPECIFIED, UHDR_CT_UNSPECIFIED, UHDR_CR_UNSPECIFIED, stream->size);
+  uint8_t* dst = static_cast<uint8_t*>(dec->m_uhdr_compressed_img->data);
+  for (const auto& chunk : stream->chunks) {
+    memcpy(dst, chunk.data(), chunk.size());
+    dst += chunk.size();
+  }
+  dec->m_uhdr_compressed_img->data_sz = stream->size;
+  dec->m_decode_cache->mSdrStreamed = stream->status.error_code == UHDR_CODEC_OK;
+  dec->m_decode_cache->mSdrStreamedMode = stream->mode;
+  dec->m_input_stream.reset();
+}
+
+// ends the base image decode of the stream of dec, if any, and drops the stream
+void abort_input_stream(uhdr_decoder_private* dec) {
+  input_stream* stream = dec->m_input_stream.get();
+  if (stream == nullptr) return;
+  {
+    std::unique_lock<std::mutex> lock(stream->mutex);
+    stream->aborted = true;
+    stream->cv.notify_all();
+    stream->cv.wait(lock, [stream] { return !stream->decoding; });
+  }
+  dec->m_input_stream.reset();
+}
+
 }  // namespace ultrahdr
 
 uhdr_codec_private::~uhdr_codec_private() {
@@ -491,9 +925,12 @@ uhdr_codec_private::~uhdr_codec_private() {
   m_effects.clear();
 }
 
+uhdr_decoder_private::~uhdr_decoder_private() { ultrahdr::abort_input_stream(this); }
+
+#ifndef UHDR_DECODER_ONLY
 uhdr_error_info_t uhdr_enc_validate_and_set_compressed_img(uhdr_codec_private_t* enc,
                                                            uhdr_compressed_image_t* img,
-                                                           uhdr_img_label_t intent) {
+                                                           uhdr_img_label_t intent, bool borrow) {
   uhdr_error_info_t status = g_no_error;
 
   if (dynamic_cast<uhdr_encoder_private*>(enc) == nullptr) {
@@ -558,11 +995,22 @@ uhdr_error_info_t uhdr_enc_validate_and_set_compressed_img(uhdr_codec_private_t*
         intent);
   }
 
-  auto entry = std::make_unique<ultrahdr::uhdr_compressed_image_ext_t>(img->cg, img->ct, img->range,
-                                                                       image_ranges[0].GetLength());
-  memcpy(entry->data, static_cast<uint8_t*>(img->data) + image_ranges[0].GetBegin(),
-         image_ranges[0].GetLength());
-  entry->data_sz = image_ranges[0].GetLength();
+  std::unique_ptr<ultrahdr::uhdr_compressed_image_ext_t> entry;
+  if (borrow) {
+    // reference the first jpeg of the caller's buffer in place
+    uhdr_compressed_image_t first = *img;
+    first.data = static_cast<uint8_t*>(img->data) + image_ranges[0].GetBegin();
+    first.data_sz = image_ranges[0].GetLength();
+    first.capacity = image_ranges[0].GetLength();
+    entry = std::make_unique<ultrahdr::uhdr_compressed_image_ext_t>(first);
+  } else {
+    ultrahdr::MemoryArena::Scope arena_scope(&handle->m_arena);
+    entry = std::make_unique<ultrahdr::uhdr_compressed_image_ext_t>(img->cg, img->ct, img->range,
+                                                                    image_ranges[0].GetLength());
+    memcpy(entry->data, static_cast<uint8_t*>(img->data) + image_ranges[0].GetBegin(),
+           image_ranges[0].GetLength());
+    entry->data_sz = image_ranges[0].GetLength();
+  }
   handle->m_compressed_images.insert_or_assign(intent, std::move(entry));
 
   return status;
@@ -580,6 +1028,7 @@ uhdr_codec_private_t* uhdr_create_encoder(void) {
 void uhdr_release_encoder(uhdr_codec_private_t* enc) {
   if (dynamic_cast<uhdr_encoder_private*>(enc) != nullptr) {
     uhdr_encoder_private* handle = dynamic_cast<uhdr_encoder_private*>(enc);
+    ultrahdr::wait_async(handle);
     delete handle;
   }
 }
@@ -808,55 +1257,173 @@ uhdr_error_info_t uhdr_enc_set_target_display_peak_brightness(uhdr_codec_private
   return status;
 }
 
-uhdr_error_info_t uhdr_enc_set_raw_image(uhdr_codec_private_t* enc, uhdr_raw_image_t* img,
-                                         uhdr_img_label_t intent) {
+uhdr_error_info_t uhdr_enc_set_num_threads(uhdr_codec_private_t* enc, int num_threads) {
   uhdr_error_info_t status = g_no_error;
 
   if (dynamic_cast<uhdr_encoder_private*>(enc) == nullptr) {
     status.error_code = UHDR_CODEC_INVALID_PARAM;
     status.has_detail = 1;
     snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
-  } else if (img == nullptr) {
+    return status;
+  }
+
+  if (num_threads < 0 || num_threads > ultrahdr::kNumThreadsMax) {
     status.error_code = UHDR_CODEC_INVALID_PARAM;
     status.has_detail = 1;
-    snprintf(status.detail, sizeof status.detail, "received nullptr for raw image handle");
-  } else if (intent != UHDR_HDR_IMG && intent != UHDR_SDR_IMG) {
-    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    snprintf(status.detail, sizeof status.detail,
+             "invalid number of threads %d, expects to be in range [0, %d]", num_threads,
+             ultrahdr::kNumThreadsMax);
+    return status;
+  }
+
+  uhdr_encoder_private* handle = dynamic_cast<uhdr_encoder_private*>(enc);
+
+  if (handle->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
     status.has_detail = 1;
     snprintf(status.detail, sizeof status.detail,
-             "invalid intent %d, expects one of {UHDR_HDR_IMG, UHDR_SDR_IMG}", intent);
-  } else if (intent == UHDR_HDR_IMG && (img->fmt != UHDR_IMG_FMT_24bppYCbCrP010 &&
-                                        img->fmt != UHDR_IMG_FMT_32bppRGBA1010102 &&
-                                        img->fmt != UHDR_IMG_FMT_64bppRGBAHalfFloat)) {
+             "An earlier call to uhdr_encode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+
+  handle->m_num_threads = num_threads;
+
+  return status;
+}
+
+uhdr_error_info_t uhdr_enc_set_gainmap_tile_size(uhdr_codec_private_t* enc, int tile_size) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_encoder_private*>(enc) == nullptr) {
     status.error_code = UHDR_CODEC_INVALID_PARAM;
     status.has_detail = 1;
-    snprintf(status.detail, sizeof status.detail,
-             "unsupported input pixel format for hdr intent %d, expects one of "
-             "{UHDR_IMG_FMT_24bppYCbCrP010, UHDR_IMG_FMT_32bppRGBA1010102, "
-             "UHDR_IMG_FMT_64bppRGBAHalfFloat}",
-             img->fmt);
-  } else if (intent == UHDR_SDR_IMG &&
-             (img->fmt != UHDR_IMG_FMT_12bppYCbCr420 && img->fmt != UHDR_IMG_FMT_32bppRGBA8888)) {
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
+  }
+
+  if (tile_size < 0 || tile_size > ultrahdr::kGainMapTileSizeMax) {
     status.error_code = UHDR_CODEC_INVALID_PARAM;
     status.has_detail = 1;
     snprintf(status.detail, sizeof status.detail,
-             "unsupported input pixel format for sdr intent %d, expects one of "
-             "{UHDR_IMG_FMT_12bppYCbCr420, UHDR_IMG_FMT_32bppRGBA8888}",
-             img->fmt);
-  } else if (img->cg != UHDR_CG_BT_2100 && img->cg != UHDR_CG_DISPLAY_P3 &&
-             img->cg != UHDR_CG_BT_709) {
-    status.error_code = UHDR_CODEC_INVALID_PARAM;
+             "invalid gainmap tile size %d, expects to be in range [0, %d]", tile_size,
+             ultrahdr::kGainMapTileSizeMax);
+    return status;
+  }
+
+  uhdr_encoder_private* handle = dynamic_cast<uhdr_encoder_private*>(enc);
+
+  if (handle->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
     status.has_detail = 1;
     snprintf(status.detail, sizeof status.detail,
-             "invalid input color gamut %d, expects one of {UHDR_CG_BT_2100, UHDR_CG_DISPLAY_P3, "
-             "UHDR_CG_BT_709}",
-             img->cg);
-  } else if (intent == UHDR_SDR_IMG && img->ct != UHDR_CT_SRGB) {
+             "An earlier call to uhdr_encode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+
+  handle->m_gainmap_tile_size = tile_size;
+
+  return status;
+}
+
+uhdr_error_info_t uhdr_enc_set_gainmap_boost_estimation(uhdr_codec_private_t* enc, int enable) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_encoder_private*>(enc) == nullptr) {
     status.error_code = UHDR_CODEC_INVALID_PARAM;
     status.has_detail = 1;
-    snprintf(status.detail, sizeof status.detail,
-             "invalid input color transfer for sdr intent image %d, expects UHDR_CT_SRGB", img->ct);
-  } else if (intent == UHDR_HDR_IMG && img->fmt == UHDR_IMG_FMT_64bppRGBAHalfFloat &&
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
+  }
+
+  uhdr_encoder_private* handle = dynamic_cast<uhdr_encoder_private*>(enc);
+
+  if (handle->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_encode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+
+  handle->m_gainmap_boost_estimation = enable ? true : false;
+
+  return status;
+}
+
+uhdr_error_info_t uhdr_enc_set_auto_gainmap_scale_factor(uhdr_codec_private_t* enc, int enable) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_encoder_private*>(enc) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
+  }
+
+  uhdr_encoder_private* handle = dynamic_cast<uhdr_encoder_private*>(enc);
+
+  if (handle->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_encode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+
+  handle->m_auto_gainmap_scale_factor = enable ? true : false;
+
+  return status;
+}
+
+// Checks the fields of a raw image descriptor of intent
+static uhdr_error_info_t check_raw_image(uhdr_raw_image_t* img, uhdr_img_label_t intent) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (img == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for raw image handle");
+  } else if (intent != UHDR_HDR_IMG && intent != UHDR_SDR_IMG) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "invalid intent %d, expects one of {UHDR_HDR_IMG, UHDR_SDR_IMG}", intent);
+  } else if (intent == UHDR_HDR_IMG && (img->fmt != UHDR_IMG_FMT_24bppYCbCrP010 &&
+                                        img->fmt != UHDR_IMG_FMT_32bppRGBA1010102 &&
+                                        img->fmt != UHDR_IMG_FMT_64bppRGBAHalfFloat)) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "unsupported input pixel format for hdr intent %d, expects one of "
+             "{UHDR_IMG_FMT_24bppYCbCrP010, UHDR_IMG_FMT_32bppRGBA1010102, "
+             "UHDR_IMG_FMT_64bppRGBAHalfFloat}",
+             img->fmt);
+  } else if (intent == UHDR_SDR_IMG &&
+             (img->fmt != UHDR_IMG_FMT_12bppYCbCr420 && img->fmt != UHDR_IMG_FMT_32bppRGBA8888)) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "unsupported input pixel format for sdr intent %d, expects one of "
+             "{UHDR_IMG_FMT_12bppYCbCr420, UHDR_IMG_FMT_32bppRGBA8888}",
+             img->fmt);
+  } else if (img->cg != UHDR_CG_BT_2100 && img->cg != UHDR_CG_DISPLAY_P3 &&
+             img->cg != UHDR_CG_BT_709) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "invalid input color gamut %d, expects one of {UHDR_CG_BT_2100, UHDR_CG_DISPLAY_P3, "
+             "UHDR_CG_BT_709}",
+             img->cg);
+  } else if (intent == UHDR_SDR_IMG && img->ct != UHDR_CT_SRGB) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "invalid input color transfer for sdr intent image %d, expects UHDR_CT_SRGB", img->ct);
+  } else if (intent == UHDR_HDR_IMG && img->fmt == UHDR_IMG_FMT_64bppRGBAHalfFloat &&
              img->ct != UHDR_CT_LINEAR) {
     status.error_code = UHDR_CODEC_INVALID_PARAM;
     status.has_detail = 1;
@@ -976,6 +1543,19 @@ uhdr_error_info_t uhdr_enc_set_raw_image(uhdr_codec_private_t* enc, uhdr_raw_ima
                "invalid range, expects one of {UHDR_CR_FULL_RANGE}");
     }
   }
+  return status;
+}
+
+static uhdr_error_info_t set_raw_image(uhdr_codec_private_t* enc, uhdr_raw_image_t* img,
+                                       uhdr_img_label_t intent, bool borrow) {
+  if (dynamic_cast<uhdr_encoder_private*>(enc) == nullptr) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
+  }
+  uhdr_error_info_t status = check_raw_image(img, intent);
   if (status.error_code != UHDR_CODEC_OK) return status;
 
   uhdr_encoder_private* handle = dynamic_cast<uhdr_encoder_private*>(enc);
@@ -1012,7 +1592,10 @@ uhdr_error_info_t uhdr_enc_set_raw_image(uhdr_codec_private_t* enc, uhdr_raw_ima
     return status;
   }
 
-  std::unique_ptr<ultrahdr::uhdr_raw_image_ext_t> entry = ultrahdr::copy_raw_image(img);
+  ultrahdr::MemoryArena::Scope arena_scope(&handle->m_arena);
+  std::unique_ptr<ultrahdr::uhdr_raw_image_ext_t> entry =
+      borrow ? std::make_unique<ultrahdr::uhdr_raw_image_ext_t>(*img)
+             : ultrahdr::copy_raw_image(img);
   if (entry == nullptr) {
     status.error_code = UHDR_CODEC_UNKNOWN_ERROR;
     status.has_detail = 1;
@@ -1026,9 +1609,19 @@ uhdr_error_info_t uhdr_enc_set_raw_image(uhdr_codec_private_t* enc, uhdr_raw_ima
   return status;
 }
 
-uhdr_error_info_t uhdr_enc_set_compressed_image(uhdr_codec_private_t* enc,
-                                                uhdr_compressed_image_t* img,
-                                                uhdr_img_label_t intent) {
+uhdr_error_info_t uhdr_enc_set_raw_image(uhdr_codec_private_t* enc, uhdr_raw_image_t* img,
+                                         uhdr_img_label_t intent) {
+  return set_raw_image(enc, img, intent, false);
+}
+
+uhdr_error_info_t uhdr_enc_set_raw_image_ref(uhdr_codec_private_t* enc, uhdr_raw_image_t* img,
+                                             uhdr_img_label_t intent) {
+  return set_raw_image(enc, img, intent, true);
+}
+
+static uhdr_error_info_t set_compressed_image(uhdr_codec_private_t* enc,
+                                              uhdr_compressed_image_t* img,
+                                              uhdr_img_label_t intent, bool borrow) {
   uhdr_error_info_t status = g_no_error;
 
   if (intent != UHDR_HDR_IMG && intent != UHDR_SDR_IMG && intent != UHDR_BASE_IMG) {
@@ -1039,7 +1632,19 @@ uhdr_error_info_t uhdr_enc_set_compressed_image(uhdr_codec_private_t* enc,
              intent);
   }
 
-  return uhdr_enc_validate_and_set_compressed_img(enc, img, intent);
+  return uhdr_enc_validate_and_set_compressed_img(enc, img, intent, borrow);
+}
+
+uhdr_error_info_t uhdr_enc_set_compressed_image(uhdr_codec_private_t* enc,
+                                                uhdr_compressed_image_t* img,
+                                                uhdr_img_label_t intent) {
+  return set_compressed_image(enc, img, intent, false);
+}
+
+uhdr_error_info_t uhdr_enc_set_compressed_image_ref(uhdr_codec_private_t* enc,
+                                                    uhdr_compressed_image_t* img,
+                                                    uhdr_img_label_t intent) {
+  return set_compressed_image(enc, img, intent, true);
 }
 
 uhdr_error_info_t uhdr_enc_set_gainmap_image(uhdr_codec_private_t* enc,
@@ -1048,7 +1653,7 @@ uhdr_error_info_t uhdr_enc_set_gainmap_image(uhdr_codec_private_t* enc,
   uhdr_error_info_t status = ultrahdr::uhdr_validate_gainmap_metadata_descriptor(metadata);
   if (status.error_code != UHDR_CODEC_OK) return status;
 
-  status = uhdr_enc_validate_and_set_compressed_img(enc, img, UHDR_GAIN_MAP_IMG);
+  status = uhdr_enc_validate_and_set_compressed_img(enc, img, UHDR_GAIN_MAP_IMG, false);
   if (status.error_code != UHDR_CODEC_OK) return status;
 
   uhdr_encoder_private* handle = dynamic_cast<uhdr_encoder_private*>(enc);
@@ -1143,6 +1748,14 @@ uhdr_error_info_t uhdr_enc_set_output_format(uhdr_codec_private_t* enc, uhdr_cod
     status.error_code = UHDR_CODEC_INVALID_PARAM;
     status.has_detail = 1;
     snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+  } else if (media_type == UHDR_CODEC_HEIF || media_type == UHDR_CODEC_AVIF) {
+    status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "output format %s needs a %s encoder, which this build does not include, expects "
+             "{UHDR_CODEC_JPG}",
+             media_type == UHDR_CODEC_HEIF ? "UHDR_CODEC_HEIF" : "UHDR_CODEC_AVIF",
+             media_type == UHDR_CODEC_HEIF ? "heif" : "av1");
   } else if (media_type != UHDR_CODEC_JPG) {
     status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
     status.has_detail = 1;
@@ -1166,110 +1779,456 @@ uhdr_error_info_t uhdr_enc_set_output_format(uhdr_codec_private_t* enc, uhdr_cod
   return status;
 }
 
-uhdr_error_info_t uhdr_encode(uhdr_codec_private_t* enc) {
+// worst case size of the encoded stream for the registered inputs, 0 if inputs are insufficient.
+// If effects are pending, the hdr intent dimensions are projected through them.
+static size_t max_output_size(uhdr_encoder_private* handle, bool effects_pending) {
+  auto& compressed_images = handle->m_compressed_images;
+  if (compressed_images.find(UHDR_BASE_IMG) != compressed_images.end() &&
+      compressed_images.find(UHDR_GAIN_MAP_IMG) != compressed_images.end()) {
+    size_t base_sz = compressed_images.find(UHDR_BASE_IMG)->second->data_sz;
+    size_t gainmap_sz = compressed_images.find(UHDR_GAIN_MAP_IMG)->second->data_sz;
+    return (std::max)(((size_t)8 * 1024), 2 * (base_sz + gainmap_sz));
+  }
+  if (handle->m_stream != nullptr) {
+    const size_t w = handle->m_stream->width, h = handle->m_stream->height;
+    return (std::max)(((size_t)8 * 1024), w * h * 3 * 2);
+  }
+  auto hdr_it = handle->m_raw_images.find(UHDR_HDR_IMG);
+  if (hdr_it == handle->m_raw_images.end()) return 0;
+
+  size_t w = hdr_it->second->w, h = hdr_it->second->h;
+  if (effects_pending) {
+    for (auto& it : handle->m_effects) {
+      if (auto crop = dynamic_cast<ultrahdr::uhdr_crop_effect_t*>(it)) {
+        w = (std::max)(0, crop->m_right - crop->m_left);
+        h = (std::max)(0, crop->m_bottom - crop->m_top);
+      } else if (auto rotate = dynamic_cast<ultrahdr::uhdr_rotate_effect_t*>(it)) {
+        if (rotate->m_degree == 90 || rotate->m_degree == 270) std::swap(w, h);
+      } else if (auto resize = dynamic_cast<ultrahdr::uhdr_resize_effect_t*>(it)) {
+        w = (std::max)(0, resize->m_width);
+        h = (std::max)(0, resize->m_height);
+      }
+    }
+  }
+  return (std::max)(((size_t)8 * 1024), w * h * 3 * 2);
+}
+
+// Encodes the stream at the configured qualities and every quality rung from one gain map
+static uhdr_error_info_t encode_quality_ladder(uhdr_encoder_private* handle, ultrahdr::JpegR& jpegr,
+                                               uhdr_raw_image_t* hdr_intent,
+                                               uhdr_raw_image_t* sdr_intent,
+                                               uhdr_mem_block_t* exif) {
+  std::vector<ultrahdr::QualityRung> rungs;
+  rungs.push_back({handle->m_quality.find(UHDR_BASE_IMG)->second,
+                   handle->m_quality.find(UHDR_GAIN_MAP_IMG)->second,
+                   handle->m_compressed_output_buffer.get()});
+  const size_t size = max_output_size(handle, false);
+  for (auto& rung : handle->m_quality_rungs) {
+    rung.img = std::make_unique<ultrahdr::uhdr_compressed_image_ext_t>(
+        UHDR_CG_UNSPECIFIED, UHDR_CT_UNSPECIFIED, UHDR_CR_UNSPECIFIED, size);
+    rungs.push_back({rung.quality, rung.gainmap_quality, rung.img.get()});
+  }
+  return jpegr.encodeJPEGRLadder(hdr_intent, sdr_intent, rungs, exif);
+}
+
+static void allocate_output_buffer(uhdr_encoder_private* handle) {
+  auto& out = handle->m_compressed_output_buffer;
+  if (handle->m_output_buffer != nullptr) {
+    // encode straight into caller memory, capacity is enforced while writing
+    out = std::make_unique<ultrahdr::uhdr_compressed_image_ext_t>(
+        static_cast<const uhdr_compressed_image_t&>(*handle->m_output_buffer));
+    out->data_sz = 0;
+  } else {
+    size_t size = max_output_size(handle, false);
+    if (out != nullptr && !out->is_borrowed() && out->capacity >= size) {
+      // buffer of an earlier encode of this context, large enough for this one
+      out->data_sz = 0;
+      out->cg = UHDR_CG_UNSPECIFIED;
+      out->ct = UHDR_CT_UNSPECIFIED;
+      out->range = UHDR_CR_UNSPECIFIED;
+    } else {
+      out = std::make_unique<ultrahdr::uhdr_compressed_image_ext_t>(
+          UHDR_CG_UNSPECIFIED, UHDR_CT_UNSPECIFIED, UHDR_CR_UNSPECIFIED, size);
+    }
+  }
+}
+
+uhdr_error_info_t uhdr_enc_set_output_buffer(uhdr_codec_private_t* enc,
+                                             uhdr_compressed_image_t* img) {
+  uhdr_error_info_t status = g_no_error;
+
   if (dynamic_cast<uhdr_encoder_private*>(enc) == nullptr) {
-    uhdr_error_info_t status;
     status.error_code = UHDR_CODEC_INVALID_PARAM;
     status.has_detail = 1;
     snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
-    return status;
+  } else if (img == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for output buffer");
+  } else if (img->data == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "received nullptr for data field of output buffer");
+  } else if (img->capacity == 0) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "output buffer capacity cannot be zero");
   }
+  if (status.error_code != UHDR_CODEC_OK) return status;
 
   uhdr_encoder_private* handle = dynamic_cast<uhdr_encoder_private*>(enc);
-
   if (handle->m_sailed) {
-    return handle->m_encode_call_status;
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_encode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
   }
 
-  handle->m_sailed = true;
+  handle->m_output_buffer = std::make_unique<ultrahdr::uhdr_compressed_image_ext_t>(*img);
 
-  uhdr_error_info_t& status = handle->m_encode_call_status;
+  return status;
+}
 
-  if (handle->m_compressed_images.find(UHDR_BASE_IMG) != handle->m_compressed_images.end() &&
-      handle->m_compressed_images.find(UHDR_GAIN_MAP_IMG) != handle->m_compressed_images.end()) {
-    if (handle->m_effects.size() != 0) {
-      status.error_code = UHDR_CODEC_INVALID_OPERATION;
-      status.has_detail = 1;
-      snprintf(status.detail, sizeof status.detail,
-               "image effects are not enabled for inputs with compressed intent");
-      return status;
-    }
-  } else if (handle->m_raw_images.find(UHDR_HDR_IMG) != handle->m_raw_images.end()) {
-    if (handle->m_compressed_images.find(UHDR_SDR_IMG) == handle->m_compressed_images.end() &&
-        handle->m_raw_images.find(UHDR_SDR_IMG) == handle->m_raw_images.end()) {
-      // api - 0
-      if (handle->m_effects.size() != 0) {
-        status = ultrahdr::apply_effects(handle);
-        if (status.error_code != UHDR_CODEC_OK) return status;
-      }
-    } else if (handle->m_compressed_images.find(UHDR_SDR_IMG) !=
-                   handle->m_compressed_images.end() &&
-               handle->m_raw_images.find(UHDR_SDR_IMG) == handle->m_raw_images.end()) {
-      if (handle->m_effects.size() != 0) {
-        status.error_code = UHDR_CODEC_INVALID_OPERATION;
-        status.has_detail = 1;
-        snprintf(status.detail, sizeof status.detail,
-                 "image effects are not enabled for inputs with compressed intent");
-        return status;
-      }
-    } else if (handle->m_raw_images.find(UHDR_SDR_IMG) != handle->m_raw_images.end()) {
-      if (handle->m_compressed_images.find(UHDR_SDR_IMG) == handle->m_compressed_images.end()) {
-        if (handle->m_effects.size() != 0) {
-          status = ultrahdr::apply_effects(handle);
-          if (status.error_code != UHDR_CODEC_OK) return status;
-        }
-      } else {
-        if (handle->m_effects.size() != 0) {
-          status.error_code = UHDR_CODEC_INVALID_OPERATION;
-          status.has_detail = 1;
-          snprintf(status.detail, sizeof status.detail,
-                   "image effects are not enabled for inputs with compressed intent");
-          return status;
-        }
-      }
-    }
+uhdr_error_info_t uhdr_enc_set_output_fd(uhdr_codec_private_t* enc, int fd) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_encoder_private*>(enc) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+  } else if (fd < 0) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received invalid file descriptor %d", fd);
   }
+  if (status.error_code != UHDR_CODEC_OK) return status;
 
-  if (handle->m_output_format == UHDR_CODEC_JPG) {
-    uhdr_mem_block_t exif{};
-    if (handle->m_exif.size() > 0) {
-      exif.data = handle->m_exif.data();
-      exif.capacity = exif.data_sz = handle->m_exif.size();
-    }
+#ifdef _WIN32
+  status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
+  status.has_detail = 1;
+  snprintf(status.detail, sizeof status.detail,
+           "file descriptor output is not supported on this platform, use "
+           "uhdr_get_encoded_stream()");
+  return status;
+#else
+  uhdr_encoder_private* handle = dynamic_cast<uhdr_encoder_private*>(enc);
+  if (handle->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_encode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
 
-    ultrahdr::JpegR jpegr(nullptr, handle->m_gainmap_scale_factor,
-                          handle->m_quality.find(UHDR_GAIN_MAP_IMG)->second,
-                          handle->m_use_multi_channel_gainmap, handle->m_gamma,
-                          handle->m_enc_preset, handle->m_min_content_boost,
-                          handle->m_max_content_boost, handle->m_target_disp_max_brightness);
-    if (handle->m_compressed_images.find(UHDR_BASE_IMG) != handle->m_compressed_images.end() &&
-        handle->m_compressed_images.find(UHDR_GAIN_MAP_IMG) != handle->m_compressed_images.end()) {
-      auto& base_entry = handle->m_compressed_images.find(UHDR_BASE_IMG)->second;
-      auto& gainmap_entry = handle->m_compressed_images.find(UHDR_GAIN_MAP_IMG)->second;
+  handle->m_output_fd = fd;
 
-      size_t size =
-          (std::max)(((size_t)8 * 1024), 2 * (base_entry->data_sz + gainmap_entry->data_sz));
-      handle->m_compressed_output_buffer = std::make_unique<ultrahdr::uhdr_compressed_image_ext_t>(
-          UHDR_CG_UNSPECIFIED, UHDR_CT_UNSPECIFIED, UHDR_CR_UNSPECIFIED, size);
+  return status;
+#endif
+}
 
-      ultrahdr::uhdr_gainmap_metadata_ext_t metadata(handle->m_metadata, ultrahdr::kJpegrVersion);
+uhdr_error_info_t uhdr_enc_enable_output_segments(uhdr_codec_private_t* enc, int enable) {
+  uhdr_error_info_t status = g_no_error;
 
-      // api - 4
-      status = jpegr.encodeJPEGR(base_entry.get(), gainmap_entry.get(), &metadata,
-                                 handle->m_compressed_output_buffer.get());
-    } else if (handle->m_raw_images.find(UHDR_HDR_IMG) != handle->m_raw_images.end()) {
-      auto& hdr_raw_entry = handle->m_raw_images.find(UHDR_HDR_IMG)->second;
+  if (dynamic_cast<uhdr_encoder_private*>(enc) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
+  }
 
-      size_t size = (std::max)((8u * 1024), hdr_raw_entry->w * hdr_raw_entry->h * 3 * 2);
-      handle->m_compressed_output_buffer = std::make_unique<ultrahdr::uhdr_compressed_image_ext_t>(
-          UHDR_CG_UNSPECIFIED, UHDR_CT_UNSPECIFIED, UHDR_CR_UNSPECIFIED, size);
+  uhdr_encoder_private* handle = dynamic_cast<uhdr_encoder_private*>(enc);
 
-      if (handle->m_compressed_images.find(UHDR_SDR_IMG) == handle->m_compressed_images.end() &&
-          handle->m_raw_images.find(UHDR_SDR_IMG) == handle->m_raw_images.end()) {
+  if (handle->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_encode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+
+  handle->m_output_segments = enable ? true : false;
+
+  return status;
+}
+
+uhdr_error_info_t uhdr_enc_add_quality_rung(uhdr_codec_private_t* enc, int base_quality,
+                                            int gainmap_quality) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_encoder_private*>(enc) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+  } else if (base_quality < 0 || base_quality > 100 || gainmap_quality < 0 ||
+             gainmap_quality > 100) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "invalid quality factors %d and %d, expects in range [0-100]", base_quality,
+             gainmap_quality);
+  }
+  if (status.error_code != UHDR_CODEC_OK) return status;
+
+  uhdr_encoder_private* handle = dynamic_cast<uhdr_encoder_private*>(enc);
+  if (handle->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_encode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+
+  handle->m_quality_rungs.push_back({base_quality, gainmap_quality, nullptr});
+
+  return status;
+}
+
+uhdr_error_info_t uhdr_enc_set_target_size(uhdr_codec_private_t* enc, size_t target_size) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_encoder_private*>(enc) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
+  }
+
+  uhdr_encoder_private* handle = dynamic_cast<uhdr_encoder_private*>(enc);
+  if (handle->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_encode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+
+  handle->m_target_size = target_size;
+
+  return status;
+}
+
+#ifndef _WIN32
+// Writes the spans of the stream with writev(), a segmented stream reaches fd without being
+// gathered. The list holds a handful of spans, well below IOV_MAX.
+static uhdr_error_info_t write_encoded_stream(uhdr_encoder_private* handle) {
+  uhdr_error_info_t status = g_no_error;
+  std::vector<struct iovec> iov;
+  size_t remaining = 0;
+  for (const uhdr_stream_segment_t& segment : handle->m_encoded_segments) {
+    iov.push_back({const_cast<void*>(segment.data), segment.data_sz});
+    remaining += segment.data_sz;
+  }
+  size_t first = 0;
+  while (remaining > 0) {
+    ssize_t written = writev(handle->m_output_fd, iov.data() + first, (int)(iov.size() - first));
+    if (written < 0 && errno == EINTR) continue;
+    if (written <= 0) {
+      status.error_code = UHDR_CODEC_ERROR;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "failed to write encoded stream to fd %d, %zu bytes left, %s", handle->m_output_fd,
+               remaining, written < 0 ? strerror(errno) : "no progress");
+      return status;
+    }
+    remaining -= written;
+    // skip the spans written in full, resume the last one where the write stopped
+    size_t done = written;
+    while (first < iov.size() && done >= iov[first].iov_len) {
+      done -= iov[first].iov_len;
+      first++;
+    }
+    if (done > 0) {
+      iov[first].iov_base = static_cast<uint8_t*>(iov[first].iov_base) + done;
+      iov[first].iov_len -= done;
+    }
+  }
+  return status;
+}
+#endif
+
+size_t uhdr_enc_get_max_output_size(uhdr_codec_private_t* enc) {
+  if (dynamic_cast<uhdr_encoder_private*>(enc) == nullptr) {
+    return 0;
+  }
+
+  uhdr_encoder_private* handle = dynamic_cast<uhdr_encoder_private*>(enc);
+  // once encoded, effects are already folded into the inputs
+  if (handle->m_sailed) return 0;
+
+  return max_output_size(handle, true);
+}
+
+uhdr_error_info_t uhdr_encode(uhdr_codec_private_t* enc) {
+  if (dynamic_cast<uhdr_encoder_private*>(enc) == nullptr) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
+  }
+
+  uhdr_encoder_private* handle = dynamic_cast<uhdr_encoder_private*>(enc);
+
+  if (handle->m_sailed) {
+    return handle->m_encode_call_status;
+  }
+
+  handle->m_sailed = true;
+  handle->m_encoded_segments.clear();
+  ultrahdr::MemoryArena::Scope arena_scope(&handle->m_arena);
+  ultrahdr::CodecStats::Scope stats_scope(handle->m_stats_enabled ? &handle->m_stats : nullptr);
+  handle->m_cancel.arm(handle->m_cancel_flag, handle->m_deadline_ms);
+  ultrahdr::CancelToken::Scope cancel_scope(&handle->m_cancel);
+
+  uhdr_error_info_t& status = handle->m_encode_call_status;
+
+  if (!handle->m_quality_rungs.empty() && handle->m_target_size > 0) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "quality rungs and a target size can not be combined");
+    return status;
+  }
+  if ((!handle->m_quality_rungs.empty() || handle->m_target_size > 0) &&
+      (handle->m_raw_images.find(UHDR_HDR_IMG) == handle->m_raw_images.end() ||
+       handle->m_compressed_images.find(UHDR_BASE_IMG) != handle->m_compressed_images.end() ||
+       handle->m_compressed_images.find(UHDR_SDR_IMG) != handle->m_compressed_images.end())) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "quality rungs and target sizes are only supported for encodes of raw hdr and sdr "
+             "intents");
+    return status;
+  }
+
+  if (handle->m_compressed_images.find(UHDR_BASE_IMG) != handle->m_compressed_images.end() &&
+      handle->m_compressed_images.find(UHDR_GAIN_MAP_IMG) != handle->m_compressed_images.end()) {
+    if (handle->m_effects.size() != 0) {
+      status.error_code = UHDR_CODEC_INVALID_OPERATION;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "image effects are not enabled for inputs with compressed intent");
+      return status;
+    }
+  } else if (handle->m_raw_images.find(UHDR_HDR_IMG) != handle->m_raw_images.end()) {
+    if (handle->m_compressed_images.find(UHDR_SDR_IMG) == handle->m_compressed_images.end() &&
+        handle->m_raw_images.find(UHDR_SDR_IMG) == handle->m_raw_images.end()) {
+      // api - 0
+      if (handle->m_effects.size() != 0) {
+        status = ultrahdr::apply_effects(handle);
+        if (status.error_code != UHDR_CODEC_OK) return status;
+      }
+    } else if (handle->m_compressed_images.find(UHDR_SDR_IMG) !=
+                   handle->m_compressed_images.end() &&
+               handle->m_raw_images.find(UHDR_SDR_IMG) == handle->m_raw_images.end()) {
+      if (handle->m_effects.size() != 0) {
+        status.error_code = UHDR_CODEC_INVALID_OPERATION;
+        status.has_detail = 1;
+        snprintf(status.detail, sizeof status.detail,
+                 "image effects are not enabled for inputs with compressed intent");
+        return status;
+      }
+    } else if (handle->m_raw_images.find(UHDR_SDR_IMG) != handle->m_raw_images.end()) {
+      if (handle->m_compressed_images.find(UHDR_SDR_IMG) == handle->m_compressed_images.end()) {
+        if (handle->m_effects.size() != 0) {
+          status = ultrahdr::apply_effects(handle);
+          if (status.error_code != UHDR_CODEC_OK) return status;
+        }
+      } else {
+        if (handle->m_effects.size() != 0) {
+          status.error_code = UHDR_CODEC_INVALID_OPERATION;
+          status.has_detail = 1;
+          snprintf(status.detail, sizeof status.detail,
+                   "image effects are not enabled for inputs with compressed intent");
+          return status;
+        }
+      }
+    }
+  }
+
+  if (handle->m_output_format == UHDR_CODEC_JPG) {
+    uhdr_mem_block_t exif{};
+    if (handle->m_exif.size() > 0) {
+      exif.data = handle->m_exif.data();
+      exif.capacity = exif.data_sz = handle->m_exif.size();
+    }
+
+#ifdef UHDR_ENABLE_GLES
+    // the gpu is used from the worker threads of the encoder, the context is made current by the
+    // stages that run on it
+    ultrahdr::uhdr_opengl_ctxt_t* uhdrGLESCtxt = nullptr;
+    if (handle->m_enable_gles &&
+        handle->m_raw_images.find(UHDR_HDR_IMG) != handle->m_raw_images.end()) {
+      handle->m_uhdr_gl_ctxt.init_opengl_ctxt();
+      status = handle->m_uhdr_gl_ctxt.mErrorStatus;
+      if (status.error_code != UHDR_CODEC_OK) return status;
+      handle->m_uhdr_gl_ctxt.release_current();
+      handle->m_uhdr_gl_ctxt.mStats = ultrahdr::CodecStats::current();
+      uhdrGLESCtxt = &handle->m_uhdr_gl_ctxt;
+    }
+#else
+    void* uhdrGLESCtxt = nullptr;
+#endif
+    ultrahdr::JpegR jpegr(uhdrGLESCtxt, handle->m_gainmap_scale_factor,
+                          handle->m_quality.find(UHDR_GAIN_MAP_IMG)->second,
+                          handle->m_use_multi_channel_gainmap, handle->m_gamma,
+                          handle->m_enc_preset, handle->m_min_content_boost,
+                          handle->m_max_content_boost, handle->m_target_disp_max_brightness);
+    jpegr.setNumThreads(handle->m_num_threads);
+    jpegr.setGainMapTileSize(handle->m_gainmap_tile_size);
+    jpegr.setGainMapBoostEstimation(handle->m_gainmap_boost_estimation);
+    jpegr.setParallelExecutor(handle->m_parallel_for, handle->m_parallel_for_ctx);
+    jpegr.setJpegBackend(handle->m_jpeg_backend);
+    jpegr.setCoreAffinity(handle->m_core_affinity);
+    jpegr.setStats(ultrahdr::CodecStats::current());
+    jpegr.setEncodeCache(handle->m_encode_cache);
+    jpegr.setHdrIntentDownscale(handle->m_hdr_intent_downscale);
+    if (handle->m_compressed_images.find(UHDR_BASE_IMG) != handle->m_compressed_images.end() &&
+        handle->m_compressed_images.find(UHDR_GAIN_MAP_IMG) != handle->m_compressed_images.end()) {
+      auto& base_entry = handle->m_compressed_images.find(UHDR_BASE_IMG)->second;
+      auto& gainmap_entry = handle->m_compressed_images.find(UHDR_GAIN_MAP_IMG)->second;
+
+      allocate_output_buffer(handle);
+
+      ultrahdr::uhdr_gainmap_metadata_ext_t metadata(handle->m_metadata, ultrahdr::kJpegrVersion);
+
+      // api - 4
+      jpegr.setOutputSegments(handle->m_output_segments ? &handle->m_encoded_segments : nullptr);
+      status = jpegr.encodeJPEGR(base_entry.get(), gainmap_entry.get(), &metadata,
+                                 handle->m_compressed_output_buffer.get());
+    } else if (handle->m_raw_images.find(UHDR_HDR_IMG) != handle->m_raw_images.end()) {
+      auto& hdr_raw_entry = handle->m_raw_images.find(UHDR_HDR_IMG)->second;
+
+      allocate_output_buffer(handle);
+      if (handle->m_auto_gainmap_scale_factor) {
+        jpegr.setMapDimensionScaleFactor(ultrahdr::JpegR::selectMapDimensionScaleFactor(
+            hdr_raw_entry.get(), handle->m_enc_preset));
+      }
+
+      if (handle->m_compressed_images.find(UHDR_SDR_IMG) == handle->m_compressed_images.end() &&
+          handle->m_raw_images.find(UHDR_SDR_IMG) == handle->m_raw_images.end()) {
         // api - 0
-        status = jpegr.encodeJPEGR(hdr_raw_entry.get(), handle->m_compressed_output_buffer.get(),
-                                   handle->m_quality.find(UHDR_BASE_IMG)->second,
-                                   handle->m_exif.size() > 0 ? &exif : nullptr);
+        if (!handle->m_quality_rungs.empty()) {
+          status = encode_quality_ladder(handle, jpegr, hdr_raw_entry.get(), nullptr,
+                                         handle->m_exif.size() > 0 ? &exif : nullptr);
+        } else if (handle->m_target_size > 0) {
+          status = jpegr.encodeJPEGRTargetSize(
+              hdr_raw_entry.get(), nullptr, handle->m_target_size,
+              handle->m_quality.find(UHDR_BASE_IMG)->second,
+              handle->m_exif.size() > 0 ? &exif : nullptr,
+              handle->m_compressed_output_buffer.get());
+        } else {
+          status = jpegr.encodeJPEGR(hdr_raw_entry.get(), handle->m_compressed_output_buffer.get(),
+                                     handle->m_quality.find(UHDR_BASE_IMG)->second,
+                                     handle->m_exif.size() > 0 ? &exif : nullptr);
+        }
       } else if (handle->m_compressed_images.find(UHDR_SDR_IMG) !=
                      handle->m_compressed_images.end() &&
                  handle->m_raw_images.find(UHDR_SDR_IMG) == handle->m_raw_images.end()) {
@@ -1280,599 +2239,3649 @@ uhdr_error_info_t uhdr_encode(uhdr_codec_private_t* enc) {
       } else if (handle->m_raw_images.find(UHDR_SDR_IMG) != handle->m_raw_images.end()) {
         auto& sdr_raw_entry = handle->m_raw_images.find(UHDR_SDR_IMG)->second;
 
-        if (handle->m_compressed_images.find(UHDR_SDR_IMG) == handle->m_compressed_images.end()) {
-          // api - 1
-          status = jpegr.encodeJPEGR(hdr_raw_entry.get(), sdr_raw_entry.get(),
-                                     handle->m_compressed_output_buffer.get(),
-                                     handle->m_quality.find(UHDR_BASE_IMG)->second,
-                                     handle->m_exif.size() > 0 ? &exif : nullptr);
-        } else {
-          auto& sdr_compressed_entry = handle->m_compressed_images.find(UHDR_SDR_IMG)->second;
-          // api - 2
-          status = jpegr.encodeJPEGR(hdr_raw_entry.get(), sdr_raw_entry.get(),
-                                     sdr_compressed_entry.get(),
-                                     handle->m_compressed_output_buffer.get());
-        }
-      }
-    } else {
-      status.error_code = UHDR_CODEC_INVALID_OPERATION;
+        if (handle->m_compressed_images.find(UHDR_SDR_IMG) == handle->m_compressed_images.end()) {
+          // api - 1 converts a yuv sdr intent to bt601 in place, keep borrowed planes untouched
+          if (sdr_raw_entry->is_borrowed() && sdr_raw_entry->fmt == UHDR_IMG_FMT_12bppYCbCr420 &&
+              sdr_raw_entry->cg != UHDR_CG_DISPLAY_P3) {
+            sdr_raw_entry = ultrahdr::copy_raw_image(sdr_raw_entry.get());
+            if (sdr_raw_entry == nullptr) {
+              status.error_code = UHDR_CODEC_MEM_ERROR;
+              status.has_detail = 1;
+              snprintf(status.detail, sizeof status.detail,
+                       "failed to allocate memory for a private copy of the sdr intent");
+              return status;
+            }
+          }
+          if (!handle->m_quality_rungs.empty()) {
+            status = encode_quality_ladder(handle, jpegr, hdr_raw_entry.get(), sdr_raw_entry.get(),
+                                           handle->m_exif.size() > 0 ? &exif : nullptr);
+          } else if (handle->m_target_size > 0) {
+            status = jpegr.encodeJPEGRTargetSize(
+                hdr_raw_entry.get(), sdr_raw_entry.get(), handle->m_target_size,
+                handle->m_quality.find(UHDR_BASE_IMG)->second,
+                handle->m_exif.size() > 0 ? &exif : nullptr,
+                handle->m_compressed_output_buffer.get());
+          } else {
+            status = jpegr.encodeJPEGR(hdr_raw_entry.get(), sdr_raw_entry.get(),
+                                       handle->m_compressed_output_buffer.get(),
+                                       handle->m_quality.find(UHDR_BASE_IMG)->second,
+                                       handle->m_exif.size() > 0 ? &exif : nullptr);
+          }
+        } else {
+          auto& sdr_compressed_entry = handle->m_compressed_images.find(UHDR_SDR_IMG)->second;
+          // api - 2
+          status = jpegr.encodeJPEGR(hdr_raw_entry.get(), sdr_raw_entry.get(),
+                                     sdr_compressed_entry.get(),
+                                     handle->m_compressed_output_buffer.get());
+        }
+      }
+    } else {
+      status.error_code = UHDR_CODEC_INVALID_OPERATION;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "resources required for uhdr_encode() operation are not present");
+    }
+  }
+
+  if (status.error_code == UHDR_CODEC_OK && handle->m_encoded_segments.empty() &&
+      handle->m_compressed_output_buffer != nullptr) {
+    handle->m_encoded_segments.push_back({handle->m_compressed_output_buffer->data,
+                                          handle->m_compressed_output_buffer->data_sz});
+  }
+
+#ifndef _WIN32
+  if (status.error_code == UHDR_CODEC_OK && handle->m_output_fd >= 0) {
+    status = write_encoded_stream(handle);
+  }
+#endif
+
+  return status;
+}
+
+uhdr_error_info_t uhdr_encode_async(uhdr_codec_private_t* enc, uhdr_completion_fn_t on_done,
+                                    void* user_ctx) {
+  if (dynamic_cast<uhdr_encoder_private*>(enc) == nullptr) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
+  }
+  return ultrahdr::run_async(enc, uhdr_encode, on_done, user_ctx);
+}
+
+uhdr_error_info_t uhdr_encode_batch(uhdr_codec_private_t** encs, unsigned int count) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (encs == nullptr || count == 0) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received empty list of encoder instances");
+    return status;
+  }
+
+  std::vector<uhdr_encoder_private*> handles(count);
+  for (unsigned int i = 0; i < count; i++) {
+    handles[i] = dynamic_cast<uhdr_encoder_private*>(encs[i]);
+    if (handles[i] == nullptr) {
+      status.error_code = UHDR_CODEC_INVALID_PARAM;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "entry %u of the batch is not a uhdr encoder instance", i);
+      return status;
+    }
+  }
+  std::vector<uhdr_encoder_private*> sorted(handles);
+  std::sort(sorted.begin(), sorted.end());
+  if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end()) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "an encoder instance appears more than once in the batch");
+    return status;
+  }
+
+  // largest images first, so that no long encode starts last while the other cores run dry
+  auto pixels = [](const uhdr_encoder_private* handle) -> int64_t {
+    for (auto label : {UHDR_HDR_IMG, UHDR_SDR_IMG}) {
+      auto it = handle->m_raw_images.find(label);
+      if (it != handle->m_raw_images.end()) return (int64_t)it->second->w * it->second->h;
+    }
+    return 0;
+  };
+  std::vector<unsigned int> order(count);
+  std::iota(order.begin(), order.end(), 0u);
+  std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {
+    return pixels(handles[a]) > pixels(handles[b]);
+  });
+
+  // base image icc profiles depend only on the color gamut, write them once for the batch
+  ultrahdr::JpegREncodeCache cache;
+  std::atomic<unsigned int> next{0}, next_worker{0};
+  const std::vector<std::vector<int>>& nodes = ultrahdr::CpuTopology::get().numaNodes();
+  auto encode_images = [&]() {
+    const std::vector<int>* node =
+        nodes.empty() ? nullptr : &nodes[next_worker.fetch_add(1) % nodes.size()];
+    for (unsigned int i = next.fetch_add(1); i < count; i = next.fetch_add(1)) {
+      uhdr_encoder_private* handle = handles[order[i]];
+      std::optional<ultrahdr::CoreAffinityScope> placement;
+      if (node != nullptr && handle->m_numa_placement) placement.emplace(*node);
+      int num_threads = handle->m_num_threads;
+      if (count > 1 && num_threads == ultrahdr::kNumThreadsDefault) handle->m_num_threads = 1;
+      handle->m_encode_cache = &cache;
+      uhdr_encode(handle);
+      handle->m_encode_cache = nullptr;
+      handle->m_num_threads = num_threads;
+    }
+  };
+  unsigned int workers = (std::min)(count, (std::max)(1u, std::thread::hardware_concurrency()));
+  ultrahdr::ThreadPool::getDefaultPool().run(encode_images, workers);
+
+  for (uhdr_encoder_private* handle : handles) {
+    if (handle->m_encode_call_status.error_code != UHDR_CODEC_OK) {
+      return handle->m_encode_call_status;
+    }
+  }
+  return status;
+}
+
+uhdr_error_info_t uhdr_enc_start_stream(uhdr_codec_private_t* enc, unsigned int height) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_encoder_private*>(enc) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
+  }
+
+  uhdr_encoder_private* handle = dynamic_cast<uhdr_encoder_private*>(enc);
+  if (handle->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_encode() or uhdr_enc_start_stream() has switched the context "
+             "from configurable state to end state. The context is no longer configurable. To "
+             "reuse, call reset()");
+    return status;
+  }
+  if ((int)height < ultrahdr::kMinHeight || (int)height > ultrahdr::kMaxHeight) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "image height must be in range [%d, %d], received %u", ultrahdr::kMinHeight,
+             ultrahdr::kMaxHeight, height);
+    return status;
+  }
+  if (!handle->m_raw_images.empty() || !handle->m_compressed_images.empty()) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "a streamed encode takes its intents from uhdr_enc_push_rows(), images set on the "
+             "context are not supported");
+    return status;
+  }
+  if (!handle->m_effects.empty() || !handle->m_quality_rungs.empty() ||
+      handle->m_target_size > 0 || handle->m_auto_gainmap_scale_factor) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "image effects, quality rungs, target sizes and the automatic gain map scale factor "
+             "need the whole image, they are not supported by streamed encodes");
+    return status;
+  }
+
+  auto jpegr = std::make_unique<ultrahdr::JpegR>(
+      nullptr, handle->m_gainmap_scale_factor, handle->m_quality.find(UHDR_GAIN_MAP_IMG)->second,
+      handle->m_use_multi_channel_gainmap, handle->m_gamma, handle->m_enc_preset,
+      handle->m_min_content_boost, handle->m_max_content_boost,
+      handle->m_target_disp_max_brightness);
+  jpegr->setNumThreads(handle->m_num_threads);
+  jpegr->setGainMapTileSize(handle->m_gainmap_tile_size);
+  jpegr->setParallelExecutor(handle->m_parallel_for, handle->m_parallel_for_ctx);
+  jpegr->setCoreAffinity(handle->m_core_affinity);
+  jpegr->setStats(handle->m_stats_enabled ? &handle->m_stats : nullptr);
+  handle->m_stream_jpegr = std::move(jpegr);
+  handle->m_stream = std::make_unique<ultrahdr::JpegREncodeStream>(
+      height, handle->m_quality.find(UHDR_BASE_IMG)->second);
+
+  handle->m_sailed = true;
+  handle->m_encoded_segments.clear();
+  uhdr_error_info_t& call_status = handle->m_encode_call_status;
+  call_status.error_code = UHDR_CODEC_INVALID_OPERATION;
+  call_status.has_detail = 1;
+  snprintf(call_status.detail, sizeof call_status.detail,
+           "a streamed encode is in progress, it completes with uhdr_enc_finish_stream()");
+  return status;
+}
+
+uhdr_error_info_t uhdr_enc_push_rows(uhdr_codec_private_t* enc, uhdr_raw_image_t* hdr_rows,
+                                     uhdr_raw_image_t* sdr_rows) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_encoder_private*>(enc) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
+  }
+
+  uhdr_encoder_private* handle = dynamic_cast<uhdr_encoder_private*>(enc);
+  if (handle->m_stream == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "no streamed encode is in progress, see uhdr_enc_start_stream()");
+    return status;
+  }
+  if (hdr_rows == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for hdr intent rows");
+    return status;
+  }
+  // the rows are checked as the intents they belong to
+  uhdr_raw_image_t intent = *hdr_rows;
+  intent.h = handle->m_stream->height;
+  status = check_raw_image(&intent, UHDR_HDR_IMG);
+  if (status.error_code != UHDR_CODEC_OK) return status;
+  if (sdr_rows != nullptr) {
+    intent = *sdr_rows;
+    intent.h = handle->m_stream->height;
+    status = check_raw_image(&intent, UHDR_SDR_IMG);
+    if (status.error_code != UHDR_CODEC_OK) return status;
+  }
+
+  ultrahdr::MemoryArena::Scope arena_scope(&handle->m_arena);
+  ultrahdr::CodecStats::Scope stats_scope(handle->m_stats_enabled ? &handle->m_stats : nullptr);
+  handle->m_cancel.arm(handle->m_cancel_flag, handle->m_deadline_ms);
+  ultrahdr::CancelToken::Scope cancel_scope(&handle->m_cancel);
+
+  status = handle->m_stream_jpegr->encodeJPEGRStreamRows(hdr_rows, sdr_rows,
+                                                         handle->m_stream.get());
+  if (status.error_code != UHDR_CODEC_OK && status.error_code != UHDR_CODEC_INVALID_PARAM) {
+    // the compressions can not resume, the encode ends with the failure
+    handle->m_encode_call_status = status;
+    handle->m_stream.reset();
+    handle->m_stream_jpegr.reset();
+  }
+  return status;
+}
+
+uhdr_error_info_t uhdr_enc_finish_stream(uhdr_codec_private_t* enc) {
+  if (dynamic_cast<uhdr_encoder_private*>(enc) == nullptr) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
+  }
+
+  uhdr_encoder_private* handle = dynamic_cast<uhdr_encoder_private*>(enc);
+  if (handle->m_stream == nullptr) {
+    if (handle->m_sailed) return handle->m_encode_call_status;
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "no streamed encode is in progress, see uhdr_enc_start_stream()");
+    return status;
+  }
+  if (handle->m_stream->rows != handle->m_stream->height) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "%u of the %u rows of the intents are pushed, the encode can not be finished yet",
+             handle->m_stream->rows, handle->m_stream->height);
+    return status;
+  }
+
+  ultrahdr::MemoryArena::Scope arena_scope(&handle->m_arena);
+  ultrahdr::CodecStats::Scope stats_scope(handle->m_stats_enabled ? &handle->m_stats : nullptr);
+  uhdr_error_info_t& status = handle->m_encode_call_status;
+
+  uhdr_mem_block_t exif{};
+  if (handle->m_exif.size() > 0) {
+    exif.data = handle->m_exif.data();
+    exif.capacity = exif.data_sz = handle->m_exif.size();
+  }
+  allocate_output_buffer(handle);
+  status = handle->m_stream_jpegr->encodeJPEGRStreamFinish(
+      handle->m_stream.get(), handle->m_exif.size() > 0 ? &exif : nullptr,
+      handle->m_compressed_output_buffer.get());
+  handle->m_stream.reset();
+  handle->m_stream_jpegr.reset();
+
+  if (status.error_code == UHDR_CODEC_OK) {
+    handle->m_encoded_segments.push_back({handle->m_compressed_output_buffer->data,
+                                          handle->m_compressed_output_buffer->data_sz});
+  }
+
+#ifndef _WIN32
+  if (status.error_code == UHDR_CODEC_OK && handle->m_output_fd >= 0) {
+    status = write_encoded_stream(handle);
+  }
+#endif
+
+  return status;
+}
+
+uhdr_compressed_image_t* uhdr_get_encoded_stream(uhdr_codec_private_t* enc) {
+  if (dynamic_cast<uhdr_encoder_private*>(enc) == nullptr) {
+    return nullptr;
+  }
+
+  uhdr_encoder_private* handle = dynamic_cast<uhdr_encoder_private*>(enc);
+  if (!handle->m_sailed || handle->m_encode_call_status.error_code != UHDR_CODEC_OK) {
+    return nullptr;
+  }
+
+  if (handle->m_encoded_segments.size() > 1) {
+    // segmented output, gather the spans into a stream of our own once
+    auto& out = handle->m_compressed_output_buffer;
+    size_t size = 0;
+    for (const uhdr_stream_segment_t& segment : handle->m_encoded_segments) {
+      size += segment.data_sz;
+    }
+    auto stream =
+        std::make_unique<ultrahdr::uhdr_compressed_image_ext_t>(out->cg, out->ct, out->range, size);
+    uint8_t* data = static_cast<uint8_t*>(stream->data);
+    for (const uhdr_stream_segment_t& segment : handle->m_encoded_segments) {
+      memcpy(data + stream->data_sz, segment.data, segment.data_sz);
+      stream->data_sz += segment.data_sz;
+    }
+    out = std::move(stream);
+    handle->m_encoded_segments.assign(1, {out->data, out->data_sz});
+  }
+
+  return handle->m_compressed_output_buffer.get();
+}
+
+const uhdr_stream_segment_t* uhdr_get_encoded_segments(uhdr_codec_private_t* enc,
+                                                       unsigned int* count) {
+  if (dynamic_cast<uhdr_encoder_private*>(enc) == nullptr || count == nullptr) {
+    return nullptr;
+  }
+
+  uhdr_encoder_private* handle = dynamic_cast<uhdr_encoder_private*>(enc);
+  if (!handle->m_sailed || handle->m_encode_call_status.error_code != UHDR_CODEC_OK) {
+    return nullptr;
+  }
+
+  *count = (unsigned int)handle->m_encoded_segments.size();
+  return handle->m_encoded_segments.data();
+}
+
+uhdr_compressed_image_t* uhdr_get_encoded_quality_rung(uhdr_codec_private_t* enc,
+                                                       unsigned int index) {
+  if (dynamic_cast<uhdr_encoder_private*>(enc) == nullptr) {
+    return nullptr;
+  }
+
+  uhdr_encoder_private* handle = dynamic_cast<uhdr_encoder_private*>(enc);
+  if (!handle->m_sailed || handle->m_encode_call_status.error_code != UHDR_CODEC_OK ||
+      index >= handle->m_quality_rungs.size()) {
+    return nullptr;
+  }
+
+  return handle->m_quality_rungs[index].img.get();
+}
+
+uhdr_codec_stats_t* uhdr_enc_get_stats(uhdr_codec_private_t* enc) {
+  if (dynamic_cast<uhdr_encoder_private*>(enc) == nullptr) {
+    return nullptr;
+  }
+
+  uhdr_encoder_private* handle = dynamic_cast<uhdr_encoder_private*>(enc);
+  if (!handle->m_stats_enabled) {
+    return nullptr;
+  }
+
+  return handle->m_stats.get();
+}
+
+void uhdr_reset_encoder(uhdr_codec_private_t* enc) {
+  if (dynamic_cast<uhdr_encoder_private*>(enc) != nullptr) {
+    uhdr_encoder_private* handle = dynamic_cast<uhdr_encoder_private*>(enc);
+    ultrahdr::wait_async(handle);
+
+    // clear entries and restore defaults
+    for (auto it : handle->m_effects) delete it;
+    handle->m_effects.clear();
+#ifdef UHDR_ENABLE_GLES
+    handle->m_uhdr_gl_ctxt.reset_opengl_ctxt();
+    handle->m_enable_gles = false;
+#endif
+    handle->m_parallel_for = nullptr;
+    handle->m_parallel_for_ctx = nullptr;
+    handle->m_cancel_flag = nullptr;
+    handle->m_deadline_ms = 0;
+    handle->m_sailed = false;
+    handle->m_raw_images.clear();
+    handle->m_compressed_images.clear();
+    handle->m_quality.clear();
+    handle->m_quality.emplace(UHDR_HDR_IMG, ultrahdr::kBaseCompressQualityDefault);
+    handle->m_quality.emplace(UHDR_SDR_IMG, ultrahdr::kBaseCompressQualityDefault);
+    handle->m_quality.emplace(UHDR_BASE_IMG, ultrahdr::kBaseCompressQualityDefault);
+    handle->m_quality.emplace(UHDR_GAIN_MAP_IMG, ultrahdr::kMapCompressQualityDefault);
+    handle->m_exif.clear();
+    handle->m_output_format = UHDR_CODEC_JPG;
+    handle->m_gainmap_scale_factor = ultrahdr::kMapDimensionScaleFactorDefault;
+    handle->m_use_multi_channel_gainmap = ultrahdr::kUseMultiChannelGainMapDefault;
+    handle->m_gamma = ultrahdr::kGainMapGammaDefault;
+    handle->m_enc_preset = ultrahdr::kEncSpeedPresetDefault;
+    handle->m_min_content_boost = FLT_MIN;
+    handle->m_max_content_boost = FLT_MAX;
+    handle->m_target_disp_max_brightness = -1.0f;
+    handle->m_num_threads = ultrahdr::kNumThreadsDefault;
+    handle->m_gainmap_tile_size = ultrahdr::kGainMapTileSizeDefault;
+    handle->m_gainmap_boost_estimation = false;
+    handle->m_auto_gainmap_scale_factor = false;
+
+    handle->m_output_buffer.reset();
+    handle->m_output_fd = -1;
+    handle->m_output_segments = false;
+    handle->m_quality_rungs.clear();
+    handle->m_target_size = 0;
+    handle->m_encoded_segments.clear();
+    handle->m_encode_cache = nullptr;
+    handle->m_stream.reset();
+    handle->m_stream_jpegr.reset();
+    handle->m_hdr_intent_downscale = 1;
+    handle->m_stats.clear();
+
+    handle->m_encode_call_status = g_no_error;
+  }
+}
+#endif  // UHDR_DECODER_ONLY
+
+int is_uhdr_image(void* data, int size) {
+  if (data == nullptr || size <= 0) return 0;
+  return ultrahdr::JpegR::hasUltraHdrSignature(data, size) ? 1 : 0;
+}
+
+uhdr_codec_private_t* uhdr_create_decoder(void) {
+  uhdr_decoder_private* handle = new uhdr_decoder_private();
+
+  if (handle != nullptr) {
+    uhdr_reset_decoder(handle);
+  }
+  return handle;
+}
+
+void uhdr_release_decoder(uhdr_codec_private_t* dec) {
+  if (dynamic_cast<uhdr_decoder_private*>(dec) != nullptr) {
+    uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+    ultrahdr::wait_async(handle);
+    delete handle;
+  }
+}
+
+static void apply_decoder_profile(uhdr_decoder_private* handle,
+                                  const uhdr_decoder_profile& profile) {
+  handle->m_output_fmt = profile.m_output_fmt;
+  handle->m_output_ct = profile.m_output_ct;
+  handle->m_output_cg = profile.m_output_cg;
+  handle->m_output_max_disp_boost = profile.m_output_max_disp_boost;
+  handle->m_num_threads = profile.m_num_threads;
+  handle->m_apply_gainmap = profile.m_apply_gainmap;
+  handle->m_gainmap_only_denom = profile.m_gainmap_only_denom;
+  handle->m_fast_idct = profile.m_fast_idct;
+  handle->m_fast_upsampling = profile.m_fast_upsampling;
+  handle->m_approximate_gainmap = profile.m_approximate_gainmap;
+#ifdef UHDR_ENABLE_GLES
+  handle->m_enable_gles = profile.m_enable_gles;
+#endif
+  handle->m_gpu_output = profile.m_gpu_output;
+  handle->m_gpu_share_ctxt = profile.m_gpu_share_ctxt;
+  handle->m_memory_limit = profile.m_memory_limit;
+  handle->m_deadline_ms = profile.m_deadline_ms;
+  handle->m_parallel_for = profile.m_parallel_for;
+  handle->m_parallel_for_ctx = profile.m_parallel_for_ctx;
+}
+
+uhdr_decoder_profile_t* uhdr_create_decoder_profile(uhdr_codec_private_t* dec) {
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (handle == nullptr) return nullptr;
+  uhdr_decoder_profile* profile = new uhdr_decoder_profile();
+  profile->m_output_fmt = handle->m_output_fmt;
+  profile->m_output_ct = handle->m_output_ct;
+  profile->m_output_cg = handle->m_output_cg;
+  profile->m_output_max_disp_boost = handle->m_output_max_disp_boost;
+  profile->m_num_threads = handle->m_num_threads;
+  profile->m_apply_gainmap = handle->m_apply_gainmap;
+  profile->m_gainmap_only_denom = handle->m_gainmap_only_denom;
+  profile->m_fast_idct = handle->m_fast_idct;
+  profile->m_fast_upsampling = handle->m_fast_upsampling;
+  profile->m_approximate_gainmap = handle->m_approximate_gainmap;
+#ifdef UHDR_ENABLE_GLES
+  profile->m_enable_gles = handle->m_enable_gles;
+#else
+  profile->m_enable_gles = false;
+#endif
+  profile->m_gpu_output = handle->m_gpu_output;
+  profile->m_gpu_share_ctxt = handle->m_gpu_share_ctxt;
+  profile->m_memory_limit = handle->m_memory_limit;
+  profile->m_deadline_ms = handle->m_deadline_ms;
+  profile->m_parallel_for = handle->m_parallel_for;
+  profile->m_parallel_for_ctx = handle->m_parallel_for_ctx;
+  return profile;
+}
+
+void uhdr_release_decoder_profile(uhdr_decoder_profile_t* profile) { delete profile; }
+
+uhdr_error_info_t uhdr_dec_set_profile(uhdr_codec_private_t* dec,
+                                       const uhdr_decoder_profile_t* profile) {
+  uhdr_error_info_t status = g_no_error;
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+
+  if (handle == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
+  }
+
+  if (handle->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(
+        status.detail, sizeof status.detail,
+        "An earlier call to uhdr_encode()/uhdr_decode() has switched the context from configurable "
+        "state to end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+
+  if (profile == nullptr) {
+    handle->m_profile.reset();
+    return status;
+  }
+  handle->m_profile = std::make_unique<uhdr_decoder_profile>(*profile);
+  apply_decoder_profile(handle, *profile);
+
+  return status;
+}
+
+uhdr_decoder_cache_t* uhdr_create_decoder_cache(size_t capacity, int keep_gainmaps) {
+  if (capacity == 0) return nullptr;
+  uhdr_decoder_cache* cache = new uhdr_decoder_cache();
+  cache->m_cache = std::make_shared<ultrahdr::DecoderCache>(capacity, keep_gainmaps != 0);
+  return cache;
+}
+
+void uhdr_release_decoder_cache(uhdr_decoder_cache_t* cache) { delete cache; }
+
+uhdr_error_info_t uhdr_dec_set_cache(uhdr_codec_private_t* dec, uhdr_decoder_cache_t* cache) {
+  uhdr_error_info_t status = g_no_error;
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+
+  if (handle == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
+  }
+
+  if (handle->m_sailed || handle->m_probed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(
+        status.detail, sizeof status.detail,
+        "An earlier call to uhdr_dec_probe()/uhdr_decode() has switched the context from "
+        "configurable state to end state. The context is no longer configurable. To reuse, call "
+        "reset()");
+    return status;
+  }
+
+  handle->m_cache = cache != nullptr ? cache->m_cache : nullptr;
+
+  return status;
+}
+
+uhdr_error_info_t uhdr_get_decoder_cache_stats(uhdr_decoder_cache_t* cache,
+                                               uhdr_decoder_cache_stats_t* stats) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (cache == nullptr || stats == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for %s",
+             cache == nullptr ? "decoder cache" : "cache stats");
+    return status;
+  }
+  cache->m_cache->getStats(stats);
+
+  return status;
+}
+
+static uhdr_error_info_t set_image(uhdr_codec_private_t* dec, uhdr_compressed_image_t* img,
+                                   bool borrow) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+  } else if (img == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for compressed image handle");
+  } else if (img->data == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "received nullptr for compressed img->data field");
+  } else if (img->capacity < img->data_sz) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "img->capacity %zd is less than img->data_sz %zd",
+             img->capacity, img->data_sz);
+  }
+  if (status.error_code != UHDR_CODEC_OK) return status;
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (handle->m_probed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_decode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+  if (handle->m_input_stream != nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "the compressed image is being pushed with uhdr_dec_push_data(). To reuse, call "
+             "reset()");
+    return status;
+  }
+
+  if (borrow) {
+    handle->m_uhdr_compressed_img = std::make_unique<ultrahdr::uhdr_compressed_image_ext_t>(*img);
+  } else {
+    ultrahdr::MemoryArena::Scope arena_scope(&handle->m_arena);
+    handle->m_uhdr_compressed_img = std::make_unique<ultrahdr::uhdr_compressed_image_ext_t>(
+        img->cg, img->ct, img->range, img->data_sz);
+    memcpy(handle->m_uhdr_compressed_img->data, img->data, img->data_sz);
+    handle->m_uhdr_compressed_img->data_sz = img->data_sz;
+  }
+  handle->m_input_mapping.reset();
+
+  return status;
+}
+
+uhdr_error_info_t uhdr_dec_set_image(uhdr_codec_private_t* dec, uhdr_compressed_image_t* img) {
+  return set_image(dec, img, false);
+}
+
+uhdr_error_info_t uhdr_dec_set_image_ref(uhdr_codec_private_t* dec, uhdr_compressed_image_t* img) {
+  return set_image(dec, img, true);
+}
+
+uhdr_error_info_t uhdr_dec_push_data(uhdr_codec_private_t* dec, const void* data, size_t size,
+                                     int last) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+  } else if (data == nullptr && size != 0) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for chunk data");
+  }
+  if (status.error_code != UHDR_CODEC_OK) return status;
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (handle->m_probed || handle->m_uhdr_compressed_img != nullptr ||
+      (handle->m_input_stream != nullptr && handle->m_input_stream->complete)) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "the compressed image of the context is already complete. To reuse, call reset()");
+    return status;
+  }
+
+  bool start = false;
+  if (handle->m_input_stream == nullptr) {
+    handle->m_input_stream = std::make_unique<ultrahdr::input_stream>();
+    start = true;
+  }
+  ultrahdr::input_stream* stream = handle->m_input_stream.get();
+  {
+    std::lock_guard<std::mutex> lock(stream->mutex);
+    if (size != 0) {
+      const uint8_t* bytes = static_cast<const uint8_t*>(data);
+      stream->chunks.emplace_back(bytes, bytes + size);
+      stream->size += size;
+    }
+    stream->complete = last != 0;
+    stream->cv.notify_all();
+  }
+#ifdef UHDR_NO_THREADS
+  // the decode would run inline and wait for chunks that are not pushed yet
+  start = last != 0;
+#endif
+  if (start) ultrahdr::start_input_stream(handle);
+
+  return status;
+}
+
+uhdr_error_info_t uhdr_dec_set_image_fd(uhdr_codec_private_t* dec, int fd) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+  } else if (fd < 0) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received invalid file descriptor %d", fd);
+  }
+  if (status.error_code != UHDR_CODEC_OK) return status;
+
+#ifdef _WIN32
+  status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
+  status.has_detail = 1;
+  snprintf(status.detail, sizeof status.detail,
+           "mapped file input is not supported on this platform, use uhdr_dec_set_image()");
+  return status;
+#else
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (handle->m_probed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_decode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+  if (handle->m_input_stream != nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "the compressed image is being pushed with uhdr_dec_push_data(). To reuse, call "
+             "reset()");
+    return status;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "file descriptor %d does not refer to a non-empty regular file", fd);
+    return status;
+  }
+  size_t size = static_cast<size_t>(st.st_size);
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    status.error_code = UHDR_CODEC_ERROR;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "failed to map %zu bytes of fd %d, %s", size,
+             fd, strerror(errno));
+    return status;
+  }
+  // the whole file is read front to back by the scanners and libjpeg
+  madvise(data, size, MADV_SEQUENTIAL);
+
+  uhdr_compressed_image_t img;
+  img.data = data;
+  img.data_sz = size;
+  img.capacity = size;
+  img.cg = UHDR_CG_UNSPECIFIED;
+  img.ct = UHDR_CT_UNSPECIFIED;
+  img.range = UHDR_CR_UNSPECIFIED;
+  handle->m_uhdr_compressed_img = std::make_unique<ultrahdr::uhdr_compressed_image_ext_t>(img);
+  handle->m_input_mapping.reset(data, [size](void* p) { munmap(p, size); });
+
+  return status;
+#endif
+}
+
+uhdr_error_info_t uhdr_dec_set_out_img_format(uhdr_codec_private_t* dec, uhdr_img_fmt_t fmt) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+  } else if (fmt != UHDR_IMG_FMT_32bppRGBA8888 && fmt != UHDR_IMG_FMT_64bppRGBAHalfFloat &&
+             fmt != UHDR_IMG_FMT_32bppRGBA1010102 && fmt != UHDR_IMG_FMT_12bppYCbCr420 &&
+             fmt != UHDR_IMG_FMT_24bppYCbCr444 && fmt != UHDR_IMG_FMT_8bppYCbCr400 &&
+             fmt != UHDR_IMG_FMT_24bppYCbCrP010) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "invalid output format %d, expects one of {UHDR_IMG_FMT_32bppRGBA8888,  "
+             "UHDR_IMG_FMT_64bppRGBAHalfFloat, UHDR_IMG_FMT_32bppRGBA1010102, "
+             "UHDR_IMG_FMT_24bppYCbCrP010, UHDR_IMG_FMT_12bppYCbCr420, "
+             "UHDR_IMG_FMT_24bppYCbCr444, UHDR_IMG_FMT_8bppYCbCr400}",
+             fmt);
+  }
+  if (status.error_code != UHDR_CODEC_OK) return status;
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (handle->m_probed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_decode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+
+  handle->m_output_fmt = fmt;
+
+  return status;
+}
+
+uhdr_error_info_t uhdr_dec_set_output_buffer(uhdr_codec_private_t* dec, uhdr_raw_image_t* img) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+  } else if (img == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for output buffer");
+  } else if (img->fmt != UHDR_IMG_FMT_32bppRGBA8888 &&
+             img->fmt != UHDR_IMG_FMT_64bppRGBAHalfFloat &&
+             img->fmt != UHDR_IMG_FMT_32bppRGBA1010102 &&
+             img->fmt != UHDR_IMG_FMT_24bppYCbCrP010) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "invalid output buffer format %d, expects one of {UHDR_IMG_FMT_32bppRGBA8888,  "
+             "UHDR_IMG_FMT_64bppRGBAHalfFloat, UHDR_IMG_FMT_32bppRGBA1010102, "
+             "UHDR_IMG_FMT_24bppYCbCrP010}",
+             img->fmt);
+  } else if (img->w == 0 || img->h == 0) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "output buffer dimensions cannot be zero, received w %u, h %u", img->w, img->h);
+  } else if (img->planes[UHDR_PLANE_PACKED] == nullptr ||
+             (img->fmt == UHDR_IMG_FMT_24bppYCbCrP010 && img->planes[UHDR_PLANE_UV] == nullptr)) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "received nullptr for data field(s) of output buffer");
+  } else if (img->stride[UHDR_PLANE_PACKED] < img->w ||
+             (img->fmt == UHDR_IMG_FMT_24bppYCbCrP010 && img->stride[UHDR_PLANE_UV] < img->w)) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "output buffer stride %u is less than width %u", img->stride[UHDR_PLANE_PACKED],
+             img->w);
+  }
+  if (status.error_code != UHDR_CODEC_OK) return status;
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (handle->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_decode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+
+  handle->m_output_buffer = std::make_unique<ultrahdr::uhdr_raw_image_ext_t>(*img);
+
+  return status;
+}
+
+uhdr_error_info_t uhdr_dec_set_strip_callback(uhdr_codec_private_t* dec, uhdr_strip_fn_t strip_fn,
+                                              void* strip_ctx, unsigned int strip_height) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+  } else if (strip_fn != nullptr && strip_height == 0) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received bad strip height %u", strip_height);
+  }
+  if (status.error_code != UHDR_CODEC_OK) return status;
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (handle->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_decode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+
+  handle->m_strip_fn = strip_fn;
+  handle->m_strip_ctx = strip_fn ? strip_ctx : nullptr;
+  handle->m_strip_height = strip_fn ? strip_height : 0;
+
+  return status;
+}
+
+uhdr_error_info_t uhdr_dec_set_memory_limit(uhdr_codec_private_t* dec, size_t limit_bytes) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
+  }
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (handle->m_probed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_decode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+
+  handle->m_memory_limit = limit_bytes;
+
+  return status;
+}
+
+uhdr_error_info_t uhdr_dec_set_base_image_callback(uhdr_codec_private_t* dec,
+                                                   uhdr_base_image_fn_t base_fn, void* base_ctx) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
+  }
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (handle->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_decode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+
+  handle->m_base_fn = base_fn;
+  handle->m_base_ctx = base_fn ? base_ctx : nullptr;
+
+  return status;
+}
+
+uhdr_error_info_t uhdr_dec_enable_gainmap_application(uhdr_codec_private_t* dec, int enable) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
+  }
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (handle->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_decode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+
+  handle->m_apply_gainmap = enable != 0;
+
+  return status;
+}
+
+uhdr_error_info_t uhdr_dec_set_gainmap_only_decode(uhdr_codec_private_t* dec, int scale_denom) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
+  }
+
+  if (scale_denom != 0 && scale_denom != 1 && scale_denom != 2 && scale_denom != 4 &&
+      scale_denom != 8) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "invalid gain map scale denominator %d, expects one of {0, 1, 2, 4, 8}", scale_denom);
+    return status;
+  }
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (handle->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_decode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+
+  handle->m_gainmap_only_denom = scale_denom;
+
+  return status;
+}
+
+uhdr_error_info_t uhdr_dec_set_out_color_transfer(uhdr_codec_private_t* dec,
+                                                  uhdr_color_transfer_t ct) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+  } else if (ct != UHDR_CT_HLG && ct != UHDR_CT_PQ && ct != UHDR_CT_LINEAR && ct != UHDR_CT_SRGB) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "invalid output color transfer %d, expects one of {UHDR_CT_HLG, UHDR_CT_PQ, "
+             "UHDR_CT_LINEAR, UHDR_CT_SRGB}",
+             ct);
+  }
+  if (status.error_code != UHDR_CODEC_OK) return status;
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (handle->m_probed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_decode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+
+  handle->m_output_ct = ct;
+
+  return status;
+}
+
+uhdr_error_info_t uhdr_dec_set_out_color_gamut(uhdr_codec_private_t* dec, uhdr_color_gamut_t cg) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+  } else if (cg != UHDR_CG_UNSPECIFIED && cg != UHDR_CG_BT_709 && cg != UHDR_CG_DISPLAY_P3 &&
+             cg != UHDR_CG_BT_2100) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "invalid output color gamut %d, expects one of {UHDR_CG_UNSPECIFIED, UHDR_CG_BT_709, "
+             "UHDR_CG_DISPLAY_P3, UHDR_CG_BT_2100}",
+             cg);
+  }
+  if (status.error_code != UHDR_CODEC_OK) return status;
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (handle->m_probed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_decode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+
+  handle->m_output_cg = cg;
+
+  return status;
+}
+
+uhdr_error_info_t uhdr_dec_set_out_max_display_boost(uhdr_codec_private_t* dec,
+                                                     float display_boost) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+  } else if (!std::isfinite(display_boost) || display_boost < 1.0f) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "invalid display boost %f, expects to be >= 1.0f}", display_boost);
+  }
+  if (status.error_code != UHDR_CODEC_OK) return status;
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (handle->m_probed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_decode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+
+  handle->m_output_max_disp_boost = display_boost;
+
+  return status;
+}
+
+uhdr_error_info_t uhdr_dec_add_rendition(uhdr_codec_private_t* dec, uhdr_img_fmt_t fmt,
+                                         uhdr_color_transfer_t ct, float display_boost) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+  } else if (!((fmt == UHDR_IMG_FMT_64bppRGBAHalfFloat && ct == UHDR_CT_LINEAR) ||
+               ((fmt == UHDR_IMG_FMT_32bppRGBA1010102 || fmt == UHDR_IMG_FMT_24bppYCbCrP010) &&
+                (ct == UHDR_CT_HLG || ct == UHDR_CT_PQ)) ||
+               (fmt == UHDR_IMG_FMT_32bppRGBA8888 && ct == UHDR_CT_SRGB))) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "unsupported output pixel format %d and output color transfer %d pair", fmt, ct);
+  } else if (!std::isfinite(display_boost) || display_boost < 1.0f) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "invalid display boost %f, expects to be >= 1.0f", display_boost);
+  }
+  if (status.error_code != UHDR_CODEC_OK) return status;
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (handle->m_probed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_decode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+
+  handle->m_renditions.push_back({fmt, ct, display_boost, nullptr});
+
+  return status;
+}
+
+uhdr_error_info_t uhdr_dec_add_pyramid_level(uhdr_codec_private_t* dec, int width, int height,
+                                             uhdr_resize_filter_t filter) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+  } else if (width <= 0 || height <= 0) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "invalid pyramid level dimensions %dx%d, expects positive values", width, height);
+  } else if (filter < UHDR_RESIZE_NEAREST || filter > UHDR_RESIZE_LANCZOS) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "unsupported resize filter %d", filter);
+  }
+  if (status.error_code != UHDR_CODEC_OK) return status;
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (handle->m_probed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_decode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+
+  handle->m_pyramid_levels.push_back({width, height, filter, nullptr});
+
+  return status;
+}
+
+uhdr_error_info_t uhdr_dec_set_num_threads(uhdr_codec_private_t* dec, int num_threads) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+  } else if (num_threads < 0 || num_threads > ultrahdr::kNumThreadsMax) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "invalid number of threads %d, expects to be in range [0, %d]", num_threads,
+             ultrahdr::kNumThreadsMax);
+  }
+  if (status.error_code != UHDR_CODEC_OK) return status;
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (handle->m_probed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_decode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+
+  handle->m_num_threads = num_threads;
+
+  return status;
+}
+
+uhdr_error_info_t uhdr_dec_enable_fast_idct(uhdr_codec_private_t* dec, int enable) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
+  }
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (handle->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_decode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+
+  handle->m_fast_idct = enable != 0;
+
+  return status;
+}
+
+uhdr_error_info_t uhdr_dec_enable_fast_upsampling(uhdr_codec_private_t* dec, int enable) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
+  }
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (handle->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_decode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+
+  handle->m_fast_upsampling = enable != 0;
+
+  return status;
+}
+
+uhdr_error_info_t uhdr_dec_enable_approximate_gainmap(uhdr_codec_private_t* dec, int enable) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
+  }
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (handle->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_decode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+
+  handle->m_approximate_gainmap = enable != 0;
+
+  return status;
+}
+
+uhdr_error_info_t uhdr_dec_enable_luminance_stats(uhdr_codec_private_t* dec, int enable) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
+  }
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (handle->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_decode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+
+  handle->m_luminance_stats_enabled = enable != 0;
+
+  return status;
+}
+
+uhdr_error_info_t uhdr_dec_enable_gpu_output(uhdr_codec_private_t* dec, int enable,
+                                             void* share_ctxt) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
+  }
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (handle->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "An earlier call to uhdr_decode() has switched the context from configurable state to "
+             "end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
+  }
+
+  handle->m_gpu_output = enable != 0;
+  handle->m_gpu_share_ctxt = enable != 0 ? share_ctxt : nullptr;
+
+  return status;
+}
+
+// rows per strip of a decode that falls back to strips to stay within the memory limit
+static const unsigned int kMemoryLimitStripHeight = 64;
+
+// Whether a whole image decode to fmt applies the gain map over a base image decoded into the
+// output, see JpegR::setApplyGainMapInPlace(). Decoders with a memory limit do so where the base
+// image decodes to the output format.
+static bool applies_gainmap_in_place(const uhdr_decoder_private* handle, uhdr_img_fmt_t fmt,
+                                     uhdr_color_transfer_t ct) {
+  return handle->m_memory_limit != 0 && handle->m_effects.size() == 0 &&
+         !ultrahdr::is_base_image_output(handle) && ct == UHDR_CT_SRGB &&
+         fmt == UHDR_IMG_FMT_32bppRGBA8888;
+}
+
+// Twice the bytes per pixel of an output in fmt, for the 4:2:0 layout
+static size_t output_bpp_x2(uhdr_img_fmt_t fmt) {
+  switch (fmt) {
+    case UHDR_IMG_FMT_64bppRGBAHalfFloat:
+      return 16;
+    case UHDR_IMG_FMT_24bppYCbCrP010:
+      return 6;
+    case UHDR_IMG_FMT_12bppYCbCr420:
+      return 3;
+    case UHDR_IMG_FMT_24bppYCbCr444:
+      return 6;
+    case UHDR_IMG_FMT_8bppYCbCr400:
+      return 2;
+    default:
+      return 8;
+  }
+}
+
+// Bytes per pixel of the decoded base image, rgba for srgb output, planar ycbcr otherwise
+static size_t base_image_bpp(const uhdr_decoder_private* handle, uhdr_color_transfer_t ct) {
+  return ct == UHDR_CT_SRGB ? 4 : (handle->m_img_num_comp == 1 ? 1 : 3);
+}
+
+// Bytes of the decoded gain map, which is held by the jpeg decoder and copied out to the decoded
+// gain map image
+static size_t gainmap_image_bytes(const uhdr_decoder_private* handle) {
+  return (size_t)handle->m_gainmap_wd * handle->m_gainmap_ht *
+         (handle->m_gainmap_num_comp == 1 ? 1 : 4);
+}
+
+// Image buffer bytes a decode to fmt is projected to hold at once, from the parsed headers. With
+// strip_height > 0 the base image is held a strip at a time, as is the rendition unless
+// whole_output adds a whole image one, be it the output of a whole image decode or one the strips
+// are rendered into. The base image is taken as decoded without chroma subsampling.
+static size_t project_decode_bytes(const uhdr_decoder_private* handle, uhdr_img_fmt_t fmt,
+                                   uhdr_color_transfer_t ct, unsigned int strip_height,
+                                   bool whole_output) {
+  const size_t wd = handle->m_img_wd, ht = handle->m_img_ht;
+  // strips are rounded up to the mcu height, at most 16 rows
+  const size_t rows = strip_height ? (std::min)(ht, (size_t)(strip_height + 15u) / 16u * 16u) : ht;
+  const size_t base_bpp = base_image_bpp(handle, ct);
+  const size_t out_bpp_x2 = output_bpp_x2(fmt);
+  const size_t gainmap_bytes = gainmap_image_bytes(handle);
+  if (handle->m_gainmap_only_denom != 0) {
+    // neither base image nor rendition, the gain map shrinks by the square of the scale
+    const size_t denom = handle->m_gainmap_only_denom;
+    return 2 * gainmap_bytes / (denom * denom);
+  }
+
+  // a base image decoded into the output takes no memory of its own
+  const bool base_in_output = strip_height == 0 && applies_gainmap_in_place(handle, fmt, ct);
+  size_t bytes = (base_in_output ? 0 : wd * rows * base_bpp) + 2 * gainmap_bytes;
+  if (strip_height && !whole_output) bytes += wd * rows * out_bpp_x2 / 2;
+  if (whole_output) bytes += wd * ht * out_bpp_x2 / 2;
+  return bytes;
+}
+
+// Checks the configured decode against the memory limit. in_strips is set if the decode only
+// fits when the base image is decoded strip wise and the rendition assembled from the strips.
+static uhdr_error_info_t plan_decode_memory(const uhdr_decoder_private* handle, bool& in_strips) {
+  in_strips = false;
+  if (handle->m_memory_limit == 0) return g_no_error;
+
+  uhdr_error_info_t status = g_no_error;
+  const uhdr_color_transfer_t ct =
+      ultrahdr::is_base_image_output(handle) ? UHDR_CT_SRGB : handle->m_output_ct;
+  if (handle->m_strip_fn != nullptr) {
+    size_t bytes =
+        project_decode_bytes(handle, handle->m_output_fmt, ct, handle->m_strip_height, false);
+    if (bytes > handle->m_memory_limit) {
+      status.error_code = UHDR_CODEC_MEM_ERROR;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "strip wise decode is projected to use %zu bytes, exceeds the memory limit of %zu "
+               "bytes",
+               bytes, handle->m_memory_limit);
+    }
+    return status;
+  }
+
+  if (handle->m_gainmap_only_denom != 0) {
+    size_t bytes = project_decode_bytes(handle, handle->m_output_fmt, ct, 0, false);
+    if (bytes > handle->m_memory_limit) {
+      status.error_code = UHDR_CODEC_MEM_ERROR;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "gain map decode is projected to use %zu bytes, exceeds the memory limit of %zu "
+               "bytes",
+               bytes, handle->m_memory_limit);
+    }
+    return status;
+  }
+
+  // a caller provided output buffer is decoded into as is, unless effects follow the decode
+  const bool whole_output =
+      handle->m_output_buffer == nullptr || handle->m_effects.size() != 0;
+  size_t bytes = project_decode_bytes(handle, handle->m_output_fmt, ct, 0, whole_output);
+  if (bytes <= handle->m_memory_limit) return status;
+
+  if (handle->m_effects.size() != 0 || handle->m_base_fn != nullptr ||
+      ultrahdr::is_base_image_output(handle)) {
+    status.error_code = UHDR_CODEC_MEM_ERROR;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "decode is projected to use %zu bytes, exceeds the memory limit of %zu bytes. Strip "
+             "wise decode does not combine with the configured effects, base image callback or "
+             "disabled gain map application",
+             bytes, handle->m_memory_limit);
+    return status;
+  }
+  bytes = project_decode_bytes(handle, handle->m_output_fmt, ct, kMemoryLimitStripHeight,
+                               whole_output);
+  if (bytes > handle->m_memory_limit) {
+    status.error_code = UHDR_CODEC_MEM_ERROR;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "decode is projected to use %zu bytes even strip wise, exceeds the memory limit of "
+             "%zu bytes",
+             bytes, handle->m_memory_limit);
+    return status;
+  }
+  in_strips = true;
+  return status;
+}
+
+// Fills the cost estimate of the configured decode, in_strips as planned by plan_decode_memory()
+static void estimate_decode_cost(uhdr_decoder_private* handle, bool in_strips) {
+  uhdr_decode_cost_t& cost = handle->m_cost;
+  const bool whole_output = handle->m_strip_fn == nullptr &&
+                            (handle->m_output_buffer == nullptr || handle->m_effects.size() != 0);
+  const unsigned int strip_height = handle->m_strip_fn != nullptr ? handle->m_strip_height : 0;
+  cost.image_pixels = (size_t)handle->m_img_wd * handle->m_img_ht;
+  cost.gainmap_pixels = (size_t)handle->m_gainmap_wd * handle->m_gainmap_ht;
+  cost.bytes_rgba_half_float = project_decode_bytes(handle, UHDR_IMG_FMT_64bppRGBAHalfFloat,
+                                                    UHDR_CT_LINEAR, strip_height, whole_output);
+  cost.bytes_rgba1010102 = project_decode_bytes(handle, UHDR_IMG_FMT_32bppRGBA1010102,
+                                                UHDR_CT_HLG, strip_height, whole_output);
+  cost.bytes_rgba8888 = project_decode_bytes(handle, UHDR_IMG_FMT_32bppRGBA8888, UHDR_CT_SRGB,
+                                             strip_height, whole_output);
+  cost.bytes = project_decode_bytes(
+      handle, handle->m_output_fmt,
+      ultrahdr::is_base_image_output(handle) ? UHDR_CT_SRGB : handle->m_output_ct,
+      in_strips ? kMemoryLimitStripHeight : strip_height, whole_output);
+  cost.in_strips = handle->m_strip_fn != nullptr || in_strips;
+  cost.gpu_capable = 0;
+#ifdef UHDR_ENABLE_GLES
+  // see acquire_gpu() and the gpu setup of uhdr_decode()
+  cost.gpu_capable = handle->m_enable_gles && !cost.in_strips &&
+                     handle->m_gainmap_only_denom == 0 &&
+                     (handle->m_gpu_output ||
+                      (int64_t)cost.image_pixels >= ultrahdr::kGpuDecodeMinPixels) &&
+                     ((handle->m_apply_gainmap && handle->m_output_ct != UHDR_CT_SRGB) ||
+                      handle->m_effects.size() > 0);
+#endif
+}
+
+uhdr_error_info_t uhdr_dec_probe(uhdr_codec_private_t* dec) {
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
+  }
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  uhdr_error_info_t& status = handle->m_probe_call_status;
+
+  if (!handle->m_probed && handle->m_input_stream != nullptr) {
+    if (!handle->m_input_stream->complete) {
+      uhdr_error_info_t pending;
+      pending.error_code = UHDR_CODEC_INVALID_OPERATION;
+      pending.has_detail = 1;
+      snprintf(pending.detail, sizeof pending.detail,
+               "the final chunk of the compressed image is not pushed yet");
+      return pending;
+    }
+    ultrahdr::MemoryArena::Scope arena_scope(&handle->m_arena);
+    ultrahdr::finish_input_stream(handle);
+  }
+
+  if (!handle->m_probed) {
+    handle->m_probed = true;
+
+    if (handle->m_uhdr_compressed_img.get() == nullptr) {
+      status.error_code = UHDR_CODEC_INVALID_OPERATION;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail, "did not receive any image for decoding");
+      return status;
+    }
+
+    // an image probed before by a decoder sharing the cache is not parsed again
+    ultrahdr::DecoderCache* cache = handle->m_cache.get();
+    const uint8_t* img_data = static_cast<const uint8_t*>(handle->m_uhdr_compressed_img->data);
+    ultrahdr::DecoderCache::Key key{};
+    ultrahdr::DecoderCache::ProbeInfo info;
+    if (cache != nullptr) {
+      key = ultrahdr::DecoderCache::keyOf(img_data, handle->m_uhdr_compressed_img->data_sz);
+      handle->m_cache_keyed = true;
+      handle->m_cache_hash = key.hash;
+    }
+    if (cache != nullptr && cache->findProbeInfo(key, info)) {
+      auto block = [img_data](uhdr_mem_block_t& dst, const ultrahdr::DecoderCache::Block& src) {
+        dst.data = src.size != 0 ? const_cast<uint8_t*>(img_data) + src.offset : nullptr;
+        dst.data_sz = dst.capacity = src.size;
+      };
+      handle->m_metadata = info.metadata;
+      handle->m_img_wd = info.img_wd;
+      handle->m_img_ht = info.img_ht;
+      handle->m_img_num_comp = info.img_num_comp;
+      handle->m_gainmap_wd = info.gainmap_wd;
+      handle->m_gainmap_ht = info.gainmap_ht;
+      handle->m_gainmap_num_comp = info.gainmap_num_comp;
+      block(handle->m_exif_block, info.exif);
+      block(handle->m_icc_block, info.icc);
+      block(handle->m_base_img_block, info.base_img);
+      block(handle->m_gainmap_img_block, info.gainmap_img);
+    } else {
+      // headers are read in place and the blocks handed out point into the registered image. The
+      // copying parse is only needed for streams the marker scan does not handle
+      ultrahdr::JpegR jpegr;
+      uhdr_compressed_image_t primary_bitstream, gainmap_bitstream;
+      ultrahdr::jpeg_header_view_t primary_view, gainmap_view;
+      ultrahdr::jpeg_info_struct primary_image;
+      ultrahdr::jpeg_info_struct gainmap_image;
+      status = jpegr.getJPEGRInfoInPlace(handle->m_uhdr_compressed_img.get(), &primary_bitstream,
+                                         &primary_view, &gainmap_bitstream, &gainmap_view);
+      const bool in_place = status.error_code == UHDR_CODEC_OK;
+      if (!in_place) {
+        ultrahdr::jpegr_info_struct jpegr_info;
+        jpegr_info.primaryImgInfo = &primary_image;
+        jpegr_info.gainmapImgInfo = &gainmap_image;
+        status = jpegr.getJPEGRInfo(handle->m_uhdr_compressed_img.get(), &jpegr_info);
+        if (status.error_code != UHDR_CODEC_OK) return status;
+
+        handle->m_exif = std::move(primary_image.exifData);
+        handle->m_icc = std::move(primary_image.iccData);
+        handle->m_base_img = std::move(primary_image.imgData);
+        handle->m_gainmap_img = std::move(gainmap_image.imgData);
+        memset(&primary_view, 0, sizeof primary_view);
+        primary_view.width = primary_image.width;
+        primary_view.height = primary_image.height;
+        primary_view.numComponents = primary_image.numComponents;
+        primary_view.exifData = handle->m_exif.data();
+        primary_view.exifSize = handle->m_exif.size();
+        primary_view.iccData = handle->m_icc.data();
+        primary_view.iccSize = handle->m_icc.size();
+        primary_bitstream.data = handle->m_base_img.data();
+        primary_bitstream.data_sz = handle->m_base_img.size();
+        memset(&gainmap_view, 0, sizeof gainmap_view);
+        gainmap_view.width = gainmap_image.width;
+        gainmap_view.height = gainmap_image.height;
+        gainmap_view.numComponents = gainmap_image.numComponents;
+        gainmap_view.xmpData = gainmap_image.xmpData.data();
+        gainmap_view.xmpSize = gainmap_image.xmpData.size();
+        gainmap_view.isoData = gainmap_image.isoData.data();
+        gainmap_view.isoSize = gainmap_image.isoData.size();
+        gainmap_bitstream.data = handle->m_gainmap_img.data();
+        gainmap_bitstream.data_sz = handle->m_gainmap_img.size();
+      }
+
+      ultrahdr::uhdr_gainmap_metadata_ext_t metadata;
+      status = jpegr.parseGainMapMetadata(const_cast<uint8_t*>(gainmap_view.isoData),
+                                          gainmap_view.isoSize,
+                                          const_cast<uint8_t*>(gainmap_view.xmpData),
+                                          gainmap_view.xmpSize, &metadata);
+      if (status.error_code != UHDR_CODEC_OK) return status;
+      handle->m_metadata.max_content_boost = metadata.max_content_boost;
+      handle->m_metadata.min_content_boost = metadata.min_content_boost;
+      handle->m_metadata.gamma = metadata.gamma;
+      handle->m_metadata.offset_sdr = metadata.offset_sdr;
+      handle->m_metadata.offset_hdr = metadata.offset_hdr;
+      handle->m_metadata.hdr_capacity_min = metadata.hdr_capacity_min;
+      handle->m_metadata.hdr_capacity_max = metadata.hdr_capacity_max;
+
+      handle->m_img_wd = primary_view.width;
+      handle->m_img_ht = primary_view.height;
+      handle->m_img_num_comp = primary_view.numComponents;
+      handle->m_gainmap_wd = gainmap_view.width;
+      handle->m_gainmap_ht = gainmap_view.height;
+      handle->m_gainmap_num_comp = gainmap_view.numComponents;
+      handle->m_exif_block.data = const_cast<uint8_t*>(primary_view.exifData);
+      handle->m_exif_block.data_sz = handle->m_exif_block.capacity = primary_view.exifSize;
+      handle->m_icc_block.data = const_cast<uint8_t*>(primary_view.iccData);
+      handle->m_icc_block.data_sz = handle->m_icc_block.capacity = primary_view.iccSize;
+      handle->m_base_img_block.data = primary_bitstream.data;
+      handle->m_base_img_block.data_sz = handle->m_base_img_block.capacity =
+          primary_bitstream.data_sz;
+      handle->m_gainmap_img_block.data = gainmap_bitstream.data;
+      handle->m_gainmap_img_block.data_sz = handle->m_gainmap_img_block.capacity =
+          gainmap_bitstream.data_sz;
+
+      // blocks of the copying parse do not point into the image, such entries are not kept
+      auto block = [img_data](const uhdr_mem_block_t& src) {
+        if (src.data_sz == 0) return ultrahdr::DecoderCache::Block{0, 0};
+        return ultrahdr::DecoderCache::Block{
+            (size_t)(static_cast<const uint8_t*>(src.data) - img_data), src.data_sz};
+      };
+      if (cache != nullptr && in_place) {
+        info.metadata = handle->m_metadata;
+        info.img_wd = handle->m_img_wd;
+        info.img_ht = handle->m_img_ht;
+        info.img_num_comp = handle->m_img_num_comp;
+        info.gainmap_wd = handle->m_gainmap_wd;
+        info.gainmap_ht = handle->m_gainmap_ht;
+        info.gainmap_num_comp = handle->m_gainmap_num_comp;
+        info.exif = block(handle->m_exif_block);
+        info.icc = block(handle->m_icc_block);
+        info.base_img = block(handle->m_base_img_block);
+        info.gainmap_img = block(handle->m_gainmap_img_block);
+        cache->storeProbeInfo(key, info);
+      }
+    }
+
+    // a decode beyond the memory limit fails here, before any image buffer is allocated
+    bool in_strips;
+    status = plan_decode_memory(handle, in_strips);
+    estimate_decode_cost(handle, in_strips);
+  }
+
+  return status;
+}
+
+int uhdr_dec_get_image_width(uhdr_codec_private_t* dec) {
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    return -1;
+  }
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (!handle->m_probed || handle->m_probe_call_status.error_code != UHDR_CODEC_OK) {
+    return -1;
+  }
+
+  return handle->m_img_wd;
+}
+
+int uhdr_dec_get_image_height(uhdr_codec_private_t* dec) {
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    return -1;
+  }
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (!handle->m_probed || handle->m_probe_call_status.error_code != UHDR_CODEC_OK) {
+    return -1;
+  }
+
+  return handle->m_img_ht;
+}
+
+int uhdr_dec_get_gainmap_width(uhdr_codec_private_t* dec) {
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    return -1;
+  }
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (!handle->m_probed || handle->m_probe_call_status.error_code != UHDR_CODEC_OK) {
+    return -1;
+  }
+
+  return handle->m_gainmap_wd;
+}
+
+int uhdr_dec_get_gainmap_height(uhdr_codec_private_t* dec) {
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    return -1;
+  }
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (!handle->m_probed || handle->m_probe_call_status.error_code != UHDR_CODEC_OK) {
+    return -1;
+  }
+
+  return handle->m_gainmap_ht;
+}
+
+uhdr_mem_block_t* uhdr_dec_get_exif(uhdr_codec_private_t* dec) {
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    return nullptr;
+  }
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (!handle->m_probed || handle->m_probe_call_status.error_code != UHDR_CODEC_OK) {
+    return nullptr;
+  }
+
+  return &handle->m_exif_block;
+}
+
+uhdr_mem_block_t* uhdr_dec_get_icc(uhdr_codec_private_t* dec) {
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    return nullptr;
+  }
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (!handle->m_probed || handle->m_probe_call_status.error_code != UHDR_CODEC_OK) {
+    return nullptr;
+  }
+
+  return &handle->m_icc_block;
+}
+
+uhdr_mem_block_t* uhdr_dec_get_base_image(uhdr_codec_private_t* dec) {
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    return nullptr;
+  }
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (!handle->m_probed || handle->m_probe_call_status.error_code != UHDR_CODEC_OK) {
+    return nullptr;
+  }
+
+  return &handle->m_base_img_block;
+}
+
+uhdr_mem_block_t* uhdr_dec_get_gainmap_image(uhdr_codec_private_t* dec) {
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    return nullptr;
+  }
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (!handle->m_probed || handle->m_probe_call_status.error_code != UHDR_CODEC_OK) {
+    return nullptr;
+  }
+
+  return &handle->m_gainmap_img_block;
+}
+
+uhdr_gainmap_metadata_t* uhdr_dec_get_gainmap_metadata(uhdr_codec_private_t* dec) {
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    return nullptr;
+  }
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (!handle->m_probed || handle->m_probe_call_status.error_code != UHDR_CODEC_OK) {
+    return nullptr;
+  }
+
+  return &handle->m_metadata;
+}
+
+uhdr_decode_cost_t* uhdr_dec_get_cost_estimate(uhdr_codec_private_t* dec) {
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    return nullptr;
+  }
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (!handle->m_probed || handle->m_probe_call_status.error_code != UHDR_CODEC_OK) {
+    return nullptr;
+  }
+
+  return &handle->m_cost;
+}
+
+// Buffers of an earlier decode of this context are reused when the geometry matches, unless they
+// are a crop view into a larger block
+static void prepare_decode_buffer(std::unique_ptr<ultrahdr::uhdr_raw_image_ext_t>& img,
+                                  uhdr_img_fmt_t fmt, uhdr_color_transfer_t ct, unsigned int w,
+                                  unsigned int h) {
+  if (img != nullptr && !img->is_borrowed() && !img->is_view() && img->fmt == fmt &&
+      img->w == w && img->h == h && img->stride[UHDR_PLANE_PACKED] == w) {
+    img->cg = UHDR_CG_UNSPECIFIED;
+    img->ct = ct;
+    img->range = UHDR_CR_UNSPECIFIED;
+    return;
+  }
+  img = std::make_unique<ultrahdr::uhdr_raw_image_ext_t>(fmt, UHDR_CG_UNSPECIFIED, ct,
+                                                         UHDR_CR_UNSPECIFIED, w, h, 1);
+}
+
+// Decodes the base image strip wise, the output strips go to emit_strip if not nullptr and to
+// their rows of dest otherwise
+static uhdr_error_info_t decode_in_strips(uhdr_decoder_private* handle, unsigned int strip_height,
+                                          const ultrahdr::PushStripFn* emit_strip,
+                                          uhdr_raw_image_t* dest) {
+  prepare_decode_buffer(
+      handle->m_gainmap_img_buffer,
+      handle->m_gainmap_num_comp == 1 ? UHDR_IMG_FMT_8bppYCbCr400 : UHDR_IMG_FMT_32bppRGBA8888,
+      UHDR_CT_UNSPECIFIED, handle->m_gainmap_wd, handle->m_gainmap_ht);
+
+  if (handle->m_decode_cache == nullptr) {
+    handle->m_decode_cache = std::make_unique<ultrahdr::JpegRDecodeCache>();
+  }
+
+  ultrahdr::JpegR jpegr;
+  jpegr.setNumThreads(handle->m_num_threads);
+  jpegr.setParallelExecutor(handle->m_parallel_for, handle->m_parallel_for_ctx);
+  jpegr.setJpegBackend(handle->m_jpeg_backend);
+  jpegr.setCoreAffinity(handle->m_core_affinity);
+  jpegr.setDecodeCache(handle->m_decode_cache.get());
+  jpegr.setFastIdct(handle->m_fast_idct);
+  jpegr.setFastUpsampling(handle->m_fast_upsampling);
+  jpegr.setApproximateGainMap(handle->m_approximate_gainmap);
+  jpegr.setStats(ultrahdr::CodecStats::current());
+  jpegr.setOutputColorGamut(handle->m_output_cg);
+  if (handle->m_luminance_stats_enabled) jpegr.setLuminanceStats(&handle->m_luminance_stats);
+
+  if (emit_strip == nullptr) {
+    return jpegr.decodeJPEGRStripWise(handle->m_uhdr_compressed_img.get(), strip_height, dest,
+                                      handle->m_output_max_disp_boost, handle->m_output_ct,
+                                      handle->m_output_fmt, handle->m_gainmap_img_buffer.get(),
+                                      nullptr);
+  }
+  return jpegr.decodeJPEGRInStrips(handle->m_uhdr_compressed_img.get(), strip_height, *emit_strip,
+                                   handle->m_output_max_disp_boost, handle->m_output_ct,
+                                   handle->m_output_fmt, handle->m_gainmap_img_buffer.get(),
+                                   nullptr);
+}
+
+// The final rendition and those of uhdr_dec_add_rendition() are rendered together, on the cpu
+static uhdr_error_info_t decode_renditions(uhdr_decoder_private* handle,
+                                           ultrahdr::uhdr_raw_image_ext_t* out_buffer) {
+  if (handle->m_output_cg != UHDR_CG_UNSPECIFIED) {
+    for (const auto& r : handle->m_renditions) {
+      if (r.ct != UHDR_CT_SRGB) continue;
+      uhdr_error_info_t status;
+      status.error_code = UHDR_CODEC_INVALID_PARAM;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "output color gamut %d requires renditions of output color transfer other than "
+               "UHDR_CT_SRGB",
+               handle->m_output_cg);
+      return status;
+    }
+  }
+  if (out_buffer != nullptr) {
+    if (out_buffer->w != (unsigned int)handle->m_img_wd ||
+        out_buffer->h != (unsigned int)handle->m_img_ht) {
+      uhdr_error_info_t status;
+      status.error_code = UHDR_CODEC_INVALID_PARAM;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "output buffer dimensions %ux%u do not match decoded image dimensions %dx%d",
+               out_buffer->w, out_buffer->h, handle->m_img_wd, handle->m_img_ht);
+      return status;
+    }
+    handle->m_decoded_img_buffer = std::make_unique<ultrahdr::uhdr_raw_image_ext_t>(
+        static_cast<const uhdr_raw_image_t&>(*out_buffer));
+  } else {
+    prepare_decode_buffer(handle->m_decoded_img_buffer, handle->m_output_fmt, handle->m_output_ct,
+                          handle->m_img_wd, handle->m_img_ht);
+  }
+  prepare_decode_buffer(
+      handle->m_gainmap_img_buffer,
+      handle->m_gainmap_num_comp == 1 ? UHDR_IMG_FMT_8bppYCbCr400 : UHDR_IMG_FMT_32bppRGBA8888,
+      UHDR_CT_UNSPECIFIED, handle->m_gainmap_wd, handle->m_gainmap_ht);
+
+  std::vector<ultrahdr::RenditionDesc> renditions;
+  renditions.push_back({handle->m_output_fmt, handle->m_output_ct, handle->m_output_max_disp_boost,
+                        handle->m_decoded_img_buffer.get()});
+  for (auto& r : handle->m_renditions) {
+    prepare_decode_buffer(r.img, r.fmt, r.ct, handle->m_img_wd, handle->m_img_ht);
+    renditions.push_back({r.fmt, r.ct, r.display_boost, r.img.get()});
+  }
+
+  if (handle->m_decode_cache == nullptr) {
+    handle->m_decode_cache = std::make_unique<ultrahdr::JpegRDecodeCache>();
+  }
+
+  ultrahdr::JpegR jpegr;
+  jpegr.setNumThreads(handle->m_num_threads);
+  jpegr.setParallelExecutor(handle->m_parallel_for, handle->m_parallel_for_ctx);
+  jpegr.setJpegBackend(handle->m_jpeg_backend);
+  jpegr.setCoreAffinity(handle->m_core_affinity);
+  jpegr.setDecodeCache(handle->m_decode_cache.get());
+  jpegr.setFastIdct(handle->m_fast_idct);
+  jpegr.setFastUpsampling(handle->m_fast_upsampling);
+  jpegr.setApproximateGainMap(handle->m_approximate_gainmap);
+  jpegr.setStats(ultrahdr::CodecStats::current());
+  jpegr.setOutputColorGamut(handle->m_output_cg);
+
+  return jpegr.decodeJPEGRRenditions(handle->m_uhdr_compressed_img.get(), renditions,
+                                     handle->m_gainmap_img_buffer.get(), nullptr);
+}
+
+// Pyramid levels are resampled from the decoded image, largest first, each from the smallest image
+// produced so far that still covers it
+static uhdr_error_info_t build_pyramid(uhdr_decoder_private* handle) {
+  auto& levels = handle->m_pyramid_levels;
+  std::vector<size_t> order(levels.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&levels](size_t a, size_t b) {
+    return (int64_t)levels[a].w * levels[a].h > (int64_t)levels[b].w * levels[b].h;
+  });
+  for (size_t i = 0; i < order.size(); i++) {
+    auto& level = levels[order[i]];
+    uhdr_raw_image_t* src = handle->m_decoded_img_buffer.get();
+    for (size_t j = 0; j < i; j++) {
+      const auto& prev = levels[order[j]];
+      if (prev.w >= level.w && prev.h >= level.h && prev.w <= (int)src->w &&
+          prev.h <= (int)src->h) {
+        src = prev.img.get();
+      }
+    }
+    ultrahdr::uhdr_resize_effect_t desc(level.w, level.h, level.filter);
+    level.img = ultrahdr::apply_resize(&desc, src, level.w, level.h);
+    if (level.img == nullptr) {
+      uhdr_error_info_t status;
+      status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "unable to resample color format %d to pyramid level %dx%d", src->fmt, level.w,
+               level.h);
+      return status;
+    }
+  }
+  return g_no_error;
+}
+
+// Output format, color transfer and color gamut are set independently, only some combinations
+// are rendered
+static uhdr_error_info_t check_output_config(uhdr_decoder_private* handle) {
+  const bool is_ycbcr_output = handle->m_output_fmt == UHDR_IMG_FMT_12bppYCbCr420 ||
+                               handle->m_output_fmt == UHDR_IMG_FMT_24bppYCbCr444 ||
+                               handle->m_output_fmt == UHDR_IMG_FMT_8bppYCbCr400;
+  if (handle->m_apply_gainmap && handle->m_output_ct == UHDR_CT_SRGB && is_ycbcr_output) {
+    // sdr output in the coded planes is the base image as is, see is_base_image_output()
+    if (handle->m_output_max_disp_boost != FLT_MAX && handle->m_output_max_disp_boost > 1.0f) {
+      uhdr_error_info_t status;
+      status.error_code = UHDR_CODEC_INVALID_PARAM;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "output pixel format %d returns the base image as is, a display boost of %f "
+               "cannot be applied to it",
+               handle->m_output_fmt, handle->m_output_max_disp_boost);
+      return status;
+    }
+  } else if (!handle->m_apply_gainmap) {
+    // the base image is returned as is, output color transfer does not apply
+    if (handle->m_output_fmt != UHDR_IMG_FMT_32bppRGBA8888 && !is_ycbcr_output) {
+      uhdr_error_info_t status;
+      status.error_code = UHDR_CODEC_INVALID_PARAM;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "unsupported output pixel format %d for base image output, expects one of "
+               "{UHDR_IMG_FMT_32bppRGBA8888, UHDR_IMG_FMT_12bppYCbCr420, "
+               "UHDR_IMG_FMT_24bppYCbCr444, UHDR_IMG_FMT_8bppYCbCr400}",
+               handle->m_output_fmt);
+      return status;
+    }
+  } else if (is_ycbcr_output) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "output pixel format %d is only supported with gain map application disabled or "
+             "output color transfer UHDR_CT_SRGB",
+             handle->m_output_fmt);
+    return status;
+  } else if (((handle->m_output_fmt == UHDR_IMG_FMT_32bppRGBA1010102 ||
+               handle->m_output_fmt == UHDR_IMG_FMT_24bppYCbCrP010) &&
+              (handle->m_output_ct != UHDR_CT_HLG && handle->m_output_ct != UHDR_CT_PQ)) ||
+             (handle->m_output_fmt == UHDR_IMG_FMT_64bppRGBAHalfFloat &&
+              handle->m_output_ct != UHDR_CT_LINEAR) ||
+             (handle->m_output_fmt == UHDR_IMG_FMT_32bppRGBA8888 &&
+              handle->m_output_ct != UHDR_CT_SRGB)) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "unsupported output pixel format and output color transfer pair");
+    return status;
+  }
+  if (handle->m_output_cg != UHDR_CG_UNSPECIFIED &&
+      (!handle->m_apply_gainmap || handle->m_output_ct == UHDR_CT_SRGB)) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "output color gamut %d requires gain map application and an output color transfer "
+             "other than UHDR_CT_SRGB",
+             handle->m_output_cg);
+    return status;
+  }
+  return g_no_error;
+}
+
+// Decodes the gain map alone, see uhdr_dec_set_gainmap_only_decode()
+static uhdr_error_info_t decode_gainmap_only(uhdr_decoder_private* handle) {
+  uhdr_error_info_t status = g_no_error;
+  if (handle->m_effects.size() != 0 || handle->m_strip_fn != nullptr ||
+      handle->m_output_buffer != nullptr || handle->m_base_fn != nullptr ||
+      !handle->m_renditions.empty() || !handle->m_pyramid_levels.empty() ||
+      handle->m_gpu_output) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "gain map only decode cannot be combined with image effects, strip wise output, an "
+             "output buffer, a base image callback, further renditions, pyramid levels or gpu "
+             "output");
+    return status;
+  }
+
+  // no final rendition exists in this mode
+  handle->m_decoded_img_buffer.reset();
+  const unsigned int denom = handle->m_gainmap_only_denom;
+  prepare_decode_buffer(
+      handle->m_gainmap_img_buffer,
+      handle->m_gainmap_num_comp == 1 ? UHDR_IMG_FMT_8bppYCbCr400 : UHDR_IMG_FMT_32bppRGBA8888,
+      UHDR_CT_UNSPECIFIED, (handle->m_gainmap_wd + denom - 1) / denom,
+      (handle->m_gainmap_ht + denom - 1) / denom);
+
+  if (handle->m_decode_cache == nullptr) {
+    handle->m_decode_cache = std::make_unique<ultrahdr::JpegRDecodeCache>();
+  }
+  ultrahdr::JpegR jpegr;
+  jpegr.setJpegBackend(handle->m_jpeg_backend);
+  jpegr.setDecodeCache(handle->m_decode_cache.get());
+  jpegr.setFastIdct(handle->m_fast_idct);
+  jpegr.setStats(ultrahdr::CodecStats::current());
+
+  // a full size gain map is served by and stored to the decoder cache as in a full decode
+  std::shared_ptr<const ultrahdr::uhdr_raw_image_ext_t> cached_gainmap;
+  ultrahdr::GainMapFn store_gainmap;
+  if (handle->m_cache != nullptr && handle->m_cache->keepsGainMaps() && handle->m_cache_keyed &&
+      denom == 1) {
+    const ultrahdr::DecoderCache::Key key{
+        handle->m_cache_hash, handle->m_uhdr_compressed_img->data_sz,
+        static_cast<const uint8_t*>(handle->m_uhdr_compressed_img->data)};
+    const int variant =
+        (handle->m_fast_idct ? 1 : 0) | (handle->m_jpeg_backend.decompress != nullptr ? 2 : 0);
+    cached_gainmap = handle->m_cache->findGainMap(key, variant);
+    if (cached_gainmap != nullptr) {
+      jpegr.setPredecodedGainMap(cached_gainmap.get());
+    } else {
+      std::shared_ptr<ultrahdr::DecoderCache> cache = handle->m_cache;
+      store_gainmap = [cache, key, variant](const uhdr_raw_image_t* gainmap) {
+        cache->storeGainMap(key, variant, gainmap);
+      };
+      jpegr.setGainMapCallback(&store_gainmap);
+    }
+  }
+
+  return jpegr.decodeJPEGRGainMap(handle->m_uhdr_compressed_img.get(), denom,
+                                  handle->m_gainmap_img_buffer.get(), nullptr);
+}
+
+uhdr_error_info_t uhdr_decode(uhdr_codec_private_t* dec) {
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
+  }
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+
+  if (handle->m_sailed) {
+    if (handle->m_transcoded_img != nullptr) {
+      uhdr_error_info_t status;
+      status.error_code = UHDR_CODEC_INVALID_OPERATION;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "An earlier call to uhdr_transcode() has switched the context from configurable "
+               "state to end state. The context is no longer configurable. To reuse, call reset()");
+      return status;
+    }
+    return handle->m_decode_call_status;
+  }
+
+  ultrahdr::MemoryArena::Scope arena_scope(&handle->m_arena);
+  ultrahdr::CodecStats::Scope stats_scope(handle->m_stats_enabled ? &handle->m_stats : nullptr);
+  handle->m_cancel.arm(handle->m_cancel_flag, handle->m_deadline_ms);
+  ultrahdr::CancelToken::Scope cancel_scope(&handle->m_cancel);
+  uhdr_error_info_t& status = handle->m_decode_call_status;
+  status = uhdr_dec_probe(dec);
+  if (status.error_code != UHDR_CODEC_OK) return status;
+
+  handle->m_sailed = true;
+
+  bool limit_in_strips;
+  if (handle->m_gainmap_only_denom != 0) {
+    status = plan_decode_memory(handle, limit_in_strips);
+    if (status.error_code != UHDR_CODEC_OK) return status;
+    status = decode_gainmap_only(handle);
+    return status;
+  }
+
+  status = check_output_config(handle);
+  if (status.error_code != UHDR_CODEC_OK) return status;
+
+  status = plan_decode_memory(handle, limit_in_strips);
+  if (status.error_code != UHDR_CODEC_OK) return status;
+
+  if (handle->m_luminance_stats_enabled &&
+      (handle->m_effects.size() != 0 || !handle->m_renditions.empty() || handle->m_gpu_output)) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "luminance statistics cannot be combined with image effects, further renditions or "
+             "gpu output");
+    return status;
+  }
+
+  for (const auto& level : handle->m_pyramid_levels) {
+    if (handle->m_effects.size() != 0 || handle->m_strip_fn != nullptr || handle->m_gpu_output ||
+        !handle->m_renditions.empty()) {
+      status.error_code = UHDR_CODEC_INVALID_OPERATION;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "pyramid levels cannot be combined with image effects, strip wise output, gpu "
+               "output or further renditions");
+      return status;
+    }
+    if (level.w > handle->m_img_wd || level.h > handle->m_img_ht) {
+      status.error_code = UHDR_CODEC_INVALID_PARAM;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "pyramid level %dx%d exceeds the image dimensions %dx%d", level.w, level.h,
+               handle->m_img_wd, handle->m_img_ht);
+      return status;
+    }
+  }
+
+  ultrahdr::uhdr_raw_image_ext_t* out_buffer = handle->m_output_buffer.get();
+  if (handle->m_strip_fn != nullptr) {
+    if (handle->m_effects.size() != 0 || out_buffer != nullptr ||
+        ultrahdr::is_base_image_output(handle) || handle->m_base_fn != nullptr) {
+      status.error_code = UHDR_CODEC_INVALID_OPERATION;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "strip wise decode cannot be combined with image effects, an output buffer, "
+               "disabled gain map application or a base image callback");
+      return status;
+    }
+    // no whole image output exists in this mode
+    handle->m_decoded_img_buffer.reset();
+    ultrahdr::PushStripFn emit_strip = [handle](uhdr_raw_image_t* strip, unsigned int row_start) {
+      int ret = handle->m_strip_fn(handle->m_strip_ctx, strip, row_start);
+      if (ret != 0) {
+        uhdr_error_info_t abort_status;
+        abort_status.error_code = UHDR_CODEC_ERROR;
+        abort_status.has_detail = 1;
+        snprintf(abort_status.detail, sizeof abort_status.detail,
+                 "strip callback returned %d for strip at row %u, decode aborted", ret, row_start);
+        return abort_status;
+      }
+      return g_no_error;
+    };
+    status = decode_in_strips(handle, handle->m_strip_height, &emit_strip, nullptr);
+    return status;
+  }
+
+  if (out_buffer != nullptr && out_buffer->fmt != handle->m_output_fmt) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "output buffer format %d does not match configured output format %d", out_buffer->fmt,
+             handle->m_output_fmt);
+    return status;
+  }
+
+  if (!handle->m_renditions.empty()) {
+    if (handle->m_effects.size() != 0 || ultrahdr::is_base_image_output(handle) ||
+        handle->m_base_fn != nullptr || handle->m_gpu_output || limit_in_strips) {
+      status.error_code = UHDR_CODEC_INVALID_OPERATION;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "further renditions cannot be combined with image effects, disabled gain map "
+               "application, a base image callback, gpu output or a memory limit below the "
+               "size of a whole image decode");
+      return status;
+    }
+    status = decode_renditions(handle, out_buffer);
+    return status;
+  }
+
+  // over the memory limit as a whole, the rendition is assembled from strips on the cpu
+  if (limit_in_strips) {
+    if (out_buffer != nullptr) {
+      if (out_buffer->w != (unsigned int)handle->m_img_wd ||
+          out_buffer->h != (unsigned int)handle->m_img_ht) {
+        status.error_code = UHDR_CODEC_INVALID_PARAM;
+        status.has_detail = 1;
+        snprintf(status.detail, sizeof status.detail,
+                 "output buffer dimensions %ux%u do not match decoded image dimensions %dx%d",
+                 out_buffer->w, out_buffer->h, handle->m_img_wd, handle->m_img_ht);
+        return status;
+      }
+      handle->m_decoded_img_buffer = std::make_unique<ultrahdr::uhdr_raw_image_ext_t>(
+          static_cast<const uhdr_raw_image_t&>(*out_buffer));
+    } else {
+      prepare_decode_buffer(handle->m_decoded_img_buffer, handle->m_output_fmt,
+                            handle->m_output_ct, handle->m_img_wd, handle->m_img_ht);
+    }
+    // the strips are rendered into their rows of the output, no strip is held apart from it
+    status = decode_in_strips(handle, kMemoryLimitStripHeight, nullptr,
+                              handle->m_decoded_img_buffer.get());
+    if (status.error_code == UHDR_CODEC_OK && !handle->m_pyramid_levels.empty()) {
+      status = build_pyramid(handle);
+    }
+    return status;
+  }
+
+#ifdef UHDR_ENABLE_GLES
+  handle->m_use_gles = ultrahdr::acquire_gpu(handle);
+  if (handle->m_enable_gles && !handle->m_use_gles &&
+      ((handle->m_apply_gainmap && handle->m_output_ct != UHDR_CT_SRGB) ||
+       handle->m_effects.size() > 0)) {
+    ultrahdr::countSlowPath(ultrahdr::CodecStats::current(), UHDR_SLOW_PATH_GPU_FALLBACK);
+  }
+  struct ReleaseGpu {
+    bool held;
+    ~ReleaseGpu() {
+      if (held) ultrahdr::release_gpu();
+    }
+  } release_gpu{handle->m_use_gles};
+#endif
+
+  // A leading crop is fused into the decode. Only the cropped rectangle of the base image is
+  // decoded and the gain map is applied over it alone. Invalid crops are left to apply_effects()
+  // to report.
+  ultrahdr::uhdr_effect_desc_t* lead_effect =
+      handle->m_effects.size() != 0 && !ultrahdr::is_base_image_output(handle)
+          ? handle->m_effects[0]
+          : nullptr;
+#ifdef UHDR_ENABLE_GLES
+  if (handle->m_use_gles) lead_effect = nullptr;
+#endif
+  ultrahdr::uhdr_crop_effect_t* roi_crop = dynamic_cast<ultrahdr::uhdr_crop_effect_t*>(lead_effect);
+  ultrahdr::crop_bounds_t roi_bounds;
+  if (roi_crop != nullptr &&
+      ultrahdr::get_crop_bounds(roi_crop, handle->m_img_wd, handle->m_img_ht, handle->m_gainmap_wd,
+                                handle->m_gainmap_ht, roi_bounds)
+              .error_code != UHDR_CODEC_OK) {
+    roi_crop = nullptr;
+  }
+  ultrahdr::image_region_t roi{};
+  if (roi_crop != nullptr) {
+    roi.left = roi_bounds.left;
+    roi.top = roi_bounds.top;
+    roi.width = roi_bounds.right - roi_bounds.left;
+    roi.height = roi_bounds.bottom - roi_bounds.top;
+  }
+
+  // A leading resize to well below the image size starts from an image that libjpeg decoded at
+  // the smallest scale that still covers the target size, instead of the full size image. So do
+  // pyramid levels, at the size of the largest level.
+  unsigned int scale_denom = 1, scaled_wd = handle->m_img_wd, scaled_ht = handle->m_img_ht;
+  unsigned int target_wd = 0, target_ht = 0;
+  auto resize_effect = dynamic_cast<ultrahdr::uhdr_resize_effect_t*>(lead_effect);
+  if (resize_effect != nullptr && resize_effect->m_width > 0 && resize_effect->m_height > 0) {
+    target_wd = resize_effect->m_width;
+    target_ht = resize_effect->m_height;
+  } else if (!handle->m_pyramid_levels.empty() && !ultrahdr::is_base_image_output(handle) &&
+             out_buffer == nullptr) {
+    for (const auto& level : handle->m_pyramid_levels) {
+      target_wd = (std::max)(target_wd, (unsigned int)level.w);
+      target_ht = (std::max)(target_ht, (unsigned int)level.h);
+    }
+#ifdef UHDR_ENABLE_GLES
+    if (handle->m_use_gles) target_wd = target_ht = 0;
+#endif
+  }
+  if (target_wd > 0 && target_ht > 0) {
+    for (unsigned int denom = 8; denom > 1; denom /= 2) {
+      unsigned int wd = (handle->m_img_wd + denom - 1) / denom;
+      unsigned int ht = (handle->m_img_ht + denom - 1) / denom;
+      if (wd >= target_wd && ht >= target_ht) {
+        scale_denom = denom;
+        scaled_wd = wd;
+        scaled_ht = ht;
+        break;
+      }
+    }
+  }
+
+  // Effects that only move and drop pixels are made while the gain map is applied, through a map
+  // from the output pixels to the decoded ones. Only the bounding box of the pixels the effects
+  // keep is decoded, and the edited image is written in the one pass over it.
+  ultrahdr::uhdr_effect_chain_t fused_chain(handle->m_img_wd, handle->m_img_ht);
+  ultrahdr::uhdr_effect_chain_t fused_gm_chain(handle->m_gainmap_wd, handle->m_gainmap_ht);
+  const bool fused = lead_effect != nullptr && scale_denom == 1 &&
+                     handle->m_output_fmt != UHDR_IMG_FMT_24bppYCbCrP010 &&
+                     ultrahdr::fold_pixel_effects(handle, fused_chain, fused_gm_chain);
+  ultrahdr::uhdr_plane_map_t fused_map = fused_chain.m_luma;
+  ultrahdr::image_region_t fused_roi{};
+  if (fused) {
+    const ultrahdr::uhdr_plane_map_t& m = fused_chain.m_luma;
+    int min_x = m.x0, max_x = m.x0, min_y = m.y0, max_y = m.y0;
+    for (int corner = 1; corner < 4; corner++) {
+      const int x = corner & 1 ? m.w - 1 : 0, y = corner & 2 ? m.h - 1 : 0;
+      min_x = (std::min)(min_x, m.xx * x + m.xy * y + m.x0);
+      max_x = (std::max)(max_x, m.xx * x + m.xy * y + m.x0);
+      min_y = (std::min)(min_y, m.yx * x + m.yy * y + m.y0);
+      max_y = (std::max)(max_y, m.yx * x + m.yy * y + m.y0);
+    }
+    fused_roi.left = min_x;
+    fused_roi.top = min_y;
+    fused_roi.width = max_x - min_x + 1;
+    fused_roi.height = max_y - min_y + 1;
+    fused_map.x0 -= min_x;
+    fused_map.y0 -= min_y;
+  }
+
+  if (out_buffer != nullptr && handle->m_effects.size() == 0) {
+    if (out_buffer->w != (unsigned int)handle->m_img_wd ||
+        out_buffer->h != (unsigned int)handle->m_img_ht) {
+      status.error_code = UHDR_CODEC_INVALID_PARAM;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "output buffer dimensions %ux%u do not match decoded image dimensions %dx%d",
+               out_buffer->w, out_buffer->h, handle->m_img_wd, handle->m_img_ht);
+      return status;
+    }
+    // decode straight into caller memory
+    handle->m_decoded_img_buffer = std::make_unique<ultrahdr::uhdr_raw_image_ext_t>(
+        static_cast<const uhdr_raw_image_t&>(*out_buffer));
+  } else if (fused) {
+    prepare_decode_buffer(handle->m_decoded_img_buffer, handle->m_output_fmt, handle->m_output_ct,
+                          fused_map.w, fused_map.h);
+  } else if (roi_crop != nullptr) {
+    prepare_decode_buffer(handle->m_decoded_img_buffer, handle->m_output_fmt, handle->m_output_ct,
+                          roi.width, roi.height);
+  } else {
+    prepare_decode_buffer(handle->m_decoded_img_buffer, handle->m_output_fmt,
+                          ultrahdr::is_base_image_output(handle) ? UHDR_CT_SRGB
+                                                                 : handle->m_output_ct,
+                          scaled_wd, scaled_ht);
+  }
+
+  prepare_decode_buffer(
+      handle->m_gainmap_img_buffer,
+      handle->m_gainmap_num_comp == 1 ? UHDR_IMG_FMT_8bppYCbCr400 : UHDR_IMG_FMT_32bppRGBA8888,
+      UHDR_CT_UNSPECIFIED, (handle->m_gainmap_wd + scale_denom - 1) / scale_denom,
+      (handle->m_gainmap_ht + scale_denom - 1) / scale_denom);
+
+  if (handle->m_decode_cache == nullptr) {
+    handle->m_decode_cache = std::make_unique<ultrahdr::JpegRDecodeCache>();
+  }
+
+#ifdef UHDR_ENABLE_GLES
+  ultrahdr::uhdr_opengl_ctxt_t* uhdrGLESCtxt = nullptr;
+  if (handle->m_use_gles &&
+      ((handle->m_apply_gainmap && handle->m_output_ct != UHDR_CT_SRGB) ||
+       handle->m_effects.size() > 0)) {
+    handle->m_uhdr_gl_ctxt.init_opengl_ctxt(static_cast<EGLContext>(handle->m_gpu_share_ctxt));
+    status = handle->m_uhdr_gl_ctxt.mErrorStatus;
+    if (status.error_code != UHDR_CODEC_OK) return status;
+    handle->m_uhdr_gl_ctxt.mStats = ultrahdr::CodecStats::current();
+    uhdrGLESCtxt = &handle->m_uhdr_gl_ctxt;
+  }
+  // the context of the application, if any, is current again once the decode returns. Reads of
+  // a gpu output after the call are not timed.
+  struct ReleaseGLESCtxt {
+    ultrahdr::uhdr_opengl_ctxt_t* ctxt;
+    ~ReleaseGLESCtxt() {
+      if (ctxt != nullptr) {
+        ctxt->release_current();
+        ctxt->mStats = nullptr;
+      }
+    }
+  } release_gl_ctxt{uhdrGLESCtxt};
+  ultrahdr::JpegR jpegr(uhdrGLESCtxt);
+#else
+  ultrahdr::JpegR jpegr;
+#endif
+  jpegr.setNumThreads(handle->m_num_threads);
+  jpegr.setParallelExecutor(handle->m_parallel_for, handle->m_parallel_for_ctx);
+  jpegr.setJpegBackend(handle->m_jpeg_backend);
+  jpegr.setCoreAffinity(handle->m_core_affinity);
+  jpegr.setDecodeCache(handle->m_decode_cache.get());
+  jpegr.setFastIdct(handle->m_fast_idct);
+  jpegr.setFastUpsampling(handle->m_fast_upsampling);
+  jpegr.setApproximateGainMap(handle->m_approximate_gainmap);
+  jpegr.setStats(ultrahdr::CodecStats::current());
+  jpegr.setOutputColorGamut(handle->m_output_cg);
+  jpegr.setApplyGainMapInPlace(handle->m_memory_limit != 0);
+  if (handle->m_luminance_stats_enabled) jpegr.setLuminanceStats(&handle->m_luminance_stats);
+  ultrahdr::BaseImageFn emit_base = [handle](uhdr_raw_image_t* base) {
+    int ret = handle->m_base_fn(handle->m_base_ctx, base);
+    if (ret != 0) {
+      uhdr_error_info_t abort_status;
+      abort_status.error_code = UHDR_CODEC_ERROR;
+      abort_status.has_detail = 1;
+      snprintf(abort_status.detail, sizeof abort_status.detail,
+               "base image callback returned %d, decode aborted", ret);
+      return abort_status;
+    }
+    return g_no_error;
+  };
+  if (handle->m_base_fn != nullptr) jpegr.setBaseImageCallback(&emit_base);
+
+  // the gain map of an image decoded before comes from the cache. Decoder settings that change the
+  // decoded samples tell entries apart
+  std::shared_ptr<const ultrahdr::uhdr_raw_image_ext_t> cached_gainmap;
+  ultrahdr::GainMapFn store_gainmap;
+  if (handle->m_cache != nullptr && handle->m_cache->keepsGainMaps() && handle->m_cache_keyed &&
+      !ultrahdr::is_base_image_output(handle) && scale_denom == 1) {
+    const ultrahdr::DecoderCache::Key key{
+        handle->m_cache_hash, handle->m_uhdr_compressed_img->data_sz,
+        static_cast<const uint8_t*>(handle->m_uhdr_compressed_img->data)};
+    const int variant =
+        (handle->m_fast_idct ? 1 : 0) | (handle->m_jpeg_backend.decompress != nullptr ? 2 : 0);
+    cached_gainmap = handle->m_cache->findGainMap(key, variant);
+    if (cached_gainmap != nullptr) {
+      jpegr.setPredecodedGainMap(cached_gainmap.get());
+    } else {
+      std::shared_ptr<ultrahdr::DecoderCache> cache = handle->m_cache;
+      store_gainmap = [cache, key, variant](const uhdr_raw_image_t* gainmap) {
+        cache->storeGainMap(key, variant, gainmap);
+      };
+      jpegr.setGainMapCallback(&store_gainmap);
+    }
+  }
+
+  size_t first_effect = 0;
+  if (ultrahdr::is_base_image_output(handle)) {
+    status = jpegr.decodeJPEGRBaseImage(handle->m_uhdr_compressed_img.get(),
+                                        handle->m_decoded_img_buffer.get(),
+                                        handle->m_gainmap_img_buffer.get(), nullptr);
+  } else if (fused) {
+    jpegr.setOutputMap(&fused_map);
+    if (fused_roi.width == (unsigned int)handle->m_img_wd &&
+        fused_roi.height == (unsigned int)handle->m_img_ht) {
+      status = jpegr.decodeJPEGR(handle->m_uhdr_compressed_img.get(),
+                                 handle->m_decoded_img_buffer.get(),
+                                 handle->m_output_max_disp_boost, handle->m_output_ct,
+                                 handle->m_output_fmt, handle->m_gainmap_img_buffer.get(), nullptr);
+    } else {
+      status = jpegr.decodeJPEGRRegion(handle->m_uhdr_compressed_img.get(), fused_roi,
+                                       handle->m_decoded_img_buffer.get(),
+                                       handle->m_output_max_disp_boost, handle->m_output_ct,
+                                       handle->m_output_fmt, handle->m_gainmap_img_buffer.get(),
+                                       nullptr);
+    }
+    if (status.error_code == UHDR_CODEC_OK) {
+      auto gm_img =
+          ultrahdr::apply_effect_chain(fused_gm_chain, handle->m_gainmap_img_buffer.get());
+      if (gm_img == nullptr) {
+        status.error_code = UHDR_CODEC_UNKNOWN_ERROR;
+        status.has_detail = 1;
+        snprintf(status.detail, sizeof status.detail,
+                 "encountered unknown error while applying effects to the gainmap image");
+        return status;
+      }
+      handle->m_gainmap_img_buffer = std::move(gm_img);
+    }
+    first_effect = handle->m_effects.size();
+  } else if (roi_crop != nullptr) {
+    status = jpegr.decodeJPEGRRegion(handle->m_uhdr_compressed_img.get(), roi,
+                                     handle->m_decoded_img_buffer.get(),
+                                     handle->m_output_max_disp_boost, handle->m_output_ct,
+                                     handle->m_output_fmt, handle->m_gainmap_img_buffer.get(),
+                                     nullptr);
+    if (status.error_code == UHDR_CODEC_OK) {
+      auto gm_img = ultrahdr::apply_crop(roi_crop, handle->m_gainmap_img_buffer.get(),
+                                         roi_bounds.gm_left, roi_bounds.gm_top,
+                                         roi_bounds.gm_right - roi_bounds.gm_left,
+                                         roi_bounds.gm_bottom - roi_bounds.gm_top);
+      if (gm_img == nullptr) {
+        status.error_code = UHDR_CODEC_UNKNOWN_ERROR;
+        status.has_detail = 1;
+        snprintf(status.detail, sizeof status.detail,
+                 "encountered unknown error while applying effect %s",
+                 roi_crop->to_string().c_str());
+        return status;
+      }
+      handle->m_gainmap_img_buffer = std::move(gm_img);
+    }
+    first_effect = 1;
+  } else if (scale_denom > 1) {
+    status = jpegr.decodeJPEGRScaled(handle->m_uhdr_compressed_img.get(), scale_denom,
+                                     handle->m_decoded_img_buffer.get(),
+                                     handle->m_output_max_disp_boost, handle->m_output_ct,
+                                     handle->m_output_fmt, handle->m_gainmap_img_buffer.get(),
+                                     nullptr);
+  } else {
+    status =
+        jpegr.decodeJPEGR(handle->m_uhdr_compressed_img.get(), handle->m_decoded_img_buffer.get(),
+                          handle->m_output_max_disp_boost, handle->m_output_ct,
+                          handle->m_output_fmt, handle->m_gainmap_img_buffer.get(), nullptr);
+  }
+
+  if (status.error_code == UHDR_CODEC_OK && dec->m_effects.size() > first_effect) {
+    status = ultrahdr::apply_effects(handle, first_effect);
+  }
+
+#ifdef UHDR_ENABLE_GLES
+  if (handle->m_use_gles) {
+    if (handle->m_uhdr_gl_ctxt.mDecodedImgTexture != 0 && handle->m_gpu_output &&
+        out_buffer == nullptr && status.error_code == UHDR_CODEC_OK) {
+      // the texture may be sampled from the share group right away, so wait for the rendering
+      glFinish();
+      handle->m_output_on_gpu = true;
+    } else if (handle->m_uhdr_gl_ctxt.mDecodedImgTexture != 0) {
+      handle->m_uhdr_gl_ctxt.begin_read_texture(
+          &handle->m_uhdr_gl_ctxt.mDecodedImgTexture, handle->m_decoded_img_buffer->fmt,
+          handle->m_decoded_img_buffer->w, handle->m_decoded_img_buffer->h, 0);
+    }
+    // both reads are in flight before waiting on either
+    bool read_gainmap =
+        handle->m_uhdr_gl_ctxt.mGainmapImgTexture != 0 && dec->m_effects.size() != 0;
+    if (read_gainmap) {
+      handle->m_uhdr_gl_ctxt.begin_read_texture(
+          &handle->m_uhdr_gl_ctxt.mGainmapImgTexture, handle->m_gainmap_img_buffer->fmt,
+          handle->m_gainmap_img_buffer->w, handle->m_gainmap_img_buffer->h, 1);
+    }
+    if (!handle->m_output_on_gpu && handle->m_uhdr_gl_ctxt.mDecodedImgTexture != 0) {
+      handle->m_uhdr_gl_ctxt.end_read_texture(0, handle->m_decoded_img_buffer->planes[0]);
+    }
+    if (read_gainmap) {
+      handle->m_uhdr_gl_ctxt.end_read_texture(1, handle->m_gainmap_img_buffer->planes[0]);
+    }
+  }
+#endif
+
+  // effects change the output geometry, so the result is produced internally and copied out
+  if (status.error_code == UHDR_CODEC_OK && out_buffer != nullptr && dec->m_effects.size() != 0) {
+    if (out_buffer->w != handle->m_decoded_img_buffer->w ||
+        out_buffer->h != handle->m_decoded_img_buffer->h) {
+      status.error_code = UHDR_CODEC_INVALID_PARAM;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "output buffer dimensions %ux%u do not match decoded image dimensions %ux%u",
+               out_buffer->w, out_buffer->h, handle->m_decoded_img_buffer->w,
+               handle->m_decoded_img_buffer->h);
+      return status;
+    }
+    status = ultrahdr::copy_raw_image(handle->m_decoded_img_buffer.get(), out_buffer);
+    if (status.error_code != UHDR_CODEC_OK) return status;
+    handle->m_decoded_img_buffer = std::make_unique<ultrahdr::uhdr_raw_image_ext_t>(
+        static_cast<const uhdr_raw_image_t&>(*out_buffer));
+  }
+  if (status.error_code == UHDR_CODEC_OK && !handle->m_pyramid_levels.empty()) {
+    status = build_pyramid(handle);
+  }
+  return status;
+}
+
+uhdr_error_info_t uhdr_decode_async(uhdr_codec_private_t* dec, uhdr_completion_fn_t on_done,
+                                    void* user_ctx) {
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    uhdr_error_info_t status;
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
+  }
+  return ultrahdr::run_async(dec, uhdr_decode, on_done, user_ctx);
+}
+
+uhdr_error_info_t uhdr_decode_batch(uhdr_codec_private_t** decs, unsigned int count) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (decs == nullptr || count == 0) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received empty list of decoder instances");
+    return status;
+  }
+
+  std::vector<uhdr_decoder_private*> handles(count);
+  for (unsigned int i = 0; i < count; i++) {
+    handles[i] = dynamic_cast<uhdr_decoder_private*>(decs[i]);
+    if (handles[i] == nullptr) {
+      status.error_code = UHDR_CODEC_INVALID_PARAM;
       status.has_detail = 1;
       snprintf(status.detail, sizeof status.detail,
-               "resources required for uhdr_encode() operation are not present");
+               "entry %u of the batch is not a uhdr decoder instance", i);
+      return status;
     }
   }
+  std::vector<uhdr_decoder_private*> sorted(handles);
+  std::sort(sorted.begin(), sorted.end());
+  if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end()) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "a decoder instance appears more than once in the batch");
+    return status;
+  }
+
+  // largest images first, so that no long decode starts last while the other cores run dry
+  for (uhdr_decoder_private* handle : handles) {
+    if (!handle->m_sailed) uhdr_dec_probe(handle);
+  }
+  std::vector<unsigned int> order(count);
+  std::iota(order.begin(), order.end(), 0u);
+  std::stable_sort(order.begin(), order.end(), [&handles](unsigned int a, unsigned int b) {
+    return (int64_t)handles[a]->m_img_wd * handles[a]->m_img_ht >
+           (int64_t)handles[b]->m_img_wd * handles[b]->m_img_ht;
+  });
+
+  // the images are spread across the cores rather than the rows of each image, so decoders left
+  // at the default thread count decode on the worker that picked them. On a NUMA host the workers
+  // are spread across the nodes, an image is then decoded, its intermediates first touched and its
+  // row jobs run on the node of the worker that picked it
+  std::atomic<unsigned int> next{0}, next_worker{0};
+  const std::vector<std::vector<int>>& nodes = ultrahdr::CpuTopology::get().numaNodes();
+  auto decode_images = [&]() {
+    const std::vector<int>* node =
+        nodes.empty() ? nullptr : &nodes[next_worker.fetch_add(1) % nodes.size()];
+    for (unsigned int i = next.fetch_add(1); i < count; i = next.fetch_add(1)) {
+      uhdr_decoder_private* handle = handles[order[i]];
+      std::optional<ultrahdr::CoreAffinityScope> placement;
+      if (node != nullptr && handle->m_numa_placement) placement.emplace(*node);
+      int num_threads = handle->m_num_threads;
+      if (count > 1 && num_threads == ultrahdr::kNumThreadsDefault) handle->m_num_threads = 1;
+      uhdr_decode(handle);
+      handle->m_num_threads = num_threads;
+    }
+  };
+  unsigned int workers = (std::min)(count, (std::max)(1u, std::thread::hardware_concurrency()));
+  ultrahdr::ThreadPool::getDefaultPool().run(decode_images, workers);
 
+  for (uhdr_decoder_private* handle : handles) {
+    if (handle->m_decode_call_status.error_code != UHDR_CODEC_OK) {
+      return handle->m_decode_call_status;
+    }
+  }
   return status;
 }
 
-uhdr_compressed_image_t* uhdr_get_encoded_stream(uhdr_codec_private_t* enc) {
-  if (dynamic_cast<uhdr_encoder_private*>(enc) == nullptr) {
-    return nullptr;
+// Rendered regions kept by a decoder for uhdr_dec_render_region(), and the bytes they may hold
+static const size_t kMaxRenderedRegions = 32;
+static const size_t kMaxRenderedRegionBytes = 64 << 20;
+
+// Configures jpegr for the decoder and decodes the inputs of gain map application on first use,
+// they are kept until reset
+static uhdr_error_info_t prepare_render_sources(uhdr_decoder_private* handle,
+                                                ultrahdr::JpegR& jpegr) {
+  if (handle->m_decode_cache == nullptr) {
+    handle->m_decode_cache = std::make_unique<ultrahdr::JpegRDecodeCache>();
   }
+  jpegr.setNumThreads(handle->m_num_threads);
+  jpegr.setParallelExecutor(handle->m_parallel_for, handle->m_parallel_for_ctx);
+  jpegr.setJpegBackend(handle->m_jpeg_backend);
+  jpegr.setCoreAffinity(handle->m_core_affinity);
+  jpegr.setDecodeCache(handle->m_decode_cache.get());
+  jpegr.setFastIdct(handle->m_fast_idct);
+  jpegr.setFastUpsampling(handle->m_fast_upsampling);
+  jpegr.setApproximateGainMap(handle->m_approximate_gainmap);
+  jpegr.setStats(ultrahdr::CodecStats::current());
+  jpegr.setOutputColorGamut(handle->m_output_cg);
+  if (handle->m_render_sdr_img != nullptr) return g_no_error;
+
+  uhdr_error_info_t status = jpegr.decodeJPEGRSources(
+      handle->m_uhdr_compressed_img.get(), handle->m_output_ct, handle->m_render_sdr_img,
+      handle->m_render_gainmap_img, &handle->m_render_metadata);
+  if (status.error_code != UHDR_CODEC_OK) {
+    handle->m_render_sdr_img.reset();
+    handle->m_render_gainmap_img.reset();
+  }
+  return status;
+}
 
-  uhdr_encoder_private* handle = dynamic_cast<uhdr_encoder_private*>(enc);
-  if (!handle->m_sailed || handle->m_encode_call_status.error_code != UHDR_CODEC_OK) {
-    return nullptr;
+uhdr_error_info_t uhdr_dec_render_region(uhdr_codec_private_t* dec, int x, int y, int w, int h,
+                                         float display_boost, uhdr_raw_image_t** region) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+  } else if (region == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for region");
+  } else if (!std::isfinite(display_boost) || display_boost < 1.0f) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "invalid display boost %f, expects to be >= 1.0f", display_boost);
   }
+  if (status.error_code != UHDR_CODEC_OK) return status;
 
-  return handle->m_compressed_output_buffer.get();
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  *region = nullptr;
+  ultrahdr::MemoryArena::Scope arena_scope(&handle->m_arena);
+  ultrahdr::CodecStats::Scope stats_scope(handle->m_stats_enabled ? &handle->m_stats : nullptr);
+  handle->m_cancel.arm(handle->m_cancel_flag, handle->m_deadline_ms);
+  ultrahdr::CancelToken::Scope cancel_scope(&handle->m_cancel);
+  status = uhdr_dec_probe(dec);
+  if (status.error_code != UHDR_CODEC_OK) return status;
+
+  if (ultrahdr::is_base_image_output(handle) || handle->m_effects.size() != 0) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "region rendering cannot be combined with image effects or disabled gain map "
+             "application");
+    return status;
+  }
+  status = check_output_config(handle);
+  if (status.error_code != UHDR_CODEC_OK) return status;
+  const bool ycbcr_output = handle->m_output_fmt == UHDR_IMG_FMT_24bppYCbCrP010;
+  if (x < 0 || y < 0 || w <= 0 || h <= 0 || x >= handle->m_img_wd || y >= handle->m_img_ht ||
+      w > handle->m_img_wd - x || h > handle->m_img_ht - y ||
+      (ycbcr_output && (x % 2 != 0 || y % 2 != 0 || w % 2 != 0 || h % 2 != 0))) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "received bad region %dx%d at (%d, %d) of a %dx%d image for output format %d", w, h,
+             x, y, handle->m_img_wd, handle->m_img_ht, handle->m_output_fmt);
+    return status;
+  }
+
+  auto& regions = handle->m_rendered_regions;
+  for (auto it = regions.begin(); it != regions.end(); ++it) {
+    if (it->x == x && it->y == y && it->w == w && it->h == h &&
+        it->display_boost == display_boost) {
+      regions.splice(regions.begin(), regions, it);
+      *region = &regions.front().view;
+      return status;
+    }
+  }
+
+  // the decoded base image and gain map and the cached regions count against the memory limit,
+  // the sources are projected from the headers until they are decoded. A region at odd
+  // coordinates may be rendered from one row and column ahead, see below.
+  const size_t region_bytes = (size_t)(w + 1) * (h + 1) * output_bpp_x2(handle->m_output_fmt) / 2;
+  size_t source_bytes = handle->m_render_sdr_img != nullptr
+                            ? handle->m_render_sdr_img->size_bytes() +
+                                  handle->m_render_gainmap_img->size_bytes()
+                            : (size_t)handle->m_img_wd * handle->m_img_ht *
+                                      base_image_bpp(handle, handle->m_output_ct) +
+                                  2 * gainmap_image_bytes(handle);
+  if (handle->m_memory_limit != 0 && source_bytes + region_bytes > handle->m_memory_limit) {
+    status.error_code = UHDR_CODEC_MEM_ERROR;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "region rendering is projected to use %zu bytes, exceeds the memory limit of %zu "
+             "bytes",
+             source_bytes + region_bytes, handle->m_memory_limit);
+    return status;
+  }
+
+  ultrahdr::JpegR jpegr;
+  status = prepare_render_sources(handle, jpegr);
+  if (status.error_code != UHDR_CODEC_OK) return status;
+  source_bytes =
+      handle->m_render_sdr_img->size_bytes() + handle->m_render_gainmap_img->size_bytes();
+
+  // least recently used regions make room for the new one
+  size_t budget = kMaxRenderedRegionBytes;
+  if (handle->m_memory_limit != 0) {
+    budget = (std::min)(budget, handle->m_memory_limit - (std::min)(handle->m_memory_limit,
+                                                                    source_bytes));
+  }
+  size_t cached_bytes = 0;
+  for (const auto& cached : regions) cached_bytes += cached.img->size_bytes();
+  while (!regions.empty() &&
+         (regions.size() >= kMaxRenderedRegions || cached_bytes + region_bytes > budget)) {
+    cached_bytes -= regions.back().img->size_bytes();
+    regions.pop_back();
+  }
+  if (region_bytes > budget && handle->m_memory_limit != 0) {
+    status.error_code = UHDR_CODEC_MEM_ERROR;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "region rendering is projected to use %zu bytes, exceeds the memory limit of %zu "
+             "bytes",
+             source_bytes + region_bytes, handle->m_memory_limit);
+    return status;
+  }
+
+  // the chroma of a 4:2:0 base image is paired from even coordinates on, an odd region is rendered
+  // from there and handed out as a view
+  const bool subsampled = handle->m_render_sdr_img->fmt == UHDR_IMG_FMT_12bppYCbCr420;
+  const unsigned int left = subsampled ? x & ~1 : x;
+  const unsigned int top = subsampled ? y & ~1 : y;
+  const ultrahdr::image_region_t roi{left, top, x + w - left, y + h - top};
+  auto img = std::make_unique<ultrahdr::uhdr_raw_image_ext_t>(
+      handle->m_output_fmt, UHDR_CG_UNSPECIFIED, handle->m_output_ct, UHDR_CR_UNSPECIFIED,
+      roi.width, roi.height, 1);
+  status = jpegr.applyGainMapRegion(handle->m_render_sdr_img.get(),
+                                    handle->m_render_gainmap_img.get(), &handle->m_render_metadata,
+                                    roi, display_boost, handle->m_output_ct, handle->m_output_fmt,
+                                    img.get());
+  if (status.error_code != UHDR_CODEC_OK) return status;
+
+  const ultrahdr::uhdr_raw_image_ext_t view(*img, x - left, y - top, w, h);
+  regions.push_front({x, y, w, h, display_boost, std::move(img), view});
+  *region = &regions.front().view;
+  return status;
 }
 
-void uhdr_reset_encoder(uhdr_codec_private_t* enc) {
-  if (dynamic_cast<uhdr_encoder_private*>(enc) != nullptr) {
-    uhdr_encoder_private* handle = dynamic_cast<uhdr_encoder_private*>(enc);
+uhdr_error_info_t uhdr_dec_rerender(uhdr_codec_private_t* dec, float display_boost) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+  } else if (!std::isfinite(display_boost) || display_boost < 1.0f) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "invalid display boost %f, expects to be >= 1.0f", display_boost);
+  }
+  if (status.error_code != UHDR_CODEC_OK) return status;
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  ultrahdr::uhdr_raw_image_ext_t* dst = handle->m_decoded_img_buffer.get();
+  if (!handle->m_sailed || handle->m_transcoded_img != nullptr ||
+      handle->m_decode_call_status.error_code != UHDR_CODEC_OK || dst == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "re-rendering requires a successful call to uhdr_decode() ahead");
+    return status;
+  }
+  if (ultrahdr::is_base_image_output(handle) || handle->m_effects.size() != 0 ||
+      handle->m_output_on_gpu || dst->w != (unsigned int)handle->m_img_wd ||
+      dst->h != (unsigned int)handle->m_img_ht) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "re-rendering cannot be combined with image effects, disabled gain map application, "
+             "gpu output or a downscaled decode");
+    return status;
+  }
+
+  ultrahdr::MemoryArena::Scope arena_scope(&handle->m_arena);
+  ultrahdr::CodecStats::Scope stats_scope(handle->m_stats_enabled ? &handle->m_stats : nullptr);
+  handle->m_cancel.arm(handle->m_cancel_flag, handle->m_deadline_ms);
+  ultrahdr::CancelToken::Scope cancel_scope(&handle->m_cancel);
+  ultrahdr::JpegR jpegr;
+  status = prepare_render_sources(handle, jpegr);
+  if (status.error_code != UHDR_CODEC_OK) return status;
+
+  const ultrahdr::image_region_t roi{0, 0, dst->w, dst->h};
+  status = jpegr.applyGainMapRegion(handle->m_render_sdr_img.get(),
+                                    handle->m_render_gainmap_img.get(), &handle->m_render_metadata,
+                                    roi, display_boost, handle->m_output_ct, handle->m_output_fmt,
+                                    dst);
+  // a partly re-rendered image is not handed out
+  if (status.error_code != UHDR_CODEC_OK) handle->m_decode_call_status = status;
+  handle->m_output_max_disp_boost = display_boost;
+  return status;
+}
+
+uhdr_raw_image_t* uhdr_get_decoded_image(uhdr_codec_private_t* dec) {
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    return nullptr;
+  }
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (!handle->m_sailed || handle->m_transcoded_img != nullptr ||
+      handle->m_decode_call_status.error_code != UHDR_CODEC_OK) {
+    return nullptr;
+  }
 
-    // clear entries and restore defaults
-    for (auto it : handle->m_effects) delete it;
-    handle->m_effects.clear();
 #ifdef UHDR_ENABLE_GLES
-    handle->m_uhdr_gl_ctxt.reset_opengl_ctxt();
-    handle->m_enable_gles = false;
+  if (handle->m_output_on_gpu) {
+    ultrahdr::uhdr_opengl_ctxt_t& gl_ctxt = handle->m_uhdr_gl_ctxt;
+    if (!gl_ctxt.make_current()) return nullptr;
+    gl_ctxt.read_texture(&gl_ctxt.mDecodedImgTexture, handle->m_decoded_img_buffer->fmt,
+                         handle->m_decoded_img_buffer->w, handle->m_decoded_img_buffer->h,
+                         handle->m_decoded_img_buffer->planes[0]);
+    gl_ctxt.release_current();
+    handle->m_output_on_gpu = false;
+  }
 #endif
-    handle->m_sailed = false;
-    handle->m_raw_images.clear();
-    handle->m_compressed_images.clear();
-    handle->m_quality.clear();
-    handle->m_quality.emplace(UHDR_HDR_IMG, ultrahdr::kBaseCompressQualityDefault);
-    handle->m_quality.emplace(UHDR_SDR_IMG, ultrahdr::kBaseCompressQualityDefault);
-    handle->m_quality.emplace(UHDR_BASE_IMG, ultrahdr::kBaseCompressQualityDefault);
-    handle->m_quality.emplace(UHDR_GAIN_MAP_IMG, ultrahdr::kMapCompressQualityDefault);
-    handle->m_exif.clear();
-    handle->m_output_format = UHDR_CODEC_JPG;
-    handle->m_gainmap_scale_factor = ultrahdr::kMapDimensionScaleFactorDefault;
-    handle->m_use_multi_channel_gainmap = ultrahdr::kUseMultiChannelGainMapDefault;
-    handle->m_gamma = ultrahdr::kGainMapGammaDefault;
-    handle->m_enc_preset = ultrahdr::kEncSpeedPresetDefault;
-    handle->m_min_content_boost = FLT_MIN;
-    handle->m_max_content_boost = FLT_MAX;
-    handle->m_target_disp_max_brightness = -1.0f;
 
-    handle->m_compressed_output_buffer.reset();
-    handle->m_encode_call_status = g_no_error;
+  return handle->m_decoded_img_buffer.get();
+}
+
+uhdr_raw_image_t* uhdr_get_decoded_gainmap_image(uhdr_codec_private_t* dec) {
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    return nullptr;
+  }
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (!handle->m_sailed || handle->m_transcoded_img != nullptr ||
+      handle->m_decode_call_status.error_code != UHDR_CODEC_OK) {
+    return nullptr;
   }
+
+  return handle->m_gainmap_img_buffer.get();
 }
 
-int is_uhdr_image(void* data, int size) {
-#define RET_IF_ERR(x)                         \
-  {                                           \
-    uhdr_error_info_t status = (x);           \
-    if (status.error_code != UHDR_CODEC_OK) { \
-      uhdr_release_decoder(obj);              \
-      return 0;                               \
-    }                                         \
+uhdr_raw_image_t* uhdr_take_decoded_image(uhdr_codec_private_t* dec) {
+  // reads back an image left on the gpu
+  if (uhdr_get_decoded_image(dec) == nullptr) return nullptr;
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  handle->m_decoded_img_buffer->detach();
+  return handle->m_decoded_img_buffer.release();
+}
+
+uhdr_raw_image_t* uhdr_take_decoded_gainmap_image(uhdr_codec_private_t* dec) {
+  if (uhdr_get_decoded_gainmap_image(dec) == nullptr) return nullptr;
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  handle->m_gainmap_img_buffer->detach();
+  return handle->m_gainmap_img_buffer.release();
+}
+
+void uhdr_release_raw_image(uhdr_raw_image_t* img) {
+  delete static_cast<ultrahdr::uhdr_raw_image_ext_t*>(img);
+}
+
+uhdr_raw_image_t* uhdr_get_decoded_rendition(uhdr_codec_private_t* dec, unsigned int index) {
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    return nullptr;
+  }
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (!handle->m_sailed || handle->m_transcoded_img != nullptr ||
+      handle->m_decode_call_status.error_code != UHDR_CODEC_OK ||
+      index >= handle->m_renditions.size()) {
+    return nullptr;
   }
 
-  uhdr_codec_private_t* obj = uhdr_create_decoder();
-  uhdr_compressed_image_t uhdr_image;
-  uhdr_image.data = data;
-  uhdr_image.data_sz = size;
-  uhdr_image.capacity = size;
-  uhdr_image.cg = UHDR_CG_UNSPECIFIED;
-  uhdr_image.ct = UHDR_CT_UNSPECIFIED;
-  uhdr_image.range = UHDR_CR_UNSPECIFIED;
+  return handle->m_renditions[index].img.get();
+}
 
-  RET_IF_ERR(uhdr_dec_set_image(obj, &uhdr_image));
-  RET_IF_ERR(uhdr_dec_probe(obj));
-#undef RET_IF_ERR
+uhdr_raw_image_t* uhdr_get_decoded_pyramid_level(uhdr_codec_private_t* dec, unsigned int index) {
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    return nullptr;
+  }
 
-  uhdr_release_decoder(obj);
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (!handle->m_sailed || handle->m_transcoded_img != nullptr ||
+      handle->m_decode_call_status.error_code != UHDR_CODEC_OK ||
+      index >= handle->m_pyramid_levels.size()) {
+    return nullptr;
+  }
 
-  return 1;
+  return handle->m_pyramid_levels[index].img.get();
 }
 
-uhdr_codec_private_t* uhdr_create_decoder(void) {
-  uhdr_decoder_private* handle = new uhdr_decoder_private();
+uhdr_codec_stats_t* uhdr_dec_get_stats(uhdr_codec_private_t* dec) {
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    return nullptr;
+  }
 
-  if (handle != nullptr) {
-    uhdr_reset_decoder(handle);
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (!handle->m_stats_enabled) {
+    return nullptr;
   }
-  return handle;
+
+  return handle->m_stats.get();
 }
 
-void uhdr_release_decoder(uhdr_codec_private_t* dec) {
-  if (dynamic_cast<uhdr_decoder_private*>(dec) != nullptr) {
-    uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
-    delete handle;
+uhdr_luminance_stats_t* uhdr_dec_get_luminance_stats(uhdr_codec_private_t* dec) {
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    return nullptr;
+  }
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (!handle->m_luminance_stats_enabled || !handle->m_sailed ||
+      handle->m_transcoded_img != nullptr ||
+      handle->m_decode_call_status.error_code != UHDR_CODEC_OK ||
+      handle->m_luminance_stats.num_pixels == 0) {
+    return nullptr;
   }
+
+  return &handle->m_luminance_stats;
 }
 
-uhdr_error_info_t uhdr_dec_set_image(uhdr_codec_private_t* dec, uhdr_compressed_image_t* img) {
-  uhdr_error_info_t status = g_no_error;
+unsigned int uhdr_get_decoded_texture(uhdr_codec_private_t* dec, unsigned int* width,
+                                      unsigned int* height, uhdr_img_fmt_t* fmt) {
+  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    return 0;
+  }
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+  if (!handle->m_sailed || handle->m_transcoded_img != nullptr ||
+      handle->m_decode_call_status.error_code != UHDR_CODEC_OK || !handle->m_gpu_output) {
+    return 0;
+  }
+
+  unsigned int texture = 0;
+#ifdef UHDR_ENABLE_GLES
+  // a read back does not release the texture, it stays valid until reset
+  texture = handle->m_uhdr_gl_ctxt.mDecodedImgTexture;
+#endif
+  if (texture != 0 && handle->m_decoded_img_buffer != nullptr) {
+    if (width != nullptr) *width = handle->m_decoded_img_buffer->w;
+    if (height != nullptr) *height = handle->m_decoded_img_buffer->h;
+    if (fmt != nullptr) *fmt = handle->m_decoded_img_buffer->fmt;
+  }
+  return texture;
+}
 
+#ifndef UHDR_DECODER_ONLY
+uhdr_error_info_t uhdr_transcode(uhdr_codec_private_t* dec) {
   if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+    uhdr_error_info_t status;
     status.error_code = UHDR_CODEC_INVALID_PARAM;
     status.has_detail = 1;
     snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
-  } else if (img == nullptr) {
-    status.error_code = UHDR_CODEC_INVALID_PARAM;
-    status.has_detail = 1;
-    snprintf(status.detail, sizeof status.detail, "received nullptr for compressed image handle");
-  } else if (img->data == nullptr) {
-    status.error_code = UHDR_CODEC_INVALID_PARAM;
-    status.has_detail = 1;
-    snprintf(status.detail, sizeof status.detail,
-             "received nullptr for compressed img->data field");
-  } else if (img->capacity < img->data_sz) {
-    status.error_code = UHDR_CODEC_INVALID_PARAM;
-    status.has_detail = 1;
-    snprintf(status.detail, sizeof status.detail, "img->capacity %zd is less than img->data_sz %zd",
-             img->capacity, img->data_sz);
+    return status;
+  }
+
+  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+
+  if (handle->m_sailed) {
+    if (handle->m_transcoded_img == nullptr) {
+      uhdr_error_info_t status;
+      status.error_code = UHDR_CODEC_INVALID_OPERATION;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "An earlier call to uhdr_decode() has switched the context from configurable state "
+               "to end state. The context is no longer configurable. To reuse, call reset()");
+      return status;
+    }
+    return handle->m_decode_call_status;
   }
+
+  ultrahdr::MemoryArena::Scope arena_scope(&handle->m_arena);
+  handle->m_cancel.arm(handle->m_cancel_flag, handle->m_deadline_ms);
+  ultrahdr::CancelToken::Scope cancel_scope(&handle->m_cancel);
+  uhdr_error_info_t& status = handle->m_decode_call_status;
+  status = uhdr_dec_probe(dec);
   if (status.error_code != UHDR_CODEC_OK) return status;
 
-  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
-  if (handle->m_probed) {
-    status.error_code = UHDR_CODEC_INVALID_OPERATION;
-    status.has_detail = 1;
-    snprintf(status.detail, sizeof status.detail,
-             "An earlier call to uhdr_decode() has switched the context from configurable state to "
-             "end state. The context is no longer configurable. To reuse, call reset()");
-    return status;
+  handle->m_sailed = true;
+  // the transformed images stay close to the input in size, the ultrahdr segments are small
+  handle->m_transcoded_img = std::make_unique<ultrahdr::uhdr_compressed_image_ext_t>(
+      UHDR_CG_UNSPECIFIED, UHDR_CT_UNSPECIFIED, UHDR_CR_UNSPECIFIED,
+      (std::max)(((size_t)8 * 1024), 2 * handle->m_uhdr_compressed_img->data_sz));
+
+  // the effects are folded into one map per image, crops reach the gain map as in apply_effects()
+  ultrahdr::uhdr_effect_chain_t base_chain(handle->m_img_wd, handle->m_img_ht);
+  ultrahdr::uhdr_effect_chain_t gm_chain(handle->m_gainmap_wd, handle->m_gainmap_ht);
+  for (auto& it : handle->m_effects) {
+    bool supported = true;
+    if (auto rotate_effect = dynamic_cast<ultrahdr::uhdr_rotate_effect_t*>(it)) {
+      supported = base_chain.rotate(rotate_effect->m_degree) &&
+                  gm_chain.rotate(rotate_effect->m_degree);
+    } else if (auto mirror_effect = dynamic_cast<ultrahdr::uhdr_mirror_effect_t*>(it)) {
+      supported = base_chain.mirror(mirror_effect->m_direction) &&
+                  gm_chain.mirror(mirror_effect->m_direction);
+    } else if (auto crop_effect = dynamic_cast<ultrahdr::uhdr_crop_effect_t*>(it)) {
+      ultrahdr::crop_bounds_t b;
+      status = ultrahdr::get_crop_bounds(crop_effect, base_chain.width(), base_chain.height(),
+                                         gm_chain.width(), gm_chain.height(), b);
+      if (status.error_code != UHDR_CODEC_OK) return status;
+      supported =
+          base_chain.crop(b.left, b.top, b.right - b.left, b.bottom - b.top) &&
+          gm_chain.crop(b.gm_left, b.gm_top, b.gm_right - b.gm_left, b.gm_bottom - b.gm_top);
+    } else {
+      status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "%s can not be applied to a compressed image, only rotate, mirror and crop can",
+               it->to_string().c_str());
+      return status;
+    }
+    if (!supported) {
+      status.error_code = UHDR_CODEC_UNKNOWN_ERROR;
+      status.has_detail = 1;
+      snprintf(status.detail, sizeof status.detail,
+               "encountered unknown error while applying effect %s", it->to_string().c_str());
+      return status;
+    }
   }
 
-  handle->m_uhdr_compressed_img = std::make_unique<ultrahdr::uhdr_compressed_image_ext_t>(
-      img->cg, img->ct, img->range, img->data_sz);
-  memcpy(handle->m_uhdr_compressed_img->data, img->data, img->data_sz);
-  handle->m_uhdr_compressed_img->data_sz = img->data_sz;
-
+  ultrahdr::JpegR jpegr;
+  jpegr.setNumThreads(handle->m_num_threads);
+  jpegr.setParallelExecutor(handle->m_parallel_for, handle->m_parallel_for_ctx);
+  jpegr.setJpegBackend(handle->m_jpeg_backend);
+  jpegr.setCoreAffinity(handle->m_core_affinity);
+  status = jpegr.transcodeJPEGR(handle->m_uhdr_compressed_img.get(), base_chain.m_luma,
+                                gm_chain.m_luma, handle->m_transcoded_img.get());
   return status;
 }
 
-uhdr_error_info_t uhdr_dec_set_out_img_format(uhdr_codec_private_t* dec, uhdr_img_fmt_t fmt) {
+uhdr_error_info_t uhdr_rewrite_gainmap_metadata(uhdr_codec_private_t* dec,
+                                                uhdr_gainmap_metadata_t* metadata) {
   uhdr_error_info_t status = g_no_error;
-
   if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
     status.error_code = UHDR_CODEC_INVALID_PARAM;
     status.has_detail = 1;
     snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
-  } else if (fmt != UHDR_IMG_FMT_32bppRGBA8888 && fmt != UHDR_IMG_FMT_64bppRGBAHalfFloat &&
-             fmt != UHDR_IMG_FMT_32bppRGBA1010102) {
-    status.error_code = UHDR_CODEC_INVALID_PARAM;
-    status.has_detail = 1;
-    snprintf(status.detail, sizeof status.detail,
-             "invalid output format %d, expects one of {UHDR_IMG_FMT_32bppRGBA8888,  "
-             "UHDR_IMG_FMT_64bppRGBAHalfFloat, UHDR_IMG_FMT_32bppRGBA1010102}",
-             fmt);
+    return status;
   }
+  status = ultrahdr::uhdr_validate_gainmap_metadata_descriptor(metadata);
   if (status.error_code != UHDR_CODEC_OK) return status;
 
   uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
-  if (handle->m_probed) {
+
+  if (handle->m_sailed) {
     status.error_code = UHDR_CODEC_INVALID_OPERATION;
     status.has_detail = 1;
     snprintf(status.detail, sizeof status.detail,
-             "An earlier call to uhdr_decode() has switched the context from configurable state to "
-             "end state. The context is no longer configurable. To reuse, call reset()");
+             "An earlier call to uhdr_decode() or uhdr_transcode() has switched the context from "
+             "configurable state to end state. The context is no longer configurable. To reuse, "
+             "call reset()");
+    return status;
+  }
+  if (handle->m_effects.size() != 0) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "effects are not applied while rewriting gain map metadata, use uhdr_transcode()");
     return status;
   }
 
-  handle->m_output_fmt = fmt;
+  ultrahdr::MemoryArena::Scope arena_scope(&handle->m_arena);
+  status = uhdr_dec_probe(dec);
+  if (status.error_code != UHDR_CODEC_OK) return status;
 
-  return status;
-}
+  handle->m_sailed = true;
+  // the regenerated segments are a few kilobytes at most, the rest of the image is copied
+  handle->m_transcoded_img = std::make_unique<ultrahdr::uhdr_compressed_image_ext_t>(
+      UHDR_CG_UNSPECIFIED, UHDR_CT_UNSPECIFIED, UHDR_CR_UNSPECIFIED,
+      handle->m_uhdr_compressed_img->data_sz + 8 * 1024);
 
-uhdr_error_info_t uhdr_dec_set_out_color_transfer(uhdr_codec_private_t* dec,
-                                                  uhdr_color_transfer_t ct) {
-  uhdr_error_info_t status = g_no_error;
+  ultrahdr::uhdr_gainmap_metadata_ext_t metadata_ext(*metadata, ultrahdr::kJpegrVersion);
+  ultrahdr::JpegR jpegr;
+  handle->m_decode_call_status = jpegr.rewriteGainMapMetadata(
+      handle->m_uhdr_compressed_img.get(), &metadata_ext, handle->m_transcoded_img.get());
+  return handle->m_decode_call_status;
+}
 
+uhdr_compressed_image_t* uhdr_get_transcoded_image(uhdr_codec_private_t* dec) {
   if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
-    status.error_code = UHDR_CODEC_INVALID_PARAM;
-    status.has_detail = 1;
-    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
-  } else if (ct != UHDR_CT_HLG && ct != UHDR_CT_PQ && ct != UHDR_CT_LINEAR && ct != UHDR_CT_SRGB) {
-    status.error_code = UHDR_CODEC_INVALID_PARAM;
-    status.has_detail = 1;
-    snprintf(status.detail, sizeof status.detail,
-             "invalid output color transfer %d, expects one of {UHDR_CT_HLG, UHDR_CT_PQ, "
-             "UHDR_CT_LINEAR, UHDR_CT_SRGB}",
-             ct);
+    return nullptr;
   }
-  if (status.error_code != UHDR_CODEC_OK) return status;
 
   uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
-  if (handle->m_probed) {
-    status.error_code = UHDR_CODEC_INVALID_OPERATION;
-    status.has_detail = 1;
-    snprintf(status.detail, sizeof status.detail,
-             "An earlier call to uhdr_decode() has switched the context from configurable state to "
-             "end state. The context is no longer configurable. To reuse, call reset()");
-    return status;
+  if (!handle->m_sailed || handle->m_transcoded_img == nullptr ||
+      handle->m_decode_call_status.error_code != UHDR_CODEC_OK) {
+    return nullptr;
   }
 
-  handle->m_output_ct = ct;
+  return handle->m_transcoded_img.get();
+}
+#endif  // UHDR_DECODER_ONLY
+
+void uhdr_reset_decoder(uhdr_codec_private_t* dec) {
+  if (dynamic_cast<uhdr_decoder_private*>(dec) != nullptr) {
+    uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+    ultrahdr::wait_async(handle);
+    ultrahdr::abort_input_stream(handle);
+    if (handle->m_decode_cache != nullptr) {
+      handle->m_decode_cache->mSdrStreamed = false;
+      handle->m_decode_cache->mHoldsSources = false;
+    }
+
+    // clear entries and restore defaults
+    for (auto it : handle->m_effects) delete it;
+    handle->m_effects.clear();
+#ifdef UHDR_ENABLE_GLES
+    handle->m_uhdr_gl_ctxt.reset_opengl_ctxt();
+    handle->m_enable_gles = false;
+#endif
+    handle->m_parallel_for = nullptr;
+    handle->m_parallel_for_ctx = nullptr;
+    handle->m_cancel_flag = nullptr;
+    handle->m_deadline_ms = 0;
+    handle->m_sailed = false;
+    handle->m_uhdr_compressed_img.reset();
+    handle->m_input_mapping.reset();
+    handle->m_transcoded_img.reset();
+    handle->m_output_fmt = UHDR_IMG_FMT_64bppRGBAHalfFloat;
+    handle->m_output_ct = UHDR_CT_LINEAR;
+    handle->m_output_cg = UHDR_CG_UNSPECIFIED;
+    handle->m_output_max_disp_boost = FLT_MAX;
+    handle->m_num_threads = ultrahdr::kNumThreadsDefault;
+    handle->m_output_buffer.reset();
+    handle->m_strip_fn = nullptr;
+    handle->m_strip_ctx = nullptr;
+    handle->m_strip_height = 0;
+    handle->m_base_fn = nullptr;
+    handle->m_base_ctx = nullptr;
+    handle->m_apply_gainmap = true;
+    handle->m_gainmap_only_denom = 0;
+    handle->m_fast_idct = false;
+    handle->m_fast_upsampling = false;
+    handle->m_approximate_gainmap = false;
+    handle->m_luminance_stats_enabled = false;
+    handle->m_gpu_output = false;
+    handle->m_gpu_share_ctxt = nullptr;
+    handle->m_memory_limit = 0;
+    handle->m_renditions.clear();
+    handle->m_pyramid_levels.clear();
+    handle->m_stats.clear();
+    if (handle->m_profile != nullptr) apply_decoder_profile(handle, *handle->m_profile);
+
+    // ready to be configured
+    handle->m_probed = false;
+    handle->m_cache_keyed = false;
+    handle->m_img_wd = 0;
+    handle->m_img_ht = 0;
+    handle->m_img_num_comp = 0;
+    handle->m_gainmap_wd = 0;
+    handle->m_gainmap_ht = 0;
+    handle->m_gainmap_num_comp = 0;
+    handle->m_exif.clear();
+    memset(&handle->m_exif_block, 0, sizeof handle->m_exif_block);
+    handle->m_icc.clear();
+    memset(&handle->m_icc_block, 0, sizeof handle->m_icc_block);
+    handle->m_base_img.clear();
+    memset(&handle->m_base_img_block, 0, sizeof handle->m_base_img_block);
+    handle->m_gainmap_img.clear();
+    memset(&handle->m_gainmap_img_block, 0, sizeof handle->m_gainmap_img_block);
+    memset(&handle->m_metadata, 0, sizeof handle->m_metadata);
+    memset(&handle->m_cost, 0, sizeof handle->m_cost);
+    memset(&handle->m_luminance_stats, 0, sizeof handle->m_luminance_stats);
+    handle->m_probe_call_status = g_no_error;
+    handle->m_decode_call_status = g_no_error;
+    handle->m_output_on_gpu = false;
+#ifdef UHDR_ENABLE_GLES
+    handle->m_use_gles = false;
+#endif
+    handle->m_render_sdr_img.reset();
+    handle->m_render_gainmap_img.reset();
+    handle->m_rendered_regions.clear();
+  }
+}
 
+uhdr_error_info_t uhdr_wait(uhdr_codec_private_t* codec) {
+  if (dynamic_cast<uhdr_encoder_private*>(codec) != nullptr) {
+    ultrahdr::wait_async(codec);
+    return dynamic_cast<uhdr_encoder_private*>(codec)->m_encode_call_status;
+  }
+  if (dynamic_cast<uhdr_decoder_private*>(codec) != nullptr) {
+    ultrahdr::wait_async(codec);
+    return dynamic_cast<uhdr_decoder_private*>(codec)->m_decode_call_status;
+  }
+  uhdr_error_info_t status;
+  status.error_code = UHDR_CODEC_INVALID_PARAM;
+  status.has_detail = 1;
+  snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
   return status;
 }
 
-uhdr_error_info_t uhdr_dec_set_out_max_display_boost(uhdr_codec_private_t* dec,
-                                                     float display_boost) {
+int uhdr_is_busy(uhdr_codec_private_t* codec) {
+  if (codec == nullptr) return 0;
+  std::lock_guard<std::mutex> lock(codec->m_async_mutex);
+  return codec->m_async_pending ? 1 : 0;
+}
+
+uhdr_error_info_t uhdr_enable_gpu_acceleration(uhdr_codec_private_t* codec,
+                                               [[maybe_unused]] int enable) {
   uhdr_error_info_t status = g_no_error;
 
-  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+  if (codec == nullptr) {
     status.error_code = UHDR_CODEC_INVALID_PARAM;
     status.has_detail = 1;
     snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
-  } else if (!std::isfinite(display_boost) || display_boost < 1.0f) {
-    status.error_code = UHDR_CODEC_INVALID_PARAM;
-    status.has_detail = 1;
-    snprintf(status.detail, sizeof status.detail,
-             "invalid display boost %f, expects to be >= 1.0f}", display_boost);
+    return status;
   }
-  if (status.error_code != UHDR_CODEC_OK) return status;
 
-  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
-  if (handle->m_probed) {
+  if (codec->m_sailed) {
     status.error_code = UHDR_CODEC_INVALID_OPERATION;
     status.has_detail = 1;
-    snprintf(status.detail, sizeof status.detail,
-             "An earlier call to uhdr_decode() has switched the context from configurable state to "
-             "end state. The context is no longer configurable. To reuse, call reset()");
+    snprintf(
+        status.detail, sizeof status.detail,
+        "An earlier call to uhdr_encode()/uhdr_decode() has switched the context from configurable "
+        "state to end state. The context is no longer configurable. To reuse, call reset()");
     return status;
   }
 
-  handle->m_output_max_disp_boost = display_boost;
+#ifdef UHDR_ENABLE_GLES
+  codec->m_enable_gles = enable;
+#endif
 
   return status;
 }
 
-uhdr_error_info_t uhdr_dec_probe(uhdr_codec_private_t* dec) {
-  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
+uhdr_error_info_t uhdr_set_gpu_program_cache_dir([[maybe_unused]] const char* dir) {
+#ifdef UHDR_ENABLE_GLES
+  ultrahdr::set_gl_program_cache_dir(dir);
+#endif
+  return g_no_error;
+}
+
+uhdr_error_info_t uhdr_preload(int flags) {
+  if ((flags & ~UHDR_PRELOAD_ALL) != 0) {
     uhdr_error_info_t status;
     status.error_code = UHDR_CODEC_INVALID_PARAM;
     status.has_detail = 1;
-    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    snprintf(status.detail, sizeof status.detail, "unrecognized preload flags 0x%x", flags);
     return status;
   }
 
-  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
-  uhdr_error_info_t& status = handle->m_probe_call_status;
-
-  if (!handle->m_probed) {
-    handle->m_probed = true;
-
-    if (handle->m_uhdr_compressed_img.get() == nullptr) {
-      status.error_code = UHDR_CODEC_INVALID_OPERATION;
-      status.has_detail = 1;
-      snprintf(status.detail, sizeof status.detail, "did not receive any image for decoding");
-      return status;
-    }
-
-    ultrahdr::jpeg_info_struct primary_image;
-    ultrahdr::jpeg_info_struct gainmap_image;
-    ultrahdr::jpegr_info_struct jpegr_info;
-    jpegr_info.primaryImgInfo = &primary_image;
-    jpegr_info.gainmapImgInfo = &gainmap_image;
-
-    ultrahdr::JpegR jpegr;
-    status = jpegr.getJPEGRInfo(handle->m_uhdr_compressed_img.get(), &jpegr_info);
-    if (status.error_code != UHDR_CODEC_OK) return status;
-
-    ultrahdr::uhdr_gainmap_metadata_ext_t metadata;
-    status = jpegr.parseGainMapMetadata(gainmap_image.isoData.data(), gainmap_image.isoData.size(),
-                                        gainmap_image.xmpData.data(), gainmap_image.xmpData.size(),
-                                        &metadata);
-    if (status.error_code != UHDR_CODEC_OK) return status;
-    handle->m_metadata.max_content_boost = metadata.max_content_boost;
-    handle->m_metadata.min_content_boost = metadata.min_content_boost;
-    handle->m_metadata.gamma = metadata.gamma;
-    handle->m_metadata.offset_sdr = metadata.offset_sdr;
-    handle->m_metadata.offset_hdr = metadata.offset_hdr;
-    handle->m_metadata.hdr_capacity_min = metadata.hdr_capacity_min;
-    handle->m_metadata.hdr_capacity_max = metadata.hdr_capacity_max;
-
-    handle->m_img_wd = primary_image.width;
-    handle->m_img_ht = primary_image.height;
-    handle->m_gainmap_wd = gainmap_image.width;
-    handle->m_gainmap_ht = gainmap_image.height;
-    handle->m_gainmap_num_comp = gainmap_image.numComponents;
-    handle->m_exif = std::move(primary_image.exifData);
-    handle->m_exif_block.data = handle->m_exif.data();
-    handle->m_exif_block.data_sz = handle->m_exif_block.capacity = handle->m_exif.size();
-    handle->m_icc = std::move(primary_image.iccData);
-    handle->m_icc_block.data = handle->m_icc.data();
-    handle->m_icc_block.data_sz = handle->m_icc_block.capacity = handle->m_icc.size();
-    handle->m_base_img = std::move(primary_image.imgData);
-    handle->m_base_img_block.data = handle->m_base_img.data();
-    handle->m_base_img_block.data_sz = handle->m_base_img_block.capacity =
-        handle->m_base_img.size();
-    handle->m_gainmap_img = std::move(gainmap_image.imgData);
-    handle->m_gainmap_img_block.data = handle->m_gainmap_img.data();
-    handle->m_gainmap_img_block.data_sz = handle->m_gainmap_img_block.capacity =
-        handle->m_gainmap_img.size();
-  }
+  if (flags & UHDR_PRELOAD_TABLES) ultrahdr::JpegR::preloadTables();
+  if (flags & UHDR_PRELOAD_THREADS) ultrahdr::JpegR::preloadThreads();
+#ifdef UHDR_ENABLE_GLES
+  if (flags & UHDR_PRELOAD_GPU) return ultrahdr::preload_gl_programs();
+#endif
+  return g_no_error;
+}
 
+uhdr_error_info_t uhdr_set_trace_callback([[maybe_unused]] uhdr_trace_fn_t trace_fn,
+                                          [[maybe_unused]] void* trace_ctx) {
+#ifdef UHDR_ENABLE_TRACING
+  ultrahdr::setTraceCallback(trace_fn, trace_ctx);
+  return g_no_error;
+#else
+  uhdr_error_info_t status;
+  status.error_code = UHDR_CODEC_UNSUPPORTED_FEATURE;
+  status.has_detail = 1;
+  snprintf(status.detail, sizeof status.detail,
+           "library is built without tracing, rebuild with UHDR_ENABLE_TRACING");
   return status;
+#endif
 }
 
-int uhdr_dec_get_image_width(uhdr_codec_private_t* dec) {
-  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
-    return -1;
-  }
+uhdr_error_info_t uhdr_set_parallel_executor(uhdr_codec_private_t* codec,
+                                             uhdr_parallel_for_fn_t parallel_for,
+                                             void* executor_ctx) {
+  uhdr_error_info_t status = g_no_error;
 
-  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
-  if (!handle->m_probed || handle->m_probe_call_status.error_code != UHDR_CODEC_OK) {
-    return -1;
+  if (codec == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
   }
 
-  return handle->m_img_wd;
-}
-
-int uhdr_dec_get_image_height(uhdr_codec_private_t* dec) {
-  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
-    return -1;
+  if (codec->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(
+        status.detail, sizeof status.detail,
+        "An earlier call to uhdr_encode()/uhdr_decode() has switched the context from configurable "
+        "state to end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
   }
 
-  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
-  if (!handle->m_probed || handle->m_probe_call_status.error_code != UHDR_CODEC_OK) {
-    return -1;
-  }
+  codec->m_parallel_for = parallel_for;
+  codec->m_parallel_for_ctx = parallel_for ? executor_ctx : nullptr;
 
-  return handle->m_img_ht;
+  return status;
 }
 
-int uhdr_dec_get_gainmap_width(uhdr_codec_private_t* dec) {
-  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
-    return -1;
-  }
+uhdr_error_info_t uhdr_set_allocator(uhdr_codec_private_t* codec, uhdr_alloc_fn_t alloc_fn,
+                                     uhdr_free_fn_t free_fn, void* alloc_ctx) {
+  uhdr_error_info_t status = g_no_error;
 
-  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
-  if (!handle->m_probed || handle->m_probe_call_status.error_code != UHDR_CODEC_OK) {
-    return -1;
+  if (codec == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
   }
 
-  return handle->m_gainmap_wd;
-}
-
-int uhdr_dec_get_gainmap_height(uhdr_codec_private_t* dec) {
-  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
-    return -1;
+  if ((alloc_fn == nullptr) != (free_fn == nullptr)) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail,
+             "alloc_fn and free_fn shall be either both set or both nullptr");
+    return status;
   }
 
-  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
-  if (!handle->m_probed || handle->m_probe_call_status.error_code != UHDR_CODEC_OK) {
-    return -1;
+  if (codec->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(
+        status.detail, sizeof status.detail,
+        "An earlier call to uhdr_encode()/uhdr_decode() has switched the context from configurable "
+        "state to end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
   }
 
-  return handle->m_gainmap_ht;
+  // pooled blocks keep their own release hook, so switching allocators is safe at any time
+  codec->m_arena.setAllocator(alloc_fn, free_fn, alloc_ctx);
+
+  return status;
 }
 
-uhdr_mem_block_t* uhdr_dec_get_exif(uhdr_codec_private_t* dec) {
-  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
-    return nullptr;
-  }
+uhdr_error_info_t uhdr_set_jpeg_backend(uhdr_codec_private_t* codec,
+                                        const uhdr_jpeg_backend_t* backend) {
+  uhdr_error_info_t status = g_no_error;
 
-  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
-  if (!handle->m_probed || handle->m_probe_call_status.error_code != UHDR_CODEC_OK) {
-    return nullptr;
+  if (codec == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
   }
 
-  return &handle->m_exif_block;
-}
-
-uhdr_mem_block_t* uhdr_dec_get_icc(uhdr_codec_private_t* dec) {
-  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
-    return nullptr;
+  if (codec->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(
+        status.detail, sizeof status.detail,
+        "An earlier call to uhdr_encode()/uhdr_decode() has switched the context from configurable "
+        "state to end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
   }
 
-  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
-  if (!handle->m_probed || handle->m_probe_call_status.error_code != UHDR_CODEC_OK) {
-    return nullptr;
-  }
+  codec->m_jpeg_backend = backend != nullptr ? *backend : uhdr_jpeg_backend_t{};
 
-  return &handle->m_icc_block;
+  return status;
 }
 
-uhdr_mem_block_t* uhdr_dec_get_base_image(uhdr_codec_private_t* dec) {
-  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
-    return nullptr;
-  }
+uhdr_error_info_t uhdr_set_core_affinity(uhdr_codec_private_t* codec,
+                                        uhdr_core_affinity_t affinity) {
+  uhdr_error_info_t status = g_no_error;
 
-  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
-  if (!handle->m_probed || handle->m_probe_call_status.error_code != UHDR_CODEC_OK) {
-    return nullptr;
+  if (codec == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
   }
 
-  return &handle->m_base_img_block;
-}
-
-uhdr_mem_block_t* uhdr_dec_get_gainmap_image(uhdr_codec_private_t* dec) {
-  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
-    return nullptr;
+  if (affinity != UHDR_CORES_ANY && affinity != UHDR_CORES_PERFORMANCE &&
+      affinity != UHDR_CORES_EFFICIENCY) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "unsupported core affinity %d", affinity);
+    return status;
   }
 
-  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
-  if (!handle->m_probed || handle->m_probe_call_status.error_code != UHDR_CODEC_OK) {
-    return nullptr;
+  if (codec->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(
+        status.detail, sizeof status.detail,
+        "An earlier call to uhdr_encode()/uhdr_decode() has switched the context from configurable "
+        "state to end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
   }
 
-  return &handle->m_gainmap_img_block;
-}
+  codec->m_core_affinity = affinity;
 
-uhdr_gainmap_metadata_t* uhdr_dec_get_gainmap_metadata(uhdr_codec_private_t* dec) {
-  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
-    return nullptr;
-  }
+  return status;
+}
 
-  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
-  if (!handle->m_probed || handle->m_probe_call_status.error_code != UHDR_CODEC_OK) {
-    return nullptr;
-  }
+uhdr_jpeg_backend_t* uhdr_create_nvjpeg_backend() {
+#ifdef UHDR_ENABLE_NVJPEG
+  return ultrahdr::create_nvjpeg_backend();
+#else
+  return nullptr;
+#endif
+}
 
-  return &handle->m_metadata;
+void uhdr_release_nvjpeg_backend([[maybe_unused]] uhdr_jpeg_backend_t* backend) {
+#ifdef UHDR_ENABLE_NVJPEG
+  ultrahdr::release_nvjpeg_backend(backend);
+#endif
 }
 
-uhdr_error_info_t uhdr_decode(uhdr_codec_private_t* dec) {
-  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
-    uhdr_error_info_t status;
+uhdr_error_info_t uhdr_enable_memory_arena(uhdr_codec_private_t* codec, int enable) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (codec == nullptr) {
     status.error_code = UHDR_CODEC_INVALID_PARAM;
     status.has_detail = 1;
     snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
     return status;
   }
 
-  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
-
-  if (handle->m_sailed) {
-    return handle->m_decode_call_status;
+  if (codec->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(
+        status.detail, sizeof status.detail,
+        "An earlier call to uhdr_encode()/uhdr_decode() has switched the context from configurable "
+        "state to end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
   }
 
-  uhdr_error_info_t& status = handle->m_decode_call_status;
-  status = uhdr_dec_probe(dec);
-  if (status.error_code != UHDR_CODEC_OK) return status;
+  codec->m_arena.setPooling(enable != 0);
 
-  handle->m_sailed = true;
+  return status;
+}
+
+uhdr_error_info_t uhdr_enable_numa_placement(uhdr_codec_private_t* codec, int enable) {
+  uhdr_error_info_t status = g_no_error;
 
-  if ((handle->m_output_fmt == UHDR_IMG_FMT_32bppRGBA1010102 &&
-       (handle->m_output_ct != UHDR_CT_HLG && handle->m_output_ct != UHDR_CT_PQ)) ||
-      (handle->m_output_fmt == UHDR_IMG_FMT_64bppRGBAHalfFloat &&
-       handle->m_output_ct != UHDR_CT_LINEAR) ||
-      (handle->m_output_fmt == UHDR_IMG_FMT_32bppRGBA8888 && handle->m_output_ct != UHDR_CT_SRGB)) {
+  if (codec == nullptr) {
     status.error_code = UHDR_CODEC_INVALID_PARAM;
     status.has_detail = 1;
-    snprintf(status.detail, sizeof status.detail,
-             "unsupported output pixel format and output color transfer pair");
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
     return status;
   }
 
-  handle->m_decoded_img_buffer = std::make_unique<ultrahdr::uhdr_raw_image_ext_t>(
-      handle->m_output_fmt, UHDR_CG_UNSPECIFIED, handle->m_output_ct, UHDR_CR_UNSPECIFIED,
-      handle->m_img_wd, handle->m_img_ht, 1);
-
-  handle->m_gainmap_img_buffer = std::make_unique<ultrahdr::uhdr_raw_image_ext_t>(
-      handle->m_gainmap_num_comp == 1 ? UHDR_IMG_FMT_8bppYCbCr400 : UHDR_IMG_FMT_32bppRGBA8888,
-      UHDR_CG_UNSPECIFIED, UHDR_CT_UNSPECIFIED, UHDR_CR_UNSPECIFIED, handle->m_gainmap_wd,
-      handle->m_gainmap_ht, 1);
-
-#ifdef UHDR_ENABLE_GLES
-  ultrahdr::uhdr_opengl_ctxt_t* uhdrGLESCtxt = nullptr;
-  if (handle->m_enable_gles &&
-      (handle->m_output_ct != UHDR_CT_SRGB || handle->m_effects.size() > 0)) {
-    handle->m_uhdr_gl_ctxt.init_opengl_ctxt();
-    status = handle->m_uhdr_gl_ctxt.mErrorStatus;
-    if (status.error_code != UHDR_CODEC_OK) return status;
-    uhdrGLESCtxt = &handle->m_uhdr_gl_ctxt;
+  if (codec->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(
+        status.detail, sizeof status.detail,
+        "An earlier call to uhdr_encode()/uhdr_decode() has switched the context from configurable "
+        "state to end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
   }
-  ultrahdr::JpegR jpegr(uhdrGLESCtxt);
-#else
-  ultrahdr::JpegR jpegr;
-#endif
-
-  status =
-      jpegr.decodeJPEGR(handle->m_uhdr_compressed_img.get(), handle->m_decoded_img_buffer.get(),
-                        handle->m_output_max_disp_boost, handle->m_output_ct, handle->m_output_fmt,
-                        handle->m_gainmap_img_buffer.get(), nullptr);
 
-  if (status.error_code == UHDR_CODEC_OK && dec->m_effects.size() != 0) {
-    status = ultrahdr::apply_effects(handle);
-  }
+  codec->m_numa_placement = enable != 0;
 
-#ifdef UHDR_ENABLE_GLES
-  if (handle->m_enable_gles) {
-    if (handle->m_uhdr_gl_ctxt.mDecodedImgTexture != 0) {
-      handle->m_uhdr_gl_ctxt.read_texture(
-          &handle->m_uhdr_gl_ctxt.mDecodedImgTexture, handle->m_decoded_img_buffer->fmt,
-          handle->m_decoded_img_buffer->w, handle->m_decoded_img_buffer->h,
-          handle->m_decoded_img_buffer->planes[0]);
-    }
-    if (handle->m_uhdr_gl_ctxt.mGainmapImgTexture != 0 && dec->m_effects.size() != 0) {
-      handle->m_uhdr_gl_ctxt.read_texture(
-          &handle->m_uhdr_gl_ctxt.mGainmapImgTexture, handle->m_gainmap_img_buffer->fmt,
-          handle->m_gainmap_img_buffer->w, handle->m_gainmap_img_buffer->h,
-          handle->m_gainmap_img_buffer->planes[0]);
-    }
-  }
-#endif
   return status;
 }
 
-uhdr_raw_image_t* uhdr_get_decoded_image(uhdr_codec_private_t* dec) {
-  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
-    return nullptr;
+uhdr_error_info_t uhdr_enable_huge_pages(uhdr_codec_private_t* codec, int enable) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (codec == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
   }
 
-  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
-  if (!handle->m_sailed || handle->m_decode_call_status.error_code != UHDR_CODEC_OK) {
-    return nullptr;
+  if (codec->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(
+        status.detail, sizeof status.detail,
+        "An earlier call to uhdr_encode()/uhdr_decode() has switched the context from configurable "
+        "state to end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
   }
 
-  return handle->m_decoded_img_buffer.get();
+  codec->m_arena.setHugePages(enable != 0);
+
+  return status;
 }
 
-uhdr_raw_image_t* uhdr_get_decoded_gainmap_image(uhdr_codec_private_t* dec) {
-  if (dynamic_cast<uhdr_decoder_private*>(dec) == nullptr) {
-    return nullptr;
+uhdr_error_info_t uhdr_enable_stats(uhdr_codec_private_t* codec, int enable) {
+  uhdr_error_info_t status = g_no_error;
+
+  if (codec == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
   }
 
-  uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
-  if (!handle->m_sailed || handle->m_decode_call_status.error_code != UHDR_CODEC_OK) {
-    return nullptr;
+  if (codec->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(
+        status.detail, sizeof status.detail,
+        "An earlier call to uhdr_encode()/uhdr_decode() has switched the context from configurable "
+        "state to end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
   }
 
-  return handle->m_gainmap_img_buffer.get();
+  codec->m_stats_enabled = enable != 0;
+
+  return status;
 }
 
-void uhdr_reset_decoder(uhdr_codec_private_t* dec) {
-  if (dynamic_cast<uhdr_decoder_private*>(dec) != nullptr) {
-    uhdr_decoder_private* handle = dynamic_cast<uhdr_decoder_private*>(dec);
+uhdr_error_info_t uhdr_set_cancel_flag(uhdr_codec_private_t* codec, const int* flag) {
+  uhdr_error_info_t status = g_no_error;
 
-    // clear entries and restore defaults
-    for (auto it : handle->m_effects) delete it;
-    handle->m_effects.clear();
-#ifdef UHDR_ENABLE_GLES
-    handle->m_uhdr_gl_ctxt.reset_opengl_ctxt();
-    handle->m_enable_gles = false;
-#endif
-    handle->m_sailed = false;
-    handle->m_uhdr_compressed_img.reset();
-    handle->m_output_fmt = UHDR_IMG_FMT_64bppRGBAHalfFloat;
-    handle->m_output_ct = UHDR_CT_LINEAR;
-    handle->m_output_max_disp_boost = FLT_MAX;
+  if (codec == nullptr) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "received nullptr for uhdr codec instance");
+    return status;
+  }
 
-    // ready to be configured
-    handle->m_probed = false;
-    handle->m_decoded_img_buffer.reset();
-    handle->m_gainmap_img_buffer.reset();
-    handle->m_img_wd = 0;
-    handle->m_img_ht = 0;
-    handle->m_gainmap_wd = 0;
-    handle->m_gainmap_ht = 0;
-    handle->m_gainmap_num_comp = 0;
-    handle->m_exif.clear();
-    memset(&handle->m_exif_block, 0, sizeof handle->m_exif_block);
-    handle->m_icc.clear();
-    memset(&handle->m_icc_block, 0, sizeof handle->m_icc_block);
-    handle->m_base_img.clear();
-    memset(&handle->m_base_img_block, 0, sizeof handle->m_base_img_block);
-    handle->m_gainmap_img.clear();
-    memset(&handle->m_gainmap_img_block, 0, sizeof handle->m_gainmap_img_block);
-    memset(&handle->m_metadata, 0, sizeof handle->m_metadata);
-    handle->m_probe_call_status = g_no_error;
-    handle->m_decode_call_status = g_no_error;
+  if (codec->m_sailed) {
+    status.error_code = UHDR_CODEC_INVALID_OPERATION;
+    status.has_detail = 1;
+    snprintf(
+        status.detail, sizeof status.detail,
+        "An earlier call to uhdr_encode()/uhdr_decode() has switched the context from configurable "
+        "state to end state. The context is no longer configurable. To reuse, call reset()");
+    return status;
   }
+
+  codec->m_cancel_flag = flag;
+
+  return status;
 }
 
-uhdr_error_info_t uhdr_enable_gpu_acceleration(uhdr_codec_private_t* codec,
-                                               [[maybe_unused]] int enable) {
+uhdr_error_info_t uhdr_set_deadline(uhdr_codec_private_t* codec, unsigned int timeout_ms) {
   uhdr_error_info_t status = g_no_error;
 
   if (codec == nullptr) {
@@ -1892,9 +5901,7 @@ uhdr_error_info_t uhdr_enable_gpu_acceleration(uhdr_codec_private_t* codec,
     return status;
   }
 
-#ifdef UHDR_ENABLE_GLES
-  codec->m_enable_gles = enable;
-#endif
+  codec->m_deadline_ms = timeout_ms;
 
   return status;
 }
@@ -1994,6 +6001,11 @@ uhdr_error_info_t uhdr_add_effect_crop(uhdr_codec_private_t* codec, int left, in
 }
 
 uhdr_error_info_t uhdr_add_effect_resize(uhdr_codec_private_t* codec, int width, int height) {
+  return uhdr_add_effect_resize_with_filter(codec, width, height, UHDR_RESIZE_NEAREST);
+}
+
+uhdr_error_info_t uhdr_add_effect_resize_with_filter(uhdr_codec_private_t* codec, int width,
+                                                     int height, uhdr_resize_filter_t filter) {
   uhdr_error_info_t status = g_no_error;
 
   if (codec == nullptr) {
@@ -2003,6 +6015,13 @@ uhdr_error_info_t uhdr_add_effect_resize(uhdr_codec_private_t* codec, int width,
     return status;
   }
 
+  if (filter < UHDR_RESIZE_NEAREST || filter > UHDR_RESIZE_LANCZOS) {
+    status.error_code = UHDR_CODEC_INVALID_PARAM;
+    status.has_detail = 1;
+    snprintf(status.detail, sizeof status.detail, "unsupported resize filter %d", filter);
+    return status;
+  }
+
   if (codec->m_sailed) {
     status.error_code = UHDR_CODEC_INVALID_OPERATION;
     status.has_detail = 1;
@@ -2013,7 +6032,7 @@ uhdr_error_info_t uhdr_add_effect_resize(uhdr_codec_private_t* codec, int width,
     return status;
   }
 
-  codec->m_effects.push_back(new ultrahdr::uhdr_resize_effect_t(width, height));
+  codec->m_effects.push_back(new ultrahdr::uhdr_resize_effect_t(width, height, filter));
 
   return status;
 }
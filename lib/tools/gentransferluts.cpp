@@ -0,0 +1,88 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Generates lib/include/ultrahdr/transferfunctionluts.h, the look up tables of the transfer
+// functions. Build the ultrahdr_gen_transfer_luts target and run it with the path of the header
+// whenever a transfer function or the size of its table changes.
+
+#include <cstdio>
+
+#include "ultrahdr/gainmapmath.h"
+
+using namespace ultrahdr;
+
+static void writeTable(FILE* out, const char* name, const char* numEntriesName,
+                       int32_t numEntries, float (*computeFunc)(float)) {
+  fprintf(out, "\nalignas(64) constexpr float %s[%s] = {", name, numEntriesName);
+  for (int32_t idx = 0; idx < numEntries; idx++) {
+    float value = static_cast<float>(idx) / static_cast<float>(numEntries - 1);
+    // hexadecimal literals keep every entry bit exact
+    fprintf(out, "%s%af,", idx % 5 == 0 ? "\n    " : " ", computeFunc(value));
+  }
+  fprintf(out, "\n};\n");
+}
+
+int main(int argc, char* argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <path of transferfunctionluts.h>\n", argv[0]);
+    return 1;
+  }
+  FILE* out = fopen(argv[1], "w");
+  if (out == nullptr) {
+    fprintf(stderr, "unable to open %s for writing\n", argv[1]);
+    return 1;
+  }
+  fprintf(out,
+          "/*\n"
+          " * Copyright 2024 The Android Open Source Project\n"
+          " *\n"
+          " * Licensed under the Apache License, Version 2.0 (the \"License\");\n"
+          " * you may not use this file except in compliance with the License.\n"
+          " * You may obtain a copy of the License at\n"
+          " *\n"
+          " *      http://www.apache.org/licenses/LICENSE-2.0\n"
+          " *\n"
+          " * Unless required by applicable law or agreed to in writing, software\n"
+          " * distributed under the License is distributed on an \"AS IS\" BASIS,\n"
+          " * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.\n"
+          " * See the License for the specific language governing permissions and\n"
+          " * limitations under the License.\n"
+          " */\n"
+          "\n"
+          "// Generated by lib/tools/gentransferluts.cpp, do not edit.\n"
+          "// Look up tables of the transfer functions, entry i holds f(i / (numEntries - 1)).\n"
+          "// Only to be included by gainmapmath.cpp.\n"
+          "\n"
+          "#ifndef ULTRAHDR_TRANSFERFUNCTIONLUTS_H\n"
+          "#define ULTRAHDR_TRANSFERFUNCTIONLUTS_H\n"
+          "\n"
+          "#include \"ultrahdr/gainmapmath.h\"\n"
+          "\n"
+          "namespace ultrahdr {\n");
+  writeTable(out, "kSrgbInvOetfTable", "kSrgbInvOETFNumEntries", kSrgbInvOETFNumEntries,
+             srgbInvOetf);
+  writeTable(out, "kHlgOetfTable", "kHlgOETFNumEntries", kHlgOETFNumEntries, hlgOetf);
+  writeTable(out, "kHlgInvOetfTable", "kHlgInvOETFNumEntries", kHlgInvOETFNumEntries,
+             hlgInvOetf);
+  writeTable(out, "kPqOetfTable", "kPqOETFNumEntries", kPqOETFNumEntries, pqOetf);
+  writeTable(out, "kPqInvOetfTable", "kPqInvOETFNumEntries", kPqInvOETFNumEntries, pqInvOetf);
+  fprintf(out,
+          "\n"
+          "}  // namespace ultrahdr\n"
+          "\n"
+          "#endif  // ULTRAHDR_TRANSFERFUNCTIONLUTS_H\n");
+  return fclose(out) == 0 ? 0 : 1;
+}
@@ -18,8 +18,11 @@
 
 #include <fstream>
 #include <iostream>
+#include <vector>
 
+#include "ultrahdr/dspdispatch.h"
 #include "ultrahdr/editorhelper.h"
+#include "ultrahdr/gainmapmath.h"
 
 // #define DUMP_OUTPUT
 
@@ -486,6 +489,221 @@ TEST_P(EditorHelperTest, MultipleEffects) {
   ASSERT_EQ(crop_ht, dst->h) << msg;
 }
 
+TEST_P(EditorHelperTest, EffectChain) {
+  std::string msg = "failed for resolution " + std::to_string(width) + " x " +
+                    std::to_string(height) + " format: " + std::to_string(fmt);
+  initImageHandle(&img_a, width, height, fmt);
+  ASSERT_TRUE(loadFile(filename.c_str(), &img_a)) << "unable to load file " << filename;
+  ultrahdr::uhdr_rotate_effect_t r90(90), r180(180), r270(270);
+  ultrahdr::uhdr_mirror_effect_t mhorz(UHDR_MIRROR_HORIZONTAL), mvert(UHDR_MIRROR_VERTICAL);
+  // dimensions stay even, so the subsampled formats take every step
+  const int crop_left = 2, crop_wd = height - 4;
+  const int resize_w = (std::max)(2, (width / 2) & ~1), resize_h = crop_wd / 2;
+  ultrahdr::uhdr_crop_effect_t crop(crop_left, crop_left + crop_wd, 0, width);
+  ultrahdr::uhdr_resize_effect_t resize(resize_w, resize_h);
+
+  auto ref = apply_mirror(&mhorz, &img_a);
+  ref = apply_rotate(&r90, ref.get());
+  ref = apply_crop(&crop, ref.get(), crop_left, 0, crop_wd, width);
+  ref = apply_rotate(&r270, ref.get());
+  ref = apply_resize(&resize, ref.get(), resize_w, resize_h);
+  ref = apply_mirror(&mvert, ref.get());
+  ref = apply_rotate(&r180, ref.get());
+
+  ultrahdr::uhdr_effect_chain_t chain(width, height);
+  ASSERT_TRUE(chain.mirror(UHDR_MIRROR_HORIZONTAL)) << msg;
+  ASSERT_TRUE(chain.rotate(90)) << msg;
+  ASSERT_TRUE(chain.crop(crop_left, 0, crop_wd, width)) << msg;
+  ASSERT_TRUE(chain.rotate(270)) << msg;
+  ASSERT_TRUE(chain.resize(resize_w, resize_h)) << msg;
+  ASSERT_TRUE(chain.mirror(UHDR_MIRROR_VERTICAL)) << msg;
+  ASSERT_TRUE(chain.rotate(180)) << msg;
+  auto dst = apply_effect_chain(chain, &img_a);
+  ASSERT_NE(dst, nullptr) << msg;
+  ASSERT_NO_FATAL_FAILURE(compareImg(ref.get(), dst.get())) << msg;
+
+#ifdef UHDR_ENABLE_GLES
+  if (gl_ctxt != nullptr) {
+    Texture = opengl_ctxt->create_texture(img_a.fmt, img_a.w, img_a.h, img_a.planes[0]);
+    texture = static_cast<void*>(&Texture);
+    dst = apply_effect_chain(chain, &img_a, gl_ctxt, texture);
+    ASSERT_NE(dst, nullptr) << msg;
+    opengl_ctxt->read_texture(static_cast<GLuint*>(texture), dst->fmt, dst->w, dst->h,
+                              dst->planes[0]);
+    ASSERT_NO_FATAL_FAILURE(compareImg(ref.get(), dst.get())) << msg;
+  }
+#endif
+}
+
+TEST_P(EditorHelperTest, GainmapTransform) {
+  std::string msg = "failed for resolution " + std::to_string(width) + " x " +
+                    std::to_string(height) + " format: " + std::to_string(fmt);
+  initImageHandle(&img_a, width, height, fmt);
+  ASSERT_TRUE(loadFile(filename.c_str(), &img_a)) << "unable to load file " << filename;
+  const int crop_left = 2, crop_wd = height - 4;
+
+  // at unit scale the window is sampled at the zero crossings of the filter, no pixel changes
+  ultrahdr::uhdr_effect_chain_t chain(width, height);
+  ultrahdr::uhdr_gainmap_transform_t transform(width, height);
+  ASSERT_TRUE(chain.mirror(UHDR_MIRROR_HORIZONTAL) && transform.mirror(UHDR_MIRROR_HORIZONTAL));
+  ASSERT_TRUE(chain.rotate(90) && transform.rotate(90)) << msg;
+  ASSERT_TRUE(chain.crop(crop_left, 0, crop_wd, width) &&
+              transform.crop(crop_left, 0, crop_wd, width))
+      << msg;
+  ASSERT_TRUE(chain.rotate(270) && transform.rotate(270)) << msg;
+  ASSERT_TRUE(chain.mirror(UHDR_MIRROR_VERTICAL) && transform.mirror(UHDR_MIRROR_VERTICAL));
+  auto ref = apply_effect_chain(chain, &img_a);
+  auto dst = apply_gainmap_transform(transform, &img_a);
+  ASSERT_NE(dst, nullptr) << msg;
+  ASSERT_NO_FATAL_FAILURE(compareImg(ref.get(), dst.get())) << msg;
+
+  // a crop after a resize takes the same taps as resampling first, up to the rounding of weights
+  if (fmt != UHDR_IMG_FMT_8bppYCbCr400 && fmt != UHDR_IMG_FMT_32bppRGBA8888) return;
+  const int resize_w = height * 3 / 2, resize_h = (std::max)(2, width / 2);
+  ultrahdr::uhdr_rotate_effect_t r90(90);
+  ultrahdr::uhdr_resize_effect_t resize(resize_w, resize_h, UHDR_RESIZE_BICUBIC);
+  ultrahdr::uhdr_crop_effect_t crop(3, resize_w - 5, 1, resize_h);
+  ref = apply_rotate(&r90, &img_a);
+  ref = apply_resize(&resize, ref.get(), resize_w, resize_h);
+  ref = apply_crop(&crop, ref.get(), 3, 1, resize_w - 8, resize_h - 1);
+
+  transform = ultrahdr::uhdr_gainmap_transform_t(width, height);
+  ASSERT_TRUE(transform.rotate(90)) << msg;
+  ASSERT_TRUE(transform.resize(resize_w, resize_h, UHDR_RESIZE_BICUBIC)) << msg;
+  ASSERT_TRUE(transform.crop(3, 1, resize_w - 8, resize_h - 1)) << msg;
+  dst = apply_gainmap_transform(transform, &img_a);
+  ASSERT_NE(dst, nullptr) << msg;
+  ASSERT_EQ(ref->w, dst->w) << msg;
+  ASSERT_EQ(ref->h, dst->h) << msg;
+  const int bpp = fmt == UHDR_IMG_FMT_32bppRGBA8888 ? 4 : 1;
+  for (unsigned int i = 0; i < ref->h; i++) {
+    const uint8_t* ref_row = static_cast<uint8_t*>(ref->planes[0]) + i * ref->stride[0] * bpp;
+    const uint8_t* dst_row = static_cast<uint8_t*>(dst->planes[0]) + i * dst->stride[0] * bpp;
+    for (unsigned int j = 0; j < ref->w * bpp; j++) {
+      ASSERT_LE(std::abs(ref_row[j] - dst_row[j]), 1) << msg << " row " << i << " sample " << j;
+    }
+  }
+}
+
+TEST_P(EditorHelperTest, CropView) {
+  // odd offsets, the chroma window of the subsampled formats starts at half of them
+  const int left = 3, top = 5, crop_wd = (width - left) & ~1, crop_ht = (height - top) & ~1;
+  if (crop_wd <= 0) {
+    GTEST_SKIP() << "Test skipped as crop attributes are too large for resolution " +
+                        std::to_string(width) + " x " + std::to_string(height) +
+                        " format: " + std::to_string(fmt);
+  }
+  std::string msg = "failed for resolution " + std::to_string(width) + " x " +
+                    std::to_string(height) + " format: " + std::to_string(fmt);
+  initImageHandle(&img_a, width, height, fmt);
+  ASSERT_TRUE(loadFile(filename.c_str(), &img_a)) << "unable to load file " << filename;
+  ultrahdr::uhdr_crop_effect_t crop(left, left + crop_wd, top, top + crop_ht);
+  auto ref = apply_crop(&crop, &img_a, left, top, crop_wd, crop_ht);
+
+  auto src = copy_raw_image(&img_a);
+  ASSERT_NE(src, nullptr) << msg;
+  const uint8_t* block = static_cast<uint8_t*>(src->planes[UHDR_PLANE_Y]);
+  auto view = apply_crop(&crop, src.get(), left, top, crop_wd, crop_ht);
+  ultrahdr::uhdr_effect_chain_t chain(width, height);
+  ASSERT_TRUE(chain.crop(left, top, crop_wd, crop_ht)) << msg;
+  auto chain_view = apply_effect_chain(chain, src.get());
+  src.reset();  // the views keep the memory alive
+
+  ASSERT_TRUE(view->is_view()) << msg;
+  ASSERT_TRUE(chain_view->is_view()) << msg;
+  ASSERT_GT(static_cast<uint8_t*>(view->planes[UHDR_PLANE_Y]), block) << msg;
+  ASSERT_NO_FATAL_FAILURE(compareImg(ref.get(), view.get())) << msg;
+  ASSERT_NO_FATAL_FAILURE(compareImg(ref.get(), chain_view.get())) << msg;
+}
+
+TEST_P(EditorHelperTest, ResizeFilters) {
+  std::string msg = "failed for resolution " + std::to_string(width) + " x " +
+                    std::to_string(height) + " format: " + std::to_string(fmt);
+  initImageHandle(&img_a, width, height, fmt);
+  ASSERT_TRUE(loadFile(filename.c_str(), &img_a)) << "unable to load file " << filename;
+  for (auto filter : {UHDR_RESIZE_BILINEAR, UHDR_RESIZE_BICUBIC, UHDR_RESIZE_LANCZOS}) {
+    // at unit scale the filters sample at their zero crossings, every sample passes through
+    auto same = resample_image(&img_a, width, height, filter);
+    ASSERT_NE(same, nullptr) << msg;
+    ASSERT_NO_FATAL_FAILURE(compareImg(&img_a, same.get())) << msg << " filter " << filter;
+
+    const int dst_w = (std::max)(2, (width * 3 / 2) & ~1), dst_h = height / 4;
+    ultrahdr::uhdr_resize_effect_t resize(dst_w, dst_h, filter);
+    auto dst = apply_resize(&resize, &img_a, dst_w, dst_h);
+    ASSERT_NE(dst, nullptr) << msg;
+    ASSERT_EQ(img_a.fmt, dst->fmt) << msg;
+    ASSERT_EQ(dst_w, (int)dst->w) << msg;
+    ASSERT_EQ(dst_h, (int)dst->h) << msg;
+  }
+}
+
+TEST(EditorHelperResampleTest, Kernels) {
+  const int taps = 7, count = 77;
+  std::vector<float> data(taps * count * 4), weights(taps * count);
+  for (size_t i = 0; i < data.size(); i++) data[i] = (float)((i * 37) % 101) - 20.0f;
+  for (size_t i = 0; i < weights.size(); i++) weights[i] = (float)((i * 13) % 17) / 17.0f - 0.25f;
+
+  std::vector<const float*> rows(taps);
+  for (int k = 0; k < taps; k++) rows[k] = &data[k * count];
+  std::vector<float> dst(count * 4);
+  resampleColumns(rows.data(), weights.data(), taps, dst.data(), count);
+  for (int i = 0; i < count; i++) {
+    float ref = 0.0f;
+    for (int k = 0; k < taps; k++) ref += weights[k] * rows[k][i];
+    ASSERT_NEAR(ref, dst[i], 1e-3f) << "column " << i;
+  }
+
+  std::vector<int> starts(count);
+  for (int x = 0; x < count; x++) starts[x] = (x * 5) % (taps * count - taps);
+  resampleRowRgba(data.data(), starts.data(), weights.data(), taps, dst.data(), count);
+  for (int x = 0; x < count; x++) {
+    for (int c = 0; c < 4; c++) {
+      float ref = 0.0f;
+      for (int k = 0; k < taps; k++) ref += weights[x * taps + k] * data[(starts[x] + k) * 4 + c];
+      ASSERT_NEAR(ref, dst[x * 4 + c], 1e-3f) << "pixel " << x << " channel " << c;
+    }
+  }
+}
+
+template <typename T>
+static void checkRotateMirrorKernels(void (*mirror)(T*, T*, int, int, int, int,
+                                                    uhdr_mirror_direction_t),
+                                     void (*rotate)(T*, T*, int, int, int, int, int)) {
+  if (mirror == nullptr || rotate == nullptr) return;
+  const int sizes[][2] = {{1, 1}, {7, 3}, {16, 16}, {37, 21}, {64, 9}, {33, 65}};
+  for (auto& size : sizes) {
+    const int w = size[0], h = size[1], src_stride = w + 5, dst_stride = std::max(w, h) + 3;
+    std::vector<T> src((size_t)src_stride * h);
+    for (size_t i = 0; i < src.size(); i++) src[i] = (T)(i * 2654435761u);
+    std::vector<T> ref((size_t)dst_stride * std::max(w, h)), dst(ref.size());
+    std::string msg = std::to_string(sizeof(T)) + " byte elements, " + std::to_string(w) + " x " +
+                      std::to_string(h);
+
+    for (auto direction : {UHDR_MIRROR_HORIZONTAL, UHDR_MIRROR_VERTICAL}) {
+      std::fill(ref.begin(), ref.end(), T(0));
+      std::fill(dst.begin(), dst.end(), T(0));
+      mirror_buffer<T>(src.data(), ref.data(), w, h, src_stride, dst_stride, direction);
+      mirror(src.data(), dst.data(), w, h, src_stride, dst_stride, direction);
+      ASSERT_EQ(ref, dst) << "mirror " << direction << ", " << msg;
+    }
+    for (int degrees : {90, 180, 270}) {
+      std::fill(ref.begin(), ref.end(), T(0));
+      std::fill(dst.begin(), dst.end(), T(0));
+      rotate_buffer_clockwise<T>(src.data(), ref.data(), w, h, src_stride, dst_stride, degrees);
+      rotate(src.data(), dst.data(), w, h, src_stride, dst_stride, degrees);
+      ASSERT_EQ(ref, dst) << "rotate " << degrees << ", " << msg;
+    }
+  }
+}
+
+TEST(EditorHelperKernelTest, RotateMirror) {
+  const uhdr_dsp_functions_t& dsp = getDspFunctions();
+  checkRotateMirrorKernels<uint8_t>(dsp.mirror_uint8_t, dsp.rotate_uint8_t);
+  checkRotateMirrorKernels<uint16_t>(dsp.mirror_uint16_t, dsp.rotate_uint16_t);
+  checkRotateMirrorKernels<uint32_t>(dsp.mirror_uint32_t, dsp.rotate_uint32_t);
+  checkRotateMirrorKernels<uint64_t>(dsp.mirror_uint64_t, dsp.rotate_uint64_t);
+}
+
 INSTANTIATE_TEST_SUITE_P(
     EditorAPIParameterizedTests, EditorHelperTest,
     ::testing::Combine(::testing::Values(INPUT_IMAGE), ::testing::Range(2, 80, 2),
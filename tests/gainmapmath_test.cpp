@@ -17,6 +17,10 @@
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
 
+#include <cfloat>
+#include <random>
+
+#include "ultrahdr/dspdispatch.h"
 #include "ultrahdr/gainmapmath.h"
 
 namespace ultrahdr {
@@ -788,12 +792,12 @@ TEST_F(GainMapMathTest, YuvConversionNeon) {
   const std::array<
       std::tuple<const int16_t*, const std::array<Pixel, 5>, const std::array<Pixel, 5>>, 6>
       coeffs_setup_correct{{
-          {kYuv709To601_coeffs_neon, SrgbYuvColors, P3YuvColors},
-          {kYuv709To2100_coeffs_neon, SrgbYuvColors, Bt2100YuvColors},
-          {kYuv601To709_coeffs_neon, P3YuvColors, SrgbYuvColors},
-          {kYuv601To2100_coeffs_neon, P3YuvColors, Bt2100YuvColors},
-          {kYuv2100To709_coeffs_neon, Bt2100YuvColors, SrgbYuvColors},
-          {kYuv2100To601_coeffs_neon, Bt2100YuvColors, P3YuvColors},
+          {kYuv709To601_coeffs_q14, SrgbYuvColors, P3YuvColors},
+          {kYuv709To2100_coeffs_q14, SrgbYuvColors, Bt2100YuvColors},
+          {kYuv601To709_coeffs_q14, P3YuvColors, SrgbYuvColors},
+          {kYuv601To2100_coeffs_q14, P3YuvColors, Bt2100YuvColors},
+          {kYuv2100To709_coeffs_q14, Bt2100YuvColors, SrgbYuvColors},
+          {kYuv2100To601_coeffs_q14, Bt2100YuvColors, P3YuvColors},
       }};
 
   for (const auto& [coeff_ptr, input, expected] : coeffs_setup_correct) {
@@ -958,12 +962,12 @@ TEST_F(GainMapMathTest, TransformYuv420) {
 #if (defined(UHDR_ENABLE_INTRINSICS) && (defined(__ARM_NEON__) || defined(__ARM_NEON)))
 TEST_F(GainMapMathTest, TransformYuv420Neon) {
   const std::array<std::pair<const int16_t*, const std::array<float, 9>>, 6> fixed_floating_coeffs{
-      {{kYuv709To601_coeffs_neon, kYuvBt709ToBt601},
-       {kYuv709To2100_coeffs_neon, kYuvBt709ToBt2100},
-       {kYuv601To709_coeffs_neon, kYuvBt601ToBt709},
-       {kYuv601To2100_coeffs_neon, kYuvBt601ToBt2100},
-       {kYuv2100To709_coeffs_neon, kYuvBt2100ToBt709},
-       {kYuv2100To601_coeffs_neon, kYuvBt2100ToBt601}}};
+      {{kYuv709To601_coeffs_q14, kYuvBt709ToBt601},
+       {kYuv709To2100_coeffs_q14, kYuvBt709ToBt2100},
+       {kYuv601To709_coeffs_q14, kYuvBt601ToBt709},
+       {kYuv601To2100_coeffs_q14, kYuvBt601ToBt2100},
+       {kYuv2100To709_coeffs_q14, kYuvBt2100ToBt709},
+       {kYuv2100To601_coeffs_q14, kYuvBt2100ToBt601}}};
 
   for (const auto& [neon_coeffs_ptr, floating_point_coeffs] : fixed_floating_coeffs) {
     uhdr_raw_image_t input = Yuv420Image32x4();
@@ -1034,6 +1038,120 @@ TEST_F(GainMapMathTest, TransformYuv420Neon) {
 }
 #endif
 
+#if (defined(UHDR_ENABLE_INTRINSICS) && \
+     (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)))
+TEST_F(GainMapMathTest, TransformYuvX86) {
+  const std::array<std::pair<const int16_t*, const std::array<float, 9>>, 6> fixed_floating_coeffs{
+      {{kYuv709To601_coeffs_q14, kYuvBt709ToBt601},
+       {kYuv709To2100_coeffs_q14, kYuvBt709ToBt2100},
+       {kYuv601To709_coeffs_q14, kYuvBt601ToBt709},
+       {kYuv601To2100_coeffs_q14, kYuvBt601ToBt2100},
+       {kYuv2100To709_coeffs_q14, kYuvBt2100ToBt709},
+       {kYuv2100To601_coeffs_q14, kYuvBt2100ToBt601}}};
+  std::vector<std::pair<TransformYuvQ14Fn, TransformYuvQ14Fn>> kernels;
+  if (getDspFunctions().isa >= UHDR_ISA_SSE41) {
+    kernels.push_back({transformYuv420_sse41, transformYuv444_sse41});
+  }
+  if (getDspFunctions().isa >= UHDR_ISA_AVX2) {
+    kernels.push_back({transformYuv420_avx2, transformYuv444_avx2});
+  }
+
+  // widths that are not a multiple of the vector width leave columns to the scalar tail
+  static const size_t kWidth = 78, kHeight = 6, kStride = 80;
+  std::mt19937 rng(5);
+  std::uniform_int_distribution<int> sample(0, 255);
+  std::vector<uint8_t> input(kStride * kHeight * 3);
+  for (auto& v : input) v = static_cast<uint8_t>(sample(rng));
+
+  for (uhdr_img_fmt_t fmt : {UHDR_IMG_FMT_12bppYCbCr420, UHDR_IMG_FMT_24bppYCbCr444}) {
+    const bool is_420 = fmt == UHDR_IMG_FMT_12bppYCbCr420;
+    auto makeImage = [&](std::vector<uint8_t>& mem) {
+      uhdr_raw_image_t img;
+      img.fmt = fmt;
+      img.cg = UHDR_CG_BT_709;
+      img.ct = UHDR_CT_SRGB;
+      img.range = UHDR_CR_FULL_RANGE;
+      img.w = kWidth;
+      img.h = kHeight;
+      for (int i = 0; i < 3; i++) {
+        img.planes[i] = mem.data() + i * kStride * kHeight;
+        img.stride[i] = is_420 && i > 0 ? kStride / 2 : kStride;
+      }
+      return img;
+    };
+
+    for (const auto& [fixed_coeffs, floating_point_coeffs] : fixed_floating_coeffs) {
+      std::vector<uint8_t> ref_mem(input), float_mem(input);
+      uhdr_raw_image_t ref = makeImage(ref_mem), float_ref = makeImage(float_mem);
+      for (size_t y = 0; y < (is_420 ? kHeight / 2 : kHeight); ++y) {
+        if (is_420) {
+          transformYuv420RowQ14(&ref, fixed_coeffs, 0, y);
+        } else {
+          transformYuv444RowQ14(&ref, fixed_coeffs, 0, y);
+        }
+      }
+      if (is_420) {
+        transformYuv420(&float_ref, floating_point_coeffs);
+      } else {
+        transformYuv444(&float_ref, floating_point_coeffs);
+      }
+      // the fixed point approximation can be off by one from the floating point version
+      for (size_t i = 0; i < input.size(); i++) {
+        EXPECT_NEAR(ref_mem[i], float_mem[i], 1) << fmt << " " << i;
+      }
+
+      for (const auto& [transform_yuv420, transform_yuv444] : kernels) {
+        std::vector<uint8_t> mem(input);
+        uhdr_raw_image_t image = makeImage(mem);
+        (is_420 ? transform_yuv420 : transform_yuv444)(&image, fixed_coeffs);
+        EXPECT_EQ(mem, ref_mem) << fmt;
+      }
+    }
+  }
+}
+
+TEST_F(GainMapMathTest, ConvertRawInputToYcbcrX86) {
+  if (getDspFunctions().isa < UHDR_ISA_AVX2) GTEST_SKIP() << "avx2 is not available";
+
+  // widths that are not a multiple of the vector width leave columns to the scalar tail
+  static const size_t kWidth = 78, kHeight = 6, kStride = 80;
+  std::mt19937 rng(7);
+  std::uniform_int_distribution<uint32_t> sample;
+  std::vector<uint32_t> input(kStride * kHeight);
+  for (auto& v : input) v = sample(rng);
+
+  for (uhdr_color_gamut_t cg : {UHDR_CG_BT_709, UHDR_CG_DISPLAY_P3, UHDR_CG_BT_2100}) {
+    uhdr_raw_image_t src;
+    src.fmt = UHDR_IMG_FMT_32bppRGBA8888;
+    src.cg = cg;
+    src.ct = UHDR_CT_SRGB;
+    src.range = UHDR_CR_FULL_RANGE;
+    src.w = kWidth;
+    src.h = kHeight;
+    src.planes[UHDR_PLANE_PACKED] = input.data();
+    src.stride[UHDR_PLANE_PACKED] = kStride;
+    src.planes[UHDR_PLANE_U] = src.planes[UHDR_PLANE_V] = nullptr;
+    src.stride[UHDR_PLANE_U] = src.stride[UHDR_PLANE_V] = 0;
+
+    auto ref = convert_raw_input_to_ycbcr(&src);
+    ASSERT_NE(ref, nullptr);
+    auto dst = alloc_ycbcr_for_raw_input(&src);
+    ASSERT_NE(dst, nullptr);
+    ASSERT_EQ(convert_raw_input_to_ycbcr_avx2(&src, dst.get()).error_code, UHDR_CODEC_OK);
+    // the fixed point kernel can be off by one from the floating point version
+    for (int p = UHDR_PLANE_Y; p <= UHDR_PLANE_V; p++) {
+      for (size_t i = 0; i < kHeight; i++) {
+        for (size_t j = 0; j < kWidth; j++) {
+          const uint8_t* ref_row = static_cast<uint8_t*>(ref->planes[p]) + i * ref->stride[p];
+          const uint8_t* row = static_cast<uint8_t*>(dst->planes[p]) + i * dst->stride[p];
+          EXPECT_NEAR(row[j], ref_row[j], 1) << cg << " " << p << " " << i << " " << j;
+        }
+      }
+    }
+  }
+}
+#endif
+
 TEST_F(GainMapMathTest, HlgOetf) {
   EXPECT_FLOAT_EQ(hlgOetf(0.0f), 0.0f);
   EXPECT_NEAR(hlgOetf(0.04167f), 0.35357f, ComparisonEpsilon());
@@ -1118,6 +1236,29 @@ TEST_F(GainMapMathTest, hlgOetfLUT) {
   }
 }
 
+TEST_F(GainMapMathTest, HdrCodeLUT) {
+  auto code = [](float e) { return static_cast<int>(CLIP3(e * 1023 + 0.5f, 0.0f, 1023.0f)); };
+  // geometric steps over the whole range of the tables and past both ends
+  for (float value = 1e-10f; value < 100.0f; value *= 1.0001f) {
+    Color e = {{{value, value, value}}};
+    int hlg = hlgLinearToRgba1010102(e) & 0x3ff;
+    int pq = pqLinearToRgba1010102(e) & 0x3ff;
+    Color hlg_e = hlgOetf(hlgInverseOotfApprox(e * kSdrWhiteNits / kHlgMaxNits));
+    ASSERT_LE(abs(hlg - code(hlg_e.r)), 1) << "value " << value;
+    ASSERT_LE(abs(pq - code(pqOetf(value * kSdrWhiteNits / kPqMaxNits))), 1) << "value " << value;
+  }
+
+  // negative components are clipped, the channels are packed in order
+  Color e = {{{-1.0f, 1.0f, 1000.0f}}};
+  uint32_t hlg = hlgLinearToRgba1010102(e);
+  EXPECT_EQ(hlg & 0x3ff, 0u);
+  EXPECT_EQ((hlg >> 10) & 0x3ff, static_cast<uint32_t>(code(hlgOetf(std::pow(
+                                     kSdrWhiteNits / kHlgMaxNits, 1.0f / 1.2f)))));
+  EXPECT_EQ((hlg >> 20) & 0x3ff, 1023u);
+  EXPECT_EQ(hlg >> 30, 3u);
+  EXPECT_EQ(pqLinearToRgba1010102(e) & 0x3ff, 0u);
+}
+
 TEST_F(GainMapMathTest, srgbInvOetfLUT) {
   for (size_t idx = 0; idx < kSrgbInvOETFNumEntries; idx++) {
     float value = static_cast<float>(idx) / static_cast<float>(kSrgbInvOETFNumEntries - 1);
@@ -1241,6 +1382,184 @@ TEST_F(GainMapMathTest, applyGainLUT) {
   }
 }
 
+TEST_F(GainMapMathTest, applyGainLUTWithGamma) {
+  for (float gamma : {0.5f, 2.2f}) {
+    uhdr_gainmap_metadata_ext_t metadata;
+
+    metadata.min_content_boost = 1.0f / 2.0f;
+    metadata.max_content_boost = 8.0f;
+    metadata.gamma = gamma;
+    metadata.offset_sdr = 0.0f;
+    metadata.offset_hdr = 0.0f;
+    float weight = 0.75f;
+    GainLUT gainLUT(&metadata);
+    GainLUT gainLUTWithBoost(&metadata, weight);
+    // every 8-bit code has an entry of its own, with the gamma applied
+    for (int code = 0; code < 256; code++) {
+      float value = static_cast<float>(code) / 255.0f;
+      EXPECT_FLOAT_EQ(gainLUT.getGainFactorForCode(code), gainLUT.getGainFactor(value));
+      EXPECT_RGB_NEAR(applyGain(RgbWhite(), value, &metadata),
+                      applyGainLUT(RgbWhite(), value, gainLUT, &metadata));
+      EXPECT_RGB_NEAR(applyGain(RgbRed(), value, &metadata, weight),
+                      applyGainLUT(RgbRed(), value, gainLUTWithBoost, &metadata));
+      Color gain = {{{value, 1.0f - value, value}}};
+      EXPECT_RGB_NEAR(applyGain(RgbWhite(), gain, &metadata, weight),
+                      applyGainLUT(RgbWhite(), gain, gainLUTWithBoost, &metadata));
+    }
+  }
+}
+
+TEST_F(GainMapMathTest, GainMapTableCache) {
+  GainMapTableCache cache;
+  uhdr_gainmap_metadata_ext_t metadata;
+  metadata.min_content_boost = 1.0f;
+  metadata.max_content_boost = 4.0f;
+  metadata.gamma = 1.0f;
+  metadata.offset_sdr = 0.0f;
+  metadata.offset_hdr = 0.0f;
+
+  // same inputs share a table, other inputs get tables of their own
+  std::shared_ptr<ShepardsIDW> idw = cache.getIdwTable(4);
+  EXPECT_EQ(idw, cache.getIdwTable(4));
+  EXPECT_NE(idw, cache.getIdwTable(2));
+  EXPECT_EQ(idw->mMapScaleFactor, 4);
+  EXPECT_EQ(cache.getIdwTableFixed(4)->mMapScaleFactor, 4);
+  std::shared_ptr<GainLUT> lut = cache.getGainLUT(&metadata, 1.0f);
+  EXPECT_EQ(lut, cache.getGainLUT(&metadata, 1.0f));
+  EXPECT_NE(lut, cache.getGainLUT(&metadata, 0.5f));
+  std::shared_ptr<GainLUTFixed> lutFixed = cache.getGainLUTFixed(&metadata, 1.0f, 4.0f);
+  EXPECT_EQ(lutFixed, cache.getGainLUTFixed(&metadata, 1.0f, 4.0f));
+  EXPECT_NE(lutFixed, cache.getGainLUTFixed(&metadata, 1.0f, 2.0f));
+  std::shared_ptr<GainMapOutputLUT> outputLUT =
+      cache.getGainMapOutputLUT(&metadata, 1.0f, UHDR_CT_PQ);
+  EXPECT_EQ(outputLUT, cache.getGainMapOutputLUT(&metadata, 1.0f, UHDR_CT_PQ));
+  EXPECT_NE(outputLUT, cache.getGainMapOutputLUT(&metadata, 1.0f, UHDR_CT_HLG));
+
+  // cached tables match freshly built ones
+  GainLUT ref(&metadata, 1.0f);
+  EXPECT_EQ(0, memcmp(lut->getGainTable(), ref.getGainTable(),
+                      kGainFactorNumEntries * sizeof(float)));
+
+  // a changed metadata field misses the cache
+  metadata.gamma = 2.0f;
+  std::shared_ptr<GainLUT> lutGamma = cache.getGainLUT(&metadata, 1.0f);
+  EXPECT_NE(lut, lutGamma);
+
+  // least recently used entries are dropped, references held by callers stay valid
+  for (int scale = 5; scale < 5 + static_cast<int>(GainMapTableCache::kMaxEntries); scale++) {
+    cache.getIdwTable(scale);
+  }
+  EXPECT_NE(idw, cache.getIdwTable(4));
+  EXPECT_EQ(idw->mMapScaleFactor, 4);
+  cache.clear();
+  EXPECT_NE(lutGamma, cache.getGainLUT(&metadata, 1.0f));
+}
+
+TEST_F(GainMapMathTest, GainMapOutputLUT) {
+  // Errors of the approximation against the float pipeline, over sdr colors on a grid of 8-bit
+  // codes and gains in quarter code steps. They are measured in 10-bit output codes for hlg and pq
+  // and relative to the value for linear output. Offsets let the hdr value cross zero between two
+  // gain nodes, where pq and hlg are steepest, so outputs near black are only covered by the mean.
+  const float kNearBlack = 0.1f;
+  for (float offset : {0.0f, 1.0f / 64.0f}) {
+    uhdr_gainmap_metadata_ext_t metadata;
+    metadata.min_content_boost = 1.0f / 2.0f;
+    metadata.max_content_boost = 8.0f;
+    metadata.gamma = 1.0f;
+    metadata.offset_sdr = offset;
+    metadata.offset_hdr = offset;
+    const float weight = 0.75f;
+    GainLUT gainLUT(&metadata, weight);
+
+    for (auto ct : {UHDR_CT_HLG, UHDR_CT_PQ, UHDR_CT_LINEAR}) {
+      GainMapOutputLUT outputLUT(&metadata, weight, ct);
+      float maxError = 0.0f;
+      double sumError = 0.0;
+      size_t count = 0;
+      for (int r = 0; r < 256; r += 15) {
+        for (int g = 0; g < 256; g += 15) {
+          for (int b = 0; b < 256; b += 15) {
+            Color rgb_gamma = p3YuvToRgb(p3RgbToYuv({{{r / 255.0f, g / 255.0f, b / 255.0f}}}));
+            for (int code = 0; code < 1024; code += 7) {
+              const float gain = code / 1023.0f;
+              Color expected =
+                  applyGainLUT(srgbInvOetf(clampPixelFloat(rgb_gamma)), gain, gainLUT, &metadata);
+              if (ct == UHDR_CT_HLG) {
+                expected = hlgOetf(
+                    hlgInverseOotfApprox(clampPixelFloat(expected * kSdrWhiteNits / kHlgMaxNits)));
+              } else if (ct == UHDR_CT_PQ) {
+                expected = pqOetf(expected * kSdrWhiteNits / kPqMaxNits);
+              }
+              Color actual = outputLUT.lookup(rgb_gamma, gain);
+              const float actuals[3] = {actual.r, actual.g, actual.b};
+              const float expecteds[3] = {expected.r, expected.g, expected.b};
+              for (int i = 0; i < 3; i++) {
+                float error = std::fabs(actuals[i] - expecteds[i]);
+                if (ct == UHDR_CT_LINEAR) {
+                  error /= (std::max)(std::fabs(expecteds[i]), 1.0f / 64.0f);
+                } else {
+                  error *= 1023.0f;
+                }
+                sumError += error;
+                count++;
+                if (ct == UHDR_CT_LINEAR || expecteds[i] > kNearBlack) {
+                  maxError = (std::max)(maxError, error);
+                }
+              }
+            }
+          }
+        }
+      }
+      // at most a code for outputs above kNearBlack and a twentieth of a code on average,
+      // 0.2% and 0.05% for linear output
+      EXPECT_LE(maxError, ct == UHDR_CT_LINEAR ? 2e-3f : 1.0f)
+          << "offset " << offset << ", transfer " << ct;
+      EXPECT_LE(sumError / count, ct == UHDR_CT_LINEAR ? 5e-4f : 0.05f)
+          << "offset " << offset << ", transfer " << ct;
+    }
+  }
+}
+
+TEST_F(GainMapMathTest, SrgbTransferFunctionFixed) {
+  for (int code = 0; code < 256; code++) {
+    float linear = srgbInvOetf(static_cast<float>(code) / 255.0f);
+    EXPECT_NEAR(srgbInvOetfFixed(code), linear * kUnorm16Max, 1.0f) << code;
+    EXPECT_NEAR(srgbOetfFixed(srgbInvOetfFixed(code)), code, 1) << code;
+  }
+  for (int e = 0; e <= kUnorm16Max; e += 7) {
+    float expected = srgbOetf(static_cast<float>(e) / kUnorm16Max) * 255.0f;
+    EXPECT_NEAR(srgbOetfFixed(e), expected, 1.0f) << e;
+  }
+}
+
+TEST_F(GainMapMathTest, ApplyGainFixed) {
+  for (float gamma : {1.0f, 2.2f}) {
+    for (float displayBoost : {1.5f, 3.0f, 8.0f}) {
+      uhdr_gainmap_metadata_ext_t metadata;
+      metadata.min_content_boost = 1.0f;
+      metadata.max_content_boost = 8.0f;
+      metadata.gamma = gamma;
+      metadata.offset_sdr = 1.0f / 64.0f;
+      metadata.offset_hdr = 1.0f / 64.0f;
+      metadata.hdr_capacity_min = 1.0f;
+      metadata.hdr_capacity_max = 8.0f;
+      float weight = log2(displayBoost) / log2(metadata.hdr_capacity_max);
+      GainLUTFixed gainLUT(&metadata, weight, displayBoost);
+
+      for (int code = 0; code < 256; code += 5) {
+        float sdr = srgbInvOetf(static_cast<float>(code) / 255.0f);
+        for (int gain = 0; gain < 256; gain += 3) {
+          float value = static_cast<float>(gain) / 255.0f;
+          float hdr = applyGain({{{sdr, sdr, sdr}}}, value, &metadata, weight).r / displayBoost;
+          float expected = srgbOetf(CLIP3(hdr, 0.0f, 1.0f)) * 255.0f;
+          uint16_t e = applyGainFixed(srgbInvOetfFixed(code), gain * kGainFixedSubSteps, gainLUT);
+          EXPECT_NEAR(srgbOetfFixed(e), expected, 1.0f) << code << " " << gain;
+        }
+      }
+    }
+  }
+}
+
 TEST_F(GainMapMathTest, PqTransferFunctionRoundtrip) {
   EXPECT_FLOAT_EQ(pqInvOetf(pqOetf(0.0f)), 0.0f);
   EXPECT_NEAR(pqInvOetf(pqOetf(0.01f)), 0.01f, ComparisonEpsilon());
@@ -1327,6 +1646,36 @@ TEST_F(GainMapMathTest, EncodeGain) {
   EXPECT_EQ(affineMapGain(computeGain(1.0f, 0.5f), min_boost, max_boost, 1.0f), 0);
 }
 
+TEST_F(GainMapMathTest, FastLog2) {
+  // powers of two and 1 are exact, the neutral gain stays at the center of the quantized range
+  for (int e = -126; e < 128; e++) EXPECT_EQ(fastLog2(ldexpf(1.0f, e)), static_cast<float>(e));
+
+  // every gain ratio computeGain() can see, with its offsets, from 1e-12 to 1e12. The rounding of
+  // the result to float adds up to half an ulp.
+  for (float x = 1e-12f; x < 1e12f; x *= 1.0001f) {
+    const double expected = log2(double(x));
+    ASSERT_NEAR(fastLog2(x), expected, 3e-6 + fabs(expected) * FLT_EPSILON / 2) << "x " << x;
+  }
+
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> nits(0.0f, 10000.0f);
+  uhdr_gainmap_metadata_ext_t metadata;
+  metadata.min_content_boost = 1.0f / 4.0f;
+  metadata.max_content_boost = 16.0f;
+  const float log2_min = log2(metadata.min_content_boost);
+  const float log2_max = log2(metadata.max_content_boost);
+  for (float gamma : {1.0f, 2.2f}) {
+    metadata.gamma = gamma;
+    for (int i = 0; i < 10000; i++) {
+      const float sdr = nits(rng) / 40.0f, hdr = nits(rng);
+      EXPECT_NEAR(computeGainFast(sdr, hdr), computeGain(sdr, hdr), 1e-5f);
+      EXPECT_LE(abs(encodeGainFast(sdr, hdr, &metadata, log2_min, log2_max) -
+                    encodeGain(sdr, hdr, &metadata, log2_min, log2_max)),
+                1);
+    }
+  }
+}
+
 TEST_F(GainMapMathTest, ApplyGain) {
   uhdr_gainmap_metadata_ext_t metadata;
 
@@ -1518,6 +1867,389 @@ TEST_F(GainMapMathTest, SampleMap) {
   }
 }
 
+TEST_F(GainMapMathTest, SampleMapFixed) {
+  auto image = MapImage();
+
+  for (size_t mapScaleFactor : {1, 2, 3, 4}) {
+    ShepardsIDW idwTable(mapScaleFactor);
+    ShepardsIDWFixed idwTableFixed(idwTable);
+    for (size_t y = 0; y < 4 * mapScaleFactor; ++y) {
+      for (size_t x = 0; x < 4 * mapScaleFactor; ++x) {
+        uint32_t gain[3];
+        sampleMapFixed(&image, mapScaleFactor, x, y, idwTableFixed, gain);
+        EXPECT_NEAR(static_cast<float>(gain[0]) / (kGainFixedNumEntries - 1),
+                    sampleMap(&image, mapScaleFactor, x, y, idwTable), 1.5f / 255.0f)
+            << x << " " << y;
+      }
+    }
+  }
+}
+
+TEST_F(GainMapMathTest, SampleMapRow) {
+  // 4x4 single channel map and a 5x3 rgba map, rows padded by one pixel
+  auto grey = MapImage();
+  uint8_t rgbaPixels[6 * 3 * 4];
+  for (size_t i = 0; i < sizeof rgbaPixels; i++) rgbaPixels[i] = static_cast<uint8_t>(i * 37 + 11);
+  uhdr_raw_image_t rgba = grey;
+  rgba.fmt = UHDR_IMG_FMT_32bppRGBA8888;
+  rgba.w = 5;
+  rgba.h = 3;
+  rgba.planes[UHDR_PLANE_PACKED] = rgbaPixels;
+  rgba.stride[UHDR_PLANE_PACKED] = 6;
+  // the planar copy samples the same values
+  std::unique_ptr<uhdr_raw_image_ext_t> planar = planar_gain_map(&rgba);
+  ASSERT_NE(nullptr, planar);
+
+  for (uhdr_raw_image_t* map : {&grey, &rgba, static_cast<uhdr_raw_image_t*>(planar.get())}) {
+    const bool isGrey = map == &grey;
+    const size_t channels = isGrey ? 1 : 3;
+    uhdr_raw_image_t* interleaved = isGrey ? map : &rgba;
+    for (size_t mapScaleFactor : {1, 2, 3, 4}) {
+      ShepardsIDW idwTable(mapScaleFactor);
+      ShepardsIDWFixed idwTableFixed(idwTable);
+      // the row may extend past the map to exercise clamping, and start anywhere
+      const size_t width = (map->w + 1) * mapScaleFactor;
+      std::vector<float> gains(width * channels);
+      std::vector<uint32_t> gainsFixed(width * channels);
+      for (size_t y = 0; y < (map->h + 1) * mapScaleFactor; ++y) {
+        for (size_t x0 : {size_t(0), size_t(1)}) {
+          sampleMapRow(map, mapScaleFactor, x0, y, width - x0, idwTable, gains.data());
+          sampleMapRowFixed(map, mapScaleFactor, x0, y, width - x0, idwTableFixed,
+                            gainsFixed.data());
+          for (size_t x = x0; x < width; ++x) {
+            const float* gain = gains.data() + (x - x0) * channels;
+            const uint32_t* gainFixed = gainsFixed.data() + (x - x0) * channels;
+            uint32_t refFixed[3];
+            sampleMapFixed(interleaved, mapScaleFactor, x, y, idwTableFixed, refFixed);
+            if (isGrey) {
+              EXPECT_EQ(gain[0], sampleMap(map, mapScaleFactor, x, y, idwTable)) << x << " " << y;
+            } else {
+              Color ref = sampleMap3Channel(interleaved, mapScaleFactor, x, y, idwTable, true);
+              EXPECT_EQ(gain[0], ref.r) << x << " " << y;
+              EXPECT_EQ(gain[1], ref.g) << x << " " << y;
+              EXPECT_EQ(gain[2], ref.b) << x << " " << y;
+            }
+            for (size_t c = 0; c < channels; c++) {
+              EXPECT_EQ(gainFixed[c], refFixed[c]) << x << " " << y;
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST_F(GainMapMathTest, SampleMapRowFractional) {
+  auto grey = MapImage();
+  uint8_t rgbaPixels[6 * 3 * 4];
+  for (size_t i = 0; i < sizeof rgbaPixels; i++) rgbaPixels[i] = static_cast<uint8_t>(i * 37 + 11);
+  uhdr_raw_image_t rgba = grey;
+  rgba.fmt = UHDR_IMG_FMT_32bppRGBA8888;
+  rgba.w = 5;
+  rgba.h = 3;
+  rgba.planes[UHDR_PLANE_PACKED] = rgbaPixels;
+  rgba.stride[UHDR_PLANE_PACKED] = 6;
+  // the planar copy samples the same values
+  std::unique_ptr<uhdr_raw_image_ext_t> planar = planar_gain_map(&rgba);
+  ASSERT_NE(nullptr, planar);
+
+  for (uhdr_raw_image_t* map : {&grey, &rgba, static_cast<uhdr_raw_image_t*>(planar.get())}) {
+    const bool isGrey = map == &grey;
+    const size_t channels = isGrey ? 1 : 3;
+    uhdr_raw_image_t* interleaved = isGrey ? map : &rgba;
+    for (float mapScaleFactor : {1.5f, 2.25f, 3.7f}) {
+      const size_t width = static_cast<size_t>((map->w + 1) * mapScaleFactor);
+      MapSampleColumns columns(map, mapScaleFactor, width);
+      std::vector<float> gains(width * channels);
+      for (size_t y = 0; y < (map->h + 1) * mapScaleFactor; ++y) {
+        for (size_t x0 : {size_t(0), size_t(1)}) {
+          sampleMapRow(map, columns, x0, y, width - x0, gains.data());
+          for (size_t x = x0; x < width; ++x) {
+            const float* gain = gains.data() + (x - x0) * channels;
+            if (isGrey) {
+              EXPECT_NEAR(gain[0], sampleMap(map, mapScaleFactor, x, y), 1e-6f) << x << " " << y;
+            } else {
+              Color ref = sampleMap3Channel(interleaved, mapScaleFactor, x, y, true);
+              EXPECT_NEAR(gain[0], ref.r, 1e-6f) << x << " " << y;
+              EXPECT_NEAR(gain[1], ref.g, 1e-6f) << x << " " << y;
+              EXPECT_NEAR(gain[2], ref.b, 1e-6f) << x << " " << y;
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST_F(GainMapMathTest, FlatGainMapBlocks) {
+  // 20x12 map, 3x2 blocks
+  static const size_t kMapW = 20, kMapH = 12;
+  uint8_t pixels[kMapW * kMapH];
+  std::fill(pixels, pixels + sizeof pixels, 100);
+  uhdr_raw_image_t map = MapImage();
+  map.w = kMapW;
+  map.h = kMapH;
+  map.planes[UHDR_PLANE_Y] = pixels;
+  map.stride[UHDR_PLANE_Y] = kMapW;
+
+  FlatGainMapBlocks constant(&map, 2.0f);
+  EXPECT_EQ(constant.mBlocksW, 3u);
+  EXPECT_EQ(constant.mBlocksH, 2u);
+  EXPECT_EQ(constant.mFlatBlocks, 6u);
+  EXPECT_EQ(constant.mConstant, 100);
+
+  pixels[8 * kMapW + 12] = 7;
+  for (float mapScaleFactor : {1.0f, 2.0f, 3.0f, 2.5f}) {
+    FlatGainMapBlocks flat(&map, mapScaleFactor);
+    EXPECT_EQ(flat.mConstant, -1);
+    // the sample starts the middle block of the second block row and neighbours the one above it
+    EXPECT_EQ(flat.mFlatBlocks, 4u);
+    ShepardsIDW idwTable(static_cast<int>(mapScaleFactor));
+    MapSampleColumns columns(&map, mapScaleFactor, 32 * 3);
+    const bool integer = mapScaleFactor == floorf(mapScaleFactor);
+    const size_t width = static_cast<size_t>(kMapW * mapScaleFactor) + 3;
+    std::vector<float> gains(width);
+    for (size_t y = 0; y < kMapH * mapScaleFactor + 3; ++y) {
+      if (integer) {
+        sampleMapRow(&map, static_cast<size_t>(mapScaleFactor), 0, y, width, idwTable,
+                     gains.data());
+      } else {
+        sampleMapRow(&map, columns, 0, y, width, gains.data());
+      }
+      for (size_t x = 0; x < width;) {
+        int32_t value;
+        const size_t end = flat.span(x, y, width, value);
+        ASSERT_GT(end, x);
+        for (; x < end; x++) {
+          if (value >= 0) {
+            EXPECT_NEAR(gains[x], value / 255.0f, 1e-6f) << x << " " << y;
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST_F(GainMapMathTest, RowAccessors) {
+  static const size_t kWidth = 8, kHeight = 4, kStride = kWidth + 2, kMapScaleFactor = 2;
+  // three planes, each large enough for any of the formats, rows padded by two pixels
+  const size_t planeSize = kStride * kHeight * 8;
+  std::vector<uint8_t> mem(planeSize * 3);
+  for (size_t i = 0; i < mem.size(); i++) mem[i] = static_cast<uint8_t>(i * 37 + 11);
+
+  for (uhdr_img_fmt_t fmt :
+       {UHDR_IMG_FMT_24bppYCbCr444, UHDR_IMG_FMT_16bppYCbCr422, UHDR_IMG_FMT_12bppYCbCr420,
+        UHDR_IMG_FMT_24bppYCbCrP010, UHDR_IMG_FMT_30bppYCbCr444, UHDR_IMG_FMT_32bppRGBA8888,
+        UHDR_IMG_FMT_32bppRGBA1010102, UHDR_IMG_FMT_64bppRGBAHalfFloat, UHDR_IMG_FMT_8bppYCbCr400,
+        UHDR_IMG_FMT_24bppRGB888}) {
+    uhdr_raw_image_t image;
+    image.fmt = fmt;
+    image.cg = UHDR_CG_BT_709;
+    image.ct = UHDR_CT_SRGB;
+    image.range = UHDR_CR_LIMITED_RANGE;
+    image.w = kWidth;
+    image.h = kHeight;
+    for (int i = 0; i < 3; i++) {
+      image.planes[i] = mem.data() + i * planeSize;
+      image.stride[i] = kStride;
+    }
+
+    GetRowFn getRow = getRowFn(fmt);
+    SampleRowFn sampleRow = getSampleRowFn(fmt);
+    PutRowFn putRow = putRowFn(fmt);
+    ASSERT_EQ(getRow == nullptr, getPixelFn(fmt) == nullptr) << fmt;
+    ASSERT_EQ(sampleRow == nullptr, getSamplePixelFn(fmt) == nullptr) << fmt;
+    ASSERT_EQ(putRow == nullptr, putPixelFn(fmt) == nullptr) << fmt;
+
+    float r[kWidth], g[kWidth], b[kWidth];
+    for (size_t y = 0; y < kHeight; ++y) {
+      for (size_t x0 : {size_t(0), size_t(3)}) {
+        float* dst[3] = {r, g, b};
+        getRow(&image, x0, y, kWidth - x0, dst);
+        for (size_t x = x0; x < kWidth; ++x) {
+          Color ref = getPixelFn(fmt)(&image, x, y);
+          EXPECT_EQ(r[x - x0], ref.r) << fmt << " " << x << " " << y;
+          EXPECT_EQ(g[x - x0], ref.g) << fmt << " " << x << " " << y;
+          EXPECT_EQ(b[x - x0], ref.b) << fmt << " " << x << " " << y;
+        }
+      }
+    }
+
+    if (sampleRow != nullptr) {
+      // the 420 and p010 row samplers sum integer samples, which is exact, where the pixel
+      // samplers sum normalized floats
+      const float tolerance =
+          fmt == UHDR_IMG_FMT_12bppYCbCr420 || fmt == UHDR_IMG_FMT_24bppYCbCrP010 ? 1e-6f : 0.0f;
+      const size_t mapWidth = kWidth / kMapScaleFactor;
+      for (size_t y = 0; y < kHeight / kMapScaleFactor; ++y) {
+        float* dst[3] = {r, g, b};
+        sampleRow(&image, kMapScaleFactor, 1, y, mapWidth - 1, dst);
+        for (size_t x = 1; x < mapWidth; ++x) {
+          Color ref = getSamplePixelFn(fmt)(&image, kMapScaleFactor, x, y);
+          EXPECT_NEAR(r[x - 1], ref.r, tolerance) << fmt << " " << x << " " << y;
+          EXPECT_NEAR(g[x - 1], ref.g, tolerance) << fmt << " " << x << " " << y;
+          EXPECT_NEAR(b[x - 1], ref.b, tolerance) << fmt << " " << x << " " << y;
+        }
+      }
+    }
+
+    if (putRow != nullptr) {
+      // out of range values are clamped the same way by both
+      for (size_t x = 0; x < kWidth; ++x) {
+        r[x] = x * 0.17f - 0.1f;
+        g[x] = 1.1f - x * 0.13f;
+        b[x] = x * 0.07f;
+      }
+      std::vector<uint8_t> refMem(mem);
+      uhdr_raw_image_t refImage = image;
+      for (int i = 0; i < 3; i++) refImage.planes[i] = refMem.data() + i * planeSize;
+      for (size_t y = 0; y < kHeight; ++y) {
+        float* src[3] = {r + y, g + y, b + y};
+        putRow(&image, y, y, kWidth - y, src);
+        for (size_t x = y; x < kWidth; ++x) {
+          Color pixel = {{{r[x], g[x], b[x]}}};
+          putPixelFn(fmt)(&refImage, x, y, pixel);
+        }
+      }
+      EXPECT_EQ(mem, refMem) << fmt;
+    }
+  }
+}
+
+// The row samplers walk the image rows in spans of columns, runs of pixels wider than a span and
+// scale factors that do not divide it must sample the same boxes as the pixel samplers.
+TEST_F(GainMapMathTest, SampleRowsAcrossSpans) {
+  std::mt19937 rng(7);
+  for (size_t scale : {1, 3, 8}) {
+    const size_t mapWidth = 300 / scale + 5, mapHeight = 2;
+    const size_t width = mapWidth * scale + 2, height = mapHeight * scale + 2;
+    const size_t stride = width + 6;
+    std::vector<uint8_t> yuv(stride * height * 2);
+    std::vector<uint16_t> p010(stride * height * 2);
+    for (auto& v : yuv) v = rng() & 0xff;
+    for (auto& v : p010) v = (rng() & 0x3ff) << 6;
+
+    uhdr_raw_image_t sdr{};
+    sdr.fmt = UHDR_IMG_FMT_12bppYCbCr420;
+    sdr.w = width;
+    sdr.h = height;
+    sdr.planes[UHDR_PLANE_Y] = yuv.data();
+    sdr.planes[UHDR_PLANE_U] = yuv.data() + stride * height;
+    sdr.planes[UHDR_PLANE_V] = yuv.data() + stride * height * 3 / 2;
+    sdr.stride[UHDR_PLANE_Y] = stride;
+    sdr.stride[UHDR_PLANE_U] = stride / 2;
+    sdr.stride[UHDR_PLANE_V] = stride / 2;
+
+    uhdr_raw_image_t hdr{};
+    hdr.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+    hdr.range = UHDR_CR_LIMITED_RANGE;
+    hdr.w = width;
+    hdr.h = height;
+    hdr.planes[UHDR_PLANE_Y] = p010.data();
+    hdr.planes[UHDR_PLANE_UV] = p010.data() + stride * height;
+    hdr.stride[UHDR_PLANE_Y] = stride;
+    hdr.stride[UHDR_PLANE_UV] = stride;
+
+    std::vector<float> planes(3 * mapWidth);
+    float* dst[3] = {planes.data(), planes.data() + mapWidth, planes.data() + 2 * mapWidth};
+    for (size_t y = 0; y < mapHeight; y++) {
+      sampleYuv420Row(&sdr, scale, 1, y, mapWidth - 1, dst);
+      for (size_t x = 1; x < mapWidth; x++) {
+        Color ref = sampleYuv420(&sdr, scale, x, y);
+        ASSERT_NEAR(dst[0][x - 1], ref.y, 1e-6f) << scale << " " << x << " " << y;
+        ASSERT_NEAR(dst[1][x - 1], ref.u, 1e-6f) << scale << " " << x << " " << y;
+        ASSERT_NEAR(dst[2][x - 1], ref.v, 1e-6f) << scale << " " << x << " " << y;
+      }
+      sampleP010Row(&hdr, scale, 1, y, mapWidth - 1, dst);
+      for (size_t x = 1; x < mapWidth; x++) {
+        Color ref = sampleP010(&hdr, scale, x, y);
+        ASSERT_NEAR(dst[0][x - 1], ref.y, 1e-6f) << scale << " " << x << " " << y;
+        ASSERT_NEAR(dst[1][x - 1], ref.u, 1e-6f) << scale << " " << x << " " << y;
+        ASSERT_NEAR(dst[2][x - 1], ref.v, 1e-6f) << scale << " " << x << " " << y;
+      }
+    }
+  }
+}
+
+TEST_F(GainMapMathTest, ColorBlock) {
+  // colors slightly out of [0, 1] exercise the clamping of the conversions
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> dist(-0.1f, 1.1f);
+  ColorBlock block;
+  Color colors[kColorBlockSize];
+  for (size_t i = 0; i < kColorBlockSize; i++) {
+    colors[i] = {{{dist(rng), dist(rng), dist(rng)}}};
+  }
+  auto load = [&](size_t n) {
+    for (size_t i = 0; i < n; i++) {
+      block.r[i] = colors[i].r;
+      block.g[i] = colors[i].g;
+      block.b[i] = colors[i].b;
+    }
+  };
+  auto expectBlock = [&](ColorTransformFn fn, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+      Color ref = fn(colors[i]);
+      EXPECT_FLOAT_EQ(block.r[i], ref.r) << i;
+      EXPECT_FLOAT_EQ(block.g[i], ref.g) << i;
+      EXPECT_FLOAT_EQ(block.b[i], ref.b) << i;
+    }
+  };
+  const uhdr_color_gamut_t gamuts[] = {UHDR_CG_BT_709, UHDR_CG_DISPLAY_P3, UHDR_CG_BT_2100};
+  const uhdr_color_transfer_t transfers[] = {UHDR_CT_LINEAR, UHDR_CT_HLG, UHDR_CT_PQ, UHDR_CT_SRGB};
+
+  for (size_t n : {size_t(1), size_t(13), kColorBlockSize}) {
+    for (uhdr_color_gamut_t dst : gamuts) {
+      for (uhdr_color_gamut_t src : gamuts) {
+        load(n);
+        getGamutConversionBlockFn(dst, src)(block, n);
+        expectBlock(getGamutConversionFn(dst, src), n);
+      }
+      load(n);
+      getYuvToRgbBlockFn(dst)(block, n);
+      expectBlock(getYuvToRgbFn(dst), n);
+
+      load(n);
+      float y[kColorBlockSize];
+      getLuminanceBlockFn(dst)(block, n, y);
+      for (size_t i = 0; i < n; i++) EXPECT_FLOAT_EQ(y[i], getLuminanceFn(dst)(colors[i])) << i;
+    }
+    for (uhdr_color_transfer_t transfer : transfers) {
+      load(n);
+      getInverseOetfBlockFn(transfer)(block, n);
+      expectBlock(getInverseOetfFn(transfer), n);
+
+      load(n);
+      getOotfBlockFn(transfer)(block, n);
+      SceneToDisplayLuminanceFn ootf = getOotfFn(transfer);
+      for (size_t i = 0; i < n; i++) {
+        // the hlg ootf is not defined for negative values
+        if (colors[i].r < 0.0f || colors[i].g < 0.0f || colors[i].b < 0.0f) continue;
+        Color ref = ootf(colors[i], bt2100Luminance);
+        EXPECT_FLOAT_EQ(block.r[i], ref.r) << i;
+        EXPECT_FLOAT_EQ(block.g[i], ref.g) << i;
+        EXPECT_FLOAT_EQ(block.b[i], ref.b) << i;
+      }
+    }
+    load(n);
+    getOetfBlockFn(UHDR_CT_SRGB)(block, n);
+    expectBlock(srgbOetf, n);
+    load(n);
+    getOetfBlockFn(UHDR_CT_HLG)(block, n);
+    expectBlock(hlgOetfLUT, n);
+    load(n);
+    getOetfBlockFn(UHDR_CT_PQ)(block, n);
+    expectBlock(pqOetfLUT, n);
+
+    load(n);
+    clipNegatives(block, n);
+    expectBlock(clipNegatives, n);
+  }
+  EXPECT_EQ(getGamutConversionBlockFn(UHDR_CG_UNSPECIFIED, UHDR_CG_BT_709), nullptr);
+  EXPECT_EQ(getYuvToRgbBlockFn(UHDR_CG_UNSPECIFIED), nullptr);
+  EXPECT_EQ(getInverseOetfBlockFn(UHDR_CT_UNSPECIFIED), nullptr);
+}
+
 TEST_F(GainMapMathTest, ColorToRgba1010102) {
   EXPECT_EQ(colorToRgba1010102(RgbBlack()), 0x3 << 30);
   EXPECT_EQ(colorToRgba1010102(RgbWhite()), 0xFFFFFFFF);
@@ -1553,6 +2285,51 @@ TEST_F(GainMapMathTest, Float32ToFloat16) {
   EXPECT_EQ(floatToHalf(0x1.0p-126f), 0x0);          // float zero
 }
 
+TEST_F(GainMapMathTest, RgbaF16RowConversion) {
+  // odd count leaves a tail for the scalar code after the kernels
+  static const size_t kCount = 67;
+  std::mt19937 rng(11);
+  std::uniform_int_distribution<uint32_t> bits(0, 0xffff);
+  std::vector<uint64_t> packed(kCount);
+  for (size_t i = 0; i < kCount; i++) {
+    uint64_t px = 0;
+    for (int c = 0; c < 4; c++) {
+      uint16_t h;
+      do {
+        h = bits(rng);
+      } while ((h & 0x7c00) == 0x7c00);  // skip inf and nan
+      px |= static_cast<uint64_t>(h) << (16 * c);
+    }
+    packed[i] = px;
+  }
+  std::vector<float> r(kCount), g(kCount), b(kCount);
+  float* rgb[3] = {r.data(), g.data(), b.data()};
+  rgbaF16ToFloatRow(packed.data(), kCount, rgb);
+  for (size_t i = 0; i < kCount; i++) {
+    EXPECT_EQ(r[i], halfToFloat(packed[i] & 0xffff)) << i;
+    EXPECT_EQ(g[i], halfToFloat((packed[i] >> 16) & 0xffff)) << i;
+    EXPECT_EQ(b[i], halfToFloat((packed[i] >> 32) & 0xffff)) << i;
+  }
+
+  // normal range of half, where floatToHalf() and the kernels differ at most on rounding ties
+  std::uniform_real_distribution<float> mag(-14.0f, 15.9f);
+  for (size_t i = 0; i < kCount; i++) {
+    r[i] = std::exp2(mag(rng));
+    g[i] = -std::exp2(mag(rng));
+    b[i] = std::exp2(mag(rng));
+  }
+  std::vector<uint64_t> out(kCount);
+  floatToRgbaF16Row(rgb, kCount, out.data());
+  for (size_t i = 0; i < kCount; i++) {
+    uint64_t ref = colorToRgbaF16({{{r[i], g[i], b[i]}}});
+    for (int c = 0; c < 4; c++) {
+      int got = static_cast<int>((out[i] >> (16 * c)) & 0xffff);
+      int exp = static_cast<int>((ref >> (16 * c)) & 0xffff);
+      EXPECT_LE(std::abs(got - exp), 1) << i << " " << c;
+    }
+  }
+}
+
 TEST_F(GainMapMathTest, GenerateMapLuminanceSrgb) {
   EXPECT_FLOAT_EQ(SrgbYuvToLuminance(YuvBlack(), srgbLuminance), 0.0f);
   EXPECT_FLOAT_EQ(SrgbYuvToLuminance(YuvWhite(), srgbLuminance), kSdrWhiteNits);
@@ -1679,4 +2456,299 @@ TEST_F(GainMapMathTest, ApplyMap) {
   EXPECT_RGB_EQ(Recover(YuvWhite(), 0.0f, &metadata), RgbWhite() / 2.0f);
 }
 
+TEST_F(GainMapMathTest, ApplyGainMapRow) {
+  // every kernel the host cpu supports, not only the dispatched one
+  std::vector<ApplyGainMapRowFn> kernels;
+#if (defined(UHDR_ENABLE_INTRINSICS) && \
+     (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)))
+  if (getDspFunctions().isa >= UHDR_ISA_SSE41) kernels.push_back(applyGainMapRowYuv420_sse41);
+  if (getDspFunctions().isa >= UHDR_ISA_AVX2) kernels.push_back(applyGainMapRowYuv420_avx2);
+  if (getDspFunctions().isa >= UHDR_ISA_AVX512) kernels.push_back(applyGainMapRowYuv420_avx512);
+#else
+  if (getDspFunctions().applyGainMapRow != nullptr) {
+    kernels.push_back(getDspFunctions().applyGainMapRow);
+  }
+#endif
+  // the half precision kernel is exercised at a coarser tolerance for linear output
+  const ApplyGainMapRowFn applyGainMapRowHalf = getDspFunctions().applyGainMapRowHalf;
+  if (applyGainMapRowHalf != nullptr) kernels.push_back(applyGainMapRowHalf);
+  if (kernels.empty()) GTEST_SKIP() << "host cpu has no supported simd extension";
+
+  const size_t kMapScaleFactor = 4, kMapWidth = 13, kMapHeight = 5;
+  const size_t kWidth = kMapWidth * kMapScaleFactor, kHeight = kMapHeight * kMapScaleFactor;
+  std::mt19937 rng(1);
+  std::vector<uint8_t> yuv(kWidth * kHeight * 3 / 2), map(kMapWidth * kMapHeight);
+  for (auto& v : yuv) v = rng() & 0xff;
+  for (auto& v : map) v = rng() & 0xff;
+
+  uhdr_raw_image_t sdr{};
+  sdr.fmt = UHDR_IMG_FMT_12bppYCbCr420;
+  sdr.w = kWidth;
+  sdr.h = kHeight;
+  sdr.planes[UHDR_PLANE_Y] = yuv.data();
+  sdr.planes[UHDR_PLANE_U] = yuv.data() + kWidth * kHeight;
+  sdr.planes[UHDR_PLANE_V] = yuv.data() + kWidth * kHeight * 5 / 4;
+  sdr.stride[UHDR_PLANE_Y] = kWidth;
+  sdr.stride[UHDR_PLANE_U] = kWidth / 2;
+  sdr.stride[UHDR_PLANE_V] = kWidth / 2;
+
+  uhdr_raw_image_t gainmap{};
+  gainmap.fmt = UHDR_IMG_FMT_8bppYCbCr400;
+  gainmap.w = kMapWidth;
+  gainmap.h = kMapHeight;
+  gainmap.planes[UHDR_PLANE_Y] = map.data();
+  gainmap.stride[UHDR_PLANE_Y] = kMapWidth;
+
+  uhdr_gainmap_metadata_ext_t metadata;
+  metadata.min_content_boost = 1.0f / 2.0f;
+  metadata.max_content_boost = 6.0f;
+  metadata.offset_sdr = 1.0f / 64.0f;
+  metadata.offset_hdr = 1.0f / 64.0f;
+
+  ShepardsIDW idwTable(kMapScaleFactor);
+  std::vector<uint64_t> out(kWidth * kHeight);
+  uhdr_raw_image_t dest{};
+  dest.w = kWidth;
+  dest.h = kHeight;
+  dest.planes[UHDR_PLANE_PACKED] = out.data();
+  dest.stride[UHDR_PLANE_PACKED] = kWidth;
+
+  // without and with a conversion of the output to a wider gamut
+  std::array<float, 9> gamutMatrix;
+  getGamutConversionMatrix(bt709ToBt2100, gamutMatrix);
+
+  for (ApplyGainMapRowFn fn : kernels) {
+    const float rel_tolerance = fn == applyGainMapRowHalf ? 5e-3f : 2e-3f;
+    const float abs_tolerance = fn == applyGainMapRowHalf ? 5e-4f : 1e-4f;
+    for (float gamma : {1.0f, 2.0f}) {
+      metadata.gamma = gamma;
+      GainLUT gainLUT(&metadata, 0.75f);
+      for (auto ct : {UHDR_CT_LINEAR, UHDR_CT_HLG, UHDR_CT_PQ}) {
+        for (const float* matrix : {static_cast<const float*>(nullptr),
+                                     static_cast<const float*>(gamutMatrix.data())}) {
+          for (size_t y = 0; y < kHeight; y++) {
+            size_t count = fn(&sdr, &gainmap, &dest, kMapScaleFactor, idwTable, gainLUT, &metadata,
+                              ct, matrix, y);
+            ASSERT_GT(count, 0u);
+            ASSERT_LE(count, kWidth);
+            for (size_t x = 0; x < count; x++) {
+              Color rgb_sdr = srgbInvOetfLUT(p3YuvToRgb(getYuv420Pixel(&sdr, x, y)));
+              float gain = sampleMap(&gainmap, kMapScaleFactor, x, y, idwTable);
+              Color rgb_hdr = applyGainLUT(rgb_sdr, gain, gainLUT, &metadata);
+              if (matrix != nullptr) {
+                rgb_hdr = bt709ToBt2100(rgb_hdr);
+                if (ct != UHDR_CT_LINEAR) {
+                  rgb_hdr.r = (std::max)(rgb_hdr.r, 0.0f);
+                  rgb_hdr.g = (std::max)(rgb_hdr.g, 0.0f);
+                  rgb_hdr.b = (std::max)(rgb_hdr.b, 0.0f);
+                }
+              }
+              if (ct == UHDR_CT_LINEAR) {
+                uint64_t actual = out[x + y * kWidth];
+                uint64_t expected = colorToRgbaF16(rgb_hdr);
+                for (int shift = 0; shift < 64; shift += 16) {
+                  float a = halfToFloat((actual >> shift) & 0xffff);
+                  float e = halfToFloat((expected >> shift) & 0xffff);
+                  ASSERT_NEAR(a, e, fabs(e) * rel_tolerance + abs_tolerance)
+                      << "x " << x << " y " << y;
+                }
+              } else {
+                uint32_t actual = reinterpret_cast<uint32_t*>(out.data())[x + y * kWidth];
+                uint32_t expected = ct == UHDR_CT_HLG ? hlgLinearToRgba1010102(rgb_hdr)
+                                                      : pqLinearToRgba1010102(rgb_hdr);
+                for (int shift = 0; shift < 32; shift += 10) {
+                  int a = (actual >> shift) & 0x3ff;
+                  int e = (expected >> shift) & 0x3ff;
+                  ASSERT_LE(abs(a - e), 1) << "x " << x << " y " << y;
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST_F(GainMapMathTest, GenerateGainMapRow) {
+  // every kernel the host cpu supports, not only the dispatched one
+  std::vector<GenerateGainMapRowFn> kernels;
+#if (defined(UHDR_ENABLE_INTRINSICS) && \
+     (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)))
+  if (getDspFunctions().isa >= UHDR_ISA_SSE41) kernels.push_back(generateGainMapRow_sse41);
+  if (getDspFunctions().isa >= UHDR_ISA_AVX2) kernels.push_back(generateGainMapRow_avx2);
+  if (getDspFunctions().isa >= UHDR_ISA_AVX512) kernels.push_back(generateGainMapRow_avx512);
+#else
+  if (getDspFunctions().generateGainMapRow != nullptr) {
+    kernels.push_back(getDspFunctions().generateGainMapRow);
+  }
+#endif
+  if (kernels.empty()) GTEST_SKIP() << "host cpu has no supported simd extension";
+
+  const size_t kMapScaleFactor = 2, kMapWidth = 19, kMapHeight = 3;
+  const size_t kWidth = kMapWidth * kMapScaleFactor, kHeight = kMapHeight * kMapScaleFactor;
+  std::mt19937 rng(1);
+  std::vector<uint8_t> yuv(kWidth * kHeight * 3 / 2);
+  std::vector<uint16_t> p010(kWidth * kHeight * 3 / 2);
+  for (auto& v : yuv) v = rng() & 0xff;
+  for (auto& v : p010) v = (rng() & 0x3ff) << 6;
+
+  uhdr_raw_image_t sdr{};
+  sdr.fmt = UHDR_IMG_FMT_12bppYCbCr420;
+  sdr.cg = UHDR_CG_BT_709;
+  sdr.w = kWidth;
+  sdr.h = kHeight;
+  sdr.planes[UHDR_PLANE_Y] = yuv.data();
+  sdr.planes[UHDR_PLANE_U] = yuv.data() + kWidth * kHeight;
+  sdr.planes[UHDR_PLANE_V] = yuv.data() + kWidth * kHeight * 5 / 4;
+  sdr.stride[UHDR_PLANE_Y] = kWidth;
+  sdr.stride[UHDR_PLANE_U] = kWidth / 2;
+  sdr.stride[UHDR_PLANE_V] = kWidth / 2;
+
+  uhdr_raw_image_t hdr{};
+  hdr.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  hdr.cg = UHDR_CG_BT_2100;
+  hdr.w = kWidth;
+  hdr.h = kHeight;
+  hdr.planes[UHDR_PLANE_Y] = p010.data();
+  hdr.planes[UHDR_PLANE_UV] = p010.data() + kWidth * kHeight;
+  hdr.stride[UHDR_PLANE_Y] = kWidth;
+  hdr.stride[UHDR_PLANE_UV] = kWidth;
+
+  std::vector<float> gains(kMapWidth * 3);
+  for (GenerateGainMapRowFn fn : kernels) {
+    for (auto ct : {UHDR_CT_HLG, UHDR_CT_PQ}) {
+      hdr.ct = ct;
+      const float nits = ct == UHDR_CT_HLG ? kHlgMaxNits : kPqMaxNits;
+      for (auto range : {UHDR_CR_FULL_RANGE, UHDR_CR_LIMITED_RANGE}) {
+        hdr.range = range;
+        for (int mode = 0; mode < 3; mode++) {
+          const bool multichannel = mode == 2, use_luminance = mode == 1;
+          GainMapRowParams params;
+          ASSERT_TRUE(
+              getGainMapRowParams(&sdr, &hdr, false, use_luminance, multichannel, nits, &params));
+          for (size_t y = 0; y < kMapHeight; y++) {
+            size_t count = fn(&sdr, &hdr, params, kMapScaleFactor, kMapWidth, y, gains.data());
+            ASSERT_GT(count, 0u);
+            ASSERT_LE(count, kMapWidth);
+            for (size_t x = 0; x < count; x++) {
+              Color sdr_rgb =
+                  srgbInvOetfLUT(srgbYuvToRgb(sampleYuv420(&sdr, kMapScaleFactor, x, y)));
+              Color hdr_rgb = bt2100YuvToRgb(sampleP010(&hdr, kMapScaleFactor, x, y));
+              if (ct == UHDR_CT_HLG) {
+                hdr_rgb = hlgOotfApprox(hlgInvOetfLUT(hdr_rgb), bt2100Luminance);
+              } else {
+                hdr_rgb = pqInvOetfLUT(hdr_rgb);
+              }
+              hdr_rgb = clipNegatives(bt2100ToBt709(hdr_rgb));
+              float expected[3];
+              if (multichannel) {
+                Color sdr_nits = sdr_rgb * kSdrWhiteNits, hdr_nits = hdr_rgb * nits;
+                expected[0] = computeGain(sdr_nits.r, hdr_nits.r);
+                expected[1] = computeGain(sdr_nits.g, hdr_nits.g);
+                expected[2] = computeGain(sdr_nits.b, hdr_nits.b);
+              } else if (use_luminance) {
+                expected[0] = computeGain(srgbLuminance(sdr_rgb) * kSdrWhiteNits,
+                                          srgbLuminance(hdr_rgb) * nits);
+              } else {
+                expected[0] =
+                    computeGain(fmax(sdr_rgb.r, fmax(sdr_rgb.g, sdr_rgb.b)) * kSdrWhiteNits,
+                                fmax(hdr_rgb.r, fmax(hdr_rgb.g, hdr_rgb.b)) * nits);
+              }
+              for (int c = 0; c < (multichannel ? 3 : 1); c++) {
+                float actual = gains[x * (multichannel ? 3 : 1) + c];
+                ASSERT_NEAR(actual, expected[c], 1e-3f) << "x " << x << " y " << y << " c " << c;
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // other input combinations are left to the scalar implementation
+  GainMapRowParams params;
+  hdr.ct = UHDR_CT_LINEAR;
+  EXPECT_FALSE(getGainMapRowParams(&sdr, &hdr, false, false, false, kSdrWhiteNits, &params));
+  hdr.ct = UHDR_CT_HLG;
+  sdr.fmt = UHDR_IMG_FMT_24bppYCbCr444;
+  EXPECT_FALSE(getGainMapRowParams(&sdr, &hdr, false, false, false, kHlgMaxNits, &params));
+}
+
+TEST_F(GainMapMathTest, ToneMapRow) {
+  ToneMapRowFn toneMapRow = getDspFunctions().toneMapRow;
+  if (toneMapRow == nullptr) GTEST_SKIP() << "host cpu has no supported simd extension";
+
+  const size_t kWidth = 38, kHeight = 4;
+  std::mt19937 rng(1);
+  std::vector<uint16_t> p010(kWidth * kHeight * 3 / 2);
+  for (auto& v : p010) v = (rng() & 0x3ff) << 6;
+  std::vector<uint8_t> yuv(kWidth * kHeight * 3 / 2);
+
+  uhdr_raw_image_t hdr{};
+  hdr.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  hdr.cg = UHDR_CG_BT_2100;
+  hdr.w = kWidth;
+  hdr.h = kHeight;
+  hdr.planes[UHDR_PLANE_Y] = p010.data();
+  hdr.planes[UHDR_PLANE_UV] = p010.data() + kWidth * kHeight;
+  hdr.stride[UHDR_PLANE_Y] = kWidth;
+  hdr.stride[UHDR_PLANE_UV] = kWidth;
+
+  uhdr_raw_image_t sdr{};
+  sdr.fmt = UHDR_IMG_FMT_12bppYCbCr420;
+  sdr.w = kWidth;
+  sdr.h = kHeight;
+  sdr.planes[UHDR_PLANE_Y] = yuv.data();
+  sdr.planes[UHDR_PLANE_U] = yuv.data() + kWidth * kHeight;
+  sdr.planes[UHDR_PLANE_V] = yuv.data() + kWidth * kHeight * 5 / 4;
+  sdr.stride[UHDR_PLANE_Y] = kWidth;
+  sdr.stride[UHDR_PLANE_U] = kWidth / 2;
+  sdr.stride[UHDR_PLANE_V] = kWidth / 2;
+
+  auto to8Bit = [](float v) {
+    return std::clamp(static_cast<int>(std::round(v * 255.0f)), 0, 255);
+  };
+  for (auto ct : {UHDR_CT_HLG, UHDR_CT_PQ}) {
+    hdr.ct = ct;
+    const float headroom = (ct == UHDR_CT_HLG ? kHlgMaxNits : kPqMaxNits) / kSdrWhiteNits;
+    for (auto range : {UHDR_CR_FULL_RANGE, UHDR_CR_LIMITED_RANGE}) {
+      hdr.range = range;
+      ToneMapRowParams params;
+      ASSERT_TRUE(getToneMapRowParams(&hdr, &params));
+      for (size_t y = 0; y < kHeight; y += 2) {
+        size_t count = toneMapRow(&hdr, &sdr, params, y);
+        ASSERT_GT(count, 0u);
+        ASSERT_LE(count, kWidth);
+        for (size_t x = 0; x < count; x += 2) {
+          float u_sum = 0.0f, v_sum = 0.0f;
+          for (size_t i = 0; i < 2; i++) {
+            for (size_t j = 0; j < 2; j++) {
+              Color rgb = bt2100YuvToRgb(getP010Pixel(&hdr, x + j, y + i));
+              rgb = (ct == UHDR_CT_HLG) ? hlgOotfApprox(hlgInvOetfLUT(rgb), bt2100Luminance)
+                                        : pqInvOetfLUT(rgb);
+              GlobalTonemapOutputs tonemap = globalTonemap({rgb.r, rgb.g, rgb.b}, headroom, true);
+              Color sdr_rgb = {{{tonemap.rgb_out[0], tonemap.rgb_out[1], tonemap.rgb_out[2]}}};
+              Color sdr_yuv = p3RgbToYuv(srgbOetf(clampPixelFloat(bt2100ToP3(sdr_rgb))));
+              int actual = yuv[(y + i) * kWidth + x + j];
+              ASSERT_LE(abs(actual - to8Bit(sdr_yuv.y)), 1) << "x " << x + j << " y " << y + i;
+              u_sum += sdr_yuv.u + 0.5f;
+              v_sum += sdr_yuv.v + 0.5f;
+            }
+          }
+          const size_t chroma_idx = (y / 2) * (kWidth / 2) + x / 2;
+          int actual_u = yuv[kWidth * kHeight + chroma_idx];
+          int actual_v = yuv[kWidth * kHeight * 5 / 4 + chroma_idx];
+          ASSERT_LE(abs(actual_u - to8Bit(u_sum / 4)), 1) << "x " << x << " y " << y;
+          ASSERT_LE(abs(actual_v - to8Bit(v_sum / 4)), 1) << "x " << x << " y " << y;
+        }
+      }
+    }
+  }
+
+  hdr.ct = UHDR_CT_LINEAR;
+  ToneMapRowParams params;
+  EXPECT_FALSE(getToneMapRowParams(&hdr, &params));
+}
+
 }  // namespace ultrahdr
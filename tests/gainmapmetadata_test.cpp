@@ -15,6 +15,7 @@
  */
 
 #include <gtest/gtest.h>
+#include <cstring>
 #include <vector>
 
 #include "ultrahdr/gainmapmetadata.h"
@@ -106,4 +107,53 @@ TEST_F(GainMapMetadataTest, encodeMetadataThenDecode) {
   EXPECT_FLOAT_EQ(expected.hdr_capacity_max, decodedUHdrMetadata.hdr_capacity_max);
 }
 
+TEST_F(GainMapMetadataTest, encodeIntoBufferThenDecodeInPlace) {
+  uhdr_gainmap_metadata_ext_t expected("1.0");
+  expected.max_content_boost = 100.5f;
+  expected.min_content_boost = 1.5f;
+  expected.gamma = 1.0f;
+  expected.offset_sdr = 0.0625f;
+  expected.offset_hdr = 0.0625f;
+  expected.hdr_capacity_min = 1.0f;
+  expected.hdr_capacity_max = 10000.0f / 203.0f;
+
+  uhdr_gainmap_metadata_frac metadata;
+  EXPECT_EQ(
+      uhdr_gainmap_metadata_frac::gainmapMetadataFloatToFraction(&expected, &metadata).error_code,
+      UHDR_CODEC_OK);
+  // distinct denominators per channel, the largest packet
+  metadata.gainMapMaxD[2] += 1;
+
+  std::vector<uint8_t> data;
+  EXPECT_EQ(uhdr_gainmap_metadata_frac::encodeGainmapMetadata(&metadata, data).error_code,
+            UHDR_CODEC_OK);
+  uint8_t packet[kGainmapMetadataMaxSize];
+  size_t size = 0;
+  EXPECT_EQ(uhdr_gainmap_metadata_frac::encodeGainmapMetadata(&metadata, packet, sizeof packet,
+                                                               size)
+                .error_code,
+            UHDR_CODEC_OK);
+  ASSERT_EQ(data.size(), size);
+  EXPECT_EQ(kGainmapMetadataMaxSize, size);
+  EXPECT_EQ(0, memcmp(data.data(), packet, size));
+  EXPECT_EQ(uhdr_gainmap_metadata_frac::encodeGainmapMetadata(&metadata, packet, size - 1, size)
+                .error_code,
+            UHDR_CODEC_MEM_ERROR);
+
+  uhdr_gainmap_metadata_frac decodedMetadata;
+  EXPECT_EQ(
+      uhdr_gainmap_metadata_frac::decodeGainmapMetadata(packet, size, &decodedMetadata).error_code,
+      UHDR_CODEC_OK);
+  EXPECT_EQ(0, memcmp(metadata.gainMapMaxD, decodedMetadata.gainMapMaxD,
+                      sizeof metadata.gainMapMaxD));
+  EXPECT_EQ(metadata.alternateHdrHeadroomN, decodedMetadata.alternateHdrHeadroomN);
+  for (size_t truncated : {(size_t)0, (size_t)1, (size_t)4, size - 1}) {
+    EXPECT_EQ(uhdr_gainmap_metadata_frac::decodeGainmapMetadata(packet, truncated,
+                                                                 &decodedMetadata)
+                  .error_code,
+              UHDR_CODEC_MEM_ERROR)
+        << truncated;
+  }
+}
+
 }  // namespace ultrahdr
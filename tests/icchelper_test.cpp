@@ -57,6 +57,28 @@ TEST_F(IccHelperTest, iccWriteThenRead) {
             UHDR_CG_BT_2100);
 }
 
+TEST_F(IccHelperTest, iccProfilesAreShared) {
+  std::shared_ptr<DataStruct> icc = IccHelper::writeIccProfile(UHDR_CT_PQ, UHDR_CG_BT_2100);
+  EXPECT_EQ(icc.get(), IccHelper::writeIccProfile(UHDR_CT_PQ, UHDR_CG_BT_2100).get());
+  EXPECT_NE(icc.get(), IccHelper::writeIccProfile(UHDR_CT_HLG, UHDR_CG_BT_2100).get());
+  EXPECT_NE(icc.get(), IccHelper::writeIccProfile(UHDR_CT_PQ, UHDR_CG_DISPLAY_P3).get());
+  EXPECT_EQ(icc->getBytesWritten(), icc->getLength());
+  EXPECT_EQ(IccHelper::readIccColorGamut(icc->getData(), icc->getLength()), UHDR_CG_BT_2100);
+}
+
+TEST_F(IccHelperTest, iccReadForeignProfile) {
+  // a profile that differs from the written one outside of the parsed tags, as from another writer
+  std::shared_ptr<DataStruct> icc = IccHelper::writeIccProfile(UHDR_CT_SRGB, UHDR_CG_DISPLAY_P3);
+  std::vector<uint8_t> foreign(static_cast<uint8_t*>(icc->getData()),
+                               static_cast<uint8_t*>(icc->getData()) + icc->getLength());
+  foreign[kICCIdentifierSize + 4] ^= 0xff;
+  for (int i = 0; i < 2; i++) {
+    EXPECT_EQ(IccHelper::readIccColorGamut(foreign.data(), foreign.size()), UHDR_CG_DISPLAY_P3);
+  }
+  foreign[2] ^= 0xff;
+  EXPECT_EQ(IccHelper::readIccColorGamut(foreign.data(), foreign.size()), UHDR_CG_UNSPECIFIED);
+}
+
 TEST_F(IccHelperTest, iccEndianness) {
   std::shared_ptr<DataStruct> icc = IccHelper::writeIccProfile(UHDR_CT_SRGB, UHDR_CG_BT_709);
   size_t profile_size = icc->getLength() - kICCIdentifierSize;
@@ -16,11 +16,14 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 
 #include "ultrahdr/ultrahdrcommon.h"
 #include "ultrahdr/jpegdecoderhelper.h"
+#include "ultrahdr/jpegencoderhelper.h"
 #include "ultrahdr/icc.h"
 
 namespace ultrahdr {
@@ -148,6 +151,95 @@ TEST_F(JpegDecoderHelperTest, decodeRgbImageToRgba) {
             UHDR_CG_UNSPECIFIED);
 }
 
+TEST_F(JpegDecoderHelperTest, decodeWithFastIdct) {
+  JpegDecoderHelper refDecoder;
+  ASSERT_EQ(refDecoder.decompressImage(mYuvImage.buffer.get(), mYuvImage.size).error_code,
+            UHDR_CODEC_OK);
+  JpegDecoderHelper decoder;
+  decoder.setFastIdct(true);
+  ASSERT_EQ(decoder.decompressImage(mYuvImage.buffer.get(), mYuvImage.size).error_code,
+            UHDR_CODEC_OK);
+  ASSERT_EQ(decoder.getDecompressedImageSize(), refDecoder.getDecompressedImageSize());
+  const uint8_t* ref = static_cast<const uint8_t*>(refDecoder.getDecompressedImagePtr());
+  const uint8_t* img = static_cast<const uint8_t*>(decoder.getDecompressedImagePtr());
+  int maxDiff = 0;
+  for (size_t i = 0; i < decoder.getDecompressedImageSize(); i++) {
+    maxDiff = (std::max)(maxDiff, std::abs(ref[i] - img[i]));
+  }
+  EXPECT_LE(maxDiff, 8) << "fast idct strays too far from the accurate one";
+}
+
+TEST_F(JpegDecoderHelperTest, decodeRestartIntervalsInParallel) {
+  JpegEncoderHelper::ParallelRunner sequential = [](const std::function<void()>& job,
+                                                    unsigned int parallelism) {
+    for (unsigned int i = 0; i < parallelism; i++) job();
+  };
+  // the decoder and its segment workers are reused from image to image
+  int calls = 0;
+  JpegDecoderHelper decoder;
+  decoder.setParallelDecode(3, [&](const std::function<void()>& job, unsigned int parallelism) {
+    calls++;
+    sequential(job, parallelism);
+  });
+  for (const Image* image : {&mYuvImage, &mGreyImage, &mYuvImage}) {
+    // re-encode with a restart marker after every mcu row
+    JpegDecoderHelper source;
+    ASSERT_EQ(source.decompressImage(image->buffer.get(), image->size).error_code, UHDR_CODEC_OK);
+    uhdr_raw_image_t raw = source.getDecompressedImage();
+    JpegEncoderHelper encoder;
+    encoder.setStripEncode(1, sequential, 1);
+    ASSERT_EQ(encoder.compressImage(&raw, 90, nullptr, 0).error_code, UHDR_CODEC_OK);
+
+    JpegDecoderHelper refDecoder;
+    ASSERT_EQ(refDecoder
+                  .decompressImage(encoder.getCompressedImagePtr(),
+                                   encoder.getCompressedImageSize())
+                  .error_code,
+              UHDR_CODEC_OK);
+    calls = 0;
+    ASSERT_EQ(
+        decoder.decompressImage(encoder.getCompressedImagePtr(), encoder.getCompressedImageSize())
+            .error_code,
+        UHDR_CODEC_OK);
+    EXPECT_EQ(calls, 1) << "restart intervals were not decoded in parallel";
+    uhdr_raw_image_t ref = refDecoder.getDecompressedImage();
+    uhdr_raw_image_t img = decoder.getDecompressedImage();
+    ASSERT_EQ(img.fmt, ref.fmt);
+    ASSERT_EQ(img.w, ref.w);
+    ASSERT_EQ(img.h, ref.h);
+    ASSERT_EQ(decoder.getDecompressedImageSize(), refDecoder.getDecompressedImageSize());
+    EXPECT_EQ(0, memcmp(decoder.getDecompressedImagePtr(), refDecoder.getDecompressedImagePtr(),
+                        refDecoder.getDecompressedImageSize()));
+  }
+}
+
+TEST_F(JpegDecoderHelperTest, reuseDecoderAcrossImages) {
+  struct Input {
+    const Image* image;
+    size_t size;
+  };
+  const Input inputs[]{
+      {&mYuvImage, mYuvImage.size},   {&mGreyImage, mGreyImage.size},
+      {&mRgbImage, mRgbImage.size},   {&mYuvIccImage, mYuvIccImage.size / 2},  // truncated
+      {&mYuvImage, mYuvImage.size / 8},  // truncated
+      {&mYuvIccImage, mYuvIccImage.size}, {&mYuvImage, mYuvImage.size},
+  };
+  // a reused decoder produces the same image as a fresh one, also after a failed decode
+  JpegDecoderHelper decoder;
+  for (const Input& in : inputs) {
+    JpegDecoderHelper refDecoder;
+    uhdr_codec_err_t refStatus =
+        refDecoder.decompressImage(in.image->buffer.get(), in.size).error_code;
+    ASSERT_EQ(decoder.decompressImage(in.image->buffer.get(), in.size).error_code, refStatus);
+    if (refStatus != UHDR_CODEC_OK) continue;
+    ASSERT_EQ(decoder.getDecompressedImageWidth(), refDecoder.getDecompressedImageWidth());
+    ASSERT_EQ(decoder.getDecompressedImageHeight(), refDecoder.getDecompressedImageHeight());
+    ASSERT_EQ(decoder.getDecompressedImageSize(), refDecoder.getDecompressedImageSize());
+    EXPECT_EQ(0, memcmp(decoder.getDecompressedImagePtr(), refDecoder.getDecompressedImagePtr(),
+                        refDecoder.getDecompressedImageSize()));
+  }
+}
+
 TEST_F(JpegDecoderHelperTest, getCompressedImageParameters) {
   JpegDecoderHelper decoder;
   EXPECT_EQ(decoder.parseImage(mYuvImage.buffer.get(), mYuvImage.size).error_code, UHDR_CODEC_OK);
@@ -169,4 +261,71 @@ TEST_F(JpegDecoderHelperTest, getCompressedImageParametersIcc) {
             UHDR_CG_BT_709);
 }
 
+TEST_F(JpegDecoderHelperTest, metadataBlocksReferToInput) {
+  JpegDecoderHelper decoder;
+  const uint8_t* begin = mYuvIccImage.buffer.get();
+  const uint8_t* end = begin + mYuvIccImage.size;
+  EXPECT_EQ(decoder.decompressImage(begin, mYuvIccImage.size, DECODE_TO_YCBCR_CS).error_code,
+            UHDR_CODEC_OK);
+  const uint8_t* icc = static_cast<const uint8_t*>(decoder.getICCPtr());
+  const uint8_t* exif = static_cast<const uint8_t*>(decoder.getEXIFPtr());
+  ASSERT_GT(decoder.getICCSize(), 0);
+  ASSERT_GT(decoder.getEXIFSize(), 0);
+  EXPECT_TRUE(icc > begin && icc + decoder.getICCSize() <= end);
+  EXPECT_TRUE(exif > begin && exif + decoder.getEXIFSize() <= end);
+  EXPECT_EQ(decoder.getEXIFPos(), exif - begin);
+  // payloads start at their signature, right after the segment length
+  EXPECT_EQ(0, memcmp(exif, "Exif\0\0", 6));
+  EXPECT_EQ(0xE1, exif[-3]);
+  EXPECT_EQ(decoder.getEXIFSize() + 2, static_cast<size_t>((exif[-2] << 8) | exif[-1]));
+
+  // views are dropped along with the previous bitstream
+  EXPECT_EQ(decoder.parseImage(mYuvImage.buffer.get(), mYuvImage.size).error_code, UHDR_CODEC_OK);
+  EXPECT_EQ(decoder.getICCSize(), 0);
+  EXPECT_EQ(decoder.getEXIFSize(), 0);
+  EXPECT_EQ(decoder.getEXIFPos(), -1);
+}
+
+TEST_F(JpegDecoderHelperTest, decodeStreamedInput) {
+  const uint8_t* image = mYuvIccImage.buffer.get();
+  JpegDecoderHelper refDecoder;
+  ASSERT_EQ(refDecoder.decompressImage(image, mYuvIccImage.size).error_code, UHDR_CODEC_OK);
+
+  // uneven pieces, with empty ones in between
+  size_t offset = 0, pieces = 0;
+  JpegDecoderHelper::InputPuller pull = [&](const uint8_t*& data, size_t& length) {
+    if (offset == mYuvIccImage.size) return false;
+    length = (pieces++ % 3 == 0) ? 0 : (std::min)(mYuvIccImage.size - offset, (size_t)777);
+    data = image + offset;
+    offset += length;
+    return true;
+  };
+  JpegDecoderHelper decoder;
+  ASSERT_EQ(decoder.decompressStream(pull).error_code, UHDR_CODEC_OK);
+  EXPECT_GT(pieces, 3u);
+  ASSERT_EQ(decoder.getDecompressedImageWidth(), refDecoder.getDecompressedImageWidth());
+  ASSERT_EQ(decoder.getDecompressedImageHeight(), refDecoder.getDecompressedImageHeight());
+  ASSERT_EQ(decoder.getDecompressedImageSize(), refDecoder.getDecompressedImageSize());
+  EXPECT_EQ(0, memcmp(decoder.getDecompressedImagePtr(), refDecoder.getDecompressedImagePtr(),
+                      refDecoder.getDecompressedImageSize()));
+
+  // metadata is located once the bitstream is in place
+  EXPECT_EQ(decoder.getICCSize(), 0);
+  ASSERT_EQ(decoder.attachBitstream(image, mYuvIccImage.size).error_code, UHDR_CODEC_OK);
+  EXPECT_EQ(decoder.getICCSize(), refDecoder.getICCSize());
+  EXPECT_EQ(decoder.getEXIFPos(), refDecoder.getEXIFPos());
+
+  // input that ends early is terminated as libjpeg's own sources do
+  offset = 0;
+  pieces = 0;
+  JpegDecoderHelper::InputPuller truncated = [&](const uint8_t*& data, size_t& length) {
+    if (offset >= mYuvIccImage.size / 2) return false;
+    length = 1000;
+    data = image + offset;
+    offset += length;
+    return true;
+  };
+  EXPECT_EQ(decoder.decompressStream(truncated).error_code, UHDR_CODEC_OK);
+}
+
 }  // namespace ultrahdr
@@ -21,6 +21,7 @@
 
 #include "ultrahdr/ultrahdrcommon.h"
 #include "ultrahdr/jpegencoderhelper.h"
+#include "ultrahdr/jpegdecoderhelper.h"
 
 namespace ultrahdr {
 
@@ -134,6 +135,185 @@ TEST_F(JpegEncoderHelperTest, encodeUnalignedImage) {
   ASSERT_GT(encoder.getCompressedImageSize(), static_cast<uint32_t>(0));
 }
 
+TEST_F(JpegEncoderHelperTest, encodeImageInStrips) {
+  const uint8_t* yPlane = mUnalignedImage.buffer.get();
+  const uint8_t* uPlane = yPlane + mUnalignedImage.width * mUnalignedImage.height;
+  const uint8_t* vPlane = uPlane + mUnalignedImage.width * mUnalignedImage.height / 4;
+  const uint8_t* planes[3]{yPlane, uPlane, vPlane};
+  const unsigned int strides[3]{mUnalignedImage.width, mUnalignedImage.width / 2,
+                                mUnalignedImage.width / 2};
+  JpegEncoderHelper refEncoder;
+  ASSERT_EQ(refEncoder
+                .compressImage(planes, strides, mUnalignedImage.width, mUnalignedImage.height,
+                               UHDR_IMG_FMT_12bppYCbCr420, JPEG_QUALITY, NULL, 0)
+                .error_code,
+            UHDR_CODEC_OK);
+  JpegDecoderHelper refDecoder;
+  ASSERT_EQ(refDecoder
+                .decompressImage(refEncoder.getCompressedImagePtr(),
+                                 refEncoder.getCompressedImageSize())
+                .error_code,
+            UHDR_CODEC_OK);
+
+  // strips are 32 rows high and the last one is partial
+  for (unsigned int parallelism : {1u, 3u}) {
+    int calls = 0;
+    JpegEncoderHelper encoder;
+    encoder.setStripEncode(
+        parallelism,
+        [&calls](const std::function<void()>& job, unsigned int count) {
+          calls++;
+          for (unsigned int i = 0; i < count; i++) job();
+        },
+        2);
+    ASSERT_EQ(encoder
+                  .compressImage(planes, strides, mUnalignedImage.width, mUnalignedImage.height,
+                                 UHDR_IMG_FMT_12bppYCbCr420, JPEG_QUALITY, NULL, 0)
+                  .error_code,
+              UHDR_CODEC_OK);
+    ASSERT_EQ(calls, 1);
+    JpegDecoderHelper decoder;
+    ASSERT_EQ(
+        decoder.decompressImage(encoder.getCompressedImagePtr(), encoder.getCompressedImageSize())
+            .error_code,
+        UHDR_CODEC_OK);
+    ASSERT_EQ(decoder.getDecompressedImageWidth(), mUnalignedImage.width);
+    ASSERT_EQ(decoder.getDecompressedImageHeight(), mUnalignedImage.height);
+    // restart markers reset dc prediction only, the coded blocks match a single pass encode
+    ASSERT_EQ(decoder.getDecompressedImageSize(), refDecoder.getDecompressedImageSize());
+    ASSERT_EQ(0, memcmp(decoder.getDecompressedImagePtr(), refDecoder.getDecompressedImagePtr(),
+                        refDecoder.getDecompressedImageSize()));
+  }
+}
+
+TEST_F(JpegEncoderHelperTest, encodeRGBImageInStrips) {
+  const uint8_t* planes[1]{mRgbImage.buffer.get()};
+  const unsigned int strides[1]{mRgbImage.width};
+  JpegEncoderHelper refEncoder;
+  ASSERT_EQ(refEncoder
+                .compressImage(planes, strides, mRgbImage.width, mRgbImage.height,
+                               UHDR_IMG_FMT_24bppRGB888, JPEG_QUALITY, NULL, 0)
+                .error_code,
+            UHDR_CODEC_OK);
+  JpegDecoderHelper refDecoder;
+  ASSERT_EQ(refDecoder
+                .decompressImage(refEncoder.getCompressedImagePtr(),
+                                 refEncoder.getCompressedImageSize())
+                .error_code,
+            UHDR_CODEC_OK);
+
+  // strips are 24 rows high, one mcu row is 8 rows for rgb input
+  JpegEncoderHelper encoder;
+  encoder.setStripEncode(
+      2,
+      [](const std::function<void()>& job, unsigned int count) {
+        for (unsigned int i = 0; i < count; i++) job();
+      },
+      3);
+  ASSERT_EQ(encoder
+                .compressImage(planes, strides, mRgbImage.width, mRgbImage.height,
+                               UHDR_IMG_FMT_24bppRGB888, JPEG_QUALITY, NULL, 0)
+                .error_code,
+            UHDR_CODEC_OK);
+  JpegDecoderHelper decoder;
+  ASSERT_EQ(
+      decoder.decompressImage(encoder.getCompressedImagePtr(), encoder.getCompressedImageSize())
+          .error_code,
+      UHDR_CODEC_OK);
+  ASSERT_EQ(decoder.getDecompressedImageWidth(), mRgbImage.width);
+  ASSERT_EQ(decoder.getDecompressedImageHeight(), mRgbImage.height);
+  ASSERT_EQ(decoder.getDecompressedImageSize(), refDecoder.getDecompressedImageSize());
+  ASSERT_EQ(0, memcmp(decoder.getDecompressedImagePtr(), refDecoder.getDecompressedImagePtr(),
+                      refDecoder.getDecompressedImageSize()));
+}
+
+TEST_F(JpegEncoderHelperTest, encodeWithPresets) {
+  const uint8_t* yPlane = mAlignedImage.buffer.get();
+  const uint8_t* uPlane = yPlane + mAlignedImage.width * mAlignedImage.height;
+  const uint8_t* vPlane = uPlane + mAlignedImage.width * mAlignedImage.height / 4;
+  const uint8_t* planes[3]{yPlane, uPlane, vPlane};
+  const unsigned int strides[3]{mAlignedImage.width, mAlignedImage.width / 2,
+                                mAlignedImage.width / 2};
+  JpegEncoderHelper refEncoder;
+  ASSERT_EQ(refEncoder
+                .compressImage(planes, strides, mAlignedImage.width, mAlignedImage.height,
+                               UHDR_IMG_FMT_12bppYCbCr420, JPEG_QUALITY, NULL, 0)
+                .error_code,
+            UHDR_CODEC_OK);
+  for (uhdr_enc_preset_t preset : {UHDR_USAGE_REALTIME, UHDR_USAGE_BEST_QUALITY}) {
+    JpegEncoderHelper encoder;
+    encoder.setPreset(preset);
+    ASSERT_EQ(encoder
+                  .compressImage(planes, strides, mAlignedImage.width, mAlignedImage.height,
+                                 UHDR_IMG_FMT_12bppYCbCr420, JPEG_QUALITY, NULL, 0)
+                  .error_code,
+              UHDR_CODEC_OK);
+    JpegDecoderHelper decoder;
+    ASSERT_EQ(
+        decoder.decompressImage(encoder.getCompressedImagePtr(), encoder.getCompressedImageSize())
+            .error_code,
+        UHDR_CODEC_OK);
+    ASSERT_EQ(decoder.getDecompressedImageWidth(), mAlignedImage.width);
+    ASSERT_EQ(decoder.getDecompressedImageHeight(), mAlignedImage.height);
+    if (preset == UHDR_USAGE_BEST_QUALITY) {
+      // same coefficients, optimized huffman tables
+      EXPECT_LT(encoder.getCompressedImageSize(), refEncoder.getCompressedImageSize());
+    }
+  }
+}
+
+TEST_F(JpegEncoderHelperTest, reuseEncoderAcrossImages) {
+  const uint8_t* yPlane = mAlignedImage.buffer.get();
+  const uint8_t* uPlane = yPlane + mAlignedImage.width * mAlignedImage.height;
+  const uint8_t* vPlane = uPlane + mAlignedImage.width * mAlignedImage.height / 4;
+  const uint8_t* yuvPlanes[3]{yPlane, uPlane, vPlane};
+  const unsigned int yuvStrides[3]{mAlignedImage.width, mAlignedImage.width / 2,
+                                   mAlignedImage.width / 2};
+  const uint8_t* greyPlanes[1]{mSingleChannelImage.buffer.get()};
+  const unsigned int greyStrides[1]{mSingleChannelImage.width};
+  const uint8_t* rgbPlanes[1]{mRgbImage.buffer.get()};
+  const unsigned int rgbStrides[1]{mRgbImage.width};
+  struct Input {
+    const uint8_t** planes;
+    const unsigned int* strides;
+    int width, height;
+    uhdr_img_fmt_t format;
+    int qfactor;
+  };
+  const Input inputs[]{
+      {yuvPlanes, yuvStrides, (int)mAlignedImage.width, (int)mAlignedImage.height,
+       UHDR_IMG_FMT_12bppYCbCr420, JPEG_QUALITY},
+      {yuvPlanes, yuvStrides, (int)mAlignedImage.width, (int)mAlignedImage.height,
+       UHDR_IMG_FMT_12bppYCbCr420, 50},
+      {greyPlanes, greyStrides, (int)mSingleChannelImage.width, (int)mSingleChannelImage.height,
+       UHDR_IMG_FMT_8bppYCbCr400, JPEG_QUALITY},
+      {rgbPlanes, rgbStrides, (int)mRgbImage.width, (int)mRgbImage.height,
+       UHDR_IMG_FMT_24bppRGB888, JPEG_QUALITY},
+      {yuvPlanes, yuvStrides, 0, (int)mAlignedImage.height, UHDR_IMG_FMT_12bppYCbCr420,
+       JPEG_QUALITY},  // rejected by libjpeg
+      {yuvPlanes, yuvStrides, (int)mAlignedImage.width, (int)mAlignedImage.height,
+       UHDR_IMG_FMT_12bppYCbCr420, JPEG_QUALITY},
+  };
+  // a reused encoder produces the same stream as a fresh one, also after a failed encode
+  JpegEncoderHelper encoder;
+  for (const Input& in : inputs) {
+    JpegEncoderHelper refEncoder;
+    uhdr_codec_err_t refStatus = refEncoder
+                                     .compressImage(in.planes, in.strides, in.width, in.height,
+                                                    in.format, in.qfactor, NULL, 0)
+                                     .error_code;
+    ASSERT_EQ(encoder
+                  .compressImage(in.planes, in.strides, in.width, in.height, in.format,
+                                 in.qfactor, NULL, 0)
+                  .error_code,
+              refStatus);
+    if (refStatus != UHDR_CODEC_OK) continue;
+    ASSERT_EQ(encoder.getCompressedImageSize(), refEncoder.getCompressedImageSize());
+    EXPECT_EQ(0, memcmp(encoder.getCompressedImagePtr(), refEncoder.getCompressedImagePtr(),
+                        refEncoder.getCompressedImageSize()));
+  }
+}
+
 TEST_F(JpegEncoderHelperTest, encodeSingleChannelImage) {
   JpegEncoderHelper encoder;
   const uint8_t* yPlane = mSingleChannelImage.buffer.get();
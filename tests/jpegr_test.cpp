@@ -17,16 +17,34 @@
 #ifdef _WIN32
 #include <windows.h>
 #else
+#include <fcntl.h>
 #include <sys/time.h>
+#include <unistd.h>
 #endif
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <filesystem>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
 
 #include "ultrahdr_api.h"
+#include "ultrahdr_api.hpp"
 
 #include "ultrahdr/ultrahdrcommon.h"
+#include "ultrahdr/decodercache.h"
+#include "ultrahdr/editorhelper.h"
+#include "ultrahdr/gainmapmath.h"
 #include "ultrahdr/jpegr.h"
 #include "ultrahdr/jpegrutils.h"
 
@@ -1434,6 +1452,6475 @@ TEST(JpegRTest, writeXmpThenRead) {
   EXPECT_FLOAT_EQ(metadata_expected.hdr_capacity_max, metadata_read.hdr_capacity_max);
 }
 
+TEST(JpegRTest, writeXmpIntoBuffer) {
+  uhdr_gainmap_metadata_ext_t metadata("1.0");
+  metadata.max_content_boost = 4.0f;
+  metadata.min_content_boost = 0.5f;
+  metadata.gamma = 1.5f;
+  metadata.offset_sdr = 0.015625f;
+  metadata.offset_hdr = 0.03125f;
+  metadata.hdr_capacity_min = 1.0f;
+  metadata.hdr_capacity_max = metadata.max_content_boost;
+
+  const std::string primary = generateXmpForPrimaryImage(123456, metadata);
+  const std::string secondary = generateXmpForSecondaryImage(metadata);
+  EXPECT_NE(std::string::npos, primary.find("Item:Length=\"123456\""));
+  EXPECT_NE(std::string::npos, secondary.find("hdrgm:GainMapMin=\"-1\""));
+  EXPECT_NE(std::string::npos, secondary.find("hdrgm:OffsetSDR=\"0.015625\""));
+
+  char packet[kXmpPacketMaxSize];
+  ASSERT_EQ(primary.size(), writeXmpForPrimaryImage(packet, primary.size(), 123456, metadata));
+  EXPECT_EQ(0, memcmp(primary.data(), packet, primary.size()));
+  EXPECT_EQ(0u, writeXmpForPrimaryImage(packet, primary.size() - 1, 123456, metadata));
+  ASSERT_EQ(secondary.size(), writeXmpForSecondaryImage(packet, secondary.size(), metadata));
+  EXPECT_EQ(0, memcmp(secondary.data(), packet, secondary.size()));
+  EXPECT_EQ(0u, writeXmpForSecondaryImage(packet, secondary.size() - 1, metadata));
+
+  uhdr_gainmap_metadata_ext_t metadata_read;
+  const std::string nameSpace = "http://ns.adobe.com/xap/1.0/";
+  std::vector<uint8_t> xmpData(nameSpace.begin(), nameSpace.end());
+  xmpData.push_back('\0');
+  xmpData.insert(xmpData.end(), secondary.begin(), secondary.end());
+  ASSERT_EQ(getMetadataFromXMP(xmpData.data(), xmpData.size(), &metadata_read).error_code,
+            UHDR_CODEC_OK);
+  EXPECT_FLOAT_EQ(metadata.min_content_boost, metadata_read.min_content_boost);
+  EXPECT_FLOAT_EQ(metadata.offset_hdr, metadata_read.offset_hdr);
+}
+
+TEST(JpegRTest, mergeXmpForPrimaryImage) {
+  uhdr_gainmap_metadata_ext_t metadata("1.0");
+  metadata.max_content_boost = 4.0f;
+  metadata.min_content_boost = 0.5f;
+  metadata.gamma = 1.0f;
+  metadata.offset_sdr = 0.015625f;
+  metadata.offset_hdr = 0.015625f;
+  metadata.hdr_capacity_min = 1.0f;
+  metadata.hdr_capacity_max = 4.0f;
+
+  // a packet of the library itself is regenerated as it would be written from scratch
+  const std::string fresh = generateXmpForPrimaryImage(2000, metadata);
+  EXPECT_EQ(fresh, mergeXmpForPrimaryImage(generateXmpForPrimaryImage(1000, metadata), 2000,
+                                           metadata));
+
+  // properties of other namespaces stay, the gain map ones are replaced
+  std::string edited = generateXmpForPrimaryImage(1000, metadata);
+  const std::string extraAttributes =
+      "\n      xmlns:xmp=\"http://ns.adobe.com/xap/1.0/\""
+      "\n      xmlns:dc=\"http://purl.org/dc/elements/1.1/\""
+      "\n      xmp:Rating='4'";
+  const std::string extraElement =
+      "\n      <dc:creator>\n        <rdf:Seq>\n          <rdf:li>A. Photographer</rdf:li>\n"
+      "        </rdf:Seq>\n      </dc:creator>";
+  const std::string description = "<rdf:Description";
+  edited.insert(edited.find(description) + description.size(), extraAttributes);
+  edited.insert(edited.find('>', edited.find("hdrgm:Version")) + 1, extraElement);
+  std::string expected = fresh;
+  expected.insert(expected.find(description) + description.size(), extraAttributes);
+  expected.insert(expected.find('>', expected.find("hdrgm:Version")) + 1, extraElement);
+  EXPECT_EQ(expected, mergeXmpForPrimaryImage(edited, 2000, metadata));
+
+  // stale gain map elements are dropped, a directory is added where there was none
+  const std::string packet =
+      "<x:xmpmeta xmlns:x=\"adobe:ns:meta/\">\n"
+      "  <rdf:RDF xmlns:rdf=\"http://www.w3.org/1999/02/22-rdf-syntax-ns#\">\n"
+      "    <rdf:Description xmlns:hdrgm=\"http://ns.adobe.com/hdr-gain-map/1.0/\"\n"
+      "      xmlns:xmp=\"http://ns.adobe.com/xap/1.0/\" xmp:Label=\"a > b\">\n"
+      "      <!-- <Container:Directory/> -->\n"
+      "      <hdrgm:Version>0.9</hdrgm:Version>\n"
+      "    </rdf:Description>\n"
+      "    <rdf:Description xmlns:tiff=\"http://ns.adobe.com/tiff/1.0/\" tiff:Orientation=\"1\"/>\n"
+      "  </rdf:RDF>\n"
+      "</x:xmpmeta>\n";
+  const std::string merged = mergeXmpForPrimaryImage(packet, 2000, metadata);
+  ASSERT_FALSE(merged.empty());
+  EXPECT_EQ(std::string::npos, merged.find("0.9"));
+  EXPECT_NE(std::string::npos, merged.find("xmp:Label=\"a > b\""));
+  EXPECT_NE(std::string::npos, merged.find("<!-- <Container:Directory/> -->"));
+  EXPECT_NE(std::string::npos, merged.find("tiff:Orientation=\"1\"/>"));
+  EXPECT_NE(std::string::npos, merged.find("hdrgm:Version=\"1.0\""));
+  EXPECT_NE(std::string::npos, merged.find("Item:Length=\"2000\""));
+  EXPECT_EQ(merged.find("xmlns:hdrgm"), merged.rfind("xmlns:hdrgm"));
+
+  // without a description to carry the metadata there is nothing to merge into
+  EXPECT_TRUE(mergeXmpForPrimaryImage("<x:xmpmeta xmlns:x=\"adobe:ns:meta/\"/>", 2000, metadata)
+                  .empty());
+  EXPECT_TRUE(mergeXmpForPrimaryImage("<x:xmpmeta><rdf:Description a=\"1", 2000, metadata).empty());
+}
+
+TEST(JpegRTest, readXmpLayouts) {
+  uhdr_gainmap_metadata_ext_t metadata_expected;
+  metadata_expected.version = "1.0";
+  metadata_expected.max_content_boost = 4.0f;
+  metadata_expected.min_content_boost = 0.5f;
+  metadata_expected.gamma = 1.5f;
+  metadata_expected.offset_sdr = 0.015625f;
+  metadata_expected.offset_hdr = 0.03125f;
+  metadata_expected.hdr_capacity_min = 1.0f;
+  metadata_expected.hdr_capacity_max = metadata_expected.max_content_boost;
+  const std::string xmp = generateXmpForSecondaryImage(metadata_expected);
+
+  auto read = [](const std::string& packet, uhdr_gainmap_metadata_ext_t* metadata) {
+    const std::string nameSpace = "http://ns.adobe.com/xap/1.0/";
+    std::vector<uint8_t> xmpData(nameSpace.begin(), nameSpace.end());
+    xmpData.push_back('\0');
+    xmpData.insert(xmpData.end(), packet.begin(), packet.end());
+    return getMetadataFromXMP(xmpData.data(), xmpData.size(), metadata).error_code;
+  };
+  auto replace = [&xmp](const std::string& from, const std::string& to) {
+    std::string packet = xmp;
+    const size_t pos = packet.find(from);
+    EXPECT_NE(std::string::npos, pos) << from;
+    if (pos != std::string::npos) packet.replace(pos, from.size(), to);
+    return packet;
+  };
+
+  // the layout as written is read without the xml parser, others go through it. Both agree.
+  const std::string packets[] = {
+      xmp,
+      "<?xpacket begin=\"\"?>" + xmp + "<?xpacket end=\"w\"?>   ",
+      replace("hdrgm:Gamma=\"1.5\"", "hdrgm:Gamma = '+1.5'"),
+      replace("hdrgm:Gamma=\"1.5\"", "hdrgm:Gamma=\"+1.5\""),
+      replace("hdrgm:Gamma=\"1.5\"", "hdrgm:Gamma=\"15E-1\""),
+      replace("hdrgm:Gamma=\"1.5\"", "hdrgm:Gamma=\"1.50\""),
+      replace("/x:xmpmeta", "rdf:Description/></x:xmpmeta"),
+  };
+  for (const std::string& packet : packets) {
+    SCOPED_TRACE(packet);
+    uhdr_gainmap_metadata_ext_t metadata_read;
+    ASSERT_EQ(UHDR_CODEC_OK, read(packet, &metadata_read));
+    EXPECT_EQ(metadata_expected.version, metadata_read.version);
+    EXPECT_FLOAT_EQ(metadata_expected.max_content_boost, metadata_read.max_content_boost);
+    EXPECT_FLOAT_EQ(metadata_expected.min_content_boost, metadata_read.min_content_boost);
+    EXPECT_FLOAT_EQ(metadata_expected.gamma, metadata_read.gamma);
+    EXPECT_FLOAT_EQ(metadata_expected.offset_sdr, metadata_read.offset_sdr);
+    EXPECT_FLOAT_EQ(metadata_expected.offset_hdr, metadata_read.offset_hdr);
+    EXPECT_FLOAT_EQ(metadata_expected.hdr_capacity_min, metadata_read.hdr_capacity_min);
+    EXPECT_FLOAT_EQ(metadata_expected.hdr_capacity_max, metadata_read.hdr_capacity_max);
+  }
+
+  // absent optional fields take defaults
+  {
+    uhdr_gainmap_metadata_ext_t metadata_read;
+    ASSERT_EQ(UHDR_CODEC_OK, read(replace("hdrgm:Gamma=\"1.5\"", ""), &metadata_read));
+    EXPECT_FLOAT_EQ(1.0f, metadata_read.gamma);
+  }
+
+  // missing required fields and values that are not numbers are rejected
+  const std::string badPackets[] = {
+      replace("hdrgm:Version=\"1.0\"", ""),
+      replace("hdrgm:Gamma=\"1.5\"", "hdrgm:Gamma=\"gamma\""),
+      replace("hdrgm:Gamma=\"1.5\"", "hdrgm:Gamma=\"inf\""),
+      replace("hdrgm:BaseRenditionIsHDR=\"False\"", "hdrgm:BaseRenditionIsHDR=\"True\""),
+  };
+  for (const std::string& packet : badPackets) {
+    SCOPED_TRACE(packet);
+    uhdr_gainmap_metadata_ext_t metadata_read;
+    ASSERT_NE(UHDR_CODEC_OK, read(packet, &metadata_read));
+  }
+}
+
+TEST(JpegRTest, EncodeOutputFormats) {
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_NE(nullptr, enc);
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM,
+            uhdr_enc_set_output_format(nullptr, UHDR_CODEC_JPG).error_code);
+  for (uhdr_codec_t codec :
+       {UHDR_CODEC_HEIF, UHDR_CODEC_AVIF, static_cast<uhdr_codec_t>(UHDR_CODEC_AVIF + 1)}) {
+    uhdr_error_info_t status = uhdr_enc_set_output_format(enc, codec);
+    ASSERT_EQ(UHDR_CODEC_UNSUPPORTED_FEATURE, status.error_code) << codec;
+    ASSERT_EQ(1, status.has_detail);
+  }
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_output_format(enc, UHDR_CODEC_JPG).error_code);
+  uhdr_release_encoder(enc);
+}
+
+/* Test output is independent of the number of threads used */
+TEST(JpegRTest, EncodeAndDecodeWithNumThreads) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_NE(UHDR_CODEC_OK, uhdr_enc_set_num_threads(nullptr, 1).error_code)
+      << "fail, API allows nullptr encoder instance";
+  ASSERT_NE(UHDR_CODEC_OK, uhdr_enc_set_num_threads(enc, -1).error_code)
+      << "fail, API allows negative thread count";
+  ASSERT_NE(UHDR_CODEC_OK, uhdr_enc_set_num_threads(enc, kNumThreadsMax + 1).error_code)
+      << "fail, API allows thread count beyond max";
+
+  std::vector<uint8_t> refStream;
+  std::vector<uint8_t> refDecoded;
+  for (int numThreads : {0, 1, 3, 8}) {
+    uhdr_reset_encoder(enc);
+    uhdr_error_info_t status = uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    status = uhdr_enc_set_num_threads(enc, numThreads);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    status = uhdr_encode(enc);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_enc_set_num_threads(enc, 1).error_code)
+        << "fail, API allows configuration after encode";
+    uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+    ASSERT_NE(nullptr, compressedImage);
+    uint8_t* streamData = static_cast<uint8_t*>(compressedImage->data);
+    std::vector<uint8_t> stream(streamData, streamData + compressedImage->data_sz);
+
+    uhdr_codec_private_t* dec = uhdr_create_decoder();
+    status = uhdr_dec_set_image(dec, compressedImage);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    status = uhdr_dec_set_num_threads(dec, numThreads);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    status = uhdr_decode(dec);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    uhdr_raw_image_t* decoded = uhdr_get_decoded_image(dec);
+    ASSERT_NE(nullptr, decoded);
+    uint8_t* decodedData = static_cast<uint8_t*>(decoded->planes[UHDR_PLANE_PACKED]);
+    std::vector<uint8_t> decodedBytes(
+        decodedData, decodedData + (size_t)decoded->stride[UHDR_PLANE_PACKED] * decoded->h * 8);
+    uhdr_release_decoder(dec);
+
+    if (numThreads == 0) {
+      refStream = std::move(stream);
+      refDecoded = std::move(decodedBytes);
+    } else {
+      ASSERT_EQ(refStream, stream) << "encoded output differs for num threads " << numThreads;
+      ASSERT_EQ(refDecoded, decodedBytes) << "decoded output differs for num threads "
+                                          << numThreads;
+    }
+  }
+
+  // external executor, runs jobs sequentially on the calling thread
+  struct ExecutorStats {
+    int calls = 0;
+    int jobs = 0;
+  } stats;
+  uhdr_parallel_for_fn_t sequentialFor = [](void* executor_ctx, int begin, int end,
+                                            uhdr_job_fn_t job, void* job_ctx) {
+    auto* stats = static_cast<ExecutorStats*>(executor_ctx);
+    stats->calls++;
+    for (int i = begin; i < end; i++, stats->jobs++) job(job_ctx, i);
+  };
+  uhdr_reset_encoder(enc);
+  uhdr_error_info_t status = uhdr_set_parallel_executor(enc, sequentialFor, &stats);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_enc_set_num_threads(enc, 4);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_encode(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  ASSERT_NE(UHDR_CODEC_OK, uhdr_set_parallel_executor(enc, nullptr, nullptr).error_code)
+      << "fail, API allows configuration after encode";
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+  uint8_t* streamData = static_cast<uint8_t*>(compressedImage->data);
+  ASSERT_EQ(refStream, std::vector<uint8_t>(streamData, streamData + compressedImage->data_sz));
+  ASSERT_GT(stats.calls, 0) << "executor was not used";
+  ASSERT_EQ(stats.jobs, stats.calls * 4);
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, EncodeAndDecodeWithPresets) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  ASSERT_NE(UHDR_CODEC_OK, uhdr_dec_enable_fast_idct(nullptr, 1).error_code)
+      << "fail, API allows nullptr decoder instance";
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  for (uhdr_enc_preset_t preset : {UHDR_USAGE_REALTIME, UHDR_USAGE_BEST_QUALITY}) {
+    uhdr_reset_encoder(enc);
+    uhdr_error_info_t status = uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    status = uhdr_enc_set_preset(enc, preset);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    status = uhdr_encode(enc);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+    ASSERT_NE(nullptr, compressedImage);
+
+    uhdr_codec_private_t* dec = uhdr_create_decoder();
+    status = uhdr_dec_set_image(dec, compressedImage);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    status = uhdr_dec_enable_fast_idct(dec, preset == UHDR_USAGE_REALTIME);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    status = uhdr_decode(dec);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_dec_enable_fast_idct(dec, 0).error_code)
+        << "fail, API allows configuration after decode";
+    uhdr_raw_image_t* decoded = uhdr_get_decoded_image(dec);
+    ASSERT_NE(nullptr, decoded);
+    ASSERT_EQ((unsigned int)kImageWidth, decoded->w);
+    ASSERT_EQ((unsigned int)kImageHeight, decoded->h);
+    uhdr_release_decoder(dec);
+  }
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, EncodeWithBorrowedRawImages) {
+  UhdrUnCompressedStructWrapper rawImgP010(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImgP010.allocateMemory());
+  ASSERT_TRUE(rawImgP010.loadRawResource(kYCbCrP010FileName));
+  UhdrUnCompressedStructWrapper rawImg420(kImageWidth, kImageHeight, YCbCr_420);
+  ASSERT_TRUE(rawImg420.allocateMemory());
+  ASSERT_TRUE(rawImg420.loadRawResource(kYCbCr420FileName));
+
+  uhdr_raw_image_t hdrImg{};
+  hdrImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  hdrImg.cg = UHDR_CG_BT_2100;
+  hdrImg.ct = UHDR_CT_HLG;
+  hdrImg.range = UHDR_CR_LIMITED_RANGE;
+  hdrImg.w = kImageWidth;
+  hdrImg.h = kImageHeight;
+  hdrImg.planes[UHDR_PLANE_Y] = rawImgP010.getImageHandle()->data;
+  hdrImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  hdrImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImgP010.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  hdrImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  // bt709 sdr intent is converted to bt601 during encode
+  uhdr_raw_image_t sdrImg{};
+  sdrImg.fmt = UHDR_IMG_FMT_12bppYCbCr420;
+  sdrImg.cg = UHDR_CG_BT_709;
+  sdrImg.ct = UHDR_CT_SRGB;
+  sdrImg.range = UHDR_CR_FULL_RANGE;
+  sdrImg.w = kImageWidth;
+  sdrImg.h = kImageHeight;
+  uint8_t* sdrData = static_cast<uint8_t*>(rawImg420.getImageHandle()->data);
+  sdrImg.planes[UHDR_PLANE_Y] = sdrData;
+  sdrImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  sdrImg.planes[UHDR_PLANE_U] = sdrData + kImageWidth * kImageHeight;
+  sdrImg.stride[UHDR_PLANE_U] = kImageWidth / 2;
+  sdrImg.planes[UHDR_PLANE_V] = sdrData + kImageWidth * kImageHeight * 5 / 4;
+  sdrImg.stride[UHDR_PLANE_V] = kImageWidth / 2;
+  const std::vector<uint8_t> sdrRef(sdrData, sdrData + kImageWidth * kImageHeight * 3 / 2);
+
+  std::vector<uint8_t> refStream;
+  for (bool borrow : {false, true}) {
+    auto setRawImage = borrow ? uhdr_enc_set_raw_image_ref : uhdr_enc_set_raw_image;
+    uhdr_codec_private_t* enc = uhdr_create_encoder();
+    ASSERT_NE(UHDR_CODEC_OK, uhdr_enc_set_raw_image_ref(enc, nullptr, UHDR_HDR_IMG).error_code)
+        << "fail, API allows nullptr raw image";
+    uhdr_error_info_t status = setRawImage(enc, &hdrImg, UHDR_HDR_IMG);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    status = setRawImage(enc, &sdrImg, UHDR_SDR_IMG);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    status = uhdr_encode(enc);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+    ASSERT_NE(nullptr, compressedImage);
+    uint8_t* streamData = static_cast<uint8_t*>(compressedImage->data);
+    std::vector<uint8_t> stream(streamData, streamData + compressedImage->data_sz);
+    uhdr_release_encoder(enc);
+
+    ASSERT_EQ(0, memcmp(sdrRef.data(), sdrData, sdrRef.size()))
+        << "encoder modified the caller's sdr intent, borrow " << borrow;
+    if (!borrow) {
+      refStream = std::move(stream);
+    } else {
+      ASSERT_EQ(refStream, stream) << "borrowed inputs produced a different stream";
+    }
+  }
+}
+
+// Gain maps of large images are compressed in strips, the stream does not depend on the thread
+// count
+TEST(JpegRTest, EncodeLargeGainMapInStrips) {
+  const unsigned int kWidth = 2048, kHeight = 1024;
+  std::vector<uint16_t> p010((size_t)kWidth * kHeight * 3 / 2);
+  for (unsigned int y = 0; y < kHeight; y++) {
+    for (unsigned int x = 0; x < kWidth; x++) {
+      p010[(size_t)y * kWidth + x] = (uint16_t)((64 + (x + y) * 876 / (kWidth + kHeight)) << 6);
+    }
+  }
+  for (size_t i = (size_t)kWidth * kHeight; i < p010.size(); i += 2) {
+    p010[i] = (uint16_t)((512 - 40) << 6);
+    p010[i + 1] = (uint16_t)((512 + 40) << 6);
+  }
+  uhdr_raw_image_t hdrImg{};
+  hdrImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  hdrImg.cg = UHDR_CG_BT_2100;
+  hdrImg.ct = UHDR_CT_HLG;
+  hdrImg.range = UHDR_CR_LIMITED_RANGE;
+  hdrImg.w = kWidth;
+  hdrImg.h = kHeight;
+  hdrImg.planes[UHDR_PLANE_Y] = p010.data();
+  hdrImg.stride[UHDR_PLANE_Y] = kWidth;
+  hdrImg.planes[UHDR_PLANE_UV] = p010.data() + (size_t)kWidth * kHeight;
+  hdrImg.stride[UHDR_PLANE_UV] = kWidth;
+
+  uhdr_codec_private_t* encs[2];
+  const int numThreads[2] = {1, 4};
+  for (int i = 0; i < 2; i++) {
+    encs[i] = uhdr_create_encoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(encs[i], &hdrImg, UHDR_HDR_IMG).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_gainmap_scale_factor(encs[i], 1).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_using_multi_channel_gainmap(encs[i], 1).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_preset(encs[i], UHDR_USAGE_REALTIME).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_num_threads(encs[i], numThreads[i]).error_code);
+    uhdr_error_info_t status = uhdr_encode(encs[i]);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  }
+  uhdr_compressed_image_t* streams[2] = {uhdr_get_encoded_stream(encs[0]),
+                                         uhdr_get_encoded_stream(encs[1])};
+  ASSERT_NE(nullptr, streams[0]);
+  ASSERT_NE(nullptr, streams[1]);
+  ASSERT_EQ(streams[0]->data_sz, streams[1]->data_sz);
+  ASSERT_EQ(0, memcmp(streams[0]->data, streams[1]->data, streams[0]->data_sz));
+
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, streams[0]).error_code);
+  uhdr_error_info_t status = uhdr_decode(dec);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_raw_image_t* gainmap = uhdr_get_decoded_gainmap_image(dec);
+  ASSERT_NE(nullptr, gainmap);
+  ASSERT_EQ(kWidth, gainmap->w);
+  ASSERT_EQ(kHeight, gainmap->h);
+
+  uhdr_release_decoder(dec);
+  for (int i = 0; i < 2; i++) uhdr_release_encoder(encs[i]);
+}
+
+TEST(JpegRTest, EncodeWithGainMapTileSizes) {
+  UhdrUnCompressedStructWrapper rawImgP010(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImgP010.allocateMemory());
+  ASSERT_TRUE(rawImgP010.loadRawResource(kYCbCrP010FileName));
+  UhdrUnCompressedStructWrapper rawImg420(kImageWidth, kImageHeight, YCbCr_420);
+  ASSERT_TRUE(rawImg420.allocateMemory());
+  ASSERT_TRUE(rawImg420.loadRawResource(kYCbCr420FileName));
+
+  uhdr_raw_image_t hdrImg{};
+  hdrImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  hdrImg.cg = UHDR_CG_BT_2100;
+  hdrImg.ct = UHDR_CT_HLG;
+  hdrImg.range = UHDR_CR_LIMITED_RANGE;
+  hdrImg.w = kImageWidth;
+  hdrImg.h = kImageHeight;
+  hdrImg.planes[UHDR_PLANE_Y] = rawImgP010.getImageHandle()->data;
+  hdrImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  hdrImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImgP010.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  hdrImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  uhdr_raw_image_t sdrImg{};
+  sdrImg.fmt = UHDR_IMG_FMT_12bppYCbCr420;
+  sdrImg.cg = UHDR_CG_BT_709;
+  sdrImg.ct = UHDR_CT_SRGB;
+  sdrImg.range = UHDR_CR_FULL_RANGE;
+  sdrImg.w = kImageWidth;
+  sdrImg.h = kImageHeight;
+  uint8_t* sdrData = static_cast<uint8_t*>(rawImg420.getImageHandle()->data);
+  sdrImg.planes[UHDR_PLANE_Y] = sdrData;
+  sdrImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  sdrImg.planes[UHDR_PLANE_U] = sdrData + kImageWidth * kImageHeight;
+  sdrImg.stride[UHDR_PLANE_U] = kImageWidth / 2;
+  sdrImg.planes[UHDR_PLANE_V] = sdrData + kImageWidth * kImageHeight * 5 / 4;
+  sdrImg.stride[UHDR_PLANE_V] = kImageWidth / 2;
+
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_NE(UHDR_CODEC_OK, uhdr_enc_set_gainmap_tile_size(nullptr, 0).error_code)
+      << "fail, API allows nullptr encoder instance";
+  ASSERT_NE(UHDR_CODEC_OK, uhdr_enc_set_gainmap_tile_size(enc, -1).error_code)
+      << "fail, API allows negative tile size";
+  ASSERT_NE(UHDR_CODEC_OK,
+            uhdr_enc_set_gainmap_tile_size(enc, kGainMapTileSizeMax + 1).error_code)
+      << "fail, API allows tile size beyond max";
+
+  // the gain map does not depend on the traversal order, every tile size must give the same stream
+  for (bool withSdr : {false, true}) {
+    for (uhdr_enc_preset_t preset : {UHDR_USAGE_REALTIME, UHDR_USAGE_BEST_QUALITY}) {
+      std::vector<uint8_t> refStream;
+      for (int tileSize : {0, 1, 4096, kGainMapTileSizeDefault, kGainMapTileSizeMax}) {
+        uhdr_reset_encoder(enc);
+        uhdr_error_info_t status = uhdr_enc_set_raw_image(enc, &hdrImg, UHDR_HDR_IMG);
+        ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+        if (withSdr) {
+          status = uhdr_enc_set_raw_image(enc, &sdrImg, UHDR_SDR_IMG);
+          ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+        }
+        status = uhdr_enc_set_preset(enc, preset);
+        ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+        status = uhdr_enc_set_gainmap_scale_factor(enc, 3);
+        ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+        status = uhdr_enc_set_gainmap_tile_size(enc, tileSize);
+        ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+        status = uhdr_encode(enc);
+        ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+        ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_enc_set_gainmap_tile_size(enc, 0).error_code)
+            << "fail, API allows configuration after encode";
+        uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+        ASSERT_NE(nullptr, compressedImage);
+        uint8_t* streamData = static_cast<uint8_t*>(compressedImage->data);
+        std::vector<uint8_t> stream(streamData, streamData + compressedImage->data_sz);
+        if (refStream.empty()) {
+          refStream = std::move(stream);
+        } else {
+          ASSERT_EQ(refStream, stream) << "encoded output differs for tile size " << tileSize
+                                       << ", sdr intent " << withSdr << ", preset " << preset;
+        }
+      }
+    }
+  }
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, EncodeWithGainMapBoostEstimation) {
+  UhdrUnCompressedStructWrapper rawImgP010(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImgP010.allocateMemory());
+  ASSERT_TRUE(rawImgP010.loadRawResource(kYCbCrP010FileName));
+  UhdrUnCompressedStructWrapper rawImg420(kImageWidth, kImageHeight, YCbCr_420);
+  ASSERT_TRUE(rawImg420.allocateMemory());
+  ASSERT_TRUE(rawImg420.loadRawResource(kYCbCr420FileName));
+
+  uhdr_raw_image_t hdrImg{};
+  hdrImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  hdrImg.cg = UHDR_CG_BT_2100;
+  hdrImg.ct = UHDR_CT_HLG;
+  hdrImg.range = UHDR_CR_LIMITED_RANGE;
+  hdrImg.w = kImageWidth;
+  hdrImg.h = kImageHeight;
+  hdrImg.planes[UHDR_PLANE_Y] = rawImgP010.getImageHandle()->data;
+  hdrImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  hdrImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImgP010.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  hdrImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  uhdr_raw_image_t sdrImg{};
+  sdrImg.fmt = UHDR_IMG_FMT_12bppYCbCr420;
+  sdrImg.cg = UHDR_CG_BT_709;
+  sdrImg.ct = UHDR_CT_SRGB;
+  sdrImg.range = UHDR_CR_FULL_RANGE;
+  sdrImg.w = kImageWidth;
+  sdrImg.h = kImageHeight;
+  uint8_t* sdrData = static_cast<uint8_t*>(rawImg420.getImageHandle()->data);
+  sdrImg.planes[UHDR_PLANE_Y] = sdrData;
+  sdrImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  sdrImg.planes[UHDR_PLANE_U] = sdrData + kImageWidth * kImageHeight;
+  sdrImg.stride[UHDR_PLANE_U] = kImageWidth / 2;
+  sdrImg.planes[UHDR_PLANE_V] = sdrData + kImageWidth * kImageHeight * 5 / 4;
+  sdrImg.stride[UHDR_PLANE_V] = kImageWidth / 2;
+
+  ASSERT_NE(UHDR_CODEC_OK, uhdr_enc_set_gainmap_boost_estimation(nullptr, 1).error_code)
+      << "fail, API allows nullptr encoder instance";
+
+  // the gains encoded with estimated boosts must stay close to those fitted to all gains
+  for (bool multiChannel : {false, true}) {
+    uhdr_codec_private_t* encs[2];
+    uhdr_codec_private_t* decs[2];
+    for (int estimate = 0; estimate < 2; estimate++) {
+      encs[estimate] = uhdr_create_encoder();
+      uhdr_codec_private_t* enc = encs[estimate];
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &hdrImg, UHDR_HDR_IMG).error_code);
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &sdrImg, UHDR_SDR_IMG).error_code);
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_preset(enc, UHDR_USAGE_BEST_QUALITY).error_code);
+      ASSERT_EQ(UHDR_CODEC_OK,
+                uhdr_enc_set_using_multi_channel_gainmap(enc, multiChannel).error_code);
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_gainmap_boost_estimation(enc, estimate).error_code);
+      uhdr_error_info_t status = uhdr_encode(enc);
+      ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+      ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION,
+                uhdr_enc_set_gainmap_boost_estimation(enc, 0).error_code)
+          << "fail, API allows configuration after encode";
+
+      decs[estimate] = uhdr_create_decoder();
+      ASSERT_EQ(UHDR_CODEC_OK,
+                uhdr_dec_set_image(decs[estimate], uhdr_get_encoded_stream(enc)).error_code);
+      status = uhdr_decode(decs[estimate]);
+      ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    }
+
+    uhdr_gainmap_metadata_t* metadata[2] = {uhdr_dec_get_gainmap_metadata(decs[0]),
+                                            uhdr_dec_get_gainmap_metadata(decs[1])};
+    uhdr_raw_image_t* gainmap[2] = {uhdr_get_decoded_gainmap_image(decs[0]),
+                                    uhdr_get_decoded_gainmap_image(decs[1])};
+    for (int i = 0; i < 2; i++) {
+      ASSERT_NE(nullptr, metadata[i]);
+      ASSERT_NE(nullptr, gainmap[i]);
+    }
+    float minLog2[2], maxLog2[2];
+    for (int i = 0; i < 2; i++) {
+      minLog2[i] = std::log2(metadata[i]->min_content_boost);
+      maxLog2[i] = std::log2(metadata[i]->max_content_boost);
+    }
+    // outliers are left out of the estimate, its range is within that of all gains, give or take
+    // a histogram bin
+    EXPECT_GE(minLog2[1], minLog2[0] - 1.0f / 64);
+    EXPECT_LE(maxLog2[1], maxLog2[0] + 1.0f / 64);
+    ASSERT_EQ(gainmap[0]->w, gainmap[1]->w);
+    ASSERT_EQ(gainmap[0]->h, gainmap[1]->h);
+
+    const int channels = multiChannel ? 4 : 1;
+    double diff = 0.0;
+    for (unsigned int y = 0; y < gainmap[0]->h; y++) {
+      for (unsigned int x = 0; x < gainmap[0]->w; x++) {
+        for (int c = 0; c < (multiChannel ? 3 : 1); c++) {
+          float gainLog2[2];
+          for (int i = 0; i < 2; i++) {
+            const uint8_t* row = static_cast<uint8_t*>(gainmap[i]->planes[UHDR_PLANE_Y]) +
+                                 (size_t)y * gainmap[i]->stride[UHDR_PLANE_Y] * channels;
+            const float v = row[x * channels + c] / 255.0f;
+            gainLog2[i] = minLog2[i] + v * (maxLog2[i] - minLog2[i]);
+          }
+          diff += std::fabs(gainLog2[0] - gainLog2[1]);
+        }
+      }
+    }
+    diff /= (double)gainmap[0]->w * gainmap[0]->h * (multiChannel ? 3 : 1);
+    // on average, within one code of the map fitted to all gains
+    EXPECT_LT(diff, (maxLog2[0] - minLog2[0]) / 255)
+        << "mean log2 gain difference, multichannel " << multiChannel;
+
+    for (int i = 0; i < 2; i++) {
+      uhdr_release_decoder(decs[i]);
+      uhdr_release_encoder(encs[i]);
+    }
+  }
+}
+
+TEST(JpegRTest, AutoGainMapScaleFactor) {
+  // p010 image whose luma alternates between lo and hi from pixel to pixel
+  auto makeImage = [](unsigned int w, unsigned int h, uint16_t lo, uint16_t hi) {
+    auto img = std::make_unique<uhdr_raw_image_ext_t>(UHDR_IMG_FMT_24bppYCbCrP010, UHDR_CG_BT_2100,
+                                                      UHDR_CT_HLG, UHDR_CR_FULL_RANGE, w, h, 64);
+    for (unsigned int y = 0; y < h; y++) {
+      uint16_t* luma = static_cast<uint16_t*>(img->planes[UHDR_PLANE_Y]) +
+                       (size_t)y * img->stride[UHDR_PLANE_Y];
+      for (unsigned int x = 0; x < w; x++) luma[x] = ((x + y) % 2 ? hi : lo) << 6;
+    }
+    for (unsigned int y = 0; y < h / 2; y++) {
+      uint16_t* chroma = static_cast<uint16_t*>(img->planes[UHDR_PLANE_UV]) +
+                         (size_t)y * img->stride[UHDR_PLANE_UV];
+      for (unsigned int x = 0; x < w; x++) chroma[x] = 512 << 6;
+    }
+    return img;
+  };
+
+  // flat content takes the coarsest map of the preset, fine detail the finest the pixel budget
+  // allows
+  auto flat = makeImage(kImageWidth, kImageHeight, 512, 512);
+  auto detailed = makeImage(kImageWidth, kImageHeight, 256, 768);
+  auto largeDetailed = makeImage(4096, 4096, 256, 768);
+  EXPECT_EQ(8, JpegR::selectMapDimensionScaleFactor(flat.get(), UHDR_USAGE_BEST_QUALITY));
+  EXPECT_EQ(16, JpegR::selectMapDimensionScaleFactor(flat.get(), UHDR_USAGE_REALTIME));
+  EXPECT_EQ(1, JpegR::selectMapDimensionScaleFactor(detailed.get(), UHDR_USAGE_BEST_QUALITY));
+  EXPECT_EQ(1, JpegR::selectMapDimensionScaleFactor(detailed.get(), UHDR_USAGE_REALTIME));
+  EXPECT_EQ(2, JpegR::selectMapDimensionScaleFactor(largeDetailed.get(), UHDR_USAGE_BEST_QUALITY));
+  EXPECT_EQ(4, JpegR::selectMapDimensionScaleFactor(largeDetailed.get(), UHDR_USAGE_REALTIME));
+
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t hdrImg{};
+  hdrImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  hdrImg.cg = UHDR_CG_BT_2100;
+  hdrImg.ct = UHDR_CT_HLG;
+  hdrImg.range = UHDR_CR_LIMITED_RANGE;
+  hdrImg.w = kImageWidth;
+  hdrImg.h = kImageHeight;
+  hdrImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  hdrImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  hdrImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  hdrImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  ASSERT_NE(UHDR_CODEC_OK, uhdr_enc_set_auto_gainmap_scale_factor(nullptr, 1).error_code)
+      << "fail, API allows nullptr encoder instance";
+
+  // the picked factor replaces the configured one and shows in the gain map dimensions
+  for (uhdr_enc_preset_t preset : {UHDR_USAGE_REALTIME, UHDR_USAGE_BEST_QUALITY}) {
+    const int factor = JpegR::selectMapDimensionScaleFactor(&hdrImg, preset);
+    uhdr_codec_private_t* enc = uhdr_create_encoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &hdrImg, UHDR_HDR_IMG).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_preset(enc, preset).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_gainmap_scale_factor(enc, 3).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_auto_gainmap_scale_factor(enc, 1).error_code);
+    uhdr_error_info_t status = uhdr_encode(enc);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION,
+              uhdr_enc_set_auto_gainmap_scale_factor(enc, 0).error_code)
+        << "fail, API allows configuration after encode";
+
+    uhdr_codec_private_t* dec = uhdr_create_decoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, uhdr_get_encoded_stream(enc)).error_code);
+    status = uhdr_decode(dec);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    uhdr_raw_image_t* gainmap = uhdr_get_decoded_gainmap_image(dec);
+    ASSERT_NE(nullptr, gainmap);
+    EXPECT_EQ(kImageWidth / factor, gainmap->w) << "preset " << preset;
+    EXPECT_EQ(kImageHeight / factor, gainmap->h) << "preset " << preset;
+    uhdr_release_decoder(dec);
+    uhdr_release_encoder(enc);
+  }
+}
+
+TEST(JpegRTest, EncodeIntoCallerBuffer) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+
+  uhdr_raw_image_t hdrImg{};
+  hdrImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  hdrImg.cg = UHDR_CG_BT_2100;
+  hdrImg.ct = UHDR_CT_HLG;
+  hdrImg.range = UHDR_CR_LIMITED_RANGE;
+  hdrImg.w = kImageWidth;
+  hdrImg.h = kImageHeight;
+  hdrImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  hdrImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  hdrImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  hdrImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  // reference encode into library owned memory
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(0u, uhdr_enc_get_max_output_size(enc)) << "fail, size reported without inputs";
+  uhdr_error_info_t status = uhdr_enc_set_raw_image(enc, &hdrImg, UHDR_HDR_IMG);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  const size_t maxSize = uhdr_enc_get_max_output_size(enc);
+  status = uhdr_encode(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_compressed_image_t* refImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, refImage);
+  ASSERT_GE(maxSize, refImage->data_sz);
+  uint8_t* refData = static_cast<uint8_t*>(refImage->data);
+  const std::vector<uint8_t> refStream(refData, refData + refImage->data_sz);
+  uhdr_release_encoder(enc);
+
+  // encode into caller memory
+  std::vector<uint8_t> outMem(maxSize);
+  uhdr_compressed_image_t outImg{};
+  outImg.data = outMem.data();
+  outImg.capacity = outMem.size();
+  enc = uhdr_create_encoder();
+  ASSERT_NE(UHDR_CODEC_OK, uhdr_enc_set_output_buffer(enc, nullptr).error_code)
+      << "fail, API allows nullptr output buffer";
+  status = uhdr_enc_set_raw_image(enc, &hdrImg, UHDR_HDR_IMG);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_enc_set_output_buffer(enc, &outImg);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_encode(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+  ASSERT_EQ(outMem.data(), compressedImage->data);
+  ASSERT_EQ(refStream.size(), compressedImage->data_sz);
+  ASSERT_EQ(0, memcmp(refStream.data(), outMem.data(), refStream.size()));
+  uhdr_release_encoder(enc);
+
+  // undersized buffer is reported, not overrun
+  outImg.capacity = refStream.size() / 2;
+  enc = uhdr_create_encoder();
+  status = uhdr_enc_set_raw_image(enc, &hdrImg, UHDR_HDR_IMG);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_enc_set_output_buffer(enc, &outImg);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_encode(enc);
+  ASSERT_EQ(UHDR_CODEC_MEM_ERROR, status.error_code);
+  ASSERT_EQ(nullptr, uhdr_get_encoded_stream(enc));
+  uhdr_release_encoder(enc);
+
+  // pending effects are reflected in the estimate
+  enc = uhdr_create_encoder();
+  status = uhdr_enc_set_raw_image(enc, &hdrImg, UHDR_HDR_IMG);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_add_effect_resize(enc, kImageWidth * 2, kImageHeight * 2);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  ASSERT_EQ(maxSize * 4, uhdr_enc_get_max_output_size(enc));
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, EncodeRelocatesBaseImageExif) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  UhdrCompressedStructWrapper jpgSdr(kImageWidth, kImageHeight);
+  ASSERT_TRUE(jpgSdr.allocateMemory());
+  auto sdr = jpgSdr.getImageHandle();
+  ASSERT_TRUE(readFile(kSdrJpgFileName, sdr->data, sdr->maxLength, sdr->length));
+
+  JpegDecoderHelper sdrParser;
+  ASSERT_EQ(UHDR_CODEC_OK, sdrParser.parseImage(sdr->data, sdr->length).error_code);
+  ASSERT_GE(sdrParser.getEXIFPos(), 0) << "test resource is expected to carry exif";
+  uint8_t* exifData = static_cast<uint8_t*>(sdrParser.getEXIFPtr());
+  const std::vector<uint8_t> exifRef(exifData, exifData + sdrParser.getEXIFSize());
+
+  uhdr_raw_image_t hdrImg{};
+  hdrImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  hdrImg.cg = UHDR_CG_BT_2100;
+  hdrImg.ct = UHDR_CT_HLG;
+  hdrImg.range = UHDR_CR_LIMITED_RANGE;
+  hdrImg.w = kImageWidth;
+  hdrImg.h = kImageHeight;
+  hdrImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  hdrImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  hdrImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  hdrImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  uhdr_compressed_image_t sdrImg{};
+  sdrImg.data = sdr->data;
+  sdrImg.data_sz = sdrImg.capacity = sdr->length;
+  sdrImg.cg = UHDR_CG_BT_709;
+  sdrImg.ct = UHDR_CT_SRGB;
+  sdrImg.range = UHDR_CR_FULL_RANGE;
+
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  uhdr_error_info_t status = uhdr_enc_set_raw_image(enc, &hdrImg, UHDR_HDR_IMG);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_enc_set_compressed_image(enc, &sdrImg, UHDR_SDR_IMG);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_encode(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  // exif moves ahead of xmp and mpf, the rest of the base image is carried over unchanged
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  status = uhdr_dec_set_image(dec, compressedImage);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_decode(dec);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_mem_block_t* exif = uhdr_dec_get_exif(dec);
+  ASSERT_NE(nullptr, exif);
+  ASSERT_EQ(exifRef.size(), exif->data_sz);
+  ASSERT_EQ(0, memcmp(exifRef.data(), exif->data, exifRef.size()));
+  uhdr_release_decoder(dec);
+  uhdr_release_encoder(enc);
+}
+
+struct CountingAllocator {
+  std::mutex mutex;
+  std::map<void*, size_t> sizes;
+  size_t allocs = 0;
+  size_t frees = 0;
+  size_t liveBytes = 0;
+  size_t peakBytes = 0;
+
+  void reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+    sizes.clear();
+    allocs = frees = liveBytes = peakBytes = 0;
+  }
+  static void* alloc(void* ctx, size_t size) {
+    CountingAllocator* counter = static_cast<CountingAllocator*>(ctx);
+    void* ptr = malloc(size);
+    std::lock_guard<std::mutex> lock(counter->mutex);
+    counter->allocs++;
+    counter->sizes[ptr] = size;
+    counter->liveBytes += size;
+    counter->peakBytes = std::max(counter->peakBytes, counter->liveBytes);
+    return ptr;
+  }
+  static void release(void* ctx, void* ptr) {
+    CountingAllocator* counter = static_cast<CountingAllocator*>(ctx);
+    {
+      std::lock_guard<std::mutex> lock(counter->mutex);
+      counter->frees++;
+      auto it = counter->sizes.find(ptr);
+      if (it != counter->sizes.end()) {
+        counter->liveBytes -= it->second;
+        counter->sizes.erase(it);
+      }
+    }
+    free(ptr);
+  }
+};
+
+TEST(JpegRTest, EncodeDecodeWithMemoryArena) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+
+  uhdr_raw_image_t hdrImg{};
+  hdrImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  hdrImg.cg = UHDR_CG_BT_2100;
+  hdrImg.ct = UHDR_CT_HLG;
+  hdrImg.range = UHDR_CR_LIMITED_RANGE;
+  hdrImg.w = kImageWidth;
+  hdrImg.h = kImageHeight;
+  hdrImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  hdrImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  hdrImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  hdrImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  auto encode = [&hdrImg](uhdr_codec_private_t* enc, std::vector<uint8_t>& out) {
+    uhdr_error_info_t status = uhdr_enc_set_raw_image(enc, &hdrImg, UHDR_HDR_IMG);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    status = uhdr_encode(enc);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+    ASSERT_NE(nullptr, compressedImage);
+    uint8_t* data = static_cast<uint8_t*>(compressedImage->data);
+    out.assign(data, data + compressedImage->data_sz);
+  };
+  auto decode = [](uhdr_codec_private_t* dec, std::vector<uint8_t>& in,
+                   std::vector<uint8_t>& out) {
+    uhdr_compressed_image_t img{in.data(), in.size(), in.size(), UHDR_CG_UNSPECIFIED,
+                                UHDR_CT_UNSPECIFIED, UHDR_CR_UNSPECIFIED};
+    uhdr_error_info_t status = uhdr_dec_set_image(dec, &img);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    status = uhdr_decode(dec);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    uhdr_raw_image_t* decoded = uhdr_get_decoded_image(dec);
+    ASSERT_NE(nullptr, decoded);
+    uint8_t* data = static_cast<uint8_t*>(decoded->planes[UHDR_PLANE_PACKED]);
+    out.assign(data, data + (size_t)decoded->stride[UHDR_PLANE_PACKED] * decoded->h * 8);
+  };
+
+  std::vector<uint8_t> refStream, refImage;
+  {
+    uhdr_codec_private_t* enc = uhdr_create_encoder();
+    encode(enc, refStream);
+    uhdr_release_encoder(enc);
+    uhdr_codec_private_t* dec = uhdr_create_decoder();
+    decode(dec, refStream, refImage);
+    uhdr_release_decoder(dec);
+  }
+
+  CountingAllocator counter;
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_NE(UHDR_CODEC_OK,
+            uhdr_set_allocator(enc, CountingAllocator::alloc, nullptr, &counter).error_code)
+      << "fail, API allows alloc hook without free hook";
+  uhdr_error_info_t status =
+      uhdr_set_allocator(enc, CountingAllocator::alloc, CountingAllocator::release, &counter);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_enable_memory_arena(enc, 1);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  std::vector<uint8_t> stream;
+  encode(enc, stream);
+  ASSERT_EQ(refStream, stream);
+  const size_t firstRoundAllocs = counter.allocs;
+  ASSERT_GT(firstRoundAllocs, 0u) << "allocator hook was not used";
+  ASSERT_EQ(0u, counter.frees) << "arena is expected to pool released blocks";
+  for (int i = 0; i < 2; i++) {
+    uhdr_reset_encoder(enc);
+    encode(enc, stream);
+    ASSERT_EQ(refStream, stream);
+  }
+  ASSERT_LT(counter.allocs, 2 * firstRoundAllocs) << "pooled blocks are not being reused";
+  uhdr_release_encoder(enc);
+  ASSERT_EQ(counter.allocs, counter.frees);
+
+  counter.reset();
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  status = uhdr_set_allocator(dec, CountingAllocator::alloc, CountingAllocator::release, &counter);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_enable_memory_arena(dec, 1);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  std::vector<uint8_t> image;
+  for (int i = 0; i < 2; i++) {
+    uhdr_reset_decoder(dec);
+    decode(dec, refStream, image);
+    ASSERT_EQ(refImage, image);
+  }
+  ASSERT_GT(counter.allocs, 0u) << "allocator hook was not used";
+  uhdr_release_decoder(dec);
+  ASSERT_EQ(counter.allocs, counter.frees);
+}
+
+TEST(JpegRTest, AlignedImageBuffers) {
+  // rows of padded images start on a block boundary in every plane
+  for (uhdr_img_fmt_t fmt :
+       {UHDR_IMG_FMT_24bppYCbCrP010, UHDR_IMG_FMT_12bppYCbCr420, UHDR_IMG_FMT_8bppYCbCr400,
+        UHDR_IMG_FMT_24bppRGB888, UHDR_IMG_FMT_32bppRGBA8888, UHDR_IMG_FMT_64bppRGBAHalfFloat}) {
+    for (unsigned int w : {1u, 33u, 318u}) {
+      uhdr_raw_image_ext_t img(fmt, UHDR_CG_UNSPECIFIED, UHDR_CT_UNSPECIFIED,
+                               UHDR_CR_UNSPECIFIED, w, 6, 64);
+      const size_t bpp = fmt == UHDR_IMG_FMT_64bppRGBAHalfFloat ? 8
+                         : fmt == UHDR_IMG_FMT_32bppRGBA8888   ? 4
+                         : fmt == UHDR_IMG_FMT_24bppRGB888      ? 3
+                         : fmt == UHDR_IMG_FMT_24bppYCbCrP010   ? 2
+                                                                : 1;
+      for (int i = 0; i < 3; i++) {
+        if (img.planes[i] == nullptr) continue;
+        EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(img.planes[i]) % MemoryArena::kBlockAlignment)
+            << fmt << " " << w << " " << i;
+        EXPECT_EQ(0u, img.stride[i] * bpp % MemoryArena::kBlockAlignment)
+            << fmt << " " << w << " " << i;
+        EXPECT_GE(img.stride[i], fmt == UHDR_IMG_FMT_12bppYCbCr420 && i > 0 ? (w + 1) / 2 : w);
+      }
+    }
+    // packed rows are kept on request
+    uhdr_raw_image_ext_t packed(fmt, UHDR_CG_UNSPECIFIED, UHDR_CT_UNSPECIFIED,
+                                UHDR_CR_UNSPECIFIED, 318, 6, 1);
+    EXPECT_EQ(318u, packed.stride[UHDR_PLANE_Y]);
+  }
+
+  // large blocks of a huge page arena are zeroed and released as mapped
+  MemoryArena arena;
+  arena.setHugePages(true);
+  arena.setPooling(true);
+  for (size_t size : {(size_t)4096, MemoryArena::kHugePageThreshold + 1}) {
+    for (int round = 0; round < 2; round++) {
+      MemoryArena::Releaser releaser;
+      uint8_t* block = arena.acquire(size, releaser);
+      ASSERT_NE(nullptr, block);
+      EXPECT_GE(releaser.capacity, size);
+#if defined(__linux__)
+      EXPECT_EQ(size >= MemoryArena::kHugePageThreshold, releaser.mapped);
+#endif
+      EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(block) % MemoryArena::kBlockAlignment);
+      EXPECT_TRUE(std::all_of(block, block + size, [](uint8_t v) { return v == 0; }));
+      memset(block, 0xa5, size);
+      releaser(block);
+    }
+  }
+  arena.trim();
+
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t hdrImg{};
+  hdrImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  hdrImg.cg = UHDR_CG_BT_2100;
+  hdrImg.ct = UHDR_CT_HLG;
+  hdrImg.range = UHDR_CR_LIMITED_RANGE;
+  hdrImg.w = kImageWidth;
+  hdrImg.h = kImageHeight;
+  hdrImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  hdrImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  hdrImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  hdrImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  // huge pages change where the buffers live, never the result
+  std::vector<uint8_t> streams[2];
+  for (int huge = 0; huge < 2; huge++) {
+    uhdr_codec_private_t* enc = uhdr_create_encoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enable_huge_pages(enc, huge).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &hdrImg, UHDR_HDR_IMG).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+    EXPECT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_enable_huge_pages(enc, huge).error_code);
+    uhdr_compressed_image_t* stream = uhdr_get_encoded_stream(enc);
+    streams[huge].assign(static_cast<uint8_t*>(stream->data),
+                         static_cast<uint8_t*>(stream->data) + stream->data_sz);
+    uhdr_release_encoder(enc);
+  }
+  EXPECT_TRUE(streams[0] == streams[1]);
+  EXPECT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_enable_huge_pages(nullptr, 1).error_code);
+}
+
+TEST(JpegRTest, CodecStats) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  auto expectStages = [](const uhdr_codec_stats_t* stats,
+                         std::initializer_list<uhdr_codec_stage_t> ran) {
+    for (int stage = 0; stage < UHDR_STAGE_COUNT; stage++) {
+      bool expected = std::find(ran.begin(), ran.end(), stage) != ran.end();
+      EXPECT_EQ(expected ? 1u : 0u, stats->stages[stage].calls) << "stage " << stage;
+      EXPECT_GE(stats->stages[stage].wall_ms, 0.0) << "stage " << stage;
+      EXPECT_LE(stats->stages[stage].wall_ms, stats->wall_ms) << "stage " << stage;
+    }
+    EXPECT_GT(stats->wall_ms, 0.0);
+    EXPECT_GE(stats->cpu_ms, 0.0);
+    EXPECT_GE(stats->num_threads, 1u);
+    EXPECT_GT(stats->peak_bytes, 0u);
+    EXPECT_LE(stats->peak_bytes, stats->bytes_allocated);
+    EXPECT_GT(stats->num_allocations, 0u);
+    // the calls run on the cpu
+    EXPECT_EQ(0u, stats->gpu.passes);
+    EXPECT_EQ(0.0, stats->gpu.upload_ms + stats->gpu.shader_ms + stats->gpu.readback_ms);
+  };
+
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_num_threads(enc, 2).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+  ASSERT_EQ(nullptr, uhdr_enc_get_stats(enc)) << "stats are collected without being enabled";
+  uhdr_reset_encoder(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enable_stats(enc, 1).error_code);
+  ASSERT_EQ(nullptr, uhdr_enc_get_stats(enc));
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_num_threads(enc, 2).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+  ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_enable_stats(enc, 0).error_code);
+  uhdr_codec_stats_t* stats = uhdr_enc_get_stats(enc);
+  ASSERT_NE(nullptr, stats);
+  // tone mapping of api - 0 runs fused with the gain map computation
+  expectStages(stats, {UHDR_STAGE_GAINMAP_GENERATE, UHDR_STAGE_BASE_COMPRESS,
+                       UHDR_STAGE_GAINMAP_COMPRESS, UHDR_STAGE_GAINMAP_APPEND});
+  EXPECT_EQ(2u, stats->num_threads);
+  // the sdr intent and the gain map are allocated and held together
+  EXPECT_GE(stats->peak_bytes, (size_t)kImageWidth * kImageHeight * 3 / 2);
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enable_stats(dec, 1).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(dec).error_code);
+  stats = uhdr_dec_get_stats(dec);
+  ASSERT_NE(nullptr, stats);
+  expectStages(stats,
+               {UHDR_STAGE_BASE_DECODE, UHDR_STAGE_GAINMAP_DECODE, UHDR_STAGE_GAINMAP_APPLY});
+  uhdr_reset_decoder(dec);
+  ASSERT_EQ(nullptr, uhdr_dec_get_stats(dec)) << "stats of the earlier call survive reset";
+  uhdr_release_decoder(dec);
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, SlowPathCounters) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  // 1280 / 3 is no whole number, so the gain map of a scale factor of 3 is sampled with
+  // interpolation weights computed per pixel rather than from the shared table
+  for (int scaleFactor : {4, 3}) {
+    uhdr_codec_private_t* enc = uhdr_create_encoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_gainmap_scale_factor(enc, scaleFactor).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+    uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+    ASSERT_NE(nullptr, compressedImage);
+
+    uhdr_codec_private_t* dec = uhdr_create_decoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enable_stats(dec, 1).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(dec).error_code);
+    uhdr_codec_stats_t* stats = uhdr_dec_get_stats(dec);
+    ASSERT_NE(nullptr, stats);
+    EXPECT_EQ(scaleFactor == 3 ? 1u : 0u, stats->slow_paths[UHDR_SLOW_PATH_FRACTIONAL_SCALE])
+        << "scale factor " << scaleFactor;
+    // the gain map keeps the aspect ratio of the base image and the decode runs on the cpu
+    EXPECT_EQ(0u, stats->slow_paths[UHDR_SLOW_PATH_GAINMAP_RESIZE]);
+    EXPECT_EQ(0u, stats->slow_paths[UHDR_SLOW_PATH_GPU_FALLBACK]);
+    EXPECT_EQ(0u, stats->slow_paths[UHDR_SLOW_PATH_BUFFER_COPY]);
+    uhdr_release_decoder(dec);
+    uhdr_release_encoder(enc);
+  }
+}
+
+/*
+ * Image buffer memory budgets of the reference encodes and decodes, in bytes per pixel of the
+ * 1280x720 test vectors and in buffer allocations per call. They sit some 10% above the figures
+ * of the current implementation, so a change that grows peak memory or the number of allocations
+ * of a call fails here. Raise them only together with the change that needs it.
+ */
+struct MemoryBudget {
+  const char* name;
+  double peakBytesPerPixel;
+  unsigned int maxAllocations;
+};
+
+TEST(JpegRTest, MemoryBudget) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  UhdrUnCompressedStructWrapper sdrImg(kImageWidth, kImageHeight, YCbCr_420);
+  ASSERT_TRUE(sdrImg.allocateMemory());
+  ASSERT_TRUE(sdrImg.loadRawResource(kYCbCr420FileName));
+
+  uhdr_raw_image_t hdrImg{};
+  hdrImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  hdrImg.cg = UHDR_CG_BT_2100;
+  hdrImg.ct = UHDR_CT_HLG;
+  hdrImg.range = UHDR_CR_LIMITED_RANGE;
+  hdrImg.w = kImageWidth;
+  hdrImg.h = kImageHeight;
+  hdrImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  hdrImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  hdrImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  hdrImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  uhdr_raw_image_t sdrRawImg{};
+  sdrRawImg.fmt = UHDR_IMG_FMT_12bppYCbCr420;
+  sdrRawImg.cg = UHDR_CG_BT_709;
+  sdrRawImg.ct = UHDR_CT_SRGB;
+  sdrRawImg.range = UHDR_CR_FULL_RANGE;
+  sdrRawImg.w = kImageWidth;
+  sdrRawImg.h = kImageHeight;
+  sdrRawImg.planes[UHDR_PLANE_Y] = sdrImg.getImageHandle()->data;
+  sdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  sdrRawImg.planes[UHDR_PLANE_U] =
+      ((uint8_t*)(sdrImg.getImageHandle()->data)) + kImageWidth * kImageHeight;
+  sdrRawImg.stride[UHDR_PLANE_U] = kImageWidth / 2;
+  sdrRawImg.planes[UHDR_PLANE_V] =
+      ((uint8_t*)(sdrImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 5 / 4;
+  sdrRawImg.stride[UHDR_PLANE_V] = kImageWidth / 2;
+
+  const double pixels = (double)kImageWidth * kImageHeight;
+  CountingAllocator counter;
+  auto checkBudget = [&counter, pixels](const MemoryBudget& budget,
+                                        const uhdr_codec_stats_t* stats) {
+    ASSERT_NE(nullptr, stats) << budget.name;
+    EXPECT_LE(stats->peak_bytes, budget.peakBytesPerPixel * pixels)
+        << budget.name << ": peak image buffer memory is over budget";
+    EXPECT_LE(stats->num_allocations, budget.maxAllocations)
+        << budget.name << ": image buffer allocations are over budget";
+    // the allocator hook sees the same buffers as the stats
+    EXPECT_EQ(counter.allocs, stats->num_allocations) << budget.name;
+    EXPECT_LE(counter.peakBytes, budget.peakBytesPerPixel * pixels) << budget.name;
+  };
+
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enable_stats(enc, 1).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK,
+            uhdr_set_allocator(enc, CountingAllocator::alloc, CountingAllocator::release, &counter)
+                .error_code);
+  const MemoryBudget kEncodeBudgets[] = {
+      {"encode api-0", 11.6, 4},
+      {"encode api-1", 16.5, 3},
+  };
+  for (const MemoryBudget& budget : kEncodeBudgets) {
+    uhdr_reset_encoder(enc);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &hdrImg, UHDR_HDR_IMG).error_code);
+    if (&budget == &kEncodeBudgets[1]) {
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &sdrRawImg, UHDR_SDR_IMG).error_code);
+    }
+    counter.reset();  // input copies are made before the call and are not part of its figures
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code) << budget.name;
+    checkBudget(budget, uhdr_enc_get_stats(enc));
+  }
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  struct DecodeBudget {
+    MemoryBudget budget;
+    uhdr_color_transfer_t ct;
+    uhdr_img_fmt_t fmt;
+  };
+  const DecodeBudget kDecodeBudgets[] = {
+      {{"decode linear rgbaf16", 13.2, 3}, UHDR_CT_LINEAR, UHDR_IMG_FMT_64bppRGBAHalfFloat},
+      {{"decode hlg rgba1010102", 4.4, 2}, UHDR_CT_HLG, UHDR_IMG_FMT_32bppRGBA1010102},
+      {{"decode pq rgba1010102", 4.4, 2}, UHDR_CT_PQ, UHDR_IMG_FMT_32bppRGBA1010102},
+      {{"decode srgb rgba8888", 4.4, 2}, UHDR_CT_SRGB, UHDR_IMG_FMT_32bppRGBA8888},
+  };
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enable_stats(dec, 1).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK,
+            uhdr_set_allocator(dec, CountingAllocator::alloc, CountingAllocator::release, &counter)
+                .error_code);
+  for (const DecodeBudget& test : kDecodeBudgets) {
+    uhdr_reset_decoder(dec);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(dec, test.ct).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_img_format(dec, test.fmt).error_code);
+    counter.reset();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(dec).error_code) << test.budget.name;
+    checkBudget(test.budget, uhdr_dec_get_stats(dec));
+  }
+  uhdr_release_decoder(dec);
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, EncodeResamplesIntentsOnce) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  UhdrUnCompressedStructWrapper sdrImg(kImageWidth, kImageHeight, YCbCr_420);
+  ASSERT_TRUE(sdrImg.allocateMemory());
+  ASSERT_TRUE(sdrImg.loadRawResource(kYCbCr420FileName));
+
+  uhdr_raw_image_t hdrImg{};
+  hdrImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  hdrImg.cg = UHDR_CG_BT_2100;
+  hdrImg.ct = UHDR_CT_HLG;
+  hdrImg.range = UHDR_CR_LIMITED_RANGE;
+  hdrImg.w = kImageWidth;
+  hdrImg.h = kImageHeight;
+  hdrImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  hdrImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  hdrImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  hdrImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  uhdr_raw_image_t sdrRawImg{};
+  sdrRawImg.fmt = UHDR_IMG_FMT_12bppYCbCr420;
+  sdrRawImg.cg = UHDR_CG_BT_709;
+  sdrRawImg.ct = UHDR_CT_SRGB;
+  sdrRawImg.range = UHDR_CR_FULL_RANGE;
+  sdrRawImg.w = kImageWidth;
+  sdrRawImg.h = kImageHeight;
+  sdrRawImg.planes[UHDR_PLANE_Y] = sdrImg.getImageHandle()->data;
+  sdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  sdrRawImg.planes[UHDR_PLANE_U] =
+      ((uint8_t*)(sdrImg.getImageHandle()->data)) + kImageWidth * kImageHeight;
+  sdrRawImg.stride[UHDR_PLANE_U] = kImageWidth / 2;
+  sdrRawImg.planes[UHDR_PLANE_V] =
+      ((uint8_t*)(sdrImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 5 / 4;
+  sdrRawImg.stride[UHDR_PLANE_V] = kImageWidth / 2;
+
+  // a rotation, a crop and a blending resize, the output is 320x480 and the gain map 80x120
+  const int dstWidth = 320, dstHeight = 480, scale = 4;
+  CountingAllocator counter;
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_OK,
+            uhdr_set_allocator(enc, CountingAllocator::alloc, CountingAllocator::release, &counter)
+                .error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &hdrImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &sdrRawImg, UHDR_SDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_gainmap_scale_factor(enc, scale).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_add_effect_rotate(enc, 90).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_add_effect_crop(enc, 40, 680, 0, 960).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK,
+            uhdr_add_effect_resize_with_filter(enc, dstWidth, dstHeight, UHDR_RESIZE_BILINEAR)
+                .error_code);
+  counter.reset();
+  uhdr_error_info_t status = uhdr_encode(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  // the base image is the only copy at the output size, less than it and a p010 hdr intent take
+  EXPECT_LT(counter.peakBytes, (size_t)dstWidth * dstHeight * 9 / 2);
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+  status = uhdr_decode(dec);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_raw_image_t* img = uhdr_get_decoded_image(dec);
+  uhdr_raw_image_t* gainmap = uhdr_get_decoded_gainmap_image(dec);
+  ASSERT_NE(nullptr, img);
+  ASSERT_NE(nullptr, gainmap);
+  EXPECT_EQ((unsigned int)dstWidth, img->w);
+  EXPECT_EQ((unsigned int)dstHeight, img->h);
+  EXPECT_EQ((unsigned int)(dstWidth / scale), gainmap->w);
+  EXPECT_EQ((unsigned int)(dstHeight / scale), gainmap->h);
+  uhdr_release_decoder(dec);
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, TraceCallback) {
+  struct Recorder {
+    std::mutex mutex;
+    std::map<std::thread::id, std::vector<std::string>> open;  // slice stack per thread
+    std::set<std::string> seen;
+    bool unbalanced = false;
+
+    static void trace(void* ctx, const char* name, int begin) {
+      Recorder* rec = static_cast<Recorder*>(ctx);
+      std::lock_guard<std::mutex> lock(rec->mutex);
+      auto& stack = rec->open[std::this_thread::get_id()];
+      if (begin) {
+        stack.push_back(name);
+        rec->seen.insert(name);
+      } else if (stack.empty() || stack.back() != name) {
+        rec->unbalanced = true;
+      } else {
+        stack.pop_back();
+      }
+    }
+  } rec;
+
+#ifndef UHDR_ENABLE_TRACING
+  ASSERT_EQ(UHDR_CODEC_UNSUPPORTED_FEATURE,
+            uhdr_set_trace_callback(Recorder::trace, &rec).error_code);
+  GTEST_SKIP() << "library is built without tracing";
+#endif
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_set_trace_callback(Recorder::trace, &rec).error_code);
+
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, uhdr_get_encoded_stream(enc)).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(dec).error_code);
+  uhdr_release_decoder(dec);
+  uhdr_release_encoder(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_set_trace_callback(nullptr, nullptr).error_code);
+
+  ASSERT_FALSE(rec.unbalanced);
+  for (auto& it : rec.open) ASSERT_TRUE(it.second.empty()) << it.second.back() << " left open";
+  for (const char* name :
+       {"JpegR::encodeJPEGR", "JpegR::generateGainMap", "JpegR::appendGainMap",
+        "JpegEncoderHelper::compressImage", "JpegR::decodeJPEGR", "JpegR::applyGainMap",
+        "JpegDecoderHelper::decompress"}) {
+    EXPECT_EQ(1u, rec.seen.count(name)) << name << " is not traced";
+  }
+}
+
+TEST(JpegRTest, JpegBackend) {
+  // a software stand-in for a hardware jpeg block, built on the helpers of the library
+  struct Backend {
+    std::mutex mutex;
+    int compressCalls = 0;
+    int decompressCalls = 0;
+    bool decline = false;
+    std::map<const uhdr_raw_image_t*, std::unique_ptr<JpegEncoderHelper>> encoders;
+
+    static int compress(void* ctx, const uhdr_raw_image_t* img, int quality,
+                        uhdr_compressed_image_t* dst) {
+      Backend* backend = static_cast<Backend*>(ctx);
+      JpegEncoderHelper* encoder;
+      {
+        std::lock_guard<std::mutex> lock(backend->mutex);
+        backend->compressCalls++;
+        if (backend->decline) return -1;
+        auto& slot = backend->encoders[img];
+        slot = std::make_unique<JpegEncoderHelper>();
+        encoder = slot.get();
+      }
+      if (encoder->compressImage(img, quality, nullptr, 0).error_code != UHDR_CODEC_OK) return -1;
+      *dst = encoder->getCompressedImage();
+      return 0;
+    }
+
+    static int decompress(void* ctx, const uhdr_compressed_image_t* src, uhdr_raw_image_t* dst) {
+      Backend* backend = static_cast<Backend*>(ctx);
+      {
+        std::lock_guard<std::mutex> lock(backend->mutex);
+        backend->decompressCalls++;
+        if (backend->decline) return -1;
+      }
+      JpegDecoderHelper decoder;
+      if (decoder.decompressImage(src->data, src->data_sz, DECODE_TO_YCBCR_CS).error_code !=
+          UHDR_CODEC_OK) {
+        return -1;
+      }
+      uhdr_raw_image_t img = decoder.getDecompressedImage();
+      if (img.fmt != dst->fmt || img.w != dst->w || img.h != dst->h) return -1;
+      const int planes = dst->fmt == UHDR_IMG_FMT_8bppYCbCr400 ? 1 : 3;
+      for (int i = 0; i < planes; i++) {
+        const bool halved = i > 0 && dst->fmt == UHDR_IMG_FMT_12bppYCbCr420;
+        const unsigned int rows = halved ? (dst->h + 1) / 2 : dst->h;
+        for (unsigned int y = 0; y < rows; y++) {
+          memcpy(static_cast<uint8_t*>(dst->planes[i]) + (size_t)y * dst->stride[i],
+                 static_cast<uint8_t*>(img.planes[i]) + (size_t)y * img.stride[i],
+                 (std::min)(dst->stride[i], img.stride[i]));
+        }
+      }
+      return 0;
+    }
+  } backend;
+  uhdr_jpeg_backend_t hooks{Backend::compress, Backend::decompress, &backend};
+
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  auto encode = [&](const uhdr_jpeg_backend_t* jpeg_backend, std::vector<uint8_t>& out) {
+    uhdr_codec_private_t* enc = uhdr_create_encoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_set_jpeg_backend(enc, jpeg_backend).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+    // a single channel gain map decodes to YCbCr, which is offered to the backend
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_using_multi_channel_gainmap(enc, 0).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+    uhdr_compressed_image_t* stream = uhdr_get_encoded_stream(enc);
+    out.assign(static_cast<uint8_t*>(stream->data),
+               static_cast<uint8_t*>(stream->data) + stream->data_sz);
+    uhdr_release_encoder(enc);
+  };
+  auto decode = [&](const uhdr_jpeg_backend_t* jpeg_backend, std::vector<uint8_t>& in,
+                    std::vector<uint8_t>& out) {
+    uhdr_codec_private_t* dec = uhdr_create_decoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_set_jpeg_backend(dec, jpeg_backend).error_code);
+    uhdr_compressed_image_t img{in.data(), in.size(), in.size(), UHDR_CG_UNSPECIFIED,
+                                UHDR_CT_UNSPECIFIED, UHDR_CR_UNSPECIFIED};
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, &img).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(dec).error_code);
+    uhdr_raw_image_t* rendition = uhdr_get_decoded_image(dec);
+    out.assign(static_cast<uint8_t*>(rendition->planes[UHDR_PLANE_PACKED]),
+               static_cast<uint8_t*>(rendition->planes[UHDR_PLANE_PACKED]) +
+                   (size_t)rendition->stride[UHDR_PLANE_PACKED] * rendition->h * 8);
+    uhdr_release_decoder(dec);
+  };
+
+  std::vector<uint8_t> reference, offloaded, referenceImg, offloadedImg;
+  ASSERT_NO_FATAL_FAILURE(encode(nullptr, reference));
+  ASSERT_NO_FATAL_FAILURE(encode(&hooks, offloaded));
+  // base image and gain map
+  EXPECT_EQ(2, backend.compressCalls);
+  ASSERT_NO_FATAL_FAILURE(decode(nullptr, reference, referenceImg));
+  ASSERT_NO_FATAL_FAILURE(decode(&hooks, offloaded, offloadedImg));
+  EXPECT_EQ(2, backend.decompressCalls);
+  // the bitstreams differ in markers only, the coded samples are those of libjpeg
+  EXPECT_TRUE(referenceImg == offloadedImg);
+
+  // declined images fall back to libjpeg
+  backend.decline = true;
+  std::vector<uint8_t> declined, declinedImg;
+  ASSERT_NO_FATAL_FAILURE(encode(&hooks, declined));
+  EXPECT_EQ(4, backend.compressCalls);
+  EXPECT_TRUE(reference == declined);
+  ASSERT_NO_FATAL_FAILURE(decode(&hooks, declined, declinedImg));
+  EXPECT_EQ(4, backend.decompressCalls);
+  EXPECT_TRUE(referenceImg == declinedImg);
+}
+
+TEST(JpegRTest, Api0GainMathFollowsPreset) {
+  // api-0 generates the gain map in one pass for either preset. Only the configured realtime
+  // preset may trade the exact logarithm for fastLog2(), the best quality map must not change.
+  struct Backend {
+    std::vector<uint8_t> gainmap;
+    static int compress(void* ctx, const uhdr_raw_image_t* img, int, uhdr_compressed_image_t*) {
+      if (img->fmt == UHDR_IMG_FMT_8bppYCbCr400) {
+        std::vector<uint8_t>& map = static_cast<Backend*>(ctx)->gainmap;
+        const uint8_t* src = static_cast<const uint8_t*>(img->planes[UHDR_PLANE_Y]);
+        map.clear();
+        for (unsigned int y = 0; y < img->h; y++) {
+          map.insert(map.end(), src + (size_t)y * img->stride[UHDR_PLANE_Y],
+                     src + (size_t)y * img->stride[UHDR_PLANE_Y] + img->w);
+        }
+      }
+      return -1;  // the images are compressed by libjpeg
+    }
+  } backend;
+  uhdr_jpeg_backend_t hooks{Backend::compress, nullptr, &backend};
+
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  std::vector<uint8_t> gainmaps[2];
+  const uhdr_enc_preset_t presets[2] = {UHDR_USAGE_BEST_QUALITY, UHDR_USAGE_REALTIME};
+  for (int i = 0; i < 2; i++) {
+    uhdr_codec_private_t* enc = uhdr_create_encoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_set_jpeg_backend(enc, &hooks).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_using_multi_channel_gainmap(enc, 0).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_preset(enc, presets[i]).error_code);
+    uhdr_error_info_t status = uhdr_encode(enc);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    uhdr_release_encoder(enc);
+    gainmaps[i].swap(backend.gainmap);
+    ASSERT_FALSE(gainmaps[i].empty()) << "gain map of preset " << presets[i] << " not offered";
+  }
+
+  // the presets share the base image and the gain map metadata, so the maps differ only where
+  // the two logarithms quantize to neighbouring codes. Before the configured preset was kept,
+  // both were computed with fastLog2().
+  ASSERT_EQ(gainmaps[0].size(), gainmaps[1].size());
+  size_t differing = 0;
+  for (size_t i = 0; i < gainmaps[0].size(); i++) {
+    ASSERT_LE(abs(gainmaps[0][i] - gainmaps[1][i]), 1) << "at " << i;
+    if (gainmaps[0][i] != gainmaps[1][i]) differing++;
+  }
+  EXPECT_GT(differing, 0u) << "best quality gain map computed with fastLog2()";
+}
+
+TEST(JpegRTest, RgbaBaseImageStreamed) {
+  struct Backend {
+    int compressCalls = 0;
+    static int compress(void* ctx, const uhdr_raw_image_t*, int, uhdr_compressed_image_t*) {
+      static_cast<Backend*>(ctx)->compressCalls++;
+      return -1;
+    }
+  } backend;
+  // declined images are compressed by libjpeg from whole images, converted ahead of compression
+  uhdr_jpeg_backend_t declining{Backend::compress, nullptr, &backend};
+
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t hdrImg{};
+  hdrImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  hdrImg.cg = UHDR_CG_BT_2100;
+  hdrImg.ct = UHDR_CT_HLG;
+  hdrImg.range = UHDR_CR_LIMITED_RANGE;
+  hdrImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  hdrImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  hdrImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  hdrImg.stride[UHDR_PLANE_UV] = kImageWidth;
+  std::vector<uint32_t> rgba(kImageWidth * kImageHeight);
+  for (size_t i = 0; i < rgba.size(); i++) {
+    const uint32_t x = i % kImageWidth, y = i / kImageWidth;
+    rgba[i] = (x & 0xFF) | ((y & 0xFF) << 8) | (((x * 7 + y * 3) & 0xFF) << 16) | 0xFF000000u;
+  }
+  uhdr_raw_image_t sdrImg{};
+  sdrImg.fmt = UHDR_IMG_FMT_32bppRGBA8888;
+  sdrImg.cg = UHDR_CG_BT_709;
+  sdrImg.ct = UHDR_CT_SRGB;
+  sdrImg.range = UHDR_CR_FULL_RANGE;
+  sdrImg.planes[UHDR_PLANE_PACKED] = rgba.data();
+  sdrImg.stride[UHDR_PLANE_PACKED] = kImageWidth;
+
+  auto encode = [&](unsigned int w, unsigned int h, const uhdr_jpeg_backend_t* jpeg_backend,
+                    std::vector<uint8_t>& out) {
+    hdrImg.w = sdrImg.w = w;
+    hdrImg.h = sdrImg.h = h;
+    uhdr_codec_private_t* enc = uhdr_create_encoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_set_jpeg_backend(enc, jpeg_backend).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &hdrImg, UHDR_HDR_IMG).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &sdrImg, UHDR_SDR_IMG).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+    uhdr_compressed_image_t* stream = uhdr_get_encoded_stream(enc);
+    out.assign(static_cast<uint8_t*>(stream->data),
+               static_cast<uint8_t*>(stream->data) + stream->data_sz);
+    uhdr_release_encoder(enc);
+  };
+
+  // without padding blocks the streamed conversion codes the same samples
+  std::vector<uint8_t> streamed, converted;
+  ASSERT_NO_FATAL_FAILURE(encode(kImageWidth, kImageHeight, nullptr, streamed));
+  ASSERT_NO_FATAL_FAILURE(encode(kImageWidth, kImageHeight, &declining, converted));
+  EXPECT_EQ(2, backend.compressCalls);
+  EXPECT_TRUE(streamed == converted);
+
+  // dimensions off the mcu grid, the last strip is padded to whole blocks
+  ASSERT_NO_FATAL_FAILURE(encode(kImageWidth - 6, kImageHeight - 2, nullptr, streamed));
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  uhdr_compressed_image_t img{streamed.data(), streamed.size(), streamed.size(),
+                              UHDR_CG_UNSPECIFIED, UHDR_CT_UNSPECIFIED, UHDR_CR_UNSPECIFIED};
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, &img).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_probe(dec).error_code);
+  EXPECT_EQ((int)kImageWidth - 6, uhdr_dec_get_image_width(dec));
+  EXPECT_EQ((int)kImageHeight - 2, uhdr_dec_get_image_height(dec));
+  EXPECT_EQ(UHDR_CODEC_OK, uhdr_decode(dec).error_code);
+  uhdr_release_decoder(dec);
+}
+
+TEST(JpegRTest, NvJpegBackend) {
+  uhdr_jpeg_backend_t* backend = uhdr_create_nvjpeg_backend();
+#ifndef UHDR_ENABLE_NVJPEG
+  ASSERT_EQ(nullptr, backend);
+  GTEST_SKIP() << "library is built without nvjpeg";
+#endif
+  if (backend == nullptr) GTEST_SKIP() << "no cuda device";
+
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_set_jpeg_backend(enc, backend).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_set_jpeg_backend(dec, backend).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, uhdr_get_encoded_stream(enc)).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(dec).error_code);
+  uhdr_raw_image_t* output = uhdr_get_decoded_image(dec);
+  ASSERT_NE(nullptr, output);
+  EXPECT_EQ((unsigned int)kImageWidth, output->w);
+  EXPECT_EQ((unsigned int)kImageHeight, output->h);
+  uhdr_release_decoder(dec);
+  uhdr_release_encoder(enc);
+  uhdr_release_nvjpeg_backend(backend);
+}
+
+TEST(JpegRTest, CoreAffinity) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  EXPECT_EQ(UHDR_CODEC_INVALID_PARAM,
+            uhdr_set_core_affinity(nullptr, UHDR_CORES_PERFORMANCE).error_code);
+  EXPECT_EQ(UHDR_CODEC_INVALID_PARAM,
+            uhdr_set_core_affinity(enc, static_cast<uhdr_core_affinity_t>(7)).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+  EXPECT_EQ(UHDR_CODEC_INVALID_OPERATION,
+            uhdr_set_core_affinity(enc, UHDR_CORES_PERFORMANCE).error_code);
+  uhdr_compressed_image_t* stream = uhdr_get_encoded_stream(enc);
+  std::vector<uint8_t> reference(static_cast<uint8_t*>(stream->data),
+                                 static_cast<uint8_t*>(stream->data) + stream->data_sz);
+
+  // placement changes where the work runs, never its result
+  std::vector<uint8_t> referenceImg;
+  for (uhdr_core_affinity_t affinity :
+       {UHDR_CORES_ANY, UHDR_CORES_PERFORMANCE, UHDR_CORES_EFFICIENCY}) {
+    uhdr_reset_encoder(enc);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_set_core_affinity(enc, affinity).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+    stream = uhdr_get_encoded_stream(enc);
+    EXPECT_TRUE(std::vector<uint8_t>(static_cast<uint8_t*>(stream->data),
+                                     static_cast<uint8_t*>(stream->data) + stream->data_sz) ==
+                reference);
+
+    uhdr_codec_private_t* dec = uhdr_create_decoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_set_core_affinity(dec, affinity).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, stream).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(dec).error_code);
+    uhdr_raw_image_t* output = uhdr_get_decoded_image(dec);
+    std::vector<uint8_t> img(static_cast<uint8_t*>(output->planes[UHDR_PLANE_PACKED]),
+                             static_cast<uint8_t*>(output->planes[UHDR_PLANE_PACKED]) +
+                                 (size_t)output->stride[UHDR_PLANE_PACKED] * output->h * 8);
+    if (referenceImg.empty()) referenceImg = img;
+    EXPECT_TRUE(img == referenceImg);
+    uhdr_release_decoder(dec);
+  }
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, DecodeSdrWithDisplayBoost) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  uhdr_error_info_t status = uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_encode(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  auto decodeSdr = [compressedImage](float displayBoost, std::vector<uint8_t>& out) {
+    uhdr_codec_private_t* dec = uhdr_create_decoder();
+    uhdr_error_info_t status = uhdr_dec_set_image(dec, compressedImage);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    status = uhdr_dec_set_out_img_format(dec, UHDR_IMG_FMT_32bppRGBA8888);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    status = uhdr_dec_set_out_color_transfer(dec, UHDR_CT_SRGB);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    if (displayBoost != 0.0f) {
+      status = uhdr_dec_set_out_max_display_boost(dec, displayBoost);
+      ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    }
+    status = uhdr_decode(dec);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    uhdr_raw_image_t* decoded = uhdr_get_decoded_image(dec);
+    ASSERT_NE(nullptr, decoded);
+    ASSERT_EQ(UHDR_IMG_FMT_32bppRGBA8888, decoded->fmt);
+    uint8_t* decodedData = static_cast<uint8_t*>(decoded->planes[UHDR_PLANE_PACKED]);
+    out.assign(decodedData,
+               decodedData + (size_t)decoded->stride[UHDR_PLANE_PACKED] * decoded->h * 4);
+    uhdr_release_decoder(dec);
+  };
+
+  std::vector<uint8_t> sdr, unitBoost, boosted;
+  decodeSdr(0.0f, sdr);
+  decodeSdr(1.0f, unitBoost);
+  decodeSdr(4.0f, boosted);
+  ASSERT_EQ(sdr, unitBoost) << "unit display boost is expected to return the base image";
+  ASSERT_EQ(sdr.size(), boosted.size());
+  ASSERT_NE(sdr, boosted) << "display boost is expected to apply the gain map";
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, DecodeIntoCallerBuffer) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  uhdr_error_info_t status = uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_encode(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  // reference decode into library owned memory
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  status = uhdr_dec_set_image(dec, compressedImage);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_decode(dec);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_raw_image_t* reference = uhdr_get_decoded_image(dec);
+  ASSERT_NE(nullptr, reference);
+
+  // decode into caller memory with a padded stride
+  const size_t bpp = 8;
+  const unsigned int stride = kImageWidth + 16;
+  std::vector<uint8_t> outMem((size_t)stride * kImageHeight * bpp, 0xa5);
+  uhdr_raw_image_t outImg{};
+  outImg.fmt = UHDR_IMG_FMT_64bppRGBAHalfFloat;
+  outImg.w = kImageWidth;
+  outImg.h = kImageHeight;
+  outImg.planes[UHDR_PLANE_PACKED] = outMem.data();
+  outImg.stride[UHDR_PLANE_PACKED] = stride;
+
+  uhdr_codec_private_t* decCaller = uhdr_create_decoder();
+  status = uhdr_dec_set_image(decCaller, compressedImage);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_dec_set_output_buffer(decCaller, &outImg);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_decode(decCaller);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_raw_image_t* decoded = uhdr_get_decoded_image(decCaller);
+  ASSERT_NE(nullptr, decoded);
+  ASSERT_EQ(outMem.data(), decoded->planes[UHDR_PLANE_PACKED]);
+  ASSERT_EQ(stride, decoded->stride[UHDR_PLANE_PACKED]);
+  ASSERT_EQ(reference->cg, decoded->cg);
+  ASSERT_EQ(reference->ct, decoded->ct);
+  for (unsigned int i = 0; i < kImageHeight; i++) {
+    uint8_t* refRow = static_cast<uint8_t*>(reference->planes[UHDR_PLANE_PACKED]) +
+                      (size_t)i * reference->stride[UHDR_PLANE_PACKED] * bpp;
+    uint8_t* outRow = outMem.data() + (size_t)i * stride * bpp;
+    ASSERT_EQ(0, memcmp(refRow, outRow, kImageWidth * bpp)) << "mismatch at row " << i;
+    ASSERT_EQ(0xa5, outRow[kImageWidth * bpp]) << "padding overwritten at row " << i;
+  }
+  uhdr_release_decoder(decCaller);
+  uhdr_release_decoder(dec);
+
+  // mismatched configuration is rejected at decode time
+  decCaller = uhdr_create_decoder();
+  status = uhdr_dec_set_image(decCaller, compressedImage);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  outImg.h = kImageHeight / 2;
+  status = uhdr_dec_set_output_buffer(decCaller, &outImg);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_decode(decCaller);
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, status.error_code);
+  ASSERT_EQ(nullptr, uhdr_get_decoded_image(decCaller));
+  uhdr_release_decoder(decCaller);
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, DecodeReusesBuffersAcrossReset) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  uhdr_error_info_t status = uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_encode(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+  std::vector<uint8_t> firstStream(
+      static_cast<uint8_t*>(compressedImage->data),
+      static_cast<uint8_t*>(compressedImage->data) + compressedImage->data_sz);
+  void* firstStreamPtr = compressedImage->data;
+
+  // encoding again after reset reuses the output buffer
+  uhdr_reset_encoder(enc);
+  status = uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_encode(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+  ASSERT_EQ(firstStreamPtr, compressedImage->data);
+  ASSERT_EQ(firstStream.size(), compressedImage->data_sz);
+  ASSERT_EQ(0, memcmp(firstStream.data(), compressedImage->data, firstStream.size()));
+
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  status = uhdr_dec_set_image(dec, compressedImage);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_decode(dec);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_raw_image_t* decoded = uhdr_get_decoded_image(dec);
+  ASSERT_NE(nullptr, decoded);
+  const size_t bpp = 8;
+  std::vector<uint8_t> firstOutput((size_t)decoded->w * decoded->h * bpp);
+  for (unsigned int i = 0; i < decoded->h; i++) {
+    memcpy(firstOutput.data() + (size_t)i * decoded->w * bpp,
+           static_cast<uint8_t*>(decoded->planes[UHDR_PLANE_PACKED]) +
+               (size_t)i * decoded->stride[UHDR_PLANE_PACKED] * bpp,
+           (size_t)decoded->w * bpp);
+  }
+  void* firstOutputPtr = decoded->planes[UHDR_PLANE_PACKED];
+
+  // a same sized decode after reset lands in the same memory with identical contents
+  uhdr_reset_decoder(dec);
+  status = uhdr_dec_set_image(dec, compressedImage);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_decode(dec);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  decoded = uhdr_get_decoded_image(dec);
+  ASSERT_NE(nullptr, decoded);
+  ASSERT_EQ(firstOutputPtr, decoded->planes[UHDR_PLANE_PACKED]);
+  for (unsigned int i = 0; i < decoded->h; i++) {
+    ASSERT_EQ(0, memcmp(firstOutput.data() + (size_t)i * decoded->w * bpp,
+                        static_cast<uint8_t*>(decoded->planes[UHDR_PLANE_PACKED]) +
+                            (size_t)i * decoded->stride[UHDR_PLANE_PACKED] * bpp,
+                        (size_t)decoded->w * bpp))
+        << "mismatch at row " << i;
+  }
+  uhdr_release_decoder(dec);
+  uhdr_release_encoder(enc);
+}
+
+struct StripCollector {
+  std::vector<uint8_t> rows;
+  size_t rowBytes = 0;
+  unsigned int nextRow = 0;
+  unsigned int numStrips = 0;
+  int abortAtStrip = -1;
+  bool inOrder = true;
+
+  static int onStrip(void* ctx, const uhdr_raw_image_t* strip, unsigned int row_start) {
+    StripCollector* collector = static_cast<StripCollector*>(ctx);
+    if (collector->abortAtStrip == (int)collector->numStrips) return -1;
+    if (row_start != collector->nextRow || strip->h == 0) collector->inOrder = false;
+    const size_t bpp = strip->fmt == UHDR_IMG_FMT_64bppRGBAHalfFloat ? 8 : 4;
+    collector->rowBytes = strip->w * bpp;
+    for (unsigned int i = 0; i < strip->h; i++) {
+      const uint8_t* src = static_cast<uint8_t*>(strip->planes[UHDR_PLANE_PACKED]) +
+                           (size_t)i * strip->stride[UHDR_PLANE_PACKED] * bpp;
+      collector->rows.insert(collector->rows.end(), src, src + collector->rowBytes);
+    }
+    collector->nextRow = row_start + strip->h;
+    collector->numStrips++;
+    return 0;
+  }
+};
+
+TEST(JpegRTest, DecodeInStrips) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  uhdr_error_info_t status = uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_encode(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  const struct {
+    uhdr_img_fmt_t fmt;
+    uhdr_color_transfer_t ct;
+    float displayBoost;
+  } outputs[] = {
+      {UHDR_IMG_FMT_64bppRGBAHalfFloat, UHDR_CT_LINEAR, FLT_MAX},
+      {UHDR_IMG_FMT_32bppRGBA1010102, UHDR_CT_HLG, FLT_MAX},
+      {UHDR_IMG_FMT_32bppRGBA8888, UHDR_CT_SRGB, FLT_MAX},
+      {UHDR_IMG_FMT_32bppRGBA8888, UHDR_CT_SRGB, 2.0f},
+  };
+  for (const auto& output : outputs) {
+    SCOPED_TRACE(::testing::Message() << "fmt " << output.fmt << " ct " << output.ct);
+    uhdr_codec_private_t* dec = uhdr_create_decoder();
+    status = uhdr_dec_set_image(dec, compressedImage);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_img_format(dec, output.fmt).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(dec, output.ct).error_code);
+    if (output.displayBoost != FLT_MAX) {
+      ASSERT_EQ(UHDR_CODEC_OK,
+                uhdr_dec_set_out_max_display_boost(dec, output.displayBoost).error_code);
+    }
+    const size_t bpp = output.fmt == UHDR_IMG_FMT_64bppRGBAHalfFloat ? 8 : 4;
+
+    // strips that are not a multiple of the mcu height
+    StripCollector collector;
+    status = uhdr_dec_set_strip_callback(dec, StripCollector::onStrip, &collector, 40);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    status = uhdr_decode(dec);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    ASSERT_EQ(nullptr, uhdr_get_decoded_image(dec));
+    ASSERT_NE(nullptr, uhdr_get_decoded_gainmap_image(dec));
+    ASSERT_TRUE(collector.inOrder);
+    ASSERT_EQ((unsigned int)kImageHeight, collector.nextRow);
+    ASSERT_GT(collector.numStrips, 1u);
+    ASSERT_EQ(kImageWidth * bpp, collector.rowBytes);
+    ASSERT_EQ(collector.rowBytes * kImageHeight, collector.rows.size());
+
+    uhdr_codec_private_t* refDec = uhdr_create_decoder();
+    status = uhdr_dec_set_image(refDec, compressedImage);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_img_format(refDec, output.fmt).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(refDec, output.ct).error_code);
+    if (output.displayBoost != FLT_MAX) {
+      ASSERT_EQ(UHDR_CODEC_OK,
+                uhdr_dec_set_out_max_display_boost(refDec, output.displayBoost).error_code);
+    }
+    status = uhdr_decode(refDec);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    uhdr_raw_image_t* reference = uhdr_get_decoded_image(refDec);
+    ASSERT_NE(nullptr, reference);
+    for (unsigned int i = 0; i < kImageHeight; i++) {
+      const uint8_t* refRow = static_cast<uint8_t*>(reference->planes[UHDR_PLANE_PACKED]) +
+                              (size_t)i * reference->stride[UHDR_PLANE_PACKED] * bpp;
+      ASSERT_EQ(0, memcmp(refRow, collector.rows.data() + i * collector.rowBytes,
+                          collector.rowBytes))
+          << "mismatch at row " << i;
+    }
+    uhdr_release_decoder(refDec);
+    uhdr_release_decoder(dec);
+  }
+
+  // a non-zero return from the callback aborts the decode
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  status = uhdr_dec_set_image(dec, compressedImage);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM,
+            uhdr_dec_set_strip_callback(dec, StripCollector::onStrip, nullptr, 0).error_code);
+  StripCollector collector;
+  collector.abortAtStrip = 1;
+  status = uhdr_dec_set_strip_callback(dec, StripCollector::onStrip, &collector, 16);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_decode(dec);
+  ASSERT_EQ(UHDR_CODEC_ERROR, status.error_code);
+  ASSERT_EQ(1u, collector.numStrips);
+  ASSERT_EQ(nullptr, uhdr_get_decoded_image(dec));
+  uhdr_release_decoder(dec);
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, DecodeWithMemoryLimit) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_gainmap_scale_factor(enc, 4).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  // half float output, the rendition alone takes 8 bytes per pixel
+  const size_t outputBytes = (size_t)kImageWidth * kImageHeight * 8;
+  uhdr_codec_private_t* refDec = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(refDec, compressedImage).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(refDec).error_code);
+  uhdr_raw_image_t* reference = uhdr_get_decoded_image(refDec);
+  ASSERT_NE(nullptr, reference);
+
+  auto expectReference = [&](uhdr_raw_image_t* img) {
+    ASSERT_NE(nullptr, img);
+    ASSERT_EQ(reference->w, img->w);
+    ASSERT_EQ(reference->h, img->h);
+    for (unsigned int i = 0; i < img->h; i++) {
+      ASSERT_EQ(0, memcmp(static_cast<uint8_t*>(reference->planes[UHDR_PLANE_PACKED]) +
+                              (size_t)i * reference->stride[UHDR_PLANE_PACKED] * 8,
+                          static_cast<uint8_t*>(img->planes[UHDR_PLANE_PACKED]) +
+                              (size_t)i * img->stride[UHDR_PLANE_PACKED] * 8,
+                          (size_t)img->w * 8))
+          << "mismatch at row " << i;
+    }
+  };
+
+  // a generous limit keeps the whole image decode
+  {
+    uhdr_codec_private_t* dec = uhdr_create_decoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_memory_limit(dec, 4 * outputBytes).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(dec).error_code);
+    expectReference(uhdr_get_decoded_image(dec));
+    uhdr_release_decoder(dec);
+  }
+
+  // without room for the whole base image, the rendition is assembled from strips
+  const size_t limit = outputBytes + (size_t)kImageWidth * kImageHeight * 2;
+  {
+    uhdr_codec_private_t* dec = uhdr_create_decoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enable_stats(dec, 1).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_memory_limit(dec, limit).error_code);
+    uhdr_error_info_t status = uhdr_decode(dec);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    ASSERT_LE(uhdr_dec_get_stats(dec)->peak_bytes, limit);
+    // the strips are rendered into the rendition in place, past it only the gain map and a strip
+    // of the base image are held
+    ASSERT_LE(uhdr_dec_get_stats(dec)->peak_bytes,
+              outputBytes + (size_t)kImageWidth * kImageHeight / 2);
+    expectReference(uhdr_get_decoded_image(dec));
+    uhdr_release_decoder(dec);
+  }
+
+  // the strips are assembled in a caller provided buffer alike, which is not counted
+  {
+    std::vector<uint64_t> pixels((size_t)kImageWidth * kImageHeight);
+    uhdr_raw_image_t outImg{};
+    outImg.fmt = UHDR_IMG_FMT_64bppRGBAHalfFloat;
+    outImg.w = kImageWidth;
+    outImg.h = kImageHeight;
+    outImg.planes[UHDR_PLANE_PACKED] = pixels.data();
+    outImg.stride[UHDR_PLANE_PACKED] = kImageWidth;
+    uhdr_codec_private_t* dec = uhdr_create_decoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_output_buffer(dec, &outImg).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_memory_limit(dec, limit - outputBytes).error_code);
+    uhdr_error_info_t status = uhdr_decode(dec);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    expectReference(&outImg);
+    uhdr_release_decoder(dec);
+  }
+
+  // a boosted sdr output has the format of the base image, which decodes into the output and has
+  // the gain map applied in place. That fits where a separate base image would not
+  {
+    const size_t sdrBytes = (size_t)kImageWidth * kImageHeight * 4;
+    uhdr_codec_private_t* sdrRefDec = uhdr_create_decoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(sdrRefDec, compressedImage).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK,
+              uhdr_dec_set_out_img_format(sdrRefDec, UHDR_IMG_FMT_32bppRGBA8888).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(sdrRefDec, UHDR_CT_SRGB).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_max_display_boost(sdrRefDec, 2.0f).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(sdrRefDec).error_code);
+    uhdr_raw_image_t* sdrReference = uhdr_get_decoded_image(sdrRefDec);
+    ASSERT_NE(nullptr, sdrReference);
+
+    uhdr_codec_private_t* dec = uhdr_create_decoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enable_stats(dec, 1).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK,
+              uhdr_dec_set_out_img_format(dec, UHDR_IMG_FMT_32bppRGBA8888).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(dec, UHDR_CT_SRGB).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_max_display_boost(dec, 2.0f).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_memory_limit(dec, sdrBytes * 3 / 2).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_probe(dec).error_code);
+    ASSERT_EQ(0, uhdr_dec_get_cost_estimate(dec)->in_strips);
+    uhdr_error_info_t status = uhdr_decode(dec);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    ASSERT_LE(uhdr_dec_get_stats(dec)->peak_bytes, sdrBytes * 3 / 2);
+    uhdr_raw_image_t* img = uhdr_get_decoded_image(dec);
+    ASSERT_NE(nullptr, img);
+    for (unsigned int i = 0; i < img->h; i++) {
+      ASSERT_EQ(0, memcmp(static_cast<uint8_t*>(sdrReference->planes[UHDR_PLANE_PACKED]) +
+                              (size_t)i * sdrReference->stride[UHDR_PLANE_PACKED] * 4,
+                          static_cast<uint8_t*>(img->planes[UHDR_PLANE_PACKED]) +
+                              (size_t)i * img->stride[UHDR_PLANE_PACKED] * 4,
+                          (size_t)img->w * 4))
+          << "mismatch at row " << i;
+    }
+    uhdr_release_decoder(dec);
+    uhdr_release_decoder(sdrRefDec);
+  }
+
+  // no room for the rendition itself, the probe fails and the decode allocates nothing
+  {
+    uhdr_codec_private_t* dec = uhdr_create_decoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enable_stats(dec, 1).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_memory_limit(dec, outputBytes).error_code);
+    ASSERT_EQ(UHDR_CODEC_MEM_ERROR, uhdr_dec_probe(dec).error_code);
+    ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_dec_set_memory_limit(dec, 0).error_code);
+    ASSERT_EQ(UHDR_CODEC_MEM_ERROR, uhdr_decode(dec).error_code);
+    ASSERT_EQ(nullptr, uhdr_get_decoded_image(dec));
+    ASSERT_EQ(0u, uhdr_dec_get_stats(dec)->bytes_allocated);
+    uhdr_release_decoder(dec);
+  }
+
+  // effects do not combine with the strip wise fallback
+  {
+    uhdr_codec_private_t* dec = uhdr_create_decoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_add_effect_mirror(dec, UHDR_MIRROR_HORIZONTAL).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_memory_limit(dec, limit).error_code);
+    ASSERT_EQ(UHDR_CODEC_MEM_ERROR, uhdr_decode(dec).error_code);
+    uhdr_release_decoder(dec);
+  }
+
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_dec_set_memory_limit(nullptr, limit).error_code);
+  uhdr_release_decoder(refDec);
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, DecodeCostEstimate) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_gainmap_scale_factor(enc, 4).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  ASSERT_EQ(nullptr, uhdr_dec_get_cost_estimate(dec));
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enable_stats(dec, 1).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_probe(dec).error_code);
+  uhdr_decode_cost_t* cost = uhdr_dec_get_cost_estimate(dec);
+  ASSERT_NE(nullptr, cost);
+  ASSERT_EQ((size_t)kImageWidth * kImageHeight, cost->image_pixels);
+  ASSERT_EQ((size_t)(kImageWidth / 4) * (kImageHeight / 4), cost->gainmap_pixels);
+  // half float output by default, more than the 4 byte formats
+  ASSERT_EQ(cost->bytes_rgba_half_float, cost->bytes);
+  ASSERT_GT(cost->bytes_rgba_half_float, cost->bytes_rgba8888);
+  ASSERT_GT(cost->bytes_rgba8888, cost->bytes_rgba1010102);
+  ASSERT_GE(cost->bytes_rgba1010102, (size_t)kImageWidth * kImageHeight * 4);
+  ASSERT_EQ(0, cost->in_strips);
+  ASSERT_EQ(0, cost->gpu_capable);
+  // the projection bounds the decode
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(dec).error_code);
+  ASSERT_LE(uhdr_dec_get_stats(dec)->peak_bytes, cost->bytes);
+
+  // the estimate follows the configuration
+  uhdr_reset_decoder(dec);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK,
+            uhdr_dec_set_out_img_format(dec, UHDR_IMG_FMT_32bppRGBA1010102).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(dec, UHDR_CT_PQ).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enable_gpu_acceleration(dec, 1).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_probe(dec).error_code);
+  cost = uhdr_dec_get_cost_estimate(dec);
+  ASSERT_NE(nullptr, cost);
+  ASSERT_EQ(cost->bytes_rgba1010102, cost->bytes);
+#ifdef UHDR_ENABLE_GLES
+  ASSERT_EQ(1, cost->gpu_capable);
+#else
+  ASSERT_EQ(0, cost->gpu_capable);
+#endif
+
+  // a memory limit that calls for strips, which run on the cpu
+  uhdr_reset_decoder(dec);
+  const size_t limit = (size_t)kImageWidth * kImageHeight * 10;
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enable_gpu_acceleration(dec, 1).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_memory_limit(dec, limit).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_probe(dec).error_code);
+  cost = uhdr_dec_get_cost_estimate(dec);
+  ASSERT_NE(nullptr, cost);
+  ASSERT_GT(cost->bytes_rgba_half_float, limit);
+  ASSERT_LE(cost->bytes, limit);
+  ASSERT_EQ(1, cost->in_strips);
+  ASSERT_EQ(0, cost->gpu_capable);
+
+  ASSERT_EQ(nullptr, uhdr_dec_get_cost_estimate(nullptr));
+  uhdr_release_decoder(dec);
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, DecodeToP010) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  // P010 output matches the packed output converted afterwards, up to rounding of the kernels
+  uhdr_codec_private_t* refDec = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(refDec, compressedImage).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK,
+            uhdr_dec_set_out_img_format(refDec, UHDR_IMG_FMT_32bppRGBA1010102).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(refDec, UHDR_CT_PQ).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(refDec).error_code);
+  uhdr_raw_image_t packed = *uhdr_get_decoded_image(refDec);
+
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK,
+            uhdr_dec_set_out_img_format(dec, UHDR_IMG_FMT_24bppYCbCrP010).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(dec, UHDR_CT_PQ).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(dec).error_code);
+  uhdr_raw_image_t* output = uhdr_get_decoded_image(dec);
+  ASSERT_NE(nullptr, output);
+  ASSERT_EQ(UHDR_IMG_FMT_24bppYCbCrP010, output->fmt);
+  ASSERT_EQ(UHDR_CT_PQ, output->ct);
+  ASSERT_EQ(UHDR_CR_FULL_RANGE, output->range);
+  ASSERT_NE(UHDR_CG_UNSPECIFIED, output->cg);
+  ASSERT_EQ(kImageWidth, output->w);
+  ASSERT_EQ(kImageHeight, output->h);
+
+  packed.cg = output->cg;
+  uhdr_raw_image_ext_t expected(UHDR_IMG_FMT_24bppYCbCrP010, output->cg, UHDR_CT_PQ,
+                                UHDR_CR_FULL_RANGE, kImageWidth, kImageHeight, 1);
+  ASSERT_EQ(UHDR_CODEC_OK, convert_raw_input_to_ycbcr(&packed, &expected).error_code);
+  auto expectNear = [&](uhdr_raw_image_t* img) {
+    for (int p = UHDR_PLANE_Y; p <= UHDR_PLANE_UV; p++) {
+      const unsigned int rows = p == UHDR_PLANE_Y ? img->h : img->h / 2;
+      for (unsigned int i = 0; i < rows; i++) {
+        const uint16_t* exp = static_cast<uint16_t*>(expected.planes[p]) + i * expected.stride[p];
+        const uint16_t* got = static_cast<uint16_t*>(img->planes[p]) + i * img->stride[p];
+        for (unsigned int j = 0; j < img->w; j++) {
+          ASSERT_LE(std::abs((exp[j] >> 6) - (got[j] >> 6)), 1)
+              << "plane " << p << ", row " << i << ", column " << j;
+        }
+      }
+    }
+  };
+  expectNear(output);
+
+  // the strip wise decode under a memory limit produces the same output
+  {
+    const size_t limit = (size_t)kImageWidth * kImageHeight * 12;
+    uhdr_codec_private_t* stripDec = uhdr_create_decoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(stripDec, compressedImage).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK,
+              uhdr_dec_set_out_img_format(stripDec, UHDR_IMG_FMT_24bppYCbCrP010).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(stripDec, UHDR_CT_PQ).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_memory_limit(stripDec, limit).error_code);
+    uhdr_error_info_t status = uhdr_dec_probe(stripDec);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    ASSERT_EQ(1, uhdr_dec_get_cost_estimate(stripDec)->in_strips);
+    status = uhdr_decode(stripDec);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    expectNear(uhdr_get_decoded_image(stripDec));
+    uhdr_release_decoder(stripDec);
+  }
+
+  // P010 is hlg or pq only
+  uhdr_reset_decoder(dec);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK,
+            uhdr_dec_set_out_img_format(dec, UHDR_IMG_FMT_24bppYCbCrP010).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(dec, UHDR_CT_LINEAR).error_code);
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_decode(dec).error_code);
+
+  uhdr_release_decoder(dec);
+  uhdr_release_decoder(refDec);
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, DecodeToOutputColorGamut) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  uhdr_codec_private_t* refDec = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(refDec, compressedImage).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(refDec).error_code);
+  uhdr_raw_image_t* ref = uhdr_get_decoded_image(refDec);
+  ASSERT_NE(nullptr, ref);
+  const uhdr_color_gamut_t outCg =
+      ref->cg == UHDR_CG_BT_2100 ? UHDR_CG_DISPLAY_P3 : UHDR_CG_BT_2100;
+  ColorTransformFn conversion = getGamutConversionFn(
+      outCg, ref->cg == UHDR_CG_UNSPECIFIED ? UHDR_CG_BT_709 : ref->cg);
+  ASSERT_NE(nullptr, conversion);
+
+  // linear output in another gamut matches the default output converted afterwards
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_gamut(dec, outCg).error_code);
+  uhdr_error_info_t status = uhdr_decode(dec);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_raw_image_t* output = uhdr_get_decoded_image(dec);
+  ASSERT_NE(nullptr, output);
+  ASSERT_EQ(outCg, output->cg);
+  for (unsigned int i = 0; i < output->h; i++) {
+    const uint64_t* exp =
+        static_cast<uint64_t*>(ref->planes[UHDR_PLANE_PACKED]) + i * ref->stride[UHDR_PLANE_PACKED];
+    const uint64_t* got = static_cast<uint64_t*>(output->planes[UHDR_PLANE_PACKED]) +
+                          i * output->stride[UHDR_PLANE_PACKED];
+    for (unsigned int j = 0; j < output->w; j++) {
+      Color e = conversion({{{halfToFloat(exp[j] & 0xffff), halfToFloat((exp[j] >> 16) & 0xffff),
+                              halfToFloat((exp[j] >> 32) & 0xffff)}}});
+      Color g = {{{halfToFloat(got[j] & 0xffff), halfToFloat((got[j] >> 16) & 0xffff),
+                   halfToFloat((got[j] >> 32) & 0xffff)}}};
+      ASSERT_NEAR(e.r, g.r, 1e-2f + 1e-2f * std::fabs(e.r)) << "row " << i << ", column " << j;
+      ASSERT_NEAR(e.g, g.g, 1e-2f + 1e-2f * std::fabs(e.g)) << "row " << i << ", column " << j;
+      ASSERT_NEAR(e.b, g.b, 1e-2f + 1e-2f * std::fabs(e.b)) << "row " << i << ", column " << j;
+    }
+  }
+
+  // the conversion is not offered for sdr output
+  uhdr_reset_decoder(dec);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK,
+            uhdr_dec_set_out_img_format(dec, UHDR_IMG_FMT_32bppRGBA8888).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(dec, UHDR_CT_SRGB).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_gamut(dec, outCg).error_code);
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_decode(dec).error_code);
+
+  uhdr_release_decoder(dec);
+  uhdr_release_decoder(refDec);
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, DecodeApproximateGainMap) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+  // the approximation covers single channel gain maps. The image width is not a multiple of the
+  // scale factor, so no pixel takes the row kernels
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_using_multi_channel_gainmap(enc, 0).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_gainmap_scale_factor(enc, 3).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  for (auto ct : {UHDR_CT_HLG, UHDR_CT_PQ}) {
+    uhdr_codec_private_t* decs[2];
+    for (int approximate = 0; approximate < 2; approximate++) {
+      decs[approximate] = uhdr_create_decoder();
+      uhdr_codec_private_t* dec = decs[approximate];
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+      ASSERT_EQ(UHDR_CODEC_OK,
+                uhdr_dec_set_out_img_format(dec, UHDR_IMG_FMT_32bppRGBA1010102).error_code);
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(dec, ct).error_code);
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_enable_approximate_gainmap(dec, approximate).error_code);
+      uhdr_error_info_t status = uhdr_decode(dec);
+      ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    }
+    uhdr_raw_image_t* exact = uhdr_get_decoded_image(decs[0]);
+    uhdr_raw_image_t* approx = uhdr_get_decoded_image(decs[1]);
+    ASSERT_NE(nullptr, exact);
+    ASSERT_NE(nullptr, approx);
+
+    // Within a code of the exact output above a quarter of the range. In the darks the exact
+    // output carries the error of the pq oetf lut of the float path, several codes at its worst,
+    // which the table of the approximation does not share. Those only count towards the mean.
+    size_t sumError = 0, count = 0;
+    for (unsigned int i = 0; i < exact->h; i++) {
+      const uint32_t* exp = static_cast<uint32_t*>(exact->planes[UHDR_PLANE_PACKED]) +
+                            i * exact->stride[UHDR_PLANE_PACKED];
+      const uint32_t* got = static_cast<uint32_t*>(approx->planes[UHDR_PLANE_PACKED]) +
+                            i * approx->stride[UHDR_PLANE_PACKED];
+      for (unsigned int j = 0; j < exact->w; j++) {
+        for (int shift = 0; shift < 30; shift += 10) {
+          const int e = (exp[j] >> shift) & 0x3ff, g = (got[j] >> shift) & 0x3ff;
+          const int error = std::abs(e - g);
+          if (e > 256) {
+            ASSERT_LE(error, 1) << "row " << i << ", column " << j << ", transfer " << ct;
+          }
+          sumError += error;
+          count++;
+        }
+      }
+    }
+    EXPECT_LE((double)sumError / count, 0.25) << "transfer " << ct;
+    uhdr_release_decoder(decs[0]);
+    uhdr_release_decoder(decs[1]);
+  }
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, DecodeLuminanceStats) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_dec_enable_luminance_stats(nullptr, 1).error_code);
+  ASSERT_EQ(nullptr, uhdr_dec_get_luminance_stats(nullptr));
+  auto decode = [compressedImage](uhdr_img_fmt_t fmt, uhdr_color_transfer_t ct, int enable,
+                                  const std::function<void(uhdr_codec_private_t*)>& add) {
+    uhdr_codec_private_t* dec = uhdr_create_decoder();
+    EXPECT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+    EXPECT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_img_format(dec, fmt).error_code);
+    EXPECT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(dec, ct).error_code);
+    EXPECT_EQ(UHDR_CODEC_OK, uhdr_dec_enable_luminance_stats(dec, enable).error_code);
+    add(dec);
+    return dec;
+  };
+  auto none = [](uhdr_codec_private_t*) {};
+
+  // reference statistics of a linear output, with a log2 per pixel
+  uhdr_codec_private_t* dec = decode(UHDR_IMG_FMT_64bppRGBAHalfFloat, UHDR_CT_LINEAR, 1, none);
+  uhdr_error_info_t status = uhdr_decode(dec);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_dec_enable_luminance_stats(dec, 0).error_code);
+  uhdr_raw_image_t* linear = uhdr_get_decoded_image(dec);
+  ASSERT_NE(nullptr, linear);
+  ultrahdr::LuminanceFn luminance = ultrahdr::getLuminanceFn(linear->cg);
+  ASSERT_NE(nullptr, luminance);
+  double sum = 0.0;
+  float maxLuminance = 0.0f;
+  size_t histogram[UHDR_LUMINANCE_HISTOGRAM_BINS] = {};
+  for (unsigned int i = 0; i < linear->h; i++) {
+    const uint64_t* row = static_cast<uint64_t*>(linear->planes[UHDR_PLANE_PACKED]) +
+                          (size_t)i * linear->stride[UHDR_PLANE_PACKED];
+    for (unsigned int j = 0; j < linear->w; j++) {
+      ultrahdr::Color rgb = {{{ultrahdr::halfToFloat(row[j] & 0xffff),
+                               ultrahdr::halfToFloat((row[j] >> 16) & 0xffff),
+                               ultrahdr::halfToFloat((row[j] >> 32) & 0xffff)}}};
+      const float y = (std::max)(luminance(rgb), 0.0f);
+      sum += y;
+      maxLuminance = (std::max)(maxLuminance, y);
+      const int bin = y > 0.0f ? (int)std::floor(2.0 * (std::log2((double)y) -
+                                                        UHDR_LUMINANCE_HISTOGRAM_MIN_LOG2))
+                               : 0;
+      histogram[std::clamp(bin, 0, UHDR_LUMINANCE_HISTOGRAM_BINS - 1)]++;
+    }
+  }
+  const size_t numPixels = (size_t)kImageWidth * kImageHeight;
+  uhdr_luminance_stats_t* stats = uhdr_dec_get_luminance_stats(dec);
+  ASSERT_NE(nullptr, stats);
+  ASSERT_EQ(numPixels, stats->num_pixels);
+  EXPECT_NEAR(maxLuminance, stats->max_luminance, maxLuminance * 1e-3f);
+  EXPECT_NEAR(sum / numPixels, stats->mean_luminance, sum / numPixels * 1e-4);
+  EXPECT_GT(stats->max_luminance, 1.0f);
+  size_t binned = 0, misplaced = 0;
+  for (int i = 0; i < UHDR_LUMINANCE_HISTOGRAM_BINS; i++) {
+    binned += stats->histogram[i];
+    misplaced += (size_t)std::abs((long long)histogram[i] - (long long)stats->histogram[i]);
+  }
+  ASSERT_EQ(numPixels, binned);
+  EXPECT_LE(misplaced, numPixels / 1000) << "pixels off their bin at the bin bounds";
+  const uhdr_luminance_stats_t linearStats = *stats;
+  uhdr_release_decoder(dec);
+
+  // the encoded outputs agree with the linear one up to their quantization, P010 output is
+  // gathered from the rgb rows it is converted from
+  std::vector<std::pair<uhdr_img_fmt_t, uhdr_color_transfer_t>> outputs = {
+      {UHDR_IMG_FMT_32bppRGBA1010102, UHDR_CT_HLG},
+      {UHDR_IMG_FMT_32bppRGBA1010102, UHDR_CT_PQ},
+      {UHDR_IMG_FMT_24bppYCbCrP010, UHDR_CT_HLG}};
+  uhdr_luminance_stats_t hlgStats{};
+  for (const auto& [fmt, ct] : outputs) {
+    dec = decode(fmt, ct, 1, none);
+    status = uhdr_decode(dec);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    stats = uhdr_dec_get_luminance_stats(dec);
+    ASSERT_NE(nullptr, stats);
+    ASSERT_EQ(numPixels, stats->num_pixels);
+    EXPECT_NEAR(linearStats.max_luminance, stats->max_luminance,
+                linearStats.max_luminance * 0.02f) << "transfer " << ct;
+    EXPECT_NEAR(linearStats.mean_luminance, stats->mean_luminance,
+                linearStats.mean_luminance * 0.02f) << "transfer " << ct;
+    if (ct == UHDR_CT_HLG && fmt == UHDR_IMG_FMT_32bppRGBA1010102) {
+      hlgStats = *stats;
+    } else if (ct == UHDR_CT_HLG) {
+      EXPECT_EQ(0, memcmp(&hlgStats, stats, sizeof hlgStats));
+    }
+    uhdr_release_decoder(dec);
+  }
+
+  // a strip wise decode gathers the statistics of the whole image
+  dec = decode(UHDR_IMG_FMT_32bppRGBA1010102, UHDR_CT_HLG, 1, [](uhdr_codec_private_t* d) {
+    ASSERT_EQ(UHDR_CODEC_OK,
+              uhdr_dec_set_strip_callback(
+                  d, [](void*, const uhdr_raw_image_t*, unsigned int) { return 0; }, nullptr, 64)
+                  .error_code);
+  });
+  status = uhdr_decode(dec);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  stats = uhdr_dec_get_luminance_stats(dec);
+  ASSERT_NE(nullptr, stats);
+  EXPECT_EQ(0, memcmp(&hlgStats, stats, sizeof hlgStats));
+  uhdr_release_decoder(dec);
+
+  // sdr output with a display boost is relative to the boost
+  dec = decode(UHDR_IMG_FMT_32bppRGBA8888, UHDR_CT_SRGB, 1, [](uhdr_codec_private_t* d) {
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_max_display_boost(d, 2.0f).error_code);
+  });
+  status = uhdr_decode(dec);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  stats = uhdr_dec_get_luminance_stats(dec);
+  ASSERT_NE(nullptr, stats);
+  EXPECT_GT(stats->max_luminance, 1.0f);
+  EXPECT_LE(stats->max_luminance, 2.0f + 1e-3f);
+  uhdr_release_decoder(dec);
+
+  // no statistics without a gain map applied or when disabled
+  dec = decode(UHDR_IMG_FMT_32bppRGBA8888, UHDR_CT_SRGB, 1, none);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(dec).error_code);
+  EXPECT_EQ(nullptr, uhdr_dec_get_luminance_stats(dec));
+  uhdr_release_decoder(dec);
+  dec = decode(UHDR_IMG_FMT_32bppRGBA1010102, UHDR_CT_HLG, 0, none);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(dec).error_code);
+  EXPECT_EQ(nullptr, uhdr_dec_get_luminance_stats(dec));
+  uhdr_release_decoder(dec);
+
+  // unsupported combinations
+  dec = decode(UHDR_IMG_FMT_32bppRGBA1010102, UHDR_CT_HLG, 1, [](uhdr_codec_private_t* d) {
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_add_effect_rotate(d, 90).error_code);
+  });
+  ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_decode(dec).error_code);
+  EXPECT_EQ(nullptr, uhdr_dec_get_luminance_stats(dec));
+  uhdr_release_decoder(dec);
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, DecodeFastUpsampling) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  ASSERT_NE(UHDR_CODEC_OK, uhdr_dec_enable_fast_upsampling(nullptr, 1).error_code)
+      << "fail, API allows nullptr decoder instance";
+  for (auto ct : {UHDR_CT_SRGB, UHDR_CT_HLG}) {
+    uhdr_codec_private_t* decs[2];
+    for (int fast = 0; fast < 2; fast++) {
+      decs[fast] = uhdr_create_decoder();
+      uhdr_codec_private_t* dec = decs[fast];
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+      ASSERT_EQ(UHDR_CODEC_OK,
+                uhdr_dec_set_out_img_format(dec, ct == UHDR_CT_SRGB ? UHDR_IMG_FMT_32bppRGBA8888
+                                                                    : UHDR_IMG_FMT_32bppRGBA1010102)
+                    .error_code);
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(dec, ct).error_code);
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_enable_fast_upsampling(dec, fast).error_code);
+      uhdr_error_info_t status = uhdr_decode(dec);
+      ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+      ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_dec_enable_fast_upsampling(dec, 0).error_code)
+          << "fail, API allows configuration after decode";
+    }
+    uhdr_raw_image_t* fancy = uhdr_get_decoded_image(decs[0]);
+    uhdr_raw_image_t* fast = uhdr_get_decoded_image(decs[1]);
+    ASSERT_NE(nullptr, fancy);
+    ASSERT_NE(nullptr, fast);
+
+    // hdr outputs are computed from the subsampled chroma planes either way. For sdr outputs the
+    // replicated chroma only departs from the filtered one around chroma edges
+    size_t sumError = 0, count = 0;
+    for (unsigned int i = 0; i < fancy->h; i++) {
+      const uint32_t* exp = static_cast<uint32_t*>(fancy->planes[UHDR_PLANE_PACKED]) +
+                            i * fancy->stride[UHDR_PLANE_PACKED];
+      const uint32_t* got = static_cast<uint32_t*>(fast->planes[UHDR_PLANE_PACKED]) +
+                            i * fast->stride[UHDR_PLANE_PACKED];
+      if (ct != UHDR_CT_SRGB) {
+        ASSERT_EQ(0, memcmp(exp, got, fancy->w * 4)) << "row " << i;
+        continue;
+      }
+      for (unsigned int j = 0; j < fancy->w; j++) {
+        for (int shift = 0; shift < 24; shift += 8) {
+          sumError += std::abs((int)((exp[j] >> shift) & 0xff) - (int)((got[j] >> shift) & 0xff));
+          count++;
+        }
+      }
+    }
+    if (ct == UHDR_CT_SRGB) {
+      EXPECT_GT(sumError, 0u) << "fast upsampling has not been applied";
+      EXPECT_LE((double)sumError / count, 1.0);
+    }
+    uhdr_release_decoder(decs[0]);
+    uhdr_release_decoder(decs[1]);
+  }
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, DecodeGainMapOnly) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  ASSERT_NE(UHDR_CODEC_OK, uhdr_dec_set_gainmap_only_decode(nullptr, 1).error_code)
+      << "fail, API allows nullptr decoder instance";
+
+  // reference gain map of a full decode
+  uhdr_codec_private_t* ref = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(ref, compressedImage).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(ref).error_code);
+  uhdr_raw_image_t* refGainmap = uhdr_get_decoded_gainmap_image(ref);
+  ASSERT_NE(nullptr, refGainmap);
+  uhdr_gainmap_metadata_t* refMetadata = uhdr_dec_get_gainmap_metadata(ref);
+  ASSERT_NE(nullptr, refMetadata);
+
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_dec_set_gainmap_only_decode(dec, 3).error_code)
+      << "fail, API allows a scale denominator other than 0, 1, 2, 4 or 8";
+  for (int denom : {1, 2, 8}) {
+    uhdr_reset_decoder(dec);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enable_stats(dec, 1).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_gainmap_only_decode(dec, denom).error_code);
+    uhdr_error_info_t status = uhdr_decode(dec);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_dec_set_gainmap_only_decode(dec, 0).error_code)
+        << "fail, API allows configuration after decode";
+    EXPECT_EQ(nullptr, uhdr_get_decoded_image(dec));
+    uhdr_codec_stats_t* stats = uhdr_dec_get_stats(dec);
+    ASSERT_NE(nullptr, stats);
+    EXPECT_EQ(0u, stats->stages[UHDR_STAGE_BASE_DECODE].calls) << "base image decoded";
+    EXPECT_EQ(0u, stats->stages[UHDR_STAGE_GAINMAP_APPLY].calls) << "gain map applied";
+    EXPECT_EQ(1u, stats->stages[UHDR_STAGE_GAINMAP_DECODE].calls);
+
+    uhdr_gainmap_metadata_t* metadata = uhdr_dec_get_gainmap_metadata(dec);
+    ASSERT_NE(nullptr, metadata);
+    EXPECT_EQ(refMetadata->max_content_boost, metadata->max_content_boost);
+    EXPECT_EQ(refMetadata->hdr_capacity_max, metadata->hdr_capacity_max);
+
+    uhdr_raw_image_t* gainmap = uhdr_get_decoded_gainmap_image(dec);
+    ASSERT_NE(nullptr, gainmap);
+    ASSERT_EQ(refGainmap->fmt, gainmap->fmt);
+    ASSERT_EQ((refGainmap->w + denom - 1) / denom, gainmap->w);
+    ASSERT_EQ((refGainmap->h + denom - 1) / denom, gainmap->h);
+    if (denom == 1) {
+      const size_t bpp = gainmap->fmt == UHDR_IMG_FMT_32bppRGBA8888 ? 4 : 1;
+      for (unsigned int i = 0; i < gainmap->h; i++) {
+        const uint8_t* exp = static_cast<uint8_t*>(refGainmap->planes[UHDR_PLANE_PACKED]) +
+                             i * refGainmap->stride[UHDR_PLANE_PACKED] * bpp;
+        const uint8_t* got = static_cast<uint8_t*>(gainmap->planes[UHDR_PLANE_PACKED]) +
+                             i * gainmap->stride[UHDR_PLANE_PACKED] * bpp;
+        ASSERT_EQ(0, memcmp(exp, got, gainmap->w * bpp)) << "row " << i;
+      }
+    }
+  }
+
+  uhdr_reset_decoder(dec);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_gainmap_only_decode(dec, 1).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_add_effect_mirror(dec, UHDR_MIRROR_HORIZONTAL).error_code);
+  EXPECT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_decode(dec).error_code)
+      << "fail, gain map only decode combines with image effects";
+
+  uhdr_release_decoder(dec);
+  uhdr_release_decoder(ref);
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, DecodeIntoOutputImage) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  JpegR jpegr;
+  jpeg_info_struct primaryInfo, gainmapInfo;
+  jpegr_info_struct info;
+  info.primaryImgInfo = &primaryInfo;
+  info.gainmapImgInfo = &gainmapInfo;
+  uhdr_error_info_t status = jpegr.getJPEGRInfo(compressedImage, &info);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  const uhdr_img_fmt_t gainmapFmt =
+      gainmapInfo.numComponents == 1 ? UHDR_IMG_FMT_8bppYCbCr400 : UHDR_IMG_FMT_32bppRGBA8888;
+  const size_t gainmapBpp = gainmapInfo.numComponents == 1 ? 1 : 4;
+
+  // outputs of the layout of the decode are written in place, the sources are not held then
+  JpegRDecodeCache cache;
+  jpegr.setDecodeCache(&cache);
+  uhdr_raw_image_ext_t dest(UHDR_IMG_FMT_32bppRGBA8888, UHDR_CG_UNSPECIFIED, UHDR_CT_SRGB,
+                            UHDR_CR_UNSPECIFIED, kImageWidth, kImageHeight, 1);
+  uhdr_raw_image_ext_t gainmap(gainmapFmt, UHDR_CG_UNSPECIFIED, UHDR_CT_UNSPECIFIED,
+                               UHDR_CR_UNSPECIFIED, gainmapInfo.width, gainmapInfo.height, 1);
+  status = jpegr.decodeJPEGR(compressedImage, &dest, FLT_MAX, UHDR_CT_SRGB,
+                             UHDR_IMG_FMT_32bppRGBA8888, &gainmap);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  EXPECT_TRUE(cache.mSdrDecoder.isResultInOutputImage());
+  EXPECT_TRUE(cache.mGainmapDecoder.isResultInOutputImage());
+  EXPECT_FALSE(cache.mHoldsSources);
+
+  // outputs with padded rows are copied to
+  JpegR refJpegr;
+  uhdr_raw_image_ext_t refDestBuffer(UHDR_IMG_FMT_32bppRGBA8888, UHDR_CG_UNSPECIFIED,
+                                     UHDR_CT_SRGB, UHDR_CR_UNSPECIFIED, kImageWidth + 8,
+                                     kImageHeight, 1);
+  uhdr_raw_image_ext_t refGainmapBuffer(gainmapFmt, UHDR_CG_UNSPECIFIED, UHDR_CT_UNSPECIFIED,
+                                        UHDR_CR_UNSPECIFIED, gainmapInfo.width + 8,
+                                        gainmapInfo.height, 1);
+  uhdr_raw_image_ext_t refDest(refDestBuffer, 0, 0, kImageWidth, kImageHeight);
+  uhdr_raw_image_ext_t refGainmap(refGainmapBuffer, 0, 0, gainmapInfo.width, gainmapInfo.height);
+  status = refJpegr.decodeJPEGR(compressedImage, &refDest, FLT_MAX, UHDR_CT_SRGB,
+                                UHDR_IMG_FMT_32bppRGBA8888, &refGainmap);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+
+  for (unsigned int y = 0; y < dest.h; y++) {
+    ASSERT_EQ(0, memcmp(static_cast<uint8_t*>(dest.planes[UHDR_PLANE_PACKED]) +
+                            (size_t)y * dest.stride[UHDR_PLANE_PACKED] * 4,
+                        static_cast<uint8_t*>(refDest.planes[UHDR_PLANE_PACKED]) +
+                            (size_t)y * refDest.stride[UHDR_PLANE_PACKED] * 4,
+                        dest.w * 4))
+        << "row " << y;
+  }
+  for (unsigned int y = 0; y < gainmap.h; y++) {
+    ASSERT_EQ(0, memcmp(static_cast<uint8_t*>(gainmap.planes[UHDR_PLANE_Y]) +
+                            (size_t)y * gainmap.stride[UHDR_PLANE_Y] * gainmapBpp,
+                        static_cast<uint8_t*>(refGainmap.planes[UHDR_PLANE_Y]) +
+                            (size_t)y * refGainmap.stride[UHDR_PLANE_Y] * gainmapBpp,
+                        gainmap.w * gainmapBpp))
+        << "gain map row " << y;
+  }
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, DecodeWithGainMapWeighedOut) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  JpegR refJpegr;
+  jpeg_info_struct primaryInfo, gainmapInfo;
+  jpegr_info_struct info;
+  info.primaryImgInfo = &primaryInfo;
+  info.gainmapImgInfo = &gainmapInfo;
+  uhdr_error_info_t status = refJpegr.getJPEGRInfo(compressedImage, &info);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  const uhdr_img_fmt_t gainmapFmt =
+      gainmapInfo.numComponents == 1 ? UHDR_IMG_FMT_8bppYCbCr400 : UHDR_IMG_FMT_32bppRGBA8888;
+
+  // a display boost of hdr_capacity_min leaves the output to the base image and the offsets. The
+  // reference decodes the gain map, as it is asked for.
+  for (unsigned int scale : {1u, 2u}) {
+    for (uhdr_color_transfer_t ct : {UHDR_CT_HLG, UHDR_CT_LINEAR}) {
+      const uhdr_img_fmt_t fmt =
+          ct == UHDR_CT_LINEAR ? UHDR_IMG_FMT_64bppRGBAHalfFloat : UHDR_IMG_FMT_32bppRGBA1010102;
+      const size_t bpp = ct == UHDR_CT_LINEAR ? 8 : 4;
+      const unsigned int w = kImageWidth / scale, h = kImageHeight / scale;
+      uhdr_raw_image_ext_t refDest(fmt, UHDR_CG_UNSPECIFIED, ct, UHDR_CR_UNSPECIFIED, w, h, 1);
+      uhdr_raw_image_ext_t gainmap(gainmapFmt, UHDR_CG_UNSPECIFIED, UHDR_CT_UNSPECIFIED,
+                                   UHDR_CR_UNSPECIFIED,
+                                   (gainmapInfo.width + scale - 1) / scale,
+                                   (gainmapInfo.height + scale - 1) / scale, 1);
+      uhdr_gainmap_metadata_t refMetadata;
+      status = refJpegr.decodeJPEGRScaled(compressedImage, scale, &refDest, 1.0f, ct, fmt,
+                                          &gainmap, &refMetadata);
+      ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+      ASSERT_LE(1.0f, refMetadata.hdr_capacity_min);
+
+      JpegR jpegr;
+      CodecStats stats;
+      jpegr.setStats(&stats);
+      uhdr_raw_image_ext_t dest(fmt, UHDR_CG_UNSPECIFIED, ct, UHDR_CR_UNSPECIFIED, w, h, 1);
+      uhdr_gainmap_metadata_t metadata;
+      {
+        CodecStats::Scope scope(&stats);
+        status = jpegr.decodeJPEGRScaled(compressedImage, scale, &dest, 1.0f, ct, fmt, nullptr,
+                                         &metadata);
+      }
+      ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+      ASSERT_NE(nullptr, stats.get());
+      EXPECT_EQ(0u, stats.get()->stages[UHDR_STAGE_GAINMAP_DECODE].calls);
+      EXPECT_EQ(0, memcmp(&metadata, &refMetadata, sizeof metadata));
+      for (unsigned int y = 0; y < h; y++) {
+        ASSERT_EQ(0, memcmp(static_cast<uint8_t*>(dest.planes[UHDR_PLANE_PACKED]) +
+                                (size_t)y * dest.stride[UHDR_PLANE_PACKED] * bpp,
+                            static_cast<uint8_t*>(refDest.planes[UHDR_PLANE_PACKED]) +
+                                (size_t)y * refDest.stride[UHDR_PLANE_PACKED] * bpp,
+                            w * bpp))
+            << "row " << y << ", transfer " << ct << ", scale 1/" << scale;
+      }
+    }
+  }
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, RenderRegion) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  const float kDisplayBoost = 2.0f;
+  uhdr_codec_private_t* decs[2];
+  for (int i = 0; i < 2; i++) {
+    decs[i] = uhdr_create_decoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(decs[i], compressedImage).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK,
+              uhdr_dec_set_out_img_format(decs[i], UHDR_IMG_FMT_32bppRGBA1010102).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(decs[i], UHDR_CT_HLG).error_code);
+  }
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_max_display_boost(decs[0], kDisplayBoost).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(decs[0]).error_code);
+  uhdr_raw_image_t* full = uhdr_get_decoded_image(decs[0]);
+  ASSERT_NE(nullptr, full);
+
+  // aligned, odd and touching the bottom right corner
+  const int regions[][4] = {{0, 0, 64, 48},
+                            {37, 21, 101, 55},
+                            {kImageWidth - 33, kImageHeight - 17, 33, 17}};
+  for (const auto& r : regions) {
+    uhdr_raw_image_t* region = nullptr;
+    uhdr_error_info_t status =
+        uhdr_dec_render_region(decs[1], r[0], r[1], r[2], r[3], kDisplayBoost, &region);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    ASSERT_NE(nullptr, region);
+    ASSERT_EQ(UHDR_IMG_FMT_32bppRGBA1010102, region->fmt);
+    ASSERT_EQ((unsigned int)r[2], region->w);
+    ASSERT_EQ((unsigned int)r[3], region->h);
+    for (int i = 0; i < r[3]; i++) {
+      const uint32_t* exp = static_cast<uint32_t*>(full->planes[UHDR_PLANE_PACKED]) +
+                            (size_t)(r[1] + i) * full->stride[UHDR_PLANE_PACKED] + r[0];
+      const uint32_t* got = static_cast<uint32_t*>(region->planes[UHDR_PLANE_PACKED]) +
+                            (size_t)i * region->stride[UHDR_PLANE_PACKED];
+      ASSERT_EQ(0, memcmp(exp, got, r[2] * sizeof(uint32_t)))
+          << "row " << i << " of region at (" << r[0] << ", " << r[1] << ")";
+    }
+
+    // a second call is served from the cache, another display boost is rendered anew
+    uhdr_raw_image_t* cached = nullptr;
+    ASSERT_EQ(UHDR_CODEC_OK,
+              uhdr_dec_render_region(decs[1], r[0], r[1], r[2], r[3], kDisplayBoost, &cached)
+                  .error_code);
+    EXPECT_EQ(region, cached);
+    uhdr_raw_image_t* boosted = nullptr;
+    ASSERT_EQ(UHDR_CODEC_OK,
+              uhdr_dec_render_region(decs[1], r[0], r[1], r[2], r[3], 4.0f, &boosted).error_code);
+    EXPECT_NE(region, boosted);
+  }
+
+  uhdr_raw_image_t* region = nullptr;
+  EXPECT_EQ(UHDR_CODEC_INVALID_PARAM,
+            uhdr_dec_render_region(decs[1], kImageWidth - 8, 0, 16, 16, kDisplayBoost, &region)
+                .error_code);
+  EXPECT_EQ(nullptr, region);
+  EXPECT_EQ(UHDR_CODEC_INVALID_PARAM,
+            uhdr_dec_render_region(decs[1], 0, 0, 16, 16, 0.5f, &region).error_code);
+  uhdr_release_decoder(decs[0]);
+  uhdr_release_decoder(decs[1]);
+
+  // with a memory limit, the decoded sources and the cached regions count against it. The limit
+  // is that of a whole image decode, which leaves room for two renditions of the whole image but
+  // not three, or that of a decode into a caller buffer, which leaves room for small regions.
+  std::vector<uint32_t> outputBuffer(kImageWidth * kImageHeight);
+  uhdr_raw_image_t output{};
+  output.fmt = UHDR_IMG_FMT_32bppRGBA1010102;
+  output.cg = UHDR_CG_BT_2100;
+  output.ct = UHDR_CT_HLG;
+  output.range = UHDR_CR_FULL_RANGE;
+  output.w = kImageWidth;
+  output.h = kImageHeight;
+  output.planes[UHDR_PLANE_PACKED] = outputBuffer.data();
+  output.stride[UHDR_PLANE_PACKED] = kImageWidth;
+  for (bool intoBuffer : {false, true}) {
+    SCOPED_TRACE(intoBuffer ? "limit of a decode into a caller buffer" : "limit of a decode");
+    uhdr_codec_private_t* limited[2];
+    for (uhdr_codec_private_t*& dec : limited) {
+      dec = uhdr_create_decoder();
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+      ASSERT_EQ(UHDR_CODEC_OK,
+                uhdr_dec_set_out_img_format(dec, UHDR_IMG_FMT_32bppRGBA1010102).error_code);
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(dec, UHDR_CT_HLG).error_code);
+      if (intoBuffer) ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_output_buffer(dec, &output).error_code);
+    }
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_probe(limited[0]).error_code);
+    const size_t limit = uhdr_dec_get_cost_estimate(limited[0])->bytes + 64 * 1024;
+    uhdr_codec_private_t* dec = limited[1];
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_memory_limit(dec, limit).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enable_stats(dec, 1).error_code);
+    // image buffers allocated by the call, UINT_MAX if it fails
+    auto render = [dec](int w, int h, float boost, uhdr_codec_err_t expected = UHDR_CODEC_OK) {
+      uhdr_raw_image_t* out = nullptr;
+      uhdr_error_info_t status = uhdr_dec_render_region(dec, 0, 0, w, h, boost, &out);
+      EXPECT_EQ(expected, status.error_code) << status.detail;
+      return out != nullptr ? uhdr_dec_get_stats(dec)->num_allocations : UINT_MAX;
+    };
+    if (intoBuffer) {
+      EXPECT_EQ(UINT_MAX, render(kImageWidth, kImageHeight, 2.0f, UHDR_CODEC_MEM_ERROR));
+      EXPECT_NE(0u, render(64, 64, 2.0f));
+      EXPECT_EQ(0u, render(64, 64, 2.0f));
+    } else {
+      EXPECT_NE(0u, render(kImageWidth, kImageHeight, 2.0f));
+      EXPECT_EQ(0u, render(kImageWidth, kImageHeight, 2.0f));
+      EXPECT_NE(0u, render(kImageWidth, kImageHeight, 3.0f));
+      EXPECT_NE(0u, render(kImageWidth, kImageHeight, 4.0f));
+      EXPECT_EQ(0u, render(kImageWidth, kImageHeight, 4.0f));
+      EXPECT_NE(0u, render(kImageWidth, kImageHeight, 2.0f));
+    }
+    uhdr_release_decoder(limited[0]);
+    uhdr_release_decoder(limited[1]);
+  }
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, RerenderForDisplayBoost) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  // decs[0] decodes at each boost, decs[1] re-renders
+  uhdr_codec_private_t* decs[2];
+  for (int i = 0; i < 2; i++) {
+    decs[i] = uhdr_create_decoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enable_stats(decs[i], 1).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(decs[i], compressedImage).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK,
+              uhdr_dec_set_out_img_format(decs[i], UHDR_IMG_FMT_32bppRGBA1010102).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(decs[i], UHDR_CT_PQ).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_max_display_boost(decs[i], 1.5f).error_code);
+  }
+  EXPECT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_dec_rerender(decs[1], 3.0f).error_code)
+      << "re-render ahead of the decode";
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(decs[1]).error_code);
+
+  for (float boost : {3.0f, 1.0f, 2.5f}) {
+    uhdr_error_info_t status = uhdr_dec_rerender(decs[1], boost);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    uhdr_codec_stats_t* stats = uhdr_dec_get_stats(decs[1]);
+    ASSERT_NE(nullptr, stats);
+    EXPECT_EQ(0u, stats->stages[UHDR_STAGE_BASE_DECODE].calls) << "base image decoded again";
+    EXPECT_EQ(0u, stats->stages[UHDR_STAGE_GAINMAP_DECODE].calls) << "gain map decoded again";
+    EXPECT_EQ(1u, stats->stages[UHDR_STAGE_GAINMAP_APPLY].calls);
+
+    uhdr_reset_decoder(decs[0]);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(decs[0], compressedImage).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK,
+              uhdr_dec_set_out_img_format(decs[0], UHDR_IMG_FMT_32bppRGBA1010102).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(decs[0], UHDR_CT_PQ).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_max_display_boost(decs[0], boost).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(decs[0]).error_code);
+    uhdr_raw_image_t* exp = uhdr_get_decoded_image(decs[0]);
+    uhdr_raw_image_t* got = uhdr_get_decoded_image(decs[1]);
+    ASSERT_NE(nullptr, exp);
+    ASSERT_NE(nullptr, got);
+    ASSERT_EQ(exp->w, got->w);
+    ASSERT_EQ(exp->h, got->h);
+    for (unsigned int i = 0; i < exp->h; i++) {
+      ASSERT_EQ(0, memcmp(static_cast<uint32_t*>(exp->planes[UHDR_PLANE_PACKED]) +
+                              i * exp->stride[UHDR_PLANE_PACKED],
+                          static_cast<uint32_t*>(got->planes[UHDR_PLANE_PACKED]) +
+                              i * got->stride[UHDR_PLANE_PACKED],
+                          exp->w * sizeof(uint32_t)))
+          << "row " << i << ", display boost " << boost;
+    }
+  }
+  EXPECT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_dec_rerender(decs[1], 0.5f).error_code);
+  uhdr_release_decoder(decs[0]);
+  uhdr_release_decoder(decs[1]);
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, DecodeRenditions) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  struct Rendition {
+    uhdr_img_fmt_t fmt;
+    uhdr_color_transfer_t ct;
+    float boost;
+  };
+  // the final rendition, then the added ones. The first three share a sweep.
+  const Rendition renditions[] = {
+      {UHDR_IMG_FMT_64bppRGBAHalfFloat, UHDR_CT_LINEAR, FLT_MAX},
+      {UHDR_IMG_FMT_32bppRGBA1010102, UHDR_CT_PQ, 1000.0f},
+      {UHDR_IMG_FMT_32bppRGBA1010102, UHDR_CT_HLG, 1000.0f},
+      {UHDR_IMG_FMT_32bppRGBA1010102, UHDR_CT_PQ, 2.0f},
+      {UHDR_IMG_FMT_24bppYCbCrP010, UHDR_CT_HLG, 1000.0f},
+      {UHDR_IMG_FMT_32bppRGBA8888, UHDR_CT_SRGB, 1.0f},
+      {UHDR_IMG_FMT_32bppRGBA8888, UHDR_CT_SRGB, 2.0f},
+  };
+  const size_t count = sizeof renditions / sizeof renditions[0];
+
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enable_stats(dec, 1).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+  for (size_t i = 1; i < count; i++) {
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_add_rendition(dec, renditions[i].fmt, renditions[i].ct,
+                                                    renditions[i].boost)
+                                 .error_code);
+  }
+  EXPECT_EQ(UHDR_CODEC_INVALID_PARAM,
+            uhdr_dec_add_rendition(dec, UHDR_IMG_FMT_32bppRGBA8888, UHDR_CT_PQ, 1.0f).error_code);
+  EXPECT_EQ(UHDR_CODEC_INVALID_PARAM,
+            uhdr_dec_add_rendition(dec, UHDR_IMG_FMT_32bppRGBA1010102, UHDR_CT_PQ, 0.5f)
+                .error_code);
+  uhdr_error_info_t status = uhdr_decode(dec);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  EXPECT_EQ(nullptr, uhdr_get_decoded_rendition(dec, count - 1));
+  uhdr_codec_stats_t* stats = uhdr_dec_get_stats(dec);
+  ASSERT_NE(nullptr, stats);
+  // once for the hdr renditions, once in rgb for the sdr ones
+  EXPECT_EQ(2u, stats->stages[UHDR_STAGE_BASE_DECODE].calls);
+  // the shared sweep, the pq rendition of another boost, P010 and the boosted sdr rendition
+  EXPECT_EQ(4u, stats->stages[UHDR_STAGE_GAINMAP_APPLY].calls);
+
+  // each rendition matches a decode of its own, up to the rounding of the vector kernels
+  for (size_t i = 0; i < count; i++) {
+    const Rendition& r = renditions[i];
+    uhdr_codec_private_t* refDec = uhdr_create_decoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(refDec, compressedImage).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_img_format(refDec, r.fmt).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(refDec, r.ct).error_code);
+    if (r.boost != FLT_MAX) {
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_max_display_boost(refDec, r.boost).error_code);
+    }
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(refDec).error_code);
+    uhdr_raw_image_t* exp = uhdr_get_decoded_image(refDec);
+    uhdr_raw_image_t* got =
+        i == 0 ? uhdr_get_decoded_image(dec) : uhdr_get_decoded_rendition(dec, i - 1);
+    ASSERT_NE(nullptr, exp);
+    ASSERT_NE(nullptr, got);
+    ASSERT_EQ(exp->fmt, got->fmt) << "rendition " << i;
+    ASSERT_EQ(r.ct, got->ct) << "rendition " << i;
+    ASSERT_EQ(exp->cg, got->cg) << "rendition " << i;
+    ASSERT_EQ(exp->w, got->w);
+    ASSERT_EQ(exp->h, got->h);
+    for (unsigned int y = 0; y < exp->h; y++) {
+      if (r.fmt == UHDR_IMG_FMT_64bppRGBAHalfFloat) {
+        const uint16_t* e = static_cast<uint16_t*>(exp->planes[UHDR_PLANE_PACKED]) +
+                            y * exp->stride[UHDR_PLANE_PACKED] * 4;
+        const uint16_t* g = static_cast<uint16_t*>(got->planes[UHDR_PLANE_PACKED]) +
+                            y * got->stride[UHDR_PLANE_PACKED] * 4;
+        for (unsigned int x = 0; x < exp->w * 4; x++) {
+          ASSERT_LE(std::abs(e[x] - g[x]), 2) << "rendition " << i << ", row " << y;
+        }
+      } else if (r.fmt == UHDR_IMG_FMT_32bppRGBA1010102) {
+        const uint32_t* e = static_cast<uint32_t*>(exp->planes[UHDR_PLANE_PACKED]) +
+                            y * exp->stride[UHDR_PLANE_PACKED];
+        const uint32_t* g = static_cast<uint32_t*>(got->planes[UHDR_PLANE_PACKED]) +
+                            y * got->stride[UHDR_PLANE_PACKED];
+        for (unsigned int x = 0; x < exp->w; x++) {
+          for (int c = 0; c < 3; c++) {
+            ASSERT_LE(std::abs((int)((e[x] >> (10 * c)) & 0x3ff) -
+                               (int)((g[x] >> (10 * c)) & 0x3ff)),
+                      1)
+                << "rendition " << i << ", row " << y << ", column " << x;
+          }
+        }
+      } else if (r.fmt == UHDR_IMG_FMT_32bppRGBA8888) {
+        ASSERT_EQ(0, memcmp(static_cast<uint32_t*>(exp->planes[UHDR_PLANE_PACKED]) +
+                                y * exp->stride[UHDR_PLANE_PACKED],
+                            static_cast<uint32_t*>(got->planes[UHDR_PLANE_PACKED]) +
+                                y * got->stride[UHDR_PLANE_PACKED],
+                            exp->w * sizeof(uint32_t)))
+            << "rendition " << i << ", row " << y;
+      }
+    }
+    for (int p = UHDR_PLANE_Y; p <= UHDR_PLANE_UV && r.fmt == UHDR_IMG_FMT_24bppYCbCrP010; p++) {
+      for (unsigned int y = 0; y < (p == UHDR_PLANE_Y ? exp->h : exp->h / 2); y++) {
+        ASSERT_EQ(0, memcmp(static_cast<uint16_t*>(exp->planes[p]) + y * exp->stride[p],
+                            static_cast<uint16_t*>(got->planes[p]) + y * got->stride[p],
+                            exp->w * sizeof(uint16_t)))
+            << "rendition " << i << ", plane " << p << ", row " << y;
+      }
+    }
+    uhdr_release_decoder(refDec);
+  }
+
+  // renditions are rendered on the cpu without effects
+  uhdr_reset_decoder(dec);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK,
+            uhdr_dec_add_rendition(dec, UHDR_IMG_FMT_32bppRGBA1010102, UHDR_CT_PQ, 4.0f)
+                .error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_add_effect_mirror(dec, UHDR_MIRROR_HORIZONTAL).error_code);
+  EXPECT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_decode(dec).error_code);
+  EXPECT_EQ(nullptr, uhdr_get_decoded_rendition(dec, 0));
+
+  uhdr_release_decoder(dec);
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, UltraHdrSignature) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+  uint8_t* data = static_cast<uint8_t*>(compressedImage->data);
+  const int size = (int)compressedImage->data_sz;
+  EXPECT_EQ(1, is_uhdr_image(data, size));
+
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_probe(dec).error_code);
+  uhdr_mem_block_t* base = uhdr_dec_get_base_image(dec);
+  uhdr_mem_block_t* gainmap = uhdr_dec_get_gainmap_image(dec);
+  ASSERT_NE(nullptr, base);
+  ASSERT_NE(nullptr, gainmap);
+  // the primary image alone points past its end, the gain map alone has no mpf block
+  EXPECT_EQ(0, is_uhdr_image(base->data, (int)base->data_sz));
+  EXPECT_EQ(0, is_uhdr_image(gainmap->data, (int)gainmap->data_sz));
+  EXPECT_EQ(0, is_uhdr_image(data, 64)) << "headers cut short";
+  EXPECT_EQ(0, is_uhdr_image(nullptr, size));
+  std::vector<uint8_t> corrupt(data, data + size);
+  corrupt[1] = 0;
+  EXPECT_EQ(0, is_uhdr_image(corrupt.data(), size)) << "no soi marker";
+  uhdr_release_decoder(dec);
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, GainMapFromMpfIndex) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+  uint8_t* data = static_cast<uint8_t*>(compressedImage->data);
+
+  JpegR jpegr;
+  uhdr_compressed_image_t img{};
+  img.data = data;
+  img.data_sz = img.capacity = compressedImage->data_sz;
+  jpeg_info_struct primaryInfo, gainmapInfo;
+  jpegr_info_struct info;
+  info.primaryImgInfo = &primaryInfo;
+  info.gainmapImgInfo = &gainmapInfo;
+  uhdr_error_info_t status = jpegr.getJPEGRInfo(&img, &info);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  const size_t primarySize = primaryInfo.imgData.size();
+
+  // an image that a walk over the stream would take for the gain map is put ahead of it, and the
+  // offset of the gain map in the mp entries moves past it
+  const uint8_t kDecoy[] = {0xFF, 0xD8, 0xFF, 0xD9};
+  std::vector<uint8_t> stream(data, data + primarySize);
+  stream.insert(stream.end(), std::begin(kDecoy), std::end(kDecoy));
+  stream.insert(stream.end(), data + primarySize, data + compressedImage->data_sz);
+  const uint8_t kMpfTag[] = {'M', 'P', 'F', '\0'};
+  auto mpf = std::search(stream.begin(), stream.end(), std::begin(kMpfTag), std::end(kMpfTag));
+  ASSERT_NE(stream.end(), mpf);
+  // big endian offset field of the second mp entry
+  uint8_t* offset = &*mpf + 78;
+  uint32_t value = (offset[0] << 24) | (offset[1] << 16) | (offset[2] << 8) | offset[3];
+  value += sizeof kDecoy;
+  for (int i = 0; i < 4; i++) offset[i] = static_cast<uint8_t>(value >> (24 - 8 * i));
+
+  img.data = stream.data();
+  img.data_sz = img.capacity = stream.size();
+  jpeg_info_struct mpfPrimaryInfo, mpfGainmapInfo;
+  info.primaryImgInfo = &mpfPrimaryInfo;
+  info.gainmapImgInfo = &mpfGainmapInfo;
+  status = jpegr.getJPEGRInfo(&img, &info);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  ASSERT_EQ(primaryInfo.imgData.size(), mpfPrimaryInfo.imgData.size());
+  ASSERT_EQ(gainmapInfo.imgData, mpfGainmapInfo.imgData);
+
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, &img).error_code);
+  status = uhdr_decode(dec);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_release_decoder(dec);
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, DecodeBaseImageEarly) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  // the base image as decoded without gain map application
+  uhdr_codec_private_t* refDec = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(refDec, compressedImage).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_enable_gainmap_application(refDec, 0).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK,
+            uhdr_dec_set_out_img_format(refDec, UHDR_IMG_FMT_12bppYCbCr420).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(refDec).error_code);
+  uhdr_raw_image_t* reference = uhdr_get_decoded_image(refDec);
+  ASSERT_NE(nullptr, reference);
+
+  struct BaseCollector {
+    uhdr_raw_image_t image{};
+    std::vector<uint8_t> planes[3];
+    int calls = 0;
+    int ret = 0;
+    static int onBase(void* ctx, const uhdr_raw_image_t* base) {
+      BaseCollector* collector = static_cast<BaseCollector*>(ctx);
+      collector->calls++;
+      collector->image = *base;
+      for (int i = 0; i < 3 && base->fmt == UHDR_IMG_FMT_12bppYCbCr420; i++) {
+        unsigned int wd = i == UHDR_PLANE_Y ? base->w : base->w / 2;
+        unsigned int ht = i == UHDR_PLANE_Y ? base->h : base->h / 2;
+        for (unsigned int y = 0; y < ht; y++) {
+          const uint8_t* row = static_cast<uint8_t*>(base->planes[i]) + (size_t)y * base->stride[i];
+          collector->planes[i].insert(collector->planes[i].end(), row, row + wd);
+        }
+      }
+      return collector->ret;
+    }
+  };
+
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK,
+            uhdr_dec_set_out_img_format(dec, UHDR_IMG_FMT_32bppRGBA1010102).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(dec, UHDR_CT_HLG).error_code);
+  BaseCollector collector;
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM,
+            uhdr_dec_set_base_image_callback(nullptr, BaseCollector::onBase, &collector)
+                .error_code);
+  ASSERT_EQ(UHDR_CODEC_OK,
+            uhdr_dec_set_base_image_callback(dec, BaseCollector::onBase, &collector).error_code);
+  uhdr_error_info_t status = uhdr_decode(dec);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  ASSERT_EQ(1, collector.calls);
+  ASSERT_EQ(UHDR_IMG_FMT_12bppYCbCr420, collector.image.fmt);
+  ASSERT_EQ(UHDR_CT_SRGB, collector.image.ct);
+  ASSERT_EQ(reference->w, collector.image.w);
+  ASSERT_EQ(reference->h, collector.image.h);
+  for (int i = 0; i < 3; i++) {
+    unsigned int wd = i == UHDR_PLANE_Y ? reference->w : reference->w / 2;
+    unsigned int ht = i == UHDR_PLANE_Y ? reference->h : reference->h / 2;
+    for (unsigned int y = 0; y < ht; y++) {
+      ASSERT_EQ(0, memcmp(static_cast<uint8_t*>(reference->planes[i]) +
+                              (size_t)y * reference->stride[i],
+                          collector.planes[i].data() + (size_t)y * wd, wd))
+          << "plane " << i << " row " << y;
+    }
+  }
+  uhdr_raw_image_t* hdr = uhdr_get_decoded_image(dec);
+  ASSERT_NE(nullptr, hdr);
+  ASSERT_EQ(UHDR_IMG_FMT_32bppRGBA1010102, hdr->fmt);
+  uhdr_release_decoder(dec);
+
+  // a non-zero return aborts the decode, and strip wise decode is refused
+  dec = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+  BaseCollector aborting;
+  aborting.ret = 1;
+  ASSERT_EQ(UHDR_CODEC_OK,
+            uhdr_dec_set_base_image_callback(dec, BaseCollector::onBase, &aborting).error_code);
+  ASSERT_EQ(UHDR_CODEC_ERROR, uhdr_decode(dec).error_code);
+  ASSERT_EQ(1, aborting.calls);
+  ASSERT_EQ(nullptr, uhdr_get_decoded_image(dec));
+  uhdr_reset_decoder(dec);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK,
+            uhdr_dec_set_base_image_callback(dec, BaseCollector::onBase, &aborting).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK,
+            uhdr_dec_set_strip_callback(dec, [](void*, const uhdr_raw_image_t*,
+                                                unsigned int) { return 0; },
+                                        nullptr, 16)
+                .error_code);
+  ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_decode(dec).error_code);
+  uhdr_release_decoder(dec);
+  uhdr_release_decoder(refDec);
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, DecodePushedData) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+  const uint8_t* bytes = static_cast<const uint8_t*>(compressedImage->data);
+
+  struct Output {
+    uhdr_img_fmt_t fmt;
+    uhdr_color_transfer_t ct;
+  } outputs[] = {
+      {UHDR_IMG_FMT_32bppRGBA1010102, UHDR_CT_HLG},
+      {UHDR_IMG_FMT_32bppRGBA8888, UHDR_CT_SRGB},
+  };
+  for (const auto& output : outputs) {
+    SCOPED_TRACE(::testing::Message() << "fmt " << output.fmt << " ct " << output.ct);
+    uhdr_codec_private_t* decs[2] = {uhdr_create_decoder(), uhdr_create_decoder()};
+    for (uhdr_codec_private_t* dec : decs) {
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_img_format(dec, output.fmt).error_code);
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(dec, output.ct).error_code);
+    }
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(decs[0], compressedImage).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(decs[0]).error_code);
+
+    // the bytes arrive from another thread, the decode waits for them
+    const size_t kChunkSize = 4096;
+    std::thread network([&]() {
+      for (size_t offset = 0; offset < compressedImage->data_sz; offset += kChunkSize) {
+        size_t size = (std::min)(kChunkSize, compressedImage->data_sz - offset);
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        uhdr_error_info_t status = uhdr_dec_push_data(decs[1], bytes + offset, size, 0);
+        EXPECT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+      }
+    });
+    network.join();
+    ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_dec_probe(decs[1]).error_code);
+    ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION,
+              uhdr_dec_set_image(decs[1], compressedImage).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_push_data(decs[1], nullptr, 0, 1).error_code);
+    ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_dec_push_data(decs[1], bytes, 1, 1).error_code);
+    uhdr_error_info_t status = uhdr_decode(decs[1]);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+
+    uhdr_raw_image_t* expected = uhdr_get_decoded_image(decs[0]);
+    uhdr_raw_image_t* img = uhdr_get_decoded_image(decs[1]);
+    ASSERT_NE(nullptr, expected);
+    ASSERT_NE(nullptr, img);
+    ASSERT_EQ(expected->w, img->w);
+    ASSERT_EQ(expected->h, img->h);
+    for (unsigned int y = 0; y < img->h; y++) {
+      ASSERT_EQ(0, memcmp(static_cast<uint8_t*>(expected->planes[UHDR_PLANE_PACKED]) +
+                              (size_t)y * expected->stride[UHDR_PLANE_PACKED] * 4,
+                          static_cast<uint8_t*>(img->planes[UHDR_PLANE_PACKED]) +
+                              (size_t)y * img->stride[UHDR_PLANE_PACKED] * 4,
+                          img->w * 4))
+          << "row " << y;
+    }
+    uhdr_release_decoder(decs[0]);
+    uhdr_release_decoder(decs[1]);
+  }
+
+  // a decoder starved of input is reset and released without waiting for the rest
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_dec_push_data(dec, nullptr, 16, 0).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK,
+            uhdr_dec_push_data(dec, bytes, compressedImage->data_sz / 3, 0).error_code);
+  uhdr_reset_decoder(dec);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(dec).error_code);
+  uhdr_reset_decoder(dec);
+  ASSERT_EQ(UHDR_CODEC_OK,
+            uhdr_dec_push_data(dec, bytes, compressedImage->data_sz / 3, 0).error_code);
+  uhdr_release_decoder(dec);
+
+  // streams stalled on input, more than there are cores, do not hold back other decodes
+  std::vector<uhdr_codec_private_t*> stalled(std::thread::hardware_concurrency() + 1);
+  for (uhdr_codec_private_t*& stalledDec : stalled) {
+    stalledDec = uhdr_create_decoder();
+    ASSERT_EQ(UHDR_CODEC_OK,
+              uhdr_dec_push_data(stalledDec, bytes, compressedImage->data_sz / 3, 0).error_code);
+  }
+  std::future<uhdr_error_info_t> others = std::async(std::launch::async, [&]() {
+    uhdr_codec_private_t* probed = uhdr_create_decoder();
+    uhdr_error_info_t status = uhdr_dec_set_image(probed, compressedImage);
+    if (status.error_code == UHDR_CODEC_OK) status = uhdr_dec_probe(probed);
+    uhdr_release_decoder(probed);
+    if (status.error_code != UHDR_CODEC_OK) return status;
+    uhdr_codec_private_t* streamed = uhdr_create_decoder();
+    status = uhdr_dec_push_data(streamed, bytes, compressedImage->data_sz, 1);
+    if (status.error_code == UHDR_CODEC_OK) status = uhdr_decode(streamed);
+    uhdr_release_decoder(streamed);
+    return status;
+  });
+  bool finished = others.wait_for(std::chrono::seconds(30)) == std::future_status::ready;
+  // releasing the stalled decoders aborts their streams, which also unblocks a starved decode
+  for (uhdr_codec_private_t* stalledDec : stalled) uhdr_release_decoder(stalledDec);
+  ASSERT_TRUE(finished);
+  uhdr_error_info_t status = others.get();
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_release_encoder(enc);
+}
+
+#ifndef _WIN32
+TEST(JpegRTest, FileDescriptorInputOutput) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  namespace fs = std::filesystem;
+  fs::path path = fs::temp_directory_path() /
+                  ("uhdr_fd_io_" +
+                   std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) +
+                   ".jpg");
+  int fd = open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0600);
+  ASSERT_GE(fd, 0);
+
+  // the stream written to the descriptor matches the one held by the encoder
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_enc_set_output_fd(enc, -1).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_output_fd(enc, fd).error_code);
+  uhdr_error_info_t status = uhdr_encode(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+  close(fd);
+  std::ifstream ifd(path, std::ios::binary);
+  std::vector<char> written((std::istreambuf_iterator<char>(ifd)),
+                            std::istreambuf_iterator<char>());
+  ifd.close();
+  ASSERT_EQ(compressedImage->data_sz, written.size());
+  ASSERT_EQ(0, memcmp(compressedImage->data, written.data(), written.size()));
+
+  // decoding the mapped file gives the same image as decoding a copy of it
+  uhdr_codec_private_t* decs[2] = {uhdr_create_decoder(), uhdr_create_decoder()};
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(decs[0], compressedImage).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(decs[0]).error_code);
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_dec_set_image_fd(decs[1], -1).error_code);
+  fd = open(path.c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  status = uhdr_dec_set_image_fd(decs[1], fd);
+  close(fd);
+  fs::remove(path);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_decode(decs[1]);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+
+  uhdr_raw_image_t* expected = uhdr_get_decoded_image(decs[0]);
+  uhdr_raw_image_t* img = uhdr_get_decoded_image(decs[1]);
+  ASSERT_NE(nullptr, expected);
+  ASSERT_NE(nullptr, img);
+  ASSERT_EQ(expected->fmt, img->fmt);
+  ASSERT_EQ(expected->w, img->w);
+  ASSERT_EQ(expected->h, img->h);
+  size_t bpp = expected->fmt == UHDR_IMG_FMT_64bppRGBAHalfFloat ? 8 : 4;
+  for (unsigned int y = 0; y < img->h; y++) {
+    ASSERT_EQ(0, memcmp(static_cast<uint8_t*>(expected->planes[UHDR_PLANE_PACKED]) +
+                            (size_t)y * expected->stride[UHDR_PLANE_PACKED] * bpp,
+                        static_cast<uint8_t*>(img->planes[UHDR_PLANE_PACKED]) +
+                            (size_t)y * img->stride[UHDR_PLANE_PACKED] * bpp,
+                        img->w * bpp))
+        << "row " << y;
+  }
+  uhdr_reset_decoder(decs[1]);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(decs[1], compressedImage).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(decs[1]).error_code);
+  uhdr_release_decoder(decs[0]);
+  uhdr_release_decoder(decs[1]);
+  uhdr_release_encoder(enc);
+}
+#endif
+
+TEST(JpegRTest, BorrowedCompressedImages) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+
+  uhdr_raw_image_t hdrImg{};
+  hdrImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  hdrImg.cg = UHDR_CG_BT_2100;
+  hdrImg.ct = UHDR_CT_HLG;
+  hdrImg.range = UHDR_CR_LIMITED_RANGE;
+  hdrImg.w = kImageWidth;
+  hdrImg.h = kImageHeight;
+  hdrImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  hdrImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  hdrImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  hdrImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  uhdr_error_info_t status = uhdr_enc_set_raw_image(enc, &hdrImg, UHDR_HDR_IMG);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_encode(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  // a borrowed bitstream decodes as a copied one does and is referenced in place
+  uhdr_codec_private_t* decs[2] = {uhdr_create_decoder(), uhdr_create_decoder()};
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_dec_set_image_ref(decs[1], nullptr).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(decs[0], compressedImage).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image_ref(decs[1], compressedImage).error_code);
+  for (auto dec : decs) {
+    status = uhdr_decode(dec);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  }
+  uhdr_raw_image_t* expected = uhdr_get_decoded_image(decs[0]);
+  uhdr_raw_image_t* img = uhdr_get_decoded_image(decs[1]);
+  ASSERT_NE(nullptr, expected);
+  ASSERT_NE(nullptr, img);
+  ASSERT_EQ(expected->fmt, img->fmt);
+  ASSERT_EQ(expected->w, img->w);
+  ASSERT_EQ(expected->h, img->h);
+  size_t bpp = expected->fmt == UHDR_IMG_FMT_64bppRGBAHalfFloat ? 8 : 4;
+  for (unsigned int y = 0; y < img->h; y++) {
+    ASSERT_EQ(0, memcmp(static_cast<uint8_t*>(expected->planes[UHDR_PLANE_PACKED]) +
+                            (size_t)y * expected->stride[UHDR_PLANE_PACKED] * bpp,
+                        static_cast<uint8_t*>(img->planes[UHDR_PLANE_PACKED]) +
+                            (size_t)y * img->stride[UHDR_PLANE_PACKED] * bpp,
+                        img->w * bpp))
+        << "row " << y;
+  }
+  uhdr_mem_block_t* base = uhdr_dec_get_base_image(decs[1]);
+  ASSERT_NE(nullptr, base);
+  const uint8_t* begin = static_cast<const uint8_t*>(compressedImage->data);
+  const uint8_t* data = static_cast<const uint8_t*>(base->data);
+  ASSERT_TRUE(data >= begin && data + base->data_sz <= begin + compressedImage->data_sz);
+
+  // an encode from a borrowed sdr intent matches the one from a copied sdr intent
+  uhdr_compressed_image_t sdrImg{};
+  sdrImg.data = base->data;
+  sdrImg.data_sz = sdrImg.capacity = base->data_sz;
+  sdrImg.cg = UHDR_CG_DISPLAY_P3;
+  sdrImg.ct = UHDR_CT_SRGB;
+  sdrImg.range = UHDR_CR_FULL_RANGE;
+  uhdr_codec_private_t* encs[2] = {uhdr_create_encoder(), uhdr_create_encoder()};
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(encs[0], &hdrImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(encs[1], &hdrImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK,
+            uhdr_enc_set_compressed_image(encs[0], &sdrImg, UHDR_SDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK,
+            uhdr_enc_set_compressed_image_ref(encs[1], &sdrImg, UHDR_SDR_IMG).error_code);
+  for (auto e : encs) {
+    status = uhdr_encode(e);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  }
+  uhdr_compressed_image_t* streams[2] = {uhdr_get_encoded_stream(encs[0]),
+                                         uhdr_get_encoded_stream(encs[1])};
+  ASSERT_NE(nullptr, streams[0]);
+  ASSERT_NE(nullptr, streams[1]);
+  ASSERT_EQ(streams[0]->data_sz, streams[1]->data_sz);
+  ASSERT_EQ(0, memcmp(streams[0]->data, streams[1]->data, streams[0]->data_sz));
+
+  uhdr_release_encoder(encs[0]);
+  uhdr_release_encoder(encs[1]);
+  uhdr_release_decoder(decs[0]);
+  uhdr_release_decoder(decs[1]);
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, EncodeOutputSegments) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t hdrImg{};
+  hdrImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  hdrImg.cg = UHDR_CG_BT_2100;
+  hdrImg.ct = UHDR_CT_HLG;
+  hdrImg.range = UHDR_CR_LIMITED_RANGE;
+  hdrImg.w = kImageWidth;
+  hdrImg.h = kImageHeight;
+  hdrImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  hdrImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  hdrImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  hdrImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  uhdr_error_info_t status = uhdr_enc_set_raw_image(enc, &hdrImg, UHDR_HDR_IMG);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_encode(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  // without segmented output, the list is a single span over the stream
+  unsigned int count = 0;
+  ASSERT_EQ(nullptr, uhdr_get_encoded_segments(enc, nullptr));
+  const uhdr_stream_segment_t* segments = uhdr_get_encoded_segments(enc, &count);
+  ASSERT_NE(nullptr, segments);
+  ASSERT_EQ(1u, count);
+  ASSERT_EQ(compressedImage->data, segments[0].data);
+  ASSERT_EQ(compressedImage->data_sz, segments[0].data_sz);
+
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+  status = uhdr_dec_probe(dec);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_mem_block_t* base = uhdr_dec_get_base_image(dec);
+  uhdr_mem_block_t* gainmap = uhdr_dec_get_gainmap_image(dec);
+  uhdr_gainmap_metadata_t* metadata = uhdr_dec_get_gainmap_metadata(dec);
+  ASSERT_NE(nullptr, base);
+  ASSERT_NE(nullptr, gainmap);
+  ASSERT_NE(nullptr, metadata);
+  uhdr_compressed_image_t baseImg{};
+  baseImg.data = base->data;
+  baseImg.data_sz = baseImg.capacity = base->data_sz;
+  baseImg.cg = UHDR_CG_DISPLAY_P3;
+  baseImg.ct = UHDR_CT_SRGB;
+  baseImg.range = UHDR_CR_FULL_RANGE;
+  uhdr_compressed_image_t gainmapImg{};
+  gainmapImg.data = gainmap->data;
+  gainmapImg.data_sz = gainmapImg.capacity = gainmap->data_sz;
+  gainmapImg.cg = UHDR_CG_UNSPECIFIED;
+  gainmapImg.ct = UHDR_CT_UNSPECIFIED;
+  gainmapImg.range = UHDR_CR_UNSPECIFIED;
+
+  // the spans of a segmented api-4 encode add up to the contiguous stream, the entropy coded data
+  // of the borrowed base image is referenced in place
+  uhdr_codec_private_t* encs[2] = {uhdr_create_encoder(), uhdr_create_encoder()};
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_enc_enable_output_segments(nullptr, 1).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_enable_output_segments(encs[1], 1).error_code);
+  for (auto e : encs) {
+    ASSERT_EQ(UHDR_CODEC_OK,
+              uhdr_enc_set_compressed_image_ref(e, &baseImg, UHDR_BASE_IMG).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_gainmap_image(e, &gainmapImg, metadata).error_code);
+  }
+#ifndef _WIN32
+  namespace fs = std::filesystem;
+  fs::path path = fs::temp_directory_path() /
+                  ("uhdr_segments_" +
+                   std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) +
+                   ".jpg");
+  int fd = open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0600);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_output_fd(encs[1], fd).error_code);
+#endif
+  for (auto e : encs) {
+    status = uhdr_encode(e);
+    ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_enc_enable_output_segments(e, 0).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  }
+  uhdr_compressed_image_t* expected = uhdr_get_encoded_stream(encs[0]);
+  ASSERT_NE(nullptr, expected);
+  segments = uhdr_get_encoded_segments(encs[1], &count);
+  ASSERT_NE(nullptr, segments);
+  ASSERT_GT(count, 2u);
+  std::vector<uint8_t> gathered;
+  const uint8_t* begin = static_cast<const uint8_t*>(base->data);
+  size_t referenced = 0;
+  for (unsigned int i = 0; i < count; i++) {
+    const uint8_t* data = static_cast<const uint8_t*>(segments[i].data);
+    gathered.insert(gathered.end(), data, data + segments[i].data_sz);
+    if (data >= begin && data + segments[i].data_sz <= begin + base->data_sz) {
+      referenced += segments[i].data_sz;
+    }
+  }
+  ASSERT_EQ(expected->data_sz, gathered.size());
+  ASSERT_EQ(0, memcmp(expected->data, gathered.data(), gathered.size()));
+  ASSERT_GT(referenced, base->data_sz / 2);
+#ifndef _WIN32
+  close(fd);
+  std::ifstream ifd(path, std::ios::binary);
+  std::vector<char> written((std::istreambuf_iterator<char>(ifd)),
+                            std::istreambuf_iterator<char>());
+  ifd.close();
+  fs::remove(path);
+  ASSERT_EQ(expected->data_sz, written.size());
+  ASSERT_EQ(0, memcmp(expected->data, written.data(), written.size()));
+#endif
+
+  // the stream accessor gathers the spans, which then collapse to one
+  uhdr_compressed_image_t* stream = uhdr_get_encoded_stream(encs[1]);
+  ASSERT_NE(nullptr, stream);
+  ASSERT_EQ(expected->data_sz, stream->data_sz);
+  ASSERT_EQ(0, memcmp(expected->data, stream->data, stream->data_sz));
+  segments = uhdr_get_encoded_segments(encs[1], &count);
+  ASSERT_NE(nullptr, segments);
+  ASSERT_EQ(1u, count);
+  ASSERT_EQ(stream->data, segments[0].data);
+
+  uhdr_release_encoder(encs[0]);
+  uhdr_release_encoder(encs[1]);
+  uhdr_release_decoder(dec);
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, EncodeQualityLadder) {
+  UhdrUnCompressedStructWrapper rawImgP010(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImgP010.allocateMemory());
+  ASSERT_TRUE(rawImgP010.loadRawResource(kYCbCrP010FileName));
+  UhdrUnCompressedStructWrapper rawImg420(kImageWidth, kImageHeight, YCbCr_420);
+  ASSERT_TRUE(rawImg420.allocateMemory());
+  ASSERT_TRUE(rawImg420.loadRawResource(kYCbCr420FileName));
+
+  uhdr_raw_image_t hdrImg{};
+  hdrImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  hdrImg.cg = UHDR_CG_BT_2100;
+  hdrImg.ct = UHDR_CT_HLG;
+  hdrImg.range = UHDR_CR_LIMITED_RANGE;
+  hdrImg.w = kImageWidth;
+  hdrImg.h = kImageHeight;
+  hdrImg.planes[UHDR_PLANE_Y] = rawImgP010.getImageHandle()->data;
+  hdrImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  hdrImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImgP010.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  hdrImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  uhdr_raw_image_t sdrImg{};
+  sdrImg.fmt = UHDR_IMG_FMT_12bppYCbCr420;
+  sdrImg.cg = UHDR_CG_BT_709;
+  sdrImg.ct = UHDR_CT_SRGB;
+  sdrImg.range = UHDR_CR_FULL_RANGE;
+  sdrImg.w = kImageWidth;
+  sdrImg.h = kImageHeight;
+  uint8_t* sdrData = static_cast<uint8_t*>(rawImg420.getImageHandle()->data);
+  sdrImg.planes[UHDR_PLANE_Y] = sdrData;
+  sdrImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  sdrImg.planes[UHDR_PLANE_U] = sdrData + kImageWidth * kImageHeight;
+  sdrImg.stride[UHDR_PLANE_U] = kImageWidth / 2;
+  sdrImg.planes[UHDR_PLANE_V] = sdrData + kImageWidth * kImageHeight * 5 / 4;
+  sdrImg.stride[UHDR_PLANE_V] = kImageWidth / 2;
+
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_enc_add_quality_rung(nullptr, 50, 50).error_code);
+
+  // every stream of a ladder encode matches a separate encode at its qualities
+  const int qualities[3][2] = {{95, 95}, {80, 70}, {50, 40}};
+  std::vector<uint8_t> jpeg;
+  for (bool withSdr : {false, true}) {
+    uhdr_codec_private_t* enc = uhdr_create_encoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &hdrImg, UHDR_HDR_IMG).error_code);
+    if (withSdr) {
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &sdrImg, UHDR_SDR_IMG).error_code);
+    }
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_quality(enc, qualities[0][0], UHDR_BASE_IMG).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK,
+              uhdr_enc_set_quality(enc, qualities[0][1], UHDR_GAIN_MAP_IMG).error_code);
+    ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_enc_add_quality_rung(enc, 101, 50).error_code);
+    for (int i = 1; i < 3; i++) {
+      ASSERT_EQ(UHDR_CODEC_OK,
+                uhdr_enc_add_quality_rung(enc, qualities[i][0], qualities[i][1]).error_code);
+    }
+    ASSERT_EQ(nullptr, uhdr_get_encoded_quality_rung(enc, 0));
+    uhdr_error_info_t status = uhdr_encode(enc);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_enc_add_quality_rung(enc, 50, 50).error_code);
+    ASSERT_EQ(nullptr, uhdr_get_encoded_quality_rung(enc, 2));
+
+    for (int i = 0; i < 3; i++) {
+      uhdr_compressed_image_t* stream =
+          i == 0 ? uhdr_get_encoded_stream(enc) : uhdr_get_encoded_quality_rung(enc, i - 1);
+      ASSERT_NE(nullptr, stream);
+      if (i == 0) {
+        jpeg.assign(static_cast<uint8_t*>(stream->data),
+                    static_cast<uint8_t*>(stream->data) + stream->data_sz);
+      }
+      uhdr_codec_private_t* ref = uhdr_create_encoder();
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(ref, &hdrImg, UHDR_HDR_IMG).error_code);
+      if (withSdr) {
+        ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(ref, &sdrImg, UHDR_SDR_IMG).error_code);
+      }
+      ASSERT_EQ(UHDR_CODEC_OK,
+                uhdr_enc_set_quality(ref, qualities[i][0], UHDR_BASE_IMG).error_code);
+      ASSERT_EQ(UHDR_CODEC_OK,
+                uhdr_enc_set_quality(ref, qualities[i][1], UHDR_GAIN_MAP_IMG).error_code);
+      status = uhdr_encode(ref);
+      ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+      uhdr_compressed_image_t* expected = uhdr_get_encoded_stream(ref);
+      ASSERT_NE(nullptr, expected);
+      ASSERT_EQ(expected->data_sz, stream->data_sz) << "rung " << i << ", sdr " << withSdr;
+      ASSERT_EQ(0, memcmp(expected->data, stream->data, stream->data_sz))
+          << "rung " << i << ", sdr " << withSdr;
+      uhdr_release_encoder(ref);
+    }
+    uhdr_release_encoder(enc);
+  }
+
+  // compressed inputs leave nothing to share between the rungs
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  uhdr_compressed_image_t sdrCompressed{};
+  sdrCompressed.data = jpeg.data();
+  sdrCompressed.data_sz = sdrCompressed.capacity = jpeg.size();
+  sdrCompressed.cg = UHDR_CG_BT_709;
+  sdrCompressed.ct = UHDR_CT_SRGB;
+  sdrCompressed.range = UHDR_CR_FULL_RANGE;
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &hdrImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK,
+            uhdr_enc_set_compressed_image(enc, &sdrCompressed, UHDR_SDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_add_quality_rung(enc, 50, 50).error_code);
+  ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_encode(enc).error_code);
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, EncodeStreamedRows) {
+  UhdrUnCompressedStructWrapper rawImgP010(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImgP010.allocateMemory());
+  ASSERT_TRUE(rawImgP010.loadRawResource(kYCbCrP010FileName));
+  UhdrUnCompressedStructWrapper rawImg420(kImageWidth, kImageHeight, YCbCr_420);
+  ASSERT_TRUE(rawImg420.allocateMemory());
+  ASSERT_TRUE(rawImg420.loadRawResource(kYCbCr420FileName));
+
+  uhdr_raw_image_t hdrImg{};
+  hdrImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  hdrImg.cg = UHDR_CG_BT_2100;
+  hdrImg.ct = UHDR_CT_HLG;
+  hdrImg.range = UHDR_CR_LIMITED_RANGE;
+  hdrImg.w = kImageWidth;
+  hdrImg.h = kImageHeight;
+  uint16_t* hdrData = static_cast<uint16_t*>(rawImgP010.getImageHandle()->data);
+  hdrImg.planes[UHDR_PLANE_Y] = hdrData;
+  hdrImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  hdrImg.planes[UHDR_PLANE_UV] = hdrData + kImageWidth * kImageHeight;
+  hdrImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  uhdr_raw_image_t sdrImg{};
+  sdrImg.fmt = UHDR_IMG_FMT_12bppYCbCr420;
+  sdrImg.cg = UHDR_CG_BT_709;
+  sdrImg.ct = UHDR_CT_SRGB;
+  sdrImg.range = UHDR_CR_FULL_RANGE;
+  sdrImg.w = kImageWidth;
+  sdrImg.h = kImageHeight;
+  uint8_t* sdrData = static_cast<uint8_t*>(rawImg420.getImageHandle()->data);
+  sdrImg.planes[UHDR_PLANE_Y] = sdrData;
+  sdrImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  sdrImg.planes[UHDR_PLANE_U] = sdrData + kImageWidth * kImageHeight;
+  sdrImg.stride[UHDR_PLANE_U] = kImageWidth / 2;
+  sdrImg.planes[UHDR_PLANE_V] = sdrData + kImageWidth * kImageHeight * 5 / 4;
+  sdrImg.stride[UHDR_PLANE_V] = kImageWidth / 2;
+
+  // descriptors of rows [row, row + h) of the intents
+  auto hdrRows = [&](unsigned int row, unsigned int h) {
+    uhdr_raw_image_t img = hdrImg;
+    img.h = h;
+    img.planes[UHDR_PLANE_Y] = hdrData + (size_t)row * hdrImg.stride[UHDR_PLANE_Y];
+    img.planes[UHDR_PLANE_UV] = static_cast<uint16_t*>(hdrImg.planes[UHDR_PLANE_UV]) +
+                                (size_t)(row / 2) * hdrImg.stride[UHDR_PLANE_UV];
+    return img;
+  };
+  auto sdrRows = [&](unsigned int row, unsigned int h) {
+    uhdr_raw_image_t img = sdrImg;
+    img.h = h;
+    img.planes[UHDR_PLANE_Y] = sdrData + (size_t)row * sdrImg.stride[UHDR_PLANE_Y];
+    for (int p : {UHDR_PLANE_U, UHDR_PLANE_V}) {
+      img.planes[p] =
+          static_cast<uint8_t*>(sdrImg.planes[p]) + (size_t)(row / 2) * sdrImg.stride[p];
+    }
+    return img;
+  };
+  auto decode = [](uhdr_compressed_image_t* img, uhdr_color_transfer_t ct,
+                   uhdr_img_fmt_t fmt, std::vector<uint8_t>* out) {
+    uhdr_codec_private_t* dec = uhdr_create_decoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, img).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(dec, ct).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_img_format(dec, fmt).error_code);
+    uhdr_error_info_t status = uhdr_decode(dec);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    uhdr_raw_image_t* raw = uhdr_get_decoded_image(dec);
+    ASSERT_NE(nullptr, raw);
+    const uint8_t* data = static_cast<uint8_t*>(raw->planes[UHDR_PLANE_PACKED]);
+    out->assign(data, data + (size_t)raw->stride[UHDR_PLANE_PACKED] * raw->h * 4);
+    uhdr_release_decoder(dec);
+  };
+
+  // misuse
+  uhdr_raw_image_t strip = hdrRows(0, 64);
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_enc_start_stream(nullptr, kImageHeight).error_code);
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_enc_start_stream(enc, 0).error_code);
+  ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_enc_push_rows(enc, &strip, nullptr).error_code);
+  ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_enc_finish_stream(enc).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_start_stream(enc, kImageHeight).error_code);
+  ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_encode(enc).error_code);
+  uhdr_raw_image_t odd = hdrRows(0, 63);
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_enc_push_rows(enc, &odd, nullptr).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_push_rows(enc, &strip, nullptr).error_code);
+  ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_enc_finish_stream(enc).error_code);
+  ASSERT_EQ(nullptr, uhdr_get_encoded_stream(enc));
+  uhdr_reset_encoder(enc);
+  uhdr_raw_image_t sdrStrip = sdrRows(0, 64);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_start_stream(enc, kImageHeight).error_code);
+  ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_enc_push_rows(enc, &strip, &sdrStrip).error_code);
+  uhdr_release_encoder(enc);
+
+  // the decoded output of a streamed encode matches that of an encode of the whole image
+  for (bool withSdr : {false, true}) {
+    enc = uhdr_create_encoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_preset(enc, UHDR_USAGE_REALTIME).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_start_stream(enc, kImageHeight).error_code);
+    const unsigned int stripHeight = 96;
+    for (unsigned int row = 0; row < kImageHeight; row += stripHeight) {
+      const unsigned int h = (std::min)(stripHeight, (unsigned int)kImageHeight - row);
+      uhdr_raw_image_t hdr = hdrRows(row, h);
+      uhdr_raw_image_t sdr = sdrRows(row, h);
+      uhdr_error_info_t status = uhdr_enc_push_rows(enc, &hdr, withSdr ? &sdr : nullptr);
+      ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    }
+    uhdr_error_info_t status = uhdr_enc_finish_stream(enc);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    uhdr_compressed_image_t* streamed = uhdr_get_encoded_stream(enc);
+    ASSERT_NE(nullptr, streamed);
+
+    uhdr_codec_private_t* ref = uhdr_create_encoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(ref, &hdrImg, UHDR_HDR_IMG).error_code);
+    if (withSdr) {
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(ref, &sdrImg, UHDR_SDR_IMG).error_code);
+    }
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_preset(ref, UHDR_USAGE_REALTIME).error_code);
+    status = uhdr_encode(ref);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    uhdr_compressed_image_t* expected = uhdr_get_encoded_stream(ref);
+    ASSERT_NE(nullptr, expected);
+
+    std::vector<uint8_t> a, b;
+    for (auto ct : {UHDR_CT_SRGB, UHDR_CT_HLG}) {
+      auto fmt = ct == UHDR_CT_SRGB ? UHDR_IMG_FMT_32bppRGBA8888 : UHDR_IMG_FMT_32bppRGBA1010102;
+      ASSERT_NO_FATAL_FAILURE(decode(streamed, ct, fmt, &a));
+      ASSERT_NO_FATAL_FAILURE(decode(expected, ct, fmt, &b));
+      ASSERT_EQ(a, b) << "transfer " << ct << ", sdr " << withSdr;
+    }
+    uhdr_release_encoder(ref);
+    uhdr_release_encoder(enc);
+  }
+}
+
+TEST(JpegRTest, EncodeTargetSize) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t hdrImg{};
+  hdrImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  hdrImg.cg = UHDR_CG_BT_2100;
+  hdrImg.ct = UHDR_CT_HLG;
+  hdrImg.range = UHDR_CR_LIMITED_RANGE;
+  hdrImg.w = kImageWidth;
+  hdrImg.h = kImageHeight;
+  hdrImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  hdrImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  hdrImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  hdrImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_enc_set_target_size(nullptr, 1000).error_code);
+
+  auto encode = [&](size_t targetSize, std::vector<uint8_t>& stream) {
+    uhdr_codec_private_t* enc = uhdr_create_encoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &hdrImg, UHDR_HDR_IMG).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_target_size(enc, targetSize).error_code);
+    uhdr_error_info_t status = uhdr_encode(enc);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_enc_set_target_size(enc, 0).error_code);
+    uhdr_compressed_image_t* out = uhdr_get_encoded_stream(enc);
+    ASSERT_NE(nullptr, out);
+    stream.assign(static_cast<uint8_t*>(out->data),
+                  static_cast<uint8_t*>(out->data) + out->data_sz);
+    uhdr_release_encoder(enc);
+  };
+
+  // without a target, the stream is that of the configured qualities. An unreachable budget
+  // yields the stream of the lowest quality.
+  std::vector<uint8_t> full, smallest;
+  encode(0, full);
+  encode(1, smallest);
+  ASSERT_LT(smallest.size(), full.size());
+
+  // a budget above the size of the configured qualities keeps them as upper bounds, smaller ones
+  // are met by lower qualities, and the streams decode
+  std::vector<uint8_t> prev = full;
+  for (size_t targetSize : {full.size() * 2, full.size() * 3 / 4,
+                            smallest.size() + (full.size() - smallest.size()) / 4}) {
+    std::vector<uint8_t> stream;
+    encode(targetSize, stream);
+    ASSERT_LE(stream.size(), targetSize);
+    ASSERT_LE(stream.size(), prev.size() + prev.size() / 20) << "budget " << targetSize;
+    ASSERT_GE(stream.size(), smallest.size());
+    prev = stream;
+
+    uhdr_compressed_image_t img{};
+    img.data = stream.data();
+    img.data_sz = img.capacity = stream.size();
+    img.cg = UHDR_CG_UNSPECIFIED;
+    img.ct = UHDR_CT_UNSPECIFIED;
+    img.range = UHDR_CR_UNSPECIFIED;
+    uhdr_codec_private_t* dec = uhdr_create_decoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, &img).error_code);
+    uhdr_error_info_t status = uhdr_decode(dec);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    uhdr_raw_image_t* decoded = uhdr_get_decoded_image(dec);
+    ASSERT_NE(nullptr, decoded);
+    ASSERT_EQ(kImageWidth, (int)decoded->w);
+    ASSERT_EQ(kImageHeight, (int)decoded->h);
+    uhdr_release_decoder(dec);
+  }
+
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &hdrImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_target_size(enc, full.size()).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_add_quality_rung(enc, 50, 50).error_code);
+  ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_encode(enc).error_code);
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, CancelFlagAndDeadline) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t hdrImg{};
+  hdrImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  hdrImg.cg = UHDR_CG_BT_2100;
+  hdrImg.ct = UHDR_CT_HLG;
+  hdrImg.range = UHDR_CR_LIMITED_RANGE;
+  hdrImg.w = kImageWidth;
+  hdrImg.h = kImageHeight;
+  hdrImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  hdrImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  hdrImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  hdrImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  int cancel = 0;
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_set_cancel_flag(nullptr, &cancel).error_code);
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_set_deadline(nullptr, 10).error_code);
+
+  // an unset flag and a generous deadline leave the encode alone
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &hdrImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_set_cancel_flag(enc, &cancel).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_set_deadline(enc, 600000).error_code);
+  uhdr_error_info_t status = uhdr_encode(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_set_cancel_flag(enc, nullptr).error_code);
+  ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_set_deadline(enc, 0).error_code);
+  uhdr_compressed_image_t* out = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, out);
+  std::vector<uint8_t> stream(static_cast<uint8_t*>(out->data),
+                              static_cast<uint8_t*>(out->data) + out->data_sz);
+  uhdr_compressed_image_t img{};
+  img.data = stream.data();
+  img.data_sz = img.capacity = stream.size();
+  img.cg = UHDR_CG_UNSPECIFIED;
+  img.ct = UHDR_CT_UNSPECIFIED;
+  img.range = UHDR_CR_UNSPECIFIED;
+
+  // a flag raised before the call
+  cancel = 1;
+  uhdr_reset_encoder(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &hdrImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_set_cancel_flag(enc, &cancel).error_code);
+  ASSERT_EQ(UHDR_CODEC_CANCELLED, uhdr_encode(enc).error_code);
+  ASSERT_EQ(nullptr, uhdr_get_encoded_stream(enc));
+
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, &img).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_set_cancel_flag(dec, &cancel).error_code);
+  ASSERT_EQ(UHDR_CODEC_CANCELLED, uhdr_decode(dec).error_code);
+  ASSERT_EQ(nullptr, uhdr_get_decoded_image(dec));
+
+  // reset drops the flag
+  uhdr_reset_decoder(dec);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, &img).error_code);
+  status = uhdr_decode(dec);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  ASSERT_NE(nullptr, uhdr_get_decoded_image(dec));
+
+  // a flag raised while the call runs, by the first parallel stage, and a deadline passed by the
+  // time the first parallel stage runs
+  struct Executor {
+    int* cancel;
+    unsigned int sleepMs;
+  };
+  uhdr_parallel_for_fn_t interruptingFor = [](void* executor_ctx, int begin, int end,
+                                               uhdr_job_fn_t job, void* job_ctx) {
+    auto* executor = static_cast<Executor*>(executor_ctx);
+    if (executor->cancel != nullptr) *executor->cancel = 1;
+    std::this_thread::sleep_for(std::chrono::milliseconds(executor->sleepMs));
+    for (int i = begin; i < end; i++) job(job_ctx, i);
+  };
+  for (bool deadline : {false, true}) {
+    SCOPED_TRACE(deadline ? "deadline" : "cancel flag");
+    cancel = 0;
+    Executor executor{deadline ? nullptr : &cancel, deadline ? 20u : 0u};
+    uhdr_reset_encoder(enc);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &hdrImg, UHDR_HDR_IMG).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_num_threads(enc, 4).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK,
+              uhdr_set_parallel_executor(enc, interruptingFor, &executor).error_code);
+    if (deadline) {
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_set_deadline(enc, 1).error_code);
+    } else {
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_set_cancel_flag(enc, &cancel).error_code);
+    }
+    ASSERT_EQ(UHDR_CODEC_CANCELLED, uhdr_encode(enc).error_code);
+
+    cancel = 0;
+    uhdr_reset_decoder(dec);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, &img).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_num_threads(dec, 4).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK,
+              uhdr_set_parallel_executor(dec, interruptingFor, &executor).error_code);
+    if (deadline) {
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_set_deadline(dec, 1).error_code);
+    } else {
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_set_cancel_flag(dec, &cancel).error_code);
+    }
+    ASSERT_EQ(UHDR_CODEC_CANCELLED, uhdr_decode(dec).error_code);
+  }
+  uhdr_release_decoder(dec);
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, DecodeWithLeadingCrop) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  uhdr_error_info_t status = uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_encode(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  // not aligned to mcus or to gain map samples, crosses the image edge
+  const int left = 37, top = 21, right = kImageWidth + 64, bottom = top + 150;
+  const unsigned int cropWd = kImageWidth - left, cropHt = bottom - top;
+  const struct {
+    uhdr_img_fmt_t fmt;
+    uhdr_color_transfer_t ct;
+    float displayBoost;
+  } outputs[] = {
+      {UHDR_IMG_FMT_64bppRGBAHalfFloat, UHDR_CT_LINEAR, FLT_MAX},
+      {UHDR_IMG_FMT_32bppRGBA1010102, UHDR_CT_HLG, FLT_MAX},
+      {UHDR_IMG_FMT_32bppRGBA8888, UHDR_CT_SRGB, FLT_MAX},
+      {UHDR_IMG_FMT_32bppRGBA8888, UHDR_CT_SRGB, 2.0f},
+  };
+  for (const auto& output : outputs) {
+    SCOPED_TRACE(::testing::Message() << "fmt " << output.fmt << " ct " << output.ct);
+    uhdr_codec_private_t* decs[2] = {uhdr_create_decoder(), uhdr_create_decoder()};
+    for (auto dec : decs) {
+      status = uhdr_dec_set_image(dec, compressedImage);
+      ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_img_format(dec, output.fmt).error_code);
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(dec, output.ct).error_code);
+      if (output.displayBoost != FLT_MAX) {
+        ASSERT_EQ(UHDR_CODEC_OK,
+                  uhdr_dec_set_out_max_display_boost(dec, output.displayBoost).error_code);
+      }
+    }
+    // the crop is followed by a mirror so that the effects after the fused crop run as well
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_add_effect_crop(decs[0], left, right, top, bottom).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_add_effect_mirror(decs[0], UHDR_MIRROR_HORIZONTAL).error_code);
+    status = uhdr_decode(decs[0]);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    status = uhdr_decode(decs[1]);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+
+    uhdr_raw_image_t* cropped = uhdr_get_decoded_image(decs[0]);
+    uhdr_raw_image_t* reference = uhdr_get_decoded_image(decs[1]);
+    ASSERT_NE(nullptr, cropped);
+    ASSERT_NE(nullptr, reference);
+    ASSERT_EQ(cropWd, cropped->w);
+    ASSERT_EQ(cropHt, cropped->h);
+    const size_t bpp = output.fmt == UHDR_IMG_FMT_64bppRGBAHalfFloat ? 8 : 4;
+    for (unsigned int i = 0; i < cropHt; i++) {
+      const size_t refOffset = (size_t)(top + i) * reference->stride[UHDR_PLANE_PACKED] + left;
+      const uint8_t* refRow =
+          static_cast<uint8_t*>(reference->planes[UHDR_PLANE_PACKED]) + refOffset * bpp;
+      const uint8_t* row = static_cast<uint8_t*>(cropped->planes[UHDR_PLANE_PACKED]) +
+                           (size_t)i * cropped->stride[UHDR_PLANE_PACKED] * bpp;
+      for (unsigned int j = 0; j < cropWd; j++) {
+        ASSERT_EQ(0, memcmp(refRow + j * bpp, row + (cropWd - 1 - j) * bpp, bpp))
+            << "mismatch at row " << i << " col " << j;
+      }
+    }
+
+    uhdr_raw_image_t* gainmap = uhdr_get_decoded_gainmap_image(decs[0]);
+    uhdr_raw_image_t* refGainmap = uhdr_get_decoded_gainmap_image(decs[1]);
+    ASSERT_NE(nullptr, gainmap);
+    ASSERT_NE(nullptr, refGainmap);
+    const float ratio = (float)kImageWidth / refGainmap->w;
+    ASSERT_EQ((unsigned int)(kImageWidth / ratio) - (unsigned int)(left / ratio), gainmap->w);
+    ASSERT_EQ((unsigned int)(bottom / ratio) - (unsigned int)(top / ratio), gainmap->h);
+    for (auto dec : decs) uhdr_release_decoder(dec);
+  }
+
+  // invalid crops are reported as before
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  status = uhdr_dec_set_image(dec, compressedImage);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_add_effect_crop(dec, 64, 32, 0, 64).error_code);
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_decode(dec).error_code);
+  uhdr_release_decoder(dec);
+  uhdr_release_encoder(enc);
+}
+
+// rotations, mirrors and crops are made while the gain map is applied
+TEST(JpegRTest, DecodeWithFusedEffects) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  uhdr_error_info_t status = uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_encode(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  // crop of the rotated image, odd and not aligned to mcus or to gain map samples
+  const int left = 13, top = 29, right = kImageHeight - 7, bottom = kImageWidth - 51;
+  const struct {
+    const char* name;
+    std::function<void(uhdr_codec_private_t*)> addEffects;
+    unsigned int w, h;
+    // pixel of the unedited image at row i, column j of the edited one
+    std::function<std::pair<int, int>(int, int)> source;
+  } edits[] = {
+      {"rotate 90 and crop",
+       [=](uhdr_codec_private_t* dec) {
+         uhdr_add_effect_rotate(dec, 90);
+         uhdr_add_effect_crop(dec, left, right, top, bottom);
+       },
+       (unsigned int)(right - left), (unsigned int)(bottom - top),
+       [=](int i, int j) { return std::make_pair(kImageHeight - 1 - (left + j), top + i); }},
+      {"mirror and rotate 180",
+       [](uhdr_codec_private_t* dec) {
+         uhdr_add_effect_mirror(dec, UHDR_MIRROR_VERTICAL);
+         uhdr_add_effect_rotate(dec, 180);
+       },
+       kImageWidth, kImageHeight,
+       [](int i, int j) { return std::make_pair(i, kImageWidth - 1 - j); }},
+  };
+  const struct {
+    uhdr_img_fmt_t fmt;
+    uhdr_color_transfer_t ct;
+  } outputs[] = {
+      {UHDR_IMG_FMT_64bppRGBAHalfFloat, UHDR_CT_LINEAR},
+      {UHDR_IMG_FMT_32bppRGBA1010102, UHDR_CT_PQ},
+      {UHDR_IMG_FMT_32bppRGBA8888, UHDR_CT_SRGB},
+  };
+  for (const auto& output : outputs) {
+    uhdr_codec_private_t* ref = uhdr_create_decoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(ref, compressedImage).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_img_format(ref, output.fmt).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(ref, output.ct).error_code);
+    status = uhdr_decode(ref);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    uhdr_raw_image_t* reference = uhdr_get_decoded_image(ref);
+    ASSERT_NE(nullptr, reference);
+    const size_t bpp = output.fmt == UHDR_IMG_FMT_64bppRGBAHalfFloat ? 8 : 4;
+
+    for (const auto& edit : edits) {
+      SCOPED_TRACE(::testing::Message() << "fmt " << output.fmt << " " << edit.name);
+      uhdr_codec_private_t* dec = uhdr_create_decoder();
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_img_format(dec, output.fmt).error_code);
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(dec, output.ct).error_code);
+      edit.addEffects(dec);
+      status = uhdr_decode(dec);
+      ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+      uhdr_raw_image_t* edited = uhdr_get_decoded_image(dec);
+      ASSERT_NE(nullptr, edited);
+      ASSERT_EQ(edit.w, edited->w);
+      ASSERT_EQ(edit.h, edited->h);
+      for (unsigned int i = 0; i < edited->h; i++) {
+        const uint8_t* row = static_cast<uint8_t*>(edited->planes[UHDR_PLANE_PACKED]) +
+                             (size_t)i * edited->stride[UHDR_PLANE_PACKED] * bpp;
+        for (unsigned int j = 0; j < edited->w; j++) {
+          auto src = edit.source(i, j);
+          const uint8_t* refPixel =
+              static_cast<uint8_t*>(reference->planes[UHDR_PLANE_PACKED]) +
+              ((size_t)src.first * reference->stride[UHDR_PLANE_PACKED] + src.second) * bpp;
+          ASSERT_EQ(0, memcmp(refPixel, row + j * bpp, bpp))
+              << "mismatch at row " << i << " col " << j;
+        }
+      }
+      uhdr_release_decoder(dec);
+    }
+    uhdr_release_decoder(ref);
+  }
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, DecodeWithLeadingResize) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  uhdr_error_info_t status = uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_encode(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  // the quarter size image, and a resize to below it, come from a 1/4 scaled decode
+  const int sizes[][2] = {{kImageWidth / 4, kImageHeight / 4}, {kImageWidth / 5, kImageHeight / 6}};
+  const struct {
+    uhdr_img_fmt_t fmt;
+    uhdr_color_transfer_t ct;
+  } outputs[] = {
+      {UHDR_IMG_FMT_64bppRGBAHalfFloat, UHDR_CT_LINEAR},
+      {UHDR_IMG_FMT_32bppRGBA1010102, UHDR_CT_HLG},
+      {UHDR_IMG_FMT_32bppRGBA8888, UHDR_CT_SRGB},
+  };
+  for (const auto& size : sizes) {
+    for (const auto& output : outputs) {
+      SCOPED_TRACE(::testing::Message() << "size " << size[0] << "x" << size[1] << " fmt "
+                                        << output.fmt << " ct " << output.ct);
+      uhdr_codec_private_t* decs[2] = {uhdr_create_decoder(), uhdr_create_decoder()};
+      for (auto dec : decs) {
+        status = uhdr_dec_set_image(dec, compressedImage);
+        ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+        ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_img_format(dec, output.fmt).error_code);
+        ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(dec, output.ct).error_code);
+      }
+      // a leading mirror keeps the reference decoder at full scale
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_add_effect_mirror(decs[1], UHDR_MIRROR_HORIZONTAL).error_code);
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_add_effect_mirror(decs[1], UHDR_MIRROR_HORIZONTAL).error_code);
+      for (auto dec : decs) {
+        ASSERT_EQ(UHDR_CODEC_OK, uhdr_add_effect_resize(dec, size[0], size[1]).error_code);
+        status = uhdr_decode(dec);
+        ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+      }
+
+      uhdr_raw_image_t* scaled = uhdr_get_decoded_image(decs[0]);
+      uhdr_raw_image_t* reference = uhdr_get_decoded_image(decs[1]);
+      ASSERT_NE(nullptr, scaled);
+      ASSERT_NE(nullptr, reference);
+      ASSERT_EQ((unsigned int)size[0], scaled->w);
+      ASSERT_EQ((unsigned int)size[1], scaled->h);
+      uhdr_raw_image_t* gainmap = uhdr_get_decoded_gainmap_image(decs[0]);
+      uhdr_raw_image_t* refGainmap = uhdr_get_decoded_gainmap_image(decs[1]);
+      ASSERT_NE(nullptr, gainmap);
+      ASSERT_NE(nullptr, refGainmap);
+      ASSERT_EQ(refGainmap->w, gainmap->w);
+      ASSERT_EQ(refGainmap->h, gainmap->h);
+
+      if (output.fmt == UHDR_IMG_FMT_32bppRGBA8888 && &size == &sizes[0]) {
+        // the scaled decode averages where the reference resize samples, away from the edges of
+        // the test pattern both agree
+        size_t numClose = 0;
+        for (unsigned int i = 0; i < scaled->h; i++) {
+          const uint8_t* row = static_cast<uint8_t*>(scaled->planes[UHDR_PLANE_PACKED]) +
+                               (size_t)i * scaled->stride[UHDR_PLANE_PACKED] * 4;
+          const uint8_t* refRow = static_cast<uint8_t*>(reference->planes[UHDR_PLANE_PACKED]) +
+                                  (size_t)i * reference->stride[UHDR_PLANE_PACKED] * 4;
+          for (unsigned int j = 0; j < scaled->w * 4; j++) {
+            if (std::abs(row[j] - refRow[j]) <= 8) numClose++;
+          }
+        }
+        ASSERT_GT((double)numClose / (scaled->w * scaled->h * 4), 0.95);
+      }
+      for (auto dec : decs) uhdr_release_decoder(dec);
+    }
+  }
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, DecodePyramid) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  uhdr_error_info_t status = uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_encode(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  // added smallest first, produced largest first
+  const int levels[][2] = {{kImageWidth / 10, kImageHeight / 10},
+                           {kImageWidth / 2, kImageHeight / 2},
+                           {kImageWidth / 4, kImageHeight / 4}};
+  uhdr_codec_private_t* decs[2] = {uhdr_create_decoder(), uhdr_create_decoder()};
+  for (auto dec : decs) {
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK,
+              uhdr_dec_set_out_img_format(dec, UHDR_IMG_FMT_32bppRGBA1010102).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(dec, UHDR_CT_HLG).error_code);
+  }
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enable_stats(decs[0], 1).error_code);
+  for (const auto& level : levels) {
+    ASSERT_EQ(UHDR_CODEC_OK,
+              uhdr_dec_add_pyramid_level(decs[0], level[0], level[1], UHDR_RESIZE_BILINEAR)
+                  .error_code);
+  }
+  EXPECT_EQ(UHDR_CODEC_INVALID_PARAM,
+            uhdr_dec_add_pyramid_level(decs[0], 0, 10, UHDR_RESIZE_BILINEAR).error_code);
+  status = uhdr_decode(decs[0]);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  EXPECT_EQ(nullptr, uhdr_get_decoded_pyramid_level(decs[0], 3));
+  uhdr_codec_stats_t* stats = uhdr_dec_get_stats(decs[0]);
+  ASSERT_NE(nullptr, stats);
+  EXPECT_EQ(1u, stats->stages[UHDR_STAGE_BASE_DECODE].calls);
+
+  // the decode runs at half scale, the largest level is resized from it as a leading resize is
+  uhdr_raw_image_t* decoded = uhdr_get_decoded_image(decs[0]);
+  ASSERT_NE(nullptr, decoded);
+  EXPECT_EQ(kImageWidth / 2, decoded->w);
+  EXPECT_EQ(kImageHeight / 2, decoded->h);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_add_effect_resize_with_filter(decs[1], kImageWidth / 2,
+                                                              kImageHeight / 2,
+                                                              UHDR_RESIZE_BILINEAR)
+                               .error_code);
+  status = uhdr_decode(decs[1]);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+
+  auto expectEqual = [](uhdr_raw_image_t* exp, uhdr_raw_image_t* got) {
+    ASSERT_NE(nullptr, exp);
+    ASSERT_NE(nullptr, got);
+    ASSERT_EQ(exp->fmt, got->fmt);
+    ASSERT_EQ(exp->w, got->w);
+    ASSERT_EQ(exp->h, got->h);
+    for (unsigned int i = 0; i < exp->h; i++) {
+      ASSERT_EQ(0, memcmp(static_cast<uint32_t*>(exp->planes[UHDR_PLANE_PACKED]) +
+                              i * exp->stride[UHDR_PLANE_PACKED],
+                          static_cast<uint32_t*>(got->planes[UHDR_PLANE_PACKED]) +
+                              i * got->stride[UHDR_PLANE_PACKED],
+                          exp->w * sizeof(uint32_t)))
+          << "row " << i;
+    }
+  };
+  expectEqual(uhdr_get_decoded_image(decs[1]), uhdr_get_decoded_pyramid_level(decs[0], 1));
+
+  // smaller levels cascade from the smallest level that covers them
+  uhdr_raw_image_t* quarter = uhdr_get_decoded_pyramid_level(decs[0], 2);
+  ASSERT_NE(nullptr, quarter);
+  auto expectedQuarter = resample_image(uhdr_get_decoded_pyramid_level(decs[0], 1),
+                                        kImageWidth / 4, kImageHeight / 4, UHDR_RESIZE_BILINEAR);
+  expectEqual(expectedQuarter.get(), quarter);
+  auto expectedTenth = resample_image(quarter, kImageWidth / 10, kImageHeight / 10,
+                                      UHDR_RESIZE_BILINEAR);
+  expectEqual(expectedTenth.get(), uhdr_get_decoded_pyramid_level(decs[0], 0));
+
+  // levels do not upscale
+  uhdr_reset_decoder(decs[1]);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(decs[1], compressedImage).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_add_pyramid_level(decs[1], kImageWidth + 2, kImageHeight,
+                                                      UHDR_RESIZE_BILINEAR)
+                               .error_code);
+  EXPECT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_decode(decs[1]).error_code);
+
+  for (auto dec : decs) uhdr_release_decoder(dec);
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, ResizeWithFilter) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  const int dstWidth = kImageWidth / 2, dstHeight = kImageHeight / 2;
+  const uhdr_resize_filter_t filters[] = {UHDR_RESIZE_NEAREST, UHDR_RESIZE_BILINEAR,
+                                          UHDR_RESIZE_BICUBIC, UHDR_RESIZE_LANCZOS};
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM,
+            uhdr_add_effect_resize_with_filter(enc, dstWidth, dstHeight, (uhdr_resize_filter_t)-1)
+                .error_code);
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM,
+            uhdr_add_effect_resize_with_filter(enc, dstWidth, dstHeight,
+                                               (uhdr_resize_filter_t)(UHDR_RESIZE_LANCZOS + 1))
+                .error_code);
+  uhdr_error_info_t status = uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_encode(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  // mirrors around the resize make the decoder run the folded effects before and after it
+  uhdr_raw_image_t* images[4];
+  uhdr_raw_image_t* gainmaps[4];
+  uhdr_codec_private_t* decs[4];
+  for (int i = 0; i < 4; i++) {
+    SCOPED_TRACE(::testing::Message() << "filter " << filters[i]);
+    decs[i] = uhdr_create_decoder();
+    status = uhdr_dec_set_image(decs[i], compressedImage);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    ASSERT_EQ(UHDR_CODEC_OK,
+              uhdr_dec_set_out_img_format(decs[i], UHDR_IMG_FMT_32bppRGBA8888).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(decs[i], UHDR_CT_SRGB).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_add_effect_mirror(decs[i], UHDR_MIRROR_HORIZONTAL).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK,
+              uhdr_add_effect_resize_with_filter(decs[i], dstWidth, dstHeight, filters[i])
+                  .error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_add_effect_mirror(decs[i], UHDR_MIRROR_HORIZONTAL).error_code);
+    status = uhdr_decode(decs[i]);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    images[i] = uhdr_get_decoded_image(decs[i]);
+    gainmaps[i] = uhdr_get_decoded_gainmap_image(decs[i]);
+    ASSERT_NE(nullptr, images[i]);
+    ASSERT_NE(nullptr, gainmaps[i]);
+    ASSERT_EQ((unsigned int)dstWidth, images[i]->w);
+    ASSERT_EQ((unsigned int)dstHeight, images[i]->h);
+    // the gain map follows the base image with the same filter
+    ASSERT_EQ(gainmaps[0]->w, gainmaps[i]->w);
+    ASSERT_EQ(gainmaps[0]->h, gainmaps[i]->h);
+  }
+  // all filters see the same picture, away from the edges of the test pattern
+  for (int i = 1; i < 4; i++) {
+    size_t numClose = 0;
+    for (unsigned int y = 0; y < images[0]->h; y++) {
+      const uint8_t* row = static_cast<uint8_t*>(images[i]->planes[UHDR_PLANE_PACKED]) +
+                           (size_t)y * images[i]->stride[UHDR_PLANE_PACKED] * 4;
+      const uint8_t* refRow = static_cast<uint8_t*>(images[0]->planes[UHDR_PLANE_PACKED]) +
+                              (size_t)y * images[0]->stride[UHDR_PLANE_PACKED] * 4;
+      for (unsigned int x = 0; x < images[0]->w * 4; x++) {
+        if (std::abs(row[x] - refRow[x]) <= 8) numClose++;
+      }
+    }
+    EXPECT_GT((double)numClose / (images[0]->w * images[0]->h * 4), 0.9) << "filter " << i;
+  }
+  for (auto dec : decs) uhdr_release_decoder(dec);
+  uhdr_release_encoder(enc);
+
+  // the encoder resamples the intent the same way
+  enc = uhdr_create_encoder();
+  status = uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  ASSERT_EQ(UHDR_CODEC_OK,
+            uhdr_add_effect_resize_with_filter(enc, dstWidth, dstHeight, UHDR_RESIZE_LANCZOS)
+                .error_code);
+  status = uhdr_encode(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  status = uhdr_dec_set_image(dec, compressedImage);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_decode(dec);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  ASSERT_EQ((unsigned int)dstWidth, uhdr_get_decoded_image(dec)->w);
+  ASSERT_EQ((unsigned int)dstHeight, uhdr_get_decoded_image(dec)->h);
+  uhdr_release_decoder(dec);
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, DecodeWithoutGainMapApplication) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  uhdr_error_info_t status = uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_encode(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  // reference base image planes, the primary image is the first image of the stream
+  JpegDecoderHelper baseDecoder;
+  status = baseDecoder.decompressImage(compressedImage->data, compressedImage->data_sz,
+                                       DECODE_TO_YCBCR_CS);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_raw_image_t refBase = baseDecoder.getDecompressedImage();
+  ASSERT_EQ(UHDR_IMG_FMT_12bppYCbCr420, refBase.fmt);
+
+  // sdr output of a regular decode is the base image as is
+  uhdr_codec_private_t* refDec = uhdr_create_decoder();
+  status = uhdr_dec_set_image(refDec, compressedImage);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  ASSERT_EQ(UHDR_CODEC_OK,
+            uhdr_dec_set_out_img_format(refDec, UHDR_IMG_FMT_32bppRGBA8888).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(refDec, UHDR_CT_SRGB).error_code);
+  status = uhdr_decode(refDec);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_raw_image_t* refRgba = uhdr_get_decoded_image(refDec);
+  uhdr_raw_image_t* refGainmap = uhdr_get_decoded_gainmap_image(refDec);
+  ASSERT_NE(nullptr, refRgba);
+  ASSERT_NE(nullptr, refGainmap);
+
+  for (uhdr_img_fmt_t fmt : {UHDR_IMG_FMT_32bppRGBA8888, UHDR_IMG_FMT_12bppYCbCr420}) {
+    SCOPED_TRACE(::testing::Message() << "fmt " << fmt);
+    uhdr_codec_private_t* dec = uhdr_create_decoder();
+    status = uhdr_dec_set_image(dec, compressedImage);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_enable_gainmap_application(dec, 0).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_img_format(dec, fmt).error_code);
+    // neither of these applies to the base image
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(dec, UHDR_CT_HLG).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_max_display_boost(dec, 2.0f).error_code);
+    status = uhdr_decode(dec);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+
+    uhdr_raw_image_t* base = uhdr_get_decoded_image(dec);
+    ASSERT_NE(nullptr, base);
+    ASSERT_EQ(fmt, base->fmt);
+    ASSERT_EQ(UHDR_CT_SRGB, base->ct);
+    ASSERT_EQ((unsigned int)kImageWidth, base->w);
+    ASSERT_EQ((unsigned int)kImageHeight, base->h);
+    const uhdr_raw_image_t* ref = fmt == UHDR_IMG_FMT_32bppRGBA8888 ? refRgba : &refBase;
+    const int numPlanes = fmt == UHDR_IMG_FMT_32bppRGBA8888 ? 1 : 3;
+    for (int p = 0; p < numPlanes; p++) {
+      const unsigned int subsample = p == 0 ? 1 : 2;
+      const size_t rowBytes = (base->w / subsample) * (numPlanes == 1 ? 4 : 1);
+      const size_t bpp = numPlanes == 1 ? 4 : 1;
+      for (unsigned int i = 0; i < base->h / subsample; i++) {
+        ASSERT_EQ(0, memcmp(static_cast<uint8_t*>(ref->planes[p]) + i * ref->stride[p] * bpp,
+                            static_cast<uint8_t*>(base->planes[p]) + i * base->stride[p] * bpp,
+                            rowBytes))
+            << "mismatch at plane " << p << " row " << i;
+      }
+    }
+
+    uhdr_raw_image_t* gainmap = uhdr_get_decoded_gainmap_image(dec);
+    ASSERT_NE(nullptr, gainmap);
+    ASSERT_EQ(refGainmap->fmt, gainmap->fmt);
+    ASSERT_EQ(refGainmap->w, gainmap->w);
+    ASSERT_EQ(refGainmap->h, gainmap->h);
+    for (unsigned int i = 0; i < gainmap->h; i++) {
+      ASSERT_EQ(0, memcmp(static_cast<uint8_t*>(refGainmap->planes[UHDR_PLANE_Y]) +
+                              i * refGainmap->stride[UHDR_PLANE_Y],
+                          static_cast<uint8_t*>(gainmap->planes[UHDR_PLANE_Y]) +
+                              i * gainmap->stride[UHDR_PLANE_Y],
+                          gainmap->w));
+    }
+    ASSERT_NE(nullptr, uhdr_dec_get_gainmap_metadata(dec));
+    uhdr_release_decoder(dec);
+  }
+  uhdr_release_decoder(refDec);
+
+  // with gain map application enabled, sdr output in the coded layout is the base image as is. A
+  // display boost would need the gain map applied, it is rejected.
+  for (float boost : {FLT_MAX, 2.0f}) {
+    SCOPED_TRACE(::testing::Message() << "boost " << boost);
+    uhdr_codec_private_t* dec = uhdr_create_decoder();
+    status = uhdr_dec_set_image(dec, compressedImage);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    ASSERT_EQ(UHDR_CODEC_OK,
+              uhdr_dec_set_out_img_format(dec, UHDR_IMG_FMT_12bppYCbCr420).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(dec, UHDR_CT_SRGB).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_max_display_boost(dec, boost).error_code);
+    status = uhdr_decode(dec);
+    if (boost != FLT_MAX) {
+      ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, status.error_code);
+      uhdr_release_decoder(dec);
+      continue;
+    }
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    uhdr_raw_image_t* base = uhdr_get_decoded_image(dec);
+    ASSERT_NE(nullptr, base);
+    ASSERT_EQ(UHDR_IMG_FMT_12bppYCbCr420, base->fmt);
+    for (int p = 0; p < 3; p++) {
+      const unsigned int subsample = p == 0 ? 1 : 2;
+      for (unsigned int i = 0; i < base->h / subsample; i++) {
+        ASSERT_EQ(0, memcmp(static_cast<uint8_t*>(refBase.planes[p]) + i * refBase.stride[p],
+                            static_cast<uint8_t*>(base->planes[p]) + i * base->stride[p],
+                            base->w / subsample))
+            << "mismatch at plane " << p << " row " << i;
+      }
+    }
+    uhdr_release_decoder(dec);
+  }
+
+  // the base image is coded 4:2:0, other layouts and hdr formats are rejected
+  const struct {
+    int applyGainmap;
+    uhdr_img_fmt_t fmt;
+    uhdr_codec_err_t expected;
+  } errCases[] = {
+      {0, UHDR_IMG_FMT_24bppYCbCr444, UHDR_CODEC_UNSUPPORTED_FEATURE},
+      {0, UHDR_IMG_FMT_64bppRGBAHalfFloat, UHDR_CODEC_INVALID_PARAM},
+      {1, UHDR_IMG_FMT_12bppYCbCr420, UHDR_CODEC_INVALID_PARAM},
+  };
+  for (const auto& errCase : errCases) {
+    SCOPED_TRACE(::testing::Message() << "apply " << errCase.applyGainmap << " fmt "
+                                      << errCase.fmt);
+    uhdr_codec_private_t* dec = uhdr_create_decoder();
+    status = uhdr_dec_set_image(dec, compressedImage);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    ASSERT_EQ(UHDR_CODEC_OK,
+              uhdr_dec_enable_gainmap_application(dec, errCase.applyGainmap).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_img_format(dec, errCase.fmt).error_code);
+    ASSERT_EQ(errCase.expected, uhdr_decode(dec).error_code);
+    ASSERT_EQ(nullptr, uhdr_get_decoded_image(dec));
+    uhdr_release_decoder(dec);
+  }
+  uhdr_release_encoder(enc);
+}
+
+// decodes the base image of an ultrahdr image as planar 4:2:0 along with its gain map, after the
+// effects that add adds to the decoder
+static void decodeUnapplied(uhdr_compressed_image_t* img,
+                            const std::function<void(uhdr_codec_private_t*)>& add,
+                            uhdr_codec_private_t** out) {
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  *out = dec;
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, img).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_enable_gainmap_application(dec, 0).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_img_format(dec, UHDR_IMG_FMT_12bppYCbCr420).error_code);
+  add(dec);
+  uhdr_error_info_t status = uhdr_decode(dec);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+}
+
+// largest absolute difference of the samples of all planes, images must have the same layout
+static int maxPlaneDifference(const uhdr_raw_image_t* a, const uhdr_raw_image_t* b) {
+  EXPECT_EQ(a->fmt, b->fmt);
+  EXPECT_EQ(a->w, b->w);
+  EXPECT_EQ(a->h, b->h);
+  if (a->fmt != b->fmt || a->w != b->w || a->h != b->h) return INT_MAX;
+  const int numPlanes = a->fmt == UHDR_IMG_FMT_12bppYCbCr420 ? 3 : 1;
+  int maxDiff = 0;
+  for (int p = 0; p < numPlanes; p++) {
+    const unsigned int subsample = p == 0 ? 1 : 2;
+    for (unsigned int i = 0; i < a->h / subsample; i++) {
+      const uint8_t* rowA = static_cast<uint8_t*>(a->planes[p]) + (size_t)i * a->stride[p];
+      const uint8_t* rowB = static_cast<uint8_t*>(b->planes[p]) + (size_t)i * b->stride[p];
+      for (unsigned int j = 0; j < a->w / subsample; j++) {
+        maxDiff = (std::max)(maxDiff, std::abs(rowA[j] - rowB[j]));
+      }
+    }
+  }
+  return maxDiff;
+}
+
+TEST(JpegRTest, TranscodeWithEffects) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  uhdr_error_info_t status = uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_encode(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  // left and top edges of the crop on mcu boundaries, the edges that the rotation and the mirror
+  // move to the top left corner as well
+  auto addEffects = [](uhdr_codec_private_t* dec) {
+    ASSERT_EQ(UHDR_CODEC_OK,
+              uhdr_add_effect_crop(dec, 64, kImageWidth - 37, 48, kImageHeight).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_add_effect_rotate(dec, 90).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_add_effect_mirror(dec, UHDR_MIRROR_HORIZONTAL).error_code);
+  };
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+  addEffects(dec);
+  status = uhdr_transcode(dec);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_decode(dec).error_code);
+  ASSERT_EQ(nullptr, uhdr_get_decoded_image(dec));
+  uhdr_compressed_image_t* transcoded = uhdr_get_transcoded_image(dec);
+  ASSERT_NE(nullptr, transcoded);
+  ASSERT_TRUE(is_uhdr_image(transcoded->data, transcoded->data_sz));
+
+  // the pixels of the transcoded image match those of a decode that applies the effects, up to
+  // the rounding of the inverse dct, which runs along the other axis for rotated blocks. The gain
+  // map of this content is saturated, its samples are compared by the round trip below
+  uhdr_codec_private_t *refDec = nullptr, *outDec = nullptr;
+  decodeUnapplied(compressedImage, addEffects, &refDec);
+  decodeUnapplied(transcoded, [](uhdr_codec_private_t*) {}, &outDec);
+  uhdr_raw_image_t* out = uhdr_get_decoded_image(outDec);
+  ASSERT_NE(nullptr, out);
+  ASSERT_EQ((unsigned int)kImageHeight - 48, out->w);
+  ASSERT_EQ((unsigned int)kImageWidth - 37 - 64, out->h);
+  ASSERT_LE(maxPlaneDifference(uhdr_get_decoded_image(refDec), out), 1);
+  ASSERT_EQ(uhdr_get_decoded_gainmap_image(refDec)->w, uhdr_get_decoded_gainmap_image(outDec)->w);
+  ASSERT_EQ(uhdr_get_decoded_gainmap_image(refDec)->h, uhdr_get_decoded_gainmap_image(outDec)->h);
+  uhdr_gainmap_metadata_t* refMetadata = uhdr_dec_get_gainmap_metadata(refDec);
+  uhdr_gainmap_metadata_t* metadata = uhdr_dec_get_gainmap_metadata(outDec);
+  ASSERT_NE(nullptr, refMetadata);
+  ASSERT_NE(nullptr, metadata);
+  ASSERT_FLOAT_EQ(refMetadata->max_content_boost, metadata->max_content_boost);
+  ASSERT_FLOAT_EQ(refMetadata->min_content_boost, metadata->min_content_boost);
+  ASSERT_FLOAT_EQ(refMetadata->gamma, metadata->gamma);
+  ASSERT_FLOAT_EQ(refMetadata->hdr_capacity_max, metadata->hdr_capacity_max);
+  // the icc segment of the base image is carried over as is
+  uhdr_mem_block_t* refIcc = uhdr_dec_get_icc(refDec);
+  uhdr_mem_block_t* icc = uhdr_dec_get_icc(outDec);
+  ASSERT_NE(nullptr, refIcc);
+  ASSERT_NE(nullptr, icc);
+  ASSERT_EQ(refIcc->data_sz, icc->data_sz);
+  ASSERT_EQ(0, memcmp(refIcc->data, icc->data, icc->data_sz));
+  uhdr_release_decoder(refDec);
+  uhdr_release_decoder(outDec);
+
+  // there is no generation loss, undoing the rotation restores the coefficients exactly
+  uhdr_codec_private_t* roundTrip[2] = {uhdr_create_decoder(), uhdr_create_decoder()};
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(roundTrip[0], compressedImage).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_add_effect_rotate(roundTrip[0], 90).error_code);
+  status = uhdr_transcode(roundTrip[0]);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  ASSERT_EQ(UHDR_CODEC_OK,
+            uhdr_dec_set_image(roundTrip[1], uhdr_get_transcoded_image(roundTrip[0])).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_add_effect_rotate(roundTrip[1], 270).error_code);
+  status = uhdr_transcode(roundTrip[1]);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  decodeUnapplied(compressedImage, [](uhdr_codec_private_t*) {}, &refDec);
+  decodeUnapplied(uhdr_get_transcoded_image(roundTrip[1]), [](uhdr_codec_private_t*) {}, &outDec);
+  ASSERT_EQ(0, maxPlaneDifference(uhdr_get_decoded_image(refDec), uhdr_get_decoded_image(outDec)));
+  ASSERT_EQ(0, maxPlaneDifference(uhdr_get_decoded_gainmap_image(refDec),
+                                  uhdr_get_decoded_gainmap_image(outDec)));
+  uhdr_release_decoder(refDec);
+  uhdr_release_decoder(outDec);
+  for (auto it : roundTrip) uhdr_release_decoder(it);
+
+  // effects that split blocks or blend pixels are rejected
+  const std::function<void(uhdr_codec_private_t*)> unsupported[] = {
+      [](uhdr_codec_private_t* dec) { uhdr_add_effect_crop(dec, 8, kImageWidth, 0, 64); },
+      [](uhdr_codec_private_t* dec) { uhdr_add_effect_crop(dec, 0, 64, 4, kImageHeight); },
+      [](uhdr_codec_private_t* dec) {
+        uhdr_add_effect_crop(dec, 0, kImageWidth - 8, 0, kImageHeight);
+        uhdr_add_effect_mirror(dec, UHDR_MIRROR_HORIZONTAL);
+      },
+      [](uhdr_codec_private_t* dec) { uhdr_add_effect_resize(dec, 640, 360); },
+  };
+  uhdr_release_decoder(dec);
+  for (size_t i = 0; i < sizeof unsupported / sizeof unsupported[0]; i++) {
+    SCOPED_TRACE(::testing::Message() << "case " << i);
+    dec = uhdr_create_decoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+    unsupported[i](dec);
+    ASSERT_EQ(UHDR_CODEC_UNSUPPORTED_FEATURE, uhdr_transcode(dec).error_code);
+    ASSERT_EQ(nullptr, uhdr_get_transcoded_image(dec));
+    uhdr_release_decoder(dec);
+  }
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, RewriteGainMapMetadata) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  uint8_t exifData[] = {'E', 'x', 'i', 'f', 0, 0, 'M', 'M', 0, 42, 0, 0, 0, 8, 0, 0};
+  uhdr_mem_block_t exif{exifData, sizeof exifData, sizeof exifData};
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  uhdr_error_info_t status = uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_exif_data(enc, &exif).error_code);
+  status = uhdr_encode(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  uhdr_codec_private_t* probe = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(probe, compressedImage).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_probe(probe).error_code);
+  uhdr_gainmap_metadata_t metadata = *uhdr_dec_get_gainmap_metadata(probe);
+  uhdr_release_decoder(probe);
+
+  // the image lays out its segments as the encoder does, so rewriting the metadata it carries
+  // reproduces the stream
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_rewrite_gainmap_metadata(dec, nullptr).error_code);
+  status = uhdr_rewrite_gainmap_metadata(dec, &metadata);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_rewrite_gainmap_metadata(dec, &metadata).error_code);
+  uhdr_compressed_image_t* rewritten = uhdr_get_transcoded_image(dec);
+  ASSERT_NE(nullptr, rewritten);
+  ASSERT_EQ(compressedImage->data_sz, rewritten->data_sz);
+  ASSERT_EQ(0, memcmp(compressedImage->data, rewritten->data, rewritten->data_sz));
+  uhdr_release_decoder(dec);
+
+  // new metadata reaches the output, the images themselves and the exif package are untouched
+  uhdr_gainmap_metadata_t adjusted = metadata;
+  adjusted.hdr_capacity_max = metadata.hdr_capacity_max / 2;
+  adjusted.offset_sdr = 1.0f / 32;
+  adjusted.offset_hdr = 1.0f / 16;
+  dec = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+  status = uhdr_rewrite_gainmap_metadata(dec, &adjusted);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  rewritten = uhdr_get_transcoded_image(dec);
+  ASSERT_NE(nullptr, rewritten);
+  ASSERT_TRUE(is_uhdr_image(rewritten->data, rewritten->data_sz));
+  uhdr_codec_private_t *refDec = nullptr, *outDec = nullptr;
+  decodeUnapplied(compressedImage, [](uhdr_codec_private_t*) {}, &refDec);
+  decodeUnapplied(rewritten, [](uhdr_codec_private_t*) {}, &outDec);
+  ASSERT_EQ(0, maxPlaneDifference(uhdr_get_decoded_image(refDec), uhdr_get_decoded_image(outDec)));
+  ASSERT_EQ(0, maxPlaneDifference(uhdr_get_decoded_gainmap_image(refDec),
+                                  uhdr_get_decoded_gainmap_image(outDec)));
+  uhdr_gainmap_metadata_t* outMetadata = uhdr_dec_get_gainmap_metadata(outDec);
+  ASSERT_NE(nullptr, outMetadata);
+  ASSERT_FLOAT_EQ(adjusted.hdr_capacity_max, outMetadata->hdr_capacity_max);
+  ASSERT_FLOAT_EQ(adjusted.offset_sdr, outMetadata->offset_sdr);
+  ASSERT_FLOAT_EQ(adjusted.offset_hdr, outMetadata->offset_hdr);
+  ASSERT_FLOAT_EQ(metadata.max_content_boost, outMetadata->max_content_boost);
+  uhdr_mem_block_t* outExif = uhdr_dec_get_exif(outDec);
+  ASSERT_NE(nullptr, outExif);
+  ASSERT_EQ(sizeof exifData, outExif->data_sz);
+  ASSERT_EQ(0, memcmp(exifData, outExif->data, sizeof exifData));
+  uhdr_release_decoder(refDec);
+  uhdr_release_decoder(outDec);
+
+  // xmp properties of other writers in the primary image survive the rewrite. The white space of
+  // the directory makes room for them so that the mpf index of the input stays valid.
+  const uint8_t* encoded = static_cast<const uint8_t*>(compressedImage->data);
+  const std::string xmpSignature("http://ns.adobe.com/xap/1.0/", 29);
+  const size_t xmpOffset =
+      std::search(encoded, encoded + compressedImage->data_sz, xmpSignature.begin(),
+                  xmpSignature.end()) - encoded + xmpSignature.size();
+  const size_t xmpSize = ((encoded[xmpOffset - xmpSignature.size() - 2] << 8) |
+                          encoded[xmpOffset - xmpSignature.size() - 1]) - 2 - xmpSignature.size();
+  std::string packet(reinterpret_cast<const char*>(encoded) + xmpOffset, xmpSize);
+  const std::string rating = "\n      xmlns:xmp=\"http://ns.adobe.com/xap/1.0/\" xmp:Rating=\"4\"";
+  packet.insert(packet.find("<rdf:Description") + 16, rating);
+  for (size_t excess = rating.size(), at = packet.find("<Container:Directory"); excess > 0;
+       excess--) {
+    at = packet.find("  ", at);
+    ASSERT_NE(std::string::npos, at);
+    packet.erase(at, 1);
+  }
+  std::vector<uint8_t> tagged(encoded, encoded + compressedImage->data_sz);
+  std::copy(packet.begin(), packet.end(), tagged.begin() + xmpOffset);
+  uhdr_compressed_image_t taggedImage = *compressedImage;
+  taggedImage.data = tagged.data();
+  taggedImage.data_sz = taggedImage.capacity = tagged.size();
+  uhdr_release_decoder(dec);
+  dec = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, &taggedImage).error_code);
+  status = uhdr_rewrite_gainmap_metadata(dec, &adjusted);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  rewritten = uhdr_get_transcoded_image(dec);
+  ASSERT_NE(nullptr, rewritten);
+  const char* output = static_cast<const char*>(rewritten->data);
+  const std::string_view outputView(output, rewritten->data_sz);
+  const size_t ratingPos = outputView.find(rating);
+  ASSERT_NE(std::string_view::npos, ratingPos);
+  const size_t lengthPos = outputView.find("Item:Length=\"", ratingPos);
+  ASSERT_NE(std::string_view::npos, lengthPos);
+  const size_t gainmapLength = strtoul(output + lengthPos + 13, nullptr, 10);
+  ASSERT_LT(gainmapLength, rewritten->data_sz);
+  // the directory and the mpf index point at the gain map
+  EXPECT_EQ(0xff, static_cast<uint8_t>(output[rewritten->data_sz - gainmapLength]));
+  EXPECT_EQ(0xd8, static_cast<uint8_t>(output[rewritten->data_sz - gainmapLength + 1]));
+  decodeUnapplied(rewritten, [](uhdr_codec_private_t*) {}, &outDec);
+  outMetadata = uhdr_dec_get_gainmap_metadata(outDec);
+  ASSERT_NE(nullptr, outMetadata);
+  ASSERT_FLOAT_EQ(adjusted.hdr_capacity_max, outMetadata->hdr_capacity_max);
+  uhdr_release_decoder(outDec);
+
+  // effects are left to uhdr_transcode()
+  uhdr_release_decoder(dec);
+  dec = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, compressedImage).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_add_effect_rotate(dec, 90).error_code);
+  ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION,
+            uhdr_rewrite_gainmap_metadata(dec, &adjusted).error_code);
+  ASSERT_EQ(nullptr, uhdr_get_transcoded_image(dec));
+  uhdr_release_decoder(dec);
+  uhdr_release_encoder(enc);
+}
+
+TEST(JpegRTest, DecodeToTexture) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  uhdr_error_info_t status = uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_encode(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  // one decoder keeps its output on the gpu, the other reads it back as usual
+  uhdr_codec_private_t* decs[2];
+  for (int i = 0; i < 2; i++) {
+    decs[i] = uhdr_create_decoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(decs[i], compressedImage).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK,
+              uhdr_dec_set_out_img_format(decs[i], UHDR_IMG_FMT_32bppRGBA1010102).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(decs[i], UHDR_CT_HLG).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enable_gpu_acceleration(decs[i], 1).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_add_effect_rotate(decs[i], 90).error_code);
+  }
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_enable_gpu_output(decs[0], 1, nullptr).error_code);
+  for (int i = 0; i < 2; i++) {
+    status = uhdr_decode(decs[i]);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  }
+  ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION,
+            uhdr_dec_enable_gpu_output(decs[0], 0, nullptr).error_code);
+  ASSERT_EQ(0u, uhdr_get_decoded_texture(decs[1], nullptr, nullptr, nullptr));
+
+  unsigned int width = 0, height = 0;
+  uhdr_img_fmt_t fmt = UHDR_IMG_FMT_UNSPECIFIED;
+  unsigned int texture = uhdr_get_decoded_texture(decs[0], &width, &height, &fmt);
+#ifndef UHDR_ENABLE_GLES
+  ASSERT_EQ(0u, texture);
+#endif
+  if (texture != 0) {
+    ASSERT_EQ((unsigned int)kImageHeight, width);
+    ASSERT_EQ((unsigned int)kImageWidth, height);
+    ASSERT_EQ(UHDR_IMG_FMT_32bppRGBA1010102, fmt);
+  }
+
+  // the image is read back on demand, and matches the one read back during decode
+  uhdr_raw_image_t* onDemand = uhdr_get_decoded_image(decs[0]);
+  uhdr_raw_image_t* eager = uhdr_get_decoded_image(decs[1]);
+  ASSERT_NE(nullptr, onDemand);
+  ASSERT_NE(nullptr, eager);
+  ASSERT_EQ(eager->w, onDemand->w);
+  ASSERT_EQ(eager->h, onDemand->h);
+  for (unsigned int i = 0; i < eager->h; i++) {
+    ASSERT_EQ(0, memcmp(static_cast<uint8_t*>(eager->planes[UHDR_PLANE_PACKED]) +
+                            (size_t)i * eager->stride[UHDR_PLANE_PACKED] * 4,
+                        static_cast<uint8_t*>(onDemand->planes[UHDR_PLANE_PACKED]) +
+                            (size_t)i * onDemand->stride[UHDR_PLANE_PACKED] * 4,
+                        eager->w * 4))
+        << "row " << i;
+  }
+  ASSERT_EQ(texture, uhdr_get_decoded_texture(decs[0], nullptr, nullptr, nullptr));
+
+  uhdr_reset_decoder(decs[0]);
+  ASSERT_EQ(0u, uhdr_get_decoded_texture(decs[0], nullptr, nullptr, nullptr));
+  for (int i = 0; i < 2; i++) uhdr_release_decoder(decs[i]);
+  uhdr_release_encoder(enc);
+}
+
+// Small images are decoded on the cpu even with gpu acceleration enabled, unless the output is to
+// stay on the gpu
+TEST(JpegRTest, SmallImageDecodesOnCpu) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+
+  const unsigned int kWidth = 256, kHeight = 192;
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kWidth;
+  uhdrRawImg.h = kHeight;
+  // a crop of the image center
+  uint16_t* luma = static_cast<uint16_t*>(rawImg.getImageHandle()->data);
+  const size_t kLeft = (kImageWidth - kWidth) / 2, kTop = (kImageHeight - kHeight) / 2;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = luma + kTop * kImageWidth + kLeft;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      luma + kImageWidth * kImageHeight + kTop / 2 * kImageWidth + kLeft;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  uhdr_error_info_t status = uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  status = uhdr_encode(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  // cpu only, gpu enabled, gpu output
+  uhdr_codec_private_t* decs[3];
+  for (int i = 0; i < 3; i++) {
+    decs[i] = uhdr_create_decoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(decs[i], compressedImage).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK,
+              uhdr_dec_set_out_img_format(decs[i], UHDR_IMG_FMT_64bppRGBAHalfFloat).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(decs[i], UHDR_CT_LINEAR).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enable_gpu_acceleration(decs[i], i > 0).error_code);
+  }
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_enable_gpu_output(decs[2], 1, nullptr).error_code);
+  for (int i = 0; i < 3; i++) {
+    status = uhdr_decode(decs[i]);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  }
+  ASSERT_EQ(0u, uhdr_get_decoded_texture(decs[1], nullptr, nullptr, nullptr));
+#ifdef UHDR_ENABLE_GLES
+  ASSERT_NE(0u, uhdr_get_decoded_texture(decs[2], nullptr, nullptr, nullptr));
+#endif
+
+  uhdr_raw_image_t* cpu = uhdr_get_decoded_image(decs[0]);
+  uhdr_raw_image_t* placed = uhdr_get_decoded_image(decs[1]);
+  ASSERT_NE(nullptr, cpu);
+  ASSERT_NE(nullptr, placed);
+  ASSERT_EQ(kWidth, placed->w);
+  ASSERT_EQ(kHeight, placed->h);
+  for (unsigned int i = 0; i < kHeight; i++) {
+    ASSERT_EQ(0, memcmp(static_cast<uint8_t*>(cpu->planes[UHDR_PLANE_PACKED]) +
+                            (size_t)i * cpu->stride[UHDR_PLANE_PACKED] * 8,
+                        static_cast<uint8_t*>(placed->planes[UHDR_PLANE_PACKED]) +
+                            (size_t)i * placed->stride[UHDR_PLANE_PACKED] * 8,
+                        kWidth * 8))
+        << "row " << i;
+  }
+  for (int i = 0; i < 3; i++) uhdr_release_decoder(decs[i]);
+  uhdr_release_encoder(enc);
+}
+
+// A batch decodes each image as uhdr_decode() does
+TEST(JpegRTest, DecodeBatch) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uint16_t* luma = static_cast<uint16_t*>(rawImg.getImageHandle()->data);
+
+  // the full image and a crop of it
+  const unsigned int widths[2] = {kImageWidth, 320}, heights[2] = {kImageHeight, 240};
+  uhdr_codec_private_t* encs[2];
+  uhdr_compressed_image_t* streams[2];
+  for (int i = 0; i < 2; i++) {
+    uhdr_raw_image_t uhdrRawImg{};
+    uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+    uhdrRawImg.cg = UHDR_CG_BT_2100;
+    uhdrRawImg.ct = UHDR_CT_HLG;
+    uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+    uhdrRawImg.w = widths[i];
+    uhdrRawImg.h = heights[i];
+    uhdrRawImg.planes[UHDR_PLANE_Y] = luma;
+    uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+    uhdrRawImg.planes[UHDR_PLANE_UV] = luma + kImageWidth * kImageHeight;
+    uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+    encs[i] = uhdr_create_encoder();
+    uhdr_error_info_t status = uhdr_enc_set_raw_image(encs[i], &uhdrRawImg, UHDR_HDR_IMG);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    status = uhdr_encode(encs[i]);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    streams[i] = uhdr_get_encoded_stream(encs[i]);
+    ASSERT_NE(nullptr, streams[i]);
+  }
+
+  const int kBatchSize = 6;
+  uhdr_codec_private_t* batch[kBatchSize];
+  uhdr_codec_private_t* single[kBatchSize];
+  for (int i = 0; i < kBatchSize; i++) {
+    for (uhdr_codec_private_t** dec : {&batch[i], &single[i]}) {
+      *dec = uhdr_create_decoder();
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(*dec, streams[i % 2]).error_code);
+      ASSERT_EQ(UHDR_CODEC_OK,
+                uhdr_dec_set_out_img_format(*dec, UHDR_IMG_FMT_32bppRGBA1010102).error_code);
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(*dec, UHDR_CT_HLG).error_code);
+    }
+    // placement on a NUMA host does not change the output
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enable_numa_placement(batch[i], i % 3 != 0).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(single[i]).error_code);
+  }
+
+  uhdr_codec_private_t* duplicates[2] = {batch[0], batch[0]};
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_decode_batch(duplicates, 2).error_code);
+  uhdr_codec_private_t* mixed[2] = {batch[0], encs[0]};
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_decode_batch(mixed, 2).error_code);
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_decode_batch(nullptr, 2).error_code);
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_decode_batch(batch, 0).error_code);
+
+  uhdr_error_info_t status = uhdr_decode_batch(batch, kBatchSize);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  for (int i = 0; i < kBatchSize; i++) {
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(batch[i]).error_code);
+    uhdr_raw_image_t* expected = uhdr_get_decoded_image(single[i]);
+    uhdr_raw_image_t* actual = uhdr_get_decoded_image(batch[i]);
+    ASSERT_NE(nullptr, expected);
+    ASSERT_NE(nullptr, actual);
+    ASSERT_EQ(widths[i % 2], actual->w);
+    ASSERT_EQ(heights[i % 2], actual->h);
+    for (unsigned int y = 0; y < actual->h; y++) {
+      ASSERT_EQ(0, memcmp(static_cast<uint8_t*>(expected->planes[UHDR_PLANE_PACKED]) +
+                              (size_t)y * expected->stride[UHDR_PLANE_PACKED] * 4,
+                          static_cast<uint8_t*>(actual->planes[UHDR_PLANE_PACKED]) +
+                              (size_t)y * actual->stride[UHDR_PLANE_PACKED] * 4,
+                          actual->w * 4))
+          << "image " << i << " row " << y;
+    }
+  }
+
+  // a failing image does not hold back the others, and its status is returned
+  uhdr_codec_private_t* failing[2] = {uhdr_create_decoder(), uhdr_create_decoder()};
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(failing[1], streams[1]).error_code);
+  ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_decode_batch(failing, 2).error_code);
+  ASSERT_EQ(nullptr, uhdr_get_decoded_image(failing[0]));
+  ASSERT_NE(nullptr, uhdr_get_decoded_image(failing[1]));
+
+  for (int i = 0; i < 2; i++) uhdr_release_decoder(failing[i]);
+  for (int i = 0; i < kBatchSize; i++) {
+    uhdr_release_decoder(batch[i]);
+    uhdr_release_decoder(single[i]);
+  }
+  for (int i = 0; i < 2; i++) uhdr_release_encoder(encs[i]);
+}
+
+TEST(JpegRTest, DecoderProfile) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+  uhdr_compressed_image_t* stream = uhdr_get_encoded_stream(enc);
+
+  // the template, a decoder configured as the service configures its requests
+  uhdr_codec_private_t* config = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK,
+            uhdr_dec_set_out_img_format(config, UHDR_IMG_FMT_32bppRGBA1010102).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(config, UHDR_CT_PQ).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_max_display_boost(config, 4.0f).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(config, stream).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(config).error_code);
+  uhdr_raw_image_t* expected = uhdr_get_decoded_image(config);
+  ASSERT_NE(nullptr, expected);
+  uhdr_decoder_profile_t* profile = uhdr_create_decoder_profile(config);
+  ASSERT_NE(nullptr, profile);
+  ASSERT_EQ(nullptr, uhdr_create_decoder_profile(enc));
+
+  // sessions decode concurrently from the shared profile, released ahead of them
+  const int kSessions = 4;
+  uhdr_codec_private_t* sessions[kSessions];
+  for (int i = 0; i < kSessions; i++) {
+    sessions[i] = uhdr_create_decoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_profile(sessions[i], profile).error_code);
+  }
+  uhdr_release_decoder_profile(profile);
+  std::vector<std::thread> workers;
+  std::vector<int> matches(kSessions, 0);
+  for (int i = 0; i < kSessions; i++) {
+    workers.emplace_back([&, i]() {
+      for (int round = 0; round < 2; round++) {
+        // reset restores the profile, not the defaults
+        uhdr_reset_decoder(sessions[i]);
+        if (uhdr_dec_set_image(sessions[i], stream).error_code != UHDR_CODEC_OK) return;
+        if (uhdr_decode(sessions[i]).error_code != UHDR_CODEC_OK) return;
+        uhdr_raw_image_t* actual = uhdr_get_decoded_image(sessions[i]);
+        if (actual->fmt != expected->fmt || actual->ct != expected->ct ||
+            actual->w != expected->w || actual->h != expected->h) {
+          return;
+        }
+        bool same = true;
+        for (unsigned int y = 0; y < actual->h && same; y++) {
+          same = 0 == memcmp(static_cast<uint8_t*>(actual->planes[UHDR_PLANE_PACKED]) +
+                                 (size_t)y * actual->stride[UHDR_PLANE_PACKED] * 4,
+                             static_cast<uint8_t*>(expected->planes[UHDR_PLANE_PACKED]) +
+                                 (size_t)y * expected->stride[UHDR_PLANE_PACKED] * 4,
+                             (size_t)actual->w * 4);
+        }
+        matches[i] += same;
+      }
+    });
+  }
+  for (auto& worker : workers) worker.join();
+  for (int i = 0; i < kSessions; i++) EXPECT_EQ(2, matches[i]) << "session " << i;
+
+  // a detached profile leaves the defaults to reset
+  uhdr_reset_decoder(sessions[0]);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_profile(sessions[0], nullptr).error_code);
+  uhdr_reset_decoder(sessions[0]);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(sessions[0], stream).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(sessions[0]).error_code);
+  EXPECT_EQ(UHDR_IMG_FMT_64bppRGBAHalfFloat, uhdr_get_decoded_image(sessions[0])->fmt);
+
+  for (int i = 0; i < kSessions; i++) uhdr_release_decoder(sessions[i]);
+  uhdr_release_decoder(config);
+  uhdr_release_encoder(enc);
+}
+
+// Decoders sharing a cache decode an image seen before as they decode it the first time
+TEST(JpegRTest, DecoderCache) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+  uhdr_compressed_image_t* encoded = uhdr_get_encoded_stream(enc);
+  // a copy of the bytes is the same image to the cache
+  std::vector<uint8_t> copy(static_cast<uint8_t*>(encoded->data),
+                            static_cast<uint8_t*>(encoded->data) + encoded->data_sz);
+  uhdr_compressed_image_t stream = *encoded;
+  stream.data = copy.data();
+
+  ASSERT_EQ(nullptr, uhdr_create_decoder_cache(0, 1));
+  uhdr_decoder_cache_t* cache = uhdr_create_decoder_cache(16 << 20, 1);
+  ASSERT_NE(nullptr, cache);
+  uhdr_decoder_cache_stats_t stats;
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_get_decoder_cache_stats(nullptr, &stats).error_code);
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_dec_set_cache(nullptr, cache).error_code);
+
+  uhdr_codec_private_t* decs[2] = {uhdr_create_decoder(), uhdr_create_decoder()};
+  for (int i = 0; i < 2; i++) {
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_cache(decs[i], cache).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK,
+              uhdr_dec_set_out_img_format(decs[i], UHDR_IMG_FMT_32bppRGBA1010102).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(decs[i], UHDR_CT_PQ).error_code);
+  }
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(decs[0], encoded).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(decs[0]).error_code);
+  ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_dec_set_cache(decs[0], nullptr).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(decs[1], &stream).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(decs[1]).error_code);
+
+  EXPECT_EQ(uhdr_dec_get_image_width(decs[0]), uhdr_dec_get_image_width(decs[1]));
+  EXPECT_EQ(uhdr_dec_get_image_height(decs[0]), uhdr_dec_get_image_height(decs[1]));
+  EXPECT_EQ(uhdr_dec_get_gainmap_width(decs[0]), uhdr_dec_get_gainmap_width(decs[1]));
+  EXPECT_EQ(uhdr_dec_get_gainmap_height(decs[0]), uhdr_dec_get_gainmap_height(decs[1]));
+  uhdr_mem_block_t* exif = uhdr_dec_get_exif(decs[1]);
+  if (exif != nullptr && exif->data_sz != 0) {
+    EXPECT_GE(static_cast<uint8_t*>(exif->data), copy.data());
+    EXPECT_LE(static_cast<uint8_t*>(exif->data) + exif->data_sz, copy.data() + copy.size());
+  }
+  uhdr_gainmap_metadata_t* metadata[2] = {uhdr_dec_get_gainmap_metadata(decs[0]),
+                                          uhdr_dec_get_gainmap_metadata(decs[1])};
+  EXPECT_EQ(metadata[0]->max_content_boost, metadata[1]->max_content_boost);
+  EXPECT_EQ(metadata[0]->hdr_capacity_max, metadata[1]->hdr_capacity_max);
+  uhdr_raw_image_t* images[2] = {uhdr_get_decoded_image(decs[0]),
+                                 uhdr_get_decoded_image(decs[1])};
+  ASSERT_EQ(images[0]->w, images[1]->w);
+  ASSERT_EQ(images[0]->h, images[1]->h);
+  for (unsigned int y = 0; y < images[0]->h; y++) {
+    ASSERT_EQ(0, memcmp(static_cast<uint8_t*>(images[0]->planes[UHDR_PLANE_PACKED]) +
+                            (size_t)y * images[0]->stride[UHDR_PLANE_PACKED] * 4,
+                        static_cast<uint8_t*>(images[1]->planes[UHDR_PLANE_PACKED]) +
+                            (size_t)y * images[1]->stride[UHDR_PLANE_PACKED] * 4,
+                        (size_t)images[0]->w * 4))
+        << "row " << y;
+  }
+  uhdr_raw_image_t* gainmaps[2] = {uhdr_get_decoded_gainmap_image(decs[0]),
+                                   uhdr_get_decoded_gainmap_image(decs[1])};
+  ASSERT_EQ(gainmaps[0]->fmt, gainmaps[1]->fmt);
+  ASSERT_EQ(gainmaps[0]->w, gainmaps[1]->w);
+  ASSERT_EQ(gainmaps[0]->h, gainmaps[1]->h);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_get_decoder_cache_stats(cache, &stats).error_code);
+  EXPECT_EQ(1u, stats.entries);
+  EXPECT_GE(stats.bytes, (size_t)gainmaps[0]->w * gainmaps[0]->h);
+  EXPECT_EQ(1u, stats.probe_hits);
+  EXPECT_EQ(1u, stats.probe_misses);
+  EXPECT_EQ(1u, stats.gainmap_hits);
+  EXPECT_EQ(1u, stats.gainmap_misses);
+
+  // decoders attached to the cache keep it alive, and it survives reset
+  uhdr_release_decoder_cache(cache);
+  uhdr_reset_decoder(decs[0]);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(decs[0], &stream).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_probe(decs[0]).error_code);
+  EXPECT_EQ(uhdr_dec_get_image_width(decs[1]), uhdr_dec_get_image_width(decs[0]));
+
+  for (int i = 0; i < 2; i++) uhdr_release_decoder(decs[i]);
+  uhdr_release_encoder(enc);
+
+  // images whose hashes collide are told apart by their bytes
+  DecoderCache direct(16 << 20, false);
+  const uint8_t imageA[4] = {1, 2, 3, 4}, imageB[4] = {1, 2, 3, 5};
+  DecoderCache::ProbeInfo info{};
+  info.img_wd = 7;
+  direct.storeProbeInfo({42, sizeof imageA, imageA}, info);
+  DecoderCache::ProbeInfo found{};
+  EXPECT_FALSE(direct.findProbeInfo({42, sizeof imageB, imageB}, found));
+  const std::vector<uint8_t> copyA(imageA, imageA + sizeof imageA);
+  ASSERT_TRUE(direct.findProbeInfo({42, copyA.size(), copyA.data()}, found));
+  EXPECT_EQ(7, found.img_wd);
+  direct.storeProbeInfo({42, sizeof imageB, imageB}, info);
+  direct.getStats(&stats);
+  EXPECT_EQ(2u, stats.entries);
+}
+
+// Images taken out of a decoder outlive it and hold the pixels it decoded
+TEST(JpegRTest, CppApiTakeImage) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+  EXPECT_EQ((size_t)kImageWidth * kImageHeight * 2,
+            uhdr::planeBytes(&uhdrRawImg, UHDR_PLANE_Y).size());
+  EXPECT_EQ((size_t)kImageWidth * kImageHeight,
+            uhdr::planeBytes(&uhdrRawImg, UHDR_PLANE_UV).size());
+  EXPECT_TRUE(uhdr::planeBytes(&uhdrRawImg, UHDR_PLANE_V).empty());
+
+  uhdr::Encoder enc;
+  ASSERT_EQ(UHDR_CODEC_OK, enc.setRawImage(uhdrRawImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, enc.encode().error_code);
+  ASSERT_FALSE(enc.stream().empty());
+  std::vector<uint8_t> stream(enc.stream().begin(), enc.stream().end());
+  uhdr::Encoder moved_enc = std::move(enc);
+  EXPECT_EQ(nullptr, enc.get());
+  EXPECT_TRUE(enc.stream().empty());
+  EXPECT_EQ(stream.size(), moved_enc.stream().size());
+
+  // a reference decode through the c api
+  uhdr_codec_private_t* ref = uhdr_create_decoder();
+  uhdr_compressed_image_t compressed{};
+  compressed.data = stream.data();
+  compressed.data_sz = compressed.capacity = stream.size();
+  compressed.cg = UHDR_CG_UNSPECIFIED;
+  compressed.ct = UHDR_CT_UNSPECIFIED;
+  compressed.range = UHDR_CR_UNSPECIFIED;
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(ref, &compressed).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK,
+            uhdr_dec_set_out_img_format(ref, UHDR_IMG_FMT_32bppRGBA1010102).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_out_color_transfer(ref, UHDR_CT_PQ).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(ref).error_code);
+  uhdr_raw_image_t* expected = uhdr_get_decoded_image(ref);
+  ASSERT_NE(nullptr, expected);
+
+  uhdr::Image img, gainmap;
+  {
+    uhdr::Decoder dec;
+    ASSERT_EQ(UHDR_CODEC_OK,
+              dec.setImageRef(uhdr::Span<const uint8_t>(stream.data(), stream.size())).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, dec.setOutImgFormat(UHDR_IMG_FMT_32bppRGBA1010102).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, dec.setOutColorTransfer(UHDR_CT_PQ).error_code);
+    // released blocks of the arena must not be where the taken image lives
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enable_memory_arena(dec.get(), 1).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, dec.decode().error_code);
+    EXPECT_EQ((int)kImageWidth, dec.imageWidth());
+    const uhdr_raw_image_t* held = dec.image();
+    ASSERT_NE(nullptr, held);
+    img = dec.takeImage();
+    ASSERT_TRUE(img);
+    EXPECT_EQ(held, img.get());
+    EXPECT_EQ(nullptr, dec.image());
+    EXPECT_FALSE(dec.takeImage());
+    gainmap = dec.takeGainmap();
+    ASSERT_TRUE(gainmap);
+
+    // the decoder goes on with new images of its own
+    dec.reset();
+    ASSERT_EQ(UHDR_CODEC_OK, dec.setImage({stream.data(), stream.size()}).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, dec.decode().error_code);
+    ASSERT_NE(nullptr, dec.image());
+    EXPECT_NE(static_cast<const void*>(img->planes[UHDR_PLANE_PACKED]),
+              dec.image()->planes[UHDR_PLANE_PACKED]);
+
+    uhdr::Decoder moved_dec = std::move(dec);
+    EXPECT_EQ(nullptr, dec.get());
+    EXPECT_EQ(UHDR_CODEC_INVALID_PARAM, dec.decode().error_code);
+    EXPECT_NE(nullptr, moved_dec.image());
+  }
+
+  ASSERT_EQ(expected->fmt, img->fmt);
+  ASSERT_EQ(expected->w, img->w);
+  ASSERT_EQ(expected->h, img->h);
+  EXPECT_EQ((size_t)img->stride[UHDR_PLANE_PACKED] * (img->h - 1) * 4 + img->w * 4,
+            img.plane(UHDR_PLANE_PACKED).size());
+  for (unsigned int y = 0; y < img->h; y++) {
+    ASSERT_EQ(0, memcmp(static_cast<uint8_t*>(expected->planes[UHDR_PLANE_PACKED]) +
+                            (size_t)y * expected->stride[UHDR_PLANE_PACKED] * 4,
+                        static_cast<uint8_t*>(img->planes[UHDR_PLANE_PACKED]) +
+                            (size_t)y * img->stride[UHDR_PLANE_PACKED] * 4,
+                        (size_t)img->w * 4))
+        << "row " << y;
+  }
+  EXPECT_EQ(uhdr_get_decoded_gainmap_image(ref)->w, gainmap->w);
+
+  uhdr::Image moved_img = std::move(img);
+  EXPECT_FALSE(img);
+  uhdr_release_raw_image(moved_img.release());
+  EXPECT_FALSE(moved_img);
+  uhdr_release_decoder(ref);
+}
+
+// A batch encodes each image as uhdr_encode() does
+TEST(JpegRTest, EncodeBatch) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uint16_t* luma = static_cast<uint16_t*>(rawImg.getImageHandle()->data);
+
+  // the full image and a crop of it
+  const unsigned int widths[2] = {kImageWidth, 320}, heights[2] = {kImageHeight, 240};
+  const int kBatchSize = 4;
+  uhdr_codec_private_t* batch[kBatchSize];
+  uhdr_codec_private_t* single[kBatchSize];
+  for (int i = 0; i < kBatchSize; i++) {
+    uhdr_raw_image_t uhdrRawImg{};
+    uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+    uhdrRawImg.cg = UHDR_CG_BT_2100;
+    uhdrRawImg.ct = UHDR_CT_HLG;
+    uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+    uhdrRawImg.w = widths[i % 2];
+    uhdrRawImg.h = heights[i % 2];
+    uhdrRawImg.planes[UHDR_PLANE_Y] = luma;
+    uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+    uhdrRawImg.planes[UHDR_PLANE_UV] = luma + kImageWidth * kImageHeight;
+    uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+    for (uhdr_codec_private_t** enc : {&batch[i], &single[i]}) {
+      *enc = uhdr_create_encoder();
+      uhdr_error_info_t status = uhdr_enc_set_raw_image(*enc, &uhdrRawImg, UHDR_HDR_IMG);
+      ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+      ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_gainmap_scale_factor(*enc, 4).error_code);
+    }
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(single[i]).error_code);
+  }
+
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  uhdr_codec_private_t* duplicates[2] = {batch[0], batch[0]};
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_encode_batch(duplicates, 2).error_code);
+  uhdr_codec_private_t* mixed[2] = {batch[0], dec};
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_encode_batch(mixed, 2).error_code);
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_encode_batch(nullptr, 2).error_code);
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_encode_batch(batch, 0).error_code);
+  ASSERT_EQ(nullptr, uhdr_get_encoded_stream(batch[0]));
+
+  uhdr_error_info_t status = uhdr_encode_batch(batch, kBatchSize);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  for (int i = 0; i < kBatchSize; i++) {
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(batch[i]).error_code);
+    uhdr_compressed_image_t* expected = uhdr_get_encoded_stream(single[i]);
+    uhdr_compressed_image_t* actual = uhdr_get_encoded_stream(batch[i]);
+    ASSERT_NE(nullptr, expected);
+    ASSERT_NE(nullptr, actual);
+    ASSERT_EQ(expected->data_sz, actual->data_sz) << "image " << i;
+    ASSERT_EQ(0, memcmp(expected->data, actual->data, actual->data_sz)) << "image " << i;
+  }
+
+  // a failing image does not hold back the others, and its status is returned
+  uhdr_codec_private_t* failing[2] = {uhdr_create_encoder(), uhdr_create_encoder()};
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = widths[1];
+  uhdrRawImg.h = heights[1];
+  uhdrRawImg.planes[UHDR_PLANE_Y] = luma;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] = luma + kImageWidth * kImageHeight;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+  ASSERT_EQ(UHDR_CODEC_OK,
+            uhdr_enc_set_raw_image(failing[1], &uhdrRawImg, UHDR_HDR_IMG).error_code);
+  ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, uhdr_encode_batch(failing, 2).error_code);
+  ASSERT_EQ(nullptr, uhdr_get_encoded_stream(failing[0]));
+  ASSERT_NE(nullptr, uhdr_get_encoded_stream(failing[1]));
+
+  for (int i = 0; i < 2; i++) uhdr_release_encoder(failing[i]);
+  uhdr_release_decoder(dec);
+  for (int i = 0; i < kBatchSize; i++) {
+    uhdr_release_encoder(batch[i]);
+    uhdr_release_encoder(single[i]);
+  }
+}
+
+TEST(JpegRTest, EncodeDecodeAsync) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      static_cast<uint16_t*>(rawImg.getImageHandle()->data) + kImageWidth * kImageHeight;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  struct Completion {
+    std::promise<uhdr_error_info_t> status;
+    uhdr_codec_private_t* codec = nullptr;
+    bool release = false;
+  };
+  auto onDone = [](void* userCtx, uhdr_codec_private_t* codec, uhdr_error_info_t status) {
+    Completion* completion = static_cast<Completion*>(userCtx);
+    completion->codec = codec;
+    if (completion->release) uhdr_release_decoder(codec);
+    completion->status.set_value(status);
+  };
+
+  uhdr_codec_private_t* encs[2] = {uhdr_create_encoder(), uhdr_create_encoder()};
+  for (uhdr_codec_private_t* enc : encs) {
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+  }
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(encs[0]).error_code);
+  Completion encoded;
+  ASSERT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_encode_async(nullptr, onDone, &encoded).error_code);
+  uhdr_error_info_t status = uhdr_encode_async(encs[1], onDone, &encoded);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  ASSERT_EQ(UHDR_CODEC_OK, encoded.status.get_future().get().error_code);
+  ASSERT_EQ(encs[1], encoded.codec);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_wait(encs[1]).error_code);
+  ASSERT_EQ(0, uhdr_is_busy(encs[1]));
+  uhdr_compressed_image_t* expected = uhdr_get_encoded_stream(encs[0]);
+  uhdr_compressed_image_t* stream = uhdr_get_encoded_stream(encs[1]);
+  ASSERT_NE(nullptr, expected);
+  ASSERT_NE(nullptr, stream);
+  ASSERT_EQ(expected->data_sz, stream->data_sz);
+  ASSERT_EQ(0, memcmp(expected->data, stream->data, stream->data_sz));
+
+  uhdr_codec_private_t* decs[2] = {uhdr_create_decoder(), uhdr_create_decoder()};
+  for (uhdr_codec_private_t* dec : decs) {
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, stream).error_code);
+  }
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode(decs[0]).error_code);
+  // polled, without a callback
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode_async(decs[1], nullptr, nullptr).error_code);
+  while (uhdr_is_busy(decs[1])) std::this_thread::yield();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_wait(decs[1]).error_code);
+  uhdr_raw_image_t* expectedImg = uhdr_get_decoded_image(decs[0]);
+  uhdr_raw_image_t* img = uhdr_get_decoded_image(decs[1]);
+  ASSERT_NE(nullptr, expectedImg);
+  ASSERT_NE(nullptr, img);
+  ASSERT_EQ(expectedImg->w, img->w);
+  ASSERT_EQ(expectedImg->h, img->h);
+  ASSERT_EQ(0, memcmp(expectedImg->planes[UHDR_PLANE_PACKED], img->planes[UHDR_PLANE_PACKED],
+                      (size_t)img->stride[UHDR_PLANE_PACKED] * img->h * 4));
+
+  // a failing decode reports its status, and the callback may release the decoder
+  Completion failed;
+  failed.release = true;
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode_async(uhdr_create_decoder(), onDone, &failed).error_code);
+  ASSERT_EQ(UHDR_CODEC_INVALID_OPERATION, failed.status.get_future().get().error_code);
+
+  // release waits for a decode in flight
+  uhdr_codec_private_t* released = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(released, stream).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode_async(released, nullptr, nullptr).error_code);
+  uhdr_release_decoder(released);
+
+  // streams stalled on input, more than there are cores, do not hold back async calls
+  std::vector<uhdr_codec_private_t*> stalled(std::thread::hardware_concurrency() + 1);
+  for (uhdr_codec_private_t*& stalledDec : stalled) {
+    stalledDec = uhdr_create_decoder();
+    ASSERT_EQ(UHDR_CODEC_OK,
+              uhdr_dec_push_data(stalledDec, stream->data, stream->data_sz / 3, 0).error_code);
+  }
+  Completion reencoded, redecoded;
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode_async(encs[0], onDone, &reencoded).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_decode_async(decs[0], onDone, &redecoded).error_code);
+  std::future<uhdr_error_info_t> futures[2] = {reencoded.status.get_future(),
+                                               redecoded.status.get_future()};
+  bool finished = true;
+  for (auto& future : futures) {
+    finished &= future.wait_for(std::chrono::seconds(30)) == std::future_status::ready;
+  }
+  // releasing the stalled decoders aborts their streams, which also unblocks a starved call
+  for (uhdr_codec_private_t* stalledDec : stalled) uhdr_release_decoder(stalledDec);
+  ASSERT_TRUE(finished);
+  for (auto& future : futures) {
+    status = future.get();
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  }
+
+  for (int i = 0; i < 2; i++) {
+    uhdr_release_decoder(decs[i]);
+    uhdr_release_encoder(encs[i]);
+  }
+}
+
+// Preloading only moves one time setup ahead, encodes running alongside it are unaffected
+TEST(JpegRTest, Preload) {
+  EXPECT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_preload(UHDR_PRELOAD_ALL + 1).error_code);
+  EXPECT_EQ(UHDR_CODEC_INVALID_PARAM, uhdr_preload(-1).error_code);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_preload(0).error_code);
+
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  std::vector<uint8_t> streams[2];
+  for (int i = 0; i < 2; i++) {
+    std::future<uhdr_error_info_t> preload;
+    if (i == 1) {
+      preload = std::async(std::launch::async, []() {
+        // gpu setup fails on hosts without a gles context, which only that flag reports
+        uhdr_error_info_t status = uhdr_preload(UHDR_PRELOAD_TABLES | UHDR_PRELOAD_THREADS);
+        uhdr_preload(UHDR_PRELOAD_GPU);
+        return status;
+      });
+    }
+    uhdr_codec_private_t* enc = uhdr_create_encoder();
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG).error_code);
+    ASSERT_EQ(UHDR_CODEC_OK, uhdr_encode(enc).error_code);
+    uhdr_compressed_image_t* stream = uhdr_get_encoded_stream(enc);
+    streams[i].assign(static_cast<uint8_t*>(stream->data),
+                      static_cast<uint8_t*>(stream->data) + stream->data_sz);
+    uhdr_release_encoder(enc);
+    if (preload.valid()) {
+      ASSERT_EQ(UHDR_CODEC_OK, preload.get().error_code);
+    }
+  }
+  EXPECT_TRUE(streams[0] == streams[1]);
+}
+
+#ifdef UHDR_ENABLE_GLES
+TEST(JpegRTest, GpuProgramCache) {
+  namespace fs = std::filesystem;
+  fs::path dir = fs::temp_directory_path() /
+                 ("uhdr_program_cache_" +
+                  std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()));
+  fs::create_directories(dir);
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_set_gpu_program_cache_dir(dir.string().c_str()).error_code);
+  auto cleanup = [&]() {
+    uhdr_set_gpu_program_cache_dir(nullptr);
+    fs::remove_all(dir);
+  };
+
+  uhdr_opengl_ctxt_t first, second, third;
+  first.init_opengl_ctxt();
+  if (first.mErrorStatus.error_code != UHDR_CODEC_OK) {
+    cleanup();
+    GTEST_SKIP() << "gles context unavailable";
+  }
+  GLint numFormats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+
+  // sources unique to the run, so that no program of an earlier test is found in the share group
+  const char* vertex = "#version 300 es\nvoid main() { gl_Position = vec4(0.0); }\n";
+  std::string fragment = "#version 300 es\n// " + dir.filename().string() +
+                         "\nprecision mediump float;\nout vec4 color;\n"
+                         "void main() { color = vec4(1.0); }\n";
+  GLuint program = first.get_shader_program(vertex, fragment.c_str());
+  ASSERT_NE(0u, program);
+  ASSERT_EQ(program, first.get_shader_program(vertex, fragment.c_str()));
+  std::vector<fs::path> binaries;
+  for (auto& entry : fs::directory_iterator(dir)) binaries.push_back(entry.path());
+  if (numFormats > 0) ASSERT_EQ(1u, binaries.size());
+
+  // the program is held by the first context, the second one loads the binary
+  second.init_opengl_ctxt();
+  ASSERT_EQ(UHDR_CODEC_OK, second.mErrorStatus.error_code) << second.mErrorStatus.detail;
+  auto stored = binaries.empty() ? fs::file_time_type() : fs::last_write_time(binaries[0]);
+  GLuint loaded = second.get_shader_program(vertex, fragment.c_str());
+  ASSERT_NE(0u, loaded);
+  ASSERT_NE(program, loaded);
+  if (!binaries.empty()) ASSERT_EQ(stored, fs::last_write_time(binaries[0]));
+
+  // a binary the driver rejects is compiled afresh and replaced
+  if (!binaries.empty()) {
+    auto size = fs::file_size(binaries[0]);
+    std::ofstream(binaries[0], std::ios::binary | std::ios::trunc) << "not a program binary";
+    third.init_opengl_ctxt();
+    ASSERT_EQ(UHDR_CODEC_OK, third.mErrorStatus.error_code) << third.mErrorStatus.detail;
+    ASSERT_NE(0u, third.get_shader_program(vertex, fragment.c_str()));
+    ASSERT_EQ(size, fs::file_size(binaries[0]));
+    third.delete_opengl_ctxt();
+  }
+  second.delete_opengl_ctxt();
+
+  // once released, programs are handed to the next context of the share group
+  first.delete_opengl_ctxt();
+  first.init_opengl_ctxt();
+  ASSERT_EQ(UHDR_CODEC_OK, first.mErrorStatus.error_code) << first.mErrorStatus.detail;
+  GLuint reused = first.get_shader_program(vertex, fragment.c_str());
+  ASSERT_TRUE(reused == program || reused == loaded);
+  first.delete_opengl_ctxt();
+  cleanup();
+}
+
+// Planes with strides upload as the contiguous planes they hold
+TEST(JpegRTest, GpuTextureOfStridedImage) {
+  uhdr_opengl_ctxt_t glCtxt;
+  glCtxt.init_opengl_ctxt();
+  if (glCtxt.mErrorStatus.error_code != UHDR_CODEC_OK) GTEST_SKIP() << "gles context unavailable";
+
+  const unsigned int w = 62, h = 34;
+  uhdr_raw_image_ext_t img(UHDR_IMG_FMT_12bppYCbCr420, UHDR_CG_BT_709, UHDR_CT_SRGB,
+                           UHDR_CR_FULL_RANGE, w, h, 64);
+  ASSERT_NE(w, img.stride[UHDR_PLANE_Y]);
+  ASSERT_FALSE(isBufferDataContiguous(&img));
+  for (int plane = UHDR_PLANE_Y; plane <= UHDR_PLANE_V; plane++) {
+    const unsigned int rows = plane == UHDR_PLANE_Y ? h : h / 2;
+    for (unsigned int y = 0; y < rows; y++) {
+      uint8_t* row = static_cast<uint8_t*>(img.planes[plane]) + y * img.stride[plane];
+      for (unsigned int x = 0; x < img.stride[plane]; x++) {
+        row[x] = (uint8_t)(x * 7 + y * 3 + plane);
+      }
+    }
+  }
+  std::vector<uint8_t> expected(w * h * 3 / 2), actual(w * h * 3 / 2);
+  copyRawImagePlanes(&img, expected.data(), true);
+
+  // the stacked planes read back as one single channel image
+  GLuint texture = glCtxt.create_texture(&img);
+  ASSERT_NE(0u, texture) << glCtxt.mErrorStatus.detail;
+  glCtxt.read_texture(&texture, UHDR_IMG_FMT_8bppYCbCr400, w, h * 3 / 2, actual.data());
+  ASSERT_EQ(UHDR_CODEC_OK, glCtxt.mErrorStatus.error_code) << glCtxt.mErrorStatus.detail;
+  ASSERT_EQ(expected, actual);
+  glDeleteTextures(1, &texture);
+  glCtxt.delete_opengl_ctxt();
+}
+#endif
+
+TEST(JpegRTest, ProbeReadsHeadersInPlace) {
+  UhdrUnCompressedStructWrapper rawImg(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImg.allocateMemory());
+  ASSERT_TRUE(rawImg.loadRawResource(kYCbCrP010FileName));
+
+  uhdr_raw_image_t uhdrRawImg{};
+  uhdrRawImg.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  uhdrRawImg.cg = UHDR_CG_BT_2100;
+  uhdrRawImg.ct = UHDR_CT_HLG;
+  uhdrRawImg.range = UHDR_CR_LIMITED_RANGE;
+  uhdrRawImg.w = kImageWidth;
+  uhdrRawImg.h = kImageHeight;
+  uhdrRawImg.planes[UHDR_PLANE_Y] = rawImg.getImageHandle()->data;
+  uhdrRawImg.stride[UHDR_PLANE_Y] = kImageWidth;
+  uhdrRawImg.planes[UHDR_PLANE_UV] =
+      ((uint8_t*)(rawImg.getImageHandle()->data)) + kImageWidth * kImageHeight * 2;
+  uhdrRawImg.stride[UHDR_PLANE_UV] = kImageWidth;
+
+  uint8_t exifData[] = {'E', 'x', 'i', 'f', 0, 0, 'M', 'M', 0, 42, 0, 0, 0, 8, 0, 0};
+  uhdr_mem_block_t exif{exifData, sizeof exifData, sizeof exifData};
+  uhdr_codec_private_t* enc = uhdr_create_encoder();
+  uhdr_error_info_t status = uhdr_enc_set_raw_image(enc, &uhdrRawImg, UHDR_HDR_IMG);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_enc_set_exif_data(enc, &exif).error_code);
+  status = uhdr_encode(enc);
+  ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+  uhdr_compressed_image_t* compressedImage = uhdr_get_encoded_stream(enc);
+  ASSERT_NE(nullptr, compressedImage);
+
+  std::vector<uint8_t> stream(static_cast<uint8_t*>(compressedImage->data),
+                              static_cast<uint8_t*>(compressedImage->data) +
+                                  compressedImage->data_sz);
+  // the same stream with its mpf block disguised, the gain map must then be searched for
+  std::vector<uint8_t> streamWithoutMpf = stream;
+  const uint8_t kMpfTag[] = {'M', 'P', 'F', '\0'};
+  auto mpf = std::search(streamWithoutMpf.begin(), streamWithoutMpf.end(), std::begin(kMpfTag),
+                         std::end(kMpfTag));
+  ASSERT_NE(streamWithoutMpf.end(), mpf);
+  mpf[2] = 'X';
+
+  auto isEqual = [](const uint8_t* view, size_t viewSize, const std::vector<uint8_t>& copy) {
+    return viewSize == copy.size() && (viewSize == 0 || !memcmp(view, copy.data(), viewSize));
+  };
+  for (std::vector<uint8_t>* input : {&stream, &streamWithoutMpf}) {
+    SCOPED_TRACE(::testing::Message() << "with mpf " << (input == &stream));
+    uhdr_compressed_image_t img{};
+    img.data = input->data();
+    img.data_sz = img.capacity = input->size();
+
+    JpegR jpegr;
+    jpeg_info_struct primaryInfo, gainmapInfo;
+    jpegr_info_struct info;
+    info.primaryImgInfo = &primaryInfo;
+    info.gainmapImgInfo = &gainmapInfo;
+    status = jpegr.getJPEGRInfo(&img, &info);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    ASSERT_GT(primaryInfo.exifData.size(), 0u);
+    ASSERT_GT(primaryInfo.iccData.size(), 0u);
+    ASSERT_GT(gainmapInfo.xmpData.size() + gainmapInfo.isoData.size(), 0u);
+
+    uhdr_compressed_image_t primaryImg, gainmapImg;
+    jpeg_header_view_t primaryView, gainmapView;
+    status = jpegr.getJPEGRInfoInPlace(&img, &primaryImg, &primaryView, &gainmapImg, &gainmapView);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    for (const jpeg_header_view_t* view : {&primaryView, &gainmapView}) {
+      const jpeg_info_struct& ref = view == &primaryView ? primaryInfo : gainmapInfo;
+      ASSERT_EQ(ref.width, view->width);
+      ASSERT_EQ(ref.height, view->height);
+      ASSERT_EQ(ref.numComponents, view->numComponents);
+      ASSERT_TRUE(isEqual(view->exifData, view->exifSize, ref.exifData));
+      ASSERT_TRUE(isEqual(view->iccData, view->iccSize, ref.iccData));
+      ASSERT_TRUE(isEqual(view->xmpData, view->xmpSize, ref.xmpData));
+      ASSERT_TRUE(isEqual(view->isoData, view->isoSize, ref.isoData));
+      // views point into the input
+      for (const uint8_t* ptr : {view->exifData, view->iccData, view->xmpData, view->isoData}) {
+        if (ptr == nullptr) continue;
+        ASSERT_GE(ptr, input->data());
+        ASSERT_LT(ptr, input->data() + input->size());
+      }
+    }
+    ASSERT_EQ(input->data(), primaryImg.data);
+    ASSERT_TRUE(isEqual(static_cast<uint8_t*>(primaryImg.data), primaryImg.data_sz,
+                        primaryInfo.imgData));
+    ASSERT_TRUE(isEqual(static_cast<uint8_t*>(gainmapImg.data), gainmapImg.data_sz,
+                        gainmapInfo.imgData));
+
+    // probe hands out the same blocks as the copying parse
+    uhdr_codec_private_t* dec = uhdr_create_decoder();
+    status = uhdr_dec_set_image(dec, &img);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    status = uhdr_dec_probe(dec);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    ASSERT_EQ((int)primaryInfo.width, uhdr_dec_get_image_width(dec));
+    ASSERT_EQ((int)primaryInfo.height, uhdr_dec_get_image_height(dec));
+    ASSERT_EQ((int)gainmapInfo.width, uhdr_dec_get_gainmap_width(dec));
+    ASSERT_EQ((int)gainmapInfo.height, uhdr_dec_get_gainmap_height(dec));
+    uhdr_mem_block_t* block = uhdr_dec_get_exif(dec);
+    ASSERT_TRUE(isEqual(static_cast<uint8_t*>(block->data), block->data_sz, primaryInfo.exifData));
+    block = uhdr_dec_get_icc(dec);
+    ASSERT_TRUE(isEqual(static_cast<uint8_t*>(block->data), block->data_sz, primaryInfo.iccData));
+    block = uhdr_dec_get_base_image(dec);
+    ASSERT_TRUE(isEqual(static_cast<uint8_t*>(block->data), block->data_sz, primaryInfo.imgData));
+    block = uhdr_dec_get_gainmap_image(dec);
+    ASSERT_TRUE(isEqual(static_cast<uint8_t*>(block->data), block->data_sz, gainmapInfo.imgData));
+    ASSERT_NE(nullptr, uhdr_dec_get_gainmap_metadata(dec));
+    status = uhdr_decode(dec);
+    ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+    uhdr_release_decoder(dec);
+  }
+
+  // a stream that ends inside the headers is rejected
+  uhdr_compressed_image_t img{};
+  img.data = stream.data();
+  img.data_sz = img.capacity = 100;
+  uhdr_compressed_image_t primaryImg, gainmapImg;
+  jpeg_header_view_t primaryView, gainmapView;
+  JpegR jpegr;
+  ASSERT_NE(UHDR_CODEC_OK, jpegr.getJPEGRInfoInPlace(&img, &primaryImg, &primaryView, &gainmapImg,
+                                                     &gainmapView)
+                               .error_code);
+  uhdr_codec_private_t* dec = uhdr_create_decoder();
+  ASSERT_EQ(UHDR_CODEC_OK, uhdr_dec_set_image(dec, &img).error_code);
+  ASSERT_NE(UHDR_CODEC_OK, uhdr_dec_probe(dec).error_code);
+  ASSERT_EQ(nullptr, uhdr_dec_get_exif(dec));
+  uhdr_release_decoder(dec);
+  uhdr_release_encoder(enc);
+}
+
 class JpegRAPIEncodeAndDecodeTest
     : public ::testing::TestWithParam<std::tuple<ultrahdr_color_gamut, ultrahdr_color_gamut>> {
  public:
@@ -2384,4 +8871,331 @@ TEST(JpegRTest, ProfileGainMapFuncs) {
 #endif
 }
 
+// The two pass gain map keeps its gains in Q4.11 fixed point between the passes. The map must
+// stay within one code of the gains encoded as floats, and the boosts within one fixed point step
+// of the float range, both through the table of the gains that occur and with gains at and beyond
+// the ends of the fixed point range, where the table is skipped.
+TEST(JpegRTest, FixedPointGainsMatchFloatGains) {
+  const unsigned int kWidth = 128, kHeight = 64;
+  std::vector<uint32_t> sdr(kWidth * kHeight);
+  std::vector<uint64_t> hdr(kWidth * kHeight);
+  uhdr_raw_image_t sdr_intent{}, hdr_intent{};
+  sdr_intent.fmt = UHDR_IMG_FMT_32bppRGBA8888;
+  sdr_intent.cg = UHDR_CG_BT_709;
+  sdr_intent.ct = UHDR_CT_SRGB;
+  sdr_intent.range = UHDR_CR_FULL_RANGE;
+  sdr_intent.w = kWidth;
+  sdr_intent.h = kHeight;
+  sdr_intent.planes[UHDR_PLANE_PACKED] = sdr.data();
+  sdr_intent.stride[UHDR_PLANE_PACKED] = kWidth;
+  hdr_intent = sdr_intent;
+  hdr_intent.fmt = UHDR_IMG_FMT_64bppRGBAHalfFloat;
+  hdr_intent.ct = UHDR_CT_LINEAR;
+  hdr_intent.planes[UHDR_PLANE_PACKED] = hdr.data();
+
+  for (bool extremes : {false, true}) {
+    SCOPED_TRACE(extremes ? "gains beyond the fixed point range" : "gains in [-1, 2]");
+    // gray pixels, so that the gain is that of the largest channel with the linear hdr intent
+    std::vector<float> gains(kWidth * kHeight);
+    for (size_t i = 0; i < sdr.size(); i++) {
+      uint8_t sdr_code = 255;
+      float hdr_value = exp2(-1.0f + 3.0f * i / (sdr.size() - 1));
+      if (extremes && i % 61 == 0) {
+        hdr_value = 0.0f;  // log2 of the offsets, about -31
+      } else if (extremes && i % 61 == 1) {
+        sdr_code = 3;
+        hdr_value = 65504.0f;  // about 26
+      }
+      const uint64_t half = floatToHalf(hdr_value);
+      sdr[i] = sdr_code * 0x010101u | 0xff000000u;
+      hdr[i] = half | half << 16 | half << 32 | (uint64_t)floatToHalf(1.0f) << 48;
+      gains[i] = computeGain(srgbInvOetf(sdr_code / 255.0f) * kSdrWhiteNits,
+                             halfToFloat(half) * kSdrWhiteNits);
+    }
+    const auto range = std::minmax_element(gains.begin(), gains.end());
+    const float min_log2 = (std::clamp)(*range.first, -14.3f, 15.6f);
+    const float max_log2 = (std::clamp)(*range.second, -14.3f, 15.6f);
+
+    JpegR jpegR(nullptr, 1, kMapCompressQualityDefault, false, kGainMapGammaDefault,
+                UHDR_USAGE_BEST_QUALITY);
+    uhdr_gainmap_metadata_ext_t metadata(kJpegrVersion);
+    std::unique_ptr<uhdr_raw_image_ext_t> gainmap;
+    ASSERT_EQ(UHDR_CODEC_OK,
+              jpegR.generateGainMap(&sdr_intent, &hdr_intent, &metadata, gainmap, false, false)
+                  .error_code);
+    const float step = 1.0f / 2048;
+    EXPECT_NEAR(min_log2, log2(metadata.min_content_boost), step);
+    EXPECT_NEAR(max_log2, log2(metadata.max_content_boost), step);
+    ASSERT_EQ(kWidth, gainmap->w);
+    ASSERT_EQ(kHeight, gainmap->h);
+    for (unsigned int y = 0; y < kHeight; y++) {
+      const uint8_t* row =
+          static_cast<uint8_t*>(gainmap->planes[UHDR_PLANE_Y]) + y * gainmap->stride[UHDR_PLANE_Y];
+      for (unsigned int x = 0; x < kWidth; x++) {
+        const float gain = gains[y * kWidth + x];
+        const int expected = affineMapGain(gain, min_log2, max_log2, kGainMapGammaDefault);
+        ASSERT_LE(std::abs(expected - row[x]), 1) << "pixel " << x << ", " << y;
+        if (gain <= -16.0f) ASSERT_EQ(0, row[x]) << "pixel " << x << ", " << y;
+        if (gain >= 16.0f) ASSERT_EQ(255, row[x]) << "pixel " << x << ", " << y;
+      }
+    }
+  }
+}
+
+// Tone mapping the sdr rows from inside gain map generation must match tone mapping the whole
+// image first, including gain map scale factors that do not divide the image height.
+TEST(JpegRTest, FusedToneMapAndGainMap) {
+  UhdrUnCompressedStructWrapper rawImgP010(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImgP010.setImageColorGamut(ultrahdr_color_gamut::ULTRAHDR_COLORGAMUT_BT2100));
+  ASSERT_TRUE(rawImgP010.allocateMemory());
+  ASSERT_TRUE(rawImgP010.loadRawResource(kYCbCrP010FileName));
+  auto rawImg = rawImgP010.getImageHandle();
+  uint16_t* luma = reinterpret_cast<uint16_t*>(rawImg->data);
+
+  const unsigned int kHeight = kImageHeight - 2;
+  uhdr_raw_image_t hdr_intent;
+  hdr_intent.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  hdr_intent.cg = UHDR_CG_BT_2100;
+  hdr_intent.ct = UHDR_CT_HLG;
+  hdr_intent.range = UHDR_CR_LIMITED_RANGE;
+  hdr_intent.w = kImageWidth;
+  hdr_intent.h = kHeight;
+  hdr_intent.planes[UHDR_PLANE_Y] = luma;
+  hdr_intent.stride[UHDR_PLANE_Y] = kImageWidth;
+  hdr_intent.planes[UHDR_PLANE_UV] = luma + kImageWidth * kImageHeight;
+  hdr_intent.stride[UHDR_PLANE_UV] = kImageWidth;
+  hdr_intent.planes[UHDR_PLANE_V] = nullptr;
+  hdr_intent.stride[UHDR_PLANE_V] = 0;
+
+  for (int scaleFactor : {1, 3, 4}) {
+    for (uhdr_enc_preset_t preset : {UHDR_USAGE_REALTIME, UHDR_USAGE_BEST_QUALITY}) {
+      SCOPED_TRACE("scale factor " + std::to_string(scaleFactor) + ", preset " +
+                   std::to_string(preset));
+      JpegR jpegR(nullptr, scaleFactor, kMapCompressQualityDefault, false, kGainMapGammaDefault,
+                  preset);
+      uhdr_raw_image_ext_t sdr_ref(UHDR_IMG_FMT_12bppYCbCr420, UHDR_CG_UNSPECIFIED,
+                                   UHDR_CT_UNSPECIFIED, UHDR_CR_UNSPECIFIED, kImageWidth, kHeight,
+                                   64);
+      uhdr_raw_image_ext_t sdr_fused(UHDR_IMG_FMT_12bppYCbCr420, UHDR_CG_UNSPECIFIED,
+                                     UHDR_CT_UNSPECIFIED, UHDR_CR_UNSPECIFIED, kImageWidth,
+                                     kHeight, 64);
+      uhdr_gainmap_metadata_ext_t metadata_ref(kJpegrVersion), metadata_fused(kJpegrVersion);
+      std::unique_ptr<uhdr_raw_image_ext_t> gainmap_ref, gainmap_fused;
+
+      ASSERT_EQ(UHDR_CODEC_OK, jpegR.toneMap(&hdr_intent, &sdr_ref).error_code);
+      ASSERT_EQ(UHDR_CODEC_OK,
+                jpegR.generateGainMap(&sdr_ref, &hdr_intent, &metadata_ref, gainmap_ref, false,
+                                      false)
+                    .error_code);
+      RowRangeFn toneMapRows;
+      ASSERT_EQ(UHDR_CODEC_OK,
+                jpegR.prepareToneMap(&hdr_intent, &sdr_fused, toneMapRows).error_code);
+      ASSERT_EQ(UHDR_CODEC_OK,
+                jpegR.generateGainMap(&sdr_fused, &hdr_intent, &metadata_fused, gainmap_fused,
+                                      false, false, toneMapRows)
+                    .error_code);
+
+      for (int plane = UHDR_PLANE_Y; plane <= UHDR_PLANE_V; plane++) {
+        const unsigned int w = plane == UHDR_PLANE_Y ? kImageWidth : kImageWidth / 2;
+        const unsigned int h = plane == UHDR_PLANE_Y ? kHeight : kHeight / 2;
+        for (unsigned int y = 0; y < h; y++) {
+          ASSERT_EQ(0, memcmp(static_cast<uint8_t*>(sdr_ref.planes[plane]) +
+                                  y * sdr_ref.stride[plane],
+                              static_cast<uint8_t*>(sdr_fused.planes[plane]) +
+                                  y * sdr_fused.stride[plane],
+                              w))
+              << "plane " << plane << " row " << y;
+        }
+      }
+      ASSERT_EQ(gainmap_ref->w, gainmap_fused->w);
+      ASSERT_EQ(gainmap_ref->h, gainmap_fused->h);
+      for (unsigned int y = 0; y < gainmap_ref->h; y++) {
+        ASSERT_EQ(0, memcmp(static_cast<uint8_t*>(gainmap_ref->planes[UHDR_PLANE_Y]) +
+                                y * gainmap_ref->stride[UHDR_PLANE_Y],
+                            static_cast<uint8_t*>(gainmap_fused->planes[UHDR_PLANE_Y]) +
+                                y * gainmap_fused->stride[UHDR_PLANE_Y],
+                            gainmap_ref->w))
+            << "gainmap row " << y;
+      }
+      ASSERT_EQ(metadata_ref.max_content_boost, metadata_fused.max_content_boost);
+      ASSERT_EQ(metadata_ref.min_content_boost, metadata_fused.min_content_boost);
+    }
+  }
+}
+
+// The gain map of an encode from a compressed sdr intent is generated from the jpeg decoded at a
+// reduced idct scale. It must stay close to the one generated from the full resolution decode.
+TEST(JpegRTest, GainMapFromScaledSdrDecode) {
+  UhdrUnCompressedStructWrapper rawImgP010(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImgP010.setImageColorGamut(ultrahdr_color_gamut::ULTRAHDR_COLORGAMUT_BT2100));
+  ASSERT_TRUE(rawImgP010.allocateMemory());
+  ASSERT_TRUE(rawImgP010.loadRawResource(kYCbCrP010FileName));
+  uint16_t* luma = reinterpret_cast<uint16_t*>(rawImgP010.getImageHandle()->data);
+  uhdr_raw_image_t hdr_intent;
+  hdr_intent.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  hdr_intent.cg = UHDR_CG_BT_2100;
+  hdr_intent.ct = UHDR_CT_HLG;
+  hdr_intent.range = UHDR_CR_LIMITED_RANGE;
+  hdr_intent.w = kImageWidth;
+  hdr_intent.h = kImageHeight;
+  hdr_intent.planes[UHDR_PLANE_Y] = luma;
+  hdr_intent.stride[UHDR_PLANE_Y] = kImageWidth;
+  hdr_intent.planes[UHDR_PLANE_UV] = luma + kImageWidth * kImageHeight;
+  hdr_intent.stride[UHDR_PLANE_UV] = kImageWidth;
+  hdr_intent.planes[UHDR_PLANE_V] = nullptr;
+  hdr_intent.stride[UHDR_PLANE_V] = 0;
+
+  JpegR toneMapper;
+  uhdr_raw_image_ext_t sdr(UHDR_IMG_FMT_12bppYCbCr420, UHDR_CG_UNSPECIFIED, UHDR_CT_UNSPECIFIED,
+                           UHDR_CR_UNSPECIFIED, kImageWidth, kImageHeight, 64);
+  ASSERT_EQ(UHDR_CODEC_OK, toneMapper.toneMap(&hdr_intent, &sdr).error_code);
+  JpegEncoderHelper encoder;
+  ASSERT_EQ(UHDR_CODEC_OK, encoder.compressImage(&sdr, 95, nullptr, 0).error_code);
+  uhdr_compressed_image_t jpeg = encoder.getCompressedImage();
+
+  JpegDecoderHelper fullDecoder;
+  ASSERT_EQ(UHDR_CODEC_OK, fullDecoder.decompressImage(jpeg.data, jpeg.data_sz).error_code);
+  uhdr_raw_image_t sdr_full = fullDecoder.getDecompressedImage();
+  sdr_full.cg = UHDR_CG_BT_709;
+
+  for (int scaleFactor : {4, 8}) {
+    SCOPED_TRACE("scale factor " + std::to_string(scaleFactor));
+    JpegDecoderHelper scaledDecoder;
+    ASSERT_EQ(UHDR_CODEC_OK, scaledDecoder
+                                 .decompressImageScaled(jpeg.data, jpeg.data_sz,
+                                                        DECODE_TO_YCBCR_CS, scaleFactor)
+                                 .error_code);
+    uhdr_raw_image_t sdr_scaled = scaledDecoder.getDecompressedImage();
+    sdr_scaled.cg = UHDR_CG_BT_709;
+
+    JpegR jpegR(nullptr, scaleFactor);
+    uhdr_gainmap_metadata_ext_t metadata_ref(kJpegrVersion), metadata_scaled(kJpegrVersion);
+    std::unique_ptr<uhdr_raw_image_ext_t> gainmap_ref, gainmap_scaled;
+    ASSERT_EQ(UHDR_CODEC_OK, jpegR.generateGainMap(&sdr_full, &hdr_intent, &metadata_ref,
+                                                   gainmap_ref, true)
+                                 .error_code);
+    ASSERT_EQ(UHDR_CODEC_OK,
+              jpegR.generateGainMap(&sdr_scaled, &hdr_intent, &metadata_scaled, gainmap_scaled,
+                                    true, true, nullptr, nullptr, scaleFactor)
+                  .error_code);
+    ASSERT_EQ(gainmap_ref->w, gainmap_scaled->w);
+    ASSERT_EQ(gainmap_ref->h, gainmap_scaled->h);
+    EXPECT_NEAR(log2(metadata_ref.max_content_boost), log2(metadata_scaled.max_content_boost),
+                0.1);
+    EXPECT_NEAR(log2(metadata_ref.min_content_boost), log2(metadata_scaled.min_content_boost),
+                0.1);
+
+    const size_t channels = gainmap_ref->fmt == UHDR_IMG_FMT_8bppYCbCr400 ? 1 : 3;
+    size_t sumError = 0;
+    int maxError = 0;
+    for (unsigned int y = 0; y < gainmap_ref->h; y++) {
+      const uint8_t* ref = static_cast<uint8_t*>(gainmap_ref->planes[UHDR_PLANE_PACKED]) +
+                           y * gainmap_ref->stride[UHDR_PLANE_PACKED] * channels;
+      const uint8_t* got = static_cast<uint8_t*>(gainmap_scaled->planes[UHDR_PLANE_PACKED]) +
+                           y * gainmap_scaled->stride[UHDR_PLANE_PACKED] * channels;
+      for (size_t x = 0; x < gainmap_ref->w * channels; x++) {
+        sumError += std::abs(ref[x] - got[x]);
+        maxError = (std::max)(maxError, std::abs(ref[x] - got[x]));
+      }
+    }
+    EXPECT_LE(maxError, 6);
+    EXPECT_LE((double)sumError / (gainmap_ref->w * gainmap_ref->h * channels), 0.1);
+  }
+}
+
+#ifdef UHDR_ENABLE_GLES
+static int maxDifference(uhdr_raw_image_t* a, uhdr_raw_image_t* b, int plane, unsigned int w,
+                         unsigned int h, int bytesPerPixel) {
+  int maxDiff = 0;
+  for (unsigned int y = 0; y < h; y++) {
+    uint8_t* rowA = static_cast<uint8_t*>(a->planes[plane]) + y * a->stride[plane] * bytesPerPixel;
+    uint8_t* rowB = static_cast<uint8_t*>(b->planes[plane]) + y * b->stride[plane] * bytesPerPixel;
+    for (unsigned int x = 0; x < w * bytesPerPixel; x++) {
+      maxDiff = (std::max)(maxDiff, std::abs(rowA[x] - rowB[x]));
+    }
+  }
+  return maxDiff;
+}
+
+// Tone mapping and gain map generation on the gpu must match the cpu implementation, up to the
+// rounding of the float math.
+TEST(JpegRTest, GpuToneMapAndGainMap) {
+  uhdr_opengl_ctxt_t glCtxt;
+  glCtxt.init_opengl_ctxt();
+  if (glCtxt.mErrorStatus.error_code != UHDR_CODEC_OK) GTEST_SKIP() << "gles context unavailable";
+  glCtxt.release_current();
+
+  UhdrUnCompressedStructWrapper rawImgP010(kImageWidth, kImageHeight, YCbCr_p010);
+  ASSERT_TRUE(rawImgP010.allocateMemory());
+  ASSERT_TRUE(rawImgP010.loadRawResource(kYCbCrP010FileName));
+  uint16_t* luma = reinterpret_cast<uint16_t*>(rawImgP010.getImageHandle()->data);
+
+  // the sdr intents are allocated with padded strides
+  const unsigned int kHeight = kImageHeight - 2;
+  uhdr_raw_image_t hdr_intent;
+  hdr_intent.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+  hdr_intent.cg = UHDR_CG_BT_2100;
+  hdr_intent.ct = UHDR_CT_HLG;
+  hdr_intent.range = UHDR_CR_LIMITED_RANGE;
+  hdr_intent.w = kImageWidth;
+  hdr_intent.h = kHeight;
+  hdr_intent.planes[UHDR_PLANE_Y] = luma;
+  hdr_intent.stride[UHDR_PLANE_Y] = kImageWidth;
+  hdr_intent.planes[UHDR_PLANE_UV] = luma + kImageWidth * kImageHeight;
+  hdr_intent.stride[UHDR_PLANE_UV] = kImageWidth;
+  hdr_intent.planes[UHDR_PLANE_V] = nullptr;
+  hdr_intent.stride[UHDR_PLANE_V] = 0;
+
+  for (int scaleFactor : {1, 4}) {
+    for (uhdr_enc_preset_t preset : {UHDR_USAGE_REALTIME, UHDR_USAGE_BEST_QUALITY}) {
+      for (bool multichannel : {false, true}) {
+        SCOPED_TRACE("scale factor " + std::to_string(scaleFactor) + ", preset " +
+                     std::to_string(preset) + ", multichannel " + std::to_string(multichannel));
+        JpegR cpu(nullptr, scaleFactor, kMapCompressQualityDefault, multichannel,
+                  kGainMapGammaDefault, preset);
+        JpegR gpu(&glCtxt, scaleFactor, kMapCompressQualityDefault, multichannel,
+                  kGainMapGammaDefault, preset);
+        uhdr_raw_image_ext_t sdr_cpu(UHDR_IMG_FMT_12bppYCbCr420, UHDR_CG_UNSPECIFIED,
+                                     UHDR_CT_UNSPECIFIED, UHDR_CR_UNSPECIFIED, kImageWidth,
+                                     kHeight, 64);
+        uhdr_raw_image_ext_t sdr_gpu(UHDR_IMG_FMT_12bppYCbCr420, UHDR_CG_UNSPECIFIED,
+                                     UHDR_CT_UNSPECIFIED, UHDR_CR_UNSPECIFIED, kImageWidth,
+                                     kHeight, 64);
+        ASSERT_EQ(UHDR_CODEC_OK, cpu.toneMap(&hdr_intent, &sdr_cpu).error_code);
+        uhdr_error_info_t status = gpu.toneMap(&hdr_intent, &sdr_gpu);
+        ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+        ASSERT_EQ(sdr_cpu.cg, sdr_gpu.cg);
+        for (int plane = UHDR_PLANE_Y; plane <= UHDR_PLANE_V; plane++) {
+          const unsigned int w = plane == UHDR_PLANE_Y ? kImageWidth : kImageWidth / 2;
+          const unsigned int h = plane == UHDR_PLANE_Y ? kHeight : kHeight / 2;
+          ASSERT_LE(maxDifference(&sdr_cpu, &sdr_gpu, plane, w, h, 1), 1) << "plane " << plane;
+        }
+
+        // both generate the gain map of the same sdr intent
+        uhdr_gainmap_metadata_ext_t metadata_cpu(kJpegrVersion), metadata_gpu(kJpegrVersion);
+        std::unique_ptr<uhdr_raw_image_ext_t> gainmap_cpu, gainmap_gpu;
+        ASSERT_EQ(UHDR_CODEC_OK,
+                  cpu.generateGainMap(&sdr_cpu, &hdr_intent, &metadata_cpu, gainmap_cpu, false,
+                                      false)
+                      .error_code);
+        status = gpu.generateGainMap(&sdr_cpu, &hdr_intent, &metadata_gpu, gainmap_gpu, false,
+                                     false);
+        ASSERT_EQ(UHDR_CODEC_OK, status.error_code) << status.detail;
+        ASSERT_EQ(gainmap_cpu->fmt, gainmap_gpu->fmt);
+        ASSERT_EQ(gainmap_cpu->w, gainmap_gpu->w);
+        ASSERT_EQ(gainmap_cpu->h, gainmap_gpu->h);
+        ASSERT_LE(maxDifference(gainmap_cpu.get(), gainmap_gpu.get(), UHDR_PLANE_PACKED,
+                                gainmap_cpu->w, gainmap_cpu->h, multichannel ? 3 : 1),
+                  2);
+        ASSERT_NEAR(metadata_cpu.max_content_boost, metadata_gpu.max_content_boost,
+                    metadata_cpu.max_content_boost * 0.01f);
+        ASSERT_NEAR(metadata_cpu.min_content_boost, metadata_gpu.min_content_boost,
+                    metadata_cpu.min_content_boost * 0.01f);
+      }
+    }
+  }
+  glCtxt.delete_opengl_ctxt();
+}
+#endif
+
 }  // namespace ultrahdr
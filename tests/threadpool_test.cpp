@@ -0,0 +1,178 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+
+#include "ultrahdr/threadpool.h"
+
+namespace ultrahdr {
+
+TEST(JobQueueTest, coversAllRowsOnce) {
+  for (unsigned int numWorkers : {1u, 2u, 4u, 7u}) {
+    for (unsigned int align : {1u, 2u, 4u}) {
+      const unsigned int numRows = 1021;
+      std::vector<std::atomic<int>> visits(numRows);
+      JobQueue jobQueue(numRows, align, numWorkers);
+      ThreadPool pool;
+      pool.run(
+          [&]() {
+            unsigned int rowStart, rowEnd;
+            while (jobQueue.dequeueJob(rowStart, rowEnd)) {
+              ASSERT_LT(rowStart, rowEnd);
+              ASSERT_EQ(rowStart % align, 0u);
+              for (unsigned int y = rowStart; y < rowEnd; y++) visits[y]++;
+            }
+          },
+          numWorkers);
+      for (unsigned int y = 0; y < numRows; y++) ASSERT_EQ(visits[y].load(), 1) << y;
+
+      unsigned int rowStart, rowEnd;
+      ASSERT_FALSE(jobQueue.dequeueJob(rowStart, rowEnd));
+      jobQueue.reset();
+      ASSERT_TRUE(jobQueue.dequeueJob(rowStart, rowEnd));
+      ASSERT_EQ(rowStart, 0u);
+    }
+  }
+}
+
+TEST(ThreadPoolTest, runsAllInstances) {
+  ThreadPool pool;
+  for (unsigned int parallelism = 1; parallelism <= 8; parallelism++) {
+    std::atomic<unsigned int> count{0};
+    pool.run([&count]() { count++; }, parallelism);
+    EXPECT_EQ(count.load(), parallelism);
+  }
+}
+
+TEST(ThreadPoolTest, reuseAcrossCalls) {
+  ThreadPool& pool = ThreadPool::getDefaultPool();
+  std::atomic<unsigned int> count{0};
+  for (int i = 0; i < 100; i++) {
+    pool.run([&count]() { count++; }, 4);
+  }
+  EXPECT_EQ(count.load(), 400u);
+}
+
+TEST(ThreadPoolTest, concurrentCallers) {
+  ThreadPool pool;
+  std::atomic<unsigned int> count{0};
+  std::vector<std::thread> callers;
+  for (int i = 0; i < 4; i++) {
+    callers.emplace_back([&pool, &count]() {
+      for (int j = 0; j < 25; j++) pool.run([&count]() { count++; }, 3);
+    });
+  }
+  for (auto& t : callers) t.join();
+  EXPECT_EQ(count.load(), 300u);
+}
+
+TEST(ThreadPoolTest, nestedCalls) {
+  ThreadPool pool;
+  std::atomic<unsigned int> count{0};
+  // every instance of the outer job occupies a pool thread while it issues its own run()
+  for (unsigned int parallelism = 2; parallelism <= 4; parallelism++) {
+    count = 0;
+    pool.run([&]() { pool.run([&count]() { count++; }, parallelism); }, parallelism);
+    EXPECT_EQ(count.load(), parallelism * parallelism);
+  }
+}
+
+TEST(CpuTopologyTest, coreTypes) {
+  const CpuTopology& topology = CpuTopology::get();
+  EXPECT_TRUE(topology.cores(UHDR_CORES_ANY).empty());
+  const std::vector<int>& big = topology.cores(UHDR_CORES_PERFORMANCE);
+  const std::vector<int>& little = topology.cores(UHDR_CORES_EFFICIENCY);
+  if (!topology.isHeterogeneous()) {
+    EXPECT_TRUE(big.empty());
+    EXPECT_TRUE(little.empty());
+    return;
+  }
+  ASSERT_FALSE(big.empty());
+  ASSERT_FALSE(little.empty());
+  for (int cpu : big) EXPECT_EQ(std::count(little.begin(), little.end(), cpu), 0) << cpu;
+}
+
+TEST(CpuTopologyTest, numaNodes) {
+  const std::vector<std::vector<int>>& nodes = CpuTopology::get().numaNodes();
+  ASSERT_NE(nodes.size(), 1u);
+  std::vector<int> seen;
+  for (const std::vector<int>& node : nodes) {
+    ASSERT_FALSE(node.empty());
+    for (int cpu : node) {
+      EXPECT_EQ(std::count(seen.begin(), seen.end(), cpu), 0) << cpu;
+      seen.push_back(cpu);
+    }
+  }
+}
+
+#if defined(__linux__)
+TEST(CpuTopologyTest, affinityScopeRestoresPlacement) {
+  cpu_set_t before, after;
+  ASSERT_EQ(sched_getaffinity(0, sizeof before, &before), 0);
+  for (uhdr_core_affinity_t affinity :
+       {UHDR_CORES_ANY, UHDR_CORES_PERFORMANCE, UHDR_CORES_EFFICIENCY}) {
+    {
+      CoreAffinityScope scope(affinity);
+      cpu_set_t pinned;
+      ASSERT_EQ(sched_getaffinity(0, sizeof pinned, &pinned), 0);
+      const std::vector<int>& cores = CpuTopology::get().cores(affinity);
+      if (cores.empty()) {
+        EXPECT_TRUE(CPU_EQUAL(&pinned, &before));
+      } else {
+        EXPECT_EQ(CPU_COUNT(&pinned), (int)cores.size());
+        for (int cpu : cores) EXPECT_TRUE(CPU_ISSET(cpu, &pinned)) << cpu;
+      }
+    }
+    ASSERT_EQ(sched_getaffinity(0, sizeof after, &after), 0);
+    EXPECT_TRUE(CPU_EQUAL(&after, &before));
+  }
+}
+
+TEST(CpuTopologyTest, nestedScopesReportPlacement) {
+  cpu_set_t allowed;
+  ASSERT_EQ(sched_getaffinity(0, sizeof allowed, &allowed), 0);
+  std::vector<int> cores;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &allowed)) cores.push_back(cpu);
+  }
+  EXPECT_EQ(CoreAffinityScope::current(), nullptr);
+  {
+    CoreAffinityScope outer(cores);
+    ASSERT_NE(CoreAffinityScope::current(), nullptr);
+    EXPECT_EQ(*CoreAffinityScope::current(), cores);
+    {
+      CoreAffinityScope inner(std::vector<int>{cores[0]});
+      ASSERT_NE(CoreAffinityScope::current(), nullptr);
+      EXPECT_EQ(*CoreAffinityScope::current(), std::vector<int>{cores[0]});
+      EXPECT_EQ(sched_getcpu(), cores[0]);
+    }
+    EXPECT_EQ(*CoreAffinityScope::current(), cores);
+  }
+  EXPECT_EQ(CoreAffinityScope::current(), nullptr);
+  cpu_set_t after;
+  ASSERT_EQ(sched_getaffinity(0, sizeof after, &after), 0);
+  EXPECT_TRUE(CPU_EQUAL(&after, &allowed));
+}
+#endif
+
+}  // namespace ultrahdr
@@ -190,6 +190,10 @@ typedef enum uhdr_codec_err {
   /*!\brief The library does not implement a feature required for the operation */
   UHDR_CODEC_UNSUPPORTED_FEATURE,
 
+  /*!\brief The operation was stopped by its cancel flag or deadline, see uhdr_set_cancel_flag()
+   * and uhdr_set_deadline() */
+  UHDR_CODEC_CANCELLED,
+
   /*!\brief Not for usage, indicates end of list */
   UHDR_CODEC_LIST_END,
 
@@ -201,6 +205,58 @@ typedef enum uhdr_mirror_direction {
   UHDR_MIRROR_HORIZONTAL,  /**< flip image over y axis */
 } uhdr_mirror_direction_t; /**< alias for enum uhdr_mirror_direction */
 
+/*!\brief List of supported resampling filters of the resize effect. */
+typedef enum uhdr_resize_filter {
+  UHDR_RESIZE_NEAREST,  /**< nearest sample at an integer step, no blending */
+  UHDR_RESIZE_BILINEAR, /**< triangle filter, support of 1 */
+  UHDR_RESIZE_BICUBIC,  /**< cubic convolution with a = -0.5, support of 2 */
+  UHDR_RESIZE_LANCZOS,  /**< windowed sinc, support of 3 */
+} uhdr_resize_filter_t; /**< alias for enum uhdr_resize_filter */
+
+/*!\brief List of codec stages timed by uhdr_enc_get_stats() / uhdr_dec_get_stats(). */
+typedef enum uhdr_codec_stage {
+  UHDR_STAGE_TONE_MAP,         /**< sdr intent from hdr intent, when done ahead of the gain map */
+  UHDR_STAGE_GAINMAP_GENERATE, /**< gain map computation, includes tone mapping fused into it */
+  UHDR_STAGE_COLOR_CONVERT,    /**< gamut and rgb to ycbcr conversions of the sdr intent */
+  UHDR_STAGE_BASE_COMPRESS,    /**< base image jpeg compression, includes fused conversions */
+  UHDR_STAGE_GAINMAP_COMPRESS, /**< jpeg compression of the gain map */
+  UHDR_STAGE_GAINMAP_APPEND,   /**< assembly of the output stream */
+  UHDR_STAGE_BASE_DECODE,      /**< jpeg decompression of the base image */
+  UHDR_STAGE_GAINMAP_DECODE,   /**< jpeg decompression of the gain map */
+  UHDR_STAGE_GAINMAP_APPLY,    /**< hdr rendition from base image and gain map */
+  UHDR_STAGE_COUNT,            /**< number of stages, not a stage */
+} uhdr_codec_stage_t;          /**< alias for enum uhdr_codec_stage */
+
+/*!\brief List of slower code paths counted by uhdr_enc_get_stats() / uhdr_dec_get_stats(). A
+ * count that stays above zero across the calls of a device points at an input or a platform that
+ * misses the fast path. */
+typedef enum uhdr_slow_path {
+  UHDR_SLOW_PATH_SCALAR_APPLY,     /**< gain map applied without a vector row kernel, for lack of
+                                        one for the cpu or for the layout of the inputs */
+  UHDR_SLOW_PATH_FRACTIONAL_SCALE, /**< gain map sampled at a fractional map scale factor */
+  UHDR_SLOW_PATH_GAINMAP_RESIZE,   /**< gain map resized for an aspect ratio off the base image */
+  UHDR_SLOW_PATH_GPU_FALLBACK,     /**< gpu acceleration enabled, work of the call ran on the cpu */
+  UHDR_SLOW_PATH_BUFFER_COPY,      /**< strided image copied contiguous for the gpu */
+  UHDR_SLOW_PATH_COUNT,            /**< number of slow paths, not a slow path */
+} uhdr_slow_path_t;                /**< alias for enum uhdr_slow_path */
+
+/*!\brief List of core types the worker threads of a codec may be placed on, see
+ * uhdr_set_core_affinity(). */
+typedef enum uhdr_core_affinity {
+  UHDR_CORES_ANY,         /**< no placement, left to the scheduler */
+  UHDR_CORES_PERFORMANCE, /**< fastest cores, for latency critical calls */
+  UHDR_CORES_EFFICIENCY,  /**< slowest cores and fewer threads, for background work */
+} uhdr_core_affinity_t;   /**< alias for enum uhdr_core_affinity */
+
+/*!\brief List of the work uhdr_preload() can do ahead of the first encode/decode. The values are
+ * flags and may be or'ed together. */
+typedef enum uhdr_preload_flag {
+  UHDR_PRELOAD_TABLES = 1 << 0,  /**< transfer function tables, icc profiles and simd dispatch */
+  UHDR_PRELOAD_THREADS = 1 << 1, /**< threads of the library-owned thread pool */
+  UHDR_PRELOAD_GPU = 1 << 2,     /**< egl context and shader programs of gpu gain map application */
+  UHDR_PRELOAD_ALL = UHDR_PRELOAD_TABLES | UHDR_PRELOAD_THREADS | UHDR_PRELOAD_GPU,
+} uhdr_preload_flag_t;           /**< alias for enum uhdr_preload_flag */
+
 // ===============================================================================================
 // Structure Definitions
 // ===============================================================================================
@@ -251,6 +307,12 @@ typedef struct uhdr_mem_block {
   size_t capacity;  /**< maximum size of the data buffer */
 } uhdr_mem_block_t; /**< alias for struct uhdr_mem_block */
 
+/**\brief Span of an encoded stream, see uhdr_get_encoded_segments() */
+typedef struct uhdr_stream_segment {
+  const void* data;      /**< Pointer to the bytes of the span */
+  size_t data_sz;        /**< size of the span */
+} uhdr_stream_segment_t; /**< alias for struct uhdr_stream_segment */
+
 /**\brief Gain map metadata. */
 typedef struct uhdr_gainmap_metadata {
   float max_content_boost; /**< Value to control how much brighter an image can get, when shown on
@@ -270,9 +332,144 @@ typedef struct uhdr_gainmap_metadata {
                               Value MUST be in linear scale. */
 } uhdr_gainmap_metadata_t; /**< alias for struct uhdr_gainmap_metadata */
 
+/**\brief Time spent in a codec stage. Stages may run concurrently and cpu time is that of the
+ * whole process over the stage, so neither sums to the figure of the call. */
+typedef struct uhdr_stage_stats {
+  double wall_ms;     /**< wall clock time, milliseconds */
+  double cpu_ms;      /**< process cpu time, milliseconds */
+  unsigned int calls; /**< times the stage ran, strip wise decodes run some stages per strip */
+} uhdr_stage_stats_t; /**< alias for struct uhdr_stage_stats */
+
+/**\brief Time spent on the gpu by a call that ran there, see uhdr_enable_gpu_acceleration(). The
+ * phases are timed on the gpu with timer queries if the driver has GL_EXT_disjoint_timer_query,
+ * else on the cpu between calls to glFinish() around each phase, which serializes the gpu work of
+ * the call. Results of timer queries spanning a disjoint operation of the gpu are left out. */
+typedef struct uhdr_gpu_stats {
+  double upload_ms;    /**< texture uploads of the inputs, milliseconds */
+  double shader_ms;    /**< shader passes, gain map generation, application and effects */
+  double readback_ms;  /**< reads of the outputs into pixel buffers, and copies out of those */
+  unsigned int passes; /**< shader passes run */
+  int timer_queries;   /**< 1 if timed with gpu timer queries, 0 if timed on the cpu */
+} uhdr_gpu_stats_t;    /**< alias for struct uhdr_gpu_stats */
+
+/**\brief Figures of the last encode/decode call of a context. */
+typedef struct uhdr_codec_stats {
+  uhdr_stage_stats_t stages[UHDR_STAGE_COUNT]; /**< per stage times, indexed by uhdr_codec_stage */
+  double wall_ms;                              /**< wall clock time of the call, milliseconds */
+  double cpu_ms;                               /**< process cpu time of the call, milliseconds */
+  unsigned int num_threads;                    /**< worker threads the call was allowed to use */
+  size_t bytes_allocated; /**< image buffer bytes allocated by the call, pooled reuse included */
+  size_t peak_bytes;      /**< peak of image buffer bytes allocated by the call and held at once */
+  unsigned int num_allocations; /**< image buffers allocated by the call, pooled reuse included */
+  uhdr_gpu_stats_t gpu;         /**< gpu phases of the call, all zero if it ran on the cpu */
+  unsigned int slow_paths[UHDR_SLOW_PATH_COUNT]; /**< times each slow path was taken, indexed by
+                                                      uhdr_slow_path */
+} uhdr_codec_stats_t; /**< alias for struct uhdr_codec_stats */
+
+/**\brief Cost of a decode, estimated by uhdr_dec_probe() from the image headers alone. Byte counts
+ * are projected peaks of the image buffers held at once, under the assumptions documented with
+ * uhdr_dec_set_memory_limit(). The per format counts keep the rest of the configuration and leave
+ * out the strip wise fallback of a memory limit. */
+typedef struct uhdr_decode_cost {
+  size_t image_pixels;   /**< pixels of the base image and of a whole image rendition */
+  size_t gainmap_pixels; /**< pixels of the gain map */
+  size_t bytes_rgba_half_float; /**< decode to #UHDR_IMG_FMT_64bppRGBAHalfFloat, linear */
+  size_t bytes_rgba1010102;     /**< decode to #UHDR_IMG_FMT_32bppRGBA1010102, hlg or pq */
+  size_t bytes_rgba8888;        /**< decode to #UHDR_IMG_FMT_32bppRGBA8888, srgb */
+  size_t bytes;    /**< decode as configured, strip wise where the configuration calls for it */
+  int in_strips;   /**< 1 if the configured decode runs strip wise, 0 otherwise */
+  int gpu_capable; /**< 1 if the configured decode is eligible for the gpu, 0 otherwise */
+} uhdr_decode_cost_t; /**< alias for struct uhdr_decode_cost */
+
+#define UHDR_LUMINANCE_HISTOGRAM_BINS 32      /**< bins of uhdr_luminance_stats::histogram */
+#define UHDR_LUMINANCE_HISTOGRAM_MIN_LOG2 -10 /**< log2 of the lower bound of the first bin */
+
+/**\brief Luminance statistics of the hdr output of a decode, see
+ * uhdr_dec_enable_luminance_stats(). Luminances are linear, in units of sdr white, so that 1.0 is
+ * sdr white and the maximum is the headroom the output makes use of. */
+typedef struct uhdr_luminance_stats {
+  float max_luminance;  /**< largest luminance of a pixel */
+  float mean_luminance; /**< mean luminance of the pixels */
+  size_t num_pixels;    /**< pixels the statistics cover */
+  /** pixel counts of half stop bins of log2 luminance, bin i covers [2^(min + i / 2),
+   * 2^(min + (i + 1) / 2)) with min UHDR_LUMINANCE_HISTOGRAM_MIN_LOG2. The first bin also counts
+   * the darker pixels, black included, and the last one the brighter pixels. */
+  size_t histogram[UHDR_LUMINANCE_HISTOGRAM_BINS];
+} uhdr_luminance_stats_t; /**< alias for struct uhdr_luminance_stats */
+
 /**\brief ultrahdr codec context opaque descriptor */
 typedef struct uhdr_codec_private uhdr_codec_private_t;
 
+/**\brief Immutable decoder configuration shared by decoders, see uhdr_create_decoder_profile() */
+typedef struct uhdr_decoder_profile uhdr_decoder_profile_t;
+
+/**\brief Probe results and gain maps shared by decoders, see uhdr_create_decoder_cache() */
+typedef struct uhdr_decoder_cache uhdr_decoder_cache_t;
+
+/**\brief Figures of a decoder cache, see uhdr_get_decoder_cache_stats() */
+typedef struct uhdr_decoder_cache_stats {
+  size_t entries;        /**< images held */
+  size_t bytes;          /**< bytes held, the decoded gain maps for the most part */
+  size_t probe_hits;     /**< probes served from the cache */
+  size_t probe_misses;   /**< probes that parsed the image */
+  size_t gainmap_hits;   /**< decodes that took the gain map from the cache */
+  size_t gainmap_misses; /**< decodes that looked for a gain map and decoded it */
+} uhdr_decoder_cache_stats_t; /**< alias for struct uhdr_decoder_cache_stats */
+
+/**\brief Unit of work submitted by the library to an external executor. Processes job #index. */
+typedef void (*uhdr_job_fn_t)(void* job_ctx, int index);
+
+/**\brief External executor. Invokes job(job_ctx, i) for every i in [begin, end), possibly
+ * concurrently, and returns only after all invocations have returned. */
+typedef void (*uhdr_parallel_for_fn_t)(void* executor_ctx, int begin, int end, uhdr_job_fn_t job,
+                                       void* job_ctx);
+
+/**\brief Completion callback of an asynchronous encode/decode. Receives the context and the
+ * status the operation returned. The callback runs on a thread that serves other asynchronous
+ * calls, it must not wait on them, with uhdr_wait() or otherwise. */
+typedef void (*uhdr_completion_fn_t)(void* user_ctx, uhdr_codec_private_t* codec,
+                                     uhdr_error_info_t status);
+
+/**\brief Allocation hook. Returns a block of at least size bytes, aligned for any scalar type. If
+ * nullptr is returned the library falls back to its default allocator for that request. Blocks of
+ * the default allocator are 64 byte aligned, an allocator that matches this keeps the rows of
+ * internal images aligned for simd kernels. */
+typedef void* (*uhdr_alloc_fn_t)(void* alloc_ctx, size_t size);
+
+/**\brief Release hook paired with #uhdr_alloc_fn_t. */
+typedef void (*uhdr_free_fn_t)(void* alloc_ctx, void* ptr);
+
+/**\brief Receives a strip of the final rendition of a strip wise decode. strip describes rows
+ * [row_start, row_start + strip->h) of the image and is only valid for the duration of the call.
+ * Returning a non-zero value aborts the decode. */
+typedef int (*uhdr_strip_fn_t)(void* strip_ctx, const uhdr_raw_image_t* strip,
+                               unsigned int row_start);
+
+/**\brief Receives the sdr base image of a decode ahead of the final rendition. base is only valid
+ * for the duration of the call. Returning a non-zero value aborts the decode. */
+typedef int (*uhdr_base_image_fn_t)(void* base_ctx, const uhdr_raw_image_t* base);
+
+/**\brief Jpeg codec backend, see uhdr_set_jpeg_backend(). Either callback may be nullptr, in
+ * which case libjpeg handles that direction. */
+typedef struct uhdr_jpeg_backend {
+  /** Compresses img, of format #UHDR_IMG_FMT_8bppYCbCr400, #UHDR_IMG_FMT_12bppYCbCr420,
+   * #UHDR_IMG_FMT_16bppYCbCr422, #UHDR_IMG_FMT_24bppYCbCr444 or #UHDR_IMG_FMT_24bppRGB888, to a
+   * baseline jpeg at quality [1 - 100]. On success sets dst->data and dst->data_sz to the
+   * bitstream, which is owned by the backend and stays valid until its next call from the same
+   * thread, and returns 0. Any other return value leaves the image to libjpeg. */
+  int (*compress)(void* backend_ctx, const uhdr_raw_image_t* img, int quality,
+                  uhdr_compressed_image_t* dst);
+  /** Decompresses the jpeg src to dst. The library sets the format, dimensions, planes and
+   * strides of dst to those of a libjpeg decode to YCbCr, the backend writes the samples. Returns
+   * 0 on success, any other value leaves the image to libjpeg. */
+  int (*decompress)(void* backend_ctx, const uhdr_compressed_image_t* src, uhdr_raw_image_t* dst);
+  void* backend_ctx; /**< opaque pointer passed back as the first argument of both callbacks */
+} uhdr_jpeg_backend_t; /**< alias for struct uhdr_jpeg_backend */
+
+/**\brief Receives the named slices of a trace. begin is 1 when the slice named name opens and 0
+ * when it closes. Slices nest per thread and may be reported from any thread of the library. */
+typedef void (*uhdr_trace_fn_t)(void* trace_ctx, const char* name, int begin);
+
 // ===============================================================================================
 // Function Declarations
 // ===============================================================================================
@@ -313,6 +510,24 @@ UHDR_EXTERN uhdr_error_info_t uhdr_enc_set_raw_image(uhdr_codec_private_t* enc,
                                                      uhdr_raw_image_t* img,
                                                      uhdr_img_label_t intent);
 
+/*!\brief Same as uhdr_enc_set_raw_image(), except that the image planes are not copied. The
+ * encoder reads the caller's planes directly, so they must stay valid and unmodified until
+ * uhdr_encode() returns, or until the context is reset or released if uhdr_encode() is not called.
+ * The library makes a private copy only when the encode path needs to modify the input, for
+ * instance to convert the color encoding of an sdr intent in place. Image effects write their
+ * results to new buffers and never modify the input.
+ *
+ * \param[in]  enc  encoder instance.
+ * \param[in]  img  image descriptor.
+ * \param[in]  intent  UHDR_HDR_IMG for hdr intent and UHDR_SDR_IMG for sdr intent.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_enc_set_raw_image_ref(uhdr_codec_private_t* enc,
+                                                         uhdr_raw_image_t* img,
+                                                         uhdr_img_label_t intent);
+
 /*!\brief Add compressed image descriptor to encoder context. The function goes through all the
  * fields of the image descriptor and checks for their sanity. If no anomalies are seen then the
  * image is added to internal list. Repeated calls to this function will replace the old entry with
@@ -343,6 +558,24 @@ UHDR_EXTERN uhdr_error_info_t uhdr_enc_set_compressed_image(uhdr_codec_private_t
                                                             uhdr_compressed_image_t* img,
                                                             uhdr_img_label_t intent);
 
+/*!\brief Same as uhdr_enc_set_compressed_image(), except that the bitstream is not copied. The
+ * encoder reads the first jpeg image of the caller's buffer in place, so the buffer must stay valid
+ * and unmodified until uhdr_encode() returns, or until the context is reset or released if
+ * uhdr_encode() is not called.
+ *
+ * \param[in]  enc  encoder instance.
+ * \param[in]  img  image descriptor.
+ * \param[in]  intent  UHDR_HDR_IMG for hdr intent,
+ *                     UHDR_SDR_IMG for sdr intent,
+ *                     UHDR_BASE_IMG for base image intent
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_enc_set_compressed_image_ref(uhdr_codec_private_t* enc,
+                                                                uhdr_compressed_image_t* img,
+                                                                uhdr_img_label_t intent);
+
 /*!\brief Add gain map image descriptor and gainmap metadata info that was used to generate the
  * aforth gainmap image to encoder context. The function internally goes through all the fields of
  * the image descriptor and checks for their sanity. If no anomalies are seen then the image is
@@ -479,15 +712,184 @@ UHDR_EXTERN uhdr_error_info_t uhdr_enc_set_preset(uhdr_codec_private_t* enc,
 /*!\brief Set output image compression format. Selects the compression format for encoding base
  * image and gainmap image. Default configuration is #UHDR_CODEC_JPG
  *
+ * #UHDR_CODEC_HEIF and #UHDR_CODEC_AVIF are reserved for gain map containers of those formats.
+ * The library does not bundle a heif or av1 encoder, so they are rejected with
+ * #UHDR_CODEC_UNSUPPORTED_FEATURE.
+ *
  * \param[in]  enc  encoder instance.
  * \param[in]  media_type  output image compression format. Supported values are #UHDR_CODEC_JPG
  *
- * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
- *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, #UHDR_CODEC_INVALID_PARAM for
+ * an invalid encoder, #UHDR_CODEC_UNSUPPORTED_FEATURE for an unsupported format.
  */
 UHDR_EXTERN uhdr_error_info_t uhdr_enc_set_output_format(uhdr_codec_private_t* enc,
                                                          uhdr_codec_t media_type);
 
+/*!\brief Set number of threads used for encoding. The count includes the calling thread. Worker
+ * threads are drawn from a pool that is shared by all codec instances of the library and persists
+ * across calls. Default configuration is 0, in which case the library picks a value based on the
+ * number of cores available.
+ *
+ * \param[in]  enc  encoder instance.
+ * \param[in]  num_threads  number of threads. Any integer in range [0, 256]
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_enc_set_num_threads(uhdr_codec_private_t* enc, int num_threads);
+
+/*!\brief Set the tile size used while generating the gain map. The gain map is computed tile by
+ * tile, with each tile sized so that the hdr and sdr intent pixels it samples fit in
+ * \p tile_size bytes. Sizing tiles to the per core cache cuts cache misses for large inputs
+ * and high gain map scale factors. 0 walks whole gain map rows. Default configuration is
+ * 262144. The output does not depend on this setting.
+ *
+ * \param[in]  enc  encoder instance.
+ * \param[in]  tile_size  tile size in bytes. Any integer in range [0, 67108864]
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_enc_set_gainmap_tile_size(uhdr_codec_private_t* enc,
+                                                             int tile_size);
+
+/*!\brief Enable content boost estimation. With #UHDR_USAGE_BEST_QUALITY, the min and max content
+ * boost are fitted to the gains of the whole image, which are therefore computed and held before
+ * the gain map is encoded. With estimation, the boosts are taken from a histogram of the gains of
+ * a subsample of gain map rows, leaving out a small share of outliers at either end, and the gain
+ * map is encoded in the same pass that computes its gains. This costs close to
+ * #UHDR_USAGE_REALTIME and stays close to the best quality output. Gains beyond the estimated
+ * boosts are clipped. Gain maps generated on the gpu, or from an sdr intent that the library
+ * derives from the hdr intent, keep to two passes. Default configuration is 0, disabled.
+ *
+ * \param[in]  enc  encoder instance.
+ * \param[in]  enable  1 to estimate the content boosts, 0 to fit them to all gains.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_enc_set_gainmap_boost_estimation(uhdr_codec_private_t* enc,
+                                                                    int enable);
+
+/*!\brief Enable automatic gain map scale factor. The factor set by
+ * uhdr_enc_set_gainmap_scale_factor() is then replaced by one picked from the hdr intent and the
+ * encoding preset: the smallest power of two that keeps the gain map within a pixel budget (1 MP
+ * for #UHDR_USAGE_REALTIME, 4 MP for #UHDR_USAGE_BEST_QUALITY), raised up to 16 respectively 8
+ * while the detail of the hdr luminance that the coarser map cannot follow stays small. The detail
+ * is estimated from a few rows of the hdr intent, at a fraction of the cost of the gain map. The
+ * picked factor is seen in the dimensions of the encoded gain map. Has no effect when the gain map
+ * is supplied by the application. Default configuration is 0, disabled.
+ *
+ * \param[in]  enc  encoder instance.
+ * \param[in]  enable  1 to pick the scale factor automatically, 0 to use the configured one.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_enc_set_auto_gainmap_scale_factor(uhdr_codec_private_t* enc,
+                                                                     int enable);
+
+/*!\brief Set caller owned buffer for the encoded stream. When set, uhdr_encode() writes the output
+ * directly into \p img->data and uhdr_get_encoded_stream() returns a descriptor backed by this
+ * memory. The library does not take ownership; the buffer must remain valid until the encoder is
+ * reset or destroyed. If the stream does not fit in \p img->capacity bytes, uhdr_encode() fails
+ * with #UHDR_CODEC_MEM_ERROR. A capacity of at least uhdr_enc_get_max_output_size() bytes is
+ * always sufficient.
+ *
+ * \param[in]  enc  encoder instance.
+ * \param[in]  img  output buffer descriptor, only data and capacity fields are read.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_enc_set_output_buffer(uhdr_codec_private_t* enc,
+                                                        uhdr_compressed_image_t* img);
+
+/*!\brief Set file descriptor for the encoded stream. When set, a successful uhdr_encode() writes
+ * the stream to \p fd starting at its current offset, sparing the caller a copy of
+ * uhdr_get_encoded_stream(). The library does not take ownership; \p fd must remain open until
+ * uhdr_encode() returns. If the write fails, uhdr_encode() fails with #UHDR_CODEC_ERROR.
+ *
+ * NOTE: Not available on Windows, #UHDR_CODEC_UNSUPPORTED_FEATURE is returned there.
+ *
+ * \param[in]  enc  encoder instance.
+ * \param[in]  fd  file descriptor open for writing.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_enc_set_output_fd(uhdr_codec_private_t* enc, int fd);
+
+/*!\brief Enable segmented output. When enabled, an encode of a compressed base image and a
+ * compressed gain map image does not copy the entropy coded data of the two images. Only the
+ * markers and metadata generated by the library are written to the output buffer, the stream is
+ * described by uhdr_get_encoded_segments() as a list of spans that alternate between this buffer
+ * and the registered images, ready to be handed to writev() or a scatter-gather socket send.
+ * Output set with uhdr_enc_set_output_fd() is written from the spans as well. Other encode modes
+ * produce a single span over the output buffer.
+ *
+ * The spans referencing the images remain valid as long as the images do, until the context is
+ * reset or released for images registered with uhdr_enc_set_compressed_image() and as long as the
+ * caller's buffers for images registered with uhdr_enc_set_compressed_image_ref(). A later call to
+ * uhdr_get_encoded_stream() gathers the spans into a buffer owned by the library.
+ *
+ * \param[in]  enc  encoder instance.
+ * \param[in]  enable  enable segmented output if 1, disable otherwise, default 0.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_enc_enable_output_segments(uhdr_codec_private_t* enc,
+                                                              int enable);
+
+/*!\brief Add an output at other qualities to the encode. uhdr_encode() then computes the sdr
+ * intent, the gain map and the color conversions of the base image once and compresses base image
+ * and gain map at the configured qualities and at those of every rung, concurrently. The stream of
+ * the configured qualities is accessible as usual, the one of a rung with
+ * uhdr_get_encoded_quality_rung(). Each is identical to the output of a separate encode at its
+ * qualities. This is available for encodes of a raw hdr intent and an optional raw sdr intent,
+ * uhdr_encode() fails with #UHDR_CODEC_INVALID_OPERATION for other inputs.
+ *
+ * \param[in]  enc  encoder instance.
+ * \param[in]  base_quality  quality factor of the base image, in range [0 - 100].
+ * \param[in]  gainmap_quality  quality factor of the gain map image, in range [0 - 100].
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_enc_add_quality_rung(uhdr_codec_private_t* enc,
+                                                        int base_quality, int gainmap_quality);
+
+/*!\brief Set a byte budget for the encoded stream. uhdr_encode() then picks the highest quality
+ * whose stream fits the budget. A quality applies to both base image and gain map, the qualities
+ * set with uhdr_enc_set_quality() act as upper bounds. Base image and gain map go through the
+ * forward dct once, the qualities tried are compressed from their dct coefficients, so rate
+ * control costs little more than a single encode. Streams compressed this way differ slightly
+ * from an encode at the chosen quality. If the stream does not fit at quality 1, the stream of
+ * quality 1 is produced, the caller can tell from its size. This is available for encodes of a raw
+ * hdr intent and an optional raw sdr intent, uhdr_encode() fails with
+ * #UHDR_CODEC_INVALID_OPERATION for other inputs and in combination with quality rungs.
+ *
+ * \param[in]  enc  encoder instance.
+ * \param[in]  target_size  byte budget of the encoded stream, 0 to disable, default 0.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_enc_set_target_size(uhdr_codec_private_t* enc,
+                                                       size_t target_size);
+
+/*!\brief Get worst case size of the encoded stream for the current configuration. Registered
+ * images and effects are taken into account, so this should be called after the inputs are set
+ * and before uhdr_encode().
+ *
+ * \param[in]  enc  encoder instance.
+ *
+ * \return size in bytes, 0 if the encoder instance is invalid, the inputs required for encoding
+ * are not registered or uhdr_encode() has already been called.
+ */
+UHDR_EXTERN size_t uhdr_enc_get_max_output_size(uhdr_codec_private_t* enc);
+
 /*!\brief Encode process call
  * After initializing the encoder context, call to this function will submit data for encoding. If
  * the call is successful, the encoded output is stored internally and is accessible via
@@ -505,7 +907,7 @@ UHDR_EXTERN uhdr_error_info_t uhdr_enc_set_output_format(uhdr_codec_private_t* e
  * - If the application wants to insert exif data
  *   - uhdr_enc_set_exif_data()
  * - If the application wants to set gainmap scale factor
- *   - uhdr_enc_set_gainmap_scale_factor()
+ *   - uhdr_enc_set_gainmap_scale_factor(), or uhdr_enc_set_auto_gainmap_scale_factor()
  * - If the application wants to enable multi channel gain map
  *   - uhdr_enc_set_using_multi_channel_gainmap()
  * - If the application wants to set gainmap image gamma
@@ -518,6 +920,28 @@ UHDR_EXTERN uhdr_error_info_t uhdr_enc_set_output_format(uhdr_codec_private_t* e
  *   - uhdr_enc_set_preset()
  * - If the application wants to control target compression format
  *   - uhdr_enc_set_output_format()
+ * - If the application wants to control the number of threads used
+ *   - uhdr_enc_set_num_threads()
+ * - If the application wants to tune the cache footprint of gain map generation
+ *   - uhdr_enc_set_gainmap_tile_size()
+ * - If the application wants best quality gain maps at lower cost
+ *   - uhdr_enc_set_gainmap_boost_estimation()
+ * - If the application wants the stream written into its own memory
+ *   - uhdr_enc_get_max_output_size(), uhdr_enc_set_output_buffer()
+ * - If the application wants the stream written to a file descriptor
+ *   - uhdr_enc_set_output_fd()
+ * - If the application wants the stream as spans referencing its compressed inputs
+ *   - uhdr_enc_enable_output_segments()
+ * - If the application wants the image at several qualities from one gain map computation
+ *   - uhdr_enc_add_quality_rung()
+ * - If the application wants the stream to fit a byte budget
+ *   - uhdr_enc_set_target_size()
+ * - If the application wants to dispatch parallel work through its own scheduler
+ *   - uhdr_set_parallel_executor()
+ * - If the application wants the work placed on performance or efficiency cores
+ *   - uhdr_set_core_affinity()
+ * - If the application wants to abort the encode on request or past a deadline
+ *   - uhdr_set_cancel_flag(), uhdr_set_deadline()
  * - The program calls uhdr_encode() to encode data. This call would initiate the process of
  * computing gain map from hdr intent and sdr intent. The sdr intent and gain map image are
  * compressed at the set quality using the codec of choice.
@@ -575,6 +999,106 @@ UHDR_EXTERN uhdr_error_info_t uhdr_enc_set_output_format(uhdr_codec_private_t* e
  */
 UHDR_EXTERN uhdr_error_info_t uhdr_encode(uhdr_codec_private_t* enc);
 
+/*!\brief Encode asynchronously. Queues uhdr_encode() of the encoder on the library thread pool
+ * and returns without waiting for it. Once the encode has finished, on_done (if not nullptr) is
+ * invoked on a pool thread with the status of the encode. The callback may release the encoder.
+ *
+ * While the encode is in flight, the encoder must not be used other than with uhdr_wait(),
+ * uhdr_is_busy(), uhdr_reset_encoder() and uhdr_release_encoder(), the latter two wait for it.
+ * With a callback set, the encoder must not be released elsewhere before the callback has run.
+ *
+ * \param[in]  enc  encoder instance.
+ * \param[in]  on_done  completion callback, can be nullptr.
+ * \param[in]  user_ctx  passed to the callback as is.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if the encode is queued, #UHDR_CODEC_INVALID_PARAM for
+ * an invalid encoder, #UHDR_CODEC_INVALID_OPERATION if an asynchronous call is already in flight.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_encode_async(uhdr_codec_private_t* enc,
+                                                uhdr_completion_fn_t on_done, void* user_ctx);
+
+/*!\brief Encode a batch of images. Each encoder is configured as for uhdr_encode(), the images
+ * are then encoded concurrently on the library thread pool, largest first. State that does not
+ * depend on the image content, such as the icc profiles of the base images, is prepared once and
+ * shared by the encodes of the batch. An encoder whose number of threads is left at its default
+ * encodes its image on a single thread, as the images of the batch rather than the rows of an
+ * image are spread across the cores. On a NUMA host each image stays on one node, see
+ * uhdr_enable_numa_placement(). Callbacks of the encoders may run on pool threads.
+ *
+ * The outputs are accessed per encoder as after uhdr_encode() and are identical to those of
+ * uhdr_encode(). uhdr_encode() of an encoder of the batch returns its own status.
+ *
+ * \param[in]  encs  encoder instances, each at most once.
+ * \param[in]  count  number of encoder instances.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if all images are encoded, the status of the first
+ * failing encoder in array order otherwise. #UHDR_CODEC_INVALID_PARAM if the list is invalid, in
+ * which case no image is encoded.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_encode_batch(uhdr_codec_private_t** encs, unsigned int count);
+
+/*!\brief Start an encode whose intents are pushed a strip of rows at a time, for producers such
+ * as camera pipelines and tiled renderers that generate an image top to bottom. Neither intent is
+ * ever held whole. Each strip is tone mapped if no sdr intent is pushed, its gain map rows are
+ * generated and both the base image and the gain map are compressed as the strips arrive. The
+ * usage is:
+ * - uhdr_create_encoder()
+ * - uhdr_enc_set_*() // optional, settings are taken by this call
+ * - uhdr_enc_start_stream(ctxt, height)
+ * - uhdr_enc_push_rows(ctxt, hdr_rows, sdr_rows) // repeated until all rows are pushed
+ * - uhdr_enc_finish_stream()
+ * - uhdr_get_encoded_stream()
+ * - uhdr_release_encoder()
+ *
+ * The gain map is computed in one pass over the strips, as for an encode of the hdr intent alone,
+ * and its metadata does not depend on the content. A streamed sdr intent therefore requires
+ * #UHDR_USAGE_REALTIME, whose gain map of raw hdr and sdr intents is computed the same way. The
+ * decoded output is that of uhdr_encode() with the intents registered whole. Settings that need
+ * the whole image are not supported, these are image effects, quality rungs, target sizes and the
+ * automatic gain map scale factor, as are images registered with uhdr_enc_set_*_image(). Like
+ * uhdr_encode(), this call switches the context to its end state, uhdr_encode() then returns
+ * #UHDR_CODEC_INVALID_OPERATION until the stream is finished.
+ *
+ * \param[in]  enc  encoder instance.
+ * \param[in]  height  height of the intents in rows.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, #UHDR_CODEC_INVALID_PARAM for
+ * an invalid height, #UHDR_CODEC_INVALID_OPERATION if the settings can not be streamed or the
+ * context was used already.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_enc_start_stream(uhdr_codec_private_t* enc, unsigned int height);
+
+/*!\brief Push the next strip of rows of the intents of an encode started by
+ * uhdr_enc_start_stream(). The descriptors are those of uhdr_enc_set_raw_image(), with the height
+ * of the strip in place of that of the image. Strips are pushed top to bottom, share the width,
+ * format and color aspects of the first strip and, but for the last one, span a multiple of the
+ * gain map scale factor rows, even for 4:2:0 intents. The rows are read during the call only.
+ *
+ * \param[in]  enc  encoder instance.
+ * \param[in]  hdr_rows  rows of the hdr intent.
+ * \param[in]  sdr_rows  rows of the sdr intent, of the height of hdr_rows, nullptr to tone map the
+ *                       hdr intent. Either every strip of an encode has one or none.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, #UHDR_CODEC_INVALID_PARAM for
+ * invalid rows, which leaves the encode as it was, #UHDR_CODEC_INVALID_OPERATION if no encode is
+ * in progress, uhdr_codec_err_t otherwise. Other failures end the encode, uhdr_enc_finish_stream()
+ * returns them.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_enc_push_rows(uhdr_codec_private_t* enc,
+                                                 uhdr_raw_image_t* hdr_rows,
+                                                 uhdr_raw_image_t* sdr_rows);
+
+/*!\brief Complete an encode started by uhdr_enc_start_stream() once all rows are pushed. On
+ * success, the output is accessed as after uhdr_encode(), output buffers and file descriptors set
+ * on the context are honored. Once the encode has ended, further calls return its status.
+ *
+ * \param[in]  enc  encoder instance.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, #UHDR_CODEC_INVALID_OPERATION if
+ * no encode was started or rows are missing, uhdr_codec_err_t otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_enc_finish_stream(uhdr_codec_private_t* enc);
+
 /*!\brief Get encoded ultra hdr stream
  *
  * \param[in]  enc  encoder instance.
@@ -583,6 +1107,40 @@ UHDR_EXTERN uhdr_error_info_t uhdr_encode(uhdr_codec_private_t* enc);
  */
 UHDR_EXTERN uhdr_compressed_image_t* uhdr_get_encoded_stream(uhdr_codec_private_t* enc);
 
+/*!\brief Get encoded ultra hdr stream as a list of spans, see uhdr_enc_enable_output_segments().
+ * The stream is the concatenation of the spans in list order. Without segmented output, the list
+ * holds a single span over the stream of uhdr_get_encoded_stream().
+ *
+ * \param[in]  enc  encoder instance.
+ * \param[out]  count  number of spans in the list.
+ *
+ * \return nullptr if encode process call is unsuccessful, the list of spans otherwise. The list is
+ * valid until the next call on the encoder instance.
+ */
+UHDR_EXTERN const uhdr_stream_segment_t* uhdr_get_encoded_segments(uhdr_codec_private_t* enc,
+                                                                   unsigned int* count);
+
+/*!\brief Get encoded ultra hdr stream of a quality rung, see uhdr_enc_add_quality_rung()
+ *
+ * \param[in]  enc  encoder instance.
+ * \param[in]  index  index of the rung, in the order of the uhdr_enc_add_quality_rung() calls.
+ *
+ * \return nullptr if encode process call is unsuccessful or index is out of range, uhdr image
+ * descriptor otherwise
+ */
+UHDR_EXTERN uhdr_compressed_image_t* uhdr_get_encoded_quality_rung(uhdr_codec_private_t* enc,
+                                                                   unsigned int index);
+
+/*!\brief Get figures of the last encode call, see uhdr_enable_stats()
+ *
+ * \param[in]  enc  encoder instance.
+ *
+ * \return nullptr if stats are disabled or no encode call has been made since reset, stats
+ * descriptor otherwise. The call status does not matter, a failed call reports its stages up to
+ * the failure.
+ */
+UHDR_EXTERN uhdr_codec_stats_t* uhdr_enc_get_stats(uhdr_codec_private_t* enc);
+
 /*!\brief Reset encoder instance.
  * Clears all previous settings and resets to default state and ready for re-initialization and
  * usage
@@ -597,7 +1155,11 @@ UHDR_EXTERN void uhdr_reset_encoder(uhdr_codec_private_t* enc);
 // Decoder APIs
 // ===============================================================================================
 
-/*!\brief check if it is a valid ultrahdr image.
+/*!\brief check if it is an ultrahdr image. This is a quick check of the markers that creates
+ * no decoder and allocates nothing: the primary image must carry the gain map xmp namespace or
+ * the iso 21496-1 urn and an mpf block that locates the gain map image, whose headers carry gain
+ * map metadata. Only the headers of the two images are read. The metadata values and the image
+ * data are not validated, uhdr_dec_probe() does that.
  *
  * @param[in]  data  pointer to input compressed stream
  * @param[in]  size  size of compressed stream
@@ -624,6 +1186,101 @@ UHDR_EXTERN uhdr_codec_private_t* uhdr_create_decoder(void);
  */
 UHDR_EXTERN void uhdr_release_decoder(uhdr_codec_private_t* dec);
 
+/*!\brief Create a decoder profile from the settings of dec. A profile captures the output
+ * format, color transfer, color gamut and display boost, the number of threads, the idct,
+ * upsampling and gain map application choices, the gpu settings, the memory limit, the deadline
+ * and the parallel executor, i.e. what a service configures once for all of its requests.
+ * Images, effects, renditions, pyramid levels and callbacks belong to a single decode and are
+ * not captured. A profile never changes after its creation, so any number of threads may apply
+ * it concurrently, see uhdr_dec_set_profile(). The tables of the gain map math are shared by all
+ * decoders of the process regardless.
+ *
+ * \param[in]  dec  decoder instance, configured as a template.
+ *
+ * \return nullptr if dec is not a decoder instance, profile otherwise
+ */
+UHDR_EXTERN uhdr_decoder_profile_t* uhdr_create_decoder_profile(uhdr_codec_private_t* dec);
+
+/*!\brief Release decoder profile. Decoders that the profile was applied to are not affected.
+ *
+ * \param[in]  profile  profile, may be nullptr.
+ *
+ * \return none
+ */
+UHDR_EXTERN void uhdr_release_decoder_profile(uhdr_decoder_profile_t* profile);
+
+/*!\brief Apply decoder profile. The settings of profile replace those of dec and, unlike other
+ * settings, are restored by uhdr_reset_decoder() in place of the defaults. A decoder thus serves
+ * as a light per request session of a shared configuration: set the image, decode, reset. Setters
+ * called after this override the profile until the next reset. Passing nullptr detaches the
+ * profile, reset restores the defaults again. The profile is copied, it may be released after
+ * the call.
+ *
+ * \param[in]  dec  decoder instance.
+ * \param[in]  profile  profile, or nullptr.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, #UHDR_CODEC_INVALID_PARAM
+ * otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_dec_set_profile(uhdr_codec_private_t* dec,
+                                                   const uhdr_decoder_profile_t* profile);
+
+/*!\brief Create a decoder cache, for services that open the same images again and again, such as
+ * thumbnailers. Entries are keyed by the compressed image, so they serve any decoder given the
+ * same bytes, wherever the bytes come from. An entry keeps a copy of the bytes, which is compared
+ * in full on a lookup, so a different image never takes the results of another. It holds the
+ * results of
+ * uhdr_dec_probe(), i.e. the image and gain map geometry, the gain map metadata and the locations
+ * of the exif, icc, base image and gain map blocks, and optionally the gain map as decoded by
+ * uhdr_decode(). A probe that finds its image skips parsing the headers, a decode that finds its
+ * gain map skips decoding it. Entries are evicted least recently used first once the bytes held
+ * exceed capacity. A cache may be used by any number of decoders and threads at once.
+ *
+ * Gain maps are kept for decodes that apply the gain map at full size only; scaled decodes, for
+ * instance for a resize effect, and strip wise decodes decode the gain map as usual. Entries of
+ * images whose headers need the copying parse fallback are not kept.
+ *
+ * \param[in]  capacity  bytes to be held at most. An entry takes the size of the compressed image
+ *                       and a few hundred bytes, plus with a gain map about its pixel count, times
+ *                       3 for a multi channel gain map.
+ * \param[in]  keep_gainmaps  1 to keep decoded gain maps, 0 to keep probe results only.
+ *
+ * \return nullptr if capacity is 0, cache otherwise
+ */
+UHDR_EXTERN uhdr_decoder_cache_t* uhdr_create_decoder_cache(size_t capacity, int keep_gainmaps);
+
+/*!\brief Release decoder cache. Decoders the cache is attached to keep it alive until they detach
+ * it or are released.
+ *
+ * \param[in]  cache  cache, may be nullptr.
+ *
+ * \return none
+ */
+UHDR_EXTERN void uhdr_release_decoder_cache(uhdr_decoder_cache_t* cache);
+
+/*!\brief Attach decoder cache. uhdr_dec_probe() and uhdr_decode() of the decoder consult the
+ * cache and add to it. The attachment persists across uhdr_reset_decoder().
+ *
+ * \param[in]  dec  decoder instance.
+ * \param[in]  cache  cache, or nullptr to detach (default).
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, #UHDR_CODEC_INVALID_PARAM for an
+ * invalid decoder, #UHDR_CODEC_INVALID_OPERATION after the decoder has probed or decoded an image.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_dec_set_cache(uhdr_codec_private_t* dec,
+                                                 uhdr_decoder_cache_t* cache);
+
+/*!\brief Get the figures of a decoder cache.
+ *
+ * \param[in]  cache  cache.
+ * \param[out]  stats  figures, hit and miss counts since the creation of the cache.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, #UHDR_CODEC_INVALID_PARAM
+ * otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_get_decoder_cache_stats(uhdr_decoder_cache_t* cache,
+                                                           uhdr_decoder_cache_stats_t* stats);
+
 /*!\brief Add compressed image descriptor to decoder context. The function goes through all the
  * fields of the image descriptor and checks for their sanity. If no anomalies are seen then the
  * image is added to internal list. Repeated calls to this function will replace the old entry with
@@ -638,12 +1295,73 @@ UHDR_EXTERN void uhdr_release_decoder(uhdr_codec_private_t* dec);
 UHDR_EXTERN uhdr_error_info_t uhdr_dec_set_image(uhdr_codec_private_t* dec,
                                                  uhdr_compressed_image_t* img);
 
+/*!\brief Same as uhdr_dec_set_image(), except that the bitstream is not copied. The decoder reads
+ * the caller's buffer in place, so it must stay valid and unmodified until the decoder is reset or
+ * released. uhdr_dec_get_base_image() and uhdr_dec_get_gainmap_image() point into this buffer.
+ *
+ * \param[in]  dec  decoder instance.
+ * \param[in]  img  image descriptor.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_dec_set_image_ref(uhdr_codec_private_t* dec,
+                                                     uhdr_compressed_image_t* img);
+
+/*!\brief Add the compressed image piecewise, as it arrives, in place of uhdr_dec_set_image(). The
+ * chunks are copied and appended in the order of the calls, last marks the final one. The base
+ * image is decoded on the library thread pool while the chunks arrive, the decode waits whenever
+ * it runs out of input. Once the final chunk is in, uhdr_decode() is left to decode the gain map
+ * and to apply it.
+ *
+ * NOTE: The decoder is to be configured before the first chunk is pushed. The base image decoded
+ * ahead is used by decodes that read the base image as a whole, that is without a strip callback
+ * or a leading crop or resize effect, and for an output setup it was decoded for. Otherwise it is
+ * decoded again from the complete image. uhdr_dec_probe() and uhdr_decode() return
+ * #UHDR_CODEC_INVALID_OPERATION until the final chunk is pushed.
+ *
+ * \param[in]  dec  decoder instance.
+ * \param[in]  data  chunk of the compressed image, can be nullptr if size is 0.
+ * \param[in]  size  chunk size in bytes.
+ * \param[in]  last  1 if this is the final chunk, 0 otherwise.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, #UHDR_CODEC_INVALID_PARAM for
+ * invalid arguments, #UHDR_CODEC_INVALID_OPERATION if an image has been set with
+ * uhdr_dec_set_image() or the final chunk is already pushed.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_dec_push_data(uhdr_codec_private_t* dec, const void* data,
+                                                 size_t size, int last);
+
+/*!\brief Add the compressed image held in a file in place of uhdr_dec_set_image(). The file is
+ * mapped read-only and decoded from the mapping, so it is neither read into nor copied to heap
+ * memory. The mapping lasts until the decoder is reset or destroyed; \p fd may be closed as soon
+ * as the call returns. Color fields of the image descriptor are left unspecified.
+ *
+ * NOTE: Not available on Windows, #UHDR_CODEC_UNSUPPORTED_FEATURE is returned there.
+ *
+ * \param[in]  dec  decoder instance.
+ * \param[in]  fd  file descriptor of a regular file open for reading.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, #UHDR_CODEC_INVALID_PARAM for
+ * invalid arguments, #UHDR_CODEC_ERROR if the file cannot be mapped.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_dec_set_image_fd(uhdr_codec_private_t* dec, int fd);
+
 /*!\brief Set output image color format
  *
  * \param[in]  dec  decoder instance.
  * \param[in]  fmt  output image color format. Supported values are
  *                  #UHDR_IMG_FMT_64bppRGBAHalfFloat, #UHDR_IMG_FMT_32bppRGBA1010102,
- *                  #UHDR_IMG_FMT_32bppRGBA8888
+ *                  #UHDR_IMG_FMT_24bppYCbCrP010, #UHDR_IMG_FMT_32bppRGBA8888. P010 output is
+ *                  full range YCbCr with the matrix of the output color gamut and is meant for
+ *                  feeding hardware video encoders, it needs even image dimensions and is always
+ *                  computed on the cpu. With gain map application disabled, see
+ *                  uhdr_dec_enable_gainmap_application(), or with output color transfer
+ *                  #UHDR_CT_SRGB, #UHDR_IMG_FMT_12bppYCbCr420, #UHDR_IMG_FMT_24bppYCbCr444 and
+ *                  #UHDR_IMG_FMT_8bppYCbCr400 are supported as well. These return the planes of
+ *                  the base image as coded, without color conversion and chroma upsampling, and
+ *                  fail if the base image is coded in another layout. Sdr output of this kind
+ *                  takes no display boost.
  *
  * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
  *                           #UHDR_CODEC_INVALID_PARAM otherwise.
@@ -651,11 +1369,147 @@ UHDR_EXTERN uhdr_error_info_t uhdr_dec_set_image(uhdr_codec_private_t* dec,
 UHDR_EXTERN uhdr_error_info_t uhdr_dec_set_out_img_format(uhdr_codec_private_t* dec,
                                                           uhdr_img_fmt_t fmt);
 
+/*!\brief Set caller owned buffer for decoded output. When set, uhdr_decode() writes the final
+ * image directly into \p img->planes[#UHDR_PLANE_PACKED] honoring \p img->stride, and
+ * uhdr_get_decoded_image() returns a descriptor backed by this memory. The library does not take
+ * ownership; the buffer must remain valid until the decoder is reset or destroyed. Image format
+ * shall match the value configured via uhdr_dec_set_out_img_format() and dimensions shall match
+ * the decoded (post-effects) image, otherwise uhdr_decode() fails. If editing effects are
+ * registered, output is produced internally and copied into the buffer once. The gain map image
+ * is always held in internal memory.
+ *
+ * \param[in]  dec  decoder instance.
+ * \param[in]  img  output buffer descriptor. Supported formats are
+ *                  #UHDR_IMG_FMT_64bppRGBAHalfFloat, #UHDR_IMG_FMT_32bppRGBA1010102,
+ *                  #UHDR_IMG_FMT_24bppYCbCrP010, #UHDR_IMG_FMT_32bppRGBA8888. A P010 buffer
+ *                  also needs \p img->planes[#UHDR_PLANE_UV]
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_dec_set_output_buffer(uhdr_codec_private_t* dec,
+                                                        uhdr_raw_image_t* img);
+
+/*!\brief Decode strip wise. With a strip callback set, uhdr_decode() does not materialize the
+ * final rendition. The base image is decoded a strip of rows at a time, the gain map is applied to
+ * it and the resulting rows are handed to strip_fn, in order, as soon as they are ready. Peak
+ * memory is thus proportional to the strip height rather than the image size. After the decode,
+ * uhdr_get_decoded_image() returns nullptr, the decoded gain map stays accessible through
+ * uhdr_get_decoded_gainmap_image().
+ *
+ * NOTE: strip_height is rounded up to a multiple of the MCU height of the base image and the last
+ * strip may be shorter. Strip wise decode cannot be combined with image effects or with
+ * uhdr_dec_set_output_buffer(), and the gain map is applied on the cpu even if gpu acceleration is
+ * enabled.
+ *
+ * \param[in]  dec  decoder instance.
+ * \param[in]  strip_fn  strip callback, nullptr restores whole image decode
+ * \param[in]  strip_ctx  opaque pointer passed back as the first argument of strip_fn
+ * \param[in]  strip_height  requested rows per strip, must be > 0 if strip_fn is not nullptr
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_dec_set_strip_callback(uhdr_codec_private_t* dec,
+                                                         uhdr_strip_fn_t strip_fn,
+                                                         void* strip_ctx,
+                                                         unsigned int strip_height);
+
+/*!\brief Set a memory limit for the decode. uhdr_dec_probe() projects the peak of the image
+ * buffers the decode is to hold at once from the image headers and the output configuration. If a
+ * whole image decode exceeds the limit, uhdr_decode() switches to a strip wise decode of the base
+ * image and assembles the final rendition from the strips, which holds neither the decoded base
+ * image nor an intermediate rendition as a whole. If that also exceeds the limit, or the
+ * configuration rules it out, uhdr_dec_probe() and uhdr_decode() fail with #UHDR_CODEC_MEM_ERROR
+ * before any image buffer is allocated. With a limit set, sdr output with a display boost to
+ * #UHDR_IMG_FMT_32bppRGBA8888 decodes the base image into the output and applies the gain map over
+ * it in place, so the decoder does not keep the base image for later decodes.
+ *
+ * NOTE: The projection assumes a base image without chroma subsampling, so it errs on the high
+ * side for the usual 4:2:0 streams. Memory held by the jpeg library itself, by a caller provided
+ * output buffer and by the compressed image is not counted. The strip wise fallback cannot be
+ * combined with image effects, a base image callback or disabled gain map application and runs
+ * on the cpu. With a strip callback set, the limit is checked against the strip wise decode.
+ * Region rendering checks it on each call of uhdr_dec_render_region().
+ *
+ * \param[in]  dec  decoder instance.
+ * \param[in]  limit_bytes  memory limit in bytes, 0 for none (default).
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_dec_set_memory_limit(uhdr_codec_private_t* dec,
+                                                       size_t limit_bytes);
+
+/*!\brief Receive the base image early. With a base image callback set, uhdr_decode() hands the
+ * decoded sdr base image to base_fn as soon as it is available, before the gain map is applied,
+ * so that it can be displayed while the hdr rendition is produced. The final rendition is then
+ * accessed as usual once uhdr_decode() returns.
+ *
+ * The base image is passed as decoded, as #UHDR_IMG_FMT_32bppRGBA8888 if the output color
+ * transfer is #UHDR_CT_SRGB, as planar YCbCr (#UHDR_IMG_FMT_12bppYCbCr420,
+ * #UHDR_IMG_FMT_24bppYCbCr444 or #UHDR_IMG_FMT_8bppYCbCr400) otherwise. With gain map
+ * application disabled, it is the decoded image itself. A leading crop or downscale effect of the
+ * decode is reflected in it, other image effects are not.
+ *
+ * NOTE: This cannot be combined with uhdr_dec_set_strip_callback(). base_fn runs on the thread
+ * that calls uhdr_decode().
+ *
+ * \param[in]  dec  decoder instance.
+ * \param[in]  base_fn  base image callback, nullptr for none
+ * \param[in]  base_ctx  opaque pointer passed back as the first argument of base_fn
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_dec_set_base_image_callback(uhdr_codec_private_t* dec,
+                                                              uhdr_base_image_fn_t base_fn,
+                                                              void* base_ctx);
+
+/*!\brief Enable / disable gain map application. With gain map application disabled, uhdr_decode()
+ * decodes the base image and the gain map only, and no hdr rendition is computed or allocated.
+ * This suits clients that apply the gain map themselves, for instance in a shader.
+ * uhdr_get_decoded_image() then returns the base image in the format configured via
+ * uhdr_dec_set_out_img_format(), which shall be #UHDR_IMG_FMT_32bppRGBA8888 or the planar YCbCr
+ * layout the base image is coded in. The output color transfer and display boost settings are
+ * ignored. uhdr_get_decoded_gainmap_image() and uhdr_dec_get_gainmap_metadata() return the gain
+ * map and its metadata as usual.
+ *
+ * NOTE: This cannot be combined with uhdr_dec_set_strip_callback().
+ *
+ * \param[in]  dec  decoder instance.
+ * \param[in]  enable  0 to disable, 1 to enable (default).
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_dec_enable_gainmap_application(uhdr_codec_private_t* dec,
+                                                                  int enable);
+
+/*!\brief Decode the gain map alone. uhdr_decode() then decodes neither the base image nor a final
+ * rendition, uhdr_get_decoded_image() returns nullptr. uhdr_get_decoded_gainmap_image() returns
+ * the gain map, decoded by libjpeg at 1 / scale_denom of its size, and
+ * uhdr_dec_get_gainmap_metadata() its metadata. This serves analysis of the gain map at a
+ * fraction of the work of a full decode. The output settings are ignored.
+ *
+ * NOTE: This cannot be combined with image effects, strip wise output, an output buffer, a base
+ * image callback, further renditions, pyramid levels or gpu output.
+ *
+ * \param[in]  dec  decoder instance.
+ * \param[in]  scale_denom  0 to decode the whole image (default), 1, 2, 4 or 8 to decode the gain
+ *                          map alone at 1 / scale_denom of its size.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_dec_set_gainmap_only_decode(uhdr_codec_private_t* dec,
+                                                               int scale_denom);
+
 /*!\brief Set output image color transfer characteristics. It should be noted that not all
  * combinations of output color format and output transfer function are supported. #UHDR_CT_SRGB
  * output color transfer shall be paired with #UHDR_IMG_FMT_32bppRGBA8888 only. #UHDR_CT_HLG,
- * #UHDR_CT_PQ shall be paired with #UHDR_IMG_FMT_32bppRGBA1010102. #UHDR_CT_LINEAR shall be paired
- * with #UHDR_IMG_FMT_64bppRGBAHalfFloat.
+ * #UHDR_CT_PQ shall be paired with #UHDR_IMG_FMT_32bppRGBA1010102 or #UHDR_IMG_FMT_24bppYCbCrP010.
+ * #UHDR_CT_LINEAR shall be paired with #UHDR_IMG_FMT_64bppRGBAHalfFloat.
  *
  * \param[in]  dec  decoder instance.
  * \param[in]  ct  output color transfer
@@ -666,9 +1520,26 @@ UHDR_EXTERN uhdr_error_info_t uhdr_dec_set_out_img_format(uhdr_codec_private_t*
 UHDR_EXTERN uhdr_error_info_t uhdr_dec_set_out_color_transfer(uhdr_codec_private_t* dec,
                                                               uhdr_color_transfer_t ct);
 
+/*!\brief Set output image color gamut. By default (#UHDR_CG_UNSPECIFIED) the hdr output is in the
+ * color gamut of the base image. Otherwise the output is converted to the configured gamut as part
+ * of gain map application, colors outside of it are clipped. The conversion requires gain map
+ * application and is not available for #UHDR_CT_SRGB output color transfer.
+ *
+ * \param[in]  dec  decoder instance.
+ * \param[in]  cg  output color gamut
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_dec_set_out_color_gamut(uhdr_codec_private_t* dec,
+                                                           uhdr_color_gamut_t cg);
+
 /*!\brief Set output display's HDR capacity. Value MUST be in linear scale. This value determines
  * the weight by which the gain map coefficients are scaled. If no value is configured, no weight is
- * applied to gainmap image.
+ * applied to gainmap image. For #UHDR_CT_SRGB output, the gain map is applied only if a value
+ * greater than 1.0f is configured, and the output is then scaled such that 255 maps to the peak of
+ * the display, i.e. sdr white scaled by the display boost. To follow changes of the capacity
+ * after decoding, see uhdr_dec_rerender().
  *
  * \param[in]  dec  decoder instance.
  * \param[in]  display_boost  hdr capacity of target display. Any real number >= 1.0f
@@ -679,10 +1550,166 @@ UHDR_EXTERN uhdr_error_info_t uhdr_dec_set_out_color_transfer(uhdr_codec_private
 UHDR_EXTERN uhdr_error_info_t uhdr_dec_set_out_max_display_boost(uhdr_codec_private_t* dec,
                                                                  float display_boost);
 
+/*!\brief Add a rendition to the outputs of uhdr_decode(). Besides the final rendition configured
+ * with uhdr_dec_set_out_img_format(), uhdr_dec_set_out_color_transfer() and
+ * uhdr_dec_set_out_max_display_boost(), the decode then renders one more output per call of this
+ * function, for instance pq, hlg and sdr variants of one image. The base image and the gain map
+ * are decoded once for all hdr outputs and once more for all sdr outputs. Packed hdr outputs of the
+ * same effective display boost are rendered in a single pass that computes the linear hdr pixel
+ * once and encodes it for each output. The renditions are read with uhdr_get_decoded_rendition(),
+ * in the order of the calls. The output color gamut applies to all of them.
+ *
+ * Renditions are rendered on the cpu with exact gain map application. They cannot be combined with
+ * image effects, disabled gain map application, strip wise output, a base image callback, gpu
+ * output or a memory limit that the whole image decode exceeds, uhdr_decode() returns
+ * #UHDR_CODEC_INVALID_OPERATION then.
+ *
+ * \param[in]  dec  decoder instance.
+ * \param[in]  fmt  output pixel format, with ct one of the pairs uhdr_dec_set_out_img_format()
+ *                  and uhdr_dec_set_out_color_transfer() accept with gain map application.
+ * \param[in]  ct  output color transfer.
+ * \param[in]  display_boost  hdr capacity of target display, see
+ *                            uhdr_dec_set_out_max_display_boost(). Any real number >= 1.0f
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_dec_add_rendition(uhdr_codec_private_t* dec,
+                                                     uhdr_img_fmt_t fmt,
+                                                     uhdr_color_transfer_t ct,
+                                                     float display_boost);
+
+/*!\brief Add a level to the downscaled outputs of uhdr_decode(), for serving several sizes of one
+ * image. The final rendition is decoded once. With gain map application and no output buffer, it
+ * is decoded at the smallest of 1/2, 1/4 or 1/8 scale that still covers the largest level, see
+ * uhdr_add_effect_resize(), and uhdr_get_decoded_image() returns it at that size. The levels are
+ * resampled from it with filter, largest first and each from the smallest image produced so far
+ * that still covers it. The levels are read with uhdr_get_decoded_pyramid_level(), in the order of
+ * the calls.
+ *
+ * Pyramid levels cannot be combined with image effects, strip wise output, gpu output or
+ * uhdr_dec_add_rendition(), uhdr_decode() returns #UHDR_CODEC_INVALID_OPERATION then. Levels
+ * larger than the image fail uhdr_decode() with #UHDR_CODEC_INVALID_PARAM.
+ *
+ * \param[in]  dec  decoder instance.
+ * \param[in]  width  level width.
+ * \param[in]  height  level height.
+ * \param[in]  filter  resampling filter, see uhdr_add_effect_resize_with_filter().
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_dec_add_pyramid_level(uhdr_codec_private_t* dec, int width,
+                                                         int height, uhdr_resize_filter_t filter);
+
+/*!\brief Set number of threads used for decoding. The count includes the calling thread. Worker
+ * threads are drawn from a pool that is shared by all codec instances of the library and persists
+ * across calls. Default configuration is 0, in which case the library picks a value based on the
+ * number of cores available.
+ *
+ * \param[in]  dec  decoder instance.
+ * \param[in]  num_threads  number of threads. Any integer in range [0, 256]
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_dec_set_num_threads(uhdr_codec_private_t* dec, int num_threads);
+
+/*!\brief Enable/Disable the fast integer idct for decoding the base image and gain map. The fast
+ * idct is quicker at some loss of accuracy, it pairs with #UHDR_USAGE_REALTIME on the encoder
+ * side. Default configuration is the accurate idct.
+ *
+ * \param[in]  dec  decoder instance.
+ * \param[in]  enable  0 to disable (default), 1 to enable.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_dec_enable_fast_idct(uhdr_codec_private_t* dec, int enable);
+
+/*!\brief Enable/Disable the fast chroma upsampling of the base image. When the base image is
+ * decoded to rgb, that is for #UHDR_CT_SRGB output or #UHDR_IMG_FMT_32bppRGBA8888 output without
+ * gain map application, subsampled chroma is replicated instead of filtered, and upsampling and
+ * color conversion run as one pass. Hdr outputs read the subsampled chroma planes directly and are
+ * not affected. Default configuration is the filtered upsampling.
+ *
+ * \param[in]  dec  decoder instance.
+ * \param[in]  enable  0 to disable (default), 1 to enable.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_dec_enable_fast_upsampling(uhdr_codec_private_t* dec,
+                                                              int enable);
+
+/*!\brief Enable/Disable the approximate gain map application. For single channel gain maps, the
+ * mapping from the base image pixel and the gain to the hdr output pixel is then interpolated from
+ * a table built once per output configuration, instead of evaluating the transfer functions per
+ * pixel. Outputs stay within a 10-bit code of the exact ones, except near black. Vector code paths
+ * that compute the exact output faster are still taken where available. On arm64 cores with fp16
+ * vector arithmetic, half float linear output is computed at half precision. Default configuration
+ * is the exact computation.
+ *
+ * \param[in]  dec  decoder instance.
+ * \param[in]  enable  0 to disable (default), 1 to enable.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_dec_enable_approximate_gainmap(uhdr_codec_private_t* dec,
+                                                                  int enable);
+
+/*!\brief Enable/Disable luminance statistics of the hdr output, see uhdr_luminance_stats_t. The
+ * gain map application gathers them from the output rows its threads write, which saves the
+ * application a pass over the decoded image. The statistics cover the pixels of the output, the
+ * alpha channel aside. Gain map application then runs on the cpu. Image effects, further
+ * renditions and gpu output are not supported with statistics, uhdr_decode() returns
+ * #UHDR_CODEC_INVALID_OPERATION then. Default configuration is disabled.
+ *
+ * \param[in]  dec  decoder instance.
+ * \param[in]  enable  0 to disable (default), 1 to enable.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ *                           #UHDR_CODEC_INVALID_OPERATION if the context has sailed,
+ *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_dec_enable_luminance_stats(uhdr_codec_private_t* dec,
+                                                              int enable);
+
+/*!\brief Enable/Disable gpu output. When the gain map application or the effects of a decode run
+ * on the gpu, the final rendition ends up in a GL texture. By default uhdr_decode() reads it back
+ * to memory. With gpu output enabled, the read back is skipped and the texture is made available
+ * via uhdr_get_decoded_texture(), so that a viewer can draw it without a round trip through memory.
+ * uhdr_get_decoded_image() remains usable, it reads the texture back on its first call.
+ *
+ * The decoder renders in an EGL context of its own. If share_ctxt is not nullptr, this context is
+ * created in the share group of share_ctxt, which makes the texture name valid in share_ctxt. The
+ * texture is owned by the decoder and lives until the decoder is reset or released.
+ *
+ * NOTE: This has no effect if gpu acceleration is not enabled, see uhdr_enable_gpu_acceleration(),
+ * if the library is built without gpu support or if an output buffer is set via
+ * uhdr_dec_set_output_buffer().
+ *
+ * \param[in]  dec  decoder instance.
+ * \param[in]  enable  0 to disable (default), 1 to enable.
+ * \param[in]  share_ctxt  EGLContext to share the texture with, may be nullptr.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ *                           #UHDR_CODEC_INVALID_PARAM otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_dec_enable_gpu_output(uhdr_codec_private_t* dec, int enable,
+                                                       void* share_ctxt);
+
 /*!\brief This function parses the bitstream that is registered with the decoder context and makes
  * image information available to the client via uhdr_dec_get_() functions. It does not decompress
  * the image. That is done by uhdr_decode().
  *
+ * NOTE: Only the marker segments up to the start of scan of the base and gain map images are read.
+ * The memory blocks returned by uhdr_dec_get_exif(), uhdr_dec_get_icc(), uhdr_dec_get_base_image()
+ * and uhdr_dec_get_gainmap_image() refer to the bitstream registered with the context and stay
+ * valid until the context is reset or released. The cost of the configured decode is estimated
+ * from the headers, see uhdr_dec_get_cost_estimate(), so the decoder is to be configured first.
+ *
  * \param[in]  dec  decoder instance.
  *
  * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
@@ -763,6 +1790,20 @@ UHDR_EXTERN uhdr_mem_block_t* uhdr_dec_get_gainmap_image(uhdr_codec_private_t* d
  */
 UHDR_EXTERN uhdr_gainmap_metadata_t* uhdr_dec_get_gainmap_metadata(uhdr_codec_private_t* dec);
 
+/*!\brief Get the cost estimate of the decode, for instance to place decode jobs by their expected
+ * memory and compute. Pixel counts scale the cpu time of the decode, the byte counts bound its
+ * image buffers, see #uhdr_decode_cost_t.
+ *
+ * NOTE: The estimate reflects the configuration at the time of uhdr_dec_probe(). A gpu capable
+ * decode may still run on the cpu, if the gpus are busy with other decodes of the process when it
+ * starts.
+ *
+ * \param[in]  dec  decoder instance.
+ *
+ * \return nullptr if probe process call is unsuccessful, cost estimate otherwise
+ */
+UHDR_EXTERN uhdr_decode_cost_t* uhdr_dec_get_cost_estimate(uhdr_codec_private_t* dec);
+
 /*!\brief Decode process call
  * After initializing the decoder context, call to this function will submit data for decoding. If
  * the call is successful, the decoded output is stored internally and is accessible via
@@ -773,19 +1814,63 @@ UHDR_EXTERN uhdr_gainmap_metadata_t* uhdr_dec_get_gainmap_metadata(uhdr_codec_pr
  *   - uhdr_create_decoder().
  * - The program registers input images to the decoder using,
  *   - uhdr_dec_set_image(ctxt, img)
+ *   - or uhdr_dec_set_image_ref(ctxt, img) to decode from the caller's buffer without a copy
+ *   - or, after the settings below, uhdr_dec_push_data() as the image arrives
+ *   - or uhdr_dec_set_image_fd(ctxt, fd) to decode a file from a read-only mapping
  * - The program overrides the default settings using uhdr_dec_set_*() functions.
  * - If the application wants to control the output image format,
  *   - uhdr_dec_set_out_img_format()
  * - If the application wants to control the output transfer characteristics,
  *   - uhdr_dec_set_out_color_transfer()
+ * - If the application wants to control the output color gamut,
+ *   - uhdr_dec_set_out_color_gamut()
  * - If the application wants to control the output display boost,
  *   - uhdr_dec_set_out_max_display_boost()
+ * - If the application wants further renditions from the same decode,
+ *   - uhdr_dec_add_rendition()
+ * - If the application wants the output at several downscaled sizes,
+ *   - uhdr_dec_add_pyramid_level()
+ * - If the application wants to control the number of threads used,
+ *   - uhdr_dec_set_num_threads()
+ * - If the application wants to trade idct accuracy for speed,
+ *   - uhdr_dec_enable_fast_idct()
+ * - If the application wants to trade chroma upsampling quality for speed,
+ *   - uhdr_dec_enable_fast_upsampling()
+ * - If the application wants to trade gain map application accuracy for speed,
+ *   - uhdr_dec_enable_approximate_gainmap()
+ * - If the application wants luminance statistics of the output for its own tone mapping,
+ *   - uhdr_dec_enable_luminance_stats(), uhdr_dec_get_luminance_stats()
+ * - If the application wants to dispatch parallel work through its own scheduler,
+ *   - uhdr_set_parallel_executor()
+ * - If the application wants the work placed on performance or efficiency cores
+ *   - uhdr_set_core_affinity()
+ * - If the application wants to abort the decode on request or past a deadline,
+ *   - uhdr_set_cancel_flag(), uhdr_set_deadline()
+ * - If the application wants to receive the output in strips of rows instead of a whole image,
+ *   - uhdr_dec_set_strip_callback()
+ * - If the application wants to bound the memory of the decode,
+ *   - uhdr_dec_set_memory_limit()
+ * - If the application wants to share one configuration across the decoders of its requests,
+ *   - uhdr_create_decoder_profile(), uhdr_dec_set_profile()
+ * - If the application wants to receive the sdr base image ahead of the final rendition,
+ *   - uhdr_dec_set_base_image_callback()
+ * - If the application wants the base image and gain map without the gain map applied,
+ *   - uhdr_dec_enable_gainmap_application()
+ * - If the application wants the gain map alone, without decoding the base image,
+ *   - uhdr_dec_set_gainmap_only_decode()
  * - If the application wants to enable/disable gpu acceleration,
  *   - uhdr_enable_gpu_acceleration()
+ * - If the application wants to keep the final rendition on the gpu,
+ *   - uhdr_dec_enable_gpu_output()
  * - The program calls uhdr_decode() to decode uhdr stream. This call would initiate the process
  * of decoding base image and gain map image. These two are combined to give the final rendition
  * image.
- * - The program can access the decoded output with uhdr_get_decoded_image().
+ * - The program can access the decoded output with uhdr_get_decoded_image(), or with
+ * uhdr_get_decoded_texture() if gpu output is enabled.
+ * - Instead of or besides uhdr_decode(), the program can render regions of the final rendition
+ * as they are needed with uhdr_dec_render_region().
+ * - If the display boost changes after decoding, the program can update the output with
+ * uhdr_dec_rerender().
  * - The program finishes the decoding with uhdr_release_decoder().
  *
  * \param[in]  dec  decoder instance.
@@ -794,6 +1879,91 @@ UHDR_EXTERN uhdr_gainmap_metadata_t* uhdr_dec_get_gainmap_metadata(uhdr_codec_pr
  */
 UHDR_EXTERN uhdr_error_info_t uhdr_decode(uhdr_codec_private_t* dec);
 
+/*!\brief Decode a batch of images. Each decoder is configured as for uhdr_decode(), the images
+ * are then decoded concurrently on the library thread pool, largest first. A decoder whose number
+ * of threads is left at its default decodes its image on a single thread, as the images of the
+ * batch rather than the rows of an image are spread across the cores. On a NUMA host each image
+ * stays on one node, see uhdr_enable_numa_placement(). Callbacks of the decoders may run on pool
+ * threads.
+ *
+ * The outputs are accessed per decoder as after uhdr_decode(), and uhdr_decode() of a decoder of
+ * the batch returns its own status.
+ *
+ * \param[in]  decs  decoder instances, each at most once.
+ * \param[in]  count  number of decoder instances.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if all images are decoded, the status of the first
+ * failing decoder in array order otherwise. #UHDR_CODEC_INVALID_PARAM if the list is invalid, in
+ * which case no image is decoded.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_decode_batch(uhdr_codec_private_t** decs, unsigned int count);
+
+/*!\brief Decode asynchronously. Queues uhdr_decode() of the decoder on the library thread pool
+ * and returns without waiting for it. Once the decode has finished, on_done (if not nullptr) is
+ * invoked on a pool thread with the status of the decode. The callback may release the decoder.
+ *
+ * The usage restrictions of uhdr_encode_async() apply to the decoder likewise.
+ *
+ * \param[in]  dec  decoder instance.
+ * \param[in]  on_done  completion callback, can be nullptr.
+ * \param[in]  user_ctx  passed to the callback as is.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if the decode is queued, #UHDR_CODEC_INVALID_PARAM for
+ * an invalid decoder, #UHDR_CODEC_INVALID_OPERATION if an asynchronous call is already in flight.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_decode_async(uhdr_codec_private_t* dec,
+                                                uhdr_completion_fn_t on_done, void* user_ctx);
+
+/*!\brief Render a region of the final rendition on demand, for viewers that show a part of the
+ * image at a time. The base image and the gain map are decoded on the first call and kept, each
+ * call then applies the gain map over the requested region alone. The output format, color
+ * transfer and color gamut are the ones configured for uhdr_decode(), the display boost is given
+ * per call.
+ *
+ * Rendered regions are cached, a call for a region and display boost rendered before returns the
+ * earlier rendition without recomputing it. The cache holds at most the 32 most recently used
+ * regions and 64 MiB of them, the least recently used ones are dropped to make room. A region
+ * larger than that is kept alone until the next call. With a memory limit set, see
+ * uhdr_dec_set_memory_limit(), the decoded base image and gain map and the cached regions count
+ * against it. The call then fails with #UHDR_CODEC_MEM_ERROR if the base image, the gain map and
+ * the new region alone exceed the limit.
+ *
+ * The call is independent of uhdr_decode(), either or both can be used on a decoder. Image
+ * effects are not supported.
+ *
+ * \param[in]  dec  decoder instance.
+ * \param[in]  x  left edge of the region in pixels of the base image.
+ * \param[in]  y  top edge of the region in pixels of the base image.
+ * \param[in]  w  width of the region, the region must lie within the image.
+ * \param[in]  h  height of the region. All four must be even for #UHDR_IMG_FMT_24bppYCbCrP010
+ *                output.
+ * \param[in]  display_boost  maximum available boost of the display, >= 1.0f.
+ * \param[out]  region  receives the rendered region. It is owned by the decoder and stays valid
+ *                     until it drops out of the cache or the decoder is reset or released.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_dec_render_region(uhdr_codec_private_t* dec, int x, int y,
+                                                     int w, int h, float display_boost,
+                                                     uhdr_raw_image_t** region);
+
+/*!\brief Re-render the final rendition for another display boost, e.g. when the brightness of
+ * the display changes. Only the gain map application is repeated, with the weight of the new
+ * boost. The base image and the gain map decoded by uhdr_decode() are kept by the decoder on the
+ * first call, the jpeg images are not decoded again. The output of uhdr_get_decoded_image() is
+ * updated in place.
+ *
+ * Requires a successful uhdr_decode() of the whole image with the gain map applied. Image
+ * effects, gpu output and downscaled decodes are not supported.
+ *
+ * \param[in]  dec  decoder instance.
+ * \param[in]  display_boost  hdr capacity of target display. Any real number >= 1.0f
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise. If
+ * the gain map application fails, uhdr_get_decoded_image() returns nullptr afterwards.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_dec_rerender(uhdr_codec_private_t* dec, float display_boost);
+
 /*!\brief Get final rendition image
  *
  * \param[in]  dec  decoder instance.
@@ -810,6 +1980,150 @@ UHDR_EXTERN uhdr_raw_image_t* uhdr_get_decoded_image(uhdr_codec_private_t* dec);
  */
 UHDR_EXTERN uhdr_raw_image_t* uhdr_get_decoded_gainmap_image(uhdr_codec_private_t* dec);
 
+/*!\brief Take the final rendition image out of the decoder. The caller owns the image and its
+ * planes afterwards and releases them with uhdr_release_raw_image(), the pixels are not copied.
+ * The image outlives the decoder, including reset and release. Its memory is released to the
+ * allocator of uhdr_set_allocator() if one was set when it was decoded, so that allocator must
+ * stay usable until then. uhdr_get_decoded_image() returns nullptr afterwards, and the next decode
+ * allocates a new image.
+ *
+ * An image decoded into the buffer of uhdr_dec_set_output_buffer() is the caller's already, the
+ * taken descriptor refers to that buffer and releasing it leaves the buffer alone.
+ *
+ * \param[in]  dec  decoder instance.
+ *
+ * \return nullptr if decoded process call is unsuccessful or the image was taken already, raw image
+ * descriptor otherwise
+ */
+UHDR_EXTERN uhdr_raw_image_t* uhdr_take_decoded_image(uhdr_codec_private_t* dec);
+
+/*!\brief Take the gain map image out of the decoder, see uhdr_take_decoded_image()
+ *
+ * \param[in]  dec  decoder instance.
+ *
+ * \return nullptr if decoded process call is unsuccessful or the gain map was taken already, raw
+ * image descriptor otherwise
+ */
+UHDR_EXTERN uhdr_raw_image_t* uhdr_take_decoded_gainmap_image(uhdr_codec_private_t* dec);
+
+/*!\brief Release an image taken out of a decoder
+ *
+ * \param[in]  img  image returned by uhdr_take_decoded_image() or
+ *                  uhdr_take_decoded_gainmap_image(), may be nullptr.
+ *
+ * \return none
+ */
+UHDR_EXTERN void uhdr_release_raw_image(uhdr_raw_image_t* img);
+
+/*!\brief Get a rendition added with uhdr_dec_add_rendition()
+ *
+ * \param[in]  dec  decoder instance.
+ * \param[in]  index  position of the rendition among the uhdr_dec_add_rendition() calls.
+ *
+ * \return nullptr if decoded process call is unsuccessful or index is out of range, raw image
+ * descriptor otherwise
+ */
+UHDR_EXTERN uhdr_raw_image_t* uhdr_get_decoded_rendition(uhdr_codec_private_t* dec,
+                                                         unsigned int index);
+
+/*!\brief Get a pyramid level added with uhdr_dec_add_pyramid_level()
+ *
+ * \param[in]  dec  decoder instance.
+ * \param[in]  index  position of the level among the uhdr_dec_add_pyramid_level() calls.
+ *
+ * \return nullptr if decoded process call is unsuccessful or index is out of range, raw image
+ * descriptor otherwise
+ */
+UHDR_EXTERN uhdr_raw_image_t* uhdr_get_decoded_pyramid_level(uhdr_codec_private_t* dec,
+                                                             unsigned int index);
+
+/*!\brief Get figures of the last decode call, see uhdr_enable_stats()
+ *
+ * \param[in]  dec  decoder instance.
+ *
+ * \return nullptr if stats are disabled or no decode call has been made since reset, stats
+ * descriptor otherwise. The call status does not matter, a failed call reports its stages up to
+ * the failure.
+ */
+UHDR_EXTERN uhdr_codec_stats_t* uhdr_dec_get_stats(uhdr_codec_private_t* dec);
+
+/*!\brief Get luminance statistics of the output of the last decode call, see
+ * uhdr_dec_enable_luminance_stats()
+ *
+ * \param[in]  dec  decoder instance.
+ *
+ * \return nullptr if statistics are disabled, the decode call is unsuccessful or it applied no
+ * gain map, i.e. for sdr output without a display boost or with gain map application disabled,
+ * statistics descriptor otherwise
+ */
+UHDR_EXTERN uhdr_luminance_stats_t* uhdr_dec_get_luminance_stats(uhdr_codec_private_t* dec);
+
+/*!\brief Get final rendition texture, see uhdr_dec_enable_gpu_output(). The texture is a
+ * GL_TEXTURE_2D holding the image of uhdr_get_decoded_image(), with its first row at t = 0.
+ *
+ * \param[in]  dec  decoder instance.
+ * \param[out]  width  width of the texture, may be nullptr.
+ * \param[out]  height  height of the texture, may be nullptr.
+ * \param[out]  fmt  pixel format of the texture contents, may be nullptr.
+ *
+ * \return 0 if decoded process call is unsuccessful or the final rendition is not on the gpu, GL
+ * texture name otherwise
+ */
+UHDR_EXTERN unsigned int uhdr_get_decoded_texture(uhdr_codec_private_t* dec, unsigned int* width,
+                                                  unsigned int* height, uhdr_img_fmt_t* fmt);
+
+/*!\brief Transcode process call
+ * Applies the effects added to the decoder context to the compressed ultrahdr image without
+ * decoding it, and stores the result as a new compressed ultrahdr image that is accessible via
+ * uhdr_get_transcoded_image(). The quantized coefficients of the base image and the gain map are
+ * rearranged in place of the pixels, so there is no generation loss and no pixel round trip. The
+ * xmp, iso 21496-1 and mpf segments are rewritten for the new layout, the gain map metadata, exif
+ * and icc are kept.
+ *
+ * Only rotate, mirror and crop effects are supported. They must move whole blocks of both
+ * images: the left and top edges of a crop, the right edge of an image that is mirrored
+ * horizontally or rotated by 180 or 270 degrees and the bottom edge of an image that is mirrored
+ * vertically or rotated by 90 or 180 degrees must lie on mcu boundaries (16 pixels for a 4:2:0
+ * base image). Crops are mapped onto the gain map as in uhdr_decode(). Other effects or edges
+ * fail with #UHDR_CODEC_UNSUPPORTED_FEATURE, uhdr_decode() followed by an encode handles them.
+ *
+ * A decoder context either decodes or transcodes, it needs a reset in between.
+ *
+ * \param[in]  dec  decoder instance.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_transcode(uhdr_codec_private_t* dec);
+
+/*!\brief Gain map metadata rewrite process call
+ * Replaces the gain map metadata of the compressed ultrahdr image with \p metadata, for instance
+ * to adjust hdr_capacity_max or the offsets of a stored image, and stores the result as a new
+ * compressed ultrahdr image that is accessible via uhdr_get_transcoded_image(). Only the xmp,
+ * iso 21496-1 and mpf segments are regenerated, the other segments and the entropy coded data of
+ * the base image and the gain map are copied byte for byte. Nothing is decoded or re-encoded.
+ * Properties of other namespaces in the xmp packet of the base image, a rating or a creator for
+ * instance, are kept, only its gain map properties and container directory are replaced.
+ *
+ * Effects are not applied, the call fails with #UHDR_CODEC_INVALID_OPERATION if any are added.
+ * As with uhdr_transcode(), the context needs a reset before it decodes.
+ *
+ * \param[in]  dec  decoder instance.
+ * \param[in]  metadata  new gain map metadata.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, uhdr_codec_err_t otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_rewrite_gainmap_metadata(uhdr_codec_private_t* dec,
+                                                            uhdr_gainmap_metadata_t* metadata);
+
+/*!\brief Get transcoded image
+ *
+ * \param[in]  dec  decoder instance.
+ *
+ * \return nullptr if transcode process call is unsuccessful, compressed image descriptor
+ * otherwise
+ */
+UHDR_EXTERN uhdr_compressed_image_t* uhdr_get_transcoded_image(uhdr_codec_private_t* dec);
+
 /*!\brief Reset decoder instance.
  * Clears all previous settings and resets to default state and ready for re-initialization and
  * usage
@@ -824,9 +2138,30 @@ UHDR_EXTERN void uhdr_reset_decoder(uhdr_codec_private_t* dec);
 // Common APIs
 // ===============================================================================================
 
+/*!\brief Wait for the asynchronous encode/decode of a codec, see uhdr_encode_async(). Returns
+ * once the operation has finished, its completion callback may still be running.
+ *
+ * \param[in]  codec  codec instance.
+ *
+ * \return uhdr_error_info_t status of the last encode/decode of the codec,
+ * #UHDR_CODEC_INVALID_PARAM for an invalid codec.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_wait(uhdr_codec_private_t* codec);
+
+/*!\brief Poll the asynchronous encode/decode of a codec, see uhdr_encode_async().
+ *
+ * \param[in]  codec  codec instance.
+ *
+ * \return 1 if an asynchronous encode/decode is in flight, 0 otherwise.
+ */
+UHDR_EXTERN int uhdr_is_busy(uhdr_codec_private_t* codec);
+
 /*!\brief Enable/Disable GPU acceleration.
  * If enabled, certain operations (if possible) of uhdr encode/decode will be offloaded to GPU.
  * NOTE: It is entirely possible for this API to have no effect on the encode/decode operation
+ * NOTE: The decoders of a process share the gpu. A decode of a small image, or one that finds the
+ * gpu busy with other decoders, runs on the cpu instead, unless gpu output is enabled, see
+ * uhdr_dec_enable_gpu_output().
  *
  * \param[in]  codec  codec instance.
  * \param[in]  enable  enable enable/disbale gpu acceleration
@@ -836,6 +2171,229 @@ UHDR_EXTERN void uhdr_reset_decoder(uhdr_codec_private_t* dec);
  */
 UHDR_EXTERN uhdr_error_info_t uhdr_enable_gpu_acceleration(uhdr_codec_private_t* codec, int enable);
 
+/*!\brief Set the directory of the gpu program cache. The shader programs of gpu acceleration are
+ * compiled once per process and shared by all codec instances. With a cache directory set, their
+ * binaries are also stored there, so that later processes load them instead of compiling them.
+ * Stale binaries, for instance after a driver update, are detected and replaced. The setting
+ * applies to the process, not to a codec instance, and has no effect without gpu support.
+ *
+ * \param[in]  dir  path of an existing directory writable by the process, nullptr to disable
+ *                  (default).
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_set_gpu_program_cache_dir(const char* dir);
+
+/*!\brief Do the one time setup of the library ahead of the first encode/decode, so that it runs at
+ * steady state speed. Otherwise the first call builds the process wide tables, spawns the threads
+ * of the library-owned pool, and with gpu acceleration, creates an egl context and compiles shader
+ * programs. The work is done on the calling thread, the function is meant to be called from a
+ * background thread at startup and may run concurrently with encodes/decodes. Contexts and
+ * programs are shared by all codec instances of the process, so set the cache directory of
+ * uhdr_set_gpu_program_cache_dir() first if one is used. Without gpu support, #UHDR_PRELOAD_GPU
+ * has no effect.
+ *
+ * \param[in]  flags  or'ed #uhdr_preload_flag_t values, #UHDR_PRELOAD_ALL for all of them.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, #UHDR_CODEC_INVALID_PARAM for
+ * unknown flags, #UHDR_CODEC_ERROR if the gpu setup fails.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_preload(int flags);
+
+/*!\brief Set receiver of trace slices. The encode and decode stages, jpeg compression and
+ * decompression and the gpu passes are traced as named slices. Without a receiver they go to
+ * ATrace on Android and nowhere elsewhere. The setting applies to the process, not to a codec
+ * instance, and is to be changed while no encode/decode call is in flight.
+ *
+ * NOTE: Slices are only emitted if the library is built with UHDR_ENABLE_TRACING.
+ *
+ * \param[in]  trace_fn  receiver of slices, nullptr to restore the default (default).
+ * \param[in]  trace_ctx  opaque pointer passed back as the first argument of trace_fn.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds,
+ * #UHDR_CODEC_UNSUPPORTED_FEATURE if the library is built without tracing.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_set_trace_callback(uhdr_trace_fn_t trace_fn, void* trace_ctx);
+
+/*!\brief Set external executor. By default, the library parallelizes encode/decode stages using a
+ * thread pool that it owns. If an executor is registered, these stages are instead dispatched
+ * through parallel_for. Each job pulls work from a shared queue, so the executor is free to run
+ * the jobs of a call with any degree of concurrency, including sequentially on the calling thread.
+ * A job may itself call parallel_for, for instance when the base image and the gain map are
+ * processed concurrently, so the executor must not block on nested calls.
+ * The number of jobs per call is governed by uhdr_enc_set_num_threads() /
+ * uhdr_dec_set_num_threads(). Passing nullptr for parallel_for restores the default behavior.
+ *
+ * \param[in]  codec  codec instance.
+ * \param[in]  parallel_for  executor callback
+ * \param[in]  executor_ctx  opaque pointer passed back as the first argument of parallel_for
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, #UHDR_CODEC_INVALID_PARAM
+ * otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_set_parallel_executor(uhdr_codec_private_t* codec,
+                                                         uhdr_parallel_for_fn_t parallel_for,
+                                                         void* executor_ctx);
+
+/*!\brief Set allocator for the image buffers of this context. Input copies, intermediate images
+ * (tonemapped sdr intent, gain map, color converted copies, effect outputs) and output images are
+ * drawn from alloc_fn and returned through free_fn. Passing nullptr for both restores the default
+ * heap. Unlike other settings, this persists across uhdr_reset_encoder() / uhdr_reset_decoder().
+ *
+ * \param[in]  codec  codec instance.
+ * \param[in]  alloc_fn  allocation callback
+ * \param[in]  free_fn  release callback
+ * \param[in]  alloc_ctx  opaque pointer passed back as the first argument of both callbacks
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, #UHDR_CODEC_INVALID_PARAM
+ * otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_set_allocator(uhdr_codec_private_t* codec,
+                                                 uhdr_alloc_fn_t alloc_fn, uhdr_free_fn_t free_fn,
+                                                 void* alloc_ctx);
+
+/*!\brief Set jpeg codec backend, for instance a hardware jpeg block. The base image and the gain
+ * map of encodes and decodes are offered to the backend first and handled by libjpeg if it
+ * declines them. Only whole images are offered, strip wise, region and scaled decodes and
+ * streamed gain map rows stay with libjpeg. Icc and gain map markers are added by the library
+ * around the bitstream of the backend. The callbacks may be called concurrently for the base
+ * image and the gain map. Passing nullptr restores libjpeg. Like uhdr_set_allocator(), this
+ * persists across uhdr_reset_encoder() / uhdr_reset_decoder().
+ *
+ * \param[in]  codec  codec instance.
+ * \param[in]  backend  jpeg codec backend, copied by the call
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, #UHDR_CODEC_INVALID_PARAM
+ * otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_set_jpeg_backend(uhdr_codec_private_t* codec,
+                                                    const uhdr_jpeg_backend_t* backend);
+
+/*!\brief Create a jpeg codec backend that runs on an nvidia gpu through nvJPEG, for
+ * uhdr_set_jpeg_backend(). Baseline images of the subsamplings 4:0:0, 4:2:0, 4:2:2 and 4:4:4 are
+ * coded on the device, others are declined and left to libjpeg. One backend may be set on any
+ * number of codec contexts, which take turns on the device. It must outlive them.
+ *
+ * \return backend, nullptr if the library is built without nvJPEG support or no cuda device is
+ * present.
+ */
+UHDR_EXTERN uhdr_jpeg_backend_t* uhdr_create_nvjpeg_backend(void);
+
+/*!\brief Release a backend of uhdr_create_nvjpeg_backend()
+ *
+ * \param[in]  backend  backend, may be nullptr.
+ *
+ * \return none
+ */
+UHDR_EXTERN void uhdr_release_nvjpeg_backend(uhdr_jpeg_backend_t* backend);
+
+/*!\brief Set the cores the encode/decode stages of this context run on. On heterogeneous cpus
+ * (big.LITTLE and the like) #UHDR_CORES_PERFORMANCE pins the threads of each parallel stage to the
+ * cores of highest capacity and uses up to one thread per such core. #UHDR_CORES_EFFICIENCY pins
+ * them to the cores of lowest capacity and uses at most two threads, which suits background work
+ * such as gallery indexing. A thread is pinned only while it runs a stage of the call, its previous
+ * placement is restored afterwards. An explicit uhdr_enc_set_num_threads() /
+ * uhdr_dec_set_num_threads() count is kept as is. Core types are read from the cpu capacities
+ * exposed by Linux and Android, elsewhere and on cpus of a single core type the setting has no
+ * effect, neither does it with an external executor of uhdr_set_parallel_executor(). Like
+ * uhdr_set_allocator(), this persists across uhdr_reset_encoder() / uhdr_reset_decoder().
+ *
+ * \param[in]  codec  codec instance.
+ * \param[in]  affinity  core type, #UHDR_CORES_ANY by default
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, #UHDR_CODEC_INVALID_PARAM
+ * otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_set_core_affinity(uhdr_codec_private_t* codec,
+                                                     uhdr_core_affinity_t affinity);
+
+/*!\brief Enable/Disable memory arena. When enabled, image buffers released by the context are
+ * kept in a per context pool and reused by later requests of similar size instead of being
+ * returned to the allocator. On uhdr_reset_encoder() / uhdr_reset_decoder() every buffer held by
+ * the context goes back to the pool, so a context that is reset and reused for a batch of images
+ * reaches a steady state without further heap traffic. Pooled memory is released when the arena
+ * is disabled or the context is destroyed. Setting persists across reset. Default is disabled.
+ *
+ * \param[in]  codec  codec instance.
+ * \param[in]  enable  enable/disable memory arena
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, #UHDR_CODEC_INVALID_PARAM
+ * otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_enable_memory_arena(uhdr_codec_private_t* codec, int enable);
+
+/*!\brief Enable/Disable huge pages for large image buffers. When enabled, image buffers of the
+ * default heap of at least 16 MiB are mapped from huge pages, which cuts the tlb misses of
+ * passes over large images. Explicit huge pages are used where the system has reserved them,
+ * transparent huge pages otherwise. Has no effect outside of Linux and for buffers of an
+ * allocator of uhdr_set_allocator(). Setting persists across reset. Default is disabled.
+ *
+ * \param[in]  codec  codec instance.
+ * \param[in]  enable  enable/disable huge pages
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, #UHDR_CODEC_INVALID_PARAM
+ * otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_enable_huge_pages(uhdr_codec_private_t* codec, int enable);
+
+/*!\brief Enable/Disable NUMA placement of batches. On hosts of more than one NUMA node, the
+ * workers of uhdr_encode_batch() / uhdr_decode_batch() are spread across the nodes. An image of a
+ * context with NUMA placement enabled is processed by a worker pinned to its node, so that the
+ * intermediate buffers of the image are allocated on that node and the row jobs of the image,
+ * if any, stay on it. Buffers kept by the memory arena across calls keep the node they were first
+ * used on. Has no effect on a host of a single node or outside of Linux. Setting persists across
+ * reset. Default is enabled.
+ *
+ * \param[in]  codec  codec instance.
+ * \param[in]  enable  enable/disable NUMA placement
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, #UHDR_CODEC_INVALID_PARAM
+ * otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_enable_numa_placement(uhdr_codec_private_t* codec, int enable);
+
+/*!\brief Enable/Disable collection of timing and memory figures. When enabled, each uhdr_encode() /
+ * uhdr_decode() call records the wall clock and cpu time of the call and of its stages, the
+ * number of worker threads and the image buffer memory it used, retrievable with
+ * uhdr_enc_get_stats() / uhdr_dec_get_stats(). Memory of the jpeg library itself is not counted.
+ * Setting persists across reset. Default is disabled.
+ *
+ * \param[in]  codec  codec instance.
+ * \param[in]  enable  enable/disable stats collection
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, #UHDR_CODEC_INVALID_PARAM
+ * otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_enable_stats(uhdr_codec_private_t* codec, int enable);
+
+/*!\brief Set cancel flag. An encode or decode call stops once *flag becomes non zero, which the
+ * application may do from any thread, for instance when the client of a request disconnects. The
+ * flag is polled between row jobs of the parallel stages and between scanlines of the jpeg coder,
+ * so the threads of the call are freed shortly after. A stopped call returns
+ * #UHDR_CODEC_CANCELLED and leaves no output. The flag is read, never written, and must stay valid
+ * until the call returns. Passing nullptr removes the flag. Default is nullptr.
+ *
+ * \param[in]  codec  codec instance.
+ * \param[in]  flag  cancel flag
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, #UHDR_CODEC_INVALID_PARAM
+ * otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_set_cancel_flag(uhdr_codec_private_t* codec, const int* flag);
+
+/*!\brief Set deadline. An encode or decode call that runs longer than timeout_ms milliseconds is
+ * stopped as with uhdr_set_cancel_flag() and returns #UHDR_CODEC_CANCELLED. The time is measured
+ * from the start of each call. 0 disables the deadline. Default is 0.
+ *
+ * \param[in]  codec  codec instance.
+ * \param[in]  timeout_ms  time budget of a call in milliseconds
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, #UHDR_CODEC_INVALID_PARAM
+ * otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_set_deadline(uhdr_codec_private_t* codec,
+                                                unsigned int timeout_ms);
+
 /*!\brief Add image editing operations (pre-encode or post-decode).
  * Below functions list the set of edits supported. Program can set any combination of these during
  * initialization. Once the encode/decode process call is made, before encoding or after decoding
@@ -867,6 +2425,10 @@ UHDR_EXTERN uhdr_error_info_t uhdr_add_effect_mirror(uhdr_codec_private_t* codec
 UHDR_EXTERN uhdr_error_info_t uhdr_add_effect_rotate(uhdr_codec_private_t* codec, int degrees);
 
 /*!\brief Add crop effect
+ *
+ * NOTE: For a decoder, a crop that is the first effect in the list is applied during decode (when
+ * not using the gpu): only the cropped region of the base image is decoded and rendered, which
+ * saves time and memory for small regions of large images.
  *
  * \param[in]  codec  codec instance.
  * \param[in]  left  crop coordinate left in pixels.
@@ -881,6 +2443,10 @@ UHDR_EXTERN uhdr_error_info_t uhdr_add_effect_crop(uhdr_codec_private_t* codec,
                                                    int top, int bottom);
 
 /*!\brief Add resize effect
+ *
+ * NOTE: For a decoder, a resize that is the first effect in the list (when not using the gpu)
+ * starts from an image decoded at 1/2, 1/4 or 1/8 scale if that still covers the target size.
+ * Thumbnails thus cost a fraction of a full resolution decode.
  *
  * \param[in]  codec  codec instance.
  * \param[in]  width  target width.
@@ -892,4 +2458,26 @@ UHDR_EXTERN uhdr_error_info_t uhdr_add_effect_crop(uhdr_codec_private_t* codec,
 UHDR_EXTERN uhdr_error_info_t uhdr_add_effect_resize(uhdr_codec_private_t* codec, int width,
                                                      int height);
 
+/*!\brief Add resize effect with a resampling filter
+ *
+ * Same as uhdr_add_effect_resize(), which uses #UHDR_RESIZE_NEAREST. The other filters blend
+ * neighbouring samples, are applied separably and widen their support by the scale factor when
+ * downscaling. The base image and the gain map are resampled with the same filter. On encode,
+ * an effect list with such a resize runs as one resample of each intent, and with an sdr intent
+ * and a fixed gain map scale factor, the hdr intent is resampled straight to the gain map size.
+ *
+ * NOTE: The gpu path resizes with its own shader and ignores the filter.
+ *
+ * \param[in]  codec  codec instance.
+ * \param[in]  width  target width.
+ * \param[in]  height  target height.
+ * \param[in]  filter  resampling filter.
+ *
+ * \return uhdr_error_info_t #UHDR_CODEC_OK if operation succeeds, #UHDR_CODEC_INVALID_PARAM
+ * otherwise.
+ */
+UHDR_EXTERN uhdr_error_info_t uhdr_add_effect_resize_with_filter(uhdr_codec_private_t* codec,
+                                                                 int width, int height,
+                                                                 uhdr_resize_filter_t filter);
+
 #endif  // ULTRAHDR_API_H
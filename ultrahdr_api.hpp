@@ -0,0 +1,298 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** \file ultrahdr_api.hpp
+ *
+ *  \brief
+ *  C++ layer over ultrahdr_api.h. Header only, it adds no symbols to the library.
+ *
+ *  Codec contexts and images taken out of a decoder are held by move-only classes that release
+ *  them on destruction. Calls return uhdr_error_info_t as the C api does, memory handed out by the
+ *  library is seen through Span, which does not own it.
+ */
+
+#ifndef ULTRAHDR_API_HPP
+#define ULTRAHDR_API_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include "ultrahdr_api.h"
+
+namespace uhdr {
+
+/*!\brief View of count elements of T at data, not owned */
+template <typename T>
+class Span {
+ public:
+  constexpr Span() = default;
+  constexpr Span(T* data, size_t count) : mData(data), mCount(count) {}
+
+  constexpr T* data() const { return mData; }
+  constexpr size_t size() const { return mCount; }
+  constexpr bool empty() const { return mCount == 0; }
+  constexpr T* begin() const { return mData; }
+  constexpr T* end() const { return mData + mCount; }
+  constexpr T& operator[](size_t i) const { return mData[i]; }
+
+ private:
+  T* mData = nullptr;
+  size_t mCount = 0;
+};
+
+/*!\brief Bytes of plane p of img, from the start of its first row to the end of the samples of its
+ * last row. Empty for planes the format does not have. */
+inline Span<uint8_t> planeBytes(const uhdr_raw_image_t* img, int p) {
+  if (img == nullptr || p < UHDR_PLANE_Y || p > UHDR_PLANE_V || img->planes[p] == nullptr ||
+      img->w == 0 || img->h == 0) {
+    return {};
+  }
+  // bytes per sample, samples per pixel and the subsampling of the plane
+  size_t bps = 1, spp = 1, div_x = 1, div_y = 1;
+  bool packed = false, semiplanar = false;
+  switch (img->fmt) {
+    case UHDR_IMG_FMT_32bppRGBA8888:
+    case UHDR_IMG_FMT_32bppRGBA1010102:
+      bps = 4, packed = true;
+      break;
+    case UHDR_IMG_FMT_64bppRGBAHalfFloat:
+      bps = 8, packed = true;
+      break;
+    case UHDR_IMG_FMT_24bppRGB888:
+      bps = 3, packed = true;
+      break;
+    case UHDR_IMG_FMT_8bppYCbCr400:
+      packed = true;
+      break;
+    case UHDR_IMG_FMT_24bppYCbCrP010:
+      bps = 2, semiplanar = true;
+      if (p == UHDR_PLANE_UV) spp = 2, div_x = 2, div_y = 2;
+      break;
+    case UHDR_IMG_FMT_30bppYCbCr444:
+      bps = 2;
+      break;
+    case UHDR_IMG_FMT_12bppYCbCr420:
+      if (p != UHDR_PLANE_Y) div_x = 2, div_y = 2;
+      break;
+    case UHDR_IMG_FMT_16bppYCbCr422:
+      if (p != UHDR_PLANE_Y) div_x = 2;
+      break;
+    case UHDR_IMG_FMT_16bppYCbCr440:
+      if (p != UHDR_PLANE_Y) div_y = 2;
+      break;
+    case UHDR_IMG_FMT_12bppYCbCr411:
+      if (p != UHDR_PLANE_Y) div_x = 4;
+      break;
+    case UHDR_IMG_FMT_10bppYCbCr410:
+      if (p != UHDR_PLANE_Y) div_x = 4, div_y = 2;
+      break;
+    case UHDR_IMG_FMT_24bppYCbCr444:
+      break;
+    default:
+      return {};
+  }
+  if ((packed && p != UHDR_PLANE_PACKED) || (semiplanar && p > UHDR_PLANE_UV)) return {};
+  const size_t rows = (img->h + div_y - 1) / div_y;
+  const size_t row_bytes = (img->w + div_x - 1) / div_x * spp * bps;
+  const size_t stride_bytes = (size_t)img->stride[p] * bps;
+  return {static_cast<uint8_t*>(img->planes[p]), (rows - 1) * stride_bytes + row_bytes};
+}
+
+/*!\brief Image taken out of a decoder, see Decoder::takeImage(). Owns its planes, which are not
+ * tied to the decoder and stay valid across its reset and release. */
+class Image {
+ public:
+  Image() = default;
+  /*!\brief Takes ownership of img, as returned by uhdr_take_decoded_image() */
+  explicit Image(uhdr_raw_image_t* img) : mImg(img) {}
+  ~Image() { uhdr_release_raw_image(mImg); }
+
+  Image(Image&& other) noexcept : mImg(std::exchange(other.mImg, nullptr)) {}
+  Image& operator=(Image&& other) noexcept {
+    if (this != &other) {
+      uhdr_release_raw_image(mImg);
+      mImg = std::exchange(other.mImg, nullptr);
+    }
+    return *this;
+  }
+  Image(const Image&) = delete;
+  Image& operator=(const Image&) = delete;
+
+  explicit operator bool() const { return mImg != nullptr; }
+  uhdr_raw_image_t* get() const { return mImg; }
+  const uhdr_raw_image_t* operator->() const { return mImg; }
+
+  /*!\brief Hands the image over to the caller, who releases it with uhdr_release_raw_image() */
+  uhdr_raw_image_t* release() { return std::exchange(mImg, nullptr); }
+
+  Span<uint8_t> plane(int p) const { return planeBytes(mImg, p); }
+
+ private:
+  uhdr_raw_image_t* mImg = nullptr;
+};
+
+/*!\brief Owner of a decoder context. A moved from Decoder holds no context, its calls fail with
+ * #UHDR_CODEC_INVALID_PARAM. */
+class Decoder {
+ public:
+  Decoder() : mDec(uhdr_create_decoder()) {}
+  ~Decoder() { uhdr_release_decoder(mDec); }
+
+  Decoder(Decoder&& other) noexcept : mDec(std::exchange(other.mDec, nullptr)) {}
+  Decoder& operator=(Decoder&& other) noexcept {
+    if (this != &other) {
+      uhdr_release_decoder(mDec);
+      mDec = std::exchange(other.mDec, nullptr);
+    }
+    return *this;
+  }
+  Decoder(const Decoder&) = delete;
+  Decoder& operator=(const Decoder&) = delete;
+
+  /*!\brief The context, for the calls of ultrahdr_api.h without a counterpart here */
+  uhdr_codec_private_t* get() const { return mDec; }
+
+  /*!\brief Copies data, see uhdr_dec_set_image() */
+  uhdr_error_info_t setImage(Span<const uint8_t> data) {
+    uhdr_compressed_image_t img = compressed(data);
+    return uhdr_dec_set_image(mDec, &img);
+  }
+
+  /*!\brief Refers to data, which must stay valid until reset, see uhdr_dec_set_image_ref() */
+  uhdr_error_info_t setImageRef(Span<const uint8_t> data) {
+    uhdr_compressed_image_t img = compressed(data);
+    return uhdr_dec_set_image_ref(mDec, &img);
+  }
+
+  uhdr_error_info_t setOutImgFormat(uhdr_img_fmt_t fmt) {
+    return uhdr_dec_set_out_img_format(mDec, fmt);
+  }
+  uhdr_error_info_t setOutColorTransfer(uhdr_color_transfer_t ct) {
+    return uhdr_dec_set_out_color_transfer(mDec, ct);
+  }
+  uhdr_error_info_t setOutMaxDisplayBoost(float display_boost) {
+    return uhdr_dec_set_out_max_display_boost(mDec, display_boost);
+  }
+  uhdr_error_info_t setProfile(const uhdr_decoder_profile_t* profile) {
+    return uhdr_dec_set_profile(mDec, profile);
+  }
+  uhdr_error_info_t setCache(uhdr_decoder_cache_t* cache) {
+    return uhdr_dec_set_cache(mDec, cache);
+  }
+
+  uhdr_error_info_t probe() { return uhdr_dec_probe(mDec); }
+  uhdr_error_info_t decode() { return uhdr_decode(mDec); }
+  void reset() { uhdr_reset_decoder(mDec); }
+
+  int imageWidth() const { return uhdr_dec_get_image_width(mDec); }
+  int imageHeight() const { return uhdr_dec_get_image_height(mDec); }
+  int gainmapWidth() const { return uhdr_dec_get_gainmap_width(mDec); }
+  int gainmapHeight() const { return uhdr_dec_get_gainmap_height(mDec); }
+  const uhdr_gainmap_metadata_t* gainmapMetadata() const {
+    return uhdr_dec_get_gainmap_metadata(mDec);
+  }
+  Span<const uint8_t> exif() const { return bytes(uhdr_dec_get_exif(mDec)); }
+  Span<const uint8_t> icc() const { return bytes(uhdr_dec_get_icc(mDec)); }
+
+  /*!\brief The decoded image, owned by the decoder and valid until reset */
+  const uhdr_raw_image_t* image() const { return uhdr_get_decoded_image(mDec); }
+  const uhdr_raw_image_t* gainmap() const { return uhdr_get_decoded_gainmap_image(mDec); }
+
+  /*!\brief The decoded image, moved out of the decoder without a copy. Empty if the decode failed
+   * or the image was taken already. */
+  Image takeImage() { return Image(uhdr_take_decoded_image(mDec)); }
+  Image takeGainmap() { return Image(uhdr_take_decoded_gainmap_image(mDec)); }
+
+ private:
+  static uhdr_compressed_image_t compressed(Span<const uint8_t> data) {
+    uhdr_compressed_image_t img{};
+    img.data = const_cast<uint8_t*>(data.data());
+    img.data_sz = img.capacity = data.size();
+    img.cg = UHDR_CG_UNSPECIFIED;
+    img.ct = UHDR_CT_UNSPECIFIED;
+    img.range = UHDR_CR_UNSPECIFIED;
+    return img;
+  }
+  static Span<const uint8_t> bytes(const uhdr_mem_block_t* block) {
+    if (block == nullptr) return {};
+    return {static_cast<const uint8_t*>(block->data), block->data_sz};
+  }
+
+  uhdr_codec_private_t* mDec = nullptr;
+};
+
+/*!\brief Owner of an encoder context. A moved from Encoder holds no context, its calls fail with
+ * #UHDR_CODEC_INVALID_PARAM. */
+class Encoder {
+ public:
+  Encoder() : mEnc(uhdr_create_encoder()) {}
+  ~Encoder() { uhdr_release_encoder(mEnc); }
+
+  Encoder(Encoder&& other) noexcept : mEnc(std::exchange(other.mEnc, nullptr)) {}
+  Encoder& operator=(Encoder&& other) noexcept {
+    if (this != &other) {
+      uhdr_release_encoder(mEnc);
+      mEnc = std::exchange(other.mEnc, nullptr);
+    }
+    return *this;
+  }
+  Encoder(const Encoder&) = delete;
+  Encoder& operator=(const Encoder&) = delete;
+
+  /*!\brief The context, for the calls of ultrahdr_api.h without a counterpart here */
+  uhdr_codec_private_t* get() const { return mEnc; }
+
+  /*!\brief Copies the planes of img, see uhdr_enc_set_raw_image() */
+  uhdr_error_info_t setRawImage(const uhdr_raw_image_t& img, uhdr_img_label_t intent) {
+    uhdr_raw_image_t desc = img;
+    return uhdr_enc_set_raw_image(mEnc, &desc, intent);
+  }
+
+  /*!\brief Refers to the planes of img, which must stay valid until the encode returns, see
+   * uhdr_enc_set_raw_image_ref() */
+  uhdr_error_info_t setRawImageRef(const uhdr_raw_image_t& img, uhdr_img_label_t intent) {
+    uhdr_raw_image_t desc = img;
+    return uhdr_enc_set_raw_image_ref(mEnc, &desc, intent);
+  }
+
+  uhdr_error_info_t setQuality(int quality, uhdr_img_label_t intent) {
+    return uhdr_enc_set_quality(mEnc, quality, intent);
+  }
+  uhdr_error_info_t setPreset(uhdr_enc_preset_t preset) {
+    return uhdr_enc_set_preset(mEnc, preset);
+  }
+  uhdr_error_info_t setOutputFormat(uhdr_codec_t media_type) {
+    return uhdr_enc_set_output_format(mEnc, media_type);
+  }
+
+  uhdr_error_info_t encode() { return uhdr_encode(mEnc); }
+  void reset() { uhdr_reset_encoder(mEnc); }
+
+  /*!\brief The encoded stream, owned by the encoder and valid until reset */
+  Span<const uint8_t> stream() const {
+    const uhdr_compressed_image_t* img = uhdr_get_encoded_stream(mEnc);
+    if (img == nullptr) return {};
+    return {static_cast<const uint8_t*>(img->data), img->data_sz};
+  }
+
+ private:
+  uhdr_codec_private_t* mEnc = nullptr;
+};
+
+}  // namespace uhdr
+
+#endif  // ULTRAHDR_API_HPP